@@ -140,6 +140,22 @@ macro(ADD_OSQUERY_BENCHMARK)
   endif()
 endmacro(ADD_OSQUERY_BENCHMARK)
 
+# Add table generator benchmark macro.
+macro(ADD_OSQUERY_TABLE_BENCHMARK)
+  if(NOT DEFINED ENV{SKIP_TESTS} AND NOT OSQUERY_BUILD_SDK_ONLY)
+    list(APPEND OSQUERY_TABLES_BENCHMARKS ${ARGN})
+    set(OSQUERY_TABLES_BENCHMARKS ${OSQUERY_TABLES_BENCHMARKS} PARENT_SCOPE)
+  endif()
+endmacro(ADD_OSQUERY_TABLE_BENCHMARK)
+
+# Add events ingestion benchmark macro.
+macro(ADD_OSQUERY_EVENTS_BENCHMARK)
+  if(NOT DEFINED ENV{SKIP_TESTS})
+    list(APPEND OSQUERY_EVENTS_LOAD_BENCHMARKS ${ARGN})
+    set(OSQUERY_EVENTS_LOAD_BENCHMARKS ${OSQUERY_EVENTS_LOAD_BENCHMARKS} PARENT_SCOPE)
+  endif()
+endmacro(ADD_OSQUERY_EVENTS_BENCHMARK)
+
 # Add kernel benchmark macro.
 macro(ADD_OSQUERY_KERNEL_BENCHMARK)
   if(NOT DEFINED ENV{SKIP_TESTS})
@@ -239,6 +255,29 @@ macro(GET_GENERATION_DEPS BASE_PATH)
   list(APPEND GENERATION_DEPENDENCIES ${TABLE_FILES_TEMPLATES})
 endmacro()
 
+# Generate the typed row builder header of each spec with typed_rows.
+# Table implementations include the headers, so they are generated when
+# configuring, and changing a spec or the template configures again.
+macro(GENERATE_TABLE_ROWS BASE_PATH)
+  set(TABLE_ROW_TEMPLATE "${BASE_PATH}/tools/codegen/templates/typed_row.h.in")
+  set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS
+    "${TABLE_ROW_TEMPLATE}")
+  foreach(TABLE_FILE ${ARGN})
+    file(STRINGS "${TABLE_FILE}" TABLE_ROWS_ATTRIBUTE REGEX "typed_rows")
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS
+      "${TABLE_FILE}")
+    if(TABLE_ROWS_ATTRIBUTE)
+      get_filename_component(TABLE_NAME "${TABLE_FILE}" NAME_WE)
+      execute_process(
+        COMMAND ${PYTHON_EXECUTABLE} "${BASE_PATH}/tools/codegen/gentable.py"
+          --row "${TABLE_FILE}"
+          "${CMAKE_BINARY_DIR}/generated/osquery/tables/rows/${TABLE_NAME}.h"
+        WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
+      )
+    endif()
+  endforeach()
+endmacro(GENERATE_TABLE_ROWS)
+
 # Find and generate table plugins from .table syntax
 macro(GENERATE_TABLES TABLES_PATH)
   # Get all matching files for all platforms.
@@ -258,6 +297,7 @@ macro(GENERATE_TABLES TABLES_PATH)
     list(APPEND TABLE_FILES_PLATFORM ${TABLE_FILES_PLATFORM_FLAVOR})
   endif()
   list(APPEND TABLE_FILES ${TABLE_FILES_PLATFORM})
+  GENERATE_TABLE_ROWS("${TABLES_PATH}" ${TABLE_FILES})
 
   get_property(TARGETS GLOBAL PROPERTY AMALGAMATE_TARGETS)
   set(NEW_TARGETS "")
@@ -273,6 +313,7 @@ endmacro()
 
 macro(GENERATE_UTILITIES TABLES_PATH)
   file(GLOB TABLE_FILES_UTILITY "${TABLES_PATH}/specs/utility/*.table")
+  GENERATE_TABLE_ROWS("${TABLES_PATH}" ${TABLE_FILES_UTILITY})
   set_property(GLOBAL APPEND PROPERTY AMALGAMATE_TARGETS "${TABLE_FILES_UTILITY}")
 endmacro(GENERATE_UTILITIES)
 
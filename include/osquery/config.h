@@ -10,9 +10,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 #include <boost/iterator/filter_iterator.hpp>
@@ -29,6 +31,18 @@ class Pack;
 class Schedule;
 class ConfigParserPlugin;
 
+/// A scheduled query compiled with its name and pack, see compileSchedule.
+struct ScheduleEntry {
+  /// The scheduled name, including the pack prefix.
+  std::string name;
+
+  /// A copy of the query, its interval, and options.
+  ScheduledQuery query;
+
+  /// The pack, which decides if the query executes on this host.
+  std::shared_ptr<Pack> pack;
+};
+
 /**
  * @brief The programmatic representation of osquery's configuration
  *
@@ -51,6 +65,9 @@ class Config : private boost::noncopyable {
   /**
    * @brief Update the internal config data.
    *
+   * Sources whose content hash is unchanged are skipped. Within a changed
+   * source only the changed packs and config parser keys are applied.
+   *
    * @param config A map of domain or namespace to config data.
    * @return If the config changes were applied.
    */
@@ -59,9 +76,10 @@ class Config : private boost::noncopyable {
   /**
    * @brief Record performance (monitoring) information about a scheduled query.
    *
-   * The daemon and query scheduler will optionally record process metadata
-   * before and after executing each query. This can be compared and reported
-   * on an interval or within the osquery_schedule table.
+   * The daemon and query scheduler will optionally sample the CPU time of the
+   * executing thread and the process memory before and after executing each
+   * query. This can be compared and reported on an interval or within the
+   * osquery_schedule table.
    *
    * The config consumes and calculates the optional performance differentials.
    * It would also be possible to store this in the RocksDB backing store or
@@ -70,16 +88,11 @@ class Config : private boost::noncopyable {
    * to the updates/changes reflected in the schedule, from the config.
    *
    * @param name The unique name of the scheduled item
-   * @param delay Number of seconds (wall time) taken by the query
-   * @param size Number of characters generated by query
-   * @param r0 the process row before the query
-   * @param r1 the process row after the query
+   * @param sample The performance of a single execution, where the
+   *   average_memory is the execution's resident memory differential
    */
   void recordQueryPerformance(const std::string& name,
-                              size_t delay,
-                              size_t size,
-                              const Row& r0,
-                              const Row& r1);
+                              const QueryPerformance& sample);
 
   /**
    * @brief Record a query 'initialization', meaning the query will run.
@@ -163,6 +176,24 @@ class Config : private boost::noncopyable {
   void scheduledQueries(std::function<
       void(const std::string& name, const ScheduledQuery& query)> predicate);
 
+  /**
+   * @brief Compile the queries of every pack with their scheduled names.
+   *
+   * The scheduler compiles the schedule when its generation changes, instead
+   * of iterating the packs and building names each step. Pack discovery and
+   * the blacklist are not applied, check a due query with isScheduled.
+   */
+  void compileSchedule(std::vector<ScheduleEntry>& entries);
+
+  /// The generation of the schedule, changed when packs change.
+  size_t getScheduleGeneration() const { return schedule_generation_; }
+
+  /// Run the pack discovery queries that are due, see Pack::refreshDiscovery.
+  void refreshDiscovery();
+
+  /// Check if a compiled query's pack executes and it is not blacklisted.
+  bool isScheduled(const ScheduleEntry& entry);
+
   /**
    * @brief Map a function across the set of configured files
    *
@@ -227,6 +258,48 @@ class Config : private boost::noncopyable {
   /// A step method for Config::update.
   Status updateSource(const std::string& source, const std::string& json);
 
+  /**
+   * @brief Apply a source's parsed content, a step method for updateSource.
+   *
+   * @param source The config content source identifier.
+   * @param tree The parsed content.
+   * @param backup If set, a copy of tree where pack resources are replaced
+   * with the content the config plugin generated for them.
+   */
+  Status applySource(const std::string& source,
+                     const boost::property_tree::ptree& tree,
+                     boost::property_tree::ptree* backup = nullptr);
+
+  /**
+   * @brief Apply the last valid content of each source, see
+   * `config_enable_backup`.
+   *
+   * The backup is stored parsed, starting from it does not wait for the
+   * config plugin, strip comments, or resolve pack resources.
+   */
+  Status restoreBackup();
+
+  /// Store a source's parsed content as its last valid content.
+  void backupSource(const std::string& source,
+                    const boost::property_tree::ptree& tree);
+
+  /**
+   * @brief Add a pack from a source update, unless its content is unchanged.
+   *
+   * An unchanged pack keeps its queries, file paths, and parser state, a
+   * changed pack is replaced using Config::addPack.
+   */
+  void updatePack(const std::string& name,
+                  const std::string& source,
+                  const boost::property_tree::ptree& tree);
+
+  /// Forget the content hashes of a source's packs, except those in keep.
+  void forgetPacks(const std::string& source,
+                   const std::set<std::string>& keep);
+
+  /// Hash the content of a property tree to detect changes between updates.
+  static std::string hashTree(const boost::property_tree::ptree& tree);
+
   /**
    * @brief Generate pack content from a resource handled by the Plugin.
    *
@@ -240,11 +313,13 @@ class Config : private boost::noncopyable {
    * @param name A pack name provided and handled by the ConfigPlugin.
    * @param source The config content source identifier.
    * @param target A resource (path, URL, etc) handled by the ConfigPlugin.
+   * @param content If set, the output parsed pack content.
    * @return status On success the response will be JSON parsed.
    */
   Status genPack(const std::string& name,
                  const std::string& source,
-                 const std::string& target);
+                 const std::string& target,
+                 boost::property_tree::ptree* content = nullptr);
 
   /**
    * @brief Apply each ConfigParser to an input property tree.
@@ -295,6 +370,12 @@ class Config : private boost::noncopyable {
   /// A set of hashes for each source of the config.
   std::map<std::string, std::string> hash_;
 
+  /// A set of hashes for each pack, keyed by source and pack name.
+  std::map<std::string, std::string> pack_hash_;
+
+  /// A set of hashes for each source of each parser's requested keys.
+  std::map<std::string, std::map<std::string, std::string> > parser_hash_;
+
   /// Check if the config received valid/parsable content from a config plugin.
   bool valid_{false};
 
@@ -305,6 +386,9 @@ class Config : private boost::noncopyable {
   /// A UNIX timestamp recorded when the config started.
   size_t start_time_{0};
 
+  /// Incremented when a pack is added or removed from the schedule.
+  std::atomic<size_t> schedule_generation_{0};
+
  private:
   friend class Initializer;
 
@@ -317,6 +401,7 @@ class Config : private boost::noncopyable {
   FRIEND_TEST(SchedulerTests, test_monitor);
   FRIEND_TEST(SchedulerTests, test_config_results_purge);
   FRIEND_TEST(EventsTests, test_event_subscriber_configure);
+  FRIEND_TEST(ConfigTests, test_config_backup);
 };
 
 /**
@@ -10,8 +10,11 @@
 
 #pragma once
 
+#include <array>
+#include <iterator>
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <boost/property_tree/ptree.hpp>
@@ -46,6 +49,9 @@ extern const std::string kEvents;
  */
 extern const std::string kLogs;
 
+/// The "domain" where file hashes are cached, keyed by path and file status.
+extern const std::string kHashes;
+
 /// An ordered list of column type names.
 extern const std::vector<std::string> kDomains;
 
@@ -106,6 +112,92 @@ Status deserializeRow(const boost::property_tree::ptree& tree, Row& r);
  */
 Status deserializeRowJSON(const std::string& json, Row& r);
 
+/**
+ * @brief Serialize a Row object into the binary storage format
+ *
+ * Rows stored internally, such as buffered events, use a versioned and
+ * length-prefixed encoding instead of JSON. JSON remains the format for
+ * logging and remote APIs.
+ *
+ * @param r the Row to serialize
+ * @param data the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeRowBinary(const Row& r, std::string& data);
+
+/**
+ * @brief Deserialize a Row object from the binary storage format
+ *
+ * Values stored before the binary format was introduced are JSON, these are
+ * detected and deserialized using deserializeRowJSON.
+ *
+ * @param data the input binary (or JSON) string
+ * @param r the output Row structure
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status deserializeRowBinary(const std::string& data, Row& r);
+
+/**
+ * @brief Read a single column from a binary Row without decoding the rest
+ *
+ * @param data the input binary (or JSON) string
+ * @param column the column name to read
+ * @param value the output column value
+ *
+ * @return Failure if the data is malformed or the column does not exist
+ */
+Status getRowBinaryValue(const std::string& data,
+                         const std::string& column,
+                         std::string& value);
+
+/**
+ * @brief The column names shared by rows built from one schema.
+ *
+ * The rows of a statement or table generator have the same columns. Each name
+ * is kept once, in Row key order, and copied into a Row with an insertion hint
+ * at the end of the Row, so building a Row never compares column names.
+ *
+ * A name repeated in the schema is one Row key, the value filled last is kept.
+ */
+class RowKeys {
+ public:
+  /// Add a column, the index is the position of its value in a source row.
+  void add(size_t index, const std::string& name);
+
+  /// The number of columns added.
+  size_t size() const { return keys_.size(); }
+
+  /**
+   * @brief Build a Row, filling each value from a source row.
+   *
+   * @param fill called with each source index and its Row value to assign.
+   */
+  template <typename Fill>
+  Row build(const Fill& fill) const {
+    Row r;
+    for (const auto& key : keys_) {
+      auto it = (key.repeated) ? std::prev(r.end())
+                               : r.emplace_hint(r.end(), key.name, RowData());
+      fill(key.index, it->second);
+    }
+    return r;
+  }
+
+ private:
+  struct Key {
+    size_t index;
+    std::string name;
+
+    /// Set if the previous key has the same name.
+    bool repeated;
+  };
+
+  /// Sorted by name then by index, so the last repeated value is kept.
+  std::vector<Key> keys_;
+};
+
 /////////////////////////////////////////////////////////////////////////////
 // QueryData
 /////////////////////////////////////////////////////////////////////////////
@@ -146,6 +238,22 @@ Status deserializeQueryData(const boost::property_tree::ptree& tree,
 /// Inverse of serializeQueryDataJSON, convert a JSON string to QueryData.
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
 
+/**
+ * @brief Serialize a QueryData object into the binary storage format
+ *
+ * Column names are written once into a dictionary, each row cell refers to
+ * its column name by dictionary index. See serializeRowBinary.
+ *
+ * @param q the QueryData to serialize
+ * @param data the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataBinary(const QueryData& q, std::string& data);
+
+/// Inverse of serializeQueryDataBinary, JSON input is also accepted.
+Status deserializeQueryDataBinary(const std::string& data, QueryData& qd);
+
 /////////////////////////////////////////////////////////////////////////////
 // DiffResults
 /////////////////////////////////////////////////////////////////////////////
@@ -196,9 +304,39 @@ Status serializeDiffResults(const DiffResults& d,
  */
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
 
+/**
+ * @brief Compute a stable 64-bit fingerprint of a Row's columns and values
+ *
+ * The fingerprint does not depend on the process or platform, so it may be
+ * stored and compared with fingerprints computed by a later run.
+ *
+ * @param r the Row to fingerprint
+ *
+ * @return the 64-bit fingerprint
+ */
+uint64_t getRowFingerprint(const Row& r);
+
+/**
+ * @brief Compute a 64-bit fingerprint of a set of rows
+ *
+ * The fingerprint is the sum, modulo 2^64, of every row's fingerprint. It
+ * does not depend on the order of rows, and a receiver applying the added
+ * and removed rows of a DiffResults may update it by adding and subtracting
+ * their fingerprints.
+ *
+ * @param qd the QueryData to fingerprint
+ *
+ * @return the 64-bit fingerprint
+ */
+uint64_t getQueryDataFingerprint(const QueryData& qd);
+
 /**
  * @brief Diff two QueryData objects and create a DiffResults object
  *
+ * Rows are compared using a hash multiset keyed by row fingerprints. A row
+ * in new_ is added if it does not exist in old_. Each copy of a row in old_
+ * beyond the copies in new_ is removed, removed rows are sorted.
+ *
  * @param old_ the "old" set of results
  * @param new_ the "new" set of results
  *
@@ -238,6 +376,56 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r);
  */
 void escapeQueryData(const QueryData& oldData, QueryData& newData);
 
+/**
+ * @brief A fixed-size histogram of unsigned values, such as query costs.
+ *
+ * Values are counted in log-linear buckets like an HDR histogram. Each power
+ * of two is split into kSubBuckets linear buckets, so a percentile is within
+ * 1/kSubBuckets of a recorded value and the memory does not grow with the
+ * number or range of values.
+ */
+class Histogram {
+ public:
+  /// Count a value.
+  void record(uint64_t value);
+
+  /**
+   * @brief The value at or below which a percent of the values fall.
+   *
+   * @param percent The percentile, from 0 to 100.
+   * @return The highest value of the percentile's bucket, at most max().
+   */
+  uint64_t percentile(double percent) const;
+
+  /// Count every value recorded by another histogram.
+  void merge(const Histogram& other);
+
+  /// The number of recorded values.
+  uint64_t count() const { return count_; }
+
+  /// The largest recorded value.
+  uint64_t max() const { return max_; }
+
+ private:
+  /// Values below kSubBuckets have a bucket each.
+  static const size_t kSubBucketBits = 3;
+  static const size_t kSubBuckets = 1 << kSubBucketBits;
+
+  /// The buckets of each power of two from kSubBuckets to 2^63.
+  static const size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  /// The bucket counting a value.
+  static size_t bucket(uint64_t value);
+
+  /// The highest value counted by a bucket.
+  static uint64_t bucketValue(size_t bucket);
+
+ private:
+  std::array<uint32_t, kBuckets> counts_{{}};
+  uint64_t count_{0};
+  uint64_t max_{0};
+};
+
 /**
  * @brief performance statistics about a query
  */
@@ -263,6 +451,19 @@ struct QueryPerformance {
   /// Total characters, bytes, generated by query.
   unsigned long long int output_size;
 
+  /// Total rows generated by query.
+  unsigned long long int output_rows;
+
+  /// Total wall time in milliseconds.
+  unsigned long long int wall_time_ms;
+
+  /// Distributions of the wall time and user and system time in milliseconds.
+  Histogram wall_times;
+  Histogram cpu_times;
+
+  /// Distribution of the bytes generated by each execution.
+  Histogram output_sizes;
+
   QueryPerformance()
       : executions(0),
         last_executed(0),
@@ -270,7 +471,9 @@ struct QueryPerformance {
         user_time(0),
         system_time(0),
         average_memory(0),
-        output_size(0) {}
+        output_size(0),
+        output_rows(0),
+        wall_time_ms(0) {}
 };
 
 /**
@@ -292,7 +495,48 @@ struct ScheduledQuery {
   /// Set of query options.
   std::map<std::string, bool> options;
 
-  ScheduledQuery() : interval(0), splayed_interval(0) {}
+  /// Seconds of executions merged by an incremental query, 0 for all.
+  size_t window;
+
+  /// The priority of the query's worker, "normal", "low", or "idle".
+  std::string priority;
+
+  /// Limit the bytes read per second by the query's tables, 0 for none.
+  size_t read_rate;
+
+  /// Seconds between complete results of a snapshot query, 0 for every run.
+  size_t full_interval;
+
+  /// The host's offset within the splayed interval, used if "spread" is set.
+  size_t offset;
+
+  /// The fraction of items the query's tables read, 1 reads every item.
+  double sample_rate;
+
+  /// Milliseconds of CPU time the query may use, 0 for the schedule default.
+  size_t max_cpu_time;
+
+  /// Megabytes of memory growth the query may use, 0 for the default.
+  size_t max_memory;
+
+  /// Seconds the query may run, 0 for the schedule default.
+  size_t deadline;
+
+  /// Rows of results the query may return, 0 for the schedule default.
+  size_t max_rows;
+
+  ScheduledQuery()
+      : interval(0),
+        splayed_interval(0),
+        window(0),
+        read_rate(0),
+        full_interval(0),
+        offset(0),
+        sample_rate(1.0),
+        max_cpu_time(0),
+        max_memory(0),
+        deadline(0),
+        max_rows(0) {}
 
   /// equals operator
   bool operator==(const ScheduledQuery& comp) const {
@@ -321,6 +565,15 @@ struct QueryLogItem {
   /// Optional snapshot results, no differential applied.
   QueryData snapshot_results;
 
+  /**
+   * @brief The fingerprint of a snapshot query's complete results, in hex.
+   *
+   * Set for snapshot queries with a full_interval. Between complete
+   * snapshots the results are the differential since the previous run, and
+   * this is the fingerprint of the results the differential produces.
+   */
+  std::string snapshot_hash;
+
   /// The name of the scheduled query.
   std::string name;
 
@@ -415,6 +668,15 @@ struct DistributedQueryRequest {
 
   std::string query;
   std::string id;
+
+  /// Seconds the results may answer an identical query, 0 to not cache.
+  size_t cache_ttl{0};
+
+  /// Answer with the id of identical results already written, not the rows.
+  bool cached_ok{false};
+
+  /// The ids of identical queries in the same batch, answered with these rows.
+  std::vector<std::string> duplicates;
 };
 
 /**
@@ -541,6 +803,9 @@ Status deserializeDistributedQueryResultJSON(const std::string& json,
  * all of the internal APIs expect RocksDB's indexing and read performance.
  * However, access to this representation of a backing-store is still abstracted
  * to removing RocksDB as a dependency for the osquery SDK.
+ *
+ * The active plugin is selected with the database_plugin flag, osquery core
+ * reads and writes the backing-store only through the plugin.
  */
 class DatabasePlugin : public Plugin {
  protected:
@@ -587,7 +852,72 @@ class DatabasePlugin : public Plugin {
     return Status(0, "Not used");
   }
 
+  /// Storage tuning and statistics, one row per domain.
+  virtual Status stats(QueryData& results) const {
+    return Status(0, "Not used");
+  }
+
  public:
+  /**
+   * @brief List the ordered keys, and optionally values, within a range.
+   *
+   * The range scans, batched writes, and range deletes are used in-process by
+   * osquery core through the scanDatabaseRange, writeDatabaseValues, and
+   * deleteDatabaseRange helpers. Plugins should override them with indexed
+   * implementations. The defaults use scan, get, put, and remove.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param start The first key of the range, inclusive.
+   * @param end The end of the range, exclusive, empty for no end.
+   * @param max The most keys to return, 0 for no limit.
+   * @param reverse Return the keys in descending order, from the range end.
+   * @param values Also read each key's value, otherwise values are empty.
+   * @param results The output keys and values.
+   * @return Storage operation status.
+   */
+  virtual Status scanRange(
+      const std::string& domain,
+      const std::string& start,
+      const std::string& end,
+      size_t max,
+      bool reverse,
+      bool values,
+      std::vector<std::pair<std::string, std::string>>& results) const;
+
+  /**
+   * @brief Read the values of a set of keys as one batched lookup.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The lookup keys.
+   * @param values The output values, in the order of keys, a key that does
+   * not exist has an empty value.
+   * @return Failure if the data could not be accessed.
+   */
+  virtual Status getMany(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values) const;
+
+  /// Apply a set of puts then deletes to a domain, atomically if supported.
+  virtual Status write(
+      const std::string& domain,
+      const std::vector<std::pair<std::string, std::string>>& puts,
+      const std::vector<std::string>& deletes);
+
+  /// Delete every key within the range [start, end) of a domain.
+  virtual Status removeRange(const std::string& domain,
+                             const std::string& start,
+                             const std::string& end);
+
+  /**
+   * @brief Reclaim the space of a domain's deleted keys.
+   *
+   * Called in the scheduler's idle windows, see compactDatabase. Plugins that
+   * do not defer space reclamation may use the default, which does nothing.
+   */
+  virtual Status compact(const std::string& domain) {
+    return Status(0, "Not used");
+  }
+
   Status call(const PluginRequest& request, PluginResponse& response);
 };
 
@@ -623,6 +953,11 @@ Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value);
 
+/// Lookup the values of a set of keys, empty for keys that do not exist.
+Status getDatabaseValues(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values);
+
 /// Remove a domain/key identified value from backing-store.
 Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 
@@ -631,6 +966,74 @@ Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
                         size_t max = 0);
 
+/// Get the ordered keys within the range [start, end) of a domain.
+Status scanDatabaseRange(const std::string& domain,
+                         std::vector<std::string>& keys,
+                         const std::string& start,
+                         const std::string& end,
+                         size_t max = 0);
+
+/// Get the ordered keys and values within a range, see scanRange.
+Status scanDatabaseRange(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& items,
+    const std::string& start,
+    const std::string& end,
+    size_t max = 0,
+    bool reverse = false);
+
+/// Get the ordered keys with a prefix.
+Status scanDatabasePrefix(const std::string& domain,
+                          std::vector<std::string>& keys,
+                          const std::string& prefix,
+                          size_t max = 0);
+
+/// Get the ordered keys and values with a prefix.
+Status scanDatabasePrefix(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& items,
+    const std::string& prefix,
+    size_t max = 0);
+
+/// Apply a set of puts then deletes to a domain of the backing-store.
+Status writeDatabaseValues(
+    const std::string& domain,
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes);
+
+/// Delete every key within the range [start, end) of a domain.
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& start,
+                           const std::string& end);
+
+/// Get the backing-store options and statistics for each domain.
+Status getDatabaseStats(QueryData& stats);
+
+/**
+ * @brief Compact a domain of the backing-store, reclaiming deleted keys.
+ *
+ * This blocks until the database plugin finishes, the scheduler compacts the
+ * domains returned by getDueCompactions when no queries are running.
+ */
+Status compactDatabase(const std::string& domain);
+
+/// Count keys deleted from a domain outside of the database helpers.
+void addDatabaseDeletes(const std::string& domain, size_t count);
+
+/// Compact a domain, or "events" and "logs" if empty, in the next idle window.
+Status requestDatabaseCompaction(const std::string& domain);
+
+/**
+ * @brief The domains due for compaction.
+ *
+ * A domain is due if compaction was requested, if database_compact_deletes
+ * keys were deleted since it was compacted, or if any keys were deleted and
+ * it was compacted database_compact_interval seconds ago.
+ *
+ * @param now The current time.
+ */
+std::vector<std::string> getDueCompactions(size_t now);
+
 /// Allow callers to scan each column family and print each value.
 void dumpDatabase();
 
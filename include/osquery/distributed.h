@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -85,7 +86,7 @@ CREATE_REGISTRY(DistributedPlugin, "distributed");
  * Consider the following workflow example, without any error handling
  *
  * @code{.cpp}
- *   auto dist = Distributed();
+ *   Distributed dist;
  *   while (true) {
  *     dist.pullUpdates();
  *     if (dist.getPendingQueryCount() > 0) {
@@ -108,10 +109,22 @@ class Distributed {
   /// Get the number of results which are waiting to be flushed
   size_t getCompletedCount();
 
-  /// Serialize result data into a JSON string and clear the results
+  /// Serialize result data into a JSON string
   Status serializeResults(std::string& json);
 
-  /// Process and execute queued queries
+  /**
+   * @brief Process and execute queued queries
+   *
+   * Up to distributed_workers queries run concurrently, each on its own
+   * database connection, on the calling thread and the dispatcher's task
+   * executor. A query running longer than distributed_timeout is interrupted
+   * and results are limited to distributed_max_rows. Each result
+   * is written as soon as its query completes, results that cannot be
+   * written are flushed again once every query finished.
+   *
+   * Identical queries of one batch run once. When the server asks for a
+   * cache_ttl, results also answer identical queries until they expire.
+   */
   Status runQueries();
 
  protected:
@@ -142,9 +155,65 @@ class Distributed {
 
   /**
    * @brief Flush all of the collected results to the server
+   *
+   * Results kept in memory are written first, then the spilled results.
    */
   Status flushCompleted();
 
+  /**
+   * @brief Keep a result that could not be written, to flush it later.
+   *
+   * With distributed_spill the result is spilled to the backing store,
+   * otherwise, or if spilling fails, it is held in memory.
+   */
+  void keepResult(const DistributedQueryResult& result);
+
+  /**
+   * @brief Spill a result to the logs domain of the backing store.
+   *
+   * The result is split into parts of distributed_chunk_rows rows, each part
+   * is serialized and kept until it is written.
+   */
+  Status spillResult(const DistributedQueryResult& result);
+
+  /// Write the spilled results in order, removing each part once written.
+  Status flushSpilled();
+
+  /// Pop and run queued queries until none remain, see runQueries.
+  void runPending();
+
+  /**
+   * @brief Run a query on its own connection and write the result.
+   *
+   * Rows are written in chunks of distributed_chunk_rows as the query steps
+   * them and the query stops once distributed_max_rows rows, or
+   * distributed_max_bytes bytes of values, are read. Chunks that cannot be
+   * written are spilled, see keepResult.
+   */
+  void runQuery(DistributedQueryRequest request);
+
+  /**
+   * @brief Write a result to the server
+   *
+   * Results with more than distributed_chunk_rows rows are written in several
+   * requests, each with a chunk of the rows under the same query id.
+   */
+  Status writeResult(const DistributedQueryResult& result);
+
+  /**
+   * @brief Answer a request with the rows of an identical query.
+   *
+   * If the server accepts cached replies only the id of the identical
+   * query's results is written, otherwise the rows are written again.
+   *
+   * @param request The answered request.
+   * @param source The id of the identical query, its results were written.
+   * @param rows The results of the identical query.
+   */
+  void writeDuplicate(const DistributedQueryRequest& request,
+                      const std::string& source,
+                      const QueryData& rows);
+
  protected:
   std::vector<DistributedQueryRequest> queries_;
   std::vector<DistributedQueryResult> results_;
@@ -152,5 +221,9 @@ class Distributed {
  private:
   friend class DistributedTests;
   FRIEND_TEST(DistributedTests, test_workflow);
+  FRIEND_TEST(DistributedTests, test_serialize_results);
+  FRIEND_TEST(DistributedTests, test_stream_rows);
+  FRIEND_TEST(DistributedTests, test_coalesce_cached);
+  FRIEND_TEST(DistributedTests, test_spill_results);
 };
 }
@@ -10,10 +10,15 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <map>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <boost/make_shared.hpp>
@@ -22,6 +27,7 @@
 #include <boost/thread/mutex.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/registry.h>
 #include <osquery/status.h>
 #include <osquery/tables.h>
@@ -34,6 +40,7 @@ class EventPublisher;
 template <class PUB>
 class EventSubscriber;
 class EventFactory;
+class EventMemoryStore;
 
 using EventPublisherID = const std::string;
 using EventSubscriberID = const std::string;
@@ -42,6 +49,9 @@ using EventContextID = uint64_t;
 using EventTime = uint32_t;
 using EventRecord = std::pair<EventID, EventTime>;
 
+/// The event locks report their contention in osquery_locks.
+using EventMutex = InstrumentedMutex<boost::mutex>;
+
 /**
  * @brief An EventPublisher will define a SubscriptionContext for
  * EventSubscriber%s to use.
@@ -72,6 +82,9 @@ struct EventContext : private boost::noncopyable {
 
   /// The time the event occurred, as determined by the publisher.
   EventTime time{0};
+
+  /// The number of events merged into this one, see `coalesceKey`.
+  size_t count{1};
 };
 
 using SubscriptionRef = std::shared_ptr<Subscription>;
@@ -105,6 +118,147 @@ enum EventSubscriberState {
   SUBSCRIBER_FAILED,
 };
 
+/**
+ * @brief The action taken when an EventSubscriber%'s dispatch queue is full.
+ *
+ * - Drop oldest: Discard the oldest queued event to make room.
+ * - Drop newest: Discard the event being fired.
+ * - Block: Apply backpressure, the publisher waits for the queue to drain.
+ */
+enum EventDispatchPolicy {
+  DISPATCH_DROP_OLDEST,
+  DISPATCH_DROP_NEWEST,
+  DISPATCH_BLOCK,
+};
+
+/**
+ * @brief A bounded queue of events and workers calling a subscriber callback.
+ *
+ * An EventSubscriber may use a dispatch queue so a slow EventCallback runs on
+ * the Dispatcher's task executor instead of the EventPublisher%'s thread. At
+ * most `workers` tasks drain the queue at once, a single worker preserves the
+ * event order. Events that do not fit in the queue are handled using the
+ * EventDispatchPolicy.
+ */
+class EventDispatchQueue : private boost::noncopyable {
+ public:
+  using Task = std::function<void()>;
+
+  EventDispatchQueue(const std::string& name,
+                     size_t capacity,
+                     EventDispatchPolicy policy,
+                     size_t workers);
+  ~EventDispatchQueue() { stop(); }
+
+  /**
+   * @brief Queue a callback for one of the workers.
+   *
+   * @param task The callback for a fired event.
+   * @return false if this task was dropped.
+   */
+  bool push(Task task);
+
+  /// Finish in-flight callbacks, drop the queued tasks, and wait for workers.
+  void stop();
+
+  /// The number of tasks dropped because the queue was full or stopped.
+  size_t dropped() const { return dropped_; }
+
+  /// The number of tasks waiting for a worker.
+  size_t queued() const;
+
+  /// A moving average of milliseconds from queuing a task to its completion.
+  size_t latency() const { return latency_; }
+
+ private:
+  /// Submit a drain task to the Dispatcher, the caller counted it as active.
+  void schedule();
+
+  /// The Dispatcher task entrypoint, calls a batch of queued tasks.
+  void drain();
+
+ private:
+  /// The dispatch queue owner, used when reporting drops.
+  std::string name_;
+
+  /// The maximum number of queued tasks.
+  size_t capacity_{0};
+
+  /// The action taken when the queue is full.
+  EventDispatchPolicy policy_{DISPATCH_DROP_OLDEST};
+
+  /// A queued task and the steady clock milliseconds it was queued at.
+  using QueuedTask = std::pair<Task, size_t>;
+
+  /// The queued tasks.
+  std::deque<QueuedTask> tasks_;
+
+  /// The maximum number of concurrent drain tasks.
+  size_t workers_{1};
+
+  /// The number of submitted drain tasks.
+  size_t active_{0};
+
+  /// Set when the queue is stopping, no more tasks are accepted.
+  bool stopping_{false};
+
+  /// The number of dropped tasks.
+  std::atomic<size_t> dropped_{0};
+
+  /// The moving average task latency in milliseconds.
+  std::atomic<size_t> latency_{0};
+
+  /// Lock protecting the tasks and state.
+  mutable boost::mutex lock_;
+
+  /// Signaled when a task is removed from the queue.
+  boost::condition_variable space_;
+
+  /// Signaled when a drain task exits.
+  boost::condition_variable idle_;
+};
+
+/**
+ * @brief Rolling-window rates and durations of a publisher or subscriber.
+ *
+ * Each recording thread counts into its own shard, so a publisher and many
+ * dispatch workers may record without contending on a single lock. Durations
+ * are kept for the current and the previous window, a reader merges the
+ * shards when the osquery_events table is selected.
+ */
+class EventMetrics : private boost::noncopyable {
+ public:
+  EventMetrics() = default;
+  ~EventMetrics();
+
+  /// Count an event and the microseconds it took.
+  void record(uint64_t micros);
+
+  /**
+   * @brief Merge the shards of every recording thread.
+   *
+   * @param rate Output, events per second during the previous window.
+   * @param durations Output, the durations of the previous and current window.
+   */
+  void merge(double& rate, Histogram& durations) const;
+
+  /// Steady clock microseconds used to measure event durations.
+  static uint64_t now();
+
+ private:
+  /// Events counted by the threads assigned to one shard.
+  struct Shard;
+
+  /// The shard of the calling thread, allocated when it first records.
+  Shard& getShard();
+
+ private:
+  /// The number of shards, threads are assigned a shard in turn.
+  static const size_t kShards = 8;
+
+  std::array<std::atomic<Shard*>, kShards> shards_{{}};
+};
+
 /// Use a single placeholder for the EventContextRef passed to EventCallback.
 using EventCallback = std::function<Status(const EventContextRef&,
                                            const SubscriptionContextRef&)>;
@@ -112,9 +266,6 @@ using EventCallback = std::function<Status(const EventContextRef&,
 /// An EventPublisher must track every subscription added.
 using SubscriptionVector = std::vector<SubscriptionRef>;
 
-/// The set of search-time binned lookup tables.
-extern const std::vector<size_t> kEventTimeLists;
-
 /**
  * @brief DECLARE_PUBLISHER supplies needed boilerplate code that applies a
  * string-type EventPublisherID to identify the publisher declaration.
@@ -216,6 +367,54 @@ class EventPublisherPlugin : public Plugin {
    */
   virtual Status run() { return Status(1, "No run loop required"); }
 
+  /**
+   * @brief A non-blocking descriptor that is readable when events are queued.
+   *
+   * Publishers with a descriptor share the EventFactory reactor thread rather
+   * than a run loop thread each. The reactor waits on every descriptor with
+   * edge-triggered epoll and calls `ready` as soon as one becomes readable.
+   *
+   * @return The descriptor, or -1 if the publisher needs a run loop thread.
+   */
+  virtual int getDescriptor() const { return -1; }
+
+  /**
+   * @brief Read and fire the events queued on the descriptor.
+   *
+   * An edge-triggered descriptor is only reported again after new events are
+   * queued, so `ready` must read until the descriptor would block.
+   *
+   * @return A FAILED status stops and tears down the publisher.
+   */
+  virtual Status ready() { return Status(1, "No descriptor required"); }
+
+  /**
+   * @brief A key merging repeated events within the coalescing window.
+   *
+   * With `--events_coalesce_window` an event is held for the window and later
+   * events with an equal key are merged into it, adding to its `count`. The
+   * held events fire in the order they were first seen. An empty key fires
+   * the event immediately.
+   */
+  virtual std::string coalesceKey(const EventContextRef& ec) const {
+    return "";
+  }
+
+  /**
+   * @brief Select the subscriptions an event may match, before `shouldFire`.
+   *
+   * A publisher with many subscriptions may index them at configure time and
+   * return the candidates for an event, rather than checking every one.
+   *
+   * @param ec The event being fired.
+   * @param matches The output candidate subscriptions.
+   * @return false if every subscription must be checked.
+   */
+  virtual bool matchSubscriptions(const EventContextRef& ec,
+                                  SubscriptionVector& matches) const {
+    return false;
+  }
+
   /**
    * @brief Allow the EventFactory to interrupt the run loop.
    *
@@ -276,6 +475,15 @@ class EventPublisherPlugin : public Plugin {
   /// Get the number of publisher restarts.
   size_t restartCount() const { return restart_count_; }
 
+  /// Get the number of events dropped before this publisher could fire them.
+  size_t numDropped() const { return drop_count_; }
+
+  /// The rate of dispatched events and the duration of each dispatch.
+  const EventMetrics& fireMetrics() const { return fire_metrics_; }
+
+  /// Fire the held events whose coalescing window ended, or all if forced.
+  void fireCoalesced(bool force);
+
  public:
   explicit EventPublisherPlugin(EventPublisherPlugin const&) = delete;
   EventPublisherPlugin& operator=(EventPublisherPlugin const&) = delete;
@@ -292,10 +500,31 @@ class EventPublisherPlugin : public Plugin {
    */
   virtual void fire(const EventContextRef& ec, EventTime time = 0) final;
 
+  /// Call the subscription callbacks for an event, after any coalescing.
+  void dispatch(const EventContextRef& ec);
+
   /// The internal fire method used by the typed EventPublisher.
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /**
+   * @brief Call a subscription's callback and record the subscriber metrics.
+   *
+   * @param fired The EventMetrics time the event was dispatched at.
+   */
+  void callSubscriber(const EventSubscriberRef& es,
+                      const SubscriptionRef& sub,
+                      const EventContextRef& ec,
+                      uint64_t fired) const;
+
+  /**
+   * @brief Check if any subscriber is called from its own dispatch queue.
+   *
+   * Queued callbacks run after `fire` returns, so a publisher must not fire
+   * EventContext%s referencing memory it reclaims after firing.
+   */
+  bool hasDispatchQueues() const;
+
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
@@ -303,6 +532,9 @@ class EventPublisherPlugin : public Plugin {
   /// This is not used to store event date in the backing store.
   EventContextID next_ec_id_{0};
 
+  /// A helper count of events the publisher's source reported as dropped.
+  std::atomic<size_t> drop_count_{0};
+
  private:
   /// Set ending to True to cause event type run loops to finish.
   std::atomic<bool> ending_{false};
@@ -311,11 +543,29 @@ class EventPublisherPlugin : public Plugin {
   std::atomic<bool> started_{false};
 
   /// A lock for incrementing the next EventContextID.
-  boost::mutex ec_id_lock_;
+  EventMutex ec_id_lock_{"event_context_id"};
 
   /// A helper count of event publisher runloop iterations.
   std::atomic<size_t> restart_count_{0};
 
+  /// Events dispatched and microseconds spent calling inline subscribers.
+  EventMetrics fire_metrics_;
+
+  /// An event held until the end of its coalescing window.
+  struct CoalescedEvent {
+    EventContextRef ec;
+    std::chrono::steady_clock::time_point first;
+  };
+
+  /// Held events by coalescing key.
+  std::map<std::string, CoalescedEvent> coalesced_;
+
+  /// Held event keys, in the order the events were first seen.
+  std::deque<std::string> coalesce_order_;
+
+  /// Protects the held events, events may be fired from several threads.
+  boost::mutex coalesce_lock_;
+
  private:
   /// Enable event factory "callins" through static publisher callbacks.
   friend class EventFactory;
@@ -323,6 +573,7 @@ class EventPublisherPlugin : public Plugin {
  private:
   FRIEND_TEST(EventsTests, test_event_publisher);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_event_dispatch);
 };
 
 class EventSubscriberPlugin : public Plugin {
@@ -365,22 +616,54 @@ class EventSubscriberPlugin : public Plugin {
   virtual QueryData get(EventTime start, EventTime stop) final;
 
  private:
-  /*
-   * @brief When `get`ing event results, return EventID%s from time indexes.
+  /**
+   * @brief Return the EventID, EventTime records within start, stop.
    *
-   * Used by EventSubscriber::get to retrieve EventID, EventTime indexes. This
-   * applies the lookup-efficiency checks for time list appropriate bins.
-   * If the time range in 24 hours and there is a 24-hour list bin it will
-   * be queried using a single backing store `Get` followed by two `Get`s of
-   * the most-specific boundary lists.
+   * Each event is stored under a single key ordered by (namespace, time,
+   * EventID), the records are read with one ordered range scan.
    *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit, 0 for no limit.
    * @return List of EventID, EventTime%s
    */
-  std::vector<EventRecord> getRecords(const std::set<std::string>& indexes);
+  std::vector<EventRecord> getRecords(EventTime start, EventTime stop);
+
+  /**
+   * @brief Return the events within start, stop in 'time' order.
+   *
+   * Compacted segments hold the oldest events, they are read before the
+   * individually stored events, or after them in descending order.
+   *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit.
+   * @param descending Read the latest events first.
+   * @param limit The most events to read, 0 for no limit.
+   * @return Set of event rows matching time limits.
+   */
+  QueryData getEvents(EventTime start,
+                      EventTime stop,
+                      bool descending,
+                      size_t limit);
+
+  /**
+   * @brief Apply the 'time' constraints and daemon select optimization.
+   *
+   * @param context The query context with optional 'time' constraints.
+   * @param start Output inclusive lower bound time limit.
+   * @param stop Output inclusive upper bound time limit.
+   */
+  void getTimeRange(QueryContext& context, EventTime& start, EventTime& stop);
+
+  /// The (ordered) backing store key for an event.
+  std::string getEventKey(EventTime time, const EventID& eid) const;
 
   /**
    * @brief Get a unique storage-related EventID.
    *
+   * EventIDs are allocated with an atomic counter. Blocks of EventIDs are
+   * reserved by persisting the end of the block, the counter is restored from
+   * this value so EventIDs remain monotonic across restarts.
+   *
    * An EventID is an index/element-identifier for the backing store.
    * Each EventPublisher maintains a fired EventContextID to identify the many
    * events that may or may not be fired based on subscription criteria for this
@@ -393,61 +676,57 @@ class EventSubscriberPlugin : public Plugin {
    */
   EventID getEventID();
 
+  /// Remove every event that occurred before expire_time_.
+  void expireRecords();
+
   /**
-   * @brief Plan the best set of indexes for event record access.
+   * @brief Commit the staged events using a single batched write.
    *
-   * @param start an inclusive time to begin searching.
-   * @param stop an inclusive time to end searching.
-   * @param list_key optional key to bind to a specific index binning.
+   * Events are staged by add and committed when the staged count reaches
+   * events_batch_size, or the oldest staged event is older than
+   * events_batch_latency milliseconds. Reads commit all staged events first.
    *
-   * @return List of 'index.step' index strings.
+   * @param force commit the staged events regardless of the thresholds.
+   * @return The status of the batched write.
    */
-  std::set<std::string> getIndexes(EventTime start,
-                                   EventTime stop,
-                                   size_t list_key = 0);
+  Status flushEvents(bool force);
 
   /**
-   * @brief Expire indexes and eventually records.
+   * @brief Expire events older than events_expiry or overflowing events_max.
+   *
+   * When the subscriber is registered, and then every events_expiry_interval
+   * seconds, the EventFactory will call expireCheck for each subscriber.
    *
-   * @param list_type the string representation of list binning type.
-   * @param indexes complete set of 'index.step' indexes for the list_type.
-   * @param expirations of the indexes, the set to expire.
+   * The subscriber counts the number of buffered records and checks if that
+   * count exceeds the configured `events_max` limit. If an overflow occurs the
+   * subscriber will expire N-events_max from the end of the queue. The expired
+   * events are removed with a single range delete.
+   *
+   * @return The number of expired events.
    */
-  void expireIndexes(const std::string& list_type,
-                     const std::vector<std::string>& indexes,
-                     const std::vector<std::string>& expirations);
-
-  /// Expire all datums within a bin.
-  void expireRecords(const std::string& list_type,
-                     const std::string& index,
-                     bool all);
+  size_t expireCheck();
 
   /**
-   * @brief Inspect the number of events, expire those overflowing events_max.
-   *
-   * When the event manager starts, or after a checkpoint number of events,
-   * the EventFactory will call expireCheck for each subscriber.
+   * @brief Move events stored with the time-binned index layout.
    *
-   * The subscriber must count the number of buffered records and check if
-   * that count exceeds the configured `events_max` limit. If an overflow
-   * occurs the subscriber will expire N-events_max from the end of the queue.
+   * Events were stored by EventID with comma-joined lists of EventID:time
+   * records within time bins. Each stored event is rewritten under its
+   * ordered event key and the bins and indexes are removed.
    */
-  void expireCheck();
+  void migrateEvents();
 
   /**
-   * @brief Add an EventID, EventTime pair to all matching list types.
+   * @brief Compact events older than events_cold_age into segments.
    *
-   * The list types are defined by time size. Based on the EventTime this pair
-   * is added to the list bin for each list type. If there are two list types:
-   * 60 seconds and 3600 seconds and `time` is 92, this pair will be added to
-   * list type 1 bin 4 and list type 2 bin 1.
+   * The aged events are replaced by immutable, compressed columnar segments
+   * of about kEventSegmentSize events. Each segment key holds the minimum and
+   * maximum time of its events, so a query only decodes overlapping segments.
+   * Segments never overlap, an aged event older than the newest segment is
+   * merged with the segments it overlaps.
    *
-   * @param eid A unique EventID.
-   * @param time The time when this EventID%'s event occurred.
-   *
-   * @return Were the indexes recorded.
+   * @return The number of compacted events.
    */
-  Status recordEvent(EventID& eid, EventTime time);
+  size_t compactEvents();
 
  public:
   /**
@@ -460,7 +739,12 @@ class EventSubscriberPlugin : public Plugin {
    */
   EventSubscriberPlugin()
       : expire_events_(true), expire_time_(0), optimize_time_(0){};
-  virtual ~EventSubscriberPlugin() {}
+  virtual ~EventSubscriberPlugin() {
+    if (dispatch_queue_ != nullptr) {
+      dispatch_queue_->stop();
+    }
+    flushEvents(true);
+  }
 
   /**
    * @brief Suggested entrypoint for table generation.
@@ -473,12 +757,52 @@ class EventSubscriberPlugin : public Plugin {
    */
   virtual QueryData genTable(QueryContext& context) __attribute__((used));
 
+  /**
+   * @brief Streaming entrypoint for table generation.
+   *
+   * Events are read from a time-ordered range of keys, seeking directly to
+   * the 'time' constraint, in batches as the virtual table cursor advances.
+   *
+   * @param columns The table columns, used to order each event Row.
+   * @param context The query context with optional 'time' constraints.
+   * @return A row generator for the matching events.
+   */
+  virtual RowGeneratorRef generator(const TableColumns& columns,
+                                    QueryContext& context);
+
   /// Number of Subscription%s this EventSubscriber has used.
   size_t numSubscriptions() const { return subscription_count_; }
 
   /// The number of events this EventSubscriber has received.
   EventContextID numEvents() const { return event_count_; }
 
+  /// The number of buffered events this EventSubscriber has expired.
+  size_t numExpired() const { return expired_count_; }
+
+  /// The number of expired events that overflowed `events_max`.
+  size_t numOverflowed() const { return overflow_count_; }
+
+  /// The rate of callbacks and the microseconds each callback ran.
+  const EventMetrics& callbackMetrics() const { return callback_metrics_; }
+
+  /// Microseconds from an event's dispatch until its callback added it.
+  const EventMetrics& storeMetrics() const { return store_metrics_; }
+
+  /// The number of events dropped by this EventSubscriber%'s dispatch queue.
+  size_t numDropped() const {
+    return (dispatch_queue_ != nullptr) ? dispatch_queue_->dropped() : 0;
+  }
+
+  /// The number of events waiting in this EventSubscriber%'s dispatch queue.
+  size_t numQueued() const {
+    return (dispatch_queue_ != nullptr) ? dispatch_queue_->queued() : 0;
+  }
+
+  /// The average milliseconds from firing an event to its dispatched callback.
+  size_t dispatchLatency() const {
+    return (dispatch_queue_ != nullptr) ? dispatch_queue_->latency() : 0;
+  }
+
  private:
   explicit EventSubscriberPlugin(EventSubscriberPlugin const&) = delete;
   EventSubscriberPlugin& operator=(EventSubscriberPlugin const&) = delete;
@@ -500,6 +824,24 @@ class EventSubscriberPlugin : public Plugin {
   /// Disable event expiration for this subscriber.
   void doNotExpire() { expire_events_ = false; }
 
+  /**
+   * @brief Call this subscriber's EventCallback%s from a dispatch queue.
+   *
+   * Subscribers with slow callbacks should use a dispatch queue so they never
+   * block their publisher or sibling subscribers. The queue is created when
+   * the subscriber is registered, see `events_dispatch_queue`.
+   */
+  void useDispatchQueue() { dispatch_async_ = true; }
+
+  /**
+   * @brief Keep this subscriber's events in memory, not the backing store.
+   *
+   * At most `events_max` events are kept, adding to a full store drops the
+   * oldest event. The events do not survive a restart. Every subscriber uses
+   * a memory store when `events_memory` is set.
+   */
+  void useMemoryStore();
+
   /// Trampoline into the EventFactory and lookup the name of the publisher.
   virtual EventPublisherID& getType() const = 0;
 
@@ -516,6 +858,18 @@ class EventSubscriberPlugin : public Plugin {
   /// A helper value counting the number of subscriptions created.
   size_t subscription_count_{0};
 
+  /// A helper value counting the number of expired events.
+  std::atomic<size_t> expired_count_{0};
+
+  /// A helper value counting the expired events overflowing events_max.
+  std::atomic<size_t> overflow_count_{0};
+
+  /// EventCallback durations, recorded by the publisher calling them.
+  EventMetrics callback_metrics_;
+
+  /// Dispatch to callback completion, including time in a dispatch queue.
+  EventMetrics store_metrics_;
+
  private:
   Status setUp() override { return Status(0, "Setup never used"); }
 
@@ -527,22 +881,51 @@ class EventSubscriberPlugin : public Plugin {
   EventTime expire_time_{0};
 
   /// Cached value of last generated EventID.
-  size_t last_eid_{0};
+  std::atomic<size_t> last_eid_{0};
+
+  /// EventIDs up to this value are reserved in the backing store.
+  std::atomic<size_t> reserved_eid_{0};
+
+  /// The reserved EventIDs were restored from the backing store.
+  std::atomic<bool> eid_restored_{false};
 
   /**
-   * @brief Optimize subscriber selects by tracking the last select time.
+   * @brief Optimize subscriber selects by tracking each query's last select.
    *
    * Event subscribers may optimize selects when used in a daemon schedule by
    * requiring an event 'time' constraint and otherwise applying a minimum time
-   * as the last time the scheduled query ran.
+   * as the last time the scheduled query ran. Each scheduled query has its
+   * own time, keyed by the query name, so queries sharing a subscriber do not
+   * advance each other's range.
    */
+  std::map<std::string, EventTime> optimize_times_;
+
+  /// The last select time restored from before times were kept per query.
   EventTime optimize_time_{0};
 
-  /// Lock used when incrementing the EventID database index.
-  boost::mutex event_id_lock_;
+  /// Lock used when reading and advancing the optimize times.
+  EventMutex optimize_lock_{"event_optimize"};
+
+  /// Lock used when reserving a block of EventIDs in the database.
+  EventMutex event_id_lock_{"event_id"};
+
+  /// Events keys and serialized rows waiting for a batched write.
+  std::vector<std::pair<std::string, std::string>> staged_events_;
+
+  /// The time the oldest staged event was added.
+  std::chrono::steady_clock::time_point staged_time_;
+
+  /// Lock used when staging and committing events.
+  EventMutex event_stage_lock_{"event_stage"};
+
+  /// Use a dispatch queue for this subscriber's EventCallback%s.
+  bool dispatch_async_{false};
 
-  /// Lock used when recording an EventID and time into search bins.
-  boost::mutex event_record_lock_;
+  /// The optional queue and workers calling this subscriber's EventCallback%s.
+  std::unique_ptr<EventDispatchQueue> dispatch_queue_{nullptr};
+
+  /// The optional in-memory store used instead of the backing store.
+  std::shared_ptr<EventMemoryStore> memory_store_{nullptr};
 
  private:
   friend class EventFactory;
@@ -550,12 +933,21 @@ class EventSubscriberPlugin : public Plugin {
 
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
-  FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
+  FRIEND_TEST(EventsDatabaseTests, test_event_id_reservation);
+  FRIEND_TEST(EventsDatabaseTests, test_record_keys);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
   FRIEND_TEST(EventsDatabaseTests, test_gentable);
+  FRIEND_TEST(EventsDatabaseTests, test_gentable_query_optimize_times);
+  FRIEND_TEST(EventsDatabaseTests, test_gentable_generator);
+  FRIEND_TEST(EventsDatabaseTests, test_gentable_descending);
+  FRIEND_TEST(EventsDatabaseTests, test_event_segments);
   FRIEND_TEST(EventsDatabaseTests, test_expire_check);
+  FRIEND_TEST(EventsDatabaseTests, test_migrate_events);
+  FRIEND_TEST(EventsDatabaseTests, test_batched_add);
+  FRIEND_TEST(EventsDatabaseTests, test_memory_store);
   friend class BenchmarkEventSubscriber;
+  friend class EventsLoadSubscriber;
 };
 
 /**
@@ -682,9 +1074,26 @@ class EventFactory : private boost::noncopyable {
   /// The dispatched event thread's entry-point (if needed).
   static Status run(EventPublisherID& type_id);
 
+  /**
+   * @brief The reactor thread's entry-point, publishers with descriptors.
+   *
+   * @param epoll An epoll descriptor, owned and closed by the reactor.
+   * @param publishers The started publishers the reactor calls `ready` on.
+   */
+  static void runReactor(int epoll, std::vector<EventPublisherRef> publishers);
+
+ private:
+  /// Commit the events staged by the subscribers of a publisher.
+  static void flushEvents(EventPublisherID& type_id);
+
+ public:
+
   /// An initializer's entry-point for spawning all event type run loops.
   static void delay();
 
+  /// Expire the buffered events of each running EventSubscriber.
+  static void expire();
+
   /// If a static EventPublisher callback wants to fire
   template <typename PUB>
   static void fire(const EventContextRef& ec) {
@@ -750,6 +1159,88 @@ class EventFactory : private boost::noncopyable {
   boost::shared_mutex factory_lock_;
 };
 
+/// Detect an EventContext that can reset itself for reuse.
+template <typename T, typename = void>
+struct IsRecyclableContext : std::false_type {};
+
+template <typename T>
+struct IsRecyclableContext<T, decltype(std::declval<T&>().clear())>
+    : std::true_type {};
+
+/**
+ * @brief Reuse the EventContext%s of a high-rate EventPublisher.
+ *
+ * A context type with a `clear` method is recycled through a bounded free
+ * list of its type. When the publisher, subscribers, and dispatch queues have
+ * released a context, the releasing thread clears it and returns it to the
+ * pool for the next event. `clear` resets the context while keeping its string
+ * buffers, so recycled contexts do not allocate or grow their buffers again.
+ * Context types without `clear` use make_shared.
+ */
+template <typename T>
+class EventContextPool : private boost::noncopyable {
+ public:
+  /// Create a context, reusing a released context of a recyclable type.
+  static std::shared_ptr<T> create() {
+    return create(IsRecyclableContext<T>());
+  }
+
+ private:
+  static std::shared_ptr<T> create(std::false_type) {
+    return std::make_shared<T>();
+  }
+
+  static std::shared_ptr<T> create(std::true_type) {
+    // Contexts may be released during shutdown, the pool is never destroyed.
+    static auto pool = new EventContextPool<T>();
+    return std::shared_ptr<T>(pool->acquire(), Recycle{pool});
+  }
+
+  /// A deleter returning a released context to its pool.
+  struct Recycle {
+    EventContextPool<T>* pool;
+
+    void operator()(T* context) const { pool->release(context); }
+  };
+
+  T* acquire() {
+    {
+      boost::lock_guard<boost::mutex> lock(lock_);
+      if (!contexts_.empty()) {
+        auto context = contexts_.back();
+        contexts_.pop_back();
+        return context;
+      }
+    }
+    return new T();
+  }
+
+  void release(T* context) {
+    context->id = 0;
+    context->time = 0;
+    context->count = 1;
+    context->clear();
+    {
+      boost::lock_guard<boost::mutex> lock(lock_);
+      if (contexts_.size() < kSize) {
+        contexts_.push_back(context);
+        return;
+      }
+    }
+    delete context;
+  }
+
+ private:
+  /// The most released contexts a pool keeps.
+  static const size_t kSize = 256;
+
+  /// The released contexts, cleared and ready for reuse.
+  std::vector<T*> contexts_;
+
+  /// Protects the pool, contexts are created and released by many threads.
+  boost::mutex lock_;
+};
+
 /**
  * @brief Generate OS events of a type (FS, Network, Syscall, ioctl).
  *
@@ -770,6 +1261,10 @@ class EventFactory : private boost::noncopyable {
  * within-thread loop where returning a FAILED status ends the run loop and
  * shuts down the thread.
  *
+ * A publisher reading events from a descriptor may return it from
+ * `getDescriptor` and implement `ready` instead. These publishers share a
+ * single epoll reactor thread, see `--events_reactor`.
+ *
  * To opt-out of polling in a thread, consider the following run implementation:
  *
  * @code{.cpp}
@@ -804,8 +1299,8 @@ class EventPublisher : public EventPublisherPlugin {
     return std::static_pointer_cast<SC>(sc);
   }
 
-  /// Create a EventContext based on the templated type.
-  static ECRef createEventContext() { return std::make_shared<EC>(); }
+  /// Create a EventContext based on the templated type, see EventContextPool.
+  static ECRef createEventContext() { return EventContextPool<EC>::create(); }
 
   /// Create a SubscriptionContext based on the templated type.
   static SCRef createSubscriptionContext() { return std::make_shared<SC>(); }
@@ -965,6 +1460,18 @@ class EventSubscriber : public EventSubscriberPlugin {
 /// the event factory.
 void attachEvents();
 
+/**
+ * @brief Register and set up every registry event publisher.
+ *
+ * Each publisher sets up its OS resources on its own thread, independent of
+ * the config and database. Called by attachEvents, or before it to set up
+ * publishers while other initialization continues.
+ */
+void attachEventPublishers();
+
+/// Register the registry event subscribers and configure the publishers.
+void attachEventSubscribers();
+
 /// Sleep in a boost::thread interruptible state.
 void publisherSleep(size_t milli);
 
@@ -21,6 +21,10 @@ DECLARE_string(extensions_socket);
 DECLARE_string(extensions_autoload);
 DECLARE_string(extensions_timeout);
 DECLARE_bool(disable_extensions);
+DECLARE_string(extensions_server);
+DECLARE_uint64(extensions_server_threads);
+DECLARE_string(extensions_protocol);
+DECLARE_uint64(extensions_buffer_size);
 
 /// A millisecond internal applied to extension initialization.
 extern const size_t kExtensionInitializeLatencyUS;
@@ -35,10 +39,39 @@ struct ExtensionInfo {
   std::string version;
   std::string min_sdk_version;
   std::string sdk_version;
+  /// The extension's Thrift server worker threads, 0 for one per connection.
+  size_t server_threads;
 };
 
 typedef std::map<RouteUUID, ExtensionInfo> ExtensionList;
 
+/// Registry calls routed to an extension, measured by the calling process.
+struct ExtensionCallStats {
+  /// The number of completed calls.
+  size_t calls{0};
+
+  /// The total latency of the completed calls in microseconds.
+  size_t latency{0};
+};
+
+/// The calls this process made to an extension.
+ExtensionCallStats getExtensionCallStats(RouteUUID uuid);
+
+/// The number of extensions registered with this process's manager.
+size_t getExtensionRegistrations();
+
+/**
+ * @brief Wait until more than seen extensions have registered.
+ *
+ * Autoloaded extensions start and register concurrently. The core waits for
+ * the one broadcasting a required plugin instead of polling the registry.
+ *
+ * @param seen A previous getExtensionRegistrations count.
+ * @param timeout_ms The most milliseconds to wait.
+ * @return true if an extension registered after the count was read.
+ */
+bool waitForExtensionRegistration(size_t seen, size_t timeout_ms);
+
 inline std::string getExtensionSocket(
     RouteUUID uuid, const std::string& path = FLAGS_extensions_socket) {
   if (uuid == 0) {
@@ -51,6 +84,20 @@ inline std::string getExtensionSocket(
 /// External (extensions) SQL implementation of the osquery query API.
 Status queryExternal(const std::string& query, QueryData& results);
 
+/**
+ * @brief External (extensions) SQL implementation of the streaming query API.
+ *
+ * Rows are fetched from a cursor on the extension manager in batches, so
+ * neither process holds the complete results. A callback returning false
+ * closes the cursor.
+ */
+Status queryExternal(const std::string& query, const RowCallback& callback);
+
+/// Internal streaming queryExternal using a UNIX domain socket path.
+Status queryExternal(const std::string& manager_path,
+                     const std::string& query,
+                     const RowCallback& callback);
+
 /// External (extensions) SQL implementation of the osquery getQueryColumns API.
 Status getQueryColumnsExternal(const std::string& q, TableColumns& columns);
 
@@ -61,6 +108,10 @@ class ExternalSQLPlugin : SQLPlugin {
     return queryExternal(q, results);
   }
 
+  Status query(const std::string& q, const RowCallback& callback) const {
+    return queryExternal(q, callback);
+  }
+
   Status getQueryColumns(const std::string& q, TableColumns& columns) const {
     return getQueryColumnsExternal(q, columns);
   }
@@ -141,6 +192,33 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+/**
+ * @brief Generate the rows of a table exposed by an Extension route.
+ *
+ * Extensions that negotiated columnar tables when registering return a column
+ * header and typed value vectors, which are read into rows without creating
+ * Row maps. Other extensions are called with callExtension.
+ *
+ * @param uuid Route UUID of the matched Extension
+ * @param item The table plugin name.
+ * @param request The table plugin request, including the query context.
+ * @param columns The table columns, which set the order of each row's cells.
+ * @param rows The output typed rows.
+ * @return Success indicates Extension API call and table generate success.
+ */
+Status generateExtensionTable(const RouteUUID uuid,
+                              const std::string& item,
+                              const PluginRequest& request,
+                              const TableColumns& columns,
+                              TableRows& rows);
+
+/// Internal generateExtensionTable implementation using a UNIX domain socket.
+Status generateExtensionTable(const std::string& extension_path,
+                              const std::string& item,
+                              const PluginRequest& request,
+                              const TableColumns& columns,
+                              TableRows& rows);
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
@@ -10,13 +10,19 @@
 
 #pragma once
 
+#include <sys/types.h>
+
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/status.h>
 
@@ -56,6 +62,64 @@ Status readFile(const boost::filesystem::path& path,
 Status forensicReadFile(const boost::filesystem::path& path,
                         std::string& content);
 
+/// A line of file content, only valid during the readLines predicate.
+using FileLine = boost::string_ref;
+
+/**
+ * @brief Read a file line by line without copying its content.
+ *
+ * The file is read in blocks with the same limits as readFile. Each line is
+ * passed without its newline as a reference into the read block. Only a
+ * line that spans blocks is copied.
+ *
+ * @param path the path of the file that you would like to read.
+ * @param predicate called with each line of the file.
+ * @param preserve_time restore the atime and mtime, see forensicReadFile.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status readLines(const boost::filesystem::path& path,
+                 std::function<void(FileLine line)> predicate,
+                 bool preserve_time = false);
+
+/// The position after the lines read from a file, see readNewLines.
+struct FileCheckpoint {
+  /// The device and inode of the file read.
+  dev_t device{0};
+  ino_t inode{0};
+
+  /// The offset after the last line read that ends with a newline.
+  size_t offset{0};
+
+  /// The end of the content before the offset, to detect a rewritten file.
+  std::string tail;
+
+  /// The last read started at the beginning of the file.
+  bool reset{false};
+
+  /// A last line without a newline, not passed and read again next time.
+  std::string partial;
+};
+
+/**
+ * @brief Read the lines appended to a file since a checkpoint.
+ *
+ * Lines are passed as with readLines, starting at the checkpoint offset. If
+ * the file was replaced, truncated, or its content before the offset changed
+ * the whole file is read and the checkpoint is reset.
+ *
+ * @param path the path of the file that you would like to read.
+ * @param checkpoint the position of the previous read, then of this read.
+ * @param predicate called with each new line ending with a newline.
+ * @param preserve_time restore the atime and mtime, see forensicReadFile.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status readNewLines(const boost::filesystem::path& path,
+                    FileCheckpoint& checkpoint,
+                    std::function<void(FileLine line)> predicate,
+                    bool preserve_time = false);
+
 /**
  * @brief Return the status of an attempted file read.
  *
@@ -66,7 +130,13 @@ Status forensicReadFile(const boost::filesystem::path& path,
  */
 Status readFile(const boost::filesystem::path& path);
 
-/// Internal representation for predicate-based chunk reading.
+/**
+ * @brief Internal representation for predicate-based chunk reading.
+ *
+ * The predicate is called with each block of up to block_size bytes. If
+ * block_size is 0 a file reporting its size is read whole, and other files
+ * are read in 4096-byte blocks.
+ */
 Status readFile(
     const boost::filesystem::path& path,
     size_t size,
@@ -280,6 +350,24 @@ Status parsePlist(const boost::filesystem::path& path,
  */
 Status parsePlistContent(const std::string& content,
                          boost::property_tree::ptree& tree);
+
+/**
+ * @brief Read selected top-level values of a property list on disk.
+ *
+ * Only the requested keys of the top-level dictionary are converted, without
+ * building a property tree. An array of values is joined with spaces and a
+ * dictionary value is empty. Values are cached by path and keys while the
+ * inode, mtime, and size of the file are unchanged.
+ *
+ * @param path the input path to a property list.
+ * @param keys the top-level keys to read.
+ * @param values the output values of the keys present in the property list.
+ *
+ * @return an instance of Status, indicating success or failure if malformed.
+ */
+Status parsePlistKeys(const boost::filesystem::path& path,
+                      const std::set<std::string>& keys,
+                      std::map<std::string, std::string>& values);
 #endif
 
 #ifdef __linux__
@@ -316,6 +404,123 @@ Status procReadDescriptor(const std::string& process,
                           const std::string& descriptor,
                           std::string& result);
 
+/**
+ * @brief A shared view of the `/proc` process list and process files.
+ *
+ * Process tables generating in the same query, or in the same scheduler step
+ * while another query holds the snapshot, share one walk of `/proc` through
+ * ProcSnapshot::current. The snapshot is released when the last query using
+ * it ends, see QueryResources. The pids are listed when the snapshot is
+ * taken. The stat, status, maps, and descriptor links of a process are each
+ * read on first use and kept for the life of the snapshot, up to
+ * kProcSnapshotMaxSize bytes of file content.
+ *
+ * Files are read with `openat` relative to a `/proc/<pid>` directory
+ * descriptor, which is opened from a `/proc` descriptor held by the snapshot.
+ */
+class ProcSnapshot : private boost::noncopyable {
+ public:
+  /**
+   * @brief Return the current snapshot, a new snapshot is taken every step.
+   *
+   * The calling thread's query keeps the snapshot until it ends. Without a
+   * query the caller's reference is the only one.
+   */
+  static std::shared_ptr<ProcSnapshot> current();
+
+  /**
+   * @brief Set the `/proc` root of new snapshots, such as a synthetic tree.
+   *
+   * The current snapshot is dropped. Tables reading other `/proc` files
+   * through the root, such as process_open_sockets, read them from the tree.
+   */
+  static void setRoot(const std::string& root);
+
+  /// The `/proc` root of new snapshots.
+  static std::string root();
+
+  /// Take a new snapshot of the current processes.
+  ProcSnapshot();
+
+  /// Take a new snapshot of the processes in a `/proc` root.
+  explicit ProcSnapshot(const std::string& root);
+  ~ProcSnapshot();
+
+  /// The pids, as strings, of processes running when the snapshot was taken.
+  const std::set<std::string>& pids() const { return pids_; }
+
+  /// Check if a pid is running now, it may have started after the snapshot.
+  bool exists(const std::string& pid) const;
+
+  /// The content of `/proc/<pid>/stat`, empty if it cannot be read.
+  std::string stat(const std::string& pid);
+
+  /// The content of `/proc/<pid>/status`, empty if it cannot be read.
+  std::string status(const std::string& pid);
+
+  /// The content of `/proc/<pid>/maps`, empty if it cannot be read.
+  std::string maps(const std::string& pid);
+
+  /// The descriptor numbers and links of `/proc/<pid>/fd`.
+  const std::map<std::string, std::string>& descriptors(
+      const std::string& pid);
+
+  /**
+   * @brief Read and keep the descriptors of many processes.
+   *
+   * The links of every process are read in one batch, see batchReadLink.
+   * Tables reading the descriptors of all processes call this first.
+   */
+  void readDescriptors(const std::set<std::string>& pids);
+
+  /// Read a process file that is not kept, such as cmdline or environ.
+  std::string read(const std::string& pid, const std::string& attr) const;
+
+  /// Read a process link that is not kept, such as exe, cwd, or root.
+  std::string readLink(const std::string& pid, const std::string& attr) const;
+
+  /**
+   * @brief The inode of a process namespace, such as "net" or "mnt".
+   *
+   * Processes in the same namespace, such as a container, have the same
+   * inode. Empty if the process is gone or its namespaces are restricted.
+   */
+  const std::string& getNamespace(const std::string& pid,
+                                  const std::string& type);
+
+ private:
+  /// Open a process directory descriptor, -1 if the process is gone.
+  int openProcess(const std::string& pid) const;
+
+  /// Read and keep a process file in one of the snapshot caches.
+  std::string readCached(std::map<std::string, std::string>& cache,
+                         const std::string& pid,
+                         const std::string& attr);
+
+ private:
+  /// The `/proc` directory descriptor.
+  int proc_{-1};
+
+  /// The time the snapshot was taken.
+  size_t time_{0};
+
+  std::set<std::string> pids_;
+
+  /// Protects the caches, tables may share the snapshot across threads.
+  std::mutex mutex_;
+
+  /// Bytes of file content kept by the caches.
+  size_t size_{0};
+
+  std::map<std::string, std::string> stat_;
+  std::map<std::string, std::string> status_;
+  std::map<std::string, std::string> maps_;
+  std::map<std::string, std::map<std::string, std::string>> descriptors_;
+
+  /// The namespace inodes of each process, by type.
+  std::map<std::string, std::map<std::string, std::string>> namespaces_;
+};
+
 /**
  * @brief Read bytes from Linux's raw memory.
  *
@@ -121,4 +121,18 @@ std::string hashFromFile(HashType hash_type, const std::string& path);
 
 /// Get multiple hashes from a file simultaneously.
 MultiHashes hashMultiFromFile(int mask, const std::string& path);
+
+/**
+ * @brief Get multiple hashes from a file, reusing those of an unchanged file.
+ *
+ * Hashes are cached in the backing store by path along with the file's
+ * device, inode, size, and modify and change times. A file with a different
+ * status is hashed again. The hash_cache_max most recently used files are
+ * kept.
+ *
+ * @param mask The HashType%s to return, more may be returned.
+ * @param path Filesystem path, the hash target.
+ * @return The hashes of the file content.
+ */
+MultiHashes hashMultiFromFileCached(int mask, const std::string& path);
 }
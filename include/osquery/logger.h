@@ -105,6 +105,21 @@ class LoggerPlugin : public Plugin {
   /// The LoggerPlugin PluginRequest action router.
   Status call(const PluginRequest& request, PluginResponse& response);
 
+  /**
+   * @brief Log the results of a scheduled query.
+   *
+   * logQueryLogItem hands local logger plugins the whole item, extension
+   * loggers receive it as one "results" request. The default writes each
+   * added and removed row as an event line with logString if
+   * log_result_events is set, otherwise the item as one batch line. Plugins
+   * may override this to forward the item without per-row overhead.
+   *
+   * @param item the results and metadata of the query.
+   * @return an instance of osquery::Status which indicates the success or
+   * failure of the operation.
+   */
+  virtual Status logResults(const QueryLogItem& item);
+
  protected:
   /** @brief Virtual method which should implement custom logging.
    *
@@ -179,6 +194,34 @@ class LoggerPlugin : public Plugin {
   }
 };
 
+/// Lines buffered by the filesystem and syslog loggers, see osquery_info.
+struct LoggerBufferStats {
+  /// The number of log lines waiting to be written.
+  size_t queued_lines{0};
+
+  /// The number of log lines dropped because the buffer was full.
+  size_t dropped_lines{0};
+
+  /// The milliseconds the last write of buffered log lines took.
+  size_t flush_latency{0};
+};
+
+/// Get the filesystem and syslog logger buffer statistics.
+LoggerBufferStats getLoggerBufferStats();
+
+/**
+ * @brief Serialize query results as the lines logged by logString.
+ *
+ * Each added and removed row is an event line if log_result_events is set,
+ * otherwise the item is one batch line. Lines do not end with a newline.
+ *
+ * @param item the results and metadata of the query.
+ * @param lines the output log lines.
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeResultLines(const QueryLogItem& item,
+                            std::vector<std::string>& lines);
+
 /// Set the verbose mode, changes Glog's sinking logic and will affect plugins.
 void setVerboseLevel();
 
@@ -276,7 +319,8 @@ Status logHealthStatus(const QueryLogItem& item);
  * When the osquery daemon uses a watcher/worker set, the watcher's status logs
  * are accumulated in a buffered log sink. Well-performing workers should have
  * the set of watcher status logs relayed and sent to the configured logger
- * plugin.
+ * plugin. If the watcher shares a status log ring with its workers the logs
+ * are copied into the ring and the worker forwards them.
  *
  * Status logs from extensions will be forwarded to the extension manager (core)
  * normally, but the watcher does not receive or send registry requests.
@@ -285,6 +329,15 @@ Status logHealthStatus(const QueryLogItem& item);
  */
 void relayStatusLogs();
 
+/**
+ * @brief Forward the queued status logs to the logger plugins.
+ *
+ * Status logs are queued by the logging thread and forwarded by a background
+ * thread. This blocks until the logs queued before the call are forwarded,
+ * such as before the process exits.
+ */
+void flushStatusLogs();
+
 /**
  * @brief Logger plugin registry.
  *
@@ -79,6 +79,9 @@ class Pack : private boost::noncopyable {
 
   size_t getShard() const { return shard_; }
 
+  /// Returns the percent of hosts sampled, 0 meaning no restriction
+  double getSample() const { return sample_; }
+
   /// Returns the schedule dictated by the pack
   const std::map<std::string, ScheduledQuery>& getSchedule() const;
 
@@ -99,6 +102,28 @@ class Pack : private boost::noncopyable {
 
   const PackStats& getStats() const;
 
+  /**
+   * @brief Evaluate discovery queries into the cache shared by every pack.
+   *
+   * Discovery results are cached by query text for pack_refresh_interval, so
+   * packs with the same discovery query run it once. The distinct queries
+   * without a fresh result run concurrently.
+   *
+   * @param queries The discovery queries, usually of every scheduled pack.
+   */
+  static void refreshDiscovery(const std::vector<std::string>& queries);
+
+  /**
+   * @brief Expire cached discovery results that read a table.
+   *
+   * Event subscribers call this when an event may change a table, such as a
+   * process starting. The discovery queries mentioning the table are run
+   * again at most every pack_refresh_event_interval seconds.
+   *
+   * @param table The name of the table the event changes.
+   */
+  static void invalidateDiscovery(const std::string& table);
+
  protected:
   /// List of query strings.
   std::vector<std::string> discovery_queries_;
@@ -115,6 +140,9 @@ class Pack : private boost::noncopyable {
   /// Optional shard requirement for pack.
   size_t shard_{0};
 
+  /// Optional percent of hosts, selected by host identifier, using the pack.
+  double sample_{0};
+
   /// Pack canonicalized name.
   std::string name_;
 
@@ -124,6 +152,9 @@ class Pack : private boost::noncopyable {
   /// Cached time and result from previous discovery step.
   std::pair<size_t, bool> discovery_cache_;
 
+  /// The invalidation generation of the cached discovery step.
+  size_t discovery_generation_{0};
+
   /// Aggregate appropriateness of pack for this host.
   std::atomic<bool> valid_{false};
 
@@ -138,8 +169,27 @@ class Pack : private boost::noncopyable {
    */
   Pack(){};
 
+  /// A discovery query's cached result.
+  struct DiscoveryResult {
+    /// The time the query ran, 0 if it has not.
+    size_t time{0};
+
+    /// Set if the query succeeded and returned rows.
+    bool result{false};
+
+    /// Set if an event invalidated the result.
+    bool invalidated{false};
+  };
+
+  /// Check if a cached result must be evaluated again.
+  static bool isStale(const DiscoveryResult& result, size_t current);
+
+  /// The discovery results shared by every pack, by query text.
+  static std::map<std::string, DiscoveryResult>& discoveryResults();
+
  private:
   FRIEND_TEST(PacksTests, test_check_platform);
+  FRIEND_TEST(PacksTests, test_discovery_shared_cache);
 };
 
 /**
@@ -12,6 +12,7 @@
 
 #include <map>
 #include <mutex>
+#include <stdexcept>
 #include <vector>
 #include <set>
 
@@ -86,6 +87,23 @@ namespace osquery {
     Registry::add<type>(registry, name, true);              \
   }
 
+/**
+ * @brief A boilerplate code helper to register a table of plugins.
+ *
+ * Code generation emits a sorted, constant PluginRegistration table for the
+ * generated tables instead of a REGISTER per table. A single constructor adds
+ * the table in constant time and each plugin is created when first used.
+ *
+ * @param registrations A const array of PluginRegistration sorted by name.
+ * @param registry The string name for the registry.
+ */
+#define REGISTER_STATIC(registrations, registry)                       \
+  __plugin_constructor__ static void registrations##Registry() {       \
+    Registry::addStatic(registry,                                      \
+                        registrations,                                 \
+                        sizeof(registrations) / sizeof(registrations[0])); \
+  }
+
 /**
  * @brief The request part of a plugin (registry item's) call.
  *
@@ -109,6 +127,14 @@ using RegistryRoutes = std::map<std::string, PluginResponse>;
 /// An extension or core's broadcast includes routes from every Registry.
 using RegistryBroadcast = std::map<std::string, RegistryRoutes>;
 
+/**
+ * @brief Hash a plugin's route info.
+ *
+ * Routes with equal hashes describe the same plugin, such as a table with
+ * the same columns, so a repeated broadcast changes nothing downstream.
+ */
+size_t hashRouteInfo(const PluginResponse& info);
+
 using RouteUUID = uint16_t;
 using AddExternalCallback =
     std::function<Status(const std::string&, const PluginResponse&)>;
@@ -207,6 +233,31 @@ class Plugin : private boost::noncopyable {
   std::string name_;
 };
 
+/// Helper definition for a shared pointer to a Plugin.
+using PluginRef = std::shared_ptr<Plugin>;
+
+/**
+ * @brief A plugin in a sorted, constant registration table.
+ *
+ * See REGISTER_STATIC, the registry creates the plugin when it is first used.
+ */
+struct PluginRegistration {
+  /// The registry item name, a registration table is sorted by name.
+  const char* name;
+
+  /// Allocate the plugin.
+  Plugin* (*create)();
+
+  /// True if the plugin should not be broadcasted.
+  bool internal;
+};
+
+/// Allocate a plugin of type Item for a PluginRegistration.
+template <class Item>
+Plugin* createPlugin() {
+  return new Item();
+}
+
 class RegistryHelperCore : private boost::noncopyable {
  public:
   explicit RegistryHelperCore(bool auto_setup = false)
@@ -230,6 +281,9 @@ class RegistryHelperCore : private boost::noncopyable {
    * The "table" registry and table plugins are the primary user of the route
    * information. Each plugin will include the SQL statement used to attach
    * an equivalent virtual table.
+   *
+   * The routes are a snapshot kept until an item or alias is added or
+   * removed, an unchanged registry is not serialized again.
    */
   RegistryRoutes getRoutes() const;
 
@@ -256,6 +310,18 @@ class RegistryHelperCore : private boost::noncopyable {
   /// Insert a named plugin into this registry.
   Status add(const std::string& item_name, bool internal = false);
 
+  /**
+   * @brief Add a sorted table of plugins created when first used.
+   *
+   * The registry keeps a pointer to the table, which must outlive it, and
+   * does not allocate a plugin until the item is called or requested.
+   *
+   * @param registrations A constant table sorted by name.
+   * @param count The number of registrations.
+   * @return Failure if the table is not sorted.
+   */
+  Status addStatic(const PluginRegistration* registrations, size_t count);
+
   /**
    * @brief Allow a plugin to perform some setup functions when osquery starts.
    *
@@ -265,7 +331,8 @@ class RegistryHelperCore : private boost::noncopyable {
    * and logs are ready to stream), do construction work in Plugin::setUp.
    *
    * The registry `setUp` will iterate over all of its registry items and call
-   * their setup unless the registry is lazy (see CREATE_REGISTRY).
+   * their setup unless the registry is lazy (see CREATE_REGISTRY). Items
+   * added with addStatic are set up when they are first used.
    */
   virtual void setUp();
 
@@ -313,6 +380,9 @@ class RegistryHelperCore : private boost::noncopyable {
   /// Facility method to check if a registry item exists.
   bool exists(const std::string& item_name, bool local = false) const;
 
+  /// Get a local plugin instance, or nullptr if the item is not local.
+  std::shared_ptr<Plugin> getLocal(const std::string& item_name) const;
+
   /// Create a registry item alias for a given item name.
   Status addAlias(const std::string& item_name, const std::string& alias);
 
@@ -375,6 +445,48 @@ class RegistryHelperCore : private boost::noncopyable {
 
   /// If a module was initialized/declared then store lookup information.
   std::map<std::string, RouteUUID> modules_;
+
+  /// A registration table and the plugins created from it.
+  struct StaticItems {
+    const PluginRegistration* registrations;
+    size_t count;
+    std::vector<PluginRef> plugins;
+    std::vector<bool> removed;
+  };
+
+  /// Find a static item that was not removed.
+  bool findStatic(const std::string& item_name,
+                  size_t& table,
+                  size_t& index) const;
+
+  /// Get a static item's plugin, creating it if needed.
+  PluginRef getStatic(const std::string& item_name) const;
+
+  /**
+   * @brief Get the static items' plugins.
+   *
+   * @param create Create the plugins not used yet, otherwise only return the
+   * plugins that already exist.
+   */
+  std::map<std::string, PluginRef> getStatics(bool create) const;
+
+  /// The registration tables, static plugins are created lazily.
+  mutable std::vector<StaticItems> statics_;
+
+  /// Protects the creation of static plugins.
+  mutable std::recursive_mutex statics_mutex_;
+
+  /// Set when the registry sets up its items, static items created later
+  /// are set up when they are created.
+  bool setup_{false};
+
+  /// Incremented when an item or alias is added or removed.
+  size_t version_{0};
+
+  /// The routes snapshot and the version it was built at.
+  mutable RegistryRoutes routes_snapshot_;
+  mutable size_t snapshot_version_{0};
+  mutable bool snapshot_{false};
 };
 
 /**
@@ -410,7 +522,7 @@ class RegistryHelper : public RegistryHelperCore {
    */
   template <class Item>
   Status add(const std::string& item_name, bool internal = false) {
-    if (items_.count(item_name) > 0) {
+    if (exists(item_name, true)) {
       return Status(1, "Duplicate registry item exists: " + item_name);
     }
 
@@ -432,7 +544,11 @@ class RegistryHelper : public RegistryHelperCore {
    * @return A std::shared_ptr of type RegistryType.
    */
   RegistryTypeRef get(const std::string& item_name) const {
-    return std::dynamic_pointer_cast<RegistryType>(items_.at(item_name));
+    auto item = getLocal(item_name);
+    if (item == nullptr) {
+      throw std::out_of_range("Unknown registry item: " + item_name);
+    }
+    return std::dynamic_pointer_cast<RegistryType>(item);
   }
 
   /// Trampoline function for calling the PluginType's addExternal.
@@ -453,6 +569,11 @@ class RegistryHelper : public RegistryHelperCore {
       ditems[item.first] = std::dynamic_pointer_cast<RegistryType>(item.second);
     }
 
+    // Static items are created, the registry is listing every plugin.
+    for (const auto& item : getStatics(true)) {
+      ditems[item.first] = std::dynamic_pointer_cast<RegistryType>(item.second);
+    }
+
     return ditems;
   }
 
@@ -481,9 +602,6 @@ class RegistryHelper : public RegistryHelperCore {
   FRIEND_TEST(EventsTests, test_event_subscriber_configure);
 };
 
-/// Helper definition for a shared pointer to a Plugin.
-using PluginRef = std::shared_ptr<Plugin>;
-
 /// Helper definition for a basic-templated Registry type using a base Plugin.
 using PluginRegistryHelper = RegistryHelper<Plugin>;
 
@@ -592,6 +710,19 @@ class RegistryFactory : private boost::noncopyable {
     return Status(0, "Registry locked");
   }
 
+  /**
+   * @brief Add a sorted table of plugins to a registry.
+   *
+   * REGISTER_STATIC is the helper macro for `addStatic` usage.
+   *
+   * @param registry_name The canonical name for this registry.
+   * @param registrations A constant table sorted by name.
+   * @param count The number of registrations.
+   */
+  static Status addStatic(const std::string& registry_name,
+                          const PluginRegistration* registrations,
+                          size_t count);
+
   /// Direct access to all registries.
   static const std::map<std::string, PluginRegistryHelperRef>& all();
 
@@ -603,6 +734,28 @@ class RegistryFactory : private boost::noncopyable {
   static PluginRef get(const std::string& registry_name,
                        const std::string& item_name);
 
+  /**
+   * @brief Get a local plugin as a specialized plugin type.
+   *
+   * In-process callers holding typed data, such as a table's QueryContext, may
+   * use the plugin's typed API instead of building a PluginRequest and parsing
+   * a PluginResponse. Extension routes are not local and must use call.
+   *
+   * @param registry_name The unique registry name containing item_name.
+   * @param item_name The name of the plugin used to REGISTER.
+   * @return The plugin, or nullptr if there is no local plugin of type T.
+   */
+  template <class T>
+  static std::shared_ptr<T> getLocal(const std::string& registry_name,
+                                     const std::string& item_name) {
+    const auto& registries = instance().registries_;
+    auto registry = registries.find(registry_name);
+    if (registry == registries.end()) {
+      return nullptr;
+    }
+    return std::dynamic_pointer_cast<T>(registry->second->getLocal(item_name));
+  }
+
   /// Serialize this core or extension's registry.
   static RegistryBroadcast getBroadcast();
 
@@ -113,6 +113,8 @@ REGISTER_INTERNAL(ExternalSQLPlugin, "sql", "sql");
 #define REGISTER "Do not REGISTER in the osquery SDK"
 #undef REGISTER_INTERNAL
 #define REGISTER_INTERNAL "Do not REGISTER_INTERNAL in the osquery SDK"
+#undef REGISTER_STATIC
+#define REGISTER_STATIC "Do not REGISTER_STATIC in the osquery SDK"
 #undef CREATE_REGISTRY
 #define CREATE_REGISTRY "Do not CREATE_REGISTRY in the osquery SDK"
 #undef CREATE_LAZY_REGISTRY
@@ -10,7 +10,9 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -22,6 +24,14 @@ namespace osquery {
 
 DECLARE_int32(value_max);
 
+/**
+ * @brief A consumer of streamed query result rows.
+ *
+ * The callback is called once for each row as it is produced and may move
+ * from the row. Returning false cancels the query, no more rows are read.
+ */
+using RowCallback = std::function<bool(Row& row)>;
+
 /**
  * @brief The core interface to executing osquery SQL commands
  *
@@ -49,6 +59,17 @@ class SQL {
    */
   explicit SQL(const std::string& q);
 
+  /**
+   * @brief Instantiate an instance of the class streaming a query's rows
+   *
+   * Rows are passed to the callback as they are produced and are not kept,
+   * rows() remains empty. The status reflects the rows that were read.
+   *
+   * @param q An osquery SQL query
+   * @param callback A RowCallback, return false to stop reading rows
+   */
+  SQL(const std::string& q, const RowCallback& callback);
+
   /**
    * @brief Accessor for the rows returned by the query
    *
@@ -104,6 +125,20 @@ class SQL {
                                  ConstraintOperator op,
                                  const std::string& expr);
 
+  /**
+   * @brief Get all with the constraints of a query context, given a virtual
+   * table name.
+   *
+   * The table may use the constraints to limit what it generates, rows that
+   * do not match the constraints may still be returned.
+   *
+   * @param table The name of the virtual table.
+   * @param context The query context with column constraints.
+   * @return A QueryData object of the 'SELECT *...' query results.
+   */
+  static QueryData selectAllFrom(const std::string& table,
+                                 const QueryContext& context);
+
  protected:
   /**
    * @brief Private default constructor
@@ -119,6 +154,21 @@ class SQL {
   Status status_;
 };
 
+/// A virtual table scan the SQL implementation planned for a query.
+struct TableScan {
+  /// The scanned table.
+  std::string table;
+
+  /// The estimated cost of the scan, relative to TablePlugin::cost.
+  double cost{0};
+
+  /// Number of column constraints passed to the table's generator.
+  size_t constraints{0};
+
+  /// The columns of those constraints.
+  std::set<std::string> columns;
+};
+
 /**
  * @brief The osquery SQL implementation is managed as a plugin.
  *
@@ -139,11 +189,26 @@ class SQLPlugin : public Plugin {
  public:
   /// Run a SQL query string against the SQL implementation.
   virtual Status query(const std::string& q, QueryData& results) const = 0;
+
+  /**
+   * @brief Run a SQL query string and stream each result row to a callback.
+   *
+   * Implementations that step results incrementally should stop producing
+   * rows when the callback returns false. The default collects all results.
+   */
+  virtual Status query(const std::string& q,
+                       const RowCallback& callback) const;
   /// Use the SQL implementation to parse a query string and return details
   /// (name, type) about the columns.
   virtual Status getQueryColumns(const std::string& q,
                                  TableColumns& columns) const = 0;
 
+  /// Plan a query without running it and return its virtual table scans.
+  virtual Status getQueryScans(const std::string& q,
+                               std::vector<TableScan>& scans) const {
+    return Status(1, "Not used");
+  }
+
   /**
    * @brief Attach a table at runtime.
    *
@@ -187,6 +252,19 @@ class SQLPlugin : public Plugin {
  */
 Status query(const std::string& query, QueryData& results);
 
+/**
+ * @brief Execute a query and stream each result row to a callback
+ *
+ * A local SQL plugin steps rows as the callback consumes them and a callback
+ * returning false stops the query early, so the full result set is not held.
+ * Extensions fetch rows from a cursor on the extension manager in batches.
+ *
+ * @param q the query to execute
+ * @param callback A RowCallback, return false to stop reading rows
+ * @return A status indicating query success.
+ */
+Status query(const std::string& query, const RowCallback& callback);
+
 /**
  * @brief Analyze a query, providing information about the result columns
  *
@@ -202,6 +280,38 @@ Status query(const std::string& query, QueryData& results);
  */
 Status getQueryColumns(const std::string& q, TableColumns& columns);
 
+/**
+ * @brief Estimate the cost of a query from its plan, without running it.
+ *
+ * SQLite plans each virtual table scan using the cost a table declares and
+ * the constraints the query applies to it. A scan without constraints
+ * generates the entire table.
+ *
+ * @param q the query to plan
+ * @param scans the virtual table scans, in the order they are planned
+ *
+ * @return status indicating success or failure of the operation
+ */
+Status getQueryScans(const std::string& q, std::vector<TableScan>& scans);
+
+/// Statistics of the scans calling a table's generator.
+struct TableStats {
+  /// Number of scans calling the generator.
+  uint64_t scans{0};
+
+  /// Rows generated by the scans.
+  uint64_t rows{0};
+
+  /// Total microseconds of wall time spent generating rows.
+  uint64_t time{0};
+
+  /// Distribution of the microseconds spent by each scan.
+  Histogram times;
+};
+
+/// Return the generator statistics of each table scanned by this process.
+std::map<std::string, TableStats> getTableStats();
+
 /*
  * @brief A mocked subclass of SQL useful for testing
  */
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <cstring>
+#include <memory>
 #include <sstream>
 #include <string>
 
@@ -37,7 +39,7 @@ class Status {
    * Note that the default constructor initialized an osquery::Status instance
    * to a state such that a successful operation is indicated.
    */
-  explicit Status(int c = 0) : code_(c), message_("OK") {}
+  explicit Status(int c = 0) : code_(c) {}
 
   /**
    * @brief A constructor which can be used to concisely express the status of
@@ -51,7 +53,43 @@ class Status {
    * Otherwise, it doesn't matter what the string is, as long as both the
    * setter and caller agree.
    */
-  Status(int c, std::string m) : code_(c), message_(m) {}
+  Status(int c, std::string m) : code_(c) {
+    if (m != "OK") {
+      message_.reset(new std::string(std::move(m)));
+    }
+  }
+
+  /// A message literal, "OK" is not copied so success never allocates.
+  Status(int c, const char* m) : code_(c) {
+    if (std::strcmp(m, "OK") != 0) {
+      message_.reset(new std::string(m));
+    }
+  }
+
+  /// Copying a successful Status does not allocate.
+  Status(const Status& s)
+      : code_(s.code_),
+        message_((s.message_ != nullptr) ? new std::string(*s.message_)
+                                         : nullptr) {}
+
+  /// Returning or storing a moved Status never copies the message.
+  Status(Status&& s) noexcept
+      : code_(s.code_), message_(std::move(s.message_)) {}
+
+  Status& operator=(const Status& s) {
+    if (this != &s) {
+      code_ = s.code_;
+      message_.reset((s.message_ != nullptr) ? new std::string(*s.message_)
+                                             : nullptr);
+    }
+    return *this;
+  }
+
+  Status& operator=(Status&& s) noexcept {
+    code_ = s.code_;
+    message_ = std::move(s.message_);
+    return *this;
+  }
 
  public:
   /**
@@ -68,7 +106,9 @@ class Status {
    * success or failure of an operation. On successful operations, the idiom
    * is for the message to be "OK"
    */
-  std::string getMessage() const { return message_; }
+  std::string getMessage() const {
+    return (message_ != nullptr) ? *message_ : "OK";
+  }
 
   /**
    * @brief A convenience method to check if the return code is 0
@@ -111,7 +151,7 @@ class Status {
 
   // Enables use of gtest (ASSERT|EXPECT)_EQ
   bool operator==(const Status& rhs) const {
-    return (code_ == rhs.getCode()) && (message_ == rhs.getMessage());
+    return (code_ == rhs.code_) && (getMessage() == rhs.getMessage());
   }
 
   // Enables use of gtest (ASSERT|EXPECT)_NE
@@ -124,7 +164,7 @@ class Status {
   /// the internal storage of the status code
   int code_;
 
-  /// the internal storage of the status message
-  std::string message_;
+  /// the internal storage of the status message, not allocated for "OK"
+  std::unique_ptr<std::string> message_;
 };
 }
@@ -11,13 +11,19 @@
 #pragma once
 
 #include <deque>
+#include <functional>
+#include <future>
+#include <initializer_list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <set>
+#include <type_traits>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/variant.hpp>
 
 #include <osquery/registry.h>
 #include <osquery/core.h>
@@ -35,6 +41,50 @@
 
 namespace osquery {
 
+/// Format a signed integer as base 10 text, without a stream.
+std::string integerText(long long value);
+
+/// Format an unsigned integer as base 10 text, without a stream.
+std::string unsignedText(unsigned long long value);
+
+/// Integral types formatted as numbers, character types are cast as text.
+template <typename T>
+struct IsAffinityInteger
+    : std::integral_constant<bool,
+                             std::is_integral<T>::value &&
+                                 !std::is_same<T, char>::value &&
+                                 !std::is_same<T, signed char>::value &&
+                                 !std::is_same<T, unsigned char>::value &&
+                                 !std::is_same<T, wchar_t>::value &&
+                                 !std::is_same<T, char16_t>::value &&
+                                 !std::is_same<T, char32_t>::value> {};
+
+/// The text of a signed integer column value.
+template <typename T>
+inline typename std::enable_if<IsAffinityInteger<T>::value &&
+                                   std::is_signed<T>::value,
+                               std::string>::type
+affinityText(T value) {
+  return integerText(value);
+}
+
+/// The text of an unsigned integer column value.
+template <typename T>
+inline typename std::enable_if<IsAffinityInteger<T>::value &&
+                                   !std::is_signed<T>::value,
+                               std::string>::type
+affinityText(T value) {
+  return unsignedText(value);
+}
+
+/// The text of any other column value, as a lexical cast.
+template <typename T>
+inline typename std::enable_if<!IsAffinityInteger<T>::value,
+                               std::string>::type
+affinityText(const T& value) {
+  return boost::lexical_cast<std::string>(value);
+}
+
 /**
  * @brief The SQLite type affinities are available as macros
  *
@@ -45,13 +95,13 @@ namespace osquery {
  * types they are storing, and more importantly how they are treated at query
  * time.
  */
-#define TEXT(x) boost::lexical_cast<std::string>(x)
+#define TEXT(x) ::osquery::affinityText(x)
 /// See the affinity type documentation for TEXT.
-#define INTEGER(x) boost::lexical_cast<std::string>(x)
+#define INTEGER(x) ::osquery::affinityText(x)
 /// See the affinity type documentation for TEXT.
-#define BIGINT(x) boost::lexical_cast<std::string>(x)
+#define BIGINT(x) ::osquery::affinityText(x)
 /// See the affinity type documentation for TEXT.
-#define UNSIGNED_BIGINT(x) boost::lexical_cast<std::string>(x)
+#define UNSIGNED_BIGINT(x) ::osquery::affinityText(x)
 /// See the affinity type documentation for TEXT.
 #define DOUBLE(x) boost::lexical_cast<std::string>(x)
 
@@ -91,6 +141,73 @@ extern const std::map<ColumnType, std::string> kColumnTypeNames;
 /// Helper alias for TablePlugin names.
 typedef std::string TableName;
 typedef std::vector<std::pair<std::string, ColumnType> > TableColumns;
+
+/**
+ * @brief Query planning options declared for columns in a table spec.
+ *
+ * Options are bitwise OR'd. They describe how a table uses EQUALS constraints
+ * so the virtual table xBestIndex can estimate the cost of each query plan,
+ * and the order the table generates rows in.
+ */
+enum ColumnOptions {
+  /// Constraints on the column are evaluated by SQLite only.
+  COLUMN_DEFAULT = 0,
+  /// An EQUALS constraint generates exactly the matching rows (a lookup).
+  COLUMN_INDEX = 1,
+  /// The table generates no rows without an EQUALS constraint on the column.
+  COLUMN_REQUIRED = 2,
+  /// An EQUALS constraint generates additional, non-default rows.
+  COLUMN_ADDITIONAL = 4,
+  /// Rows are generated in ascending, or if descending is set descending,
+  /// order of the column. An ORDER BY the column does not need a sort.
+  COLUMN_ORDERED = 8,
+};
+
+/// Map of column name to OR'd ColumnOptions, default columns are omitted.
+typedef std::map<std::string, int> TableColumnOptions;
+
+/**
+ * @brief A column of a table schema compiled into the table plugin.
+ *
+ * The table codegen emits a constexpr array of definitions for each spec,
+ * which the generated plugin's columns and columnOptions are built from.
+ */
+struct ColumnDefinition {
+  /// The column name.
+  const char* name;
+
+  /// The column affinity.
+  ColumnType type;
+
+  /// The OR'd ColumnOptions.
+  int options;
+};
+
+/// Build the column name and type pairs of a compiled-in schema.
+template <size_t N>
+TableColumns schemaColumns(const ColumnDefinition (&schema)[N]) {
+  TableColumns columns;
+  columns.reserve(N);
+  for (const auto& column : schema) {
+    columns.push_back(std::make_pair(column.name, column.type));
+  }
+  return columns;
+}
+
+/// Build the non-default planner options of a compiled-in schema.
+template <size_t N>
+TableColumnOptions schemaColumnOptions(const ColumnDefinition (&schema)[N]) {
+  TableColumnOptions options;
+  for (const auto& column : schema) {
+    if (column.options != COLUMN_DEFAULT) {
+      options[column.name] = column.options;
+    }
+  }
+  return options;
+}
+
+/// The relative cost of a table scan when a spec does not declare one.
+extern const size_t kDefaultTableCost;
 struct QueryContext;
 
 /**
@@ -253,6 +370,9 @@ struct ConstraintList {
     constraints_.push_back(constraint);
   }
 
+  /// Remove the constraints, keeping the list's allocation.
+  void clear() { constraints_.clear(); }
+
   /**
    * @brief Serialize a ConstraintList into a property tree.
    *
@@ -350,16 +470,196 @@ struct QueryContext {
     return forEachConstraint<std::string>(column, op, predicate);
   }
 
+  /**
+   * @brief Check if the query reads a column.
+   *
+   * SQLite reports the columns a scan reads, including those in predicates it
+   * evaluates itself. A table may skip expensive work, such as hashing, for
+   * columns that are not used. Every column is used unless projected is set.
+   *
+   * @param column The name of a column within this table.
+   * @return true if the column may be read.
+   */
+  bool isColumnUsed(const std::string& column) const;
+
+  /**
+   * @brief Clear the constraints and hints of a previous filter.
+   *
+   * The column constraint lists, and their affinities, are kept. A context
+   * reused by each filter of a cursor does not reallocate them.
+   */
+  void reset();
+
+  /// Check if the query reads any of the columns, see isColumnUsed.
+  bool isAnyColumnUsed(std::initializer_list<std::string> columns) const;
+
+  /**
+   * @brief Check if a sampled query generates the rows of an item.
+   *
+   * A query may request that only a fraction of the rows is generated, see
+   * setQuerySampleRate. Generators that can skip work cheaply, a directory
+   * walker or a process enumerator, check each item before reading it.
+   *
+   * @param key A stable identifier of the item, such as a path or pid.
+   * @return true if the item is part of the sample.
+   */
+  bool isSampled(const std::string& key) const;
+
   ConstraintMap constraints;
   /// Support a limit to the number of results.
   int limit{0};
+  /// Generate the rows in descending order of a COLUMN_ORDERED column.
+  bool descending{false};
+  /// The columns read by the query, only known if projected is set.
+  std::set<std::string> used_columns;
+  /// Set when used_columns lists every column the query reads.
+  bool projected{false};
   /// Is the table allowed to "traverse" directories.
   bool traverse{false};
+  /// The fraction of items the generator reads, 1 reads every item.
+  double sample_rate{1.0};
 };
 
 typedef struct QueryContext QueryContext;
+
+/**
+ * @brief Check if an item belongs to a sample of the given rate.
+ *
+ * The decision depends only on the key, so repeated queries sample the same
+ * items and the items of a join agree.
+ */
+bool isSampledKey(const std::string& key, double rate);
+
+/**
+ * @brief Set the sample rate of queries run by the calling thread.
+ *
+ * Each table scan started afterwards passes the rate to its generator in
+ * QueryContext::sample_rate. Aggregates over sampled rows are estimates.
+ *
+ * @param rate The fraction of items generated within (0, 1], 1 to disable.
+ */
+void setQuerySampleRate(double rate);
+
+/// The sample rate of queries run by the calling thread.
+double getQuerySampleRate();
+
+/**
+ * @brief Resources shared by the table generators of one query.
+ *
+ * A generator may keep state that other tables of the same query reuse, such
+ * as a snapshot of the process list, with QueryResources::keep. The resources
+ * are released when the query's scope ends. A scope applies to the calling
+ * thread, a worker generating rows for the query adopts it with the
+ * QueryResources::current pointer.
+ */
+class QueryResources : private boost::noncopyable {
+ public:
+  /// Start the scope of a query run by the calling thread.
+  QueryResources();
+
+  /// Adopt the scope of a query on a worker thread, nullptr for none.
+  explicit QueryResources(QueryResources* parent);
+
+  /// Release the kept resources, or restore the worker's previous scope.
+  ~QueryResources();
+
+  /**
+   * @brief Keep a resource until the calling thread's query ends.
+   *
+   * @return false if no query is running, the caller owns the resource alone.
+   */
+  static bool keep(const std::shared_ptr<void>& resource);
+
+  /// The scope of the calling thread's query, nullptr if none.
+  static QueryResources* current();
+
+ private:
+  /// The scope of a query this thread was running before.
+  QueryResources* previous_{nullptr};
+
+  /// Protects the resources, workers keep resources for the query's thread.
+  std::mutex mutex_;
+
+  std::set<std::shared_ptr<void>> resources_;
+};
 typedef struct Constraint Constraint;
 
+/**
+ * @brief A typed cell within a column-ordered table row.
+ *
+ * Virtual table cursors read cells by column ordinal. A generator that fills
+ * integer and double cells directly avoids the map lookup and string to
+ * number conversion needed for every cell of a Row.
+ */
+using TableCell = boost::variant<std::string, long long int, double>;
+
+/// A column-ordered row, each cell index is the table's column ordinal.
+using TableRow = std::vector<TableCell>;
+
+/// The typed, column-ordered equivalent of QueryData.
+using TableRows = std::vector<TableRow>;
+
+/// Immutable table results shared by reference, for example from a cache.
+using QueryDataRef = std::shared_ptr<const QueryData>;
+
+/// A deferred unit of row generation, appending zero or more Rows.
+using RowTask = std::function<void(QueryData& results)>;
+
+/// An ordered list of deferred row generation work.
+using RowTasks = std::vector<RowTask>;
+
+/**
+ * @brief A resumable source of rows for streaming table generation.
+ *
+ * A virtual table cursor pulls one batch of rows at a time from a generator
+ * as SQLite advances the cursor. When SQLite stops early, because of a LIMIT
+ * or a failed join probe, the remaining rows are never generated.
+ */
+class RowGenerator : private boost::noncopyable {
+ public:
+  virtual ~RowGenerator() {}
+
+  /**
+   * @brief Append the next batch of rows.
+   *
+   * @param rows The output typed rows, in the order of the table columns.
+   * @return false if the generator is exhausted after this batch.
+   */
+  virtual bool next(TableRows& rows) = 0;
+};
+
+using RowGeneratorRef = std::shared_ptr<RowGenerator>;
+
+/**
+ * @brief A RowGenerator that lazily runs a list of RowTask%s.
+ *
+ * Tables that expand their constraints into work items, such as paths to
+ * stat or hash, defer the expensive part of each item into a RowTask. The
+ * tasks run in order until a batch of rows is filled.
+ */
+class LazyRowGenerator : public RowGenerator {
+ public:
+  LazyRowGenerator(const TableColumns& columns,
+                   RowTasks tasks,
+                   size_t batch_size = 32)
+      : columns_(columns), tasks_(std::move(tasks)), batch_size_(batch_size) {}
+
+  bool next(TableRows& rows) override;
+
+ private:
+  /// The table columns, used to order each generated Row.
+  TableColumns columns_;
+
+  /// The deferred row generation work.
+  RowTasks tasks_;
+
+  /// The next task to run.
+  size_t position_{0};
+
+  /// The minimum number of rows in each batch, unless exhausted.
+  size_t batch_size_{0};
+};
+
 /**
  * @brief The TablePlugin defines the name, types, and column information.
  *
@@ -375,6 +675,19 @@ class TablePlugin : public Plugin {
   /// Return the table's column name and type pairs.
   virtual TableColumns columns() const { return TableColumns(); }
 
+  /// Return the planner options for columns with non-default options.
+  virtual TableColumnOptions columnOptions() const {
+    return TableColumnOptions();
+  }
+
+  /**
+   * @brief Return the cost of generating every row, relative to most tables.
+   *
+   * A spec declares this using attributes(cost=N). SQLite compares the cost
+   * of each table in a JOIN to choose the outer (driving) table.
+   */
+  virtual size_t cost() const { return kDefaultTableCost; }
+
   /**
    * @brief Generate a complete table representation.
    *
@@ -406,19 +719,14 @@ class TablePlugin : public Plugin {
    *
    * Table results are considered fresh when evaluated against a given interval.
    * The interval is the expected rate for which this data should be generated.
-   * Caching and cache freshness only applies to queries acting on tables
-   * within a schedule. If two queries "one" and "two" both inspect the
-   * table "processes" at the interval 60. The first executed will cache results
-   * and the second will use the cached results.
-   *
-   * Table results are not cached if a QueryContext contains constraints or
-   * provides HOB (hand-off blocks) to additional tables within a query.
-   * Currently, the query scheduler cannot communicate to table implementations.
-   * An interval is set globally by the scheduler and passed to the table
-   * implementation as a future-proof API. There is no "shortcut" for caching
-   * when used in external tables. A cache lookup within an extension means
-   * a database call API and re-serialization to the virtual table APIs. In
-   * practice this does not perform well and is explicitly disabled.
+   * If two queries "one" and "two" both inspect the table "processes" at the
+   * interval 60. The first executed will cache results and the second will use
+   * the cached results.
+   *
+   * This checks the results cached for a query without constraints, see the
+   * QueryContext overloads of getCache and setCache for constraint-aware
+   * caching. Results are cached in-process and shared, so there is no
+   * "shortcut" for caching when used in external tables.
    *
    * @param interval The interval this query expects the tables results.
    * @return True if the cache contains fresh results, otherwise false.
@@ -426,36 +734,158 @@ class TablePlugin : public Plugin {
   bool isCached(size_t interval);
 
   /**
-   * @brief Perform a database lookup of cached results and deserialize.
+   * @brief Copy the cached results of a query without constraints.
    *
    * If a query determined the table's cached results are fresh, it may ask the
-   * table to retrieve results from the database and deserialized them into
-   * table row data.
+   * table to retrieve them as table row data.
    *
-   * @return The deserialized row data of cached results.
+   * @return The cached row data.
    */
   QueryData getCache() const;
 
   /// Similar to TablePlugin::getCache, if TablePlugin::generate is called.
   void setCache(size_t step, size_t interval, const QueryData& results);
 
+  /**
+   * @brief Lookup fresh cached results for the constraints of a query.
+   *
+   * Entries are keyed by the constraints in the QueryContext and shared by
+   * reference between concurrent queries, a hit does not copy or deserialize.
+   *
+   * @param context The query context used to generate the results.
+   * @return The shared cached results, or nullptr if missing or stale.
+   */
+  QueryDataRef getCache(const QueryContext& context) const;
+
+  /**
+   * @brief Cache results for the constraints of a query.
+   *
+   * Results stay fresh for TablePlugin::cacheTTL seconds. Tables without a
+   * TTL are fresh for the interval of the scheduled query, and are not cached
+   * outside of the schedule.
+   */
+  void setCache(const QueryContext& context, const QueryData& results);
+
+  /// Return the seconds cached results are fresh, 0 to use the schedule.
+  virtual size_t cacheTTL() const { return 0; }
+
+  /**
+   * @brief Return true if cached results are fresh until the next boot.
+   *
+   * Hardware and OS details such as SMBIOS or CPUID cannot change while the
+   * system runs, their results are cached for the life of the process.
+   */
+  virtual bool cacheBoot() const { return false; }
+
+  /**
+   * @brief Return true if boot cached results describe hotplugged devices.
+   *
+   * These results are only cached while a hotplug event publisher watches
+   * for devices, and they are invalidated when a device is added or removed.
+   */
+  virtual bool cacheHotplug() const { return false; }
+
+  /**
+   * @brief Generate results through the cache, sharing scans between queries.
+   *
+   * Queries with the same constraints, limit and used columns share one
+   * generation, the generator is given the query's context. Constraints only
+   * on index and default columns are filtered from fresh unconstrained
+   * results when they are available, since SQLite evaluates them again. A
+   * query that needs results another query is generating,
+   * such as several scheduled queries due in the same tick, waits for and
+   * shares that generation instead of scanning again.
+   *
+   * @param context The query context filled in by SQLite.
+   * @param generator The table's generate implementation.
+   * @return The shared results for the query context.
+   */
+  QueryDataRef generateCached(
+      QueryContext& context,
+      const std::function<QueryData(QueryContext&)>& generator);
+
+ private:
+  /// Store an entry in the cache, fresh until the expiration time or while
+  /// a boot cache generation, if not 0, is current. A stepped expiration is
+  /// a schedule step rather than a unix time.
+  void storeCache(const std::string& key,
+                  size_t expires,
+                  QueryDataRef results,
+                  size_t generation = 0,
+                  bool stepped = false);
+
+  /**
+   * @brief Store results for the constraints of a query.
+   *
+   * @param key The cache key of the constraints.
+   * @param results The generated results.
+   * @param generation The hotplug generation read before generating.
+   */
+  void storeResults(const std::string& key,
+                    QueryDataRef results,
+                    size_t generation);
+
+  /// Check if results that may be generated now are cached until boot.
+  bool isBootCached() const;
+
  private:
-  /// The last time in seconds the table data results were saved to cache.
-  size_t last_cached_{0};
-  /// The last interval in seconds when the table data was cached.
-  size_t last_interval_{0};
+  /**
+   * @brief A shared result set and the time in seconds it is fresh until.
+   *
+   * Results cached until boot have no expiration time, they record the
+   * hotplug generation and are fresh until it changes.
+   */
+  struct CacheEntry {
+    QueryDataRef results;
+    size_t expires{0};
+    size_t generation{0};
+
+    /// Set if expires is a schedule step, see TablePlugin::setCache.
+    bool stepped{false};
+
+    /// Check if the entry is fresh at a time and schedule step.
+    bool fresh(size_t now, size_t step) const;
+  };
+
+  /// Cached results keyed by the constraints used to generate them.
+  std::map<std::string, CacheEntry> cache_;
+
+  /// Results being generated, keyed like the cache, for waiting queries.
+  std::map<std::string, std::shared_future<QueryDataRef>> pending_;
+
+  /// Protect the cache, a table may be used by concurrent queries.
+  mutable boost::shared_mutex cache_mutex_;
 
  public:
   /**
    * @brief The scheduled interval for the executing query.
    *
-   * Scheduled queries execute within a pseudo-mutex, and each may communicate
+   * Scheduled queries execute on parallel workers, and each may communicate
    * their scheduled interval to internal TablePlugin implementations. If the
    * table is cachable then the interval can be used to calculate freshness.
+   * The interval is per thread, tables are generated on the query's thread.
    */
-  static size_t kCacheInterval;
+  static thread_local size_t kCacheInterval;
   /// The schedule step, this is the current position of the schedule.
-  static size_t kCacheStep;
+  static thread_local size_t kCacheStep;
+
+  /// The name of the executing scheduled query, empty for other queries.
+  static thread_local std::string kQueryName;
+
+  /**
+   * @brief Invalidate the results of hotplug tables cached until boot.
+   *
+   * Hotplug event publishers call this when a device is added or removed.
+   */
+  static void invalidateHotplugCache();
+
+  /**
+   * @brief Declare if a hotplug event publisher is watching for devices.
+   *
+   * Without a publisher to invalidate them, hotplug tables are not cached
+   * until boot. Changing the state also invalidates the cached results.
+   */
+  static void setHotplugWatched(bool watched);
 
  public:
   /**
@@ -467,13 +897,76 @@ class TablePlugin : public Plugin {
    *   - generate: call the plugin's row generate method (defined in spec).
    *   - columns: return a list of column name and SQLite types.
    *   - definition: return an SQL statement for table creation.
+   *   - attributes: return table planning details such as the scan cost.
    *
    * @param request The plugin request, must include an action key.
    * @param response A plugin response, for generation this contains the rows.
    */
   Status call(const PluginRequest& request, PluginResponse& response) override;
 
+  /**
+   * @brief Generate typed, column-ordered rows.
+   *
+   * Virtual table cursors use this method when the table plugin is local to
+   * the process, skipping the registry call and context serialization. The
+   * default implementation adapts the Row maps from TablePlugin::generate so
+   * existing tables work unchanged. A table may override this to fill cells
+   * by column ordinal directly.
+   *
+   * @param context A query context filled in by SQLite's virtual table API.
+   * @param rows The output typed rows, in the order of TablePlugin::columns.
+   */
+  virtual void generateRows(QueryContext& context, TableRows& rows);
+
+  /**
+   * @brief Create a streaming row generator for a query.
+   *
+   * Cursors for local tables prefer a generator over generateRows, pulling
+   * rows in batches as SQLite consumes them. The default implementation
+   * returns nullptr, meaning the table does not stream.
+   *
+   * @param context A query context filled in by SQLite's virtual table API.
+   * @return A row generator or nullptr.
+   */
+  virtual RowGeneratorRef generator(QueryContext& context) { return nullptr; }
+
+  /**
+   * @brief The table's column name and type pairs, see columns.
+   *
+   * A table's columns do not change, they are built once per plugin so the
+   * per-query callers do not allocate a new list.
+   */
+  const TableColumns& tableColumns() const;
+
+ private:
+  /// Guard building the columns once.
+  mutable std::once_flag columns_once_;
+
+  /// The columns, built on first use.
+  mutable TableColumns columns_cache_;
+
  public:
+  /// Run every deferred RowTask, used when a complete QueryData is needed.
+  static QueryData generateFromTasks(RowTasks tasks);
+
+  /// Move Row maps into column-ordered rows, missing columns are empty.
+  static void setRowsFromQueryData(const TableColumns& columns,
+                                   QueryData& data,
+                                   TableRows& rows);
+
+  /// Copy shared Row maps into column-ordered rows, see setRowsFromQueryData.
+  static void setRowsFromQueryData(const TableColumns& columns,
+                                   const QueryData& data,
+                                   TableRows& rows);
+
+  /// Convert column-ordered rows into Row maps keyed by column name.
+  static void setQueryDataFromRows(const TableColumns& columns,
+                                   const TableRows& rows,
+                                   QueryData& data);
+
+  /// Write a typed cell using the text representation found in a Row.
+  static std::string cellText(const TableCell& cell);
+
   /// Helper data structure transformation methods.
   static void setRequestFromContext(const QueryContext& context,
                                     PluginRequest& request);
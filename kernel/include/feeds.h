@@ -28,7 +28,7 @@
  *  A daemon may only connect to a kernel with the same communication version.
  *  Bump this number when changing or adding any event structs.
  */
-#define OSQUERY_KERNEL_COMMUNICATION_VERSION 4
+#define OSQUERY_KERNEL_COMMUNICATION_VERSION 6
 #ifdef KERNEL_TEST
 #define OSQUERY_KERNEL_COMM_VERSION \
   (OSQUERY_KERNEL_COMMUNICATION_VERSION | (1UL << 63))
@@ -122,10 +122,66 @@ typedef struct {
   char path[MAXPATHLEN];
 } osquery_file_event_t;
 
+//
+// Subscription filters.
+//
+
+// Fields applied by a subscription filter.
+#define OSQUERY_FILTER_ACTIONS (1 << 0)
+#define OSQUERY_FILTER_PID (1 << 1)
+#define OSQUERY_FILTER_UID (1 << 2)
+#define OSQUERY_FILTER_PATH (1 << 3)
+
+// Maximum number of filters per event type.
+#define OSQUERY_MAX_FILTERS 16
+
 typedef struct {
-  osquery_file_action_t actions;
+  // Bit mask of the OSQUERY_FILTER_ fields to match, 0 matches every event.
+  uint32_t fields;
+  // Mask of event actions, such as osquery_file_action_t.
+  uint32_t actions;
+  uint64_t pid;
+  uint64_t uid;
+  // Prefix of the event path.
   char path[MAXPATHLEN];
-} osquery_file_event_subscription_t;
+} osquery_event_filter_t;
+
+/** @brief Check if an event matches every field of a subscription filter.
+ *
+ *  @param filter The subscription filter.
+ *  @param action The event action, 0 if the event type has no actions.
+ *  @param pid The event process ID.
+ *  @param uid The event user ID.
+ *  @param path The event path, NULL if the event type has no path.
+ *  @return 1 if the event matches, otherwise 0.
+ */
+static inline int osquery_filter_match(const osquery_event_filter_t *filter,
+                                       uint32_t action,
+                                       uint64_t pid,
+                                       uint64_t uid,
+                                       const char *path) {
+  if ((filter->fields & OSQUERY_FILTER_ACTIONS) &&
+      !(filter->actions & action)) {
+    return 0;
+  }
+  if ((filter->fields & OSQUERY_FILTER_PID) && filter->pid != pid) {
+    return 0;
+  }
+  if ((filter->fields & OSQUERY_FILTER_UID) && filter->uid != uid) {
+    return 0;
+  }
+  if (filter->fields & OSQUERY_FILTER_PATH) {
+    if (path == 0) {
+      return 0;
+    }
+    for (size_t i = 0; i < MAXPATHLEN && filter->path[i] != '\0'; i++) {
+      if (path[i] != filter->path[i]) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
 
 #ifdef KERNEL_TEST
 typedef struct {
@@ -168,8 +224,18 @@ typedef struct {
 typedef struct {
   osquery_event_t event;
   int subscribe;
+
+  // Remove the event's previous filters before adding this filter.
+  int reset;
+
+  // Events matching any of an event type's filters are queued.
+  osquery_event_filter_t filter;
 } osquery_subscription_args_t;
 
+// Bounds of the shared buffer size requested by the daemon.
+#define OSQUERY_MIN_QUEUE_SIZE (8 * (1 << 10))
+#define OSQUERY_MAX_QUEUE_SIZE (256 * (1 << 20))
+
 // Flags for buffer sync options.
 #define OSQUERY_DEFAULT 0
 #define OSQUERY_NO_BLOCK 1
@@ -186,6 +252,9 @@ typedef struct {
 
   // (Output) Number of drops or negative on overflow.
   int drops;
+
+  // (Output) Most bytes of the buffer in use since the previous sync.
+  size_t high_water_mark;
 } osquery_buf_sync_args_t;
 
 typedef struct {
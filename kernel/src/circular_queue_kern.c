@@ -124,8 +124,10 @@ void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size) {
   queue->read = queue->buffer;
 
   queue->drops = 0;
+  queue->high_water_mark = 0;
   queue->initialized = 1;
   queue->reservations = 0;
+  queue->waiting = 0;
   lck_spin_unlock(queue->lck);
 }
 
@@ -185,11 +187,14 @@ ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue) {
     goto error_exit;
   }
 
+  // Producers only wake the consumer while it is waiting.
   wait_result_t wait_result = THREAD_AWAKENED;
   while (wait_result == THREAD_AWAKENED && queue->max_read == queue->read) {
+    queue->waiting = 1;
     wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
                                  &queue->max_read, THREAD_ABORTSAFE);
   }
+  queue->waiting = 0;
   offset = queue->max_read - queue->buffer;
 
 error_exit:
@@ -214,6 +219,18 @@ error_exit:
   return drops;
 }
 
+size_t osquery_cqueue_high_water_mark(osquery_cqueue_t *queue) {
+  size_t high_water_mark = 0;
+  lck_spin_lock(queue->lck);
+  if (queue->initialized) {
+    high_water_mark = queue->high_water_mark;
+    queue->high_water_mark = 0;
+  }
+  lck_spin_unlock(queue->lck);
+
+  return high_water_mark;
+}
+
 void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
                              osquery_event_t event,
                              size_t size) {
@@ -262,6 +279,11 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
     // Give them the pointer to the space not the header.
     ret = (void *)(header + 1);
     queue->reservations++;
+
+    size_t used = get_distance(queue, queue->read, queue->write, 0);
+    if (used > queue->high_water_mark) {
+      queue->high_water_mark = used;
+    }
   } else {
     if (queue->drops >= 0) {
       queue->drops += 1;
@@ -285,6 +307,7 @@ error_exit:
 static inline void coalesce_readable(osquery_cqueue_t *queue) {
   osquery_data_header_t *header = (osquery_data_header_t *)queue->max_read;
   osquery_between_t b;
+  int readable = 0;
 
   while (OSQUERY_BETWEEN & (b = is_between(queue, header, queue->max_read,
                                        queue->write, sizeof(osquery_data_header_t)))) {
@@ -300,16 +323,30 @@ static inline void coalesce_readable(osquery_cqueue_t *queue) {
         queue, queue->max_read, header->size + sizeof(osquery_data_header_t));
 
     header = (osquery_data_header_t *)queue->max_read;
-    wakeup(&queue->max_read);
+    readable = 1;
 
     lck_spin_unlock(queue->lck);
     lck_spin_lock(queue->lck);
   }
+
+  // Wake a waiting consumer once for every block made readable.
+  if (readable && queue->waiting) {
+    queue->waiting = 0;
+    wakeup(&queue->max_read);
+  }
 }
 
 int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   int err = 0;
 
+  // Read the clocks before taking the lock shared by every producer.
+  clock_sec_t seconds;
+  clock_usec_t microsecs;
+  clock_get_calendar_microtime(&seconds, &microsecs);
+  uint64_t time = (uint64_t)seconds;
+  clock_get_system_microtime(&seconds, &microsecs);
+  uint64_t uptime = (uint64_t)seconds;
+
   lck_spin_lock(queue->lck);
 
   // Retrieve the header for the initialized space.
@@ -324,12 +361,8 @@ int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   }
 
   header->finished = 1;
-  clock_sec_t seconds;
-  clock_usec_t microsecs;
-  clock_get_calendar_microtime(&seconds, &microsecs);
-  header->time.time = (uint64_t)seconds;
-  clock_get_system_microtime(&seconds, &microsecs);
-  header->time.uptime = (uint64_t)seconds;
+  header->time.time = time;
+  header->time.uptime = uptime;
 
   coalesce_readable(queue);
 
@@ -39,8 +39,10 @@ typedef struct {
   uint8_t *max_read;
   uint8_t *read;
   int drops;
+  size_t high_water_mark;
   int initialized;
   uint32_t reservations;
+  int waiting;
   clock_sec_t last_destruction_time;
 
   lck_grp_attr_t *lck_grp_attr;
@@ -126,6 +128,13 @@ ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue);
  */
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
 
+/** @brief Returns the most space used since the last call of this function.
+ *
+ *  @param queue The cqueue to find the high water mark of.
+ *  @return The most bytes of the buffer reserved or readable at once.
+ */
+size_t osquery_cqueue_high_water_mark(osquery_cqueue_t *queue);
+
 /** @brief Reserve space to store an event in the queue.
  *
  *  This gives you a brief moment to write data to the returned space.
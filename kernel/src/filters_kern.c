@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <libkern/libkern.h>
+
+#include <sys/lock.h>
+
+#include "filters_kern.h"
+
+typedef struct {
+  osquery_event_filter_t filters[OSQUERY_MAX_FILTERS];
+  size_t count;
+} osquery_filter_list_t;
+
+static struct {
+  /// The filters for each event type.
+  osquery_filter_list_t lists[OSQUERY_NUM_EVENTS];
+
+  lck_grp_attr_t *lck_grp_attr;
+  lck_grp_t *lck_grp;
+  lck_attr_t *lck_attr;
+
+  /// Event callbacks share the lock, the IOCTL API takes it exclusively.
+  lck_rw_t *lck;
+} osquery_filters;
+
+static inline int valid_event(osquery_event_t event) {
+  return (OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS);
+}
+
+void osquery_filters_setup() {
+  // Create locks. Cannot be done on the stack.
+  osquery_filters.lck_grp_attr = lck_grp_attr_alloc_init();
+  lck_grp_attr_setstat(osquery_filters.lck_grp_attr);
+  osquery_filters.lck_grp =
+      lck_grp_alloc_init("osquery filters", osquery_filters.lck_grp_attr);
+  osquery_filters.lck_attr = lck_attr_alloc_init();
+  osquery_filters.lck =
+      lck_rw_alloc_init(osquery_filters.lck_grp, osquery_filters.lck_attr);
+
+  bzero(osquery_filters.lists, sizeof(osquery_filters.lists));
+}
+
+void osquery_filters_teardown() {
+  lck_rw_free(osquery_filters.lck, osquery_filters.lck_grp);
+
+  lck_attr_free(osquery_filters.lck_attr);
+  lck_grp_free(osquery_filters.lck_grp);
+  lck_grp_attr_free(osquery_filters.lck_grp_attr);
+}
+
+int osquery_filters_add(osquery_event_t event,
+                        int reset,
+                        const osquery_event_filter_t *filter) {
+  if (!valid_event(event)) {
+    return -1;
+  }
+
+  int err = 0;
+  lck_rw_lock_exclusive(osquery_filters.lck);
+  osquery_filter_list_t *list = &osquery_filters.lists[event];
+  if (reset) {
+    list->count = 0;
+  }
+
+  if (list->count < OSQUERY_MAX_FILTERS) {
+    list->filters[list->count] = *filter;
+    // Never trust the daemon to terminate the path prefix.
+    list->filters[list->count].path[MAXPATHLEN - 1] = '\0';
+    list->count++;
+  } else {
+    err = -1;
+  }
+  lck_rw_unlock_exclusive(osquery_filters.lck);
+  return err;
+}
+
+void osquery_filters_clear(osquery_event_t event) {
+  if (!valid_event(event)) {
+    return;
+  }
+
+  lck_rw_lock_exclusive(osquery_filters.lck);
+  osquery_filters.lists[event].count = 0;
+  lck_rw_unlock_exclusive(osquery_filters.lck);
+}
+
+int osquery_filters_use_path(osquery_event_t event) {
+  if (!valid_event(event)) {
+    return 0;
+  }
+
+  int use_path = 0;
+  lck_rw_lock_shared(osquery_filters.lck);
+  osquery_filter_list_t *list = &osquery_filters.lists[event];
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->filters[i].fields & OSQUERY_FILTER_PATH) {
+      use_path = 1;
+      break;
+    }
+  }
+  lck_rw_unlock_shared(osquery_filters.lck);
+  return use_path;
+}
+
+int osquery_filters_match(osquery_event_t event,
+                          uint32_t action,
+                          uint64_t pid,
+                          uint64_t uid,
+                          const char *path) {
+  if (!valid_event(event)) {
+    return 0;
+  }
+
+  lck_rw_lock_shared(osquery_filters.lck);
+  osquery_filter_list_t *list = &osquery_filters.lists[event];
+  // An event type without filters queues every event.
+  int match = (list->count == 0);
+  for (size_t i = 0; i < list->count && !match; i++) {
+    match = osquery_filter_match(&list->filters[i], action, pid, uid, path);
+  }
+  lck_rw_unlock_shared(osquery_filters.lck);
+  return match;
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+/** @brief Subscription filters applied before events are queued.
+ *
+ *  The daemon compiles its subscriptions into a small set of filters for each
+ *  event type. Publishers check the filters before reserving queue space, so
+ *  events no subscription wants are never copied to the daemon.
+ *
+ *  An event type without filters, or with a filter using no fields, queues
+ *  every event.
+ */
+
+#pragma once
+
+#include <feeds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Setup the filter table locks.
+ *
+ *  @return Void.
+ */
+void osquery_filters_setup();
+
+/** @brief Remove every filter and teardown the filter table locks.
+ *
+ *  @return Void.
+ */
+void osquery_filters_teardown();
+
+/** @brief Add a filter for an event type.
+ *
+ *  @param event The event type the filter applies to.
+ *  @param reset Remove the event type's previous filters first.
+ *  @param filter The filter to add.
+ *  @return 0 on success, negative if the event type has too many filters.
+ */
+int osquery_filters_add(osquery_event_t event,
+                        int reset,
+                        const osquery_event_filter_t *filter);
+
+/** @brief Remove every filter for an event type.
+ *
+ *  @param event The event type.
+ *  @return Void.
+ */
+void osquery_filters_clear(osquery_event_t event);
+
+/** @brief Check if any filter for an event type requires the event path.
+ *
+ *  Publishers use this to skip resolving paths that no filter will inspect.
+ *
+ *  @param event The event type.
+ *  @return 1 if a path is required, otherwise 0.
+ */
+int osquery_filters_use_path(osquery_event_t event);
+
+/** @brief Check if an event should be queued.
+ *
+ *  @param event The event type.
+ *  @param action The event action, 0 if the event type has no actions.
+ *  @param pid The event process ID.
+ *  @param uid The event user ID.
+ *  @param path The event path, NULL if unavailable.
+ *  @return 1 if the event should be queued, otherwise 0.
+ */
+int osquery_filters_match(osquery_event_t event,
+                          uint32_t action,
+                          uint64_t pid,
+                          uint64_t uid,
+                          const char *path);
+
+#ifdef __cplusplus
+}  // end extern "c"
+#endif
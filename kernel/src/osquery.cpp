@@ -24,6 +24,7 @@
 #include "publishers.h"
 
 #include "circular_queue_kern.h"
+#include "filters_kern.h"
 
 #ifdef DEBUG
 #define dbg_printf(...) printf("osquery kext: " __VA_ARGS__)
@@ -48,8 +49,8 @@
 
 // Let the major number be decided for us.
 #define OSQUERY_MAJOR -1
-#define MAX_KMEM (20 * (1 << 20))
-#define MIN_KMEM (8 * (1 << 10))
+#define MAX_KMEM OSQUERY_MAX_QUEUE_SIZE
+#define MIN_KMEM OSQUERY_MIN_QUEUE_SIZE
 
 static struct {
   /// The shared (user/kernel space) circular queue holding event results.
@@ -67,6 +68,9 @@ static struct {
   int major_number;
   int open_count;
 
+  /// Set for each event type with a subscribed publisher.
+  int subscribed[OSQUERY_NUM_EVENTS];
+
   /// IOCTL API handling lock/mutex data.
   lck_grp_attr_t *lck_grp_attr;
   lck_grp_t *lck_grp;
@@ -108,10 +112,15 @@ static void unsubscribe_all_events() {
     if (osquery_publishers[i]) {
       osquery_publishers[i]->unsubscribe();
     }
+    osquery_filters_clear((osquery_event_t)i);
+    osquery.subscribed[i] = 0;
   }
 }
 
-static int subscribe_to_event(osquery_event_t event, int subscribe) {
+static int subscribe_to_event(osquery_event_t event,
+                              int subscribe,
+                              int reset,
+                              const osquery_event_filter_t *filter) {
   if (osquery.buffer == NULL) {
     return -EINVAL;
   }
@@ -123,11 +132,22 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
   }
 
   if (subscribe) {
-    if (osquery_publishers[event]->subscribe(&osquery.cqueue)) {
+    // Filters are applied by the publisher before reserving queue space.
+    if (osquery_filters_add(event, reset, filter)) {
       return -EINVAL;
     }
+    // Each additional subscription only adds a filter.
+    if (!osquery.subscribed[event]) {
+      if (osquery_publishers[event]->subscribe(&osquery.cqueue)) {
+        osquery_filters_clear(event);
+        return -EINVAL;
+      }
+      osquery.subscribed[event] = 1;
+    }
   } else {
     osquery_publishers[event]->unsubscribe();
+    osquery_filters_clear(event);
+    osquery.subscribed[event] = 0;
   }
 
   return 0;
@@ -136,7 +156,8 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
 static int update_user_kernel_buffer(int options,
                                      size_t read_offset,
                                      size_t *max_read_offset,
-                                     int *drops) {
+                                     int *drops,
+                                     size_t *high_water_mark) {
   if (osquery_cqueue_advance_read(
           &osquery.cqueue, read_offset, max_read_offset)) {
     return -EINVAL;
@@ -150,6 +171,7 @@ static int update_user_kernel_buffer(int options,
     *max_read_offset = offset;
   }
   *drops = osquery_cqueue_dropped_data(&osquery.cqueue);
+  *high_water_mark = osquery_cqueue_high_water_mark(&osquery.cqueue);
   return 0;
 }
 
@@ -311,7 +333,8 @@ static int osquery_ioctl(
   // Daemon is requesting a new subscription (e.g., monitored path).
   case OSQUERY_IOCTL_SUBSCRIPTION:
     sub = (osquery_subscription_args_t *)data;
-    if ((err = subscribe_to_event(sub->event, sub->subscribe))) {
+    if ((err = subscribe_to_event(
+             sub->event, sub->subscribe, sub->reset, &sub->filter))) {
       goto error_exit;
     }
     break;
@@ -330,7 +353,8 @@ static int osquery_ioctl(
     if ((err = update_user_kernel_buffer(sync->options,
                                          sync->read_offset,
                                          &(sync->max_read_offset),
-                                         &(sync->drops)))) {
+                                         &(sync->drops),
+                                         &(sync->high_water_mark)))) {
       lck_mtx_lock(osquery.mtx);
       goto error_exit;
     }
@@ -421,6 +445,8 @@ kern_return_t OsqueryStart(kmod_info_t *ki, void *d) {
 
   // Set up the IOCTL and kernel API locks (not queue locks).
   setup_locks();
+  // Set up the subscription filter table and locks.
+  osquery_filters_setup();
 
   return KERN_SUCCESS;
 error_exit:
@@ -472,6 +498,7 @@ kern_return_t OsqueryStop(kmod_info_t *ki, void *d) {
   // Deallocate the IOCTL and kernel API locks.
   lck_mtx_unlock(osquery.mtx);
   teardown_locks();
+  osquery_filters_teardown();
 
   return KERN_SUCCESS;
 }
@@ -12,30 +12,12 @@
 #include <sys/systm.h>
 #include <sys/kauth.h>
 #include <sys/vnode.h>
-#include <sys/queue.h>
-
-#include <libkern/OSMalloc.h>
-
-#define TAGNAME "com.facebook.security.osquery.file_events"
 
 #include "publishers.h"
 
 static osquery_cqueue_t *cqueue = NULL;
 static kauth_listener_t fileop_listener = NULL;
 
-typedef struct subscription {
-  osquery_file_event_subscription_t subscription;
-  size_t pathlen;
-  SLIST_ENTRY(subscription) next;
-} subscription_t;
-
-SLIST_HEAD(subscription_list, subscription);
-static struct subscription_list sub_list = SLIST_HEAD_INITIALIZER(sub_list);
-
-static osquery_file_action_t sub_actions = OSQUERY_FILE_ACTION_NONE;
-
-static OSMallocTag malloc_tag = NULL;
-
 static int fileop_scope_callback(kauth_cred_t credential,
                                  void *idata,
                                  kauth_action_t action,
@@ -56,16 +38,14 @@ static int fileop_scope_callback(kauth_cred_t credential,
 
   vnode_t vp = (vnode_t)arg0;
   char *path = (char *)arg1;
-  if (sub_actions & file_action && vp != NULL && path != NULL) {
-    int subscribed_to_event = 0;
-    subscription_t *sub = NULL;
-    SLIST_FOREACH(sub, &sub_list, next) {
-      if (sub->subscription.actions & file_action &&
-          strncmp(path, sub->subscription.path, sub->pathlen) == 0) {
-        subscribed_to_event = 1;
-        break;
-      }
-    }
+  if (file_action != OSQUERY_FILE_ACTION_NONE && vp != NULL && path != NULL) {
+    // Only queue events matching the daemon's subscription filters.
+    int subscribed_to_event =
+        osquery_filters_match(OSQUERY_FILE_EVENT,
+                              file_action,
+                              proc_selfpid(),
+                              kauth_cred_getruid(credential),
+                              path);
     if (subscribed_to_event) {
       // Someone is using a file in a way that we are subscribed to.
       int path_len = MAXPATHLEN;
@@ -131,51 +111,16 @@ static int fileop_scope_callback(kauth_cred_t credential,
 }
 
 static int subscribe(osquery_cqueue_t *queue) {
-  if (malloc_tag == NULL) {
-    malloc_tag = OSMalloc_Tagalloc(TAGNAME, OSMT_DEFAULT);
-    if (malloc_tag == NULL) {
-      return -1;
-    }
-  }
-
-  int err = 0;
-  subscription_t *sub = OSMalloc(sizeof(subscription_t), malloc_tag);
-  if (sub == NULL) {
-    return -1;
-  }
-
   cqueue = queue;
   if (fileop_listener == NULL) {
     fileop_listener =
         kauth_listen_scope(KAUTH_SCOPE_FILEOP, fileop_scope_callback, NULL);
   }
   if (fileop_listener == NULL) {
-    err = -1;
-    goto error_exit;
-  }
-
-  sub->pathlen = strnlen(sub->subscription.path, MAXPATHLEN);
-
-  // Check if we are already subscribed to this event.
-  subscription_t *sub_entry = NULL;
-  SLIST_FOREACH(sub_entry, &sub_list, next) {
-    if (sub_entry->subscription.actions == sub->subscription.actions &&
-        strncmp(sub_entry->subscription.path,
-                sub->subscription.path,
-                MAXPATHLEN) == 0) {
-      // Already subscribed.
-      err = 0;
-      goto error_exit;
-    }
+    return -1;
   }
 
-  sub_actions |= sub->subscription.actions;
-
-  SLIST_INSERT_HEAD(&sub_list, sub, next);
   return 0;
-error_exit:
-  OSFree(sub, sizeof(subscription_t), malloc_tag);
-  return err;
 }
 
 static void unsubscribe() {
@@ -183,19 +128,6 @@ static void unsubscribe() {
     kauth_unlisten_scope(fileop_listener);
     fileop_listener = NULL;
   }
-
-  while (!SLIST_EMPTY(&sub_list)) {
-    subscription_t *sub = SLIST_FIRST(&sub_list);
-    SLIST_REMOVE_HEAD(&sub_list, next);
-    OSFree(sub, sizeof(subscription_t), malloc_tag);
-  }
-
-  if (malloc_tag) {
-    OSMalloc_Tagfree(malloc_tag);
-    malloc_tag = NULL;
-  }
-
-  sub_actions = OSQUERY_FILE_ACTION_NONE;
 }
 
 osquery_kernel_event_publisher_t kernel_file_events_publisher = {
@@ -54,6 +54,22 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
     goto error_exit;
   }
 
+  // Only queue events matching the daemon's subscription filters.
+  // The path is only resolved before reserving if a filter inspects it.
+  char path[MAXPATHLEN];
+  char *filter_path = NULL;
+  if (osquery_filters_use_path(OSQUERY_PROCESS_EVENT) &&
+      vn_getpath(vp, path, &path_len) == 0) {
+    filter_path = path;
+  }
+  if (!osquery_filters_match(OSQUERY_PROCESS_EVENT,
+                             0,
+                             proc_pid(p),
+                             kauth_cred_getruid(new_cred),
+                             filter_path)) {
+    goto error_exit;
+  }
+
   // Determine address of image_params based off of csflags pointer. (HACKY)
   struct image_params *img =
       (struct image_params *)((char *)csflags -
@@ -129,7 +145,12 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
   e->gid = kauth_cred_getrgid(new_cred);
   e->egid = kauth_cred_getgid(new_cred);
 
-  vn_getpath(vp, e->path, &path_len);
+  if (filter_path != NULL) {
+    strlcpy(e->path, filter_path, MAXPATHLEN);
+  } else {
+    path_len = MAXPATHLEN;
+    vn_getpath(vp, e->path, &path_len);
+  }
 
   osquery_cqueue_commit(cqueue, e);
 error_exit:
@@ -21,6 +21,14 @@ struct InternalExtensionInfo {
   2:string version,
   3:string sdk_version,
   4:string min_sdk_version,
+  /// The extension serves table generate calls as typed columns.
+  5:bool columnar_tables = false,
+  /// The extension's server worker threads, 0 for one per connection.
+  6:i32 server_threads = 0,
+  /// The extension writes table responses to shared memory rings.
+  7:bool shared_tables = false,
+  /// The protocol the extension prefers to serve, "compact" or "binary".
+  8:string protocol = "",
 }
 
 /// Unique ID for each extension.
@@ -44,6 +52,8 @@ struct ExtensionStatus {
   2:string message,
   /// Add a thrift Status parameter identifying the request/response.
   3:ExtensionRouteUUID uuid,
+  /// The protocol an extension serves, set by registerExtension.
+  4:string protocol = "",
 }
 
 struct ExtensionResponse {
@@ -51,6 +61,53 @@ struct ExtensionResponse {
   2:ExtensionPluginResponse response,
 }
 
+/// The type of the values within an ExtensionColumn.
+enum ExtensionColumnType {
+  EXT_COLUMN_TEXT = 0,
+  EXT_COLUMN_INTEGER = 1,
+  EXT_COLUMN_DOUBLE = 2,
+}
+
+/// The values of one column for every row, only the typed list is set.
+struct ExtensionColumn {
+  1:ExtensionColumnType type,
+  2:list<string> text_values,
+  3:list<i64> integer_values,
+  4:list<double> double_values,
+}
+
+/// Generated table rows as a column header and a value vector per column.
+struct ExtensionTableResponse {
+  1:ExtensionStatus status,
+  2:list<string> columns,
+  3:list<ExtensionColumn> values,
+  4:i64 rows,
+}
+
+/// A serialized ExtensionTableResponse within a shared memory ring.
+struct ExtensionSegment {
+  1:i64 offset,
+  2:i64 length,
+}
+
+/// Batches of table rows written to a shared memory ring.
+struct ExtensionSharedResponse {
+  1:ExtensionStatus status,
+  2:list<ExtensionSegment> segments,
+  /// Call nextShared with the cursor, after reading the segments, until done.
+  3:i64 cursor,
+  4:bool done,
+}
+
+/// Rows of an open query, see openQuery.
+struct ExtensionQueryResponse {
+  1:ExtensionStatus status,
+  2:ExtensionPluginResponse response,
+  /// Call fetchQuery with the cursor until done, or closeQuery to stop.
+  3:i64 cursor,
+  4:bool done,
+}
+
 exception ExtensionException {
   1:i32 code,
   2:string message,
@@ -68,6 +125,25 @@ service Extension {
     2:string item,
     /// The thrift-equivilent of an osquery::PluginRequest.
     3:ExtensionPluginRequest request),
+  /// Generate a table plugin's rows as typed columns, see columnar_tables.
+  ExtensionTableResponse generate(
+    /// The table plugin name.
+    1:string item,
+    /// The thrift-equivilent of the table's osquery::PluginRequest.
+    2:ExtensionPluginRequest request),
+  /// Generate a table plugin's rows into a shared memory ring.
+  ExtensionSharedResponse generateShared(
+    /// The table plugin name.
+    1:string item,
+    /// The thrift-equivilent of the table's osquery::PluginRequest.
+    2:ExtensionPluginRequest request,
+    /// The name of the shared memory object created by the caller.
+    3:string ring,
+    /// The size of the shared memory object in bytes.
+    4:i64 size),
+  /// Write the next rows of a shared response, the ring is free to reuse.
+  ExtensionSharedResponse nextShared(
+    1:i64 cursor),
 }
 
 /// The extension manager is run by the osquery core process.
@@ -91,4 +167,19 @@ service ExtensionManager extends Extension {
   ExtensionResponse getQueryColumns(
     1:string sql,
   ),
+  /// Open a cursor for an SQL query, returning up to its first rows.
+  ExtensionQueryResponse openQuery(
+    1:string sql,
+    /// The most rows returned, 0 for the default batch.
+    2:i64 rows,
+  ),
+  /// Return up to the next rows of an open query cursor.
+  ExtensionQueryResponse fetchQuery(
+    1:i64 cursor,
+    2:i64 rows,
+  ),
+  /// Close a query cursor before its last rows are fetched.
+  ExtensionStatus closeQuery(
+    1:i64 cursor,
+  ),
 }
@@ -27,6 +27,10 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+#include "osquery/database/query.h"
+#include "osquery/database/view.h"
+#include "osquery/dispatcher/dispatcher.h"
 
 namespace pt = boost::property_tree;
 
@@ -42,6 +46,11 @@ CLI_FLAG(bool,
 
 CLI_FLAG(bool, config_dump, false, "Dump the contents of the configuration");
 
+CLI_FLAG(bool,
+         config_enable_backup,
+         false,
+         "Start from the last valid config while the config plugin loads");
+
 DECLARE_string(config_plugin);
 DECLARE_string(pack_delimiter);
 DECLARE_bool(disable_events);
@@ -56,6 +65,20 @@ DECLARE_bool(disable_events);
 const std::string kExecutingQuery = "executing_query";
 const std::string kFailedQueries = "failed_queries";
 
+/**
+ * @brief The backing store key prefix for each source's last valid config.
+ *
+ * Each value holds the hash of the content as the config plugin generated it
+ * and the parsed content, the source name follows the prefix.
+ */
+const std::string kConfigBackup = "config_backup.";
+
+/// Load the config plugin's content after starting from the config backup.
+class ConfigLoadRunner : public InternalRunnable {
+ public:
+  void start() override;
+};
+
 // The config may be accessed and updated asynchronously; use mutexes.
 boost::shared_mutex config_schedule_mutex_;
 boost::shared_mutex config_performance_mutex_;
@@ -117,9 +140,13 @@ class Schedule : private boost::noncopyable {
   }
 
   /// Remove all packs by source.
-  void removeAll(const std::string& source) {
-    packs_.remove_if(([source](PackRef& p) {
-      if (p->getSource() == source) {
+  void removeAll(const std::string& source) { removeAll(source, {}); }
+
+  /// Remove all packs by source, except those named in keep.
+  void removeAll(const std::string& source,
+                 const std::set<std::string>& keep) {
+    packs_.remove_if(([&source, &keep](PackRef& p) {
+      if (p->getSource() == source && keep.count(p->getName()) == 0) {
         Config::getInstance().removeFiles(source + FLAGS_pack_delimiter +
                                           p->getName());
         return true;
@@ -136,6 +163,23 @@ class Schedule : private boost::noncopyable {
 
   PackRef& last() { return packs_.back(); }
 
+  /**
+   * @brief Check if a query name is blacklisted.
+   *
+   * An expired blacklist entry is removed and the blacklist is saved.
+   */
+  bool blacklisted(const std::string& name);
+
+  /// Check if a pack from a source is in the schedule.
+  bool exists(const std::string& pack, const std::string& source) const {
+    for (const auto& p : packs_) {
+      if (p->getName() == pack && p->getSource() == source) {
+        return true;
+      }
+    }
+    return false;
+  }
+
  private:
   /// Underlying storage for the packs
   container packs_;
@@ -192,6 +236,21 @@ void saveScheduleBlacklist(const std::map<std::string, size_t>& blacklist) {
   setDatabaseValue(kPersistentSettings, kFailedQueries, content);
 }
 
+bool Schedule::blacklisted(const std::string& name) {
+  auto blacklisted_query = blacklist_.find(name);
+  if (blacklisted_query == blacklist_.end()) {
+    return false;
+  }
+  if (getUnixTime() > blacklisted_query->second) {
+    // The blacklisted query passed the expiration time (remove).
+    blacklist_.erase(blacklisted_query);
+    saveScheduleBlacklist(blacklist_);
+    return false;
+  }
+  // The query is still blacklisted.
+  return true;
+}
+
 Schedule::Schedule() {
   if (Registry::external()) {
     // Extensions should not restore or save schedule details.
@@ -220,6 +279,7 @@ void Config::addPack(const std::string& name,
                      const std::string& source,
                      const pt::ptree& tree) {
   WriteLock wlock(config_schedule_mutex_);
+  schedule_generation_++;
   try {
     schedule_->add(std::make_shared<Pack>(name, source, tree));
     if (schedule_->last()->shouldPackExecute()) {
@@ -230,8 +290,44 @@ void Config::addPack(const std::string& name,
   }
 }
 
+void Config::updatePack(const std::string& name,
+                        const std::string& source,
+                        const pt::ptree& tree) {
+  auto key = source + FLAGS_pack_delimiter + name;
+  auto hash = hashTree(tree);
+  {
+    ReadLock rlock(config_schedule_mutex_);
+    ReadLock hlock(config_hash_mutex_);
+    auto previous = pack_hash_.find(key);
+    if (previous != pack_hash_.end() && previous->second == hash &&
+        schedule_->exists(name, source)) {
+      // The pack's queries, discovery and file paths are unchanged.
+      return;
+    }
+  }
+
+  addPack(name, source, tree);
+  WriteLock hlock(config_hash_mutex_);
+  pack_hash_[key] = hash;
+}
+
 void Config::removePack(const std::string& pack) {
+  {
+    WriteLock hlock(config_hash_mutex_);
+    for (auto it = pack_hash_.begin(); it != pack_hash_.end();) {
+      auto delimiter = it->first.rfind(FLAGS_pack_delimiter);
+      if (delimiter != std::string::npos &&
+          it->first.substr(delimiter + FLAGS_pack_delimiter.size()) == pack) {
+        parser_hash_.erase(it->first);
+        it = pack_hash_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
   WriteLock wlock(config_schedule_mutex_);
+  schedule_generation_++;
   return schedule_->remove(pack);
 }
 
@@ -249,28 +345,37 @@ void Config::removeFiles(const std::string& source) {
   }
 }
 
+/// Run the distinct discovery queries of every pack together.
+static void refreshScheduleDiscovery(const std::list<PackRef>& packs) {
+  std::vector<std::string> discovery;
+  for (const auto& pack : packs) {
+    const auto& queries = pack->getDiscoveryQueries();
+    discovery.insert(discovery.end(), queries.begin(), queries.end());
+  }
+  Pack::refreshDiscovery(discovery);
+}
+
+/// The scheduled name of a pack's query, synthetic for non-main packs.
+static std::string getScheduledName(const Pack& pack,
+                                    const std::string& query) {
+  if (pack.getName() != "main" && pack.getName() != "legacy_main") {
+    return "pack" + FLAGS_pack_delimiter + pack.getName() +
+           FLAGS_pack_delimiter + query;
+  }
+  return query;
+}
+
 void Config::scheduledQueries(std::function<
     void(const std::string& name, const ScheduledQuery& query)> predicate) {
   ReadLock rlock(config_schedule_mutex_);
+  refreshScheduleDiscovery(schedule_->packs_);
+
   for (const PackRef& pack : *schedule_) {
     for (const auto& it : pack->getSchedule()) {
-      std::string name = it.first;
-      // The query name may be synthetic.
-      if (pack->getName() != "main" && pack->getName() != "legacy_main") {
-        name = "pack" + FLAGS_pack_delimiter + pack->getName() +
-               FLAGS_pack_delimiter + it.first;
-      }
+      auto name = getScheduledName(*pack, it.first);
       // They query may have failed and been added to the schedule's blacklist.
-      if (schedule_->blacklist_.count(name) > 0) {
-        auto blacklisted_query = schedule_->blacklist_.find(name);
-        if (getUnixTime() > blacklisted_query->second) {
-          // The blacklisted query passed the expiration time (remove).
-          schedule_->blacklist_.erase(blacklisted_query);
-          saveScheduleBlacklist(schedule_->blacklist_);
-        } else {
-          // The query is still blacklisted.
-          continue;
-        }
+      if (schedule_->blacklisted(name)) {
+        continue;
       }
       // Call the predicate.
       predicate(name, it.second);
@@ -278,6 +383,29 @@ void Config::scheduledQueries(std::function<
   }
 }
 
+void Config::compileSchedule(std::vector<ScheduleEntry>& entries) {
+  ReadLock rlock(config_schedule_mutex_);
+  for (const auto& pack : schedule_->packs_) {
+    for (const auto& it : pack->getSchedule()) {
+      ScheduleEntry entry;
+      entry.name = getScheduledName(*pack, it.first);
+      entry.query = it.second;
+      entry.pack = pack;
+      entries.push_back(std::move(entry));
+    }
+  }
+}
+
+void Config::refreshDiscovery() {
+  ReadLock rlock(config_schedule_mutex_);
+  refreshScheduleDiscovery(schedule_->packs_);
+}
+
+bool Config::isScheduled(const ScheduleEntry& entry) {
+  ReadLock rlock(config_schedule_mutex_);
+  return entry.pack->shouldPackExecute() && !schedule_->blacklisted(entry.name);
+}
+
 void Config::packs(std::function<void(PackRef& pack)> predicate) {
   ReadLock rlock(config_schedule_mutex_);
   for (PackRef& pack : schedule_->packs_) {
@@ -292,6 +420,20 @@ Status Config::load() {
     return Status(1, "Missing config plugin " + config_plugin);
   }
 
+  if (FLAGS_config_enable_backup && !FLAGS_config_check && !FLAGS_config_dump &&
+      !loaded_ && !Registry::external()) {
+    // The schedule starts from the last valid config, the config plugin's
+    // content is applied once it arrives.
+    auto status = restoreBackup();
+    if (status.ok()) {
+      valid_ = true;
+      loaded_ = true;
+      Dispatcher::addService(std::make_shared<ConfigLoadRunner>());
+      return status;
+    }
+    VLOG(1) << "Cannot start from the config backup: " << status.getMessage();
+  }
+
   PluginResponse response;
   auto status = Registry::call("config", {{"action", "genConfig"}}, response);
   if (!status.ok()) {
@@ -341,34 +483,163 @@ inline void stripConfigComments(std::string& json) {
   json = sink;
 }
 
+std::string Config::hashTree(const pt::ptree& tree) {
+  std::stringstream stream;
+  try {
+    pt::write_json(stream, tree, false);
+  } catch (const pt::json_parser::json_parser_error& e) {
+    // An unserializable tree is never considered unchanged.
+    return "";
+  }
+  auto content = stream.str();
+  return hashFromBuffer(HASH_TYPE_MD5, content.data(), content.size());
+}
+
+void Config::forgetPacks(const std::string& source,
+                         const std::set<std::string>& keep) {
+  WriteLock hlock(config_hash_mutex_);
+  auto prefix = source + FLAGS_pack_delimiter;
+  for (auto it = pack_hash_.begin(); it != pack_hash_.end();) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0 &&
+        keep.count(it->first.substr(prefix.size())) == 0) {
+      parser_hash_.erase(it->first);
+      it = pack_hash_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+Status Config::restoreBackup() {
+  std::vector<std::pair<std::string, std::string>> backups;
+  scanDatabasePrefix(kPersistentSettings, backups, kConfigBackup);
+  if (backups.empty()) {
+    return Status(1, "No config backup");
+  }
+
+  std::vector<std::pair<std::string, pt::ptree>> sources;
+  for (const auto& backup : backups) {
+    pt::ptree tree;
+    if (!parseJSONTree(backup.second, tree).ok()) {
+      return Status(1, "Cannot parse the config backup");
+    }
+    sources.push_back(
+        std::make_pair(backup.first.substr(kConfigBackup.size()), tree));
+  }
+
+  purge();
+  for (const auto& source : sources) {
+    auto config = source.second.get_child_optional("config");
+    if (!config) {
+      return Status(1, "Invalid config backup for " + source.first);
+    }
+    auto status = applySource(source.first, *config);
+    if (!status.ok()) {
+      return status;
+    }
+
+    // The hash of the generated content recognizes it unchanged once the
+    // config plugin loads it again.
+    WriteLock hlock(config_hash_mutex_);
+    hash_[source.first] = source.second.get<std::string>("hash", "");
+  }
+
+  resetHostIdentifier();
+  return Status(0, "OK");
+}
+
+void Config::backupSource(const std::string& source,
+                          const pt::ptree& tree) {
+  pt::ptree backup;
+  {
+    ReadLock hlock(config_hash_mutex_);
+    auto hash = hash_.find(source);
+    backup.put("hash", (hash != hash_.end()) ? hash->second : "");
+  }
+  backup.add_child("config", tree);
+
+  std::stringstream stream;
+  try {
+    pt::write_json(stream, backup, false);
+  } catch (const pt::json_parser::json_parser_error& e) {
+    LOG(WARNING) << "Cannot serialize the config backup for " << source;
+    return;
+  }
+  setDatabaseValue(kPersistentSettings, kConfigBackup + source, stream.str());
+}
+
 Status Config::updateSource(const std::string& source,
                             const std::string& json) {
   // Compute a 'synthesized' hash using the content before it is parsed.
   hashSource(source, json);
 
-  // Remove all packs from this source.
-  schedule_->removeAll(source);
-  // Remove all files from this source.
-  removeFiles(source);
-
   // load the config (source.second) into a pt::ptree
   pt::ptree tree;
-  try {
-    auto clone = json;
-    stripConfigComments(clone);
-    std::stringstream json_stream;
-    json_stream << clone;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
+  auto clone = json;
+  stripConfigComments(clone);
+  if (!parseJSONTree(clone, tree).ok()) {
+    // Remove all packs and files from this source.
+    {
+      WriteLock wlock(config_schedule_mutex_);
+      schedule_generation_++;
+      schedule_->removeAll(source);
+    }
+    removeFiles(source);
+    forgetPacks(source, {});
+
+    // Invalid content is parsed again, and fails again, when refreshed.
+    WriteLock hlock(config_hash_mutex_);
+    hash_.erase(source);
+    parser_hash_.erase(source);
     return Status(1, "Error parsing the config JSON");
   }
 
+  if (!FLAGS_config_enable_backup || Registry::external()) {
+    return applySource(source, tree);
+  }
+
+  // Only content that parsed and applied replaces the backup.
+  auto backup = tree;
+  auto status = applySource(source, tree, &backup);
+  if (status.ok()) {
+    backupSource(source, backup);
+  }
+  return status;
+}
+
+Status Config::applySource(const std::string& source,
+                           const pt::ptree& tree,
+                           pt::ptree* backup) {
+  // Packs named by this content are kept if their content is unchanged.
+  std::set<std::string> packs;
+  if (!Registry::external()) {
+    if (tree.count("schedule") > 0) {
+      packs.insert("main");
+    }
+    if (tree.count("scheduledQueries") > 0) {
+      packs.insert("legacy_main");
+    }
+    if (tree.count("packs") > 0) {
+      for (const auto& pack : tree.get_child("packs")) {
+        packs.insert(pack.first);
+      }
+    }
+  }
+
+  // Remove the packs from this source that are no longer configured.
+  {
+    WriteLock wlock(config_schedule_mutex_);
+    schedule_generation_++;
+    schedule_->removeAll(source, packs);
+  }
+  forgetPacks(source, packs);
+
   // extract the "schedule" key and store it as the main pack
   if (tree.count("schedule") > 0 && !Registry::external()) {
     auto& schedule = tree.get_child("schedule");
     pt::ptree main_pack;
     main_pack.add_child("queries", schedule);
-    addPack("main", source, main_pack);
+    updatePack("main", source, main_pack);
   }
 
   if (tree.count("scheduledQueries") > 0 && !Registry::external()) {
@@ -383,7 +654,7 @@ Status Config::updateSource(const std::string& source,
     }
     pt::ptree legacy_pack;
     legacy_pack.add_child("queries", queries);
-    addPack("legacy_main", source, legacy_pack);
+    updatePack("legacy_main", source, legacy_pack);
   }
 
   // extract the "packs" key into additional pack objects
@@ -393,9 +664,15 @@ Status Config::updateSource(const std::string& source,
       auto value = packs.get<std::string>(pack.first, "");
       if (value.empty()) {
         // The pack is a JSON object, treat the content as pack data.
-        addPack(pack.first, source, pack.second);
+        updatePack(pack.first, source, pack.second);
       } else {
-        genPack(pack.first, source, value);
+        pt::ptree content;
+        genPack(pack.first, source, value, &content);
+        if (backup != nullptr && !content.empty()) {
+          // The backup holds the resource's content instead of its name.
+          backup->get_child("packs").put_child(
+              pt::ptree::path_type(pack.first, '\0'), content);
+        }
       }
     }
   }
@@ -406,7 +683,8 @@ Status Config::updateSource(const std::string& source,
 
 Status Config::genPack(const std::string& name,
                        const std::string& source,
-                       const std::string& target) {
+                       const std::string& target,
+                       pt::ptree* content) {
   // If the pack value is a string (and not a JSON object) then it is a
   // resource to be handled by the config plugin.
   PluginResponse response;
@@ -418,14 +696,15 @@ Status Config::genPack(const std::string& name,
     return Status(1, "Invalid plugin response");
   }
 
-  try {
-    pt::ptree pack_tree;
-    std::stringstream pack_stream;
-    pack_stream << response[0][name];
-    pt::read_json(pack_stream, pack_tree);
-    addPack(name, source, pack_tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
+  pt::ptree pack_tree;
+  if (!parseJSONTree(response[0][name], pack_tree).ok()) {
     LOG(WARNING) << "Error parsing the pack JSON: " << name;
+    return Status(0);
+  }
+
+  updatePack(name, source, pack_tree);
+  if (content != nullptr) {
+    *content = std::move(pack_tree);
   }
   return Status(0);
 }
@@ -454,10 +733,31 @@ void Config::applyParsers(const std::string& source,
         parser_config[key] = pt::ptree();
       }
     }
+    // Top-level keys are only applied when their content changed. Pack
+    // content is only applied when the pack itself changed.
+    std::string hash;
+    if (!pack) {
+      for (const auto& key : parser_config) {
+        hash += hashTree(key.second);
+      }
+
+      ReadLock hlock(config_hash_mutex_);
+      auto hashes = parser_hash_.find(source);
+      if (hashes != parser_hash_.end() &&
+          hashes->second.count(plugin.first) > 0 &&
+          hashes->second.at(plugin.first) == hash) {
+        continue;
+      }
+    }
+
     // The config parser plugin will receive a copy of each property tree for
     // each top-level-config key. The parser may choose to update the config's
     // internal state
     parser->update(source, parser_config);
+    if (!pack) {
+      WriteLock hlock(config_hash_mutex_);
+      parser_hash_[source][plugin.first] = hash;
+    }
   }
 }
 
@@ -479,19 +779,41 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
+  // Only sources with changed content are applied, a refresh of the same
+  // content does not purge, rebuild packs, or reconfigure plugins.
+  std::vector<std::pair<std::string, std::string>> changed;
+  {
+    ReadLock rlock(config_hash_mutex_);
+    for (const auto& source : config) {
+      auto hash = hashFromBuffer(
+          HASH_TYPE_MD5, source.second.data(), source.second.size());
+      auto previous = hash_.find(source.first);
+      if (previous == hash_.end() || previous->second != hash) {
+        changed.push_back(source);
+      }
+    }
+  }
+
+  if (changed.empty()) {
+    return Status(0, "OK");
+  }
+
   // Iterate though each source and overwrite config data.
   // This will add/overwrite pack data, append to the schedule, change watched
   // files, set options, etc.
   // Before this occurs, take an opportunity to purge stale state.
   purge();
 
-  for (const auto& source : config) {
+  for (const auto& source : changed) {
     auto status = updateSource(source.first, source.second);
     if (!status.ok()) {
       return status;
     }
   }
 
+  // Options may have changed the host identifier, or how it is chosen.
+  resetHostIdentifier();
+
   if (loaded_) {
     // The config has since been loaded.
     // This update call is most likely a response to an async update request
@@ -516,8 +838,7 @@ Status Config::update(const std::map<std::string, std::string>& config) {
 
 void Config::purge() {
   // The first use of purge is removing expired query results.
-  std::vector<std::string> saved_queries;
-  scanDatabaseKeys(kQueries, saved_queries);
+  auto saved_queries = Query::getStoredQueryNames();
 
   const auto& schedule = this->schedule_;
   auto queryExists = [&schedule](const std::string& query_name) {
@@ -560,9 +881,11 @@ void Config::purge() {
 
     if (last_executed < getUnixTime() - 592200) {
       // Query has not run in the last week, expire results and interval.
-      deleteDatabaseValue(kQueries, saved_query);
+      Query(saved_query, ScheduledQuery()).removePreviousQueryResults();
       deleteDatabaseValue(kPersistentSettings, "interval." + saved_query);
       deleteDatabaseValue(kPersistentSettings, "timestamp." + saved_query);
+      deleteDatabaseValue(kPersistentSettings, "snapshot." + saved_query);
+      IncrementalView::remove(saved_query);
       VLOG(1) << "Expiring results for scheduled query: " << saved_query;
     }
   }
@@ -570,19 +893,20 @@ void Config::purge() {
 
 void Config::reset() {
   schedule_ = std::make_shared<Schedule>();
+  schedule_generation_++;
   std::map<std::string, QueryPerformance>().swap(performance_);
   std::map<std::string, FileCategories>().swap(files_);
   std::map<std::string, std::string>().swap(hash_);
+  std::map<std::string, std::string>().swap(pack_hash_);
+  std::map<std::string, std::map<std::string, std::string> >().swap(
+      parser_hash_);
   valid_ = false;
   loaded_ = false;
   start_time_ = 0;
 }
 
 void Config::recordQueryPerformance(const std::string& name,
-                                    size_t delay,
-                                    size_t size,
-                                    const Row& r0,
-                                    const Row& r1) {
+                                    const QueryPerformance& sample) {
   WriteLock wlock(config_performance_mutex_);
   if (performance_.count(name) == 0) {
     performance_[name] = QueryPerformance();
@@ -590,36 +914,25 @@ void Config::recordQueryPerformance(const std::string& name,
 
   // Grab access to the non-const schedule item.
   auto& query = performance_.at(name);
-  BIGINT_LITERAL diff = 0;
-  if (!r1.at("user_time").empty() && !r0.at("user_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("user_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("user_time"));
-    if (diff > 0) {
-      query.user_time += diff;
-    }
+  query.user_time += sample.user_time;
+  query.system_time += sample.system_time;
+  if (sample.average_memory > 0) {
+    // Memory is stored as an average of RSS changes between query executions.
+    query.average_memory =
+        (query.average_memory * query.executions) + sample.average_memory;
+    query.average_memory = (query.average_memory / (query.executions + 1));
   }
 
-  if (!r1.at("system_time").empty() && !r0.at("system_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("system_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("system_time"));
-    if (diff > 0) {
-      query.system_time += diff;
-    }
-  }
-
-  if (!r1.at("resident_size").empty() && !r0.at("resident_size").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("resident_size")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("resident_size"));
-    if (diff > 0) {
-      // Memory is stored as an average of RSS changes between query executions.
-      query.average_memory = (query.average_memory * query.executions) + diff;
-      query.average_memory = (query.average_memory / (query.executions + 1));
-    }
-  }
-
-  query.wall_time += delay;
-  query.output_size += size;
+  query.wall_time += sample.wall_time;
+  query.wall_time_ms += sample.wall_time_ms;
+  query.output_size += sample.output_size;
+  query.output_rows += sample.output_rows;
   query.executions += 1;
+
+  // Totals hide the spikes of an expensive execution.
+  query.wall_times.record(sample.wall_time_ms);
+  query.cpu_times.record(sample.user_time + sample.system_time);
+  query.output_sizes.record(sample.output_size);
   query.last_executed = getUnixTime();
 
   // Clear the executing query (remove the dirty bit).
@@ -689,6 +1002,24 @@ const std::shared_ptr<ConfigParserPlugin> Config::getParser(
   return config_parser;
 }
 
+void ConfigLoadRunner::start() {
+  PluginResponse response;
+  auto status = Registry::call("config", {{"action", "genConfig"}}, response);
+  if (!status.ok()) {
+    LOG(WARNING) << "Error reading config, using the config backup: "
+                 << status.toString();
+    return;
+  }
+
+  if (response.size() > 0) {
+    status = Config::getInstance().update(response[0]);
+    if (!status.ok()) {
+      LOG(WARNING) << "Error applying config, using the config backup: "
+                   << status.toString();
+    }
+  }
+}
+
 void Config::files(
     std::function<void(const std::string& category,
                        const std::vector<std::string>& files)> predicate) {
@@ -9,8 +9,10 @@
  */
 
 #include <algorithm>
+#include <mutex>
 #include <random>
 
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/core.h>
@@ -20,6 +22,7 @@
 #include <osquery/sql.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/dispatcher/executor.h"
 
 namespace pt = boost::property_tree;
 
@@ -30,6 +33,16 @@ FLAG(uint64,
      3600,
      "Cache expiration for a packs discovery queries");
 
+FLAG(uint64,
+     pack_refresh_event_interval,
+     60,
+     "Minimum seconds between event triggered discovery query refreshes");
+
+FLAG(uint64,
+     pack_discovery_threads,
+     4,
+     "Threads running distinct pack discovery queries");
+
 FLAG(string, pack_delimiter, "_", "Delimiter for pack and query names");
 
 FLAG(uint64, schedule_splay_percent, 10, "Percent to splay config times");
@@ -39,6 +52,12 @@ FLAG(uint64,
      3600,
      "Query interval to use if none is provided");
 
+/// Protect the shared discovery results.
+static std::mutex kDiscoveryMutex;
+
+/// Incremented when a shared discovery result changes.
+static std::atomic<size_t> kDiscoveryGeneration{1};
+
 size_t splayValue(size_t original, size_t splayPercent) {
   if (splayPercent == 0 || splayPercent > 100) {
     return original;
@@ -78,6 +97,43 @@ size_t getMachineShard(const std::string& hostname = "", bool force = false) {
   return shard;
 }
 
+/// Hosts are sampled in steps of 0.01 percent.
+const size_t kSampleBuckets = 10000;
+
+/// A stable hash of the host identifier and a pack or query name.
+static unsigned long long getHostHash(const std::string& name,
+                                      const std::string& identifier) {
+  auto input = ((identifier.empty()) ? getHostIdentifier() : identifier) +
+               "." + name;
+  auto hash = hashFromBuffer(HASH_TYPE_MD5, input.c_str(), input.size());
+  long long value = 0;
+  if (hash.size() >= 15) {
+    safeStrtoll(hash.substr(0, 15), 16, value);
+  }
+  return static_cast<unsigned long long>(value);
+}
+
+bool isHostSampled(double percent,
+                   const std::string& name,
+                   const std::string& identifier = "") {
+  if (percent <= 0 || percent >= 100) {
+    return true;
+  }
+  // Each name samples a different set of hosts.
+  auto bucket = getHostHash(name, identifier) % kSampleBuckets;
+  return bucket < static_cast<size_t>(percent * kSampleBuckets / 100);
+}
+
+size_t getHostOffset(const std::string& name,
+                     size_t interval,
+                     const std::string& identifier = "") {
+  if (interval <= 1) {
+    return 0;
+  }
+  // The offset is independent of the sampling of the same name.
+  return getHostHash(name + ".spread", identifier) % interval;
+}
+
 size_t restoreSplayedValue(const std::string& name, size_t interval) {
   // Attempt to restore a previously-calculated splay.
   std::string content;
@@ -114,6 +170,9 @@ void Pack::initialize(const std::string& name,
     shard_ = tree.get<size_t>("shard", 0);
   }
 
+  // Check the sample, a deterministic percent of hosts use the pack.
+  sample_ = tree.get<double>("sample", 0);
+
   // Check for a platform restriction.
   platform_.clear();
   if (tree.count("platform") > 0) {
@@ -130,10 +189,13 @@ void Pack::initialize(const std::string& name,
   // It is important to set each value such that the packs meta-table can report
   // each of the restrictions.
   if ((shard_ > 0 && shard_ < getMachineShard()) || !checkPlatform() ||
-      !checkVersion()) {
+      !checkVersion() || !isHostSampled(sample_, name_)) {
     return;
   }
 
+  // Spread the queries of the pack over their intervals across hosts.
+  auto spread = tree.get<bool>("spread", false);
+
   discovery_queries_.clear();
   if (tree.count("discovery") > 0) {
     for (const auto& item : tree.get_child("discovery")) {
@@ -165,6 +227,11 @@ void Pack::initialize(const std::string& name,
       }
     }
 
+    if (!isHostSampled(
+            q.second.get<double>("sample", 0), name_ + "." + q.first)) {
+      continue;
+    }
+
     if (q.second.count("platform")) {
       if (!checkPlatform(q.second.get<std::string>("platform", ""))) {
         continue;
@@ -190,6 +257,30 @@ void Pack::initialize(const std::string& name,
     query.splayed_interval = restoreSplayedValue(q.first, query.interval);
     query.options["snapshot"] = q.second.get<bool>("snapshot", false);
     query.options["removed"] = q.second.get<bool>("removed", true);
+    query.options["incremental"] = q.second.get<bool>("incremental", false);
+    if (q.second.count("append")) {
+      // Without the option, event subscriber queries are detected.
+      query.options["append"] = q.second.get<bool>("append", false);
+    }
+    query.window = q.second.get<size_t>("window", 0);
+    query.priority = q.second.get<std::string>("priority", "");
+    // The read rate is configured in KB per second.
+    query.read_rate = q.second.get<size_t>("read_rate", 0) * 1024;
+    query.full_interval = q.second.get<size_t>("full_interval", 0);
+    query.sample_rate = q.second.get<double>("sample", 1.0);
+    if (query.sample_rate <= 0 || query.sample_rate > 1) {
+      VLOG(1) << "Query has invalid sample rate: " << q.first;
+      query.sample_rate = 1.0;
+    }
+    query.max_cpu_time = q.second.get<size_t>("max_cpu_time", 0);
+    query.max_memory = q.second.get<size_t>("max_memory", 0);
+    query.deadline = q.second.get<size_t>("deadline", 0);
+    query.max_rows = q.second.get<size_t>("max_rows", 0);
+    query.options["spread"] = q.second.get<bool>("spread", spread);
+    if (query.options["spread"]) {
+      query.offset =
+          getHostOffset(name_ + "." + q.first, query.splayed_interval);
+    }
     schedule_[q.first] = query;
   }
 }
@@ -270,27 +361,103 @@ bool Pack::checkVersion(const std::string& version) const {
 bool Pack::checkDiscovery() {
   stats_.total++;
   size_t current = osquery::getUnixTime();
-  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
+  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval &&
+      discovery_generation_ == kDiscoveryGeneration) {
     stats_.hits++;
     return discovery_cache_.second;
   }
 
   stats_.misses++;
+  refreshDiscovery(discovery_queries_);
+
   discovery_cache_.first = current;
   discovery_cache_.second = true;
+  std::lock_guard<std::mutex> lock(kDiscoveryMutex);
+  discovery_generation_ = kDiscoveryGeneration;
+  const auto& results = discoveryResults();
   for (const auto& q : discovery_queries_) {
-    auto sql = SQL(q);
-    if (!sql.ok()) {
-      LOG(WARNING) << "Discovery query failed (" << q
-                   << "): " << sql.getMessageString();
-      discovery_cache_.second = false;
-      break;
-    }
-    if (sql.rows().size() == 0) {
+    auto result = results.find(q);
+    if (result == results.end() || !result->second.result) {
       discovery_cache_.second = false;
       break;
     }
   }
   return discovery_cache_.second;
 }
+
+std::map<std::string, Pack::DiscoveryResult>& Pack::discoveryResults() {
+  static std::map<std::string, DiscoveryResult> results;
+  return results;
+}
+
+bool Pack::isStale(const DiscoveryResult& result, size_t current) {
+  if (result.time == 0 || current < result.time) {
+    return true;
+  }
+  auto age = current - result.time;
+  return (age >= FLAGS_pack_refresh_interval ||
+          (result.invalidated && age >= FLAGS_pack_refresh_event_interval));
+}
+
+static bool runDiscoveryQuery(const std::string& query) {
+  auto sql = SQL(query);
+  if (!sql.ok()) {
+    LOG(WARNING) << "Discovery query failed (" << query
+                 << "): " << sql.getMessageString();
+    return false;
+  }
+  return (sql.rows().size() > 0);
+}
+
+void Pack::refreshDiscovery(const std::vector<std::string>& queries) {
+  size_t current = osquery::getUnixTime();
+  std::vector<std::string> stale;
+  {
+    std::lock_guard<std::mutex> lock(kDiscoveryMutex);
+    auto& results = discoveryResults();
+    for (const auto& q : queries) {
+      if (isStale(results[q], current) &&
+          std::find(stale.begin(), stale.end(), q) == stale.end()) {
+        stale.push_back(q);
+      }
+    }
+  }
+
+  if (stale.empty()) {
+    return;
+  }
+
+  // This thread runs queries alongside the workers.
+  std::vector<char> passed(stale.size(), false);
+  parallelFor(stale.size(),
+              FLAGS_pack_discovery_threads,
+              [&stale, &passed](size_t i) {
+                passed[i] = runDiscoveryQuery(stale[i]);
+              });
+
+  std::lock_guard<std::mutex> lock(kDiscoveryMutex);
+  auto& results = discoveryResults();
+  for (size_t i = 0; i < stale.size(); i++) {
+    auto& result = results[stale[i]];
+    if (result.time > 0 && result.result != static_cast<bool>(passed[i])) {
+      // Packs using this query check their discovery again.
+      kDiscoveryGeneration++;
+    }
+    result.time = current;
+    result.result = passed[i];
+    result.invalidated = false;
+  }
+}
+
+void Pack::invalidateDiscovery(const std::string& table) {
+  auto name = boost::algorithm::to_lower_copy(table);
+  std::lock_guard<std::mutex> lock(kDiscoveryMutex);
+  for (auto& result : discoveryResults()) {
+    if (!result.second.invalidated &&
+        boost::algorithm::to_lower_copy(result.first).find(name) !=
+            std::string::npos) {
+      result.second.invalidated = true;
+    }
+  }
+}
 }
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/logger.h>
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/**
+ * @brief A ConfigParserPlugin for a "database_compact" list of domains.
+ *
+ * The listed backing-store domains are compacted in the scheduler's next idle
+ * window. Parsers are only updated when their keys change, so changing the
+ * list, or its first appearance, requests one compaction.
+ */
+class DatabaseCompactConfigParserPlugin : public ConfigParserPlugin {
+ public:
+  std::vector<std::string> keys() const override {
+    return {"database_compact"};
+  }
+
+  Status update(const std::string& source, const ParserConfig& config) override;
+};
+
+Status DatabaseCompactConfigParserPlugin::update(const std::string& source,
+                                                 const ParserConfig& config) {
+  if (config.count("database_compact") == 0) {
+    return Status(0, "OK");
+  }
+
+  // The domains are a list, or a single domain as a string.
+  const auto& node = config.at("database_compact");
+  std::vector<std::string> domains;
+  for (const auto& domain : node) {
+    domains.push_back(domain.second.data());
+  }
+  if (node.empty() && !node.data().empty()) {
+    domains.push_back(node.data());
+  }
+
+  for (const auto& domain : domains) {
+    auto status = requestDatabaseCompaction(domain);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot compact: " << status.getMessage();
+    }
+  }
+  return Status(0, "OK");
+}
+
+REGISTER_INTERNAL(DatabaseCompactConfigParserPlugin,
+                  "config_parser",
+                  "database_compact");
+}
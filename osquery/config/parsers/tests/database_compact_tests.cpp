@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include <osquery/config.h>
+#include <osquery/core.h>
+#include <osquery/database.h>
+
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+class DatabaseCompactConfigParserPluginTests : public testing::Test {};
+
+TEST_F(DatabaseCompactConfigParserPluginTests, test_request_compaction) {
+  auto& c = Config::getInstance();
+  auto s = c.update({{"compact", "{\"database_compact\": [\"hashes\"]}"}});
+  EXPECT_TRUE(s.ok());
+
+  // The listed domains are compacted in the next idle window.
+  auto due = getDueCompactions(getUnixTime());
+  EXPECT_NE(std::find(due.begin(), due.end(), kHashes), due.end());
+  EXPECT_TRUE(compactDatabase(kHashes).ok());
+
+  // The same content does not request another compaction.
+  c.update({{"compact", "{\"database_compact\": [\"hashes\"]}"}});
+  due = getDueCompactions(getUnixTime());
+  EXPECT_EQ(std::find(due.begin(), due.end(), kHashes), due.end());
+  c.update({{"compact", "{}"}});
+}
+}
@@ -8,6 +8,7 @@
  *
  */
 
+#include <mutex>
 #include <vector>
 #include <sstream>
 
@@ -58,9 +59,23 @@ class TLSConfigPlugin : public ConfigPlugin,
   Status setUp() override;
   Status genConfig(std::map<std::string, std::string>& config) override;
 
+ protected:
+  /// Request the config, or the changes to the cached config.
+  Status requestConfig();
+
+  /// Forget the cached config, the next request is for the complete config.
+  void resetConfig();
+
  protected:
   /// Calculate the URL once and cache the result.
   std::string uri_;
+
+  /// Protect the cached config from concurrent refreshes.
+  std::mutex mutex_;
+
+  /// The most recent config and the server's version identifier for it.
+  std::string config_;
+  std::string version_;
 };
 
 class TLSConfigRefreshRunner : public InternalRunnable {
@@ -84,33 +99,85 @@ Status TLSConfigPlugin::setUp() {
 }
 
 Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
-  std::string json;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto s = requestConfig();
+  if (s.getCode() == 2) {
+    // The changes do not apply to the cached config, request all of it.
+    VLOG(1) << "Could not apply TLS config patch: " << s.getMessage();
+    resetConfig();
+    s = requestConfig();
+  }
 
-  auto s = TLSRequestHelper::go<JSONSerializer>(
-      uri_, json, FLAGS_config_tls_max_attempts);
+  if (s.ok()) {
+    // An unchanged config is recognized and not applied again.
+    config["tls_plugin"] = config_;
+  }
+  return s;
+}
+
+Status TLSConfigPlugin::requestConfig() {
+  pt::ptree params;
+  if (!version_.empty() && !FLAGS_tls_node_api) {
+    params.put<std::string>("config_version", version_);
+  }
+
+  pt::ptree recv;
+  bool modified = true;
+  auto etag = version_;
+  auto s = TLSRequestHelper::goConditional<JSONSerializer>(
+      uri_, params, recv, etag, modified, FLAGS_config_tls_max_attempts);
   if (!s.ok()) {
     return s;
   }
 
-  if (FLAGS_tls_node_api) {
-    // The node API embeds configuration data (JSON escaped).
-    pt::ptree tree;
-    try {
-      std::stringstream input;
-      input << json;
-      pt::read_json(input, tree);
-    } catch (const pt::json_parser::json_parser_error& e) {
-      VLOG(1) << "Could not parse JSON from TLS node API";
+  if (!modified || (!config_.empty() &&
+                    recv.get<std::string>("config_unchanged", "") == "true")) {
+    if (config_.empty()) {
+      return Status(1, "TLS config not modified before it was received");
     }
+    return Status(0, "OK");
+  }
+
+  // Servers that cannot set an ETag header may version the config body.
+  if (etag.empty()) {
+    etag = recv.get<std::string>("config_version", "");
+  }
+  recv.erase("config_version");
 
+  auto json = JSONSerializer();
+  std::string config;
+  auto patch = recv.get_child_optional("config_patch");
+  if (patch) {
+    // The server sent the changes since the config version in the request.
+    pt::ptree tree;
+    if (config_.empty() || !json.deserialize(config_, tree).ok()) {
+      return Status(2, "No cached config to patch");
+    }
+    s = applyJSONPatch(*patch, tree);
+    if (!s.ok()) {
+      return Status(2, s.getMessage());
+    }
+    s = json.serialize(tree, config);
+  } else if (FLAGS_tls_node_api) {
+    // The node API embeds configuration data (JSON escaped).
     // Re-encode the config key into JSON.
-    config["tls_plugin"] = unescapeUnicode(tree.get("config", ""));
+    config = unescapeUnicode(recv.get("config", ""));
   } else {
-    config["tls_plugin"] = json;
+    s = json.serialize(recv, config);
+  }
+
+  if (s.ok()) {
+    config_ = std::move(config);
+    version_ = std::move(etag);
   }
   return s;
 }
 
+void TLSConfigPlugin::resetConfig() {
+  config_.clear();
+  version_.clear();
+}
+
 void TLSConfigRefreshRunner::start() {
   while (true) {
     // Cool off and time wait the configured period.
@@ -17,6 +17,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/packs.h>
 #include <osquery/registry.h>
@@ -28,6 +29,8 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(config_enable_backup);
+
 // Blacklist testing methods, internal to config implementations.
 extern void restoreScheduleBlacklist(std::map<std::string, size_t>& blacklist);
 extern void saveScheduleBlacklist(
@@ -226,6 +229,44 @@ TEST_F(ConfigTests, test_content_update) {
   EXPECT_EQ(count, 0U);
 }
 
+TEST_F(ConfigTests, test_config_backup) {
+  FLAGS_config_enable_backup = true;
+  std::string content;
+  readFile(kTestDataPath + "test_parse_items.conf", content);
+  ASSERT_TRUE(get().update({{"awesome", content}}).ok());
+
+  // The parsed content is stored with the hash of the generated content.
+  std::string backup;
+  getDatabaseValue(kPersistentSettings, "config_backup.awesome", backup);
+  EXPECT_FALSE(backup.empty());
+  auto hash = get().hash_.at("awesome");
+
+  size_t count = 0;
+  auto packCounter = [&count](std::shared_ptr<Pack>& pack) { count++; };
+  get().packs(packCounter);
+  auto packs = count;
+  EXPECT_GT(packs, 0U);
+
+  // Starting from the backup applies the same packs.
+  get().reset();
+  ASSERT_TRUE(get().restoreBackup().ok());
+  count = 0;
+  get().packs(packCounter);
+  EXPECT_EQ(count, packs);
+  EXPECT_EQ(get().hash_.at("awesome"), hash);
+
+  // Unparsable content does not replace the backup.
+  get().update({{"awesome", "{\"packs\": "}});
+  std::string unchanged;
+  getDatabaseValue(kPersistentSettings, "config_backup.awesome", unchanged);
+  EXPECT_EQ(unchanged, backup);
+
+  deleteDatabaseValue(kPersistentSettings, "config_backup.awesome");
+  FLAGS_config_enable_backup = false;
+  get().reset();
+  EXPECT_FALSE(get().restoreBackup().ok());
+}
+
 TEST_F(ConfigTests, test_get_scheduled_queries) {
   std::vector<ScheduledQuery> queries;
   get().addPack("unrestricted_pack", "", getUnrestrictedPack());
@@ -286,6 +327,30 @@ TEST_F(ConfigTests, test_get_parser) {
   EXPECT_EQ(data.count("dictionary"), 1U);
 }
 
+TEST_F(ConfigTests, test_unchanged_update) {
+  Registry::add<TestConfigParserPlugin>("config_parser", "test");
+  std::map<std::string, std::string> config_data = {
+      {"data", "{\"list\": [1, 2]}"}};
+  get().update(config_data);
+  EXPECT_TRUE(TestConfigParserPlugin::update_called);
+
+  // The same content is not applied again.
+  TestConfigParserPlugin::update_called = false;
+  get().update(config_data);
+  EXPECT_FALSE(TestConfigParserPlugin::update_called);
+
+  // Changing a key requested by the parser applies it again.
+  config_data["data"] = "{\"list\": [1, 2, 3]}";
+  get().update(config_data);
+  EXPECT_TRUE(TestConfigParserPlugin::update_called);
+
+  // Changing content the parser did not request does not.
+  TestConfigParserPlugin::update_called = false;
+  config_data["data"] = "{\"list\": [1, 2, 3], \"other\": 1}";
+  get().update(config_data);
+  EXPECT_FALSE(TestConfigParserPlugin::update_called);
+}
+
 class PlaceboConfigParserPlugin : public ConfigParserPlugin {
  public:
   std::vector<std::string> keys() const override { return {}; }
@@ -8,6 +8,8 @@
  *
  */
 
+#include <set>
+
 #include <boost/property_tree/json_parser.hpp>
 
 #include <gtest/gtest.h>
@@ -23,6 +25,12 @@ namespace osquery {
 
 extern size_t getMachineShard(const std::string& hostname = "",
                               bool force = false);
+extern bool isHostSampled(double percent,
+                          const std::string& name,
+                          const std::string& identifier = "");
+extern size_t getHostOffset(const std::string& name,
+                            size_t interval,
+                            const std::string& identifier = "");
 
 class PacksTests : public testing::Test {};
 
@@ -77,6 +85,44 @@ TEST_F(PacksTests, test_sharding) {
   EXPECT_NE(shard1, shard2);
 }
 
+TEST_F(PacksTests, test_sampling) {
+  // Without a percent, or with all hosts, every host is sampled.
+  EXPECT_TRUE(isHostSampled(0, "pack.query", "host"));
+  EXPECT_TRUE(isHostSampled(100, "pack.query", "host"));
+
+  size_t sampled = 0;
+  size_t both = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    auto host = "host" + std::to_string(i);
+    // The sample of a host is deterministic.
+    EXPECT_EQ(isHostSampled(10, "pack.query", host),
+              isHostSampled(10, "pack.query", host));
+    if (isHostSampled(10, "pack.query", host)) {
+      sampled++;
+      if (isHostSampled(10, "pack.other", host)) {
+        both++;
+      }
+    }
+  }
+  EXPECT_GT(sampled, 50U);
+  EXPECT_LT(sampled, 150U);
+  // Each name samples a different set of hosts.
+  EXPECT_LT(both, sampled / 2);
+}
+
+TEST_F(PacksTests, test_spread_offsets) {
+  std::set<size_t> offsets;
+  for (size_t i = 0; i < 100; i++) {
+    auto host = "host" + std::to_string(i);
+    auto offset = getHostOffset("pack.query", 3600, host);
+    EXPECT_LT(offset, 3600U);
+    EXPECT_EQ(offset, getHostOffset("pack.query", 3600, host));
+    offsets.insert(offset);
+  }
+  EXPECT_GT(offsets.size(), 90U);
+  EXPECT_EQ(getHostOffset("pack.query", 1, "host"), 0U);
+}
+
 TEST_F(PacksTests, test_check_platform) {
   Pack fpack("discovery_pack", getPackWithDiscovery());
   EXPECT_TRUE(fpack.checkPlatform());
@@ -150,6 +196,32 @@ TEST_F(PacksTests, test_discovery_cache) {
   EXPECT_EQ(pack_count, 1U);
 }
 
+TEST_F(PacksTests, test_discovery_shared_cache) {
+  Pack first("first_pack", getPackWithValidDiscovery());
+  EXPECT_TRUE(first.shouldPackExecute());
+  ASSERT_EQ(first.getDiscoveryQueries().size(), 1U);
+  const auto& query = first.getDiscoveryQueries()[0];
+
+  // A pack with the same discovery query uses the shared result.
+  Pack::discoveryResults()[query].result = false;
+  Pack second("second_pack", getPackWithValidDiscovery());
+  EXPECT_FALSE(second.shouldPackExecute());
+
+  // Changing a shared result expires the packs' cached discovery.
+  Pack::discoveryResults()[query].time = 1;
+  Pack::refreshDiscovery({query});
+  EXPECT_TRUE(Pack::discoveryResults()[query].result);
+  EXPECT_TRUE(second.shouldPackExecute());
+  EXPECT_EQ(second.getStats().misses, 2U);
+
+  // Events mark the results of queries reading their table.
+  Pack::invalidateDiscovery("OSQUERY_INFO");
+  EXPECT_TRUE(Pack::discoveryResults()[query].invalidated);
+  Pack::discoveryResults()[query].time = 1;
+  Pack::refreshDiscovery({query});
+  EXPECT_FALSE(Pack::discoveryResults()[query].invalidated);
+}
+
 TEST_F(PacksTests, test_discovery_zero_state) {
   Pack pack("discovery_pack", getPackWithDiscovery());
   auto stats = pack.getStats();
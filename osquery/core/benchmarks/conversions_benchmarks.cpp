@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+
+namespace osquery {
+
+/// Column values of mixed widths, similar to sizes, times, and pids.
+static std::vector<long long> getBenchmarkValues() {
+  std::vector<long long> values;
+  long long value = 1;
+  for (size_t i = 0; i < 64; ++i) {
+    values.push_back((i % 2 == 0) ? value : -value);
+    value = value * 7 + 3;
+    if (value > 1000000000000000LL) {
+      value = 1;
+    }
+  }
+  return values;
+}
+
+static void CONVERSIONS_lexical_cast(benchmark::State& state) {
+  auto values = getBenchmarkValues();
+  while (state.KeepRunning()) {
+    for (const auto& value : values) {
+      auto text = boost::lexical_cast<std::string>(value);
+      benchmark::DoNotOptimize(text);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+BENCHMARK(CONVERSIONS_lexical_cast);
+
+static void CONVERSIONS_integer_text(benchmark::State& state) {
+  auto values = getBenchmarkValues();
+  while (state.KeepRunning()) {
+    for (const auto& value : values) {
+      auto text = BIGINT(value);
+      benchmark::DoNotOptimize(text);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+BENCHMARK(CONVERSIONS_integer_text);
+
+static std::vector<std::string> getBenchmarkStrings() {
+  std::vector<std::string> strings;
+  for (const auto& value : getBenchmarkValues()) {
+    strings.push_back(std::to_string(value));
+  }
+  return strings;
+}
+
+static void CONVERSIONS_safe_strtoll(benchmark::State& state) {
+  auto strings = getBenchmarkStrings();
+  long long value = 0;
+  while (state.KeepRunning()) {
+    for (const auto& string : strings) {
+      safeStrtoll(string, 10, value);
+      benchmark::DoNotOptimize(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * strings.size());
+}
+
+BENCHMARK(CONVERSIONS_safe_strtoll);
+
+static void CONVERSIONS_parse_decimal(benchmark::State& state) {
+  auto strings = getBenchmarkStrings();
+  long long value = 0;
+  while (state.KeepRunning()) {
+    for (const auto& string : strings) {
+      parseDecimal(string, value);
+      benchmark::DoNotOptimize(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * strings.size());
+}
+
+BENCHMARK(CONVERSIONS_parse_decimal);
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/hash.h>
+
+#include "osquery/core/test_util.h"
+
+namespace osquery {
+
+/// Write a file of the benchmark's size, in bytes, to hash.
+static std::string getBenchmarkFile(size_t size) {
+  auto path = kTestWorkingDirectory + "hash_benchmark_" + std::to_string(size);
+  writeTextFile(path, std::string(size, 'A'));
+  return path;
+}
+
+static void hashBenchmark(benchmark::State& state, int mask) {
+  auto path = getBenchmarkFile(state.range_x());
+  while (state.KeepRunning()) {
+    hashMultiFromFile(mask, path);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range_x());
+  remove(path);
+}
+
+static void HASH_md5(benchmark::State& state) {
+  hashBenchmark(state, HASH_TYPE_MD5);
+}
+
+static void HASH_sha1(benchmark::State& state) {
+  hashBenchmark(state, HASH_TYPE_SHA1);
+}
+
+static void HASH_sha256(benchmark::State& state) {
+  hashBenchmark(state, HASH_TYPE_SHA256);
+}
+
+static void HASH_multi(benchmark::State& state) {
+  hashBenchmark(state, HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256);
+}
+
+BENCHMARK(HASH_md5)->Arg(4096)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+BENCHMARK(HASH_sha1)->Arg(4096)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+BENCHMARK(HASH_sha256)->Arg(4096)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+BENCHMARK(HASH_multi)->Arg(4096)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+}
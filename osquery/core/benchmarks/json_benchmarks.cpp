@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <benchmark/benchmark.h>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// A config with a schedule of the given size, similar to a pack.
+static std::string getBenchmarkConfig(size_t queries) {
+  std::string json = "{\"options\": {\"host_identifier\": \"hostname\"}, ";
+  json += "\"schedule\": {";
+  for (size_t i = 0; i < queries; ++i) {
+    auto name = std::to_string(i);
+    json += (i > 0) ? ", " : "";
+    json += "\"query_" + name + "\": {\"query\": \"SELECT * FROM processes ";
+    json += "WHERE pid > " + name + "\", \"interval\": 3600, ";
+    json += "\"platform\": \"linux\", \"removed\": false, ";
+    json += "\"description\": \"Process \\\"listing\\\" " + name + "\"}";
+  }
+  json += "}}";
+  return json;
+}
+
+/// A row as stored by the legacy JSON result format.
+static std::string getBenchmarkRow() {
+  std::string json = "{";
+  for (size_t i = 0; i < 16; ++i) {
+    json += (i > 0) ? ", " : "";
+    json += "\"column_" + std::to_string(i) + "\": \"/usr/local/bin/value_" +
+            std::to_string(i * 7919) + "\"";
+  }
+  json += "}";
+  return json;
+}
+
+static void JSON_read_json_config(benchmark::State& state) {
+  auto json = getBenchmarkConfig(state.range_x());
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    std::stringstream input;
+    input << json;
+    pt::read_json(input, tree);
+    benchmark::DoNotOptimize(tree);
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+BENCHMARK(JSON_read_json_config)->Arg(10)->Arg(1000);
+
+static void JSON_parse_tree_config(benchmark::State& state) {
+  auto json = getBenchmarkConfig(state.range_x());
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    parseJSONTree(json, tree);
+    benchmark::DoNotOptimize(tree);
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+BENCHMARK(JSON_parse_tree_config)->Arg(10)->Arg(1000);
+
+/// Validates and visits the content without storing it.
+class JSONCountHandler : public JSONHandler {
+ public:
+  bool startObject(const std::string& key) override {
+    return true;
+  }
+  bool endObject() override {
+    return true;
+  }
+  bool startArray(const std::string& key) override {
+    return true;
+  }
+  bool endArray() override {
+    return true;
+  }
+  bool value(const std::string& key,
+             const std::string& value,
+             JSONValueType type) override {
+    count++;
+    return true;
+  }
+
+  size_t count{0};
+};
+
+static void JSON_parse_events_config(benchmark::State& state) {
+  auto json = getBenchmarkConfig(state.range_x());
+  while (state.KeepRunning()) {
+    JSONCountHandler handler;
+    parseJSONEvents(json, handler);
+    benchmark::DoNotOptimize(handler.count);
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+BENCHMARK(JSON_parse_events_config)->Arg(10)->Arg(1000);
+
+static void JSON_read_json_row(benchmark::State& state) {
+  auto json = getBenchmarkRow();
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    std::stringstream input;
+    input << json;
+    pt::read_json(input, tree);
+    Row r;
+    for (const auto& column : tree) {
+      r[column.first] = column.second.data();
+    }
+    benchmark::DoNotOptimize(r);
+  }
+}
+
+BENCHMARK(JSON_read_json_row);
+
+static void JSON_parse_row(benchmark::State& state) {
+  auto json = getBenchmarkRow();
+  while (state.KeepRunning()) {
+    Row r;
+    parseJSONRow(json, r);
+    benchmark::DoNotOptimize(r);
+  }
+}
+
+BENCHMARK(JSON_parse_row);
+}
@@ -8,6 +8,8 @@
  *
  */
 
+#include <cctype>
+#include <cstring>
 #include <sstream>
 
 #include <boost/algorithm/string.hpp>
@@ -113,6 +115,114 @@ std::vector<std::string> split(const std::string& s,
   return elems;
 }
 
+bool LineScanner::next() {
+  fields_.clear();
+  while (position_ < end_) {
+    auto line = position_;
+    auto newline =
+        static_cast<const char*>(memchr(position_, '\n', end_ - position_));
+    auto line_end = (newline == nullptr) ? end_ : newline;
+    position_ = (newline == nullptr) ? end_ : newline + 1;
+
+    while (line_end > line && isspace(*(line_end - 1))) {
+      line_end--;
+    }
+
+    // Split the line into runs of characters between delimiters.
+    auto field = line;
+    while (field < line_end) {
+      while (field < line_end && delims_.find(*field) != std::string::npos) {
+        field++;
+      }
+      auto field_end = field;
+      while (field_end < line_end &&
+             delims_.find(*field_end) == std::string::npos) {
+        field_end++;
+      }
+      if (field_end > field) {
+        fields_.emplace_back(field, field_end - field);
+      }
+      field = field_end;
+    }
+
+    if (!fields_.empty()) {
+      line_ = boost::string_ref(line, line_end - line);
+      return true;
+    }
+  }
+  line_.clear();
+  return false;
+}
+
+boost::string_ref LineScanner::rest(size_t field) const {
+  if (field >= fields_.size()) {
+    return boost::string_ref();
+  }
+  auto start = fields_[field].data();
+  return boost::string_ref(start, line_.data() + line_.size() - start);
+}
+
+/// The digits of 0 through 99, two characters each.
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+size_t formatDecimal(unsigned long long value, char* buffer) {
+  // Fill from the end of a scratch buffer, then copy the used digits.
+  char digits[kDecimalDigitsMax];
+  char* end = digits + kDecimalDigitsMax;
+  char* pos = end;
+  while (value >= 100) {
+    auto pair = static_cast<size_t>(value % 100) * 2;
+    value /= 100;
+    *--pos = kDigitPairs[pair + 1];
+    *--pos = kDigitPairs[pair];
+  }
+  if (value >= 10) {
+    auto pair = static_cast<size_t>(value) * 2;
+    *--pos = kDigitPairs[pair + 1];
+    *--pos = kDigitPairs[pair];
+  } else {
+    *--pos = static_cast<char>('0' + value);
+  }
+
+  auto size = static_cast<size_t>(end - pos);
+  memcpy(buffer, pos, size);
+  return size;
+}
+
+bool parseDecimal(const std::string& rep, long long& out) {
+  const char* pos = rep.c_str();
+  bool negative = false;
+  if (*pos == '-' || *pos == '+') {
+    negative = (*pos == '-');
+    ++pos;
+  }
+
+  // 18 digits cannot overflow, longer values are left to strtoll.
+  const char* start = pos;
+  long long value = 0;
+  while (*pos >= '0' && *pos <= '9' && pos - start < 18) {
+    value = value * 10 + (*pos - '0');
+    ++pos;
+  }
+
+  if (pos == start || *pos != '\0' ||
+      static_cast<size_t>(pos - rep.c_str()) != rep.size()) {
+    return safeStrtoll(rep, 10, out).ok();
+  }
+  out = (negative) ? -value : value;
+  return true;
+}
+
 std::string join(const std::vector<std::string>& s, const std::string& tok) {
   return boost::algorithm::join(s, tok);
 }
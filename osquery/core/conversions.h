@@ -18,6 +18,7 @@
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/status.h>
 
@@ -77,6 +78,44 @@ std::vector<std::string> split(const std::string& s,
                                const std::string& delim,
                                size_t occurences);
 
+/**
+ * @brief Scan the lines and fields of text in place.
+ *
+ * Table readers of proc and sysfs files visit each line and its fields
+ * without copying them into split strings. Lines are found with memchr,
+ * which libc vectorizes, and fields are runs of characters between any of
+ * the delimiters. The fields refer to the scanned content, which must
+ * outlive the scanner.
+ */
+class LineScanner {
+ public:
+  explicit LineScanner(const std::string& content,
+                       const std::string& delims = "\t ")
+      : position_(content.data()),
+        end_(content.data() + content.size()),
+        delims_(delims) {}
+
+  /// Move to the next line that is not empty, false after the last line.
+  bool next();
+
+  /// The current line without its newline or trailing whitespace.
+  const boost::string_ref& line() const { return line_; }
+
+  /// The fields of the current line, runs of delimiters are compressed.
+  const std::vector<boost::string_ref>& fields() const { return fields_; }
+
+  /// The rest of the current line from a field, for fields with delimiters.
+  boost::string_ref rest(size_t field) const;
+
+ private:
+  const char* position_{nullptr};
+  const char* end_{nullptr};
+  std::string delims_;
+
+  boost::string_ref line_;
+  std::vector<boost::string_ref> fields_;
+};
+
 /**
  * @brief In-line replace all instances of from with to.
  *
@@ -154,6 +193,32 @@ inline Status safeStrtoll(const std::string& rep, size_t base, long long& out) {
   return Status(0);
 }
 
+/// The most digits formatDecimal writes, for the largest unsigned long long.
+const size_t kDecimalDigitsMax = 20;
+
+/**
+ * @brief Write the base 10 digits of a value without a stream or locale.
+ *
+ * Digits are produced two at a time from a table of digit pairs.
+ *
+ * @param value The value to format.
+ * @param buffer At least kDecimalDigitsMax bytes, not NULL-terminated.
+ * @return The number of digits written.
+ */
+size_t formatDecimal(unsigned long long value, char* buffer);
+
+/**
+ * @brief Convert a base 10 integer, accepting what safeStrtoll accepts.
+ *
+ * An optional sign and up to 18 digits are parsed inline. Other input, such
+ * as leading whitespace or values that may overflow, uses safeStrtoll.
+ *
+ * @param rep The string representation.
+ * @param out The parsed value.
+ * @return If the whole string was a base 10 integer.
+ */
+bool parseDecimal(const std::string& rep, long long& out);
+
 /// Safely convert unicode escaped ASCII.
 inline std::string unescapeUnicode(const std::string& escaped) {
   if (escaped.size() < 6) {
@@ -0,0 +1,179 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <thread>
+
+#include <osquery/logger.h>
+
+#include "osquery/core/governor.h"
+
+namespace osquery {
+
+#if defined(__linux__)
+/// There is no libc wrapper for ioprio_set, see linux/ioprio.h.
+const int kIOPrioWhoProcess = 1;
+const int kIOPrioClassShift = 13;
+const int kIOPrioClassBestEffort = 2;
+const int kIOPrioClassIdle = 3;
+
+/// The lowest best-effort I/O priority level.
+const int kIOPrioLowestLevel = 7;
+
+/// The nice value of SCHED_IDLE when deciding if a thread may leave it.
+const int kIdleNice = 20;
+
+static int getIOPriority() {
+  return static_cast<int>(syscall(SYS_ioprio_get, kIOPrioWhoProcess, 0));
+}
+
+static bool setIOPriority(int value) {
+  return syscall(SYS_ioprio_set, kIOPrioWhoProcess, 0, value) == 0;
+}
+
+/**
+ * @brief Check if the thread may return to its policy after SCHED_IDLE.
+ *
+ * Leaving SCHED_IDLE raises the thread's priority, which needs privileges or
+ * an RLIMIT_NICE allowing its nice value. A worker left idle would slow the
+ * next queries it runs.
+ */
+static bool canLeaveIdle() {
+  if (geteuid() == 0) {
+    return true;
+  }
+  struct rlimit limit;
+  errno = 0;
+  auto nice = getpriority(PRIO_PROCESS, 0);
+  return errno == 0 && getrlimit(RLIMIT_NICE, &limit) == 0 &&
+         limit.rlim_cur >= static_cast<rlim_t>(kIdleNice - nice);
+}
+#endif
+
+/// The limiter of the governed query running on this thread.
+static thread_local ReadRateLimiter* kReadLimiter{nullptr};
+
+ReadRateLimiter::ReadRateLimiter(size_t rate)
+    : rate_(static_cast<double>(std::max<size_t>(rate, 1))),
+      tokens_(rate_),
+      refilled_(std::chrono::steady_clock::now()) {}
+
+double ReadRateLimiter::take(size_t bytes,
+                             std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::chrono::duration<double> elapsed = now - refilled_;
+  if (elapsed.count() > 0) {
+    tokens_ = std::min(rate_, tokens_ + elapsed.count() * rate_);
+    refilled_ = now;
+  }
+  tokens_ -= static_cast<double>(bytes);
+  return (tokens_ < 0) ? -tokens_ / rate_ : 0;
+}
+
+void ReadRateLimiter::consume(size_t bytes) {
+  auto wait = take(bytes, std::chrono::steady_clock::now());
+  if (wait > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+  }
+}
+
+ScopedGovernor::ScopedGovernor(const std::string& priority,
+                               size_t read_rate) {
+  if (read_rate > 0) {
+    limiter_.reset(new ReadRateLimiter(read_rate));
+    previous_ = kReadLimiter;
+    kReadLimiter = limiter_.get();
+  }
+
+  if (priority.empty() || priority == "normal") {
+    return;
+  }
+  bool idle = (priority == "idle");
+  if (!idle && priority != "low") {
+    VLOG(1) << "Unknown scheduled query priority: " << priority;
+    return;
+  }
+
+#if defined(__linux__)
+  auto io_priority = getIOPriority();
+  auto io_class = (idle) ? kIOPrioClassIdle : kIOPrioClassBestEffort;
+  auto io_level = (idle) ? 0 : kIOPrioLowestLevel;
+  if (io_priority >= 0 &&
+      setIOPriority((io_class << kIOPrioClassShift) | io_level)) {
+    io_priority_ = io_priority;
+  }
+
+  struct sched_param param;
+  auto policy = sched_getscheduler(0);
+  if (policy < 0 || sched_getparam(0, &param) != 0) {
+    return;
+  }
+  if (idle && !canLeaveIdle()) {
+    VLOG(1) << "Cannot return from SCHED_IDLE, using SCHED_BATCH";
+    idle = false;
+  }
+  struct sched_param lowered;
+  lowered.sched_priority = 0;
+  if (sched_setscheduler(0, (idle) ? SCHED_IDLE : SCHED_BATCH, &lowered) ==
+      0) {
+    policy_ = policy;
+    policy_priority_ = param.sched_priority;
+  }
+#elif defined(__APPLE__)
+  auto io_policy = getiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD);
+  if (io_policy >= 0 &&
+      setiopolicy_np(IOPOL_TYPE_DISK,
+                     IOPOL_SCOPE_THREAD,
+                     (idle) ? IOPOL_THROTTLE : IOPOL_UTILITY) == 0) {
+    io_priority_ = io_policy;
+  }
+#endif
+}
+
+ScopedGovernor::~ScopedGovernor() {
+  if (limiter_ != nullptr) {
+    kReadLimiter = previous_;
+  }
+
+#if defined(__linux__)
+  if (policy_ >= 0) {
+    struct sched_param param;
+    param.sched_priority = policy_priority_;
+    if (sched_setscheduler(0, policy_, &param) != 0) {
+      LOG(WARNING) << "Cannot restore the scheduling policy of a worker";
+    }
+  }
+  if (io_priority_ >= 0) {
+    setIOPriority(io_priority_);
+  }
+#elif defined(__APPLE__)
+  if (io_priority_ >= 0) {
+    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, io_priority_);
+  }
+#endif
+}
+
+void throttleRead(size_t bytes) {
+  if (kReadLimiter != nullptr && bytes > 0) {
+    kReadLimiter->consume(bytes);
+  }
+}
+}
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <gtest/gtest_prod.h>
+
+namespace osquery {
+
+/**
+ * @brief A token bucket limiting the bytes read per second.
+ *
+ * The bucket holds one second of reads. A read larger than the bucket is
+ * allowed and waits for the bucket to refill, so file readers keep their
+ * block sizes.
+ */
+class ReadRateLimiter : private boost::noncopyable {
+ public:
+  /// Limit reads to rate bytes per second.
+  explicit ReadRateLimiter(size_t rate);
+
+  /// Take bytes read from the bucket, waiting while it is overdrawn.
+  void consume(size_t bytes);
+
+ private:
+  /// Take bytes at a time, returning the seconds to wait.
+  double take(size_t bytes, std::chrono::steady_clock::time_point now);
+
+ private:
+  /// Bytes per second, also the size of the bucket.
+  double rate_{0};
+
+  /// Bytes that may be read without waiting, negative when overdrawn.
+  double tokens_{0};
+
+  /// The time the bucket was last refilled.
+  std::chrono::steady_clock::time_point refilled_;
+
+  /// Protects the bucket, a query's table may read from several threads.
+  std::mutex mutex_;
+
+ private:
+  FRIEND_TEST(GovernorTests, test_read_rate_limiter);
+};
+
+/**
+ * @brief Apply a scheduled query's priority and read rate to this thread.
+ *
+ * Heavy tables such as hash, file, yara, and device_hash yield to the host's
+ * workloads instead of competing with them. The priority is "normal", "low",
+ * or "idle". On Linux a low query's thread uses the lowest best-effort I/O
+ * priority and SCHED_BATCH, an idle query's thread the idle I/O class and
+ * SCHED_IDLE. On OS X both throttle the thread's disk I/O.
+ *
+ * A read rate over 0 limits the bytes the thread reads per second through
+ * readFile, hashing, YARA scanning, and device reads. The previous state is
+ * restored when the governor is destroyed.
+ */
+class ScopedGovernor : private boost::noncopyable {
+ public:
+  /**
+   * @brief Govern the calling thread until destroyed.
+   *
+   * @param priority The query priority, empty for normal.
+   * @param read_rate The limit of bytes read per second, 0 for none.
+   */
+  ScopedGovernor(const std::string& priority, size_t read_rate);
+  ~ScopedGovernor();
+
+ private:
+  /// The previous CPU scheduling policy and priority, -1 if not changed.
+  int policy_{-1};
+  int policy_priority_{0};
+
+  /// The previous I/O priority or policy, -1 if not changed.
+  int io_priority_{-1};
+
+  /// The limiter of this governor, and the one it replaced.
+  std::unique_ptr<ReadRateLimiter> limiter_;
+  ReadRateLimiter* previous_{nullptr};
+};
+
+/// Wait for the calling thread's read rate before using bytes read.
+void throttleRead(size_t bytes);
+}
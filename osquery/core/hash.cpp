@@ -9,14 +9,29 @@
  */
 
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 
+#include <sys/stat.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/logger.h>
 
+#include "osquery/dispatcher/dispatcher.h"
+
 namespace osquery {
 
+FLAG(uint64,
+     hash_cache_max,
+     10000,
+     "Maximum number of file hashes cached in the backing store (0 disables)");
+
 #ifdef __APPLE__
 #import <CommonCrypto/CommonDigest.h>
 #define __HASH_API(name) CC_##name
@@ -29,7 +44,11 @@ namespace osquery {
 #define SHA1_CTX SHA_CTX
 #endif
 
-#define HASH_CHUNK_SIZE 4096
+/// Files are hashed in blocks, read with sequential read ahead.
+#define HASH_CHUNK_SIZE (1024 * 1024)
+
+/// Blocks of at least this size run each requested digest in parallel.
+#define HASH_PARALLEL_SIZE (256 * 1024)
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
@@ -94,38 +113,241 @@ std::string hashFromBuffer(HashType hash_type,
   return hash.digest();
 }
 
-MultiHashes hashMultiFromFile(int mask, const std::string& path) {
-  std::map<HashType, std::shared_ptr<Hash> > hashes = {
-      {HASH_TYPE_MD5, std::make_shared<Hash>(HASH_TYPE_MD5)},
-      {HASH_TYPE_SHA1, std::make_shared<Hash>(HASH_TYPE_SHA1)},
-      {HASH_TYPE_SHA256, std::make_shared<Hash>(HASH_TYPE_SHA256)},
-  };
-
-  readFile(path,
-           0,
-           HASH_CHUNK_SIZE,
-           false,
-           true,
-           ([&hashes, &mask](std::string& buffer, size_t size) {
-             for (auto& hash : hashes) {
-               if (mask & hash.first) {
-                 hash.second->update(&buffer[0], size);
-               }
-             }
-           }));
+/// A digest of a block, updated by a worker or by the reading thread.
+struct HashLane {
+  Hash* hash{nullptr};
+  bool updated{false};
+  TaskRef task{nullptr};
+};
+
+/// Hash a file's content, fails if the file could not be read.
+static Status hashFile(int mask, const std::string& path, MultiHashes& mh) {
+  std::vector<std::pair<HashType, std::unique_ptr<Hash>>> hashes;
+  for (const auto& type : {HASH_TYPE_MD5, HASH_TYPE_SHA1, HASH_TYPE_SHA256}) {
+    if (mask & type) {
+      hashes.emplace_back(type, std::unique_ptr<Hash>(new Hash(type)));
+    }
+  }
+
+  auto status = readFile(
+      path,
+      0,
+      HASH_CHUNK_SIZE,
+      false,
+      true,
+      ([&hashes](std::string& buffer, size_t size) {
+        if (hashes.size() == 1 || size < HASH_PARALLEL_SIZE) {
+          for (auto& hash : hashes) {
+            hash.second->update(&buffer[0], size);
+          }
+          return;
+        }
+
+        // The other digests of a large block are offered to the dispatcher's
+        // workers, a digest no worker has started runs on this thread.
+        std::vector<HashLane> lanes(hashes.size() - 1);
+        for (size_t i = 0; i < lanes.size(); i++) {
+          auto lane = &lanes[i];
+          lane->hash = hashes[i + 1].second.get();
+          lane->task = Dispatcher::submit(
+              [lane, &buffer, size](const Task&) {
+                lane->hash->update(&buffer[0], size);
+                lane->updated = true;
+              },
+              TASK_PRIORITY_SCHEDULE);
+        }
+        hashes[0].second->update(&buffer[0], size);
+        for (auto& lane : lanes) {
+          // The worker reads the buffer until the digest is updated.
+          if (lane.task != nullptr) {
+            lane.task->runOrWait();
+          }
+          // A stopping executor drops queued tasks without running them.
+          if (!lane.updated) {
+            lane.hash->update(&buffer[0], size);
+          }
+        }
+      }));
 
-  MultiHashes mh;
   mh.mask = mask;
-  if (mask & HASH_TYPE_MD5) {
-    mh.md5 = hashes.at(HASH_TYPE_MD5)->digest();
+  for (auto& hash : hashes) {
+    if (hash.first == HASH_TYPE_MD5) {
+      mh.md5 = hash.second->digest();
+    } else if (hash.first == HASH_TYPE_SHA1) {
+      mh.sha1 = hash.second->digest();
+    } else {
+      mh.sha256 = hash.second->digest();
+    }
   }
-  if (mask & HASH_TYPE_SHA1) {
-    mh.sha1 = hashes.at(HASH_TYPE_SHA1)->digest();
+  return status;
+}
+
+MultiHashes hashMultiFromFile(int mask, const std::string& path) {
+  MultiHashes mh;
+  hashFile(mask, path, mh);
+  return mh;
+}
+
+/// A cached file's hashes, the status identity, and the last access stamp.
+struct HashCacheRecord {
+  std::string identity;
+  std::string stamp;
+  MultiHashes hashes;
+};
+
+/// Cache records and their access order share the hashes domain.
+const std::string kHashCacheAccess = "access.";
+const std::string kHashCacheFile = "file.";
+
+/// The width of an access stamp, seconds followed by a sequence.
+const size_t kHashCacheStampWidth = 16;
+
+/// A cache hit refreshes the access order at most this often, in seconds.
+const size_t kHashCacheRefresh = 60;
+
+/// Protects updating records and the cache size.
+static std::mutex kHashCacheMutex;
+
+/// The number of cached files, counted when the cache is first written.
+static size_t kHashCacheSize = 0;
+static bool kHashCacheCounted = false;
+
+/// Stamps sort access keys oldest first, the sequence orders one second.
+static std::string getHashCacheStamp() {
+  static size_t sequence = 0;
+  std::stringstream stamp;
+  stamp << std::setw(10) << std::setfill('0') << getUnixTime()
+        << std::setw(6) << std::setfill('0') << (sequence++ % 1000000);
+  return stamp.str();
+}
+
+/// Any write to a file changes its size, modify, or change time.
+static std::string getFileIdentity(const struct stat& info) {
+#ifdef __APPLE__
+  const auto& mtime = info.st_mtimespec;
+  const auto& ctime = info.st_ctimespec;
+#else
+  const auto& mtime = info.st_mtim;
+  const auto& ctime = info.st_ctim;
+#endif
+  std::stringstream identity;
+  identity << info.st_dev << ":" << info.st_ino << ":" << info.st_size << ":"
+           << mtime.tv_sec << "." << mtime.tv_nsec << ":" << ctime.tv_sec
+           << "." << ctime.tv_nsec;
+  return identity.str();
+}
+
+static bool parseHashCacheRecord(const std::string& value,
+                                 HashCacheRecord& record) {
+  std::vector<std::string> fields;
+  boost::split(fields, value, boost::is_any_of(","));
+  if (fields.size() != 6) {
+    return false;
   }
-  if (mask & HASH_TYPE_SHA256) {
-    mh.sha256 = hashes.at(HASH_TYPE_SHA256)->digest();
+
+  record.identity = fields[0];
+  record.stamp = fields[1];
+  record.hashes.mask = std::atoi(fields[2].c_str());
+  record.hashes.md5 = fields[3];
+  record.hashes.sha1 = fields[4];
+  record.hashes.sha256 = fields[5];
+  return true;
+}
+
+/// Remove the least recently used files beyond hash_cache_max, call locked.
+static void evictHashCache() {
+  if (kHashCacheSize <= FLAGS_hash_cache_max) {
+    return;
   }
-  return mh;
+
+  // Evict a tenth beyond the limit so eviction scans are infrequent.
+  size_t evict = kHashCacheSize - FLAGS_hash_cache_max + kHashCacheSize / 10;
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kHashes, keys, evict);
+  for (const auto& key : keys) {
+    if (key.find(kHashCacheAccess) != 0) {
+      // Access keys sort before the file records.
+      break;
+    }
+    auto path = key.substr(kHashCacheAccess.size() + kHashCacheStampWidth + 1);
+    deleteDatabaseValue(kHashes, key);
+    deleteDatabaseValue(kHashes, kHashCacheFile + path);
+    kHashCacheSize--;
+  }
+}
+
+/// Store or refresh a file's hashes as the most recently used.
+static void storeHashCacheRecord(const std::string& path,
+                                 const std::string& identity,
+                                 const MultiHashes& hashes) {
+  std::lock_guard<std::mutex> lock(kHashCacheMutex);
+  if (!kHashCacheCounted) {
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kHashes, keys);
+    for (const auto& key : keys) {
+      kHashCacheSize += (key.find(kHashCacheAccess) == 0) ? 1 : 0;
+    }
+    kHashCacheCounted = true;
+  }
+
+  // Replace the previous access key of the file, if it was cached.
+  std::string value;
+  HashCacheRecord previous;
+  getDatabaseValue(kHashes, kHashCacheFile + path, value);
+  if (parseHashCacheRecord(value, previous)) {
+    deleteDatabaseValue(kHashes,
+                        kHashCacheAccess + previous.stamp + "." + path);
+  } else {
+    kHashCacheSize++;
+  }
+
+  auto stamp = getHashCacheStamp();
+  setDatabaseValue(kHashes, kHashCacheAccess + stamp + "." + path, "");
+  setDatabaseValue(kHashes,
+                   kHashCacheFile + path,
+                   identity + "," + stamp + "," + std::to_string(hashes.mask) +
+                       "," + hashes.md5 + "," + hashes.sha1 + "," +
+                       hashes.sha256);
+  evictHashCache();
+}
+
+MultiHashes hashMultiFromFileCached(int mask, const std::string& path) {
+  struct stat info;
+  if (FLAGS_hash_cache_max == 0 || mask == 0 ||
+      stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+    return hashMultiFromFile(mask, path);
+  }
+
+  std::string value;
+  HashCacheRecord cached;
+  auto identity = getFileIdentity(info);
+  getDatabaseValue(kHashes, kHashCacheFile + path, value);
+  if (parseHashCacheRecord(value, cached) && cached.identity == identity) {
+    if ((cached.hashes.mask & mask) == mask) {
+      auto accessed = std::atoll(cached.stamp.substr(0, 10).c_str());
+      if (getUnixTime() > accessed + kHashCacheRefresh) {
+        storeHashCacheRecord(path, identity, cached.hashes);
+      }
+      return cached.hashes;
+    }
+    // Hash the union so the record serves either set of hash columns.
+    mask |= cached.hashes.mask;
+  }
+
+  MultiHashes hashes;
+  if (!hashFile(mask, path, hashes).ok()) {
+    return hashes;
+  }
+
+  // A file changed while hashing, or within the granularity of the change
+  // time, may change again without a different identity.
+  struct stat after;
+  if (stat(path.c_str(), &after) == 0 &&
+      getFileIdentity(after) == identity &&
+      static_cast<size_t>(after.st_ctime) + 1 < getUnixTime()) {
+    storeHashCacheRecord(path, identity, hashes);
+  }
+  return hashes;
 }
 
 std::string hashFromFile(HashType hash_type, const std::string& path) {
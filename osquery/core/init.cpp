@@ -10,6 +10,9 @@
 
 #include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <future>
+#include <mutex>
 #include <random>
 
 #include <syslog.h>
@@ -29,9 +32,11 @@
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 
+#include "osquery/core/tracing.h"
 #include "osquery/core/watcher.h"
 #include "osquery/dispatcher/dispatcher.h"
 #include "osquery/database/db_handle.h"
+#include "osquery/sql/sqlite_util.h"
 
 #if defined(__linux__) || defined(__FreeBSD__)
 #include <sys/resource.h>
@@ -167,9 +172,73 @@ DECLARE_bool(disable_distributed);
 DECLARE_string(config_plugin);
 DECLARE_bool(config_check);
 DECLARE_bool(database_dump);
+DECLARE_bool(database_in_memory);
+DECLARE_string(database_plugin);
+DECLARE_string(trace_file);
 
 ToolType kToolType = OSQUERY_TOOL_UNKNOWN;
 
+CLI_FLAG(bool,
+         startup_profile,
+         false,
+         "Print the duration of each initialization phase to stderr");
+
+/// The time the Initializer started, phases are measured from it.
+static chrono_clock::time_point kStartupTime;
+
+/// Protects the recorded phases, some phases run on other threads.
+static std::mutex kStartupMutex;
+
+/// The recorded initialization phases, in order of completion.
+static std::vector<StartupPhase> kStartupPhases;
+
+/// Milliseconds from the start of initialization to a time.
+static size_t startupMilliseconds(const chrono_clock::time_point& time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(time -
+                                                               kStartupTime)
+      .count();
+}
+
+/// Record a phase that began at start and ended now, return now.
+static chrono_clock::time_point recordPhase(const std::string& name,
+                                            chrono_clock::time_point start) {
+  auto now = chrono_clock::now();
+  StartupPhase phase;
+  phase.name = name;
+  phase.start = startupMilliseconds(start);
+  phase.duration = startupMilliseconds(now) - phase.start;
+
+  std::lock_guard<std::mutex> lock(kStartupMutex);
+  kStartupPhases.push_back(phase);
+  return now;
+}
+
+std::vector<StartupPhase> getStartupPhases() {
+  std::lock_guard<std::mutex> lock(kStartupMutex);
+  return kStartupPhases;
+}
+
+/// Report the recorded phases, to stderr if requested by --startup_profile.
+static void reportStartupPhases() {
+  auto phases = getStartupPhases();
+  if (FLAGS_startup_profile) {
+    fprintf(stderr, "%-20s %10s %10s\n", "phase", "start_ms", "duration_ms");
+    for (const auto& phase : phases) {
+      fprintf(stderr,
+              "%-20s %10zu %10zu\n",
+              phase.name.c_str(),
+              phase.start,
+              phase.duration);
+    }
+  }
+
+  std::string summary;
+  for (const auto& phase : phases) {
+    summary += " " + phase.name + "=" + std::to_string(phase.duration) + "ms";
+  }
+  VLOG(1) << "osquery startup phases:" << summary;
+}
+
 void printUsage(const std::string& binary, int tool) {
   // Parse help options before gflags. Only display osquery-related options.
   fprintf(stdout, DESCRIPTION, kVersion.c_str());
@@ -204,7 +273,8 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
       argv_(&argv),
       tool_(tool),
       binary_((tool == OSQUERY_TOOL_DAEMON) ? "osqueryd" : "osqueryi") {
-  std::srand(chrono_clock::now().time_since_epoch().count());
+  kStartupTime = chrono_clock::now();
+  std::srand(kStartupTime.time_since_epoch().count());
 
   // Handled boost filesystem locale problems fixes in 1.56.
   // See issue #1559 for the discussion and upstream boost patch.
@@ -243,6 +313,7 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
   // Let gflags parse the non-help options/flags.
   GFLAGS_NAMESPACE::ParseCommandLineFlags(
       argc_, argv_, (tool == OSQUERY_TOOL_SHELL));
+  auto phase = recordPhase("flags", kStartupTime);
 
   // Set the tool type to allow runtime decisions based on daemon, shell, etc.
   kToolType = tool;
@@ -251,6 +322,13 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
     FLAGS_disable_logging = true;
     // The shell never will not fork a worker.
     FLAGS_disable_watchdog = true;
+    // The shell's database is transient, keep it in memory unless a path is
+    // requested or the database is being inspected.
+    if (Flag::isDefault("database_in_memory") &&
+        Flag::isDefault("database_path") && !FLAGS_database_dump &&
+        DBHandle::supportsInMemory()) {
+      FLAGS_database_in_memory = true;
+    }
     // Get the caller's home dir for temporary storage/state management.
     auto homedir = osqueryHomeDirectory();
     boost::system::error_code ec;
@@ -286,6 +364,13 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
 
   // Initialize the status and results logger.
   initStatusLogger(binary_);
+  recordPhase("status_logger", phase);
+  if (!FLAGS_trace_file.empty()) {
+#ifndef OSQUERY_TRACING
+    LOG(WARNING) << "Tracing spans were not compiled, rebuild with TRACING set";
+#endif
+    setTracing(true);
+  }
   if (tool != OSQUERY_EXTENSION) {
     if (isWorker()) {
       VLOG(1) << "osquery worker initialized [watcher=" << getppid() << "]";
@@ -413,27 +498,48 @@ bool Initializer::isWorker() { return hasWorkerVariable(); }
 
 void Initializer::initActivePlugin(const std::string& type,
                                    const std::string& name) const {
-  // Use a delay, meaning the amount of milliseconds waited for extensions.
-  size_t delay = 0;
   // The timeout is the maximum microseconds in seconds to wait for extensions.
   size_t timeout = atoi(FLAGS_extensions_timeout.c_str()) * 1000000;
   if (timeout < kExtensionInitializeLatencyUS * 10) {
     timeout = kExtensionInitializeLatencyUS * 10;
   }
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::microseconds(timeout);
 
+  // Read the registrations before each check, a plugin broadcast between the
+  // check and the wait ends the wait.
+  auto registrations = getExtensionRegistrations();
   while (!Registry::setActive(type, name)) {
-    if (!Watcher::hasManagedExtensions() || delay > timeout) {
+    auto now = std::chrono::steady_clock::now();
+    if (!Watcher::hasManagedExtensions() || now >= deadline) {
       LOG(ERROR) << "Active " << type << " plugin not found: " << name;
       osquery::shutdown(EXIT_CATASTROPHIC);
     }
-    delay += kExtensionInitializeLatencyUS;
-    ::usleep(kExtensionInitializeLatencyUS);
+    waitForExtensionRegistration(
+        registrations,
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+                .count() +
+            1);
+    registrations = getExtensionRegistrations();
   }
 }
 
 void Initializer::start() const {
   // Load registry/extension modules before extensions.
+  auto phase = chrono_clock::now();
   osquery::loadModules();
+  phase = recordPhase("modules", phase);
+
+  // A standby worker prepares what does not need the database, then waits
+  // until the watcher promotes it to replace a stopped worker.
+  if (isStandbyWorker()) {
+    SQLiteDBManager::prewarm();
+    recordPhase("sql", phase);
+    VLOG(1) << "osquery standby worker waiting [watcher=" << getppid() << "]";
+    awaitPromotion();
+    VLOG(1) << "osquery standby worker promoted";
+    phase = chrono_clock::now();
+  }
 
   // Pre-extension manager initialization options checking.
   if (FLAGS_config_check && !Watcher::hasManagedExtensions()) {
@@ -441,14 +547,25 @@ void Initializer::start() const {
   }
 
   // A daemon must always have R/W access to the database.
+  // The database opens while extensions start and broadcast their plugins.
   DBHandle::setAllowOpen(true);
   DBHandle::setRequireWrite(tool_ == OSQUERY_TOOL_DAEMON);
-  if (!DBHandle::checkDB()) {
-    LOG(ERROR) << RLOG(1629) << binary_
-               << " initialize failed: Could not open RocksDB";
-    auto retcode = (isWorker()) ? EXIT_CATASTROPHIC : EXIT_FAILURE;
-    ::exit(retcode);
-  }
+  auto database = std::async(std::launch::async, []() {
+    auto start = chrono_clock::now();
+    if (FLAGS_database_plugin != "rocks") {
+      // Other backing stores are opened by their plugin.
+      if (!Registry::exists("database", FLAGS_database_plugin, true) ||
+          !Registry::get("database", FLAGS_database_plugin)->setUp().ok()) {
+        return false;
+      }
+    } else if (!DBHandle::checkDB()) {
+      return false;
+    } else {
+      DBHandle::getInstance();
+    }
+    recordPhase("database", start);
+    return true;
+  });
 
   // Bind to an extensions socket and wait for registry additions.
   // After starting the extension manager, osquery MUST shutdown using the
@@ -457,9 +574,19 @@ void Initializer::start() const {
 
   // Then set the config plugin, which uses a single/active plugin.
   initActivePlugin("config", FLAGS_config_plugin);
+  phase = recordPhase("extensions", phase);
+
+  if (!database.get()) {
+    LOG(ERROR) << RLOG(1629) << binary_
+               << " initialize failed: Could not open RocksDB";
+    auto retcode = (isWorker()) ? EXIT_CATASTROPHIC : EXIT_FAILURE;
+    osquery::shutdown(retcode);
+  }
+  phase = chrono_clock::now();
 
   // Run the setup for all lazy registries (tables, SQL).
   Registry::setUp();
+  phase = recordPhase("registry", phase);
 
   if (FLAGS_config_check) {
     // The initiator requested an initialization and config check.
@@ -476,6 +603,13 @@ void Initializer::start() const {
     osquery::shutdown(EXIT_SUCCESS);
   }
 
+  // Event publishers set up their OS resources while the config loads.
+  auto publishers = std::async(std::launch::async, []() {
+    auto start = chrono_clock::now();
+    osquery::attachEventPublishers();
+    recordPhase("event_publishers", start);
+  });
+
   // Load the osquery config using the default/active config plugin.
   auto s = Config::getInstance().load();
   if (!s.ok()) {
@@ -486,6 +620,7 @@ void Initializer::start() const {
       LOG(INFO) << message;
     }
   }
+  phase = recordPhase("config", phase);
 
   // Initialize the status and result plugin logger.
   if (!FLAGS_disable_logging) {
@@ -499,10 +634,15 @@ void Initializer::start() const {
       initActivePlugin("distributed", FLAGS_distributed_plugin);
     }
   }
+  phase = recordPhase("logger", phase);
 
   // Start event threads.
-  osquery::attachEvents();
+  publishers.wait();
+  phase = chrono_clock::now();
+  osquery::attachEventSubscribers();
   EventFactory::delay();
+  recordPhase("event_subscribers", phase);
+  reportStartupPhases();
 }
 
 void Initializer::shutdown() const { osquery::shutdown(EXIT_SUCCESS, false); }
@@ -513,6 +653,11 @@ void shutdown(int retcode, bool wait) {
   // Stop thrift services/clients/and their thread pools.
   Dispatcher::stopServices();
   Dispatcher::joinServices();
+  // Forward the status logs still queued for the logger plugins.
+  flushStatusLogs();
+  if (isTracing() && !writeTrace().ok()) {
+    LOG(WARNING) << "Cannot write the trace to " << FLAGS_trace_file;
+  }
 
   // Hopefully release memory used by global string constructors in gflags.
   GFLAGS_NAMESPACE::ShutDownCommandLineFlags();
@@ -0,0 +1,556 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+namespace {
+
+/// Check if a string byte may be copied without unescaping.
+inline bool isPlainByte(unsigned char c) {
+  return c >= 0x20 && c != '"' && c != '\\';
+}
+
+/**
+ * @brief Check if any of eight bytes ends a plain run of string content.
+ *
+ * Each test is the bit trick for a zero byte, or a byte below 0x20, within a
+ * word. It reports that such a byte exists but not which one.
+ */
+inline bool hasSpecialByte(uint64_t word) {
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  uint64_t quote = word ^ (ones * '"');
+  uint64_t slash = word ^ (ones * '\\');
+  uint64_t special = ((quote - ones) & ~quote) | ((slash - ones) & ~slash) |
+                     ((word - ones * 0x20) & ~word);
+  return (special & highs) != 0;
+}
+
+inline int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void appendUTF8(uint32_t code, std::string& out) {
+  if (code < 0x80) {
+    out += static_cast<char>(code);
+  } else if (code < 0x800) {
+    out += static_cast<char>(0xC0 | (code >> 6));
+    out += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    out += static_cast<char>(0xE0 | (code >> 12));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (code >> 18));
+    out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+/// A single pass JSON reader, one instance parses one document.
+class JSONReader {
+ public:
+  JSONReader(const std::string& json, JSONHandler& handler)
+      : begin_(json.data()),
+        pos_(json.data()),
+        end_(json.data() + json.size()),
+        handler_(handler) {}
+
+  Status parse();
+
+ private:
+  /// Parse the value at the position, the key is its member name.
+  bool parseValue();
+
+  /// Parse a member name and its separator within an object.
+  bool parseKey();
+
+  bool parseString(std::string& out);
+  bool parseEscape(std::string& out);
+  bool parseHex(uint32_t& code);
+  bool parseNumber();
+  bool parseLiteral(const char* literal, size_t length, JSONValueType type);
+
+  void skipWhitespace() {
+    while (pos_ < end_ &&
+           (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t')) {
+      ++pos_;
+    }
+  }
+
+  bool fail(const char* reason) {
+    error_ = reason;
+    return false;
+  }
+
+ private:
+  const char* begin_{nullptr};
+  const char* pos_{nullptr};
+  const char* end_{nullptr};
+  JSONHandler& handler_;
+
+  /// The open objects and arrays, as their opening character.
+  std::vector<char> stack_;
+
+  /// Reused buffers for the current member name and scalar.
+  std::string key_;
+  std::string value_;
+
+  /// Set when the last value parsed opened a non-empty object or array.
+  bool opened_{false};
+
+  const char* error_{nullptr};
+};
+
+Status JSONReader::parse() {
+  // Skip a UTF-8 byte order mark.
+  if (end_ - pos_ >= 3 && std::memcmp(pos_, "\xEF\xBB\xBF", 3) == 0) {
+    pos_ += 3;
+  }
+
+  skipWhitespace();
+  bool expect_value = true;
+  while (error_ == nullptr) {
+    if (expect_value) {
+      opened_ = false;
+      if (!parseValue()) {
+        break;
+      }
+      expect_value = false;
+      if (opened_) {
+        // Read the first member of a non-empty object or array.
+        if (stack_.back() == '{') {
+          if (!parseKey()) {
+            break;
+          }
+        } else {
+          key_.clear();
+        }
+        expect_value = true;
+      }
+      continue;
+    }
+
+    skipWhitespace();
+    if (stack_.empty()) {
+      break;
+    }
+
+    if (pos_ >= end_) {
+      fail("unexpected end of content");
+    } else if (*pos_ == ',') {
+      ++pos_;
+      skipWhitespace();
+      if (stack_.back() == '{') {
+        parseKey();
+      } else {
+        key_.clear();
+      }
+      expect_value = true;
+    } else if (*pos_ == '}' && stack_.back() == '{') {
+      ++pos_;
+      stack_.pop_back();
+      if (!handler_.endObject()) {
+        fail("content rejected");
+      }
+    } else if (*pos_ == ']' && stack_.back() == '[') {
+      ++pos_;
+      stack_.pop_back();
+      if (!handler_.endArray()) {
+        fail("content rejected");
+      }
+    } else {
+      fail("expected a separator or end of container");
+    }
+  }
+
+  if (error_ == nullptr && pos_ != end_) {
+    fail("unexpected content after the document");
+  }
+
+  if (error_ != nullptr) {
+    return Status(1,
+                  "JSON " + std::string(error_) + " at offset " +
+                      std::to_string(pos_ - begin_));
+  }
+  return Status(0, "OK");
+}
+
+bool JSONReader::parseValue() {
+  skipWhitespace();
+  if (pos_ >= end_) {
+    return fail("unexpected end of content");
+  }
+
+  switch (*pos_) {
+  case '{':
+  case '[': {
+    bool object = (*pos_ == '{');
+    if (stack_.size() >= kJSONMaxDepth) {
+      return fail("nesting is too deep");
+    }
+    if (!(object ? handler_.startObject(key_) : handler_.startArray(key_))) {
+      return fail("content rejected");
+    }
+    ++pos_;
+    skipWhitespace();
+    if (pos_ < end_ && *pos_ == (object ? '}' : ']')) {
+      ++pos_;
+      return (object ? handler_.endObject() : handler_.endArray()) ||
+             fail("content rejected");
+    }
+    stack_.push_back(object ? '{' : '[');
+    opened_ = true;
+    return true;
+  }
+  case '"':
+    if (!parseString(value_)) {
+      return false;
+    }
+    return handler_.value(key_, value_, JSON_STRING) ||
+           fail("content rejected");
+  case 't':
+    return parseLiteral("true", 4, JSON_TRUE);
+  case 'f':
+    return parseLiteral("false", 5, JSON_FALSE);
+  case 'n':
+    return parseLiteral("null", 4, JSON_NULL);
+  default:
+    return parseNumber();
+  }
+}
+
+bool JSONReader::parseKey() {
+  if (pos_ >= end_ || *pos_ != '"') {
+    return fail("expected a member name");
+  }
+  if (!parseString(key_)) {
+    return false;
+  }
+  skipWhitespace();
+  if (pos_ >= end_ || *pos_ != ':') {
+    return fail("expected ':' after a member name");
+  }
+  ++pos_;
+  return true;
+}
+
+bool JSONReader::parseString(std::string& out) {
+  // Skip the opening quote.
+  ++pos_;
+  out.clear();
+  while (true) {
+    const char* run = pos_;
+    // Most string content needs no unescaping, skip it a word at a time.
+    while (end_ - pos_ >= 8) {
+      uint64_t word;
+      std::memcpy(&word, pos_, sizeof(word));
+      if (hasSpecialByte(word)) {
+        break;
+      }
+      pos_ += 8;
+    }
+    while (pos_ < end_ && isPlainByte(static_cast<unsigned char>(*pos_))) {
+      ++pos_;
+    }
+    out.append(run, pos_ - run);
+
+    if (pos_ >= end_) {
+      return fail("unterminated string");
+    } else if (*pos_ == '"') {
+      ++pos_;
+      return true;
+    } else if (*pos_ == '\\') {
+      ++pos_;
+      if (!parseEscape(out)) {
+        return false;
+      }
+    } else {
+      return fail("control character in string");
+    }
+  }
+}
+
+bool JSONReader::parseEscape(std::string& out) {
+  if (pos_ >= end_) {
+    return fail("unterminated string");
+  }
+
+  char c = *pos_++;
+  switch (c) {
+  case '"':
+  case '\\':
+  case '/':
+    out += c;
+    return true;
+  case 'b':
+    out += '\b';
+    return true;
+  case 'f':
+    out += '\f';
+    return true;
+  case 'n':
+    out += '\n';
+    return true;
+  case 'r':
+    out += '\r';
+    return true;
+  case 't':
+    out += '\t';
+    return true;
+  case 'u':
+    break;
+  default:
+    --pos_;
+    return fail("invalid escape");
+  }
+
+  uint32_t code = 0;
+  if (!parseHex(code)) {
+    return false;
+  }
+  if (code >= 0xDC00 && code <= 0xDFFF) {
+    return fail("invalid surrogate pair");
+  } else if (code >= 0xD800 && code <= 0xDBFF) {
+    // A high surrogate must be followed by an escaped low surrogate.
+    uint32_t low = 0;
+    if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') {
+      return fail("invalid surrogate pair");
+    }
+    pos_ += 2;
+    if (!parseHex(low)) {
+      return false;
+    }
+    if (low < 0xDC00 || low > 0xDFFF) {
+      return fail("invalid surrogate pair");
+    }
+    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+  }
+  appendUTF8(code, out);
+  return true;
+}
+
+bool JSONReader::parseHex(uint32_t& code) {
+  if (end_ - pos_ < 4) {
+    return fail("invalid unicode escape");
+  }
+  code = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    int digit = hexValue(pos_[i]);
+    if (digit < 0) {
+      return fail("invalid unicode escape");
+    }
+    code = (code << 4) | digit;
+  }
+  pos_ += 4;
+  return true;
+}
+
+bool JSONReader::parseNumber() {
+  const char* start = pos_;
+  if (pos_ < end_ && *pos_ == '-') {
+    ++pos_;
+  }
+
+  // The integer part is 0 or begins with a non-zero digit.
+  if (pos_ < end_ && *pos_ == '0') {
+    ++pos_;
+  } else if (pos_ < end_ && *pos_ >= '1' && *pos_ <= '9') {
+    while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+      ++pos_;
+    }
+  } else {
+    return fail("unexpected character");
+  }
+
+  if (pos_ < end_ && *pos_ == '.') {
+    ++pos_;
+    if (pos_ >= end_ || *pos_ < '0' || *pos_ > '9') {
+      return fail("invalid number");
+    }
+    while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+      ++pos_;
+    }
+  }
+
+  if (pos_ < end_ && (*pos_ == 'e' || *pos_ == 'E')) {
+    ++pos_;
+    if (pos_ < end_ && (*pos_ == '+' || *pos_ == '-')) {
+      ++pos_;
+    }
+    if (pos_ >= end_ || *pos_ < '0' || *pos_ > '9') {
+      return fail("invalid number");
+    }
+    while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+      ++pos_;
+    }
+  }
+
+  value_.assign(start, pos_ - start);
+  return handler_.value(key_, value_, JSON_NUMBER) || fail("content rejected");
+}
+
+bool JSONReader::parseLiteral(const char* literal,
+                              size_t length,
+                              JSONValueType type) {
+  if (static_cast<size_t>(end_ - pos_) < length ||
+      std::memcmp(pos_, literal, length) != 0) {
+    return fail("unexpected character");
+  }
+  pos_ += length;
+  value_.assign(literal, length);
+  return handler_.value(key_, value_, type) || fail("content rejected");
+}
+
+/// Builds a property tree with the layout of read_json.
+class JSONTreeHandler : public JSONHandler {
+ public:
+  explicit JSONTreeHandler(pt::ptree& tree) : root_(tree) {}
+
+  bool startObject(const std::string& key) override {
+    return start(key);
+  }
+
+  bool endObject() override {
+    stack_.pop_back();
+    return true;
+  }
+
+  bool startArray(const std::string& key) override {
+    return start(key);
+  }
+
+  bool endArray() override {
+    stack_.pop_back();
+    return true;
+  }
+
+  bool value(const std::string& key,
+             const std::string& value,
+             JSONValueType type) override {
+    if (stack_.empty()) {
+      root_.data() = value;
+    } else {
+      stack_.back()->push_back(std::make_pair(key, pt::ptree(value)));
+    }
+    return true;
+  }
+
+ private:
+  bool start(const std::string& key) {
+    if (stack_.empty()) {
+      stack_.push_back(&root_);
+    } else {
+      auto child = stack_.back()->push_back(std::make_pair(key, pt::ptree()));
+      stack_.push_back(&child->second);
+    }
+    return true;
+  }
+
+ private:
+  pt::ptree& root_;
+
+  /// The open containers, tree nodes do not move as siblings are added.
+  std::vector<pt::ptree*> stack_;
+};
+
+/// Collects the members of a root object as columns.
+class JSONRowHandler : public JSONHandler {
+ public:
+  explicit JSONRowHandler(Row& r) : r_(r) {}
+
+  bool startObject(const std::string& key) override {
+    return start(key);
+  }
+
+  bool endObject() override {
+    depth_--;
+    return true;
+  }
+
+  bool startArray(const std::string& key) override {
+    return start(key);
+  }
+
+  bool endArray() override {
+    depth_--;
+    return true;
+  }
+
+  bool value(const std::string& key,
+             const std::string& value,
+             JSONValueType type) override {
+    if (depth_ == 1 && !key.empty()) {
+      r_[key] = value;
+    }
+    return true;
+  }
+
+ private:
+  bool start(const std::string& key) {
+    if (depth_ == 1 && !key.empty()) {
+      r_[key].clear();
+    }
+    depth_++;
+    return true;
+  }
+
+ private:
+  Row& r_;
+  size_t depth_{0};
+};
+}
+
+Status parseJSONEvents(const std::string& json, JSONHandler& handler) {
+  JSONReader reader(json, handler);
+  return reader.parse();
+}
+
+Status parseJSONTree(const std::string& json, pt::ptree& tree) {
+  // Like read_json, the tree is only replaced if all of the content parses.
+  pt::ptree parsed;
+  JSONTreeHandler handler(parsed);
+  auto status = parseJSONEvents(json, handler);
+  if (status.ok()) {
+    tree.swap(parsed);
+  }
+  return status;
+}
+
+Status parseJSONRow(const std::string& json, Row& r) {
+  Row parsed;
+  JSONRowHandler handler(parsed);
+  auto status = parseJSONEvents(json, handler);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (auto& column : parsed) {
+    r[column.first] = std::move(column.second);
+  }
+  return status;
+}
+}
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/database.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The maximum nesting of JSON objects and arrays accepted.
+const size_t kJSONMaxDepth = 512;
+
+/// The kind of a JSON scalar passed to JSONHandler::value.
+enum JSONValueType {
+  JSON_STRING = 0,
+  JSON_NUMBER,
+  JSON_TRUE,
+  JSON_FALSE,
+  JSON_NULL,
+};
+
+/**
+ * @brief Receives the events of a JSON document from parseJSONEvents.
+ *
+ * The key is the member name within objects and empty within arrays and for
+ * the root. References passed to a handler are only valid during the call.
+ * Returning false from any event stops the parse with an error.
+ */
+class JSONHandler {
+ public:
+  virtual ~JSONHandler() {}
+
+  /// An object begins.
+  virtual bool startObject(const std::string& key) = 0;
+
+  /// The most recent object or array ends.
+  virtual bool endObject() = 0;
+
+  /// An array begins.
+  virtual bool startArray(const std::string& key) = 0;
+
+  /// The most recent object or array ends.
+  virtual bool endArray() = 0;
+
+  /// A scalar, numbers and literals are passed as their JSON text.
+  virtual bool value(const std::string& key,
+                     const std::string& value,
+                     JSONValueType type) = 0;
+};
+
+/**
+ * @brief Parse JSON content in one pass, sending each member to a handler.
+ *
+ * The content is validated as it is read, strings are unescaped to UTF-8 and
+ * a leading byte order mark is skipped. Nesting is tracked without recursion.
+ *
+ * @param json The JSON content.
+ * @param handler Receives each object, array, and scalar in document order.
+ * @return Failure with the byte offset if the content is not valid JSON.
+ */
+Status parseJSONEvents(const std::string& json, JSONHandler& handler);
+
+/**
+ * @brief Parse JSON content into a property tree.
+ *
+ * The tree matches boost::property_tree::read_json: array elements have empty
+ * keys, duplicate keys are kept, and scalars keep their JSON text, so literals
+ * are "true", "false", and "null". This avoids read_json's stream and its
+ * per-character callbacks.
+ */
+Status parseJSONTree(const std::string& json,
+                     boost::property_tree::ptree& tree);
+
+/**
+ * @brief Parse a flat JSON object into a Row without building a tree.
+ *
+ * Members with an empty name are skipped and nested objects and arrays become
+ * empty values, matching deserializeRow.
+ */
+Status parseJSONRow(const std::string& json, Row& r);
+}
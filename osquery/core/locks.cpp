@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+/// Locks are often static members, the registry is created on first use.
+/// It is never destroyed, locks may be used by other static destructors.
+static std::mutex& locksMutex() {
+  static auto* mutex = new std::mutex();
+  return *mutex;
+}
+
+static std::map<std::string, std::unique_ptr<LockStats>>& locks() {
+  static auto* locks = new std::map<std::string, std::unique_ptr<LockStats>>();
+  return *locks;
+}
+
+LockStats& getLockStats(const std::string& name) {
+  std::lock_guard<std::mutex> lock(locksMutex());
+  auto& stats = locks()[name];
+  if (stats == nullptr) {
+    stats.reset(new LockStats());
+  }
+  return *stats;
+}
+
+void getLocks(
+    std::function<void(const std::string& name, const LockStats& stats)>
+        predicate) {
+  std::lock_guard<std::mutex> lock(locksMutex());
+  for (const auto& stats : locks()) {
+    predicate(stats.first, *stats.second);
+  }
+}
+}
@@ -0,0 +1,227 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+
+#if defined(OSQUERY_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#elif defined(OSQUERY_TCMALLOC)
+#include <gperftools/malloc_extension_c.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "osquery/core/memory.h"
+
+namespace osquery {
+
+static const char* kMemoryArenaNames[ARENA_COUNT] = {
+    "default", "events", "sql", "database", "extensions",
+};
+
+#ifdef OSQUERY_JEMALLOC
+/// The jemalloc arena index of each subsystem arena.
+static unsigned kArenaIndexes[ARENA_COUNT] = {0};
+
+/// Arenas are created on first use, valid if each was created.
+static std::once_flag kArenasCreated;
+static bool kArenasValid{false};
+
+static void createArenas() {
+  for (size_t i = ARENA_DEFAULT + 1; i < ARENA_COUNT; i++) {
+    unsigned index = 0;
+    size_t size = sizeof(index);
+    if (mallctl("arenas.create", &index, &size, nullptr, 0) != 0) {
+      return;
+    }
+    kArenaIndexes[i] = index;
+  }
+  kArenasValid = true;
+}
+
+/// The jemalloc index of a subsystem arena, false for the default arena.
+static bool getArenaIndex(MemoryArena arena, unsigned& index) {
+  if (arena <= ARENA_DEFAULT || arena >= ARENA_COUNT) {
+    return false;
+  }
+  std::call_once(kArenasCreated, createArenas);
+  index = kArenaIndexes[arena];
+  return kArenasValid;
+}
+
+template <typename T>
+static T readStat(const std::string& name) {
+  T value = 0;
+  size_t size = sizeof(value);
+  if (mallctl(name.c_str(), &value, &size, nullptr, 0) != 0) {
+    return 0;
+  }
+  return value;
+}
+
+/// jemalloc statistics are a snapshot, refreshed by advancing the epoch.
+static void refreshStats() {
+  uint64_t epoch = 1;
+  size_t size = sizeof(epoch);
+  mallctl("epoch", &epoch, &size, &epoch, size);
+}
+
+static void getArenaStats(unsigned index, MemoryArenaStats& stats) {
+  auto prefix = "stats.arenas." + std::to_string(index) + ".";
+  auto page = readStat<size_t>("arenas.page");
+  stats.allocated = readStat<size_t>(prefix + "small.allocated") +
+                    readStat<size_t>(prefix + "large.allocated");
+  // Dirty and muzzy pages are unused but still mapped.
+  stats.retained = (readStat<size_t>(prefix + "pdirty") +
+                    readStat<size_t>(prefix + "pmuzzy")) *
+                   page;
+  stats.threads = readStat<unsigned>(prefix + "nthreads");
+}
+#endif
+
+void setThreadArena(MemoryArena arena) {
+#ifdef OSQUERY_JEMALLOC
+  unsigned index = 0;
+  if (getArenaIndex(arena, index)) {
+    mallctl("thread.arena", nullptr, nullptr, &index, sizeof(index));
+  }
+#endif
+}
+
+MemoryArenaScope::MemoryArenaScope(MemoryArena arena) {
+#ifdef OSQUERY_JEMALLOC
+  unsigned index = 0;
+  if (getArenaIndex(arena, index)) {
+    size_t size = sizeof(previous_);
+    bound_ = (mallctl("thread.arena", &previous_, &size, &index,
+                      sizeof(index)) == 0);
+  }
+#endif
+}
+
+MemoryArenaScope::~MemoryArenaScope() {
+#ifdef OSQUERY_JEMALLOC
+  if (bound_) {
+    mallctl("thread.arena", nullptr, nullptr, &previous_, sizeof(previous_));
+  }
+#endif
+}
+
+const char* getMemoryArenaName(MemoryArena arena) {
+  if (arena < ARENA_DEFAULT || arena >= ARENA_COUNT) {
+    return "";
+  }
+  return kMemoryArenaNames[arena];
+}
+
+const char* getMemoryAllocator() {
+#if defined(OSQUERY_JEMALLOC)
+  return "jemalloc";
+#elif defined(OSQUERY_TCMALLOC)
+  return "tcmalloc";
+#else
+  return "system";
+#endif
+}
+
+bool hasMemoryArenas() {
+#ifdef OSQUERY_JEMALLOC
+  unsigned index = 0;
+  return getArenaIndex(ARENA_EVENTS, index);
+#else
+  return false;
+#endif
+}
+
+Status getMemoryArenaStats(MemoryArena arena, MemoryArenaStats& stats) {
+#ifdef OSQUERY_JEMALLOC
+  if (!hasMemoryArenas()) {
+    return Status(1, "Cannot create allocator arenas");
+  }
+  if (arena < ARENA_DEFAULT || arena >= ARENA_COUNT) {
+    return Status(1, "Unknown arena");
+  }
+
+  refreshStats();
+  unsigned index = 0;
+  if (getArenaIndex(arena, index)) {
+    getArenaStats(index, stats);
+    return Status(0, "OK");
+  }
+
+  // The default arena is every automatic arena, the total less subsystems.
+  getArenaStats(MALLCTL_ARENAS_ALL, stats);
+  for (size_t i = ARENA_DEFAULT + 1; i < ARENA_COUNT; i++) {
+    MemoryArenaStats subsystem;
+    getArenaStats(kArenaIndexes[i], subsystem);
+    stats.allocated -= std::min(stats.allocated, subsystem.allocated);
+    stats.retained -= std::min(stats.retained, subsystem.retained);
+    stats.threads -= std::min(stats.threads, subsystem.threads);
+  }
+  return Status(0, "OK");
+#else
+  return Status(1, "Allocator arenas require ALLOCATOR=jemalloc");
+#endif
+}
+
+Status getMemoryStats(MemoryArenaStats& stats) {
+#if defined(OSQUERY_JEMALLOC)
+  refreshStats();
+  getArenaStats(MALLCTL_ARENAS_ALL, stats);
+#elif defined(OSQUERY_TCMALLOC)
+  size_t allocated = 0;
+  size_t unused = 0;
+  MallocExtension_GetNumericProperty("generic.current_allocated_bytes",
+                                     &allocated);
+  MallocExtension_GetNumericProperty("tcmalloc.pageheap_free_bytes", &unused);
+  stats.allocated = allocated;
+  stats.retained = unused;
+#elif defined(__APPLE__)
+  malloc_statistics_t info;
+  malloc_zone_statistics(nullptr, &info);
+  stats.allocated = info.size_in_use;
+  stats.retained = info.size_allocated - info.size_in_use;
+#elif defined(__GLIBC__)
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+  auto info = mallinfo2();
+#else
+  auto info = mallinfo();
+#endif
+  stats.allocated = static_cast<uint64_t>(info.uordblks) + info.hblkhd;
+  stats.retained = static_cast<uint64_t>(info.fordblks);
+#else
+  return Status(1, "Allocator statistics are not supported");
+#endif
+  return Status(0, "OK");
+}
+
+Status purgeMemory() {
+#if defined(OSQUERY_JEMALLOC)
+  mallctl("thread.tcache.flush", nullptr, nullptr, nullptr, 0);
+  auto purge = "arena." + std::to_string(MALLCTL_ARENAS_ALL) + ".purge";
+  if (mallctl(purge.c_str(), nullptr, nullptr, nullptr, 0) != 0) {
+    return Status(1, "Cannot purge allocator arenas");
+  }
+#elif defined(OSQUERY_TCMALLOC)
+  MallocExtension_ReleaseFreeMemory();
+#elif defined(__APPLE__)
+  malloc_zone_pressure_relief(nullptr, 0);
+#elif defined(__GLIBC__)
+  malloc_trim(0);
+#else
+  return Status(1, "Allocator purging is not supported");
+#endif
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The subsystems with their own allocator arena.
+enum MemoryArena {
+  /// Allocations outside of any subsystem scope.
+  ARENA_DEFAULT = 0,
+  ARENA_EVENTS,
+  ARENA_SQL,
+  ARENA_DATABASE,
+  ARENA_EXTENSIONS,
+  ARENA_COUNT,
+};
+
+/// Allocated and retained bytes of an arena or of the process.
+struct MemoryArenaStats {
+  /// Bytes of live allocations.
+  uint64_t allocated{0};
+
+  /// Bytes freed to the allocator but not returned to the system.
+  uint64_t retained{0};
+
+  /// Threads bound to the arena, 0 if the allocator does not report it.
+  uint64_t threads{0};
+};
+
+/**
+ * @brief Bind the calling thread's allocations to a subsystem arena.
+ *
+ * Arenas only exist when osquery is built with ALLOCATOR=jemalloc, otherwise
+ * this does nothing. Memory is always freed to the arena that allocated it,
+ * so a thread may be bound at any time. Long-lived threads, such as the
+ * scheduler and the event publishers, are bound once as they start so their
+ * thread caches are filled only from their own arena.
+ */
+void setThreadArena(MemoryArena arena);
+
+/// Bind the calling thread to an arena until the scope ends.
+class MemoryArenaScope : private boost::noncopyable {
+ public:
+  explicit MemoryArenaScope(MemoryArena arena);
+  ~MemoryArenaScope();
+
+ private:
+  /// The allocator's arena the thread was bound to.
+  unsigned previous_{0};
+  bool bound_{false};
+};
+
+/// The name of an arena, as reported by the osquery_memory table.
+const char* getMemoryArenaName(MemoryArena arena);
+
+/// The allocator osquery was built with: jemalloc, tcmalloc, or system.
+const char* getMemoryAllocator();
+
+/// Check if the allocator keeps an arena for each subsystem.
+bool hasMemoryArenas();
+
+/**
+ * @brief Statistics of one subsystem arena.
+ *
+ * The default arena reports every allocation not made within a subsystem
+ * arena. Fails if the allocator does not have arenas.
+ */
+Status getMemoryArenaStats(MemoryArena arena, MemoryArenaStats& stats);
+
+/// Statistics of the allocator for the whole process.
+Status getMemoryStats(MemoryArenaStats& stats);
+
+/**
+ * @brief Return memory freed to the allocator to the system.
+ *
+ * The calling thread's cache is flushed and every arena purges its unused
+ * pages. Without jemalloc the system allocator is trimmed where supported.
+ */
+Status purgeMemory();
+}
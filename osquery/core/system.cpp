@@ -9,6 +9,7 @@
  */
 
 #include <ctime>
+#include <mutex>
 #include <sstream>
 
 #include <sys/types.h>
@@ -111,32 +112,57 @@ std::string generateHostUUID() {
 #endif
 }
 
+/// Protects the cached host identifier.
+static std::mutex kHostIdentifierMutex;
+
+/// The cached host identifier and the host_identifier flag it was read for.
+static std::string kHostIdentifier;
+static std::string kHostIdentifierSource;
+
 std::string getHostIdentifier() {
+  std::lock_guard<std::mutex> lock(kHostIdentifierMutex);
+  if (!kHostIdentifier.empty() &&
+      kHostIdentifierSource == FLAGS_host_identifier) {
+    return kHostIdentifier;
+  }
+
+  kHostIdentifierSource = FLAGS_host_identifier;
   if (FLAGS_host_identifier != "uuid") {
     // use the hostname as the default machine identifier
-    return osquery::getHostname();
+    kHostIdentifier = osquery::getHostname();
+    return kHostIdentifier;
   }
 
   // Generate a identifier/UUID for this application launch, and persist.
-  static std::string ident;
-  if (ident.size() == 0) {
-    // Lookup the host identifier (UUID) previously generated and stored.
-    getDatabaseValue(kPersistentSettings, "hostIdentifier", ident);
-    if (ident.size() == 0) {
-      ident = osquery::generateHostUUID();
-      VLOG(1) << "Using uuid " << ident << " as host identifier";
-      setDatabaseValue(kPersistentSettings, "hostIdentifier", ident);
-    }
+  // Lookup the host identifier (UUID) previously generated and stored.
+  getDatabaseValue(kPersistentSettings, "hostIdentifier", kHostIdentifier);
+  if (kHostIdentifier.size() == 0) {
+    kHostIdentifier = osquery::generateHostUUID();
+    VLOG(1) << "Using uuid " << kHostIdentifier << " as host identifier";
+    setDatabaseValue(kPersistentSettings, "hostIdentifier", kHostIdentifier);
   }
+  return kHostIdentifier;
+}
 
-  return ident;
+void resetHostIdentifier() {
+  std::lock_guard<std::mutex> lock(kHostIdentifierMutex);
+  kHostIdentifier.clear();
 }
 
 std::string getAsciiTime() {
-  auto result = std::time(nullptr);
-  auto time_str = std::string(std::asctime(std::gmtime(&result)));
-  boost::algorithm::trim(time_str);
-  return time_str + " UTC";
+  return getAsciiTime(getUnixTime());
+}
+
+std::string getAsciiTime(size_t time) {
+  auto result = static_cast<std::time_t>(time);
+  struct tm utc;
+  char buffer[32] = {0};
+  if (gmtime_r(&result, &utc) == nullptr ||
+      std::strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", &utc) ==
+          0) {
+    return "";
+  }
+  return std::string(buffer) + " UTC";
 }
 
 size_t getUnixTime() {
@@ -8,6 +8,8 @@
  *
  */
 
+#include <atomic>
+
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/database.h>
@@ -15,14 +17,52 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
 FLAG(bool, disable_caching, false, "Disable scheduled query caching");
 
-size_t TablePlugin::kCacheInterval = 0;
-size_t TablePlugin::kCacheStep = 0;
+const size_t kDefaultTableCost = 1;
+
+thread_local size_t TablePlugin::kCacheInterval = 0;
+thread_local size_t TablePlugin::kCacheStep = 0;
+thread_local std::string TablePlugin::kQueryName;
+
+/// Boot cached results of tables without devices are never invalidated.
+const size_t kBootGeneration = 1;
+
+/// The generation of cached device results, incremented by hotplugs.
+static std::atomic<size_t> kHotplugGeneration{kBootGeneration + 1};
+
+/// Set while a hotplug event publisher invalidates cached device results.
+static std::atomic<bool> kHotplugWatched{false};
+
+void TablePlugin::invalidateHotplugCache() { kHotplugGeneration++; }
+
+void TablePlugin::setHotplugWatched(bool watched) {
+  if (kHotplugWatched.exchange(watched) != watched) {
+    kHotplugGeneration++;
+  }
+}
+
+bool TablePlugin::CacheEntry::fresh(size_t now, size_t step) const {
+  if (generation == kBootGeneration) {
+    return true;
+  } else if (generation != 0) {
+    return generation == kHotplugGeneration;
+  } else if (stepped) {
+    // Steps are only known while a scheduled query runs.
+    return step > 0 && step < expires;
+  }
+  return now < expires;
+}
+
+bool TablePlugin::isBootCached() const {
+  return cacheBoot() && (!cacheHotplug() || kHotplugWatched);
+}
 
 const std::map<ColumnType, std::string> kColumnTypeNames = {
     {UNKNOWN_TYPE, "UNKNOWN"},
@@ -34,6 +74,22 @@ const std::map<ColumnType, std::string> kColumnTypeNames = {
     {BLOB_TYPE, "BLOB"},
 };
 
+std::string integerText(long long value) {
+  char buffer[kDecimalDigitsMax + 1];
+  if (value < 0) {
+    buffer[0] = '-';
+    // Negate as unsigned, the magnitude of LLONG_MIN is not a long long.
+    auto magnitude = 0ULL - static_cast<unsigned long long>(value);
+    return std::string(buffer, formatDecimal(magnitude, buffer + 1) + 1);
+  }
+  return std::string(buffer, formatDecimal(value, buffer));
+}
+
+std::string unsignedText(unsigned long long value) {
+  char buffer[kDecimalDigitsMax];
+  return std::string(buffer, formatDecimal(value, buffer));
+}
+
 Status TablePlugin::addExternal(const std::string& name,
                                 const PluginResponse& response) {
   // Attach the table.
@@ -55,6 +111,9 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
                                         PluginRequest& request) {
   pt::ptree tree;
   tree.put("limit", context.limit);
+  if (context.sample_rate < 1) {
+    tree.put("sample_rate", context.sample_rate);
+  }
 
   // The QueryContext contains a constraint map from column to type information
   // and the list of operand/expression constraints applied to that column from
@@ -68,6 +127,15 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
   }
   tree.add_child("constraints", constraints);
 
+  // Only a projected context lists columns, otherwise every column is used.
+  if (context.projected) {
+    pt::ptree used_columns;
+    for (const auto& column : context.used_columns) {
+      used_columns.push_back(std::make_pair("", pt::ptree(column)));
+    }
+    tree.add_child("used_columns", used_columns);
+  }
+
   // Write the property tree as a JSON string into the PluginRequest.
   std::ostringstream output;
   try {
@@ -96,10 +164,19 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
 
   // Set the context limit and deserialize each column constraint list.
   context.limit = tree.get<int>("limit", 0);
+  context.sample_rate = tree.get<double>("sample_rate", 1.0);
   for (const auto& constraint : tree.get_child("constraints")) {
     auto column_name = constraint.second.get<std::string>("name");
     context.constraints[column_name].unserialize(constraint.second);
   }
+
+  auto used_columns = tree.get_child_optional("used_columns");
+  if (used_columns) {
+    context.projected = true;
+    for (const auto& column : *used_columns) {
+      context.used_columns.insert(column.second.data());
+    }
+  }
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -121,14 +198,12 @@ Status TablePlugin::call(const PluginRequest& request,
     response = generate(context);
   } else if (request.at("action") == "columns") {
     // "columns" returns a PluginRequest filled with column information
-    // such as name and type.
-    const auto& column_list = columns();
-    for (const auto& column : column_list) {
-      response.push_back(
-          {{"name", column.first}, {"type", columnTypeName(column.second)}});
-    }
+    // such as name, type, and optional planner options.
+    response = routeInfo();
   } else if (request.at("action") == "definition") {
     response.push_back({{"definition", columnDefinition()}});
+  } else if (request.at("action") == "attributes") {
+    response.push_back({{"cost", std::to_string(cost())}});
   } else {
     return Status(1, "Unknown table plugin action: " + request.at("action"));
   }
@@ -136,46 +211,367 @@ Status TablePlugin::call(const PluginRequest& request,
   return Status(0, "OK");
 }
 
+void TablePlugin::generateRows(QueryContext& context, TableRows& rows) {
+  // Adapt the Row maps of a table implementing only generate.
+  auto data = generate(context);
+  setRowsFromQueryData(tableColumns(), data, rows);
+}
+
+void TablePlugin::setRowsFromQueryData(const TableColumns& columns,
+                                       const QueryData& data,
+                                       TableRows& rows) {
+  rows.reserve(rows.size() + data.size());
+  for (const auto& r : data) {
+    TableRow row;
+    row.reserve(columns.size());
+    for (const auto& column : columns) {
+      auto value = r.find(column.first);
+      row.push_back((value == r.end()) ? std::string() : value->second);
+    }
+    rows.push_back(std::move(row));
+  }
+}
+
+void TablePlugin::setRowsFromQueryData(const TableColumns& columns,
+                                       QueryData& data,
+                                       TableRows& rows) {
+  rows.reserve(rows.size() + data.size());
+  for (auto& r : data) {
+    TableRow row;
+    row.reserve(columns.size());
+    for (const auto& column : columns) {
+      auto value = r.find(column.first);
+      if (value == r.end()) {
+        row.push_back(std::string());
+      } else {
+        row.push_back(std::move(value->second));
+      }
+    }
+    rows.push_back(std::move(row));
+  }
+  data.clear();
+}
+
+QueryData TablePlugin::generateFromTasks(RowTasks tasks) {
+  QueryData results;
+  for (auto& task : tasks) {
+    task(results);
+  }
+  return results;
+}
+
+bool LazyRowGenerator::next(TableRows& rows) {
+  QueryData results;
+  while (position_ < tasks_.size() && results.size() < batch_size_) {
+    tasks_[position_](results);
+    // Release any state captured by the completed task.
+    tasks_[position_++] = nullptr;
+  }
+  TablePlugin::setRowsFromQueryData(columns_, results, rows);
+  return (position_ < tasks_.size());
+}
+
+std::string TablePlugin::cellText(const TableCell& cell) {
+  if (const auto* value = boost::get<long long int>(&cell)) {
+    return BIGINT(*value);
+  } else if (const auto* value = boost::get<double>(&cell)) {
+    return DOUBLE(*value);
+  }
+  return boost::get<std::string>(cell);
+}
+
+void TablePlugin::setQueryDataFromRows(const TableColumns& columns,
+                                       const TableRows& rows,
+                                       QueryData& data) {
+  RowKeys keys;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    keys.add(i, columns[i].first);
+  }
+
+  data.reserve(data.size() + rows.size());
+  for (const auto& row : rows) {
+    if (row.size() < columns.size()) {
+      // A short row only has keys for its cells.
+      Row r;
+      for (size_t i = 0; i < row.size(); ++i) {
+        r[columns[i].first] = cellText(row[i]);
+      }
+      data.push_back(std::move(r));
+      continue;
+    }
+    data.push_back(keys.build([&row](size_t i, RowData& field) {
+      field = cellText(row[i]);
+    }));
+  }
+}
+
+const TableColumns& TablePlugin::tableColumns() const {
+  std::call_once(columns_once_, [this]() { columns_cache_ = columns(); });
+  return columns_cache_;
+}
+
 std::string TablePlugin::columnDefinition() const {
-  return osquery::columnDefinition(columns());
+  return osquery::columnDefinition(tableColumns());
 }
 
 PluginResponse TablePlugin::routeInfo() const {
   // Route info consists of only the serialized column information.
   PluginResponse response;
-  for (const auto& column : columns()) {
+  auto options = columnOptions();
+  for (const auto& column : tableColumns()) {
     response.push_back(
         {{"name", column.first}, {"type", columnTypeName(column.second)}});
+    if (options.count(column.first) > 0) {
+      response.back()["options"] = INTEGER(options.at(column.first));
+    }
   }
   return response;
 }
 
+/// Build a cache key from the constraints and hints of a query.
+static std::string cacheKey(const QueryContext& context) {
+  std::string key = std::to_string(context.limit);
+  if (context.descending) {
+    key += '\x1b';
+  }
+  for (const auto& column : context.constraints) {
+    for (const auto& constraint : column.second.getAll()) {
+      key += '\x1f' + column.first + '\x1e' + std::to_string(constraint.op) +
+             '\x1e' + constraint.expr;
+    }
+  }
+
+  // Results of a projected query may omit the unused columns.
+  if (context.projected) {
+    key += '\x1d';
+    for (const auto& column : context.used_columns) {
+      key += '\x1f' + column;
+    }
+  }
+
+  // Sampled results are not those of a complete scan.
+  if (context.sample_rate < 1) {
+    key += '\x1c' + std::to_string(context.sample_rate);
+  }
+  return key;
+}
+
 bool TablePlugin::isCached(size_t step) {
-  return (!FLAGS_disable_caching && step < last_cached_ + last_interval_);
+  if (FLAGS_disable_caching) {
+    return false;
+  }
+
+  ReadLock lock(cache_mutex_);
+  auto entry = cache_.find(cacheKey(QueryContext()));
+  return (entry != cache_.end() && entry->second.fresh(getUnixTime(), step));
 }
 
 QueryData TablePlugin::getCache() const {
   VLOG(1) << "Retrieving results from cache for table: " << getName();
-  // Lookup results from database and deserialize.
-  std::string content;
-  getDatabaseValue(kQueries, "cache." + getName(), content);
-  QueryData results;
-  deserializeQueryDataJSON(content, results);
-  return results;
+  ReadLock lock(cache_mutex_);
+  auto entry = cache_.find(cacheKey(QueryContext()));
+  if (entry == cache_.end()) {
+    return QueryData();
+  }
+  return *entry->second.results;
 }
 
 void TablePlugin::setCache(size_t step,
                            size_t interval,
                            const QueryData& results) {
-  // Serialize QueryData and save to database.
-  std::string content;
-  if (!FLAGS_disable_caching && serializeQueryDataJSON(results, content)) {
-    last_cached_ = step;
-    last_interval_ = interval;
-    setDatabaseValue(kQueries, "cache." + getName(), content);
+  if (!FLAGS_disable_caching) {
+    storeCache(cacheKey(QueryContext()),
+               step + interval,
+               std::make_shared<const QueryData>(results),
+               0,
+               true);
+  }
+}
+
+QueryDataRef TablePlugin::getCache(const QueryContext& context) const {
+  if (FLAGS_disable_caching) {
+    return nullptr;
+  }
+
+  auto key = cacheKey(context);
+  ReadLock lock(cache_mutex_);
+  auto entry = cache_.find(key);
+  if (entry == cache_.end() ||
+      !entry->second.fresh(getUnixTime(), kCacheStep)) {
+    return nullptr;
+  }
+  VLOG(1) << "Retrieving results from cache for table: " << getName();
+  return entry->second.results;
+}
+
+void TablePlugin::setCache(const QueryContext& context,
+                           const QueryData& results) {
+  if (!FLAGS_disable_caching) {
+    storeResults(cacheKey(context),
+                 std::make_shared<const QueryData>(results),
+                 kHotplugGeneration);
+  }
+}
+
+/// Select the rows of an unconstrained scan matching the context.
+static QueryDataRef filterRows(const QueryDataRef& rows,
+                               const QueryContext& context) {
+  auto results = std::make_shared<QueryData>();
+  for (const auto& row : *rows) {
+    bool match = true;
+    for (const auto& column : context.constraints) {
+      if (column.second.getAll().empty()) {
+        continue;
+      }
+      auto value = row.find(column.first);
+      if (value == row.end() || !column.second.matches(value->second)) {
+        match = false;
+        break;
+      }
+    }
+    if (match) {
+      results->push_back(row);
+    }
+  }
+  return results;
+}
+
+QueryDataRef TablePlugin::generateCached(
+    QueryContext& context,
+    const std::function<QueryData(QueryContext&)>& generator) {
+  if (FLAGS_disable_caching) {
+    return std::make_shared<const QueryData>(generator(context));
+  }
+
+  // Every constraint is part of the key, generators may use any of them.
+  // Constraints only on index and default columns select a subset of the
+  // rows of an unconstrained scan, SQLite evaluates them again.
+  auto options = columnOptions();
+  bool constrained = false;
+  bool subset = (context.sample_rate >= 1 && !context.descending);
+  for (const auto& column : context.constraints) {
+    if (column.second.getAll().empty()) {
+      continue;
+    }
+    constrained = true;
+    auto option = options.find(column.first);
+    if (option != options.end() && option->second != COLUMN_DEFAULT &&
+        option->second != COLUMN_INDEX) {
+      subset = false;
+    }
+  }
+
+  auto key = cacheKey(context);
+  auto scan_key = cacheKey(QueryContext());
+  subset = subset && constrained;
+
+  std::promise<QueryDataRef> promise;
+  std::shared_future<QueryDataRef> waiting;
+  bool filter = false;
+  {
+    auto now = getUnixTime();
+    WriteLock lock(cache_mutex_);
+    auto entry = cache_.find(key);
+    if (entry != cache_.end() && entry->second.fresh(now, kCacheStep)) {
+      VLOG(1) << "Retrieving results from cache for table: " << getName();
+      return entry->second.results;
+    }
+
+    entry = cache_.find(scan_key);
+    if (subset && entry != cache_.end() &&
+        entry->second.fresh(now, kCacheStep)) {
+      VLOG(1) << "Filtering cached results for table: " << getName();
+      return filterRows(entry->second.results, context);
+    }
+
+    auto pending = pending_.find(key);
+    if (pending == pending_.end() && subset) {
+      pending = pending_.find(scan_key);
+      filter = (pending != pending_.end());
+    }
+
+    if (pending != pending_.end()) {
+      waiting = pending->second;
+    } else {
+      pending_[key] = promise.get_future().share();
+    }
+  }
+
+  if (waiting.valid()) {
+    // Another query is generating compatible results, share its scan.
+    VLOG(1) << "Waiting for shared results for table: " << getName();
+    auto results = waiting.get();
+    return (filter) ? filterRows(results, context) : results;
+  }
+
+  // A hotplug while generating invalidates the results being generated.
+  size_t generation = kHotplugGeneration;
+  QueryDataRef results;
+  try {
+    results = std::make_shared<const QueryData>(generator(context));
+  } catch (...) {
+    {
+      WriteLock lock(cache_mutex_);
+      pending_.erase(key);
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+
+  storeResults(key, results, generation);
+  {
+    WriteLock lock(cache_mutex_);
+    pending_.erase(key);
+  }
+  promise.set_value(results);
+  return results;
+}
+
+void TablePlugin::storeResults(const std::string& key,
+                               QueryDataRef results,
+                               size_t generation) {
+  if (isBootCached()) {
+    storeCache(key,
+               0,
+               std::move(results),
+               (cacheHotplug()) ? generation : kBootGeneration);
+    return;
+  }
+
+  auto ttl = cacheTTL();
+  if (ttl == 0) {
+    // Without a declared TTL results are shared within a scheduled interval.
+    ttl = kCacheInterval;
+  }
+
+  if (ttl > 0) {
+    storeCache(key, getUnixTime() + ttl, std::move(results));
   }
 }
 
+void TablePlugin::storeCache(const std::string& key,
+                             size_t expires,
+                             QueryDataRef results,
+                             size_t generation,
+                             bool stepped) {
+  auto now = getUnixTime();
+  WriteLock lock(cache_mutex_);
+  // Drop stale entries, each set of constraints adds an entry.
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (!it->second.fresh(now, kCacheStep)) {
+      it = cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  auto& entry = cache_[key];
+  entry.results = std::move(results);
+  entry.expires = expires;
+  entry.generation = generation;
+  entry.stepped = stepped;
+}
+
 std::string columnDefinition(const TableColumns& columns) {
   std::string statement = "(";
   for (size_t i = 0; i < columns.size(); ++i) {
@@ -299,6 +695,98 @@ void ConstraintList::unserialize(const boost::property_tree::ptree& tree) {
   affinity = columnTypeName(tree.get<std::string>("affinity", "UNKNOWN"));
 }
 
+/// The sample rate of the queries run by each thread.
+static thread_local double kQuerySampleRate{1.0};
+
+void setQuerySampleRate(double rate) {
+  kQuerySampleRate = (rate > 0 && rate < 1) ? rate : 1.0;
+}
+
+double getQuerySampleRate() {
+  return kQuerySampleRate;
+}
+
+/// The scope of the query run by each thread.
+static thread_local QueryResources* kQueryResources{nullptr};
+
+QueryResources::QueryResources() : previous_(kQueryResources) {
+  kQueryResources = this;
+}
+
+QueryResources::QueryResources(QueryResources* parent)
+    : previous_(kQueryResources) {
+  // Resources kept by the worker are held by the query's scope.
+  kQueryResources = parent;
+}
+
+QueryResources::~QueryResources() {
+  kQueryResources = previous_;
+}
+
+bool QueryResources::keep(const std::shared_ptr<void>& resource) {
+  auto scope = kQueryResources;
+  if (scope == nullptr) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(scope->mutex_);
+  scope->resources_.insert(resource);
+  return true;
+}
+
+QueryResources* QueryResources::current() {
+  return kQueryResources;
+}
+
+bool isSampledKey(const std::string& key, double rate) {
+  if (rate >= 1) {
+    return true;
+  }
+
+  // FNV-1a, finished with the MurmurHash3 mix so the high bits are uniform.
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& c : key) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return static_cast<double>(hash >> 11) / (1ULL << 53) < rate;
+}
+
+bool QueryContext::isSampled(const std::string& key) const {
+  return isSampledKey(key, sample_rate);
+}
+
+void QueryContext::reset() {
+  for (auto& constraint : constraints) {
+    constraint.second.clear();
+  }
+  limit = 0;
+  descending = false;
+  used_columns.clear();
+  projected = false;
+  traverse = false;
+  sample_rate = 1.0;
+}
+
+bool QueryContext::isColumnUsed(const std::string& column) const {
+  return !projected || used_columns.count(column) > 0;
+}
+
+bool QueryContext::isAnyColumnUsed(
+    std::initializer_list<std::string> columns) const {
+  for (const auto& column : columns) {
+    if (isColumnUsed(column)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool QueryContext::hasConstraint(const std::string& column,
                                  ConstraintOperator op) const {
   if (constraints.count(column) == 0) {
@@ -44,6 +44,7 @@ std::string kTestDataPath = "../../../../tools/tests/";
 #endif
 
 DECLARE_string(database_path);
+DECLARE_bool(database_in_memory);
 DECLARE_string(extensions_socket);
 DECLARE_string(modules_autoload);
 DECLARE_string(extensions_autoload);
@@ -75,6 +76,8 @@ void initTesting() {
   fs::remove_all(kTestWorkingDirectory);
   fs::create_directories(kTestWorkingDirectory);
   FLAGS_database_path = kTestWorkingDirectory + "unittests.db";
+  // Tests of on-disk behavior reset the instance to a path.
+  FLAGS_database_in_memory = DBHandle::supportsInMemory();
   FLAGS_extensions_socket = kTestWorkingDirectory + "unittests.em";
   FLAGS_extensions_autoload = kTestWorkingDirectory + "unittests-ext.load";
   FLAGS_modules_autoload = kTestWorkingDirectory + "unittests-mod.load";
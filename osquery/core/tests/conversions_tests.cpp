@@ -88,4 +88,65 @@ TEST_F(ConversionsTests, test_split_occurences) {
   };
   EXPECT_EQ(split(content, ":", 1), expected);
 }
+
+TEST_F(ConversionsTests, test_line_scanner) {
+  std::string content = "a  b\tc\n\n  \nd e f g  \r\nh";
+  LineScanner scanner(content);
+
+  ASSERT_TRUE(scanner.next());
+  ASSERT_EQ(scanner.fields().size(), 3U);
+  EXPECT_EQ(scanner.fields()[0], "a");
+  EXPECT_EQ(scanner.fields()[1], "b");
+  EXPECT_EQ(scanner.fields()[2], "c");
+
+  // Empty and whitespace lines are skipped, trailing whitespace is trimmed.
+  ASSERT_TRUE(scanner.next());
+  EXPECT_EQ(scanner.line(), "d e f g");
+  ASSERT_EQ(scanner.fields().size(), 4U);
+  EXPECT_EQ(scanner.rest(2), "f g");
+  EXPECT_EQ(scanner.rest(4), "");
+
+  // The last line does not need a newline.
+  ASSERT_TRUE(scanner.next());
+  EXPECT_EQ(scanner.line(), "h");
+  EXPECT_FALSE(scanner.next());
+  EXPECT_TRUE(scanner.fields().empty());
+
+  LineScanner commas("x,y,,z", ",");
+  ASSERT_TRUE(commas.next());
+  EXPECT_EQ(commas.fields().size(), 3U);
+}
+
+TEST_F(ConversionsTests, test_format_decimal) {
+  char buffer[kDecimalDigitsMax];
+  std::vector<unsigned long long> values = {
+      0, 7, 10, 99, 100, 12345, 1000000, ULLONG_MAX};
+  for (const auto& value : values) {
+    auto size = formatDecimal(value, buffer);
+    EXPECT_EQ(std::string(buffer, size), std::to_string(value));
+  }
+}
+
+TEST_F(ConversionsTests, test_parse_decimal) {
+  long long value = 0;
+  EXPECT_TRUE(parseDecimal("12345", value));
+  EXPECT_EQ(value, 12345);
+  EXPECT_TRUE(parseDecimal("-42", value));
+  EXPECT_EQ(value, -42);
+  EXPECT_TRUE(parseDecimal("+7", value));
+  EXPECT_EQ(value, 7);
+
+  // Values needing overflow checks use strtoll.
+  EXPECT_TRUE(parseDecimal("9223372036854775807", value));
+  EXPECT_EQ(value, LLONG_MAX);
+  EXPECT_TRUE(parseDecimal("-9223372036854775808", value));
+  EXPECT_EQ(value, LLONG_MIN);
+  EXPECT_TRUE(parseDecimal(" 12", value));
+  EXPECT_EQ(value, 12);
+
+  EXPECT_FALSE(parseDecimal("", value));
+  EXPECT_FALSE(parseDecimal("-", value));
+  EXPECT_FALSE(parseDecimal("12a", value));
+  EXPECT_FALSE(parseDecimal("1.5", value));
+}
 }
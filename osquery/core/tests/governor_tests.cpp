@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/governor.h"
+
+namespace osquery {
+
+class GovernorTests : public testing::Test {};
+
+TEST_F(GovernorTests, test_read_rate_limiter) {
+  ReadRateLimiter limiter(1000);
+  auto now = limiter.refilled_;
+
+  // The bucket starts full with one second of reads.
+  EXPECT_EQ(limiter.take(600, now), 0);
+  EXPECT_EQ(limiter.take(400, now), 0);
+
+  // An overdrawn bucket waits for the refill.
+  EXPECT_DOUBLE_EQ(limiter.take(500, now), 0.5);
+  now += std::chrono::milliseconds(500);
+  EXPECT_DOUBLE_EQ(limiter.take(0, now), 0);
+
+  // Refills are capped at the size of the bucket.
+  now += std::chrono::seconds(10);
+  EXPECT_EQ(limiter.take(1000, now), 0);
+  EXPECT_DOUBLE_EQ(limiter.take(2000, now), 2);
+}
+
+TEST_F(GovernorTests, test_scoped_governor) {
+#if defined(__linux__)
+  auto policy = sched_getscheduler(0);
+  {
+    ScopedGovernor governor("idle", 0);
+    auto governed = sched_getscheduler(0);
+    EXPECT_TRUE(governed == SCHED_IDLE || governed == SCHED_BATCH);
+  }
+  EXPECT_EQ(sched_getscheduler(0), policy);
+
+  {
+    ScopedGovernor governor("low", 0);
+    EXPECT_EQ(sched_getscheduler(0), SCHED_BATCH);
+  }
+  EXPECT_EQ(sched_getscheduler(0), policy);
+
+  {
+    ScopedGovernor governor("unknown", 0);
+    EXPECT_EQ(sched_getscheduler(0), policy);
+  }
+#endif
+
+  // Reads are only throttled while a governor with a read rate exists.
+  auto start = std::chrono::steady_clock::now();
+  {
+    ScopedGovernor governor("", 100 * 1024);
+    throttleRead(100 * 1024);
+    throttleRead(10 * 1024);
+  }
+  throttleRead(100 * 1024 * 1024);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(elapsed, std::chrono::milliseconds(90));
+  EXPECT_LT(elapsed, std::chrono::seconds(5));
+}
+}
@@ -10,6 +10,10 @@
 
 #include <gtest/gtest.h>
 
+#include <boost/algorithm/string.hpp>
+
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
 #include <osquery/hash.h>
 
 #include "osquery/core/test_util.h"
@@ -46,4 +50,54 @@ TEST_F(HashTests, test_file_hashing) {
   auto digest = hashFromFile(HASH_TYPE_MD5, kTestDataPath + "test_hashing.bin");
   EXPECT_EQ(digest, "88ee11f2aa7903f34b8b8785d92208b1");
 }
+
+TEST_F(HashTests, test_file_hashing_blocks) {
+  // A file larger than a block is hashed in blocks, digests in parallel.
+  std::string content(3 * 1024 * 1024 + 7, '\0');
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = static_cast<char>(i % 251);
+  }
+  auto path = kTestWorkingDirectory + "hash-blocks";
+  writeTextFile(path, content);
+
+  auto hashes = hashMultiFromFile(
+      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.md5,
+            hashFromBuffer(HASH_TYPE_MD5, content.data(), content.size()));
+  EXPECT_EQ(hashes.sha1,
+            hashFromBuffer(HASH_TYPE_SHA1, content.data(), content.size()));
+  EXPECT_EQ(hashes.sha256,
+            hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size()));
+  osquery::remove(path);
+}
+
+TEST_F(HashTests, test_file_hashing_cached) {
+  auto path = kTestDataPath + "test_hashing.bin";
+  auto hashes = hashMultiFromFileCached(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, "88ee11f2aa7903f34b8b8785d92208b1");
+
+  // The record is keyed by path and holds the file identity first.
+  std::string value;
+  getDatabaseValue(kHashes, "file." + path, value);
+  std::vector<std::string> fields;
+  boost::split(fields, value, boost::is_any_of(","));
+  ASSERT_EQ(fields.size(), 6U);
+
+  // An unchanged file is served from the cache.
+  fields[3] = "cached";
+  setDatabaseValue(kHashes, "file." + path, boost::join(fields, ","));
+  hashes = hashMultiFromFileCached(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, "cached");
+
+  // A different file status, or a hash not yet cached, reads the file.
+  hashes = hashMultiFromFileCached(HASH_TYPE_MD5 | HASH_TYPE_SHA1, path);
+  EXPECT_EQ(hashes.md5, "88ee11f2aa7903f34b8b8785d92208b1");
+  EXPECT_FALSE(hashes.sha1.empty());
+
+  fields[0] = "0:0:0:0.0:0.0";
+  fields[3] = "cached";
+  setDatabaseValue(kHashes, "file." + path, boost::join(fields, ","));
+  hashes = hashMultiFromFileCached(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, "88ee11f2aa7903f34b8b8785d92208b1");
+}
 }
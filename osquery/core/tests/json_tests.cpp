@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <osquery/filesystem.h>
+
+#include "osquery/core/json.h"
+#include "osquery/core/test_util.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class JSONTests : public testing::Test {};
+
+static pt::ptree readJSON(const std::string& json) {
+  pt::ptree tree;
+  std::stringstream input;
+  input << json;
+  pt::read_json(input, tree);
+  return tree;
+}
+
+TEST_F(JSONTests, test_parse_tree) {
+  std::vector<std::string> documents = {
+      "{\"a\": 1, \"b\": [1, 2, {\"c\": \"d\"}], \"e\": {}, \"f\": []}",
+      "{\"a\": true, \"b\": false, \"c\": null, \"d\": -1.5e+3}",
+      "{\"a\": \"one\", \"a\": \"two\"}",
+      "[\"a\", [], {\"b\": [[]]}]",
+      "\"scalar\"",
+      "\xEF\xBB\xBF {}",
+  };
+
+  // The trees match read_json, including duplicate keys and literals.
+  for (const auto& json : documents) {
+    pt::ptree tree;
+    EXPECT_TRUE(parseJSONTree(json, tree).ok());
+    EXPECT_TRUE(tree == readJSON(json));
+  }
+
+  std::string content;
+  ASSERT_TRUE(readFile(kTestDataPath + "test_parse_items.conf", content).ok());
+  pt::ptree tree;
+  EXPECT_TRUE(parseJSONTree(content, tree).ok());
+  EXPECT_TRUE(tree == readJSON(content));
+}
+
+TEST_F(JSONTests, test_parse_strings) {
+  pt::ptree tree;
+  auto json = "{\"a\": \"\\\"\\\\\\/\\b\\f\\n\\r\\t\", \"b\": \"\\u00e9\\u20ac\"}";
+  ASSERT_TRUE(parseJSONTree(json, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("a"), "\"\\/\b\f\n\r\t");
+  EXPECT_EQ(tree.get<std::string>("b"), "\xC3\xA9\xE2\x82\xAC");
+
+  // Surrogate pairs are combined, the word at a time scan stops at escapes.
+  ASSERT_TRUE(parseJSONTree("[\"0123456789abcdef\\ud83d\\ude00\"]", tree).ok());
+  EXPECT_EQ(tree.front().second.data(), "0123456789abcdef\xF0\x9F\x98\x80");
+}
+
+TEST_F(JSONTests, test_parse_invalid) {
+  std::vector<std::string> documents = {
+      "",
+      "{",
+      "{\"a\"}",
+      "{\"a\": 1,}",
+      "[1, ]",
+      "[1 2]",
+      "{\"a\": 1]",
+      "01",
+      "1.",
+      "-",
+      "tru",
+      "\"\\ud800\"",
+      "\"\\x\"",
+      "\"a\nb\"",
+      "{} {}",
+      std::string(kJSONMaxDepth + 1, '['),
+  };
+
+  // A failed parse leaves the output unchanged.
+  for (const auto& json : documents) {
+    pt::ptree tree;
+    tree.put("unchanged", "true");
+    EXPECT_FALSE(parseJSONTree(json, tree).ok());
+    EXPECT_EQ(tree.get<std::string>("unchanged"), "true");
+  }
+
+  pt::ptree tree;
+  auto status = parseJSONTree("{\"a\": x}", tree);
+  EXPECT_EQ(status.getMessage(), "JSON unexpected character at offset 6");
+}
+
+TEST_F(JSONTests, test_parse_row) {
+  Row r = {{"existing", "1"}};
+  auto json = "{\"a\": \"1\", \"b\": 2, \"\": \"3\", \"c\": {\"d\": 4}, \"a\": \"5\"}";
+  ASSERT_TRUE(parseJSONRow(json, r).ok());
+
+  // Like deserializeRow, nested members are empty and nameless are skipped.
+  Row expected = {{"existing", "1"}, {"a", "5"}, {"b", "2"}, {"c", ""}};
+  EXPECT_EQ(r, expected);
+
+  EXPECT_FALSE(parseJSONRow("{\"a\": ", r).ok());
+  EXPECT_EQ(r, expected);
+}
+}
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <mutex>
+#include <thread>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+class LocksTests : public testing::Test {};
+
+TEST_F(LocksTests, test_instrumented_mutex) {
+  InstrumentedMutex<std::mutex> mutex("locks_tests.mutex");
+  { std::lock_guard<InstrumentedMutex<std::mutex>> lock(mutex); }
+
+  auto& stats = getLockStats("locks_tests.mutex");
+  EXPECT_EQ(stats.acquisitions, 1U);
+  EXPECT_EQ(stats.contentions, 0U);
+
+  // A held lock makes a try fail and an acquisition wait.
+  std::unique_lock<InstrumentedMutex<std::mutex>> held(mutex);
+  std::thread thread([&mutex]() {
+    EXPECT_FALSE(mutex.try_lock());
+    std::lock_guard<InstrumentedMutex<std::mutex>> lock(mutex);
+  });
+  while (stats.contentions < 2) {
+    std::this_thread::yield();
+  }
+  held.unlock();
+  thread.join();
+
+  EXPECT_EQ(stats.acquisitions, 3U);
+  EXPECT_EQ(stats.contentions, 2U);
+  EXPECT_GT(stats.hold_time, 0U);
+
+  size_t found = 0;
+  getLocks([&found](const std::string& name, const LockStats& lock) {
+    found += (name == "locks_tests.mutex") ? 1 : 0;
+  });
+  EXPECT_EQ(found, 1U);
+}
+
+TEST_F(LocksTests, test_instrumented_shared_mutex) {
+  InstrumentedMutex<boost::shared_mutex> mutex("locks_tests.shared_mutex");
+  {
+    boost::shared_lock<InstrumentedMutex<boost::shared_mutex>> first(mutex);
+    boost::shared_lock<InstrumentedMutex<boost::shared_mutex>> second(mutex);
+    EXPECT_FALSE(mutex.try_lock());
+  }
+  { boost::unique_lock<InstrumentedMutex<boost::shared_mutex>> lock(mutex); }
+
+  auto& stats = getLockStats("locks_tests.shared_mutex");
+  EXPECT_EQ(stats.acquisitions, 3U);
+  EXPECT_EQ(stats.contentions, 1U);
+}
+}
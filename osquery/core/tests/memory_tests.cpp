@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/memory.h"
+
+namespace osquery {
+
+class MemoryTests : public testing::Test {};
+
+TEST_F(MemoryTests, test_arena_names) {
+  EXPECT_EQ(std::string(getMemoryArenaName(ARENA_DEFAULT)), "default");
+  EXPECT_EQ(std::string(getMemoryArenaName(ARENA_EVENTS)), "events");
+  EXPECT_EQ(std::string(getMemoryArenaName(ARENA_EXTENSIONS)), "extensions");
+  EXPECT_EQ(std::string(getMemoryArenaName(ARENA_COUNT)), "");
+}
+
+TEST_F(MemoryTests, test_arena_scope) {
+  const size_t kBlock = 1 << 20;
+  std::unique_ptr<char[]> block;
+  {
+    MemoryArenaScope scope(ARENA_EVENTS);
+    block.reset(new char[kBlock]);
+    block[0] = 1;
+  }
+
+  MemoryArenaStats stats;
+  auto status = getMemoryArenaStats(ARENA_EVENTS, stats);
+  EXPECT_EQ(status.ok(), hasMemoryArenas());
+  if (hasMemoryArenas()) {
+    // The block stays charged to the arena after the scope ends.
+    EXPECT_GE(stats.allocated, kBlock);
+  }
+}
+
+TEST_F(MemoryTests, test_thread_arena) {
+  std::thread thread([]() {
+    setThreadArena(ARENA_SQL);
+    std::vector<char> buffer(1 << 20, 1);
+    MemoryArenaStats stats;
+    if (getMemoryArenaStats(ARENA_SQL, stats).ok()) {
+      EXPECT_GE(stats.allocated, buffer.size());
+      EXPECT_GE(stats.threads, 1U);
+    }
+  });
+  thread.join();
+}
+
+TEST_F(MemoryTests, test_purge_memory) {
+  MemoryArenaStats before;
+  if (!getMemoryStats(before).ok()) {
+    return;
+  }
+
+  {
+    std::vector<std::unique_ptr<char[]>> blocks;
+    for (size_t i = 0; i < 64; i++) {
+      blocks.emplace_back(new char[4096]);
+    }
+  }
+  EXPECT_TRUE(purgeMemory().ok());
+
+  MemoryArenaStats after;
+  EXPECT_TRUE(getMemoryStats(after).ok());
+  EXPECT_GT(after.allocated, 0U);
+}
+}
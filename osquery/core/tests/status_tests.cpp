@@ -39,4 +39,21 @@ TEST_F(StatusTests, test_to_string) {
   auto s = Status(0, "foobar");
   EXPECT_EQ(s.toString(), "foobar");
 }
+
+TEST_F(StatusTests, test_copy_and_move) {
+  auto s1 = Status(1, std::string("message"));
+  auto s2 = s1;
+  EXPECT_EQ(s1, s2);
+  EXPECT_EQ(s2.getMessage(), "message");
+
+  auto s3 = std::move(s2);
+  EXPECT_EQ(s3.getCode(), 1);
+  EXPECT_EQ(s3.getMessage(), "message");
+
+  // An "OK" message is equal however it was constructed.
+  s3 = Status(0, std::string("OK"));
+  EXPECT_EQ(s3, Status(0, "OK"));
+  EXPECT_EQ(s3, Status());
+  EXPECT_EQ(s3.getMessage(), "OK");
+}
 }
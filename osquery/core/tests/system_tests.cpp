@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_string(host_identifier);
+
+class SystemTests : public testing::Test {};
+
+TEST_F(SystemTests, test_ascii_time) {
+  EXPECT_EQ(getAsciiTime(0), "Thu Jan  1 00:00:00 1970 UTC");
+  EXPECT_EQ(getAsciiTime(1316600872), "Wed Sep 21 10:27:52 2011 UTC");
+}
+
+TEST_F(SystemTests, test_host_identifier) {
+  auto host_identifier = FLAGS_host_identifier;
+  FLAGS_host_identifier = "hostname";
+  resetHostIdentifier();
+  EXPECT_EQ(getHostIdentifier(), getHostname());
+
+  // The identifier is read again when the flag changes.
+  FLAGS_host_identifier = "uuid";
+  auto uuid = getHostIdentifier();
+  EXPECT_FALSE(uuid.empty());
+  EXPECT_EQ(getHostIdentifier(), uuid);
+
+  FLAGS_host_identifier = host_identifier;
+  resetHostIdentifier();
+}
+}
@@ -131,6 +131,86 @@ TEST_F(TablesTests, test_constraint_map) {
   EXPECT_TRUE(cm["path"].existsAndMatches("some"));
 }
 
+TEST_F(TablesTests, test_column_projection) {
+  // Without a projection every column is used.
+  QueryContext context;
+  EXPECT_TRUE(context.isColumnUsed("path"));
+
+  context.projected = true;
+  context.used_columns = {"path"};
+  context.limit = 10;
+  EXPECT_TRUE(context.isColumnUsed("path"));
+  EXPECT_FALSE(context.isColumnUsed("md5"));
+  EXPECT_TRUE(context.isAnyColumnUsed({"md5", "path"}));
+  EXPECT_FALSE(context.isAnyColumnUsed({"md5", "sha1"}));
+
+  // The projection and limit are passed through a plugin request.
+  PluginRequest request;
+  TablePlugin::setRequestFromContext(context, request);
+  QueryContext copy;
+  TablePlugin::setContextFromRequest(request, copy);
+  EXPECT_TRUE(copy.projected);
+  EXPECT_EQ(copy.used_columns, context.used_columns);
+  EXPECT_EQ(copy.limit, 10);
+
+  // An unprojected request does not restrict the columns.
+  request.clear();
+  TablePlugin::setRequestFromContext(QueryContext(), request);
+  QueryContext unprojected;
+  TablePlugin::setContextFromRequest(request, unprojected);
+  EXPECT_FALSE(unprojected.projected);
+  EXPECT_TRUE(unprojected.isColumnUsed("md5"));
+}
+
+TEST_F(TablesTests, test_context_reset) {
+  QueryContext context;
+  context.constraints["size"].affinity = INTEGER_TYPE;
+  context.constraints["size"].add(Constraint(EQUALS, "1"));
+  context.projected = true;
+  context.used_columns = {"size"};
+  context.limit = 10;
+
+  // The constraint lists and their affinities are kept for the next filter.
+  context.reset();
+  ASSERT_EQ(context.constraints.count("size"), 1U);
+  EXPECT_EQ(context.constraints["size"].affinity, INTEGER_TYPE);
+  EXPECT_FALSE(context.constraints["size"].exists());
+  EXPECT_FALSE(context.projected);
+  EXPECT_TRUE(context.isColumnUsed("path"));
+  EXPECT_EQ(context.limit, 0);
+}
+
+constexpr ColumnDefinition kTestSchema[] = {
+    {"path", TEXT_TYPE, COLUMN_INDEX | COLUMN_REQUIRED},
+    {"size", BIGINT_TYPE, COLUMN_DEFAULT},
+};
+
+TEST_F(TablesTests, test_affinity_text) {
+  EXPECT_EQ(INTEGER(0), "0");
+  EXPECT_EQ(INTEGER(-1), "-1");
+  EXPECT_EQ(BIGINT(LLONG_MIN), "-9223372036854775808");
+  EXPECT_EQ(UNSIGNED_BIGINT(ULLONG_MAX), "18446744073709551615");
+  EXPECT_EQ(INTEGER(true), "1");
+
+  // Characters and other types are lexically cast.
+  EXPECT_EQ(TEXT('a'), "a");
+  EXPECT_EQ(TEXT("text"), "text");
+  EXPECT_EQ(INTEGER(std::string("12")), "12");
+  EXPECT_EQ(DOUBLE(1.5), "1.5");
+}
+
+TEST_F(TablesTests, test_compiled_schema) {
+  auto columns = schemaColumns(kTestSchema);
+  ASSERT_EQ(columns.size(), 2U);
+  EXPECT_EQ(columns[0], std::make_pair(std::string("path"), TEXT_TYPE));
+  EXPECT_EQ(columns[1], std::make_pair(std::string("size"), BIGINT_TYPE));
+
+  // Only non-default options are planner hints.
+  auto options = schemaColumnOptions(kTestSchema);
+  ASSERT_EQ(options.size(), 1U);
+  EXPECT_EQ(options.at("path"), COLUMN_INDEX | COLUMN_REQUIRED);
+}
+
 class TestTablePlugin : public TablePlugin {
  public:
   void testSetCache(size_t step, size_t interval) {
@@ -139,6 +219,11 @@ class TestTablePlugin : public TablePlugin {
   }
 
   bool testIsCached(size_t interval) { return isCached(interval); }
+
+  QueryDataRef testGetCache() { return getCache(QueryContext()); }
+
+ private:
+  FRIEND_TEST(TablesTests, test_constraint_caching);
 };
 
 TEST_F(TablesTests, test_caching) {
@@ -165,5 +250,271 @@ TEST_F(TablesTests, test_caching) {
   // Now 6 is within the freshness of 2 + 5.
   EXPECT_TRUE(test.testIsCached(6));
   EXPECT_FALSE(test.testIsCached(7));
+
+  // Expiration by step is checked against the step, not the time.
+  EXPECT_NE(test.testGetCache(), nullptr);
+  TablePlugin::kCacheStep = 7;
+  EXPECT_EQ(test.testGetCache(), nullptr);
+  // Outside of the schedule there is no step.
+  TablePlugin::kCacheStep = 0;
+  EXPECT_EQ(test.testGetCache(), nullptr);
+  TablePlugin::kCacheStep = 2;
+}
+
+class TTLTablePlugin : public TablePlugin {
+ public:
+  QueryDataRef testGetCache(const QueryContext& context) {
+    return getCache(context);
+  }
+
+  void testSetCache(const QueryContext& context, const QueryData& results) {
+    setCache(context, results);
+  }
+
+ private:
+  size_t cacheTTL() const { return 60; }
+};
+
+TEST_F(TablesTests, test_constraint_caching) {
+  TTLTablePlugin test;
+  QueryContext context;
+  EXPECT_EQ(test.testGetCache(context), nullptr);
+
+  // Results are cached by the set of constraints.
+  QueryContext constrained;
+  constrained.constraints["path"].add(Constraint(EQUALS, "/"));
+  test.testSetCache(context, {{{"path", "/"}}, {{"path", "/tmp"}}});
+  test.testSetCache(constrained, {{{"path", "/"}}});
+
+  auto cached = test.testGetCache(context);
+  ASSERT_NE(cached, nullptr);
+  EXPECT_EQ(cached->size(), 2U);
+  cached = test.testGetCache(constrained);
+  ASSERT_NE(cached, nullptr);
+  EXPECT_EQ(cached->size(), 1U);
+
+  // Hits share the same results.
+  EXPECT_EQ(test.testGetCache(constrained), cached);
+
+  // A different expression is a miss.
+  QueryContext other;
+  other.constraints["path"].add(Constraint(EQUALS, "/tmp"));
+  EXPECT_EQ(test.testGetCache(other), nullptr);
+
+  // Tables without a TTL are only cached within a scheduled interval.
+  TestTablePlugin scheduled;
+  auto interval = TablePlugin::kCacheInterval;
+  TablePlugin::kCacheInterval = 0;
+  scheduled.setCache(context, {{{"path", "/"}}});
+  EXPECT_EQ(scheduled.getCache(context), nullptr);
+  TablePlugin::kCacheInterval = interval;
+}
+
+class SharedTablePlugin : public TablePlugin {
+ public:
+  QueryDataRef testGenerate(QueryContext& context) {
+    return generateCached(context, [this](QueryContext& request) {
+      generated++;
+      named = request.hasConstraint("name");
+      QueryData results;
+      for (const auto& pid : {"1", "2", "3"}) {
+        if (request.constraints["pid"].matches(std::string(pid))) {
+          results.push_back({{"pid", pid}, {"name", "init"}});
+        }
+      }
+      return results;
+    });
+  }
+
+  size_t generated{0};
+
+  /// Set if the generator was given a constraint on a default column.
+  bool named{false};
+
+ private:
+  TableColumns columns() const {
+    return {{"pid", BIGINT_TYPE}, {"name", TEXT_TYPE}};
+  }
+
+  TableColumnOptions columnOptions() const { return {{"pid", COLUMN_INDEX}}; }
+
+  size_t cacheTTL() const { return 60; }
+};
+
+TEST_F(TablesTests, test_shared_generation) {
+  SharedTablePlugin test;
+
+  // Generators are given every constraint of the query.
+  QueryContext named;
+  named.constraints["name"].add(Constraint(EQUALS, "init"));
+  auto results = test.testGenerate(named);
+  ASSERT_NE(results, nullptr);
+  EXPECT_TRUE(test.named);
+  EXPECT_EQ(test.testGenerate(named), results);
+  EXPECT_EQ(test.generated, 1U);
+
+  QueryContext context;
+  context.constraints["pid"].affinity = BIGINT_TYPE;
+  auto scan = test.testGenerate(context);
+  ASSERT_NE(scan, nullptr);
+  EXPECT_EQ(scan->size(), 3U);
+  EXPECT_FALSE(test.named);
+  EXPECT_EQ(test.generated, 2U);
+
+  // Constraints on default columns are filtered from the fresh scan.
+  QueryContext other;
+  other.constraints["name"].affinity = TEXT_TYPE;
+  other.constraints["name"].add(Constraint(GREATER_THAN, "a"));
+  results = test.testGenerate(other);
+  ASSERT_NE(results, nullptr);
+  EXPECT_EQ(results->size(), 3U);
+  EXPECT_EQ(test.generated, 2U);
+
+  // A limit is part of the key.
+  QueryContext limited;
+  limited.limit = 1;
+  test.testGenerate(limited);
+  EXPECT_EQ(test.generated, 3U);
+
+  // Index constraints are selected from the fresh unconstrained scan.
+  QueryContext lookup;
+  lookup.constraints["pid"].affinity = BIGINT_TYPE;
+  lookup.constraints["pid"].add(Constraint(EQUALS, "2"));
+  results = test.testGenerate(lookup);
+  ASSERT_EQ(results->size(), 1U);
+  EXPECT_EQ(results->at(0).at("pid"), "2");
+  EXPECT_EQ(test.generated, 3U);
+}
+
+class BootTablePlugin : public TablePlugin {
+ public:
+  explicit BootTablePlugin(bool hotplug) : hotplug_(hotplug) {}
+
+  QueryDataRef testGenerate() {
+    QueryContext context;
+    return generateCached(context, [this](QueryContext& request) {
+      generated++;
+      return QueryData({{{"vendor", "osquery"}}});
+    });
+  }
+
+  size_t generated{0};
+
+ private:
+  bool cacheBoot() const { return true; }
+
+  bool cacheHotplug() const { return hotplug_; }
+
+ private:
+  bool hotplug_{false};
+};
+
+TEST_F(TablesTests, test_boot_caching) {
+  // Boot cached results do not need a scheduled interval or a TTL.
+  auto interval = TablePlugin::kCacheInterval;
+  TablePlugin::kCacheInterval = 0;
+  BootTablePlugin boot(false);
+  auto results = boot.testGenerate();
+  TablePlugin::invalidateHotplugCache();
+  EXPECT_EQ(boot.testGenerate(), results);
+  EXPECT_EQ(boot.generated, 1U);
+
+  // Device results are only cached while hotplugs are watched.
+  BootTablePlugin devices(true);
+  devices.testGenerate();
+  devices.testGenerate();
+  EXPECT_EQ(devices.generated, 2U);
+
+  TablePlugin::setHotplugWatched(true);
+  devices.testGenerate();
+  devices.testGenerate();
+  EXPECT_EQ(devices.generated, 3U);
+
+  // A hotplug invalidates the device results.
+  TablePlugin::invalidateHotplugCache();
+  devices.testGenerate();
+  EXPECT_EQ(devices.generated, 4U);
+
+  // So does the publisher stopping.
+  TablePlugin::setHotplugWatched(false);
+  devices.testGenerate();
+  EXPECT_EQ(devices.generated, 5U);
+  EXPECT_EQ(boot.generated, 1U);
+  TablePlugin::kCacheInterval = interval;
+}
+
+TEST_F(TablesTests, test_typed_rows) {
+  TableColumns columns = {
+      {"name", TEXT_TYPE}, {"size", BIGINT_TYPE}, {"missing", INTEGER_TYPE},
+  };
+
+  // Row maps are reordered by column ordinal, missing columns are empty.
+  QueryData data = {{{"size", "10"}, {"name", "first"}}};
+  TableRows rows;
+  TablePlugin::setRowsFromQueryData(columns, data, rows);
+  ASSERT_EQ(rows.size(), 1U);
+  ASSERT_EQ(rows[0].size(), 3U);
+  EXPECT_EQ(boost::get<std::string>(rows[0][0]), "first");
+  EXPECT_EQ(boost::get<std::string>(rows[0][1]), "10");
+  EXPECT_EQ(boost::get<std::string>(rows[0][2]), "");
+  EXPECT_TRUE(data.empty());
+
+  // Typed cells are converted back into their text representation.
+  rows[0][1] = 11LL;
+  QueryData results;
+  TablePlugin::setQueryDataFromRows(columns, rows, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["name"], "first");
+  EXPECT_EQ(results[0]["size"], "11");
+  EXPECT_EQ(results[0]["missing"], "");
+}
+
+class PlannedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"id", INTEGER_TYPE}, {"name", TEXT_TYPE}};
+  }
+
+  TableColumnOptions columnOptions() const { return {{"id", COLUMN_INDEX}}; }
+
+  size_t cost() const { return 42; }
+};
+
+TEST_F(TablesTests, test_column_options) {
+  PlannedTablePlugin table;
+  PluginResponse response;
+  EXPECT_TRUE(table.call({{"action", "columns"}}, response).ok());
+  ASSERT_EQ(response.size(), 2U);
+  EXPECT_EQ(response[0]["options"], INTEGER(COLUMN_INDEX));
+  // Default columns do not include options.
+  EXPECT_EQ(response[1].count("options"), 0U);
+
+  EXPECT_TRUE(table.call({{"action", "attributes"}}, response).ok());
+  ASSERT_EQ(response.size(), 1U);
+  EXPECT_EQ(response[0]["cost"], "42");
+
+  TestTablePlugin default_table;
+  EXPECT_TRUE(default_table.call({{"action", "attributes"}}, response).ok());
+  EXPECT_EQ(response[0]["cost"], std::to_string(kDefaultTableCost));
+}
+
+TEST_F(TablesTests, test_sampled_keys) {
+  QueryContext context;
+  size_t sampled = 0;
+  for (size_t i = 0; i < 10000; i++) {
+    auto key = "/var/log/" + std::to_string(i);
+    EXPECT_TRUE(context.isSampled(key));
+    sampled += (isSampledKey(key, 0.1)) ? 1 : 0;
+    // The same items are sampled by every query.
+    EXPECT_EQ(isSampledKey(key, 0.1), isSampledKey(key, 0.1));
+  }
+  EXPECT_GT(sampled, 900U);
+  EXPECT_LT(sampled, 1100U);
+
+  // The rate applies to the queries of the calling thread, 1 disables it.
+  setQuerySampleRate(0.25);
+  EXPECT_EQ(getQuerySampleRate(), 0.25);
+  setQuerySampleRate(0);
+  EXPECT_EQ(getQuerySampleRate(), 1.0);
 }
 }
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+#include <thread>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/tracing.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class TracingTests : public testing::Test {};
+
+/// Count the spans of a serialized trace with a name.
+static size_t countSpans(const std::string& name) {
+  std::string json;
+  serializeTrace(json);
+  std::stringstream stream(json);
+  pt::ptree tree;
+  pt::read_json(stream, tree);
+
+  size_t count = 0;
+  for (const auto& event : tree.get_child("traceEvents")) {
+    if (event.second.get<std::string>("name") == name) {
+      EXPECT_EQ(event.second.get<std::string>("ph"), "X");
+      count++;
+    }
+  }
+  return count;
+}
+
+TEST_F(TracingTests, test_trace_scope) {
+  { TraceScope scope("tracing_tests.disabled"); }
+  EXPECT_EQ(countSpans("tracing_tests.disabled"), 0U);
+
+  setTracing(true);
+  EXPECT_TRUE(isTracing());
+  { TraceScope scope("tracing_tests.span", "with \"detail\""); }
+  // Spans of each thread are kept in the thread's ring.
+  std::thread thread([]() { TraceScope scope("tracing_tests.span"); });
+  thread.join();
+  setTracing(false);
+
+  EXPECT_EQ(countSpans("tracing_tests.span"), 2U);
+  std::string json;
+  serializeTrace(json);
+  EXPECT_NE(json.find("with \\\"detail\\\""), std::string::npos);
+}
+}
@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/core/tracing.h"
+
+namespace osquery {
+
+CLI_FLAG(string,
+         trace_file,
+         "",
+         "Write a Chrome trace of the most recent tracing spans on shutdown");
+
+/// The spans kept by each thread.
+const size_t kTraceRingSize = 8192;
+
+/// The ring buffer of spans recorded by a thread.
+struct TraceRing {
+  /// Only contended while the trace is serialized.
+  std::mutex mutex;
+
+  /// The thread's spans, allocated when the thread records its first span.
+  std::vector<TraceEvent> events;
+
+  /// The position of the next span.
+  size_t next{0};
+
+  /// Number of spans kept, at most kTraceRingSize.
+  size_t count{0};
+
+  /// The thread id written to the trace.
+  size_t tid{0};
+};
+
+/// Spans are only recorded while set.
+static std::atomic<bool> kTracing{false};
+
+/// Protects the list of rings.
+static std::mutex kTraceRingsMutex;
+
+/// The ring of every thread that recorded a span, kept after threads exit.
+static std::vector<std::shared_ptr<TraceRing>> kTraceRings;
+
+/// The ring of the calling thread.
+static thread_local std::shared_ptr<TraceRing> kThreadRing{nullptr};
+
+/// Nanoseconds from the first call.
+static uint64_t traceTime() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+static TraceRing& threadRing() {
+  if (kThreadRing == nullptr) {
+    kThreadRing = std::make_shared<TraceRing>();
+    kThreadRing->events.resize(kTraceRingSize);
+    std::lock_guard<std::mutex> lock(kTraceRingsMutex);
+    kThreadRing->tid = kTraceRings.size() + 1;
+    kTraceRings.push_back(kThreadRing);
+  }
+  return *kThreadRing;
+}
+
+TraceScope::TraceScope(const char* name) : name_(name) {
+  if (kTracing) {
+    active_ = true;
+    start_ = traceTime();
+  }
+}
+
+TraceScope::TraceScope(const char* name, const std::string& detail)
+    : name_(name), detail_(&detail) {
+  if (kTracing) {
+    active_ = true;
+    start_ = traceTime();
+  }
+}
+
+TraceScope::~TraceScope() {
+  if (!active_) {
+    return;
+  }
+
+  auto end = traceTime();
+  auto& ring = threadRing();
+  std::lock_guard<std::mutex> lock(ring.mutex);
+  auto& event = ring.events[ring.next];
+  event.name = name_;
+  event.start = start_;
+  event.duration = end - start_;
+  event.detail[0] = 0;
+  if (detail_ != nullptr) {
+    auto size = std::min(detail_->size(), kTraceDetailSize - 1);
+    memcpy(event.detail, detail_->data(), size);
+    event.detail[size] = 0;
+  }
+  ring.next = (ring.next + 1) % kTraceRingSize;
+  ring.count = std::min(ring.count + 1, kTraceRingSize);
+}
+
+void setTracing(bool enabled) {
+  // Start the clock before the first span.
+  traceTime();
+  kTracing = enabled;
+}
+
+bool isTracing() {
+  return kTracing;
+}
+
+/// Append a JSON string, control characters are replaced.
+static void appendString(const char* value, std::string& json) {
+  json += '"';
+  for (; *value != 0; ++value) {
+    auto c = static_cast<unsigned char>(*value);
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += *value;
+    } else if (c < 0x20) {
+      json += '?';
+    } else {
+      json += *value;
+    }
+  }
+  json += '"';
+}
+
+void serializeTrace(std::string& json) {
+  std::vector<std::shared_ptr<TraceRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock(kTraceRingsMutex);
+    rings = kTraceRings;
+  }
+
+  // Complete events, 'X', with microsecond timestamps.
+  auto pid = std::to_string(getpid());
+  json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  char times[64];
+  for (const auto& ring : rings) {
+    std::lock_guard<std::mutex> lock(ring->mutex);
+    auto oldest = (ring->next + kTraceRingSize - ring->count) % kTraceRingSize;
+    for (size_t i = 0; i < ring->count; ++i) {
+      const auto& event = ring->events[(oldest + i) % kTraceRingSize];
+      json += (first) ? "\n" : ",\n";
+      first = false;
+      json += "{\"name\":";
+      appendString(event.name, json);
+      json += ",\"cat\":\"osquery\",\"ph\":\"X\",\"pid\":" + pid +
+              ",\"tid\":" + std::to_string(ring->tid);
+      snprintf(times,
+               sizeof(times),
+               ",\"ts\":%.3f,\"dur\":%.3f",
+               event.start / 1000.0,
+               event.duration / 1000.0);
+      json += times;
+      if (event.detail[0] != 0) {
+        json += ",\"args\":{\"detail\":";
+        appendString(event.detail, json);
+        json += "}";
+      }
+      json += "}";
+    }
+  }
+  json += "\n]}\n";
+}
+
+Status writeTrace() {
+  if (FLAGS_trace_file.empty()) {
+    return Status(0, "OK");
+  }
+
+  std::string json;
+  serializeTrace(json);
+  return writeTextFile(FLAGS_trace_file, json, 0600, true);
+}
+}
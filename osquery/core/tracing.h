@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// Bytes of a span's detail text kept, including the terminator.
+const size_t kTraceDetailSize = 48;
+
+/// A finished span, kept in the ring buffer of the thread that ran it.
+struct TraceEvent {
+  /// The span name, a string literal.
+  const char* name{nullptr};
+
+  /// Nanoseconds from the first span of the process to the span start.
+  uint64_t start{0};
+
+  /// Nanoseconds the span took.
+  uint64_t duration{0};
+
+  /// Optional truncated detail, such as a table or query name.
+  char detail[kTraceDetailSize];
+};
+
+/**
+ * @brief A span of work, recorded when the scope ends.
+ *
+ * Spans are kept in a fixed-size ring buffer owned by each thread, so
+ * recording never waits on another thread and only the most recent spans are
+ * kept. When tracing is disabled a scope only checks an atomic flag.
+ *
+ * Use the TRACE_SCOPE macros, which compile to nothing unless osquery is built
+ * with OSQUERY_TRACING.
+ */
+class TraceScope : private boost::noncopyable {
+ public:
+  /// Start a span, the name must be a string literal.
+  explicit TraceScope(const char* name);
+
+  /// Start a span with detail text, copied only if tracing is enabled.
+  TraceScope(const char* name, const std::string& detail);
+
+  ~TraceScope();
+
+ private:
+  const char* name_{nullptr};
+  const std::string* detail_{nullptr};
+  uint64_t start_{0};
+  bool active_{false};
+};
+
+/// Enable or disable recording spans.
+void setTracing(bool enabled);
+
+/// Check if spans are recorded.
+bool isTracing();
+
+/// Serialize the buffered spans of every thread as Chrome trace event JSON.
+void serializeTrace(std::string& json);
+
+/// Write the buffered spans to the --trace_file path, if set.
+Status writeTrace();
+
+#ifdef OSQUERY_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+/// Record a span until the end of the enclosing scope.
+#define TRACE_SCOPE(name) \
+  ::osquery::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+/// Record a span with detail text until the end of the enclosing scope.
+#define TRACE_SCOPE_DETAIL(name, detail) \
+  ::osquery::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, detail)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_DETAIL(name, detail)
+#endif
+}
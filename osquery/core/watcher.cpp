@@ -8,20 +8,33 @@
  *
  */
 
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
 #include <math.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <signal.h>
 
+#include <sqlite3.h>
+
+#ifdef __APPLE__
+#include <libproc.h>
+#endif
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/memory.h"
 #include "osquery/core/watcher.h"
+#include "osquery/database/db_handle.h"
 #include "osquery/dispatcher/dispatcher.h"
+#include "osquery/logger/status_log_ring.h"
 
 extern char** environ;
 
@@ -54,6 +67,41 @@ CLI_FLAG(int32,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(uint64,
+         watchdog_rocksdb_limit,
+         0,
+         "Maximum MB of worker memory used by RocksDB (0=unlimited)");
+
+CLI_FLAG(uint64,
+         watchdog_sqlite_limit,
+         0,
+         "Maximum MB of worker memory used by SQLite (0=unlimited)");
+
+CLI_FLAG(uint64,
+         watchdog_cgroup_percent,
+         75,
+         "Percent of a cgroup memory limit the worker may use (0=ignore)");
+
+CLI_FLAG(bool,
+         watchdog_standby,
+         false,
+         "Keep a prepared standby worker to replace a stopped worker");
+
+/// The environment variable holding the worker's telemetry descriptor.
+const char* kWorkerTelemetryEnv = "OSQUERY_WORKER_TELEMETRY";
+
+/// The environment variable holding the worker's status log ring descriptor.
+const char* kStatusLogRingEnv = "OSQUERY_STATUS_LOG_RING";
+
+/// The environment variable holding a standby worker's promotion descriptor.
+const char* kWorkerStandbyEnv = "OSQUERY_WORKER_STANDBY";
+
+/// Set when the watcher promotes this standby worker.
+static std::atomic<bool> kWorkerPromoted{false};
+
+/// Telemetry older than this many watchdog intervals is not trusted.
+const size_t kTelemetryIntervals = 3;
+
 void Watcher::resetWorkerCounters(size_t respawn_time) {
   // Reset the monitoring counters for the watcher.
   auto& state = instance().state_;
@@ -61,6 +109,8 @@ void Watcher::resetWorkerCounters(size_t respawn_time) {
   state.user_time = 0;
   state.system_time = 0;
   state.last_respawn_time = respawn_time;
+  state.initial_footprint = 0;
+  state.initial_heap = 0;
 }
 
 void Watcher::resetExtensionCounters(const std::string& extension,
@@ -71,6 +121,7 @@ void Watcher::resetExtensionCounters(const std::string& extension,
   state.user_time = 0;
   state.system_time = 0;
   state.last_respawn_time = respawn_time;
+  state.initial_footprint = 0;
 }
 
 std::string Watcher::getExtensionPath(pid_t child) {
@@ -170,19 +221,12 @@ void WatcherRunner::start() {
 
   // Enter the watch loop.
   do {
-    if (use_worker_ && !watch(Watcher::getWorker())) {
-      if (Watcher::fatesBound()) {
-        // A signal has interrupted the watcher.
-        break;
-      }
-      // The watcher failed, create a worker.
-      createWorker();
-    }
-
-    // Loop over every managed extension and check sanity.
+    // Loop over every managed extension and check sanity. Extensions are
+    // launched before the worker, each waits for the worker's manager socket
+    // while the worker starts, and they register concurrently.
     std::vector<std::string> failing_extensions;
     for (const auto& extension : Watcher::extensions()) {
-      if (!watch(extension.second)) {
+      if (!watch(extension.second) && !Watcher::fatesBound()) {
         if (!createExtension(extension.first)) {
           failing_extensions.push_back(extension.first);
         }
@@ -192,6 +236,15 @@ void WatcherRunner::start() {
     for (const auto& failed_extension : failing_extensions) {
       Watcher::removeExtensionPath(failed_extension);
     }
+
+    if (use_worker_ && !watch(Watcher::getWorker())) {
+      if (Watcher::fatesBound()) {
+        // A signal has interrupted the watcher.
+        break;
+      }
+      // The watcher failed, create a worker.
+      createWorker();
+    }
   } while (ok());
 }
 
@@ -229,9 +282,160 @@ void WatcherRunner::stopChild(pid_t child) {
   waitpid(-1, 0, WNOHANG);
 }
 
-bool WatcherRunner::isChildSane(pid_t child) {
-  auto rows = SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(child));
+#if defined(__linux__)
+/// Read a small proc file into a buffer, terminated.
+static bool readProcFile(const char* path, char* buffer, size_t size) {
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  auto bytes = ::read(fd, buffer, size - 1);
+  ::close(fd);
+  if (bytes <= 0) {
+    return false;
+  }
+  buffer[bytes] = 0;
+  return true;
+}
+
+bool sampleProcess(pid_t pid, ProcessSample& sample) {
+  char path[64];
+  char buffer[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if (!readProcFile(path, buffer, sizeof(buffer))) {
+    return false;
+  }
+
+  // The command name may contain spaces and parentheses.
+  auto fields = strrchr(buffer, ')');
+  int parent = 0;
+  unsigned long user_time = 0;
+  unsigned long system_time = 0;
+  if (fields == nullptr ||
+      sscanf(fields + 1,
+             " %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &parent,
+             &user_time,
+             &system_time) != 3) {
+    return false;
+  }
+
+  // The resident pages not shared with files or other processes.
+  snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+  unsigned long resident = 0;
+  unsigned long shared = 0;
+  if (!readProcFile(path, buffer, sizeof(buffer)) ||
+      sscanf(buffer, "%*u %lu %lu", &resident, &shared) != 2) {
+    return false;
+  }
+
+  static const auto page_size = sysconf(_SC_PAGESIZE);
+  sample.parent = parent;
+  sample.user_time = user_time;
+  sample.system_time = system_time;
+  sample.private_memory =
+      (resident > shared) ? (resident - shared) * page_size : 0;
+  return true;
+}
+
+/// Read a cgroup limit file, "max" or a page-rounded maximum is unlimited.
+static size_t readCgroupLimit(const std::string& path) {
+  char buffer[64];
+  if (!readProcFile(path.c_str(), buffer, sizeof(buffer))) {
+    return 0;
+  }
+
+  char* end = nullptr;
+  auto limit = strtoull(buffer, &end, 10);
+  if (end == buffer || limit >= (1ULL << 62)) {
+    return 0;
+  }
+  return static_cast<size_t>(limit);
+}
+
+size_t getCgroupMemoryLimit(pid_t pid) {
+  char path[64];
+  char buffer[4096];
+  snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+  if (!readProcFile(path, buffer, sizeof(buffer))) {
+    return 0;
+  }
+
+  // Each line is hierarchy-ID:controller-list:cgroup-path.
+  size_t limit = 0;
+  char* saved = nullptr;
+  for (auto line = strtok_r(buffer, "\n", &saved); line != nullptr;
+       line = strtok_r(nullptr, "\n", &saved)) {
+    auto controllers = strchr(line, ':');
+    auto group = (controllers != nullptr) ? strchr(controllers + 1, ':')
+                                          : nullptr;
+    if (group == nullptr) {
+      continue;
+    }
+
+    std::string names(controllers + 1, group - controllers - 1);
+    std::string cgroup(group + 1);
+    size_t group_limit = 0;
+    if (strncmp(line, "0::", 3) == 0) {
+      group_limit = readCgroupLimit("/sys/fs/cgroup" + cgroup + "/memory.max");
+    } else if (("," + names + ",").find(",memory,") != std::string::npos) {
+      group_limit = readCgroupLimit("/sys/fs/cgroup/memory" + cgroup +
+                                    "/memory.limit_in_bytes");
+    }
+    if (group_limit > 0 && (limit == 0 || group_limit < limit)) {
+      limit = group_limit;
+    }
+  }
+  return limit;
+}
+#elif defined(__APPLE__)
+bool sampleProcess(pid_t pid, ProcessSample& sample) {
+  struct proc_bsdshortinfo info;
+  if (proc_pidinfo(pid, PROC_PIDT_SHORTBSDINFO, 1, &info, sizeof(info)) !=
+      sizeof(info)) {
+    return false;
+  }
+
+  struct rusage_info_v2 usage;
+  if (proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t*)&usage) != 0) {
+    return false;
+  }
+
+  // The physical footprint counts dirty private memory, as the processes
+  // table reports times in the same units.
+  sample.parent = info.pbsi_ppid;
+  sample.user_time = usage.ri_user_time / 1000000;
+  sample.system_time = usage.ri_system_time / 1000000;
+  sample.private_memory = usage.ri_phys_footprint;
+  return true;
+}
+#else
+bool sampleProcess(pid_t pid, ProcessSample& sample) {
+  auto rows = SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(pid));
   if (rows.size() == 0) {
+    return false;
+  }
+
+  try {
+    sample.parent = AS_LITERAL(BIGINT_LITERAL, rows[0].at("parent"));
+    sample.user_time = AS_LITERAL(BIGINT_LITERAL, rows[0].at("user_time"));
+    sample.system_time = AS_LITERAL(BIGINT_LITERAL, rows[0].at("system_time"));
+    sample.private_memory =
+        AS_LITERAL(BIGINT_LITERAL, rows[0].at("resident_size"));
+  } catch (const std::exception& e) {
+    return false;
+  }
+  return true;
+}
+#endif
+
+#if !defined(__linux__)
+size_t getCgroupMemoryLimit(pid_t pid) { return 0; }
+#endif
+
+bool WatcherRunner::isChildSane(pid_t child) {
+  ProcessSample sample;
+  if (!sampleProcess(child, sample)) {
     // Could not find worker process?
     return false;
   }
@@ -240,22 +444,28 @@ bool WatcherRunner::isChildSane(pid_t child) {
   size_t sustained_latency = 0;
   // Compare CPU utilization since last check.
   size_t footprint = 0;
-  pid_t parent = 0;
+  size_t cgroup_limit = 0;
+  pid_t parent = sample.parent;
   // IV is the check interval in seconds, and utilization is set per-second.
   auto iv = std::max(getWorkerLimit(INTERVAL), (size_t)1);
 
+  // A worker publishing fresh telemetry is measured by its allocator heap.
+  uint64_t memory[MEMORY_COMPONENTS] = {0};
+  bool published = false;
+  if (child == Watcher::getWorker() && telemetry_ != nullptr) {
+    published = (telemetry_->updated + kTelemetryIntervals * iv >=
+                 static_cast<uint64_t>(getUnixTime()));
+    for (size_t i = 0; published && i < MEMORY_COMPONENTS; i++) {
+      memory[i] = telemetry_->bytes[i];
+    }
+  }
+
   {
     WatcherLocker locker;
     auto& state = Watcher::getState(child);
-    UNSIGNED_BIGINT_LITERAL user_time = 0, system_time = 0;
-    try {
-      parent = AS_LITERAL(BIGINT_LITERAL, rows[0].at("parent"));
-      user_time = AS_LITERAL(BIGINT_LITERAL, rows[0].at("user_time")) / iv;
-      system_time = AS_LITERAL(BIGINT_LITERAL, rows[0].at("system_time")) / iv;
-      footprint = AS_LITERAL(BIGINT_LITERAL, rows[0].at("resident_size"));
-    } catch (const std::exception& e) {
-      state.sustained_latency = 0;
-    }
+    UNSIGNED_BIGINT_LITERAL user_time = sample.user_time / iv;
+    UNSIGNED_BIGINT_LITERAL system_time = sample.system_time / iv;
+    footprint = sample.private_memory;
 
     // Check the difference of CPU time used since last check.
     if (user_time - state.user_time > getWorkerLimit(UTILIZATION_LIMIT) ||
@@ -271,15 +481,25 @@ bool WatcherRunner::isChildSane(pid_t child) {
     // Check if the sustained difference exceeded the acceptable latency limit.
     sustained_latency = state.sustained_latency;
 
-    // Set the memory footprint as the amount of resident bytes allocated
-    // since the process image was created (estimate).
-    // A more-meaningful check would limit this to writable regions.
+    // Set the memory footprint as the amount of private memory allocated
+    // since the process image was created (estimate). Shared libraries and
+    // mapped files are not counted.
     if (state.initial_footprint == 0) {
       state.initial_footprint = footprint;
+      state.cgroup_limit = getCgroupMemoryLimit(child);
     }
+    cgroup_limit = state.cgroup_limit;
 
     // Set the measured/limit-applied footprint to the post-launch allocations.
-    if (footprint < state.initial_footprint) {
+    if (published) {
+      // Memory the allocator retains counts, pages it returned do not.
+      size_t heap = memory[MEMORY_ALLOCATOR_IN_USE] +
+                    memory[MEMORY_ALLOCATOR_RETAINED];
+      if (state.initial_heap == 0) {
+        state.initial_heap = heap;
+      }
+      footprint = (heap < state.initial_heap) ? 0 : heap - state.initial_heap;
+    } else if (footprint < state.initial_footprint) {
       footprint = 0;
     } else {
       footprint = footprint - state.initial_footprint;
@@ -307,6 +527,31 @@ bool WatcherRunner::isChildSane(pid_t child) {
                  << ") memory limits exceeded: " << footprint;
     return false;
   }
+  // Restart the child before its cgroup's OOM killer would.
+  if (cgroup_limit > 0 && FLAGS_watchdog_cgroup_percent > 0 &&
+      sample.private_memory >
+          cgroup_limit / 100 * std::min<size_t>(FLAGS_watchdog_cgroup_percent,
+                                                100)) {
+    LOG(WARNING) << "osqueryd worker (" << child
+                 << ") cgroup memory limits exceeded: "
+                 << sample.private_memory;
+    return false;
+  }
+  // Check the memory of each component the worker published.
+  if (FLAGS_watchdog_rocksdb_limit > 0 &&
+      memory[MEMORY_ROCKSDB] > FLAGS_watchdog_rocksdb_limit * 1024 * 1024) {
+    LOG(WARNING) << "osqueryd worker (" << child
+                 << ") RocksDB memory limits exceeded: "
+                 << memory[MEMORY_ROCKSDB];
+    return false;
+  }
+  if (FLAGS_watchdog_sqlite_limit > 0 &&
+      memory[MEMORY_SQLITE] > FLAGS_watchdog_sqlite_limit * 1024 * 1024) {
+    LOG(WARNING) << "osqueryd worker (" << child
+                 << ") SQLite memory limits exceeded: "
+                 << memory[MEMORY_SQLITE];
+    return false;
+  }
 
   // The worker is sane, no action needed.
   // Attempt to flush status logs to the well-behaved worker.
@@ -314,6 +559,78 @@ bool WatcherRunner::isChildSane(pid_t child) {
   return true;
 }
 
+/**
+ * @brief Map a zeroed shared memory region that workers inherit.
+ *
+ * @param purpose Names the region while it is created.
+ * @param size The bytes of the region.
+ * @param fd The output descriptor, passed to workers.
+ * @return The mapped region, nullptr on failure.
+ */
+static void* createSharedRegion(const std::string& purpose,
+                                size_t size,
+                                int& fd) {
+  // The name is only used to create the descriptor, workers inherit it.
+  auto name = "/osquery." + purpose + "." + std::to_string(getpid());
+  fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return nullptr;
+  }
+  shm_unlink(name.c_str());
+
+  void* region = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (region == MAP_FAILED) {
+    close(fd);
+    fd = -1;
+    return nullptr;
+  }
+  return region;
+}
+
+/// Map a shared region whose descriptor the watcher passed in a variable.
+static void* mapSharedRegion(const char* variable, size_t size) {
+  auto descriptor = getenv(variable);
+  if (descriptor == nullptr) {
+    return nullptr;
+  }
+
+  auto fd = atoi(descriptor);
+  unsetenv(variable);
+  auto region =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return (region != MAP_FAILED) ? region : nullptr;
+}
+
+bool WatcherRunner::createTelemetry() {
+  if (telemetry_ != nullptr) {
+    return true;
+  }
+
+  telemetry_ = static_cast<WorkerTelemetry*>(
+      createSharedRegion("telemetry", sizeof(WorkerTelemetry), telemetry_fd_));
+  return (telemetry_ != nullptr);
+}
+
+bool WatcherRunner::createStatusLogRing() {
+  if (status_ring_ != nullptr) {
+    return true;
+  }
+
+  // The ring lives as long as the watcher, unread logs outlive a worker.
+  status_ring_ = static_cast<StatusLogRing*>(createSharedRegion(
+      "status", sizeof(StatusLogRing), status_ring_fd_));
+  if (status_ring_ == nullptr) {
+    return false;
+  }
+  status_ring_->init();
+  setStatusLogRing(status_ring_);
+  return true;
+}
+
 void WatcherRunner::createWorker() {
   {
     WatcherLocker locker;
@@ -328,6 +645,23 @@ void WatcherRunner::createWorker() {
     }
   }
 
+  // A prepared standby replaces the worker without another initialization.
+  auto worker_pid = promoteStandby();
+  if (worker_pid <= 0) {
+    worker_pid = spawnWorker(false);
+  }
+
+  Watcher::setWorker(worker_pid);
+  Watcher::resetWorkerCounters(getUnixTime());
+  VLOG(1) << "osqueryd watcher (" << getpid() << ") executing worker ("
+          << worker_pid << ")";
+
+  if (FLAGS_watchdog_standby) {
+    standby_ = spawnWorker(true);
+  }
+}
+
+pid_t WatcherRunner::spawnWorker(bool standby) {
   // Get the path of the current process.
   auto qd = SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(getpid()));
   if (qd.size() != 1 || qd[0].count("path") == 0 || qd[0]["path"].size() == 0) {
@@ -351,24 +685,95 @@ void WatcherRunner::createWorker() {
     osquery::shutdown(EXIT_FAILURE);
   }
 
+  // The new worker publishes into a cleared telemetry page.
+  if (createTelemetry()) {
+    if (!standby) {
+      telemetry_->updated = 0;
+      for (auto& bytes : telemetry_->bytes) {
+        bytes = 0;
+      }
+    }
+  } else {
+    VLOG(1) << "osqueryd watcher cannot share worker memory telemetry";
+  }
+  if (!createStatusLogRing()) {
+    VLOG(1) << "osqueryd watcher cannot share a status log ring";
+  }
+
+  // A standby worker waits for a byte on a pipe before opening the database.
+  int promotion[2] = {-1, -1};
+  if (standby && pipe(promotion) != 0) {
+    LOG(WARNING) << "osqueryd watcher cannot create a standby worker";
+    return -1;
+  }
+
   auto worker_pid = fork();
-  if (worker_pid < 0) {
+  if (worker_pid < 0 && standby) {
+    // The current worker continues without a standby.
+    close(promotion[0]);
+    close(promotion[1]);
+    return -1;
+  } else if (worker_pid < 0) {
     // Unrecoverable error, cannot create a worker process.
     LOG(ERROR) << "osqueryd could not create a worker process";
     osquery::shutdown(EXIT_FAILURE);
   } else if (worker_pid == 0) {
     // This is the new worker process, no watching needed.
     setenv("OSQUERY_WORKER", std::to_string(getpid()).c_str(), 1);
+    if (telemetry_fd_ >= 0 && fcntl(telemetry_fd_, F_SETFD, 0) == 0) {
+      setenv(kWorkerTelemetryEnv, std::to_string(telemetry_fd_).c_str(), 1);
+    }
+    if (status_ring_fd_ >= 0 && fcntl(status_ring_fd_, F_SETFD, 0) == 0) {
+      setenv(kStatusLogRingEnv, std::to_string(status_ring_fd_).c_str(), 1);
+    }
+    if (standby) {
+      close(promotion[1]);
+      setenv(kWorkerStandbyEnv, std::to_string(promotion[0]).c_str(), 1);
+    }
     execve(exec_path.string().c_str(), argv_, environ);
     // Code should never reach this point.
     LOG(ERROR) << "osqueryd could not start worker process";
     osquery::shutdown(EXIT_CATASTROPHIC);
   }
 
-  Watcher::setWorker(worker_pid);
-  Watcher::resetWorkerCounters(getUnixTime());
-  VLOG(1) << "osqueryd watcher (" << getpid() << ") executing worker ("
-          << worker_pid << ")";
+  if (standby) {
+    // The watcher keeps the write end, closing it ends the standby.
+    close(promotion[0]);
+    fcntl(promotion[1], F_SETFD, FD_CLOEXEC);
+    standby_pipe_ = promotion[1];
+    VLOG(1) << "osqueryd watcher (" << getpid() << ") prepared standby worker ("
+            << worker_pid << ")";
+  }
+  return worker_pid;
+}
+
+pid_t WatcherRunner::promoteStandby() {
+  auto standby = standby_;
+  auto promotion = standby_pipe_;
+  standby_ = -1;
+  standby_pipe_ = -1;
+  if (standby <= 0) {
+    return -1;
+  }
+
+  // The standby publishes into a cleared telemetry page once promoted.
+  if (telemetry_ != nullptr) {
+    telemetry_->updated = 0;
+    for (auto& bytes : telemetry_->bytes) {
+      bytes = 0;
+    }
+  }
+
+  char byte = 1;
+  bool promoted = (waitpid(standby, nullptr, WNOHANG) == 0 &&
+                   write(promotion, &byte, 1) == 1);
+  close(promotion);
+  if (!promoted) {
+    // The standby exited, closing the pipe ends it if it is still starting.
+    waitpid(standby, nullptr, WNOHANG);
+    return -1;
+  }
+  return standby;
 }
 
 bool WatcherRunner::createExtension(const std::string& extension) {
@@ -424,7 +829,69 @@ bool WatcherRunner::createExtension(const std::string& extension) {
   return true;
 }
 
+bool isStandbyWorker() {
+  static const bool standby = (getenv(kWorkerStandbyEnv) != nullptr);
+  return standby && !kWorkerPromoted;
+}
+
+void awaitPromotion() {
+  auto descriptor = getenv(kWorkerStandbyEnv);
+  if (descriptor == nullptr || kWorkerPromoted) {
+    return;
+  }
+
+  auto fd = atoi(descriptor);
+  char byte = 0;
+  ssize_t bytes = 0;
+  do {
+    bytes = read(fd, &byte, 1);
+  } while (bytes < 0 && errno == EINTR);
+  close(fd);
+
+  if (bytes != 1) {
+    // The watcher replaced this standby, or exited.
+    ::exit(EXIT_SUCCESS);
+  }
+  kWorkerPromoted = true;
+}
+
+void WatcherWatcherRunner::mapTelemetry() {
+  telemetry_ = static_cast<WorkerTelemetry*>(
+      mapSharedRegion(kWorkerTelemetryEnv, sizeof(WorkerTelemetry)));
+  status_ring_ = static_cast<StatusLogRing*>(
+      mapSharedRegion(kStatusLogRingEnv, sizeof(StatusLogRing)));
+}
+
+void WatcherWatcherRunner::relayWatcherLogs() {
+  if (status_ring_ == nullptr || isStandbyWorker()) {
+    return;
+  }
+
+  // The watcher's logs are forwarded with the worker's own status logs.
+  std::vector<StatusLogLine> lines;
+  while (status_ring_->pop(lines, kStatusLogRingSize) > 0 || !lines.empty()) {
+    forwardStatusLogs(lines);
+    lines.clear();
+  }
+}
+
+void WatcherWatcherRunner::publishTelemetry() {
+  if (telemetry_ == nullptr || isStandbyWorker()) {
+    return;
+  }
+
+  // Memory freed to the allocator but not returned to the system is retained.
+  MemoryArenaStats allocator;
+  getMemoryStats(allocator);
+  telemetry_->bytes[MEMORY_ALLOCATOR_IN_USE] = allocator.allocated;
+  telemetry_->bytes[MEMORY_ALLOCATOR_RETAINED] = allocator.retained;
+  telemetry_->bytes[MEMORY_ROCKSDB] = DBHandle::getMemoryUsage();
+  telemetry_->bytes[MEMORY_SQLITE] = sqlite3_memory_used();
+  telemetry_->updated = getUnixTime();
+}
+
 void WatcherWatcherRunner::start() {
+  mapTelemetry();
   while (true) {
     if (getppid() != watcher_) {
       // Watcher died, the worker must follow.
@@ -433,6 +900,8 @@ void WatcherWatcherRunner::start() {
       // The watcher watcher is a thread. Do not join services after removing.
       ::exit(EXIT_FAILURE);
     }
+    publishTelemetry();
+    relayWatcherLogs();
     interruptableSleep(getWorkerLimit(INTERVAL) * 1000);
   }
 }
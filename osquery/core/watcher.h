@@ -31,8 +31,13 @@ namespace osquery {
 
 DECLARE_bool(disable_watchdog);
 DECLARE_int32(watchdog_level);
+DECLARE_uint64(watchdog_rocksdb_limit);
+DECLARE_uint64(watchdog_sqlite_limit);
+DECLARE_uint64(watchdog_cgroup_percent);
+DECLARE_bool(watchdog_standby);
 
 class WatcherRunner;
+struct StatusLogRing;
 
 /**
  * @brief Categories of process performance limitations.
@@ -67,18 +72,102 @@ struct PerformanceState {
   /// A timestamp when the process/worker was last created.
   size_t last_respawn_time;
 
-  /// The initial (or as close as possible) process image footprint.
+  /// The initial (or as close as possible) private memory footprint.
   size_t initial_footprint;
 
+  /// The initial allocator heap published by a worker's telemetry.
+  size_t initial_heap;
+
+  /// The memory limit of the process's cgroup in bytes, 0 if unlimited.
+  size_t cgroup_limit;
+
   PerformanceState() {
     sustained_latency = 0;
     user_time = 0;
     system_time = 0;
     last_respawn_time = 0;
     initial_footprint = 0;
+    initial_heap = 0;
+    cgroup_limit = 0;
   }
 };
 
+/// Components of a worker's memory, published for the watcher.
+enum WorkerMemoryComponent {
+  MEMORY_ALLOCATOR_IN_USE,
+  MEMORY_ALLOCATOR_RETAINED,
+  MEMORY_ROCKSDB,
+  MEMORY_SQLITE,
+  MEMORY_COMPONENTS,
+};
+
+/**
+ * @brief Memory telemetry a worker publishes for its watcher.
+ *
+ * The watcher maps a shared page before creating a worker and passes its
+ * descriptor through the OSQUERY_WORKER_TELEMETRY environment variable. The
+ * worker publishes its allocator statistics and the memory of its RocksDB and
+ * SQLite use each watchdog interval. Page-level sampling cannot tell memory
+ * the allocator retained from a leak, or which component is growing.
+ */
+struct WorkerTelemetry {
+  /// The unix time of the last publish, 0 before the first.
+  std::atomic<uint64_t> updated;
+
+  /// Bytes of memory used by each component.
+  std::atomic<uint64_t> bytes[MEMORY_COMPONENTS];
+};
+
+/**
+ * @brief Read the memory limit of a process's cgroup.
+ *
+ * Reads memory.max of a cgroup v2 hierarchy, or memory.limit_in_bytes of the
+ * cgroup v1 memory controller, for the cgroup in /proc/<pid>/cgroup.
+ *
+ * @param pid The process.
+ * @return The limit in bytes, 0 if unlimited or not Linux.
+ */
+size_t getCgroupMemoryLimit(pid_t pid);
+
+/// Check if this process is a standby worker its watcher has not promoted.
+bool isStandbyWorker();
+
+/**
+ * @brief Block a standby worker until its watcher promotes it.
+ *
+ * A standby worker prepares everything that does not need the database, the
+ * active worker holds its lock, then waits. The watcher promotes the standby
+ * when the active worker stops. The standby exits if the watcher replaces it
+ * or exits.
+ */
+void awaitPromotion();
+
+/// A resource sample of a watched process, read without running a query.
+struct ProcessSample {
+  /// The parent process, a reused pid has another parent.
+  pid_t parent{0};
+
+  /// CPU times, in the units of the processes table columns.
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+
+  /// Bytes of memory private to the process, not shared or file-backed.
+  uint64_t private_memory{0};
+};
+
+/**
+ * @brief Sample the CPU times and private memory of a process.
+ *
+ * Linux reads /proc/<pid>/stat and statm into fixed buffers, OS X uses
+ * proc_pid_rusage and its physical footprint. Other platforms select the
+ * processes table row of the pid.
+ *
+ * @param pid The process to sample.
+ * @param sample The output sample.
+ * @return false if the process does not exist.
+ */
+bool sampleProcess(pid_t pid, ProcessSample& sample);
+
 /**
  * @brief Thread-safe watched child process state manager.
  *
@@ -206,10 +295,10 @@ class Watcher : private boost::noncopyable {
 
  private:
   /// Mutex and lock around extensions access.
-  boost::mutex mutex_;
+  InstrumentedMutex<boost::mutex> mutex_{"watcher"};
 
   /// Mutex and lock around extensions access.
-  boost::unique_lock<boost::mutex> lock_;
+  boost::unique_lock<InstrumentedMutex<boost::mutex>> lock_;
 
  private:
   friend class WatcherRunner;
@@ -264,6 +353,14 @@ class WatcherRunner : public InternalRunnable {
  private:
   /// Fork and execute a worker process.
   void createWorker();
+  /// Fork and execute a worker or standby worker, return its pid.
+  pid_t spawnWorker(bool standby);
+  /// Promote the standby worker, return its pid or -1 if there is none.
+  pid_t promoteStandby();
+  /// Map the telemetry page shared with workers.
+  bool createTelemetry();
+  /// Map the status log ring shared with workers, see StatusLogRing.
+  bool createStatusLogRing();
   /// Fork an extension process.
   bool createExtension(const std::string& extension);
   /// If a worker/extension has otherwise gone insane, stop it.
@@ -276,6 +373,18 @@ class WatcherRunner : public InternalRunnable {
   char** argv_{nullptr};
   /// Spawn/monitor a worker process.
   bool use_worker_{false};
+  /// The descriptor of the telemetry page shared with workers.
+  int telemetry_fd_{-1};
+  /// The telemetry published by the current worker.
+  WorkerTelemetry* telemetry_{nullptr};
+  /// The descriptor of the status log ring shared with workers.
+  int status_ring_fd_{-1};
+  /// The ring the watcher's status logs are relayed through.
+  StatusLogRing* status_ring_{nullptr};
+  /// A prepared worker waiting to replace the current worker.
+  pid_t standby_{-1};
+  /// The pipe a byte is written to, promoting the standby worker.
+  int standby_pipe_{-1};
 };
 
 /// The WatcherWatcher is spawned within the worker and watches the watcher.
@@ -286,9 +395,21 @@ class WatcherWatcherRunner : public InternalRunnable {
   /// Runnable thread's entry point.
   void start();
 
+ private:
+  /// Map the telemetry page and status log ring passed by the watcher.
+  void mapTelemetry();
+  /// Publish the worker's memory use to the watcher.
+  void publishTelemetry();
+  /// Forward the status logs the watcher relayed through the ring.
+  void relayWatcherLogs();
+
  private:
   /// Parent, or watchdog, process ID.
   pid_t watcher_{-1};
+  /// The telemetry page shared with the watcher, if one was passed.
+  WorkerTelemetry* telemetry_{nullptr};
+  /// The status log ring shared with the watcher, if one was passed.
+  StatusLogRing* status_ring_{nullptr};
 };
 
 /// Get a performance limit by name and optional level.
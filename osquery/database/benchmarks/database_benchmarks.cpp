@@ -57,6 +57,34 @@ BENCHMARK(DATABASE_serialize_json)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+static void DATABASE_serialize_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeQueryDataBinary(qd, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_binary)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_deserialize_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataBinary(qd, content);
+  while (state.KeepRunning()) {
+    QueryData results;
+    deserializeQueryDataBinary(content, results);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_binary)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
 static void DATABASE_diff(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   while (state.KeepRunning()) {
@@ -64,7 +92,33 @@ static void DATABASE_diff(benchmark::State& state) {
   }
 }
 
-BENCHMARK(DATABASE_diff)->ArgPair(1, 1)->ArgPair(10, 10)->ArgPair(10, 100);
+BENCHMARK(DATABASE_diff)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 100000);
+
+static void DATABASE_diff_distinct(benchmark::State& state) {
+  // Each row is distinct, and the current results replace 1% of the rows.
+  auto old = getExampleQueryData(state.range_x(), state.range_y());
+  for (size_t i = 0; i < old.size(); i++) {
+    old[i]["id"] = std::to_string(i);
+  }
+  auto current = old;
+  for (size_t i = 0; i < current.size(); i += 100) {
+    current[i]["id"] = "changed" + std::to_string(i);
+  }
+
+  while (state.KeepRunning()) {
+    auto d = diff(old, current);
+  }
+}
+
+BENCHMARK(DATABASE_diff_distinct)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 100000);
 
 static void DATABASE_query_results(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
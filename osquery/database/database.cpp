@@ -9,24 +9,62 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
-#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/json.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
 CLI_FLAG(bool, database_dump, false, "Dump the contents of the backing store");
 
+CLI_FLAG(string,
+         database_plugin,
+         "rocks",
+         "Backing store plugin: rocks, mmap");
+
+FLAG(uint64,
+     database_compact_deletes,
+     100000,
+     "Compact a domain when idle after N deleted keys (0=never)");
+
+FLAG(uint64,
+     database_compact_interval,
+     3600,
+     "Compact domains with deleted keys when idle every N seconds (0=never)");
+
+/// The deleted keys of a domain since it was last compacted.
+struct DomainCompaction {
+  /// The number of deleted keys, range deletes count their expired keys.
+  size_t deletes{0};
+
+  /// The time of the last compaction, or of the first delete.
+  size_t compacted{0};
+
+  /// Compaction was requested through requestDatabaseCompaction.
+  bool requested{false};
+};
+
+/// The compaction state of each domain, see getDueCompactions.
+static std::map<std::string, DomainCompaction> kCompactions;
+static std::mutex kCompactionsMutex;
+
 /////////////////////////////////////////////////////////////////////////////
 // Row - the representation of a row in a set of database results. Row is a
 // simple map where individual column names are keys, which map to the Row's
@@ -72,15 +110,180 @@ Status deserializeRow(const pt::ptree& tree, Row& r) {
 }
 
 Status deserializeRowJSON(const std::string& json, Row& r) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  // Rows are flat, columns are read without building a tree.
+  return parseJSONRow(json, r);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Binary storage format - a versioned, length-prefixed encoding for Rows and
+// QueryData stored internally.
+//
+// Each value begins with a 0 byte, a type byte ('R' or 'Q'), and a version.
+// JSON content never begins with a 0 byte. Lengths and counts are unsigned
+// LEB128 varints.
+//
+// Row: count, then count pairs of (length, name) (length, value).
+// QueryData: dictionary count, then (length, name) for each column name.
+//   Followed by row count, each row is a cell count then for every cell the
+//   column dictionary index and the (length, value).
+/////////////////////////////////////////////////////////////////////////////
+
+/// The current version of the binary storage format.
+const char kBinaryVersion = 1;
+
+/// Type identifiers following the 0 byte of a binary value.
+const char kBinaryRow = 'R';
+const char kBinaryQueryData = 'Q';
+
+static void writeBinaryHeader(char type, std::string& data) {
+  data.push_back(0);
+  data.push_back(type);
+  data.push_back(kBinaryVersion);
+}
+
+static bool isBinary(const std::string& data, char type) {
+  return (data.size() >= 3 && data[0] == 0 && data[1] == type);
+}
+
+static void writeVarint(size_t value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+static void writeString(const std::string& value, std::string& data) {
+  writeVarint(value.size(), data);
+  data.append(value);
+}
+
+static bool readVarint(const std::string& data, size_t& offset, size_t& value) {
+  value = 0;
+  for (size_t shift = 0; offset < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[offset++]);
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool readString(const std::string& data,
+                       size_t& offset,
+                       std::string& value) {
+  size_t length = 0;
+  if (!readVarint(data, offset, length) || length > data.size() - offset) {
+    return false;
+  }
+  value.assign(data, offset, length);
+  offset += length;
+  return true;
+}
+
+static bool skipString(const std::string& data, size_t& offset) {
+  size_t length = 0;
+  if (!readVarint(data, offset, length) || length > data.size() - offset) {
+    return false;
+  }
+  offset += length;
+  return true;
+}
+
+/// Check the header of a binary value and return the offset of its content.
+static Status readBinaryHeader(const std::string& data, size_t& offset) {
+  if (data[2] != kBinaryVersion) {
+    return Status(1, "Unknown binary storage version");
+  }
+  offset = 3;
+  return Status(0, "OK");
+}
+
+Status serializeRowBinary(const Row& r, std::string& data) {
+  data.clear();
+  writeBinaryHeader(kBinaryRow, data);
+  writeVarint(r.size(), data);
+  for (const auto& column : r) {
+    writeString(column.first, data);
+    writeString(column.second, data);
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeRowBinary(const std::string& data, Row& r) {
+  if (!isBinary(data, kBinaryRow)) {
+    return deserializeRowJSON(data, r);
+  }
+
+  size_t offset = 0;
+  auto status = readBinaryHeader(data, offset);
+  if (!status.ok()) {
+    return status;
+  }
+
+  size_t count = 0;
+  if (!readVarint(data, offset, count)) {
+    return Status(1, "Malformed binary row");
+  }
+  for (size_t i = 0; i < count; i++) {
+    std::string name;
+    if (!readString(data, offset, name) ||
+        !readString(data, offset, r[name])) {
+      return Status(1, "Malformed binary row");
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status getRowBinaryValue(const std::string& data,
+                         const std::string& column,
+                         std::string& value) {
+  if (!isBinary(data, kBinaryRow)) {
+    Row r;
+    auto status = deserializeRowJSON(data, r);
+    if (!status.ok() || r.count(column) == 0) {
+      return Status(1, "Column not found: " + column);
+    }
+    value = r.at(column);
+    return Status(0, "OK");
+  }
+
+  size_t offset = 0;
+  auto status = readBinaryHeader(data, offset);
+  if (!status.ok()) {
+    return status;
+  }
+
+  size_t count = 0;
+  if (!readVarint(data, offset, count)) {
+    return Status(1, "Malformed binary row");
+  }
+  for (size_t i = 0; i < count; i++) {
+    std::string name;
+    if (!readString(data, offset, name)) {
+      return Status(1, "Malformed binary row");
+    }
+    if (name == column) {
+      return (readString(data, offset, value))
+                 ? Status(0, "OK")
+                 : Status(1, "Malformed binary row");
+    }
+    if (!skipString(data, offset)) {
+      return Status(1, "Malformed binary row");
+    }
   }
-  return deserializeRow(tree, r);
+  return Status(1, "Column not found: " + column);
+}
+
+void RowKeys::add(size_t index, const std::string& name) {
+  auto it = std::upper_bound(
+      keys_.begin(),
+      keys_.end(),
+      name,
+      [](const std::string& n, const Key& key) { return n < key.name; });
+  bool repeated = (it != keys_.begin() && std::prev(it)->name == name);
+  keys_.insert(it, {index, name, repeated});
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -132,16 +335,151 @@ Status deserializeQueryData(const pt::ptree& tree, QueryData& qd) {
 
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd) {
   pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return status;
   }
   return deserializeQueryData(tree, qd);
 }
 
+Status serializeQueryDataBinary(const QueryData& q, std::string& data) {
+  // Assign each column name an index into the dictionary.
+  std::unordered_map<std::string, size_t> dictionary;
+  std::vector<const std::string*> names;
+  for (const auto& r : q) {
+    for (const auto& column : r) {
+      if (dictionary.emplace(column.first, names.size()).second) {
+        names.push_back(&column.first);
+      }
+    }
+  }
+
+  data.clear();
+  writeBinaryHeader(kBinaryQueryData, data);
+  writeVarint(names.size(), data);
+  for (const auto& name : names) {
+    writeString(*name, data);
+  }
+
+  writeVarint(q.size(), data);
+  for (const auto& r : q) {
+    writeVarint(r.size(), data);
+    for (const auto& column : r) {
+      writeVarint(dictionary.at(column.first), data);
+      writeString(column.second, data);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryDataBinary(const std::string& data, QueryData& qd) {
+  if (!isBinary(data, kBinaryQueryData)) {
+    return deserializeQueryDataJSON(data, qd);
+  }
+
+  size_t offset = 0;
+  auto status = readBinaryHeader(data, offset);
+  if (!status.ok()) {
+    return status;
+  }
+
+  size_t count = 0;
+  if (!readVarint(data, offset, count)) {
+    return Status(1, "Malformed binary query data");
+  }
+  std::vector<std::string> names(count);
+  for (auto& name : names) {
+    if (!readString(data, offset, name)) {
+      return Status(1, "Malformed binary query data");
+    }
+  }
+
+  size_t rows = 0;
+  if (!readVarint(data, offset, rows)) {
+    return Status(1, "Malformed binary query data");
+  }
+  qd.reserve(qd.size() + rows);
+  for (size_t i = 0; i < rows; i++) {
+    size_t cells = 0;
+    if (!readVarint(data, offset, cells)) {
+      return Status(1, "Malformed binary query data");
+    }
+
+    // Cells are written in Row key order, each is inserted at the end.
+    Row r;
+    for (size_t j = 0; j < cells; j++) {
+      size_t index = 0;
+      if (!readVarint(data, offset, index) || index >= names.size()) {
+        return Status(1, "Malformed binary query data");
+      }
+      auto cell = r.emplace_hint(r.end(), names[index], RowData());
+      if (!readString(data, offset, cell->second)) {
+        return Status(1, "Malformed binary query data");
+      }
+    }
+    qd.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
+size_t Histogram::bucket(uint64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<size_t>(value);
+  }
+  // The position of the highest bit selects the power of two, the following
+  // bits select the linear bucket within it.
+  size_t exponent = 63 - __builtin_clzll(value);
+  size_t shift = exponent - kSubBucketBits;
+  return (shift + 1) * kSubBuckets +
+         static_cast<size_t>((value >> shift) - kSubBuckets);
+}
+
+uint64_t Histogram::bucketValue(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  size_t shift = bucket / kSubBuckets - 1;
+  uint64_t lowest = static_cast<uint64_t>(kSubBuckets + bucket % kSubBuckets)
+                    << shift;
+  return lowest + ((1ULL << shift) - 1);
+}
+
+void Histogram::record(uint64_t value) {
+  auto& counter = counts_[bucket(value)];
+  if (counter < UINT32_MAX) {
+    counter++;
+  }
+  count_++;
+  max_ = std::max(max_, value);
+}
+
+void Histogram::merge(const Histogram& other) {
+  for (size_t i = 0; i < kBuckets; ++i) {
+    auto sum = static_cast<uint64_t>(counts_[i]) + other.counts_[i];
+    counts_[i] = static_cast<uint32_t>(std::min<uint64_t>(sum, UINT32_MAX));
+  }
+  count_ += other.count_;
+  max_ = std::max(max_, other.max_);
+}
+
+uint64_t Histogram::percentile(double percent) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  percent = std::min(std::max(percent, 0.0), 100.0);
+  auto rank = static_cast<uint64_t>(std::ceil(percent / 100 * count_));
+  rank = std::max<uint64_t>(rank, 1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(bucketValue(i), max_);
+    }
+  }
+  return max_;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // DiffResults - the representation of two diffed QueryData result sets.
 // Given and old and new QueryData, DiffResults indicates the "added" subset
@@ -200,26 +538,88 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
   return Status(0, "OK");
 }
 
-DiffResults diff(const QueryData& old, const QueryData& current) {
-  DiffResults r;
-  QueryData overlap;
+/// FNV-1a 64-bit offset basis and prime.
+const uint64_t kFingerprintBasis = 14695981039346656037ULL;
+const uint64_t kFingerprintPrime = 1099511628211ULL;
 
-  for (const auto& i : current) {
-    auto item = std::find(old.begin(), old.end(), i);
-    if (item != old.end()) {
-      overlap.push_back(i);
+static void fingerprintBytes(const std::string& bytes, uint64_t& hash) {
+  // Include the length so adjacent strings cannot shift into each other.
+  auto length = static_cast<uint64_t>(bytes.size());
+  for (size_t i = 0; i < sizeof(length); i++) {
+    hash ^= (length >> (i * 8)) & 0xFF;
+    hash *= kFingerprintPrime;
+  }
+  for (const auto& c : bytes) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= kFingerprintPrime;
+  }
+}
+
+uint64_t getRowFingerprint(const Row& r) {
+  uint64_t hash = kFingerprintBasis;
+  for (const auto& column : r) {
+    fingerprintBytes(column.first, hash);
+    fingerprintBytes(column.second, hash);
+  }
+  return hash;
+}
+
+uint64_t getQueryDataFingerprint(const QueryData& qd) {
+  uint64_t hash = 0;
+  for (const auto& r : qd) {
+    hash += getRowFingerprint(r);
+  }
+  return hash;
+}
+
+DiffResults diff(const QueryData& old, const QueryData& current) {
+  // A distinct row and the number of copies in the old and current results.
+  struct RowCount {
+    const Row* row;
+    size_t old_count;
+    size_t current_count;
+  };
+
+  // Hash multiset of the old rows, fingerprints with collisions share a bucket.
+  std::unordered_map<uint64_t, std::vector<RowCount>> counts;
+  counts.reserve(old.size());
+  for (const auto& row : old) {
+    auto& bucket = counts[getRowFingerprint(row)];
+    auto match = std::find_if(bucket.begin(),
+                              bucket.end(),
+                              [&row](const RowCount& c) { return *c.row == row; });
+    if (match == bucket.end()) {
+      bucket.push_back({&row, 1, 0});
     } else {
-      r.added.push_back(i);
+      match->old_count++;
     }
   }
 
-  std::multiset<Row> overlap_set(overlap.begin(), overlap.end());
-  std::multiset<Row> old_set(old.begin(), old.end());
-  std::set_difference(old_set.begin(),
-                      old_set.end(),
-                      overlap_set.begin(),
-                      overlap_set.end(),
-                      std::back_inserter(r.removed));
+  DiffResults r;
+  for (const auto& row : current) {
+    auto bucket = counts.find(getRowFingerprint(row));
+    if (bucket != counts.end()) {
+      auto match = std::find_if(
+          bucket->second.begin(),
+          bucket->second.end(),
+          [&row](const RowCount& c) { return *c.row == row; });
+      if (match != bucket->second.end()) {
+        match->current_count++;
+        continue;
+      }
+    }
+    r.added.push_back(row);
+  }
+
+  // Old copies in excess of the current copies are removed.
+  for (const auto& bucket : counts) {
+    for (const auto& c : bucket.second) {
+      for (size_t i = c.current_count; i < c.old_count; i++) {
+        r.removed.push_back(*c.row);
+      }
+    }
+  }
+  std::sort(r.removed.begin(), r.removed.end());
   return r;
 }
 
@@ -244,6 +644,10 @@ Status serializeQueryLogItem(const QueryLogItem& i, pt::ptree& tree) {
     tree.add_child("snapshot", results_tree);
   }
 
+  if (!i.snapshot_hash.empty()) {
+    tree.put<std::string>("snapshotHash", i.snapshot_hash);
+  }
+
   tree.put<std::string>("name", i.name);
   tree.put<std::string>("hostIdentifier", i.identifier);
   tree.put<std::string>("calendarTime", i.calendar_time);
@@ -284,6 +688,7 @@ Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
     }
   }
 
+  item.snapshot_hash = tree.get<std::string>("snapshotHash", "");
   item.name = tree.get<std::string>("name", "");
   item.identifier = tree.get<std::string>("hostIdentifier", "");
   item.calendar_time = tree.get<std::string>("calendarTime", "");
@@ -294,12 +699,9 @@ Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
 Status deserializeQueryLogItemJSON(const std::string& json,
                                    QueryLogItem& item) {
   pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return status;
   }
   return deserializeQueryLogItem(tree, item);
 }
@@ -399,12 +801,10 @@ Status deserializeDistributedQueryRequest(const pt::ptree& tree,
 
 Status deserializeDistributedQueryRequestJSON(const std::string& json,
                                               DistributedQueryRequest& r) {
-  std::stringstream ss(json);
   pt::ptree tree;
-  try {
-    pt::read_json(ss, tree);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error serializing JSON: " + std::string(e.what()));
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return Status(1, "Error serializing JSON: " + status.getMessage());
   }
   return deserializeDistributedQueryRequest(tree, r);
 }
@@ -475,12 +875,10 @@ Status deserializeDistributedQueryResult(const pt::ptree& tree,
 
 Status deserializeDistributedQueryResultJSON(const std::string& json,
                                              DistributedQueryResult& r) {
-  std::stringstream ss(json);
   pt::ptree tree;
-  try {
-    pt::read_json(ss, tree);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error serializing JSON: " + std::string(e.what()));
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return Status(1, "Error serializing JSON: " + status.getMessage());
   }
   return deserializeDistributedQueryResult(tree, r);
 }
@@ -495,6 +893,85 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
   return true;
 }
 
+Status DatabasePlugin::scanRange(
+    const std::string& domain,
+    const std::string& start,
+    const std::string& end,
+    size_t max,
+    bool reverse,
+    bool values,
+    std::vector<std::pair<std::string, std::string>>& results) const {
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::sort(keys.begin(), keys.end());
+  auto first = std::lower_bound(keys.begin(), keys.end(), start);
+  auto last = (end.empty()) ? keys.end()
+                            : std::lower_bound(first, keys.end(), end);
+  if (reverse) {
+    std::reverse(first, last);
+  }
+  for (auto key = first; key != last; ++key) {
+    if (max > 0 && results.size() >= max) {
+      break;
+    }
+    std::string value;
+    if (values && !get(domain, *key, value).ok()) {
+      continue;
+    }
+    results.push_back(std::make_pair(*key, std::move(value)));
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::getMany(const std::string& domain,
+                               const std::vector<std::string>& keys,
+                               std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+  for (size_t i = 0; i < keys.size(); i++) {
+    // Plugins may fail the lookup of a key that does not exist.
+    get(domain, keys[i], values[i]);
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::write(
+    const std::string& domain,
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes) {
+  for (const auto& item : puts) {
+    auto status = put(domain, item.first, item.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  for (const auto& key : deletes) {
+    auto status = remove(domain, key);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::removeRange(const std::string& domain,
+                                   const std::string& start,
+                                   const std::string& end) {
+  if (end.empty() || start >= end) {
+    return Status(1, "Invalid delete range");
+  }
+
+  std::vector<std::pair<std::string, std::string>> keys;
+  auto status = scanRange(domain, start, end, 0, false, false, keys);
+  for (size_t i = 0; status.ok() && i < keys.size(); i++) {
+    status = remove(domain, keys[i].first);
+  }
+  return status;
+}
+
 Status DatabasePlugin::call(const PluginRequest& request,
                             PluginResponse& response) {
   if (request.count("action") == 0) {
@@ -531,6 +1008,13 @@ Status DatabasePlugin::call(const PluginRequest& request,
       response.push_back({{"k", key}});
     }
     return status;
+  } else if (request.at("action") == "stats") {
+    QueryData stats;
+    auto status = this->stats(stats);
+    response.insert(response.end(), stats.begin(), stats.end());
+    return status;
+  } else if (request.at("action") == "compact") {
+    return this->compact(domain);
   }
 
   return Status(1, "Unknown database plugin action");
@@ -541,7 +1025,8 @@ Status getDatabaseValue(const std::string& domain,
                         std::string& value) {
   PluginRequest request = {{"action", "get"}, {"domain", domain}, {"key", key}};
   PluginResponse response;
-  auto status = Registry::call("database", "rocks", request, response);
+  auto status =
+      Registry::call("database", FLAGS_database_plugin, request, response);
   if (!status.ok()) {
     return status;
   }
@@ -558,13 +1043,17 @@ Status setDatabaseValue(const std::string& domain,
                         const std::string& value) {
   PluginRequest request = {
       {"action", "put"}, {"domain", domain}, {"key", key}, {"value", value}};
-  return Registry::call("database", "rocks", request);
+  return Registry::call("database", FLAGS_database_plugin, request);
 }
 
 Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
   PluginRequest request = {
       {"action", "remove"}, {"domain", domain}, {"key", key}};
-  return Registry::call("database", "rocks", request);
+  auto status = Registry::call("database", FLAGS_database_plugin, request);
+  if (status.ok()) {
+    addDatabaseDeletes(domain, 1);
+  }
+  return status;
 }
 
 Status scanDatabaseKeys(const std::string& domain,
@@ -573,7 +1062,8 @@ Status scanDatabaseKeys(const std::string& domain,
   PluginRequest request = {
       {"action", "scan"}, {"domain", domain}, {"max", std::to_string(max)}};
   PluginResponse response;
-  auto status = Registry::call("database", "rocks", request, response);
+  auto status =
+      Registry::call("database", FLAGS_database_plugin, request, response);
 
   for (const auto& item : response) {
     if (item.count("k") > 0) {
@@ -583,6 +1073,169 @@ Status scanDatabaseKeys(const std::string& domain,
   return status;
 }
 
+/// The active database plugin, if it is registered in this process.
+static std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
+  return std::dynamic_pointer_cast<DatabasePlugin>(
+      Registry::get("database", FLAGS_database_plugin));
+}
+
+Status getDatabaseValues(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values) {
+  auto plugin = getDatabasePlugin();
+  if (plugin == nullptr) {
+    return Status(1, "Database plugin is not available");
+  }
+  return plugin->getMany(domain, keys, values);
+}
+
+/// The first key after every key with this prefix, empty if unbounded.
+static std::string getPrefixEnd(std::string prefix) {
+  while (!prefix.empty()) {
+    auto& last = prefix.back();
+    if (static_cast<unsigned char>(last) != 0xff) {
+      last++;
+      return prefix;
+    }
+    prefix.pop_back();
+  }
+  return prefix;
+}
+
+Status scanDatabaseRange(const std::string& domain,
+                         std::vector<std::string>& keys,
+                         const std::string& start,
+                         const std::string& end,
+                         size_t max) {
+  auto plugin = getDatabasePlugin();
+  if (plugin == nullptr) {
+    return Status(1, "Database plugin is not available");
+  }
+
+  std::vector<std::pair<std::string, std::string>> items;
+  auto status = plugin->scanRange(domain, start, end, max, false, false, items);
+  for (auto& item : items) {
+    keys.push_back(std::move(item.first));
+  }
+  return status;
+}
+
+Status scanDatabaseRange(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& items,
+    const std::string& start,
+    const std::string& end,
+    size_t max,
+    bool reverse) {
+  auto plugin = getDatabasePlugin();
+  if (plugin == nullptr) {
+    return Status(1, "Database plugin is not available");
+  }
+  return plugin->scanRange(domain, start, end, max, reverse, true, items);
+}
+
+Status scanDatabasePrefix(const std::string& domain,
+                          std::vector<std::string>& keys,
+                          const std::string& prefix,
+                          size_t max) {
+  return scanDatabaseRange(domain, keys, prefix, getPrefixEnd(prefix), max);
+}
+
+Status scanDatabasePrefix(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& items,
+    const std::string& prefix,
+    size_t max) {
+  return scanDatabaseRange(domain, items, prefix, getPrefixEnd(prefix), max);
+}
+
+Status writeDatabaseValues(
+    const std::string& domain,
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes) {
+  auto plugin = getDatabasePlugin();
+  if (plugin == nullptr) {
+    return Status(1, "Database plugin is not available");
+  }
+  auto status = plugin->write(domain, puts, deletes);
+  if (status.ok() && !deletes.empty()) {
+    addDatabaseDeletes(domain, deletes.size());
+  }
+  return status;
+}
+
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& start,
+                           const std::string& end) {
+  auto plugin = getDatabasePlugin();
+  if (plugin == nullptr) {
+    return Status(1, "Database plugin is not available");
+  }
+  return plugin->removeRange(domain, start, end);
+}
+
+Status getDatabaseStats(QueryData& stats) {
+  PluginRequest request = {{"action", "stats"}};
+  PluginResponse response;
+  auto status =
+      Registry::call("database", FLAGS_database_plugin, request, response);
+  stats.insert(stats.end(), response.begin(), response.end());
+  return status;
+}
+
+Status compactDatabase(const std::string& domain) {
+  PluginRequest request = {{"action", "compact"}, {"domain", domain}};
+  auto status = Registry::call("database", FLAGS_database_plugin, request);
+  if (status.ok()) {
+    std::lock_guard<std::mutex> lock(kCompactionsMutex);
+    auto& compaction = kCompactions[domain];
+    compaction.deletes = 0;
+    compaction.compacted = getUnixTime();
+    compaction.requested = false;
+  }
+  return status;
+}
+
+void addDatabaseDeletes(const std::string& domain, size_t count) {
+  std::lock_guard<std::mutex> lock(kCompactionsMutex);
+  auto& compaction = kCompactions[domain];
+  if (compaction.compacted == 0) {
+    compaction.compacted = getUnixTime();
+  }
+  compaction.deletes += count;
+}
+
+Status requestDatabaseCompaction(const std::string& domain) {
+  if (domain.empty()) {
+    // Events and buffered logs are the domains that expire data.
+    requestDatabaseCompaction(kEvents);
+    return requestDatabaseCompaction(kLogs);
+  }
+
+  if (std::find(kDomains.begin(), kDomains.end(), domain) == kDomains.end()) {
+    return Status(1, "Unknown database domain: " + domain);
+  }
+  std::lock_guard<std::mutex> lock(kCompactionsMutex);
+  kCompactions[domain].requested = true;
+  return Status(0, "OK");
+}
+
+std::vector<std::string> getDueCompactions(size_t now) {
+  std::vector<std::string> domains;
+  std::lock_guard<std::mutex> lock(kCompactionsMutex);
+  for (const auto& domain : kCompactions) {
+    const auto& compaction = domain.second;
+    if (compaction.requested ||
+        (FLAGS_database_compact_deletes > 0 &&
+         compaction.deletes >= FLAGS_database_compact_deletes) ||
+        (FLAGS_database_compact_interval > 0 && compaction.deletes > 0 &&
+         now >= compaction.compacted + FLAGS_database_compact_interval)) {
+      domains.push_back(domain.first);
+    }
+  }
+  return domains;
+}
+
 void dumpDatabase() {
   for (const auto& domain : kDomains) {
     std::vector<std::string> keys;
@@ -594,6 +1247,17 @@ void dumpDatabase() {
       if (!getDatabaseValue(domain, key, value)) {
         continue;
       }
+
+      // Display binary stored values as JSON.
+      if (isBinary(value, kBinaryRow)) {
+        Row r;
+        deserializeRowBinary(value, r);
+        serializeRowJSON(r, value);
+      } else if (isBinary(value, kBinaryQueryData)) {
+        QueryData qd;
+        deserializeQueryDataBinary(value, qd);
+        serializeQueryDataJSON(qd, value);
+      }
       fprintf(
           stdout, "%s[%s]: %s\n", domain.c_str(), key.c_str(), value.c_str());
     }
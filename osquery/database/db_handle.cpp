@@ -9,6 +9,7 @@
  */
 
 #include <algorithm>
+#include <map>
 #include <mutex>
 #include <stdexcept>
 
@@ -16,14 +17,23 @@
 
 #include <snappy.h>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/env.h>
 #include <rocksdb/options.h>
+#include <rocksdb/rate_limiter.h>
+#include <rocksdb/table.h>
+#include <rocksdb/version.h>
+#include <rocksdb/write_batch.h>
+#include <rocksdb/write_buffer_manager.h>
 
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/status.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/watcher.h"
 #include "osquery/database/db_handle.h"
 
 namespace osquery {
@@ -47,6 +57,37 @@ class RocksDatabasePlugin : public DatabasePlugin {
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               size_t max = 0) const override;
+
+  /// Per-domain RocksDB statistics.
+  Status stats(QueryData& results) const override;
+
+  /// Batched lookups use RocksDB MultiGet.
+  Status getMany(const std::string& domain,
+                 const std::vector<std::string>& keys,
+                 std::vector<std::string>& values) const override;
+
+  /// Range scans use a RocksDB iterator.
+  Status scanRange(
+      const std::string& domain,
+      const std::string& start,
+      const std::string& end,
+      size_t max,
+      bool reverse,
+      bool values,
+      std::vector<std::pair<std::string, std::string>>& results) const override;
+
+  /// Writes use a single RocksDB WriteBatch.
+  Status write(const std::string& domain,
+               const std::vector<std::pair<std::string, std::string>>& puts,
+               const std::vector<std::string>& deletes) override;
+
+  /// Range deletes use a range tombstone.
+  Status removeRange(const std::string& domain,
+                     const std::string& start,
+                     const std::string& end) override;
+
+  /// Compaction uses a manual RocksDB CompactRange.
+  Status compact(const std::string& domain) override;
 };
 
 /// Backing-storage provider for osquery internal/core.
@@ -63,6 +104,7 @@ const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
 const std::string kEvents = "events";
 const std::string kLogs = "logs";
+const std::string kHashes = "hashes";
 
 /**
  * @brief A const vector of column families in RocksDB
@@ -73,7 +115,7 @@ const std::string kLogs = "logs";
  * database.
  */
 const std::vector<std::string> kDomains = {
-    kPersistentSettings, kQueries, kEvents, kLogs};
+    kPersistentSettings, kQueries, kEvents, kLogs, kHashes};
 
 CLI_FLAG(string,
          database_path,
@@ -87,6 +129,206 @@ CLI_FLAG(bool,
          "Keep osquery backing-store in memory");
 FLAG_ALIAS(bool, use_in_memory_database, database_in_memory);
 
+CLI_FLAG(string,
+         database_profile,
+         "default",
+         "RocksDB tuning profile: default, low_disk, performance");
+
+CLI_FLAG(uint64,
+         database_memory_limit,
+         0,
+         "Maximum MB of RocksDB block cache and memtables (0=profile)");
+
+CLI_FLAG(uint64,
+         database_compaction_rate,
+         0,
+         "Maximum MB per second written by RocksDB compactions (0=unlimited)");
+
+DECLARE_uint64(watchdog_rocksdb_limit);
+
+CLI_FLAG(string,
+         database_durability,
+         "",
+         "Comma-separated domain=none|async|sync write durability overrides");
+
+/// Memtables are charged to the shared block cache from RocksDB 5.6.
+#if ROCKSDB_MAJOR > 5 || (ROCKSDB_MAJOR == 5 && ROCKSDB_MINOR >= 6)
+#define OSQUERY_ROCKSDB_CHARGE_MEMTABLES 1
+#endif
+
+/// Column family tuning applied to a single domain.
+struct DomainOptions {
+  /// Memtable budget: size of each write buffer and the number of buffers.
+  size_t write_buffer_size;
+  int max_write_buffer_number;
+
+  /// The domain's share of the block cache, 0 disables the block cache.
+  size_t block_cache_size;
+
+  /// Bloom filter bits per key for point lookups, 0 disables the filter.
+  int bloom_bits;
+
+  /// Compress SST files.
+  bool compression;
+
+  /// Use FIFO compaction and cap the SST files at this size, 0 uses level.
+  uint64_t fifo_size;
+};
+
+/**
+ * @brief Named tuning profiles, each maps a domain to column family options.
+ *
+ * The "events" and "logs" domains are append-heavy and expire data by time,
+ * they use larger memtables. Event segments are read by key, in batches, so
+ * "events" uses a bloom filter. Buffered logs are only prefix scanned and
+ * skip the filter. The "queries" and "hashes" domains are rewrite-heavy and
+ * point-read. The "configurations" domain is tiny and read-mostly.
+ *
+ * Snappy is used for compression, it is the codec osquery links against
+ * RocksDB.
+ */
+const std::map<std::string, std::map<std::string, DomainOptions>>
+    kDatabaseProfiles = {
+        {"default",
+         {
+             {kPersistentSettings, {64 * 1024, 2, 1024 * 1024, 10, false, 0}},
+             {kQueries, {512 * 1024, 2, 4 * 1024 * 1024, 10, true, 0}},
+             {kEvents, {1024 * 1024, 3, 2 * 1024 * 1024, 10, true, 0}},
+             {kLogs, {512 * 1024, 2, 0, 0, true, 0}},
+             {kHashes, {256 * 1024, 2, 1024 * 1024, 10, true, 0}},
+         }},
+        {"low_disk",
+         {
+             {kPersistentSettings, {64 * 1024, 2, 512 * 1024, 10, true, 0}},
+             {kQueries, {256 * 1024, 2, 1 * 1024 * 1024, 10, true, 0}},
+             {kEvents,
+              {512 * 1024, 2, 1 * 1024 * 1024, 10, true, 256 * 1024 * 1024}},
+             {kLogs, {256 * 1024, 2, 0, 0, true, 64 * 1024 * 1024}},
+             {kHashes, {128 * 1024, 2, 512 * 1024, 10, true, 0}},
+         }},
+        {"performance",
+         {
+             {kPersistentSettings,
+              {256 * 1024, 2, 4 * 1024 * 1024, 10, false, 0}},
+             {kQueries, {4 * 1024 * 1024, 3, 32 * 1024 * 1024, 10, false, 0}},
+             {kEvents, {8 * 1024 * 1024, 4, 16 * 1024 * 1024, 10, true, 0}},
+             {kLogs, {2 * 1024 * 1024, 3, 0, 0, false, 0}},
+             {kHashes, {1024 * 1024, 2, 4 * 1024 * 1024, 10, false, 0}},
+         }},
+};
+
+/**
+ * @brief How the writes of each domain are persisted.
+ *
+ * Regenerable data, the hash cache, skips the write-ahead log and is only
+ * persisted when memtables are flushed, such as on shutdown. Events and
+ * settings are written to the log without a sync, RocksDB groups concurrent
+ * writers into one log write. Buffered results awaiting a logger plugin are
+ * synced so they survive a host crash.
+ */
+const std::map<std::string, DomainDurability> kDomainDurability = {
+    {kPersistentSettings, DURABILITY_ASYNC},
+    {kQueries, DURABILITY_ASYNC},
+    {kEvents, DURABILITY_ASYNC},
+    {kLogs, DURABILITY_SYNC},
+    {kHashes, DURABILITY_NONE},
+};
+
+const std::map<DomainDurability, std::string> kDurabilityNames = {
+    {DURABILITY_NONE, "none"},
+    {DURABILITY_ASYNC, "async"},
+    {DURABILITY_SYNC, "sync"},
+};
+
+/// The durability of each domain, with the database_durability overrides.
+static std::map<std::string, DomainDurability> getDomainDurability() {
+  auto durability = kDomainDurability;
+  for (const auto& item : split(FLAGS_database_durability, ",")) {
+    auto pair = split(item, "=");
+    auto name = std::find_if(
+        kDurabilityNames.begin(),
+        kDurabilityNames.end(),
+        [&pair](const std::pair<DomainDurability, std::string>& n) {
+          return pair.size() == 2 && n.second == pair[1];
+        });
+    if (pair.size() != 2 || durability.count(pair[0]) == 0 ||
+        name == kDurabilityNames.end()) {
+      LOG(WARNING) << "Unknown database durability: " << item;
+      continue;
+    }
+    durability[pair[0]] = name->first;
+  }
+  return durability;
+}
+
+/// The worker memory limit divisor, RocksDB uses at most half.
+const size_t kDatabaseWorkerShare = 2;
+
+/**
+ * @brief The bytes of block cache and memtables shared by every domain.
+ *
+ * Without --database_memory_limit the budget is the sum of the profile's
+ * block caches and memtables. The budget is kept below the watchdog's worker
+ * and RocksDB memory limits so the backing store alone never exceeds them.
+ */
+static size_t getMemoryBudget(
+    const std::map<std::string, DomainOptions>& profile) {
+  size_t budget = 0;
+  if (FLAGS_database_memory_limit > 0) {
+    budget = FLAGS_database_memory_limit * 1024 * 1024;
+  } else {
+    for (const auto& domain : profile) {
+      budget += domain.second.block_cache_size +
+                domain.second.write_buffer_size *
+                    domain.second.max_write_buffer_number;
+    }
+  }
+
+  if (!FLAGS_disable_watchdog) {
+    budget = std::min(budget,
+                      getWorkerLimit(MEMORY_LIMIT) * 1024 * 1024 /
+                          kDatabaseWorkerShare);
+  }
+  if (FLAGS_watchdog_rocksdb_limit > 0) {
+    // Leave a quarter of the limit for table readers and iterators.
+    budget = std::min<size_t>(
+        budget, FLAGS_watchdog_rocksdb_limit * 1024 * 1024 / 4 * 3);
+  }
+  return budget;
+}
+
+/// Apply a domain's tuning options to the base column family options.
+static rocksdb::ColumnFamilyOptions getDomainOptions(
+    const rocksdb::Options& base,
+    const DomainOptions& domain,
+    const std::shared_ptr<rocksdb::Cache>& cache) {
+  rocksdb::ColumnFamilyOptions options(base);
+  options.write_buffer_size = domain.write_buffer_size;
+  options.max_write_buffer_number = domain.max_write_buffer_number;
+  options.compression = (domain.compression) ? rocksdb::kSnappyCompression
+                                             : rocksdb::kNoCompression;
+  if (domain.fifo_size > 0) {
+    options.compaction_style = rocksdb::kCompactionStyleFIFO;
+    options.compaction_options_fifo.max_table_files_size = domain.fifo_size;
+  }
+
+  rocksdb::BlockBasedTableOptions table_options;
+  if (domain.block_cache_size > 0) {
+    // Index and filter blocks are also bounded by the shared cache.
+    table_options.block_cache = cache;
+    table_options.cache_index_and_filter_blocks = true;
+  } else {
+    table_options.no_block_cache = true;
+  }
+  if (domain.bloom_bits > 0) {
+    table_options.filter_policy.reset(
+        rocksdb::NewBloomFilterPolicy(domain.bloom_bits, false));
+  }
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+  return options;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // constructors and destructors
 /////////////////////////////////////////////////////////////////////////////
@@ -133,6 +375,13 @@ DBHandle::DBHandle(const std::string& path, bool in_memory)
   options_.max_background_compactions = 2;
   options_.max_background_flushes = 2;
 
+  // Flushes and compactions compete with scheduled queries for disk I/O.
+  if (FLAGS_database_compaction_rate > 0) {
+    rate_limiter_.reset(rocksdb::NewGenericRateLimiter(
+        static_cast<int64_t>(FLAGS_database_compaction_rate) * 1024 * 1024));
+    options_.rate_limiter = rate_limiter_;
+  }
+
   // Create an environment to replace the default logger.
   if (logger_ == nullptr) {
     logger_ = std::make_shared<GlogRocksDBLogger>();
@@ -142,23 +391,81 @@ DBHandle::DBHandle(const std::string& path, bool in_memory)
   column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
       rocksdb::kDefaultColumnFamilyName, options_));
 
+  profile_ = FLAGS_database_profile;
+  if (kDatabaseProfiles.count(profile_) == 0) {
+    LOG(WARNING) << "Unknown database profile: " << profile_;
+    profile_ = "default";
+  }
+
+  // Every domain shares one block cache and one memtable budget, so memory
+  // does not grow with the number of domains. Memtables may use half of the
+  // budget before they are flushed.
+  const auto& profile = kDatabaseProfiles.at(profile_);
+  memory_limit_ = getMemoryBudget(profile);
+  block_cache_ = rocksdb::NewLRUCache(memory_limit_);
+#if defined(OSQUERY_ROCKSDB_CHARGE_MEMTABLES)
+  write_buffer_manager_ = std::make_shared<rocksdb::WriteBufferManager>(
+      memory_limit_ / 2, block_cache_);
+#else
+  write_buffer_manager_ =
+      std::make_shared<rocksdb::WriteBufferManager>(memory_limit_ / 2);
+#endif
+  options_.write_buffer_manager = write_buffer_manager_;
+
+  // Each domain writes with the options of its durability.
+  for (const auto& domain : getDomainDurability()) {
+    rocksdb::WriteOptions options;
+    options.disableWAL = (domain.second == DURABILITY_NONE);
+    options.sync = (domain.second == DURABILITY_SYNC);
+    durability_[domain.first] = domain.second;
+    write_options_[domain.first] = options;
+  }
+
+  // Each domain uses the column family options from the tuning profile.
   for (const auto& cf_name : kDomains) {
-    column_families_.push_back(
-        rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+    const auto& domain = profile.at(cf_name);
+    if (domain.fifo_size > 0) {
+      // FIFO compaction requires the table files to remain open.
+      options_.max_open_files = -1;
+    }
+    column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
+        cf_name, getDomainOptions(options_, domain, block_cache_)));
   }
 
   // Make the magic happen.
   open();
 }
 
+/// The path of an in-memory database without a path.
+const std::string kInMemoryPath = "/osquery-memory";
+
+bool DBHandle::supportsInMemory() {
+#if ROCKSDB_MAJOR >= 5 && !defined(ROCKSDB_LITE)
+  return true;
+#else
+  return false;
+#endif
+}
+
 void DBHandle::open() {
   if (in_memory_) {
-    // Remove when MemEnv is included in librocksdb
-    // options_.env = rocksdb::NewMemEnv(rocksdb::Env::Default());
+#if ROCKSDB_MAJOR >= 5 && !defined(ROCKSDB_LITE)
+    // Files, the write-ahead log, and locks are kept in the process.
+    if (env_ == nullptr) {
+      env_.reset(rocksdb::NewMemEnv(rocksdb::Env::Default()));
+    }
+    options_.env = env_.get();
+    if (path_.empty()) {
+      path_ = kInMemoryPath;
+    }
+#else
     throw std::runtime_error("Cannot start in-memory RocksDB: Requires MemEnv");
+#endif
+  } else {
+    options_.env = rocksdb::Env::Default();
   }
 
-  if (pathExists(path_).ok() && !isReadable(path_).ok()) {
+  if (!in_memory_ && pathExists(path_).ok() && !isReadable(path_).ok()) {
     throw std::runtime_error("Cannot read RocksDB path: " + path_);
   }
 
@@ -191,7 +498,7 @@ void DBHandle::open() {
   }
 
   // RocksDB may not create/append a directory with acceptable permissions.
-  if (!read_only_ && chmod(path_.c_str(), S_IRWXU) != 0) {
+  if (!in_memory_ && !read_only_ && chmod(path_.c_str(), S_IRWXU) != 0) {
     throw std::runtime_error("Cannot set permissions on RocksDB path: " +
                              path_);
   }
@@ -199,13 +506,26 @@ void DBHandle::open() {
 
 DBHandle::~DBHandle() { close(); }
 
+/// Protects the opened handle from memory reporting while it closes.
+static std::mutex kDBHandleMutex;
+
+/// The DBHandle singleton, once created.
+static std::weak_ptr<DBHandle> kDBHandleInstance;
+
+/// Property, in bytes, of each column family's memory outside the cache.
+const std::string kDBTableReadersProperty =
+    "rocksdb.estimate-table-readers-mem";
+
 void DBHandle::close() {
+  std::lock_guard<std::mutex> lock(kDBHandleMutex);
   for (auto handle : handles_) {
     delete handle;
   }
+  handles_.clear();
 
   if (db_ != nullptr) {
     delete db_;
+    db_ = nullptr;
   }
 }
 
@@ -221,7 +541,7 @@ bool DBHandle::checkDB() {
   // Allow database instances to check if a status/sanity check was requested.
   kCheckingDB = true;
   try {
-    auto handle = DBHandle(FLAGS_database_path, FLAGS_database_in_memory);
+    DBHandle handle(FLAGS_database_path, FLAGS_database_in_memory);
     kCheckingDB = false;
     if (kDBHandleOptionRequireWrite && handle.read_only_) {
       return false;
@@ -242,9 +562,39 @@ DBHandleRef DBHandle::getInstanceAtPath(const std::string& path) {
 
 DBHandleRef DBHandle::getInstance(const std::string& path, bool in_memory) {
   static DBHandleRef db_handle = DBHandleRef(new DBHandle(path, in_memory));
+  static std::once_flag registered;
+  std::call_once(registered, []() {
+    std::lock_guard<std::mutex> lock(kDBHandleMutex);
+    kDBHandleInstance = db_handle;
+  });
   return db_handle;
 }
 
+uint64_t DBHandle::getMemoryUsage() {
+  std::lock_guard<std::mutex> lock(kDBHandleMutex);
+  auto instance = kDBHandleInstance.lock();
+  if (instance == nullptr || instance->db_ == nullptr) {
+    return 0;
+  }
+
+  return instance->memoryUsage();
+}
+
+uint64_t DBHandle::memoryUsage() const {
+  // The block cache is shared, it is counted once rather than per domain.
+  uint64_t usage = block_cache_->GetUsage();
+#if !defined(OSQUERY_ROCKSDB_CHARGE_MEMTABLES)
+  usage += write_buffer_manager_->memory_usage();
+#endif
+  for (auto handle : handles_) {
+    uint64_t value = 0;
+    if (db_->GetIntProperty(handle, kDBTableReadersProperty, &value)) {
+      usage += value;
+    }
+  }
+  return usage;
+}
+
 void DBHandle::resetInstance(const std::string& path, bool in_memory) {
   close();
 
@@ -259,6 +609,14 @@ void DBHandle::resetInstance(const std::string& path, bool in_memory) {
 
 rocksdb::DB* DBHandle::getDB() const { return db_; }
 
+const rocksdb::WriteOptions& DBHandle::getWriteOptions(
+    const std::string& domain) const {
+  static const auto kDefaultWriteOptions = rocksdb::WriteOptions();
+  auto options = write_options_.find(domain);
+  return (options == write_options_.end()) ? kDefaultWriteOptions
+                                           : options->second;
+}
+
 rocksdb::ColumnFamilyHandle* DBHandle::getHandleForColumnFamily(
     const std::string& cf) const {
   try {
@@ -287,10 +645,40 @@ Status DBHandle::Get(const std::string& domain,
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
+  // Block cache and memtable memory is allocated from the database arena.
+  MemoryArenaScope arena(ARENA_DATABASE);
   auto s = getDB()->Get(rocksdb::ReadOptions(), cfh, key, &value);
   return Status(s.code(), s.ToString());
 }
 
+Status DBHandle::MultiGet(const std::string& domain,
+                          const std::vector<std::string>& keys,
+                          std::vector<std::string>& values) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  std::vector<rocksdb::ColumnFamilyHandle*> handles(keys.size(), cfh);
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  values.clear();
+  MemoryArenaScope arena(ARENA_DATABASE);
+  auto statuses =
+      getDB()->MultiGet(rocksdb::ReadOptions(), handles, slices, &values);
+  values.resize(keys.size());
+  for (size_t i = 0; i < statuses.size(); i++) {
+    if (statuses[i].IsNotFound()) {
+      values[i].clear();
+    } else if (!statuses[i].ok()) {
+      return Status(statuses[i].code(), statuses[i].ToString());
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status DBHandle::Put(const std::string& domain,
                      const std::string& key,
                      const std::string& value) const {
@@ -302,7 +690,8 @@ Status DBHandle::Put(const std::string& domain,
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
-  auto s = getDB()->Put(rocksdb::WriteOptions(), cfh, key, value);
+  MemoryArenaScope arena(ARENA_DATABASE);
+  auto s = getDB()->Put(getWriteOptions(domain), cfh, key, value);
   if (s.code() != 0 && s.IsIOError()) {
     // An error occurred, check if it is an IO error and remove the offending
     // specific filename or log name.
@@ -325,26 +714,103 @@ Status DBHandle::Delete(const std::string& domain,
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
-  auto options = rocksdb::WriteOptions();
+  auto s = getDB()->Delete(getWriteOptions(domain), cfh, key);
+  return Status(s.code(), s.ToString());
+}
 
-  // We could sync here, but large deletes will cause multi-syncs.
-  // For example: event record expirations found in an expired index.
-  // options.sync = true;
-  auto s = getDB()->Delete(options, cfh, key);
+Status DBHandle::Write(
+    const std::string& domain,
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes) const {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  MemoryArenaScope arena(ARENA_DATABASE);
+  rocksdb::WriteBatch batch;
+  for (const auto& put : puts) {
+    batch.Put(cfh, put.first, put.second);
+  }
+  for (const auto& key : deletes) {
+    batch.Delete(cfh, key);
+  }
+  auto s = getDB()->Write(getWriteOptions(domain), &batch);
   return Status(s.code(), s.ToString());
 }
 
-Status DBHandle::Scan(const std::string& domain,
-                      std::vector<std::string>& results,
-                      size_t max) const {
-  // Trampoline into scan prefix with an empty prefix requirement.
-  return ScanPrefix(domain, results, "", max);
+Status DBHandle::DeleteRange(const std::string& domain,
+                             const std::string& start,
+                             const std::string& end) const {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  if (end.empty() || start >= end) {
+    return Status(1, "Invalid delete range");
+  }
+
+#if ROCKSDB_MAJOR >= 5
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // A single range tombstone replaces a delete per key.
+  auto s = getDB()->DeleteRange(getWriteOptions(domain), cfh, start, end);
+  return Status(s.code(), s.ToString());
+#else
+  // Older RocksDB releases do not support range tombstones.
+  std::vector<std::string> keys;
+  auto status = ScanRange(domain, keys, start, end);
+  if (!status.ok() || keys.empty()) {
+    return status;
+  }
+  return Write(domain, {}, keys);
+#endif
 }
 
-Status DBHandle::ScanPrefix(const std::string& domain,
-                            std::vector<std::string>& results,
-                            const std::string& prefix,
-                            size_t max) const {
+Status DBHandle::Compact(const std::string& domain) const {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // Background compactions may continue while the range is compacted.
+  rocksdb::CompactRangeOptions options;
+  options.exclusive_manual_compaction = false;
+  auto s = getDB()->CompactRange(options, cfh, nullptr, nullptr);
+  return Status(s.code(), s.ToString());
+}
+
+/// The first key after every key with this prefix, empty if unbounded.
+static std::string getPrefixEnd(std::string prefix) {
+  while (!prefix.empty()) {
+    auto& last = prefix.back();
+    if (static_cast<unsigned char>(last) != 0xff) {
+      last++;
+      return prefix;
+    }
+    prefix.pop_back();
+  }
+  return prefix;
+}
+
+Status DBHandle::scanRange(
+    const std::string& domain,
+    const std::string& start,
+    const std::string& end,
+    size_t max,
+    bool reverse,
+    const std::function<void(const rocksdb::Iterator&)>& visitor) const {
   if (getDB() == nullptr) {
     return Status(1, "Database not opened");
   }
@@ -353,34 +819,185 @@ Status DBHandle::ScanPrefix(const std::string& domain,
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
+
+  // Scans are bounded reads, do not pollute the block cache.
   auto options = rocksdb::ReadOptions();
   options.verify_checksums = false;
   options.fill_cache = false;
-  auto it = getDB()->NewIterator(rocksdb::ReadOptions(), cfh);
+  rocksdb::Slice upper_bound(end);
+  if (!end.empty() && !reverse) {
+    options.iterate_upper_bound = &upper_bound;
+  }
+
+  auto it = getDB()->NewIterator(options, cfh);
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
   }
 
   size_t count = 0;
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
-    auto key = it->key().ToString();
-    if (key.find(prefix) == 0) {
-      results.push_back(std::move(key));
+  if (reverse) {
+    // Start at the last key before the end, and stop before the start.
+    if (end.empty()) {
+      it->SeekToLast();
+    } else {
+      it->Seek(end);
+      if (it->Valid()) {
+        it->Prev();
+      } else {
+        it->SeekToLast();
+      }
+    }
+    for (; it->Valid(); it->Prev()) {
+      if (it->key().compare(start) < 0) {
+        break;
+      }
+      visitor(*it);
       if (max > 0 && ++count >= max) {
         break;
       }
     }
+    delete it;
+    return Status(0, "OK");
+  }
+
+  for (it->Seek(start); it->Valid(); it->Next()) {
+    if (!end.empty() && it->key().compare(upper_bound) >= 0) {
+      break;
+    }
+    visitor(*it);
+    if (max > 0 && ++count >= max) {
+      break;
+    }
   }
   delete it;
   return Status(0, "OK");
 }
 
+Status DBHandle::Scan(const std::string& domain,
+                      std::vector<std::string>& results,
+                      size_t max) const {
+  // Trampoline into scan prefix with an empty prefix requirement.
+  return ScanPrefix(domain, results, "", max);
+}
+
+Status DBHandle::ScanPrefix(const std::string& domain,
+                            std::vector<std::string>& results,
+                            const std::string& prefix,
+                            size_t max) const {
+  return ScanRange(domain, results, prefix, getPrefixEnd(prefix), max);
+}
+
+Status DBHandle::ScanPrefix(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& results,
+    const std::string& prefix,
+    size_t max) const {
+  return ScanRange(domain, results, prefix, getPrefixEnd(prefix), max);
+}
+
+Status DBHandle::ScanRange(const std::string& domain,
+                           std::vector<std::string>& results,
+                           const std::string& start,
+                           const std::string& end,
+                           size_t max) const {
+  return scanRange(domain,
+                   start,
+                   end,
+                   max,
+                   false,
+                   ([&results](const rocksdb::Iterator& it) {
+                     results.push_back(it.key().ToString());
+                   }));
+}
+
+Status DBHandle::ScanRange(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& results,
+    const std::string& start,
+    const std::string& end,
+    size_t max) const {
+  return scanRange(domain,
+                   start,
+                   end,
+                   max,
+                   false,
+                   ([&results](const rocksdb::Iterator& it) {
+                     results.push_back(std::make_pair(it.key().ToString(),
+                                                      it.value().ToString()));
+                   }));
+}
+
+Status DBHandle::ScanRangeReverse(
+    const std::string& domain,
+    std::vector<std::pair<std::string, std::string>>& results,
+    const std::string& start,
+    const std::string& end,
+    size_t max) const {
+  return scanRange(domain,
+                   start,
+                   end,
+                   max,
+                   true,
+                   ([&results](const rocksdb::Iterator& it) {
+                     results.push_back(std::make_pair(it.key().ToString(),
+                                                      it.value().ToString()));
+                   }));
+}
+
+Status DBHandle::Stats(const std::string& domain, Row& stats) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  const auto& options = kDatabaseProfiles.at(profile_).at(domain);
+  stats["domain"] = domain;
+  stats["profile"] = profile_;
+  stats["compaction"] = (options.fifo_size > 0) ? "fifo" : "level";
+  stats["compression"] = (options.compression) ? "snappy" : "none";
+  stats["durability"] = kDurabilityNames.at(durability_.at(domain));
+  stats["max_size"] = std::to_string(options.fifo_size);
+  stats["block_cache_size"] = std::to_string(
+      (options.block_cache_size > 0) ? block_cache_->GetCapacity() : 0);
+  stats["block_cache_usage"] = std::to_string(block_cache_->GetUsage());
+  stats["memory_limit"] = std::to_string(memory_limit_);
+  stats["memory_usage"] = std::to_string(memoryUsage());
+  stats["bloom_bits"] = std::to_string(options.bloom_bits);
+
+  // Integer properties which are not supported are reported as -1.
+  const std::map<std::string, std::string> properties = {
+      {"keys", "rocksdb.estimate-num-keys"},
+      {"size", "rocksdb.total-sst-files-size"},
+      {"memtable_size", "rocksdb.cur-size-all-mem-tables"},
+      {"pending_compaction", "rocksdb.compaction-pending"},
+  };
+  for (const auto& property : properties) {
+    uint64_t value = 0;
+    if (getDB()->GetIntProperty(cfh, property.second, &value)) {
+      stats[property.first] = std::to_string(value);
+    } else {
+      stats[property.first] = "-1";
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status RocksDatabasePlugin::get(const std::string& domain,
                                 const std::string& key,
                                 std::string& value) const {
   return DBHandle::getInstance()->Get(domain, key, value);
 }
 
+Status RocksDatabasePlugin::getMany(const std::string& domain,
+                                    const std::vector<std::string>& keys,
+                                    std::vector<std::string>& values) const {
+  return DBHandle::getInstance()->MultiGet(domain, keys, values);
+}
+
 Status RocksDatabasePlugin::put(const std::string& domain,
                                 const std::string& key,
                                 const std::string& value) {
@@ -397,4 +1014,54 @@ Status RocksDatabasePlugin::scan(const std::string& domain,
                                  size_t max) const {
   return DBHandle::getInstance()->Scan(domain, results, max);
 }
+
+Status RocksDatabasePlugin::stats(QueryData& results) const {
+  auto db = DBHandle::getInstance();
+  for (const auto& domain : kDomains) {
+    Row r;
+    auto status = db->Stats(domain, r);
+    if (!status.ok()) {
+      return status;
+    }
+    results.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
+Status RocksDatabasePlugin::scanRange(
+    const std::string& domain,
+    const std::string& start,
+    const std::string& end,
+    size_t max,
+    bool reverse,
+    bool values,
+    std::vector<std::pair<std::string, std::string>>& results) const {
+  return DBHandle::getInstance()->scanRange(
+      domain,
+      start,
+      end,
+      max,
+      reverse,
+      ([&results, values](const rocksdb::Iterator& it) {
+        results.push_back(std::make_pair(
+            it.key().ToString(), (values) ? it.value().ToString() : ""));
+      }));
+}
+
+Status RocksDatabasePlugin::write(
+    const std::string& domain,
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes) {
+  return DBHandle::getInstance()->Write(domain, puts, deletes);
+}
+
+Status RocksDatabasePlugin::removeRange(const std::string& domain,
+                                        const std::string& start,
+                                        const std::string& end) {
+  return DBHandle::getInstance()->DeleteRange(domain, start, end);
+}
+
+Status RocksDatabasePlugin::compact(const std::string& domain) {
+  return DBHandle::getInstance()->Compact(domain);
+}
 }
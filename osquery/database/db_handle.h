@@ -10,17 +10,24 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
 #include <rocksdb/env.h>
 #include <rocksdb/options.h>
+#include <rocksdb/rate_limiter.h>
+#include <rocksdb/write_buffer_manager.h>
 
 #include <boost/noncopyable.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/flags.h>
 
 namespace osquery {
@@ -30,6 +37,16 @@ DECLARE_string(database_path);
 class DBHandle;
 typedef std::shared_ptr<DBHandle> DBHandleRef;
 
+/// How a domain's writes are persisted, see --database_durability.
+enum DomainDurability {
+  /// Skip the write-ahead log, writes persist when memtables are flushed.
+  DURABILITY_NONE = 0,
+  /// Append to the write-ahead log without a sync.
+  DURABILITY_ASYNC,
+  /// Append to and sync the write-ahead log.
+  DURABILITY_SYNC,
+};
+
 class GlogRocksDBLogger : public rocksdb::Logger {
  public:
   // We intend to override a virtual method that is overloaded.
@@ -78,12 +95,24 @@ class DBHandle {
    */
   static bool checkDB();
 
+  /// Check if RocksDB was built with the in-memory environment (MemEnv).
+  static bool supportsInMemory();
+
   /// Require all DBHandle accesses to open a read and write handle.
   static void setRequireWrite(bool rw) { kDBHandleOptionRequireWrite = rw; }
 
   /// Allow DBHandle creations.
   static void setAllowOpen(bool ao) { kDBHandleOptionAllowOpen = ao; }
 
+  /**
+   * @brief Report the bytes of memory used by the open database.
+   *
+   * Sums the shared block cache, the memtables charged to it, and the table
+   * readers of every column family. This does not create the DBHandle
+   * singleton, a process that has not opened the database reports 0.
+   */
+  static uint64_t getMemoryUsage();
+
  public:
   /////////////////////////////////////////////////////////////////////////////
   // Data access methods
@@ -102,6 +131,20 @@ class DBHandle {
              const std::string& key,
              std::string& value) const;
 
+  /**
+   * @brief Get data for a set of keys from a "domain" in one batched read.
+   *
+   * @param domain the "domain" or "column family"
+   * @param keys the string keys
+   * @param values the output values, in the order of keys, a key that does
+   * not exist has an empty value
+   *
+   * @return failure if a key exists but could not be read
+   */
+  Status MultiGet(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const;
+
   /**
    * @brief Put data into the database identified by a domain and key.
    *
@@ -125,6 +168,37 @@ class DBHandle {
    */
   Status Delete(const std::string& domain, const std::string& key) const;
 
+  /**
+   * @brief Atomically apply a set of puts and deletes to a domain.
+   *
+   * All of the writes are applied using a single RocksDB WriteBatch.
+   *
+   * @param domain the "domain" or "column family"
+   * @param puts the key and value pairs to write
+   * @param deletes the keys to delete
+   *
+   * @return operation success or failure
+   */
+  Status Write(const std::string& domain,
+               const std::vector<std::pair<std::string, std::string>>& puts,
+               const std::vector<std::string>& deletes) const;
+
+  /**
+   * @brief Delete every key within the range [start, end) in a "domain"
+   *
+   * RocksDB 5 and later write a single range tombstone, older releases scan
+   * the range and delete each key with a single WriteBatch.
+   *
+   * @param domain the "domain" or "column family"
+   * @param start the first key, inclusive
+   * @param end the last key, exclusive, must not be empty
+   *
+   * @return operation success or failure
+   */
+  Status DeleteRange(const std::string& domain,
+                     const std::string& start,
+                     const std::string& end) const;
+
   /**
    * @brief List the keys in a "domain"
    *
@@ -141,6 +215,9 @@ class DBHandle {
   /**
    * @brief List the data in a "domain"
    *
+   * Keys are ordered, the scan seeks to the prefix and stops at the first key
+   * without the prefix.
+   *
    * @param domain the "domain" or "column family"
    * @param results an output list of all keys with the given prefix
    * @param prefix require each key to contain this string prefix
@@ -153,7 +230,70 @@ class DBHandle {
                     const std::string& prefix,
                     size_t max = 0) const;
 
+  /// List the keys and values with a prefix in a "domain".
+  Status ScanPrefix(const std::string& domain,
+                    std::vector<std::pair<std::string, std::string>>& results,
+                    const std::string& prefix,
+                    size_t max = 0) const;
+
+  /**
+   * @brief List the keys within the range [start, end) in a "domain"
+   *
+   * @param domain the "domain" or "column family"
+   * @param results an output list of keys, in order
+   * @param start the first key, inclusive
+   * @param end the last key, exclusive, or empty for no upper bound
+   * @param optional max limit the number of result keys to a max
+   *
+   * @return operation success or failure
+   */
+  Status ScanRange(const std::string& domain,
+                   std::vector<std::string>& results,
+                   const std::string& start,
+                   const std::string& end,
+                   size_t max = 0) const;
+
+  /// List the keys and values within the range [start, end) in a "domain".
+  Status ScanRange(const std::string& domain,
+                   std::vector<std::pair<std::string, std::string>>& results,
+                   const std::string& start,
+                   const std::string& end,
+                   size_t max = 0) const;
+
+  /// List the keys and values within [start, end) in descending key order.
+  Status ScanRangeReverse(
+      const std::string& domain,
+      std::vector<std::pair<std::string, std::string>>& results,
+      const std::string& start,
+      const std::string& end,
+      size_t max = 0) const;
+
+  /**
+   * @brief Report the tuning options and RocksDB statistics for a "domain"
+   *
+   * @param domain the "domain" or "column family"
+   * @param stats an output row of option and statistic names to values
+   *
+   * @return operation success or failure
+   */
+  Status Stats(const std::string& domain, Row& stats) const;
+
+  /**
+   * @brief Compact every key of a "domain", reclaiming the space of deletes
+   *
+   * The compaction runs on the calling thread and its writes are bounded by
+   * the database_compaction_rate limiter, like background compactions.
+   *
+   * @param domain the "domain" or "column family"
+   *
+   * @return operation success or failure
+   */
+  Status Compact(const std::string& domain) const;
+
  private:
+  /// The memory usage of the opened database, see getMemoryUsage.
+  uint64_t memoryUsage() const;
+
   /**
    * @brief Default constructor
    *
@@ -219,6 +359,15 @@ class DBHandle {
   /// Perform the DB close work.
   void close();
 
+  /// Iterate the keys within [start, end), an empty end is unbounded.
+  Status scanRange(const std::string& domain,
+                   const std::string& start,
+                   const std::string& end,
+                   size_t max,
+                   bool reverse,
+                   const std::function<void(const rocksdb::Iterator&)>& visitor)
+      const;
+
   /**
    * @brief Private helper around accessing the column family handle for a
    * specific column family, based on its name
@@ -237,6 +386,9 @@ class DBHandle {
    */
   rocksdb::DB* getDB() const;
 
+  /// The write options for a domain's durability.
+  const rocksdb::WriteOptions& getWriteOptions(const std::string& domain) const;
+
  public:
   /// Control availability of the RocksDB handle (default false).
   static bool kDBHandleOptionAllowOpen;
@@ -263,6 +415,9 @@ class DBHandle {
   /// The RocksDB connection options that are used to connect to RocksDB
   rocksdb::Options options_;
 
+  /// The tuning profile used for each domain's column family options.
+  std::string profile_;
+
   /// The database was opened in a ReadOnly mode.
   bool read_only_{false};
 
@@ -272,6 +427,25 @@ class DBHandle {
   /// True if the database was started in an in-memory only mode.
   bool in_memory_{false};
 
+  /// The in-memory filesystem, it outlives reopening the database.
+  std::unique_ptr<rocksdb::Env> env_{nullptr};
+
+  /// The durability and write options of each domain.
+  std::map<std::string, DomainDurability> durability_;
+  std::map<std::string, rocksdb::WriteOptions> write_options_;
+
+  /// The bytes of block cache and memtables shared by every domain.
+  size_t memory_limit_{0};
+
+  /// The block cache shared by every domain that caches blocks.
+  std::shared_ptr<rocksdb::Cache> block_cache_{nullptr};
+
+  /// Bounds the memtables of every domain, charged to the block cache.
+  std::shared_ptr<rocksdb::WriteBufferManager> write_buffer_manager_{nullptr};
+
+  /// Bounds the bytes per second written by flushes and compactions.
+  std::shared_ptr<rocksdb::RateLimiter> rate_limiter_{nullptr};
+
  private:
   friend class RocksDatabasePlugin;
   friend class Query;
@@ -283,9 +457,14 @@ class DBHandle {
 
   friend class DBHandleTests;
   FRIEND_TEST(DBHandleTests, test_get);
+  FRIEND_TEST(DBHandleTests, test_multi_get);
   FRIEND_TEST(DBHandleTests, test_put);
   FRIEND_TEST(DBHandleTests, test_delete);
   FRIEND_TEST(DBHandleTests, test_scan);
+  FRIEND_TEST(DBHandleTests, test_stats);
+  FRIEND_TEST(DBHandleTests, test_durability);
+  FRIEND_TEST(DBHandleTests, test_memory_budget);
+  FRIEND_TEST(DBHandleTests, test_in_memory);
   friend class QueryTests;
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_is_query_name_in_database);
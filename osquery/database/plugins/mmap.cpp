@@ -0,0 +1,768 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/database/plugins/mmap.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_string(database_path);
+DECLARE_bool(database_in_memory);
+
+FLAG(uint64,
+     database_mmap_overlay,
+     4 * 1024 * 1024,
+     "Bytes of writes before the mmap database plugin rebuilds a table");
+
+/// Read-optimized backing-storage provider.
+REGISTER_INTERNAL(MmapDatabasePlugin, "database", "mmap");
+
+/// The table header is the magic, a u32 version, and a u64 record count.
+const char kMmapMagic[] = {'O', 'S', 'Q', 'M'};
+const uint32_t kMmapVersion = 1;
+const size_t kMmapHeaderSize = 16;
+
+/// Records and log operations start with their u32 key and value sizes.
+const size_t kMmapRecordHeaderSize = 8;
+
+/// Log batches start with their u32 size and u32 operation count.
+const size_t kMmapBatchHeaderSize = 8;
+
+/// Table writes are buffered to this size.
+const size_t kMmapWriteBufferSize = 1024 * 1024;
+
+/// Log operation types.
+const char kMmapPut = 'P';
+const char kMmapDelete = 'D';
+
+static void appendInteger(std::string& data, uint32_t value) {
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendInteger(std::string& data, uint64_t value) {
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static T readInteger(const char* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+/// Compare a table key to a key using the same order as std::string.
+static int compareKey(const char* key, size_t size, const std::string& other) {
+  auto result = memcmp(key, other.data(), std::min(size, other.size()));
+  if (result != 0) {
+    return result;
+  }
+  return (size < other.size()) ? -1 : ((size > other.size()) ? 1 : 0);
+}
+
+/// Write all of the data to a file descriptor.
+static bool writeAll(int fd, const std::string& data) {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    auto bytes = ::write(fd, data.data() + offset, data.size() - offset);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      return false;
+    }
+    offset += static_cast<size_t>(bytes);
+  }
+  return true;
+}
+
+/// Sync a directory so a rename within it is durable.
+static void syncDirectory(const std::string& path) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+Status MmapDomain::open(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  if (path_.empty()) {
+    return Status(0, "OK");
+  }
+
+  auto log_path = path_ + ".log";
+  log_ = ::open(
+      log_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (log_ < 0) {
+    return Status(1, "Cannot open database log: " + log_path);
+  }
+
+  // Only one process may use a domain.
+  if (::flock(log_, LOCK_EX | LOCK_NB) != 0) {
+    ::close(log_);
+    log_ = -1;
+    return Status(1, "Database is locked: " + log_path);
+  }
+
+  auto status = mapTable();
+  if (status.ok()) {
+    status = replayLog();
+  }
+  return status;
+}
+
+void MmapDomain::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  unmapTable();
+  overlay_.clear();
+  overlay_size_ = 0;
+  if (log_ >= 0) {
+    ::close(log_);
+    log_ = -1;
+  }
+}
+
+Status MmapDomain::mapTable() {
+  auto fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0 && errno == ENOENT) {
+    return Status(0, "OK");
+  } else if (fd < 0) {
+    return Status(1, "Cannot open database table: " + path_);
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < kMmapHeaderSize) {
+    ::close(fd);
+    return Status(1, "Malformed database table: " + path_);
+  }
+
+  map_size_ = static_cast<size_t>(file_stat.st_size);
+  map_ = ::mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    map_size_ = 0;
+    return Status(1, "Cannot map database table: " + path_);
+  }
+
+  // Check every record once so lookups may trust the offsets.
+  auto data = static_cast<const char*>(map_);
+  count_ = readInteger<uint64_t>(data + 8);
+  bool valid = memcmp(data, kMmapMagic, sizeof(kMmapMagic)) == 0 &&
+               readInteger<uint32_t>(data + 4) == kMmapVersion &&
+               count_ <= (map_size_ - kMmapHeaderSize) / sizeof(uint64_t);
+  std::string previous;
+  for (size_t i = 0; valid && i < count_; i++) {
+    auto offset = readInteger<uint64_t>(data + kMmapHeaderSize + i * 8);
+    if (offset > map_size_ || map_size_ - offset < kMmapRecordHeaderSize) {
+      valid = false;
+      break;
+    }
+    auto key_size = readInteger<uint32_t>(data + offset);
+    auto value_size = readInteger<uint32_t>(data + offset + 4);
+    auto available = map_size_ - offset - kMmapRecordHeaderSize;
+    if (key_size > available || value_size > available - key_size) {
+      valid = false;
+      break;
+    }
+    auto key = data + offset + kMmapRecordHeaderSize;
+    if (i > 0 && compareKey(key, key_size, previous) <= 0) {
+      valid = false;
+      break;
+    }
+    previous.assign(key, key_size);
+  }
+
+  if (!valid) {
+    unmapTable();
+    return Status(1, "Malformed database table: " + path_);
+  }
+  return Status(0, "OK");
+}
+
+void MmapDomain::unmapTable() {
+  if (map_ != nullptr) {
+    ::munmap(map_, map_size_);
+  }
+  map_ = nullptr;
+  map_size_ = 0;
+  count_ = 0;
+}
+
+MmapDomain::Record MmapDomain::record(size_t index) const {
+  auto data = static_cast<const char*>(map_);
+  auto offset = readInteger<uint64_t>(data + kMmapHeaderSize + index * 8);
+  Record r;
+  r.key_size = readInteger<uint32_t>(data + offset);
+  r.value_size = readInteger<uint32_t>(data + offset + 4);
+  r.key = data + offset + kMmapRecordHeaderSize;
+  r.value = r.key + r.key_size;
+  return r;
+}
+
+size_t MmapDomain::lowerBound(const std::string& key) const {
+  size_t first = 0;
+  size_t last = static_cast<size_t>(count_);
+  while (first < last) {
+    auto middle = first + (last - first) / 2;
+    auto r = record(middle);
+    if (compareKey(r.key, r.key_size, key) < 0) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  return first;
+}
+
+bool MmapDomain::applyBatch(const char* data, size_t size, uint32_t count) {
+  // Decode the entire batch before applying any of it.
+  std::vector<std::pair<std::string, Entry>> entries;
+  size_t offset = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (size - offset < 1 + kMmapRecordHeaderSize) {
+      return false;
+    }
+    auto type = data[offset];
+    auto key_size = readInteger<uint32_t>(data + offset + 1);
+    auto value_size = readInteger<uint32_t>(data + offset + 5);
+    offset += 1 + kMmapRecordHeaderSize;
+    if ((type != kMmapPut && type != kMmapDelete) ||
+        key_size > size - offset || value_size > size - offset - key_size) {
+      return false;
+    }
+    Entry entry;
+    entry.deleted = (type == kMmapDelete);
+    entry.value.assign(data + offset + key_size, value_size);
+    entries.push_back(
+        std::make_pair(std::string(data + offset, key_size), entry));
+    offset += key_size + value_size;
+  }
+  if (offset != size) {
+    return false;
+  }
+
+  for (auto& entry : entries) {
+    overlay_size_ += kMmapRecordHeaderSize + entry.first.size() +
+                     entry.second.value.size();
+    overlay_[entry.first] = std::move(entry.second);
+  }
+  return true;
+}
+
+Status MmapDomain::replayLog() {
+  struct stat file_stat;
+  if (::fstat(log_, &file_stat) != 0) {
+    return Status(1, "Cannot read database log: " + path_);
+  }
+
+  std::string data(static_cast<size_t>(file_stat.st_size), 0);
+  size_t read = 0;
+  while (read < data.size()) {
+    auto bytes = ::pread(log_, &data[read], data.size() - read, read);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      return Status(1, "Cannot read database log: " + path_);
+    }
+    read += static_cast<size_t>(bytes);
+  }
+
+  size_t offset = 0;
+  while (data.size() - offset >= kMmapBatchHeaderSize) {
+    auto size = readInteger<uint32_t>(&data[offset]);
+    auto count = readInteger<uint32_t>(&data[offset + 4]);
+    if (size > data.size() - offset - kMmapBatchHeaderSize ||
+        !applyBatch(&data[offset + kMmapBatchHeaderSize], size, count)) {
+      break;
+    }
+    offset += kMmapBatchHeaderSize + size;
+  }
+
+  // A batch that was interrupted while it was appended was never applied.
+  if (offset < data.size()) {
+    LOG(WARNING) << "Discarding incomplete database log batch: " << path_;
+    if (::ftruncate(log_, static_cast<off_t>(offset)) != 0) {
+      return Status(1, "Cannot truncate database log: " + path_);
+    }
+  }
+  return Status(0, "OK");
+}
+
+bool MmapDomain::find(const std::string& key, std::string& value) const {
+  auto entry = overlay_.find(key);
+  if (entry != overlay_.end()) {
+    if (entry->second.deleted) {
+      return false;
+    }
+    value = entry->second.value;
+    return true;
+  }
+
+  auto index = lowerBound(key);
+  if (index < count_) {
+    auto r = record(index);
+    if (compareKey(r.key, r.key_size, key) == 0) {
+      value.assign(r.value, r.value_size);
+      return true;
+    }
+  }
+  return false;
+}
+
+Status MmapDomain::get(const std::string& key, std::string& value) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!find(key, value)) {
+    return Status(1, "Key not found");
+  }
+  return Status(0, "OK");
+}
+
+Status MmapDomain::get(const std::vector<std::string>& keys,
+                       std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < keys.size(); i++) {
+    find(keys[i], values[i]);
+  }
+  return Status(0, "OK");
+}
+
+Status MmapDomain::write(
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes) {
+  std::string batch;
+  for (const auto& put : puts) {
+    batch.push_back(kMmapPut);
+    appendInteger(batch, static_cast<uint32_t>(put.first.size()));
+    appendInteger(batch, static_cast<uint32_t>(put.second.size()));
+    batch.append(put.first);
+    batch.append(put.second);
+  }
+  for (const auto& key : deletes) {
+    batch.push_back(kMmapDelete);
+    appendInteger(batch, static_cast<uint32_t>(key.size()));
+    appendInteger(batch, static_cast<uint32_t>(0));
+    batch.append(key);
+  }
+  if (batch.size() > UINT32_MAX) {
+    return Status(1, "Database write batch is too large");
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (log_ >= 0) {
+    std::string header;
+    appendInteger(header, static_cast<uint32_t>(batch.size()));
+    appendInteger(header, static_cast<uint32_t>(puts.size() + deletes.size()));
+    if (!writeAll(log_, header + batch)) {
+      return Status(1, "Cannot write database log: " + path_);
+    }
+  }
+
+  for (const auto& put : puts) {
+    overlay_size_ +=
+        kMmapRecordHeaderSize + put.first.size() + put.second.size();
+    auto& entry = overlay_[put.first];
+    entry.deleted = false;
+    entry.value = put.second;
+  }
+  for (const auto& key : deletes) {
+    // Only a key within the table needs a delete entry.
+    auto index = lowerBound(key);
+    if (index < count_) {
+      auto r = record(index);
+      if (compareKey(r.key, r.key_size, key) == 0) {
+        overlay_size_ += kMmapRecordHeaderSize + key.size();
+        auto& entry = overlay_[key];
+        entry.deleted = true;
+        entry.value.clear();
+        continue;
+      }
+    }
+    overlay_.erase(key);
+  }
+
+  if (log_ >= 0 && overlay_size_ > FLAGS_database_mmap_overlay) {
+    auto status = compact();
+    if (!status.ok()) {
+      // The writes are kept in the log and overlay.
+      LOG(WARNING) << "Cannot compact database: " << status.getMessage();
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status MmapDomain::scan(
+    const std::string& start,
+    const std::string& end,
+    size_t max,
+    bool reverse,
+    bool values,
+    std::vector<std::pair<std::string, std::string>>& results) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!end.empty() && end <= start) {
+    return Status(0, "OK");
+  }
+
+  size_t table_first = lowerBound(start);
+  size_t table_last = (end.empty()) ? count_ : lowerBound(end);
+  auto overlay_first = overlay_.lower_bound(start);
+  auto overlay_last =
+      (end.empty()) ? overlay_.end() : overlay_.lower_bound(end);
+
+  size_t added = 0;
+  auto addRecord = [&results, &added, values](const Record& r) {
+    results.push_back(std::make_pair(
+        std::string(r.key, r.key_size),
+        (values) ? std::string(r.value, r.value_size) : std::string()));
+    added++;
+  };
+  auto addEntry = [&results, &added, values](Overlay::const_iterator it) {
+    if (!it->second.deleted) {
+      results.push_back(std::make_pair(
+          it->first, (values) ? it->second.value : std::string()));
+      added++;
+    }
+  };
+
+  // Merge the table and overlay, an overlay entry replaces a table record.
+  if (!reverse) {
+    auto table = table_first;
+    auto overlay = overlay_first;
+    while ((max == 0 || added < max) &&
+           (table < table_last || overlay != overlay_last)) {
+      if (overlay == overlay_last) {
+        addRecord(record(table++));
+        continue;
+      }
+      int order = 1;
+      if (table < table_last) {
+        auto r = record(table);
+        order = compareKey(r.key, r.key_size, overlay->first);
+      }
+      if (order < 0) {
+        addRecord(record(table++));
+        continue;
+      }
+      if (order == 0) {
+        table++;
+      }
+      addEntry(overlay++);
+    }
+  } else {
+    auto table = table_last;
+    auto overlay = overlay_last;
+    while ((max == 0 || added < max) &&
+           (table > table_first || overlay != overlay_first)) {
+      if (overlay == overlay_first) {
+        addRecord(record(--table));
+        continue;
+      }
+      auto previous = std::prev(overlay);
+      int order = -1;
+      if (table > table_first) {
+        auto r = record(table - 1);
+        order = compareKey(r.key, r.key_size, previous->first);
+      }
+      if (order > 0) {
+        addRecord(record(--table));
+        continue;
+      }
+      if (order == 0) {
+        table--;
+      }
+      addEntry(previous);
+      overlay = previous;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status MmapDomain::merge() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (log_ < 0 || overlay_.empty()) {
+    return Status(0, "OK");
+  }
+  return compact();
+}
+
+Status MmapDomain::compact() {
+  // Merge the live table records and overlay values in key order.
+  std::vector<Record> records;
+  records.reserve(static_cast<size_t>(count_) + overlay_.size());
+  size_t table = 0;
+  auto overlay = overlay_.begin();
+  while (table < count_ || overlay != overlay_.end()) {
+    int order = -1;
+    if (overlay != overlay_.end()) {
+      order = 1;
+      if (table < count_) {
+        auto r = record(table);
+        order = compareKey(r.key, r.key_size, overlay->first);
+      }
+    }
+    if (order < 0) {
+      records.push_back(record(table++));
+      continue;
+    }
+    if (order == 0) {
+      table++;
+    }
+    if (!overlay->second.deleted) {
+      Record r;
+      r.key = overlay->first.data();
+      r.key_size = static_cast<uint32_t>(overlay->first.size());
+      r.value = overlay->second.value.data();
+      r.value_size = static_cast<uint32_t>(overlay->second.value.size());
+      records.push_back(r);
+    }
+    overlay++;
+  }
+
+  std::string header(kMmapMagic, sizeof(kMmapMagic));
+  appendInteger(header, kMmapVersion);
+  appendInteger(header, static_cast<uint64_t>(records.size()));
+  uint64_t offset = kMmapHeaderSize + records.size() * sizeof(uint64_t);
+  for (const auto& r : records) {
+    appendInteger(header, offset);
+    offset += kMmapRecordHeaderSize + r.key_size + r.value_size;
+  }
+
+  auto temp_path = path_ + ".tmp";
+  auto fd = ::open(temp_path.c_str(),
+                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0600);
+  if (fd < 0) {
+    return Status(1, "Cannot create database table: " + temp_path);
+  }
+
+  bool written = writeAll(fd, header);
+  std::string buffer;
+  for (size_t i = 0; written && i < records.size(); i++) {
+    appendInteger(buffer, records[i].key_size);
+    appendInteger(buffer, records[i].value_size);
+    buffer.append(records[i].key, records[i].key_size);
+    buffer.append(records[i].value, records[i].value_size);
+    if (buffer.size() >= kMmapWriteBufferSize || i + 1 == records.size()) {
+      written = writeAll(fd, buffer);
+      buffer.clear();
+    }
+  }
+  written = written && ::fsync(fd) == 0;
+  ::close(fd);
+  if (!written || ::rename(temp_path.c_str(), path_.c_str()) != 0) {
+    ::unlink(temp_path.c_str());
+    return Status(1, "Cannot write database table: " + path_);
+  }
+  syncDirectory(fs::path(path_).parent_path().string());
+
+  // The new table has every write, the overlay and log are no longer needed.
+  unmapTable();
+  overlay_.clear();
+  overlay_size_ = 0;
+  if (::ftruncate(log_, 0) != 0) {
+    LOG(WARNING) << "Cannot truncate database log: " << path_;
+  }
+  return mapTable();
+}
+
+void MmapDomain::stats(Row& r) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  r["profile"] = "mmap";
+  r["compaction"] = "table";
+  r["compression"] = "none";
+  r["durability"] = (path_.empty()) ? "none" : "async";
+  r["max_size"] = "0";
+  r["block_cache_size"] = "0";
+  r["block_cache_usage"] = "0";
+  r["bloom_bits"] = "0";
+  r["keys"] = std::to_string(count_ + overlay_.size());
+  r["size"] = std::to_string(map_size_);
+  r["memtable_size"] = std::to_string(overlay_size_);
+  r["pending_compaction"] = "0";
+  r["memory_limit"] = std::to_string(FLAGS_database_mmap_overlay);
+  r["memory_usage"] = std::to_string(overlay_size_);
+}
+
+Status MmapDatabasePlugin::setUp() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!domains_.empty()) {
+    return Status(0, "OK");
+  }
+
+  if (!FLAGS_database_in_memory) {
+    boost::system::error_code ec;
+    fs::create_directories(FLAGS_database_path, ec);
+    if (!fs::is_directory(FLAGS_database_path, ec)) {
+      return Status(1, "Cannot create database path: " + FLAGS_database_path);
+    }
+  }
+
+  for (const auto& domain : kDomains) {
+    std::string path;
+    if (!FLAGS_database_in_memory) {
+      path = (fs::path(FLAGS_database_path) / (domain + ".mdb")).string();
+    }
+    auto storage = std::make_shared<MmapDomain>();
+    auto status = storage->open(path);
+    if (!status.ok()) {
+      domains_.clear();
+      return status;
+    }
+    domains_[domain] = storage;
+  }
+  return Status(0, "OK");
+}
+
+void MmapDatabasePlugin::tearDown() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  domains_.clear();
+}
+
+std::shared_ptr<MmapDomain> MmapDatabasePlugin::getDomain(
+    const std::string& domain) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto storage = domains_.find(domain);
+  return (storage == domains_.end()) ? nullptr : storage->second;
+}
+
+Status MmapDatabasePlugin::get(const std::string& domain,
+                               const std::string& key,
+                               std::string& value) const {
+  auto storage = getDomain(domain);
+  if (storage == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  return storage->get(key, value);
+}
+
+Status MmapDatabasePlugin::getMany(const std::string& domain,
+                                   const std::vector<std::string>& keys,
+                                   std::vector<std::string>& values) const {
+  auto storage = getDomain(domain);
+  if (storage == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  return storage->get(keys, values);
+}
+
+Status MmapDatabasePlugin::put(const std::string& domain,
+                               const std::string& key,
+                               const std::string& value) {
+  return write(domain, {std::make_pair(key, value)}, {});
+}
+
+Status MmapDatabasePlugin::remove(const std::string& domain,
+                                  const std::string& key) {
+  return write(domain, {}, {key});
+}
+
+Status MmapDatabasePlugin::scan(const std::string& domain,
+                                std::vector<std::string>& results,
+                                size_t max) const {
+  std::vector<std::pair<std::string, std::string>> items;
+  auto status = scanRange(domain, "", "", max, false, false, items);
+  for (auto& item : items) {
+    results.push_back(std::move(item.first));
+  }
+  return status;
+}
+
+Status MmapDatabasePlugin::stats(QueryData& results) const {
+  for (const auto& domain : kDomains) {
+    auto storage = getDomain(domain);
+    if (storage == nullptr) {
+      return Status(1, "Database not opened");
+    }
+    Row r;
+    r["domain"] = domain;
+    storage->stats(r);
+    results.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
+Status MmapDatabasePlugin::scanRange(
+    const std::string& domain,
+    const std::string& start,
+    const std::string& end,
+    size_t max,
+    bool reverse,
+    bool values,
+    std::vector<std::pair<std::string, std::string>>& results) const {
+  auto storage = getDomain(domain);
+  if (storage == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  return storage->scan(start, end, max, reverse, values, results);
+}
+
+Status MmapDatabasePlugin::write(
+    const std::string& domain,
+    const std::vector<std::pair<std::string, std::string>>& puts,
+    const std::vector<std::string>& deletes) {
+  auto storage = getDomain(domain);
+  if (storage == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  return storage->write(puts, deletes);
+}
+
+Status MmapDatabasePlugin::compact(const std::string& domain) {
+  auto storage = getDomain(domain);
+  if (storage == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  return storage->merge();
+}
+
+Status MmapDatabasePlugin::removeRange(const std::string& domain,
+                                       const std::string& start,
+                                       const std::string& end) {
+  if (end.empty() || start >= end) {
+    return Status(1, "Invalid delete range");
+  }
+
+  auto storage = getDomain(domain);
+  if (storage == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  std::vector<std::pair<std::string, std::string>> items;
+  auto status = storage->scan(start, end, 0, false, false, items);
+  if (!status.ok()) {
+    return status;
+  }
+  std::vector<std::string> deletes;
+  deletes.reserve(items.size());
+  for (auto& item : items) {
+    deletes.push_back(std::move(item.first));
+  }
+  return storage->write({}, deletes);
+}
+}
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <gtest/gtest_prod.h>
+
+#include <osquery/database.h>
+
+namespace osquery {
+
+/**
+ * @brief The storage of one database domain for the mmap plugin.
+ *
+ * A domain is an immutable table of sorted keys and values, read through a
+ * shared memory map, and an overlay of the writes since the table was built.
+ * Lookups binary search the table's key offsets and scans are ordered merges
+ * of the table and overlay, neither copies the table into the heap.
+ *
+ * Every write batch is appended to a log before it is applied to the overlay,
+ * the log is replayed when the domain opens. When the overlay grows past
+ * database_mmap_overlay bytes the table and overlay are merged into a new
+ * table, which atomically replaces the old table, and the log is truncated.
+ *
+ * Table: "OSQM", a u32 version, a u64 count, count u64 record offsets, then
+ * each record as a u32 key size, a u32 value size, the key, and the value.
+ * Log: each batch as a u32 size and u32 count, then each operation as a u8
+ * type, a u32 key size, a u32 value size, the key, and the value.
+ */
+class MmapDomain : private boost::noncopyable {
+ public:
+  /**
+   * @brief Open or create the domain's table and log.
+   *
+   * @param path the table path, the log appends ".log", empty for a domain
+   * that is only kept in memory.
+   */
+  Status open(const std::string& path);
+
+  /// Unmap the table and close the log.
+  void close();
+
+  ~MmapDomain() { close(); }
+
+  /// Read the value for a key, empty if the key does not exist.
+  Status get(const std::string& key, std::string& value) const;
+
+  /// Read the values for a set of keys under one lock, empty if missing.
+  Status get(const std::vector<std::string>& keys,
+             std::vector<std::string>& values) const;
+
+  /// Log and apply puts then deletes as a single batch.
+  Status write(const std::vector<std::pair<std::string, std::string>>& puts,
+               const std::vector<std::string>& deletes);
+
+  /// List the ordered keys and values in [start, end), see scanRange.
+  Status scan(const std::string& start,
+              const std::string& end,
+              size_t max,
+              bool reverse,
+              bool values,
+              std::vector<std::pair<std::string, std::string>>& results) const;
+
+  /// Add the domain's statistics to a row.
+  void stats(Row& r) const;
+
+  /// Merge the overlay into a new table now, see compact.
+  Status merge();
+
+ private:
+  /// A record within the mapped table.
+  struct Record {
+    const char* key;
+    uint32_t key_size;
+    const char* value;
+    uint32_t value_size;
+  };
+
+  /// An overlay entry, a value or a delete of the table's value.
+  struct Entry {
+    bool deleted;
+    std::string value;
+  };
+
+  using Overlay = std::map<std::string, Entry>;
+
+ private:
+  /// Map the table at path_, an absent table is empty.
+  Status mapTable();
+
+  /// Release the mapped table.
+  void unmapTable();
+
+  /// The table record at an index, which must be less than count_.
+  Record record(size_t index) const;
+
+  /// Find a key's value in the overlay then the table, the lock is held.
+  bool find(const std::string& key, std::string& value) const;
+
+  /// The index of the first table record with a key not less than key.
+  size_t lowerBound(const std::string& key) const;
+
+  /// Apply the log's complete batches to the overlay.
+  Status replayLog();
+
+  /// Apply an encoded batch of operations to the overlay.
+  bool applyBatch(const char* data, size_t size, uint32_t count);
+
+  /// Merge the table and overlay into a new table and truncate the log.
+  Status compact();
+
+ private:
+  /// The table path, empty if the domain is in memory.
+  std::string path_;
+
+  /// The mapped table.
+  void* map_{nullptr};
+  size_t map_size_{0};
+
+  /// The number of table records.
+  uint64_t count_{0};
+
+  /// Writes since the table was built, and their approximate size.
+  Overlay overlay_;
+  size_t overlay_size_{0};
+
+  /// The log file descriptor, -1 if the domain is in memory.
+  int log_{-1};
+
+  /// Protects the table, overlay, and log.
+  mutable std::mutex mutex_;
+
+ private:
+  FRIEND_TEST(MmapDatabaseTests, test_compaction);
+};
+
+/**
+ * @brief A read-optimized DatabasePlugin that uses memory mapped tables.
+ *
+ * Select with --database_plugin=mmap. Each domain is stored in the files
+ * "<database_path>/<domain>.mdb" and "<database_path>/<domain>.mdb.log".
+ * With --database_in_memory the domains are not stored.
+ */
+class MmapDatabasePlugin : public DatabasePlugin {
+ public:
+  /// Open every domain in the database path.
+  Status setUp() override;
+
+  /// Close every domain.
+  void tearDown() override;
+
+  Status scanRange(
+      const std::string& domain,
+      const std::string& start,
+      const std::string& end,
+      size_t max,
+      bool reverse,
+      bool values,
+      std::vector<std::pair<std::string, std::string>>& results) const override;
+
+  Status getMany(const std::string& domain,
+                 const std::vector<std::string>& keys,
+                 std::vector<std::string>& values) const override;
+
+  Status write(const std::string& domain,
+               const std::vector<std::pair<std::string, std::string>>& puts,
+               const std::vector<std::string>& deletes) override;
+
+  Status removeRange(const std::string& domain,
+                     const std::string& start,
+                     const std::string& end) override;
+
+  /// Rebuild the domain's table without waiting for database_mmap_overlay.
+  Status compact(const std::string& domain) override;
+
+ protected:
+  Status get(const std::string& domain,
+             const std::string& key,
+             std::string& value) const override;
+
+  Status put(const std::string& domain,
+             const std::string& key,
+             const std::string& value) override;
+
+  Status remove(const std::string& domain, const std::string& k) override;
+
+  Status scan(const std::string& domain,
+              std::vector<std::string>& results,
+              size_t max = 0) const override;
+
+  Status stats(QueryData& results) const override;
+
+ private:
+  /// The opened domain, nullptr if the plugin is not set up.
+  std::shared_ptr<MmapDomain> getDomain(const std::string& domain) const;
+
+ private:
+  /// The opened domains.
+  std::map<std::string, std::shared_ptr<MmapDomain>> domains_;
+
+  /// Protects the set of domains.
+  mutable std::mutex mutex_;
+
+ private:
+  FRIEND_TEST(MmapDatabaseTests, test_plugin);
+};
+}
@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/database/plugins/mmap.h"
+
+namespace osquery {
+
+DECLARE_string(database_path);
+DECLARE_bool(database_in_memory);
+DECLARE_uint64(database_mmap_overlay);
+
+class MmapDatabaseTests : public testing::Test {
+ public:
+  void SetUp() {
+    path_ = kTestWorkingDirectory + "mmap." +
+            std::to_string(rand() % 10000 + 20000);
+    boost::filesystem::create_directories(path_);
+  }
+
+  void TearDown() { boost::filesystem::remove_all(path_); }
+
+ protected:
+  /// Scan every key and value of a domain.
+  std::vector<std::pair<std::string, std::string>> scanAll(
+      const MmapDomain& domain, bool reverse = false) {
+    std::vector<std::pair<std::string, std::string>> items;
+    EXPECT_TRUE(domain.scan("", "", 0, reverse, true, items).ok());
+    return items;
+  }
+
+ protected:
+  std::string path_;
+};
+
+TEST_F(MmapDatabaseTests, test_domain) {
+  MmapDomain domain;
+  ASSERT_TRUE(domain.open(path_ + "/test.mdb").ok());
+  ASSERT_TRUE(domain.write({{"b", "2"}, {"a", "1"}, {"c", "3"}}, {}).ok());
+
+  std::string value;
+  EXPECT_TRUE(domain.get("b", value).ok());
+  EXPECT_EQ(value, "2");
+  EXPECT_FALSE(domain.get("d", value).ok());
+
+  std::vector<std::string> values;
+  EXPECT_TRUE(domain.get({"c", "d", "a"}, values).ok());
+  EXPECT_EQ(values, std::vector<std::string>({"3", "", "1"}));
+
+  // A batch applies its puts before its deletes.
+  ASSERT_TRUE(domain.write({{"d", "4"}}, {"b"}).ok());
+  EXPECT_FALSE(domain.get("b", value).ok());
+
+  std::vector<std::pair<std::string, std::string>> expected = {
+      {"a", "1"}, {"c", "3"}, {"d", "4"}};
+  EXPECT_EQ(scanAll(domain), expected);
+
+  // Ranges are [start, end), limits are applied in the scanned order.
+  std::vector<std::pair<std::string, std::string>> items;
+  EXPECT_TRUE(domain.scan("b", "d", 0, false, true, items).ok());
+  ASSERT_EQ(items.size(), 1U);
+  EXPECT_EQ(items[0].first, "c");
+
+  items.clear();
+  EXPECT_TRUE(domain.scan("a", "", 2, true, false, items).ok());
+  ASSERT_EQ(items.size(), 2U);
+  EXPECT_EQ(items[0].first, "d");
+  EXPECT_EQ(items[1].first, "c");
+  EXPECT_TRUE(items[1].second.empty());
+
+  // The log is replayed when the domain is opened again.
+  domain.close();
+  ASSERT_TRUE(domain.open(path_ + "/test.mdb").ok());
+  EXPECT_EQ(scanAll(domain), expected);
+}
+
+TEST_F(MmapDatabaseTests, test_compaction) {
+  auto overlay = FLAGS_database_mmap_overlay;
+  FLAGS_database_mmap_overlay = 1;
+
+  MmapDomain domain;
+  ASSERT_TRUE(domain.open(path_ + "/test.mdb").ok());
+  for (size_t i = 0; i < 100; i += 2) {
+    std::string key = "key." + std::to_string(1000 + i);
+    ASSERT_TRUE(domain.write({{key, std::to_string(i)}}, {}).ok());
+  }
+
+  // Every write was merged into the mapped table.
+  EXPECT_EQ(domain.count_, 50U);
+  EXPECT_TRUE(domain.overlay_.empty());
+  EXPECT_EQ(boost::filesystem::file_size(path_ + "/test.mdb.log"), 0U);
+
+  // Writes since the table was built are merged with the table in scans.
+  FLAGS_database_mmap_overlay = overlay;
+  ASSERT_TRUE(domain.write({{"key.1001", "odd"}, {"key.1002", "new"}},
+                           {"key.1000", "key.1004"})
+                  .ok());
+  auto items = scanAll(domain);
+  ASSERT_EQ(items.size(), 49U);
+  EXPECT_EQ(items[0], std::make_pair(std::string("key.1001"),
+                                     std::string("odd")));
+  EXPECT_EQ(items[1].second, "new");
+  EXPECT_EQ(items[2].first, "key.1006");
+
+  auto reversed = scanAll(domain, true);
+  std::reverse(reversed.begin(), reversed.end());
+  EXPECT_EQ(reversed, items);
+
+  // The table and log are both read when the domain is opened again.
+  domain.close();
+  ASSERT_TRUE(domain.open(path_ + "/test.mdb").ok());
+  EXPECT_EQ(scanAll(domain), items);
+
+  // A requested merge rebuilds the table before the overlay is full.
+  ASSERT_TRUE(domain.merge().ok());
+  EXPECT_TRUE(domain.overlay_.empty());
+  EXPECT_EQ(domain.count_, 49U);
+  EXPECT_EQ(scanAll(domain), items);
+}
+
+TEST_F(MmapDatabaseTests, test_incomplete_log) {
+  {
+    MmapDomain domain;
+    ASSERT_TRUE(domain.open(path_ + "/test.mdb").ok());
+    ASSERT_TRUE(domain.write({{"a", "1"}}, {}).ok());
+    ASSERT_TRUE(domain.write({{"b", "2"}, {"c", "3"}}, {}).ok());
+  }
+
+  // A batch interrupted while it was appended is not applied.
+  auto log = path_ + "/test.mdb.log";
+  boost::filesystem::resize_file(log, boost::filesystem::file_size(log) - 1);
+
+  MmapDomain domain;
+  ASSERT_TRUE(domain.open(path_ + "/test.mdb").ok());
+  std::vector<std::pair<std::string, std::string>> expected = {{"a", "1"}};
+  EXPECT_EQ(scanAll(domain), expected);
+}
+
+TEST_F(MmapDatabaseTests, test_plugin) {
+  auto database_path = FLAGS_database_path;
+  auto database_in_memory = FLAGS_database_in_memory;
+  FLAGS_database_path = path_ + "/db";
+  FLAGS_database_in_memory = false;
+
+  MmapDatabasePlugin plugin;
+  ASSERT_TRUE(plugin.setUp().ok());
+  EXPECT_TRUE(plugin.put(kQueries, "query.1", "value").ok());
+  EXPECT_TRUE(plugin.put(kQueries, "query.2", "value").ok());
+  EXPECT_TRUE(plugin.put(kEvents, "event.1", "value").ok());
+  EXPECT_TRUE(plugin.removeRange(kQueries, "query.2", "query.3").ok());
+  EXPECT_FALSE(plugin.removeRange(kQueries, "query.3", "query.2").ok());
+
+  std::vector<std::string> keys;
+  EXPECT_TRUE(plugin.scan(kQueries, keys).ok());
+  EXPECT_EQ(keys, std::vector<std::string>{"query.1"});
+
+  QueryData stats;
+  EXPECT_TRUE(plugin.stats(stats).ok());
+  EXPECT_EQ(stats.size(), kDomains.size());
+
+  // A second process may not open the same database.
+  MmapDatabasePlugin locked;
+  EXPECT_FALSE(locked.setUp().ok());
+
+  plugin.tearDown();
+  ASSERT_TRUE(plugin.setUp().ok());
+  std::string value;
+  EXPECT_TRUE(plugin.get(kEvents, "event.1", value).ok());
+  EXPECT_EQ(value, "value");
+  plugin.tearDown();
+
+  FLAGS_database_path = database_path;
+  FLAGS_database_in_memory = database_in_memory;
+}
+}
@@ -9,99 +9,291 @@
  */
 
 #include <algorithm>
+#include <cstdio>
+#include <map>
+#include <utility>
 
+#include "osquery/core/tracing.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+/**
+ * @brief The value stored under a query name using the per-row layout.
+ *
+ * Previous results were stored as a single serialized QueryData value under
+ * the query name. Each distinct row fingerprint is now stored under its own
+ * key and the query name holds this marker. A legacy value is read, and
+ * migrated on the next call to addNewResults.
+ */
+const std::string kQueryRowLayout = "rows:1";
+
+/// All per-row keys are grouped below this prefix, apart from query names.
+const std::string kQueryRowKeyPrefix = "rows.";
+
+/// Row keys use a fixed-length hex encoding of the row fingerprint.
+const size_t kQueryRowKeyHexLength = 16;
+
+static std::string getRowKeySuffix(const Row& r) {
+  char hex[kQueryRowKeyHexLength + 1] = {0};
+  snprintf(hex,
+           sizeof(hex),
+           "%016llx",
+           static_cast<unsigned long long>(getRowFingerprint(r)));
+  return std::string(hex, kQueryRowKeyHexLength);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Data access methods
 /////////////////////////////////////////////////////////////////////////////
 
+std::string Query::getRowKeyPrefix() const {
+  return kQueryRowKeyPrefix + name_ + ".";
+}
+
 Status Query::getPreviousQueryResults(QueryData& results) {
-  return getPreviousQueryResults(results, DBHandle::getInstance());
+  return getPreviousQueryResults(
+      [&results](const Row& r) { results.push_back(r); });
 }
 
-Status Query::getPreviousQueryResults(QueryData& results, DBHandleRef db) {
-  if (!isQueryNameInDatabase()) {
+Status Query::getPreviousQueryResults(
+    const std::function<void(const Row&)>& callback) {
+  std::string raw;
+  if (!getDatabaseValue(kQueries, name_, raw).ok() || raw.empty()) {
     return Status(0, "Query name not found in database");
   }
 
-  std::string raw;
-  auto status = db->Get(kQueries, name_, raw);
+  if (raw != kQueryRowLayout) {
+    // Results stored as a single value, before the per-row layout.
+    QueryData results;
+    auto status = deserializeQueryDataBinary(raw, results);
+    if (!status.ok()) {
+      return status;
+    }
+    for (const auto& r : results) {
+      callback(r);
+    }
+    return Status(0, "OK");
+  }
+
+  auto prefix = getRowKeyPrefix();
+  std::vector<std::string> keys;
+  auto status = scanDatabasePrefix(kQueries, keys, prefix);
   if (!status.ok()) {
     return status;
   }
 
-  status = deserializeQueryDataJSON(raw, results);
+  for (const auto& key : keys) {
+    // The prefix may also match the rows of a query named "<name>.<suffix>".
+    if (key.size() != prefix.size() + kQueryRowKeyHexLength) {
+      continue;
+    }
+
+    QueryData rows;
+    status = getDatabaseValue(kQueries, key, raw);
+    if (status.ok()) {
+      status = deserializeQueryDataBinary(raw, rows);
+    }
+    if (!status.ok()) {
+      return status;
+    }
+    for (const auto& r : rows) {
+      callback(r);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status Query::removePreviousQueryResults() {
+  auto prefix = getRowKeyPrefix();
+  std::vector<std::string> keys;
+  auto status = scanDatabasePrefix(kQueries, keys, prefix);
   if (!status.ok()) {
     return status;
   }
-  return Status(0, "OK");
+
+  std::vector<std::string> deletes = {name_};
+  for (auto& key : keys) {
+    if (key.size() == prefix.size() + kQueryRowKeyHexLength) {
+      deletes.push_back(std::move(key));
+    }
+  }
+  return writeDatabaseValues(kQueries, {}, deletes);
 }
 
 std::vector<std::string> Query::getStoredQueryNames() {
-  return getStoredQueryNames(DBHandle::getInstance());
-}
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueries, keys);
 
-std::vector<std::string> Query::getStoredQueryNames(DBHandleRef db) {
   std::vector<std::string> results;
-  db->Scan(kQueries, results);
+  for (auto& key : keys) {
+    if (key.compare(0, kQueryRowKeyPrefix.size(), kQueryRowKeyPrefix) != 0) {
+      results.push_back(std::move(key));
+    }
+  }
   return results;
 }
 
 bool Query::isQueryNameInDatabase() {
-  return isQueryNameInDatabase(DBHandle::getInstance());
-}
-
-bool Query::isQueryNameInDatabase(DBHandleRef db) {
-  auto names = Query::getStoredQueryNames(db);
-  return std::find(names.begin(), names.end(), name_) != names.end();
+  std::string raw;
+  return getDatabaseValue(kQueries, name_, raw).ok() && !raw.empty();
 }
 
 Status Query::addNewResults(const osquery::QueryData& qd) {
-  return addNewResults(qd, DBHandle::getInstance());
-}
-
-Status Query::addNewResults(const QueryData& qd, DBHandleRef db) {
   DiffResults dr;
-  return addNewResults(qd, dr, false, db);
+  return addNewResults(qd, dr, false);
 }
 
 Status Query::addNewResults(const QueryData& qd, DiffResults& dr) {
-  return addNewResults(qd, dr, true, DBHandle::getInstance());
+  return addNewResults(qd, dr, true);
+}
+
+namespace {
+
+/// The current rows sharing a fingerprint, stored as a single value.
+struct RowGroup {
+  QueryData rows;
+  std::string value;
+  /// The group's key already exists in the database.
+  bool stored{false};
+  /// The stored rows differ from the current rows.
+  bool changed{false};
+  /// The stored rows, only decoded if changed.
+  QueryData previous;
+};
 }
 
 Status Query::addNewResults(const QueryData& current_qd,
                             DiffResults& dr,
-                            bool calculate_diff,
-                            DBHandleRef db) {
-  // Get the rows from the last run of this query name.
-  QueryData previous_qd;
-  auto status = getPreviousQueryResults(previous_qd);
-  if (!status.ok()) {
-    return status;
+                            bool calculate_diff) {
+  TRACE_SCOPE_DETAIL("query.addNewResults", name_);
+  auto prefix = getRowKeyPrefix();
+
+  // Group the current rows by fingerprint, remember each row's key.
+  std::map<std::string, RowGroup> groups;
+  std::vector<std::string> row_keys;
+  row_keys.reserve(current_qd.size());
+  for (const auto& r : current_qd) {
+    row_keys.push_back(prefix + getRowKeySuffix(r));
+    groups[row_keys.back()].rows.push_back(r);
   }
 
-  // Calculate the differential between previous and current query results.
-  if (calculate_diff) {
-    dr = diff(previous_qd, current_qd);
+  for (auto& group : groups) {
+    auto& rows = group.second;
+    auto status = serializeQueryDataBinary(rows.rows, rows.value);
+    if (!status.ok()) {
+      return status;
+    }
   }
 
-  if (previous_qd.size() == 0 || dr.added.size() != 0 ||
-      dr.removed.size() != 0) {
-    // Replace the "previous" query data with the current.
-    std::string json;
-    status = serializeQueryDataJSON(current_qd, json);
+  std::vector<std::pair<std::string, std::string>> puts;
+  std::vector<std::string> deletes;
+
+  std::string raw;
+  bool exists = getDatabaseValue(kQueries, name_, raw).ok() && !raw.empty();
+  if (exists && raw != kQueryRowLayout) {
+    // Migrate a single-value result set, every row is written once.
+    QueryData previous_qd;
+    auto status = deserializeQueryDataBinary(raw, previous_qd);
     if (!status.ok()) {
       return status;
     }
 
-    status = db->Put(kQueries, name_, json);
+    if (calculate_diff) {
+      dr = diff(previous_qd, current_qd);
+    }
+    for (const auto& group : groups) {
+      puts.push_back(std::make_pair(group.first, group.second.value));
+    }
+    puts.push_back(std::make_pair(name_, kQueryRowLayout));
+    return writeDatabaseValues(kQueries, puts, deletes);
+  }
+
+  if (!exists) {
+    puts.push_back(std::make_pair(name_, kQueryRowLayout));
+  }
+
+  // Every stored row value is compared, read them with the keys.
+  std::vector<std::pair<std::string, std::string>> stored;
+  if (exists) {
+    auto status = scanDatabasePrefix(kQueries, stored, prefix);
     if (!status.ok()) {
       return status;
     }
   }
-  return Status(0, "OK");
+
+  DiffResults changes;
+  for (const auto& item : stored) {
+    const auto& key = item.first;
+    const auto& raw = item.second;
+    if (key.size() != prefix.size() + kQueryRowKeyHexLength) {
+      continue;
+    }
+
+    Status status;
+    auto group = groups.find(key);
+    if (group == groups.end()) {
+      // Every row with this fingerprint was removed.
+      if (calculate_diff) {
+        QueryData removed;
+        status = deserializeQueryDataBinary(raw, removed);
+        if (!status.ok()) {
+          return status;
+        }
+        changes.removed.insert(
+            changes.removed.end(), removed.begin(), removed.end());
+      }
+      deletes.push_back(key);
+      continue;
+    }
+
+    group->second.stored = true;
+    if (group->second.value == raw) {
+      continue;
+    }
+
+    // Rows differ within a fingerprint: duplicates or a hash collision.
+    group->second.changed = true;
+    puts.push_back(std::make_pair(key, group->second.value));
+    if (calculate_diff) {
+      status = deserializeQueryDataBinary(raw, group->second.previous);
+      if (!status.ok()) {
+        return status;
+      }
+      auto group_diff = diff(group->second.previous, group->second.rows);
+      changes.removed.insert(changes.removed.end(),
+                             group_diff.removed.begin(),
+                             group_diff.removed.end());
+    }
+  }
+
+  for (const auto& group : groups) {
+    if (!group.second.stored) {
+      puts.push_back(std::make_pair(group.first, group.second.value));
+    }
+  }
+
+  if (calculate_diff) {
+    // Report added rows in the order of the current results.
+    for (size_t i = 0; i < current_qd.size(); ++i) {
+      const auto& group = groups.at(row_keys[i]);
+      if (!group.stored ||
+          (group.changed &&
+           std::find(group.previous.begin(),
+                     group.previous.end(),
+                     current_qd[i]) == group.previous.end())) {
+        changes.added.push_back(current_qd[i]);
+      }
+    }
+    std::sort(changes.removed.begin(), changes.removed.end());
+    dr = std::move(changes);
+  }
+
+  if (puts.empty() && deletes.empty()) {
+    return Status(0, "OK");
+  }
+
+  // Only the changed fingerprints are written, using a single batch.
+  return writeDatabaseValues(kQueries, puts, deletes);
 }
 }
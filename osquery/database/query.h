@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -58,51 +59,46 @@ class Query {
    */
   Status getPreviousQueryResults(QueryData& results);
 
- private:
+ public:
   /**
-   * @brief Serialize the data in RocksDB into a useful data structure using a
-   * custom database handle
+   * @brief Stream the previous results of this query, one row at a time
    *
-   * This method is the same as getHistoricalQueryResults, but with the
-   * addition of a parameter which allows you to pass a custom RocksDB
-   * database handle.
+   * Results are stored as one database value per distinct row fingerprint,
+   * rows are decoded and handed to the callback one value at a time rather
+   * than materializing the entire previous result set. The order of rows is
+   * not preserved.
    *
-   * @param hQR the output HistoricalQueryResults struct
-   * @param db a shared pointer to a custom DBHandle
+   * @param callback called once for each stored row
    *
    * @return the success or failure of the operation
-   * @see getHistoricalQueryResults
    */
-  Status getPreviousQueryResults(QueryData& results, DBHandleRef db);
+  Status getPreviousQueryResults(
+      const std::function<void(const Row&)>& callback);
 
  public:
   /**
-   * @brief Get the names of all historical queries that are stored in RocksDB
-   *
-   * If you'd like to perform some database maintenance, getStoredQueryNames()
-   * allows you to get a vector of the names of all queries which are
-   * currently stored in RocksDB
+   * @brief Remove the stored previous results and rows of this query
    *
-   * @return a vector containing the string names of all scheduled queries
-   * which currently exist in the database
+   * @return the success or failure of the operation
    */
-  static std::vector<std::string> getStoredQueryNames();
+  Status removePreviousQueryResults();
 
  private:
+  /// The key prefix shared by every stored row of this query.
+  std::string getRowKeyPrefix() const;
+
+ public:
   /**
    * @brief Get the names of all historical queries that are stored in RocksDB
-   * using a custom database handle
    *
-   * This method is the same as getStoredQueryNames(), but with the addition
-   * of a parameter which allows you to pass a custom RocksDB database handle.
-   *
-   * @param db a custom RocksDB database handle
+   * If you'd like to perform some database maintenance, getStoredQueryNames()
+   * allows you to get a vector of the names of all queries which are
+   * currently stored in RocksDB
    *
    * @return a vector containing the string names of all scheduled queries
-   *
-   * @see getStoredQueryNames()
+   * which currently exist in the database
    */
-  static std::vector<std::string> getStoredQueryNames(DBHandleRef db);
+  static std::vector<std::string> getStoredQueryNames();
 
  public:
   /**
@@ -113,20 +109,6 @@ class Query {
    */
   bool isQueryNameInDatabase();
 
- private:
-  /**
-   * @brief Accessor method for checking if a given scheduled query exists in
-   * the database, using a custom database handle
-   *
-   * This method is the same as isQueryNameInDatabase(), but with the addition
-   * of a parameter which allows you to pass a custom RocksDB database handle
-   *
-   * @param db a custom RocksDB database handle
-   *
-   * @return does the scheduled query which is already exists in the database
-   */
-  bool isQueryNameInDatabase(DBHandleRef db);
-
  public:
   /**
    * @brief Add a new set of results to the persistant storage
@@ -143,24 +125,6 @@ class Query {
    */
   Status addNewResults(const QueryData& qd);
 
- private:
-  /**
-   * @brief Add a new set of results to the persistant storage using a custom
-   * database handle
-   *
-   * This method is the same as addNewResults(), but with the addition of a
-   * parameter which allows you to pass a custom RocksDB database handle
-   *
-   * @param qd the QueryData object, which has the results of the query which
-   * you would like to store
-   * @param unix_time the time that the query was executed
-   * @param db a custom RocksDB database handle
-   *
-   * @return an instance of osquery::Status indicating the success or failure
-   * of the operation
-   */
-  Status addNewResults(const QueryData& qd, DBHandleRef db);
-
  public:
   /**
    * @brief Add a new set of results to the persistent storage and get back
@@ -179,21 +143,18 @@ class Query {
 
  private:
   /**
-   * @brief Add a new set of results to the persistent storage and get back
-   * the differential results, using a custom database handle.
-   *
-   * This method is the same as Query::addNewResults, but with the addition of a
-   * parameter which allows you to pass a custom RocksDB database handle
+   * @brief Add a new set of results to the persistent storage and optionally
+   * get back the differential results.
    *
    * @param qd the QueryData object containing query results to store
    * @param dr an output to a DiffResults object populated based on last run
+   * @param calculate_diff populate dr, otherwise only store the results
    *
    * @return the success or failure of the operation
    */
   Status addNewResults(const QueryData& qd,
                        DiffResults& dr,
-                       bool calculate_diff,
-                       DBHandleRef db);
+                       bool calculate_diff);
 
  public:
   /**
@@ -205,22 +166,6 @@ class Query {
    */
   Status getCurrentResults(QueryData& qd);
 
- private:
-  /**
-   * @brief A getter for the most recent result set for a scheduled query,
-   * but with the addition of a parameter which allows you to pass a custom
-   * RocksDB database handle.
-   *
-   * This method is the same as Query::getCurrentResults, but with addition of a
-   * parameter which allows you to pass a custom RocksDB database handle.
-   *
-   * @param qd the output QueryData object
-   * @param db a custom RocksDB database handle
-   *
-   * @return the success or failure of the operation
-   */
-  Status getCurrentResults(QueryData& qd, DBHandleRef db);
-
  private:
   /////////////////////////////////////////////////////////////////////////////
   // Private members
@@ -243,5 +188,7 @@ class Query {
   FRIEND_TEST(QueryTests, test_get_executions);
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_query_name_not_found_in_db);
+  FRIEND_TEST(QueryTests, test_incremental_row_storage);
+  FRIEND_TEST(QueryTests, test_legacy_results_migration);
 };
 }
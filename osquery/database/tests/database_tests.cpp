@@ -18,6 +18,45 @@ namespace osquery {
 
 class DatabaseTests : public testing::Test {};
 
+TEST_F(DatabaseTests, test_histogram) {
+  Histogram histogram;
+  EXPECT_EQ(histogram.percentile(50), 0U);
+
+  for (uint64_t i = 1; i <= 1000; i++) {
+    histogram.record(i);
+  }
+  EXPECT_EQ(histogram.count(), 1000U);
+  EXPECT_EQ(histogram.max(), 1000U);
+
+  // Percentiles are within the width of a bucket, 1/8th of the value.
+  auto median = histogram.percentile(50);
+  EXPECT_GE(median, 500U);
+  EXPECT_LE(median, 500U + 500U / 8);
+  auto tail = histogram.percentile(99);
+  EXPECT_GE(tail, 990U);
+  EXPECT_LE(tail, 1000U);
+  EXPECT_EQ(histogram.percentile(100), 1000U);
+
+  // Small values are counted exactly.
+  Histogram small;
+  small.record(0);
+  small.record(3);
+  small.record(7);
+  EXPECT_EQ(small.percentile(0), 0U);
+  EXPECT_EQ(small.percentile(50), 3U);
+  EXPECT_EQ(small.percentile(100), 7U);
+
+  // The largest values have a bucket.
+  small.record(UINT64_MAX);
+  EXPECT_EQ(small.percentile(100), UINT64_MAX);
+
+  // Merged histograms count the values of both.
+  histogram.merge(small);
+  EXPECT_EQ(histogram.count(), 1004U);
+  EXPECT_EQ(histogram.max(), UINT64_MAX);
+  EXPECT_EQ(histogram.percentile(0), 0U);
+}
+
 TEST_F(DatabaseTests, test_set_value) {
   auto s = setDatabaseValue(kLogs, "i", "{}");
   EXPECT_TRUE(s.ok());
@@ -22,9 +22,13 @@
 
 #include "osquery/database/db_handle.h"
 #include "osquery/core/test_util.h"
+#include "osquery/core/watcher.h"
 
 namespace osquery {
 
+DECLARE_bool(database_in_memory);
+DECLARE_uint64(database_compact_deletes);
+
 class DBHandleTests : public testing::Test {
  public:
   void SetUp() {
@@ -42,8 +46,8 @@ class DBHandleTests : public testing::Test {
   void TearDown() {
     // Clean the transient instance and reset to the testing instance.
     boost::filesystem::remove_all(path_);
-    auto path = Flag::getValue("database_path");
-    DBHandle::getInstance()->resetInstance(path, false);
+    DBHandle::getInstance()->resetInstance(FLAGS_database_path,
+                                           FLAGS_database_in_memory);
   }
 
  public:
@@ -75,6 +79,18 @@ TEST_F(DBHandleTests, test_get) {
   EXPECT_EQ(r, "{}");
 }
 
+TEST_F(DBHandleTests, test_multi_get) {
+  db_->Put(kEvents, "test_multi_1", "one");
+  db_->Put(kEvents, "test_multi_3", "three");
+
+  std::vector<std::string> values;
+  auto s = db_->MultiGet(
+      kEvents, {"test_multi_1", "test_multi_2", "test_multi_3"}, values);
+  EXPECT_TRUE(s.ok());
+  std::vector<std::string> expected = {"one", "", "three"};
+  EXPECT_EQ(values, expected);
+}
+
 TEST_F(DBHandleTests, test_put) {
   auto s = db_->Put(kQueries, "test_put", "bar");
   EXPECT_TRUE(s.ok());
@@ -117,6 +133,194 @@ TEST_F(DBHandleTests, test_scan_limit) {
   EXPECT_EQ(keys.size(), 2U);
 }
 
+TEST_F(DBHandleTests, test_scan_prefix_values) {
+  db_->Put(kQueries, "test_prefix_a", "1");
+  db_->Put(kQueries, "test_prefix_b", "2");
+  db_->Put(kQueries, "test_prefiy", "3");
+
+  std::vector<std::pair<std::string, std::string>> items;
+  auto s = db_->ScanPrefix(kQueries, items, "test_prefix_");
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(items.size(), 2U);
+  EXPECT_EQ(items[0].first, "test_prefix_a");
+  EXPECT_EQ(items[0].second, "1");
+  EXPECT_EQ(items[1].second, "2");
+
+  // A prefix ending in 0xff is bounded by the shorter successor.
+  auto prefix = std::string("test_prefix\xff");
+  db_->Put(kQueries, prefix + "a", "4");
+  std::vector<std::string> keys;
+  db_->ScanPrefix(kQueries, keys, prefix);
+  EXPECT_EQ(keys, std::vector<std::string>({prefix + "a"}));
+}
+
+TEST_F(DBHandleTests, test_scan_range) {
+  for (const auto& key : {"test_range_1", "test_range_2", "test_range_3"}) {
+    db_->Put(kQueries, key, "baz");
+  }
+
+  std::vector<std::string> keys;
+  auto s = db_->ScanRange(kQueries, keys, "test_range_1", "test_range_3");
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(keys,
+            std::vector<std::string>({"test_range_1", "test_range_2"}));
+
+  // The max applies to the ordered range.
+  std::vector<std::pair<std::string, std::string>> items;
+  db_->ScanRange(kQueries, items, "test_range_2", "", 1);
+  ASSERT_EQ(items.size(), 1U);
+  EXPECT_EQ(items[0].first, "test_range_2");
+}
+
+TEST_F(DBHandleTests, test_scan_range_reverse) {
+  for (const auto& key :
+       {"test_reverse_1", "test_reverse_2", "test_reverse_3"}) {
+    db_->Put(kQueries, key, "baz");
+  }
+
+  std::vector<std::pair<std::string, std::string>> items;
+  auto s = db_->ScanRangeReverse(
+      kQueries, items, "test_reverse_1", "test_reverse_3");
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(items.size(), 2U);
+  EXPECT_EQ(items[0].first, "test_reverse_2");
+  EXPECT_EQ(items[1].first, "test_reverse_1");
+
+  // The max applies to the latest keys of the range.
+  items.clear();
+  db_->ScanRangeReverse(kQueries, items, "test_reverse_", "test_reverse_4", 1);
+  ASSERT_EQ(items.size(), 1U);
+  EXPECT_EQ(items[0].first, "test_reverse_3");
+}
+
+TEST_F(DBHandleTests, test_write) {
+  db_->Put(kQueries, "test_write_old", "baz");
+  auto s = db_->Write(
+      kQueries, {{"test_write_foo1", "bar"}, {"test_write_foo2", "baz"}},
+      {"test_write_old"});
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  db_->ScanPrefix(kQueries, keys, "test_write_");
+  EXPECT_EQ(keys,
+            std::vector<std::string>({"test_write_foo1", "test_write_foo2"}));
+}
+
+TEST_F(DBHandleTests, test_delete_range) {
+  for (const auto& key : {"test_delete_1", "test_delete_2", "test_delete_3"}) {
+    db_->Put(kQueries, key, "baz");
+  }
+
+  auto s = db_->DeleteRange(kQueries, "test_delete_1", "test_delete_3");
+  EXPECT_TRUE(s.ok());
+  std::vector<std::string> keys;
+  db_->ScanPrefix(kQueries, keys, "test_delete_");
+  EXPECT_EQ(keys, std::vector<std::string>({"test_delete_3"}));
+
+  // The range end is exclusive and required.
+  EXPECT_FALSE(db_->DeleteRange(kQueries, "test_delete_", "").ok());
+}
+
+TEST_F(DBHandleTests, test_compact) {
+  for (const auto& key : {"test_compact_1", "test_compact_2"}) {
+    db_->Put(kLogs, key, "baz");
+  }
+  EXPECT_TRUE(db_->Compact(kLogs).ok());
+  EXPECT_FALSE(db_->Compact("foobartest").ok());
+
+  // Deletes through the database helpers are counted toward compaction.
+  auto deletes = FLAGS_database_compact_deletes;
+  FLAGS_database_compact_deletes = 2;
+  writeDatabaseValues(kLogs, {}, {"test_compact_1", "test_compact_2"});
+  auto due = getDueCompactions(getUnixTime());
+  EXPECT_NE(std::find(due.begin(), due.end(), kLogs), due.end());
+
+  EXPECT_TRUE(compactDatabase(kLogs).ok());
+  due = getDueCompactions(getUnixTime());
+  EXPECT_EQ(std::find(due.begin(), due.end(), kLogs), due.end());
+
+  // The events and logs are compacted when no domain is requested.
+  EXPECT_TRUE(requestDatabaseCompaction("").ok());
+  due = getDueCompactions(getUnixTime());
+  EXPECT_NE(std::find(due.begin(), due.end(), kEvents), due.end());
+  EXPECT_NE(std::find(due.begin(), due.end(), kLogs), due.end());
+  EXPECT_FALSE(requestDatabaseCompaction("foobartest").ok());
+
+  EXPECT_TRUE(compactDatabase(kEvents).ok());
+  EXPECT_TRUE(compactDatabase(kLogs).ok());
+  FLAGS_database_compact_deletes = deletes;
+}
+
+TEST_F(DBHandleTests, test_stats) {
+  Row stats;
+  EXPECT_TRUE(db_->Stats(kEvents, stats).ok());
+  EXPECT_EQ(stats["domain"], kEvents);
+  EXPECT_EQ(stats["profile"], "default");
+  EXPECT_EQ(stats["compaction"], "level");
+  EXPECT_EQ(stats["compression"], "snappy");
+  EXPECT_EQ(stats.count("keys"), 1U);
+
+  // Each domain is reported through the database plugin.
+  QueryData results;
+  EXPECT_TRUE(getDatabaseStats(results).ok());
+  EXPECT_EQ(results.size(), kDomains.size());
+  EXPECT_FALSE(db_->Stats("foobartest", stats).ok());
+}
+
+TEST_F(DBHandleTests, test_durability) {
+  // Regenerable hashes skip the log, buffered results are synced.
+  EXPECT_TRUE(db_->getWriteOptions(kHashes).disableWAL);
+  EXPECT_FALSE(db_->getWriteOptions(kEvents).disableWAL);
+  EXPECT_FALSE(db_->getWriteOptions(kEvents).sync);
+  EXPECT_TRUE(db_->getWriteOptions(kLogs).sync);
+
+  Row stats;
+  ASSERT_TRUE(db_->Stats(kHashes, stats).ok());
+  EXPECT_EQ(stats["durability"], "none");
+
+  // Writes without the log are still read back.
+  std::string value;
+  EXPECT_TRUE(db_->Put(kHashes, "test_durability", "1").ok());
+  EXPECT_TRUE(db_->Get(kHashes, "test_durability", value).ok());
+  EXPECT_EQ(value, "1");
+}
+
+TEST_F(DBHandleTests, test_memory_budget) {
+  // Every domain that caches blocks shares one cache bounded by the budget.
+  Row events, queries, logs;
+  ASSERT_TRUE(db_->Stats(kEvents, events).ok());
+  ASSERT_TRUE(db_->Stats(kQueries, queries).ok());
+  ASSERT_TRUE(db_->Stats(kLogs, logs).ok());
+  EXPECT_EQ(events["block_cache_size"], std::to_string(db_->memory_limit_));
+  EXPECT_EQ(events["block_cache_size"], queries["block_cache_size"]);
+  EXPECT_EQ(logs["block_cache_size"], "0");
+  EXPECT_EQ(events["memory_limit"], queries["memory_limit"]);
+
+  // The budget stays within the watchdog's worker memory limit.
+  if (!FLAGS_disable_watchdog) {
+    EXPECT_LE(db_->memory_limit_,
+              getWorkerLimit(MEMORY_LIMIT) * 1024 * 1024 / 2);
+  }
+}
+
+TEST_F(DBHandleTests, test_in_memory) {
+  if (!DBHandle::supportsInMemory()) {
+    return;
+  }
+
+  // An in-memory database does not create its path.
+  auto path = path_ + "-memory";
+  db_->resetInstance(path, true);
+  EXPECT_TRUE(db_->Put(kQueries, "test_in_memory", "1").ok());
+  EXPECT_FALSE(pathExists(path));
+
+  // The data remains while the process reopens the database.
+  db_->resetInstance(path, true);
+  std::string value;
+  EXPECT_TRUE(db_->Get(kQueries, "test_in_memory", value).ok());
+  EXPECT_EQ(value, "1");
+}
+
 TEST_F(DBHandleTests, test_rocksdb_loglevel) {
   // Make sure a log file was created.
   EXPECT_FALSE(pathExists(path_ + "/LOG"));
@@ -12,25 +12,14 @@
 #include <ctime>
 #include <deque>
 
-#include <boost/filesystem/operations.hpp>
-
 #include <gtest/gtest.h>
 
 #include "osquery/core/test_util.h"
 #include "osquery/database/query.h"
 
-const std::string kTestingQueryDBPath = "/tmp/rocksdb-osquery-querytests";
-
 namespace osquery {
 
-class QueryTests : public testing::Test {
- public:
-  void SetUp() { db_ = DBHandle::getInstanceAtPath(kTestingQueryDBPath); }
-  void TearDown() { boost::filesystem::remove_all(kTestingQueryDBPath); }
-
- public:
-  std::shared_ptr<DBHandle> db_;
-};
+class QueryTests : public testing::Test {};
 
 TEST_F(QueryTests, test_private_members) {
   auto query = getOsqueryScheduledQuery();
@@ -42,7 +31,7 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
   // Test adding a "current" set of results to a scheduled query instance.
   auto query = getOsqueryScheduledQuery();
   auto cf = Query("foobar", query);
-  auto status = cf.addNewResults(getTestDBExpectedResults(), db_);
+  auto status = cf.addNewResults(getTestDBExpectedResults());
   EXPECT_TRUE(status.ok());
   EXPECT_EQ(status.toString(), "OK");
 
@@ -50,13 +39,13 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
   for (auto result : getTestDBResultStream()) {
     // Get the results from the previous query execution (from RocksDB).
     QueryData previous_qd;
-    auto status = cf.getPreviousQueryResults(previous_qd, db_);
+    auto status = cf.getPreviousQueryResults(previous_qd);
     EXPECT_TRUE(status.ok());
     EXPECT_EQ(status.toString(), "OK");
 
     // Add the "current" results and output the differentials.
     DiffResults dr;
-    auto s = cf.addNewResults(result.second, dr, true, db_);
+    auto s = cf.addNewResults(result.second, dr, true);
     EXPECT_TRUE(s.ok());
 
     // Call the diffing utility directly.
@@ -64,23 +53,88 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
     EXPECT_EQ(dr, expected);
 
     // After Query::addNewResults the previous results are now current.
+    // Rows are stored by fingerprint, so the row order is not preserved.
     QueryData qd;
-    cf.getPreviousQueryResults(qd, db_);
-    EXPECT_EQ(qd, result.second);
+    cf.getPreviousQueryResults(qd);
+    auto expected_qd = result.second;
+    std::sort(qd.begin(), qd.end());
+    std::sort(expected_qd.begin(), expected_qd.end());
+    EXPECT_EQ(qd, expected_qd);
   }
 }
 
+TEST_F(QueryTests, test_incremental_row_storage) {
+  auto cf = Query("foobar", getOsqueryScheduledQuery());
+  QueryData qd = {
+      {{"name", "a"}}, {{"name", "b"}}, {{"name", "b"}}, {{"name", "c"}}};
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(qd, dr, true).ok());
+  EXPECT_EQ(dr.added, qd);
+
+  // Each distinct row is stored under the query's row key prefix.
+  std::vector<std::string> keys;
+  scanDatabasePrefix(kQueries, keys, cf.getRowKeyPrefix());
+  EXPECT_EQ(keys.size(), 3U);
+
+  // Row keys are not reported as query names.
+  auto names = cf.getStoredQueryNames();
+  EXPECT_EQ(names, std::vector<std::string>({"foobar"}));
+
+  QueryData next = {{{"name", "b"}}, {{"name", "c"}}, {{"name", "d"}}};
+  EXPECT_TRUE(cf.addNewResults(next, dr, true).ok());
+  EXPECT_EQ(dr, diff(qd, next));
+
+  // Streaming the previous results yields every stored row.
+  QueryData streamed;
+  auto status = cf.getPreviousQueryResults(
+      [&streamed](const Row& r) { streamed.push_back(r); });
+  EXPECT_TRUE(status.ok());
+  std::sort(streamed.begin(), streamed.end());
+  EXPECT_EQ(streamed, next);
+
+  // A query sharing the name as a prefix does not see these rows.
+  auto other = Query("foobar.baz", getOsqueryScheduledQuery());
+  EXPECT_TRUE(other.addNewResults({{{"name", "z"}}}, dr, true).ok());
+  QueryData previous;
+  cf.getPreviousQueryResults(previous);
+  std::sort(previous.begin(), previous.end());
+  EXPECT_EQ(previous, next);
+}
+
+TEST_F(QueryTests, test_legacy_results_migration) {
+  // Results stored as a single value are read and migrated on write.
+  QueryData qd = {{{"name", "a"}}, {{"name", "b"}}};
+  std::string legacy;
+  serializeQueryDataJSON(qd, legacy);
+  setDatabaseValue(kQueries, "legacy", legacy);
+
+  auto cf = Query("legacy", getOsqueryScheduledQuery());
+  QueryData previous;
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous).ok());
+  EXPECT_EQ(previous, qd);
+
+  QueryData next = {{{"name", "b"}}, {{"name", "c"}}};
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(next, dr, true).ok());
+  EXPECT_EQ(dr, diff(qd, next));
+
+  std::vector<std::string> keys;
+  scanDatabasePrefix(kQueries, keys, cf.getRowKeyPrefix());
+  EXPECT_EQ(keys.size(), 2U);
+  EXPECT_TRUE(cf.isQueryNameInDatabase());
+}
+
 TEST_F(QueryTests, test_get_query_results) {
   // Grab an expected set of query data and add it as the previous result.
   auto encoded_qd = getSerializedQueryDataJSON();
   auto query = getOsqueryScheduledQuery();
-  auto status = db_->Put(kQueries, "foobar", encoded_qd.first);
+  auto status = setDatabaseValue(kQueries, "foobar", encoded_qd.first);
   EXPECT_TRUE(status.ok());
 
   // Use the Query retrieval API to check the now "previous" result.
   QueryData previous_qd;
   auto cf = Query("foobar", query);
-  status = cf.getPreviousQueryResults(previous_qd, db_);
+  status = cf.getPreviousQueryResults(previous_qd);
   EXPECT_TRUE(status.ok());
 }
 
@@ -89,7 +143,7 @@ TEST_F(QueryTests, test_query_name_not_found_in_db) {
   QueryData previous_qd;
   auto query = getOsqueryScheduledQuery();
   auto cf = Query("not_a_real_query", query);
-  auto status = cf.getPreviousQueryResults(previous_qd, db_);
+  auto status = cf.getPreviousQueryResults(previous_qd);
   EXPECT_TRUE(status.toString() == "Query name not found in database");
   EXPECT_TRUE(status.ok());
 }
@@ -98,22 +152,22 @@ TEST_F(QueryTests, test_is_query_name_in_database) {
   auto query = getOsqueryScheduledQuery();
   auto cf = Query("foobar", query);
   auto encoded_qd = getSerializedQueryDataJSON();
-  auto status = db_->Put(kQueries, "foobar", encoded_qd.first);
+  auto status = setDatabaseValue(kQueries, "foobar", encoded_qd.first);
   EXPECT_TRUE(status.ok());
   // Now test that the query name exists.
-  EXPECT_TRUE(cf.isQueryNameInDatabase(db_));
+  EXPECT_TRUE(cf.isQueryNameInDatabase());
 }
 
 TEST_F(QueryTests, test_get_stored_query_names) {
   auto query = getOsqueryScheduledQuery();
   auto cf = Query("foobar", query);
   auto encoded_qd = getSerializedQueryDataJSON();
-  auto status = db_->Put(kQueries, "foobar", encoded_qd.first);
+  auto status = setDatabaseValue(kQueries, "foobar", encoded_qd.first);
   EXPECT_TRUE(status.ok());
 
   // Stored query names is a factory method included alongside every query.
   // It will include the set of query names with existing "previous" results.
-  auto names = cf.getStoredQueryNames(db_);
+  auto names = cf.getStoredQueryNames();
   auto in_vector = std::find(names.begin(), names.end(), "foobar");
   EXPECT_NE(in_vector, names.end());
 }
@@ -38,6 +38,55 @@ TEST_F(ResultsTests, test_simple_diff) {
   EXPECT_EQ(results.removed, o);
 }
 
+TEST_F(ResultsTests, test_duplicate_row_diff) {
+  Row a = {{"name", "a"}};
+  Row b = {{"name", "b"}};
+  Row c = {{"name", "c"}};
+
+  // Extra copies of an existing row are not added, missing copies are removed.
+  QueryData o = {c, a, a, a, b};
+  QueryData n = {a, b, b, c, {{"name", "d"}}};
+  auto results = diff(o, n);
+  EXPECT_EQ(results.added, QueryData({{{"name", "d"}}}));
+  EXPECT_EQ(results.removed, QueryData({a, a}));
+
+  // Removed rows are returned sorted.
+  results = diff({c, b, a}, {});
+  EXPECT_EQ(results.removed, QueryData({a, b, c}));
+}
+
+TEST_F(ResultsTests, test_row_fingerprint) {
+  Row r = {{"key", "value"}};
+  EXPECT_EQ(getRowFingerprint(r), getRowFingerprint({{"key", "value"}}));
+  EXPECT_NE(getRowFingerprint(r), getRowFingerprint({{"keyv", "alue"}}));
+  EXPECT_NE(getRowFingerprint(r), getRowFingerprint(Row()));
+}
+
+TEST_F(ResultsTests, test_query_data_fingerprint) {
+  Row a = {{"name", "a"}};
+  Row b = {{"name", "b"}};
+  Row c = {{"name", "c"}};
+
+  // The order of rows does not matter, duplicate rows do.
+  EXPECT_EQ(getQueryDataFingerprint({a, b}), getQueryDataFingerprint({b, a}));
+  EXPECT_NE(getQueryDataFingerprint({a, b}),
+            getQueryDataFingerprint({a, b, b}));
+  EXPECT_EQ(getQueryDataFingerprint({}), 0U);
+
+  // A receiver updates the fingerprint with the differential.
+  QueryData o = {a, b};
+  QueryData n = {b, c};
+  auto results = diff(o, n);
+  auto hash = getQueryDataFingerprint(o);
+  for (const auto& r : results.added) {
+    hash += getRowFingerprint(r);
+  }
+  for (const auto& r : results.removed) {
+    hash -= getRowFingerprint(r);
+  }
+  EXPECT_EQ(hash, getQueryDataFingerprint(n));
+}
+
 TEST_F(ResultsTests, test_serialize_row) {
   auto results = getSerializedRow();
   pt::ptree tree;
@@ -89,6 +138,72 @@ TEST_F(ResultsTests, test_deserialize_query_data_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_snapshot_hash) {
+  auto item = getSerializedQueryLogItem().second;
+  item.snapshot_hash = "00000000000000ff";
+  std::string json;
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json).ok());
+  EXPECT_NE(json.find("\"snapshotHash\":\"00000000000000ff\""),
+            std::string::npos);
+
+  QueryLogItem output;
+  EXPECT_TRUE(deserializeQueryLogItemJSON(json, output).ok());
+  EXPECT_EQ(output.snapshot_hash, item.snapshot_hash);
+}
+
+TEST_F(ResultsTests, test_serialize_row_binary) {
+  auto results = getSerializedRow();
+  std::string data;
+  EXPECT_TRUE(serializeRowBinary(results.second, data).ok());
+  EXPECT_EQ(data[0], 0);
+
+  Row output;
+  EXPECT_TRUE(deserializeRowBinary(data, output).ok());
+  EXPECT_EQ(output, results.second);
+
+  // A single column is read without decoding the row.
+  std::string value;
+  EXPECT_TRUE(getRowBinaryValue(data, "meaning_of_life", value).ok());
+  EXPECT_EQ(value, results.second.at("meaning_of_life"));
+  EXPECT_FALSE(getRowBinaryValue(data, "not_a_column", value).ok());
+
+  // Rows stored as JSON are still readable.
+  std::string json;
+  serializeRowJSON(results.second, json);
+  output.clear();
+  EXPECT_TRUE(deserializeRowBinary(json, output).ok());
+  EXPECT_EQ(output, results.second);
+  EXPECT_TRUE(getRowBinaryValue(json, "meaning_of_life", value).ok());
+
+  // Truncated content is an error.
+  output.clear();
+  EXPECT_FALSE(deserializeRowBinary(data.substr(0, data.size() - 1), output));
+}
+
+TEST_F(ResultsTests, test_serialize_query_data_binary) {
+  auto results = getSerializedQueryDataJSON();
+  std::string data;
+  EXPECT_TRUE(serializeQueryDataBinary(results.second, data).ok());
+
+  QueryData output;
+  EXPECT_TRUE(deserializeQueryDataBinary(data, output).ok());
+  EXPECT_EQ(output, results.second);
+
+  // Column names are written once, the binary form is smaller than JSON.
+  EXPECT_LT(data.size(), results.first.size());
+
+  // Query results stored as JSON are still readable.
+  output.clear();
+  EXPECT_TRUE(deserializeQueryDataBinary(results.first, output).ok());
+  EXPECT_EQ(output, results.second);
+
+  // An empty result set is valid.
+  EXPECT_TRUE(serializeQueryDataBinary(QueryData(), data).ok());
+  output.clear();
+  EXPECT_TRUE(deserializeQueryDataBinary(data, output).ok());
+  EXPECT_TRUE(output.empty());
+}
+
 TEST_F(ResultsTests, test_serialize_diff_results) {
   auto results = getSerializedDiffResults();
   pt::ptree tree;
@@ -241,6 +356,29 @@ TEST_F(ResultsTests, test_deserialize_distributed_query_result_json) {
   EXPECT_EQ(r.results[0]["foo"], "bar");
 }
 
+TEST_F(ResultsTests, test_row_keys) {
+  RowKeys keys;
+  keys.add(0, "name");
+  keys.add(1, "age");
+  keys.add(2, "name");
+  keys.add(3, "city");
+  EXPECT_EQ(keys.size(), 4U);
+
+  // Each value is filled by its source index, a repeated name keeps the last.
+  std::vector<std::string> source = {"alice", "30", "bob", "paris"};
+  auto r = keys.build(
+      [&source](size_t i, RowData& field) { field = source[i]; });
+  Row expected = {{"age", "30"}, {"city", "paris"}, {"name", "bob"}};
+  EXPECT_EQ(r, expected);
+
+  // Rows built from the same keys are independent.
+  source[1] = "31";
+  auto r2 = keys.build(
+      [&source](size_t i, RowData& field) { field = source[i]; });
+  EXPECT_EQ(r2["age"], "31");
+  EXPECT_EQ(r["age"], "30");
+}
+
 TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
   Row r1, r2, r3;
   r1["foo"] = "bar";
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/database/view.h"
+
+namespace osquery {
+
+class ViewTests : public testing::Test {
+ public:
+  void TearDown() { IncrementalView::remove("view_test"); }
+};
+
+static ScheduledQuery getViewQuery(const std::string& text, size_t window) {
+  ScheduledQuery query;
+  query.query = text;
+  query.interval = 60;
+  query.window = window;
+  return query;
+}
+
+TEST_F(ViewTests, test_supported_queries) {
+  std::vector<std::string> supported = {
+      "select path, count(*) as count from process_events group by path",
+      "SELECT count(*) FROM file_events;",
+      "select e.uid as user, max(time) latest, min(pid) from process_events e "
+      "where uid > 0 group by uid",
+  };
+  for (const auto& text : supported) {
+    EXPECT_TRUE(IncrementalView("view_test", getViewQuery(text, 0)).valid());
+  }
+
+  std::vector<std::string> unsupported = {
+      "select * from process_events",
+      "select path, avg(pid) from process_events group by path",
+      "select path, count(*) from process_events group by path order by path",
+      "select p.path, count(*) from process_events p join users u using (uid)",
+      "select count(*) from (select * from process_events)",
+      "select path, max(pid, uid) from process_events",
+  };
+  for (const auto& text : unsupported) {
+    EXPECT_FALSE(IncrementalView("view_test", getViewQuery(text, 0)).valid());
+  }
+}
+
+TEST_F(ViewTests, test_delta_query) {
+  auto query = getViewQuery(
+      "select path, count(*) as count from process_events where uid = 0 "
+      "group by path",
+      0);
+  IncrementalView view("view_test", query);
+  EXPECT_EQ(view.deltaQuery(10, 20),
+            "SELECT path, count(*) as count FROM process_events WHERE "
+            "(uid = 0) AND time >= 10 AND time < 20 GROUP BY path");
+}
+
+TEST_F(ViewTests, test_incremental_update) {
+  auto query = getViewQuery(
+      "select path, count(*) as count, max(time) as latest from "
+      "process_events group by path",
+      0);
+  QueryData rows;
+  {
+    IncrementalView view("view_test", query);
+    EXPECT_EQ(view.watermark(), 0U);
+    QueryData delta = {{{"path", "/bin/ls"}, {"count", "2"}, {"latest", "5"}}};
+    ASSERT_TRUE(view.update(delta, 10, rows).ok());
+    ASSERT_EQ(rows.size(), 1U);
+  }
+
+  // The state is stored, a later execution merges only its new rows.
+  IncrementalView view("view_test", query);
+  EXPECT_EQ(view.watermark(), 10U);
+  QueryData delta = {
+      {{"path", "/bin/ls"}, {"count", "3"}, {"latest", "12"}},
+      {{"path", "/bin/sh"}, {"count", "1"}, {"latest", "11"}},
+  };
+  ASSERT_TRUE(view.update(delta, 20, rows).ok());
+  ASSERT_EQ(rows.size(), 2U);
+  EXPECT_EQ(rows[0]["count"], "5");
+  EXPECT_EQ(rows[0]["latest"], "12");
+  EXPECT_EQ(rows[1]["path"], "/bin/sh");
+
+  // A changed query discards the state.
+  query.query += " ";
+  EXPECT_EQ(IncrementalView("view_test", query).watermark(), 0U);
+}
+
+TEST_F(ViewTests, test_window_expiration) {
+  auto query = getViewQuery(
+      "select path, count(*) as count from process_events group by path", 15);
+  IncrementalView view("view_test", query);
+  QueryData rows;
+  view.update({{{"path", "/bin/ls"}, {"count", "2"}}}, 10, rows);
+  view.update({{{"path", "/bin/ls"}, {"count", "1"}}}, 20, rows);
+  ASSERT_EQ(rows.size(), 1U);
+  EXPECT_EQ(rows[0]["count"], "3");
+
+  // The first execution is outside of the window.
+  view.update({}, 25, rows);
+  ASSERT_EQ(rows.size(), 1U);
+  EXPECT_EQ(rows[0]["count"], "1");
+}
+}
@@ -0,0 +1,302 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstdlib>
+#include <map>
+#include <sstream>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/regex.hpp>
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/database/view.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// The supported query form: a select list, one table, and optional clauses.
+static const boost::regex kViewQuery(
+    "^\\s*select\\s+(.+?)\\s+from\\s+([A-Za-z_][A-Za-z0-9_]*"
+    "(?:\\s+(?:as\\s+)?(?!where\\b|group\\b)[A-Za-z_][A-Za-z0-9_]*)?)"
+    "(?:\\s+where\\s+(.+?))?(?:\\s+group\\s+by\\s+(.+?))?\\s*;?\\s*$",
+    boost::regex::icase);
+
+/// An aggregate result column, with an optional alias.
+static const boost::regex kViewAggregate(
+    "^(count|sum|min|max)\\s*\\((.*)\\)"
+    "(?:\\s+(?:as\\s+)?([A-Za-z_][A-Za-z0-9_]*))?$",
+    boost::regex::icase);
+
+/// A key result column, optionally qualified, with an optional alias.
+static const boost::regex kViewKey(
+    "^(?:[A-Za-z_][A-Za-z0-9_]*\\.)?([A-Za-z_][A-Za-z0-9_]*)"
+    "(?:\\s+(?:as\\s+)?([A-Za-z_][A-Za-z0-9_]*))?$",
+    boost::regex::icase);
+
+/// Clauses that change which rows are aggregated, these are not supported.
+static const boost::regex kViewUnsupported(
+    "\\b(join|having|order|limit|union|distinct)\\b|"
+    "\\bselect\\b.*\\bselect\\b",
+    boost::regex::icase);
+
+/// Split a select list at commas outside of parentheses and quotes.
+static std::vector<std::string> splitColumns(const std::string& columns) {
+  std::vector<std::string> items;
+  std::string item;
+  size_t depth = 0;
+  char quote = 0;
+  for (const auto& c : columns) {
+    if (quote != 0) {
+      quote = (c == quote) ? 0 : quote;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else if (c == '(') {
+      depth++;
+    } else if (c == ')' && depth > 0) {
+      depth--;
+    } else if (c == ',' && depth == 0) {
+      items.push_back(boost::algorithm::trim_copy(item));
+      item.clear();
+      continue;
+    }
+    item += c;
+  }
+  items.push_back(boost::algorithm::trim_copy(item));
+  return items;
+}
+
+/// Parse a complete string as a number.
+static bool parseNumber(const std::string& value, double& number) {
+  if (value.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  number = strtod(value.c_str(), &end);
+  return end != nullptr && *end == '\0';
+}
+
+/// Merge two values of an aggregate column, an empty value is a NULL.
+static std::string mergeValue(ViewAggregate aggregate,
+                              const std::string& left,
+                              const std::string& right) {
+  if (left.empty()) {
+    return right;
+  } else if (right.empty()) {
+    return left;
+  }
+
+  if (aggregate == VIEW_COUNT || aggregate == VIEW_SUM) {
+    long long a = 0;
+    long long b = 0;
+    if (parseDecimal(left, a) && parseDecimal(right, b)) {
+      return BIGINT(a + b);
+    }
+    double x = 0;
+    double y = 0;
+    parseNumber(left, x);
+    parseNumber(right, y);
+    return DOUBLE(x + y);
+  }
+
+  // Compare numbers as numbers, as SQLite compares numeric columns.
+  double x = 0;
+  double y = 0;
+  bool less = (parseNumber(left, x) && parseNumber(right, y)) ? x < y
+                                                              : left < right;
+  if (aggregate == VIEW_MIN) {
+    return (less) ? left : right;
+  }
+  return (less) ? right : left;
+}
+
+IncrementalView::IncrementalView(const std::string& name,
+                                 const ScheduledQuery& query)
+    : name_(name), query_(query.query), window_(query.window) {
+  boost::smatch match;
+  if (!boost::regex_match(query_, match, kViewQuery) ||
+      boost::regex_search(query_, kViewUnsupported)) {
+    return;
+  }
+  columns_ = match[1];
+  table_ = match[2];
+  where_ = match[3];
+  group_ = match[4];
+
+  for (const auto& column : splitColumns(columns_)) {
+    boost::smatch item;
+    if (boost::regex_match(column, item, kViewAggregate)) {
+      auto function = boost::algorithm::to_lower_copy(std::string(item[1]));
+      if (splitColumns(item[2]).size() != 1) {
+        // A min or max of several arguments is not an aggregate.
+        return;
+      }
+      // SQLite names an unaliased expression column by its text.
+      auto name = (item[3].matched) ? std::string(item[3]) : column;
+      auto aggregate = (function == "count")
+                           ? VIEW_COUNT
+                           : (function == "sum")
+                                 ? VIEW_SUM
+                                 : (function == "min") ? VIEW_MIN : VIEW_MAX;
+      aggregates_.push_back(std::make_pair(name, aggregate));
+    } else if (boost::regex_match(column, item, kViewKey)) {
+      auto name = std::string((item[2].matched) ? item[2] : item[1]);
+      aggregates_.push_back(std::make_pair(name, VIEW_KEY));
+    } else {
+      return;
+    }
+  }
+  valid_ = true;
+
+  // State stored for a different query text is discarded.
+  std::string content;
+  if (!getDatabaseValue(kPersistentSettings, "view." + name_, content).ok() ||
+      content.empty()) {
+    return;
+  }
+
+  pt::ptree tree;
+  try {
+    std::stringstream input;
+    input << content;
+    pt::read_json(input, tree);
+  } catch (const pt::json_parser::json_parser_error& e) {
+    VLOG(1) << "Discarding the incremental view of " << name_ << ": "
+            << e.what();
+    return;
+  }
+
+  if (tree.get<std::string>("query", "") != query_) {
+    return;
+  }
+  watermark_ = tree.get<size_t>("watermark", 0);
+  for (const auto& bucket : tree.get_child("buckets", pt::ptree())) {
+    QueryData rows;
+    deserializeQueryData(bucket.second.get_child("rows", pt::ptree()), rows);
+    buckets_.push_back(
+        std::make_pair(bucket.second.get<size_t>("time", 0), std::move(rows)));
+  }
+}
+
+std::string IncrementalView::deltaQuery(size_t start, size_t stop) const {
+  auto query = "SELECT " + columns_ + " FROM " + table_ + " WHERE ";
+  if (!where_.empty()) {
+    query += "(" + where_ + ") AND ";
+  }
+  query += "time >= " + std::to_string(start) + " AND time < " +
+           std::to_string(stop);
+  if (!group_.empty()) {
+    query += " GROUP BY " + group_;
+  }
+  return query;
+}
+
+void IncrementalView::merge(const QueryData& rows, QueryData& aggregate) const {
+  // Rows are grouped by the values of their key columns.
+  std::map<std::vector<std::string>, size_t> groups;
+  auto keyOf = [this](const Row& row) {
+    std::vector<std::string> key;
+    for (const auto& column : aggregates_) {
+      if (column.second == VIEW_KEY) {
+        auto value = row.find(column.first);
+        key.push_back((value != row.end()) ? value->second : "");
+      }
+    }
+    return key;
+  };
+
+  for (size_t i = 0; i < aggregate.size(); ++i) {
+    groups[keyOf(aggregate[i])] = i;
+  }
+
+  for (const auto& row : rows) {
+    auto group = groups.find(keyOf(row));
+    if (group == groups.end()) {
+      groups[keyOf(row)] = aggregate.size();
+      aggregate.push_back(row);
+      continue;
+    }
+
+    auto& merged = aggregate[group->second];
+    for (const auto& column : aggregates_) {
+      if (column.second == VIEW_KEY) {
+        continue;
+      }
+      auto value = row.find(column.first);
+      if (value != row.end()) {
+        merged[column.first] =
+            mergeValue(column.second, merged[column.first], value->second);
+      }
+    }
+  }
+}
+
+Status IncrementalView::update(const QueryData& delta,
+                               size_t time,
+                               QueryData& rows) {
+  if (window_ == 0) {
+    // Without a window every execution is merged into a single bucket.
+    if (buckets_.empty()) {
+      buckets_.push_back(std::make_pair(time, QueryData()));
+    }
+    merge(delta, buckets_.front().second);
+    buckets_.front().first = time;
+  } else {
+    std::vector<std::pair<size_t, QueryData>> buckets;
+    for (auto& bucket : buckets_) {
+      if (bucket.first + window_ > time) {
+        buckets.push_back(std::move(bucket));
+      }
+    }
+    buckets.push_back(std::make_pair(time, delta));
+    buckets_ = std::move(buckets);
+  }
+  watermark_ = time;
+
+  rows.clear();
+  for (const auto& bucket : buckets_) {
+    merge(bucket.second, rows);
+  }
+
+  pt::ptree tree;
+  tree.put<std::string>("query", query_);
+  tree.put<size_t>("watermark", watermark_);
+  pt::ptree buckets;
+  for (const auto& bucket : buckets_) {
+    pt::ptree child;
+    child.put<size_t>("time", bucket.first);
+    pt::ptree bucket_rows;
+    auto status = serializeQueryData(bucket.second, bucket_rows);
+    if (!status.ok()) {
+      return status;
+    }
+    child.add_child("rows", bucket_rows);
+    buckets.push_back(std::make_pair("", child));
+  }
+  tree.add_child("buckets", buckets);
+
+  std::ostringstream output;
+  try {
+    pt::write_json(output, tree, false);
+  } catch (const pt::json_parser::json_parser_error& e) {
+    return Status(1, e.what());
+  }
+  return setDatabaseValue(kPersistentSettings, "view." + name_, output.str());
+}
+
+Status IncrementalView::remove(const std::string& name) {
+  return deleteDatabaseValue(kPersistentSettings, "view." + name);
+}
+}
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osquery/database.h>
+
+namespace osquery {
+
+/// How an incremental view merges a result column.
+enum ViewAggregate {
+  VIEW_KEY = 0,
+  VIEW_COUNT,
+  VIEW_SUM,
+  VIEW_MIN,
+  VIEW_MAX,
+};
+
+/**
+ * @brief An incrementally maintained aggregate of a scheduled query.
+ *
+ * A scheduled query with the "incremental" option and the form:
+ *
+ *   SELECT keys, count(...), sum(...), min(...), max(...) FROM table
+ *   [WHERE condition] [GROUP BY keys]
+ *
+ * is executed only over the rows with a time after its previous execution,
+ * usually the rows of an events table. The aggregate of each execution is
+ * merged into state kept in the database, so an execution reads only the new
+ * events. When the query sets a window only the executions within the last
+ * window seconds are merged.
+ */
+class IncrementalView {
+ public:
+  /// Parse the query and load the view's state.
+  IncrementalView(const std::string& name, const ScheduledQuery& query);
+
+  /// Check if the query has a form the view can maintain.
+  bool valid() const { return valid_; }
+
+  /// The end time of the previous execution, 0 before the first.
+  size_t watermark() const { return watermark_; }
+
+  /// The query over the rows with a time in [start, stop).
+  std::string deltaQuery(size_t start, size_t stop) const;
+
+  /**
+   * @brief Merge the results of an execution into the view and store it.
+   *
+   * @param delta the results of deltaQuery(watermark(), time).
+   * @param time the end time of the execution, the next watermark.
+   * @param rows the aggregate rows of the view.
+   * @return success if the view was stored.
+   */
+  Status update(const QueryData& delta, size_t time, QueryData& rows);
+
+  /// Remove the stored state of a scheduled query's view.
+  static Status remove(const std::string& name);
+
+ private:
+  /// Merge rows into the aggregate, by their key columns.
+  void merge(const QueryData& rows, QueryData& aggregate) const;
+
+ private:
+  /// The scheduled query name and text.
+  std::string name_;
+  std::string query_;
+
+  /// Seconds of executions merged into the view, 0 for every execution.
+  size_t window_{0};
+
+  /// Set if the query has a supported form.
+  bool valid_{false};
+
+  /// The clauses of the query, the table includes its alias.
+  std::string columns_;
+  std::string table_;
+  std::string where_;
+  std::string group_;
+
+  /// The result column names and how each is merged.
+  std::vector<std::pair<std::string, ViewAggregate>> aggregates_;
+
+  /// The end time of the previous execution.
+  size_t watermark_{0};
+
+  /// The aggregate of each execution within the window, by end time.
+  std::vector<std::pair<size_t, QueryData>> buckets_;
+};
+}
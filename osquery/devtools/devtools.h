@@ -10,8 +10,12 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdio>
 #include <string>
 
+#include <boost/noncopyable.hpp>
+
 #include <osquery/database.h>
 #include <osquery/flags.h>
 
@@ -69,6 +73,91 @@ void prettyPrint(const QueryData& results,
  */
 void jsonPrint(const QueryData& q);
 
+/**
+ * @brief Pretty print rows as they are added, without keeping every row.
+ *
+ * Column widths are estimated from a sample of the first rows, printed once
+ * the sample is full or a short time after the first row. Later rows print
+ * immediately. A row wider than the estimate widens its columns, then the
+ * table is closed and the header printed again with the new widths.
+ */
+class PrettyPrinter : private boost::noncopyable {
+ public:
+  /**
+   * @brief Create a printer.
+   *
+   * @param sample The most rows held to estimate the column widths.
+   * @param out The stream rows are printed to.
+   */
+  explicit PrettyPrinter(size_t sample = 100, FILE* out = stdout)
+      : sample_size_(sample), out_(out) {}
+
+  /// Set the order of the keys of the following rows.
+  void setColumns(const std::vector<std::string>& columns);
+
+  /// Print or sample a row.
+  void addRow(const Row& r);
+
+  /// Print the sampled rows, if any, and close the table.
+  void finish();
+
+ private:
+  /// Print a separator, the header, and a separator.
+  void printHeader();
+
+  /// Print the sampled rows with their estimated widths.
+  void flushSample();
+
+ private:
+  /// The order of the keys.
+  std::vector<std::string> columns_;
+
+  /// The width of each column.
+  std::map<std::string, size_t> lengths_;
+
+  /// Rows held until the column widths are estimated.
+  QueryData sample_;
+
+  /// The time the first sampled row was added.
+  std::chrono::steady_clock::time_point first_;
+
+  /// The header was printed and rows print immediately.
+  bool started_{false};
+
+  size_t sample_size_{0};
+  FILE* out_{nullptr};
+};
+
+/**
+ * @brief JSON print rows as they are added, without keeping every row.
+ *
+ * Rows are printed as the array jsonPrint prints, or as one object per line.
+ */
+class JSONPrinter : private boost::noncopyable {
+ public:
+  /**
+   * @brief Create a printer.
+   *
+   * @param lines Print each row as an object on its own line, not an array.
+   * @param out The stream rows are printed to.
+   */
+  explicit JSONPrinter(bool lines = false, FILE* out = stdout)
+      : lines_(lines), out_(out) {}
+
+  /// Print a row.
+  void addRow(const Row& r);
+
+  /// Close the array, if any rows were printed.
+  void finish();
+
+ private:
+  /// The number of rows printed since the last finish.
+  size_t rows_{0};
+
+  bool lines_{false};
+  FILE* out_{nullptr};
+};
+
 /**
  * @brief Compute a map of metadata about the supplied QueryData object
  *
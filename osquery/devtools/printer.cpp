@@ -123,18 +123,108 @@ void prettyPrint(const QueryData& results,
 }
 
 void jsonPrint(const QueryData& q) {
-  printf("[\n");
-  for (size_t i = 0; i < q.size(); ++i) {
-    std::string row_string;
-    if (serializeRowJSON(q[i], row_string).ok()) {
-      row_string.pop_back();
-      printf("  %s", row_string.c_str());
-      if (i < q.size() - 1) {
-        printf(",\n");
-      }
+  JSONPrinter printer;
+  for (const auto& row : q) {
+    printer.addRow(row);
+  }
+  printer.finish();
+}
+
+/// Milliseconds after the first row before the sampled rows are printed.
+const size_t kPrettyPrintSampleMs = 500;
+
+void PrettyPrinter::setColumns(const std::vector<std::string>& columns) {
+  columns_ = columns;
+}
+
+void PrettyPrinter::printHeader() {
+  auto separator = generateToken(lengths_, columns_);
+  auto header = separator + generateHeader(lengths_, columns_) + separator;
+  fprintf(out_, "%s", header.c_str());
+}
+
+void PrettyPrinter::flushSample() {
+  // The column names are the minimum widths.
+  if (!sample_.empty()) {
+    computeRowLengths(sample_.front(), lengths_, true);
+  }
+  printHeader();
+  for (const auto& row : sample_) {
+    fprintf(out_, "%s", generateRow(row, lengths_, columns_).c_str());
+  }
+  sample_.clear();
+  started_ = true;
+}
+
+void PrettyPrinter::addRow(const Row& r) {
+  if (!started_) {
+    if (sample_.empty()) {
+      first_ = std::chrono::steady_clock::now();
+    }
+    computeRowLengths(r, lengths_);
+    sample_.push_back(r);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - first_);
+    if (sample_.size() >= sample_size_ ||
+        static_cast<size_t>(elapsed.count()) >= kPrettyPrintSampleMs) {
+      flushSample();
+    }
+    return;
+  }
+
+  // A wider value widens its column, repaint the header with the new widths.
+  bool wider = false;
+  for (const auto& column : r) {
+    auto length = lengths_.find(column.first);
+    auto size = utf8StringSize(column.second);
+    if (length == lengths_.end() || size > length->second) {
+      wider = true;
+      break;
     }
   }
-  printf("\n]\n");
+  if (wider) {
+    fprintf(out_, "%s", generateToken(lengths_, columns_).c_str());
+    computeRowLengths(r, lengths_);
+    computeRowLengths(r, lengths_, true);
+    printHeader();
+  }
+  fprintf(out_, "%s", generateRow(r, lengths_, columns_).c_str());
+}
+
+void PrettyPrinter::finish() {
+  if (!started_ && !sample_.empty()) {
+    flushSample();
+  }
+  if (started_) {
+    fprintf(out_, "%s", generateToken(lengths_, columns_).c_str());
+  }
+  started_ = false;
+  sample_.clear();
+  lengths_.clear();
+}
+
+void JSONPrinter::addRow(const Row& r) {
+  std::string row_string;
+  if (!serializeRowJSON(r, row_string).ok()) {
+    return;
+  }
+
+  // The serialized row ends with a newline.
+  row_string.pop_back();
+  if (lines_) {
+    fprintf(out_, "%s\n", row_string.c_str());
+  } else {
+    fprintf(out_, "%s  %s", (rows_ == 0) ? "[\n" : ",\n", row_string.c_str());
+  }
+  rows_++;
+}
+
+void JSONPrinter::finish() {
+  if (!lines_) {
+    fprintf(out_, "%s\n]\n", (rows_ == 0) ? "[\n" : "");
+  }
+  rows_ = 0;
 }
 
 void computeRowLengths(const Row& r,
@@ -18,6 +18,12 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -37,6 +43,10 @@ namespace osquery {
 /// Define flags used by the shell. They are parsed by the drop-in shell.
 SHELL_FLAG(bool, csv, false, "Set output mode to 'csv'");
 SHELL_FLAG(bool, json, false, "Set output mode to 'json'");
+SHELL_FLAG(bool,
+           json_lines,
+           false,
+           "Set output mode to 'json' with one object per line");
 SHELL_FLAG(bool, line, false, "Set output mode to 'line'");
 SHELL_FLAG(bool, list, false, "Set output mode to 'list'");
 SHELL_FLAG(string, nullvalue, "", "Set string for NULL values, default ''");
@@ -46,6 +56,13 @@ SHELL_FLAG(bool, header, true, "Toggle column headers true/false");
 /// Define short-hand shell switches.
 SHELL_FLAG(bool, L, false, "List all table names");
 SHELL_FLAG(string, A, "", "Select all from a table");
+
+SHELL_FLAG(uint64,
+           benchmark,
+           0,
+           "Run the query N times and print its cost, 0 to print its rows");
+
+DECLARE_bool(disable_caching);
 }
 
 static char zHelp[] =
@@ -54,6 +71,7 @@ static char zHelp[] =
     "\n"
     ".all [TABLE]       Select all from a table\n"
     ".bail ON|OFF       Stop after hitting an error; default OFF\n"
+    ".bench N SQL       Run SQL N times with cold and warm caches, print cost\n"
     ".echo ON|OFF       Turn command echo on or off\n"
     ".exit              Exit this program\n"
     ".header(s) ON|OFF  Turn display of headers on or off\n"
@@ -66,7 +84,9 @@ static char zHelp[] =
     "                     pretty   Pretty printed SQL results\n"
     ".nullvalue STR     Use STRING in place of NULL values\n"
     ".print STR...      Print literal STRING\n"
+    ".profile ON|OFF    Profile the virtual tables used by each query\n"
     ".quit              Exit this program\n"
+    ".sample RATE       Sample the items scanned by tables, 1 to disable\n"
     ".schema [TABLE]    Show the CREATE statements\n"
     ".separator STR     Change separator used by output mode and .import\n"
     ".show              Show the current values for various settings\n"
@@ -263,9 +283,11 @@ static char *one_input_line(FILE *in, char *zPrior, int isContinuation) {
 ** Pretty print structure
  */
 struct prettyprint_data {
-  osquery::QueryData results;
+  prettyprint_data() : json(osquery::FLAGS_json_lines) {}
+
   std::vector<std::string> columns;
-  std::map<std::string, size_t> lengths;
+  osquery::PrettyPrinter pretty;
+  osquery::JSONPrinter json;
 };
 
 /*
@@ -686,6 +708,7 @@ static int shell_callback(
       for (i = 0; i < nArg; i++) {
         p->prettyPrint->columns.push_back(std::string(azCol[i]));
       }
+      p->prettyPrint->pretty.setColumns(p->prettyPrint->columns);
     }
 
     osquery::Row r;
@@ -694,8 +717,12 @@ static int shell_callback(
         r[std::string(azCol[i])] = std::string(azArg[i]);
       }
     }
-    osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
+    // Rows are printed as they arrive, only a sample is kept to size columns.
+    if (osquery::FLAGS_json || osquery::FLAGS_json_lines) {
+      p->prettyPrint->json.addRow(r);
+    } else {
+      p->prettyPrint->pretty.addRow(r);
+    }
     break;
   }
   case MODE_Line: {
@@ -935,6 +962,180 @@ static char *save_err_msg(sqlite3 *db) {
 ** function except it takes a slightly different callback
 ** and callback data argument.
 */
+/*
+** Print the work of each virtual table used by a statement, with the
+** statement's SQLite VM counters.
+*/
+static void print_profile(int vm_steps, int scan_steps, int sorts) {
+  fprintf(stderr,
+          "osquery profile: vm_steps=%d fullscan_steps=%d sorts=%d\n",
+          vm_steps,
+          scan_steps,
+          sorts);
+  for (const auto &table : osquery::takeTableProfiles()) {
+    const auto &profile = table.second;
+    fprintf(stderr,
+            "  %s: filters=%zu constrained=%zu/%zu probe_hits=%zu "
+            "rows=%zu/%zu bytes=%zu wall=%.3fms cpu=%.3fms\n",
+            table.first.c_str(),
+            profile.filters,
+            profile.constrained,
+            profile.filters,
+            profile.probe_hits,
+            profile.rows_consumed,
+            profile.rows_produced,
+            profile.bytes,
+            profile.wall_time / 1000.0,
+            profile.cpu_time / 1000.0);
+  }
+}
+
+/// The cost of one benchmarked execution of a query.
+struct BenchmarkRun {
+  /// Milliseconds of wall and process CPU time.
+  double wall{0};
+  double cpu{0};
+  /// KB the process's peak resident size grew.
+  long rss{0};
+  /// Rows returned by the query.
+  size_t rows{0};
+  /// The work of each virtual table the query used.
+  osquery::TableProfiles tables;
+};
+
+static double cpuMilliseconds(const struct rusage &usage) {
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+static long maxResidentKB(const struct rusage &usage) {
+#ifdef __APPLE__
+  // The macOS high-water mark is in bytes.
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+/*
+** Execute a query, without printing its rows, and measure its cost.
+*/
+static osquery::Status benchmark_run(const std::string &sql,
+                                     BenchmarkRun &run) {
+  auto dbc = osquery::SQLiteDBManager::get();
+  struct rusage r0, r1;
+  getrusage(RUSAGE_SELF, &r0);
+  auto start = std::chrono::steady_clock::now();
+  auto status = osquery::queryInternal(sql,
+                                       [&run](osquery::Row &row) {
+                                         run.rows++;
+                                         return true;
+                                       },
+                                       dbc->db());
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  getrusage(RUSAGE_SELF, &r1);
+
+  run.wall = std::chrono::duration<double, std::milli>(elapsed).count();
+  run.cpu = cpuMilliseconds(r1) - cpuMilliseconds(r0);
+  run.rss = maxResidentKB(r1) - maxResidentKB(r0);
+  run.tables = osquery::takeTableProfiles();
+  return status;
+}
+
+/// The value at a percentile, p in [0, 1], of unsorted values.
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  auto index = static_cast<size_t>(std::ceil(p * values.size()));
+  return values[(index > 0) ? std::min(index, values.size()) - 1 : 0];
+}
+
+/*
+** Print the distribution of a set of benchmark runs, one line for the
+** query and one line for each virtual table, averaged per run.
+*/
+static void benchmark_print(FILE *out,
+                            const char *mode,
+                            const std::vector<BenchmarkRun> &runs) {
+  std::vector<double> wall, cpu;
+  long rss = 0;
+  osquery::TableProfiles tables;
+  for (const auto &run : runs) {
+    wall.push_back(run.wall);
+    cpu.push_back(run.cpu);
+    rss = std::max(rss, run.rss);
+    for (const auto &table : run.tables) {
+      auto &total = tables[table.first];
+      total.wall_time += table.second.wall_time;
+      total.cpu_time += table.second.cpu_time;
+      total.rows_produced += table.second.rows_produced;
+    }
+  }
+
+  fprintf(out,
+          "%s: runs=%zu rows=%zu wall_ms min=%.3f median=%.3f p99=%.3f "
+          "cpu_ms min=%.3f median=%.3f p99=%.3f peak_rss_delta_kb=%ld\n",
+          mode,
+          runs.size(),
+          (runs.empty()) ? 0 : runs.back().rows,
+          percentile(wall, 0),
+          percentile(wall, 0.5),
+          percentile(wall, 0.99),
+          percentile(cpu, 0),
+          percentile(cpu, 0.5),
+          percentile(cpu, 0.99),
+          rss);
+  double count = std::max<size_t>(runs.size(), 1);
+  for (const auto &table : tables) {
+    fprintf(out,
+            "  %s: generate_wall_ms=%.3f generate_cpu_ms=%.3f rows=%.0f\n",
+            table.first.c_str(),
+            table.second.wall_time / 1000.0 / count,
+            table.second.cpu_time / 1000.0 / count,
+            table.second.rows_produced / count);
+  }
+}
+
+/*
+** Run a query count times without table caching, then count times with
+** caching after an execution that fills the caches. Return 1 on error.
+*/
+static int run_benchmark(const std::string &sql, size_t count, FILE *out) {
+  auto profiling = osquery::isTableProfiling();
+  auto caching = osquery::FLAGS_disable_caching;
+  osquery::setTableProfiling(true);
+  osquery::takeTableProfiles();
+
+  std::vector<BenchmarkRun> cold(count);
+  std::vector<BenchmarkRun> warm(count);
+  osquery::FLAGS_disable_caching = true;
+  auto status = osquery::Status(0, "OK");
+  for (size_t i = 0; i < count && status.ok(); i++) {
+    status = benchmark_run(sql, cold[i]);
+  }
+
+  osquery::FLAGS_disable_caching = caching;
+  BenchmarkRun prime;
+  if (status.ok()) {
+    status = benchmark_run(sql, prime);
+  }
+  for (size_t i = 0; i < count && status.ok(); i++) {
+    status = benchmark_run(sql, warm[i]);
+  }
+  osquery::setTableProfiling(profiling);
+
+  if (!status.ok()) {
+    fprintf(stderr, "Error: %s\n", status.getMessage().c_str());
+    return 1;
+  }
+  fprintf(out, "benchmark: %s\n", sql.c_str());
+  benchmark_print(out, "cold", cold);
+  benchmark_print(out, "warm", warm);
+  return 0;
+}
+
 static int shell_exec(
     const char *zSql, /* SQL to be evaluated */
     int (*xCallback)(
@@ -958,7 +1159,7 @@ static int shell_exec(
   }
 
   while (zSql[0] && (SQLITE_OK == rc)) {
-    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, &zLeftover);
+    rc = osquery::prepareStatement(db, zSql, -1, &pStmt, &zLeftover);
     if (SQLITE_OK != rc) {
       if (pzErrMsg) {
         *pzErrMsg = save_err_msg(db);
@@ -1041,7 +1242,15 @@ static int shell_exec(
       /* Finalize the statement just executed. If this fails, save a
       ** copy of the error message. Otherwise, set zSql to point to the
       ** next statement to execute. */
+      int vm_steps = sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+      int scan_steps =
+          sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+      int sorts = sqlite3_stmt_status(pStmt, SQLITE_STMTSTATUS_SORT, 0);
       rc2 = sqlite3_finalize(pStmt);
+      if (osquery::isTableProfiling()) {
+        // Finalizing the statement closed its cursors.
+        print_profile(vm_steps, scan_steps, sorts);
+      }
       if (rc != SQLITE_NOMEM) {
         rc = rc2;
       }
@@ -1062,16 +1271,12 @@ static int shell_exec(
   } /* end while */
 
   if (pArg && pArg->mode == MODE_Pretty) {
-    if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
+    if (osquery::FLAGS_json || osquery::FLAGS_json_lines) {
+      pArg->prettyPrint->json.finish();
     } else {
-      osquery::prettyPrint(pArg->prettyPrint->results,
-                           pArg->prettyPrint->columns,
-                           pArg->prettyPrint->lengths);
+      pArg->prettyPrint->pretty.finish();
     }
-    pArg->prettyPrint->results.clear();
     pArg->prettyPrint->columns.clear();
-    pArg->prettyPrint->lengths.clear();
   }
 
   return rc;
@@ -1288,6 +1493,8 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
   int n, c;
   int rc = 0;
   char *azArg[50];
+  // The tokens are parsed in place, keep the line for commands taking SQL.
+  std::string line(zLine);
 
   /* Parse the input line into tokens.
   */
@@ -1343,6 +1550,17 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
     return rc;
   }
 
+  if (c == 'b' && n >= 3 && strncmp(azArg[0], "bench", n) == 0 && nArg > 2) {
+    // The SQL is the rest of the line after the count.
+    auto sql = line.substr(azArg[1] - zLine + strlen(azArg[1]));
+    auto count = integerValue(azArg[1]);
+    if (count <= 0) {
+      fprintf(stderr, "Error: not a run count: \"%s\"\n", azArg[1]);
+      return 1;
+    }
+    return run_benchmark(sql, static_cast<size_t>(count), p->out);
+  }
+
   // A meta command may act on the database, grab a lock and instance.
   auto dbc = osquery::SQLiteDBManager::get();
   auto db = dbc->db();
@@ -1407,6 +1625,10 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
       fprintf(p->out, "%s", azArg[i]);
     }
     fprintf(p->out, "\n");
+  } else if (c == 'p' && n >= 3 && strncmp(azArg[0], "profile", n) == 0 &&
+             nArg == 2) {
+    osquery::setTableProfiling(booleanValue(azArg[1]) != 0);
+    osquery::takeTableProfiles();
   } else if (c == 'q' && strncmp(azArg[0], "quit", n) == 0 && nArg == 1) {
     rc = 2;
   } else if (c == 's' && strncmp(azArg[0], "schema", n) == 0 && nArg < 3) {
@@ -1437,6 +1659,16 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
       fprintf(p->out, "%d ", p->colWidth[i]);
     }
     fprintf(p->out, "\n");
+    fprintf(p->out, "%9.9s: %g\n", "sample", osquery::getQuerySampleRate());
+  } else if (c == 's' && n >= 2 && strncmp(azArg[0], "sample", n) == 0 &&
+             nArg == 2) {
+    auto rate = atof(azArg[1]);
+    if (rate <= 0 || rate > 1) {
+      fprintf(stderr, "Error: not a sample rate within (0, 1]: %s\n", azArg[1]);
+      rc = 1;
+    } else {
+      osquery::setQuerySampleRate(rate);
+    }
   } else if (c == 't' && n > 1 && strncmp(azArg[0], "tables", n) == 0 &&
              nArg < 3) {
     meta_tables(nArg, azArg);
@@ -1722,6 +1954,8 @@ int launchIntoShell(int argc, char **argv) {
     if (query[0] == '.') {
       rc = do_meta_command(query, &data);
       rc = (rc == 2) ? 0 : rc;
+    } else if (FLAGS_benchmark > 0) {
+      rc = run_benchmark(query, FLAGS_benchmark, data.out);
     } else {
       rc = shell_exec(query, shell_callback, &data, &error);
       if (error != 0) {
@@ -8,6 +8,8 @@
  *
  */
 
+#include <cstdio>
+
 #include <gtest/gtest.h>
 
 #include <osquery/logger.h>
@@ -95,6 +97,81 @@ TEST_F(PrinterTests, test_generate_row) {
   EXPECT_EQ(results, expected);
 }
 
+/// Read everything printed to a temporary file.
+static std::string readPrinted(FILE* out) {
+  std::string printed;
+  rewind(out);
+  char buffer[256];
+  size_t bytes = 0;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), out)) > 0) {
+    printed.append(buffer, bytes);
+  }
+  return printed;
+}
+
+TEST_F(PrinterTests, test_pretty_printer) {
+  // A sample of every row prints the same table as prettyPrint.
+  auto out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  PrettyPrinter printer(10, out);
+  printer.setColumns(order);
+  for (const auto& row : q) {
+    printer.addRow(row);
+  }
+  printer.finish();
+
+  std::string separator =
+      "+------------+------+-------------------------+--------+\n";
+  auto expected = separator +
+                  "| name       | age  | food                    | number |\n" +
+                  separator +
+                  "| Mike Jones | 39   | mac and cheese          | 1      |\n" +
+                  "| John Smith | 44   | peanut butter and jelly | 2      |\n" +
+                  "| Doctor Who | 2000 | fish sticks and custard | 11     |\n" +
+                  separator;
+  EXPECT_EQ(readPrinted(out), expected);
+  fclose(out);
+}
+
+TEST_F(PrinterTests, test_pretty_printer_repaint) {
+  // A row wider than the sample widens its column and repaints the header.
+  auto out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  PrettyPrinter printer(1, out);
+  printer.setColumns({"name"});
+  printer.addRow({{"name", "Mike"}});
+  printer.addRow({{"name", "Doctor Who"}});
+  printer.finish();
+
+  std::string expected =
+      "+------+\n| name |\n+------+\n| Mike |\n+------+\n"
+      "+------------+\n| name       |\n+------------+\n"
+      "| Doctor Who |\n+------------+\n";
+  EXPECT_EQ(readPrinted(out), expected);
+  fclose(out);
+}
+
+TEST_F(PrinterTests, test_json_printer) {
+  auto out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  JSONPrinter printer(false, out);
+  printer.addRow({{"age", "39"}});
+  printer.addRow({{"age", "44"}});
+  printer.finish();
+  EXPECT_EQ(readPrinted(out),
+            "[\n  {\"age\":\"39\"},\n  {\"age\":\"44\"}\n]\n");
+  fclose(out);
+
+  out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  JSONPrinter lines(true, out);
+  lines.addRow({{"age", "39"}});
+  lines.addRow({{"age", "44"}});
+  lines.finish();
+  EXPECT_EQ(readPrinted(out), "{\"age\":\"39\"}\n{\"age\":\"44\"}\n");
+  fclose(out);
+}
+
 TEST_F(PrinterTests, test_unicode) {
   Row r = {{"name", "Àlex Smith"}};
   std::map<std::string, size_t> lengths;
@@ -8,7 +8,8 @@
  *
  */
 
-#include <boost/chrono.hpp>
+#include <algorithm>
+#include <chrono>
 
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -23,38 +24,70 @@ namespace osquery {
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
-void interruptableSleep(size_t milli) {
-  boost::this_thread::sleep_for(boost::chrono::milliseconds(milli));
-}
+FLAG(bool,
+     worker_affinity,
+     false,
+     "Pin each work dispatch thread to a CPU core (Linux only)");
 
-Dispatcher::~Dispatcher() { join(); }
+/// Long sleeps are rounded up to this boundary to coalesce wakeups.
+const size_t kSleepSlackMilli = 100;
+
+void interruptableSleep(size_t milli) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(milli);
+  if (milli >= 1000) {
+    auto slack = std::chrono::milliseconds(kSleepSlackMilli);
+    auto since = deadline.time_since_epoch();
+    deadline += (slack - since % slack) % slack;
+  }
 
-void Dispatcher::init() {
-  thread_manager_ = InternalThreadManager::newSimpleThreadManager(
-      (size_t)FLAGS_worker_threads, 0);
-  auto thread_factory = ThriftThreadFactory(new PosixThreadFactory());
-  thread_manager_->threadFactory(thread_factory);
-  thread_manager_->start();
+  auto& self = Dispatcher::instance();
+  {
+    std::unique_lock<std::mutex> lock(self.sleep_mutex_);
+    auto generation = self.sleep_generation_;
+    // An interruption requested before the sleep must not wait for a wake.
+    if (!boost::this_thread::interruption_requested()) {
+      self.sleep_wake_.wait_until(lock, deadline, [&self, generation]() {
+        return self.sleep_generation_ != generation;
+      });
+    }
+  }
+  boost::this_thread::interruption_point();
 }
 
-Status Dispatcher::add(ThriftInternalRunnableRef task) {
+void Dispatcher::wakeSleepers() {
   auto& self = instance();
-  if (self.thread_manager_ == nullptr) {
+  {
+    std::lock_guard<std::mutex> lock(self.sleep_mutex_);
+    self.sleep_generation_++;
+  }
+  self.sleep_wake_.notify_all();
+}
+
+Dispatcher::~Dispatcher() { join(); }
+
+TaskExecutorRef Dispatcher::executor() {
+  std::lock_guard<std::mutex> lock(executor_mutex_);
+  if (executor_ == nullptr) {
     // The dispatcher's thread pool is not initialized.
-    self.init();
+    executor_ = std::make_shared<TaskExecutor>(
+        std::max<int>(FLAGS_worker_threads, 1), FLAGS_worker_affinity);
   }
+  return executor_;
+}
 
-  try {
-    if (self.state() != InternalThreadManager::STARTED) {
-      self.thread_manager_->start();
-    }
-    instance().thread_manager_->add(task, 0, 0);
-  } catch (std::exception& e) {
-    return Status(1, e.what());
+Status Dispatcher::add(ThriftInternalRunnableRef task, TaskPriority priority) {
+  auto queued = submit([task](const Task&) { task->run(); }, priority);
+  if (queued == nullptr) {
+    return Status(1, "Cannot dispatch task, the dispatcher is stopping");
   }
   return Status(0, "OK");
 }
 
+TaskRef Dispatcher::submit(TaskWork work, TaskPriority priority) {
+  return instance().executor()->submit(std::move(work), priority);
+}
+
 Status Dispatcher::addService(InternalRunnableRef service) {
   if (service->hasRun()) {
     return Status(1, "Cannot schedule a service twice");
@@ -68,21 +101,29 @@ Status Dispatcher::addService(InternalRunnableRef service) {
   return Status(0, "OK");
 }
 
-InternalThreadManagerRef Dispatcher::getThreadManager() const {
-  return instance().thread_manager_;
+TaskExecutorRef Dispatcher::getExecutor() const {
+  return instance().executor();
 }
 
 void Dispatcher::join() {
   auto& self = instance();
-  if (self.thread_manager_ != nullptr) {
-    self.thread_manager_->stop();
-    self.thread_manager_->join();
+  TaskExecutorRef executor;
+  {
+    std::lock_guard<std::mutex> lock(self.executor_mutex_);
+    executor = self.executor_;
+  }
+  if (executor != nullptr) {
+    executor->join();
   }
 }
 
 void Dispatcher::joinServices() {
   for (auto& thread : instance().service_threads_) {
-    thread->join();
+    // A thread joining itself would wait forever.
+    if (thread->joinable() &&
+        thread->get_id() != boost::this_thread::get_id()) {
+      thread->join();
+    }
   }
 }
 
@@ -105,41 +146,22 @@ void Dispatcher::stopServices() {
   for (auto& thread : self.service_threads_) {
     thread->interrupt();
   }
-}
-
-InternalThreadManager::STATE Dispatcher::state() const {
-  return instance().thread_manager_->state();
-}
-
-void Dispatcher::addWorker(size_t value) {
-  instance().thread_manager_->addWorker(value);
-}
-
-void Dispatcher::removeWorker(size_t value) {
-  instance().thread_manager_->removeWorker(value);
+  wakeSleepers();
 }
 
 size_t Dispatcher::idleWorkerCount() const {
-  return instance().thread_manager_->idleWorkerCount();
+  return instance().executor()->idleWorkerCount();
 }
 
 size_t Dispatcher::workerCount() const {
-  return instance().thread_manager_->workerCount();
+  return instance().executor()->workerCount();
 }
 
 size_t Dispatcher::pendingTaskCount() const {
-  return instance().thread_manager_->pendingTaskCount();
+  return instance().executor()->pendingTaskCount();
 }
 
 size_t Dispatcher::totalTaskCount() const {
-  return instance().thread_manager_->totalTaskCount();
-}
-
-size_t Dispatcher::pendingTaskCountMax() const {
-  return instance().thread_manager_->pendingTaskCountMax();
-}
-
-size_t Dispatcher::expiredTaskCount() const {
-  return instance().thread_manager_->expiredTaskCount();
+  return instance().executor()->totalTaskCount();
 }
 }
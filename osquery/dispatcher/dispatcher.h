@@ -11,7 +11,9 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -21,6 +23,8 @@
 
 #include <osquery/core.h>
 
+#include "osquery/dispatcher/executor.h"
+
 // osquery is built with various versions of thrift that use different search
 // paths for their includes. Unfortunately, changing include paths is not
 // possible in every build system.
@@ -50,6 +54,7 @@ using namespace apache::thrift::concurrency;
 #define SHARED_PTR_IMPL OSQUERY_THRIFT_POINTER::shared_ptr
 using InternalThreadManager = apache::thrift::concurrency::ThreadManager;
 using InternalThreadManagerRef = SHARED_PTR_IMPL<InternalThreadManager>;
+using TaskExecutorRef = std::shared_ptr<TaskExecutor>;
 
 /**
  * @brief Default number of threads in the thread pool.
@@ -99,7 +104,9 @@ using ThriftThreadFactory = SHARED_PTR_IMPL<PosixThreadFactory>;
  *
  * Dispatcher is a singleton which can be used to coordinate the parallel
  * execution of asynchronous tasks across an application. Internally,
- * Dispatcher is back by the Apache Thrift thread pool.
+ * Dispatcher is backed by a work-stealing TaskExecutor shared by events, the
+ * schedule, and distributed queries. Long-running services use their own
+ * threads, see addService.
  */
 class Dispatcher : private boost::noncopyable {
  public:
@@ -139,81 +146,62 @@ class Dispatcher : private boost::noncopyable {
    *
    * @param task a C++11 std shared pointer to an instance of a class which
    * publicly inherits from `apache::thrift::concurrency::Runnable`.
+   * @param priority the order the task is started in, see TaskPriority.
    *
    * @return osquery success status
    */
-  static Status add(ThriftInternalRunnableRef task);
+  static Status add(ThriftInternalRunnableRef task,
+                    TaskPriority priority = TASK_PRIORITY_SCHEDULE);
+
+  /**
+   * @brief Submit work to the dispatcher's task executor.
+   *
+   * @param work the work, which may check the Task for cancellation.
+   * @param priority the order the task is started in, see TaskPriority.
+   * @return the queued task, or nullptr if the dispatcher is stopping.
+   */
+  static TaskRef submit(TaskWork work, TaskPriority priority);
 
   /// See `add`, but services are not limited to a thread poll size.
   static Status addService(InternalRunnableRef service);
 
   /**
-   * @brief Getter for the underlying thread manager instance.
-   *
-   * Use this getter if you'd like to perform some operations which the
-   * Dispatcher API doesn't support, but you are certain are supported by the
-   * backing Apache Thrift thread manager.
-   *
-   * Use this method with caution, as it only exists to allow developers to
-   * iterate quickly in the event that the pragmatic decision to access the
-   * underlying thread manager has been determined to be necessary.
+   * @brief Getter for the underlying task executor instance.
    *
    * @code{.cpp}
-   *   auto t = osquery::Dispatcher::getThreadManager();
+   *   auto executor = osquery::Dispatcher::instance().getExecutor();
    * @endcode
    *
-   * @return a shared pointer to the Apache Thrift `ThreadManager` instance
-   * which is currently being used to orchestrate multi-threaded operations.
+   * @return a shared pointer to the TaskExecutor running dispatched tasks.
    */
-  InternalThreadManagerRef getThreadManager() const;
+  TaskExecutorRef getExecutor() const;
 
   /**
-   * @brief Joins the thread manager.
+   * @brief Joins the task executor.
    *
-   * This is the same as stop, except that it will block until all the workers
-   * have finished their work. At that point the ThreadManager will transition
-   * into the STOPPED state.
+   * This will block until all the workers have finished the queued tasks.
+   * No more tasks are accepted afterward.
    */
   static void join();
 
-  /// See `join`, but applied to osquery services.
-  static void joinServices();
-
-  /// Destroy and stop all osquery service threads and service objects.
-  static void stopServices();
-
   /**
-   * @brief Get the current state of the thread manager.
+   * @brief See `join`, but applied to osquery services.
    *
-   * @return an Apache Thrift STATE enum.
+   * A service may shut down the process, which joins the services from that
+   * service's own thread. The calling thread is not joined.
    */
-  InternalThreadManager::STATE state() const;
+  static void joinServices();
 
-  /**
-   * @brief Add a worker thread.
-   *
-   * Use this method to add an additional thread to the thread pool.
-   *
-   * @param value is a size_t indicating how many additional worker threads
-   * should be added to the thread group. If not parameter is supplied, one
-   * worker thread is added.
-   *
-   * @see osquery::Dispatcher::removeWorker
-   */
-  static void addWorker(size_t value = 1);
+  /// Destroy and stop all osquery service threads and service objects.
+  static void stopServices();
 
   /**
-   * @brief Remove a worker thread.
-   *
-   * Use this method to remove a thread from the thread pool.
-   *
-   * @param value is a size_t indicating how many additional worker threads
-   * should be removed from the thread group. If not parameter is supplied,
-   * one worker thread is removed.
+   * @brief Wake every thread in interruptableSleep.
    *
-   * @see osquery::Dispatcher::addWorker
+   * A woken thread whose boost::thread was interrupted unwinds with
+   * boost::thread_interrupted, other threads return from the sleep early.
    */
-  static void removeWorker(size_t value = 1);
+  static void wakeSleepers();
 
   /**
    * @brief Gets the current number of idle worker threads.
@@ -243,21 +231,6 @@ class Dispatcher : private boost::noncopyable {
    */
   size_t totalTaskCount() const;
 
-  /**
-   * @brief Gets the maximum pending task count. 0 indicates no maximum.
-   *
-   * @return the maximum pending task count. 0 indicates no maximum.
-   */
-  size_t pendingTaskCountMax() const;
-
-  /**
-   * @brief Gets the number of tasks which have been expired without being
-   * run.
-   *
-   * @return he number of tasks which have been expired without being run.
-   */
-  size_t expiredTaskCount() const;
-
  private:
   /**
    * @brief Default constructor.
@@ -270,21 +243,19 @@ class Dispatcher : private boost::noncopyable {
   void operator=(Dispatcher const&);
   virtual ~Dispatcher();
 
-  /// Initialize the thread poll when the first dispatcher thread is needed.
-  void init();
+  /// Return the task executor, starting it when the first task is added.
+  TaskExecutorRef executor();
 
  private:
   /**
-   * @brief Internal shared pointer which references Thrift's thread manager
-   *
-   * All thread operations occur via Apache Thrift's ThreadManager class. This
-   * private member represents a shared pointer to an instantiation of that
-   * thread manager, which can be used to accomplish various threading
-   * objectives.
+   * @brief The work-stealing executor running dispatched tasks.
    *
-   * @see getThreadManager
+   * @see getExecutor
    */
-  InternalThreadManagerRef thread_manager_{nullptr};
+  TaskExecutorRef executor_{nullptr};
+
+  /// Protect starting the executor.
+  std::mutex executor_mutex_;
 
   /// The set of shared osquery service threads.
   std::vector<InternalThreadRef> service_threads_;
@@ -292,10 +263,28 @@ class Dispatcher : private boost::noncopyable {
   /// The set of shared osquery services.
   std::vector<InternalRunnableRef> services_;
 
+  /// Protect the sleepers' wake generation.
+  std::mutex sleep_mutex_;
+
+  /// Signaled when sleepers are woken.
+  std::condition_variable sleep_wake_;
+
+  /// Incremented each time sleepers are woken.
+  size_t sleep_generation_{0};
+
  private:
   friend class ExtensionsTest;
+  friend void interruptableSleep(size_t milli);
 };
 
-/// Allow a dispatched thread to wait while processing or to prevent thrashing.
+/**
+ * @brief Allow a dispatched thread to wait while processing or to prevent
+ * thrashing.
+ *
+ * The thread blocks on a condition variable until the deadline, without
+ * periodic wakeups, and is woken immediately when services stop. Sleeps of a
+ * second or more end on a shared boundary so concurrent services wake
+ * together.
+ */
 void interruptableSleep(size_t milli);
 }
@@ -20,20 +20,40 @@ FLAG(uint64,
      60,
      "Seconds between polling for new queries (default 60)")
 
+DECLARE_uint64(distributed_long_poll);
 DECLARE_bool(disable_distributed);
 DECLARE_string(distributed_plugin);
 
 void DistributedRunner::start() {
-  auto dist = Distributed();
-  while (true) {
-    dist.pullUpdates();
-    if (dist.getPendingQueryCount() > 0) {
-      dist.runQueries();
+  Distributed dist;
+  while (!stopping_) {
+    auto start = getUnixTime();
+    auto status = dist.pullUpdates();
+    auto pending = dist.getPendingQueryCount();
+    if (pending > 0) {
+      // Queries run with the lowest priority on the dispatcher's executor.
+      auto task = Dispatcher::submit(
+          [&dist](const Task&) { dist.runQueries(); },
+          TASK_PRIORITY_DISTRIBUTED);
+      if (task == nullptr) {
+        break;
+      }
+      task->wait();
     }
-    ::sleep(FLAGS_distributed_interval);
+
+    // A long poll returning queries or after waiting is followed by the next
+    // long poll. Servers answering immediately fall back to the interval.
+    if (FLAGS_distributed_long_poll > 0 && status.ok() &&
+        (pending > 0 || getUnixTime() > start)) {
+      boost::this_thread::interruption_point();
+      continue;
+    }
+    interruptableSleep(FLAGS_distributed_interval * 1000);
   }
 }
 
+void DistributedRunner::stop() { stopping_ = true; }
+
 Status startDistributed() {
   if (!FLAGS_disable_distributed && !FLAGS_distributed_plugin.empty() &&
       Registry::getActive("distributed") == FLAGS_distributed_plugin) {
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "osquery/dispatcher/dispatcher.h"
 
 namespace osquery {
@@ -23,6 +25,13 @@ class DistributedRunner : public InternalRunnable {
  public:
   /// The Dispatcher thread entry point.
   void start();
+
+  /// Stop polling, a long poll answered without waiting would not sleep.
+  void stop() override;
+
+ private:
+  /// Set when the service should stop polling.
+  std::atomic<bool> stopping_{false};
 };
 
 Status startDistributed();
@@ -0,0 +1,301 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/dispatcher/executor.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     table_threads,
+     4,
+     "Threads shared by filesystem walks and tables generating in parallel");
+
+/// The executor and index of the worker running on this thread, if any.
+static thread_local const void* kWorkerExecutor = nullptr;
+static thread_local size_t kWorkerIndex = 0;
+
+void Task::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this]() { return done_.load(); });
+}
+
+void Task::runOrWait() {
+  run();
+  wait();
+}
+
+void Task::drop() {
+  if (!started_.exchange(true)) {
+    finish();
+  }
+}
+
+void Task::run() {
+  if (started_.exchange(true)) {
+    // A worker or a waiter ran the task, or it was dropped.
+    return;
+  }
+  if (!cancelled_) {
+    try {
+      work_(*this);
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Dispatched task caused exception: " << e.what();
+    }
+  }
+  finish();
+}
+
+void Task::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+  }
+  finished_.notify_all();
+  // Release captured state, waiters only need the done state.
+  work_ = nullptr;
+}
+
+TaskExecutor::TaskExecutor(size_t workers, bool pin) {
+  workers = std::max<size_t>(workers, 1);
+  for (size_t i = 0; i < workers; i++) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+
+  // Start the threads after every deque exists, workers steal from peers.
+  for (size_t i = 0; i < workers; i++) {
+    workers_[i]->thread = std::thread(&TaskExecutor::work, this, i, pin);
+  }
+}
+
+TaskExecutor::~TaskExecutor() { stop(); }
+
+Status TaskExecutor::submit(const TaskRef& task) {
+  if (joining_ || stopping_) {
+    task->drop();
+    return Status(1, "Task executor is stopping");
+  }
+
+  if (kWorkerExecutor == this) {
+    // A worker queues follow-up work locally.
+    auto& worker = *workers_[kWorkerIndex];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks[task->priority()].push_back(task);
+    pending_++;
+  } else {
+    // Other threads queue in submission order.
+    std::lock_guard<std::mutex> lock(submitted_mutex_);
+    submitted_[task->priority()].push_back(task);
+    pending_++;
+  }
+
+  {
+    // Taking the lock orders the queue with a worker deciding to sleep.
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  ready_.notify_one();
+  return Status(0, "OK");
+}
+
+TaskRef TaskExecutor::submit(TaskWork work, TaskPriority priority) {
+  auto task = std::make_shared<Task>(std::move(work), priority);
+  if (!submit(task).ok()) {
+    return nullptr;
+  }
+  return task;
+}
+
+TaskRef TaskExecutor::take(size_t index) {
+  for (size_t priority = 0; priority < kTaskPriorities; priority++) {
+    // Prefer the newest local task, its data is most likely cached.
+    {
+      auto& worker = *workers_[index];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      auto& tasks = worker.tasks[priority];
+      if (!tasks.empty()) {
+        auto task = std::move(tasks.back());
+        tasks.pop_back();
+        running_++;
+        pending_--;
+        return task;
+      }
+    }
+
+    // Take the oldest task submitted by a non-worker thread.
+    {
+      std::lock_guard<std::mutex> lock(submitted_mutex_);
+      auto& tasks = submitted_[priority];
+      if (!tasks.empty()) {
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        running_++;
+        pending_--;
+        return task;
+      }
+    }
+
+    // Steal the oldest task of this priority from the other workers.
+    for (size_t i = 1; i < workers_.size(); i++) {
+      auto& victim = *workers_[(index + i) % workers_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      auto& tasks = victim.tasks[priority];
+      if (!tasks.empty()) {
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        running_++;
+        pending_--;
+        return task;
+      }
+    }
+  }
+  return nullptr;
+}
+
+void TaskExecutor::work(size_t index, bool pin) {
+  kWorkerExecutor = this;
+  kWorkerIndex = index;
+
+#ifdef __linux__
+  if (pin) {
+    auto cores = std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % cores, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      VLOG(1) << "Cannot pin task executor worker " << index;
+    }
+  }
+#endif
+
+  auto& worker = *workers_[index];
+  while (!stopping_) {
+    auto task = take(index);
+    if (task == nullptr) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stopping_ || (joining_ && pending_ == 0)) {
+        break;
+      }
+      if (pending_ == 0) {
+        idle_++;
+        ready_.wait(lock, [this]() {
+          return pending_ > 0 || stopping_ || joining_;
+        });
+        idle_--;
+      }
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.current = task;
+    }
+    task->run();
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.current = nullptr;
+    }
+    running_--;
+  }
+}
+
+void TaskExecutor::stop() {
+  stopping_ = true;
+  for (auto& worker : workers_) {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (auto& tasks : worker->tasks) {
+      for (auto& task : tasks) {
+        task->drop();
+      }
+      pending_ -= tasks.size();
+      tasks.clear();
+    }
+    if (worker->current != nullptr) {
+      worker->current->cancel();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(submitted_mutex_);
+    for (auto& tasks : submitted_) {
+      for (auto& task : tasks) {
+        task->drop();
+      }
+      pending_ -= tasks.size();
+      tasks.clear();
+    }
+  }
+  joinWorkers();
+}
+
+void TaskExecutor::join() {
+  joining_ = true;
+  joinWorkers();
+}
+
+void TaskExecutor::joinWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  ready_.notify_all();
+
+  std::lock_guard<std::mutex> lock(join_mutex_);
+  for (auto& worker : workers_) {
+    if (!worker->thread.joinable()) {
+      continue;
+    }
+    if (worker->thread.get_id() == std::this_thread::get_id()) {
+      // A task stopped its own executor, this worker exits after the task.
+      worker->thread.detach();
+    } else {
+      worker->thread.join();
+    }
+  }
+}
+
+TaskExecutor& getTableExecutor() {
+  static TaskExecutor executor(std::max<size_t>(FLAGS_table_threads, 1), false);
+  return executor;
+}
+
+void parallelFor(size_t count,
+                 size_t lanes,
+                 const std::function<void(size_t index)>& work) {
+  std::atomic<size_t> next{0};
+  auto lane = [&next, &work, count](const Task&) {
+    for (auto i = next++; i < count; i = next++) {
+      work(i);
+    }
+  };
+
+  std::vector<TaskRef> tasks;
+  lanes = std::min(std::max<size_t>(lanes, 1), count);
+  for (size_t i = 1; i < lanes; i++) {
+    auto task = getTableExecutor().submit(lane, TASK_PRIORITY_SCHEDULE);
+    if (task != nullptr) {
+      tasks.push_back(std::move(task));
+    }
+  }
+
+  // The calling thread is a lane, a stopping executor runs no other lanes.
+  Task self(lane, TASK_PRIORITY_SCHEDULE);
+  lane(self);
+  for (const auto& task : tasks) {
+    task->runOrWait();
+  }
+}
+}
@@ -0,0 +1,255 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief The order queued tasks are started in, lower values start first.
+ *
+ * Event callbacks are latency sensitive and delay publishers when their queues
+ * fill, scheduled queries have deadlines, and distributed queries are polled.
+ */
+enum TaskPriority {
+  TASK_PRIORITY_EVENTS = 0,
+  TASK_PRIORITY_SCHEDULE,
+  TASK_PRIORITY_DISTRIBUTED,
+};
+
+/// The number of TaskPriority levels.
+const size_t kTaskPriorities = 3;
+
+class Task;
+
+/// The work of a Task, which may check Task::isCancelled to stop early.
+using TaskWork = std::function<void(const Task& task)>;
+
+/**
+ * @brief A unit of work submitted to a TaskExecutor.
+ *
+ * Cancellation is cooperative: a queued task that is cancelled is never
+ * started, and a running task may check isCancelled and return early.
+ */
+class Task : private boost::noncopyable {
+ public:
+  Task(TaskWork work, TaskPriority priority)
+      : work_(std::move(work)), priority_(priority) {}
+
+  /// Request the task stop, or not start if it is still queued.
+  void cancel() { cancelled_ = true; }
+
+  /// Check if the task was asked to stop.
+  bool isCancelled() const { return cancelled_; }
+
+  /// Check if the task finished or was dropped without running.
+  bool isDone() const { return done_; }
+
+  /// Block until the task finished or was dropped without running.
+  void wait();
+
+  /**
+   * @brief Run the task on this thread unless a worker started it, then wait.
+   *
+   * A thread waiting for tasks of the executor it runs on, or of an executor
+   * whose workers are busy, does not wait for a worker to become free.
+   */
+  void runOrWait();
+
+  /// The priority the task was submitted with.
+  TaskPriority priority() const { return priority_; }
+
+ private:
+  /// Run the work unless cancelled or already started, then mark it done.
+  void run();
+
+  /// Mark the task done and wake any waiters.
+  void finish();
+
+  /// Mark a task that has not started done, it is never run.
+  void drop();
+
+ private:
+  /// The work to run.
+  TaskWork work_;
+
+  /// See TaskPriority.
+  TaskPriority priority_{TASK_PRIORITY_SCHEDULE};
+
+  /// Set when the task should stop or not start.
+  std::atomic<bool> cancelled_{false};
+
+  /// Set when the task finished or was dropped.
+  std::atomic<bool> done_{false};
+
+  /// Set when a worker or a waiter starts the task.
+  std::atomic<bool> started_{false};
+
+  /// Protect waiting on done_.
+  std::mutex mutex_;
+
+  /// Signaled when the task is done.
+  std::condition_variable finished_;
+
+ private:
+  friend class TaskExecutor;
+};
+
+using TaskRef = std::shared_ptr<Task>;
+
+/**
+ * @brief A fixed-size, work-stealing pool of worker threads.
+ *
+ * Each worker owns a deque per TaskPriority. Tasks submitted from a worker are
+ * queued on that worker's deques and taken newest-first, which keeps related
+ * work on a warm core. Tasks submitted from other threads are queued on shared
+ * deques and taken oldest-first, so they start in submission order. A worker
+ * without local tasks of a priority takes a submitted task, or steals the
+ * oldest task of that priority from the other workers, before sleeping. A
+ * worker never starts a lower priority task while a higher priority task is
+ * queued anywhere.
+ */
+class TaskExecutor : private boost::noncopyable {
+ public:
+  /**
+   * @brief Start the workers.
+   *
+   * @param workers The number of worker threads, at least one.
+   * @param pin Pin each worker to a CPU core, where supported.
+   */
+  TaskExecutor(size_t workers, bool pin);
+  ~TaskExecutor();
+
+  /**
+   * @brief Queue a task for the workers.
+   *
+   * @param task The task, it is dropped and marked done if it cannot queue.
+   * @return Failure if the executor is stopping.
+   */
+  Status submit(const TaskRef& task);
+
+  /// See submit, create a task from the work and priority.
+  TaskRef submit(TaskWork work, TaskPriority priority);
+
+  /// Drop the queued tasks, cancel the running tasks, and join the workers.
+  void stop();
+
+  /// Finish every queued task, then join the workers.
+  void join();
+
+  /// The number of worker threads.
+  size_t workerCount() const { return workers_.size(); }
+
+  /// The number of workers waiting for a task.
+  size_t idleWorkerCount() const { return idle_; }
+
+  /// The number of queued tasks.
+  size_t pendingTaskCount() const { return pending_; }
+
+  /// The number of queued and running tasks.
+  size_t totalTaskCount() const { return pending_ + running_; }
+
+ private:
+  /// Queued tasks owned by a worker thread.
+  struct Worker {
+    /// A deque for each TaskPriority.
+    std::deque<TaskRef> tasks[kTaskPriorities];
+
+    /// Protect the deques, the owner and thieves lock the same mutex.
+    std::mutex mutex;
+
+    /// The task this worker is running, for cancellation on stop.
+    TaskRef current;
+
+    std::thread thread;
+  };
+
+  /// The worker thread entrypoint.
+  void work(size_t index, bool pin);
+
+  /// Take the next task for a worker, its own or a stolen task.
+  TaskRef take(size_t index);
+
+  /// Join the worker threads once, called by stop and join.
+  void joinWorkers();
+
+ private:
+  /// The workers and their deques.
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  /// Tasks submitted by non-worker threads, a deque for each TaskPriority.
+  std::deque<TaskRef> submitted_[kTaskPriorities];
+
+  /// Protect the submitted task deques.
+  std::mutex submitted_mutex_;
+
+  /// The number of queued tasks.
+  std::atomic<size_t> pending_{0};
+
+  /// The number of running tasks.
+  std::atomic<size_t> running_{0};
+
+  /// The number of workers waiting for a task.
+  std::atomic<size_t> idle_{0};
+
+  /// No more tasks are accepted, workers exit once the queues are empty.
+  std::atomic<bool> joining_{false};
+
+  /// Queued tasks are dropped, workers exit.
+  std::atomic<bool> stopping_{false};
+
+  /// Protect sleeping workers.
+  std::mutex mutex_;
+
+  /// Signaled when a task is queued or the executor stops.
+  std::condition_variable ready_;
+
+  /// Serialize joining the worker threads.
+  std::mutex join_mutex_;
+};
+/**
+ * @brief The workers shared by parallel filesystem and table work.
+ *
+ * Filesystem walks, batched file reads, and tables splitting their items into
+ * chunks, such as `magic` and `process_memory_map`, submit to one executor of
+ * `table_threads` workers. The thread count flag of each feature limits how
+ * much of the executor one walk or query uses. Waiters use Task::runOrWait,
+ * work submitted from a worker of this executor cannot starve it.
+ */
+TaskExecutor& getTableExecutor();
+
+/**
+ * @brief Run work for each index below count on the table executor.
+ *
+ * At most lanes tasks run at once, the calling thread is one of them. Each
+ * lane runs the next index not yet taken, so uneven items balance across the
+ * lanes. Returns once the work for every index returned.
+ *
+ * @param count The number of items.
+ * @param lanes The most items run at once, such as a table's thread flag.
+ * @param work The work for one item, by index.
+ */
+void parallelFor(size_t count,
+                 size_t lanes,
+                 const std::function<void(size_t index)>& work);
+}
@@ -8,86 +8,534 @@
  *
  */
 
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
 #include <ctime>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
+#include <osquery/events.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/governor.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/tracing.h"
 #include "osquery/database/query.h"
+#include "osquery/database/view.h"
 #include "osquery/dispatcher/scheduler.h"
 #include "osquery/sql/sqlite_util.h"
 
 namespace osquery {
 
-FLAG(bool, enable_monitor, false, "Enable the schedule monitor");
+DECLARE_bool(events_optimize);
+
+FLAG(bool, enable_monitor, true, "Enable the schedule monitor");
 
 FLAG(uint64, schedule_timeout, 0, "Limit the schedule, 0 for no limit")
 
-inline SQL monitor(const std::string& name, const ScheduledQuery& query) {
+FLAG(uint64,
+     schedule_workers,
+     4,
+     "Number of scheduled queries executing in parallel");
+
+FLAG(uint64,
+     schedule_queue,
+     64,
+     "Maximum number of due scheduled queries waiting for a worker");
+
+FLAG(bool,
+     schedule_adaptive_splay,
+     false,
+     "Place scheduled queries to spread their measured cost over time");
+
+FLAG(uint64,
+     schedule_deadline,
+     0,
+     "Interrupt scheduled queries running longer than N seconds, 0 for none");
+
+FLAG(uint64,
+     schedule_max_cpu_time,
+     0,
+     "Interrupt scheduled queries using more than N ms of CPU, 0 for none");
+
+FLAG(uint64,
+     memory_purge_interval,
+     300,
+     "Return freed memory to the system when idle at most every N seconds");
+
+FLAG(uint64,
+     schedule_max_memory,
+     0,
+     "Interrupt scheduled queries growing memory by N MB, 0 for none");
+
+FLAG(uint64,
+     schedule_max_rows,
+     0,
+     "Discard scheduled query results with more than N rows, 0 for none");
+
+/// Placement considers the schedule executions within this many seconds.
+static const size_t kPlacementHorizon = 3600;
+
+/// Check for changed query costs every 60 schedule steps.
+static const size_t kBalanceSteps = 60;
+
+/// A query is placed again when its cost changes by at least half.
+static const double kBalanceChange = 0.5;
+
+/// The time of a snapshot query's last complete results is persisted here.
+static const std::string kSnapshotTimePrefix = "snapshot.";
+
+/// Queries without a measured cost are placed with this normalized weight.
+static const double kPlacementMinWeight = 0.01;
+
+/// Check a query's budget every 10000 SQLite virtual machine instructions.
+static const int kBudgetInstructions = 10000;
+
+/// A query's resources are sampled at most every 50 milliseconds.
+static const std::chrono::milliseconds kBudgetSampleInterval(50);
+
+/// A query exceeding its budget is backed off up to 16 times its interval.
+static const size_t kMaxBackoff = 16;
+
+/// The database is compacted when no query is due within 10 schedule steps.
+static const size_t kCompactIdleSteps = 10;
+
+/// Set while a compaction task runs, at most one is submitted at a time.
+static std::atomic<bool> kCompacting{false};
+
+/// The schedule step freed memory was last returned to the system.
+static size_t kLastPurge{0};
+
+/// CPU time of the calling thread and memory of the process.
+struct ResourceSample {
+  /// User and system CPU time in milliseconds.
+  unsigned long long int user_time{0};
+  unsigned long long int system_time{0};
+
+  /// Resident memory size in bytes.
+  unsigned long long int resident_size{0};
+};
+
+inline unsigned long long int timevalToMilli(const struct timeval& tv) {
+  return static_cast<unsigned long long int>(tv.tv_sec) * 1000 +
+         tv.tv_usec / 1000;
+}
+
+/**
+ * @brief Sample the resources used by the calling thread.
+ *
+ * Scheduled queries run on their own worker threads, so the thread CPU time
+ * is exactly the time spent executing a query. This avoids querying the
+ * processes table before and after each query.
+ */
+inline void sampleResources(ResourceSample& sample) {
+#ifdef __APPLE__
+  mach_port_t thread = mach_thread_self();
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  if (thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count) ==
+      KERN_SUCCESS) {
+    sample.user_time = info.user_time.seconds * 1000ULL +
+                       info.user_time.microseconds / 1000;
+    sample.system_time = info.system_time.seconds * 1000ULL +
+                         info.system_time.microseconds / 1000;
+  }
+  mach_port_deallocate(mach_task_self(), thread);
+
+  mach_task_basic_info_data_t task;
+  count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(),
+                MACH_TASK_BASIC_INFO,
+                (task_info_t)&task,
+                &count) == KERN_SUCCESS) {
+    sample.resident_size = task.resident_size;
+  }
+#else
+  struct rusage usage;
+#if defined(RUSAGE_THREAD)
+  int who = RUSAGE_THREAD;
+#else
+  int who = RUSAGE_SELF;
+#endif
+  if (getrusage(who, &usage) == 0) {
+    sample.user_time = timevalToMilli(usage.ru_utime);
+    sample.system_time = timevalToMilli(usage.ru_stime);
+  }
+
+#ifdef __linux__
+  // The second field of statm is the resident size in pages.
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm != nullptr) {
+    unsigned long long int size = 0, resident = 0;
+    if (fscanf(statm, "%llu %llu", &size, &resident) == 2) {
+      sample.resident_size = resident * sysconf(_SC_PAGESIZE);
+    }
+    fclose(statm);
+  }
+#else
+  // Without a resident size use the high-water mark, in kilobytes.
+  sample.resident_size = usage.ru_maxrss * 1024ULL;
+#endif
+#endif
+}
+
+/// A query's own limit, or the schedule's limit if the query has none.
+inline size_t getQueryLimit(size_t limit, size_t schedule_limit) {
+  return (limit > 0) ? limit : schedule_limit;
+}
+
+/// Resource budgets applied to a single scheduled query execution.
+struct QueryBudget {
+  explicit QueryBudget(const ScheduledQuery& query)
+      : max_cpu_time(
+            getQueryLimit(query.max_cpu_time, FLAGS_schedule_max_cpu_time)),
+        max_memory(getQueryLimit(query.max_memory, FLAGS_schedule_max_memory)),
+        deadline(getQueryLimit(query.deadline, FLAGS_schedule_deadline)),
+        max_rows(getQueryLimit(query.max_rows, FLAGS_schedule_max_rows)) {}
+
+  /// The query's limits, 0 for none.
+  size_t max_cpu_time{0};
+  size_t max_memory{0};
+  size_t deadline{0};
+  size_t max_rows{0};
+
+  /// Resources used by the worker thread when the query started.
+  ResourceSample start;
+
+  /// Time the query started.
+  size_t started{0};
+
+  /// The resources are sampled again after this time.
+  std::chrono::steady_clock::time_point next_sample;
+
+  /// Name of the first exceeded budget, empty while within budget.
+  std::string exceeded;
+
+  /// Check if this budget has any limits enforced while the query runs.
+  bool limited() const {
+    return max_cpu_time > 0 || max_memory > 0 || deadline > 0;
+  }
+};
+
+/**
+ * @brief SQLite progress handler enforcing a query's budget.
+ *
+ * Returning non-zero interrupts the query. The thread's CPU time and the
+ * process memory are sampled at most every kBudgetSampleInterval. Time spent
+ * generating a virtual table does not call the handler, the scheduler's
+ * deadline interrupts those.
+ */
+static int budgetProgressHandler(void* argument) {
+  auto& budget = *static_cast<QueryBudget*>(argument);
+  auto now = std::chrono::steady_clock::now();
+  if (now < budget.next_sample) {
+    return 0;
+  }
+  budget.next_sample = now + kBudgetSampleInterval;
+
+  ResourceSample sample;
+  sampleResources(sample);
+  auto cpu = (sample.user_time + sample.system_time) -
+             (budget.start.user_time + budget.start.system_time);
+  if (budget.max_cpu_time > 0 && cpu > budget.max_cpu_time) {
+    budget.exceeded = "CPU time";
+  } else if (budget.max_memory > 0 &&
+             sample.resident_size >
+                 budget.start.resident_size + budget.max_memory * 1024 * 1024) {
+    budget.exceeded = "memory";
+  } else if (budget.deadline > 0 &&
+             getUnixTime() > budget.started + budget.deadline) {
+    budget.exceeded = "wall time";
+  }
+  return (budget.exceeded.empty()) ? 0 : 1;
+}
+
+inline SQL monitor(const std::string& name,
+                   const ScheduledQuery& query,
+                   sqlite3* db) {
   // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(getpid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
+  ResourceSample r0;
+  sampleResources(r0);
   auto t0 = getUnixTime();
+  auto start = std::chrono::steady_clock::now();
   Config::getInstance().recordQueryStart(name);
-  auto sql = SQLInternal(query.query);
+  auto sql = SQLInternal(query.query, db);
   // Snapshot the performance after, and compare.
   auto t1 = getUnixTime();
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
-    // Calculate a size as the expected byte output of results.
-    // This does not dedup result differentials and is not aware of snapshots.
-    size_t size = 0;
-    for (const auto& row : sql.rows()) {
-      for (const auto& column : row) {
-        size += column.first.size();
-        size += column.second.size();
-      }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ResourceSample r1;
+  sampleResources(r1);
+
+  // Calculate a size as the expected byte output of results.
+  // This does not dedup result differentials and is not aware of snapshots.
+  QueryPerformance perf;
+  for (const auto& row : sql.rows()) {
+    for (const auto& column : row) {
+      perf.output_size += column.first.size();
+      perf.output_size += column.second.size();
     }
-    // Always called while processes table is working.
-    Config::getInstance().recordQueryPerformance(
-        name, t1 - t0, size, r0[0], r1[0]);
   }
+  perf.output_rows = sql.rows().size();
+  perf.wall_time = t1 - t0;
+  perf.wall_time_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+  perf.user_time = (r1.user_time > r0.user_time) ? r1.user_time - r0.user_time
+                                                 : 0;
+  perf.system_time = (r1.system_time > r0.system_time)
+                         ? r1.system_time - r0.system_time
+                         : 0;
+  perf.average_memory = (r1.resident_size > r0.resident_size)
+                            ? r1.resident_size - r0.resident_size
+                            : 0;
+  Config::getInstance().recordQueryPerformance(name, perf);
   return sql;
 }
 
-inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
+SQL monitor(const std::string& name, const ScheduledQuery& query) {
+  auto dbc = SQLiteDBManager::get();
+  return monitor(name, query, dbc->db());
+}
+
+/// The aggregate rows of an incremental view, used as a query's results.
+class ViewSQL : public SQL {
+ public:
+  explicit ViewSQL(QueryData rows) { results_ = std::move(rows); }
+};
+
+/// Build the decorations of a schedule step, once its first query is due.
+static std::shared_ptr<const ScheduleContext> makeScheduleContext(
+    size_t step) {
+  auto context = std::make_shared<ScheduleContext>();
+  context->identifier = getHostIdentifier();
+  context->time = step;
+  context->calendar_time = getAsciiTime(step);
+  return context;
+}
+
+/**
+ * @brief Log the results of a snapshot query with a full_interval.
+ *
+ * Complete results are logged once every full_interval seconds. In between
+ * the results are stored like those of a differential query and only the
+ * added and removed rows are logged, nothing if the results did not change.
+ * Every item includes the fingerprint of the complete results so a receiver
+ * can verify the state it reconstructs. If an item cannot be logged the next
+ * run logs complete results.
+ */
+static void logSnapshotDelta(const std::string& name,
+                             const ScheduledQuery& query,
+                             QueryData rows,
+                             QueryLogItem& item) {
+  auto key = kSnapshotTimePrefix + name;
+  std::string content;
+  long long last_full = 0;
+  getDatabaseValue(kPersistentSettings, key, content);
+  if (content.empty() || !parseDecimal(content, last_full)) {
+    last_full = 0;
+  }
+
+  auto now = static_cast<long long>(item.time);
+  bool full = (last_full == 0 || now < last_full ||
+               now - last_full >= static_cast<long long>(query.full_interval));
+
+  auto dbQuery = Query(name, query);
+  DiffResults diff_results;
+  auto status = (full) ? dbQuery.addNewResults(rows)
+                       : dbQuery.addNewResults(rows, diff_results);
+  if (!status.ok()) {
+    LOG(ERROR) << "Error adding new results to database: " << status.what();
+    return;
+  }
+
+  char hash[17] = {0};
+  snprintf(hash,
+           sizeof(hash),
+           "%016llx",
+           static_cast<unsigned long long>(getQueryDataFingerprint(rows)));
+  item.snapshot_hash = hash;
+  if (full) {
+    item.snapshot_results = std::move(rows);
+  } else if (diff_results.added.empty() && diff_results.removed.empty()) {
+    return;
+  } else {
+    item.results = std::move(diff_results);
+  }
+
+  status = logSnapshotQuery(item);
+  if (!status.ok()) {
+    LOG(ERROR) << "Error logging the results of query (" << query.query
+               << "): " << status.toString();
+    deleteDatabaseValue(kPersistentSettings, key);
+  } else if (full) {
+    setDatabaseValue(kPersistentSettings, key, std::to_string(now));
+  }
+}
+
+bool isAppendOnly(const ScheduledQuery& query, sqlite3* db) {
+  if (query.options.count("append")) {
+    return query.options.at("append");
+  }
+  if (!FLAGS_events_optimize) {
+    return false;
+  }
+
+  // Planning is cached by query, a query's tables do not change.
+  static std::map<std::string, bool> append_queries;
+  static std::mutex append_mutex;
+  {
+    std::lock_guard<std::mutex> lock(append_mutex);
+    auto cached = append_queries.find(query.query);
+    if (cached != append_queries.end()) {
+      return cached->second;
+    }
+  }
+
+  // An aggregate is computed over every event it selects, not only new ones.
+  std::vector<TableScan> scans;
+  QueryPlanner planner(query.query, db);
+  if (!planner.getScans(scans).ok() || planner.hasAggregate()) {
+    return false;
+  }
+  bool append = !scans.empty();
+  for (const auto& scan : scans) {
+    // An explicit time constraint replaces the optimized time range, each
+    // execution may select events already logged.
+    if (!EventFactory::exists(scan.table) || scan.columns.count("time") > 0) {
+      append = false;
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(append_mutex);
+  append_queries[query.query] = append;
+  return append;
+}
+
+/**
+ * @brief Execute a scheduled query and log its results.
+ *
+ * @return false if the query exceeded its budget.
+ */
+bool launchQuery(const std::string& name,
+                 const ScheduledQuery& query,
+                 const ScheduleContext& context,
+                 sqlite3* db) {
+  TRACE_SCOPE_DETAIL("scheduler.launchQuery", name);
+  // Enforce the budgets cooperatively, within this worker.
+  QueryBudget budget(query);
+  if (budget.limited()) {
+    sampleResources(budget.start);
+    budget.started = getUnixTime();
+    budget.next_sample = std::chrono::steady_clock::now();
+    sqlite3_progress_handler(
+        db, kBudgetInstructions, budgetProgressHandler, &budget);
+  }
+
+  // An incremental view executes the query over the rows since its last run.
+  std::unique_ptr<IncrementalView> view;
+  if (query.options.count("incremental") && query.options.at("incremental")) {
+    view.reset(new IncrementalView(name, query));
+    if (!view->valid()) {
+      LOG(WARNING) << "Scheduled query (" << name
+                   << ") is not a supported incremental aggregate";
+      view.reset();
+    }
+  }
+
+  ScheduledQuery delta;
+  const auto* executed = &query;
+  if (view != nullptr) {
+    delta = query;
+    delta.query = view->deltaQuery(view->watermark(), context.time);
+    executed = &delta;
+  }
+
   // Execute the scheduled query and create a named query object.
-  VLOG(1) << "Executing query: " << query.query;
-  auto sql =
-      (FLAGS_enable_monitor) ? monitor(name, query) : SQLInternal(query.query);
+  VLOG(1) << "Executing query: " << executed->query;
+  auto sql = (FLAGS_enable_monitor) ? monitor(name, *executed, db)
+                                    : SQLInternal(executed->query, db);
+  sqlite3_progress_handler(db, 0, nullptr, nullptr);
+
+  if (budget.exceeded.empty() && budget.max_rows > 0 &&
+      sql.rows().size() > budget.max_rows) {
+    budget.exceeded = "row count";
+  }
+
+  if (!budget.exceeded.empty()) {
+    LOG(WARNING) << "Scheduled query (" << name << ") exceeded its "
+                 << budget.exceeded << " budget";
+    return false;
+  }
 
   if (!sql.ok()) {
-    LOG(ERROR) << "Error executing query (" << query.query
+    LOG(ERROR) << "Error executing query (" << executed->query
                << "): " << sql.getMessageString();
-    return;
+    return true;
   }
 
-  // Fill in a host identifier fields based on configuration or availability.
-  std::string ident = getHostIdentifier();
+  if (view != nullptr) {
+    // The view's aggregate replaces the results of the new rows.
+    QueryData rows;
+    auto status = view->update(sql.rows(), context.time, rows);
+    if (!status.ok()) {
+      LOG(ERROR) << "Error updating the incremental view of query (" << name
+                 << "): " << status.getMessage();
+      return true;
+    }
+    sql = ViewSQL(std::move(rows));
+  }
 
   // A query log item contains an optional set of differential results or
   // a copy of the most-recent execution alongside some query metadata.
+  // The host identifier and times are shared by the queries of the step.
   QueryLogItem item;
   item.name = name;
-  item.identifier = ident;
-  item.time = osquery::getUnixTime();
-  item.calendar_time = osquery::getAsciiTime();
+  item.identifier = context.identifier;
+  item.time = context.time;
+  item.calendar_time = context.calendar_time;
 
   if (query.options.count("snapshot") && query.options.at("snapshot")) {
     // This is a snapshot query, emit results with a differential or state.
+    if (query.full_interval > 0) {
+      logSnapshotDelta(name, query, sql.rows(), item);
+      return true;
+    }
     item.snapshot_results = std::move(sql.rows());
     logSnapshotQuery(item);
-    return;
+    return true;
   }
 
-  // Create a database-backed set of query results.
-  auto dbQuery = Query(name, query);
   // Comparisons and stores must include escaped data.
   sql.escapeResults();
 
+  if (view == nullptr && isAppendOnly(query, db)) {
+    // Event rows are only returned once, there is nothing to compare.
+    if (sql.rows().empty()) {
+      return true;
+    }
+    item.results.added = sql.rows();
+    auto status = logQueryLogItem(item);
+    if (!status.ok()) {
+      LOG(ERROR) << "Error logging the results of query (" << query.query
+                 << "): " << status.toString();
+    }
+    return true;
+  }
+
+  // Create a database-backed set of query results.
+  auto dbQuery = Query(name, query);
+
   DiffResults diff_results;
   // Add this execution's set of results to the database-tracked named query.
   // We can then ask for a differential from the last time this named query
@@ -95,15 +543,16 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   auto status = dbQuery.addNewResults(sql.rows(), diff_results);
   if (!status.ok()) {
     LOG(ERROR) << "Error adding new results to database: " << status.what();
-    return;
+    return true;
   }
 
   if (diff_results.added.size() == 0 && diff_results.removed.size() == 0) {
     // No diff results or events to emit.
-    return;
+    return true;
   }
 
-  VLOG(1) << "Found results for query (" << name << ") for host: " << ident;
+  VLOG(1) << "Found results for query (" << name
+          << ") for host: " << item.identifier;
   item.results = diff_results;
   if (query.options.count("removed") && !query.options.at("removed")) {
     item.results.removed.clear();
@@ -114,23 +563,454 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
     LOG(ERROR) << "Error logging the results of query (" << query.query
                << "): " << status.toString();
   }
+  return true;
+}
+
+void SchedulerRunner::runQuery(const PendingQuery& pending,
+                               const Task& task) {
+  if (!task.isCancelled()) {
+    // Each query holds its connection exclusively so it can be interrupted.
+    MemoryArenaScope arena(ARENA_SQL);
+    auto dbc = SQLiteDBManager::get();
+    beginQuery(pending.name, pending.query, dbc->db());
+    TablePlugin::kCacheInterval = pending.query.splayed_interval;
+    TablePlugin::kCacheStep = pending.step;
+    TablePlugin::kQueryName = pending.name;
+    ScopedGovernor governor(pending.query.priority, pending.query.read_rate);
+    setQuerySampleRate(pending.query.sample_rate);
+    auto within_budget =
+        launchQuery(pending.name, pending.query, *pending.context, dbc->db());
+    setQuerySampleRate(1.0);
+    TablePlugin::kQueryName.clear();
+    endQuery(pending.name, within_budget);
+  } else {
+    std::lock_guard<std::mutex> lock(running_mutex_);
+    running_.erase(pending.name);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(running_mutex_);
+    tasks_.erase(pending.name);
+  }
+  finished_.notify_all();
+  launch();
+}
+
+void SchedulerRunner::launch() {
+  std::lock_guard<std::mutex> lock(running_mutex_);
+  // Leave an executor worker for event callbacks and distributed queries.
+  auto workers = std::max<size_t>(FLAGS_schedule_workers, 1);
+  auto executor_workers = Dispatcher::instance().workerCount();
+  if (executor_workers > 1) {
+    workers = std::min(workers, executor_workers - 1);
+  }
+  while (!stopping_ && !pending_.empty() && tasks_.size() < workers) {
+    auto pending = std::move(pending_.front());
+    pending_.pop_front();
+    auto name = pending.name;
+    auto task = Dispatcher::submit(
+        [this, pending](const Task& task) { runQuery(pending, task); },
+        TASK_PRIORITY_SCHEDULE);
+    if (task == nullptr) {
+      LOG(WARNING) << "Cannot dispatch query (" << name
+                   << "): the dispatcher is stopping";
+      running_.erase(name);
+      continue;
+    }
+    tasks_[name] = task;
+  }
+}
+
+void SchedulerRunner::beginQuery(const std::string& name,
+                                 const ScheduledQuery& query,
+                                 sqlite3* db) {
+  // The deadline starts when a worker begins, not when the query was due.
+  auto now = osquery::getUnixTime();
+  auto deadline = getQueryLimit(query.deadline, FLAGS_schedule_deadline);
+  std::lock_guard<std::mutex> lock(running_mutex_);
+  auto& running = running_[name];
+  running.started = now;
+  running.deadline = (deadline > 0) ? now + deadline : 0;
+  running.db = db;
+}
+
+void SchedulerRunner::endQuery(const std::string& name, bool within_budget) {
+  std::lock_guard<std::mutex> lock(running_mutex_);
+  if (running_.count(name) > 0 && running_.at(name).interrupted) {
+    within_budget = false;
+  }
+  running_.erase(name);
+
+  // Back off the interval of a query exceeding its budget, and recover it
+  // while the query stays within budget.
+  auto& backoff = backoff_[name];
+  auto previous = std::max<size_t>(backoff, 1);
+  if (!within_budget) {
+    backoff = std::min(std::max<size_t>(backoff, 1) * 2, kMaxBackoff);
+    LOG(WARNING) << "Backing off scheduled query (" << name << ") to "
+                 << backoff << " times its interval";
+  } else if (backoff > 1) {
+    backoff /= 2;
+  }
+  if (std::max<size_t>(backoff, 1) != previous) {
+    // The query is due again at its new interval.
+    reindex_ = true;
+  }
+  if (backoff <= 1) {
+    backoff_.erase(name);
+  }
+}
+
+size_t getNextDueStep(size_t step, size_t interval, size_t offset) {
+  return ((step - offset) / interval + 1) * interval + offset;
+}
+
+size_t SchedulerRunner::getInterval(const ScheduleEntry& entry) {
+  std::lock_guard<std::mutex> lock(running_mutex_);
+  auto backoff = backoff_.find(entry.name);
+  return entry.query.splayed_interval *
+         ((backoff != backoff_.end()) ? backoff->second : 1);
+}
+
+size_t SchedulerRunner::getOffset(const ScheduleEntry& entry) const {
+  // A query spread across hosts keeps its offset, placement is per host.
+  const auto& options = entry.query.options;
+  if (options.count("spread") && options.at("spread")) {
+    return entry.query.offset;
+  }
+  auto offset = splay_.find(entry.name);
+  return (offset != splay_.end()) ? offset->second : 0;
+}
+
+void SchedulerRunner::index(size_t last) {
+  auto& config = Config::getInstance();
+  auto generation = config.getScheduleGeneration();
+  if (!compiled_ || generation != generation_) {
+    schedule_.clear();
+    config.compileSchedule(schedule_);
+    generation_ = generation;
+    compiled_ = true;
+    reindex_ = true;
+  }
+
+  if (!reindex_.exchange(false)) {
+    return;
+  }
+  due_ = decltype(due_)();
+  for (size_t i = 0; i < schedule_.size(); i++) {
+    auto interval = getInterval(schedule_[i]);
+    if (interval > 0) {
+      due_.push(std::make_pair(
+          getNextDueStep(last, interval, getOffset(schedule_[i])), i));
+    }
+  }
+}
+
+void SchedulerRunner::dispatch(size_t last, size_t step) {
+  index(last);
+
+  // Only the queries due within the steps are visited, in schedule order.
+  auto& config = Config::getInstance();
+  bool discovered = false;
+  std::shared_ptr<const ScheduleContext> context;
+  while (!due_.empty() && due_.top().first <= step) {
+    const auto& entry = schedule_[due_.top().second];
+    due_.push(std::make_pair(
+        getNextDueStep(step, getInterval(entry), getOffset(entry)),
+        due_.top().second));
+    due_.pop();
+
+    // Discovery runs once per step, when the step has a due query.
+    if (!discovered) {
+      config.refreshDiscovery();
+      discovered = true;
+    }
+    if (!config.isScheduled(entry)) {
+      continue;
+    }
+
+    const auto& name = entry.name;
+    std::lock_guard<std::mutex> lock(running_mutex_);
+    if (stopping_) {
+      break;
+    }
+    if (running_.count(name) > 0) {
+      VLOG(1) << "Skipping query (" << name << "), still running since "
+              << running_.at(name).started;
+      continue;
+    }
+    if (FLAGS_schedule_queue > 0 && pending_.size() >= FLAGS_schedule_queue) {
+      LOG(WARNING) << "Cannot dispatch query (" << name
+                   << "): too many queries are waiting for a worker";
+      continue;
+    }
+    // Reserve the query, the worker fills in its connection.
+    running_[name].started = step;
+    PendingQuery pending;
+    pending.name = name;
+    pending.query = entry.query;
+    pending.step = step;
+    if (context == nullptr) {
+      context = makeScheduleContext(step);
+    }
+    pending.context = context;
+    pending_.push_back(std::move(pending));
+  }
+  launch();
+}
+
+void SchedulerRunner::interrupt(size_t step) {
+  std::lock_guard<std::mutex> lock(running_mutex_);
+  for (auto& running : running_) {
+    if (running.second.db != nullptr && running.second.deadline > 0 &&
+        step >= running.second.deadline) {
+      LOG(WARNING) << "Interrupting query (" << running.first
+                   << ") after its deadline";
+      running.second.interrupted = true;
+      sqlite3_interrupt(running.second.db);
+    }
+  }
+}
+
+void placeQueries(std::map<std::string, QueryPlacement>& queries) {
+  // Order the queries by cost, normalized by the most expensive.
+  double max_cpu = 0;
+  double max_memory = 0;
+  size_t horizon = 1;
+  for (const auto& query : queries) {
+    max_cpu = std::max(max_cpu, query.second.cpu);
+    max_memory = std::max(max_memory, query.second.memory);
+    horizon = std::max(horizon, query.second.interval);
+  }
+  horizon = std::min(horizon, kPlacementHorizon);
+
+  std::vector<std::pair<double, std::string> > order;
+  for (const auto& query : queries) {
+    double cpu = (max_cpu > 0) ? query.second.cpu / max_cpu : 0;
+    double memory = (max_memory > 0) ? query.second.memory / max_memory : 0;
+    order.push_back(std::make_pair(cpu + memory, query.first));
+  }
+  std::sort(order.rbegin(), order.rend());
+
+  // The accumulated, normalized cost of each second within the horizon.
+  std::vector<double> cpu_load(horizon, 0);
+  std::vector<double> memory_load(horizon, 0);
+  for (const auto& item : order) {
+    auto& query = queries.at(item.second);
+    auto interval = std::max<size_t>(query.interval, 1);
+    double cpu = (max_cpu > 0) ? query.cpu / max_cpu : 0;
+    double memory = (max_memory > 0) ? query.memory / max_memory : 0;
+    if (cpu + memory < kPlacementMinWeight) {
+      cpu = kPlacementMinWeight;
+    }
+
+    // Score each offset by the peaks of the seconds the query would run in.
+    // Ties prefer the least total load, so equal costs spread by count.
+    double best_peak = 0;
+    double best_total = 0;
+    size_t best_offset = 0;
+    for (size_t offset = 0; offset < std::min(interval, horizon); offset++) {
+      double cpu_peak = 0, memory_peak = 0, total = 0;
+      for (size_t t = offset; t < horizon; t += interval) {
+        cpu_peak = std::max(cpu_peak, cpu_load[t] + cpu);
+        memory_peak = std::max(memory_peak, memory_load[t] + memory);
+        total += cpu_load[t] + memory_load[t];
+      }
+      double peak = cpu_peak + memory_peak;
+      if (offset == 0 || peak < best_peak ||
+          (peak == best_peak && total < best_total)) {
+        best_peak = peak;
+        best_total = total;
+        best_offset = offset;
+      }
+    }
+
+    query.offset = best_offset;
+    for (size_t t = best_offset; t < horizon; t += interval) {
+      cpu_load[t] += cpu;
+      memory_load[t] += memory;
+    }
+  }
+}
+
+/// Check if a measured cost changed enough to place the schedule again.
+inline bool costChanged(double placed, double current) {
+  auto change = (placed > current) ? placed - current : current - placed;
+  return change > placed * kBalanceChange && change > 0;
+}
+
+void SchedulerRunner::balance() {
+  std::map<std::string, QueryPlacement> queries;
+  auto& config = Config::getInstance();
+  config.scheduledQueries(
+      ([&queries](const std::string& name, const ScheduledQuery& query) {
+        queries[name].interval = query.splayed_interval;
+      }));
+
+  // Measured costs are recorded by the schedule monitor.
+  bool changed = (queries.size() != placed_.size());
+  for (auto& query : queries) {
+    auto& placement = query.second;
+    config.getPerformanceStats(
+        query.first, ([&placement](const QueryPerformance& perf) {
+          if (perf.executions > 0) {
+            placement.cpu = static_cast<double>(perf.user_time +
+                                                perf.system_time) /
+                            perf.executions;
+            placement.memory = static_cast<double>(perf.average_memory);
+          }
+        }));
+
+    auto placed = placed_.find(query.first);
+    if (placed == placed_.end() ||
+        placed->second.interval != placement.interval ||
+        costChanged(placed->second.cpu, placement.cpu) ||
+        costChanged(placed->second.memory, placement.memory)) {
+      changed = true;
+    }
+  }
+
+  if (!changed) {
+    return;
+  }
+
+  placeQueries(queries);
+  splay_.clear();
+  for (const auto& query : queries) {
+    splay_[query.first] = query.second.offset;
+  }
+  placed_ = std::move(queries);
+  reindex_ = true;
+  VLOG(1) << "Placed " << placed_.size() << " scheduled queries by cost";
+}
+
+bool SchedulerRunner::idle(size_t step) {
+  {
+    std::lock_guard<std::mutex> lock(running_mutex_);
+    if (stopping_ || !tasks_.empty() || !pending_.empty()) {
+      return false;
+    }
+  }
+  return (due_.empty() || due_.top().first > step + kCompactIdleSteps);
+}
+
+void SchedulerRunner::compact(size_t step) {
+  if (kCompacting || !idle(step)) {
+    return;
+  }
+
+  auto domains = getDueCompactions(step);
+  if (domains.empty()) {
+    return;
+  }
+
+  // Compaction runs on a worker, the scheduler keeps dispatching.
+  kCompacting = true;
+  auto task = Dispatcher::submit(
+      [domains](const Task& task) {
+        for (const auto& domain : domains) {
+          TRACE_SCOPE("scheduler.compact");
+          auto status = compactDatabase(domain);
+          if (!status.ok()) {
+            LOG(WARNING) << "Cannot compact database domain (" << domain
+                         << "): " << status.getMessage();
+          } else {
+            VLOG(1) << "Compacted database domain: " << domain;
+          }
+        }
+        kCompacting = false;
+      },
+      TASK_PRIORITY_SCHEDULE);
+  if (task == nullptr) {
+    kCompacting = false;
+  }
+}
+
+void SchedulerRunner::purge(size_t step) {
+  if (FLAGS_memory_purge_interval == 0 ||
+      step < kLastPurge + FLAGS_memory_purge_interval || !idle(step)) {
+    return;
+  }
+
+  // Query results and event batches are freed by now, their pages go back.
+  TRACE_SCOPE("scheduler.purge");
+  kLastPurge = step;
+  auto status = purgeMemory();
+  if (!status.ok()) {
+    VLOG(1) << "Cannot return freed memory: " << status.getMessage();
+  }
 }
 
 void SchedulerRunner::start() {
   // Start the counter at the second.
   auto i = osquery::getUnixTime();
-  for (; (timeout_ == 0) || (i <= timeout_); ++i) {
-    Config::getInstance().scheduledQueries(
-        ([&i](const std::string& name, const ScheduledQuery& query) {
-          if (query.splayed_interval > 0 && i % query.splayed_interval == 0) {
-            TablePlugin::kCacheInterval = query.splayed_interval;
-            TablePlugin::kCacheStep = i;
-            launchQuery(name, query);
-          }
-        }));
+  auto last = i - 1;
+  size_t steps = 0;
+  while ((timeout_ == 0) || (i <= timeout_)) {
+    {
+      std::lock_guard<std::mutex> lock(running_mutex_);
+      if (stopping_) {
+        break;
+      }
+    }
+    {
+      TRACE_SCOPE("scheduler.tick");
+      if (FLAGS_schedule_adaptive_splay && steps++ % kBalanceSteps == 0) {
+        balance();
+      }
+      dispatch(last, i);
+      interrupt(i);
+      compact(i);
+      purge(i);
+    }
+    last = i;
+
+    // Sleep until the next step, compensating for time spent dispatching.
+    // If steps were missed, the next dispatch covers every missed step.
     // Put the thread into an interruptible sleep without a config instance.
-    osquery::interruptableSleep(interval_ * 1000);
+    auto next = i + interval_;
+    auto now = osquery::getUnixTime();
+    if (next > now) {
+      osquery::interruptableSleep((next - now) * 1000);
+    }
+    i = std::max<size_t>(next, osquery::getUnixTime());
+  }
+
+  // Allow the dispatched queries to finish.
+  launch();
+  std::unique_lock<std::mutex> lock(running_mutex_);
+  while (!tasks_.empty() || (!stopping_ && !pending_.empty())) {
+    // A task dropped by a stopping executor finishes without running.
+    for (auto it = tasks_.begin(); it != tasks_.end();) {
+      it = (it->second->isDone()) ? tasks_.erase(it) : std::next(it);
+    }
+    if (tasks_.empty() && !stopping_ && !pending_.empty()) {
+      lock.unlock();
+      launch();
+      lock.lock();
+      continue;
+    }
+    finished_.wait_for(lock, std::chrono::seconds(1));
+  }
+}
+
+void SchedulerRunner::stop() {
+  std::lock_guard<std::mutex> lock(running_mutex_);
+  stopping_ = true;
+  for (const auto& pending : pending_) {
+    running_.erase(pending.name);
+  }
+  pending_.clear();
+
+  for (const auto& task : tasks_) {
+    task.second->cancel();
+  }
+  for (const auto& running : running_) {
+    if (running.second.db != nullptr) {
+      sqlite3_interrupt(running.second.db);
+    }
   }
+  finished_.notify_all();
 }
 
 Status startScheduler() {
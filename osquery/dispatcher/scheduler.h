@@ -10,10 +10,109 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+
 #include "osquery/dispatcher/dispatcher.h"
 
+struct sqlite3;
+
 namespace osquery {
 
+/// A scheduled query executing on one of the scheduler's workers.
+struct InFlightQuery {
+  /// The time the query started, or was dispatched if it is waiting.
+  size_t started{0};
+
+  /// The query is interrupted at this time, 0 for no deadline.
+  size_t deadline{0};
+
+  /// The query's own database connection, used to interrupt it.
+  sqlite3* db{nullptr};
+
+  /// Set if the scheduler interrupted the query after its deadline.
+  bool interrupted{false};
+};
+
+/// Log item decorations shared by every query due in one schedule step.
+struct ScheduleContext {
+  /// The host identifier, cached until the config changes.
+  std::string identifier;
+
+  /// The time of the schedule step, and its calendar format.
+  size_t time{0};
+  std::string calendar_time;
+};
+
+/// A due scheduled query waiting for one of the scheduler's workers.
+struct PendingQuery {
+  std::string name;
+  ScheduledQuery query;
+
+  /// The schedule step the query was due in.
+  size_t step{0};
+
+  /// The decorations of the step, shared by the queries due in it.
+  std::shared_ptr<const ScheduleContext> context{nullptr};
+};
+
+/// The measured cost and assigned offset of a scheduled query.
+struct QueryPlacement {
+  /// The splayed interval of the query.
+  size_t interval{0};
+
+  /// Average CPU time and memory differential of an execution.
+  double cpu{0};
+  double memory{0};
+
+  /// The assigned offset within the interval.
+  size_t offset{0};
+};
+
+/**
+ * @brief Assign each query an offset within its interval.
+ *
+ * Queries are placed most expensive first, each at the offset minimizing the
+ * peak CPU and memory of the seconds it executes within the placement horizon.
+ * Queries without a measured cost are spread by count.
+ *
+ * @param queries The scheduled queries by name, offsets are filled in.
+ */
+void placeQueries(std::map<std::string, QueryPlacement>& queries);
+
+/**
+ * @brief The first schedule step after a step at which a query is due.
+ *
+ * A query is due at its offset plus each multiple of its interval.
+ */
+size_t getNextDueStep(size_t step, size_t interval, size_t offset);
+
+/**
+ * @brief Check if a differential query only appends new rows.
+ *
+ * A query reading only event subscribers, with events_optimize, returns the
+ * events since its last execution. Its results are not stored or compared,
+ * every row is logged as added. Queries with a time constraint, which
+ * replaces the optimized time range, or with an aggregate are differential.
+ * The "append" query option overrides this.
+ *
+ * @param query The scheduled query.
+ * @param db The connection used to plan the query.
+ */
+bool isAppendOnly(const ScheduledQuery& query, sqlite3* db);
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class SchedulerRunner : public InternalRunnable {
  public:
@@ -25,13 +124,120 @@ class SchedulerRunner : public InternalRunnable {
   /// The Dispatcher thread entry point.
   void start();
 
+  /// Stop the query workers, running queries are interrupted.
+  void stop() override;
+
+ public:
+  /// Track a query starting on a worker with its own database connection.
+  void beginQuery(const std::string& name,
+                  const ScheduledQuery& query,
+                  sqlite3* db);
+
+  /**
+   * @brief Remove the query before its database connection is released.
+   *
+   * A query exceeding its budget has its interval backed off, doubling for
+   * each execution exceeding the budget and halving while within budget.
+   */
+  void endQuery(const std::string& name, bool within_budget);
+
+  /// The Dispatcher task entry point of a launched query.
+  void runQuery(const PendingQuery& pending, const Task& task);
+
+ protected:
+  /**
+   * @brief Launch each query due within the schedule steps (last, step].
+   *
+   * The scheduler thread only dispatches, queries run as tasks on the
+   * Dispatcher's executor with at most FLAGS_schedule_workers concurrently, so
+   * a slow query does not delay the queries due after it. A query still
+   * running from a previous step is not launched again.
+   */
+  void dispatch(size_t last, size_t step);
+
+  /// Submit waiting queries while fewer than FLAGS_schedule_workers run.
+  void launch();
+
+  /// Interrupt queries running past their deadline.
+  void interrupt(size_t step);
+
+  /// Place queries again if the schedule or a query's measured cost changed.
+  void balance();
+
+  /**
+   * @brief Compact the due database domains in an idle window.
+   *
+   * The scheduler is idle when no query is running or waiting and none is due
+   * within the next steps. Deleted events and logs are reclaimed then, not
+   * when RocksDB decides during scheduled query executions.
+   */
+  void compact(size_t step);
+
+  /// Return memory freed to the allocator in an idle window.
+  void purge(size_t step);
+
+  /// Check if no query runs, waits, or is due within the next steps.
+  bool idle(size_t step);
+
+  /**
+   * @brief Compile the schedule if it changed, and index the next due steps.
+   *
+   * The due steps are indexed after the last dispatched step, and again when
+   * the offsets or backoffs change.
+   */
+  void index(size_t last);
+
+  /// The interval of a compiled query, including its backoff.
+  size_t getInterval(const ScheduleEntry& entry);
+
+  /// The offset of a compiled query, its spread or its placement by cost.
+  size_t getOffset(const ScheduleEntry& entry) const;
+
  protected:
-  /// The UNIX domain socket path for the ExtensionManager.
+  /// Offsets of each scheduled query within its splayed interval.
   std::map<std::string, size_t> splay_;
   /// Interval in seconds between schedule steps.
   size_t interval_;
   /// Maximum number of steps.
   unsigned long int timeout_;
+
+ private:
+  /// Due queries waiting for a worker, bounded by FLAGS_schedule_queue.
+  std::deque<PendingQuery> pending_;
+
+  /// The submitted query tasks, cancelled on stop.
+  std::map<std::string, TaskRef> tasks_;
+
+  /// Set when the scheduler is stopping, no more queries are launched.
+  bool stopping_{false};
+
+  /// Signaled when a submitted query task finishes.
+  std::condition_variable finished_;
+
+  /// The costs the current offsets were placed with.
+  std::map<std::string, QueryPlacement> placed_;
+
+  /// The running queries by name.
+  std::map<std::string, InFlightQuery> running_;
+
+  /// Interval multipliers of queries that exceeded their budgets.
+  std::map<std::string, size_t> backoff_;
+
+  /// Protect the running, pending, and submitted queries and backoffs.
+  std::mutex running_mutex_;
+
+  /// The compiled schedule, and the config generation it was compiled from.
+  std::vector<ScheduleEntry> schedule_;
+  size_t generation_{0};
+  bool compiled_{false};
+
+  /// The next due step and schedule index of each query, earliest first.
+  using DueQuery = std::pair<size_t, size_t>;
+  std::priority_queue<DueQuery, std::vector<DueQuery>, std::greater<DueQuery>>
+      due_;
+
+  /// Set when offsets or backoffs change, the due steps are indexed again.
+  std::atomic<bool> reindex_{true};
 };
 
 /// Start querying according to the config's schedule
@@ -8,6 +8,11 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
 #include <boost/make_shared.hpp>
 
 #include <gtest/gtest.h>
@@ -21,7 +26,7 @@ class DispatcherTests : public testing::Test {};
 TEST_F(DispatcherTests, test_singleton) {
   auto& one = Dispatcher::instance();
   auto& two = Dispatcher::instance();
-  EXPECT_EQ(one.getThreadManager().get(), two.getThreadManager().get());
+  EXPECT_EQ(one.getExecutor().get(), two.getExecutor().get());
 }
 
 class TestRunnable : public InternalRunnable {
@@ -45,4 +50,163 @@ TEST_F(DispatcherTests, test_add_work) {
 
   EXPECT_EQ(i, base + repetitions);
 }
+
+TEST_F(DispatcherTests, test_executor_priority) {
+  TaskExecutor executor(1, false);
+  std::atomic<bool> started{false}, release{false};
+  std::vector<int> order;
+
+  // Hold the single worker so following tasks are queued.
+  executor.submit(
+      [&started, &release](const Task&) {
+        started = true;
+        while (!release) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      },
+      TASK_PRIORITY_SCHEDULE);
+  while (!started) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto record = [&order](int id) {
+    return [&order, id](const Task&) { order.push_back(id); };
+  };
+  executor.submit(record(1), TASK_PRIORITY_DISTRIBUTED);
+  executor.submit(record(2), TASK_PRIORITY_SCHEDULE);
+  auto cancelled = executor.submit(record(3), TASK_PRIORITY_EVENTS);
+  executor.submit(record(4), TASK_PRIORITY_EVENTS);
+  ASSERT_NE(cancelled, nullptr);
+  cancelled->cancel();
+  EXPECT_EQ(executor.pendingTaskCount(), 4U);
+
+  release = true;
+  cancelled->wait();
+  executor.join();
+  EXPECT_TRUE(cancelled->isDone());
+  EXPECT_EQ(order, std::vector<int>({4, 2, 1}));
+
+  // A joined executor does not accept tasks.
+  EXPECT_EQ(executor.submit(record(5), TASK_PRIORITY_EVENTS), nullptr);
+  EXPECT_EQ(executor.totalTaskCount(), 0U);
+}
+
+TEST_F(DispatcherTests, test_executor_submission_order) {
+  TaskExecutor executor(1, false);
+  std::atomic<bool> started{false}, release{false};
+  std::vector<int> order;
+
+  // Hold the single worker so following tasks are queued.
+  executor.submit(
+      [&started, &release](const Task&) {
+        started = true;
+        while (!release) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      },
+      TASK_PRIORITY_SCHEDULE);
+  while (!started) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // Tasks submitted by other threads run in submission order.
+  std::vector<int> expected;
+  for (int i = 0; i < 16; i++) {
+    executor.submit([&order, i](const Task&) { order.push_back(i); },
+                    TASK_PRIORITY_SCHEDULE);
+    expected.push_back(i);
+  }
+  release = true;
+  executor.join();
+  EXPECT_EQ(order, expected);
+
+  // Tasks a worker submits itself run newest-first.
+  TaskExecutor local(1, false);
+  order.clear();
+  auto parent = local.submit(
+      [&local, &order](const Task&) {
+        for (int i = 0; i < 4; i++) {
+          local.submit([&order, i](const Task&) { order.push_back(i); },
+                       TASK_PRIORITY_SCHEDULE);
+        }
+      },
+      TASK_PRIORITY_SCHEDULE);
+  parent->wait();
+  local.join();
+  EXPECT_EQ(order, std::vector<int>({3, 2, 1, 0}));
+}
+
+TEST_F(DispatcherTests, test_executor_run_or_wait) {
+  TaskExecutor executor(1, false);
+  std::atomic<bool> started{false}, release{false};
+  executor.submit(
+      [&started, &release](const Task&) {
+        started = true;
+        while (!release) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      },
+      TASK_PRIORITY_SCHEDULE);
+  while (!started) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // A task queued behind a busy worker runs on the waiting thread, once.
+  size_t runs = 0;
+  auto task =
+      executor.submit([&runs](const Task&) { runs++; }, TASK_PRIORITY_SCHEDULE);
+  ASSERT_NE(task, nullptr);
+  task->runOrWait();
+  EXPECT_TRUE(task->isDone());
+  release = true;
+  executor.join();
+  EXPECT_EQ(runs, 1U);
+}
+
+TEST_F(DispatcherTests, test_parallel_for) {
+  // Every index runs once, whatever the number of lanes.
+  for (size_t lanes : {0, 1, 3, 64}) {
+    std::vector<std::atomic<size_t>> runs(100);
+    parallelFor(runs.size(), lanes, [&runs](size_t i) { runs[i]++; });
+    for (const auto& count : runs) {
+      EXPECT_EQ(count, 1U);
+    }
+  }
+  parallelFor(0, 4, [](size_t) { FAIL(); });
+}
+
+TEST_F(DispatcherTests, test_wake_sleepers) {
+  std::atomic<bool> woke{false};
+  boost::thread sleeper([&woke]() {
+    interruptableSleep(60 * 1000);
+    woke = true;
+  });
+
+  // An interrupted sleeper unwinds as soon as it is woken.
+  auto start = std::chrono::steady_clock::now();
+  sleeper.interrupt();
+  Dispatcher::wakeSleepers();
+  sleeper.join();
+  EXPECT_FALSE(woke);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+/// A service joining the services, as a shutdown requested by a service does.
+class JoiningRunnable : public InternalRunnable {
+ public:
+  virtual void start() {
+    Dispatcher::joinServices();
+    joined = true;
+  }
+
+  static std::atomic<bool> joined;
+};
+
+std::atomic<bool> JoiningRunnable::joined{false};
+
+TEST_F(DispatcherTests, test_join_services_from_service) {
+  Dispatcher::addService(std::make_shared<JoiningRunnable>());
+  Dispatcher::joinServices();
+  EXPECT_TRUE(JoiningRunnable::joined);
+}
 }
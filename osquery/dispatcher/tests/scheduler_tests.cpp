@@ -17,6 +17,10 @@
 namespace osquery {
 
 extern SQL monitor(const std::string& name, const ScheduledQuery& query);
+extern bool launchQuery(const std::string& name,
+                        const ScheduledQuery& query,
+                        const ScheduleContext& context,
+                        sqlite3* db);
 
 class SchedulerTests : public testing::Test {};
 
@@ -45,6 +49,9 @@ TEST_F(SchedulerTests, test_monitor) {
   // performance stats are tracked independently.
   EXPECT_EQ(perf.executions, 1U);
   EXPECT_GT(perf.output_size, 0U);
+  EXPECT_EQ(perf.output_rows, 1U);
+  EXPECT_EQ(perf.wall_times.count(), 1U);
+  EXPECT_EQ(perf.output_sizes.percentile(50), perf.output_size);
 
   // A bit more testing, potentially redundant, check the database results.
   // Since we are only monitoring, no 'actual' results are stored.
@@ -58,6 +65,91 @@ TEST_F(SchedulerTests, test_monitor) {
   EXPECT_FALSE(timestamp.empty());
 }
 
+TEST_F(SchedulerTests, test_place_queries) {
+  std::map<std::string, QueryPlacement> queries;
+  queries["heavy1"].interval = 10;
+  queries["heavy1"].cpu = 100;
+  queries["heavy1"].memory = 1000;
+  queries["heavy2"].interval = 10;
+  queries["heavy2"].cpu = 90;
+  queries["heavy2"].memory = 900;
+  queries["slow"].interval = 60;
+  queries["slow"].cpu = 50;
+  for (size_t i = 0; i < 4; i++) {
+    queries["cheap" + std::to_string(i)].interval = 5;
+  }
+  placeQueries(queries);
+
+  // Expensive queries with the same interval do not share a second.
+  EXPECT_NE(queries["heavy1"].offset, queries["heavy2"].offset);
+  EXPECT_NE(queries["heavy1"].offset, queries["slow"].offset);
+  EXPECT_NE(queries["heavy2"].offset, queries["slow"].offset);
+
+  // Queries without a measured cost avoid the expensive seconds.
+  for (size_t i = 0; i < 4; i++) {
+    auto offset = queries["cheap" + std::to_string(i)].offset;
+    EXPECT_LT(offset, 5U);
+    EXPECT_NE(offset, queries["heavy1"].offset % 5);
+    EXPECT_NE(offset, queries["heavy2"].offset % 5);
+  }
+}
+
+TEST_F(SchedulerTests, test_next_due_step) {
+  // A query is due at each multiple of its interval after its offset.
+  EXPECT_EQ(getNextDueStep(100, 10, 0), 110U);
+  EXPECT_EQ(getNextDueStep(109, 10, 0), 110U);
+  EXPECT_EQ(getNextDueStep(100, 10, 3), 103U);
+  EXPECT_EQ(getNextDueStep(103, 10, 3), 113U);
+  EXPECT_EQ(getNextDueStep(100, 1, 0), 101U);
+}
+
+TEST_F(SchedulerTests, test_append_only) {
+  auto dbc = SQLiteDBManager::get();
+  ScheduledQuery query;
+  query.query = "select * from time";
+
+  // A query of a table that is not an event subscriber is differential.
+  EXPECT_FALSE(isAppendOnly(query, dbc->db()));
+
+  // The query option overrides the detection.
+  query.options["append"] = true;
+  EXPECT_TRUE(isAppendOnly(query, dbc->db()));
+  query.options["append"] = false;
+  EXPECT_FALSE(isAppendOnly(query, dbc->db()));
+
+  // A query that cannot be planned is differential.
+  query.options.clear();
+  query.query = "select * from does_not_exist";
+  EXPECT_FALSE(isAppendOnly(query, dbc->db()));
+}
+
+TEST_F(SchedulerTests, test_query_budget) {
+  auto dbc = SQLiteDBManager::get();
+  ScheduleContext context;
+
+  // Counting a long recursive sequence runs within the SQLite VM.
+  ScheduledQuery query;
+  query.interval = 10;
+  query.query =
+      "with recursive c(x) as (select 1 union all select x + 1 from c "
+      "where x < 1000000000) select count(*) from c";
+  query.max_cpu_time = 10;
+  auto start = getUnixTime();
+  EXPECT_FALSE(launchQuery("budget_query", query, context, dbc->db()));
+  EXPECT_LT(getUnixTime(), start + 10);
+
+  // The budget belongs to the query, other queries run without it.
+  ScheduledQuery other;
+  other.interval = 10;
+  other.query = "select 1";
+  EXPECT_TRUE(launchQuery("budget_other", other, context, dbc->db()));
+
+  // A query's row limit discards its results.
+  other.max_rows = 1;
+  other.query = "select 1 union all select 2";
+  EXPECT_FALSE(launchQuery("budget_rows", other, context, dbc->db()));
+}
+
 TEST_F(SchedulerTests, test_config_results_purge) {
   // Set a query time for now (time is only important relative to a week ago).
   auto query_time = osquery::getUnixTime();
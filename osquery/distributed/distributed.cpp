@@ -8,6 +8,10 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <mutex>
 #include <sstream>
 #include <utility>
 
@@ -18,6 +22,10 @@
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+#include "osquery/dispatcher/dispatcher.h"
+#include "osquery/sql/sqlite_util.h"
 
 namespace pt = boost::property_tree;
 
@@ -30,8 +38,156 @@ FLAG(bool,
      true,
      "Disable distributed queries (default true)");
 
-boost::shared_mutex distributed_queries_mutex_;
-boost::shared_mutex distributed_results_mutex_;
+FLAG(uint64,
+     distributed_long_poll,
+     0,
+     "Seconds a distributed plugin may wait for new queries, 0 to poll");
+
+FLAG(uint64,
+     distributed_workers,
+     2,
+     "Number of distributed queries executing in parallel");
+
+FLAG(uint64,
+     distributed_timeout,
+     0,
+     "Seconds a distributed query may run, 0 for no limit");
+
+FLAG(uint64,
+     distributed_max_rows,
+     0,
+     "Maximum rows written for a distributed query, 0 for no limit");
+
+FLAG(uint64,
+     distributed_chunk_rows,
+     0,
+     "Maximum rows written per distributed results request, 0 for no limit");
+
+FLAG(uint64,
+     distributed_max_bytes,
+     0,
+     "Maximum bytes of values written for a distributed query, 0 for no limit");
+
+FLAG(bool,
+     distributed_spill,
+     true,
+     "Keep unwritten distributed results in the backing store, not memory");
+
+FLAG(uint64,
+     distributed_cache_max_ttl,
+     300,
+     "Maximum seconds distributed results are cached, 0 to never cache");
+
+/// The queries and results locks report their contention in osquery_locks.
+using DistributedMutex = InstrumentedMutex<boost::shared_mutex>;
+using DistributedReadLock = boost::shared_lock<DistributedMutex>;
+using DistributedWriteLock = boost::unique_lock<DistributedMutex>;
+
+DistributedMutex distributed_queries_mutex_("distributed_queries");
+DistributedMutex distributed_results_mutex_("distributed_results");
+
+/// Check a query's deadline every 10000 SQLite virtual machine instructions.
+const int kDistributedDeadlineInstructions = 10000;
+
+/// The key prefix of distributed results spilled to the logs domain.
+const std::string kDistributedSpillPrefix = "distributed_";
+
+/// The most spilled results read from the backing store at once.
+const size_t kDistributedSpillBatch = 16;
+
+/// Results kept to answer identical distributed queries.
+struct CachedResult {
+  /// The time the results expire.
+  size_t expires{0};
+
+  /// The id the results were written with.
+  std::string id;
+
+  QueryData rows;
+};
+
+/// Cached results by normalized query.
+static std::map<std::string, CachedResult> kDistributedCache;
+static std::mutex kDistributedCacheMutex;
+
+/// Interrupt a query past the deadline it is given, see runQuery.
+static int deadlineProgressHandler(void* argument) {
+  auto deadline = *static_cast<const size_t*>(argument);
+  return (getUnixTime() >= deadline) ? 1 : 0;
+}
+
+/**
+ * @brief Normalize a query to compare identical queries.
+ *
+ * Whitespace outside of quoted strings is collapsed to one space and
+ * trailing semicolons are removed.
+ */
+static std::string normalizeQuery(const std::string& query) {
+  std::string normalized;
+  char quote = 0;
+  bool space = false;
+  for (const auto& c : query) {
+    if (quote == 0 && isspace(static_cast<unsigned char>(c))) {
+      space = true;
+      continue;
+    }
+    if (space && !normalized.empty()) {
+      normalized += ' ';
+    }
+    space = false;
+    if (quote == 0 && (c == '\'' || c == '"')) {
+      quote = c;
+    } else if (c == quote) {
+      quote = 0;
+    }
+    normalized += c;
+  }
+
+  while (!normalized.empty() &&
+         (normalized.back() == ';' || normalized.back() == ' ')) {
+    normalized.pop_back();
+  }
+  return normalized;
+}
+
+/// Serialize results into the writeResults JSON format.
+static Status serializeResultList(
+    const std::vector<const DistributedQueryResult*>& results,
+    std::string& json) {
+  pt::ptree tree;
+  for (const auto& result : results) {
+    pt::ptree qd;
+    auto s = serializeQueryData(result->results, qd);
+    if (!s.ok()) {
+      return s;
+    }
+    tree.add_child(result->request.id, qd);
+  }
+
+  pt::ptree params;
+  params.add_child("queries", tree);
+
+  std::stringstream ss;
+  try {
+    pt::write_json(ss, params, false);
+  } catch (const pt::ptree_error& e) {
+    return Status(1, "Error writing JSON: " + std::string(e.what()));
+  }
+  json = ss.str();
+  return Status(0, "OK");
+}
+
+/// Call the active distributed plugin's writeResults.
+static Status writeResultsJSON(const std::string& json) {
+  auto& distributed_plugin = Registry::getActive("distributed");
+  if (!Registry::exists("distributed", distributed_plugin)) {
+    return Status(1, "Missing distributed plugin " + distributed_plugin);
+  }
+
+  PluginResponse response;
+  return Registry::call(
+      "distributed", {{"action", "writeResults"}, {"results", json}}, response);
+}
 
 Status DistributedPlugin::call(const PluginRequest& request,
                                PluginResponse& response) {
@@ -76,92 +232,368 @@ Status Distributed::pullUpdates() {
 }
 
 size_t Distributed::getPendingQueryCount() {
-  ReadLock rlock(distributed_queries_mutex_);
+  DistributedReadLock rlock(distributed_queries_mutex_);
   return queries_.size();
 }
 
 size_t Distributed::getCompletedCount() {
-  ReadLock rlock(distributed_results_mutex_);
+  DistributedReadLock rlock(distributed_results_mutex_);
   return results_.size();
 }
 
 Status Distributed::serializeResults(std::string& json) {
-  WriteLock wlock(distributed_results_mutex_);
-
-  pt::ptree tree;
+  DistributedReadLock rlock(distributed_results_mutex_);
+  std::vector<const DistributedQueryResult*> results;
   for (const auto& result : results_) {
-    pt::ptree qd;
-    auto s = serializeQueryData(result.results, qd);
-    if (!s.ok()) {
-      return s;
-    }
-    tree.add_child(result.request.id, qd);
+    results.push_back(&result);
   }
+  return serializeResultList(results, json);
+}
 
-  pt::ptree results;
-  results.add_child("queries", tree);
+void Distributed::addResult(const DistributedQueryResult& result) {
+  DistributedWriteLock wlock_results(distributed_results_mutex_);
+  results_.push_back(result);
+}
 
-  std::stringstream ss;
-  try {
-    pt::write_json(ss, results, false);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error writing JSON: " + std::string(e.what()));
+Status Distributed::runQueries() {
+  // This thread runs queries alongside the executor's tasks, which it runs
+  // itself if no worker started them.
+  auto workers = std::min<size_t>(
+      std::max<size_t>(FLAGS_distributed_workers, 1), getPendingQueryCount());
+  std::vector<TaskRef> tasks;
+  for (size_t i = 1; i < workers; i++) {
+    auto task = Dispatcher::submit([this](const Task&) { runPending(); },
+                                   TASK_PRIORITY_DISTRIBUTED);
+    if (task != nullptr) {
+      tasks.push_back(std::move(task));
+    }
+  }
+  runPending();
+  for (const auto& task : tasks) {
+    task->runOrWait();
   }
-  json = ss.str();
 
-  return Status(0, "OK");
+  // Retry the results that could not be written when their query completed.
+  return flushCompleted();
 }
 
-void Distributed::addResult(const DistributedQueryResult& result) {
-  WriteLock wlock_results(distributed_results_mutex_);
-  results_.push_back(result);
+void Distributed::runPending() {
+  while (true) {
+    DistributedQueryRequest request;
+    {
+      DistributedWriteLock wlock_queries(distributed_queries_mutex_);
+      if (queries_.empty()) {
+        break;
+      }
+      request = std::move(queries_.front());
+      queries_.erase(queries_.begin());
+    }
+    runQuery(std::move(request));
+  }
 }
 
-Status Distributed::runQueries() {
-  while (getPendingQueryCount() > 0) {
-    auto query = popRequest();
+void Distributed::runQuery(DistributedQueryRequest request) {
+  auto key = normalizeQuery(request.query);
+  if (request.cache_ttl > 0) {
+    CachedResult cached;
+    {
+      std::lock_guard<std::mutex> lock(kDistributedCacheMutex);
+      auto entry = kDistributedCache.find(key);
+      if (entry != kDistributedCache.end() &&
+          getUnixTime() < entry->second.expires) {
+        cached = entry->second;
+      }
+    }
 
-    auto sql = SQL(query.query);
-    if (!sql.getStatus().ok()) {
-      LOG(ERROR) << "Error running distributed query[" << query.id
-                 << "]: " << query.query;
-      continue;
+    if (!cached.id.empty()) {
+      writeDuplicate(request, cached.id, cached.rows);
+      for (const auto& id : request.duplicates) {
+        auto duplicate = request;
+        duplicate.id = id;
+        writeDuplicate(duplicate, cached.id, cached.rows);
+      }
+      return;
     }
+  }
+
+  // Each query holds its connection exclusively so it can be interrupted.
+  auto dbc = SQLiteDBManager::get();
+  size_t deadline = (FLAGS_distributed_timeout > 0)
+                        ? getUnixTime() + FLAGS_distributed_timeout
+                        : 0;
+  if (deadline > 0) {
+    sqlite3_progress_handler(dbc->db(),
+                             kDistributedDeadlineInstructions,
+                             deadlineProgressHandler,
+                             &deadline);
+  }
+
+  // Rows are written in chunks as they are stepped and the query stops
+  // reading at the row limit, only one chunk of rows is held at a time.
+  auto max_rows = FLAGS_distributed_max_rows;
+  auto chunk = FLAGS_distributed_chunk_rows;
+  QueryData rows;
+  // Every row is kept if identical queries are answered with the results.
+  bool keep = (request.cache_ttl > 0 || !request.duplicates.empty());
+  QueryData kept;
+  auto max_bytes = FLAGS_distributed_max_bytes;
+  size_t total = 0;
+  size_t bytes = 0;
+  size_t written = 0;
+  bool truncated = false;
+  Status write_status(0, "OK");
+  auto consume = [&](Row& row) {
+    if (max_rows > 0 && total >= max_rows) {
+      truncated = true;
+      return false;
+    }
+    if (max_bytes > 0) {
+      size_t row_bytes = 0;
+      for (const auto& column : row) {
+        row_bytes += column.first.size() + column.second.size();
+      }
+      if (bytes + row_bytes > max_bytes) {
+        truncated = true;
+        return false;
+      }
+      bytes += row_bytes;
+    }
+    if (keep) {
+      kept.push_back(row);
+    }
+    rows.push_back(std::move(row));
+    total++;
+
+    // After a failed write the later chunks are spilled, in order, or kept
+    // in memory to retry the remaining result.
+    if (chunk > 0 && rows.size() >= chunk) {
+      if (write_status.ok()) {
+        write_status = writeResult(DistributedQueryResult(request, rows));
+        if (write_status.ok()) {
+          written++;
+          rows.clear();
+        }
+      }
+      if (!write_status.ok() && FLAGS_distributed_spill &&
+          spillResult(DistributedQueryResult(request, rows)).ok()) {
+        written++;
+        rows.clear();
+      }
+    }
+    return true;
+  };
+
+  auto status = queryInternal(request.query, consume, dbc->db());
+  if (deadline > 0) {
+    sqlite3_progress_handler(dbc->db(), 0, nullptr, nullptr);
+    if (!status.ok() && getUnixTime() >= deadline) {
+      LOG(WARNING) << "Interrupted distributed query[" << request.id
+                   << "] after " << FLAGS_distributed_timeout << " seconds";
+    }
+  }
+
+  if (!status.ok()) {
+    LOG(ERROR) << "Error running distributed query[" << request.id
+               << "]: " << request.query << " (" << status.getMessage()
+               << ")";
+    return;
+  }
 
-    DistributedQueryResult result(std::move(query), std::move(sql.rows()));
+  if (truncated) {
+    LOG(WARNING) << "Distributed query[" << request.id
+                 << "] exceeded its limits, writing the first " << total
+                 << " rows";
+  }
+
+  // The final write also reports queries without rows as complete.
+  if (!rows.empty() || written == 0) {
+    DistributedQueryResult result(request, std::move(rows));
+    if (!write_status.ok() || !writeResult(result).ok()) {
+      keepResult(result);
+    }
+  }
+
+  for (const auto& id : request.duplicates) {
+    auto duplicate = request;
+    duplicate.id = id;
+    writeDuplicate(duplicate, request.id, kept);
+  }
+
+  if (request.cache_ttl > 0) {
+    auto now = getUnixTime();
+    std::lock_guard<std::mutex> lock(kDistributedCacheMutex);
+    for (auto it = kDistributedCache.begin(); it != kDistributedCache.end();) {
+      it = (now >= it->second.expires) ? kDistributedCache.erase(it) : ++it;
+    }
+    auto& cached = kDistributedCache[key];
+    cached.expires = now + request.cache_ttl;
+    cached.id = request.id;
+    cached.rows = std::move(kept);
+  }
+}
+
+void Distributed::writeDuplicate(const DistributedQueryRequest& request,
+                                 const std::string& source,
+                                 const QueryData& rows) {
+  if (request.cached_ok) {
+    // The server already has the rows written for the source id.
+    pt::ptree cached;
+    cached.put(pt::ptree::path_type(request.id, '\0'), source);
+    pt::ptree params;
+    params.add_child("queries", pt::ptree());
+    params.add_child("cached", cached);
+
+    std::stringstream ss;
+    try {
+      pt::write_json(ss, params, false);
+      if (writeResultsJSON(ss.str()).ok()) {
+        return;
+      }
+    } catch (const pt::ptree_error& e) {
+      LOG(ERROR) << "Error writing JSON: " << e.what();
+    }
+  }
+
+  DistributedQueryResult result(request, rows);
+  if (!writeResult(result).ok()) {
+    keepResult(result);
+  }
+}
+
+void Distributed::keepResult(const DistributedQueryResult& result) {
+  if (!FLAGS_distributed_spill || !spillResult(result).ok()) {
     addResult(result);
   }
-  return flushCompleted();
 }
 
-Status Distributed::flushCompleted() {
-  if (getCompletedCount() == 0) {
-    return Status(0, "OK");
+Status Distributed::spillResult(const DistributedQueryResult& result) {
+  // Parts are written under the same query id as chunks, see writeResult.
+  auto chunk = FLAGS_distributed_chunk_rows;
+  if (chunk == 0) {
+    chunk = std::max<size_t>(result.results.size(), 1);
   }
 
-  auto& distributed_plugin = Registry::getActive("distributed");
-  if (!Registry::exists("distributed", distributed_plugin)) {
-    return Status(1, "Missing distributed plugin " + distributed_plugin);
+  // Keys sort by time then by a fixed-width counter, in the order spilled.
+  static std::atomic<size_t> spill_index{0};
+  auto time = std::to_string(getUnixTime());
+  std::vector<std::pair<std::string, std::string>> puts;
+  size_t i = 0;
+  do {
+    auto end = std::min(i + chunk, result.results.size());
+    DistributedQueryResult part(
+        result.request,
+        QueryData(result.results.begin() + i, result.results.begin() + end));
+    std::string json;
+    auto s = serializeResultList({&part}, json);
+    if (!s.ok()) {
+      return s;
+    }
+
+    std::stringstream index;
+    index << kDistributedSpillPrefix << time << "_" << std::setfill('0')
+          << std::setw(20) << ++spill_index;
+    puts.push_back(std::make_pair(index.str(), std::move(json)));
+    i = end;
+  } while (i < result.results.size());
+  return writeDatabaseValues(kLogs, puts, {});
+}
+
+Status Distributed::flushSpilled() {
+  while (true) {
+    std::vector<std::pair<std::string, std::string>> items;
+    scanDatabasePrefix(
+        kLogs, items, kDistributedSpillPrefix, kDistributedSpillBatch);
+    for (const auto& item : items) {
+      // Each acknowledged part is removed, a failed flush resumes from it.
+      auto s = writeResultsJSON(item.second);
+      if (!s.ok()) {
+        return s;
+      }
+      deleteDatabaseValue(kLogs, item.first);
+    }
+    if (items.size() < kDistributedSpillBatch) {
+      return Status(0, "OK");
+    }
   }
+}
 
-  std::string results;
-  auto s = serializeResults(results);
-  if (!s.ok()) {
-    return s;
+Status Distributed::writeResult(const DistributedQueryResult& result) {
+  auto chunk = FLAGS_distributed_chunk_rows;
+  if (chunk == 0 || result.results.size() <= chunk) {
+    std::string json;
+    auto s = serializeResultList({&result}, json);
+    return (s.ok()) ? writeResultsJSON(json) : s;
   }
 
-  PluginResponse response;
-  return Registry::call("distributed",
-                        {{"action", "writeResults"}, {"results", results}},
-                        response);
+  for (size_t i = 0; i < result.results.size(); i += chunk) {
+    auto end = std::min(i + chunk, result.results.size());
+    DistributedQueryResult part(
+        result.request,
+        QueryData(result.results.begin() + i, result.results.begin() + end));
+    std::string json;
+    auto s = serializeResultList({&part}, json);
+    if (s.ok()) {
+      s = writeResultsJSON(json);
+    }
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return Status(0, "OK");
+}
+
+
+Status Distributed::flushCompleted() {
+  // Results held in memory are small, they are not delayed by spilled parts.
+  if (getCompletedCount() > 0) {
+    std::string results;
+    auto s = serializeResults(results);
+    if (!s.ok()) {
+      return s;
+    }
+
+    s = writeResultsJSON(results);
+    if (!s.ok()) {
+      return s;
+    }
+
+    // Written results are not sent again.
+    DistributedWriteLock wlock_results(distributed_results_mutex_);
+    results_.clear();
+  }
+  return flushSpilled();
 }
 
 Status Distributed::acceptWork(const std::string& work) {
   pt::ptree tree;
-  std::stringstream ss(work);
+  auto status = parseJSONTree(work, tree);
+  if (!status.ok()) {
+    return Status(1, "Error parsing JSON: " + status.getMessage());
+  }
+
   try {
-    pt::read_json(ss, tree);
+    // The server may allow results to answer identical queries for a time.
+    auto cache_ttl = std::min<size_t>(tree.get<size_t>("cache_ttl", 0),
+                                      FLAGS_distributed_cache_max_ttl);
+    auto cached_ok = tree.get<bool>("cached_ok", false);
+
+    // The server may ask for deleted data to be reclaimed when idle.
+    auto compact = tree.get_optional<std::string>("database_compact");
+    if (compact) {
+      auto domains = split(*compact, ",");
+      if (domains.empty()) {
+        domains.push_back("");
+      }
+      for (const auto& domain : domains) {
+        auto status = requestDatabaseCompaction(domain);
+        if (!status.ok()) {
+          LOG(WARNING) << "Cannot compact: " << status.getMessage();
+        }
+      }
+    }
 
+    // Identical queries of the batch are answered by the first.
+    std::map<std::string, size_t> batch;
     auto& queries = tree.get_child("queries");
     for (const auto& node : queries) {
       DistributedQueryRequest request;
@@ -171,7 +603,17 @@ Status Distributed::acceptWork(const std::string& work) {
         return Status(1,
                       "Distributed query does not have complete attributes.");
       }
-      WriteLock wlock(distributed_queries_mutex_);
+      request.cache_ttl = cache_ttl;
+      request.cached_ok = cached_ok;
+
+      auto key = normalizeQuery(request.query);
+      DistributedWriteLock wlock(distributed_queries_mutex_);
+      auto first = batch.find(key);
+      if (first != batch.end()) {
+        queries_[first->second].duplicates.push_back(request.id);
+        continue;
+      }
+      batch[key] = queries_.size();
       queries_.push_back(request);
     }
   } catch (const pt::ptree_error& e) {
@@ -182,7 +624,7 @@ Status Distributed::acceptWork(const std::string& work) {
 }
 
 DistributedQueryRequest Distributed::popRequest() {
-  WriteLock wlock_queries(distributed_queries_mutex_);
+  DistributedWriteLock wlock_queries(distributed_queries_mutex_);
   auto q = queries_[0];
   queries_.erase(queries_.begin());
   return q;
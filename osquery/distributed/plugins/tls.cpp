@@ -8,6 +8,7 @@
  *
  */
 
+#include <atomic>
 #include <vector>
 #include <sstream>
 
@@ -21,6 +22,7 @@
 
 #include "osquery/remote/requests.h"
 #include "osquery/remote/transports/tls.h"
+#include "osquery/remote/serializers/columnar.h"
 #include "osquery/remote/serializers/json.h"
 #include "osquery/remote/utility.h"
 
@@ -28,6 +30,8 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(distributed_long_poll);
+
 FLAG(string,
      distributed_tls_read_endpoint,
      "",
@@ -52,6 +56,9 @@ class TLSDistributedPlugin : public DistributedPlugin {
  protected:
   std::string read_uri_;
   std::string write_uri_;
+
+  /// Set if the last read response accepted columnar result uploads.
+  std::atomic<bool> columnar_{false};
 };
 
 REGISTER(TLSDistributedPlugin, "distributed", "tls");
@@ -63,8 +70,25 @@ Status TLSDistributedPlugin::setUp() {
 }
 
 Status TLSDistributedPlugin::getQueries(std::string& json) {
-  return TLSRequestHelper::go<JSONSerializer>(
-      read_uri_, json, FLAGS_distributed_tls_max_attempts);
+  // A long poll asks the server to hold the read open until queries arrive,
+  // and allows the request to take that long.
+  size_t timeout = 0;
+  pt::ptree params;
+  if (FLAGS_distributed_long_poll > 0) {
+    params.put<size_t>("long_poll", FLAGS_distributed_long_poll);
+    // Allow the default request timeout beyond the time the server may wait.
+    timeout = FLAGS_distributed_long_poll + kTLSTimeout;
+  }
+  offerColumnarEncoding(params);
+
+  pt::ptree recv;
+  auto s = TLSRequestHelper::go<JSONSerializer>(
+      read_uri_, params, recv, FLAGS_distributed_tls_max_attempts, timeout);
+  if (!s.ok()) {
+    return s;
+  }
+  columnar_ = acceptsColumnarEncoding(recv);
+  return JSONSerializer().serialize(recv, json);
 }
 
 Status TLSDistributedPlugin::writeResults(const std::string& json) {
@@ -77,6 +101,12 @@ Status TLSDistributedPlugin::writeResults(const std::string& json) {
     return Status(1, "Error parsing JSON: " + std::string(e.what()));
   }
 
+  if (columnar_) {
+    // Write each result's column names once instead of in every row.
+    offerColumnarEncoding(params);
+    return TLSRequestHelper::go<ColumnarSerializer>(
+        write_uri_, params, response, FLAGS_distributed_tls_max_attempts);
+  }
   return TLSRequestHelper::go<JSONSerializer>(
       write_uri_, params, response, FLAGS_distributed_tls_max_attempts);
 }
@@ -8,7 +8,11 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -21,6 +25,8 @@
 #include <osquery/sql.h>
 
 #include "osquery/core/test_util.h"
+#include "osquery/dispatcher/dispatcher.h"
+#include "osquery/dispatcher/distributed.h"
 
 #include "osquery/sql/sqlite_util.h"
 
@@ -28,9 +34,58 @@ namespace pt = boost::property_tree;
 
 DECLARE_string(distributed_tls_read_endpoint);
 DECLARE_string(distributed_tls_write_endpoint);
+DECLARE_uint64(distributed_max_rows);
+DECLARE_uint64(distributed_chunk_rows);
+DECLARE_uint64(distributed_max_bytes);
+DECLARE_uint64(distributed_tls_max_attempts);
+DECLARE_uint64(distributed_long_poll);
 
 namespace osquery {
 
+/// A distributed plugin keeping every results request it is asked to write.
+class RecordingDistributedPlugin : public DistributedPlugin {
+ public:
+  Status getQueries(std::string& json) override {
+    json = "{\"queries\": {}}";
+    return Status(0, "OK");
+  }
+
+  Status writeResults(const std::string& json) override {
+    if (failures > 0) {
+      failures--;
+      return Status(1, "Unavailable");
+    }
+    writes.push_back(json);
+    return Status(0, "OK");
+  }
+
+  static std::vector<std::string> writes;
+
+  /// The number of writes to fail before writes are accepted again.
+  static size_t failures;
+};
+
+std::vector<std::string> RecordingDistributedPlugin::writes;
+size_t RecordingDistributedPlugin::failures{0};
+
+/// A distributed plugin answering every long poll with a query at once.
+class LongPollDistributedPlugin : public DistributedPlugin {
+ public:
+  Status getQueries(std::string& json) override {
+    json = "{\"queries\": {\"poll" + std::to_string(polls++) +
+           "\": \"select 1\"}}";
+    return Status(0, "OK");
+  }
+
+  Status writeResults(const std::string& json) override {
+    return Status(0, "OK");
+  }
+
+  static std::atomic<size_t> polls;
+};
+
+std::atomic<size_t> LongPollDistributedPlugin::polls{0};
+
 class DistributedTests : public testing::Test {
  protected:
   void SetUp() {
@@ -66,7 +121,7 @@ class DistributedTests : public testing::Test {
 };
 
 TEST_F(DistributedTests, test_workflow) {
-  auto dist = Distributed();
+  Distributed dist;
   auto s = dist.pullUpdates();
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(s.toString(), "OK");
@@ -77,7 +132,199 @@ TEST_F(DistributedTests, test_workflow) {
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(s.toString(), "OK");
 
+  // Each result was written as its query completed.
   EXPECT_EQ(dist.getPendingQueryCount(), 0U);
-  EXPECT_EQ(dist.results_.size(), 2U);
+  EXPECT_EQ(dist.results_.size(), 0U);
+}
+
+TEST_F(DistributedTests, test_serialize_results) {
+  Distributed dist;
+  QueryData rows = {{{"col", "one"}}, {{"col", "two"}}};
+  dist.addResult(DistributedQueryResult(
+      DistributedQueryRequest("select 1", "id1"), rows));
+  EXPECT_EQ(dist.getCompletedCount(), 1U);
+
+  std::string json;
+  auto s = dist.serializeResults(json);
+  ASSERT_TRUE(s.ok());
+
+  pt::ptree tree;
+  std::stringstream input(json);
+  pt::read_json(input, tree);
+  EXPECT_EQ(tree.get_child("queries.id1").size(), 2U);
+  // Serializing does not clear the results, only a successful flush does.
+  EXPECT_EQ(dist.getCompletedCount(), 1U);
+}
+
+TEST_F(DistributedTests, test_stream_rows) {
+  Registry::add<RecordingDistributedPlugin>("distributed", "recording");
+  ASSERT_TRUE(Registry::setActive("distributed", "recording").ok());
+  RecordingDistributedPlugin::writes.clear();
+
+  auto max_rows = FLAGS_distributed_max_rows;
+  auto chunk_rows = FLAGS_distributed_chunk_rows;
+  FLAGS_distributed_max_rows = 5;
+  FLAGS_distributed_chunk_rows = 2;
+
+  // The unbounded scan stops after the row limit is read.
+  Distributed dist;
+  dist.runQuery(DistributedQueryRequest(
+      "with recursive n(i) as (select 1 union all select i + 1 from n) "
+      "select i from n",
+      "unbounded"));
+  FLAGS_distributed_max_rows = max_rows;
+  FLAGS_distributed_chunk_rows = chunk_rows;
+  Registry::setActive("distributed", "tls");
+
+  EXPECT_EQ(dist.getCompletedCount(), 0U);
+  ASSERT_EQ(RecordingDistributedPlugin::writes.size(), 3U);
+  std::vector<size_t> sizes;
+  for (const auto& json : RecordingDistributedPlugin::writes) {
+    pt::ptree tree;
+    std::stringstream input(json);
+    pt::read_json(input, tree);
+    sizes.push_back(tree.get_child("queries.unbounded").size());
+  }
+  EXPECT_EQ(sizes, std::vector<size_t>({2, 2, 1}));
+}
+
+TEST_F(DistributedTests, test_coalesce_cached) {
+  Registry::add<RecordingDistributedPlugin>("distributed", "recording");
+  ASSERT_TRUE(Registry::setActive("distributed", "recording").ok());
+  RecordingDistributedPlugin::writes.clear();
+
+  // Identical queries, apart from whitespace, run once.
+  Distributed dist;
+  ASSERT_TRUE(dist.acceptWork("{\"queries\": {"
+                              "\"first\": \"select 1336 + 1 as n;\", "
+                              "\"second\": \"select  1336 + 1  as n\"}, "
+                              "\"cache_ttl\": 60, \"cached_ok\": true}")
+                  .ok());
+  EXPECT_EQ(dist.getPendingQueryCount(), 1U);
+  dist.runQueries();
+
+  // A later identical query is answered from the cache.
+  ASSERT_TRUE(dist.acceptWork("{\"queries\": {"
+                              "\"third\": \"select 1336 + 1 as n\"}, "
+                              "\"cache_ttl\": 60, \"cached_ok\": true}")
+                  .ok());
+  dist.runQueries();
+  Registry::setActive("distributed", "tls");
+
+  ASSERT_EQ(RecordingDistributedPlugin::writes.size(), 3U);
+  std::vector<std::string> cached;
+  for (const auto& json : RecordingDistributedPlugin::writes) {
+    pt::ptree tree;
+    std::stringstream input(json);
+    pt::read_json(input, tree);
+    if (tree.count("cached") > 0) {
+      for (const auto& node : tree.get_child("cached")) {
+        EXPECT_EQ(node.second.data(), "first");
+        cached.push_back(node.first);
+      }
+    } else {
+      auto& rows = tree.get_child("queries.first");
+      ASSERT_EQ(rows.size(), 1U);
+      EXPECT_EQ(rows.front().second.get<std::string>("n"), "1337");
+    }
+  }
+  EXPECT_EQ(cached, std::vector<std::string>({"second", "third"}));
+}
+
+TEST_F(DistributedTests, test_spill_results) {
+  Registry::add<RecordingDistributedPlugin>("distributed", "recording");
+  ASSERT_TRUE(Registry::setActive("distributed", "recording").ok());
+  RecordingDistributedPlugin::writes.clear();
+
+  auto chunk_rows = FLAGS_distributed_chunk_rows;
+  auto max_bytes = FLAGS_distributed_max_bytes;
+  FLAGS_distributed_chunk_rows = 2;
+  // Each row is the column name and a one digit value.
+  FLAGS_distributed_max_bytes = 5 * 2;
+
+  // The server is unavailable, the chunks are spilled instead of kept.
+  RecordingDistributedPlugin::failures = 1;
+  Distributed dist;
+  dist.runQuery(DistributedQueryRequest(
+      "with recursive n(i) as (select 1 union all select i + 1 from n) "
+      "select i from n",
+      "spilled"));
+  EXPECT_EQ(dist.getCompletedCount(), 0U);
+  EXPECT_TRUE(RecordingDistributedPlugin::writes.empty());
+
+  // A failed flush resumes with the part that was not written.
+  RecordingDistributedPlugin::failures = 1;
+  EXPECT_FALSE(dist.flushCompleted().ok());
+  EXPECT_TRUE(dist.flushCompleted().ok());
+  FLAGS_distributed_chunk_rows = chunk_rows;
+  FLAGS_distributed_max_bytes = max_bytes;
+  Registry::setActive("distributed", "tls");
+
+  std::vector<std::string> values;
+  for (const auto& json : RecordingDistributedPlugin::writes) {
+    pt::ptree tree;
+    std::stringstream input(json);
+    pt::read_json(input, tree);
+    for (const auto& row : tree.get_child("queries.spilled")) {
+      values.push_back(row.second.get<std::string>("i"));
+    }
+  }
+  EXPECT_EQ(RecordingDistributedPlugin::writes.size(), 3U);
+  EXPECT_EQ(values, std::vector<std::string>({"1", "2", "3", "4", "5"}));
+
+  // Nothing remains to be written.
+  RecordingDistributedPlugin::writes.clear();
+  EXPECT_TRUE(dist.flushCompleted().ok());
+  EXPECT_TRUE(RecordingDistributedPlugin::writes.empty());
+}
+
+TEST_F(DistributedTests, test_interrupt_retries) {
+  // Enroll while the server is reachable, then read from a closed port.
+  EXPECT_FALSE(getNodeKey("tls").empty());
+  auto hostname = Flag::getValue("tls_hostname");
+  auto attempts = FLAGS_distributed_tls_max_attempts;
+  Flag::updateValue("tls_hostname", "localhost:1");
+  FLAGS_distributed_tls_max_attempts = 10;
+  Registry::setActive("distributed", "tls");
+
+  // An interrupted read unwinds without setting a status.
+  Status status(1, "Interrupted");
+  boost::thread reader([&status]() {
+    Distributed dist;
+    status = dist.pullUpdates();
+  });
+
+  // Without an interruption the retry backoff would wait for minutes.
+  auto start = std::chrono::steady_clock::now();
+  reader.interrupt();
+  Dispatcher::wakeSleepers();
+  reader.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+  EXPECT_FALSE(status.ok());
+
+  Flag::updateValue("tls_hostname", hostname);
+  FLAGS_distributed_tls_max_attempts = attempts;
+  Registry::setActive("distributed", "tls");
+}
+
+TEST_F(DistributedTests, test_stop_long_poll) {
+  Registry::add<LongPollDistributedPlugin>("distributed", "long_poll");
+  ASSERT_TRUE(Registry::setActive("distributed", "long_poll").ok());
+  auto long_poll = FLAGS_distributed_long_poll;
+  FLAGS_distributed_long_poll = 1;
+
+  Dispatcher::addService(std::make_shared<DistributedRunner>());
+  while (LongPollDistributedPlugin::polls < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // Each poll is answered at once, the runner never reaches its sleep.
+  auto start = std::chrono::steady_clock::now();
+  Dispatcher::stopServices();
+  Dispatcher::joinServices();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+
+  FLAGS_distributed_long_poll = long_poll;
+  Registry::setActive("distributed", "tls");
 }
 }
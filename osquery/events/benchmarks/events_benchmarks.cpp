@@ -60,10 +60,12 @@ class BenchmarkEventSubscriber
   void clearRows() {
     expire_events_ = true;
     expire_time_ = -1;
-    getIndexes(0, 0);
+    expireRecords();
   }
 
   void benchmarkGet(int low, int high) { auto results = get(low, high); }
+
+  void benchmarkEventID() { auto eid = getEventID(); }
 };
 
 static void EVENTS_subscribe_fire(benchmark::State& state) {
@@ -110,6 +112,15 @@ static void EVENTS_add_events(benchmark::State& state) {
 
 BENCHMARK(EVENTS_add_events);
 
+static void EVENTS_get_event_id(benchmark::State& state) {
+  static auto sub = std::make_shared<BenchmarkEventSubscriber>();
+  while (state.KeepRunning()) {
+    sub->benchmarkEventID();
+  }
+}
+
+BENCHMARK(EVENTS_get_event_id)->ThreadRange(1, 8);
+
 static void EVENTS_retrieve_events(benchmark::State& state) {
   auto sub = std::make_shared<BenchmarkEventSubscriber>();
 
@@ -0,0 +1,355 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/events.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+DECLARE_string(database_plugin);
+DECLARE_uint64(events_max);
+DECLARE_uint64(events_expiry);
+
+/// Events each producer adds per benchmark iteration.
+const size_t kLoadEventsPerProducer = 2000;
+
+/// Events within one second of event time.
+const size_t kLoadEventsPerSecond = 1000;
+
+/// Events a query thread selects, the most recent events.
+const size_t kLoadQueryWindow = 1000;
+
+/**
+ * @brief Forward to the active database plugin, counting the bytes written.
+ *
+ * Keys and values of puts and batched writes are counted, deletes count their
+ * keys, and range deletes count both range keys.
+ */
+class CountingDatabasePlugin : public DatabasePlugin {
+ public:
+  Status get(const std::string& domain,
+             const std::string& key,
+             std::string& value) const override {
+    PluginResponse response;
+    auto status = call({{"action", "get"}, {"domain", domain}, {"key", key}},
+                       response);
+    if (response.size() > 0 && response[0].count("v") > 0) {
+      value = response[0].at("v");
+    }
+    return status;
+  }
+
+  Status put(const std::string& domain,
+             const std::string& key,
+             const std::string& value) override {
+    PluginResponse response;
+    return call(
+        {{"action", "put"}, {"domain", domain}, {"key", key}, {"value", value}},
+        response);
+  }
+
+  Status remove(const std::string& domain, const std::string& key) override {
+    PluginResponse response;
+    return call({{"action", "remove"}, {"domain", domain}, {"key", key}},
+                response);
+  }
+
+  Status call(const PluginRequest& request, PluginResponse& response) override {
+    const auto& action = request.at("action");
+    if (action == "put") {
+      bytes += request.at("key").size() + request.at("value").size();
+    } else if (action == "remove") {
+      bytes += request.at("key").size();
+    }
+    return wrapped->call(request, response);
+  }
+
+  Status scanRange(const std::string& domain,
+                   const std::string& start,
+                   const std::string& end,
+                   size_t max,
+                   bool reverse,
+                   bool values,
+                   std::vector<std::pair<std::string, std::string>>& results)
+      const override {
+    return wrapped->scanRange(
+        domain, start, end, max, reverse, values, results);
+  }
+
+  Status getMany(const std::string& domain,
+                 const std::vector<std::string>& keys,
+                 std::vector<std::string>& values) const override {
+    return wrapped->getMany(domain, keys, values);
+  }
+
+  Status write(const std::string& domain,
+               const std::vector<std::pair<std::string, std::string>>& puts,
+               const std::vector<std::string>& deletes) override {
+    for (const auto& put : puts) {
+      bytes += put.first.size() + put.second.size();
+    }
+    for (const auto& key : deletes) {
+      bytes += key.size();
+    }
+    return wrapped->write(domain, puts, deletes);
+  }
+
+  Status removeRange(const std::string& domain,
+                     const std::string& start,
+                     const std::string& end) override {
+    bytes += start.size() + end.size();
+    return wrapped->removeRange(domain, start, end);
+  }
+
+  /// The database plugin receiving each request.
+  std::shared_ptr<DatabasePlugin> wrapped{nullptr};
+
+  /// Bytes written to the wrapped database plugin.
+  std::atomic<size_t> bytes{0};
+};
+
+class EventsLoadPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("events_load");
+};
+
+/// A subscriber holding a backlog of events, one per backlog size.
+class EventsLoadSubscriber : public EventSubscriber<EventsLoadPublisher> {
+ public:
+  explicit EventsLoadSubscriber(const std::string& name) {
+    setName(name);
+  }
+
+  /// A file event row, the byte size is counted as the written content.
+  static Row getLoadRow(size_t i) {
+    return {
+        {"target_path", "/var/log/application/" + std::to_string(i % 64)},
+        {"category", "logs"},
+        {"action", (i % 3 == 0) ? "CREATED" : "UPDATED"},
+        {"transaction_id", std::to_string(i)},
+        {"inode", std::to_string(1000000 + i)},
+        {"uid", "0"},
+        {"mode", "0644"},
+        {"size", std::to_string(i * 31 % 65536)},
+    };
+  }
+
+  static size_t getRowBytes(const Row& r) {
+    size_t bytes = 0;
+    for (const auto& column : r) {
+      bytes += column.first.size() + column.second.size();
+    }
+    return bytes;
+  }
+
+  /// Add the next event, returns the row bytes including the time column.
+  size_t addNext() {
+    auto i = next_++;
+    auto r = getLoadRow(i);
+    add(r, start_ + i / kLoadEventsPerSecond);
+    return getRowBytes(r);
+  }
+
+  /// Select the most recent events.
+  size_t queryRecent() {
+    auto latest = start_ + next_ / kLoadEventsPerSecond;
+    auto window = kLoadQueryWindow / kLoadEventsPerSecond + 1;
+    return get(latest - window, latest).size();
+  }
+
+  /// Expire events overflowing events_max.
+  size_t expire() {
+    return expireCheck();
+  }
+
+ private:
+  /// The event time of the first event.
+  EventTime start_{getUnixTime() - 2 * 86400};
+
+  /// The index of the next event added.
+  std::atomic<size_t> next_{0};
+};
+
+/// Latency percentiles of added events, in microseconds.
+static std::string getLatencyLabel(std::vector<uint64_t>& latencies) {
+  if (latencies.empty()) {
+    return "";
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    auto index = static_cast<size_t>(p * (latencies.size() - 1));
+    return std::to_string(latencies[index] / 1000) + "us";
+  };
+  return "p50=" + percentile(0.50) + " p99=" + percentile(0.99) + " p999=" +
+         percentile(0.999) + " max=" + percentile(1.0);
+}
+
+/// Register the counting plugin, forwarding to the active database plugin.
+static std::shared_ptr<CountingDatabasePlugin> getCountingPlugin() {
+  static std::shared_ptr<CountingDatabasePlugin> counter = nullptr;
+  if (counter == nullptr) {
+    Registry::add<CountingDatabasePlugin>("database", "events_load");
+    counter = std::dynamic_pointer_cast<CountingDatabasePlugin>(
+        Registry::get("database", "events_load"));
+    counter->wrapped = std::dynamic_pointer_cast<DatabasePlugin>(
+        Registry::get("database", FLAGS_database_plugin));
+  }
+  return counter;
+}
+
+/// The backlog is stored once, expiry keeps it stable across runs.
+static std::shared_ptr<EventsLoadSubscriber> getLoadSubscriber(
+    size_t backlog) {
+  static std::map<size_t, std::shared_ptr<EventsLoadSubscriber>> subscribers;
+  auto& sub = subscribers[backlog];
+  if (sub == nullptr) {
+    sub = std::make_shared<EventsLoadSubscriber>("events_load_" +
+                                                 std::to_string(backlog));
+    for (size_t i = 0; i < backlog; ++i) {
+      sub->addNext();
+    }
+  }
+  return sub;
+}
+
+/**
+ * @brief Add events from concurrent producers while querying and expiring.
+ *
+ * The first argument is the number of producers and the second is the
+ * backlog, the events stored before and kept during the run by events_max.
+ * The template argument is each producer's rate in events per second, 0 for
+ * no limit. A query thread selects the most recent events and an expiry
+ * thread expires the overflow until the producers finish.
+ *
+ * The label reports the latency percentiles of add, the queries and expired
+ * events, and the write amplification: bytes written to the backing store per
+ * byte of added row content.
+ */
+template <size_t kRate>
+static void EVENTS_load(benchmark::State& state) {
+  auto producers = static_cast<size_t>(state.range_x());
+  auto backlog = static_cast<size_t>(state.range_y());
+
+  auto counter = getCountingPlugin();
+  auto database_plugin = FLAGS_database_plugin;
+  auto events_max = FLAGS_events_max;
+  auto events_expiry = FLAGS_events_expiry;
+  FLAGS_database_plugin = "events_load";
+  FLAGS_events_max = backlog;
+  FLAGS_events_expiry = 0;
+
+  auto sub = getLoadSubscriber(backlog);
+
+  std::vector<uint64_t> latencies;
+  size_t row_bytes = 0;
+  size_t queries = 0;
+  size_t expired = 0;
+  counter->bytes = 0;
+  while (state.KeepRunning()) {
+    std::atomic<size_t> running(producers);
+    std::vector<std::vector<uint64_t>> producer_latencies(producers);
+    std::vector<size_t> producer_bytes(producers, 0);
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+      threads.push_back(std::thread([&, p]() {
+        auto& times = producer_latencies[p];
+        times.reserve(kLoadEventsPerProducer);
+        // With a rate, each event is added at its scheduled time.
+        auto interval =
+            std::chrono::microseconds(1000000 / std::max<size_t>(kRate, 1));
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < kLoadEventsPerProducer; ++i) {
+          if (kRate > 0) {
+            std::this_thread::sleep_until(begin + interval * i);
+          }
+          auto start = std::chrono::steady_clock::now();
+          producer_bytes[p] += sub->addNext();
+          times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+        }
+        running--;
+      }));
+    }
+
+    std::thread query([&]() {
+      while (running > 0) {
+        sub->queryRecent();
+        queries++;
+      }
+    });
+
+    std::thread expiry([&]() {
+      while (running > 0) {
+        expired += sub->expire();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    });
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    query.join();
+    expiry.join();
+
+    for (size_t p = 0; p < producers; ++p) {
+      latencies.insert(latencies.end(),
+                       producer_latencies[p].begin(),
+                       producer_latencies[p].end());
+      row_bytes += producer_bytes[p];
+    }
+  }
+
+  // Staged events are written before the amplification is measured.
+  sub->queryRecent();
+  auto amplification = (row_bytes > 0)
+                           ? static_cast<double>(counter->bytes) / row_bytes
+                           : 0.0;
+  state.SetItemsProcessed(state.iterations() * producers *
+                          kLoadEventsPerProducer);
+  state.SetLabel(getLatencyLabel(latencies) + " queries=" +
+                 std::to_string(queries) + " expired=" +
+                 std::to_string(expired) + " write_amp=" +
+                 std::to_string(amplification));
+
+  FLAGS_database_plugin = database_plugin;
+  FLAGS_events_max = events_max;
+  FLAGS_events_expiry = events_expiry;
+}
+
+/// Producers from 1 to 8 sharing one backlog, then backlogs from 10k to 10M.
+static void getLoadArguments(benchmark::internal::Benchmark* b) {
+  for (int producers : {1, 2, 4, 8}) {
+    b->ArgPair(producers, 10000);
+  }
+  for (int backlog : {100000, 1000000, 10000000}) {
+    b->ArgPair(4, backlog);
+  }
+}
+
+BENCHMARK_TEMPLATE(EVENTS_load, 0)->Apply(getLoadArguments)->UseRealTime();
+BENCHMARK_TEMPLATE(EVENTS_load, 1000)->Apply(getLoadArguments)->UseRealTime();
+BENCHMARK_TEMPLATE(EVENTS_load, 10000)->Apply(getLoadArguments)->UseRealTime();
+}
@@ -12,10 +12,12 @@
 
 #include <boost/filesystem.hpp>
 
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/darwin/fsevents.h"
 
 /**
@@ -31,6 +33,19 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
+FLAG(uint64,
+     fsevents_latency,
+     1000,
+     "Milliseconds FSEvents batches file events before delivering them");
+
+FLAG(bool,
+     fsevents_checkpoint,
+     true,
+     "Persist the last FSEvents event ID and resume from it after a restart");
+
+/// The backing store key of the last delivered FSEvents event ID.
+const std::string kFSEventsCheckpointKey = "fsevents.last_event_id";
+
 std::map<FSEventStreamEventFlags, std::string> kMaskActions = {
     {kFSEventStreamEventFlagItemChangeOwner, "ATTRIBUTES_MODIFIED"},
     {kFSEventStreamEventFlagItemXattrMod, "ATTRIBUTES_MODIFIED"},
@@ -54,11 +69,47 @@ void FSEventsSubscriptionContext::requireAction(const std::string& action) {
   }
 }
 
+FSEventStreamEventId FSEventsEventPublisher::getSinceWhen() {
+  FSEventStreamEventId since = last_event_id_;
+  if (since == 0 && FLAGS_fsevents_checkpoint) {
+    // Resume after the last event delivered before osquery restarted.
+    std::string value;
+    long long saved = 0;
+    if (getDatabaseValue(kPersistentSettings, kFSEventsCheckpointKey, value)
+            .ok() &&
+        safeStrtoll(value, 10, saved).ok() && saved > 0) {
+      since = static_cast<FSEventStreamEventId>(saved);
+      saved_event_id_ = since;
+    }
+  }
+
+  // An event ID from before the FSEvents database was reset is invalid.
+  if (since == 0 || since > FSEventsGetCurrentEventId()) {
+    return kFSEventStreamEventIdSinceNow;
+  }
+  return since;
+}
+
+void FSEventsEventPublisher::checkpoint(FSEventStreamEventId id) {
+  if (id <= last_event_id_) {
+    return;
+  }
+  last_event_id_ = id;
+
+  if (FLAGS_fsevents_checkpoint && id != saved_event_id_) {
+    // One write for each delivered batch of events.
+    setDatabaseValue(kPersistentSettings,
+                     kFSEventsCheckpointKey,
+                     std::to_string(id));
+    saved_event_id_ = id;
+  }
+}
+
 void FSEventsEventPublisher::restart() {
   // Build paths as CFStrings
   std::vector<CFStringRef> cf_paths;
   {
-    ReadLock lock(mutex_);
+    WriteLock lock(mutex_);
     if (paths_.empty()) {
       // There are no paths to watch.
       paths_.insert("/dev/null");
@@ -69,6 +120,12 @@ void FSEventsEventPublisher::restart() {
       return;
     }
 
+    if (stream_ != nullptr && stream_started_ && paths_ == stream_paths_) {
+      // The running stream already watches these paths.
+      return;
+    }
+    stream_paths_ = paths_;
+
     for (const auto& path : paths_) {
       auto cf_path = CFStringCreateWithCString(
           nullptr, path.c_str(), kCFStringEncodingUTF8);
@@ -82,26 +139,27 @@ void FSEventsEventPublisher::restart() {
                                   cf_paths.size(),
                                   &kCFTypeArrayCallBacks);
 
-  // Remove any existing stream.
-  stop();
+  // Remove any existing stream, the run loop continues.
+  stopStream();
 
   // Set stream flags.
   auto flags =
       kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagWatchRoot;
-  if (no_defer_) {
+  if (no_defer_ || FLAGS_fsevents_latency == 0) {
     flags |= kFSEventStreamCreateFlagNoDefer;
   }
   if (no_self_) {
     flags |= kFSEventStreamCreateFlagIgnoreSelf;
   }
 
-  // Create the FSEvent stream.
+  // Create the FSEvent stream, the callback is given this publisher.
+  FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
   stream_ = FSEventStreamCreate(nullptr,
                                 &FSEventsEventPublisher::Callback,
-                                nullptr,
+                                &context,
                                 watch_list,
-                                kFSEventStreamEventIdSinceNow,
-                                1,
+                                getSinceWhen(),
+                                FLAGS_fsevents_latency / 1000.0,
                                 flags);
   if (stream_ != nullptr) {
     // Schedule the stream on the run loop.
@@ -122,8 +180,7 @@ void FSEventsEventPublisher::restart() {
   }
 }
 
-void FSEventsEventPublisher::stop() {
-  // Stop the stream.
+void FSEventsEventPublisher::stopStream() {
   if (stream_ != nullptr) {
     FSEventStreamStop(stream_);
     stream_started_ = false;
@@ -133,6 +190,11 @@ void FSEventsEventPublisher::stop() {
     FSEventStreamRelease(stream_);
     stream_ = nullptr;
   }
+}
+
+void FSEventsEventPublisher::stop() {
+  // Stop the stream.
+  stopStream();
 
   // Stop the run loop.
   if (run_loop_ != nullptr) {
@@ -195,6 +257,13 @@ void FSEventsEventPublisher::configure() {
       auto paths = transformSubscription(sc);
       paths_.insert(paths.begin(), paths.end());
     }
+
+    // Subscription paths are final once transformed.
+    matcher_.clear();
+    for (const auto& sub : subscriptions_) {
+      matcher_.insert(getSubscriptionContext(sub->context)->path, sub);
+    }
+    matcher_.setComplete();
   }
 
   restart();
@@ -221,11 +290,16 @@ void FSEventsEventPublisher::Callback(
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
   for (size_t i = 0; i < num_events; ++i) {
+    if (fsevent_flags[i] & kFSEventStreamEventFlagHistoryDone) {
+      // Marks the end of the events replayed since the checkpoint.
+      continue;
+    }
+
     auto ec = createEventContext();
     ec->fsevent_stream = stream;
     ec->fsevent_flags = fsevent_flags[i];
     ec->transaction_id = fsevent_ids[i];
-    ec->path = std::string(((char**)event_paths)[i]);
+    ec->path = ((char**)event_paths)[i];
 
     if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
@@ -257,6 +331,11 @@ void FSEventsEventPublisher::Callback(
       EventFactory::fire<FSEventsEventPublisher>(ec);
     }
   }
+
+  auto publisher = static_cast<FSEventsEventPublisher*>(callback_info);
+  if (publisher != nullptr && num_events > 0) {
+    publisher->checkpoint(fsevent_ids[num_events - 1]);
+  }
 }
 
 bool FSEventsEventPublisher::shouldFire(
@@ -288,10 +367,27 @@ void FSEventsEventPublisher::removeSubscriptions(
   {
     WriteLock lock(mutex_);
     std::set<std::string>().swap(paths_);
+    matcher_.clear();
   }
   EventPublisherPlugin::removeSubscriptions(subscription);
 }
 
+Status FSEventsEventPublisher::addSubscription(
+    const SubscriptionRef& subscription) {
+  {
+    // Every subscription is checked until the next configure.
+    WriteLock lock(mutex_);
+    matcher_.clear();
+  }
+  return EventPublisherPlugin::addSubscription(subscription);
+}
+
+bool FSEventsEventPublisher::matchSubscriptions(
+    const EventContextRef& ec, SubscriptionVector& matches) const {
+  ReadLock lock(mutex_);
+  return matcher_.match(getEventContext(ec)->path, matches);
+}
+
 void FSEventsEventPublisher::flush(bool async) {
   if (stream_ != nullptr && stream_started_) {
     if (async) {
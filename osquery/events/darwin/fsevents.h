@@ -19,10 +19,16 @@
 #include <CoreServices/CoreServices.h>
 
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/status.h>
 
+#include "osquery/events/path_trie.h"
+
 namespace osquery {
 
+DECLARE_uint64(fsevents_latency);
+DECLARE_bool(fsevents_checkpoint);
+
 struct FSEventsSubscriptionContext : public SubscriptionContext {
  public:
   /// Subscription the following filesystem path.
@@ -71,6 +77,15 @@ struct FSEventsEventContext : public EventContext {
 
   std::string path;
   std::string action;
+
+  /// Reset a pooled context, keeping the string buffers.
+  void clear() {
+    fsevent_stream = nullptr;
+    fsevent_flags = 0;
+    transaction_id = 0;
+    path.clear();
+    action.clear();
+  }
 };
 
 using FSEventsEventContextRef = std::shared_ptr<FSEventsEventContext>;
@@ -104,6 +119,13 @@ class FSEventsEventPublisher
   /// Delete all paths from prior configuration.
   void removeSubscriptions(const std::string& subscriber) override;
 
+  /// Add a subscription, it is matched by path once configured.
+  Status addSubscription(const SubscriptionRef& subscription) override;
+
+  /// Find the subscriptions matching an event path prefix.
+  bool matchSubscriptions(const EventContextRef& ec,
+                          SubscriptionVector& matches) const override;
+
  public:
   /// FSEvents registers a client callback instead of using a select/poll loop.
   static void Callback(ConstFSEventStreamRef fsevent_stream,
@@ -118,12 +140,27 @@ class FSEventsEventPublisher
                   const FSEventsEventContextRef& ec) const override;
 
  private:
-  /// Restart the run loop.
+  /**
+   * @brief Replace the stream if the watched paths changed.
+   *
+   * The run loop keeps running, the new stream is scheduled on it. The stream
+   * resumes from the last event ID seen, so events while the stream changes
+   * are not lost.
+   */
   void restart();
 
   /// Stop the stream and the run loop.
   void stop();
 
+  /// Stop and release the stream, the run loop keeps running.
+  void stopStream();
+
+  /// Record the last event ID delivered, persisted if fsevents_checkpoint.
+  void checkpoint(FSEventStreamEventId id);
+
+  /// The event ID a new stream should start after.
+  FSEventStreamEventId getSinceWhen();
+
   /// Cause the FSEvents to flush kernel-buffered events.
   void flush(bool async = false);
 
@@ -158,6 +195,18 @@ class FSEventsEventPublisher
   /// Set of paths to monitor, determined by a configure step.
   std::set<std::string> paths_;
 
+  /// The paths watched by the running stream.
+  std::set<std::string> stream_paths_;
+
+  /// The last event ID delivered by a stream, 0 before any event.
+  std::atomic<FSEventStreamEventId> last_event_id_{0};
+
+  /// The last event ID written to the backing store.
+  FSEventStreamEventId saved_event_id_{0};
+
+  /// The subscriptions by path, rebuilt when configured.
+  SubscriptionPathTrie matcher_;
+
   /// Reference to the run loop for this thread.
   CFRunLoopRef run_loop_{nullptr};
 
@@ -168,7 +217,7 @@ class FSEventsEventPublisher
   /// For testing only, allow the event stream to publish its own events.
   bool no_self_{true};
 
-  /// Access to watched path set.
+  /// Access to watched path set and the subscription trie.
   mutable boost::shared_mutex mutex_;
 
  private:
@@ -179,5 +228,6 @@ class FSEventsEventPublisher
   FRIEND_TEST(FSEventsTests, test_fsevents_run);
   FRIEND_TEST(FSEventsTests, test_fsevents_fire_event);
   FRIEND_TEST(FSEventsTests, test_fsevents_event_action);
+  FRIEND_TEST(FSEventsTests, test_fsevents_checkpoint);
 };
 }
@@ -71,6 +71,9 @@ void IOKitEventPublisher::restart() {
     }
   }
   publisher_started_ = true;
+
+  // PCI device attaches and detaches invalidate the cached pci_devices.
+  TablePlugin::setHotplugWatched(true);
 }
 
 void IOKitEventPublisher::newEvent(const io_service_t& device,
@@ -87,6 +90,10 @@ void IOKitEventPublisher::newEvent(const io_service_t& device,
     ec->type = std::string(class_name);
   }
 
+  if (ec->type == tables::kIOPCIDeviceClassName_) {
+    TablePlugin::invalidateHotplugCache();
+  }
+
   // Get the device details
   CFMutableDictionaryRef details;
   IORegistryEntryCreateCFProperties(
@@ -225,6 +232,7 @@ void IOKitEventPublisher::stop() {
 }
 
 void IOKitEventPublisher::tearDown() {
+  TablePlugin::setHotplugWatched(false);
   stop();
 
   // Do not keep a reference to the run loop.
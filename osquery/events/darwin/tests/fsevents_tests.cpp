@@ -14,6 +14,7 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
@@ -320,4 +321,30 @@ TEST_F(FSEventsTests, test_fsevents_event_action) {
 
   EndEventLoop();
 }
+
+TEST_F(FSEventsTests, test_fsevents_checkpoint) {
+  auto pub = std::make_shared<FSEventsEventPublisher>();
+  auto current = FSEventsGetCurrentEventId();
+  ASSERT_GT(current, 2U);
+
+  // Delivered event IDs are persisted, older IDs are ignored.
+  pub->checkpoint(current - 1);
+  pub->checkpoint(current - 2);
+  EXPECT_EQ(pub->last_event_id_, current - 1);
+  std::string value;
+  getDatabaseValue(kPersistentSettings, "fsevents.last_event_id", value);
+  EXPECT_EQ(value, std::to_string(current - 1));
+
+  // A new publisher resumes from the persisted event ID.
+  auto resumed = std::make_shared<FSEventsEventPublisher>();
+  EXPECT_EQ(resumed->getSinceWhen(), current - 1);
+
+  // An event ID past the current ID is not resumed from.
+  setDatabaseValue(kPersistentSettings,
+                   "fsevents.last_event_id",
+                   std::to_string(current + 1000000));
+  auto reset = std::make_shared<FSEventsEventPublisher>();
+  EXPECT_EQ(reset->getSinceWhen(), kFSEventStreamEventIdSinceNow);
+  deleteDatabaseValue(kPersistentSettings, "fsevents.last_event_id");
+}
 }
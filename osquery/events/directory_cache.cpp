@@ -0,0 +1,220 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include <boost/algorithm/string/split.hpp>
+
+#include "osquery/events/directory_cache.h"
+
+namespace osquery {
+
+/// Check if a directory pattern component has a glob wildcard.
+static inline bool hasWildcard(const std::string& component) {
+  return component.find_first_of("*?[") != std::string::npos;
+}
+
+const DirectoryCache::Entry* DirectoryCache::refresh(const std::string& dir,
+                                                     bool observed) {
+  auto it = entries_.find(dir);
+  if (it != entries_.end() && it->second.observed) {
+    it->second.observed = observed;
+    return &it->second;
+  }
+
+  struct stat info;
+  if (::stat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+    if (it != entries_.end()) {
+      entries_.erase(it);
+    }
+    return nullptr;
+  }
+
+  if (it != entries_.end()) {
+    auto& entry = it->second;
+    if (entry.mtime.tv_sec == info.st_mtim.tv_sec &&
+        entry.mtime.tv_nsec == info.st_mtim.tv_nsec &&
+        entry.inode == info.st_ino && entry.device == info.st_dev) {
+      // Nothing was created, removed, or renamed within the directory.
+      entry.observed = observed;
+      return &entry;
+    }
+  }
+
+  auto handle = ::opendir(dir.c_str());
+  if (handle == nullptr) {
+    return nullptr;
+  }
+
+  Entry entry;
+  entry.mtime = info.st_mtim;
+  entry.inode = info.st_ino;
+  entry.device = info.st_dev;
+  entry.observed = observed;
+  struct dirent* child = nullptr;
+  while ((child = ::readdir(handle)) != nullptr) {
+    std::string name = child->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+
+    auto path = dir + name;
+    if (child->d_type == DT_DIR) {
+      entry.children.push_back(std::make_pair(name, path + '/'));
+      continue;
+    }
+    if (child->d_type != DT_LNK && child->d_type != DT_UNKNOWN) {
+      continue;
+    }
+
+    // Linked directories are followed, as a recursive glob does.
+    struct stat target;
+    if (::stat(path.c_str(), &target) != 0 || !S_ISDIR(target.st_mode)) {
+      continue;
+    }
+    if (child->d_type == DT_LNK) {
+      char resolved[PATH_MAX] = {0};
+      if (::realpath(path.c_str(), resolved) == nullptr) {
+        continue;
+      }
+      path = resolved;
+    }
+    entry.children.push_back(std::make_pair(name, path + '/'));
+  }
+  ::closedir(handle);
+
+  listings_++;
+  auto& stored = entries_[dir];
+  stored = std::move(entry);
+  return &stored;
+}
+
+void DirectoryCache::list(const std::string& dir,
+                          bool observed,
+                          bool hidden,
+                          std::vector<std::string>& children) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = refresh(dir, observed);
+  if (entry == nullptr) {
+    return;
+  }
+
+  for (const auto& child : entry->children) {
+    if (hidden || child.first[0] != '.') {
+      children.push_back(child.second);
+    }
+  }
+}
+
+void DirectoryCache::resolve(const std::string& pattern,
+                             const ObservedCallback& observed,
+                             std::vector<std::string>& results) {
+  if (pattern.empty() || pattern[0] != '/') {
+    return;
+  }
+
+  std::vector<std::string> components;
+  boost::split(components, pattern, [](char c) { return c == '/'; });
+  bool trailing = (pattern.back() == '/');
+
+  // Expand each component from the root, the last component may be a file.
+  std::vector<std::string> dirs = {"/"};
+  for (size_t i = 1; i < components.size() && !dirs.empty(); i++) {
+    const auto& component = components[i];
+    if (component.empty()) {
+      continue;
+    }
+
+    bool last = true;
+    for (size_t j = i + 1; j < components.size(); j++) {
+      last = last && components[j].empty();
+    }
+
+    std::vector<std::string> matches;
+    for (const auto& dir : dirs) {
+      if (!hasWildcard(component)) {
+        auto path = dir + component;
+        struct stat info;
+        if (::stat(path.c_str(), &info) != 0) {
+          continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+          matches.push_back(path + '/');
+        } else if (last && !trailing) {
+          matches.push_back(path);
+        }
+        continue;
+      }
+
+      auto is_observed = observed(dir);
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto entry = refresh(dir, is_observed);
+      if (entry == nullptr) {
+        continue;
+      }
+      for (const auto& child : entry->children) {
+        if (::fnmatch(component.c_str(), child.first.c_str(), FNM_PERIOD) ==
+            0) {
+          matches.push_back(dir + child.first + '/');
+        }
+      }
+    }
+    dirs = std::move(matches);
+  }
+
+  for (auto& path : dirs) {
+    if (!trailing && path.size() > 1 && path.back() == '/') {
+      path.pop_back();
+    }
+    results.push_back(std::move(path));
+  }
+}
+
+void DirectoryCache::invalidate(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.erase(dir);
+}
+
+void DirectoryCache::unobserve(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(dir);
+  if (it != entries_.end()) {
+    it->second.observed = false;
+  }
+}
+
+void DirectoryCache::unobserveAll() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& entry : entries_) {
+    entry.second.observed = false;
+  }
+}
+
+void DirectoryCache::remove(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.lower_bound(dir);
+  while (it != entries_.end() && it->first.compare(0, dir.size(), dir) == 0) {
+    it = entries_.erase(it);
+  }
+}
+
+size_t DirectoryCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t DirectoryCache::listings() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return listings_;
+}
+}
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief The subdirectories of each expanded directory, kept until it changes.
+ *
+ * File event publishers expand recursive and wildcard subscription paths into
+ * the directories they watch. Expanding on every configure, and after an
+ * event queue overflow, walked each subscribed tree again.
+ *
+ * A directory's listing is kept with its modification time. It is listed
+ * again if the publisher reported a change with invalidate, or if changes
+ * were not observed and the modification time differs. A directory whose
+ * changes are observed, it is watched and the publisher invalidates it when
+ * a subdirectory is created, removed, or renamed, is not checked at all.
+ * Other directories cost a stat rather than a listing.
+ */
+class DirectoryCache : private boost::noncopyable {
+ public:
+  /// Decide if the changes of a directory are observed by the caller.
+  using ObservedCallback = std::function<bool(const std::string& dir)>;
+
+  /**
+   * @brief List the subdirectories of a directory.
+   *
+   * Linked directories are followed and reported with their canonical path.
+   *
+   * @param dir The directory, with a trailing '/'.
+   * @param observed The caller reports changes to dir until unobserve.
+   * @param hidden Include the subdirectories starting with '.'.
+   * @param children The output subdirectories, each with a trailing '/'.
+   */
+  void list(const std::string& dir,
+            bool observed,
+            bool hidden,
+            std::vector<std::string>& children);
+
+  /**
+   * @brief Expand the '*' components of a directory pattern.
+   *
+   * Wildcard components match directories like a glob, '*' does not match a
+   * leading '.'. A last component without a wildcard matches a file or a
+   * directory.
+   *
+   * @param pattern An absolute path with wildcard components.
+   * @param observed Decides if the changes of each listed directory are
+   * observed, see list.
+   * @param results The output matching paths, directories have a trailing
+   * '/' if the pattern does.
+   */
+  void resolve(const std::string& pattern,
+               const ObservedCallback& observed,
+               std::vector<std::string>& results);
+
+  /// A subdirectory of dir was created, removed, or renamed.
+  void invalidate(const std::string& dir);
+
+  /// Changes to dir are no longer reported, such as when its watch is removed.
+  void unobserve(const std::string& dir);
+
+  /// Forget every observation, changes may have been missed.
+  void unobserveAll();
+
+  /// Remove a directory and every directory below it.
+  void remove(const std::string& dir);
+
+  /// The number of cached directories.
+  size_t size() const;
+
+  /// The number of directories read, for expansion statistics.
+  size_t listings() const;
+
+ private:
+  /// A listed directory.
+  struct Entry {
+    /// The directory's modification time and identity when it was listed.
+    struct timespec mtime;
+    ino_t inode{0};
+    dev_t device{0};
+
+    /// Changes are reported through invalidate, the entry is not checked.
+    bool observed{false};
+
+    /// Each subdirectory's name and canonical path.
+    std::vector<std::pair<std::string, std::string>> children;
+  };
+
+ private:
+  /// List dir again if it changed, returns nullptr if it is not readable.
+  const Entry* refresh(const std::string& dir, bool observed);
+
+ private:
+  /// The listed directories by path.
+  std::map<std::string, Entry> entries_;
+
+  /// The number of directories read.
+  size_t listings_{0};
+
+  /// Protects the entries, used by configure and publisher threads.
+  mutable std::mutex mutex_;
+};
+}
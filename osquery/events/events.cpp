@@ -8,11 +8,13 @@
  *
  */
 
+#include <algorithm>
 #include <exception>
 
-#include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/lexical_cast.hpp>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
 
 #include <osquery/config.h>
 #include <osquery/core.h>
@@ -21,15 +23,37 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
-#include "osquery/database/db_handle.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/tracing.h"
+#include "osquery/dispatcher/dispatcher.h"
+#include "osquery/events/memory_store.h"
+#include "osquery/events/segment.h"
 
 namespace osquery {
 
 /// Helper cooloff (ms) macro to prevent thread failure thrashing.
 #define EVENTS_COOLOFF 20
 
-/// Checkpoint interval to inspect max event buffering.
-#define EVENTS_CHECKPOINT 256
+/// Number of EventIDs reserved with each backing store write.
+#define EVENTS_ID_BLOCK 10000
+
+/// Number of events read and deserialized with each streamed batch.
+#define EVENTS_PAGE_SIZE 256
+
+/// Number of queued callbacks a dispatch queue drain task calls at once.
+const size_t kDispatchBatch = 64;
+
+/// Number of ready descriptors the events reactor handles per wait.
+const size_t kReactorEvents = 64;
+
+/// Milliseconds the reactor waits before checking ending and staged events.
+const int kReactorLatency = 500;
+
+/// The most events each publisher holds for coalescing.
+const size_t kCoalesceMax = 4096;
+
+/// Seconds of each EventMetrics window.
+const uint64_t kEventMetricsWindow = 60;
 
 FLAG(bool, disable_events, false, "Disable osquery publish/subscribe system");
 
@@ -45,10 +69,80 @@ FLAG(uint64,
 
 FLAG(uint64, events_max, 1000, "Maximum number of events per type to buffer");
 
-const std::vector<size_t> kEventTimeLists = {
-    1 * 60 * 60, // 1 hour
-    1 * 60, // 1 minute
-    10, // 10 seconds
+FLAG(bool,
+     events_memory,
+     false,
+     "Keep buffered events in memory, they do not survive a restart");
+
+FLAG(uint64,
+     events_expiry_interval,
+     60,
+     "Seconds between background expirations of buffered events");
+
+FLAG(uint64,
+     events_batch_size,
+     64,
+     "Number of events per subscriber to stage before a batched write");
+
+FLAG(uint64,
+     events_batch_latency,
+     500,
+     "Maximum milliseconds an event is staged before a batched write");
+
+FLAG(uint64,
+     events_dispatch_queue,
+     1024,
+     "Events queued per dispatching subscriber, 0 calls subscribers inline");
+
+FLAG(uint64,
+     events_dispatch_workers,
+     1,
+     "Worker threads per dispatching subscriber");
+
+FLAG(bool,
+     events_reactor,
+     true,
+     "Run publishers with descriptors on one shared epoll thread");
+
+FLAG(uint64,
+     events_coalesce_window,
+     0,
+     "Milliseconds repeated events are merged before firing, 0 disables");
+
+FLAG(uint64,
+     events_cold_age,
+     0,
+     "Seconds before buffered events are compacted into segments, 0 disables");
+
+FLAG(string,
+     events_dispatch_policy,
+     "drop_oldest",
+     "Full dispatch queue policy: drop_oldest, drop_newest, block");
+
+/// Events are stored under "event.<namespace>.<time>.<eid>".
+const std::string kEventKeyPrefix = "event.";
+
+/// Width of the zero-padded time and EventID key fields, keeps keys ordered.
+const size_t kEventTimeWidth = 10;
+const size_t kEventIDWidth = 20;
+
+/// Compacted events are stored under "segment.<namespace>.<min>.<max>".
+const std::string kEventSegmentPrefix = "segment.";
+
+/// Number of events compacted into each segment.
+const size_t kEventSegmentSize = 4096;
+
+/**
+ * @brief A Dispatcher service expiring buffered events.
+ *
+ * Every events_expiry_interval seconds each running subscriber applies the
+ * events_expiry and events_max limits, keeping expiration off the query-time
+ * and event ingestion paths.
+ */
+class EventExpirationRunner : public InternalRunnable {
+ public:
+  /// Sleep for the interval then expire each subscriber's events.
+  void start() override;
 };
 
 void publisherSleep(size_t milli) {
@@ -64,9 +158,12 @@ static inline EventTime timeFromRecord(const std::string& record) {
   return afinite;
 }
 
-QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
+void EventSubscriberPlugin::getTimeRange(QueryContext& context,
+                                         EventTime& start,
+                                         EventTime& stop) {
   // Stop is an unsigned (-1), our end of time equivalent.
-  EventTime start = 0, stop = -1;
+  start = 0;
+  stop = -1;
   if (context.constraints["time"].getAll().size() > 0) {
     // Use the 'time' constraint to optimize backing-store lookups.
     for (const auto& constraint : context.constraints["time"].getAll()) {
@@ -84,432 +181,1146 @@ QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
         stop = std::min(stop, expr);
       }
     }
-  } else if (kToolType == OSQUERY_TOOL_DAEMON && FLAGS_events_optimize) {
-    // If the daemon is querying a subscriber without a 'time' constraint and
-    // allows optimization, only emit events since the last query.
-    start = optimize_time_;
-    optimize_time_ = getUnixTime() - 1;
+  } else if (kToolType == OSQUERY_TOOL_DAEMON && FLAGS_events_optimize &&
+             !TablePlugin::kQueryName.empty()) {
+    // If a scheduled query selects from a subscriber without a 'time'
+    // constraint and allows optimization, only emit events since the last
+    // execution of the same query.
+    const auto& query = TablePlugin::kQueryName;
+    auto index_key = "optimize." + dbNamespace() + "." + query;
+    EventTime optimize_time = getUnixTime() - 1;
+    {
+      boost::lock_guard<EventMutex> lock(optimize_lock_);
+      auto last = optimize_times_.find(query);
+      if (last == optimize_times_.end()) {
+        // Restore the query's time, or start from the subscriber's time.
+        std::string content;
+        EventTime restored = optimize_time_;
+        if (getDatabaseValue(kEvents, index_key, content) && !content.empty()) {
+          restored = timeFromRecord(content);
+        }
+        last = optimize_times_.insert({query, restored}).first;
+      }
+      start = last->second;
+      last->second = optimize_time;
+    }
 
     // Store the optimize time such that it can be restored if the daemon is
-    // restarted.
-    auto db = DBHandle::getInstance();
-    auto index_key = "optimize." + dbNamespace();
-    db->Put(kEvents, index_key, std::to_string(optimize_time_));
+    // restarted, events kept in memory are not restored.
+    if (memory_store_ == nullptr) {
+      setDatabaseValue(kEvents, index_key, std::to_string(optimize_time));
+    }
   }
-
-  return get(start, stop);
 }
 
 void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
+  TRACE_SCOPE("events.fire");
   if (isEnding()) {
     // Cannot emit/fire while ending
     return;
   }
 
+  // Fill in EventContext time if needed, a held event keeps its first time.
+  if (ec != nullptr && ec->time == 0) {
+    ec->time = (time == 0) ? getUnixTime() : time;
+  }
+
+  if (FLAGS_events_coalesce_window > 0 && ec != nullptr) {
+    auto key = coalesceKey(ec);
+    if (!key.empty()) {
+      EventContextRef oldest = nullptr;
+      {
+        boost::lock_guard<boost::mutex> lock(coalesce_lock_);
+        auto held = coalesced_.find(key);
+        if (held != coalesced_.end()) {
+          held->second.ec->count += ec->count;
+          return;
+        }
+
+        if (coalesced_.size() >= kCoalesceMax) {
+          // Too many distinct events are held, fire the oldest early.
+          auto first = coalesced_.find(coalesce_order_.front());
+          oldest = first->second.ec;
+          coalesced_.erase(first);
+          coalesce_order_.pop_front();
+        }
+        coalesced_[key] = {ec, std::chrono::steady_clock::now()};
+        coalesce_order_.push_back(key);
+      }
+
+      if (oldest != nullptr) {
+        dispatch(oldest);
+      }
+      return;
+    }
+  }
+  dispatch(ec);
+}
+
+void EventPublisherPlugin::fireCoalesced(bool force) {
+  std::vector<EventContextRef> expired;
+  {
+    boost::lock_guard<boost::mutex> lock(coalesce_lock_);
+    auto window = std::chrono::milliseconds(FLAGS_events_coalesce_window);
+    auto now = std::chrono::steady_clock::now();
+    while (!coalesce_order_.empty()) {
+      auto held = coalesced_.find(coalesce_order_.front());
+      if (!force && now - held->second.first < window) {
+        break;
+      }
+      expired.push_back(held->second.ec);
+      coalesced_.erase(held);
+      coalesce_order_.pop_front();
+    }
+  }
+
+  for (const auto& ec : expired) {
+    dispatch(ec);
+  }
+}
+
+void EventPublisherPlugin::dispatch(const EventContextRef& ec) {
   EventContextID ec_id = 0;
   {
-    boost::lock_guard<boost::mutex> lock(ec_id_lock_);
+    boost::lock_guard<EventMutex> lock(ec_id_lock_);
     ec_id = next_ec_id_++;
   }
 
-  // Fill in EventContext ID and time if needed.
   if (ec != nullptr) {
     ec->id = ec_id;
-    if (ec->time == 0) {
-      if (time == 0) {
-        time = getUnixTime();
+  }
+
+  auto fired = EventMetrics::now();
+  SubscriptionVector matches;
+  bool matched = (ec != nullptr) && matchSubscriptions(ec, matches);
+  for (const auto& subscription : (matched) ? matches : subscriptions_) {
+    auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
+    if (es != nullptr && es->state() == SUBSCRIBER_RUNNING) {
+      es->event_count_++;
+      if (es->dispatch_queue_ != nullptr) {
+        // Slow subscribers are called from their own dispatch workers.
+        es->dispatch_queue_->push([this, es, subscription, ec, fired]() {
+          callSubscriber(es, subscription, ec, fired);
+        });
+      } else {
+        callSubscriber(es, subscription, ec, fired);
       }
-      ec->time = time;
     }
   }
+  fire_metrics_.record(EventMetrics::now() - fired);
+}
+
+void EventPublisherPlugin::callSubscriber(const EventSubscriberRef& es,
+                                          const SubscriptionRef& sub,
+                                          const EventContextRef& ec,
+                                          uint64_t fired) const {
+  auto start = EventMetrics::now();
+  fireCallback(sub, ec);
+  auto end = EventMetrics::now();
+  es->callback_metrics_.record(end - start);
+  es->store_metrics_.record(end - fired);
+}
 
+bool EventPublisherPlugin::hasDispatchQueues() const {
   for (const auto& subscription : subscriptions_) {
     auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
-    if (es != nullptr && es->state() == SUBSCRIBER_RUNNING) {
-      es->event_count_++;
-      fireCallback(subscription, ec);
+    if (es != nullptr && es->dispatch_queue_ != nullptr) {
+      return true;
     }
   }
+  return false;
 }
 
-std::set<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
-                                                        EventTime stop,
-                                                        size_t list_key) {
-  auto db = DBHandle::getInstance();
-  auto index_key = "indexes." + dbNamespace();
-  std::set<std::string> indexes;
+struct EventMetrics::Shard {
+  /// Protects the windows, the shard's threads and readers may race.
+  mutable boost::mutex lock;
 
-  // Keep track of the tail/head of account time while bin searching.
-  EventTime start_max = stop, stop_min = stop, local_start, local_stop;
-  auto types = kEventTimeLists.size();
-  // List types are sized bins of time containing records for this namespace.
-  for (size_t i = 0; i < types; ++i) {
-    auto size = kEventTimeLists[i];
-    if (list_key > 0 && i != list_key) {
-      // A specific list_type was requested, only return bins of this key.
+  /// The window of the current durations.
+  uint64_t window{0};
+
+  /// The durations of the current window.
+  Histogram current;
+
+  /// The durations of the window before the current window.
+  Histogram previous;
+};
+
+/// The index of the EventMetrics window including a steady clock time.
+static inline uint64_t getMetricsWindow(uint64_t micros) {
+  return micros / (kEventMetricsWindow * 1000000);
+}
+
+EventMetrics::~EventMetrics() {
+  for (auto& shard : shards_) {
+    delete shard.load();
+  }
+}
+
+uint64_t EventMetrics::now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+EventMetrics::Shard& EventMetrics::getShard() {
+  // Threads are spread over the shards as they first record any metrics.
+  static std::atomic<size_t> next_slot{0};
+  static thread_local size_t slot = next_slot++ % kShards;
+
+  auto shard = shards_[slot].load(std::memory_order_acquire);
+  if (shard == nullptr) {
+    auto created = new Shard();
+    if (shards_[slot].compare_exchange_strong(shard, created)) {
+      shard = created;
+    } else {
+      delete created;
+    }
+  }
+  return *shard;
+}
+
+void EventMetrics::record(uint64_t micros) {
+  auto window = getMetricsWindow(now());
+  auto& shard = getShard();
+  boost::lock_guard<boost::mutex> lock(shard.lock);
+  if (shard.window != window) {
+    // Rotate the windows, durations older than the previous window are reset.
+    shard.previous =
+        (shard.window + 1 == window) ? shard.current : Histogram();
+    shard.current = Histogram();
+    shard.window = window;
+  }
+  shard.current.record(micros);
+}
+
+void EventMetrics::merge(double& rate, Histogram& durations) const {
+  auto window = getMetricsWindow(now());
+  uint64_t previous = 0;
+  for (const auto& slot : shards_) {
+    auto shard = slot.load(std::memory_order_acquire);
+    if (shard == nullptr) {
       continue;
     }
 
-    std::string time_list;
-    auto list_type = boost::lexical_cast<std::string>(size);
-    db->Get(kEvents, index_key + "." + list_type, time_list);
-    if (time_list.empty()) {
-      // No events in this binning size.
-      return indexes;
+    // A shard that has not recorded during this window is not rotated.
+    boost::lock_guard<boost::mutex> lock(shard->lock);
+    if (shard->window == window) {
+      durations.merge(shard->current);
+      durations.merge(shard->previous);
+      previous += shard->previous.count();
+    } else if (shard->window + 1 == window) {
+      durations.merge(shard->current);
+      previous += shard->current.count();
     }
+  }
+  rate = static_cast<double>(previous) / kEventMetricsWindow;
+}
 
-    if (list_key == 0 && i == (types - 1) && types > 1) {
-      // Relax the requested start/stop bounds.
-      if (start != start_max) {
-        start = (start / size) * size;
-        start_max = ((start / size) + 1) * size;
-        if (start_max < stop) {
-          start_max = start + kEventTimeLists[types - 2];
-        }
-      }
+/// The steady clock milliseconds used to measure dispatch latency.
+static inline size_t getDispatchTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
-      if (stop != stop_min) {
-        stop = ((stop / size) + 1) * size;
-        stop_min = (stop / size) * size;
-        if (stop_min > start) {
-          stop_min = stop_min - kEventTimeLists[types - 1];
-        }
-      }
-    } else if (list_key > 0 || types == 1) {
-      // Relax the requested bounds to fit the requested/only index.
-      start = (start / size) * size;
-      start_max = ((start_max / size) + 1) * size;
-    }
-
-    // (1) The first iteration will have 1 range (start to start_max=stop).
-    // (2) Intermediate iterations will have 2 (start-start_max, stop-stop_min).
-    // For each iteration the range collapses based on the coverage using
-    // the first bin's start time and the last bin's stop time.
-    // (3) The last iteration's range includes relaxed bounds outside the
-    // requested start to stop range.
-    std::vector<std::string> all_bins, bins, expirations;
-    boost::split(all_bins, time_list, boost::is_any_of(","));
-    for (const auto& bin : all_bins) {
-      // Bins are identified by the binning size step.
-      auto step = timeFromRecord(bin);
-      // Check if size * step -> size * (step + 1) is within a range.
-      size_t bin_start = size * step;
-      size_t bin_stop = size * (step + 1);
-      if (expire_events_ && expire_time_ > 0) {
-        if (bin_stop <= expire_time_) {
-          // This entire bin will be expired.
-          expirations.push_back(bin);
-        } else if (bin_start < expire_time_) {
-          expireRecords(list_type, bin, false);
-        }
-      }
+EventDispatchQueue::EventDispatchQueue(const std::string& name,
+                                       size_t capacity,
+                                       EventDispatchPolicy policy,
+                                       size_t workers)
+    : name_(name),
+      capacity_(std::max<size_t>(capacity, 1)),
+      policy_(policy),
+      workers_(std::max<size_t>(workers, 1)) {}
 
-      if (bin_start >= start && bin_stop <= start_max) {
-        bins.push_back(bin);
-      } else if ((bin_start >= stop_min && bin_stop <= stop) || stop == 0) {
-        bins.push_back(bin);
+bool EventDispatchQueue::push(Task task) {
+  {
+    boost::unique_lock<boost::mutex> lock(lock_);
+    if (policy_ == DISPATCH_BLOCK) {
+      while (!stopping_ && tasks_.size() >= capacity_) {
+        space_.wait(lock);
       }
     }
 
-    // Rewrite the index lists and delete each expired item.
-    if (!expirations.empty()) {
-      expireIndexes(list_type, all_bins, expirations);
+    if (stopping_ ||
+        (policy_ == DISPATCH_DROP_NEWEST && tasks_.size() >= capacity_)) {
+      dropped_++;
+      return false;
     }
 
-    if (!bins.empty()) {
-      // If more precision was achieved though this list's binning.
-      local_start = timeFromRecord(bins.front()) * size;
-      start_max = (local_start < start_max) ? local_start : start_max;
-      local_stop = (timeFromRecord(bins.back()) + 1) * size;
-      stop_min = (local_stop < stop_min) ? local_stop : stop_min;
+    if (tasks_.size() >= capacity_) {
+      // Make room by dropping the oldest queued event.
+      tasks_.pop_front();
+      dropped_++;
+    }
+    tasks_.push_back(std::make_pair(std::move(task), getDispatchTime()));
+    if (active_ >= workers_) {
+      // A running drain task calls this task.
+      return true;
     }
+    active_++;
+  }
+  schedule();
+  return true;
+}
 
-    for (const auto& bin : bins) {
-      indexes.insert(list_type + "." + bin);
+void EventDispatchQueue::schedule() {
+  auto queued = Dispatcher::submit([this](const osquery::Task&) { drain(); },
+                                   TASK_PRIORITY_EVENTS);
+  if (queued == nullptr) {
+    // The dispatcher is stopping, the queued tasks are dropped by stop.
+    {
+      boost::lock_guard<boost::mutex> lock(lock_);
+      active_--;
     }
+    idle_.notify_all();
+  }
+}
 
-    if (start == start_max && stop == stop_min) {
-      break;
+void EventDispatchQueue::drain() {
+  // Yield the worker after a batch so other queues and tasks are not starved.
+  for (size_t i = 0; i < kDispatchBatch; i++) {
+    QueuedTask task;
+    {
+      boost::lock_guard<boost::mutex> lock(lock_);
+      if (stopping_ || tasks_.empty()) {
+        active_--;
+        idle_.notify_all();
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
     }
+    space_.notify_one();
+    task.first();
+
+    // Weight each task as an eighth of the average.
+    auto latency = getDispatchTime() - task.second;
+    latency_ = (latency_ * 7 + latency) / 8;
   }
+  schedule();
+}
 
-  // Update the new time that events expire to now - expiry.
-  return indexes;
+size_t EventDispatchQueue::queued() const {
+  boost::lock_guard<boost::mutex> lock(lock_);
+  return tasks_.size();
 }
 
-void EventSubscriberPlugin::expireRecords(const std::string& list_type,
-                                          const std::string& index,
-                                          bool all) {
-  auto db = DBHandle::getInstance();
-  auto record_key = "records." + dbNamespace();
-  auto data_key = "data." + dbNamespace();
+void EventDispatchQueue::stop() {
+  {
+    boost::lock_guard<boost::mutex> lock(lock_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+    dropped_ += tasks_.size();
+    tasks_.clear();
+  }
+  space_.notify_all();
 
-  // If the expirations is not removing all records, rewrite the persisting.
-  std::vector<std::string> persisting_records;
-  // Request all records within this list-size + bin offset.
-  auto expired_records = getRecords({list_type + "." + index});
-  for (const auto& record : expired_records) {
-    if (all) {
-      db->Delete(kEvents, data_key + "." + record.first);
-    } else if (record.second > expire_time_) {
-      persisting_records.push_back(record.first + ":" +
-                                   std::to_string(record.second));
+  {
+    // Wait for the in-flight callbacks.
+    boost::unique_lock<boost::mutex> lock(lock_);
+    while (active_ > 0) {
+      idle_.wait(lock);
     }
   }
 
-  // Either drop or overwrite the record list.
-  if (all) {
-    db->Delete(kEvents, record_key + "." + list_type + "." + index);
+  if (dropped_ > 0) {
+    LOG(WARNING) << "Event subscriber " << name_ << " dropped " << dropped_
+                 << " events from its dispatch queue";
+  }
+}
+
+/// Parse the events_dispatch_policy flag, unknown policies drop the oldest.
+static EventDispatchPolicy getDispatchPolicy() {
+  if (FLAGS_events_dispatch_policy == "drop_newest") {
+    return DISPATCH_DROP_NEWEST;
+  } else if (FLAGS_events_dispatch_policy == "block") {
+    return DISPATCH_BLOCK;
+  } else if (FLAGS_events_dispatch_policy != "drop_oldest") {
+    LOG(WARNING) << "Unknown events_dispatch_policy: "
+                 << FLAGS_events_dispatch_policy;
+  }
+  return DISPATCH_DROP_OLDEST;
+}
+
+static inline std::string padKeyField(const std::string& field, size_t width) {
+  if (field.size() >= width) {
+    return field;
+  }
+  return std::string(width - field.size(), '0') + field;
+}
+
+std::string EventSubscriberPlugin::getEventKey(EventTime time,
+                                               const EventID& eid) const {
+  return kEventKeyPrefix + dbNamespace() + "." +
+         padKeyField(std::to_string(time), kEventTimeWidth) + "." +
+         padKeyField(eid, kEventIDWidth);
+}
+
+/// The event key range [start, stop], a stop of 0 has no upper limit.
+static void getEventRange(const std::string& prefix,
+                          EventTime start,
+                          EventTime stop,
+                          std::string& range_start,
+                          std::string& range_end) {
+  range_start = prefix + padKeyField(std::to_string(start), kEventTimeWidth);
+  if (stop == 0) {
+    // The '/' character sorts after the '.' separator and before digits.
+    range_end = prefix.substr(0, prefix.size() - 1) + "/";
   } else {
-    auto new_records = boost::algorithm::join(persisting_records, ",");
-    db->Put(kEvents, record_key + "." + list_type + "." + index, new_records);
+    uint64_t end = static_cast<uint64_t>(stop) + 1;
+    range_end = prefix + padKeyField(std::to_string(end), kEventTimeWidth);
   }
 }
 
-void EventSubscriberPlugin::expireIndexes(
-    const std::string& list_type,
-    const std::vector<std::string>& indexes,
-    const std::vector<std::string>& expirations) {
-  auto db = DBHandle::getInstance();
-  auto index_key = "indexes." + dbNamespace();
+/// Check that an event key is a padded time and EventID after the prefix.
+static bool isEventKey(const std::string& key, size_t prefix_size) {
+  if (key.size() != prefix_size + kEventTimeWidth + 1 + kEventIDWidth) {
+    return false;
+  }
+
+  // A longer namespace sharing the prefix has non-digits in the time field.
+  auto separator = prefix_size + kEventTimeWidth;
+  return key[separator] == '.' &&
+         key.find_first_not_of("0123456789", prefix_size) == separator &&
+         key.find_first_not_of("0123456789", separator + 1) ==
+             std::string::npos;
+}
 
-  // Construct a mutable list of persisting indexes to rewrite as records.
-  std::vector<std::string> persisting_indexes = indexes;
-  // Remove the records using the list of expired indexes.
-  for (const auto& bin : expirations) {
-    expireRecords(list_type, bin, true);
-    persisting_indexes.erase(
-        std::remove(persisting_indexes.begin(), persisting_indexes.end(), bin),
-        persisting_indexes.end());
+/// Parse the EventID and EventTime from an event key.
+static bool getRecordFromKey(const std::string& key,
+                             size_t prefix_size,
+                             std::string& eid,
+                             EventTime& time) {
+  if (!isEventKey(key, prefix_size)) {
+    return false;
   }
 
-  // Update the list of indexes with the non-expired indexes.
-  auto new_indexes = boost::algorithm::join(persisting_indexes, ",");
-  db->Put(kEvents, index_key + "." + list_type, new_indexes);
+  time = timeFromRecord(key.substr(prefix_size, kEventTimeWidth));
+  auto digit = key.find_first_not_of('0', prefix_size + kEventTimeWidth + 1);
+  eid = (digit == std::string::npos) ? "0" : key.substr(digit);
+  return true;
 }
 
-void EventSubscriberPlugin::expireCheck() {
-  auto db = DBHandle::getInstance();
-  auto data_key = "data." + dbNamespace();
-  auto eid_key = "eid." + dbNamespace();
+/// Parse the minimum and maximum EventTime from a segment key.
+static bool getSegmentTimes(const std::string& key,
+                            EventTime& min,
+                            EventTime& max) {
+  auto size = 2 * kEventTimeWidth + 1;
+  if (key.size() < size || key[key.size() - kEventTimeWidth - 1] != '.') {
+    return false;
+  }
+  min = timeFromRecord(key.substr(key.size() - size, kEventTimeWidth));
+  max = timeFromRecord(key.substr(key.size() - kEventTimeWidth));
+  return true;
+}
 
-  std::vector<std::string> keys;
-  db->ScanPrefix(kEvents, keys, data_key);
-  if (keys.size() <= FLAGS_events_max) {
-    return;
+/// The keys of the segments overlapping [start, stop], ordered by time.
+static void getSegmentKeys(const std::string& name,
+                           EventTime start,
+                           EventTime stop,
+                           std::vector<std::string>& keys) {
+  // Segments do not overlap, so they are ordered by both of their times.
+  auto prefix = kEventSegmentPrefix + name + ".";
+  auto range_end = prefix +
+                   padKeyField(std::to_string(static_cast<uint64_t>(stop) + 1),
+                               kEventTimeWidth);
+  std::vector<std::string> segments;
+  scanDatabaseRange(kEvents, segments, prefix, range_end);
+  for (auto& key : segments) {
+    EventTime min = 0, max = 0;
+    if (getSegmentTimes(key, min, max) && max >= start) {
+      keys.push_back(std::move(key));
+    }
   }
+}
 
-  // There is an overflow of events buffered for this subscriber.
-  LOG(WARNING) << "Expiring events for subscriber: " << getName() << " limit ("
-               << FLAGS_events_max << ") exceeded: " << keys.size();
-  // Inspect the N-FLAGS_events_max -th event's value and expire before the
-  // time within the content.
-  std::string last_key;
-  db->Get(kEvents, eid_key, last_key);
-  // The EID is the next-index.
-  size_t max_key = boost::lexical_cast<size_t>(last_key) - FLAGS_events_max - 1;
+/// Append the events of segments within [start, stop], in the keys' order.
+static void readSegments(const std::vector<std::string>& keys,
+                         EventTime start,
+                         EventTime stop,
+                         bool descending,
+                         QueryData& results) {
+  // The segments are read with a single batched lookup.
+  std::vector<std::string> values;
+  getDatabaseValues(kEvents, keys, values);
+  for (size_t i = 0; i < keys.size(); i++) {
+    QueryData rows;
+    if (i >= values.size() || values[i].empty() ||
+        !decodeEventSegment(values[i], rows).ok()) {
+      LOG(WARNING) << "Cannot read event segment: " << keys[i];
+      continue;
+    }
 
-  // Convert the key index into a time using the content.
-  std::string content;
-  db->Get(kEvents, data_key + "." + std::to_string(max_key), content);
+    if (descending) {
+      std::reverse(rows.begin(), rows.end());
+    }
+    for (auto& row : rows) {
+      auto time = timeFromRecord(row["time"]);
+      if (time >= start && time <= stop) {
+        results.push_back(std::move(row));
+      }
+    }
+  }
+}
+
+std::vector<EventRecord> EventSubscriberPlugin::getRecords(EventTime start,
+                                                           EventTime stop) {
+  flushEvents(true);
+  auto prefix = kEventKeyPrefix + dbNamespace() + ".";
+  std::string range_start, range_end;
+  getEventRange(prefix, start, stop, range_start, range_end);
+
+  std::vector<std::string> keys;
+  scanDatabaseRange(kEvents, keys, range_start, range_end);
+
+  std::vector<EventRecord> records;
+  records.reserve(keys.size());
+  for (const auto& key : keys) {
+    std::string eid;
+    EventTime time = 0;
+    if (getRecordFromKey(key, prefix.size(), eid, time)) {
+      records.push_back(std::make_pair(eid, time));
+    }
+  }
+  return records;
+}
 
-  // Decode the value into a row structure to extract the time.
-  Row r;
-  if (!deserializeRowJSON(content, r) || r.count("time") == 0) {
+void EventSubscriberPlugin::expireRecords() {
+  if (!expire_events_ || expire_time_ == 0) {
     return;
   }
 
-  // The last time will become the implicit expiration time.
-  size_t last_time = boost::lexical_cast<size_t>(r.at("time"));
-  if (last_time > 0) {
-    expire_time_ = last_time;
+  auto prefix = kEventKeyPrefix + dbNamespace() + ".";
+  auto range_end =
+      prefix + padKeyField(std::to_string(expire_time_), kEventTimeWidth);
+
+  // Expired events are a contiguous range of the oldest keys.
+  auto status = deleteDatabaseRange(kEvents, prefix, range_end);
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot expire events for subscriber: " << getName()
+                 << " (" << status.getMessage() << ")";
   }
 
-  // Finally, attempt an index query to trigger expirations.
-  // In this case the result set is not used.
-  getIndexes(expire_time_ - 1, -1);
+  // Segments are removed once their newest event expires.
+  std::vector<std::string> segments;
+  std::vector<std::string> expired;
+  getSegmentKeys(dbNamespace(), 0, expire_time_ - 1, segments);
+  for (auto& key : segments) {
+    EventTime min = 0, max = 0;
+    if (getSegmentTimes(key, min, max) && max < expire_time_) {
+      expired.push_back(std::move(key));
+    }
+  }
+  if (!expired.empty()) {
+    writeDatabaseValues(kEvents, {}, expired);
+  }
 }
 
-std::vector<EventRecord> EventSubscriberPlugin::getRecords(
-    const std::set<std::string>& indexes) {
-  auto db = DBHandle::getInstance();
-  auto record_key = "records." + dbNamespace();
+Status EventSubscriberPlugin::flushEvents(bool force) {
+  std::vector<std::pair<std::string, std::string>> batch;
+  {
+    TRACE_SCOPE("events.flush_stage_lock");
+    boost::lock_guard<EventMutex> lock(event_stage_lock_);
+    if (staged_events_.empty()) {
+      return Status(0, "OK");
+    }
 
-  std::vector<EventRecord> records;
-  for (const auto& index : indexes) {
-    std::vector<std::string> bin_records;
-    {
-      std::string record_value;
-      db->Get(kEvents, record_key + "." + index, record_value);
-      if (record_value.empty()) {
-        // There are actually no events in this bin, interesting error case.
-        continue;
+    if (!force && staged_events_.size() < FLAGS_events_batch_size) {
+      auto staged = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - staged_time_);
+      if (static_cast<uint64_t>(staged.count()) < FLAGS_events_batch_latency) {
+        return Status(0, "OK");
       }
-
-      // Each list is tokenized into a record=event_id:time.
-      boost::split(bin_records, record_value, boost::is_any_of(",:"));
     }
+    batch.swap(staged_events_);
+  }
 
-    auto bin_it = bin_records.begin();
-    // Iterate over every 2 items: EID:TIME.
-    for (; bin_it != bin_records.end(); bin_it++) {
-      const auto& eid = *bin_it;
-      EventTime time = timeFromRecord(*(++bin_it));
-      records.push_back(std::make_pair(eid, time));
+  auto status = writeDatabaseValues(kEvents, batch, {});
+  if (!status.ok()) {
+    LOG(ERROR) << "Could not write " << batch.size()
+               << " events for subscriber: " << getName() << " ("
+               << status.getMessage() << ")";
+  }
+  return status;
+}
+
+size_t EventSubscriberPlugin::expireCheck() {
+  if (!expire_events_) {
+    return 0;
+  }
+
+  // Events older than the configured lifetime are expired.
+  auto now = getUnixTime();
+  if (FLAGS_events_expiry > 0 && now > FLAGS_events_expiry &&
+      now - FLAGS_events_expiry > expire_time_) {
+    expire_time_ = now - FLAGS_events_expiry;
+  }
+
+  if (memory_store_ != nullptr) {
+    // The memory store drops events overflowing events_max as they are added.
+    auto expired = memory_store_->expire(expire_time_);
+    expired_count_ += expired;
+    return expired;
+  }
+
+  // Aged events are compacted, events_max applies to the remaining events.
+  compactEvents();
+
+  auto records = getRecords(0, 0);
+  if (records.size() > FLAGS_events_max) {
+    // There is an overflow of events buffered for this subscriber.
+    LOG(WARNING) << "Expiring events for subscriber: " << getName()
+                 << " limit (" << FLAGS_events_max
+                 << ") exceeded: " << records.size();
+
+    // Records are ordered by time, keep the newest events_max events.
+    overflow_count_ += records.size() - FLAGS_events_max;
+    auto last_time = records[records.size() - FLAGS_events_max].second;
+    if (last_time > expire_time_) {
+      expire_time_ = last_time;
     }
   }
 
-  return records;
+  // Count the expired records before removing their range.
+  auto expire_time = expire_time_;
+  auto expired = std::lower_bound(records.begin(),
+                                  records.end(),
+                                  expire_time,
+                                  [](const EventRecord& r, EventTime time) {
+                                    return r.second < time;
+                                  }) -
+                 records.begin();
+  if (expired > 0) {
+    expireRecords();
+    expired_count_ += expired;
+    // The range tombstone's space is reclaimed by compaction.
+    addDatabaseDeletes(kEvents, expired);
+  }
+  return expired;
 }
 
-Status EventSubscriberPlugin::recordEvent(EventID& eid, EventTime time) {
-  Status status;
-  auto db = DBHandle::getInstance();
-  std::string time_value = boost::lexical_cast<std::string>(time);
+size_t EventSubscriberPlugin::compactEvents() {
+  auto now = getUnixTime();
+  if (FLAGS_events_cold_age == 0 || now <= FLAGS_events_cold_age) {
+    return 0;
+  }
 
-  // The record is identified by the event type then module name.
-  std::string index_key = "indexes." + dbNamespace();
-  std::string record_key = "records." + dbNamespace();
-  // The list key includes the list type (bin size) and the list ID (bin).
-  std::string list_key;
-  std::string list_id;
+  // Events that will be expired are not compacted.
+  auto cold_time = static_cast<EventTime>(now - FLAGS_events_cold_age);
+  if (cold_time <= expire_time_) {
+    return 0;
+  }
 
-  for (const auto& time_list : kEventTimeLists) {
-    // The list_id is the MOST-Specific key ID, the bin for this list.
-    // If the event time was 13 and the time_list is 5 seconds, lid = 2.
-    list_id = boost::lexical_cast<std::string>(time / time_list);
-    // The list name identifies the 'type' of list.
-    list_key = boost::lexical_cast<std::string>(time_list);
-    // list_key = list_key + "." + list_id;
+  flushEvents(true);
+  auto prefix = kEventKeyPrefix + dbNamespace() + ".";
+  std::vector<std::pair<std::string, std::string>> events;
+  scanDatabaseRange(
+      kEvents,
+      events,
+      prefix + padKeyField(std::to_string(expire_time_), kEventTimeWidth),
+      prefix + padKeyField(std::to_string(cold_time), kEventTimeWidth));
+  if (events.empty()) {
+    return 0;
+  }
 
-    {
-      boost::lock_guard<boost::mutex> lock(event_record_lock_);
-      // Append the record (eid, unix_time) to the list bin.
-      std::string record_value;
-      status = db->Get(
-          kEvents, record_key + "." + list_key + "." + list_id, record_value);
-
-      if (record_value.length() == 0) {
-        // This is a new list_id for list_key, append the ID to the indirect
-        // lookup for this list_key.
-        std::string index_value;
-        status = db->Get(kEvents, index_key + "." + list_key, index_value);
-        if (index_value.length() == 0) {
-          // A new index.
-          index_value = list_id;
-        } else {
-          index_value += "," + list_id;
-        }
-        status = db->Put(kEvents, index_key + "." + list_key, index_value);
-        record_value = eid + ":" + time_value;
-      } else {
-        // Tokenize a record using ',' and the EID/time using ':'.
-        record_value += "," + eid + ":" + time_value;
+  std::vector<std::pair<EventTime, Row>> rows;
+  std::vector<std::string> deletes;
+  rows.reserve(events.size());
+  for (auto& event : events) {
+    Row r;
+    if (deserializeRowBinary(event.second, r).ok()) {
+      rows.push_back(std::make_pair(timeFromRecord(r["time"]), std::move(r)));
+    }
+    deletes.push_back(std::move(event.first));
+  }
+  auto compacted = deletes.size();
+
+  // Segments are kept disjoint, merge the segments overlapping these events.
+  if (!rows.empty()) {
+    std::vector<std::string> overlapping;
+    getSegmentKeys(
+        dbNamespace(), rows.front().first, rows.back().first, overlapping);
+    std::vector<std::string> values;
+    getDatabaseValues(kEvents, overlapping, values);
+    for (size_t i = 0; i < overlapping.size(); i++) {
+      auto& key = overlapping[i];
+      QueryData segment;
+      if (i >= values.size() || values[i].empty() ||
+          !decodeEventSegment(values[i], segment).ok()) {
+        LOG(WARNING) << "Cannot merge event segment: " << key;
+        return 0;
       }
-      status = db->Put(
-          kEvents, record_key + "." + list_key + "." + list_id, record_value);
-      if (!status.ok()) {
-        LOG(ERROR) << "Could not put Event Record key: " << record_key;
+      for (auto& r : segment) {
+        rows.push_back(std::make_pair(timeFromRecord(r["time"]), std::move(r)));
       }
+      deletes.push_back(std::move(key));
     }
   }
+  std::stable_sort(rows.begin(),
+                   rows.end(),
+                   [](const std::pair<EventTime, Row>& l,
+                      const std::pair<EventTime, Row>& r) {
+                     return l.first < r.first;
+                   });
+
+  // Events with the same time are kept in one segment, keys are unique.
+  auto segment_prefix = kEventSegmentPrefix + dbNamespace() + ".";
+  std::vector<std::pair<std::string, std::string>> puts;
+  for (size_t i = 0; i < rows.size();) {
+    auto end = std::min(i + kEventSegmentSize, rows.size());
+    while (end < rows.size() && rows[end].first == rows[end - 1].first) {
+      end++;
+    }
 
-  return Status(0, "OK");
+    QueryData segment;
+    segment.reserve(end - i);
+    for (size_t j = i; j < end; j++) {
+      segment.push_back(std::move(rows[j].second));
+    }
+    std::string data;
+    auto status = encodeEventSegment(segment, data);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot compact events for subscriber: " << getName()
+                   << " (" << status.getMessage() << ")";
+      return 0;
+    }
+    auto key =
+        segment_prefix +
+        padKeyField(std::to_string(rows[i].first), kEventTimeWidth) + "." +
+        padKeyField(std::to_string(rows[end - 1].first), kEventTimeWidth);
+    puts.push_back(std::make_pair(std::move(key), std::move(data)));
+    i = end;
+  }
+
+  // A rewritten segment may keep the key of a merged segment.
+  for (const auto& put : puts) {
+    deletes.erase(std::remove(deletes.begin(), deletes.end(), put.first),
+                  deletes.end());
+  }
+  auto status = writeDatabaseValues(kEvents, puts, deletes);
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot compact events for subscriber: " << getName()
+                 << " (" << status.getMessage() << ")";
+    return 0;
+  }
+  return compacted;
 }
 
-EventID EventSubscriberPlugin::getEventID() {
-  Status status;
-  auto db = DBHandle::getInstance();
-  // First get an event ID from the meta key.
-  std::string eid_key = "eid." + dbNamespace();
-  std::string last_eid_value;
-  std::string eid_value;
+void EventSubscriberPlugin::migrateEvents() {
+  auto data_key = "data." + dbNamespace() + ".";
 
-  {
-    boost::lock_guard<boost::mutex> lock(event_id_lock_);
-    status = db->Get(kEvents, eid_key, last_eid_value);
-    if (!status.ok() || last_eid_value.empty()) {
-      last_eid_value = "0";
-    }
+  std::vector<std::string> bins;
+  scanDatabasePrefix(kEvents, bins, "records." + dbNamespace() + ".");
+  scanDatabasePrefix(kEvents, bins, "indexes." + dbNamespace() + ".");
+  std::vector<std::pair<std::string, std::string>> legacy;
+  scanDatabasePrefix(kEvents, legacy, data_key);
+  if (bins.empty() && legacy.empty()) {
+    return;
+  }
 
-    last_eid_ = boost::lexical_cast<size_t>(last_eid_value) + 1;
-    eid_value = boost::lexical_cast<std::string>(last_eid_);
-    status = db->Put(kEvents, eid_key, eid_value);
+  std::vector<std::pair<std::string, std::string>> events;
+  std::vector<std::string> deletes = std::move(bins);
+  for (auto& item : legacy) {
+    // The event time is part of the stored row.
+    std::string time;
+    if (getRowBinaryValue(item.second, "time", time).ok()) {
+      auto eid = item.first.substr(data_key.size());
+      events.push_back(std::make_pair(getEventKey(timeFromRecord(time), eid),
+                                      std::move(item.second)));
+    }
+    deletes.push_back(std::move(item.first));
   }
 
+  auto status = writeDatabaseValues(kEvents, events, deletes);
   if (!status.ok()) {
-    return "0";
+    LOG(WARNING) << "Cannot migrate events for subscriber: " << getName()
+                 << " (" << status.getMessage() << ")";
+  } else {
+    VLOG(1) << "Migrated " << events.size()
+            << " events for subscriber: " << getName();
+  }
+}
+
+EventID EventSubscriberPlugin::getEventID() {
+  // The common case is an atomic increment within the reserved block.
+  if (eid_restored_.load(std::memory_order_acquire)) {
+    auto eid = ++last_eid_;
+    if (eid <= reserved_eid_.load(std::memory_order_acquire)) {
+      return std::to_string(eid);
+    }
+  }
+
+  boost::lock_guard<EventMutex> lock(event_id_lock_);
+  std::string eid_key = "eid." + dbNamespace();
+  if (!eid_restored_.load(std::memory_order_acquire)) {
+    // Every EventID up to the persisted value may have been used.
+    std::string reserved_value;
+    long long reserved = 0;
+    auto status = getDatabaseValue(kEvents, eid_key, reserved_value);
+    if (status.ok() && !reserved_value.empty()) {
+      safeStrtoll(reserved_value, 10, reserved);
+    }
+    last_eid_ = static_cast<size_t>(std::max(reserved, 0LL));
+    reserved_eid_ = last_eid_.load();
+    eid_restored_.store(true, std::memory_order_release);
   }
 
-  return eid_value;
+  auto eid = ++last_eid_;
+  while (eid > reserved_eid_) {
+    // Persist the end of the next block before handing out its EventIDs.
+    auto reserved = reserved_eid_ + EVENTS_ID_BLOCK;
+    auto status = setDatabaseValue(kEvents, eid_key, std::to_string(reserved));
+    if (!status.ok()) {
+      return "0";
+    }
+    reserved_eid_.store(reserved, std::memory_order_release);
+  }
+  return std::to_string(eid);
 }
 
 QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
-  QueryData results;
+  return getEvents(start, stop, false, 0);
+}
 
-  // Get the records for this time range.
-  auto db = DBHandle::getInstance();
-  auto indexes = getIndexes(start, stop);
-  auto records = getRecords(indexes);
-  std::string events_key = "data." + dbNamespace();
+QueryData EventSubscriberPlugin::getEvents(EventTime start,
+                                           EventTime stop,
+                                           bool descending,
+                                           size_t limit) {
+  QueryData results;
+  if (memory_store_ != nullptr) {
+    memory_store_->get(start, stop, descending, limit, results);
+    return results;
+  }
 
-  std::vector<std::string> mapped_records;
-  for (const auto& record : records) {
-    if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(events_key + "." + record.first);
+  // Commit staged events before reading, expiration happens in the background.
+  flushEvents(true);
+
+  std::vector<std::string> segments;
+  getSegmentKeys(dbNamespace(), start, stop, segments);
+  if (!descending && limit == 0) {
+    readSegments(segments, start, stop, false, results);
+  } else if (!descending) {
+    // With a limit the segments are read until enough events are found.
+    for (const auto& key : segments) {
+      readSegments({key}, start, stop, false, results);
+      if (results.size() >= limit) {
+        results.resize(limit);
+        return results;
+      }
     }
   }
 
-  // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
-    Row r;
-    auto status = db->Get(kEvents, record, data_value);
-    if (data_value.length() == 0) {
-      // There is no record here, interesting error case.
+  // Read the individually stored events with a single range scan.
+  auto prefix = kEventKeyPrefix + dbNamespace() + ".";
+  std::string range_start, range_end;
+  getEventRange(prefix, start, stop, range_start, range_end);
+
+  std::vector<std::pair<std::string, std::string>> events;
+  size_t max = (limit > results.size()) ? limit - results.size() : 0;
+  scanDatabaseRange(kEvents, events, range_start, range_end, max, descending);
+  results.reserve(results.size() + events.size());
+  for (const auto& event : events) {
+    if (!isEventKey(event.first, prefix.size())) {
       continue;
     }
-    status = deserializeRowJSON(data_value, r);
-    data_value.clear();
+    Row r;
+    auto status = deserializeRowBinary(event.second, r);
     if (status.ok()) {
       results.push_back(std::move(r));
     }
   }
 
-  if (FLAGS_events_expiry > 0) {
-    // Set the expire time to NOW - "configured lifetime".
-    // Index retrieval will apply the constraints checking and auto-expire.
-    expire_time_ = getUnixTime() - FLAGS_events_expiry;
+  if (descending && limit == 0) {
+    std::reverse(segments.begin(), segments.end());
+    readSegments(segments, start, stop, true, results);
+  } else if (descending) {
+    for (auto key = segments.rbegin(); key != segments.rend(); ++key) {
+      if (results.size() >= limit) {
+        break;
+      }
+      readSegments({*key}, start, stop, true, results);
+    }
+  }
+  if (limit > 0 && results.size() > limit) {
+    results.resize(limit);
   }
   return results;
 }
 
+/// Remove the events a sampled query does not read, sampled by eid.
+static void sampleEvents(double rate, QueryData& results) {
+  if (rate >= 1) {
+    return;
+  }
+  results.erase(std::remove_if(results.begin(),
+                               results.end(),
+                               [rate](const Row& r) {
+                                 auto eid = r.find("eid");
+                                 return eid != r.end() &&
+                                        !isSampledKey(eid->second, rate);
+                               }),
+                results.end());
+}
+
+QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
+  EventTime start = 0, stop = -1;
+  getTimeRange(context, start, stop);
+  auto results = getEvents(start,
+                           stop,
+                           context.descending,
+                           static_cast<size_t>(std::max(context.limit, 0)));
+  sampleEvents(context.sample_rate, results);
+  return results;
+}
+
+/**
+ * @brief Stream events from an ordered range of event keys.
+ *
+ * Each batch seeks to the key following the last returned event and reads at
+ * most EVENTS_PAGE_SIZE events, so memory is bounded by the page size rather
+ * than the number of buffered events. A descending generator reads each batch
+ * backwards from the key preceding the last returned event.
+ *
+ * Compacted segments are decoded one per batch, before the individually
+ * stored events or after them in descending order.
+ */
+class EventRowGenerator : public RowGenerator {
+ public:
+  EventRowGenerator(const TableColumns& columns,
+                    size_t prefix_size,
+                    const std::string& range_start,
+                    const std::string& range_end,
+                    bool descending,
+                    size_t page_size)
+      : columns_(columns),
+        prefix_size_(prefix_size),
+        range_start_(range_start),
+        range_end_(range_end),
+        descending_(descending),
+        page_size_(page_size) {}
+
+  /// Read the segments overlapping [start, stop] with the events.
+  void setSegments(std::vector<std::string> segments,
+                   EventTime start,
+                   EventTime stop) {
+    segments_ = std::move(segments);
+    if (descending_) {
+      std::reverse(segments_.begin(), segments_.end());
+    }
+    start_ = start;
+    stop_ = stop;
+  }
+
+  /// Return only a sample of the events, see QueryContext::sample_rate.
+  void setSampleRate(double rate) {
+    sample_rate_ = rate;
+  }
+
+  bool next(TableRows& rows) override {
+    if (!descending_ && next_segment_ < segments_.size()) {
+      nextSegment(rows);
+      return true;
+    }
+
+    if (!events_done_) {
+      nextEvents(rows);
+      if (!events_done_) {
+        return true;
+      }
+    }
+
+    if (descending_ && next_segment_ < segments_.size()) {
+      nextSegment(rows);
+    }
+    return (descending_ && next_segment_ < segments_.size());
+  }
+
+ private:
+  /// Read the next page of individually stored events.
+  void nextEvents(TableRows& rows) {
+    std::vector<std::pair<std::string, std::string>> events;
+    scanDatabaseRange(
+        kEvents, events, range_start_, range_end_, page_size_, descending_);
+    events_done_ = (events.size() < page_size_);
+    if (events.empty()) {
+      return;
+    }
+
+    QueryData results;
+    results.reserve(events.size());
+    for (const auto& event : events) {
+      Row r;
+      if (isEventKey(event.first, prefix_size_) &&
+          deserializeRowBinary(event.second, r).ok()) {
+        results.push_back(std::move(r));
+      }
+    }
+    sampleEvents(sample_rate_, results);
+    TablePlugin::setRowsFromQueryData(columns_, results, rows);
+
+    // The next batch continues immediately after the last key read.
+    if (descending_) {
+      range_end_ = events.back().first;
+    } else {
+      range_start_ = events.back().first + '\0';
+    }
+  }
+
+  /// Decode the next segment.
+  void nextSegment(TableRows& rows) {
+    QueryData results;
+    readSegments(
+        {segments_[next_segment_++]}, start_, stop_, descending_, results);
+    sampleEvents(sample_rate_, results);
+    TablePlugin::setRowsFromQueryData(columns_, results, rows);
+  }
+
+ private:
+  /// The table columns, used to order each event Row.
+  TableColumns columns_;
+
+  /// The size of the subscriber's event key prefix.
+  size_t prefix_size_{0};
+
+  /// The inclusive start of the remaining event key range.
+  std::string range_start_;
+
+  /// The exclusive end of the remaining event key range.
+  std::string range_end_;
+
+  /// Set to read the events with the latest time first.
+  bool descending_{false};
+
+  /// The maximum number of events read by each batch.
+  size_t page_size_{EVENTS_PAGE_SIZE};
+
+  /// Set when every individually stored event was read.
+  bool events_done_{false};
+
+  /// The overlapping segment keys, in the order they are read.
+  std::vector<std::string> segments_;
+
+  /// The next segment to read.
+  size_t next_segment_{0};
+
+  /// The time range of the events read from segments.
+  EventTime start_{0};
+  EventTime stop_{0};
+
+  /// The fraction of events returned.
+  double sample_rate_{1.0};
+};
+
+/// Stream events read from a memory store in batches.
+class EventMemoryRowGenerator : public RowGenerator {
+ public:
+  EventMemoryRowGenerator(const TableColumns& columns, QueryData events)
+      : columns_(columns), events_(std::move(events)) {}
+
+  bool next(TableRows& rows) override {
+    auto end = std::min(next_ + EVENTS_PAGE_SIZE, events_.size());
+    QueryData results(std::make_move_iterator(events_.begin() + next_),
+                      std::make_move_iterator(events_.begin() + end));
+    TablePlugin::setRowsFromQueryData(columns_, results, rows);
+    next_ = end;
+    return (next_ < events_.size());
+  }
+
+ private:
+  /// The table columns, used to order each event Row.
+  TableColumns columns_;
+
+  /// The events in range, copied when the query started.
+  QueryData events_;
+
+  /// The next event to return.
+  size_t next_{0};
+};
+
+RowGeneratorRef EventSubscriberPlugin::generator(const TableColumns& columns,
+                                                 QueryContext& context) {
+  EventTime start = 0, stop = -1;
+  getTimeRange(context, start, stop);
+  if (memory_store_ != nullptr) {
+    // The memory store is bounded by events_max, the range is copied at once.
+    auto events = getEvents(start,
+                            stop,
+                            context.descending,
+                            static_cast<size_t>(std::max(context.limit, 0)));
+    sampleEvents(context.sample_rate, events);
+    return std::make_shared<EventMemoryRowGenerator>(columns,
+                                                     std::move(events));
+  }
+
+  // Commit staged events, then seek directly to the first event in range.
+  flushEvents(true);
+  auto prefix = kEventKeyPrefix + dbNamespace() + ".";
+  std::string range_start, range_end;
+  getEventRange(prefix, start, stop, range_start, range_end);
+
+  // A LIMIT smaller than a page is read with a single, smaller batch.
+  size_t page_size = EVENTS_PAGE_SIZE;
+  if (context.limit > 0 && static_cast<size_t>(context.limit) < page_size) {
+    page_size = static_cast<size_t>(context.limit);
+  }
+  auto generator = std::make_shared<EventRowGenerator>(columns,
+                                                       prefix.size(),
+                                                       range_start,
+                                                       range_end,
+                                                       context.descending,
+                                                       page_size);
+
+  std::vector<std::string> segments;
+  getSegmentKeys(dbNamespace(), start, stop, segments);
+  generator->setSegments(std::move(segments), start, stop);
+  generator->setSampleRate(context.sample_rate);
+  return generator;
+}
+
 Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
-  auto db = DBHandle::getInstance();
+  // Without encouraging a missing event time, do not support a 0-time.
+  if (event_time == 0) {
+    event_time = getUnixTime();
+  }
+  r["time"] = std::to_string(event_time);
+
+  if (memory_store_ != nullptr) {
+    // Events kept in memory need neither an EventID nor serialization.
+    auto overflowed = memory_store_->add(event_time, r);
+    expired_count_ += overflowed;
+    overflow_count_ += overflowed;
+    return Status(0, "OK");
+  }
+
   // Get and increment the EID for this module.
   EventID eid = getEventID();
-  // Without encouraging a missing event time, do not support a 0-time.
-  r["time"] = std::to_string((event_time == 0) ? getUnixTime() : event_time);
 
   // Serialize and store the row data, for query-time retrieval.
   std::string data;
-  auto status = serializeRowJSON(r, data);
+  auto status = serializeRowBinary(r, data);
   if (!status.ok()) {
     return status;
   }
 
-  // Use the last EventID and a checkpoint bucket size to periodically apply
-  // buffer eviction. Eviction occurs if the total count exceeds events_max.
-  if (last_eid_ % EVENTS_CHECKPOINT == 0) {
-    expireCheck();
+  // Stage the event data, the key orders events by time.
+  {
+    TRACE_SCOPE("events.add_stage_lock");
+    boost::lock_guard<EventMutex> lock(event_stage_lock_);
+    if (staged_events_.empty()) {
+      staged_time_ = std::chrono::steady_clock::now();
+    }
+    staged_events_.push_back(
+        std::make_pair(getEventKey(event_time, eid), std::move(data)));
   }
+  return flushEvents(false);
+}
 
-  // Store the event data.
-  std::string event_key = "data." + dbNamespace() + "." + eid;
-  status = db->Put(kEvents, event_key, data);
-  // Record the event in the indexing bins, using the index time.
-  recordEvent(eid, event_time);
-  return status;
+void EventSubscriberPlugin::useMemoryStore() {
+  if (memory_store_ == nullptr) {
+    memory_store_ = std::make_shared<EventMemoryStore>(FLAGS_events_max);
+  }
 }
 
 EventPublisherRef EventSubscriberPlugin::getPublisher() const {
@@ -521,21 +1332,77 @@ void EventSubscriberPlugin::removeSubscriptions() {
   getPublisher()->removeSubscriptions(getName());
 }
 
+void EventExpirationRunner::start() {
+  while (true) {
+    osquery::interruptableSleep(FLAGS_events_expiry_interval * 1000);
+    EventFactory::expire();
+  }
+}
+
+void EventFactory::expire() {
+  auto& ef = EventFactory::getInstance();
+  auto read_lock = ef.requestRead();
+  for (const auto& subscriber : ef.event_subs_) {
+    if (subscriber.second->state() != SUBSCRIBER_RUNNING) {
+      continue;
+    }
+
+    auto expired = subscriber.second->expireCheck();
+    if (expired > 0) {
+      VLOG(1) << "Expired " << expired
+              << " events for subscriber: " << subscriber.first;
+    }
+  }
+}
+
 void EventFactory::delay() {
   // Caller may disable event publisher threads.
   if (FLAGS_disable_events) {
     return;
   }
 
-  // Create a thread for each event publisher.
+  // Buffered events are expired outside of query and ingestion paths.
+  if (FLAGS_events_expiry_interval > 0) {
+    Dispatcher::addService(std::make_shared<EventExpirationRunner>());
+  }
+
+  // Create a thread for each event publisher without a descriptor.
   auto& ef = EventFactory::getInstance();
+  std::vector<EventPublisherRef> reactor;
   for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
     // Publishers that did not set up correctly are put into an ending state.
-    if (!publisher.second->isEnding()) {
-      auto thread_ = std::make_shared<boost::thread>(
-          boost::bind(&EventFactory::run, publisher.first));
-      ef.threads_.push_back(thread_);
+    if (publisher.second->isEnding()) {
+      continue;
+    }
+    if (FLAGS_events_reactor && publisher.second->getDescriptor() >= 0) {
+      reactor.push_back(publisher.second);
+      continue;
     }
+    auto thread_ = std::make_shared<boost::thread>(
+        boost::bind(&EventFactory::run, publisher.first));
+    ef.threads_.push_back(thread_);
+  }
+
+  if (reactor.empty()) {
+    return;
+  }
+
+#ifdef __linux__
+  int epoll = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll >= 0) {
+    for (const auto& publisher : reactor) {
+      publisher->hasStarted(true);
+    }
+    ef.threads_.push_back(std::make_shared<boost::thread>(
+        boost::bind(&EventFactory::runReactor, epoll, reactor)));
+    return;
+  }
+  LOG(WARNING) << "Could not create the events reactor, using threads";
+#endif
+
+  for (const auto& publisher : reactor) {
+    ef.threads_.push_back(std::make_shared<boost::thread>(
+        boost::bind(&EventFactory::run, publisher->type())));
   }
 }
 
@@ -573,18 +1440,24 @@ Status EventFactory::run(EventPublisherID& type_id) {
   }
   VLOG(1) << "Starting event publisher run loop: " + type_id;
   publisher->hasStarted(true);
+  // The run loop thread buffers events, its cache fills from the events arena.
+  setThreadArena(ARENA_EVENTS);
 
   auto status = Status(0, "OK");
   while (!publisher->isEnding() && status.ok()) {
     // Can optionally implement a global cooloff latency here.
     status = publisher->run();
     publisher->restart_count_++;
+    publisher->fireCoalesced(false);
+
+    flushEvents(type_id);
     osquery::publisherSleep(EVENTS_COOLOFF);
   }
   // The runloop status is not reflective of the event type's.
   VLOG(1) << "Event publisher " << publisher->type()
           << " run loop terminated for reason: " << status.getMessage();
   // Publishers auto tear down when their run loop stops.
+  publisher->fireCoalesced(true);
   publisher->tearDown();
 
   // Do not remove the publisher from the event factory.
@@ -594,6 +1467,89 @@ Status EventFactory::run(EventPublisherID& type_id) {
   return Status(0, "OK");
 }
 
+void EventFactory::runReactor(int epoll,
+                              std::vector<EventPublisherRef> publishers) {
+#ifdef __linux__
+  std::vector<bool> stopped(publishers.size(), false);
+  auto stop = [&](size_t index, const Status& status) {
+    auto& publisher = publishers[index];
+    VLOG(1) << "Event publisher " << publisher->type()
+            << " run loop terminated for reason: " << status.getMessage();
+    ::epoll_ctl(epoll, EPOLL_CTL_DEL, publisher->getDescriptor(), nullptr);
+    // Publishers auto tear down when their run loop stops.
+    publisher->fireCoalesced(true);
+    publisher->tearDown();
+    stopped[index] = true;
+  };
+
+  // Events queued before a descriptor is added do not trigger an edge, so
+  // every publisher is first read once.
+  std::vector<size_t> readable;
+  for (size_t i = 0; i < publishers.size(); i++) {
+    VLOG(1) << "Starting event publisher reactor: " << publishers[i]->type();
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = i;
+    if (::epoll_ctl(epoll,
+                    EPOLL_CTL_ADD,
+                    publishers[i]->getDescriptor(),
+                    &event) != 0) {
+      stop(i, Status(1, "Cannot add the publisher descriptor"));
+      continue;
+    }
+    readable.push_back(i);
+  }
+
+  struct epoll_event events[kReactorEvents];
+  while (true) {
+    for (const auto& i : readable) {
+      if (stopped[i] || publishers[i]->isEnding()) {
+        continue;
+      }
+      auto status = publishers[i]->ready();
+      publishers[i]->restart_count_++;
+      if (!status.ok()) {
+        stop(i, status);
+      }
+    }
+
+    bool running = false;
+    for (size_t i = 0; i < publishers.size(); i++) {
+      if (stopped[i]) {
+        continue;
+      } else if (publishers[i]->isEnding()) {
+        stop(i, Status(0, "Ending"));
+        continue;
+      }
+      publishers[i]->fireCoalesced(false);
+      flushEvents(publishers[i]->type());
+      running = true;
+    }
+    if (!running) {
+      break;
+    }
+
+    readable.clear();
+    int count = ::epoll_wait(epoll, events, kReactorEvents, kReactorLatency);
+    for (int i = 0; i < count; i++) {
+      readable.push_back(static_cast<size_t>(events[i].data.u64));
+    }
+  }
+  ::close(epoll);
+#endif
+}
+
+void EventFactory::flushEvents(EventPublisherID& type_id) {
+  // Commit events staged by this publisher's subscribers beyond the latency.
+  auto& ef = EventFactory::getInstance();
+  auto read_lock = ef.requestRead();
+  for (const auto& subscriber : ef.event_subs_) {
+    if (subscriber.second->getType() == type_id) {
+      subscriber.second->flushEvents(false);
+    }
+  }
+}
+
 // There's no reason for the event factory to keep multiple instances.
 EventFactory& EventFactory::getInstance() {
   static EventFactory ef;
@@ -616,13 +1572,17 @@ Status EventFactory::registerEventPublisher(const PluginRef& pub) {
 
   auto& ef = EventFactory::getInstance();
   auto type_id = specialized_pub->type();
-  if (ef.event_pubs_.count(type_id) != 0) {
-    // This is a duplicate event publisher.
-    return Status(1, "Duplicate publisher type");
+  {
+    // Publishers may be registered from several threads.
+    WriteLock lock(ef.factory_lock_);
+    if (ef.event_pubs_.count(type_id) != 0) {
+      // This is a duplicate event publisher.
+      return Status(1, "Duplicate publisher type");
+    }
+    ef.event_pubs_[type_id] = specialized_pub;
   }
 
   // Do not set up event publisher if events are disabled.
-  ef.event_pubs_[type_id] = specialized_pub;
   if (!FLAGS_disable_events) {
     auto status = specialized_pub->setUp();
     if (!status.ok()) {
@@ -680,8 +1640,22 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   // Let the module initialize any Subscriptions.
   auto status = Status(0, "OK");
   if (!FLAGS_disable_events && !specialized_sub->disabled) {
+    if (FLAGS_events_memory) {
+      specialized_sub->useMemoryStore();
+    }
+    if (specialized_sub->memory_store_ == nullptr) {
+      specialized_sub->migrateEvents();
+    }
     specialized_sub->expireCheck();
     status = specialized_sub->init();
+    if (specialized_sub->dispatch_async_ && FLAGS_events_dispatch_queue > 0 &&
+        specialized_sub->dispatch_queue_ == nullptr) {
+      specialized_sub->dispatch_queue_.reset(
+          new EventDispatchQueue(name,
+                                 FLAGS_events_dispatch_queue,
+                                 getDispatchPolicy(),
+                                 FLAGS_events_dispatch_workers));
+    }
     specialized_sub->state(SUBSCRIBER_RUNNING);
   } else {
     specialized_sub->state(SUBSCRIBER_PAUSED);
@@ -690,12 +1664,11 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   auto& ef = EventFactory::getInstance();
   ef.event_subs_[name] = specialized_sub;
 
-  // Restore optimize times for a daemon.
+  // Restore the optimize time kept before times were kept per query.
   if (kToolType == OSQUERY_TOOL_DAEMON && FLAGS_events_optimize) {
-    auto db = DBHandle::getInstance();
     auto index_key = "optimize." + specialized_sub->dbNamespace();
     std::string content;
-    if (db->Get(kEvents, index_key, content)) {
+    if (getDatabaseValue(kEvents, index_key, content)) {
       long long optimize_time = 0;
       safeStrtoll(content, 10, optimize_time);
       specialized_sub->optimize_time_ = static_cast<EventTime>(optimize_time);
@@ -824,6 +1797,16 @@ void EventFactory::end(bool join) {
     }
   }
 
+  {
+    // Finish dispatched callbacks before their publishers are released.
+    auto read_lock = ef.requestRead();
+    for (const auto& subscriber : ef.event_subs_) {
+      if (subscriber.second->dispatch_queue_ != nullptr) {
+        subscriber.second->dispatch_queue_->stop();
+      }
+    }
+  }
+
   {
     auto write_lock = ef.requestWrite();
     // A small cool off helps OS API event publisher flushing.
@@ -833,16 +1816,32 @@ void EventFactory::end(bool join) {
 
     // Threads may still be executing, when they finish, release publishers.
     ef.event_pubs_.clear();
+    for (const auto& subscriber : ef.event_subs_) {
+      subscriber.second->flushEvents(true);
+    }
     ef.event_subs_.clear();
   }
 }
 
-void attachEvents() {
-  const auto& publishers = Registry::all("event_publisher");
-  for (const auto& publisher : publishers) {
-    EventFactory::registerEventPublisher(publisher.second);
+void attachEventPublishers() {
+  // A publisher's setUp may wait on the kernel, set up each in parallel.
+  std::vector<std::shared_ptr<boost::thread>> setups;
+  for (const auto& publisher : Registry::all("event_publisher")) {
+    auto plugin = publisher.second;
+    setups.push_back(std::make_shared<boost::thread>(
+        [plugin]() { EventFactory::registerEventPublisher(plugin); }));
   }
+  for (const auto& setup : setups) {
+    setup->join();
+  }
+}
+
+void attachEvents() {
+  attachEventPublishers();
+  attachEventSubscribers();
+}
 
+void attachEventSubscribers() {
   const auto& subscribers = Registry::all("event_subscriber");
   for (const auto& subscriber : subscribers) {
     auto status = EventFactory::registerEventSubscriber(subscriber.second);
@@ -8,6 +8,10 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
@@ -17,14 +21,24 @@ namespace osquery {
 
 FLAG(bool, disable_kernel, false, "Disable osquery kernel extension");
 
-const std::string kKernelDevice = "/dev/osquery";
+FLAG(bool,
+     kernel_zero_copy,
+     true,
+     "Fire kernel events referencing the shared queue without copying");
+
+FLAG(uint64,
+     kernel_queue_size,
+     20 * (1 << 20),
+     "Bytes of the event buffer shared with the osquery kernel extension");
 
-/// Kernel shared buffer size in bytes.
-static const size_t kKernelQueueSize = (20 * (1 << 20));
+const std::string kKernelDevice = "/dev/osquery";
 
 /// Handle a maximum of 1000 events before requesting a resync.
 static const int kKernelEventsSyncMax = 1000;
 
+/// The most resyncs of a backlogged queue before returning to the run loop.
+static const size_t kKernelSyncBatchMax = 64;
+
 REGISTER(KernelEventPublisher, "event_publisher", "kernel");
 
 Status KernelEventPublisher::setUp() {
@@ -43,8 +57,17 @@ Status KernelEventPublisher::setUp() {
   // Assume the kernel extension is loaded, initialize the queue.
   // This will open the extension descriptor and synchronize queue data.
   // If any other daemons or osquery processes are using the queue this fails.
+  size_t queue_size = FLAGS_kernel_queue_size;
+  if (queue_size < OSQUERY_MIN_QUEUE_SIZE ||
+      queue_size > OSQUERY_MAX_QUEUE_SIZE) {
+    queue_size = std::min<size_t>(
+        std::max<size_t>(queue_size, OSQUERY_MIN_QUEUE_SIZE),
+        OSQUERY_MAX_QUEUE_SIZE);
+    LOG(WARNING) << "Using a kernel_queue_size of " << queue_size << " bytes";
+  }
+
   try {
-    queue_ = new CQueue(kKernelDevice, kKernelQueueSize);
+    queue_ = new CQueue(kKernelDevice, queue_size);
   } catch (const CQueueException &e) {
     queue_ = nullptr;
     return Status(1, e.what());
@@ -58,10 +81,42 @@ Status KernelEventPublisher::setUp() {
 }
 
 void KernelEventPublisher::configure() {
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  try {
+    subscribeFilters();
+  } catch (const CQueueException &e) {
+    LOG(WARNING) << "Cannot subscribe to kernel events: " << e.what();
+  }
+}
+
+void KernelEventPublisher::subscribeFilters() {
+  // Compile the subscriptions into a set of filters for each event type.
+  std::map<osquery_event_t, std::vector<osquery_event_filter_t> > filters;
+  std::map<osquery_event_t, bool> unfiltered;
   for (const auto &sub : subscriptions_) {
-    if (queue_ != nullptr) {
-      auto sc = getSubscriptionContext(sub->context);
-      queue_->subscribe(sc->event_type);
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->filter.fields == 0) {
+      unfiltered[sc->event_type] = true;
+    }
+    filters[sc->event_type].push_back(sc->filter);
+  }
+
+  for (const auto &event_filters : filters) {
+    auto event_type = event_filters.first;
+    if (unfiltered.count(event_type) > 0 ||
+        event_filters.second.size() > OSQUERY_MAX_FILTERS) {
+      // Queue every event, subscriptions are matched by shouldFire.
+      queue_->subscribe(event_type);
+      continue;
+    }
+
+    bool reset = true;
+    for (const auto &filter : event_filters.second) {
+      queue_->subscribe(event_type, &filter, reset);
+      reset = false;
     }
   }
 }
@@ -77,62 +132,132 @@ Status KernelEventPublisher::run() {
     return Status(1, "No kernel communication");
   }
 
-  // Perform queue read min/max synchronization.
-  try {
-    int drops = 0;
-    if ((drops = queue_->kernelSync(OSQUERY_DEFAULT)) > 0 &&
-        kToolType == OSQUERY_TOOL_DAEMON) {
-      LOG(WARNING) << "Dropping " << drops << " kernel events";
-    }
-  } catch (const CQueueException &e) {
-    LOG(WARNING) << "Queue synchronization error: " << e.what();
-  }
+  // Events dequeued in this batch remain in the shared queue until the next
+  // synchronization, so contexts may reference them while subscribers are
+  // called synchronously.
+  bool zero_copy = FLAGS_kernel_zero_copy && !hasDispatchQueues();
 
-  // Iterate over each event type in the queue and appropriately fire each.
-  int max_before_sync = kKernelEventsSyncMax;
-  KernelEventContextRef ec;
-  osquery_event_t event_type = OSQUERY_NULL_EVENT;
-  CQueue::event *event = nullptr;
-  while (max_before_sync > 0 && (event_type = queue_->dequeue(&event))) {
-    // Each event type may use a specific event type structure.
-    switch (event_type) {
-    case OSQUERY_PROCESS_EVENT:
-      ec = createEventContextFrom<osquery_process_event_t>(event_type, event);
-      fire(ec);
+  // The first synchronization waits for the kernel to wake this thread with
+  // readable events. While the queue is backlogged the following batches
+  // synchronize without waiting, so a busy queue is drained without sleeps.
+  int options = OSQUERY_DEFAULT;
+  for (size_t batch = 0; batch < kKernelSyncBatchMax && !isEnding(); batch++) {
+    // Perform queue read min/max synchronization.
+    try {
+      int drops = 0;
+      if ((drops = queue_->kernelSync(options)) > 0) {
+        drop_count_ += drops;
+        if (kToolType == OSQUERY_TOOL_DAEMON) {
+          LOG(WARNING) << "Dropping " << drops << " kernel events";
+        }
+      } else if (drops < 0) {
+        LOG(WARNING) << "Kernel queue overflow";
+      }
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Queue synchronization error: " << e.what();
       break;
-    case OSQUERY_FILE_EVENT:
-      ec = createEventContextFrom<osquery_file_event_t>(event_type, event);
-      fire(ec);
-      break;
-    default:
-      LOG(WARNING) << "Unknown kernel event received: " << event_type;
+    }
+
+    if (queue_->highWaterMark() > queue_->size() / 4 * 3) {
+      VLOG(1) << "Kernel queue high-water mark: " << queue_->highWaterMark()
+              << " of " << queue_->size() << " bytes";
+    }
+
+    if (queue_->empty()) {
       break;
     }
-    max_before_sync--;
+    options = OSQUERY_NO_BLOCK;
+
+    // Iterate over each event type in the queue and appropriately fire each.
+    int max_before_sync = kKernelEventsSyncMax;
+    KernelEventContextRef ec;
+    osquery_event_t event_type = OSQUERY_NULL_EVENT;
+    CQueue::event *event = nullptr;
+    while (max_before_sync > 0 && (event_type = queue_->dequeue(&event))) {
+      // Each event type may use a specific event type structure.
+      switch (event_type) {
+      case OSQUERY_PROCESS_EVENT:
+        ec = createEventContextFrom<osquery_process_event_t>(
+            event_type, event, zero_copy);
+        fire(ec);
+        break;
+      case OSQUERY_FILE_EVENT:
+        ec = createEventContextFrom<osquery_file_event_t>(
+            event_type, event, zero_copy);
+        fire(ec);
+        break;
+      default:
+        LOG(WARNING) << "Unknown kernel event received: " << event_type;
+        break;
+      }
+      max_before_sync--;
+    }
   }
 
   return Status(0, "Continue");
 }
 
+/// Event types without filterable fields.
+template <typename EventType>
+static inline void setFilterFields(KernelEventContext &ec,
+                                   const EventType &event) {}
+
+static inline void setFilterFields(KernelEventContext &ec,
+                                   const osquery_process_event_t &event) {
+  ec.pid = event.pid;
+  ec.uid = event.uid;
+  ec.path = event.path;
+}
+
+static inline void setFilterFields(KernelEventContext &ec,
+                                   const osquery_file_event_t &event) {
+  ec.action = event.action;
+  ec.pid = event.pid;
+  ec.uid = event.uid;
+  ec.path = event.path;
+}
+
 template <typename EventType>
 KernelEventContextRef KernelEventPublisher::createEventContextFrom(
-    osquery_event_t event_type, CQueue::event *event) const {
+    osquery_event_t event_type, CQueue::event *event, bool zero_copy) {
   TypedKernelEventContextRef<EventType> ec = nullptr;
 
-  ec = std::make_shared<TypedKernelEventContext<EventType> >();
+  if (zero_copy) {
+    // Reuse the previous context unless a subscriber still holds it.
+    auto &context = contexts_[event_type];
+    if (context != nullptr && context.use_count() == 1) {
+      ec = std::static_pointer_cast<TypedKernelEventContext<EventType> >(
+          context);
+    } else {
+      ec = std::make_shared<TypedKernelEventContext<EventType> >();
+      context = ec;
+    }
+    ec->event = reinterpret_cast<const EventType *>(event->buf);
+    ec->flexible_data = event->buf + sizeof(EventType);
+  } else {
+    ec = std::make_shared<TypedKernelEventContext<EventType> >();
+    ec->storage.assign(event->buf, event->buf + event->size);
+    ec->event = reinterpret_cast<const EventType *>(ec->storage.data());
+    ec->flexible_data = ec->storage.data() + sizeof(EventType);
+  }
+
   ec->event_type = event_type;
   ec->time = event->time.time;
   ec->uptime = event->time.uptime;
-  memcpy(&(ec->event), event->buf, sizeof(EventType));
-  ec->flexible_data.insert(ec->flexible_data.begin(),
-                           event->buf + sizeof(EventType),
-                           event->buf + event->size);
+  ec->flexible_size = event->size - sizeof(EventType);
+  setFilterFields(*ec, *ec->event);
 
   return std::static_pointer_cast<KernelEventContext>(ec);
 }
 
 bool KernelEventPublisher::shouldFire(const KernelSubscriptionContextRef &sc,
                                       const KernelEventContextRef &ec) const {
-  return ec->event_type == sc->event_type;
+  if (ec->event_type != sc->event_type) {
+    return false;
+  }
+
+  // The kernel applies the union of the filters for an event type.
+  return osquery_filter_match(
+             &sc->filter, ec->action, ec->pid, ec->uid, ec->path) == 1;
 }
 } // namespace osquery
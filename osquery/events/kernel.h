@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <map>
 #include <vector>
 
 #include <osquery/events.h>
@@ -41,6 +42,15 @@ struct KernelSubscriptionContext : public SubscriptionContext {
 
   /// Optional category passed to the callback.
   std::string category;
+
+  /**
+   * @brief Optional event predicates.
+   *
+   * The publisher compiles the filters of every subscription for an event
+   * type and pushes them to the kernel, so non-matching events are never
+   * queued. A filter without fields matches every event.
+   */
+  osquery_event_filter_t filter{};
 };
 
 /**
@@ -52,14 +62,35 @@ struct KernelEventContext : public EventContext {
 
   /// The observed uptime of the system at event time.
   uint32_t uptime{0};
+
+  /// Event fields inspected by subscription filters.
+  uint32_t action{0};
+  uint64_t pid{0};
+  uint64_t uid{0};
+  const char *path{nullptr};
 };
 
+/**
+ * @brief Event details for a typed kernel event.
+ *
+ * The event and its flexible data may reference the shared kernel queue
+ * directly. The queue slice is only reclaimed by the kernel at the next queue
+ * synchronization, after every subscriber has been called for the batch, so
+ * callbacks must copy anything they keep beyond the callback.
+ */
 template <typename EventType>
 struct TypedKernelEventContext : public KernelEventContext {
-  EventType event;
+  /// The typed event, within the shared queue or the owned storage.
+  const EventType *event{nullptr};
 
-  // The flexible data must remain as the last member.
-  std::vector<char> flexible_data;
+  /// Variable-length data following the typed event.
+  const char *flexible_data{nullptr};
+
+  /// Size of the flexible data in bytes.
+  size_t flexible_size{0};
+
+  /// An owned copy of the queue slice, empty when referencing the queue.
+  std::vector<char> storage;
 };
 
 using KernelSubscriptionContextRef = std::shared_ptr<KernelSubscriptionContext>;
@@ -87,13 +118,27 @@ class KernelEventPublisher
  private:
   CQueue *queue_{nullptr};
 
+  /// Push the subscription filters for each event type to the kernel.
+  void subscribeFilters();
+
   /// Check whether the subscription matches the event.
   bool shouldFire(const KernelSubscriptionContextRef &sc,
                   const KernelEventContextRef &ec) const override;
 
+  /**
+   * @brief Create or reuse an event context for a dequeued event.
+   *
+   * When zero_copy is set the context references the shared queue and a
+   * context is reused for each event type unless a subscriber kept it.
+   */
   template <typename EventType>
   KernelEventContextRef createEventContextFrom(osquery_event_t event_type,
-                                               CQueue::event *event) const;
+                                               CQueue::event *event,
+                                               bool zero_copy);
+
+ private:
+  /// Reusable zero-copy contexts for each event type.
+  std::map<osquery_event_t, KernelEventContextRef> contexts_;
 };
 
 } // namespace osquery
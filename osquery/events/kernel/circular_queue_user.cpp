@@ -10,6 +10,7 @@
 
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "osquery/events/kernel/circular_queue_user.h"
@@ -44,10 +45,17 @@ CQueue::~CQueue() {
   }
 }
 
-void CQueue::subscribe(osquery_event_t event) {
+void CQueue::subscribe(osquery_event_t event,
+                       const osquery_event_filter_t *filter,
+                       bool reset) {
   osquery_subscription_args_t sub;
+  memset(&sub, 0, sizeof(sub));
   sub.event = event;
   sub.subscribe = 1;
+  sub.reset = (reset) ? 1 : 0;
+  if (filter != nullptr) {
+    sub.filter = *filter;
+  }
 
   if (ioctl(fd_, OSQUERY_IOCTL_SUBSCRIPTION, &sub)) {
     throw CQueueException("Could not subscribe to event");
@@ -80,6 +88,7 @@ int CQueue::kernelSync(int options) {
   // A positive return indicates drops, 0 is all good in the hood.
   // Options are listed in kernel feeds; primarily OSQUERY_NO_BLOCK.
   osquery_buf_sync_args_t sync;
+  memset(&sync, 0, sizeof(sync));
   sync.read_offset = read_ - buffer_;
   sync.options = options;
 
@@ -91,6 +100,7 @@ int CQueue::kernelSync(int options) {
     read_ = max_read_;
     throw CQueueException("Could not sync buffer with kernel properly");
   }
+  high_water_mark_ = sync.high_water_mark;
 
   return sync.drops;
 }
@@ -61,14 +61,23 @@ class CQueue : private boost::noncopyable {
    * @brief Sends a subscription call to the kernel extension.
    *
    * This sets up the event callbacks so we start hearing about the given event.
+   * The kernel only queues events matching any of the event's filters.
    *
    * @param event The event we are interested in.
+   * @param filter An optional filter, nullptr matches every event.
+   * @param reset Remove the event's previous filters first.
    */
-  void subscribe(osquery_event_t event);
+  void subscribe(osquery_event_t event,
+                 const osquery_event_filter_t *filter = nullptr,
+                 bool reset = true);
 
   /**
    * @brief Dequeue's an event from the shared buffer.
    *
+   * The event is not copied, it points into the shared buffer. The kernel
+   * only reclaims dequeued events at the next kernelSync, so the pointer is
+   * valid until then.
+   *
    * @param event (output) A pointer to the event dequeue if any.
    * @return Returns 0 if queue is empty, otherwise the number of the event put
    * into event.
@@ -86,11 +95,21 @@ class CQueue : private boost::noncopyable {
    */
   int kernelSync(int options);
 
+  /// The size of the shared buffer in bytes.
+  size_t size() const { return size_; }
+
+  /// The most bytes of the buffer used between the two latest syncs.
+  size_t highWaterMark() const { return high_water_mark_; }
+
+  /// Check if the events made readable by the latest sync are dequeued.
+  bool empty() const { return read_ == max_read_; }
+
  private:
   uint8_t *buffer_{nullptr};
   size_t size_{0};
   uint8_t *max_read_{nullptr};
   uint8_t *read_{nullptr};
+  size_t high_water_mark_{0};
   int fd_{-1};
 };
 
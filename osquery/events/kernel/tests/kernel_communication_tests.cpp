@@ -10,8 +10,11 @@
 
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <boost/make_shared.hpp>
 
 #include <gtest/gtest.h>
@@ -64,9 +67,11 @@ TEST_F(KernelCommunicationTests, test_communication) {
   osquery_event_t event;
   osquery::CQueue::event* event_buf = nullptr;
   unsigned int tasks = 0;
+  size_t high_water_mark = 0;
   do {
     tasks = dispatcher.totalTaskCount();
     drops += queue.kernelSync(OSQUERY_NO_BLOCK);
+    high_water_mark = std::max(high_water_mark, queue.highWaterMark());
     unsigned int max_before_sync = 2000;
     while (max_before_sync > 0 && (event = queue.dequeue(&event_buf))) {
       switch (event) {
@@ -82,6 +87,44 @@ TEST_F(KernelCommunicationTests, test_communication) {
   } while (tasks > 0);
 
   EXPECT_EQ(num_threads * events_per_thread, reads + drops);
+
+  // Readable and reserved events never exceed the shared buffer.
+  EXPECT_GT(high_water_mark, 0U);
+  EXPECT_LE(high_water_mark, queue.size());
 }
 #endif // KERNEL_TEST
+
+TEST_F(KernelCommunicationTests, test_event_filter_match) {
+  osquery_event_filter_t filter;
+  memset(&filter, 0, sizeof(filter));
+
+  // A filter without fields matches every event.
+  EXPECT_EQ(osquery_filter_match(&filter, 0, 1, 0, nullptr), 1);
+
+  filter.fields = OSQUERY_FILTER_ACTIONS | OSQUERY_FILTER_PATH;
+  filter.actions = OSQUERY_FILE_ACTION_OPEN;
+  strncpy(filter.path, "/etc/", MAXPATHLEN - 1);
+  EXPECT_EQ(
+      osquery_filter_match(&filter, OSQUERY_FILE_ACTION_OPEN, 1, 0, "/etc/"),
+      1);
+  EXPECT_EQ(osquery_filter_match(
+                &filter, OSQUERY_FILE_ACTION_OPEN, 1, 0, "/etc/hosts"),
+            1);
+  EXPECT_EQ(osquery_filter_match(
+                &filter, OSQUERY_FILE_ACTION_CLOSE, 1, 0, "/etc/hosts"),
+            0);
+  EXPECT_EQ(
+      osquery_filter_match(&filter, OSQUERY_FILE_ACTION_OPEN, 1, 0, "/et"), 0);
+  EXPECT_EQ(
+      osquery_filter_match(&filter, OSQUERY_FILE_ACTION_OPEN, 1, 0, nullptr),
+      0);
+
+  // Every field must match.
+  filter.fields = OSQUERY_FILTER_PID | OSQUERY_FILTER_UID;
+  filter.pid = 10;
+  filter.uid = 501;
+  EXPECT_EQ(osquery_filter_match(&filter, 0, 10, 501, nullptr), 1);
+  EXPECT_EQ(osquery_filter_match(&filter, 0, 10, 0, nullptr), 0);
+  EXPECT_EQ(osquery_filter_match(&filter, 0, 11, 501, nullptr), 0);
+}
 }
@@ -8,15 +8,22 @@
  *
  */
 
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <tuple>
+
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
-#include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
 
 namespace osquery {
@@ -36,6 +43,42 @@ FLAG(bool,
      false,
      "Allow the audit publisher to change auditing configuration");
 
+/// Size the netlink receive buffer to absorb bursts of audit records.
+FLAG(uint64,
+     audit_socket_buffer,
+     4 * (1 << 20),
+     "Size of the audit netlink receive buffer in bytes");
+
+/// The kernel backlog limit enforced while in control of audit.
+FLAG(uint64,
+     audit_backlog_limit,
+     8192,
+     "Minimum audit kernel backlog limit while in control of audit");
+
+/// The kernel backlog limit is doubled up to this maximum when records drop.
+FLAG(uint64,
+     audit_backlog_limit_max,
+     131072,
+     "Maximum audit kernel backlog limit when adapting to record loss");
+
+/// Records received but not yet parsed, newer records are dropped when full.
+FLAG(uint64,
+     audit_parse_queue,
+     16384,
+     "Number of audit records buffered for the parsing thread");
+
+/// Service accounts with frequent syscalls are excluded in the kernel.
+FLAG(string,
+     audit_exclude_users,
+     "",
+     "Comma-separated users or uids whose syscalls are not audited");
+
+/// Executables with frequent syscalls are excluded in the kernel.
+FLAG(string,
+     audit_exclude_exes,
+     "",
+     "Comma-separated executable paths whose syscalls are not audited");
+
 REGISTER(AuditEventPublisher, "event_publisher", "audit");
 
 enum AuditStatus {
@@ -46,6 +89,12 @@ enum AuditStatus {
 
 static const int kAuditMLatency = 1000;
 
+/// Number of netlink datagrams received in a single call.
+static const size_t kAuditBatchSize = 64;
+
+/// Size of each datagram's receive buffer, a netlink header and audit record.
+static const size_t kAuditMessageSize = NLMSG_SPACE(MAX_AUDIT_MESSAGE_LENGTH);
+
 Status AuditEventPublisher::setUp() {
   handle_ = audit_open();
   if (handle_ <= 0) {
@@ -81,57 +130,225 @@ Status AuditEventPublisher::setUp() {
     // Want to set a min sane buffer and maximum number of events/second min.
     // This is normally controlled through the audit config, but we must
     // enforce sane minimums: -b 8192 -e 100
+    // The backlog minimum is applied when the first status reply arrives.
 
     // Request only the highest priority of audit status messages.
     set_aumessage_mode(MSG_QUIET, DBG_NO);
   }
+
+  // Grow the receive buffer, forcing beyond the system maximum as root.
+  int buffer_size = static_cast<int>(FLAGS_audit_socket_buffer);
+  if (setsockopt(handle_,
+                 SOL_SOCKET,
+                 SO_RCVBUFFORCE,
+                 &buffer_size,
+                 sizeof(buffer_size)) != 0) {
+    setsockopt(
+        handle_, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  }
+
+  // Prepare the batched receive structures, each message has its own buffer.
+  buffers_.resize(kAuditBatchSize * kAuditMessageSize);
+  messages_.resize(kAuditBatchSize);
+  addresses_.resize(kAuditBatchSize);
+  iovecs_.resize(kAuditBatchSize);
+  for (size_t i = 0; i < kAuditBatchSize; i++) {
+    iovecs_[i].iov_base = &buffers_[i * kAuditMessageSize];
+    iovecs_[i].iov_len = kAuditMessageSize;
+  }
+
+  // Records are parsed and fired in order by a single worker.
+  parser_.reset(new EventDispatchQueue(
+      "audit", FLAGS_audit_parse_queue, DISPATCH_DROP_NEWEST, 1));
   return Status(0, "OK");
 }
 
-void AuditEventPublisher::configure() {
-  // Able to issue libaudit API calls.
-  struct AuditRuleInternal rule;
+/// Build a kernel rule for a set of syscalls and space-separated comparisons.
+static bool makeAuditRule(int flags,
+                          int action,
+                          const std::set<int>& syscalls,
+                          const std::string& filter,
+                          AuditRuleInternal& output) {
+  // String field values are appended, the rule data is reallocated.
+  auto rule = static_cast<struct audit_rule_data*>(
+      calloc(1, sizeof(struct audit_rule_data)));
+  if (rule == nullptr) {
+    return false;
+  }
+
+  for (const auto& syscall : syscalls) {
+    audit_rule_syscall_data(rule, syscall);
+  }
+
+  std::vector<std::string> pairs;
+  boost::split(pairs, filter, boost::is_any_of(" "));
+  for (const auto& pair : pairs) {
+    if (pair.empty()) {
+      continue;
+    }
+    // The prepend bit is not a filter list.
+    int rc = audit_rule_fieldpair_data(
+        &rule, pair.c_str(), flags & ~AUDIT_FILTER_PREPEND);
+    if (rc < 0) {
+      VLOG(1) << "Cannot use audit rule filter '" << pair << "': error " << rc;
+      free(rule);
+      return false;
+    }
+  }
+
+  auto data = reinterpret_cast<const char*>(rule);
+  output.data.assign(data, data + sizeof(struct audit_rule_data) + rule->buflen);
+  output.flags = flags;
+  output.action = action;
+  free(rule);
+  return true;
+}
+
+std::vector<AuditRuleInternal> AuditEventPublisher::buildRules(
+    const std::vector<AuditRule>& rules,
+    const std::vector<std::string>& exclusions) {
+  // Merge the syscalls of rules with equal filters, in subscription order.
+  using RuleKey = std::tuple<int, int, std::string>;
+  std::vector<RuleKey> order;
+  std::map<RuleKey, std::set<int>> syscalls;
+  std::set<int> exit_syscalls;
+  std::vector<AuditRuleInternal> output;
+  AuditRuleInternal internal;
+
+  for (const auto& rule : rules) {
+    if (!rule.apply_rule) {
+      continue;
+    }
+
+    if (rule.syscall == 0) {
+      // A filter without a syscall is not merged.
+      if (makeAuditRule(rule.flags, rule.action, {}, rule.filter, internal) &&
+          std::find(output.begin(), output.end(), internal) == output.end()) {
+        output.push_back(internal);
+      }
+      continue;
+    }
 
-  // Before reply data is ever filled in, assure an empty message.
-  memset(&reply_, 0, sizeof(struct audit_reply));
+    RuleKey key(rule.flags, rule.action, rule.filter);
+    if (syscalls.count(key) == 0) {
+      order.push_back(key);
+    }
+    syscalls[key].insert(rule.syscall);
+    if (rule.flags == AUDIT_FILTER_EXIT && rule.action == AUDIT_ALWAYS) {
+      exit_syscalls.insert(rule.syscall);
+    }
+  }
+
+  std::vector<AuditRuleInternal> merged;
+  for (const auto& key : order) {
+    if (makeAuditRule(std::get<0>(key),
+                      std::get<1>(key),
+                      syscalls[key],
+                      std::get<2>(key),
+                      internal)) {
+      merged.push_back(internal);
+    }
+  }
+
+  // Never rules are prepended, the first matching rule decides a syscall.
+  std::vector<AuditRuleInternal> excluded;
+  if (!exit_syscalls.empty()) {
+    for (const auto& exclusion : exclusions) {
+      if (makeAuditRule(AUDIT_FILTER_EXIT | AUDIT_FILTER_PREPEND,
+                        AUDIT_NEVER,
+                        exit_syscalls,
+                        exclusion,
+                        internal) &&
+          std::find(excluded.begin(), excluded.end(), internal) ==
+              excluded.end()) {
+        excluded.push_back(internal);
+      }
+    }
+  }
 
+  excluded.insert(excluded.end(), merged.begin(), merged.end());
+  excluded.insert(excluded.end(), output.begin(), output.end());
+  return excluded;
+}
+
+/// Add a comparison for each comma-separated value of an exclusion flag.
+static void addExclusions(const std::string& values,
+                          const std::string& field,
+                          std::vector<std::string>& exclusions) {
+  std::vector<std::string> items;
+  boost::split(items, values, boost::is_any_of(","));
+  for (auto& item : items) {
+    boost::trim(item);
+    if (!item.empty()) {
+      exclusions.push_back(field + "=" + item);
+    }
+  }
+}
+
+void AuditEventPublisher::configure() {
   if (handle_ <= 0 || FLAGS_disable_audit || immutable_) {
     // No configuration or rule manipulation needed.
     // The publisher run loop may still receive audit metadata events.
     return;
   }
 
+  std::vector<AuditRule> rules;
   for (auto& sub : subscriptions_) {
     auto sc = getSubscriptionContext(sub->context);
-    for (const auto& scr : sc->rules) {
-      // Reset all members to nothing.
-      memset(&rule.rule, 0, sizeof(struct audit_rule_data));
+    rules.insert(rules.end(), sc->rules.begin(), sc->rules.end());
+  }
 
-      if (scr.syscall != 0) {
-        audit_rule_syscall_data(&rule.rule, scr.syscall);
-      }
+  std::vector<std::string> exclusions;
+  addExclusions(FLAGS_audit_exclude_users, "uid", exclusions);
+  addExclusions(FLAGS_audit_exclude_exes, "exe", exclusions);
+  auto desired = buildRules(rules, exclusions);
+
+  // Add the new rules before removing the previous, if any add fails the
+  // added rules are removed and the previous set remains.
+  std::vector<AuditRuleInternal> added;
+  bool failed = false;
+  for (auto& rule : desired) {
+    if (std::find(transient_rules_.begin(), transient_rules_.end(), rule) !=
+        transient_rules_.end()) {
+      continue;
+    }
 
-      if (scr.filter.size() > 0) {
-        // Fill in rule's filter data.
-        auto* rrule = &rule.rule;
-        audit_rule_fieldpair_data(&rrule, scr.filter.c_str(), scr.flags);
-      }
+    int rc = audit_add_rule_data(handle_, rule.rule(), rule.flags, rule.action);
+    if (rc == -EEXIST) {
+      // An equal rule was configured by the system, it is not transient.
+      continue;
+    } else if (rc < 0) {
+      VLOG(1) << "Cannot add audit rule with " << rule.rule()->field_count
+              << " fields: error " << rc;
+      failed = true;
+      break;
+    }
+    added.push_back(rule);
+  }
 
-      // Apply this rule to the EXIT filter, ALWAYS.
-      int rc = audit_add_rule_data(handle_, &rule.rule, scr.flags, scr.action);
-      if (rc < 0) {
-        // Problem adding rule. If errno == EEXIST then fine.
-        VLOG(1) << "Cannot add audit rule: syscall=" << scr.syscall
-                << " filter='" << scr.filter << "': error " << rc;
+  if (failed) {
+    for (auto& rule : added) {
+      audit_delete_rule_data(handle_, rule.rule(), rule.flags, rule.action);
+    }
+    LOG(WARNING) << "Cannot install audit rules, keeping the previous rules";
+  } else {
+    for (auto& rule : transient_rules_) {
+      if (std::find(desired.begin(), desired.end(), rule) == desired.end()) {
+        audit_delete_rule_data(handle_, rule.rule(), rule.flags, rule.action);
       }
+    }
 
-      // Note: all rules are considered transient if added by subscribers.
-      // Add this rule data to the publisher's list of transient rules.
-      // These will be removed during tear down or re-configure.
-      rule.flags = scr.flags;
-      rule.action = scr.action;
-      transient_rules_.push_back(rule);
+    // Note: all rules are considered transient if added by subscribers.
+    // These will be removed during tear down or re-configure.
+    std::vector<AuditRuleInternal> installed;
+    for (auto& rule : desired) {
+      if (std::find(transient_rules_.begin(), transient_rules_.end(), rule) !=
+              transient_rules_.end() ||
+          std::find(added.begin(), added.end(), rule) != added.end()) {
+        installed.push_back(rule);
+      }
     }
+    transient_rules_.swap(installed);
   }
 
   // The audit library provides an API to send a netlink request that fills in
@@ -148,94 +365,214 @@ void AuditEventPublisher::tearDown() {
     return;
   }
 
+  // Stop parsing before the subscribers and handle are removed.
+  if (parser_ != nullptr) {
+    parser_->stop();
+  }
+
   // The configure step will store successful rule adds.
   // Each of these rules has been added by the publisher and should be remove
   // when the process tears down.
   if (!immutable_) {
     for (auto& rule : transient_rules_) {
-      audit_delete_rule_data(handle_, &rule.rule, rule.flags, rule.action);
+      audit_delete_rule_data(handle_, rule.rule(), rule.flags, rule.action);
     }
   }
 
   audit_close(handle_);
 }
 
-inline void handleAuditConfigChange(const struct audit_reply& reply) {
+inline void handleAuditConfigChange(const struct nlmsghdr* nlh) {
   // Another daemon may have taken control.
 }
 
-inline bool handleAuditReply(const struct audit_reply& reply,
+inline bool parseAuditRecord(int type,
+                             std::string message,
                              AuditEventContextRef& ec) {
-  // Build an event context around this reply.
-  ec->type = reply.type;
+  // Build an event context around this record.
+  // The fields reference the record so it is tokenized without copies.
+  ec->type = type;
+  ec->record = std::move(message);
+  ec->fields.clear();
+  AuditFieldValue record(ec->record);
 
   // Tokenize the message.
-  auto message = std::string(reply.message, reply.len);
-  auto preamble_end = message.find("): ");
-  if (preamble_end == std::string::npos) {
+  auto preamble_end = record.find("): ");
+  if (preamble_end == AuditFieldValue::npos) {
     return false;
-  } else {
-    ec->preamble = message.substr(0, preamble_end + 1);
-    message = message.substr(preamble_end + 3);
   }
+  ec->preamble = record.substr(0, preamble_end + 1);
 
   // The linear search will construct series of key value pairs.
-  std::string key, value;
+  size_t key_begin = preamble_end + 3;
+  size_t key_end = key_begin;
+  size_t value_begin = key_begin;
   // There are several ways of representing value data (enclosed strings, etc).
   bool found_assignment{false}, found_enclose{false};
-  for (const auto& c : message) {
+  for (size_t i = key_begin; i < record.size(); i++) {
     // Iterate over each character in the audit message.
+    char c = record[i];
     if ((found_enclose && c == '"') || (!found_enclose && c == ' ')) {
-      if (c == '"') {
-        value += c;
-      }
       // This is a terminating sequence, the end of an enclosure or space tok.
-      if (!key.empty()) {
+      if (!found_assignment) {
+        key_end = i;
+        value_begin = i;
+      }
+      if (key_end > key_begin) {
         // Multiple space tokens are supported.
-        ec->fields[key] = value;
+        size_t value_end = (c == '"') ? i + 1 : i;
+        ec->fields.add(record.substr(key_begin, key_end - key_begin),
+                       record.substr(value_begin, value_end - value_begin));
       }
       found_enclose = false;
       found_assignment = false;
-      key.clear();
-      value.clear();
-    } else if (!found_assignment && c == ' ') {
-      // A field tokenizer.
+      key_begin = i + 1;
     } else if (found_assignment) {
       // Enclosure sequences appear immediately following assignment.
       if (c == '"') {
         found_enclose = true;
       }
-      value += c;
     } else if (c == '=') {
       found_assignment = true;
-    } else {
-      key += c;
+      key_end = i;
+      value_begin = i + 1;
     }
   }
 
   // Last step, if there was no trailing tokenizer.
-  if (!key.empty()) {
-    ec->fields[key] = value;
+  if (!found_assignment) {
+    key_end = record.size();
+    value_begin = record.size();
+  }
+  if (key_end > key_begin) {
+    ec->fields.add(record.substr(key_begin, key_end - key_begin),
+                   record.substr(value_begin));
   }
 
   // There is a special field for syscalls.
-  if (ec->fields.count("syscall") == 1) {
-    const auto& syscall_string = ec->fields.at("syscall").c_str();
-    long long syscall{0};
-    if (!safeStrtoll(syscall_string, 10, syscall)) {
-      syscall = 0;
+  ec->syscall = 0;
+  auto syscall = ec->fields["syscall"];
+  for (const auto& c : syscall) {
+    if (c < '0' || c > '9') {
+      ec->syscall = 0;
+      break;
     }
-    ec->syscall = syscall;
+    ec->syscall = ec->syscall * 10 + (c - '0');
   }
 
   return true;
 }
 
+inline bool handleAuditReply(const struct audit_reply& reply,
+                             AuditEventContextRef& ec) {
+  return parseAuditRecord(
+      reply.type, std::string(reply.message, reply.len), ec);
+}
+
 void AuditEventPublisher::handleListRules() {
   // Store the rules response.
   // This is not needed until there are audit meta-tables listing the rules.
 }
 
+void AuditEventPublisher::handleStatus(const struct audit_status& status) {
+  memcpy(&status_, &status, sizeof(struct audit_status));
+
+  // The kernel lost count is cumulative, only count losses while running.
+  uint32_t lost = 0;
+  if (has_status_ && status_.lost > last_lost_) {
+    lost = status_.lost - last_lost_;
+    drop_count_ += lost;
+    VLOG(1) << "Audit kernel backlog lost " << lost << " records";
+  }
+  last_lost_ = status_.lost;
+  has_status_ = true;
+
+  if (!control_ || immutable_ || FLAGS_disable_audit) {
+    return;
+  }
+
+  // Enforce the minimum limit, and double it while records are being lost.
+  uint64_t limit = std::max<uint64_t>(status_.backlog_limit, 1);
+  if (lost > 0 && limit < FLAGS_audit_backlog_limit_max) {
+    limit = std::min<uint64_t>(limit * 2, FLAGS_audit_backlog_limit_max);
+  }
+  limit = std::max<uint64_t>(limit, FLAGS_audit_backlog_limit);
+  if (limit != status_.backlog_limit) {
+    VLOG(1) << "Setting audit backlog limit: " << limit;
+    audit_set_backlog_limit(handle_, static_cast<uint32_t>(limit));
+  }
+}
+
+void AuditEventPublisher::handleMessage(const struct nlmsghdr* nlh) {
+  // Replies are 'handled' as potential events for several audit types.
+  bool handle_reply = false;
+  switch (nlh->nlmsg_type) {
+  case NLMSG_NOOP:
+  case NLMSG_DONE:
+  case NLMSG_ERROR:
+    // Not handled, request another reply.
+    break;
+  case AUDIT_LIST_RULES:
+    // Build rules cache.
+    handleListRules();
+    break;
+  case AUDIT_GET:
+    // Make a copy of the status reply and store as the most-recent.
+    if (nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct audit_status))) {
+      handleStatus(*static_cast<const struct audit_status*>(
+          NLMSG_DATA(const_cast<struct nlmsghdr*>(nlh))));
+    }
+    break;
+  case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
+    handle_reply = true;
+    break;
+  case (AUDIT_GET + 1)...(AUDIT_LIST_RULES - 1):
+  case (AUDIT_LIST_RULES + 1)...(AUDIT_FIRST_USER_MSG - 1):
+    // Not interested in handling meta-commands and actions.
+    break;
+  case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
+  case AUDIT_CONFIG_CHANGE:
+    handleAuditConfigChange(nlh);
+    break;
+  case AUDIT_SYSCALL: // 1300
+    // A monitored syscall was issued, most likely part of a multi-record.
+    handle_reply = true;
+    break;
+  case AUDIT_CWD: // 1307
+  case AUDIT_PATH: // 1302
+  case AUDIT_EXECVE: // // 1309 (execve arguments).
+    handle_reply = true;
+  case AUDIT_EOE: // 1320 (multi-record event).
+    break;
+  default:
+    // All other cases, pass to reply.
+    handle_reply = true;
+  }
+
+  if (!handle_reply || parser_ == nullptr) {
+    return;
+  }
+
+  // Copy the record out of the receive buffer, the record may not be
+  // terminated and may include trailing padding.
+  const char* data = static_cast<const char*>(
+      NLMSG_DATA(const_cast<struct nlmsghdr*>(nlh)));
+  size_t length = nlh->nlmsg_len - NLMSG_HDRLEN;
+  std::string message(data, strnlen(data, length));
+  int type = nlh->nlmsg_type;
+
+  // Build the event context from the reply type and parse the message.
+  bool queued = parser_->push([this, type, message]() mutable {
+    auto ec = createEventContext();
+    if (parseAuditRecord(type, std::move(message), ec)) {
+      fire(ec);
+    }
+  });
+  if (!queued) {
+    drop_count_++;
+  }
+}
+
 Status AuditEventPublisher::run() {
   if (!FLAGS_disable_audit && (count_ == 0 || count_++ % 10 == 0)) {
     // Request an update to the audit status.
@@ -243,71 +580,48 @@ Status AuditEventPublisher::run() {
     audit_request_status(handle_);
   }
 
-  // Reset the reply data.
-  int result = 0;
-  bool handle_reply = false;
-  while (true) {
-    handle_reply = false;
-
-    // Request a reply in a non-blocking mode.
-    // This allows the publisher's run loop to periodically request an audit
-    // status update. These updates can check for other processes attempting to
-    // gain control over the audit sink.
-    // This non-blocking also allows faster receipt of multi-message events.
-    result = audit_get_reply(handle_, &reply_, GET_REPLY_NONBLOCKING, 0);
-    if (result > 0) {
-      switch (reply_.type) {
-      case NLMSG_NOOP:
-      case NLMSG_DONE:
-      case NLMSG_ERROR:
-        // Not handled, request another reply.
-        break;
-      case AUDIT_LIST_RULES:
-        // Build rules cache.
-        handleListRules();
+  // Wait for records rather than sleeping, multi-message events are received
+  // as soon as the kernel emits them.
+  struct pollfd fds[1];
+  fds[0].fd = handle_;
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  if (poll(fds, 1, kAuditMLatency) > 0 && (fds[0].revents & POLLIN)) {
+    while (!isEnding()) {
+      // Receive a batch of datagrams in a non-blocking mode.
+      // This allows the publisher's run loop to periodically request an audit
+      // status update. These updates can check for other processes attempting
+      // to gain control over the audit sink.
+      for (size_t i = 0; i < kAuditBatchSize; i++) {
+        memset(&messages_[i], 0, sizeof(struct mmsghdr));
+        messages_[i].msg_hdr.msg_name = &addresses_[i];
+        messages_[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+        messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int count = recvmmsg(
+          handle_, messages_.data(), kAuditBatchSize, MSG_DONTWAIT, nullptr);
+      if (count <= 0) {
         break;
-      case AUDIT_GET:
-        // Make a copy of the status reply and store as the most-recent.
-        if (reply_.status != nullptr) {
-          memcpy(&status_, reply_.status, sizeof(struct audit_status));
+      }
+
+      for (int i = 0; i < count; i++) {
+        // Only trust messages sent from the kernel.
+        if (addresses_[i].nl_pid != 0) {
+          continue;
+        }
+
+        auto nlh = reinterpret_cast<struct nlmsghdr*>(iovecs_[i].iov_base);
+        unsigned int length = messages_[i].msg_len;
+        for (; NLMSG_OK(nlh, length); nlh = NLMSG_NEXT(nlh, length)) {
+          handleMessage(nlh);
         }
-        break;
-      case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
-        handle_reply = true;
-        break;
-      case (AUDIT_GET + 1)...(AUDIT_LIST_RULES - 1):
-      case (AUDIT_LIST_RULES + 1)...(AUDIT_FIRST_USER_MSG - 1):
-        // Not interested in handling meta-commands and actions.
-        break;
-      case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
-      case AUDIT_CONFIG_CHANGE:
-        handleAuditConfigChange(reply_);
-        break;
-      case AUDIT_SYSCALL: // 1300
-        // A monitored syscall was issued, most likely part of a multi-record.
-        handle_reply = true;
-        break;
-      case AUDIT_CWD: // 1307
-      case AUDIT_PATH: // 1302
-      case AUDIT_EXECVE: // // 1309 (execve arguments).
-        handle_reply = true;
-      case AUDIT_EOE: // 1320 (multi-record event).
-        break;
-      default:
-        // All other cases, pass to reply.
-        handle_reply = true;
       }
-    } else {
-      // Fall through to the run loop cool down.
-      break;
-    }
 
-    // Replies are 'handled' as potential events for several audit types.
-    if (handle_reply) {
-      auto ec = createEventContext();
-      // Build the event context from the reply type and parse the message.
-      if (handleAuditReply(reply_, ec)) {
-        fire(ec);
+      if (static_cast<size_t>(count) < kAuditBatchSize) {
+        // The socket was drained.
+        break;
       }
     }
   }
@@ -327,8 +641,6 @@ Status AuditEventPublisher::run() {
     }
   }
 
-  // Only apply a cool down if the reply request failed.
-  osquery::publisherSleep(kAuditMLatency);
   return Status(0, "OK");
 }
 
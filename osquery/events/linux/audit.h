@@ -10,11 +10,18 @@
 
 #pragma once
 
+#include <sys/socket.h>
+
 #include <map>
+#include <memory>
 #include <set>
+#include <stdexcept>
 #include <vector>
 
+#include <boost/utility/string_ref.hpp>
+
 #include <libaudit.h>
+#include <linux/netlink.h>
 
 #include <osquery/events.h>
 
@@ -35,7 +42,12 @@ struct AuditRule {
   /// The rule may either contain a filter or syscall number.
   int syscall{0};
 
-  /// The rule may either contain a filter or a syscall number.
+  /**
+   * @brief Space-separated field comparisons, such as "success=1 uid!=0".
+   *
+   * Field comparisons are evaluated by the kernel, a syscall record is only
+   * sent if every comparison of a rule matches.
+   */
   std::string filter;
 
   /// All rules must include an action and set of flags.
@@ -53,9 +65,19 @@ struct AuditRule {
 
 /// Internal rule storage for transient rule additions/removals.
 struct AuditRuleInternal {
-  struct audit_rule_data rule;
+  /// The rule data followed by the buffer of its string field values.
+  std::vector<char> data;
   int flags{0};
   int action{0};
+
+  struct audit_rule_data* rule() {
+    return reinterpret_cast<struct audit_rule_data*>(data.data());
+  }
+
+  bool operator==(const AuditRuleInternal& other) const {
+    return flags == other.flags && action == other.action &&
+           data == other.data;
+  }
 };
 
 /**
@@ -101,6 +123,107 @@ struct AuditSubscriptionContext : public SubscriptionContext {
   friend class AuditEventPublisher;
 };
 
+/// An audit field key or value referencing the audit record.
+using AuditFieldValue = boost::string_ref;
+
+/**
+ * @brief Audit record fields tokenized in place.
+ *
+ * Keys and values reference the record owned by the AuditEventContext, in the
+ * order they appear in the record. Records hold few fields, so a linear
+ * search is faster than building a map of copied strings.
+ */
+class AuditFields {
+ public:
+  using Field = std::pair<AuditFieldValue, AuditFieldValue>;
+  using const_iterator = std::vector<Field>::const_iterator;
+
+  /// Add a field, a repeated key replaces the previous value.
+  void add(const AuditFieldValue& key, const AuditFieldValue& value) {
+    for (auto& field : fields_) {
+      if (field.first == key) {
+        field.second = value;
+        return;
+      }
+    }
+    fields_.push_back(std::make_pair(key, value));
+  }
+
+  /// The number of fields with the key, either 0 or 1.
+  size_t count(const AuditFieldValue& key) const {
+    return (find(key) != fields_.end()) ? 1 : 0;
+  }
+
+  /// Access a field value, throws std::out_of_range if there is no key.
+  const AuditFieldValue& at(const AuditFieldValue& key) const {
+    auto field = find(key);
+    if (field == fields_.end()) {
+      throw std::out_of_range("No audit field: " + key.to_string());
+    }
+    return field->second;
+  }
+
+  /// Access a field value, or an empty value if there is no key.
+  AuditFieldValue operator[](const AuditFieldValue& key) const {
+    auto field = find(key);
+    return (field != fields_.end()) ? field->second : AuditFieldValue();
+  }
+
+  size_t size() const { return fields_.size(); }
+  void clear() { fields_.clear(); }
+  const_iterator begin() const { return fields_.begin(); }
+  const_iterator end() const { return fields_.end(); }
+
+ private:
+  const_iterator find(const AuditFieldValue& key) const {
+    for (auto it = fields_.begin(); it != fields_.end(); ++it) {
+      if (it->first == key) {
+        return it;
+      }
+    }
+    return fields_.end();
+  }
+
+ private:
+  std::vector<Field> fields_;
+};
+
+/// Convert a hex character to its value, or -1 if it is not a hex character.
+inline int auditHexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief Append a hex-encoded audit value to an output buffer.
+ *
+ * @return false, leaving the output unchanged, if the value is not hex.
+ */
+inline bool decodeAuditHex(const AuditFieldValue& value, std::string& output) {
+  if (value.size() % 2 != 0) {
+    return false;
+  }
+
+  auto size = output.size();
+  output.reserve(size + value.size() / 2);
+  for (size_t i = 0; i < value.size(); i += 2) {
+    int high = auditHexValue(value[i]);
+    int low = auditHexValue(value[i + 1]);
+    if (high < 0 || low < 0) {
+      output.resize(size);
+      return false;
+    }
+    output.push_back(static_cast<char>((high << 4) | low));
+  }
+  return true;
+}
+
 struct AuditEventContext : public EventContext {
   /// The audit reply type.
   int type{0};
@@ -114,11 +237,24 @@ struct AuditEventContext : public EventContext {
    *
    * If the field contained a space in the value the data will be hex encoded.
    * It is the responsibility of the subscription callback/handler to parse.
+   * Fields reference the record and are only valid with this context.
    */
-  std::map<std::string, std::string> fields;
+  AuditFields fields;
 
   /// Each message will contain the audit time.
-  std::string preamble;
+  AuditFieldValue preamble;
+
+  /// The audit record's message, owned by the context.
+  std::string record;
+
+  /// Reset a pooled context, keeping the field storage.
+  void clear() {
+    type = 0;
+    syscall = 0;
+    fields.clear();
+    preamble = AuditFieldValue();
+    record.clear();
+  }
 };
 
 using AuditEventContextRef = std::shared_ptr<AuditEventContext>;
@@ -155,16 +291,45 @@ class AuditEventPublisher
   /// Remove audit rules and close the handle.
   void tearDown() override;
 
-  /// Poll for replies to the netlink handle in a non-blocking mode.
+  /**
+   * @brief Drain the netlink handle in batches of messages.
+   *
+   * Each receive call reads a batch of netlink datagrams. Event records are
+   * copied and handed to a parsing worker, so the socket is drained as fast
+   * as the kernel audit thread emits records.
+   */
   Status run() override;
 
  public:
   AuditEventPublisher() : EventPublisher(){};
 
  private:
+  /**
+   * @brief Merge the subscription rules into a minimal set of kernel rules.
+   *
+   * Rules with equal filters, flags, and action become a single rule matching
+   * the union of their syscalls. Each exclusion, a field comparison such as
+   * "uid=postgres", becomes a never rule for the union of every exit syscall.
+   * Never rules come first as the kernel stops at the first matching rule.
+   */
+  static std::vector<AuditRuleInternal> buildRules(
+      const std::vector<AuditRule>& rules,
+      const std::vector<std::string>& exclusions);
+
   /// Maintain a list of audit rule data for displaying or deleting.
   void handleListRules();
 
+  /// Handle a single netlink message from a received datagram.
+  void handleMessage(const struct nlmsghdr* nlh);
+
+  /**
+   * @brief Count kernel losses as drops and grow the backlog limit for them.
+   *
+   * Records the kernel lost since the previous status reply are added to the
+   * publisher's drop count, see numDropped.
+   */
+  void handleStatus(const struct audit_status& status);
+
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const AuditSubscriptionContextRef& mc,
                   const AuditEventContextRef& ec) const override;
@@ -196,10 +361,28 @@ class AuditEventPublisher
   /// Is this process in control of the audit subsystem.
   bool control_{false};
 
-  /// The last (most recent) audit reply.
-  struct audit_reply reply_;
+  /// A receive buffer for each message in a batch.
+  std::vector<char> buffers_;
+
+  /// Batched receive message headers, netlink addresses, and vectors.
+  std::vector<struct mmsghdr> messages_;
+  std::vector<struct sockaddr_nl> addresses_;
+  std::vector<struct iovec> iovecs_;
 
-  /// Track all rule data added by the publisher.
+  /// Parse and fire event records away from the netlink receive loop.
+  std::unique_ptr<EventDispatchQueue> parser_{nullptr};
+
+  /// The kernel's cumulative lost count at the previous status reply.
+  uint32_t last_lost_{0};
+
+  /// Set after the first status reply established the lost count baseline.
+  bool has_status_{false};
+
+  /// Track all rule data added by the publisher, removed during tear down.
   std::vector<struct AuditRuleInternal> transient_rules_;
+
+ private:
+  FRIEND_TEST(AuditTests, test_build_rules);
+  FRIEND_TEST(AuditTests, test_handle_status);
 };
 }
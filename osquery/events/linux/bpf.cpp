@@ -0,0 +1,810 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <pwd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+/// The BPF publisher is an alternative to the audit publisher.
+FLAG(bool,
+     disable_bpf,
+     true,
+     "Disable receiving process and socket events from eBPF programs");
+
+/// Each CPU's ring buffer absorbs bursts of records between drains.
+FLAG(uint64,
+     bpf_perf_pages,
+     64,
+     "Pages of the BPF perf ring buffer of each CPU, a power of 2");
+
+/// Service accounts with frequent events are excluded in the kernel.
+FLAG(string,
+     bpf_exclude_users,
+     "",
+     "Comma-separated users or uids whose events are dropped in the kernel");
+
+REGISTER(BPFEventPublisher, "event_publisher", "bpf");
+
+/// The mount points of the tracing filesystem.
+static const std::vector<std::string> kTracingPaths = {
+    "/sys/kernel/tracing", "/sys/kernel/debug/tracing",
+};
+
+/// Milliseconds to wait for a buffer to pass its watermark before a drain.
+static const int kBPFLatency = 200;
+
+/// The most socket syscalls between entry and exit, and excluded uids.
+static const size_t kBPFPendingMax = 4096;
+static const size_t kBPFExcludedMax = 64;
+
+/// Helpers of Linux 5.5, and the helpers they replace.
+static const int32_t kBPFProbeReadUser = 112;
+static const int32_t kBPFProbeReadKernelStr = 115;
+static const int32_t kBPFProbeRead = 4;
+static const int32_t kBPFProbeReadStr = 45;
+
+/// The record and the map key on the program stack.
+static const int16_t kBPFRecord = -static_cast<int16_t>(sizeof(BPFRecord));
+static const int16_t kBPFKey = kBPFRecord - 8;
+
+/// The program registers, r1-r5 are helper arguments and r6-r9 are kept.
+enum BPFRegister {
+  R0 = 0,
+  R1,
+  R2,
+  R3,
+  R4,
+  R5,
+  R6,
+  R7,
+  R8,
+  R9,
+  R10,
+};
+
+/// The offset of a record field on the program stack.
+#define BPF_RECORD_FIELD(field) \
+  static_cast<int16_t>(kBPFRecord + offsetof(BPFRecord, field))
+
+/**
+ * @brief A minimal assembler for the publisher's programs.
+ *
+ * Forward jumps are emitted with jump and resolved with label.
+ */
+class BPFAssembler {
+ public:
+  void mov(uint8_t dst, uint8_t src) {
+    emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+  }
+
+  void movImm(uint8_t dst, int32_t imm) {
+    emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+  }
+
+  /// Move a 32-bit immediate, the upper 32 bits are zero.
+  void mov32Imm(uint8_t dst, int32_t imm) {
+    emit(BPF_ALU | BPF_MOV | BPF_K, dst, 0, 0, imm);
+  }
+
+  void aluImm(uint8_t op, uint8_t dst, int32_t imm) {
+    emit(BPF_ALU64 | op | BPF_K, dst, 0, 0, imm);
+  }
+
+  void alu(uint8_t op, uint8_t dst, uint8_t src) {
+    emit(BPF_ALU64 | op | BPF_X, dst, src, 0, 0);
+  }
+
+  void load(uint8_t size, uint8_t dst, uint8_t src, int16_t off) {
+    emit(BPF_LDX | size | BPF_MEM, dst, src, off, 0);
+  }
+
+  void store(uint8_t size, uint8_t dst, int16_t off, uint8_t src) {
+    emit(BPF_STX | size | BPF_MEM, dst, src, off, 0);
+  }
+
+  void storeImm(uint8_t size, uint8_t dst, int16_t off, int32_t imm) {
+    emit(BPF_ST | size | BPF_MEM, dst, 0, off, imm);
+  }
+
+  /// Set a register to a pointer on the stack.
+  void stack(uint8_t dst, int16_t off) {
+    mov(dst, R10);
+    aluImm(BPF_ADD, dst, off);
+  }
+
+  /// Load a map descriptor, which the kernel replaces with the map.
+  void loadMap(uint8_t dst, int fd) {
+    emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+    emit(0, 0, 0, 0, 0);
+  }
+
+  void call(int32_t helper) { emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper); }
+
+  /// Emit a conditional jump, returning the jump to resolve with label.
+  size_t jump(uint8_t op, uint8_t dst, int32_t imm) {
+    emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+    return program.size() - 1;
+  }
+
+  /// Emit a conditional jump comparing two registers.
+  size_t jumpReg(uint8_t op, uint8_t dst, uint8_t src) {
+    emit(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+    return program.size() - 1;
+  }
+
+  /// Resolve a jump to the next instruction.
+  void label(size_t jump) {
+    program[jump].off = static_cast<int16_t>(program.size() - jump - 1);
+  }
+
+  void exit() { emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0); }
+
+ public:
+  std::vector<struct bpf_insn> program;
+
+ private:
+  void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    struct bpf_insn insn;
+    memset(&insn, 0, sizeof(insn));
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    program.push_back(insn);
+  }
+};
+
+static int bpf(int cmd, union bpf_attr& attr) {
+  return static_cast<int>(::syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+}
+
+static int openPerfEvent(struct perf_event_attr& attr, int cpu) {
+  return static_cast<int>(::syscall(
+      __NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+static int createMap(bpf_map_type type,
+                     size_t key_size,
+                     size_t value_size,
+                     size_t max_entries) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = type;
+  attr.key_size = static_cast<uint32_t>(key_size);
+  attr.value_size = static_cast<uint32_t>(value_size);
+  attr.max_entries = static_cast<uint32_t>(max_entries);
+  return bpf(BPF_MAP_CREATE, attr);
+}
+
+static int updateMap(int map, const void* key, const void* value) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map;
+  attr.key = reinterpret_cast<uint64_t>(key);
+  attr.value = reinterpret_cast<uint64_t>(value);
+  attr.flags = BPF_ANY;
+  return bpf(BPF_MAP_UPDATE_ELEM, attr);
+}
+
+static int deleteMap(int map, const void* key) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map;
+  attr.key = reinterpret_cast<uint64_t>(key);
+  return bpf(BPF_MAP_DELETE_ELEM, attr);
+}
+
+static int loadProgram(const std::vector<struct bpf_insn>& program,
+                       std::string& log) {
+  static const char kLicense[] = "GPL";
+  std::vector<char> buffer(64 * 1024);
+
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+  attr.insn_cnt = static_cast<uint32_t>(program.size());
+  attr.insns = reinterpret_cast<uint64_t>(program.data());
+  attr.license = reinterpret_cast<uint64_t>(kLicense);
+  attr.log_level = 1;
+  attr.log_size = static_cast<uint32_t>(buffer.size());
+  attr.log_buf = reinterpret_cast<uint64_t>(buffer.data());
+  auto fd = bpf(BPF_PROG_LOAD, attr);
+  if (fd < 0) {
+    log = std::string(strerror(errno)) + ": " + buffer.data();
+  }
+  return fd;
+}
+
+Status parseTracepointFormat(const std::string& format,
+                             std::map<std::string, size_t>& offsets) {
+  // Fields are described as "field:int fd;\toffset:16;\tsize:8;\tsigned:0;".
+  for (const auto& line : osquery::split(format, "\n")) {
+    auto field = line.find("field:");
+    auto offset = line.find("offset:");
+    if (field == std::string::npos || offset == std::string::npos) {
+      continue;
+    }
+
+    auto end = line.find(';', field);
+    auto declaration = line.substr(field + 6, end - field - 6);
+    boost::trim(declaration);
+    auto name = declaration.substr(declaration.find_last_of(" *") + 1);
+    name = name.substr(0, name.find('['));
+
+    long long value = 0;
+    end = line.find(';', offset);
+    if (name.empty() ||
+        !safeStrtoll(line.substr(offset + 7, end - offset - 7), 10, value)
+             .ok()) {
+      return Status(1, "Unexpected tracepoint field: " + line);
+    }
+    offsets[name] = static_cast<size_t>(value);
+  }
+
+  if (offsets.empty()) {
+    return Status(1, "No tracepoint fields");
+  }
+  return Status(0, "OK");
+}
+
+/**
+ * @brief Start a record of the current task on the stack.
+ *
+ * Zeros the record, fills in the task and the event type, and exits without
+ * a record if the task's uid is excluded. Keeps the context in r6 and the
+ * pid and thread id in r7.
+ */
+static void emitRecordStart(BPFAssembler& a,
+                            int excluded_map,
+                            BPFEventType type,
+                            size_t size,
+                            std::vector<size_t>& exits) {
+  a.mov(R6, R1);
+  for (size_t i = 0; i < size; i += 8) {
+    a.storeImm(BPF_DW, R10, static_cast<int16_t>(kBPFRecord + i), 0);
+  }
+
+  a.call(BPF_FUNC_get_current_pid_tgid);
+  a.mov(R7, R0);
+  a.store(BPF_W, R10, BPF_RECORD_FIELD(tid), R0);
+  a.aluImm(BPF_RSH, R0, 32);
+  a.store(BPF_W, R10, BPF_RECORD_FIELD(pid), R0);
+
+  // Excluded users are dropped before copying any memory.
+  a.call(BPF_FUNC_get_current_uid_gid);
+  a.mov(R8, R0);
+  a.store(BPF_W, R10, kBPFKey, R0);
+  a.loadMap(R1, excluded_map);
+  a.stack(R2, kBPFKey);
+  a.call(BPF_FUNC_map_lookup_elem);
+  exits.push_back(a.jump(BPF_JNE, R0, 0));
+  a.store(BPF_W, R10, BPF_RECORD_FIELD(uid), R8);
+  a.aluImm(BPF_RSH, R8, 32);
+  a.store(BPF_W, R10, BPF_RECORD_FIELD(gid), R8);
+
+  a.stack(R1, BPF_RECORD_FIELD(comm));
+  a.movImm(R2, sizeof(BPFRecord::comm));
+  a.call(BPF_FUNC_get_current_comm);
+  a.call(BPF_FUNC_ktime_get_ns);
+  a.store(BPF_DW, R10, BPF_RECORD_FIELD(time), R0);
+  a.storeImm(BPF_W, R10, BPF_RECORD_FIELD(type), type);
+}
+
+/// Write a record to the perf buffer of the current CPU, r4 is the record.
+static void emitOutput(BPFAssembler& a, int events_map, size_t size) {
+  a.mov(R1, R6);
+  a.loadMap(R2, events_map);
+  a.mov32Imm(R3, static_cast<int32_t>(BPF_F_CURRENT_CPU));
+  a.movImm(R5, static_cast<int32_t>(size));
+  a.call(BPF_FUNC_perf_event_output);
+}
+
+/// Resolve the exits and return from the program.
+static void emitExit(BPFAssembler& a, const std::vector<size_t>& exits) {
+  for (const auto& exit : exits) {
+    a.label(exit);
+  }
+  a.movImm(R0, 0);
+  a.exit();
+}
+
+/// The sched_process_exec program, a record with the executed path.
+static std::vector<struct bpf_insn> buildExecProgram(
+    const std::map<std::string, size_t>& offsets,
+    bool compatible,
+    int events_map,
+    int excluded_map) {
+  if (offsets.count("filename") == 0) {
+    return {};
+  }
+
+  BPFAssembler a;
+  std::vector<size_t> exits;
+  emitRecordStart(a, excluded_map, BPF_TYPE_EXEC, sizeof(BPFRecord), exits);
+
+  // The filename is a __data_loc, its offset is the low 16 bits.
+  a.load(BPF_W, R3, R6, static_cast<int16_t>(offsets.at("filename")));
+  a.aluImm(BPF_AND, R3, 0xffff);
+  a.alu(BPF_ADD, R3, R6);
+  a.stack(R1, BPF_RECORD_FIELD(path));
+  a.movImm(R2, sizeof(BPFRecord::path));
+  a.call((compatible) ? kBPFProbeReadStr : kBPFProbeReadKernelStr);
+
+  a.stack(R4, kBPFRecord);
+  emitOutput(a, events_map, sizeof(BPFRecord));
+  emitExit(a, exits);
+  return a.program;
+}
+
+/// The sched_process_exit program, a record when the thread group exits.
+static std::vector<struct bpf_insn> buildExitProgram(int events_map,
+                                                     int excluded_map) {
+  BPFAssembler a;
+  std::vector<size_t> exits;
+  emitRecordStart(a, excluded_map, BPF_TYPE_EXIT, kBPFSocketRecordSize, exits);
+
+  // Every thread exits, the process has exited with its leader.
+  a.mov(R1, R7);
+  a.aluImm(BPF_RSH, R1, 32);
+  a.mov32Imm(R2, -1);
+  a.alu(BPF_AND, R7, R2);
+  exits.push_back(a.jumpReg(BPF_JNE, R1, R7));
+
+  a.stack(R4, kBPFRecord);
+  emitOutput(a, events_map, kBPFSocketRecordSize);
+  emitExit(a, exits);
+  return a.program;
+}
+
+/// The connect or bind entry program, a record kept until the syscall exits.
+static std::vector<struct bpf_insn> buildSocketEntryProgram(
+    const std::map<std::string, size_t>& offsets,
+    bool compatible,
+    BPFEventType type,
+    int pending_map,
+    int excluded_map) {
+  // The bind tracepoint names the address umyaddr, connect names uservaddr.
+  auto address = (offsets.count("uservaddr") > 0) ? "uservaddr" : "umyaddr";
+  if (offsets.count("fd") == 0 || offsets.count(address) == 0 ||
+      offsets.count("addrlen") == 0) {
+    return {};
+  }
+
+  BPFAssembler a;
+  std::vector<size_t> exits;
+  emitRecordStart(a, excluded_map, type, kBPFSocketRecordSize, exits);
+  a.load(BPF_DW, R1, R6, static_cast<int16_t>(offsets.at("fd")));
+  a.store(BPF_DW, R10, BPF_RECORD_FIELD(fd), R1);
+
+  // Copy at most the size of the address field.
+  a.load(BPF_DW, R2, R6, static_cast<int16_t>(offsets.at("addrlen")));
+  auto bounded = a.jump(BPF_JLE, R2, sizeof(BPFRecord::address));
+  a.movImm(R2, sizeof(BPFRecord::address));
+  a.label(bounded);
+  a.store(BPF_W, R10, BPF_RECORD_FIELD(address_length), R2);
+  a.load(BPF_DW, R3, R6, static_cast<int16_t>(offsets.at(address)));
+  a.stack(R1, BPF_RECORD_FIELD(address));
+  a.call((compatible) ? kBPFProbeRead : kBPFProbeReadUser);
+
+  // The record is written when the thread exits the syscall.
+  a.store(BPF_DW, R10, kBPFKey, R7);
+  a.loadMap(R1, pending_map);
+  a.stack(R2, kBPFKey);
+  a.stack(R3, kBPFRecord);
+  a.movImm(R4, BPF_ANY);
+  a.call(BPF_FUNC_map_update_elem);
+  emitExit(a, exits);
+  return a.program;
+}
+
+/// The connect or bind exit program, writes the record with the result.
+static std::vector<struct bpf_insn> buildSocketExitProgram(
+    const std::map<std::string, size_t>& offsets,
+    int events_map,
+    int pending_map) {
+  if (offsets.count("ret") == 0) {
+    return {};
+  }
+
+  BPFAssembler a;
+  std::vector<size_t> exits;
+  a.mov(R6, R1);
+  a.call(BPF_FUNC_get_current_pid_tgid);
+  a.store(BPF_DW, R10, -8, R0);
+  a.loadMap(R1, pending_map);
+  a.stack(R2, -8);
+  a.call(BPF_FUNC_map_lookup_elem);
+  exits.push_back(a.jump(BPF_JEQ, R0, 0));
+
+  a.mov(R7, R0);
+  a.load(BPF_DW, R1, R6, static_cast<int16_t>(offsets.at("ret")));
+  a.store(BPF_DW, R7, offsetof(BPFRecord, ret), R1);
+  a.mov(R4, R7);
+  emitOutput(a, events_map, kBPFSocketRecordSize);
+  a.loadMap(R1, pending_map);
+  a.stack(R2, -8);
+  a.call(BPF_FUNC_map_delete_elem);
+  emitExit(a, exits);
+  return a.program;
+}
+
+Status BPFEventPublisher::setUp() {
+  if (FLAGS_disable_bpf) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  for (const auto& path : kTracingPaths) {
+    if (isReadable(path + "/events/sched/sched_process_exec/id").ok()) {
+      tracefs_ = path;
+      break;
+    }
+  }
+  if (tracefs_.empty()) {
+    return Status(1, "Cannot find the tracing filesystem");
+  }
+
+  auto cpus = static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF));
+  events_map_ = createMap(BPF_MAP_TYPE_PERF_EVENT_ARRAY, 4, 4, cpus);
+  pending_map_ =
+      createMap(BPF_MAP_TYPE_HASH, 8, kBPFSocketRecordSize, kBPFPendingMax);
+  excluded_map_ = createMap(BPF_MAP_TYPE_HASH, 4, 1, kBPFExcludedMax);
+  if (events_map_ < 0 || pending_map_ < 0 || excluded_map_ < 0) {
+    auto error = std::string(strerror(errno));
+    tearDown();
+    return Status(1, "Cannot create BPF maps: " + error);
+  }
+
+  // The ring buffer size must be a power of 2 pages.
+  size_t pages = 1;
+  while (pages < FLAGS_bpf_perf_pages) {
+    pages <<= 1;
+  }
+  auto page_size = static_cast<size_t>(getpagesize());
+  for (size_t cpu = 0; cpu < cpus; cpu++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_BPF_OUTPUT;
+    attr.sample_type = PERF_SAMPLE_RAW;
+    attr.sample_period = 1;
+    // Wake the run loop when a quarter of the buffer is used.
+    attr.watermark = 1;
+    attr.wakeup_watermark = static_cast<uint32_t>(pages * page_size / 4);
+
+    BPFPerfBuffer buffer;
+    buffer.fd = openPerfEvent(attr, static_cast<int>(cpu));
+    if (buffer.fd < 0) {
+      // The CPU is offline.
+      continue;
+    }
+
+    buffer.size = pages * page_size;
+    buffer.base = ::mmap(nullptr,
+                         buffer.size + page_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         buffer.fd,
+                         0);
+    if (buffer.base == MAP_FAILED) {
+      ::close(buffer.fd);
+      continue;
+    }
+
+    uint32_t key = static_cast<uint32_t>(cpu);
+    ::ioctl(buffer.fd, PERF_EVENT_IOC_ENABLE, 0);
+    updateMap(events_map_, &key, &buffer.fd);
+    buffers_.push_back(buffer);
+  }
+
+  if (buffers_.empty()) {
+    tearDown();
+    return Status(1, "Cannot open BPF perf buffers");
+  }
+  return Status(0, "OK");
+}
+
+Status BPFEventPublisher::attachTracepoint(const std::string& name,
+                                           const BPFProgramBuilder& builder) {
+  auto path = tracefs_ + "/events/" + name;
+  std::string format;
+  std::string id;
+  if (!readFile(path + "/format", format).ok() ||
+      !readFile(path + "/id", id).ok()) {
+    return Status(1, "Cannot read tracepoint " + name);
+  }
+
+  std::map<std::string, size_t> offsets;
+  long long config = 0;
+  boost::trim(id);
+  auto status = parseTracepointFormat(format, offsets);
+  if (!status.ok() || !safeStrtoll(id, 10, config).ok()) {
+    return Status(1, "Cannot parse tracepoint " + name);
+  }
+
+  auto program = builder(offsets, compatible_);
+  if (program.empty()) {
+    return Status(1, "Unexpected tracepoint fields for " + name);
+  }
+
+  std::string log;
+  auto fd = loadProgram(program, log);
+  if (fd < 0 && !compatible_) {
+    // Kernels before Linux 5.5 only have the original memory helpers.
+    compatible_ = true;
+    fd = loadProgram(builder(offsets, compatible_), log);
+  }
+  if (fd < 0) {
+    return Status(1, "Cannot load the program for " + name + ": " + log);
+  }
+  programs_.push_back(fd);
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_TRACEPOINT;
+  attr.config = static_cast<uint64_t>(config);
+  attr.sample_period = 1;
+  attr.wakeup_events = 1;
+
+  // A tracepoint program runs on every CPU.
+  auto tracepoint = openPerfEvent(attr, 0);
+  if (tracepoint < 0) {
+    return Status(1, "Cannot open tracepoint " + name);
+  }
+  tracepoints_.push_back(tracepoint);
+  if (::ioctl(tracepoint, PERF_EVENT_IOC_SET_BPF, fd) != 0 ||
+      ::ioctl(tracepoint, PERF_EVENT_IOC_ENABLE, 0) != 0) {
+    return Status(1, "Cannot attach the program to " + name);
+  }
+  return Status(0, "OK");
+}
+
+Status BPFEventPublisher::attach(BPFEventType type) {
+  auto events_map = events_map_;
+  auto pending_map = pending_map_;
+  auto excluded_map = excluded_map_;
+  if (type == BPF_TYPE_EXEC) {
+    return attachTracepoint(
+        "sched/sched_process_exec",
+        ([events_map, excluded_map](
+            const std::map<std::string, size_t>& offsets, bool compatible) {
+          return buildExecProgram(
+              offsets, compatible, events_map, excluded_map);
+        }));
+  } else if (type == BPF_TYPE_EXIT) {
+    return attachTracepoint(
+        "sched/sched_process_exit",
+        ([events_map, excluded_map](const std::map<std::string, size_t>&,
+                                    bool) {
+          return buildExitProgram(events_map, excluded_map);
+        }));
+  }
+
+  auto syscall = (type == BPF_TYPE_CONNECT) ? "connect" : "bind";
+  auto status = attachTracepoint(
+      std::string("syscalls/sys_enter_") + syscall,
+      ([type, pending_map, excluded_map](
+          const std::map<std::string, size_t>& offsets, bool compatible) {
+        return buildSocketEntryProgram(
+            offsets, compatible, type, pending_map, excluded_map);
+      }));
+  if (!status.ok()) {
+    return status;
+  }
+  return attachTracepoint(
+      std::string("syscalls/sys_exit_") + syscall,
+      ([events_map, pending_map](const std::map<std::string, size_t>& offsets,
+                                 bool) {
+        return buildSocketExitProgram(offsets, events_map, pending_map);
+      }));
+}
+
+void BPFEventPublisher::updateExclusions() {
+  std::set<uint32_t> excluded;
+  for (const auto& user : osquery::split(FLAGS_bpf_exclude_users, ",")) {
+    long long uid = 0;
+    if (safeStrtoll(user, 10, uid).ok()) {
+      excluded.insert(static_cast<uint32_t>(uid));
+      continue;
+    }
+    auto pwd = getpwnam(user.c_str());
+    if (pwd == nullptr) {
+      LOG(WARNING) << "Cannot exclude unknown user from BPF events: " << user;
+      continue;
+    }
+    excluded.insert(pwd->pw_uid);
+  }
+
+  for (const auto& uid : excluded_) {
+    if (excluded.count(uid) == 0) {
+      deleteMap(excluded_map_, &uid);
+    }
+  }
+  uint8_t value = 1;
+  for (const auto& uid : excluded) {
+    if (updateMap(excluded_map_, &uid, &value) != 0) {
+      LOG(WARNING) << "Cannot exclude more than " << kBPFExcludedMax
+                   << " users from BPF events";
+      break;
+    }
+  }
+  excluded_ = std::move(excluded);
+}
+
+void BPFEventPublisher::configure() {
+  if (events_map_ < 0) {
+    return;
+  }
+
+  // Programs are only attached for the subscribed event types.
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    for (const auto& type : sc->types) {
+      if (attached_.count(type) > 0) {
+        continue;
+      }
+      attached_.insert(type);
+      auto status = attach(type);
+      if (!status.ok()) {
+        LOG(WARNING) << "Cannot attach BPF program: " << status.getMessage();
+      }
+    }
+  }
+  updateExclusions();
+}
+
+void BPFEventPublisher::tearDown() {
+  // Closing the tracepoint events detaches the programs.
+  for (const auto& fd : tracepoints_) {
+    ::close(fd);
+  }
+  tracepoints_.clear();
+  for (const auto& fd : programs_) {
+    ::close(fd);
+  }
+  programs_.clear();
+  attached_.clear();
+
+  for (auto& buffer : buffers_) {
+    ::munmap(buffer.base, buffer.size + getpagesize());
+    ::close(buffer.fd);
+  }
+  buffers_.clear();
+
+  for (auto map : {&events_map_, &pending_map_, &excluded_map_}) {
+    if (*map >= 0) {
+      ::close(*map);
+      *map = -1;
+    }
+  }
+  excluded_.clear();
+}
+
+void BPFEventPublisher::drain(BPFPerfBuffer& buffer) {
+  auto page = static_cast<struct perf_event_mmap_page*>(buffer.base);
+  auto data = static_cast<const char*>(buffer.base) + getpagesize();
+  auto head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+  auto tail = page->data_tail;
+
+  // Records may wrap around the end of the buffer, each is copied out.
+  std::string record;
+  while (tail < head) {
+    struct perf_event_header header;
+    auto offset = tail % buffer.size;
+    auto first = std::min<size_t>(sizeof(header), buffer.size - offset);
+    memcpy(&header, data + offset, first);
+    memcpy(
+        reinterpret_cast<char*>(&header) + first, data, sizeof(header) - first);
+    if (header.size < sizeof(header)) {
+      break;
+    }
+
+    first = std::min<size_t>(header.size, buffer.size - offset);
+    record.assign(data + offset, first);
+    record.append(data, header.size - first);
+    tail += header.size;
+
+    if (header.type == PERF_RECORD_SAMPLE &&
+        record.size() >= sizeof(header) + sizeof(uint32_t)) {
+      // A raw sample is its size followed by the program's record.
+      uint32_t size = 0;
+      memcpy(&size, &record[sizeof(header)], sizeof(size));
+      auto begin = sizeof(header) + sizeof(size);
+      handleRecord(&record[begin],
+                   std::min<size_t>(size, record.size() - begin));
+    } else if (header.type == PERF_RECORD_LOST &&
+               record.size() >= sizeof(header) + 2 * sizeof(uint64_t)) {
+      uint64_t lost = 0;
+      memcpy(&lost, &record[sizeof(header) + sizeof(uint64_t)], sizeof(lost));
+      lost_ += lost;
+    }
+  }
+  __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void BPFEventPublisher::handleRecord(const char* data, size_t size) {
+  if (size < kBPFSocketRecordSize) {
+    return;
+  }
+
+  BPFRecord record;
+  memset(&record, 0, sizeof(record));
+  memcpy(&record, data, std::min(size, sizeof(record)));
+
+  auto ec = createEventContext();
+  ec->type = static_cast<BPFEventType>(record.type);
+  ec->pid = static_cast<pid_t>(record.pid);
+  ec->tid = static_cast<pid_t>(record.tid);
+  ec->uid = static_cast<uid_t>(record.uid);
+  ec->gid = static_cast<gid_t>(record.gid);
+  ec->comm.assign(record.comm, strnlen(record.comm, sizeof(record.comm)));
+  if (ec->type == BPF_TYPE_EXEC) {
+    ec->path.assign(record.path, strnlen(record.path, sizeof(record.path)));
+  } else if (ec->type != BPF_TYPE_EXIT) {
+    ec->fd = record.fd;
+    ec->ret = record.ret;
+    ec->address.assign(
+        reinterpret_cast<const char*>(record.address),
+        std::min<size_t>(record.address_length, sizeof(record.address)));
+  }
+  fire(ec);
+}
+
+Status BPFEventPublisher::run() {
+  // Records are drained in batches, either at a buffer's watermark or after
+  // the latency timeout.
+  std::vector<struct pollfd> fds(buffers_.size());
+  for (size_t i = 0; i < buffers_.size(); i++) {
+    fds[i].fd = buffers_[i].fd;
+    fds[i].events = POLLIN;
+    fds[i].revents = 0;
+  }
+  if (::poll(fds.data(), fds.size(), kBPFLatency) < 0 && errno != EINTR) {
+    return Status(1, "BPF perf buffer poll failed");
+  }
+
+  for (auto& buffer : buffers_) {
+    drain(buffer);
+  }
+
+  // Report records lost by the kernel once per batch.
+  if (lost_ > reported_) {
+    LOG(WARNING) << "The BPF perf buffers were full, " << lost_ - reported_
+                 << " event records were lost";
+    reported_ = lost_;
+  }
+  return Status(0, "OK");
+}
+
+bool BPFEventPublisher::shouldFire(const BPFSubscriptionContextRef& sc,
+                                   const BPFEventContextRef& ec) const {
+  return sc->types.count(ec->type) > 0;
+}
+}
@@ -0,0 +1,236 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <linux/bpf.h>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// The kernel events a BPF subscription may request.
+enum BPFEventType {
+  BPF_TYPE_EXEC = 1,
+  BPF_TYPE_CONNECT = 2,
+  BPF_TYPE_BIND = 3,
+  BPF_TYPE_EXIT = 4,
+};
+
+/**
+ * @brief The record written by the kernel programs to the perf buffers.
+ *
+ * Socket and exit records end before the path, exec records include the
+ * path.
+ */
+struct BPFRecord {
+  uint32_t type;
+  uint32_t pid;
+  uint32_t tid;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t address_length;
+  int64_t fd;
+  int64_t ret;
+  uint64_t time;
+  char comm[16];
+  uint8_t address[112];
+  char path[256];
+};
+
+/// The size of a socket record, without the path.
+const size_t kBPFSocketRecordSize = offsetof(BPFRecord, path);
+
+/**
+ * @brief Read the field offsets of a tracepoint format description.
+ *
+ * The format is read from the tracing filesystem, such as
+ * events/syscalls/sys_enter_connect/format. Array field names do not include
+ * the array size.
+ */
+Status parseTracepointFormat(const std::string& format,
+                             std::map<std::string, size_t>& offsets);
+
+struct BPFSubscriptionContext : public SubscriptionContext {
+  /// The event types fired to the subscription.
+  std::set<BPFEventType> types;
+
+ private:
+  friend class BPFEventPublisher;
+};
+
+struct BPFEventContext : public EventContext {
+  /// The event type.
+  BPFEventType type{BPF_TYPE_EXEC};
+
+  /// The process and thread causing the event.
+  pid_t pid{0};
+  pid_t tid{0};
+
+  /// The real user and group of the process.
+  uid_t uid{0};
+  gid_t gid{0};
+
+  /// The process name, for an exec the name of the executed image.
+  std::string comm;
+
+  /// The executed path of an exec.
+  std::string path;
+
+  /// The socket descriptor and the syscall result of a connect or bind.
+  int64_t fd{-1};
+  int64_t ret{0};
+
+  /// The socket address of a connect or bind, as passed to the syscall.
+  std::string address;
+
+  /// Reset a pooled context, keeping the string buffers.
+  void clear() {
+    type = BPF_TYPE_EXEC;
+    pid = 0;
+    tid = 0;
+    uid = 0;
+    gid = 0;
+    comm.clear();
+    path.clear();
+    fd = -1;
+    ret = 0;
+    address.clear();
+  }
+};
+
+using BPFEventContextRef = std::shared_ptr<BPFEventContext>;
+using BPFSubscriptionContextRef = std::shared_ptr<BPFSubscriptionContext>;
+
+/// A perf ring buffer the kernel programs write records of one CPU to.
+struct BPFPerfBuffer {
+  /// The BPF output perf event.
+  int fd{-1};
+
+  /// The mapped metadata page, followed by the data pages.
+  void* base{nullptr};
+
+  /// The size of the data pages.
+  size_t size{0};
+};
+
+/**
+ * @brief Assemble the program of a tracepoint from its field offsets.
+ *
+ * Compatible programs use the helpers of kernels before Linux 5.5 to read
+ * user and kernel memory.
+ */
+using BPFProgramBuilder = std::function<std::vector<struct bpf_insn>(
+    const std::map<std::string, size_t>& offsets, bool compatible)>;
+
+/**
+ * @brief Process and socket events from eBPF programs on tracepoints.
+ *
+ * An alternative to the audit publisher that does not take the audit netlink
+ * sink, so it may run alongside auditd. Programs are attached to the
+ * sched_process_exec and sched_process_exit tracepoints and the connect and
+ * bind syscall tracepoints for the event types of the subscriptions. The
+ * programs drop the events of the users excluded with --bpf_exclude_users in
+ * the kernel, and write a fixed-size record to a perf ring buffer of each CPU.
+ *
+ * The run loop drains every ring buffer in a batch when a buffer passes its
+ * wakeup watermark, or after a short timeout. The programs are assembled by
+ * the publisher, there is no compiler or BPF library dependency. This
+ * requires Linux 4.14, root, and the tracing filesystem.
+ */
+class BPFEventPublisher
+    : public EventPublisher<BPFSubscriptionContext, BPFEventContext> {
+  DECLARE_PUBLISHER("bpf");
+
+ public:
+  /// Find the tracing filesystem, create the maps and perf ring buffers.
+  Status setUp() override;
+
+  /// Attach the programs needed by the subscriptions.
+  void configure() override;
+
+  /// Detach the programs and release the maps and buffers.
+  void tearDown() override;
+
+  /// Wait for and drain the perf ring buffers.
+  Status run() override;
+
+ public:
+  /// The number of records the kernel could not write to a full buffer.
+  size_t lost() const { return lost_; }
+
+ private:
+  /// Load the program of an event type and attach it to its tracepoints.
+  Status attach(BPFEventType type);
+
+  /// Load and attach a program to a tracepoint, setting the field offsets.
+  Status attachTracepoint(const std::string& name,
+                          const BPFProgramBuilder& builder);
+
+  /// Replace the excluded uids in the kernel map.
+  void updateExclusions();
+
+  /// Read the records of a buffer, then return the space to the kernel.
+  void drain(BPFPerfBuffer& buffer);
+
+  /// Fire an event context for a complete record.
+  void handleRecord(const char* data, size_t size);
+
+  /// Match the event type to the subscription.
+  bool shouldFire(const BPFSubscriptionContextRef& sc,
+                  const BPFEventContextRef& ec) const override;
+
+ private:
+  /// The tracing filesystem mount point.
+  std::string tracefs_;
+
+  /// The perf event array, socket records between syscall entry and exit,
+  /// and the excluded uids.
+  int events_map_{-1};
+  int pending_map_{-1};
+  int excluded_map_{-1};
+
+  /// The perf ring buffer of each CPU.
+  std::vector<BPFPerfBuffer> buffers_;
+
+  /// The loaded programs and the tracepoint perf events they are attached to.
+  std::vector<int> programs_;
+  std::vector<int> tracepoints_;
+
+  /// The kernel does not have the helpers of Linux 5.5.
+  bool compatible_{false};
+
+  /// The event types with attached programs.
+  std::set<BPFEventType> attached_;
+
+  /// The excluded uids in the kernel map.
+  std::set<uint32_t> excluded_;
+
+  /// Records lost by the kernel since the publisher started.
+  std::atomic<size_t> lost_{0};
+
+  /// The lost records already reported by the run loop.
+  size_t reported_{0};
+
+ private:
+  FRIEND_TEST(BPFTests, test_bpf_events);
+};
+}
@@ -0,0 +1,306 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <mntent.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+// Directory and name events, from Linux 5.9 headers.
+#ifndef FAN_REPORT_DFID_NAME
+#define FAN_REPORT_DIR_FID 0x00000400
+#define FAN_REPORT_NAME 0x00000800
+#define FAN_REPORT_DFID_NAME (FAN_REPORT_DIR_FID | FAN_REPORT_NAME)
+#endif
+#ifndef FAN_MARK_FILESYSTEM
+#define FAN_MARK_FILESYSTEM 0x00000100
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_DFID_NAME
+#define FAN_EVENT_INFO_TYPE_DFID_NAME 2
+#endif
+#ifndef FAN_CREATE
+#define FAN_ATTRIB 0x00000004
+#define FAN_MOVED_FROM 0x00000040
+#define FAN_MOVED_TO 0x00000080
+#define FAN_CREATE 0x00000100
+#define FAN_DELETE 0x00000200
+#define FAN_DELETE_SELF 0x00000400
+#define FAN_MOVE_SELF 0x00000800
+#endif
+
+namespace osquery {
+
+/// Events are read by reads of up to this many bytes.
+static const size_t kFANotifyBufferSize = 64 * 1024;
+
+/// The most resolved directories kept.
+static const size_t kFANotifyDirectoryMax = 4096;
+
+/// An event information record, see struct fanotify_event_info_fid.
+struct FANotifyInfo {
+  uint8_t info_type;
+  uint8_t pad;
+  uint16_t len;
+  int32_t fsid[2];
+  // Followed by a struct file_handle, then a name for DFID_NAME records.
+};
+
+void PathPrefixTrie::insert(const std::string& prefix) {
+  size_t node = 0;
+  for (const auto& c : prefix) {
+    // Subscriptions match paths ignoring case.
+    auto key = static_cast<char>(std::tolower(c));
+    auto child = nodes_[node].children.find(key);
+    if (child != nodes_[node].children.end()) {
+      node = child->second;
+      continue;
+    }
+    nodes_[node].children[key] = nodes_.size();
+    node = nodes_.size();
+    nodes_.emplace_back();
+  }
+  nodes_[node].terminal = true;
+}
+
+bool PathPrefixTrie::matches(const std::string& path) const {
+  size_t node = 0;
+  for (const auto& c : path) {
+    if (nodes_[node].terminal) {
+      return true;
+    }
+    auto key = static_cast<char>(std::tolower(c));
+    auto child = nodes_[node].children.find(key);
+    if (child == nodes_[node].children.end()) {
+      return false;
+    }
+    node = child->second;
+  }
+  return nodes_[node].terminal;
+}
+
+Status FANotifyHandle::open() {
+  handle_ = ::fanotify_init(
+      FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+      O_RDONLY | O_CLOEXEC);
+  if (handle_ < 0) {
+    return Status(1, std::string("fanotify_init failed: ") + strerror(errno));
+  }
+  return Status(0, "OK");
+}
+
+void FANotifyHandle::close() {
+  for (const auto& filesystem : filesystems_) {
+    ::close(filesystem.second);
+  }
+  filesystems_.clear();
+  directories_.clear();
+
+  if (handle_ >= 0) {
+    ::close(handle_);
+    handle_ = -1;
+  }
+}
+
+bool FANotifyHandle::markFilesystem(const std::string& path, uint64_t mask) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct statfs info;
+  if (::fstatfs(fd, &info) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // The descriptor of a filesystem resolves the handles of its events.
+  std::string fsid(reinterpret_cast<const char*>(&info.f_fsid),
+                   sizeof(info.f_fsid));
+  if (filesystems_.count(fsid) > 0) {
+    ::close(fd);
+    return true;
+  }
+
+  if (::fanotify_mark(handle_,
+                      FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                      mask | FAN_ONDIR,
+                      fd,
+                      nullptr) != 0) {
+    VLOG(1) << "Cannot add fanotify mark on the filesystem of " << path << ": "
+            << strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  filesystems_[fsid] = fd;
+  return true;
+}
+
+Status FANotifyHandle::setMarks(const std::set<std::string>& paths,
+                                uint64_t mask) {
+  ::fanotify_mark(
+      handle_, FAN_MARK_FLUSH | FAN_MARK_FILESYSTEM, 0, AT_FDCWD, nullptr);
+  for (const auto& filesystem : filesystems_) {
+    ::close(filesystem.second);
+  }
+  filesystems_.clear();
+  directories_.clear();
+
+  // Filesystems mounted within a path are marked separately.
+  std::vector<std::string> mounts;
+  auto* table = ::setmntent("/proc/mounts", "r");
+  if (table != nullptr) {
+    struct mntent* entry = nullptr;
+    while ((entry = ::getmntent(table)) != nullptr) {
+      mounts.push_back(entry->mnt_dir);
+    }
+    ::endmntent(table);
+  }
+
+  for (const auto& path : paths) {
+    // A path that does not exist yet is within its nearest parent.
+    auto directory = boost::filesystem::path(path);
+    while (!directory.empty() && !isDirectory(directory).ok()) {
+      directory = directory.parent_path();
+    }
+    if (!directory.empty()) {
+      markFilesystem(directory.string(), mask);
+    }
+
+    for (const auto& mount : mounts) {
+      if (mount.compare(0, path.size(), path) == 0) {
+        markFilesystem(mount, mask);
+      }
+    }
+  }
+
+  if (filesystems_.empty()) {
+    return Status(1, "No filesystems were marked");
+  }
+  return Status(0, "OK");
+}
+
+bool FANotifyHandle::resolveDirectory(const void* fsid,
+                                      const void* handle,
+                                      std::string& path) {
+  auto* file = static_cast<const struct file_handle*>(handle);
+  std::string key(static_cast<const char*>(fsid), sizeof(FANotifyInfo::fsid));
+  key.append(static_cast<const char*>(handle),
+             sizeof(struct file_handle) + file->handle_bytes);
+  auto directory = directories_.find(key);
+  if (directory != directories_.end()) {
+    path = directory->second;
+    return true;
+  }
+
+  auto filesystem =
+      filesystems_.find(key.substr(0, sizeof(FANotifyInfo::fsid)));
+  if (filesystem == filesystems_.end()) {
+    return false;
+  }
+
+  int fd = ::open_by_handle_at(filesystem->second,
+                               const_cast<struct file_handle*>(file),
+                               O_PATH | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  char target[PATH_MAX];
+  auto link = "/proc/self/fd/" + std::to_string(fd);
+  auto size = ::readlink(link.c_str(), target, sizeof(target));
+  ::close(fd);
+  if (size <= 0) {
+    return false;
+  }
+
+  path.assign(target, size);
+  if (directories_.size() >= kFANotifyDirectoryMax) {
+    directories_.clear();
+  }
+  directories_[key] = path;
+  return true;
+}
+
+Status FANotifyHandle::read(std::vector<FANotifyEvent>& events) {
+  std::vector<char> buffer(kFANotifyBufferSize);
+  auto length = ::read(handle_, buffer.data(), buffer.size());
+  if (length < 0) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return Status(0, "OK");
+    }
+    return Status(1, "fanotify read failed");
+  }
+
+  auto metadata = reinterpret_cast<struct fanotify_event_metadata*>(&buffer[0]);
+  for (; FAN_EVENT_OK(metadata, length);
+       metadata = FAN_EVENT_NEXT(metadata, length)) {
+    if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+      return Status(1, "Unexpected fanotify event version");
+    }
+    if (metadata->fd >= 0) {
+      ::close(metadata->fd);
+    }
+    if (metadata->mask & FAN_Q_OVERFLOW) {
+      LOG(WARNING) << "The fanotify queue overflowed, file events were lost";
+      continue;
+    }
+
+    // Information records follow the event metadata.
+    FANotifyEvent event;
+    event.mask = metadata->mask;
+    event.pid = metadata->pid;
+    auto record = reinterpret_cast<const char*>(metadata);
+    auto end = record + metadata->event_len;
+    record += metadata->metadata_len;
+    while (record + sizeof(FANotifyInfo) <= end) {
+      auto info = reinterpret_cast<const FANotifyInfo*>(record);
+      if (info->len == 0 || record + info->len > end) {
+        break;
+      }
+
+      auto handle = record + sizeof(FANotifyInfo);
+      if (info->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME &&
+          resolveDirectory(info->fsid, handle, event.path)) {
+        auto file = reinterpret_cast<const struct file_handle*>(handle);
+        std::string name(reinterpret_cast<const char*>(file->f_handle) +
+                         file->handle_bytes);
+        if (!name.empty() && name != ".") {
+          event.path += (event.path.back() == '/') ? name : '/' + name;
+        }
+      }
+      record += info->len;
+    }
+
+    // A moved or deleted directory may be the path of a resolved handle.
+    if ((event.mask & FAN_ONDIR) &&
+        (event.mask &
+         (FAN_MOVED_FROM | FAN_DELETE | FAN_MOVE_SELF | FAN_DELETE_SELF))) {
+      directories_.clear();
+    }
+    if (!event.path.empty()) {
+      events.push_back(std::move(event));
+    }
+  }
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief A set of path prefixes matched against event paths.
+ *
+ * A character trie of the configured file paths before any wildcard. A path
+ * matches if an added prefix is a prefix of the path, found in one pass over
+ * the path regardless of the number of prefixes.
+ */
+class PathPrefixTrie {
+ public:
+  PathPrefixTrie() : nodes_(1) {}
+
+  /// Add a prefix, an empty prefix matches every path.
+  void insert(const std::string& prefix);
+
+  /// Check if an added prefix is a prefix of the path.
+  bool matches(const std::string& path) const;
+
+  /// Remove all prefixes.
+  void clear() { nodes_.assign(1, Node()); }
+
+ private:
+  struct Node {
+    /// The index of the node following each character.
+    std::map<char, size_t> children;
+
+    /// A prefix ends at this node.
+    bool terminal{false};
+  };
+
+  /// The nodes of the trie, the first is the root.
+  std::vector<Node> nodes_;
+};
+
+/// A filesystem event read from fanotify.
+struct FANotifyEvent {
+  /// The event mask, fanotify event bits are equal to the inotify bits.
+  uint64_t mask{0};
+
+  /// The process causing the event.
+  pid_t pid{-1};
+
+  /// The path of the file or directory.
+  std::string path;
+};
+
+/**
+ * @brief An fanotify handle reporting the events of whole filesystems.
+ *
+ * A filesystem mark reports the events of every file within a filesystem at
+ * a constant setup cost, rather than an inotify watch for each directory.
+ * Events report the handle of the parent directory and the name of the file.
+ * A directory handle is resolved to a path through a descriptor opened on the
+ * marked filesystem.
+ *
+ * The directory and name events require Linux 5.9 and CAP_SYS_ADMIN.
+ */
+class FANotifyHandle : private boost::noncopyable {
+ public:
+  ~FANotifyHandle() { close(); }
+
+  /// Create the fanotify handle.
+  Status open();
+
+  /// Remove the marks and close the handle.
+  void close();
+
+  /// Check if the handle is open.
+  bool isOpen() const { return handle_ >= 0; }
+
+  /// The handle descriptor, readable when events are queued.
+  int getHandle() const { return handle_; }
+
+  /**
+   * @brief Replace the marks with marks of the filesystems of paths.
+   *
+   * Each path marks the filesystem containing it, or its nearest existing
+   * parent, and the filesystems mounted within it.
+   *
+   * @param paths The paths events are needed for.
+   * @param mask The fanotify events needed.
+   * @return success if a filesystem was marked.
+   */
+  Status setMarks(const std::set<std::string>& paths, uint64_t mask);
+
+  /**
+   * @brief Read the queued events.
+   *
+   * @param events The output events, appended.
+   * @return failure if the handle failed, events may have been appended.
+   */
+  Status read(std::vector<FANotifyEvent>& events);
+
+ private:
+  /// Mark the filesystem containing a directory, keeping a descriptor.
+  bool markFilesystem(const std::string& path, uint64_t mask);
+
+  /// Resolve the path of a directory handle reported by an event.
+  bool resolveDirectory(const void* fsid,
+                        const void* handle,
+                        std::string& path);
+
+ private:
+  /// The fanotify handle descriptor.
+  int handle_{-1};
+
+  /// A descriptor within each marked filesystem, by filesystem id.
+  std::map<std::string, int> filesystems_;
+
+  /// Resolved directories by handle, cleared as directories move.
+  std::map<std::string, std::string> directories_;
+};
+}
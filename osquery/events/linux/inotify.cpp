@@ -8,14 +8,19 @@
  *
  */
 
+#include <cstring>
+#include <set>
 #include <sstream>
 
+#include <errno.h>
 #include <fnmatch.h>
 #include <linux/limits.h>
+#include <unistd.h>
 
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/events/linux/inotify.h"
@@ -24,7 +29,6 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
-static const int kINotifyMLatency = 200;
 static const uint32_t kINotifyBufferSize =
     (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
 
@@ -45,10 +49,31 @@ const uint32_t kFileDefaultMasks = IN_MOVED_TO | IN_MOVED_FROM | IN_MODIFY |
                                    IN_ATTRIB;
 const uint32_t kFileAccessMasks = IN_OPEN | IN_ACCESS;
 
+/// Directory watches report subdirectory changes to the expansion cache.
+static const uint32_t kDirectoryChangeMasks =
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+/// Recursive watches are limited to the depth of a recursive glob.
+static const size_t kMaxWatchDepth = 62;
+
+FLAG(bool,
+     file_events_fanotify,
+     false,
+     "Use fanotify filesystem marks for file events (Linux 5.9 and later)");
+
 REGISTER(INotifyEventPublisher, "event_publisher", "inotify");
 
 Status INotifyEventPublisher::setUp() {
-  inotify_handle_ = ::inotify_init();
+  if (FLAGS_file_events_fanotify) {
+    auto status = fanotify_.open();
+    if (status.ok()) {
+      return status;
+    }
+    LOG(WARNING) << "Could not start fanotify, using inotify: "
+                 << status.getMessage();
+  }
+
+  inotify_handle_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
   // If this does not work throw an exception.
   if (inotify_handle_ == -1) {
     return Status(1, "Could not start inotify: inotify_init failed");
@@ -76,10 +101,15 @@ bool INotifyEventPublisher::monitorSubscription(
     if (sc->discovered_.find('*') != std::string::npos) {
       // If a wildcard exists within the tree (stem), resolve at configure
       // time and monitor each path.
-      std::vector<std::string> paths;
-      resolveFilePattern(sc->discovered_, paths);
-      for (const auto& _path : paths) {
-        addMonitor(_path, sc->mask, sc->recursive, add_watch);
+      if (!fanotify_.isOpen()) {
+        std::vector<std::string> paths;
+        directories_.resolve(
+            sc->discovered_,
+            [this](const std::string& dir) { return isDirectoryWatched(dir); },
+            paths);
+        for (const auto& _path : paths) {
+          addMonitor(_path, sc->mask, sc->recursive, add_watch);
+        }
       }
       sc->recursive_match = sc->recursive;
       return true;
@@ -90,6 +120,11 @@ bool INotifyEventPublisher::monitorSubscription(
     sc->path += '/';
     sc->discovered_ += '/';
   }
+
+  // Filesystem marks are added for every subscription once configured.
+  if (fanotify_.isOpen()) {
+    return true;
+  }
   return addMonitor(sc->discovered_, sc->mask, sc->recursive, add_watch);
 }
 
@@ -104,11 +139,54 @@ void INotifyEventPublisher::configure() {
     }
     monitorSubscription(sc);
   }
+
+  {
+    // Subscription paths are final once monitored.
+    WriteLock lock(mutex_);
+    matcher_.clear();
+    for (const auto& sub : subscriptions_) {
+      matcher_.insert(getSubscriptionContext(sub->context)->path, sub);
+    }
+    matcher_.setComplete();
+  }
+
+  if (fanotify_.isOpen()) {
+    configureFANotify();
+  }
+}
+
+void INotifyEventPublisher::configureFANotify() {
+  std::set<std::string> paths;
+  uint32_t mask = 0;
+  {
+    WriteLock lock(mutex_);
+    prefixes_.clear();
+    for (auto& sub : subscriptions_) {
+      // Events are matched by the path before any wildcard, then shouldFire.
+      auto sc = getSubscriptionContext(sub->context);
+      auto prefix = sc->path.substr(0, sc->path.find('*'));
+      prefixes_.insert(prefix);
+      paths.insert(prefix);
+      mask |= (sc->mask == 0) ? kFileDefaultMasks : sc->mask;
+    }
+  }
+
+  if (paths.empty()) {
+    return;
+  }
+  auto status =
+      fanotify_.setMarks(paths, mask & (kFileDefaultMasks | kFileAccessMasks));
+  if (!status.ok()) {
+    LOG(WARNING) << "Could not add fanotify marks: " << status.getMessage();
+  }
 }
 
 void INotifyEventPublisher::tearDown() {
-  ::close(inotify_handle_);
-  inotify_handle_ = -1;
+  fanotify_.close();
+  if (inotify_handle_ >= 0) {
+    ::close(inotify_handle_);
+    inotify_handle_ = -1;
+  }
 }
 
 Status INotifyEventPublisher::restartMonitoring() {
@@ -132,21 +210,61 @@ Status INotifyEventPublisher::restartMonitoring() {
     descriptor_paths_.clear();
   }
 
+  // Events were lost, each expanded directory is checked for changes. Only
+  // the directories that changed are listed again.
+  directories_.unobserveAll();
+  for (auto& sub : subscriptions_) {
+    getSubscriptionContext(sub->context)->discovered_.clear();
+  }
+
   // Reconfigure ourself, the subscribers will not reconfigure.
   configure();
   return Status(0, "OK");
 }
 
+Status INotifyEventPublisher::readFANotify() {
+  // Marks report every file of a filesystem, including the files osquery
+  // hashes for file events and its own database.
+  auto self = ::getpid();
+  std::vector<FANotifyEvent> events;
+  do {
+    events.clear();
+    auto status = fanotify_.read(events);
+    if (!status.ok()) {
+      return status;
+    }
+
+    for (const auto& event : events) {
+      if (event.pid == self) {
+        continue;
+      }
+
+      {
+        ReadLock lock(mutex_);
+        if (!prefixes_.matches(event.path)) {
+          continue;
+        }
+      }
+
+      auto ec = createEventContextFrom(event);
+      if (!ec->action.empty()) {
+        fire(ec);
+      }
+    }
+  } while (!events.empty());
+  return Status(0, "OK");
+}
+
 Status INotifyEventPublisher::run() {
   // Get a while wrapper for free.
-  char buffer[kINotifyBufferSize];
   fd_set set;
 
   FD_ZERO(&set);
-  FD_SET(getHandle(), &set);
+  FD_SET(getDescriptor(), &set);
 
   struct timeval timeout = {1, 0};
-  int selector = ::select(getHandle() + 1, &set, nullptr, nullptr, &timeout);
+  int selector =
+      ::select(getDescriptor() + 1, &set, nullptr, nullptr, &timeout);
   if (selector == -1) {
     LOG(WARNING) << "Could not read inotify handle";
     return Status(1, "INotify handle failed");
@@ -156,50 +274,67 @@ Status INotifyEventPublisher::run() {
     // Read timeout.
     return Status(0, "Continue");
   }
-  ssize_t record_num = ::read(getHandle(), buffer, kINotifyBufferSize);
-  if (record_num == 0 || record_num == -1) {
-    return Status(1, "INotify read failed");
+  return ready();
+}
+
+Status INotifyEventPublisher::ready() {
+  if (fanotify_.isOpen()) {
+    return readFANotify();
   }
 
-  for (char* p = buffer; p < buffer + record_num;) {
-    // Cast the inotify struct, make shared pointer, and append to contexts.
-    auto event = reinterpret_cast<struct inotify_event*>(p);
-    if (event->mask & IN_Q_OVERFLOW) {
-      // The inotify queue was overflown (remove all paths).
-      Status stat = restartMonitoring();
-      if (!stat.ok()) {
-        return stat;
-      }
+  // The handle is non-blocking, read until the queue is empty.
+  char buffer[kINotifyBufferSize];
+  while (true) {
+    ssize_t record_num = ::read(getHandle(), buffer, kINotifyBufferSize);
+    if (record_num == -1 && errno == EINTR) {
+      continue;
+    } else if (record_num == -1 && errno == EAGAIN) {
+      break;
+    } else if (record_num == 0 || record_num == -1) {
+      return Status(1, "INotify read failed");
     }
 
-    if (event->mask & IN_IGNORED) {
-      // This inotify watch was removed.
-      removeMonitor(event->wd, false);
-    } else if (event->mask & IN_MOVE_SELF) {
-      // This inotify path was moved, but is still watched.
-      removeMonitor(event->wd, true);
-    } else if (event->mask & IN_DELETE_SELF) {
-      // A file was moved to replace the watched path.
-      removeMonitor(event->wd, false);
-    } else {
-      auto ec = createEventContextFrom(event);
-      if (!ec->action.empty()) {
-        fire(ec);
+    for (char* p = buffer; p < buffer + record_num;) {
+      // Cast the inotify struct, make shared pointer, and append to contexts.
+      auto event = reinterpret_cast<struct inotify_event*>(p);
+      if (event->mask & IN_Q_OVERFLOW) {
+        // The inotify queue was overflown (remove all paths).
+        Status stat = restartMonitoring();
+        if (!stat.ok()) {
+          return stat;
+        }
+      }
+
+      if (event->mask & IN_IGNORED) {
+        // This inotify watch was removed.
+        removeMonitor(event->wd, false);
+      } else if (event->mask & IN_MOVE_SELF) {
+        // This inotify path was moved, but is still watched.
+        removeMonitor(event->wd, true);
+      } else if (event->mask & IN_DELETE_SELF) {
+        // A file was moved to replace the watched path.
+        removeMonitor(event->wd, false);
+      } else {
+        auto ec = createEventContextFrom(event);
+        updateDirectories(ec);
+        if (!ec->action.empty()) {
+          fire(ec);
+        }
       }
+      // Continue to iterate
+      p += (sizeof(struct inotify_event)) + event->len;
     }
-    // Continue to iterate
-    p += (sizeof(struct inotify_event)) + event->len;
   }
-
-  osquery::publisherSleep(kINotifyMLatency);
   return Status(0, "OK");
 }
 
 INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
     struct inotify_event* event) const {
-  auto shared_event = std::make_shared<struct inotify_event>(*event);
   auto ec = createEventContext();
-  ec->event = shared_event;
+  if (ec->event == nullptr) {
+    ec->event = std::make_shared<struct inotify_event>();
+  }
+  *ec->event = *event;
 
   // Get the pathname the watch fired on.
   ec->path = descriptor_paths_.at(event->wd);
@@ -216,6 +351,53 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
   return ec;
 }
 
+INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
+    const FANotifyEvent& event) const {
+  // The fanotify event bits are equal to the inotify bits.
+  auto ec = createEventContext();
+  if (ec->event == nullptr) {
+    ec->event = std::make_shared<struct inotify_event>();
+  }
+  memset(ec->event.get(), 0, sizeof(struct inotify_event));
+  ec->event->wd = -1;
+  ec->event->mask = static_cast<uint32_t>(event.mask);
+  ec->path = event.path;
+  ec->pid = event.pid;
+
+  for (const auto& action : kMaskActions) {
+    if (event.mask & action.first) {
+      ec->action = action.second;
+      break;
+    }
+  }
+  return ec;
+}
+
+void INotifyEventPublisher::updateDirectories(
+    const INotifyEventContextRef& ec) {
+  auto mask = ec->event->mask;
+  if (!(mask & IN_ISDIR) || !(mask & kDirectoryChangeMasks)) {
+    return;
+  }
+
+  // The watched directory is listed again by the next expansion.
+  directories_.invalidate(ec->path.substr(0, ec->path.rfind('/') + 1));
+  if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+    directories_.remove(ec->path + '/');
+  }
+}
+
+std::string INotifyEventPublisher::coalesceKey(
+    const EventContextRef& ec) const {
+  // Recursive monitors must watch a new directory before its files change.
+  auto inotify_ec = getEventContext(ec);
+  if ((inotify_ec->event->mask & IN_ISDIR) &&
+      inotify_ec->action == "CREATED") {
+    return "";
+  }
+  return inotify_ec->action + ':' + inotify_ec->path;
+}
+
 bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
                                        const INotifyEventContextRef& ec) const {
   // The subscription may supply a required event mask.
@@ -240,7 +422,9 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
   }
 
   // inotify will not monitor recursively, new directories need watches.
-  if (sc->recursive && ec->action == "CREATED" && isDirectory(ec->path)) {
+  // A filesystem mark includes new directories.
+  if (sc->recursive && ec->action == "CREATED" && !fanotify_.isOpen() &&
+      isDirectory(ec->path)) {
     const_cast<INotifyEventPublisher*>(this)
         ->addMonitor(ec->path + '/', sc->mask, true);
   }
@@ -253,8 +437,11 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
                                        bool recursive,
                                        bool add_watch) {
   if (!isPathMonitored(path)) {
-    int watch = ::inotify_add_watch(
-        getHandle(), path.c_str(), ((mask == 0) ? kFileDefaultMasks : mask));
+    auto watch_mask = (mask == 0) ? kFileDefaultMasks : mask;
+    if (path.back() == '/') {
+      watch_mask |= kDirectoryChangeMasks;
+    }
+    int watch = ::inotify_add_watch(getHandle(), path.c_str(), watch_mask);
     if (add_watch && watch == -1) {
       LOG(WARNING) << "Could not add inotify watch on: " << path;
       return false;
@@ -272,14 +459,23 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
   }
 
   if (recursive && isDirectory(path).ok()) {
-    std::vector<std::string> children;
-    // Get a list of children of this directory (requested recursive watches).
-    listDirectoriesInDirectory(path, children, true);
-
-    boost::system::error_code ec;
-    for (const auto& child : children) {
-      auto canonicalized = fs::canonical(child, ec).string() + '/';
-      addMonitor(canonicalized, mask, false);
+    // Watch each subdirectory, from the expanded directories. A directory is
+    // only listed again if it changed since it was expanded.
+    std::set<std::string> visited = {path};
+    std::vector<std::pair<std::string, size_t>> pending = {{path, 0}};
+    while (!pending.empty()) {
+      auto dir = std::move(pending.back());
+      pending.pop_back();
+      std::vector<std::string> children;
+      directories_.list(
+          dir.first, isDirectoryWatched(dir.first), false, children);
+      for (const auto& child : children) {
+        if (dir.second + 1 >= kMaxWatchDepth || !visited.insert(child).second) {
+          continue;
+        }
+        addMonitor(child, mask, false);
+        pending.push_back(std::make_pair(child, dir.second + 1));
+      }
     }
   }
 
@@ -306,6 +502,9 @@ bool INotifyEventPublisher::removeMonitor(const std::string& path, bool force) {
     descriptors_.erase(position);
   }
 
+  // Changes to the directory are no longer reported.
+  directories_.unobserve(path);
+
   if (force) {
     ::inotify_rm_watch(getHandle(), watch);
   }
@@ -329,9 +528,30 @@ void INotifyEventPublisher::removeSubscriptions(const std::string& subscriber) {
   for (const auto& path : paths) {
     removeMonitor(path.first, true);
   }
+
+  {
+    WriteLock lock(mutex_);
+    matcher_.clear();
+  }
   EventPublisherPlugin::removeSubscriptions(subscriber);
 }
 
+Status INotifyEventPublisher::addSubscription(
+    const SubscriptionRef& subscription) {
+  {
+    // Every subscription is checked until the next configure.
+    WriteLock lock(mutex_);
+    matcher_.clear();
+  }
+  return EventPublisherPlugin::addSubscription(subscription);
+}
+
+bool INotifyEventPublisher::matchSubscriptions(
+    const EventContextRef& ec, SubscriptionVector& matches) const {
+  ReadLock lock(mutex_);
+  return matcher_.match(getEventContext(ec)->path, matches);
+}
+
 bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
   ReadLock lock(mutex_);
   std::string parent_path;
@@ -349,4 +569,10 @@ bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
   auto path_iterator = path_descriptors_.find(parent_path);
   return (path_iterator != path_descriptors_.end());
 }
+
+bool INotifyEventPublisher::isDirectoryWatched(const std::string& dir) const {
+  ReadLock lock(mutex_);
+  auto watch = path_descriptors_.find(dir);
+  return (watch != path_descriptors_.end() && watch->second >= 0);
+}
 }
@@ -18,6 +18,10 @@
 
 #include <osquery/events.h>
 
+#include "osquery/events/directory_cache.h"
+#include "osquery/events/linux/fanotify.h"
+#include "osquery/events/path_trie.h"
+
 namespace osquery {
 
 extern std::map<int, std::string> kMaskActions;
@@ -90,6 +94,20 @@ struct INotifyEventContext : public EventContext {
 
   /// A no-op event transaction id.
   uint32_t transaction_id{0};
+
+  /// The process causing the event, reported by fanotify, otherwise -1.
+  pid_t pid{-1};
+
+  /// Reset a pooled context, the event copy is reused unless still shared.
+  void clear() {
+    if (event.use_count() > 1) {
+      event = nullptr;
+    }
+    path.clear();
+    action.clear();
+    transaction_id = 0;
+    pid = -1;
+  }
 };
 
 using INotifyEventContextRef = std::shared_ptr<INotifyEventContext>;
@@ -130,20 +148,51 @@ class INotifyEventPublisher
   /// The calling for beginning the thread's run loop.
   Status run() override;
 
+  /// The fanotify or inotify handle, events are read when it is readable.
+  int getDescriptor() const override {
+    return fanotify_.isOpen() ? fanotify_.getHandle() : inotify_handle_.load();
+  }
+
+  /// Read and fire the queued events until the handle would block.
+  Status ready() override;
+
+  /// Merge repeated events by path and action, except directory creation.
+  std::string coalesceKey(const EventContextRef& ec) const override;
+
   /// Remove all monitors and subscriptions.
   void removeSubscriptions(const std::string& subscriber) override;
 
+  /// Add a subscription, it is matched by path once configured.
+  Status addSubscription(const SubscriptionRef& subscription) override;
+
+  /// Find the subscriptions matching an event path prefix.
+  bool matchSubscriptions(const EventContextRef& ec,
+                          SubscriptionVector& matches) const override;
+
  private:
   /// Helper/specialized event context creation.
   INotifyEventContextRef createEventContextFrom(
       struct inotify_event* event) const;
 
+  /// Event context creation from an fanotify event, with an inotify mask.
+  INotifyEventContextRef createEventContextFrom(
+      const FANotifyEvent& event) const;
+
+  /// Replace the fanotify marks and path prefixes for every subscription.
+  void configureFANotify();
+
+  /// Read the queued fanotify events, used instead of inotify watches.
+  Status readFANotify();
+
   /// Check if the application-global `inotify` handle is alive.
   bool isHandleOpen() const { return inotify_handle_ > 0; }
 
   /// Check all added Subscription%s for a path.
   bool isPathMonitored(const std::string& path) const;
 
+  /// Check if a directory has an inotify watch reporting its changes.
+  bool isDirectoryWatched(const std::string& dir) const;
+
   /**
    * @brief Add an INotify watch (monitor) on this path.
    *
@@ -185,6 +234,9 @@ class INotifyEventPublisher
   /// If we overflow, try and restart the monitor
   Status restartMonitoring();
 
+  /// Update the expanded directories for a directory event.
+  void updateDirectories(const INotifyEventContextRef& ec);
+
   // Consider an event queue if separating buffering from firing/servicing.
   DescriptorVector descriptors_;
 
@@ -200,7 +252,19 @@ class INotifyEventPublisher
   /// Time in seconds of the last inotify restart.
   std::atomic<int> last_restart_{-1};
 
-  /// Access to path and descriptor mappings.
+  /// The fanotify filesystem marks, if file_events_fanotify is used.
+  FANotifyHandle fanotify_;
+
+  /// Subscription paths before any wildcard, matched before firing events.
+  PathPrefixTrie prefixes_;
+
+  /// The subscriptions by path, rebuilt when configured.
+  SubscriptionPathTrie matcher_;
+
+  /// The expanded subscription directories, kept across configures.
+  DirectoryCache directories_;
+
+  /// Access to path and descriptor mappings, and the path tries.
   mutable boost::shared_mutex mutex_;
 
  public:
@@ -208,6 +272,7 @@ class INotifyEventPublisher
   FRIEND_TEST(INotifyTests, test_inotify_init);
   FRIEND_TEST(INotifyTests, test_inotify_optimization);
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
+  FRIEND_TEST(INotifyTests, test_inotify_expansion_cache);
   FRIEND_TEST(INotifyTests, test_inotify_match_subscription);
 };
 }
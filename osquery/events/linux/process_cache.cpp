@@ -0,0 +1,201 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <linux/limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/hash.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/process_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     process_cache_max,
+     8192,
+     "Maximum number of processes kept to enrich process and socket events");
+
+FLAG(bool,
+     process_cache_hash,
+     true,
+     "Hash executed files when enriching process events");
+
+/// The stat fields after the process name, starting with the state.
+const size_t kStatParentField = 1;
+const size_t kStatStartTimeField = 19;
+
+ProcessCache& ProcessCache::getInstance() {
+  static ProcessCache cache;
+  static std::once_flag seeded;
+  std::call_once(seeded, [] { cache.seed(); });
+  return cache;
+}
+
+bool ProcessCache::readProcess(const std::string& root,
+                               pid_t pid,
+                               ProcessCacheEntry& entry) {
+  auto proc = root + "/" + std::to_string(pid);
+  std::string stat;
+  if (!readFile(proc + "/stat", stat).ok()) {
+    return false;
+  }
+
+  // The process name may contain spaces, fields follow its last parenthesis.
+  auto name = stat.rfind(')');
+  if (name == std::string::npos) {
+    return false;
+  }
+  auto fields = split(stat.substr(name + 1), " ");
+  long long value = 0;
+  entry.pid = pid;
+  if (fields.size() > kStatStartTimeField) {
+    if (safeStrtoll(fields[kStatParentField], 10, value).ok()) {
+      entry.parent = static_cast<pid_t>(value);
+    }
+    if (safeStrtoll(fields[kStatStartTimeField], 10, value).ok()) {
+      entry.start_time = static_cast<uint64_t>(value);
+    }
+  }
+
+  if (entry.path.empty()) {
+    char path[PATH_MAX] = {0};
+    auto size = ::readlink((proc + "/exe").c_str(), path, sizeof(path) - 1);
+    if (size > 0) {
+      entry.path.assign(path, size);
+    }
+  }
+  if (entry.cmdline.empty() &&
+      readFile(proc + "/cmdline", entry.cmdline).ok()) {
+    while (!entry.cmdline.empty() && entry.cmdline.back() == '\0') {
+      entry.cmdline.pop_back();
+    }
+    std::replace(entry.cmdline.begin(), entry.cmdline.end(), '\0', ' ');
+  }
+  return true;
+}
+
+void ProcessCache::seed() {
+  std::set<std::string> pids;
+  procProcesses(pids);
+  for (const auto& pid : pids) {
+    ProcessCacheEntry entry;
+    if (readProcess("/proc", std::atoi(pid.c_str()), entry)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      insert(entry);
+    }
+  }
+}
+
+void ProcessCache::insert(const ProcessCacheEntry& entry) {
+  auto existing = index_.find(entry.pid);
+  if (existing != index_.end()) {
+    entries_.erase(existing->second);
+  }
+  entries_.push_front(entry);
+  index_[entry.pid] = entries_.begin();
+
+  while (entries_.size() > std::max<size_t>(FLAGS_process_cache_max, 1)) {
+    index_.erase(entries_.back().pid);
+    entries_.pop_back();
+  }
+}
+
+ProcessCacheEntry ProcessCache::exec(ProcessCacheEntry entry) {
+  // The event may not include the parent or start time.
+  if (entry.parent == 0 || entry.start_time == 0) {
+    ProcessCacheEntry running;
+    running.path = entry.path;
+    running.cmdline = entry.cmdline;
+    if (readProcess("/proc", entry.pid, running)) {
+      entry.parent = (entry.parent == 0) ? running.parent : entry.parent;
+      entry.start_time = running.start_time;
+      entry.path = running.path;
+      entry.cmdline = running.cmdline;
+    }
+  }
+  if (FLAGS_process_cache_hash && !entry.path.empty()) {
+    entry.sha256 =
+        hashMultiFromFileCached(HASH_TYPE_SHA256, entry.path).sha256;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert(entry);
+  return entry;
+}
+
+void ProcessCache::exit(pid_t pid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto existing = index_.find(pid);
+  if (existing != index_.end()) {
+    entries_.erase(existing->second);
+    index_.erase(existing);
+  }
+}
+
+bool ProcessCache::get(pid_t pid, ProcessCacheEntry& entry) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto existing = index_.find(pid);
+    if (existing != index_.end()) {
+      // Move the entry to the front, it is the most recently used.
+      entries_.splice(entries_.begin(), entries_, existing->second);
+      entry = entries_.front();
+      return true;
+    }
+  }
+
+  ProcessCacheEntry running;
+  if (!readProcess("/proc", pid, running)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert(running);
+  entry = running;
+  return true;
+}
+
+bool ProcessCache::getParent(const ProcessCacheEntry& entry,
+                             ProcessCacheEntry& parent) {
+  if (entry.parent <= 0 || !get(entry.parent, parent)) {
+    return false;
+  }
+
+  // A parent that started after the process is a reused pid, the parent
+  // exited. An exited parent that is still cached is reported.
+  return entry.start_time == 0 || parent.start_time == 0 ||
+         parent.start_time <= entry.start_time;
+}
+
+size_t ProcessCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void addProcessCacheColumns(pid_t pid, Row& r) {
+  auto& cache = ProcessCache::getInstance();
+  ProcessCacheEntry process;
+  ProcessCacheEntry parent;
+  if (!cache.get(pid, process)) {
+    r["cmdline"] = "";
+    r["parent"] = "0";
+    r["parent_path"] = "";
+    return;
+  }
+  r["cmdline"] = process.cmdline;
+  r["parent"] = INTEGER(process.parent);
+  r["parent_path"] = (cache.getParent(process, parent)) ? parent.path : "";
+}
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include <gtest/gtest_prod.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/// A process known to the process cache.
+struct ProcessCacheEntry {
+  pid_t pid{0};
+
+  /// The parent pid, 0 if it is not known.
+  pid_t parent{0};
+
+  /// The executed path and command line arguments, separated by spaces.
+  std::string path;
+  std::string cmdline;
+
+  /// The start time in clock ticks since boot, 0 if it is not known.
+  uint64_t start_time{0};
+
+  /// The SHA256 of the executed file, empty unless hashed at exec.
+  std::string sha256;
+};
+
+/**
+ * @brief Processes seen by the event subscribers, by pid.
+ *
+ * Process and socket event subscribers enrich rows at ingest with the
+ * process and its parent, instead of joining against the processes table at
+ * query time. A join re-reads `/proc` and misses processes that already
+ * exited.
+ *
+ * The cache is seeded from `/proc` on first use and updated from exec and
+ * exit events. A pid missing from the cache is read from `/proc`. At most
+ * --process_cache_max processes are kept, the least recently used are
+ * evicted first. A cached parent that started after its child is a reused
+ * pid, and is not reported as the parent.
+ */
+class ProcessCache : private boost::noncopyable {
+ public:
+  /// The process-wide cache, seeded on first use.
+  static ProcessCache& getInstance();
+
+  /**
+   * @brief Record an exec, replacing the entry of the pid.
+   *
+   * A missing parent or start time is read from `/proc`. The executed file
+   * is hashed if --process_cache_hash is set.
+   */
+  ProcessCacheEntry exec(ProcessCacheEntry entry);
+
+  /// Remove an exited process.
+  void exit(pid_t pid);
+
+  /// Find a process, reading it from `/proc` if it is not cached.
+  bool get(pid_t pid, ProcessCacheEntry& entry);
+
+  /// Find the parent of a process, false if it is not known.
+  bool getParent(const ProcessCacheEntry& entry, ProcessCacheEntry& parent);
+
+  /// The number of cached processes.
+  size_t size();
+
+  /// Read a process from a `/proc` root, false if it does not exist.
+  static bool readProcess(const std::string& root,
+                          pid_t pid,
+                          ProcessCacheEntry& entry);
+
+ private:
+  ProcessCache() = default;
+
+  /// Add every process in `/proc`.
+  void seed();
+
+  /// Add or replace an entry as the most recently used, call locked.
+  void insert(const ProcessCacheEntry& entry);
+
+ private:
+  /// Entries from the most to the least recently used.
+  std::list<ProcessCacheEntry> entries_;
+
+  /// The entry of each pid.
+  std::unordered_map<pid_t, std::list<ProcessCacheEntry>::iterator> index_;
+
+  /// Protects the entries, subscribers of several publishers share the cache.
+  std::mutex mutex_;
+
+ private:
+  FRIEND_TEST(ProcessCacheTests, test_process_cache);
+  FRIEND_TEST(ProcessCacheTests, test_eviction);
+};
+
+/// Add the cmdline, parent, and parent_path columns of a cached process.
+void addProcessCacheColumns(pid_t pid, Row& r);
+}
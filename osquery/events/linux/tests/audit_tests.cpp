@@ -68,6 +68,36 @@ TEST_F(AuditTests, test_handle_reply) {
   EXPECT_EQ(ec->fields["a2"], "c");
 }
 
+TEST_F(AuditTests, test_handle_reply_fields) {
+  auto ec = std::make_shared<AuditEventContext>();
+  std::string message =
+      "audit(1440542781.644:403031): arch=c000003e syscall=59 success=yes "
+      "a1=\"b\" a0=\"a\" a1=\"c\" exe=\"/bin/ls\"";
+
+  struct audit_reply reply;
+  reply.type = AUDIT_SYSCALL;
+  reply.len = message.size();
+  reply.message = (char*)message.c_str();
+  EXPECT_TRUE(handleAuditReply(reply, ec));
+
+  // The fields reference the context's copy of the record.
+  message.clear();
+  EXPECT_EQ(ec->syscall, 59);
+  EXPECT_EQ(ec->fields.size(), 6U);
+  EXPECT_EQ(ec->fields["success"], "yes");
+  EXPECT_EQ(ec->fields["exe"], "\"/bin/ls\"");
+  EXPECT_TRUE(ec->fields["missing"].empty());
+  EXPECT_THROW(ec->fields.at("missing"), std::out_of_range);
+
+  // Fields keep the record order and a repeated key replaces its value.
+  auto field = ec->fields.begin();
+  EXPECT_EQ(field->first, "arch");
+  std::advance(field, 3);
+  EXPECT_EQ(field->first, "a1");
+  EXPECT_EQ(field->second, "\"c\"");
+  EXPECT_EQ((++field)->first, "a0");
+}
+
 TEST_F(AuditTests, test_audit_value_decode) {
   // In the normal case the decoding only removes '"' characters from the ends.
   auto decoded_normal = decodeAuditValue("\"/bin/ls\"");
@@ -169,4 +199,56 @@ TEST_F(AuditTests, test_parse_sock_addr) {
   parseSockAddr(msg3, r4, true);
   EXPECT_EQ(r4["socket"], "/tmp/osquery.em");
 }
+
+TEST_F(AuditTests, test_build_rules) {
+  // The execve, bind, and connect syscall numbers.
+  std::vector<AuditRule> rules = {
+      {59, "success=1"}, {49, ""}, {42, ""}, {49, ""}};
+  rules.push_back({42, "uid=0"});
+  rules.back().apply_rule = false;
+
+  auto built = AuditEventPublisher::buildRules(rules, {});
+  ASSERT_EQ(built.size(), 2U);
+  EXPECT_EQ(built[0].rule()->field_count, 1U);
+  EXPECT_TRUE(built[0].rule()->mask[AUDIT_WORD(59)] & AUDIT_BIT(59));
+  EXPECT_EQ(built[1].rule()->field_count, 0U);
+  EXPECT_TRUE(built[1].rule()->mask[AUDIT_WORD(49)] & AUDIT_BIT(49));
+  EXPECT_TRUE(built[1].rule()->mask[AUDIT_WORD(42)] & AUDIT_BIT(42));
+  EXPECT_FALSE(built[1].rule()->mask[AUDIT_WORD(59)] & AUDIT_BIT(59));
+
+  // Exclusions are prepended never rules for every syscall.
+  auto excluded =
+      AuditEventPublisher::buildRules(rules, {"uid=0", "uid=0", "uid=1"});
+  ASSERT_EQ(excluded.size(), 4U);
+  EXPECT_EQ(excluded[0].action, AUDIT_NEVER);
+  EXPECT_TRUE(excluded[0].flags & AUDIT_FILTER_PREPEND);
+  EXPECT_TRUE(excluded[0].rule()->mask[AUDIT_WORD(59)] & AUDIT_BIT(59));
+  EXPECT_TRUE(excluded[0].rule()->mask[AUDIT_WORD(42)] & AUDIT_BIT(42));
+  EXPECT_EQ(excluded[1].action, AUDIT_NEVER);
+  EXPECT_FALSE(excluded[0] == excluded[1]);
+  EXPECT_TRUE(excluded[2] == built[0]);
+  EXPECT_TRUE(excluded[3] == built[1]);
+
+  // An invalid comparison does not add a rule.
+  rules = {{59, "notafield=1"}};
+  EXPECT_TRUE(AuditEventPublisher::buildRules(rules, {}).empty());
+}
+
+TEST_F(AuditTests, test_handle_status) {
+  AuditEventPublisher publisher;
+  struct audit_status status;
+  memset(&status, 0, sizeof(struct audit_status));
+
+  // The first reply is the baseline of the kernel's cumulative lost count.
+  status.lost = 5;
+  publisher.handleStatus(status);
+  EXPECT_EQ(publisher.numDropped(), 0U);
+
+  // Later losses are counted as publisher drops.
+  status.lost = 12;
+  publisher.handleStatus(status);
+  EXPECT_EQ(publisher.numDropped(), 7U);
+  publisher.handleStatus(status);
+  EXPECT_EQ(publisher.numDropped(), 7U);
+}
 }
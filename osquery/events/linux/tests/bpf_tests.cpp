@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+DECLARE_bool(disable_bpf);
+
+extern void parseBPFSockAddr(const std::string& address, Row& r, bool local);
+
+class BPFTests : public testing::Test {};
+
+TEST_F(BPFTests, test_parse_tracepoint_format) {
+  std::string format =
+      "name: sys_enter_connect\n"
+      "ID: 2130\n"
+      "format:\n"
+      "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+      "\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+      "\n"
+      "\tfield:int fd;\toffset:16;\tsize:8;\tsigned:0;\n"
+      "\tfield:struct sockaddr * uservaddr;\toffset:24;\tsize:8;\tsigned:0;\n"
+      "\tfield:__data_loc char[] filename;\toffset:8;\tsize:4;\tsigned:0;\n"
+      "\tfield:char comm[16];\toffset:40;\tsize:16;\tsigned:0;\n"
+      "\n"
+      "print fmt: \"fd: 0x%08lx\", ((unsigned long)(REC->fd))\n";
+
+  std::map<std::string, size_t> offsets;
+  ASSERT_TRUE(parseTracepointFormat(format, offsets).ok());
+  EXPECT_EQ(offsets.size(), 6U);
+  EXPECT_EQ(offsets["common_pid"], 4U);
+  EXPECT_EQ(offsets["fd"], 16U);
+  EXPECT_EQ(offsets["uservaddr"], 24U);
+  EXPECT_EQ(offsets["filename"], 8U);
+  EXPECT_EQ(offsets["comm"], 40U);
+
+  offsets.clear();
+  EXPECT_FALSE(parseTracepointFormat("name: empty\n", offsets).ok());
+  EXPECT_FALSE(
+      parseTracepointFormat("\tfield:int fd;\toffset:x;\n", offsets).ok());
+}
+
+TEST_F(BPFTests, test_parse_sockaddr) {
+  struct sockaddr_in in;
+  memset(&in, 0, sizeof(in));
+  in.sin_family = AF_INET;
+  in.sin_port = htons(443);
+  inet_pton(AF_INET, "192.168.1.10", &in.sin_addr);
+  Row r;
+  parseBPFSockAddr(
+      std::string(reinterpret_cast<const char*>(&in), sizeof(in)), r, false);
+  EXPECT_EQ(r["family"], "2");
+  EXPECT_EQ(r["remote_address"], "192.168.1.10");
+  EXPECT_EQ(r["remote_port"], "443");
+
+  struct sockaddr_in6 in6;
+  memset(&in6, 0, sizeof(in6));
+  in6.sin6_family = AF_INET6;
+  in6.sin6_port = htons(8080);
+  inet_pton(AF_INET6, "fe80::1", &in6.sin6_addr);
+  Row r6;
+  parseBPFSockAddr(
+      std::string(reinterpret_cast<const char*>(&in6), sizeof(in6)), r6, true);
+  EXPECT_EQ(r6["family"], "10");
+  EXPECT_EQ(r6["local_address"], "fe80::1");
+  EXPECT_EQ(r6["local_port"], "8080");
+
+  // An abstract unix socket path starts with a null.
+  std::string un("\x01\x00\x00/run/bus", 11);
+  Row ru;
+  parseBPFSockAddr(un, ru, true);
+  EXPECT_EQ(ru["family"], "1");
+  EXPECT_EQ(ru["socket"], "/run/bus");
+
+  // A truncated address is unknown.
+  Row unknown;
+  parseBPFSockAddr(std::string("\x02\x00", 2), unknown, false);
+  EXPECT_EQ(unknown["family"], "-1");
+}
+
+/// The records written by the kernel and not yet drained.
+static size_t getPendingRecordBytes(const std::vector<BPFPerfBuffer>& buffers) {
+  size_t pending = 0;
+  for (const auto& buffer : buffers) {
+    auto page = static_cast<struct perf_event_mmap_page*>(buffer.base);
+    pending += __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE) -
+               page->data_tail;
+  }
+  return pending;
+}
+
+TEST_F(BPFTests, test_bpf_events) {
+  auto disable_bpf = FLAGS_disable_bpf;
+  FLAGS_disable_bpf = false;
+  auto pub = std::make_shared<BPFEventPublisher>();
+  auto status = pub->setUp();
+  FLAGS_disable_bpf = disable_bpf;
+  if (!status.ok()) {
+    // The tracing filesystem and BPF need root and a recent kernel.
+    return;
+  }
+
+  auto sc = std::make_shared<BPFSubscriptionContext>();
+  sc->types = {BPF_TYPE_EXEC, BPF_TYPE_CONNECT};
+  pub->addSubscription(Subscription::create("TestSubscriber", sc));
+  pub->configure();
+  EXPECT_EQ(pub->attached_.size(), 2U);
+  if (pub->tracepoints_.size() != 3) {
+    // The kernel may not support a helper or tracepoint.
+    pub->tearDown();
+    return;
+  }
+
+  // Execute a process and connect a socket.
+  auto child = fork();
+  if (child == 0) {
+    execl("/bin/true", "true", nullptr);
+    _exit(1);
+  }
+  waitpid(child, nullptr, 0);
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(9);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+  close(fd);
+
+  // The wakeup watermark is not crossed, the records are drained by run.
+  EXPECT_GT(getPendingRecordBytes(pub->buffers_), 0U);
+  EXPECT_TRUE(pub->run().ok());
+  EXPECT_EQ(getPendingRecordBytes(pub->buffers_), 0U);
+  pub->tearDown();
+  EXPECT_TRUE(pub->buffers_.empty());
+}
+}
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/events/linux/fanotify.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+class FANotifyTests : public testing::Test {};
+
+TEST_F(FANotifyTests, test_path_prefix_trie) {
+  PathPrefixTrie prefixes;
+  EXPECT_FALSE(prefixes.matches("/etc/passwd"));
+
+  prefixes.insert("/etc/");
+  prefixes.insert("/home/user/.ssh/auth");
+  EXPECT_TRUE(prefixes.matches("/etc/"));
+  EXPECT_TRUE(prefixes.matches("/etc/passwd"));
+  EXPECT_TRUE(prefixes.matches("/ETC/passwd"));
+  EXPECT_FALSE(prefixes.matches("/etc"));
+  EXPECT_FALSE(prefixes.matches("/var/etc/passwd"));
+  EXPECT_TRUE(prefixes.matches("/home/user/.ssh/authorized_keys"));
+  EXPECT_FALSE(prefixes.matches("/home/user/.ssh/known_hosts"));
+
+  prefixes.clear();
+  EXPECT_FALSE(prefixes.matches("/etc/passwd"));
+  prefixes.insert("");
+  EXPECT_TRUE(prefixes.matches("/etc/passwd"));
+}
+
+TEST_F(FANotifyTests, test_fanotify_events) {
+  FANotifyHandle handle;
+  if (!handle.open().ok()) {
+    // Filesystem marks need Linux 5.9 and CAP_SYS_ADMIN.
+    return;
+  }
+
+  auto directory = kTestWorkingDirectory + "fanotify-trigger";
+  fs::create_directories(directory);
+  auto status = handle.setMarks({directory}, IN_CREATE | IN_DELETE);
+  if (!status.ok()) {
+    // The filesystem may not support file handles.
+    fs::remove_all(directory);
+    return;
+  }
+
+  auto path = directory + "/1";
+  writeTextFile(path, "", 0644);
+  fs::remove(path);
+
+  // The fanotify event bits are equal to the inotify bits.
+  bool created = false;
+  bool deleted = false;
+  size_t delay = 0;
+  while (!(created && deleted) && delay < 3000) {
+    std::vector<FANotifyEvent> events;
+    EXPECT_TRUE(handle.read(events).ok());
+    for (const auto& event : events) {
+      if (event.path != fs::canonical(directory).string() + "/1") {
+        continue;
+      }
+      EXPECT_GT(event.pid, 0);
+      created = created || (event.mask & IN_CREATE);
+      deleted = deleted || (event.mask & IN_DELETE);
+    }
+    ::usleep(20 * 1000);
+    delay += 20;
+  }
+  EXPECT_TRUE(created);
+  EXPECT_TRUE(deleted);
+
+  handle.close();
+  EXPECT_FALSE(handle.isOpen());
+  fs::remove_all(directory);
+}
+}
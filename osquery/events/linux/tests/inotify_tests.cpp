@@ -275,6 +275,7 @@ class TestINotifyEventSubscriber
   FRIEND_TEST(INotifyTests, test_inotify_optimization);
   FRIEND_TEST(INotifyTests, test_inotify_directory_watch);
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
+  FRIEND_TEST(INotifyTests, test_inotify_expansion_cache);
 };
 
 TEST_F(INotifyTests, test_inotify_run) {
@@ -446,4 +447,42 @@ TEST_F(INotifyTests, test_inotify_recursion) {
   tearDownMockFileStructure();
   EventFactory::deregisterEventPublisher("inotify");
 }
+
+TEST_F(INotifyTests, test_inotify_expansion_cache) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+  createMockFileStructure();
+
+  // Configure the same recursive subscription three times, the mock tree has
+  // a new directory before the last.
+  size_t listings = 0;
+  for (size_t i = 0; i < 3; i++) {
+    if (i == 2) {
+      fs::create_directory(kFakeDirectory + "/deep1/new");
+    }
+    auto sc = sub->createSubscriptionContext();
+    sc->path = kFakeDirectory + "/**";
+    sub->subscribe(&TestINotifyEventSubscriber::Callback, sc);
+    pub->configure();
+
+    if (i == 0) {
+      EXPECT_EQ(pub->path_descriptors_.size(), 6U);
+      listings = pub->directories_.listings();
+      EXPECT_EQ(listings, 6U);
+    } else if (i == 1) {
+      // Configuring again does not list the unchanged directories.
+      EXPECT_EQ(pub->path_descriptors_.size(), 6U);
+      EXPECT_EQ(pub->directories_.listings(), listings);
+    } else {
+      // A new directory is listed with its changed parent.
+      EXPECT_EQ(pub->path_descriptors_.size(), 7U);
+      EXPECT_EQ(pub->directories_.listings(), listings + 2);
+    }
+    RemoveAll(pub);
+  }
+
+  tearDownMockFileStructure();
+  EventFactory::deregisterEventPublisher("inotify");
+}
 }
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/events/linux/process_cache.h"
+
+namespace osquery {
+
+DECLARE_uint64(process_cache_max);
+DECLARE_bool(process_cache_hash);
+
+class ProcessCacheTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    process_cache_hash_ = FLAGS_process_cache_hash;
+    FLAGS_process_cache_hash = false;
+  }
+
+  void TearDown() override {
+    FLAGS_process_cache_hash = process_cache_hash_;
+  }
+
+ private:
+  bool process_cache_hash_{false};
+};
+
+TEST_F(ProcessCacheTests, test_process_cache) {
+  ProcessCacheEntry self;
+  ASSERT_TRUE(ProcessCache::readProcess("/proc", getpid(), self));
+  EXPECT_EQ(self.pid, getpid());
+  EXPECT_EQ(self.parent, getppid());
+  EXPECT_GT(self.start_time, 0U);
+  EXPECT_FALSE(self.path.empty());
+  EXPECT_FALSE(self.cmdline.empty());
+  EXPECT_EQ(self.cmdline.find('\0'), std::string::npos);
+
+  ProcessCacheEntry missing;
+  EXPECT_FALSE(ProcessCache::readProcess("/proc", -1, missing));
+
+  ProcessCache cache;
+  ProcessCacheEntry parent;
+  parent.pid = 100;
+  parent.path = "/bin/bash";
+  parent.start_time = 10;
+  cache.exec(parent);
+
+  ProcessCacheEntry child;
+  child.pid = 101;
+  child.parent = 100;
+  child.path = "/bin/ls";
+  child.cmdline = "ls -l";
+  child.start_time = 20;
+  EXPECT_EQ(cache.exec(child).cmdline, "ls -l");
+  EXPECT_EQ(cache.size(), 2U);
+
+  ProcessCacheEntry entry;
+  ASSERT_TRUE(cache.get(101, entry));
+  EXPECT_EQ(entry.path, "/bin/ls");
+  ASSERT_TRUE(cache.getParent(entry, parent));
+  EXPECT_EQ(parent.path, "/bin/bash");
+
+  // An exited parent is still the parent until its pid is reused.
+  cache.exit(100);
+  EXPECT_EQ(cache.size(), 1U);
+  parent.path = "/usr/bin/python";
+  parent.start_time = 30;
+  cache.exec(parent);
+  EXPECT_FALSE(cache.getParent(entry, parent));
+
+  // A running process missing from the cache is read from /proc.
+  ASSERT_TRUE(cache.get(getpid(), entry));
+  EXPECT_EQ(entry.start_time, self.start_time);
+  EXPECT_EQ(cache.size(), 3U);
+}
+
+TEST_F(ProcessCacheTests, test_eviction) {
+  auto process_cache_max = FLAGS_process_cache_max;
+  FLAGS_process_cache_max = 2;
+
+  ProcessCache cache;
+  ProcessCacheEntry entry;
+  entry.start_time = 1;
+  for (pid_t pid = 1000000; pid < 1000003; pid++) {
+    entry.pid = pid;
+    entry.parent = 1;
+    entry.path = "/bin/" + std::to_string(pid);
+    cache.exec(entry);
+    if (pid == 1000001) {
+      // Using the first process makes the second the least recently used.
+      EXPECT_TRUE(cache.get(1000000, entry));
+    }
+  }
+  EXPECT_EQ(cache.size(), 2U);
+  EXPECT_EQ(cache.index_.count(1000000), 1U);
+  EXPECT_EQ(cache.index_.count(1000001), 0U);
+  EXPECT_EQ(cache.index_.count(1000002), 1U);
+  EXPECT_EQ(cache.entries_.front().pid, 1000002);
+
+  FLAGS_process_cache_max = process_cache_max;
+}
+}
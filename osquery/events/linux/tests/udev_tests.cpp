@@ -0,0 +1,53 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/udev.h"
+
+namespace osquery {
+
+class UdevTests : public testing::Test {};
+
+TEST_F(UdevTests, test_udev_context_fields) {
+  // Fields of a context without a device are empty.
+  auto ec = std::make_shared<UdevEventContext>();
+  EXPECT_TRUE(ec->subsystem().empty());
+  EXPECT_TRUE(ec->devnode().empty());
+  EXPECT_TRUE(ec->devtype().empty());
+  EXPECT_TRUE(ec->driver().empty());
+}
+
+TEST_F(UdevTests, test_udev_filters) {
+  auto pub = std::make_shared<UdevEventPublisher>();
+  if (!pub->setUp().ok() || pub->monitor_ == nullptr) {
+    // The netlink monitor may not be available.
+    return;
+  }
+
+  auto sc = std::make_shared<UdevSubscriptionContext>();
+  sc->action = UDEV_EVENT_ACTION_ALL;
+  sc->subsystem = "usb";
+  pub->addSubscription(Subscription::create("TestSubscriber", sc));
+  pub->configure();
+  EXPECT_EQ(pub->filters_.size(), 1U);
+  EXPECT_EQ(pub->filters_.count(std::make_pair("usb", "")), 1U);
+
+  // A subscription to every subsystem removes the filters.
+  auto all = std::make_shared<UdevSubscriptionContext>();
+  all->action = UDEV_EVENT_ACTION_ALL;
+  pub->addSubscription(Subscription::create("TestSubscriber", all));
+  EXPECT_TRUE(pub->filters_.empty());
+
+  pub->tearDown();
+}
+}
@@ -11,15 +11,17 @@
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
 
 #include "osquery/events/linux/udev.h"
 
 namespace osquery {
 
-static const int kUdevMLatency = 200;
-
 REGISTER(UdevEventPublisher, "event_publisher", "udev");
 
+/// The subsystem of the devices cached by the pci_devices table.
+const std::string kPCISubsystem = "pci";
+
 Status UdevEventPublisher::setUp() {
   // Create the udev object.
   handle_ = udev_new();
@@ -31,12 +33,65 @@ Status UdevEventPublisher::setUp() {
   monitor_ = udev_monitor_new_from_netlink(handle_, "udev");
   udev_monitor_enable_receiving(monitor_);
 
+  // Without subsystem filters every device change is received.
+  TablePlugin::setHotplugWatched(true);
   return Status(0, "OK");
 }
 
-void UdevEventPublisher::configure() {}
+void UdevEventPublisher::configure() {
+  if (monitor_ == nullptr) {
+    return;
+  }
+
+  // The kernel only sends the subsystems subscriptions require, unless a
+  // subscription needs every subsystem.
+  std::set<std::pair<std::string, std::string>> filters;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->subsystem.empty()) {
+      filters.clear();
+      break;
+    }
+    filters.insert(std::make_pair(sc->subsystem, sc->devtype));
+  }
+
+  if (filters == filters_) {
+    return;
+  }
+  filters_ = filters;
+
+  // Cached PCI devices are invalidated only if their changes are received.
+  bool pci = filters_.empty();
+  for (const auto& filter : filters_) {
+    pci = pci || (filter.first == kPCISubsystem && filter.second.empty());
+  }
+  TablePlugin::setHotplugWatched(pci);
+
+  udev_monitor_filter_remove(monitor_);
+  for (const auto& filter : filters_) {
+    // A subscription without a devtype matches every devtype.
+    udev_monitor_filter_add_match_subsystem_devtype(
+        monitor_,
+        filter.first.c_str(),
+        (filter.second.empty()) ? nullptr : filter.second.c_str());
+  }
+  if (udev_monitor_filter_update(monitor_) < 0) {
+    LOG(WARNING) << "Cannot update the udev monitor subsystem filters";
+  }
+}
+
+Status UdevEventPublisher::addSubscription(
+    const SubscriptionRef& subscription) {
+  auto status = EventPublisherPlugin::addSubscription(subscription);
+  if (status.ok() && !filters_.empty()) {
+    // The subsystem of a new subscription may not be filtered yet.
+    configure();
+  }
+  return status;
+}
 
 void UdevEventPublisher::tearDown() {
+  TablePlugin::setHotplugWatched(false);
   if (monitor_ != nullptr) {
     udev_monitor_unref(monitor_);
   }
@@ -47,7 +102,7 @@ void UdevEventPublisher::tearDown() {
 }
 
 Status UdevEventPublisher::run() {
-  int fd = udev_monitor_get_fd(monitor_);
+  int fd = getDescriptor();
   fd_set set;
 
   FD_ZERO(&set);
@@ -64,19 +119,25 @@ Status UdevEventPublisher::run() {
     // Read timeout.
     return Status(0, "Finished");
   }
+  return ready();
+}
 
-  struct udev_device *device = udev_monitor_receive_device(monitor_);
-  if (device == nullptr) {
-    LOG(ERROR) << "udev monitor returned invalid device";
-    return Status(1, "udev monitor failed.");
-  }
-
-  auto ec = createEventContextFrom(device);
-  fire(ec);
-
-  udev_device_unref(device);
+Status UdevEventPublisher::ready() {
+  // The monitor socket is non-blocking, no device is returned once drained.
+  struct udev_device* device = nullptr;
+  while ((device = udev_monitor_receive_device(monitor_)) != nullptr) {
+    auto subsystem = udev_device_get_subsystem(device);
+    if (subsystem != nullptr && kPCISubsystem == subsystem) {
+      TablePlugin::invalidateHotplugCache();
+    }
 
-  osquery::publisherSleep(kUdevMLatency);
+    if (numSubscriptions() == 0) {
+      udev_device_unref(device);
+      continue;
+    }
+    // The context owns the received device reference.
+    fire(createEventContextFrom(device));
+  }
   return Status(0, "OK");
 }
 
@@ -98,13 +159,58 @@ std::string UdevEventPublisher::getAttr(struct udev_device* device,
   return "";
 }
 
+const std::string& UdevEventContext::getField(
+    DeviceField& field, const char* (*getter)(struct udev_device*)) const {
+  std::lock_guard<std::mutex> lock(fields_mutex_);
+  if (!field.read) {
+    auto value = (device != nullptr) ? getter(device) : nullptr;
+    if (value != nullptr) {
+      field.value = value;
+    }
+    field.read = true;
+  }
+  return field.value;
+}
+
+const std::string& UdevEventContext::subsystem() const {
+  return getField(subsystem_, udev_device_get_subsystem);
+}
+
+const std::string& UdevEventContext::devnode() const {
+  return getField(devnode_, udev_device_get_devnode);
+}
+
+const std::string& UdevEventContext::devtype() const {
+  return getField(devtype_, udev_device_get_devtype);
+}
+
+const std::string& UdevEventContext::driver() const {
+  return getField(driver_, udev_device_get_driver);
+}
+
+void UdevEventContext::clear() {
+  if (device != nullptr) {
+    udev_device_unref(device);
+    device = nullptr;
+  }
+  action = UDEV_EVENT_ACTION_UNKNOWN;
+  action_string.clear();
+  for (auto field : {&subsystem_, &devnode_, &devtype_, &driver_}) {
+    field->value.clear();
+    field->read = false;
+  }
+}
+
 UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     struct udev_device* device) {
   auto ec = createEventContext();
   ec->device = device;
   // Map the action string to the eventing enum.
   ec->action = UDEV_EVENT_ACTION_UNKNOWN;
-  ec->action_string = std::string(udev_device_get_action(device));
+  auto action = udev_device_get_action(device);
+  if (action != nullptr) {
+    ec->action_string = action;
+  }
   if (ec->action_string == "add") {
     ec->action = UDEV_EVENT_ACTION_ADD;
   } else if (ec->action_string == "remove") {
@@ -112,28 +218,6 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
   } else if (ec->action_string == "change") {
     ec->action = UDEV_EVENT_ACTION_CHANGE;
   }
-
-  // Set the subscription-aware variables for the event.
-  auto value = udev_device_get_subsystem(device);
-  if (value != nullptr) {
-    ec->subsystem = std::string(value);
-  }
-
-  value = udev_device_get_devnode(device);
-  if (value != nullptr) {
-    ec->devnode = std::string(value);
-  }
-
-  value = udev_device_get_devtype(device);
-  if (value != nullptr) {
-    ec->devtype = std::string(value);
-  }
-
-  value = udev_device_get_driver(device);
-  if (value != nullptr) {
-    ec->driver = std::string(value);
-  }
-
   return ec;
 }
 
@@ -145,13 +229,13 @@ bool UdevEventPublisher::shouldFire(const UdevSubscriptionContextRef& sc,
     }
   }
 
-  if (sc->subsystem.length() != 0 && sc->subsystem != ec->subsystem) {
+  if (sc->subsystem.length() != 0 && sc->subsystem != ec->subsystem()) {
     return false;
-  } else if (sc->devnode.length() != 0 && sc->devnode != ec->devnode) {
+  } else if (sc->devnode.length() != 0 && sc->devnode != ec->devnode()) {
     return false;
-  } else if (sc->devtype.length() != 0 && sc->devtype != ec->devtype) {
+  } else if (sc->devtype.length() != 0 && sc->devtype != ec->devtype()) {
     return false;
-  } else if (sc->driver.length() != 0 && sc->driver != ec->driver) {
+  } else if (sc->driver.length() != 0 && sc->driver != ec->driver()) {
     return false;
   }
 
@@ -12,6 +12,9 @@
 
 #include <libudev.h>
 
+#include <mutex>
+#include <set>
+
 #include <osquery/events.h>
 #include <osquery/status.h>
 
@@ -50,9 +53,19 @@ struct UdevSubscriptionContext : public SubscriptionContext {
 
 /**
  * @brief Event details for UdevEventPublisher events.
+ *
+ * The device fields are read from the device when first used, so events that
+ * no subscription inspects are not copied.
  */
 struct UdevEventContext : public EventContext {
-  /// A pointer to the device object, most subscribers will only use device.
+ public:
+  ~UdevEventContext() {
+    if (device != nullptr) {
+      udev_device_unref(device);
+    }
+  }
+
+  /// A reference to the device object, released with the context.
   struct udev_device* device{nullptr};
 
   /// The udev_event_action identifier.
@@ -61,10 +74,40 @@ struct UdevEventContext : public EventContext {
   /// Action as a string (as given by udev).
   std::string action_string;
 
-  std::string subsystem;
-  std::string devnode;
-  std::string devtype;
-  std::string driver;
+  /// The device subsystem.
+  const std::string& subsystem() const;
+
+  /// The device node path.
+  const std::string& devnode() const;
+
+  /// The device type.
+  const std::string& devtype() const;
+
+  /// The device driver name.
+  const std::string& driver() const;
+
+  /// Reset a pooled context, releasing the device.
+  void clear();
+
+ private:
+  /// A device field and whether it was read.
+  struct DeviceField {
+    std::string value;
+    bool read{false};
+  };
+
+  /// Read a device field once, subscribers may share the context.
+  const std::string& getField(DeviceField& field,
+                              const char* (*getter)(struct udev_device*)) const;
+
+ private:
+  mutable DeviceField subsystem_;
+  mutable DeviceField devnode_;
+  mutable DeviceField devtype_;
+  mutable DeviceField driver_;
+
+  /// Protects reading the device fields.
+  mutable std::mutex fields_mutex_;
 };
 
 using UdevEventContextRef = std::shared_ptr<UdevEventContext>;
@@ -81,12 +124,24 @@ class UdevEventPublisher
  public:
   Status setUp() override;
 
+  /// Filter the monitor by the subsystems of the subscriptions.
   void configure() override;
 
   void tearDown() override;
 
   Status run() override;
 
+  /// Add a subscription, widening the monitor filters if needed.
+  Status addSubscription(const SubscriptionRef& subscription) override;
+
+  /// The non-blocking udev monitor socket.
+  int getDescriptor() const override {
+    return (monitor_ != nullptr) ? udev_monitor_get_fd(monitor_) : -1;
+  }
+
+  /// Receive and fire the queued devices until the monitor would block.
+  Status ready() override;
+
   UdevEventPublisher() : EventPublisher(){};
 
   /**
@@ -121,5 +176,12 @@ class UdevEventPublisher
 
   /// Helper function to create an EventContext using a udev_device pointer.
   UdevEventContextRef createEventContextFrom(struct udev_device* device);
+
+ private:
+  /// The subsystem and devtype pairs filtered by the monitor.
+  std::set<std::pair<std::string, std::string>> filters_;
+
+ private:
+  FRIEND_TEST(UdevTests, test_udev_filters);
 };
 }
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include "osquery/events/memory_store.h"
+
+namespace osquery {
+
+EventMemoryStore::EventMemoryStore(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)) {}
+
+size_t EventMemoryStore::add(EventTime time, Row row) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t dropped = 0;
+  if (events_.size() >= capacity_) {
+    if (time < events_.front().time) {
+      // The event is older than every stored event, it would be dropped.
+      return 1;
+    }
+    events_.pop_front();
+    dropped = 1;
+  }
+
+  if (events_.empty() || events_.back().time <= time) {
+    events_.push_back({time, std::move(row)});
+    return dropped;
+  }
+
+  // Events are mostly added in order, a late event is inserted after the
+  // events with the same time.
+  auto position = std::upper_bound(
+      events_.begin(),
+      events_.end(),
+      time,
+      [](EventTime t, const Event& event) { return t < event.time; });
+  events_.insert(position, {time, std::move(row)});
+  return dropped;
+}
+
+void EventMemoryStore::get(EventTime start,
+                           EventTime stop,
+                           bool descending,
+                           size_t limit,
+                           QueryData& results) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto first = std::lower_bound(
+      events_.begin(),
+      events_.end(),
+      start,
+      [](const Event& event, EventTime t) { return event.time < t; });
+  auto last = std::upper_bound(
+      first,
+      events_.end(),
+      stop,
+      [](EventTime t, const Event& event) { return t < event.time; });
+
+  size_t count = static_cast<size_t>(last - first);
+  if (limit > 0 && count > limit) {
+    count = limit;
+  }
+  results.reserve(results.size() + count);
+  if (descending) {
+    for (auto event = last; count > 0; count--) {
+      results.push_back((--event)->row);
+    }
+  } else {
+    for (auto event = first; count > 0; count--) {
+      results.push_back((event++)->row);
+    }
+  }
+}
+
+size_t EventMemoryStore::expire(EventTime time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t expired = 0;
+  while (!events_.empty() && events_.front().time < time) {
+    events_.pop_front();
+    expired++;
+  }
+  return expired;
+}
+
+size_t EventMemoryStore::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return events_.size();
+}
+}
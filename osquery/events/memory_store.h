@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief A bounded, in-memory store of a subscriber's events.
+ *
+ * Used instead of the backing store when events do not need to survive a
+ * restart, see `events_memory`. Events are kept ordered by time, so a query
+ * seeks to the first event in its time range with a binary search. Adding an
+ * event to a full store drops the oldest event. Events are kept as rows, so
+ * nothing is serialized or written to disk.
+ */
+class EventMemoryStore : private boost::noncopyable {
+ public:
+  /// Create a store holding at most capacity events.
+  explicit EventMemoryStore(size_t capacity);
+
+  /**
+   * @brief Add an event, dropping the oldest event if the store is full.
+   *
+   * @param time The time the event occurred.
+   * @param row The event row.
+   * @return The number of dropped events.
+   */
+  size_t add(EventTime time, Row row);
+
+  /**
+   * @brief Append the events within start, stop in 'time' order.
+   *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit.
+   * @param descending Append the latest events first.
+   * @param limit The most events to append, 0 for no limit.
+   * @param results The output event rows.
+   */
+  void get(EventTime start,
+           EventTime stop,
+           bool descending,
+           size_t limit,
+           QueryData& results) const;
+
+  /// Remove every event that occurred before time, returns the count.
+  size_t expire(EventTime time);
+
+  /// The number of stored events.
+  size_t size() const;
+
+ private:
+  /// A stored event and the time used to order it.
+  struct Event {
+    EventTime time;
+    Row row;
+  };
+
+  /// Events ordered by time, an event arriving late is inserted in order.
+  std::deque<Event> events_;
+
+  /// The most events stored.
+  size_t capacity_{0};
+
+  /// Protect the events, added by publishers and read by queries.
+  mutable std::mutex mutex_;
+};
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "osquery/events/path_trie.h"
+
+namespace osquery {
+
+/// Characters starting a wildcard in an fnmatch pattern.
+const std::string kPathWildcards = "*?[\\";
+
+void SubscriptionPathTrie::insert(const std::string& path,
+                                  const SubscriptionRef& subscription) {
+  auto prefix =
+      boost::to_lower_copy(path.substr(0, path.find_first_of(kPathWildcards)));
+
+  size_t node = 0;
+  size_t start = 0;
+  for (auto slash = prefix.find('/'); slash != std::string::npos;
+       slash = prefix.find('/', start)) {
+    auto component = prefix.substr(start, slash - start);
+    auto child = nodes_[node].children.find(component);
+    if (child != nodes_[node].children.end()) {
+      node = child->second;
+    } else {
+      nodes_[node].children[component] = nodes_.size();
+      node = nodes_.size();
+      nodes_.emplace_back();
+    }
+    start = slash + 1;
+  }
+  nodes_[node].subscriptions.push_back(
+      std::make_pair(prefix.substr(start), subscription));
+}
+
+void SubscriptionPathTrie::clear() {
+  nodes_.assign(1, Node());
+  complete_ = false;
+}
+
+bool SubscriptionPathTrie::match(const std::string& path,
+                                 SubscriptionVector& matches) const {
+  if (!complete_) {
+    return false;
+  }
+
+  auto lower = boost::to_lower_copy(path);
+  size_t node = 0;
+  size_t start = 0;
+  while (true) {
+    auto slash = lower.find('/', start);
+    auto component = lower.substr(
+        start, (slash == std::string::npos) ? slash : slash - start);
+    for (const auto& subscription : nodes_[node].subscriptions) {
+      const auto& partial = subscription.first;
+      if (component.compare(0, partial.size(), partial) == 0) {
+        matches.push_back(subscription.second);
+      }
+    }
+
+    // Only a complete component continues a subscription's prefix.
+    if (slash == std::string::npos) {
+      break;
+    }
+    auto child = nodes_[node].children.find(component);
+    if (child == nodes_[node].children.end()) {
+      break;
+    }
+    node = child->second;
+    start = slash + 1;
+  }
+  return true;
+}
+}
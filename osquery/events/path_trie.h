@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief A path-component trie of file path subscriptions.
+ *
+ * Each subscription is indexed by its path before any wildcard, as the
+ * complete path components and a partial last component. Matching walks the
+ * components of an event path once and returns the subscriptions whose path
+ * prefix the event path starts with, ignoring case as file path subscriptions
+ * do. A publisher then checks only these candidates with `shouldFire`, so an
+ * event costs its path depth rather than a match of every subscription.
+ */
+class SubscriptionPathTrie {
+ public:
+  SubscriptionPathTrie() : nodes_(1) {}
+
+  /// Index a subscription by the (possibly wildcard) path it matches.
+  void insert(const std::string& path, const SubscriptionRef& subscription);
+
+  /// Every subscription is indexed, until the next clear.
+  void setComplete() { complete_ = true; }
+
+  /// Remove all subscriptions, the trie is incomplete until rebuilt.
+  void clear();
+
+  /**
+   * @brief Find the subscriptions an event path may match.
+   *
+   * @param path The event path.
+   * @param matches The output candidate subscriptions, appended.
+   * @return false if the trie is incomplete and no candidates were found.
+   */
+  bool match(const std::string& path, SubscriptionVector& matches) const;
+
+ private:
+  struct Node {
+    /// The node following each complete, lowercase, component.
+    std::map<std::string, size_t> children;
+
+    /// Subscriptions ending within the next component, by its prefix.
+    std::vector<std::pair<std::string, SubscriptionRef>> subscriptions;
+  };
+
+  /// The nodes of the trie, the first is the root.
+  std::vector<Node> nodes_;
+
+  /// Every subscription of the publisher is indexed.
+  bool complete_{false};
+};
+}
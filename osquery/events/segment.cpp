@@ -0,0 +1,263 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <lz4.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/segment.h"
+
+namespace osquery {
+
+/////////////////////////////////////////////////////////////////////////////
+// Event segment format - a version byte, the varint size of the columns, and
+// the LZ4 block of the columns.
+//
+// Columns: row count, column count, then for each column its (length, name),
+// an encoding byte, and its values.
+//   Dictionary: entry count, each (length, value), then an index for every
+//   row, 0 if the row does not have the column.
+//   Delta: for every row the zigzag varint difference from the previous row,
+//   the first row's difference is from 0.
+/////////////////////////////////////////////////////////////////////////////
+
+/// The current version of the segment format.
+const char kSegmentVersion = 1;
+
+/// Column encodings.
+const char kSegmentDictionary = 'D';
+const char kSegmentDelta = 'I';
+
+/// The largest uncompressed segment, LZ4 block sizes are ints.
+const size_t kSegmentSizeMax = 0x7E000000;
+
+static void writeVarint(unsigned long long value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+static void writeString(const std::string& value, std::string& data) {
+  writeVarint(value.size(), data);
+  data.append(value);
+}
+
+static bool readVarint(const std::string& data,
+                       size_t& offset,
+                       unsigned long long& value) {
+  value = 0;
+  for (size_t shift = 0; offset < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[offset++]);
+    value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool readString(const std::string& data,
+                       size_t& offset,
+                       std::string& value) {
+  unsigned long long length = 0;
+  if (!readVarint(data, offset, length) || length > data.size() - offset) {
+    return false;
+  }
+  value.assign(data, offset, length);
+  offset += length;
+  return true;
+}
+
+/// Check if every row has the column as an integer that prints identically.
+static bool isIntegerColumn(const QueryData& rows,
+                            const std::string& column,
+                            std::vector<long long>& values) {
+  values.clear();
+  values.reserve(rows.size());
+  for (const auto& row : rows) {
+    auto value = row.find(column);
+    long long number = 0;
+    if (value == row.end() || !parseDecimal(value->second, number) ||
+        std::to_string(number) != value->second) {
+      return false;
+    }
+    values.push_back(number);
+  }
+  return true;
+}
+
+Status encodeEventSegment(const QueryData& rows, std::string& data) {
+  std::set<std::string> columns;
+  for (const auto& row : rows) {
+    for (const auto& column : row) {
+      columns.insert(column.first);
+    }
+  }
+
+  std::string content;
+  writeVarint(rows.size(), content);
+  writeVarint(columns.size(), content);
+  std::vector<long long> values;
+  for (const auto& column : columns) {
+    writeString(column, content);
+
+    // Each row's index into the column's distinct values, 0 if absent.
+    std::unordered_map<std::string, size_t> dictionary;
+    std::vector<const std::string*> entries;
+    std::vector<size_t> indexes;
+    indexes.reserve(rows.size());
+    for (const auto& row : rows) {
+      auto value = row.find(column);
+      if (value == row.end()) {
+        indexes.push_back(0);
+        continue;
+      }
+      auto entry = dictionary.emplace(value->second, entries.size() + 1);
+      if (entry.second) {
+        entries.push_back(&entry.first->first);
+      }
+      indexes.push_back(entry.first->second);
+    }
+
+    // Integers that rarely repeat, such as times, are smaller as deltas.
+    if (entries.size() * 2 > rows.size() &&
+        isIntegerColumn(rows, column, values)) {
+      content.push_back(kSegmentDelta);
+      unsigned long long previous = 0;
+      for (const auto& value : values) {
+        auto delta = static_cast<long long>(
+            static_cast<unsigned long long>(value) - previous);
+        writeVarint((static_cast<unsigned long long>(delta) << 1) ^
+                        static_cast<unsigned long long>(delta >> 63),
+                    content);
+        previous = static_cast<unsigned long long>(value);
+      }
+      continue;
+    }
+
+    content.push_back(kSegmentDictionary);
+    writeVarint(entries.size(), content);
+    for (const auto& entry : entries) {
+      writeString(*entry, content);
+    }
+    for (const auto& index : indexes) {
+      writeVarint(index, content);
+    }
+  }
+
+  if (content.size() > kSegmentSizeMax) {
+    return Status(1, "Event segment is too large");
+  }
+
+  data.clear();
+  data.push_back(kSegmentVersion);
+  writeVarint(content.size(), data);
+  auto header = data.size();
+  auto bound = LZ4_compressBound(static_cast<int>(content.size()));
+  data.resize(header + bound);
+  auto size = LZ4_compress_default(content.data(),
+                                   &data[header],
+                                   static_cast<int>(content.size()),
+                                   bound);
+  if (size <= 0) {
+    return Status(1, "Cannot compress event segment");
+  }
+  data.resize(header + size);
+  return Status(0, "OK");
+}
+
+Status decodeEventSegment(const std::string& data, QueryData& rows) {
+  if (data.empty() || data[0] != kSegmentVersion) {
+    return Status(1, "Unknown event segment version");
+  }
+
+  size_t offset = 1;
+  unsigned long long size = 0;
+  if (!readVarint(data, offset, size) || size > kSegmentSizeMax) {
+    return Status(1, "Malformed event segment");
+  }
+  std::string content(size, 0);
+  auto decoded = LZ4_decompress_safe(data.data() + offset,
+                                     &content[0],
+                                     static_cast<int>(data.size() - offset),
+                                     static_cast<int>(size));
+  if (decoded < 0 || static_cast<size_t>(decoded) != size) {
+    return Status(1, "Cannot decompress event segment");
+  }
+
+  offset = 0;
+  unsigned long long count = 0;
+  unsigned long long columns = 0;
+  // Every row and column uses at least one byte of content.
+  if (!readVarint(content, offset, count) ||
+      !readVarint(content, offset, columns) || count > content.size() ||
+      columns > content.size()) {
+    return Status(1, "Malformed event segment");
+  }
+
+  auto first = rows.size();
+  rows.resize(first + count);
+  for (size_t i = 0; i < columns; i++) {
+    std::string column;
+    if (!readString(content, offset, column) || offset >= content.size()) {
+      rows.resize(first);
+      return Status(1, "Malformed event segment");
+    }
+
+    auto encoding = content[offset++];
+    if (encoding == kSegmentDelta) {
+      unsigned long long value = 0;
+      for (size_t row = 0; row < count; row++) {
+        unsigned long long delta = 0;
+        if (!readVarint(content, offset, delta)) {
+          rows.resize(first);
+          return Status(1, "Malformed event segment");
+        }
+        value += (delta >> 1) ^ (~(delta & 1) + 1);
+        rows[first + row][column] =
+            std::to_string(static_cast<long long>(value));
+      }
+      continue;
+    } else if (encoding != kSegmentDictionary) {
+      rows.resize(first);
+      return Status(1, "Unknown event segment column encoding");
+    }
+
+    unsigned long long entries = 0;
+    if (!readVarint(content, offset, entries) || entries > content.size()) {
+      rows.resize(first);
+      return Status(1, "Malformed event segment");
+    }
+    std::vector<std::string> dictionary(entries);
+    for (auto& entry : dictionary) {
+      if (!readString(content, offset, entry)) {
+        rows.resize(first);
+        return Status(1, "Malformed event segment");
+      }
+    }
+    for (size_t row = 0; row < count; row++) {
+      unsigned long long index = 0;
+      if (!readVarint(content, offset, index) || index > entries) {
+        rows.resize(first);
+        return Status(1, "Malformed event segment");
+      }
+      if (index > 0) {
+        rows[first + row][column] = dictionary[index - 1];
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,37 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <osquery/database.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Encode event rows into a compressed, columnar segment.
+ *
+ * Aged events are compacted from one key per event into immutable segments.
+ * The values of each column are stored together, either as a dictionary of
+ * distinct values with an index for each row, or for high-cardinality integer
+ * columns such as 'time' as varint deltas. The columns are then compressed
+ * with LZ4.
+ *
+ * @param rows the event rows, in the order they are decoded.
+ * @param data the output segment.
+ * @return success if the rows were encoded.
+ */
+Status encodeEventSegment(const QueryData& rows, std::string& data);
+
+/// Inverse of encodeEventSegment, the rows are appended.
+Status decodeEventSegment(const std::string& data, QueryData& rows);
+}
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/events/directory_cache.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+class DirectoryCacheTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    createMockFileStructure();
+    root_ = fs::canonical(kFakeDirectory).string() + '/';
+  }
+
+  void TearDown() override { tearDownMockFileStructure(); }
+
+  std::vector<std::string> list(DirectoryCache& cache,
+                                const std::string& dir,
+                                bool observed = false) {
+    std::vector<std::string> children;
+    cache.list(dir, observed, false, children);
+    std::sort(children.begin(), children.end());
+    return children;
+  }
+
+ protected:
+  std::string root_;
+};
+
+TEST_F(DirectoryCacheTests, test_list) {
+  DirectoryCache cache;
+  auto expected =
+      std::vector<std::string>({root_ + "deep1/", root_ + "deep11/"});
+  EXPECT_EQ(list(cache, root_), expected);
+  EXPECT_EQ(cache.listings(), 1U);
+
+  // An unchanged directory is not listed again.
+  EXPECT_EQ(list(cache, root_), expected);
+  EXPECT_EQ(cache.listings(), 1U);
+
+  // A changed directory is listed again, unless its changes are observed.
+  fs::create_directory(root_ + "deep2");
+  EXPECT_EQ(list(cache, root_, true).size(), 3U);
+  EXPECT_EQ(cache.listings(), 2U);
+  fs::create_directory(root_ + "deep3");
+  EXPECT_EQ(list(cache, root_).size(), 3U);
+  EXPECT_EQ(cache.listings(), 2U);
+
+  // An observer reports the change, or stops observing.
+  cache.invalidate(root_);
+  EXPECT_EQ(list(cache, root_, true).size(), 4U);
+  fs::remove(root_ + "deep3");
+  cache.unobserve(root_);
+  EXPECT_EQ(list(cache, root_).size(), 3U);
+  EXPECT_EQ(cache.listings(), 4U);
+
+  // Removing a directory forgets the directories below it.
+  list(cache, root_ + "deep11/");
+  list(cache, root_ + "deep11/deep2/");
+  EXPECT_EQ(cache.size(), 3U);
+  cache.remove(root_ + "deep11/");
+  EXPECT_EQ(cache.size(), 1U);
+}
+
+TEST_F(DirectoryCacheTests, test_resolve) {
+  DirectoryCache cache;
+  auto unobserved = [](const std::string&) { return false; };
+
+  std::vector<std::string> results;
+  cache.resolve(root_ + "deep*/deep2/", unobserved, results);
+  std::sort(results.begin(), results.end());
+  EXPECT_EQ(results,
+            std::vector<std::string>(
+                {root_ + "deep1/deep2/", root_ + "deep11/deep2/"}));
+
+  // A last component without a wildcard may be a file.
+  results.clear();
+  cache.resolve(root_ + "deep1?/level1.txt", unobserved, results);
+  EXPECT_EQ(results, std::vector<std::string>({root_ + "deep11/level1.txt"}));
+
+  // Resolving again uses the listed directories.
+  auto listings = cache.listings();
+  results.clear();
+  cache.resolve(root_ + "deep*/deep2/", unobserved, results);
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(cache.listings(), listings);
+}
+}
@@ -8,6 +8,8 @@
  *
  */
 
+#include <algorithm>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 
@@ -25,6 +27,9 @@ namespace osquery {
 
 DECLARE_uint64(events_expiry);
 DECLARE_uint64(events_max);
+DECLARE_uint64(events_batch_size);
+DECLARE_uint64(events_batch_latency);
+DECLARE_uint64(events_cold_age);
 
 class EventsDatabaseTests : public ::testing::Test {
   void SetUp() override { Registry::registry("config_parser")->setUp(); }
@@ -59,13 +64,34 @@ TEST_F(EventsDatabaseTests, test_event_module_id) {
   EXPECT_EQ(event_id2, "2");
 }
 
+TEST_F(EventsDatabaseTests, test_event_id_reservation) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeReserveSubscriber");
+  EXPECT_EQ(sub->getEventID(), "1");
+
+  // A block of EventIDs is reserved with a single write.
+  std::string reserved;
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), reserved);
+  EXPECT_EQ(reserved, "10000");
+  for (size_t i = 2; i <= 10001; i++) {
+    sub->getEventID();
+  }
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), reserved);
+  EXPECT_EQ(reserved, "20000");
+
+  // A restarted subscriber continues after the reserved EventIDs.
+  auto restarted = std::make_shared<DBFakeEventSubscriber>();
+  restarted->setName("DBFakeReserveSubscriber");
+  EXPECT_EQ(restarted->getEventID(), "20001");
+}
+
 TEST_F(EventsDatabaseTests, test_event_add) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(1);
   EXPECT_TRUE(status.ok());
 }
 
-TEST_F(EventsDatabaseTests, test_record_indexing) {
+TEST_F(EventsDatabaseTests, test_record_keys) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(2);
   status = sub->testAdd(11);
@@ -73,63 +99,47 @@ TEST_F(EventsDatabaseTests, test_record_indexing) {
   status = sub->testAdd((1 * 3600) + 1);
   status = sub->testAdd((2 * 3600) + 1);
 
-  // An "all" range, will pick up everything in the largest index.
-  auto indexes = sub->getIndexes(0, 3 * 3600);
-  auto output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "3600.0, 3600.1, 3600.2");
-
-  // Restrict range to "most specific", which is an index by 10.
-  indexes = sub->getIndexes(0, 5);
-  output = boost::algorithm::join(indexes, ", ");
-  // The order 10, 0th index include results with t = [0, 10).
-  EXPECT_EQ(output, "10.0");
-
-  // Get a mix of indexes for the lower bounding.
-  indexes = sub->getIndexes(2, (3 * 3600));
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "10.0, 10.1, 3600.1, 3600.2, 60.1");
-
-  // Rare, but test ONLY intermediate indexes.
-  // Provide an optional third parameter to getIndexes: 1 = 10,(60),3600.
-  indexes = sub->getIndexes(2, (3 * 3600), 1);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "60.0, 60.1, 60.120, 60.60");
-
-  // Add specific indexes to the upper bound.
-  status = sub->testAdd((2 * 3600) + 11);
-  status = sub->testAdd((2 * 3600) + 61);
-  indexes = sub->getIndexes(2 * 3600, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "10.726, 60.120");
-
-  // Request specific lower and upper bounding.
-  indexes = sub->getIndexes(2, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ(output, "10.0, 10.1, 10.726, 3600.1, 60.1, 60.120");
+  // Keys order events by time, regardless of the number of digits.
+  EXPECT_LT(sub->getEventKey(2, "10"), sub->getEventKey(11, "2"));
+  EXPECT_LT(sub->getEventKey(11, "2"), sub->getEventKey(11, "10"));
+
+  // Each event is a single key, reading records commits staged events.
+  auto records = sub->getRecords(0, 3 * 3600);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys);
+  auto prefix = "event." + sub->dbNamespace() + ".";
+  auto count = std::count_if(
+      keys.begin(), keys.end(), [&prefix](const std::string& key) {
+        return key.compare(0, prefix.size(), prefix) == 0;
+      });
+  EXPECT_EQ(count, 6);
+
+  // Records are returned in time order.
+  ASSERT_EQ(records.size(), 6U);
+  EXPECT_EQ(records[0].second, 1U);
+  EXPECT_EQ(records[1].second, 2U);
+  EXPECT_EQ(records[5].second, (2U * 3600) + 1);
 }
 
 TEST_F(EventsDatabaseTests, test_record_range) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->testAdd((2 * 3600) + 11);
+  sub->testAdd((2 * 3600) + 61);
 
   // Search within a specific record range.
-  auto indexes = sub->getIndexes(0, 10);
-  auto records = sub->getRecords(indexes);
+  auto records = sub->getRecords(0, 10);
   EXPECT_EQ(records.size(), 2U); // 1, 2
 
-  // Search within a large bound.
-  indexes = sub->getIndexes(3, 3601);
-  // This will include the 0-10 bucket meaning 1, 2 will show up.
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 5U); // 1, 2, 11, 61, 3601
+  // Search within a large bound, the bounds are inclusive.
+  records = sub->getRecords(2, 3601);
+  EXPECT_EQ(records.size(), 4U); // 2, 11, 61, 3601
 
   // Get all of the records.
-  indexes = sub->getIndexes(0, 3 * 3600);
-  records = sub->getRecords(indexes);
+  records = sub->getRecords(0, 3 * 3600);
   EXPECT_EQ(records.size(), 8U); // 1, 2, 11, 61, 3601, 7201, 7211, 7261
 
   // stop = 0 is an alias for everything.
-  indexes = sub->getIndexes(0, 0);
-  records = sub->getRecords(indexes);
+  records = sub->getRecords(0, 0);
   EXPECT_EQ(records.size(), 8U);
 }
 
@@ -137,33 +147,24 @@ TEST_F(EventsDatabaseTests, test_record_expiration) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
 
   // No expiration
-  auto indexes = sub->getIndexes(0, 5000);
-  auto records = sub->getRecords(indexes);
+  auto records = sub->getRecords(0, 5000);
   EXPECT_EQ(records.size(), 5U); // 1, 2, 11, 61, 3601
 
-  sub->expire_events_ = true;
+  sub->expire_events_ = false;
   sub->expire_time_ = 10;
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 3U); // 11, 61, 3601
+  sub->expireRecords();
+  records = sub->getRecords(0, 5000);
+  EXPECT_EQ(records.size(), 5U);
 
-  indexes = sub->getIndexes(0, 5000, 0);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 3U); // 11, 61, 3601
-
-  indexes = sub->getIndexes(0, 5000, 1);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(records.size(), 3U); // 11, 61, 3601
-
-  indexes = sub->getIndexes(0, 5000, 2);
-  records = sub->getRecords(indexes);
+  sub->expire_events_ = true;
+  sub->expireRecords();
+  records = sub->getRecords(0, 5000);
   EXPECT_EQ(records.size(), 3U); // 11, 61, 3601
 
   // Check that get/deletes did not act on cache.
   // This implies that RocksDB is flushing the requested delete records.
   sub->expire_time_ = 0;
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
+  records = sub->getRecords(0, 5000);
   EXPECT_EQ(records.size(), 3U); // 11, 61, 3601
 }
 
@@ -172,6 +173,7 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   // Lie about the tool type to enable optimizations.
   auto default_type = kToolType;
   kToolType = OSQUERY_TOOL_DAEMON;
+  TablePlugin::kQueryName = "test_query";
   ASSERT_EQ(sub->optimize_time_, 0U);
   ASSERT_EQ(sub->expire_time_, 0U);
 
@@ -182,24 +184,31 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   // Test the expire workflow by creating a short expiration time.
   FLAGS_events_expiry = 10;
 
+  // The 9 buffered events and the EventID.
+  sub->flushEvents(true);
   std::vector<std::string> keys;
   scanDatabaseKeys("events", keys);
-  EXPECT_GT(keys.size(), 10U);
+  EXPECT_GE(keys.size(), 10U);
 
   // Perform a "select" equivalent.
   QueryContext context;
   auto results = sub->genTable(context);
 
-  // Expect all non-expired results: 11, +
+  // Expect all buffered results: 11, +
   EXPECT_EQ(results.size(), 9U);
-  // The expiration time is now - events_expiry.
-  EXPECT_GT(sub->expire_time_, getUnixTime() - (FLAGS_events_expiry * 2));
-  EXPECT_LT(sub->expire_time_, getUnixTime());
-  // The optimize time will be changed too.
-  ASSERT_GT(sub->optimize_time_, 0U);
+  // Selects do not expire events.
+  EXPECT_EQ(sub->expire_time_, 0U);
+  // The optimize time of the query will be changed too.
+  ASSERT_GT(sub->optimize_times_["test_query"], 0U);
   // Restore the tool type.
   kToolType = default_type;
 
+  // The background expiration time is now - events_expiry.
+  EXPECT_EQ(sub->expireCheck(), 6U);
+  EXPECT_GT(sub->expire_time_, getUnixTime() - (FLAGS_events_expiry * 2));
+  EXPECT_LT(sub->expire_time_, getUnixTime());
+  EXPECT_EQ(sub->numExpired(), 6U);
+
   results = sub->genTable(context);
   EXPECT_EQ(results.size(), 3U);
 
@@ -209,39 +218,333 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   // The optimize time should have been written to the database.
   // It should be the same as the current (relative) optimize time.
   std::string content;
-  getDatabaseValue(
-      "events", "optimize.DBFakePublisher.DBFakeSubscriber", content);
-  EXPECT_EQ(std::to_string(sub->optimize_time_), content);
+  getDatabaseValue("events",
+                   "optimize.DBFakePublisher.DBFakeSubscriber.test_query",
+                   content);
+  EXPECT_EQ(std::to_string(sub->optimize_times_["test_query"]), content);
+  TablePlugin::kQueryName.clear();
 
   keys.clear();
   scanDatabaseKeys("events", keys);
   EXPECT_LT(keys.size(), 30U);
 }
 
+TEST_F(EventsDatabaseTests, test_gentable_query_optimize_times) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBQueryTimesSubscriber");
+  for (const auto& query : {"first_query", "second_query"}) {
+    deleteDatabaseValue(
+        kEvents, "optimize." + sub->dbNamespace() + "." + query);
+  }
+
+  auto default_type = kToolType;
+  kToolType = OSQUERY_TOOL_DAEMON;
+  sub->testAdd(getUnixTime() - 10);
+  sub->testAdd(getUnixTime() - 5);
+
+  // Each scheduled query reads the events since its own last execution.
+  QueryContext context;
+  TablePlugin::kQueryName = "first_query";
+  EXPECT_EQ(sub->genTable(context).size(), 2U);
+  EXPECT_EQ(sub->genTable(context).size(), 0U);
+  TablePlugin::kQueryName = "second_query";
+  EXPECT_EQ(sub->genTable(context).size(), 2U);
+  EXPECT_EQ(sub->genTable(context).size(), 0U);
+
+  // Queries that are not scheduled read every event and keep no time.
+  TablePlugin::kQueryName.clear();
+  EXPECT_EQ(sub->genTable(context).size(), 2U);
+  EXPECT_EQ(sub->optimize_times_.size(), 2U);
+  kToolType = default_type;
+}
+
+TEST_F(EventsDatabaseTests, test_gentable_generator) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeGeneratorSubscriber");
+  for (int t = 1; t <= 600; t++) {
+    sub->testAdd(t);
+  }
+
+  // Events are streamed in pages, starting at the 'time' constraint.
+  QueryContext context;
+  context.constraints["time"].add(Constraint(GREATER_THAN_OR_EQUALS, "100"));
+  TableColumns columns = {{"time", BIGINT_TYPE}, {"testing", TEXT_TYPE}};
+  auto generator = sub->generator(columns, context);
+  ASSERT_NE(generator, nullptr);
+
+  size_t batches = 0;
+  TableRows rows;
+  while (generator->next(rows)) {
+    batches++;
+  }
+  EXPECT_EQ(batches, 1U);
+  ASSERT_EQ(rows.size(), 501U);
+  EXPECT_EQ(boost::get<std::string>(rows[0][0]), "100");
+  EXPECT_EQ(boost::get<std::string>(rows[500][1]), "hello from space");
+
+  // Bounded selects stop at the end of the time range.
+  context.constraints["time"].add(Constraint(LESS_THAN, "110"));
+  rows.clear();
+  EXPECT_FALSE(sub->generator(columns, context)->next(rows));
+  EXPECT_EQ(rows.size(), 10U);
+}
+
+TEST_F(EventsDatabaseTests, test_gentable_namespace_prefix) {
+  // The second namespace extends the first, its keys sort within its range.
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakePrefixSubscriber");
+  auto other = std::make_shared<DBFakeEventSubscriber>();
+  other->setName("DBFakePrefixSubscriber.other");
+  sub->testAdd(1);
+  other->testAdd(2);
+  other->testAdd(3);
+
+  // A malformed key under the prefix is not read as an event.
+  setDatabaseValue(kEvents, "event." + sub->dbNamespace() + ".10.1", "");
+
+  EXPECT_EQ(sub->get(0, 0).size(), 1U);
+  EXPECT_EQ(other->get(0, 0).size(), 2U);
+
+  QueryContext context;
+  TableColumns columns = {{"time", BIGINT_TYPE}};
+  TableRows rows;
+  EXPECT_FALSE(sub->generator(columns, context)->next(rows));
+  ASSERT_EQ(rows.size(), 1U);
+  EXPECT_EQ(boost::get<std::string>(rows[0][0]), "1");
+}
+
+TEST_F(EventsDatabaseTests, test_gentable_descending) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeDescendingSubscriber");
+  for (int t = 1; t <= 600; t++) {
+    sub->testAdd(t);
+  }
+
+  // The latest events are read first, in batches bounded by the limit.
+  QueryContext context;
+  context.descending = true;
+  context.limit = 100;
+  TableColumns columns = {{"time", BIGINT_TYPE}, {"testing", TEXT_TYPE}};
+  TableRows rows;
+  EXPECT_TRUE(sub->generator(columns, context)->next(rows));
+  ASSERT_EQ(rows.size(), 100U);
+  EXPECT_EQ(boost::get<std::string>(rows[0][0]), "600");
+  EXPECT_EQ(boost::get<std::string>(rows[99][0]), "501");
+
+  // Without a limit every event in the time range is read, in order.
+  context.limit = 0;
+  context.constraints["time"].add(Constraint(LESS_THAN, "300"));
+  auto generator = sub->generator(columns, context);
+  rows.clear();
+  while (generator->next(rows)) {
+  }
+  ASSERT_EQ(rows.size(), 299U);
+  EXPECT_EQ(boost::get<std::string>(rows[0][0]), "299");
+  EXPECT_EQ(boost::get<std::string>(rows[298][0]), "1");
+
+  auto results = sub->genTable(context);
+  ASSERT_EQ(results.size(), 299U);
+  EXPECT_EQ(results[0]["time"], "299");
+}
+
+TEST_F(EventsDatabaseTests, test_event_segments) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeSegmentSubscriber");
+  auto now = getUnixTime();
+  for (size_t t = now - 1000; t < now - 950; t++) {
+    sub->testAdd(static_cast<int>(t));
+  }
+  for (size_t t = now - 50; t < now; t++) {
+    sub->testAdd(static_cast<int>(t));
+  }
+
+  // Events older than the cold age are compacted, the newest remain.
+  auto cold_age = FLAGS_events_cold_age;
+  FLAGS_events_cold_age = 500;
+  EXPECT_EQ(sub->compactEvents(), 50U);
+  EXPECT_EQ(sub->getRecords(0, 0).size(), 50U);
+  auto segment_prefix = "segment." + sub->dbNamespace() + ".";
+  std::vector<std::string> segments;
+  DBHandle::getInstance()->ScanPrefix(kEvents, segments, segment_prefix);
+  EXPECT_EQ(segments.size(), 1U);
+
+  // Compacted events are read in time order with the remaining events.
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(results.size(), 100U);
+  EXPECT_EQ(results[0]["time"], std::to_string(now - 1000));
+  EXPECT_EQ(results[99]["time"], std::to_string(now - 1));
+  EXPECT_EQ(results[0]["testing"], "hello from space");
+
+  results = sub->getEvents(now - 960, now - 41, true, 0);
+  ASSERT_EQ(results.size(), 20U);
+  EXPECT_EQ(results[0]["time"], std::to_string(now - 41));
+  EXPECT_EQ(results[10]["time"], std::to_string(now - 951));
+  EXPECT_EQ(results[19]["time"], std::to_string(now - 960));
+
+  // An aged event within the segment's times is merged into it.
+  sub->testAdd(static_cast<int>(now - 975));
+  EXPECT_EQ(sub->compactEvents(), 1U);
+  segments.clear();
+  DBHandle::getInstance()->ScanPrefix(kEvents, segments, segment_prefix);
+  EXPECT_EQ(segments.size(), 1U);
+
+  QueryContext context;
+  context.constraints["time"].add(
+      Constraint(LESS_THAN, std::to_string(now - 970)));
+  TableColumns columns = {{"time", BIGINT_TYPE}, {"testing", TEXT_TYPE}};
+  auto generator = sub->generator(columns, context);
+  TableRows rows;
+  while (generator->next(rows)) {
+  }
+  ASSERT_EQ(rows.size(), 31U);
+  EXPECT_EQ(boost::get<std::string>(rows[0][0]), std::to_string(now - 1000));
+  EXPECT_EQ(boost::get<std::string>(rows[26][0]), std::to_string(now - 975));
+  EXPECT_EQ(boost::get<std::string>(rows[30][0]), std::to_string(now - 971));
+
+  // Segments expire once their newest event expires.
+  sub->expire_time_ = static_cast<EventTime>(now - 40);
+  sub->expireRecords();
+  EXPECT_EQ(sub->get(0, 0).size(), 40U);
+  FLAGS_events_cold_age = cold_age;
+}
+
 TEST_F(EventsDatabaseTests, test_expire_check) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   // Set the max number of buffered events to something reasonably small.
+  auto expiry = FLAGS_events_expiry;
+  FLAGS_events_expiry = 0;
   FLAGS_events_max = 10;
   auto t = getUnixTime() - (10 * 1000);
 
-  // We are still at the mercy of the opaque EVENTS_CHECKPOINT define.
-  for (size_t x = 0; x < 3; x++) {
-    size_t num_events = 256 * x;
-    for (size_t i = 0; i < num_events; i++) {
-      sub->testAdd(t + i);
-    }
-
-    // Since events tests are dependent, expect 257 + 3 events.
-    QueryContext context;
-    auto results = sub->genTable(context);
-    if (x == 0) {
-      // The first iteration is dependent on previous test state.
-      continue;
-    }
-
-    // The number of events should remain constant.
-    // In practice there may be an event still in the write queue.
-    EXPECT_LT(results.size(), 60U);
+  for (size_t i = 0; i < 300; i++) {
+    sub->testAdd(t + i);
+  }
+
+  // Adding events does not expire, the buffer is trimmed in the background.
+  EXPECT_GT(sub->getRecords(0, 0).size(), 300U);
+  EXPECT_GT(sub->expireCheck(), 290U);
+  EXPECT_EQ(sub->getRecords(0, 0).size(), 10U);
+
+  // Nothing remains to expire.
+  EXPECT_EQ(sub->expireCheck(), 0U);
+  FLAGS_events_expiry = expiry;
+}
+
+TEST_F(EventsDatabaseTests, test_batched_add) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeBatchSubscriber");
+  auto batch_size = FLAGS_events_batch_size;
+  auto batch_latency = FLAGS_events_batch_latency;
+  FLAGS_events_batch_size = 4;
+  FLAGS_events_batch_latency = 60 * 1000;
+
+  auto prefix = "event." + sub->dbNamespace() + ".";
+  auto stored = [&prefix]() {
+    std::vector<std::string> keys;
+    DBHandle::getInstance()->ScanPrefix(kEvents, keys, prefix);
+    return keys.size();
+  };
+
+  // Events are staged until the batch size is reached.
+  for (int t = 1; t <= 3; t++) {
+    EXPECT_TRUE(sub->testAdd(t).ok());
+  }
+  EXPECT_EQ(stored(), 0U);
+  sub->testAdd(4);
+  EXPECT_EQ(stored(), 4U);
+
+  // Reads commit the staged events.
+  sub->testAdd(5);
+  EXPECT_EQ(stored(), 4U);
+  EXPECT_EQ(sub->getRecords(0, 0).size(), 5U);
+
+  // A latency of 0 commits every event.
+  FLAGS_events_batch_latency = 0;
+  sub->testAdd(6);
+  EXPECT_EQ(stored(), 6U);
+
+  FLAGS_events_batch_size = batch_size;
+  FLAGS_events_batch_latency = batch_latency;
+}
+
+TEST_F(EventsDatabaseTests, test_memory_store) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeMemorySubscriber");
+  auto events_max = FLAGS_events_max;
+  auto events_expiry = FLAGS_events_expiry;
+  FLAGS_events_max = 3;
+  FLAGS_events_expiry = 0;
+  sub->useMemoryStore();
+
+  // A late event is stored in order, a full store drops the oldest event.
+  sub->testAdd(10);
+  sub->testAdd(30);
+  sub->testAdd(20);
+  sub->testAdd(40);
+  EXPECT_EQ(sub->numExpired(), 1U);
+
+  auto results = sub->get(0, -1);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["time"], "20");
+  EXPECT_EQ(results[1]["time"], "30");
+  EXPECT_EQ(results[2]["time"], "40");
+
+  // Reads seek to the time range, and may read the latest events first.
+  EXPECT_EQ(sub->get(25, 35).size(), 1U);
+  results = sub->getEvents(0, -1, true, 2);
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["time"], "40");
+  EXPECT_EQ(results[1]["time"], "30");
+
+  // Nothing is written to the backing store.
+  std::vector<std::string> keys;
+  DBHandle::getInstance()->ScanPrefix(
+      kEvents, keys, "event." + sub->dbNamespace() + ".");
+  EXPECT_TRUE(keys.empty());
+
+  // Expiration applies to the events in memory.
+  sub->expire_time_ = 35;
+  EXPECT_EQ(sub->expireCheck(), 2U);
+  EXPECT_EQ(sub->get(0, -1).size(), 1U);
+  EXPECT_EQ(sub->numExpired(), 3U);
+
+  FLAGS_events_max = events_max;
+  FLAGS_events_expiry = events_expiry;
+}
+
+TEST_F(EventsDatabaseTests, test_migrate_events) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFakeMigrateSubscriber");
+
+  // Store events using the EventID and time-binned index layout.
+  auto ns = sub->dbNamespace();
+  for (const auto& time : {"5", "15"}) {
+    Row r = {{"time", time}, {"testing", "legacy"}};
+    std::string data;
+    serializeRowBinary(r, data);
+    setDatabaseValue(kEvents, "data." + ns + "." + time, data);
+  }
+  setDatabaseValue(kEvents, "records." + ns + ".10.0", "5:5");
+  setDatabaseValue(kEvents, "records." + ns + ".10.1", "15:15");
+  setDatabaseValue(kEvents, "indexes." + ns + ".10", "0,1");
+
+  sub->migrateEvents();
+  auto records = sub->getRecords(0, 0);
+  ASSERT_EQ(records.size(), 2U);
+  EXPECT_EQ(records[0].first, "5");
+  EXPECT_EQ(records[1].second, 15U);
+
+  auto results = sub->get(0, 10);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["testing"], "legacy");
+
+  // The legacy keys are removed.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys);
+  for (const auto& key : keys) {
+    EXPECT_EQ(key.find("data." + ns), std::string::npos);
+    EXPECT_EQ(key.find("records." + ns), std::string::npos);
+    EXPECT_EQ(key.find("indexes." + ns), std::string::npos);
   }
 }
 }
@@ -8,12 +8,20 @@
  *
  */
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
 #include <boost/filesystem/operations.hpp>
 
 #include <gtest/gtest.h>
 
 #include <osquery/config.h>
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -397,6 +405,184 @@ TEST_F(EventsTests, test_fire_event) {
   EXPECT_EQ(kBellHathTolled, 4);
 }
 
+/// Wait up to a second for a predicate set by a dispatch worker.
+static bool waitFor(const std::function<bool()>& predicate) {
+  for (size_t i = 0; i < 100 && !predicate(); i++) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+  return predicate();
+}
+
+TEST_F(EventsTests, test_dispatch_queue) {
+  boost::mutex order_lock;
+  std::vector<int> order;
+  std::atomic<bool> started{false}, release{false};
+  auto task = [&order_lock, &order](int id) {
+    boost::lock_guard<boost::mutex> lock(order_lock);
+    order.push_back(id);
+  };
+
+  for (const auto& policy : {DISPATCH_DROP_OLDEST, DISPATCH_DROP_NEWEST}) {
+    order.clear();
+    started = false;
+    release = false;
+    EventDispatchQueue queue("test", 2, policy, 1);
+
+    // Hold the single worker so following tasks are queued.
+    queue.push([&started, &release]() {
+      started = true;
+      while (!release) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+    });
+    ASSERT_TRUE(waitFor([&started]() { return started.load(); }));
+
+    EXPECT_TRUE(queue.push(std::bind(task, 1)));
+    EXPECT_TRUE(queue.push(std::bind(task, 2)));
+    EXPECT_EQ(queue.queued(), 2U);
+    // The queue is full.
+    EXPECT_EQ(queue.push(std::bind(task, 3)), policy == DISPATCH_DROP_OLDEST);
+    EXPECT_EQ(queue.dropped(), 1U);
+    EXPECT_EQ(queue.queued(), 2U);
+
+    release = true;
+    ASSERT_TRUE(waitFor([&order_lock, &order]() {
+      boost::lock_guard<boost::mutex> lock(order_lock);
+      return order.size() == 2;
+    }));
+    EXPECT_EQ(queue.queued(), 0U);
+    if (policy == DISPATCH_DROP_OLDEST) {
+      EXPECT_EQ(order, std::vector<int>({2, 3}));
+    } else {
+      EXPECT_EQ(order, std::vector<int>({1, 2}));
+    }
+
+    // A stopped queue drops every task.
+    queue.stop();
+    EXPECT_FALSE(queue.push(std::bind(task, 4)));
+    EXPECT_EQ(queue.dropped(), 2U);
+  }
+}
+
+class DispatchEventSubscriber : public FakeEventSubscriber {
+ public:
+  DispatchEventSubscriber() { setName("DispatchSubscriber"); }
+
+  Status init() override {
+    useDispatchQueue();
+    return Status(0);
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    callback_thread = boost::this_thread::get_id();
+    dispatched = true;
+    return Status(0, "OK");
+  }
+
+  void lateInit() {
+    auto sub_ctx = createSubscriptionContext();
+    subscribe(&DispatchEventSubscriber::Callback, sub_ctx);
+  }
+
+  std::atomic<bool> dispatched{false};
+  boost::thread::id callback_thread;
+};
+
+TEST_F(EventsTests, test_fire_event_dispatch) {
+  auto pub = std::make_shared<FakeEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<DispatchEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->lateInit();
+  pub->configure();
+
+  // The callback is called from the subscriber's dispatch worker.
+  auto ec = pub->createEventContext();
+  pub->fire(ec, 0);
+  EXPECT_TRUE(waitFor([&sub]() { return sub->dispatched.load(); }));
+  EXPECT_NE(sub->callback_thread, boost::this_thread::get_id());
+  EXPECT_EQ(sub->numDropped(), 0U);
+
+  // Queued callbacks record their duration and the time until stored.
+  EXPECT_TRUE(waitFor([&sub]() {
+    double rate = 0;
+    Histogram stored;
+    sub->storeMetrics().merge(rate, stored);
+    return stored.count() == 1;
+  }));
+  double rate = 0;
+  Histogram callbacks;
+  sub->callbackMetrics().merge(rate, callbacks);
+  EXPECT_EQ(callbacks.count(), 1U);
+
+  Histogram dispatches;
+  pub->fireMetrics().merge(rate, dispatches);
+  EXPECT_EQ(dispatches.count(), 1U);
+}
+
+struct PooledEventContext : public EventContext {
+  std::string path;
+  size_t clears{0};
+
+  void clear() {
+    path.clear();
+    clears++;
+  }
+};
+
+TEST_F(EventsTests, test_event_context_pool) {
+  auto ec = EventContextPool<PooledEventContext>::create();
+  ec->id = 1;
+  ec->path = std::string(128, 'a');
+  auto pooled = ec.get();
+
+  // A context is not reused while it is referenced.
+  auto other = EventContextPool<PooledEventContext>::create();
+  EXPECT_NE(other.get(), pooled);
+
+  // Released contexts are cleared and keep their buffers.
+  ec.reset();
+  auto reused = EventContextPool<PooledEventContext>::create();
+  ASSERT_EQ(reused.get(), pooled);
+  EXPECT_EQ(reused->id, 0U);
+  EXPECT_EQ(reused->clears, 1U);
+  EXPECT_TRUE(reused->path.empty());
+  EXPECT_GE(reused->path.capacity(), 128U);
+
+  // Contexts without a clear method are always allocated.
+  EXPECT_TRUE(IsRecyclableContext<PooledEventContext>::value);
+  EXPECT_FALSE(IsRecyclableContext<EventContext>::value);
+  EXPECT_EQ(EventContextPool<EventContext>::create().use_count(), 1);
+}
+
+TEST_F(EventsTests, test_event_metrics) {
+  EventMetrics metrics;
+  double rate = 1;
+  Histogram durations;
+  metrics.merge(rate, durations);
+  EXPECT_EQ(rate, 0);
+  EXPECT_EQ(durations.count(), 0U);
+
+  // Each thread records into a shard, the reader merges every shard.
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 16; i++) {
+    threads.emplace_back([&metrics, i]() {
+      for (uint64_t j = 1; j <= 100; j++) {
+        metrics.record(j * (i + 1));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  metrics.merge(rate, durations);
+  EXPECT_EQ(durations.count(), 1600U);
+  EXPECT_EQ(durations.max(), 1600U);
+  EXPECT_GT(durations.percentile(99), durations.percentile(50));
+}
+
 class SubFakeEventSubscriber : public FakeEventSubscriber {
  public:
   SubFakeEventSubscriber() { setName("SubFakeSubscriber"); }
@@ -437,4 +623,148 @@ TEST_F(EventsTests, test_event_toggle_subscribers) {
   EventFactory::registerEventSubscriber(sub);
   EXPECT_EQ(sub->state(), SUBSCRIBER_PAUSED);
 }
+
+class DescriptorEventPublisher
+    : public EventPublisher<FakeSubscriptionContext, FakeEventContext> {
+  DECLARE_PUBLISHER("DescriptorPublisher");
+
+ public:
+  Status setUp() override {
+    if (::pipe2(fds_, O_NONBLOCK | O_CLOEXEC) != 0) {
+      return Status(1, "Cannot create pipe");
+    }
+    return Status(0, "OK");
+  }
+
+  void tearDown() override {
+    ::close(fds_[0]);
+    ::close(fds_[1]);
+    torn_down = true;
+  }
+
+  int getDescriptor() const override { return fds_[0]; }
+
+  Status ready() override {
+    char byte = 0;
+    while (::read(fds_[0], &byte, 1) == 1) {
+      reads++;
+    }
+    return Status(0, "OK");
+  }
+
+  void write(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(::write(fds_[1], "1", 1), 1);
+    }
+  }
+
+  bool waitForReads(size_t count) {
+    for (size_t delay = 0; reads < count && delay < 3000; delay += 10) {
+      ::usleep(10 * 1000);
+    }
+    return reads == count;
+  }
+
+  std::atomic<size_t> reads{0};
+  std::atomic<bool> torn_down{false};
+
+ private:
+  int fds_[2];
+};
+
+TEST_F(EventsTests, test_event_reactor) {
+  auto pub = std::make_shared<DescriptorEventPublisher>();
+  ASSERT_TRUE(pub->setUp().ok());
+
+  // A write before the reactor started is read without a new edge.
+  pub->write(1);
+  int epoll = ::epoll_create1(EPOLL_CLOEXEC);
+  ASSERT_GE(epoll, 0);
+  pub->hasStarted(true);
+  auto base_pub = std::static_pointer_cast<EventPublisherPlugin>(pub);
+  std::vector<EventPublisherRef> publishers = {
+      std::static_pointer_cast<BaseEventPublisher>(base_pub)};
+  boost::thread reactor(EventFactory::runReactor, epoll, publishers);
+  EXPECT_TRUE(pub->waitForReads(1));
+
+  pub->write(3);
+  EXPECT_TRUE(pub->waitForReads(4));
+
+  // An ending publisher is torn down and the reactor returns.
+  pub->isEnding(true);
+  reactor.join();
+  EXPECT_TRUE(pub->torn_down);
+}
+
+DECLARE_uint64(events_coalesce_window);
+
+class CoalescingEventPublisher
+    : public EventPublisher<FakeSubscriptionContext, FakeEventContext> {
+  DECLARE_PUBLISHER("CoalescingPublisher");
+
+ public:
+  std::string coalesceKey(const EventContextRef& ec) const override {
+    auto value = getEventContext(ec)->required_value;
+    return (value == 0) ? "" : std::to_string(value);
+  }
+
+  void fireValue(int value) {
+    auto ec = createEventContext();
+    ec->required_value = value;
+    fire(ec);
+  }
+};
+
+class CoalescingEventSubscriber
+    : public EventSubscriber<CoalescingEventPublisher> {
+ public:
+  CoalescingEventSubscriber() { setName("CoalescingSubscriber"); }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    counts.push_back(std::make_pair(ec->required_value, ec->count));
+    return Status(0, "OK");
+  }
+
+  std::vector<std::pair<int, size_t>> counts;
+};
+
+TEST_F(EventsTests, test_coalesce_events) {
+  auto pub = std::make_shared<CoalescingEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<CoalescingEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  auto subscription = Subscription::create("CoalescingSubscriber");
+  subscription->callback = [&sub](const EventContextRef& ec,
+                                  const SubscriptionContextRef& sc) {
+    return sub->Callback(std::static_pointer_cast<FakeEventContext>(ec),
+                         nullptr);
+  };
+  EventFactory::addSubscription("CoalescingPublisher", subscription);
+
+  auto window = FLAGS_events_coalesce_window;
+  FLAGS_events_coalesce_window = 60 * 1000;
+  pub->fireValue(1);
+  pub->fireValue(2);
+  pub->fireValue(1);
+  pub->fireValue(1);
+
+  // Events without a key fire immediately.
+  pub->fireValue(0);
+  ASSERT_EQ(sub->counts.size(), 1U);
+  EXPECT_EQ(sub->counts[0].first, 0);
+
+  // Held events fire once the window ends, in the order first seen.
+  pub->fireCoalesced(false);
+  EXPECT_EQ(sub->counts.size(), 1U);
+  pub->fireCoalesced(true);
+  ASSERT_EQ(sub->counts.size(), 3U);
+  EXPECT_EQ(sub->counts[1], std::make_pair(1, size_t(3)));
+  EXPECT_EQ(sub->counts[2], std::make_pair(2, size_t(1)));
+
+  // Without a window every event fires immediately.
+  FLAGS_events_coalesce_window = 0;
+  pub->fireValue(1);
+  EXPECT_EQ(sub->counts.size(), 4U);
+  FLAGS_events_coalesce_window = window;
+}
 }
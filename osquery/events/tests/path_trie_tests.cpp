@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/path_trie.h"
+
+namespace osquery {
+
+class SubscriptionPathTrieTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    for (const auto& path : paths_) {
+      auto subscription = Subscription::create(path);
+      trie_.insert(path, subscription);
+    }
+    trie_.setComplete();
+  }
+
+  /// The names of the subscriptions matching a path, sorted.
+  std::vector<std::string> match(const std::string& path) {
+    SubscriptionVector matches;
+    EXPECT_TRUE(trie_.match(path, matches));
+    std::vector<std::string> names;
+    for (const auto& subscription : matches) {
+      names.push_back(subscription->subscriber_name);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  std::vector<std::string> paths_ = {
+      "/etc/", "/etc/pass*", "/home/*/.ssh/", "/Users/", "/tmp/[ab]/file"};
+
+  SubscriptionPathTrie trie_;
+};
+
+TEST_F(SubscriptionPathTrieTests, test_match) {
+  std::vector<std::string> etc = {"/etc/", "/etc/pass*"};
+  EXPECT_EQ(match("/etc/passwd"), etc);
+  EXPECT_EQ(match("/etc/hosts"), std::vector<std::string>{"/etc/"});
+  EXPECT_EQ(match("/etc/"), std::vector<std::string>{"/etc/"});
+  EXPECT_TRUE(match("/etc").empty());
+  EXPECT_TRUE(match("/var/etc/passwd").empty());
+
+  // Paths are matched by the prefix before a wildcard, ignoring case.
+  EXPECT_EQ(match("/home/user/.ssh/authorized_keys"),
+            std::vector<std::string>{"/home/*/.ssh/"});
+  EXPECT_EQ(match("/users/admin/.bashrc"), std::vector<std::string>{"/Users/"});
+  EXPECT_EQ(match("/tmp/a/file"), std::vector<std::string>{"/tmp/[ab]/file"});
+  EXPECT_EQ(match("/tmp/c"), std::vector<std::string>{"/tmp/[ab]/file"});
+}
+
+TEST_F(SubscriptionPathTrieTests, test_incomplete) {
+  SubscriptionVector matches;
+  trie_.clear();
+  EXPECT_FALSE(trie_.match("/etc/passwd", matches));
+
+  trie_.insert("/etc/", Subscription::create("/etc/"));
+  EXPECT_FALSE(trie_.match("/etc/passwd", matches));
+  trie_.setComplete();
+  EXPECT_TRUE(trie_.match("/etc/passwd", matches));
+  EXPECT_EQ(matches.size(), 1U);
+}
+}
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/segment.h"
+
+namespace osquery {
+
+class EventSegmentTests : public testing::Test {};
+
+TEST_F(EventSegmentTests, test_segment_round_trip) {
+  QueryData rows;
+  for (size_t i = 0; i < 1000; i++) {
+    Row r;
+    r["time"] = std::to_string(1500000000 + i / 3);
+    r["pid"] = std::to_string(i % 7);
+    r["path"] = (i % 2 == 0) ? "/usr/bin/even" : "/usr/bin/odd";
+    if (i % 10 == 0) {
+      // Columns missing from some rows remain missing.
+      r["extra"] = "-1";
+    }
+    rows.push_back(r);
+  }
+
+  std::string data;
+  ASSERT_TRUE(encodeEventSegment(rows, data).ok());
+
+  // Repeated values and small time deltas are much smaller than the rows.
+  size_t size = 0;
+  for (const auto& row : rows) {
+    for (const auto& column : row) {
+      size += column.first.size() + column.second.size();
+    }
+  }
+  EXPECT_LT(data.size(), size / 4);
+
+  QueryData decoded;
+  ASSERT_TRUE(decodeEventSegment(data, decoded).ok());
+  EXPECT_EQ(decoded, rows);
+}
+
+TEST_F(EventSegmentTests, test_segment_integers) {
+  // Integers that do not print identically are kept as text.
+  QueryData rows = {
+      {{"time", "-5"}, {"value", "007"}},
+      {{"time", "9223372036854775807"}, {"value", "8"}},
+      {{"time", "-9223372036854775808"}, {"value", ""}},
+  };
+
+  std::string data;
+  ASSERT_TRUE(encodeEventSegment(rows, data).ok());
+  QueryData decoded = {{{"first", "row"}}};
+  ASSERT_TRUE(decodeEventSegment(data, decoded).ok());
+  ASSERT_EQ(decoded.size(), 4U);
+  EXPECT_EQ(decoded[0].at("first"), "row");
+  EXPECT_EQ(QueryData(decoded.begin() + 1, decoded.end()), rows);
+}
+
+TEST_F(EventSegmentTests, test_segment_malformed) {
+  QueryData rows = {{{"time", "1"}}, {{"time", "2"}}};
+  std::string data;
+  ASSERT_TRUE(encodeEventSegment(rows, data).ok());
+
+  QueryData decoded;
+  EXPECT_FALSE(decodeEventSegment("", decoded).ok());
+  EXPECT_FALSE(decodeEventSegment(std::string(1, 2) + data.substr(1), decoded)
+                   .ok());
+  EXPECT_FALSE(decodeEventSegment(data.substr(0, data.size() - 1), decoded)
+                   .ok());
+  EXPECT_TRUE(decoded.empty());
+}
+}
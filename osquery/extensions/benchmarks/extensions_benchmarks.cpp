@@ -0,0 +1,212 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <map>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/extensions.h>
+#include <osquery/filesystem.h>
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/extensions/interface.h"
+
+namespace osquery {
+
+/// A table generating Rows rows of a text and an integer column.
+template <size_t Rows>
+class BenchmarkRowsTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"test_int", BIGINT_TYPE}, {"test_text", TEXT_TYPE}};
+  }
+
+  void generateRows(QueryContext& context, TableRows& rows) {
+    rows.reserve(Rows);
+    for (size_t i = 0; i < Rows; i++) {
+      rows.push_back({static_cast<long long int>(i), std::string("hello")});
+    }
+  }
+};
+
+/// Start the manager and an extension serving each protocol, once.
+static const std::string& getBenchmarkExtension(const std::string& protocol) {
+  static std::map<std::string, std::string> sockets;
+  if (sockets.count(protocol) > 0) {
+    return sockets[protocol];
+  }
+
+  static std::string manager;
+  if (manager.empty()) {
+    manager = kTestWorkingDirectory + "benchmark.em";
+    remove(manager);
+    startExtensionManager(manager);
+    // Calls by extension UUID use the benchmark manager's sockets.
+    FLAGS_extensions_socket = manager;
+    Registry::add<BenchmarkRowsTablePlugin<1>>("table", "benchmark_1");
+    Registry::add<BenchmarkRowsTablePlugin<1000>>("table", "benchmark_1000");
+    Registry::add<BenchmarkRowsTablePlugin<100000>>("table",
+                                                    "benchmark_100000");
+    // Extensions broadcast the alias, which is not a local item of the core.
+    Registry::addAlias("table", "benchmark_1000", "benchmark_external");
+    Registry::allowDuplicates(true);
+    ::usleep(100000);
+  }
+
+  // The extension prefers, and the manager accepts, the flag's protocol.
+  FLAGS_extensions_protocol = protocol;
+  auto status = startExtension(
+      manager, "benchmark_" + protocol, "0.1", "0.0.0", "0.0.1");
+  auto uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+  sockets[protocol] = getExtensionSocket(uuid, manager);
+  ::usleep(100000);
+  return sockets[protocol];
+}
+
+/// Generate an extension table of range_y rows with protocol range_x.
+static void EXTENSIONS_generate_table(benchmark::State& state) {
+  auto protocol = (state.range_x() == 0) ? kExtensionProtocolBinary
+                                         : kExtensionProtocolCompact;
+  const auto& path = getBenchmarkExtension(protocol);
+  auto table = "benchmark_" + std::to_string(state.range_y());
+  TableColumns columns = {{"test_int", BIGINT_TYPE}, {"test_text", TEXT_TYPE}};
+  while (state.KeepRunning()) {
+    TableRows rows;
+    generateExtensionTable(
+        path, table, {{"action", "generate"}}, columns, rows);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_y());
+}
+
+BENCHMARK(EXTENSIONS_generate_table)
+    ->ArgPair(0, 1)
+    ->ArgPair(1, 1)
+    ->ArgPair(0, 1000)
+    ->ArgPair(1, 1000)
+    ->ArgPair(0, 100000)
+    ->ArgPair(1, 100000);
+
+/// Ping an extension with protocol range_x over a pooled connection.
+static void EXTENSIONS_ping(benchmark::State& state) {
+  auto protocol = (state.range_x() == 0) ? kExtensionProtocolBinary
+                                         : kExtensionProtocolCompact;
+  const auto& path = getBenchmarkExtension(protocol);
+  while (state.KeepRunning()) {
+    pingExtension(path);
+  }
+}
+
+BENCHMARK(EXTENSIONS_ping)->Arg(0)->Arg(1);
+
+/// Connect a new client and ping, the cost of an unpooled call.
+static void EXTENSIONS_client_connect(benchmark::State& state) {
+  auto protocol = (state.range_x() == 0) ? kExtensionProtocolBinary
+                                         : kExtensionProtocolCompact;
+  const auto& path = getBenchmarkExtension(protocol);
+  while (state.KeepRunning()) {
+    EXClient client(path, protocol);
+    ExtensionStatus status;
+    client.get()->ping(status);
+  }
+}
+
+BENCHMARK(EXTENSIONS_client_connect)->Arg(0)->Arg(1);
+
+/// Call a table of range_x rows through the handler without a transport.
+static void EXTENSIONS_handler_call(benchmark::State& state) {
+  getBenchmarkExtension(kExtensionProtocolBinary);
+  auto table = "benchmark_" + std::to_string(state.range_x());
+  ExtensionHandler handler;
+  while (state.KeepRunning()) {
+    ExtensionResponse response;
+    handler.call(response, "table", table, {{"action", "generate"}});
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+BENCHMARK(EXTENSIONS_handler_call)->Arg(1)->Arg(1000)->Arg(100000);
+
+/// Serialize a call response of range_y rows with protocol range_x.
+static void EXTENSIONS_serialize_response(benchmark::State& state) {
+  ExtensionResponse response;
+  for (long long i = 0; i < state.range_y(); i++) {
+    response.response.push_back(
+        {{"test_int", std::to_string(i)}, {"test_text", "hello"}});
+  }
+
+  TMemoryBufferRef buffer(new TMemoryBuffer());
+  auto protocol = makeExtensionProtocol(buffer,
+                                        (state.range_x() == 0)
+                                            ? kExtensionProtocolBinary
+                                            : kExtensionProtocolCompact);
+  while (state.KeepRunning()) {
+    buffer->resetBuffer();
+    response.write(protocol.get());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer->available_read());
+  state.SetItemsProcessed(state.iterations() * state.range_y());
+}
+
+BENCHMARK(EXTENSIONS_serialize_response)
+    ->ArgPair(0, 1)
+    ->ArgPair(1, 1)
+    ->ArgPair(0, 1000)
+    ->ArgPair(1, 1000)
+    ->ArgPair(0, 100000)
+    ->ArgPair(1, 100000);
+
+/**
+ * @brief Call an external table through the core's registry.
+ *
+ * The registry routes the broadcasted alias to the most recently registered
+ * benchmark extension, whose handler resolves it to a local table.
+ */
+static void EXTENSIONS_registry_call_external(benchmark::State& state) {
+  getBenchmarkExtension(kExtensionProtocolBinary);
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    Registry::call(
+        "table", "benchmark_external", {{"action", "generate"}}, response);
+  }
+  state.SetItemsProcessed(state.iterations() * 1000);
+}
+
+BENCHMARK(EXTENSIONS_registry_call_external);
+
+/// Add and remove the broadcast of an extension with range_x tables.
+static void EXTENSIONS_broadcast(benchmark::State& state) {
+  // Tables are attached to, and detached from, the SQL database.
+  PluginResponse columns = {{{"name", "test_int"}, {"type", "BIGINT"}},
+                            {{"name", "test_text"}, {"type", "TEXT"}}};
+  RegistryBroadcast broadcast;
+  for (long long i = 0; i < state.range_x(); i++) {
+    broadcast["table"]["benchmark_broadcast_" + std::to_string(i)] = columns;
+  }
+
+  // The UUID is not registered with the manager, no socket is needed.
+  RouteUUID uuid = 1;
+  while (!Registry::addBroadcast(uuid, {}).ok()) {
+    uuid++;
+  }
+  Registry::removeBroadcast(uuid);
+
+  while (state.KeepRunning()) {
+    Registry::addBroadcast(uuid, broadcast);
+    Registry::removeBroadcast(uuid);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+BENCHMARK(EXTENSIONS_broadcast)->Arg(1)->Arg(10)->Arg(100);
+}
@@ -8,7 +8,16 @@
  *
  */
 
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <thread>
 
 #include <boost/algorithm/string/trim.hpp>
 
@@ -30,6 +39,9 @@ namespace osquery {
 // Millisecond latency between initalizing manager pings.
 const size_t kExtensionInitializeLatencyUS = 20000;
 
+/// Rows fetched from a manager's query cursor at once.
+const int64_t kExternalQueryRows = 1024;
+
 #ifdef __APPLE__
 const std::string kModuleExtension = ".dylib";
 #else
@@ -58,6 +70,36 @@ CLI_FLAG(string,
          "3",
          "Seconds delay between connectivity checks")
 
+CLI_FLAG(string,
+         extensions_server,
+         "pool",
+         "Extension API server model: pool or threaded");
+
+CLI_FLAG(uint64,
+         extensions_server_threads,
+         8,
+         "Worker threads of the pool extension API server");
+
+CLI_FLAG(string,
+         extensions_protocol,
+         "compact",
+         "Preferred extension API protocol: compact or binary");
+
+CLI_FLAG(uint64,
+         extensions_buffer_size,
+         65536,
+         "Bytes buffered by each extension API connection");
+
+CLI_FLAG(uint64,
+         extensions_shared_memory,
+         0,
+         "MB of shared memory for each extension table response, 0 disables");
+
+CLI_FLAG(uint64,
+         extensions_cursor_timeout,
+         60,
+         "Seconds an unused extension API query cursor stays open");
+
 CLI_FLAG(string,
          modules_autoload,
          "/etc/osquery/modules.load",
@@ -125,19 +167,24 @@ void ExtensionManagerWatcher::watch() {
   // will be deregistered.
   const auto uuids = Registry::routeUUIDs();
 
+  auto& pool = ExtensionClientPool::instance();
   ExtensionStatus status;
   for (const auto& uuid : uuids) {
+    auto path = getExtensionSocket(uuid);
     try {
-      auto client = EXClient(getExtensionSocket(uuid));
-      // Ping the extension until it goes down.
-      client.get()->ping(status);
+      // Ping the extension until it goes down, this checks a pooled
+      // connection or replaces a closed one.
+      callPooledExtension(
+          path, [&status](ExtensionClient& client) { client.ping(status); });
     } catch (const std::exception& e) {
+      pool.remove(path);
       failures_[uuid] += 1;
       continue;
     }
 
     if (status.code != ExtensionCode::EXT_SUCCESS) {
       LOG(INFO) << "Extension UUID " << uuid << " ping failed";
+      pool.remove(path);
       failures_[uuid] += 1;
     } else {
       failures_[uuid] = 0;
@@ -148,6 +195,7 @@ void ExtensionManagerWatcher::watch() {
     if (uuid.second >= 3) {
       LOG(INFO) << "Extension UUID " << uuid.first << " has gone away";
       Registry::removeBroadcast(uuid.first);
+      pool.remove(getExtensionSocket(uuid.first));
       failures_[uuid.first] = 0;
     }
   }
@@ -242,15 +290,67 @@ Status loadModules(const std::string& loadfile) {
   return Status(1, "Failed reading: " + loadfile);
 }
 
+bool waitForExtensionPath(const std::string& path, size_t timeout_ms) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  int watch = -1;
+#if defined(__linux__)
+  // The watch is added before the first check, so a socket created between
+  // the check and the wait still wakes the waiter.
+  auto directory = fs::path(path).parent_path().string();
+  watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch >= 0 &&
+      inotify_add_watch(watch,
+                        (directory.empty()) ? "." : directory.c_str(),
+                        IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0) {
+    ::close(watch);
+    watch = -1;
+  }
+#endif
+
+  bool exists = false;
+  while (!(exists = pathExists(path).ok())) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      break;
+    }
+    // Round up so a wait under a millisecond does not spin.
+    auto remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+            .count() +
+        1;
+#if defined(__linux__)
+    if (watch >= 0) {
+      struct pollfd event = {watch, POLLIN, 0};
+      if (::poll(&event, 1, static_cast<int>(remaining)) > 0) {
+        char events[4096];
+        while (::read(watch, events, sizeof(events)) > 0) {
+        }
+      }
+      continue;
+    }
+#endif
+    std::this_thread::sleep_for(std::min<std::chrono::microseconds>(
+        std::chrono::milliseconds(remaining),
+        std::chrono::microseconds(kExtensionInitializeLatencyUS)));
+  }
+
+  if (watch >= 0) {
+    ::close(watch);
+  }
+  return exists;
+}
+
 Status extensionPathActive(const std::string& path, bool use_timeout = false) {
   // Make sure the extension manager path exists, and is writable.
-  size_t delay = 0;
   // The timeout is given in seconds, but checked interval is microseconds.
   size_t timeout = atoi(FLAGS_extensions_timeout.c_str()) * 1000000;
   if (timeout < kExtensionInitializeLatencyUS * 10) {
     timeout = kExtensionInitializeLatencyUS * 10;
   }
-  do {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::microseconds(timeout);
+  while (true) {
     if (pathExists(path) && isWritable(path)) {
       try {
         auto client = EXManagerClient(path);
@@ -260,13 +360,22 @@ Status extensionPathActive(const std::string& path, bool use_timeout = false) {
       }
     }
     // Only check active once if this check does not allow a timeout.
-    if (!use_timeout || timeout == 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (!use_timeout || now >= deadline) {
       break;
     }
-    // Increase the total wait detail.
-    delay += kExtensionInitializeLatencyUS;
-    ::usleep(kExtensionInitializeLatencyUS);
-  } while (delay < timeout);
+
+    if (!pathExists(path).ok()) {
+      // Sleep until the manager or extension creates its socket.
+      waitForExtensionPath(
+          path,
+          std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+              .count());
+    } else {
+      // The socket is created before its server accepts, retry shortly.
+      ::usleep(kExtensionInitializeLatencyUS);
+    }
+  }
   return Status(1, "Extension socket not available: " + path);
 }
 
@@ -325,6 +434,11 @@ Status startExtension(const std::string& manager_path,
   info.version = version;
   info.sdk_version = sdk_version;
   info.min_sdk_version = min_sdk_version;
+  // This SDK serves table generate calls as typed columns.
+  info.columnar_tables = true;
+  info.shared_tables = true;
+  info.server_threads = static_cast<int32_t>(extensionServerThreads());
+  info.protocol = FLAGS_extensions_protocol;
 
   // If registration is successful, we will also request the manager's options.
   InternalOptionList options;
@@ -360,9 +474,12 @@ Status startExtension(const std::string& manager_path,
   // Set up all lazy registry plugins and the active config/logger plugin.
   Registry::setUp();
 
-  // Start the extension's Thrift server
-  Dispatcher::addService(
-      std::make_shared<ExtensionRunner>(manager_path, ext_status.uuid));
+  // Start the extension's Thrift server, a core that did not choose a
+  // protocol only speaks binary.
+  auto protocol = (ext_status.protocol.empty()) ? kExtensionProtocolBinary
+                                                : ext_status.protocol;
+  Dispatcher::addService(std::make_shared<ExtensionRunner>(
+      manager_path, ext_status.uuid, protocol));
   VLOG(1) << "Extension (" << name << ", " << ext_status.uuid << ", " << version
           << ", " << sdk_version << ") registered";
   return Status(0, std::to_string(ext_status.uuid));
@@ -396,6 +513,63 @@ Status queryExternal(const std::string& query, QueryData& results) {
   return queryExternal(FLAGS_extensions_socket, query, results);
 }
 
+Status queryExternal(const std::string& manager_path,
+                     const std::string& query,
+                     const RowCallback& callback) {
+  auto status = extensionPathActive(manager_path);
+  if (!status.ok()) {
+    return status;
+  }
+
+  ExtensionQueryResponse response;
+  try {
+    auto client = EXManagerClient(manager_path);
+    try {
+      client.get()->openQuery(response, query, kExternalQueryRows);
+    } catch (const TApplicationException& e) {
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        throw;
+      }
+      // Managers without cursors answer with the complete results.
+      QueryData results;
+      status = queryExternal(manager_path, query, results);
+      for (auto& row : results) {
+        if (!status.ok() || !callback(row)) {
+          break;
+        }
+      }
+      return status;
+    }
+
+    while (response.status.code == ExtensionCode::EXT_SUCCESS) {
+      for (auto& external : response.response) {
+        Row row(external.begin(), external.end());
+        if (!callback(row)) {
+          if (!response.done) {
+            ExtensionStatus closed;
+            client.get()->closeQuery(closed, response.cursor);
+          }
+          return Status(0, "OK");
+        }
+      }
+      if (response.done) {
+        break;
+      }
+
+      auto cursor = response.cursor;
+      response = ExtensionQueryResponse();
+      client.get()->fetchQuery(response, cursor, kExternalQueryRows);
+    }
+  } catch (const std::exception& e) {
+    return Status(1, "Extension call failed: " + std::string(e.what()));
+  }
+  return Status(response.status.code, response.status.message);
+}
+
+Status queryExternal(const std::string& query, const RowCallback& callback) {
+  return queryExternal(FLAGS_extensions_socket, query, callback);
+}
+
 Status getQueryColumnsExternal(const std::string& manager_path,
                                const std::string& query,
                                TableColumns& columns) {
@@ -441,8 +615,9 @@ Status pingExtension(const std::string& path) {
 
   ExtensionStatus ext_status;
   try {
-    auto client = EXClient(path);
-    client.get()->ping(ext_status);
+    callPooledExtension(path, [&ext_status](ExtensionClient& client) {
+      client.ping(ext_status);
+    });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
@@ -474,14 +649,17 @@ Status getExtensions(const std::string& manager_path,
   }
 
   // Add the extension manager to the list called (core).
-  extensions[0] = {"core", kVersion, "0.0.0", kSDKVersion};
+  extensions[0] = {
+      "core", kVersion, "0.0.0", kSDKVersion, extensionServerThreads()};
 
   // Convert from Thrift-internal list type to RouteUUID/ExtenionInfo type.
   for (const auto& ext : ext_list) {
     extensions[ext.first] = {ext.second.name,
                              ext.second.version,
                              ext.second.min_sdk_version,
-                             ext.second.sdk_version};
+                             ext.second.sdk_version,
+                             static_cast<size_t>(
+                                 std::max(ext.second.server_threads, 0))};
   }
 
   return Status(0, "OK");
@@ -512,8 +690,10 @@ Status callExtension(const std::string& extension_path,
 
   ExtensionResponse ext_response;
   try {
-    auto client = EXClient(extension_path);
-    client.get()->call(ext_response, registry, item, request);
+    callPooledExtension(extension_path, [&](ExtensionClient& client) {
+      ext_response = ExtensionResponse();
+      client.call(ext_response, registry, item, request);
+    });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
@@ -527,6 +707,186 @@ Status callExtension(const std::string& extension_path,
   return Status(ext_response.status.code, ext_response.status.message);
 }
 
+/// Read the typed columns of a table response into column-ordered rows.
+static void setRowsFromResponse(const TableColumns& columns,
+                                ExtensionTableResponse& response,
+                                TableRows& rows) {
+  auto count = static_cast<size_t>(std::max<int64_t>(response.rows, 0));
+  auto first = rows.size();
+  rows.resize(first + count, TableRow(columns.size(), std::string()));
+
+  for (size_t i = 0; i < response.columns.size(); ++i) {
+    // Responses list columns by name, the local definition sets the order.
+    auto ordinal = std::find_if(
+        columns.begin(),
+        columns.end(),
+        [&response, i](const std::pair<std::string, ColumnType>& column) {
+          return column.first == response.columns[i];
+        });
+    if (ordinal == columns.end() || i >= response.values.size()) {
+      continue;
+    }
+
+    auto index = static_cast<size_t>(ordinal - columns.begin());
+    auto& column = response.values[i];
+    for (size_t row = 0; row < count; ++row) {
+      auto& cell = rows[first + row][index];
+      if (column.type == ExtensionColumnType::EXT_COLUMN_INTEGER) {
+        if (row < column.integer_values.size()) {
+          cell = static_cast<long long int>(column.integer_values[row]);
+        }
+      } else if (column.type == ExtensionColumnType::EXT_COLUMN_DOUBLE) {
+        if (row < column.double_values.size()) {
+          cell = column.double_values[row];
+        }
+      } else if (row < column.text_values.size()) {
+        cell = std::move(column.text_values[row]);
+      }
+    }
+  }
+}
+
+Status generateExtensionTable(const RouteUUID uuid,
+                              const std::string& item,
+                              const PluginRequest& request,
+                              const TableColumns& columns,
+                              TableRows& rows) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+
+  if (!isColumnarExtension(uuid)) {
+    // Extensions built with an older SDK only return Row maps.
+    QueryData data;
+    auto status = callExtension(uuid, "table", item, request, data);
+    TablePlugin::setRowsFromQueryData(columns, data, rows);
+    return status;
+  }
+
+  auto path = getExtensionSocket(uuid);
+  if (FLAGS_extensions_shared_memory > 0 && isSharedExtension(uuid)) {
+    auto first = rows.size();
+    auto status = generateSharedExtensionTable(
+        path,
+        item,
+        request,
+        columns,
+        FLAGS_extensions_shared_memory * 1024 * 1024,
+        rows);
+    if (status.ok()) {
+      return status;
+    }
+    // The rows are sent over the socket if the ring could not be used.
+    VLOG(1) << "Shared memory table response failed: " << status.getMessage();
+    rows.resize(first);
+  }
+  return generateExtensionTable(path, item, request, columns, rows);
+}
+
+Status generateExtensionTable(const std::string& extension_path,
+                              const std::string& item,
+                              const PluginRequest& request,
+                              const TableColumns& columns,
+                              TableRows& rows) {
+  // Make sure the extension path exists, and is writable.
+  auto status = extensionPathActive(extension_path);
+  if (!status.ok()) {
+    return status;
+  }
+
+  ExtensionTableResponse ext_response;
+  try {
+    callPooledExtension(extension_path, [&](ExtensionClient& client) {
+      ext_response = ExtensionTableResponse();
+      client.generate(ext_response, item, request);
+    });
+  } catch (const std::exception& e) {
+    return Status(1, "Extension call failed: " + std::string(e.what()));
+  }
+
+  if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
+    setRowsFromResponse(columns, ext_response, rows);
+  }
+  return Status(ext_response.status.code, ext_response.status.message);
+}
+
+/// Read the segments of a shared response from its ring.
+static Status readSharedSegments(const SharedRegion& ring,
+                                 const ExtensionSharedResponse& response,
+                                 const TableColumns& columns,
+                                 TableRows& rows) {
+  for (const auto& segment : response.segments) {
+    if (segment.offset < 0 || segment.length <= 0 ||
+        static_cast<size_t>(segment.offset + segment.length) > ring.size()) {
+      return Status(1, "Invalid shared memory segment");
+    }
+
+    // The buffer observes the ring, each batch is decoded in place.
+    TMemoryBufferRef buffer(new TMemoryBuffer(
+        ring.data() + segment.offset, static_cast<uint32_t>(segment.length)));
+    TBinaryProtocol protocol(buffer);
+    ExtensionTableResponse batch;
+    try {
+      batch.read(&protocol);
+    } catch (const std::exception& e) {
+      return Status(1, "Invalid shared memory segment: " +
+                           std::string(e.what()));
+    }
+    setRowsFromResponse(columns, batch, rows);
+  }
+  return Status(0, "OK");
+}
+
+Status generateSharedExtensionTable(const std::string& extension_path,
+                                    const std::string& item,
+                                    const PluginRequest& request,
+                                    const TableColumns& columns,
+                                    size_t ring_size,
+                                    TableRows& rows) {
+  auto status = extensionPathActive(extension_path);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto& pool = ExtensionClientPool::instance();
+  SharedRegionRef ring;
+  ExtensionSharedResponse ext_response;
+  try {
+    ring = pool.acquireRing(extension_path, ring_size);
+    callPooledExtension(extension_path, [&](ExtensionClient& client) {
+      ext_response = ExtensionSharedResponse();
+      client.generateShared(ext_response,
+                            item,
+                            request,
+                            ring->name(),
+                            static_cast<int64_t>(ring->size()));
+    });
+
+    // The extension writes the next segments once these are read.
+    while (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
+      status = readSharedSegments(*ring, ext_response, columns, rows);
+      if (!status.ok() || ext_response.done) {
+        break;
+      }
+      auto cursor = ext_response.cursor;
+      callPooledExtension(extension_path, [&](ExtensionClient& client) {
+        ext_response = ExtensionSharedResponse();
+        client.nextShared(ext_response, cursor);
+      });
+    }
+  } catch (const std::exception& e) {
+    return Status(1, "Extension call failed: " + std::string(e.what()));
+  }
+
+  // The extension only writes the ring within a call, it may be reused. A
+  // failed call may still be writing, that ring is dropped above.
+  pool.releaseRing(extension_path, std::move(ring));
+  if (!status.ok()) {
+    return status;
+  }
+  return Status(ext_response.status.code, ext_response.status.message);
+}
+
 Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal) {
@@ -565,6 +925,9 @@ Status startExtensionManager(const std::string& manager_path) {
   // Start the extension manager thread.
   Dispatcher::addService(
       std::make_shared<ExtensionManagerRunner>(manager_path));
+
+  // Close the query cursors abandoned by extension API clients.
+  Dispatcher::addService(std::make_shared<QueryCursorExpirer>());
   return Status(0, "OK");
 }
 }
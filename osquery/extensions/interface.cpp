@@ -8,16 +8,543 @@
  *
  */
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
 
+#include "osquery/core/memory.h"
 #include "osquery/extensions/interface.h"
 
 using namespace osquery::extensions;
 
 namespace osquery {
+
+/// Shared memory object names created by this process.
+static std::atomic<size_t> kSharedRegionCount{0};
+
+SharedRegionRef SharedRegion::create(size_t size) {
+  // OS X limits shared memory object names to 31 characters.
+  auto name = "/osquery." + std::to_string(getpid()) + "." +
+              std::to_string(kSharedRegionCount++);
+  auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create shared memory: " + name);
+  }
+
+  SharedRegionRef region(new SharedRegion());
+  region->name_ = name;
+  region->owner_ = true;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+      region->data_ = static_cast<uint8_t*>(data);
+      region->size_ = size;
+    }
+  }
+  ::close(fd);
+  if (region->data_ == nullptr) {
+    throw std::runtime_error("Cannot map shared memory: " + name);
+  }
+  return region;
+}
+
+SharedRegionRef SharedRegion::open(const std::string& name, size_t size) {
+  auto fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open shared memory: " + name);
+  }
+
+  // The object must be at least the size the caller will read.
+  SharedRegionRef region(new SharedRegion());
+  region->name_ = name;
+  struct stat info;
+  if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= size) {
+    auto data = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+      region->data_ = static_cast<uint8_t*>(data);
+      region->size_ = size;
+    }
+  }
+  ::close(fd);
+  if (region->data_ == nullptr) {
+    throw std::runtime_error("Cannot map shared memory: " + name);
+  }
+  return region;
+}
+
+TTransportRef makeExtensionTransport(TTransportRef socket,
+                                     const std::string& protocol) {
+  auto size = static_cast<uint32_t>(
+      std::max<uint64_t>(FLAGS_extensions_buffer_size, 512));
+  if (protocol == kExtensionProtocolCompact) {
+    return TTransportRef(new TFramedTransport(socket, size));
+  }
+  return TTransportRef(new TBufferedTransport(socket, size, size));
+}
+
+TProtocolRef makeExtensionProtocol(TTransportRef transport,
+                                   const std::string& protocol) {
+  if (protocol == kExtensionProtocolCompact) {
+    return TProtocolRef(new TCompactProtocol(transport));
+  }
+  return TProtocolRef(new TBinaryProtocol(transport));
+}
+
+/// Create the server transports of a protocol, see makeExtensionTransport.
+class ExtensionTransportFactory : public TTransportFactory {
+ public:
+  explicit ExtensionTransportFactory(const std::string& protocol)
+      : protocol_(protocol) {}
+
+  TTransportRef getTransport(TTransportRef transport) override {
+    return makeExtensionTransport(transport, protocol_);
+  }
+
+ private:
+  std::string protocol_;
+};
+
+SharedRegion::~SharedRegion() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+  if (owner_) {
+    shm_unlink(name_.c_str());
+  }
+}
+
 namespace extensions {
 
+/// Extensions that negotiated columnar table responses when registering.
+static std::set<RouteUUID> kColumnarExtensions;
+
+/// Extensions that negotiated shared memory table responses.
+static std::set<RouteUUID> kSharedExtensions;
+
+/// The protocol served on each extension socket path, if not binary.
+static std::map<std::string, std::string> kExtensionProtocols;
+
+/// Protect the sets of columnar and shared extensions, and the protocols.
+static std::mutex kColumnarExtensionsMutex;
+
+/// Rows serialized into each segment of a shared response, at most.
+const size_t kSharedBatchRows = 4096;
+
+/// Shared responses kept for their readers, the oldest are abandoned.
+const size_t kSharedCursorsMax = 16;
+
+/// A shared response unused for this many seconds is abandoned.
+const size_t kSharedCursorExpiry = 60;
+
+/// A table response being written to a shared memory ring.
+struct SharedTableCursor {
+  SharedRegionRef ring;
+
+  /// The table's "columns" action response.
+  PluginResponse columns;
+
+  /// The source of more rows, if the table streams.
+  RowGeneratorRef generator;
+
+  /// Generated rows from position on are not written.
+  TableRows rows;
+  size_t position{0};
+
+  /// The table has no more rows beyond rows.
+  bool exhausted{false};
+
+  std::chrono::steady_clock::time_point used;
+};
+
+/// Shared responses by cursor, any server worker may continue a response.
+static std::map<int64_t, std::shared_ptr<SharedTableCursor>> kSharedCursors;
+static int64_t kSharedCursorNext = 1;
+static std::mutex kSharedCursorsMutex;
+
+DECLARE_uint64(extensions_cursor_timeout);
+
+/// Rows of a query cursor fetch that does not ask for a number of rows.
+const size_t kQueryCursorRows = 1024;
+
+/// Rows of a single query cursor fetch, at most.
+const size_t kQueryCursorMaxRows = 65536;
+
+/// Query cursors open at once, more are refused until one closes or expires.
+const size_t kQueryCursorsMax = 16;
+
+/// Milliseconds between checks for expired query cursors.
+const size_t kQueryCursorExpiryInterval = 1000;
+
+/**
+ * @brief An open query, its rows are produced as they are fetched.
+ *
+ * The query streams rows to a callback on the cursor's thread, which waits
+ * while a fetched batch is full. It holds its SQLite connection until the
+ * query finishes or the cursor is closed.
+ */
+class QueryCursor : private boost::noncopyable {
+ public:
+  explicit QueryCursor(const std::string& sql)
+      : thread_([this, sql]() { run(sql); }) {}
+
+  /// Stop the query after the row being produced.
+  ~QueryCursor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    produce_.notify_all();
+    thread_.join();
+  }
+
+  /// Wait for up to max rows, done is set when the query has no more.
+  Status fetch(size_t max, QueryData& results, bool& done) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    capacity_ = max;
+    produce_.notify_all();
+    fetched_.wait(lock,
+                  [this]() { return finished_ || rows_.size() >= capacity_; });
+    results.swap(rows_);
+    rows_.clear();
+    capacity_ = 0;
+    done = finished_;
+    return (finished_) ? status_ : Status(0, "OK");
+  }
+
+  std::chrono::steady_clock::time_point used;
+
+ private:
+  void run(const std::string& sql) {
+    MemoryArenaScope arena(ARENA_SQL);
+    auto status = osquery::query(sql, [this](Row& row) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      produce_.wait(lock,
+                    [this]() { return closed_ || rows_.size() < capacity_; });
+      if (closed_) {
+        return false;
+      }
+      rows_.push_back(std::move(row));
+      if (rows_.size() >= capacity_) {
+        fetched_.notify_all();
+      }
+      return true;
+    });
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+    finished_ = true;
+    fetched_.notify_all();
+  }
+
+ private:
+  /// Rows produced for the current fetch, at most its capacity.
+  QueryData rows_;
+  size_t capacity_{0};
+
+  /// The query finished with a status, or the cursor is closing.
+  Status status_;
+  bool finished_{false};
+  bool closed_{false};
+
+  std::mutex mutex_;
+  std::condition_variable produce_;
+  std::condition_variable fetched_;
+
+  /// Started last, after the state it uses.
+  std::thread thread_;
+};
+
+/// Open query cursors, any server worker may fetch from a cursor.
+static std::map<int64_t, std::shared_ptr<QueryCursor>> kQueryCursors;
+static int64_t kQueryCursorNext = 1;
+static std::mutex kQueryCursorsMutex;
+
+bool isColumnarExtension(RouteUUID uuid) {
+  std::lock_guard<std::mutex> lock(kColumnarExtensionsMutex);
+  return kColumnarExtensions.count(uuid) > 0;
+}
+
+bool isSharedExtension(RouteUUID uuid) {
+  std::lock_guard<std::mutex> lock(kColumnarExtensionsMutex);
+  return kSharedExtensions.count(uuid) > 0;
+}
+
+std::string getExtensionProtocol(const std::string& path) {
+  std::lock_guard<std::mutex> lock(kColumnarExtensionsMutex);
+  auto protocol = kExtensionProtocols.find(path);
+  return (protocol != kExtensionProtocols.end()) ? protocol->second
+                                                 : kExtensionProtocolBinary;
+}
+
+static void setExtensionProtocol(const std::string& path,
+                                 const std::string& protocol) {
+  std::lock_guard<std::mutex> lock(kColumnarExtensionsMutex);
+  if (protocol == kExtensionProtocolBinary) {
+    kExtensionProtocols.erase(path);
+  } else {
+    kExtensionProtocols[path] = protocol;
+  }
+}
+
+/// Extensions registered with this process's manager, signalled to waiters.
+static size_t kExtensionRegistrations{0};
+static std::mutex kExtensionRegistrationsMutex;
+static std::condition_variable kExtensionRegistered;
+
+size_t getExtensionRegistrations() {
+  std::lock_guard<std::mutex> lock(kExtensionRegistrationsMutex);
+  return kExtensionRegistrations;
+}
+
+bool waitForExtensionRegistration(size_t seen, size_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(kExtensionRegistrationsMutex);
+  return kExtensionRegistered.wait_for(
+      lock, std::chrono::milliseconds(timeout_ms), [seen]() {
+        return kExtensionRegistrations > seen;
+      });
+}
+
+static void signalExtensionRegistration() {
+  {
+    std::lock_guard<std::mutex> lock(kExtensionRegistrationsMutex);
+    kExtensionRegistrations++;
+  }
+  kExtensionRegistered.notify_all();
+}
+
+static void setColumnarExtension(RouteUUID uuid,
+                                 bool columnar,
+                                 bool shared = false) {
+  std::lock_guard<std::mutex> lock(kColumnarExtensionsMutex);
+  if (columnar) {
+    kColumnarExtensions.insert(uuid);
+  } else {
+    kColumnarExtensions.erase(uuid);
+  }
+  if (columnar && shared) {
+    kSharedExtensions.insert(uuid);
+  } else {
+    kSharedExtensions.erase(uuid);
+  }
+}
+
+/// Write the typed rows of a table as one value vector per column.
+static void setResponseFromRows(const PluginResponse& columns,
+                                TableRows::const_iterator first,
+                                TableRows::const_iterator last,
+                                ExtensionTableResponse& response) {
+  auto count = static_cast<size_t>(last - first);
+  response.rows = count;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    auto name = columns[i].find("name");
+    response.columns.push_back((name != columns[i].end()) ? name->second : "");
+
+    // A column is sent as integers or doubles only if every cell has the type.
+    bool integers = true;
+    bool doubles = true;
+    for (auto row = first; row != last; ++row) {
+      if (i >= row->size()) {
+        integers = doubles = false;
+        break;
+      }
+      const auto& cell = (*row)[i];
+      integers = integers && (boost::get<long long int>(&cell) != nullptr);
+      doubles = doubles && (boost::get<double>(&cell) != nullptr);
+    }
+
+    ExtensionColumn column;
+    if (integers && count > 0) {
+      column.type = ExtensionColumnType::EXT_COLUMN_INTEGER;
+      column.integer_values.reserve(count);
+      for (auto row = first; row != last; ++row) {
+        column.integer_values.push_back(boost::get<long long int>((*row)[i]));
+      }
+    } else if (doubles && count > 0) {
+      column.type = ExtensionColumnType::EXT_COLUMN_DOUBLE;
+      column.double_values.reserve(count);
+      for (auto row = first; row != last; ++row) {
+        column.double_values.push_back(boost::get<double>((*row)[i]));
+      }
+    } else {
+      column.type = ExtensionColumnType::EXT_COLUMN_TEXT;
+      column.text_values.reserve(count);
+      for (auto row = first; row != last; ++row) {
+        column.text_values.push_back(
+            (i < row->size()) ? TablePlugin::cellText((*row)[i]) : "");
+      }
+    }
+    response.values.push_back(std::move(column));
+  }
+}
+
+/// Find the local table plugin of an extension table call.
+static std::shared_ptr<TablePlugin> getLocalTable(const std::string& item) {
+  auto local_item = Registry::getAlias("table", item);
+  if (!Registry::exists("table", local_item, true)) {
+    return nullptr;
+  }
+  return std::dynamic_pointer_cast<TablePlugin>(
+      Registry::get("table", local_item));
+}
+
+/**
+ * @brief Write a shared response's next batches into its ring.
+ *
+ * Batches are written from the start of the ring until the next does not
+ * fit. A batch that does not fit an empty ring is split, a single row that
+ * does not fit fails the response.
+ */
+static void writeSharedSegments(SharedTableCursor& cursor,
+                                ExtensionSharedResponse& response) {
+  size_t offset = 0;
+  size_t batch = kSharedBatchRows;
+  while (true) {
+    if (cursor.position == cursor.rows.size()) {
+      cursor.rows.clear();
+      cursor.position = 0;
+      if (!cursor.exhausted) {
+        cursor.exhausted = (cursor.generator == nullptr) ||
+                           !cursor.generator->next(cursor.rows);
+      }
+      if (cursor.rows.empty()) {
+        if (cursor.exhausted) {
+          response.done = true;
+          return;
+        }
+        continue;
+      }
+    }
+
+    auto count = std::min(batch, cursor.rows.size() - cursor.position);
+    auto first = cursor.rows.cbegin() + cursor.position;
+    ExtensionTableResponse segment;
+    setResponseFromRows(cursor.columns, first, first + count, segment);
+    segment.status.code = ExtensionCode::EXT_SUCCESS;
+
+    TMemoryBufferRef buffer(new TMemoryBuffer());
+    TBinaryProtocol protocol(buffer);
+    segment.write(&protocol);
+    uint8_t* data = nullptr;
+    uint32_t length = 0;
+    buffer->getBuffer(&data, &length);
+
+    if (offset + length > cursor.ring->size()) {
+      if (offset > 0) {
+        // The ring is full, the reader continues with nextShared.
+        return;
+      } else if (count == 1) {
+        response.status.code = ExtensionCode::EXT_FAILED;
+        response.status.message = "Row exceeds the shared memory ring";
+        return;
+      }
+      batch = std::max<size_t>(count / 2, 1);
+      continue;
+    }
+
+    memcpy(cursor.ring->data() + offset, data, length);
+    ExtensionSegment written;
+    written.offset = static_cast<int64_t>(offset);
+    written.length = static_cast<int64_t>(length);
+    response.segments.push_back(written);
+    offset += length;
+    cursor.position += count;
+  }
+}
+
+/// Write the next segments of a shared response and keep or forget it.
+static void continueShared(int64_t id,
+                           std::shared_ptr<SharedTableCursor> cursor,
+                           ExtensionSharedResponse& response) {
+  response.status.code = ExtensionCode::EXT_SUCCESS;
+  response.status.message = "OK";
+  try {
+    writeSharedSegments(*cursor, response);
+  } catch (const std::exception& e) {
+    response.status.code = ExtensionCode::EXT_FAILED;
+    response.status.message =
+        "Table plugin caused exception: " + std::string(e.what());
+  }
+
+  std::lock_guard<std::mutex> lock(kSharedCursorsMutex);
+  if (response.done ||
+      response.status.code != ExtensionCode::EXT_SUCCESS) {
+    kSharedCursors.erase(id);
+    return;
+  }
+  cursor->used = std::chrono::steady_clock::now();
+  kSharedCursors[id] = cursor;
+  response.cursor = id;
+}
+
+void expireQueryCursors() {
+  // Cursors close their connections outside of the lock.
+  std::vector<std::shared_ptr<QueryCursor>> expired;
+  {
+    std::lock_guard<std::mutex> lock(kQueryCursorsMutex);
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::seconds(FLAGS_extensions_cursor_timeout);
+    for (auto it = kQueryCursors.begin(); it != kQueryCursors.end();) {
+      if (now - it->second->used > timeout) {
+        expired.push_back(std::move(it->second));
+        it = kQueryCursors.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void QueryCursorExpirer::start() {
+  while (true) {
+    expireQueryCursors();
+    interruptableSleep(kQueryCursorExpiryInterval);
+  }
+}
+
+/// Fetch the next rows of a query cursor and forget it when done.
+static void continueQuery(int64_t id,
+                          std::shared_ptr<QueryCursor> cursor,
+                          int64_t rows,
+                          ExtensionQueryResponse& response) {
+  auto max = (rows <= 0) ? kQueryCursorRows
+                         : std::min(static_cast<size_t>(rows),
+                                    kQueryCursorMaxRows);
+  QueryData results;
+  bool done = false;
+  auto status = cursor->fetch(max, results, done);
+  {
+    std::lock_guard<std::mutex> lock(kQueryCursorsMutex);
+    cursor->used = std::chrono::steady_clock::now();
+  }
+
+  response.status.code = status.getCode();
+  response.status.message = status.getMessage();
+  for (auto& row : results) {
+    response.response.push_back(std::move(row));
+  }
+  response.cursor = id;
+  response.done = done;
+  if (done) {
+    std::lock_guard<std::mutex> lock(kQueryCursorsMutex);
+    kQueryCursors.erase(id);
+  }
+}
+
 void ExtensionHandler::ping(ExtensionStatus& _return) {
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "pong";
@@ -30,7 +557,8 @@ void ExtensionHandler::call(ExtensionResponse& _return,
                             const ExtensionPluginRequest& request) {
   // Call will receive an extension or core's request to call the other's
   // internal registry call. It is the ONLY actor that resolves registry
-  // item aliases.
+  // item aliases. Requests and responses are charged to the extensions arena.
+  MemoryArenaScope arena(ARENA_EXTENSIONS);
   auto local_item = Registry::getAlias(registry, item);
 
   PluginResponse response;
@@ -53,7 +581,129 @@ void ExtensionHandler::call(ExtensionResponse& _return,
   }
 }
 
+void ExtensionHandler::generate(ExtensionTableResponse& _return,
+                                const std::string& item,
+                                const ExtensionPluginRequest& request) {
+  MemoryArenaScope arena(ARENA_EXTENSIONS);
+  _return.status.uuid = uuid_;
+  auto table = getLocalTable(item);
+  if (table == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "No local table plugin: " + item;
+    return;
+  }
+
+  PluginRequest plugin_request(request.begin(), request.end());
+  QueryContext context;
+  TablePlugin::setContextFromRequest(plugin_request, context);
+
+  // The table fills typed rows, which are never converted to Row maps.
+  TableRows rows;
+  try {
+    auto generator = table->generator(context);
+    if (generator == nullptr) {
+      table->generateRows(context, rows);
+    } else {
+      while (generator->next(rows)) {
+      }
+    }
+  } catch (const std::exception& e) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Table plugin caused exception: " +
+                             std::string(e.what());
+    return;
+  }
+
+  // The "columns" action lists the column names in the order of each row.
+  PluginResponse columns;
+  table->call({{"action", "columns"}}, columns);
+  setResponseFromRows(columns, rows.cbegin(), rows.cend(), _return);
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
+}
+
+void ExtensionHandler::generateShared(ExtensionSharedResponse& _return,
+                                      const std::string& item,
+                                      const ExtensionPluginRequest& request,
+                                      const std::string& ring,
+                                      const int64_t size) {
+  MemoryArenaScope arena(ARENA_EXTENSIONS);
+  _return.status.uuid = uuid_;
+  auto table = getLocalTable(item);
+  if (table == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "No local table plugin: " + item;
+    return;
+  }
+
+  auto cursor = std::make_shared<SharedTableCursor>();
+  try {
+    cursor->ring = SharedRegion::open(ring, static_cast<size_t>(size));
+  } catch (const std::exception& e) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = e.what();
+    return;
+  }
+
+  PluginRequest plugin_request(request.begin(), request.end());
+  QueryContext context;
+  TablePlugin::setContextFromRequest(plugin_request, context);
+  try {
+    // A streaming table is generated as the reader drains the ring.
+    cursor->generator = table->generator(context);
+    if (cursor->generator == nullptr) {
+      table->generateRows(context, cursor->rows);
+      cursor->exhausted = true;
+    }
+  } catch (const std::exception& e) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message =
+        "Table plugin caused exception: " + std::string(e.what());
+    return;
+  }
+  table->call({{"action", "columns"}}, cursor->columns);
+
+  int64_t id = 0;
+  {
+    // Abandon responses whose readers stopped, and the oldest beyond the max.
+    std::lock_guard<std::mutex> lock(kSharedCursorsMutex);
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = kSharedCursors.begin(); it != kSharedCursors.end();) {
+      if (now - it->second->used > std::chrono::seconds(kSharedCursorExpiry) ||
+          kSharedCursors.size() >= kSharedCursorsMax) {
+        it = kSharedCursors.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    id = kSharedCursorNext++;
+  }
+  continueShared(id, cursor, _return);
+}
+
+void ExtensionHandler::nextShared(ExtensionSharedResponse& _return,
+                                  const int64_t cursor) {
+  _return.status.uuid = uuid_;
+  std::shared_ptr<SharedTableCursor> shared;
+  {
+    std::lock_guard<std::mutex> lock(kSharedCursorsMutex);
+    auto it = kSharedCursors.find(cursor);
+    if (it != kSharedCursors.end()) {
+      shared = std::move(it->second);
+      kSharedCursors.erase(it);
+    }
+  }
+  if (shared == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "No shared table response: " +
+                             std::to_string(cursor);
+    return;
+  }
+  continueShared(cursor, std::move(shared), _return);
+}
+
 void ExtensionManagerHandler::extensions(InternalExtensionList& _return) {
+  std::lock_guard<std::mutex> lock(mutex_);
   refresh();
   _return = extensions_;
 }
@@ -71,6 +721,8 @@ void ExtensionManagerHandler::registerExtension(
     ExtensionStatus& _return,
     const InternalExtensionInfo& info,
     const ExtensionRegistry& registry) {
+  // Autoloaded extensions register concurrently, one server worker each.
+  std::lock_guard<std::mutex> lock(mutex_);
   if (exists(info.name)) {
     LOG(WARNING) << "Refusing to register duplicate extension " << info.name;
     _return.code = ExtensionCode::EXT_FAILED;
@@ -93,13 +745,26 @@ void ExtensionManagerHandler::registerExtension(
   }
 
   extensions_[uuid] = info;
+  setColumnarExtension(uuid, info.columnar_tables, info.shared_tables);
+
+  // Older SDKs do not set a protocol and always serve binary.
+  _return.protocol =
+      (info.protocol == kExtensionProtocolCompact &&
+       FLAGS_extensions_protocol == kExtensionProtocolCompact)
+          ? kExtensionProtocolCompact
+          : kExtensionProtocolBinary;
+  setExtensionProtocol(getExtensionSocket(uuid, path_), _return.protocol);
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "OK";
   _return.uuid = uuid;
+
+  // Wake the core if it is waiting for this extension's plugins.
+  signalExtensionRegistration();
 }
 
 void ExtensionManagerHandler::deregisterExtension(
     ExtensionStatus& _return, const ExtensionRouteUUID uuid) {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (extensions_.count(uuid) == 0) {
     _return.code = ExtensionCode::EXT_FAILED;
     _return.message = "No extension UUID registered";
@@ -110,12 +775,17 @@ void ExtensionManagerHandler::deregisterExtension(
   // On success return the uuid of the now de-registered extension.
   Registry::removeBroadcast(uuid);
   extensions_.erase(uuid);
+  setColumnarExtension(uuid, false);
+  auto path = getExtensionSocket(uuid, path_);
+  setExtensionProtocol(path, kExtensionProtocolBinary);
+  ExtensionClientPool::instance().remove(path);
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.uuid = uuid;
 }
 
 void ExtensionManagerHandler::query(ExtensionResponse& _return,
                                     const std::string& sql) {
+  MemoryArenaScope arena(ARENA_SQL);
   QueryData results;
   auto status = osquery::query(sql, results);
   _return.status.code = status.getCode();
@@ -129,6 +799,69 @@ void ExtensionManagerHandler::query(ExtensionResponse& _return,
   }
 }
 
+void ExtensionManagerHandler::openQuery(ExtensionQueryResponse& _return,
+                                        const std::string& sql,
+                                        const int64_t rows) {
+  _return.status.uuid = uuid_;
+  std::shared_ptr<QueryCursor> cursor;
+  int64_t id = 0;
+  {
+    // Concurrent opens must not exceed the limit between check and insert.
+    std::lock_guard<std::mutex> lock(kQueryCursorsMutex);
+    if (kQueryCursors.size() >= kQueryCursorsMax) {
+      _return.status.code = ExtensionCode::EXT_FAILED;
+      _return.status.message = "Too many open query cursors";
+      return;
+    }
+    cursor = std::make_shared<QueryCursor>(sql);
+    id = kQueryCursorNext++;
+    cursor->used = std::chrono::steady_clock::now();
+    kQueryCursors[id] = cursor;
+  }
+  continueQuery(id, std::move(cursor), rows, _return);
+}
+
+void ExtensionManagerHandler::fetchQuery(ExtensionQueryResponse& _return,
+                                         const int64_t cursor,
+                                         const int64_t rows) {
+  _return.status.uuid = uuid_;
+  std::shared_ptr<QueryCursor> query;
+  {
+    std::lock_guard<std::mutex> lock(kQueryCursorsMutex);
+    auto it = kQueryCursors.find(cursor);
+    if (it != kQueryCursors.end()) {
+      query = it->second;
+    }
+  }
+  if (query == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "No open query cursor: " + std::to_string(cursor);
+    return;
+  }
+  continueQuery(cursor, std::move(query), rows, _return);
+}
+
+void ExtensionManagerHandler::closeQuery(ExtensionStatus& _return,
+                                         const int64_t cursor) {
+  _return.uuid = uuid_;
+  std::shared_ptr<QueryCursor> query;
+  {
+    std::lock_guard<std::mutex> lock(kQueryCursorsMutex);
+    auto it = kQueryCursors.find(cursor);
+    if (it != kQueryCursors.end()) {
+      query = std::move(it->second);
+      kQueryCursors.erase(it);
+    }
+  }
+  if (query == nullptr) {
+    _return.code = ExtensionCode::EXT_FAILED;
+    _return.message = "No open query cursor: " + std::to_string(cursor);
+    return;
+  }
+  _return.code = ExtensionCode::EXT_SUCCESS;
+  _return.message = "OK";
+}
+
 void ExtensionManagerHandler::getQueryColumns(ExtensionResponse& _return,
                                               const std::string& sql) {
   TableColumns columns;
@@ -157,6 +890,9 @@ void ExtensionManagerHandler::refresh() {
   // Remove each from the manager's list of extension metadata.
   for (const auto& uuid : removed_routes) {
     extensions_.erase(uuid);
+    setColumnarExtension(uuid, false);
+    setExtensionProtocol(getExtensionSocket(uuid, path_),
+                         kExtensionProtocolBinary);
   }
 }
 
@@ -173,6 +909,142 @@ bool ExtensionManagerHandler::exists(const std::string& name) {
 }
 }
 
+/// The most idle connections kept open to each extension.
+const size_t kExtensionPoolIdle = 4;
+
+size_t extensionServerThreads() {
+  if (FLAGS_extensions_server == "threaded") {
+    return 0;
+  }
+  // Pooled client connections each keep a worker, leave room for more.
+  return std::max<size_t>(FLAGS_extensions_server_threads,
+                          kExtensionPoolIdle + 1);
+}
+
+ExtensionClientPool::ClientRef ExtensionClientPool::acquire(
+    const std::string& path, bool& reused) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto idle = idle_.find(path);
+    if (idle != idle_.end() && !idle->second.empty()) {
+      auto client = std::move(idle->second.back());
+      idle->second.pop_back();
+      reused = true;
+      return client;
+    }
+  }
+
+  // Connect without holding the lock, other paths are not delayed.
+  reused = false;
+  return std::make_shared<EXClient>(path, getExtensionProtocol(path));
+}
+
+void ExtensionClientPool::release(const std::string& path, ClientRef client) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& idle = idle_[path];
+  if (idle.size() < kExtensionPoolIdle) {
+    idle.push_back(std::move(client));
+  }
+}
+
+void ExtensionClientPool::remove(const std::string& path) {
+  std::vector<ClientRef> clients;
+  std::vector<SharedRegionRef> rings;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto idle = idle_.find(path);
+    if (idle != idle_.end()) {
+      clients = std::move(idle->second);
+      idle_.erase(idle);
+    }
+    auto idle_rings = rings_.find(path);
+    if (idle_rings != rings_.end()) {
+      rings = std::move(idle_rings->second);
+      rings_.erase(idle_rings);
+    }
+  }
+  // The transports close and the rings unmap as they are destroyed, outside
+  // the lock.
+}
+
+size_t ExtensionClientPool::idleCount(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto idle = idle_.find(path);
+  return (idle == idle_.end()) ? 0 : idle->second.size();
+}
+
+void ExtensionClientPool::record(const std::string& path, size_t latency) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& stats = stats_[path];
+  stats.calls++;
+  stats.latency += latency;
+}
+
+ExtensionCallStats ExtensionClientPool::stats(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto stats = stats_.find(path);
+  return (stats == stats_.end()) ? ExtensionCallStats() : stats->second;
+}
+
+SharedRegionRef ExtensionClientPool::acquireRing(const std::string& path,
+                                                 size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& rings = rings_[path];
+    for (auto ring = rings.begin(); ring != rings.end(); ++ring) {
+      if ((*ring)->size() == size) {
+        auto leased = std::move(*ring);
+        rings.erase(ring);
+        return leased;
+      }
+    }
+  }
+  return SharedRegion::create(size);
+}
+
+void ExtensionClientPool::releaseRing(const std::string& path,
+                                      SharedRegionRef ring) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& rings = rings_[path];
+  if (rings.size() < kExtensionPoolIdle) {
+    rings.push_back(std::move(ring));
+  }
+}
+
+size_t ExtensionClientPool::idleRingCount(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto rings = rings_.find(path);
+  return (rings == rings_.end()) ? 0 : rings->second.size();
+}
+
+ExtensionCallStats getExtensionCallStats(RouteUUID uuid) {
+  return ExtensionClientPool::instance().stats(getExtensionSocket(uuid));
+}
+
+void callPooledExtension(const std::string& path,
+                         std::function<void(ExtensionClient&)> call) {
+  auto& pool = ExtensionClientPool::instance();
+  auto start = std::chrono::steady_clock::now();
+  bool reused = false;
+  auto client = pool.acquire(path, reused);
+  try {
+    call(*client->get());
+  } catch (const std::exception& e) {
+    if (!reused) {
+      throw;
+    }
+    // The extension may have closed the idle connection, connect again.
+    pool.remove(path);
+    client = std::make_shared<EXClient>(path, getExtensionProtocol(path));
+    call(*client->get());
+  }
+  pool.release(path, std::move(client));
+  pool.record(path,
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count());
+}
+
 ExtensionRunnerCore::~ExtensionRunnerCore() { remove(path_); }
 
 void ExtensionRunnerCore::stop() {
@@ -200,7 +1072,8 @@ inline void removeStalePaths(const std::string& manager) {
   }
 }
 
-void ExtensionRunnerCore::startServer(TProcessorRef processor) {
+void ExtensionRunnerCore::startServer(TProcessorRef processor,
+                                      const std::string& protocol) {
   {
     boost::lock_guard<boost::mutex> lock(service_start_);
     // A request to stop the service may occur before the thread starts.
@@ -213,12 +1086,26 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
     removeStalePaths(path_);
 
     // Construct the service's transport, protocol, thread pool.
-    auto transport_fac = TTransportFactoryRef(new TBufferedTransportFactory());
-    auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
+    auto transport_fac =
+        TTransportFactoryRef(new ExtensionTransportFactory(protocol));
+    auto protocol_fac =
+        (protocol == kExtensionProtocolCompact)
+            ? TProtocolFactoryRef(new TCompactProtocolFactory())
+            : TProtocolFactoryRef(new TBinaryProtocolFactory());
 
     // Start the Thrift server's run loop.
-    server_ = TThreadedServerRef(new TThreadedServer(
-        processor, transport_, transport_fac, protocol_fac));
+    auto threads = extensionServerThreads();
+    if (threads == 0) {
+      server_ = TServerRef(new TThreadedServer(
+          processor, transport_, transport_fac, protocol_fac));
+    } else {
+      auto thread_manager = ThreadManager::newSimpleThreadManager(threads);
+      thread_manager->threadFactory(
+          PosixThreadFactoryRef(new PosixThreadFactory()));
+      thread_manager->start();
+      server_ = TServerRef(new TThreadPoolServer(
+          processor, transport_, transport_fac, protocol_fac, thread_manager));
+    }
   }
 
   {
@@ -232,9 +1119,10 @@ void ExtensionRunner::start() {
   auto handler = ExtensionHandlerRef(new ExtensionHandler(uuid_));
   auto processor = TProcessorRef(new ExtensionProcessor(handler));
 
-  VLOG(1) << "Extension service starting: " << path_;
+  VLOG(1) << "Extension service starting: " << path_ << " (" << protocol_
+          << ")";
   try {
-    startServer(processor);
+    startServer(processor, protocol_);
   } catch (const std::exception& e) {
     LOG(ERROR) << "Cannot start extension handler: " << path_ << " ("
                << e.what() << ")";
@@ -251,7 +1139,7 @@ ExtensionManagerRunner::~ExtensionManagerRunner() {
 
 void ExtensionManagerRunner::start() {
   // Create the thrift instances.
-  auto handler = ExtensionManagerHandlerRef(new ExtensionManagerHandler());
+  auto handler = ExtensionManagerHandlerRef(new ExtensionManagerHandler(path_));
   auto processor = TProcessorRef(new ExtensionManagerProcessor(handler));
 
   VLOG(1) << "Extension manager service starting: " << path_;
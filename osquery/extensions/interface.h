@@ -10,6 +10,11 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
 #include <osquery/extensions.h>
 
 #include "osquery/dispatcher/dispatcher.h"
@@ -19,7 +24,9 @@
 // possible in every build system.
 // clang-format off
 #include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadedServer.h)
+#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadPoolServer.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TBinaryProtocol.h)
+#include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TCompactProtocol.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TServerSocket.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TBufferTransports.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TSocket.h)
@@ -42,6 +49,7 @@ using namespace apache::thrift::concurrency;
 typedef SHARED_PTR_IMPL<TSocket> TSocketRef;
 typedef SHARED_PTR_IMPL<TTransport> TTransportRef;
 typedef SHARED_PTR_IMPL<TProtocol> TProtocolRef;
+typedef SHARED_PTR_IMPL<TMemoryBuffer> TMemoryBufferRef;
 
 typedef SHARED_PTR_IMPL<TProcessor> TProcessorRef;
 typedef SHARED_PTR_IMPL<TServerTransport> TServerTransportRef;
@@ -49,7 +57,65 @@ typedef SHARED_PTR_IMPL<TTransportFactory> TTransportFactoryRef;
 typedef SHARED_PTR_IMPL<TProtocolFactory> TProtocolFactoryRef;
 typedef SHARED_PTR_IMPL<ThreadManager> TThreadManagerRef;
 typedef SHARED_PTR_IMPL<PosixThreadFactory> PosixThreadFactoryRef;
-using TThreadedServerRef = std::shared_ptr<TThreadedServer>;
+using TServerRef = std::shared_ptr<TServer>;
+
+/**
+ * @brief The protocols of the extension API.
+ *
+ * The compact protocol is sent over a framed transport, the binary protocol
+ * over a buffered transport. The extension manager socket always serves the
+ * binary protocol, which every SDK uses to register. An extension's own
+ * socket serves the compact protocol if the extension and the core both
+ * prefer it, see registerExtension.
+ */
+const std::string kExtensionProtocolBinary = "binary";
+const std::string kExtensionProtocolCompact = "compact";
+
+/// Create a client transport of a protocol, see extensions_buffer_size.
+TTransportRef makeExtensionTransport(TTransportRef socket,
+                                     const std::string& protocol);
+
+/// Create a client protocol over a transport from makeExtensionTransport.
+TProtocolRef makeExtensionProtocol(TTransportRef transport,
+                                   const std::string& protocol);
+
+/**
+ * @brief A POSIX shared memory object mapped into this process.
+ *
+ * The core creates a region for each concurrent table response from an
+ * extension negotiating shared tables, and the extension maps it by name to
+ * write batches of rows. Only the batches' offsets cross the socket.
+ */
+class SharedRegion : private boost::noncopyable {
+ public:
+  /// Create and map a region for reading, removed when destroyed.
+  static std::shared_ptr<SharedRegion> create(size_t size);
+
+  /// Map a region created by another process for writing.
+  static std::shared_ptr<SharedRegion> open(const std::string& name,
+                                            size_t size);
+
+  ~SharedRegion();
+
+  /// The name of the shared memory object.
+  const std::string& name() const { return name_; }
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  SharedRegion() {}
+
+ private:
+  std::string name_;
+  uint8_t* data_{nullptr};
+  size_t size_{0};
+
+  /// The creator removes the shared memory object.
+  bool owner_{false};
+};
+
+using SharedRegionRef = std::shared_ptr<SharedRegion>;
 
 namespace extensions {
 
@@ -82,6 +148,43 @@ class ExtensionHandler : virtual public ExtensionIf {
             const std::string& item,
             const ExtensionPluginRequest& request);
 
+  /**
+   * @brief The Thrift API used to generate an extension table's rows.
+   *
+   * Rows are returned as a column header and a typed value vector for each
+   * column, which avoids repeating every column name in every row.
+   *
+   * @param _return The status and the generated columns.
+   * @param item The table plugin name.
+   * @param request The table plugin request, including the query context.
+   */
+  void generate(ExtensionTableResponse& _return,
+                const std::string& item,
+                const ExtensionPluginRequest& request);
+
+  /**
+   * @brief The Thrift API used to generate a table's rows into shared memory.
+   *
+   * Batches of rows are serialized as ExtensionTableResponse%s into the
+   * caller's ring until it is full, then the response returns their offsets
+   * and a cursor. The table is generated no further than the caller reads,
+   * nextShared continues from the start of the ring.
+   *
+   * @param _return The status, the written segments, and the cursor.
+   * @param item The table plugin name.
+   * @param request The table plugin request, including the query context.
+   * @param ring The name of the caller's shared memory object.
+   * @param size The size of the shared memory object.
+   */
+  void generateShared(ExtensionSharedResponse& _return,
+                      const std::string& item,
+                      const ExtensionPluginRequest& request,
+                      const std::string& ring,
+                      const int64_t size);
+
+  /// Continue a shared table response after its segments were read.
+  void nextShared(ExtensionSharedResponse& _return, const int64_t cursor);
+
  protected:
   /// Transient UUID assigned to the extension after registering.
   RouteUUID uuid_;
@@ -101,7 +204,8 @@ class ExtensionHandler : virtual public ExtensionIf {
 class ExtensionManagerHandler : virtual public ExtensionManagerIf,
                                 public ExtensionHandler {
  public:
-  ExtensionManagerHandler() {}
+  /// Serve the extension manager socket path.
+  explicit ExtensionManagerHandler(const std::string& path) : path_(path) {}
 
   /// Return a list of Route UUIDs and extension metadata.
   void extensions(InternalExtensionList& _return);
@@ -176,6 +280,30 @@ class ExtensionManagerHandler : virtual public ExtensionManagerIf,
    */
   void getQueryColumns(ExtensionResponse& _return, const std::string& sql);
 
+  /**
+   * @brief Open a cursor for an SQL statement in osquery core.
+   *
+   * Large results are read in batches instead of collected by query. The
+   * statement is stepped only as far as the rows fetched, so neither the core
+   * nor the caller holds more than a batch. A cursor unused for
+   * --extensions_cursor_timeout seconds is closed.
+   *
+   * @param _return The output Status, the first rows, and the cursor.
+   * @param sql The sql statement.
+   * @param rows The most rows returned, 0 for the default batch.
+   */
+  void openQuery(ExtensionQueryResponse& _return,
+                 const std::string& sql,
+                 const int64_t rows);
+
+  /// Return up to the next rows of an open cursor, see openQuery.
+  void fetchQuery(ExtensionQueryResponse& _return,
+                  const int64_t cursor,
+                  const int64_t rows);
+
+  /// Close an open cursor before its last rows are fetched.
+  void closeQuery(ExtensionStatus& _return, const int64_t cursor);
+
  private:
   /// Check if an extension exists by the name it registered.
   bool exists(const std::string& name);
@@ -186,8 +314,37 @@ class ExtensionManagerHandler : virtual public ExtensionManagerIf,
 
   /// Maintain a map of extension UUID to metadata for tracking deregistration.
   InternalExtensionList extensions_;
+
+  /// The manager socket path, extension sockets are named after it.
+  std::string path_;
+
+  /// Protects the extension metadata, registrations arrive concurrently.
+  std::mutex mutex_;
 };
 
+/// Check if a registered extension serves table generate calls as columns.
+bool isColumnarExtension(RouteUUID uuid);
+
+/// Check if a registered extension writes table responses to shared memory.
+bool isSharedExtension(RouteUUID uuid);
+
+/// The protocol served on an extension socket path, binary if unknown.
+std::string getExtensionProtocol(const std::string& path);
+
+/// Close query cursors unused for --extensions_cursor_timeout seconds.
+void expireQueryCursors();
+
+/**
+ * @brief Wait for a socket path to be created.
+ *
+ * On Linux an inotify watch on the socket's directory wakes the caller when
+ * the path appears, elsewhere the path is checked every
+ * kExtensionInitializeLatencyUS.
+ *
+ * @return true if the path exists before timeout_ms milliseconds pass.
+ */
+bool waitForExtensionPath(const std::string& path, size_t timeout_ms);
+
 typedef SHARED_PTR_IMPL<ExtensionHandler> ExtensionHandlerRef;
 typedef SHARED_PTR_IMPL<ExtensionManagerHandler> ExtensionManagerHandlerRef;
 }
@@ -237,6 +394,28 @@ class ExtensionManagerWatcher : public ExtensionWatcher {
   std::map<RouteUUID, size_t> failures_;
 };
 
+/**
+ * @brief A Dispatcher service thread that closes abandoned query cursors.
+ *
+ * A cursor holds a thread and an SQLite connection while it is open. A client
+ * that stops fetching without closing its cursor releases them when this
+ * service next finds the cursor expired, not when another cursor is used.
+ */
+class QueryCursorExpirer : public InternalRunnable {
+ public:
+  /// The Dispatcher thread entry point.
+  void start();
+};
+
+/**
+ * @brief The worker threads of the extension API server.
+ *
+ * The "pool" server model serves connections from a bounded pool of workers
+ * and returns the pool size. The "threaded" model starts a thread for each
+ * connection and returns 0.
+ */
+size_t extensionServerThreads();
+
 class ExtensionRunnerCore : public InternalRunnable {
  public:
   virtual ~ExtensionRunnerCore();
@@ -244,8 +423,9 @@ class ExtensionRunnerCore : public InternalRunnable {
       : path_(path), server_(nullptr) {}
 
  public:
-  /// Given a handler transport and protocol start a thrift threaded server.
-  void startServer(TProcessorRef processor);
+  /// Given a handler and an API protocol start a thrift threaded server.
+  void startServer(TProcessorRef processor,
+                   const std::string& protocol = kExtensionProtocolBinary);
 
   // The Dispatcher thread service stop point.
   void stop();
@@ -258,7 +438,7 @@ class ExtensionRunnerCore : public InternalRunnable {
   TServerTransportRef transport_{nullptr};
 
   /// Server instance, will be stopped if thread service is removed.
-  TThreadedServerRef server_{nullptr};
+  TServerRef server_{nullptr};
 
   /// Protect the service start and stop, this mutex protects server creation.
   boost::mutex service_start_;
@@ -281,8 +461,10 @@ class ExtensionRunnerCore : public InternalRunnable {
  */
 class ExtensionRunner : public ExtensionRunnerCore {
  public:
-  ExtensionRunner(const std::string& manager_path, RouteUUID uuid)
-      : ExtensionRunnerCore(""), uuid_(uuid) {
+  ExtensionRunner(const std::string& manager_path,
+                  RouteUUID uuid,
+                  const std::string& protocol = kExtensionProtocolBinary)
+      : ExtensionRunnerCore(""), uuid_(uuid), protocol_(protocol) {
     path_ = getExtensionSocket(uuid, manager_path);
   }
 
@@ -295,6 +477,9 @@ class ExtensionRunner : public ExtensionRunnerCore {
  private:
   /// The unique and transient Extension UUID assigned by the ExtensionManager.
   RouteUUID uuid_;
+
+  /// The protocol chosen by the ExtensionManager when registering.
+  std::string protocol_;
 };
 
 /**
@@ -317,10 +502,11 @@ class ExtensionManagerRunner : public ExtensionRunnerCore {
 /// Internal accessor for extension clients.
 class EXInternal {
  public:
-  explicit EXInternal(const std::string& path)
+  explicit EXInternal(const std::string& path,
+                      const std::string& protocol = kExtensionProtocolBinary)
       : socket_(new TSocket(path)),
-        transport_(new TBufferedTransport(socket_)),
-        protocol_(new TBinaryProtocol(transport_)) {}
+        transport_(makeExtensionTransport(socket_, protocol)),
+        protocol_(makeExtensionProtocol(transport_, protocol)) {}
 
   virtual ~EXInternal() { transport_->close(); }
 
@@ -333,8 +519,9 @@ class EXInternal {
 /// Internal accessor for a client to an extension (from an extension manager).
 class EXClient : public EXInternal {
  public:
-  explicit EXClient(const std::string& path)
-      : EXInternal(path),
+  explicit EXClient(const std::string& path,
+                    const std::string& protocol = kExtensionProtocolBinary)
+      : EXInternal(path, protocol),
         client_(std::make_shared<extensions::ExtensionClient>(protocol_)) {
 
     (void)transport_->open();
@@ -346,6 +533,98 @@ class EXClient : public EXInternal {
   std::shared_ptr<extensions::ExtensionClient> client_;
 };
 
+/**
+ * @brief Open connections to extensions, reused across registry calls.
+ *
+ * Each EXClient opens a UNIX domain socket when constructed. A query that
+ * calls an extension table for every row of a JOIN would otherwise connect
+ * once per call. Connections are leased to one thread at a time, since a
+ * Thrift client is not safe to share, and returned to the pool after a
+ * successful call. The ExtensionManagerWatcher closes the connections to an
+ * extension that fails its health check.
+ */
+class ExtensionClientPool : private boost::noncopyable {
+ public:
+  using ClientRef = std::shared_ptr<EXClient>;
+
+  static ExtensionClientPool& instance() {
+    static ExtensionClientPool pool;
+    return pool;
+  }
+
+  /**
+   * @brief Lease a connection to an extension, this may throw.
+   *
+   * @param path The extension's UNIX domain socket path.
+   * @param reused Set if the connection was opened by an earlier call.
+   */
+  ClientRef acquire(const std::string& path, bool& reused);
+
+  /// Return a connection after a successful call.
+  void release(const std::string& path, ClientRef client);
+
+  /// Close the idle connections to an extension.
+  void remove(const std::string& path);
+
+  /// The number of idle connections to an extension.
+  size_t idleCount(const std::string& path);
+
+  /// Count a completed call and its latency in microseconds.
+  void record(const std::string& path, size_t latency);
+
+  /// The calls made to an extension, see getExtensionCallStats.
+  ExtensionCallStats stats(const std::string& path);
+
+  /// Lease a shared memory ring for a table response, this may throw.
+  SharedRegionRef acquireRing(const std::string& path, size_t size);
+
+  /// Return a ring after its response was read.
+  void releaseRing(const std::string& path, SharedRegionRef ring);
+
+  /// The number of idle rings for an extension.
+  size_t idleRingCount(const std::string& path);
+
+ private:
+  ExtensionClientPool() {}
+
+ private:
+  /// Idle connections by socket path.
+  std::map<std::string, std::vector<ClientRef>> idle_;
+
+  /// Idle shared memory rings by socket path.
+  std::map<std::string, std::vector<SharedRegionRef>> rings_;
+
+  /// Completed calls by socket path.
+  std::map<std::string, ExtensionCallStats> stats_;
+
+  /// Protect the idle connections and call stats.
+  std::mutex mutex_;
+};
+
+/**
+ * @brief Call an extension using a pooled connection.
+ *
+ * An idle connection may have been closed by the extension since its last
+ * use, then the call is tried once more on a new connection. Exceptions
+ * from the new connection are thrown to the caller.
+ */
+void callPooledExtension(const std::string& path,
+                         std::function<void(extensions::ExtensionClient&)> call);
+
+/**
+ * @brief Generate an extension table's rows through a shared memory ring.
+ *
+ * The ring of ring_size bytes is leased from the ExtensionClientPool. The
+ * ring bounds the rows written ahead of the reader, each full ring is read
+ * before the extension continues.
+ */
+Status generateSharedExtensionTable(const std::string& extension_path,
+                                    const std::string& item,
+                                    const PluginRequest& request,
+                                    const TableColumns& columns,
+                                    size_t ring_size,
+                                    TableRows& rows);
+
 /// Internal accessor for a client to an extension manager (from an extension).
 class EXManagerClient : public EXInternal {
  public:
@@ -8,7 +8,10 @@
  *
  */
 
+#include <chrono>
+#include <cstring>
 #include <stdexcept>
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -22,6 +25,8 @@ using namespace osquery::extensions;
 
 namespace osquery {
 
+DECLARE_uint64(extensions_cursor_timeout);
+
 const int kDelayUS = 2000;
 const int kTimeoutUS = 1000000;
 
@@ -147,6 +152,79 @@ TEST_F(ExtensionsTest, test_extension_start) {
   Registry::allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_extension_path_wait) {
+  // A socket that is never created is waited for until the timeout.
+  EXPECT_FALSE(waitForExtensionPath(socket_path, 50));
+
+  // The wait ends when the socket is created, well before the timeout.
+  auto start = std::chrono::steady_clock::now();
+  std::thread creator([this]() {
+    ::usleep(100000);
+    writeTextFile(socket_path, "");
+  });
+  EXPECT_TRUE(waitForExtensionPath(socket_path, 30000));
+  creator.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+TEST_F(ExtensionsTest, test_extension_registration_wait) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+
+  // Nothing registers, the wait times out.
+  auto seen = getExtensionRegistrations();
+  EXPECT_FALSE(waitForExtensionRegistration(seen, 10));
+
+  // A registration since the count was read ends the wait immediately.
+  Registry::allowDuplicates(true);
+  status = startExtension(socket_path, "test", "0.1", "0.0.0", "0.0.1");
+  ASSERT_TRUE(status.ok());
+  EXPECT_TRUE(waitForExtensionRegistration(seen, 0));
+  EXPECT_EQ(getExtensionRegistrations(), seen + 1);
+
+  auto uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+  Registry::removeBroadcast(uuid);
+  Registry::allowDuplicates(false);
+}
+
+TEST_F(ExtensionsTest, test_extension_protocol) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+
+  // This SDK prefers the compact protocol, and so does the core.
+  Registry::allowDuplicates(true);
+  status = startExtension(socket_path, "test", "0.1", "0.0.0", "0.0.1");
+  ASSERT_TRUE(status.ok());
+  auto uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+  auto ext_socket = socket_path + "." + std::to_string(uuid);
+  EXPECT_TRUE(socketExists(ext_socket));
+  EXPECT_EQ(getExtensionProtocol(ext_socket), kExtensionProtocolCompact);
+
+  // The extension serves the compact protocol over a framed transport.
+  ExtensionStatus ext_status;
+  EXClient client(ext_socket, kExtensionProtocolCompact);
+  client.get()->ping(ext_status);
+  EXPECT_EQ(ext_status.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_EQ(ext_status.uuid, uuid);
+
+  // An extension built with an older SDK does not set a protocol.
+  InternalExtensionInfo info;
+  info.name = "older";
+  EXManagerClient manager(socket_path);
+  manager.get()->registerExtension(ext_status, info, ExtensionRegistry());
+  EXPECT_EQ(ext_status.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_EQ(ext_status.protocol, kExtensionProtocolBinary);
+  auto older = ext_status.uuid;
+  auto older_socket = socket_path + "." + std::to_string(older);
+  EXPECT_EQ(getExtensionProtocol(older_socket), kExtensionProtocolBinary);
+
+  manager.get()->deregisterExtension(ext_status, older);
+  Registry::removeBroadcast(uuid);
+  Registry::allowDuplicates(false);
+}
+
 class ExtensionPlugin : public Plugin {
  public:
   Status call(const PluginRequest& request, PluginResponse& response) {
@@ -229,10 +307,267 @@ TEST_F(ExtensionsTest, test_extension_broadcast) {
   EXPECT_EQ(response.size(), 1U);
   EXPECT_EQ(response[0]["test_key"], "test_value");
 
+  // The connection is kept open and reused by the next call.
+  auto& pool = ExtensionClientPool::instance();
+  EXPECT_EQ(pool.idleCount(ext_socket), 1U);
+  response.clear();
+  status = callExtension(ext_socket,
+                         "extension_test",
+                         "test_alias",
+                         {{"test_key", "test_value"}},
+                         response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 1U);
+  EXPECT_EQ(pool.idleCount(ext_socket), 1U);
+  pool.remove(ext_socket);
+  EXPECT_EQ(pool.idleCount(ext_socket), 0U);
+
   Registry::removeBroadcast(uuid);
   Registry::allowDuplicates(false);
 }
 
+class ColumnarTestTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"name", TEXT_TYPE}, {"size", BIGINT_TYPE}, {"ratio", DOUBLE_TYPE}};
+  }
+
+  void generateRows(QueryContext& context, TableRows& rows) {
+    rows.push_back({std::string("first"), 1LL, 0.5});
+    rows.push_back({std::string("second"), 2LL, 1.5});
+  }
+};
+
+TEST_F(ExtensionsTest, test_extension_columnar_table) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+
+  Registry::add<ColumnarTestTablePlugin>("table", "columnar_test");
+  Registry::allowDuplicates(true);
+
+  status = startExtension(socket_path, "test", "0.1", "0.0.0", "0.0.1");
+  ASSERT_TRUE(status.ok());
+  auto uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+  auto ext_socket = socket_path + "." + std::to_string(uuid);
+  EXPECT_TRUE(socketExists(ext_socket));
+
+  // This SDK negotiates typed, columnar table responses when registering.
+  EXPECT_TRUE(isColumnarExtension(uuid));
+
+  // The local column order differs from the table's, cells follow by name.
+  TableColumns columns = {
+      {"ratio", DOUBLE_TYPE}, {"name", TEXT_TYPE}, {"size", BIGINT_TYPE}};
+  TableRows rows;
+  status = generateExtensionTable(ext_socket,
+                                  "columnar_test",
+                                  {{"action", "generate"}},
+                                  columns,
+                                  rows);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(rows.size(), 2U);
+  EXPECT_EQ(boost::get<double>(rows[1][0]), 1.5);
+  EXPECT_EQ(boost::get<std::string>(rows[1][1]), "second");
+  EXPECT_EQ(boost::get<long long int>(rows[1][2]), 2LL);
+
+  ExtensionClientPool::instance().remove(ext_socket);
+  Registry::removeBroadcast(uuid);
+  Registry::allowDuplicates(false);
+}
+
+class SharedTestTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {{"name", TEXT_TYPE}, {"size", BIGINT_TYPE}};
+  }
+
+  void generateRows(QueryContext& context, TableRows& rows) {
+    for (long long int i = 0; i < 100; i++) {
+      rows.push_back({std::string("row") + std::to_string(i), i});
+    }
+  }
+};
+
+TEST_F(ExtensionsTest, test_shared_region) {
+  auto region = SharedRegion::create(4096);
+  ASSERT_NE(region->data(), nullptr);
+  EXPECT_EQ(region->size(), 4096U);
+
+  // Another process maps the region by name and writes into it.
+  {
+    auto writer = SharedRegion::open(region->name(), 4096);
+    memcpy(writer->data() + 100, "shared", 6);
+  }
+  EXPECT_EQ(std::string((const char*)region->data() + 100, 6), "shared");
+
+  // A region smaller than the writer expects is not mapped.
+  EXPECT_THROW(SharedRegion::open(region->name(), 8192), std::exception);
+
+  // The creator removes the shared memory object.
+  auto name = region->name();
+  region.reset();
+  EXPECT_THROW(SharedRegion::open(name, 4096), std::exception);
+}
+
+TEST_F(ExtensionsTest, test_extension_shared_table) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+
+  Registry::add<SharedTestTablePlugin>("table", "shared_test");
+  Registry::allowDuplicates(true);
+
+  status = startExtension(socket_path, "test", "0.1", "0.0.0", "0.0.1");
+  ASSERT_TRUE(status.ok());
+  auto uuid = (RouteUUID)stoi(status.getMessage(), nullptr, 0);
+  auto ext_socket = socket_path + "." + std::to_string(uuid);
+  EXPECT_TRUE(socketExists(ext_socket));
+  EXPECT_TRUE(isSharedExtension(uuid));
+
+  // A small ring holds a few rows, the rest follow with nextShared.
+  TableColumns columns = {{"size", BIGINT_TYPE}, {"name", TEXT_TYPE}};
+  TableRows rows;
+  status = generateSharedExtensionTable(
+      ext_socket, "shared_test", {{"action", "generate"}}, columns, 256, rows);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(rows.size(), 100U);
+  EXPECT_EQ(boost::get<long long int>(rows[99][0]), 99LL);
+  EXPECT_EQ(boost::get<std::string>(rows[99][1]), "row99");
+
+  // The ring is kept for the next response.
+  auto& pool = ExtensionClientPool::instance();
+  EXPECT_EQ(pool.idleRingCount(ext_socket), 1U);
+
+  // A row larger than the ring fails the response.
+  rows.clear();
+  status = generateSharedExtensionTable(
+      ext_socket, "shared_test", {{"action", "generate"}}, columns, 8, rows);
+  EXPECT_FALSE(status.ok());
+
+  pool.remove(ext_socket);
+  EXPECT_EQ(pool.idleRingCount(ext_socket), 0U);
+  Registry::removeBroadcast(uuid);
+  Registry::allowDuplicates(false);
+}
+
+/// Rows of every query run by the cursor test SQL plugin.
+const size_t kCursorTestRows = 10000;
+
+/// Stream numbered rows, counting the rows produced.
+class CursorTestSQLPlugin : public SQLPlugin {
+ public:
+  Status query(const std::string& q, QueryData& results) const override {
+    return query(q, [&results](Row& row) {
+      results.push_back(row);
+      return true;
+    });
+  }
+
+  Status query(const std::string& q,
+               const RowCallback& callback) const override {
+    for (size_t i = 0; i < kCursorTestRows; i++) {
+      Row r = {{"i", std::to_string(i)}};
+      produced++;
+      if (!callback(r)) {
+        break;
+      }
+    }
+    return Status(0, "OK");
+  }
+
+  Status getQueryColumns(const std::string& q,
+                         TableColumns& columns) const override {
+    return Status(0, "OK");
+  }
+
+  static std::atomic<size_t> produced;
+};
+
+std::atomic<size_t> CursorTestSQLPlugin::produced{0};
+
+TEST_F(ExtensionsTest, test_extension_query_cursor) {
+  Registry::add<CursorTestSQLPlugin>("sql", "sql");
+  CursorTestSQLPlugin::produced = 0;
+
+  ExtensionManagerHandler handler(socket_path);
+  ExtensionQueryResponse response;
+  handler.openQuery(response, "select", 100);
+  EXPECT_EQ(response.status.code, ExtensionCode::EXT_SUCCESS);
+  ASSERT_EQ(response.response.size(), 100U);
+  EXPECT_EQ(response.response[99]["i"], "99");
+  EXPECT_FALSE(response.done);
+
+  // Rows are produced no further than the fetched batch and the next row.
+  EXPECT_LE(CursorTestSQLPlugin::produced, 101U);
+  auto cursor = response.cursor;
+  response = ExtensionQueryResponse();
+  handler.fetchQuery(response, cursor, 100);
+  ASSERT_EQ(response.response.size(), 100U);
+  EXPECT_EQ(response.response[0]["i"], "100");
+  EXPECT_LE(CursorTestSQLPlugin::produced, 201U);
+
+  // A closed cursor stops its query and cannot be fetched.
+  ExtensionStatus closed;
+  handler.closeQuery(closed, cursor);
+  EXPECT_EQ(closed.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_LE(CursorTestSQLPlugin::produced, 202U);
+  response = ExtensionQueryResponse();
+  handler.fetchQuery(response, cursor, 100);
+  EXPECT_EQ(response.status.code, ExtensionCode::EXT_FAILED);
+
+  // A client reads every row through the manager in batches.
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+  size_t count = 0;
+  status = queryExternal(socket_path, "select", [&count](Row& row) {
+    count++;
+    return true;
+  });
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(count, kCursorTestRows);
+
+  // Stopping early closes the cursor.
+  count = 0;
+  status = queryExternal(socket_path, "select", [&count](Row& row) {
+    return (++count < 10);
+  });
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(count, 10U);
+}
+
+TEST_F(ExtensionsTest, test_extension_query_cursor_expiry) {
+  Registry::add<CursorTestSQLPlugin>("sql", "sql");
+  auto timeout = FLAGS_extensions_cursor_timeout;
+  FLAGS_extensions_cursor_timeout = 0;
+  expireQueryCursors();
+
+  // Open cursors are limited, more are refused.
+  ExtensionManagerHandler handler(socket_path);
+  std::vector<int64_t> cursors;
+  ExtensionQueryResponse response;
+  while (cursors.size() < 32) {
+    response = ExtensionQueryResponse();
+    handler.openQuery(response, "select", 1);
+    if (response.status.code != ExtensionCode::EXT_SUCCESS) {
+      break;
+    }
+    cursors.push_back(response.cursor);
+  }
+  EXPECT_EQ(cursors.size(), 16U);
+  EXPECT_EQ(response.status.message, "Too many open query cursors");
+
+  // The expiry service closes cursors a client abandoned.
+  Dispatcher::addService(std::make_shared<QueryCursorExpirer>());
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  FLAGS_extensions_cursor_timeout = timeout;
+  for (const auto& cursor : cursors) {
+    response = ExtensionQueryResponse();
+    handler.fetchQuery(response, cursor, 1);
+    EXPECT_EQ(response.status.code, ExtensionCode::EXT_FAILED);
+  }
+}
+
 TEST_F(ExtensionsTest, test_extension_module_search) {
   createMockFileStructure();
   EXPECT_FALSE(loadModules(kFakeDirectory + "/root.txt"));
@@ -8,6 +8,9 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <mutex>
 #include <sstream>
 
 #import <Foundation/Foundation.h>
@@ -23,6 +26,22 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+/// The most property lists with cached values.
+const size_t kPlistCacheMax = 4096;
+
+/// Values of a property list, the file stat and keys they were read with.
+struct PlistCacheEntry {
+  std::string stat;
+  std::set<std::string> keys;
+  std::map<std::string, std::string> values;
+};
+
+/// Cached parsePlistKeys results by path.
+static std::map<std::string, PlistCacheEntry> kPlistCache;
+
+/// Protect the cached parsePlistKeys results.
+static std::mutex kPlistCacheMutex;
+
 /**
  * @brief Filter selected data types from deserialized property list.
  *
@@ -166,36 +185,112 @@ Status parsePlist(const fs::path& path, pt::ptree& tree) {
   auto dropper = DropPrivileges::get();
   dropper->dropToParent(path);
 
-  auto status = readFile(path);
+  // The content is read once, the most common error is lack of permissions.
+  std::string content;
+  auto status = readFile(path, content);
+  if (!status.ok()) {
+    return status;
+  }
+  return parsePlistContent(content, tree);
+}
+
+/// Convert a top-level value, arrays are joined and dictionaries are empty.
+static std::string getTopLevelValue(id value) {
+  if ([value isKindOfClass:[NSDictionary class]]) {
+    return "";
+  } else if (![value isKindOfClass:[NSArray class]]) {
+    return getValue(value);
+  }
+
+  std::string joined;
+  for (id item in value) {
+    if (item == nil) {
+      continue;
+    }
+    if (!joined.empty()) {
+      joined += " ";
+    }
+    if (![item isKindOfClass:[NSArray class]] &&
+        ![item isKindOfClass:[NSDictionary class]]) {
+      joined += getValue(item);
+    }
+  }
+  return joined;
+}
+
+Status parsePlistKeys(const fs::path& path,
+                      const std::set<std::string>& keys,
+                      std::map<std::string, std::string>& values) {
+  values.clear();
+  struct stat info;
+  if (::stat(path.string().c_str(), &info) != 0) {
+    return Status(1, "Cannot stat plist: " + path.string());
+  }
+
+  auto stat = std::to_string(info.st_ino) + ":" +
+              std::to_string(info.st_mtimespec.tv_sec) + "." +
+              std::to_string(info.st_mtimespec.tv_nsec) + ":" +
+              std::to_string(info.st_size);
+  {
+    std::lock_guard<std::mutex> lock(kPlistCacheMutex);
+    auto entry = kPlistCache.find(path.string());
+    if (entry != kPlistCache.end() && entry->second.stat == stat &&
+        entry->second.keys == keys) {
+      values = entry->second.values;
+      return Status(0, "OK");
+    }
+  }
+
+  // Drop privileges, if needed, before parsing plist data.
+  auto dropper = DropPrivileges::get();
+  dropper->dropToParent(path);
+
+  std::string content;
+  auto status = readFile(path, content);
   if (!status.ok()) {
     return status;
   }
 
   @autoreleasepool {
-    id ns_path = [NSString stringWithUTF8String:path.string().c_str()];
-    id stream = [NSInputStream inputStreamWithFileAtPath:ns_path];
-    if (stream == nil) {
-      return Status(1, "Unable to read plist: " + path.string());
+    id data = [NSData dataWithBytesNoCopy:(void*)content.data()
+                                   length:content.size()
+                             freeWhenDone:NO];
+    if (data == nil) {
+      return Status(1, "Unable to create plist content");
     }
 
-    // Read file content into a data object, containing potential plist data.
     NSError* error = nil;
-    [stream open];
-    id plist_data = [NSPropertyListSerialization propertyListWithStream:stream
-                                                                options:0
-                                                                 format:NULL
-                                                                  error:&error];
-    if (plist_data == nil) {
-      // The most common error is lack of read permissions.
+    id plist = [NSPropertyListSerialization
+        propertyListWithData:data
+                     options:NSPropertyListImmutable
+                      format:NULL
+                       error:&error];
+    if (plist == nil) {
       std::string error_message([[error localizedFailureReason] UTF8String]);
       VLOG(1) << error_message;
-      [stream close];
       return Status(1, error_message);
     }
-    // Parse the plist data into a core foundation dictionary-literal.
-    status = filterPlist(plist_data, tree);
-    [stream close];
+    if (![plist isKindOfClass:[NSDictionary class]]) {
+      return Status(1, "Plist is not a dictionary: " + path.string());
+    }
+
+    // Only the requested keys are converted from the decoded objects.
+    for (const auto& key : keys) {
+      id value = [plist objectForKey:@(key.c_str())];
+      if (value != nil) {
+        values[key] = getTopLevelValue(value);
+      }
+    }
   }
-  return status;
+
+  std::lock_guard<std::mutex> lock(kPlistCacheMutex);
+  if (kPlistCache.size() >= kPlistCacheMax) {
+    kPlistCache.clear();
+  }
+  auto& entry = kPlistCache[path.string()];
+  entry.stat = std::move(stat);
+  entry.keys = keys;
+  entry.values = values;
+  return Status(0, "OK");
 }
 }
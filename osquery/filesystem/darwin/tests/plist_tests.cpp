@@ -102,4 +102,39 @@ TEST_F(PlistTests, test_parse_plist_content_with_blobs) {
   // Verify we parsed the binary blob correctly
   EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
 }
+
+TEST_F(PlistTests, test_parse_plist_keys) {
+  std::map<std::string, std::string> values;
+  auto s = parsePlistKeys(kTestDataPath + "test.plist",
+                          {"Label", "Disabled", "ProgramArguments", "foobar"},
+                          values);
+  EXPECT_TRUE(s.ok());
+
+  // Only the requested keys that exist are read.
+  EXPECT_EQ(values.size(), 3U);
+  EXPECT_EQ(values.count("foobar"), 0U);
+  EXPECT_EQ(values["Label"], "com.apple.FileSyncAgent.sshd");
+  EXPECT_EQ(values["Disabled"], "1");
+  EXPECT_EQ(values["ProgramArguments"],
+            "/System/Library/CoreServices/FileSyncAgent.app/Contents/"
+            "Resources/FileSyncAgent_sshd-keygen-wrapper -i -f "
+            "/System/Library/CoreServices/FileSyncAgent.app/Contents/"
+            "Resources/FileSyncAgent_sshd_config");
+
+  // A repeated read is served from the cache with the same values.
+  std::map<std::string, std::string> cached;
+  s = parsePlistKeys(kTestDataPath + "test.plist",
+                     {"Label", "Disabled", "ProgramArguments", "foobar"},
+                     cached);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, cached);
+
+  // The cached values are not reused for a different set of keys.
+  s = parsePlistKeys(kTestDataPath + "test.plist", {"Label"}, cached);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(cached.size(), 1U);
+
+  s = parsePlistKeys(kTestDataPath + "test_array.plist", {"Label"}, values);
+  EXPECT_FALSE(s.ok());
+}
 }
@@ -8,6 +8,8 @@
  *
  */
 
+#include <cerrno>
+#include <cstring>
 #include <sstream>
 
 #include <fcntl.h>
@@ -18,13 +20,16 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
-#include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/governor.h"
+#include "osquery/core/json.h"
+#include "osquery/filesystem/walker.h"
+
 namespace pt = boost::property_tree;
 namespace fs = boost::filesystem;
 namespace errc = boost::system::errc;
@@ -42,6 +47,12 @@ HIDDEN_FLAG(bool, disable_forensic, true, "Disable atime/mtime preservation");
 
 static const size_t kMaxRecursiveGlobs = 64;
 
+/// The block size of line-based reads, a line spanning blocks is copied.
+static const size_t kReadLinesBlockSize = 64 * 1024;
+
+/// The content before a checkpoint compared to detect a rewritten file.
+static const size_t kCheckpointTailSize = 64;
+
 Status writeTextFile(const fs::path& path,
                      const std::string& content,
                      int permissions,
@@ -92,27 +103,31 @@ struct OpenReadableFile {
   DropPrivilegesRef dropper_{nullptr};
 };
 
-Status readFile(
+/// Read an open file from an offset, see the predicate form of readFile.
+static Status readFileAt(
     const fs::path& path,
+    int fd,
+    const struct stat& file,
+    off_t offset,
     size_t size,
     size_t block_size,
     bool dry_run,
     bool preserve_time,
     std::function<void(std::string& buffer, size_t size)> predicate) {
-  auto handle = OpenReadableFile(path);
-  if (handle.fd < 0) {
-    return Status(1, "Cannot open file for reading: " + path.string());
-  }
-
-  struct stat file;
-  if (fstat(handle.fd, &file) < 0) {
-    return Status(1, "Cannot access path: " + path.string());
-  }
-
   off_t file_size = file.st_size;
   if (file_size == 0 && size > 0) {
     file_size = static_cast<off_t>(size);
   }
+  if (offset > 0) {
+    if (file_size < offset || lseek(fd, offset, SEEK_SET) != offset) {
+      return Status(1, "Cannot seek in file: " + path.string());
+    }
+    // A read to the end of the file remains unsized.
+    file_size -= offset;
+    if (file_size == 0) {
+      return Status(0, "OK");
+    }
+  }
 
   // Apply the max byte-read based on file/link target ownership.
   off_t read_max = (file.st_uid == 0)
@@ -139,42 +154,97 @@ Status readFile(
   TIMESPEC_TO_TIMEVAL(&times[1], &file.st_mtimespec);
 #endif
 
+  // A predicate may take the buffer, it is reallocated for the next block.
+  std::string part;
   if (file_size == 0) {
+    size_t part_size = (block_size > 0) ? block_size : 4096;
     off_t total_bytes = 0;
     ssize_t part_bytes = 0;
     do {
-      auto part = std::string(4096, '\0');
-      part_bytes = read(handle.fd, &part[0], block_size);
+      if (part.size() != part_size) {
+        part.assign(part_size, '\0');
+      }
+      part_bytes = read(fd, &part[0], part_size);
       if (part_bytes > 0) {
         total_bytes += part_bytes;
         if (total_bytes >= read_max) {
           return Status(1, "File exceeds read limits");
         }
-        //        content += part.substr(0, part_bytes);
+        throttleRead(part_bytes);
         predicate(part, part_bytes);
       }
     } while (part_bytes > 0);
   } else {
-    auto content = std::string(file_size, '\0');
-    read(handle.fd, &content[0], file_size);
-    predicate(content, file_size);
+#if defined(__linux__)
+    posix_fadvise(fd, offset, file_size, POSIX_FADV_SEQUENTIAL);
+#endif
+    // Read the file in blocks of block_size, or whole if block_size is 0.
+    size_t part_size = static_cast<size_t>(file_size);
+    if (block_size > 0 && block_size < part_size) {
+      part_size = block_size;
+    }
+    off_t total_bytes = 0;
+    while (total_bytes < file_size) {
+      if (part.size() != part_size) {
+        part.assign(part_size, '\0');
+      }
+      auto remaining = static_cast<size_t>(file_size - total_bytes);
+      auto part_bytes = read(fd, &part[0], std::min(part_size, remaining));
+      if (part_bytes < 0 && errno == EINTR) {
+        continue;
+      } else if (part_bytes <= 0) {
+        // The file was truncated while reading.
+        break;
+      }
+      total_bytes += part_bytes;
+      throttleRead(part_bytes);
+      predicate(part, part_bytes);
+    }
   }
 
   // Attempt to restore the atime and mtime before the file read.
   if (preserve_time && !FLAGS_disable_forensic) {
-    futimes(handle.fd, times);
+    futimes(fd, times);
   }
   return Status(0, "OK");
 }
 
+Status readFile(
+    const fs::path& path,
+    size_t size,
+    size_t block_size,
+    bool dry_run,
+    bool preserve_time,
+    std::function<void(std::string& buffer, size_t size)> predicate) {
+  auto handle = OpenReadableFile(path);
+  if (handle.fd < 0) {
+    return Status(1, "Cannot open file for reading: " + path.string());
+  }
+
+  struct stat file;
+  if (fstat(handle.fd, &file) < 0) {
+    return Status(1, "Cannot access path: " + path.string());
+  }
+  return readFileAt(path,
+                    handle.fd,
+                    file,
+                    0,
+                    size,
+                    block_size,
+                    dry_run,
+                    preserve_time,
+                    predicate);
+}
+
 Status readFile(const fs::path& path,
                 std::string& content,
                 size_t size,
                 bool dry_run,
                 bool preserve_time) {
+  // Sized files are read whole, a single buffer moved into the content.
   return readFile(path,
                   size,
-                  4096,
+                  0,
                   dry_run,
                   preserve_time,
                   ([&content](std::string& buffer, size_t size) {
@@ -195,6 +265,107 @@ Status forensicReadFile(const fs::path& path, std::string& content) {
   return readFile(path, content, 0, false, true);
 }
 
+/// The checkpoint is of this file and its content before the offset is read.
+static bool isCheckpointOf(int fd,
+                           const struct stat& file,
+                           const FileCheckpoint& checkpoint) {
+  if (checkpoint.device != file.st_dev ||
+             checkpoint.inode != file.st_ino ||
+             checkpoint.offset > static_cast<size_t>(file.st_size)) {
+    return false;
+  }
+
+  // A file rewritten in place, such as a truncated shell history, differs.
+  std::string tail(checkpoint.tail.size(), '\0');
+  auto position = static_cast<off_t>(checkpoint.offset - tail.size());
+  return pread(fd, &tail[0], tail.size(), position) ==
+             static_cast<ssize_t>(tail.size()) &&
+         tail == checkpoint.tail;
+}
+
+Status readNewLines(const fs::path& path,
+                    FileCheckpoint& checkpoint,
+                    std::function<void(FileLine line)> predicate,
+                    bool preserve_time) {
+  auto handle = OpenReadableFile(path);
+  if (handle.fd < 0) {
+    return Status(1, "Cannot open file for reading: " + path.string());
+  }
+
+  struct stat file;
+  if (fstat(handle.fd, &file) < 0) {
+    return Status(1, "Cannot access path: " + path.string());
+  }
+
+  if (!isCheckpointOf(handle.fd, file, checkpoint)) {
+    checkpoint.offset = 0;
+    checkpoint.tail.clear();
+  }
+  checkpoint.reset = (checkpoint.offset == 0);
+  checkpoint.device = file.st_dev;
+  checkpoint.inode = file.st_ino;
+
+  // The start of a line continued in the next block.
+  auto& partial = checkpoint.partial;
+  partial.clear();
+  size_t offset = checkpoint.offset;
+  auto status = readFileAt(
+      path,
+      handle.fd,
+      file,
+      static_cast<off_t>(offset),
+      0,
+      kReadLinesBlockSize,
+      false,
+      preserve_time,
+      ([&partial, &predicate, &offset](std::string& buffer, size_t size) {
+        const char* line = buffer.data();
+        const char* end = line + size;
+        const void* newline = nullptr;
+        while ((newline = memchr(line, '\n', end - line)) != nullptr) {
+          auto length = static_cast<const char*>(newline) - line;
+          if (partial.empty()) {
+            predicate(FileLine(line, length));
+          } else {
+            partial.append(line, length);
+            predicate(FileLine(partial));
+            partial.clear();
+          }
+          line += length + 1;
+        }
+        partial.append(line, end - line);
+        offset += size;
+      }));
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The checkpoint follows the last line ending with a newline.
+  checkpoint.offset = offset - partial.size();
+  auto tail_size = std::min(checkpoint.offset, kCheckpointTailSize);
+  checkpoint.tail.assign(tail_size, '\0');
+  auto position = static_cast<off_t>(checkpoint.offset - tail_size);
+  if (pread(handle.fd, &checkpoint.tail[0], tail_size, position) !=
+      static_cast<ssize_t>(tail_size)) {
+    // The file was truncated while reading, the next read starts again.
+    checkpoint.offset = 0;
+    checkpoint.tail.clear();
+  }
+  return status;
+}
+
+Status readLines(const fs::path& path,
+                 std::function<void(FileLine line)> predicate,
+                 bool preserve_time) {
+  FileCheckpoint checkpoint;
+  auto status = readNewLines(path, checkpoint, predicate, preserve_time);
+  if (status.ok() && !checkpoint.partial.empty()) {
+    // The last line does not end with a newline.
+    predicate(FileLine(checkpoint.partial));
+  }
+  return status;
+}
+
 Status isWritable(const fs::path& path) {
   auto path_exists = pathExists(path);
   if (!path_exists.ok()) {
@@ -243,23 +414,38 @@ static void genGlobs(std::string path,
   // Use our helped escape/replace for wildcards.
   replaceGlobWildcards(path);
 
-  // Generate a glob set and recurse for double star.
-  size_t glob_index = 0;
-  while (++glob_index < kMaxRecursiveGlobs) {
-    glob_t data;
-    glob(path.c_str(), GLOB_TILDE | GLOB_MARK | GLOB_BRACE, nullptr, &data);
-    size_t count = data.gl_pathc;
-    for (size_t index = 0; index < count; index++) {
-      results.push_back(data.gl_pathv[index]);
+  // Generate a glob set, the double star matches the first level.
+  glob_t data;
+  glob(path.c_str(), GLOB_TILDE | GLOB_MARK | GLOB_BRACE, nullptr, &data);
+  size_t count = data.gl_pathc;
+  for (size_t index = 0; index < count; index++) {
+    results.push_back(data.gl_pathv[index]);
+  }
+  globfree(&data);
+
+  // A recursive ending walks the matched directories once, rather than
+  // globbing each additional level from the root.
+  size_t wild = path.rfind("**");
+  // Allow a trailing slash after the double wild indicator.
+  if (count > 0 && wild <= path.size() && wild >= path.size() - 3) {
+    std::vector<std::string> roots;
+    for (const auto& found : results) {
+      if (found[found.length() - 1] == '/') {
+        roots.push_back(found);
+      }
     }
-    globfree(&data);
-    // The end state is a non-recursive ending or empty set of matches.
-    size_t wild = path.rfind("**");
-    // Allow a trailing slash after the double wild indicator.
-    if (count == 0 || wild > path.size() || wild < path.size() - 3) {
-      break;
+
+    // Match glob, which skips hidden entries and follows linked directories.
+    WalkLimits walk_limits;
+    walk_limits.max_depth = kMaxRecursiveGlobs - 2;
+    walk_limits.follow_links = true;
+    walk_limits.hidden = false;
+    std::vector<WalkEntry> entries;
+    FileWalker::walk(roots, walk_limits, entries);
+    for (const auto& entry : entries) {
+      results.push_back(S_ISDIR(entry.info.st_mode) ? entry.path + '/'
+                                                    : entry.path);
     }
-    path += "/**";
   }
 
   // Prune results based on settings/requested glob limitations.
@@ -436,12 +622,7 @@ Status parseJSON(const fs::path& path, pt::ptree& tree) {
 }
 
 Status parseJSONContent(const std::string& content, pt::ptree& tree) {
-  // Read the extensions data into a JSON blob, then property tree.
-  try {
-    std::stringstream json_stream;
-    json_stream << content;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
+  if (!parseJSONTree(content, tree).ok()) {
     return Status(1, "Could not parse JSON from file");
   }
   return Status(0, "OK");
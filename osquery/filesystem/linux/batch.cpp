@@ -0,0 +1,405 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#ifndef STATX_BASIC_STATS
+#include <linux/stat.h>
+#endif
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define OSQUERY_IO_URING 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/logger.h>
+
+#include "osquery/dispatcher/executor.h"
+#include "osquery/filesystem/linux/batch.h"
+
+namespace osquery {
+
+FLAG(bool,
+     disable_io_uring,
+     true,
+     "Disable batching file status reads with io_uring");
+
+/// Batches smaller than this are read on the calling thread.
+const size_t kBatchMin = 64;
+
+/// The requests read by each task of the table executor.
+const size_t kBatchChunk = 512;
+
+/// The io_uring submission queue entries, the most reads in flight.
+const unsigned kIOUringEntries = 256;
+
+/// Cleared when the kernel or a sandbox does not allow io_uring statx.
+static std::atomic<bool> kIOUringStatx{true};
+
+static void readStat(BatchStat& request) {
+  int flags = (request.follow) ? 0 : AT_SYMLINK_NOFOLLOW;
+  request.ok =
+      (fstatat(request.dir, request.path.c_str(), &request.info, flags) == 0);
+}
+
+static void readLink(BatchLink& request) {
+  char link[PATH_MAX] = {0};
+  auto size =
+      readlinkat(request.dir, request.path.c_str(), link, sizeof(link) - 1);
+  request.ok = (size >= 0);
+  if (request.ok) {
+    request.link.assign(link, size);
+  }
+}
+
+/// Read each request, splitting large batches across the table executor.
+template <typename T>
+static void readRequests(const std::vector<T*>& requests, void (*read)(T&)) {
+  if (requests.size() < kBatchMin) {
+    for (auto request : requests) {
+      read(*request);
+    }
+    return;
+  }
+
+  std::vector<TaskRef> tasks;
+  for (size_t begin = 0; begin < requests.size(); begin += kBatchChunk) {
+    auto end = std::min(begin + kBatchChunk, requests.size());
+    auto work = [&requests, read, begin, end](const Task& task) {
+      for (size_t i = begin; i < end; i++) {
+        read(*requests[i]);
+      }
+    };
+
+    auto task = getTableExecutor().submit(work, TASK_PRIORITY_SCHEDULE);
+    if (task == nullptr) {
+      // The executor is stopping, read the chunk on this thread.
+      for (size_t i = begin; i < end; i++) {
+        read(*requests[i]);
+      }
+      continue;
+    }
+    tasks.push_back(task);
+  }
+
+  for (const auto& task : tasks) {
+    task->runOrWait();
+  }
+}
+
+#ifdef OSQUERY_IO_URING
+/**
+ * @brief A minimal io_uring for statx operations.
+ *
+ * The submission and completion rings are mapped from the ring descriptor.
+ * Operations are prepared in the submission ring, then submitted with the
+ * wait for completions in one io_uring_enter.
+ */
+class IOUring : private boost::noncopyable {
+ public:
+  explicit IOUring(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+      return;
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ring_ = map(sq_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP)
+                   ? sq_ring_
+                   : map(cq_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(
+        map(sqes_size_, IORING_OFF_SQES));
+    if (sq_ring_ == nullptr || cq_ring_ == nullptr || sqes_ == nullptr) {
+      reset();
+      return;
+    }
+
+    auto sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+
+    auto cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  ~IOUring() { reset(); }
+
+  bool ok() const { return fd_ >= 0; }
+
+  /// Prepare a statx, false if the submission ring is full.
+  bool prepareStatx(int dir,
+                    const char* path,
+                    int flags,
+                    struct statx* buffer,
+                    uint64_t data) {
+    auto tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+      return false;
+    }
+
+    auto index = tail & sq_mask_;
+    auto& sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_STATX;
+    sqe.fd = dir;
+    sqe.addr = reinterpret_cast<uint64_t>(path);
+    sqe.len = STATX_BASIC_STATS;
+    sqe.off = reinterpret_cast<uint64_t>(buffer);
+    sqe.statx_flags = static_cast<uint32_t>(flags);
+    sqe.user_data = data;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    prepared_++;
+    return true;
+  }
+
+  /// Submit the prepared operations and wait for a completion.
+  bool submitAndWait() {
+    while (true) {
+      auto submitted = ::syscall(__NR_io_uring_enter,
+                                 fd_,
+                                 prepared_,
+                                 1,
+                                 IORING_ENTER_GETEVENTS,
+                                 nullptr,
+                                 0);
+      if (submitted >= 0) {
+        prepared_ -= static_cast<unsigned>(submitted);
+        return true;
+      } else if (errno != EINTR) {
+        return false;
+      }
+    }
+  }
+
+  /// Take a completion, false if none are ready.
+  bool complete(uint64_t& data, int32_t& result) {
+    auto head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      return false;
+    }
+    const auto& cqe = cqes_[head & cq_mask_];
+    data = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  /// The prepared operations not yet taken by the kernel.
+  unsigned prepared() const { return prepared_; }
+
+ private:
+  void* map(size_t size, uint64_t offset) {
+    auto address = mmap(nullptr,
+                        size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        fd_,
+                        static_cast<off_t>(offset));
+    return (address == MAP_FAILED) ? nullptr : address;
+  }
+
+  void reset() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_size_);
+    }
+    if (sq_ring_ != nullptr) {
+      munmap(sq_ring_, sq_size_);
+    }
+    sqes_ = nullptr;
+    cq_ring_ = sq_ring_ = nullptr;
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+ private:
+  int fd_{-1};
+
+  void* sq_ring_{nullptr};
+  size_t sq_size_{0};
+  void* cq_ring_{nullptr};
+  size_t cq_size_{0};
+  struct io_uring_sqe* sqes_{nullptr};
+  size_t sqes_size_{0};
+
+  unsigned* sq_head_{nullptr};
+  unsigned* sq_tail_{nullptr};
+  unsigned* sq_array_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned sq_entries_{0};
+
+  unsigned* cq_head_{nullptr};
+  unsigned* cq_tail_{nullptr};
+  struct io_uring_cqe* cqes_{nullptr};
+  unsigned cq_mask_{0};
+
+  /// Prepared operations not yet submitted.
+  unsigned prepared_{0};
+};
+
+static void toStat(const struct statx& from, struct stat& to) {
+  memset(&to, 0, sizeof(to));
+  to.st_dev = makedev(from.stx_dev_major, from.stx_dev_minor);
+  to.st_ino = from.stx_ino;
+  to.st_mode = from.stx_mode;
+  to.st_nlink = from.stx_nlink;
+  to.st_uid = from.stx_uid;
+  to.st_gid = from.stx_gid;
+  to.st_rdev = makedev(from.stx_rdev_major, from.stx_rdev_minor);
+  to.st_size = static_cast<off_t>(from.stx_size);
+  to.st_blksize = from.stx_blksize;
+  to.st_blocks = static_cast<blkcnt_t>(from.stx_blocks);
+  to.st_atim.tv_sec = from.stx_atime.tv_sec;
+  to.st_atim.tv_nsec = from.stx_atime.tv_nsec;
+  to.st_mtim.tv_sec = from.stx_mtime.tv_sec;
+  to.st_mtim.tv_nsec = from.stx_mtime.tv_nsec;
+  to.st_ctim.tv_sec = from.stx_ctime.tv_sec;
+  to.st_ctim.tv_nsec = from.stx_ctime.tv_nsec;
+}
+
+/**
+ * @brief Read the status of requests with an io_uring.
+ *
+ * Requests the ring could not read, because the kernel does not support
+ * statx operations or the ring failed, are returned for the table executor.
+ */
+static std::vector<BatchStat*> statWithIOUring(
+    std::vector<BatchStat>& requests) {
+  std::vector<BatchStat*> remaining;
+  IOUring ring(kIOUringEntries);
+  if (!ring.ok()) {
+    // A sandbox or kernel.io_uring_disabled denies rings, do not retry.
+    VLOG(1) << "Cannot create an io_uring: " << strerror(errno);
+    kIOUringStatx = false;
+    for (auto& request : requests) {
+      remaining.push_back(&request);
+    }
+    return remaining;
+  }
+
+  // The kernel writes completed operations into the buffers. A buffer is
+  // released only when every submitted operation completed.
+  std::unique_ptr<struct statx[]> buffers(new struct statx[requests.size()]);
+  std::vector<char> done(requests.size(), 0);
+  size_t next = 0;
+  size_t submitted = 0;
+  bool failed = false;
+  while ((!failed && next < requests.size()) || submitted > 0) {
+    while (!failed && next < requests.size()) {
+      auto& request = requests[next];
+      int flags = AT_STATX_SYNC_AS_STAT |
+                  ((request.follow) ? 0 : AT_SYMLINK_NOFOLLOW);
+      if (!ring.prepareStatx(
+              request.dir, request.path.c_str(), flags, &buffers[next], next)) {
+        break;
+      }
+      next++;
+    }
+
+    auto prepared = ring.prepared();
+    if (!ring.submitAndWait()) {
+      if (submitted == 0) {
+        break;
+      }
+      // Operations in flight may still write the buffers, keep them.
+      LOG(WARNING) << "Cannot wait for io_uring completions: "
+                   << strerror(errno);
+      buffers.release();
+      kIOUringStatx = false;
+      break;
+    }
+    submitted += prepared - ring.prepared();
+    failed = failed || (ring.prepared() > 0 && next < requests.size());
+
+    uint64_t index = 0;
+    int32_t result = 0;
+    while (ring.complete(index, result)) {
+      submitted--;
+      if (result == -EINVAL) {
+        // Kernels before 5.6 do not support statx operations.
+        kIOUringStatx = false;
+        failed = true;
+        continue;
+      }
+      done[index] = 1;
+      requests[index].ok = (result == 0);
+      if (requests[index].ok) {
+        toStat(buffers[index], requests[index].info);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < requests.size(); i++) {
+    if (!done[i]) {
+      remaining.push_back(&requests[i]);
+    }
+  }
+  return remaining;
+}
+#endif
+
+void batchStat(std::vector<BatchStat>& requests) {
+  std::vector<BatchStat*> remaining;
+#ifdef OSQUERY_IO_URING
+  if (!FLAGS_disable_io_uring && kIOUringStatx &&
+      requests.size() >= kBatchMin) {
+    remaining = statWithIOUring(requests);
+    readRequests(remaining, readStat);
+    return;
+  }
+#endif
+
+  for (auto& request : requests) {
+    remaining.push_back(&request);
+  }
+  readRequests(remaining, readStat);
+}
+
+void batchReadLink(std::vector<BatchLink>& requests) {
+  std::vector<BatchLink*> remaining;
+  for (auto& request : requests) {
+    remaining.push_back(&request);
+  }
+  readRequests(remaining, readLink);
+}
+}
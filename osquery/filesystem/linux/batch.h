@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_bool(disable_io_uring);
+
+/// A file status read by batchStat.
+struct BatchStat {
+  /// The directory a relative path is read from, AT_FDCWD for the cwd.
+  int dir{AT_FDCWD};
+
+  std::string path;
+
+  /// Read the status of a final symlink's target, as stat, or the link.
+  bool follow{true};
+
+  /// The status, set if ok.
+  struct stat info;
+
+  bool ok{false};
+};
+
+/// A symbolic link read by batchReadLink.
+struct BatchLink {
+  /// The directory a relative path is read from, AT_FDCWD for the cwd.
+  int dir{AT_FDCWD};
+
+  std::string path;
+
+  /// The link content, set if ok.
+  std::string link;
+
+  bool ok{false};
+};
+
+/**
+ * @brief Read the status of many files.
+ *
+ * Large batches are split across the workers of getTableExecutor. With
+ * --disable_io_uring=false they are submitted to an io_uring as statx
+ * operations instead, a few hundred in flight with one io_uring_enter per
+ * completion batch, and the workers read what the ring cannot. Small batches
+ * are read on the calling thread.
+ */
+void batchStat(std::vector<BatchStat>& requests);
+
+/**
+ * @brief Read many symbolic links, such as the `/proc/<pid>/fd` links.
+ *
+ * io_uring has no readlink operation, large batches are split across the
+ * workers used by batchStat.
+ */
+void batchReadLink(std::vector<BatchLink>& requests);
+}
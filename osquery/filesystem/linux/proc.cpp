@@ -8,18 +8,306 @@
  *
  */
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <unistd.h>
 
 #include <boost/filesystem.hpp>
 
+#include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/filesystem/linux/batch.h"
 
 namespace osquery {
 
 const std::string kLinuxProcPath = "/proc";
 
+/// Seconds a process snapshot is shared, the scheduler steps every second.
+const size_t kProcSnapshotTTL = 1;
+
+/// Bytes of process files a snapshot keeps, later reads are not kept.
+const size_t kProcSnapshotMaxSize = 16 * 1024 * 1024;
+
+/// The snapshot shared by process tables, owned by the queries using it.
+static std::weak_ptr<ProcSnapshot> kProcSnapshot;
+static std::mutex kProcSnapshotMutex;
+
+/// The root of new snapshots, protected by the snapshot mutex.
+static std::string kProcSnapshotRoot = kLinuxProcPath;
+
+/// Read a file relative to a directory descriptor until the end of file.
+static bool readAt(int dir, const std::string& name, std::string& content) {
+  int fd = openat(dir, name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Sizes of proc files are not reported, read until there is no more.
+  char buffer[4096];
+  ssize_t bytes = 0;
+  while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, bytes);
+  }
+  close(fd);
+  return bytes == 0;
+}
+
+/// Read a link relative to a directory descriptor.
+static bool readLinkAt(int dir, const char* name, std::string& result) {
+  char link[PATH_MAX] = {0};
+  auto size = readlinkat(dir, name, link, sizeof(link) - 1);
+  if (size < 0) {
+    return false;
+  }
+  result.assign(link, size);
+  return true;
+}
+
+std::shared_ptr<ProcSnapshot> ProcSnapshot::current() {
+  std::lock_guard<std::mutex> lock(kProcSnapshotMutex);
+  auto snapshot = kProcSnapshot.lock();
+  if (snapshot == nullptr ||
+      getUnixTime() >= snapshot->time_ + kProcSnapshotTTL) {
+    snapshot = std::make_shared<ProcSnapshot>(kProcSnapshotRoot);
+    kProcSnapshot = snapshot;
+  }
+
+  // The other tables of the query share the snapshot until the query ends.
+  QueryResources::keep(snapshot);
+  return snapshot;
+}
+
+void ProcSnapshot::setRoot(const std::string& root) {
+  std::lock_guard<std::mutex> lock(kProcSnapshotMutex);
+  kProcSnapshotRoot = root;
+  kProcSnapshot.reset();
+}
+
+std::string ProcSnapshot::root() {
+  std::lock_guard<std::mutex> lock(kProcSnapshotMutex);
+  return kProcSnapshotRoot;
+}
+
+ProcSnapshot::ProcSnapshot() : ProcSnapshot(root()) {}
+
+ProcSnapshot::ProcSnapshot(const std::string& root) : time_(getUnixTime()) {
+  proc_ = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (proc_ < 0) {
+    VLOG(1) << "Cannot open " << root;
+    return;
+  }
+
+  // Iterate a duplicate, closing the directory stream closes its descriptor.
+  int list = dup(proc_);
+  auto dir = (list >= 0) ? fdopendir(list) : nullptr;
+  if (dir == nullptr) {
+    if (list >= 0) {
+      close(list);
+    }
+    return;
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(dir)) != nullptr) {
+    if ((entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN) &&
+        std::atoll(entry->d_name) > 0) {
+      pids_.insert(entry->d_name);
+    }
+  }
+  closedir(dir);
+}
+
+ProcSnapshot::~ProcSnapshot() {
+  if (proc_ >= 0) {
+    close(proc_);
+  }
+}
+
+int ProcSnapshot::openProcess(const std::string& pid) const {
+  if (proc_ < 0 || std::atoll(pid.c_str()) <= 0) {
+    return -1;
+  }
+  return openat(proc_, pid.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+bool ProcSnapshot::exists(const std::string& pid) const {
+  int dir = openProcess(pid);
+  if (dir < 0) {
+    return false;
+  }
+  close(dir);
+  return true;
+}
+
+std::string ProcSnapshot::readCached(std::map<std::string, std::string>& cache,
+                                     const std::string& pid,
+                                     const std::string& attr) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = cache.find(pid);
+    if (it != cache.end()) {
+      return it->second;
+    }
+  }
+
+  // Read without the lock, a concurrent read of the same file is kept once.
+  auto content = read(pid, attr);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ + content.size() <= kProcSnapshotMaxSize &&
+      cache.insert(std::make_pair(pid, content)).second) {
+    size_ += content.size();
+  }
+  return content;
+}
+
+std::string ProcSnapshot::stat(const std::string& pid) {
+  return readCached(stat_, pid, "stat");
+}
+
+std::string ProcSnapshot::status(const std::string& pid) {
+  return readCached(status_, pid, "status");
+}
+
+std::string ProcSnapshot::maps(const std::string& pid) {
+  return readCached(maps_, pid, "maps");
+}
+
+/// List the descriptor links of a process fd directory, without reading them.
+static void listDescriptors(int fds, std::vector<BatchLink>& links) {
+  int list = dup(fds);
+  auto fd_dir = (list >= 0) ? fdopendir(list) : nullptr;
+  if (fd_dir == nullptr) {
+    if (list >= 0) {
+      close(list);
+    }
+    return;
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(fd_dir)) != nullptr) {
+    if (entry->d_name[0] != '.') {
+      BatchLink link;
+      link.dir = fds;
+      link.path = entry->d_name;
+      links.push_back(std::move(link));
+    }
+  }
+  closedir(fd_dir);
+}
+
+void ProcSnapshot::readDescriptors(const std::set<std::string>& pids) {
+  // Access to a process' fd directory may be restricted.
+  std::vector<std::pair<std::string, int>> directories;
+  std::vector<BatchLink> links;
+  std::vector<size_t> ends;
+  for (const auto& pid : pids) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (descriptors_.count(pid) > 0) {
+        continue;
+      }
+    }
+
+    int dir = openProcess(pid);
+    int fds = (dir >= 0)
+                  ? openat(dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                  : -1;
+    if (dir >= 0) {
+      close(dir);
+    }
+    if (fds >= 0) {
+      listDescriptors(fds, links);
+    }
+    directories.push_back(std::make_pair(pid, fds));
+    ends.push_back(links.size());
+  }
+
+  // The links of every process are read in one batch.
+  batchReadLink(links);
+
+  size_t begin = 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < directories.size(); i++) {
+    std::map<std::string, std::string> descriptors;
+    for (size_t j = begin; j < ends[i]; j++) {
+      if (links[j].ok) {
+        descriptors[links[j].path] = std::move(links[j].link);
+      }
+    }
+    begin = ends[i];
+    if (directories[i].second >= 0) {
+      close(directories[i].second);
+    }
+    descriptors_.insert(
+        std::make_pair(directories[i].first, std::move(descriptors)));
+  }
+}
+
+const std::map<std::string, std::string>& ProcSnapshot::descriptors(
+    const std::string& pid) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = descriptors_.find(pid);
+    if (it != descriptors_.end()) {
+      return it->second;
+    }
+  }
+
+  readDescriptors({pid});
+  std::lock_guard<std::mutex> lock(mutex_);
+  return descriptors_[pid];
+}
+
+std::string ProcSnapshot::read(const std::string& pid,
+                               const std::string& attr) const {
+  std::string content;
+  int dir = openProcess(pid);
+  if (dir >= 0) {
+    if (!readAt(dir, attr, content)) {
+      content.clear();
+    }
+    close(dir);
+  }
+  return content;
+}
+
+std::string ProcSnapshot::readLink(const std::string& pid,
+                                   const std::string& attr) const {
+  std::string result;
+  int dir = openProcess(pid);
+  if (dir >= 0) {
+    readLinkAt(dir, attr.c_str(), result);
+    close(dir);
+  }
+  return result;
+}
+
+const std::string& ProcSnapshot::getNamespace(const std::string& pid,
+                                             const std::string& type) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = namespaces_[pid].find(type);
+    if (it != namespaces_[pid].end()) {
+      return it->second;
+    }
+  }
+
+  // The link is the type and inode, such as "net:[4026531992]".
+  auto link = readLink(pid, "ns/" + type);
+  auto begin = link.find('[');
+  auto end = link.rfind(']');
+  auto inode = (begin != std::string::npos && end != std::string::npos &&
+                end > begin)
+                   ? link.substr(begin + 1, end - begin - 1)
+                   : "";
+  std::lock_guard<std::mutex> lock(mutex_);
+  return namespaces_[pid].insert(std::make_pair(type, inode)).first->second;
+}
+
 Status procProcesses(std::set<std::string>& processes) {
   // Iterate over each process-like directory in proc.
   boost::filesystem::directory_iterator it(kLinuxProcPath), end;
@@ -43,20 +331,21 @@ Status procProcesses(std::set<std::string>& processes) {
 Status procDescriptors(const std::string& process,
                        std::map<std::string, std::string>& descriptors) {
   auto descriptors_path = kLinuxProcPath + "/" + process + "/fd";
-  try {
+  int fds = open(descriptors_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fds < 0) {
     // Access to the process' /fd may be restricted.
-    boost::filesystem::directory_iterator it(descriptors_path), end;
-    for (; it != end; ++it) {
-      auto fd = it->path().leaf().string();
-      std::string linkname;
-      if (procReadDescriptor(process, fd, linkname).ok()) {
-        descriptors[fd] = linkname;
-      }
-    }
-  } catch (boost::filesystem::filesystem_error& e) {
     return Status(1, "Cannot access descriptors for " + process);
   }
 
+  std::vector<BatchLink> links;
+  listDescriptors(fds, links);
+  batchReadLink(links);
+  close(fds);
+  for (auto& link : links) {
+    if (link.ok) {
+      descriptors[link.path] = std::move(link.link);
+    }
+  }
   return Status(0, "OK");
 }
 
@@ -18,8 +18,14 @@
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/test_util.h"
+#include "osquery/filesystem/walker.h"
+
+#ifdef __linux__
+#include "osquery/filesystem/linux/batch.h"
+#endif
 
 namespace pt = boost::property_tree;
 
@@ -55,6 +61,60 @@ TEST_F(FilesystemTests, test_read_file) {
   remove(kTestWorkingDirectory + "fstests-file");
 }
 
+TEST_F(FilesystemTests, test_read_lines) {
+  // A line longer than a read block spans blocks.
+  std::string long_line(100 * 1024, 'a');
+  auto path = kTestWorkingDirectory + "fstests-lines";
+  writeTextFile(path, "first\n\n" + long_line + "\nlast");
+
+  std::vector<std::string> lines;
+  auto status = readLines(
+      path, ([&lines](FileLine line) { lines.push_back(line.to_string()); }));
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(lines.size(), 4U);
+  EXPECT_EQ(lines[0], "first");
+  EXPECT_TRUE(lines[1].empty());
+  EXPECT_EQ(lines[2], long_line);
+  EXPECT_EQ(lines[3], "last");
+
+  status = readLines(kFakeDirectory + "/not_a_file", ([](FileLine line) {}));
+  EXPECT_FALSE(status.ok());
+  remove(path);
+}
+
+TEST_F(FilesystemTests, test_read_new_lines) {
+  auto path = kTestWorkingDirectory + "fstests-new-lines";
+  writeTextFile(path, "first\nsecond\nthi");
+
+  FileCheckpoint checkpoint;
+  std::vector<std::string> lines;
+  auto reader = [&lines](FileLine line) { lines.push_back(line.to_string()); };
+  auto status = readNewLines(path, checkpoint, reader);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(checkpoint.reset);
+  EXPECT_EQ(lines, std::vector<std::string>({"first", "second"}));
+  EXPECT_EQ(checkpoint.partial, "thi");
+
+  // Only the appended lines are read, a partial line is read again.
+  lines.clear();
+  writeTextFile(path, "rd\nfourth\n");
+  status = readNewLines(path, checkpoint, reader);
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(checkpoint.reset);
+  EXPECT_EQ(lines, std::vector<std::string>({"third", "fourth"}));
+  EXPECT_TRUE(checkpoint.partial.empty());
+
+  // A replaced file is read again from the beginning.
+  lines.clear();
+  remove(path);
+  writeTextFile(path, "fifth\nsixth\nseventh\neighth\nninth\n");
+  status = readNewLines(path, checkpoint, reader);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(checkpoint.reset);
+  EXPECT_EQ(lines.size(), 5U);
+  remove(path);
+}
+
 TEST_F(FilesystemTests, test_read_symlink) {
   std::string content;
   auto status = readFile(kFakeDirectory + "/root2.txt", content);
@@ -296,11 +356,136 @@ TEST_F(FilesystemTests, test_safe_permissions) {
   EXPECT_TRUE(safePermissions("/", "/dev/zero"));
 }
 
+TEST_F(FilesystemTests, test_file_walker) {
+  writeTextFile(kFakeDirectory + "/.hidden", "hidden");
+
+  // Every entry beneath the root is walked once, the root is not.
+  std::vector<WalkEntry> entries;
+  FileWalker::walk({kFakeDirectory}, WalkLimits(), entries);
+  EXPECT_EQ(entries.size(), 16U);
+
+  std::vector<std::string> paths;
+  for (const auto& entry : entries) {
+    paths.push_back(entry.path);
+    if (entry.path == kFakeDirectory + "/root2.txt") {
+      EXPECT_TRUE(entry.is_link);
+      EXPECT_TRUE(S_ISREG(entry.info.st_mode));
+    } else if (entry.path == kFakeDirectory + "/deep11/deep2/deep3") {
+      EXPECT_EQ(entry.depth, 3U);
+      EXPECT_EQ(entry.directory, kFakeDirectory + "/deep11/deep2");
+    }
+  }
+  EXPECT_TRUE(contains(paths, kFakeDirectory + "/.hidden"));
+  EXPECT_TRUE(contains(paths, kFakeDirectory + "/deep11/deep2/deep3"));
+
+  WalkLimits limits;
+  limits.max_depth = 1;
+  limits.hidden = false;
+  entries.clear();
+  FileWalker::walk({kFakeDirectory}, limits, entries);
+  EXPECT_EQ(entries.size(), 6U);
+
+  limits.max_depth = 0;
+  limits.max_files = 3;
+  entries.clear();
+  FileWalker::walk({kFakeDirectory, "/not_ther_abcdefz"}, limits, entries);
+  EXPECT_EQ(entries.size(), 3U);
+}
+
 #ifdef __linux__
 TEST_F(FilesystemTests, test_read_proc) {
   std::string content;
   EXPECT_TRUE(readFile("/proc/" + std::to_string(getpid()) + "/stat", content));
   EXPECT_GT(content.size(), 0U);
 }
+
+TEST_F(FilesystemTests, test_proc_snapshot) {
+  auto snapshot = ProcSnapshot::current();
+  auto pid = std::to_string(getpid());
+  EXPECT_EQ(snapshot->pids().count(pid), 1U);
+  EXPECT_TRUE(snapshot->exists(pid));
+  EXPECT_FALSE(snapshot->exists("-1"));
+
+  // Process files are read once and kept by the snapshot.
+  EXPECT_EQ(snapshot->stat(pid).find(pid + " ("), 0U);
+  EXPECT_EQ(snapshot->stat(pid), snapshot->stat(pid));
+  EXPECT_NE(snapshot->status(pid).find("Name:"), std::string::npos);
+  EXPECT_FALSE(snapshot->maps(pid).empty());
+  EXPECT_FALSE(snapshot->readLink(pid, "exe").empty());
+
+  // Namespaces are the inode of the namespace link.
+  const auto& net = snapshot->getNamespace(pid, "net");
+  EXPECT_FALSE(net.empty());
+  EXPECT_EQ(net.find_first_not_of("0123456789"), std::string::npos);
+  EXPECT_TRUE(snapshot->getNamespace("-1", "net").empty());
+
+  // Standard input, output, and error are open descriptors.
+  EXPECT_GE(snapshot->descriptors(pid).size(), 3U);
+  EXPECT_TRUE(snapshot->descriptors("-1").empty());
+
+  // Descriptors read in a batch match the descriptors of a single process.
+  ProcSnapshot batched;
+  batched.readDescriptors({pid, "-1"});
+  EXPECT_EQ(batched.descriptors(pid).size(), snapshot->descriptors(pid).size());
+}
+
+TEST_F(FilesystemTests, test_proc_snapshot_scope) {
+  // Without a query the snapshot is released with the last reference.
+  std::weak_ptr<ProcSnapshot> released = ProcSnapshot::current();
+  EXPECT_TRUE(released.expired());
+
+  // A query keeps the snapshot for its tables until it ends.
+  std::weak_ptr<ProcSnapshot> kept;
+  {
+    QueryResources resources;
+    kept = ProcSnapshot::current();
+    EXPECT_FALSE(kept.expired());
+  }
+  EXPECT_TRUE(kept.expired());
+}
+
+TEST_F(FilesystemTests, test_batch_stat) {
+  // Batches this large are read with io_uring, if available, or the pool.
+  std::vector<BatchStat> requests;
+  for (size_t i = 0; i < 100; i++) {
+    BatchStat request;
+    request.path = (i % 3 == 0) ? kFakeDirectory + "/root.txt"
+                                : kFakeDirectory + "/does_not_exist";
+    request.follow = (i % 2 == 0);
+    requests.push_back(request);
+  }
+
+  auto disable_io_uring = FLAGS_disable_io_uring;
+  for (auto disable : {false, true}) {
+    FLAGS_disable_io_uring = disable;
+    batchStat(requests);
+    for (size_t i = 0; i < requests.size(); i++) {
+      struct stat expected;
+      int flags = (requests[i].follow) ? 0 : AT_SYMLINK_NOFOLLOW;
+      const auto& path = requests[i].path;
+      bool ok = (fstatat(AT_FDCWD, path.c_str(), &expected, flags) == 0);
+      ASSERT_EQ(requests[i].ok, ok);
+      if (ok) {
+        EXPECT_EQ(requests[i].info.st_ino, expected.st_ino);
+        EXPECT_EQ(requests[i].info.st_mode, expected.st_mode);
+        EXPECT_EQ(requests[i].info.st_size, expected.st_size);
+      }
+      requests[i].ok = false;
+    }
+  }
+  FLAGS_disable_io_uring = disable_io_uring;
+}
+
+TEST_F(FilesystemTests, test_batch_read_link) {
+  std::vector<BatchLink> links(100);
+  for (size_t i = 0; i < links.size(); i++) {
+    links[i].path = (i % 2 == 0) ? "/proc/self/exe" : kFakeDirectory;
+  }
+  batchReadLink(links);
+  for (size_t i = 0; i < links.size(); i++) {
+    EXPECT_EQ(links[i].ok, i % 2 == 0);
+  }
+  EXPECT_FALSE(links[0].link.empty());
+}
 #endif
 }
@@ -0,0 +1,312 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "osquery/dispatcher/executor.h"
+#include "osquery/filesystem/walker.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     filesystem_walk_threads,
+     4,
+     "Threads listing and reading the status of files for file tables");
+
+/// The most entries returned by each FileWalker::next.
+const size_t kWalkBatchSize = 256;
+
+/// Work is queued while fewer than this many entries are waiting.
+const size_t kWalkReadyLimit = 4 * kWalkBatchSize;
+
+/// The directory entries read by each unit of work.
+const size_t kWalkStatChunk = 256;
+
+/// A unit of walk work, run by an I/O worker.
+using WalkWork = std::function<void()>;
+
+struct FileWalker::State {
+  explicit State(const WalkLimits& walk_limits) : limits(walk_limits) {}
+
+  WalkLimits limits;
+
+  /// Protects the queues and counts.
+  std::mutex mutex;
+
+  /// Signaled when entries are ready or work finished.
+  std::condition_variable changed;
+
+  /// Work waiting for a worker, stat-ing entries is queued first.
+  std::deque<WalkWork> pending;
+
+  /// The executor tasks submitted to run pending work.
+  size_t running{0};
+
+  /// The pending work being run, by a task or by the consumer.
+  size_t working{0};
+
+  /// Entries waiting for the consumer.
+  std::deque<WalkEntry> ready;
+
+  /// The number of entries found, for the max_files budget.
+  size_t found{0};
+
+  /// The walk was stopped or exhausted its budget.
+  std::atomic<bool> stopped{false};
+};
+
+/// An open directory shared by the work reading its entries.
+struct WalkDirectory : private boost::noncopyable {
+  WalkDirectory(const std::string& dir_path, size_t entry_depth, DIR* dir)
+      : path(dir_path), depth(entry_depth), stream(dir) {}
+
+  ~WalkDirectory() { closedir(stream); }
+
+  /// The descriptor entries are read relative to.
+  int fd() const { return dirfd(stream); }
+
+  std::string path;
+  size_t depth{0};
+  DIR* stream{nullptr};
+};
+
+static std::string joinPath(const std::string& directory,
+                            const std::string& name) {
+  if (!directory.empty() && directory.back() == '/') {
+    return directory + name;
+  }
+  return directory + "/" + name;
+}
+
+static void listDirectory(FileWalker::State* state,
+                          const std::string& path,
+                          size_t depth);
+
+/// Read the status of a chunk of a directory's entries.
+static void statEntries(FileWalker::State* state,
+                        const WalkDirectory& directory,
+                        const std::vector<std::string>& names) {
+  std::vector<WalkEntry> entries;
+  std::vector<std::string> directories;
+  const auto& limits = state->limits;
+  for (const auto& name : names) {
+    if (state->stopped) {
+      return;
+    }
+
+    WalkEntry entry;
+    if (fstatat(directory.fd(),
+                name.c_str(),
+                &entry.info,
+                AT_SYMLINK_NOFOLLOW) != 0) {
+      continue;
+    }
+    entry.is_link = S_ISLNK(entry.info.st_mode);
+    if (entry.is_link) {
+      // Report the target of a valid link, a broken link reports itself.
+      struct stat target;
+      if (fstatat(directory.fd(), name.c_str(), &target, 0) == 0) {
+        entry.info = target;
+      }
+    }
+    entry.path = joinPath(directory.path, name);
+    entry.directory = directory.path;
+    entry.depth = directory.depth;
+
+    if (S_ISDIR(entry.info.st_mode) &&
+        (!entry.is_link || limits.follow_links) &&
+        (limits.max_depth == 0 || directory.depth < limits.max_depth)) {
+      directories.push_back(entry.path);
+    }
+    entries.push_back(std::move(entry));
+  }
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  for (auto& entry : entries) {
+    if (limits.max_files > 0 && state->found >= limits.max_files) {
+      state->stopped = true;
+      state->pending.clear();
+      return;
+    }
+    state->ready.push_back(std::move(entry));
+    state->found++;
+  }
+
+  auto depth = directory.depth + 1;
+  for (const auto& path : directories) {
+    state->pending.push_back(
+        [state, path, depth]() { listDirectory(state, path, depth); });
+  }
+}
+
+/// List a directory and queue work reading the status of its entries.
+static void listDirectory(FileWalker::State* state,
+                          const std::string& path,
+                          size_t depth) {
+  if (state->stopped) {
+    return;
+  }
+
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  auto stream = (fd >= 0) ? fdopendir(fd) : nullptr;
+  if (stream == nullptr) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+
+  // The stream owns the descriptor until every chunk is read.
+  auto directory = std::make_shared<WalkDirectory>(path, depth, stream);
+  std::vector<std::vector<std::string>> chunks(1);
+  struct dirent* entry = nullptr;
+  while ((entry = readdir(stream)) != nullptr) {
+    const char* name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == 0 || (name[1] == '.' && name[2] == 0) ||
+         !state->limits.hidden)) {
+      continue;
+    }
+    if (chunks.back().size() == kWalkStatChunk) {
+      chunks.emplace_back();
+    }
+    chunks.back().push_back(name);
+  }
+
+  // A small directory is read by the work that listed it.
+  if (chunks.size() == 1) {
+    statEntries(state, *directory, chunks.back());
+    return;
+  }
+
+  // Finish reading listed directories before listing more of the tree.
+  std::lock_guard<std::mutex> lock(state->mutex);
+  for (auto chunk = chunks.rbegin(); chunk != chunks.rend(); ++chunk) {
+    if (chunk->empty()) {
+      continue;
+    }
+    auto names = std::move(*chunk);
+    state->pending.push_front([state, directory, names]() {
+      statEntries(state, *directory, names);
+    });
+  }
+}
+
+/// Work may run while the walk is not stopped or reading too far ahead.
+static bool runnable(const FileWalker::State& state) {
+  return !state.stopped && !state.pending.empty() &&
+         state.ready.size() < kWalkReadyLimit;
+}
+
+static void schedule(const std::shared_ptr<FileWalker::State>& state);
+
+/// Run pending work until none is runnable, a worker per executor task.
+static void drain(const std::shared_ptr<FileWalker::State>& state) {
+  std::unique_lock<std::mutex> lock(state->mutex);
+  while (runnable(*state)) {
+    auto work = std::move(state->pending.front());
+    state->pending.pop_front();
+    state->working++;
+    // Listing a directory may queue enough work for another worker.
+    schedule(state);
+    lock.unlock();
+    work();
+    lock.lock();
+    state->working--;
+    if (state->ready.size() >= kWalkBatchSize) {
+      state->changed.notify_all();
+    }
+  }
+  state->running--;
+  state->changed.notify_all();
+}
+
+/// Start workers for pending work, up to filesystem_walk_threads, call locked.
+static void schedule(const std::shared_ptr<FileWalker::State>& state) {
+  auto workers = std::max<size_t>(FLAGS_filesystem_walk_threads, 1);
+  while (state->running < workers && state->pending.size() > state->running &&
+         runnable(*state)) {
+    state->running++;
+    // The task keeps the walk state alive while it runs.
+    auto task = getTableExecutor().submit(
+        [state](const Task&) { drain(state); }, TASK_PRIORITY_SCHEDULE);
+    if (task == nullptr) {
+      // The executor is stopping, so is the process.
+      state->running--;
+      state->stopped = true;
+    }
+  }
+}
+
+FileWalker::FileWalker(const std::vector<std::string>& roots,
+                       const WalkLimits& limits)
+    : state_(std::make_shared<State>(limits)) {
+  auto state = state_.get();
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (const auto& root : roots) {
+    state_->pending.push_back(
+        [state, root]() { listDirectory(state, root, 1); });
+  }
+  schedule(state_);
+}
+
+FileWalker::~FileWalker() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->stopped = true;
+  state_->pending.clear();
+}
+
+bool FileWalker::next(std::vector<WalkEntry>& entries) {
+  auto& state = *state_;
+  auto done = [&state]() {
+    return state.working == 0 && (state.pending.empty() || state.stopped);
+  };
+
+  // Run pending work while nothing is ready, the shared workers may be busy.
+  std::unique_lock<std::mutex> lock(state.mutex);
+  while (state.ready.empty() && runnable(state)) {
+    auto work = std::move(state.pending.front());
+    state.pending.pop_front();
+    state.working++;
+    lock.unlock();
+    work();
+    lock.lock();
+    state.working--;
+  }
+  state.changed.wait(lock, [&]() { return !state.ready.empty() || done(); });
+
+  auto count = std::min(state.ready.size(), kWalkBatchSize);
+  for (size_t i = 0; i < count; i++) {
+    entries.push_back(std::move(state.ready.front()));
+    state.ready.pop_front();
+  }
+
+  // Reading entries may allow more work within the read ahead limit.
+  schedule(state_);
+  return !(state.ready.empty() && done());
+}
+
+void FileWalker::walk(const std::vector<std::string>& roots,
+                      const WalkLimits& limits,
+                      std::vector<WalkEntry>& entries) {
+  FileWalker walker(roots, limits);
+  while (walker.next(entries)) {
+  }
+}
+}
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_uint64(filesystem_walk_threads);
+
+/// Limits of a FileWalker walk, a 0 limit is unlimited.
+struct WalkLimits {
+  /// The deepest entry returned, entries of a root have depth 1.
+  size_t max_depth{0};
+
+  /// Stop the walk after this many entries.
+  size_t max_files{0};
+
+  /// Descend into symlinked directories.
+  bool follow_links{false};
+
+  /// Include entries with names starting with '.'.
+  bool hidden{true};
+};
+
+/// A file or directory found by a FileWalker.
+struct WalkEntry {
+  /// The directory path joined with the entry name.
+  std::string path;
+
+  /// The directory path, as given for a root.
+  std::string directory;
+
+  /// The entry status, of the link target if the entry is a valid link.
+  struct stat info;
+
+  /// The entry is a symbolic link.
+  bool is_link{false};
+
+  /// The number of directories between the root and this entry.
+  size_t depth{0};
+};
+
+/**
+ * @brief A parallel, bounded walk of directory trees.
+ *
+ * Directories are listed and their entries are stat-ed by up to
+ * filesystem_walk_threads workers of the shared getTableExecutor, and by the
+ * consumer while no entries are ready. Entries are read and stat-ed relative
+ * to a directory descriptor.
+ * Large directories are split so several workers stat one directory.
+ *
+ * Work is only queued while fewer than a few batches of entries are waiting,
+ * so a consumer that stops reading stops the walk. Entries are returned in
+ * no particular order.
+ */
+class FileWalker : private boost::noncopyable {
+ public:
+  /**
+   * @brief Start a walk of the entries within each root directory.
+   *
+   * @param roots The directories to walk, which are not returned.
+   * @param limits The depth and entry budgets of the walk.
+   */
+  FileWalker(const std::vector<std::string>& roots, const WalkLimits& limits);
+
+  /// Stop the walk, queued work is dropped.
+  ~FileWalker();
+
+  /**
+   * @brief Wait for and move the next batch of walked entries.
+   *
+   * @param entries The output entries, appended.
+   * @return false if the walk is complete after this batch.
+   */
+  bool next(std::vector<WalkEntry>& entries);
+
+  /// Walk to completion, appending every entry.
+  static void walk(const std::vector<std::string>& roots,
+                   const WalkLimits& limits,
+                   std::vector<WalkEntry>& entries);
+
+ public:
+  struct State;
+
+ private:
+  std::shared_ptr<State> state_;
+};
+}
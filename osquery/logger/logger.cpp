@@ -9,6 +9,12 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include <boost/noncopyable.hpp>
@@ -20,6 +26,8 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/tracing.h"
+#include "osquery/logger/status_log_ring.h"
 
 namespace pt = boost::property_tree;
 
@@ -36,6 +44,139 @@ FLAG(string, logger_plugin, "filesystem", "Logger plugin name");
 
 FLAG(bool, log_result_events, true, "Log scheduled results as events");
 
+FLAG(uint64,
+     logger_status_queue,
+     8192,
+     "Max number of status logs queued for logger plugins");
+
+FLAG(uint64,
+     logger_status_rate,
+     100,
+     "Max status logs per second from one source line, 0 for no limit");
+
+/// The number of rate limited status log sources, sources may share a slot.
+const size_t kStatusLogSources = 1024;
+
+/// The most status logs forwarded to logger plugins in one request.
+const size_t kStatusLogBatch = 256;
+
+/// Milliseconds the drain thread waits for new status logs between checks.
+const size_t kStatusLogWait = 100;
+
+/**
+ * @brief A bounded multi-producer queue of status logs.
+ *
+ * Each slot holds a sequence number that tells producers and consumers if
+ * the slot is free or filled for their position, so pushing and popping only
+ * use atomic operations. A push fails instead of blocking if the queue is
+ * full.
+ */
+class StatusLogQueue : private boost::noncopyable {
+ public:
+  /// Create a queue, the capacity is rounded up to a power of two.
+  explicit StatusLogQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+      cells_[i].sequence = i;
+    }
+  }
+
+  /// Queue a line, fails if the queue is full.
+  bool push(StatusLogLine&& line) {
+    auto position = tail_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    while (true) {
+      cell = &cells_[position & mask_];
+      auto sequence = cell->sequence.load(std::memory_order_acquire);
+      auto difference =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (difference == 0) {
+        if (tail_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->line = std::move(line);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Take the oldest line, fails if the queue is empty.
+  bool pop(StatusLogLine& line) {
+    auto position = head_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    while (true) {
+      cell = &cells_[position & mask_];
+      auto sequence = cell->sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<intptr_t>(sequence) -
+                        static_cast<intptr_t>(position + 1);
+      if (difference == 0) {
+        if (head_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = head_.load(std::memory_order_relaxed);
+      }
+    }
+    line = std::move(cell->line);
+    cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// The approximate number of queued lines.
+  size_t size() const {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_relaxed);
+    return (tail > head) ? tail - head : 0;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    StatusLogLine line;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_{0};
+
+  /// The next position to push, written by producers.
+  std::atomic<size_t> tail_{0};
+
+  /// The next position to pop, written by the consumer.
+  std::atomic<size_t> head_{0};
+};
+
+/// The rate limit state of status logs from one source line.
+struct StatusLogSource {
+  /// The second the count applies to.
+  std::atomic<size_t> window{0};
+
+  /// The number of status logs within the window.
+  std::atomic<size_t> count{0};
+
+  /// The number of status logs dropped since last reported.
+  std::atomic<size_t> dropped{0};
+
+  /// The last source dropping logs, Glog file names are static strings.
+  std::atomic<const char*> filename{nullptr};
+  std::atomic<int> line{0};
+};
+
 /**
  * @brief A custom Glog log sink for forwarding or buffering status logs.
  *
@@ -46,6 +187,13 @@ FLAG(bool, log_result_events, true, "Log scheduled results as events");
  * then a BufferedLogSink will start forwarding status logs to
  * LoggerPlugin::logStatus.
  *
+ * Logging threads only push status logs onto a bounded queue. When forwarding,
+ * a drain thread sends the queued logs to the logger plugins in batches.
+ * To keep a storm of logs from starving important ones, INFO logs are dropped
+ * once the queue is half full and WARNING logs once it is three quarters
+ * full. Each source line is also limited to logger_status_rate logs each
+ * second. Dropped logs are counted and reported by the drain thread.
+ *
  * This facility will start buffering when first used and stop buffering
  * (aka remove itself as a Glog sink) using the exposed APIs. It will live
  * throughout the life of the process for two reasons: (1) It makes sense when
@@ -71,10 +219,46 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
 
  public:
   /// Accessor/mutator to dump all of the buffered logs.
-  static std::vector<StatusLogLine>& dump() { return instance().logs_; }
+  static std::vector<StatusLogLine>& dump() {
+    auto& self = instance();
+    std::lock_guard<std::mutex> lock(self.drain_mutex_);
+    StatusLogLine line;
+    while (self.queue_.pop(line)) {
+      self.logs_.push_back(std::move(line));
+    }
+    return self.logs_;
+  }
 
   /// Set the forwarding mode of the buffering sink.
-  static void forward(bool forward = false) { instance().forward_ = forward; }
+  static void forward(bool forward = false) {
+    auto& self = instance();
+    self.forward_ = forward;
+    if (forward) {
+      std::call_once(self.started_, [&self]() {
+        self.thread_ = std::thread(&BufferedLogSink::drain, &self);
+      });
+    }
+  }
+
+  /// Queue status logs read from another process, see forwardStatusLogs.
+  static void queue(std::vector<StatusLogLine>& lines) {
+    auto& self = instance();
+    for (auto& line : lines) {
+      if (!self.queue_.push(std::move(line))) {
+        self.dropped_++;
+      }
+    }
+    if (self.forward_ && self.waiting_) {
+      self.wake_.notify_one();
+    }
+  }
+
+  /// Forward the queued status logs to the logger plugins now.
+  static void flush() {
+    auto& self = instance();
+    std::lock_guard<std::mutex> lock(self.drain_mutex_);
+    self.forwardQueued();
+  }
 
   /// Remove the buffered log sink from Glog.
   static void disable() {
@@ -103,12 +287,9 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
    * and active Glog Sink (supports multiple) will create a logging loop.
    */
   static void addPlugin(const std::string& name) {
-    instance().sinks_.push_back(name);
-  }
-
-  /// Retrieve the list of enabled plugins that should have logs forwarded.
-  static const std::vector<std::string>& enabledPlugins() {
-    return instance().sinks_;
+    auto& self = instance();
+    std::lock_guard<std::mutex> lock(self.drain_mutex_);
+    self.sinks_.push_back(name);
   }
 
  public:
@@ -117,21 +298,67 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
 
  private:
   /// Create the log sink as buffering or forwarding.
-  BufferedLogSink() : forward_(false), enabled_(false) {}
+  BufferedLogSink()
+      : forward_(false),
+        enabled_(false),
+        queue_(std::max<size_t>(FLAGS_logger_status_queue, 1)) {}
+
+  /// Remove the log sink, queued logs are forwarded by flushStatusLogs.
+  ~BufferedLogSink() {
+    disable();
+    if (thread_.joinable()) {
+      stopping_ = true;
+      wake_.notify_one();
+      thread_.join();
+    }
+  }
+
+  /// Check the rate limit of a source line, count the log if dropped.
+  bool allow(const char* filename, int line);
 
-  /// Remove the log sink.
-  ~BufferedLogSink() { disable(); }
+  /// The drain thread entrypoint.
+  void drain();
+
+  /// Send the queued logs to the enabled plugins, and report drops.
+  void forwardQueued();
+
+  /// Send a batch of logs to the enabled plugins.
+  void forwardLogs(const std::vector<StatusLogLine>& log);
 
  private:
   /// Intermediate log storage until an osquery logger is initialized.
   std::vector<StatusLogLine> logs_;
 
   /// Should the sending act in a forwarding mode.
-  bool forward_{false};
+  std::atomic<bool> forward_{false};
   bool enabled_{false};
 
   /// Track multiple loggers that should receive sinks from the send forwarder.
   std::vector<std::string> sinks_;
+
+  /// Status logs waiting to be forwarded or dumped.
+  StatusLogQueue queue_;
+
+  /// The rate limits of source lines, by a hash of the file name and line.
+  StatusLogSource sources_[kStatusLogSources];
+
+  /// The number of logs dropped because the queue was full.
+  std::atomic<size_t> dropped_{0};
+
+  /// Serialize taking logs from the queue, and forwarding them.
+  std::mutex drain_mutex_;
+
+  /// The thread forwarding queued logs.
+  std::thread thread_;
+  std::once_flag started_;
+
+  /// Set when the drain thread should exit.
+  std::atomic<bool> stopping_{false};
+
+  /// Set while the drain thread waits, so logging threads wake it.
+  std::atomic<bool> waiting_{false};
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
 };
 
 /// Scoped helper to perform logging actions without races.
@@ -284,32 +511,221 @@ void BufferedLogSink::send(google::LogSeverity severity,
                            const struct ::tm* tm_time,
                            const char* message,
                            size_t message_len) {
-  // Either forward the log to an enabled logger or buffer until one exists.
-  if (forward_) {
-    const auto& logger_plugin = Registry::getActive("logger");
-    for (const auto& logger : osquery::split(logger_plugin, ",")) {
-      auto& enabled = BufferedLogSink::enabledPlugins();
-      if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
-        // May use the logs_ storage to buffer/delay sending logs.
-        std::vector<StatusLogLine> log;
-        log.push_back({(StatusLogSeverity)severity,
-                       std::string(base_filename),
-                       line,
-                       std::string(message, message_len)});
-        PluginRequest request = {{"status", "true"}};
-        serializeIntermediateLog(log, request);
-        if (!request["log"].empty()) {
-          request["log"].pop_back();
-        }
-        Registry::call("logger", logger, request);
+  auto status_severity = static_cast<StatusLogSeverity>(severity);
+  if (status_severity < O_FATAL && !allow(base_filename, line)) {
+    return;
+  }
+
+  // Keep room in the queue for more severe logs.
+  auto size = queue_.size();
+  auto capacity = queue_.capacity();
+  if ((status_severity == O_INFO && size >= capacity / 2) ||
+      (status_severity == O_WARNING && size >= capacity / 4 * 3)) {
+    dropped_++;
+    return;
+  }
+
+  if (!queue_.push({status_severity,
+                    std::string(base_filename),
+                    line,
+                    std::string(message, message_len)})) {
+    dropped_++;
+    return;
+  }
+
+  if (!forward_) {
+    // Buffer until a logger is initialized, see dump.
+    return;
+  }
+
+  if (status_severity >= O_FATAL) {
+    // Glog aborts after a fatal log, forward it on this thread. A plugin may
+    // log fatally while the drain thread forwards, then it is only queued.
+    std::unique_lock<std::mutex> lock(drain_mutex_, std::try_to_lock);
+    if (lock.owns_lock()) {
+      forwardQueued();
+    }
+  } else if (waiting_) {
+    wake_.notify_one();
+  }
+}
+
+bool BufferedLogSink::allow(const char* filename, int line) {
+  if (FLAGS_logger_status_rate == 0) {
+    return true;
+  }
+
+  auto hash = std::hash<std::string>()(filename) ^ static_cast<size_t>(line);
+  auto& source = sources_[hash % kStatusLogSources];
+  auto now = static_cast<size_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+  auto window = source.window.load();
+  if (window != now && source.window.compare_exchange_strong(window, now)) {
+    source.count = 0;
+  }
+  if (source.count++ < FLAGS_logger_status_rate) {
+    return true;
+  }
+
+  source.filename = filename;
+  source.line = line;
+  source.dropped++;
+  return false;
+}
+
+void BufferedLogSink::drain() {
+  while (!stopping_) {
+    {
+      std::lock_guard<std::mutex> lock(drain_mutex_);
+      forwardQueued();
+    }
+
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    waiting_ = true;
+    if (queue_.size() == 0 && !stopping_) {
+      // Logging threads notify without the lock, a missed wake only delays.
+      wake_.wait_for(lock, std::chrono::milliseconds(kStatusLogWait));
+    }
+    waiting_ = false;
+  }
+}
+
+void BufferedLogSink::forwardQueued() {
+  std::vector<StatusLogLine> log;
+  StatusLogLine line;
+  while (queue_.pop(line)) {
+    log.push_back(std::move(line));
+    if (log.size() == kStatusLogBatch) {
+      forwardLogs(log);
+      log.clear();
+    }
+  }
+
+  // Report dropped logs as the sink's own warnings.
+  if (dropped_ > 0) {
+    log.push_back({O_WARNING,
+                   "logger.cpp",
+                   __LINE__,
+                   "Dropped " + std::to_string(dropped_.exchange(0)) +
+                       " status logs, the status log queue was full"});
+  }
+  for (auto& source : sources_) {
+    if (source.dropped > 0) {
+      const char* filename = source.filename;
+      log.push_back({O_WARNING,
+                     "logger.cpp",
+                     __LINE__,
+                     "Dropped " + std::to_string(source.dropped.exchange(0)) +
+                         " status logs from " +
+                         ((filename != nullptr) ? filename : "<unknown>") +
+                         ":" + std::to_string(source.line) +
+                         ", logged too often"});
+    }
+  }
+
+  if (!log.empty()) {
+    forwardLogs(log);
+  }
+}
+
+void BufferedLogSink::forwardLogs(const std::vector<StatusLogLine>& log) {
+  PluginRequest request = {{"status", "true"}};
+  serializeIntermediateLog(log, request);
+  if (!request["log"].empty()) {
+    request["log"].pop_back();
+  }
+
+  const auto& logger_plugin = Registry::getActive("logger");
+  for (const auto& logger : osquery::split(logger_plugin, ",")) {
+    if (std::find(sinks_.begin(), sinks_.end(), logger) != sinks_.end()) {
+      Registry::call("logger", logger, request);
+    }
+  }
+}
+
+void flushStatusLogs() { BufferedLogSink::flush(); }
+
+void forwardStatusLogs(std::vector<StatusLogLine>& lines) {
+  BufferedLogSink::queue(lines);
+}
+
+/// The ring status logs are relayed through, set by the watcher.
+static std::atomic<StatusLogRing*> kStatusLogRing{nullptr};
+
+void setStatusLogRing(StatusLogRing* ring) { kStatusLogRing = ring; }
+
+void StatusLogRing::init() {
+  tail = 0;
+  head = 0;
+  dropped = 0;
+  for (size_t i = 0; i < kStatusLogRingSize; i++) {
+    records[i].sequence = i;
+  }
+}
+
+bool StatusLogRing::push(const StatusLogLine& line) {
+  auto position = tail.load(std::memory_order_relaxed);
+  StatusLogRecord* record = nullptr;
+  while (true) {
+    record = &records[position & (kStatusLogRingSize - 1)];
+    auto sequence = record->sequence.load(std::memory_order_acquire);
+    auto difference =
+        static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+    if (difference == 0) {
+      if (tail.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
       }
+    } else if (difference < 0) {
+      dropped++;
+      return false;
+    } else {
+      position = tail.load(std::memory_order_relaxed);
     }
-  } else {
-    logs_.push_back({(StatusLogSeverity)severity,
-                     std::string(base_filename),
-                     line,
-                     std::string(message, message_len)});
   }
+
+  record->severity = line.severity;
+  record->line = line.line;
+  auto file_size = std::min(line.filename.size(), kStatusLogRecordFile - 1);
+  memcpy(record->filename, line.filename.data(), file_size);
+  record->filename[file_size] = 0;
+  record->length = static_cast<uint32_t>(
+      std::min(line.message.size(), kStatusLogRecordMessage));
+  memcpy(record->message, line.message.data(), record->length);
+  record->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+size_t StatusLogRing::pop(std::vector<StatusLogLine>& lines, size_t max) {
+  size_t count = 0;
+  auto position = head.load(std::memory_order_relaxed);
+  for (; count < max; count++, position++) {
+    auto& record = records[position & (kStatusLogRingSize - 1)];
+    if (record.sequence.load(std::memory_order_acquire) != position + 1) {
+      break;
+    }
+
+    // The record is copied before it is released to producers.
+    lines.push_back({static_cast<StatusLogSeverity>(record.severity),
+                     std::string(record.filename),
+                     record.line,
+                     std::string(record.message, record.length)});
+    record.sequence.store(position + kStatusLogRingSize,
+                          std::memory_order_release);
+    head.store(position + 1, std::memory_order_relaxed);
+  }
+
+  auto drops = dropped.exchange(0);
+  if (drops > 0) {
+    lines.push_back({O_WARNING,
+                     "logger.cpp",
+                     __LINE__,
+                     "Dropped " + std::to_string(drops) +
+                         " relayed status logs, the status log ring was full"});
+  }
+  return count;
 }
 
 Status LoggerPlugin::call(const PluginRequest& request,
@@ -322,6 +738,12 @@ Status LoggerPlugin::call(const PluginRequest& request,
     return this->logSnapshot(request.at("snapshot"));
   } else if (request.count("health") > 0) {
     return this->logHealth(request.at("health"));
+  } else if (request.count("results") > 0) {
+    auto status = deserializeQueryLogItemJSON(request.at("results"), item);
+    if (!status.ok()) {
+      return status;
+    }
+    return this->logResults(item);
   } else if (request.count("init") > 0) {
     deserializeIntermediateLog(request, intermediate_logs);
     return this->init(request.at("init"), intermediate_logs);
@@ -349,25 +771,97 @@ Status logQueryLogItem(const QueryLogItem& results) {
   return logQueryLogItem(results, Registry::getActive("logger"));
 }
 
-Status logQueryLogItem(const QueryLogItem& results,
-                       const std::string& receiver) {
-  std::vector<std::string> json_items;
+Status serializeResultLines(const QueryLogItem& item,
+                            std::vector<std::string>& lines) {
   Status status;
   if (FLAGS_log_result_events) {
-    status = serializeQueryLogItemAsEventsJSON(results, json_items);
+    status = serializeQueryLogItemAsEventsJSON(item, lines);
   } else {
     std::string json;
-    status = serializeQueryLogItemJSON(results, json);
-    json_items.push_back(json);
+    status = serializeQueryLogItemJSON(item, json);
+    lines.push_back(std::move(json));
   }
+
+  for (auto& line : lines) {
+    if (!line.empty()) {
+      line.pop_back();
+    }
+  }
+  return status;
+}
+
+Status LoggerPlugin::logResults(const QueryLogItem& item) {
+  std::vector<std::string> lines;
+  auto status = serializeResultLines(item, lines);
   if (!status.ok()) {
     return status;
   }
 
-  for (auto& json : json_items) {
-    if (!json.empty()) {
-      json.pop_back();
-      status = logString(json, "event", receiver);
+  for (const auto& line : lines) {
+    if (!line.empty()) {
+      logString(line);
+    }
+  }
+  return Status(0, "OK");
+}
+
+/**
+ * @brief Hand query results to one logger plugin.
+ *
+ * Local plugins are called directly with the item. Extension loggers are sent
+ * the item as one batch, serialized at most once for every receiver. Older
+ * extensions do not support batches and are sent each line.
+ */
+static Status logResultsTo(const QueryLogItem& item,
+                           const std::string& receiver,
+                           std::string& batch) {
+  if (Registry::exists("logger", receiver, true)) {
+    auto plugin = std::dynamic_pointer_cast<LoggerPlugin>(
+        Registry::get("logger", receiver));
+    if (plugin != nullptr) {
+      try {
+        return plugin->logResults(item);
+      } catch (const std::exception& e) {
+        LOG(ERROR) << "logger registry " << receiver
+                   << " plugin caused exception: " << e.what();
+        return Status(1, e.what());
+      }
+    }
+  }
+
+  if (batch.empty()) {
+    auto status = serializeQueryLogItemJSON(item, batch);
+    if (!status.ok()) {
+      return status;
+    }
+    if (!batch.empty()) {
+      batch.pop_back();
+    }
+  }
+  if (Registry::call("logger", receiver, {{"results", batch}}).ok()) {
+    return Status(0, "OK");
+  }
+
+  std::vector<std::string> lines;
+  auto status = serializeResultLines(item, lines);
+  for (const auto& line : lines) {
+    if (!line.empty()) {
+      logString(line, "event", receiver);
+    }
+  }
+  return status;
+}
+
+Status logQueryLogItem(const QueryLogItem& results,
+                       const std::string& receiver) {
+  TRACE_SCOPE_DETAIL("logger.logQueryLogItem", results.name);
+  // Every logger is called, the last failure is returned.
+  Status status;
+  std::string batch;
+  for (const auto& name : osquery::split(receiver, ",")) {
+    auto s = logResultsTo(results, name, batch);
+    if (!s.ok()) {
+      status = s;
     }
   }
   return status;
@@ -405,6 +899,18 @@ void relayStatusLogs() {
   if (status_logs.size() == 0) {
     return;
   }
+
+  // Copy the logs into the ring shared with the worker, without a request.
+  // Logs that do not fit are dropped and reported by the worker.
+  auto ring = kStatusLogRing.load();
+  if (ring != nullptr) {
+    for (const auto& line : status_logs) {
+      ring->push(line);
+    }
+    status_logs.clear();
+    return;
+  }
+
   serializeIntermediateLog(status_logs, request);
   if (!request["log"].empty()) {
     request["log"].pop_back();
@@ -8,13 +8,26 @@
  *
  */
 
-#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <map>
 #include <mutex>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/dispatcher/dispatcher.h"
+#include "osquery/logger/plugins/syslog.h"
+
 namespace pt = boost::property_tree;
 namespace fs = boost::filesystem;
 
@@ -34,16 +47,309 @@ FLAG(int32, logger_mode, 0640, "Decimal mode for log files (default '0640')");
 /// Legacy, backward compatible "osquery_log_dir" CLI option.
 FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
+FLAG(uint64,
+     logger_buffer_size,
+     4 * 1024 * 1024,
+     "Max bytes of results buffered by the filesystem logger, 0 to not buffer");
+
+FLAG(uint64,
+     logger_rotate_size,
+     0,
+     "Rotate filesystem results logs larger than this many bytes");
+
+FLAG(uint64,
+     logger_rotate_interval,
+     0,
+     "Seconds before rotating filesystem results logs, 0 to not rotate");
+
+FLAG(uint64,
+     logger_rotate_max_files,
+     10,
+     "Number of rotated filesystem results logs to keep");
+
+FLAG(bool, logger_fsync, false, "Sync filesystem results logs after writes");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 const std::string kFilesystemLoggerHealth = "osqueryd.health.log";
 
-std::mutex filesystemLoggerPluginMutex;
+/// A log file kept open between writes.
+struct FilesystemLogFile {
+  int fd{-1};
+
+  /// The size of the file in bytes.
+  size_t size{0};
+
+  /// The time the file was created or opened.
+  std::time_t started{0};
+};
+
+/**
+ * @brief A writer thread appending buffered log lines to their files.
+ *
+ * Loggers queue lines in memory and return, the writer swaps the queue and
+ * writes every line queued for a file with one write call. Files are kept
+ * open between writes and rotated by size or age. When the buffer is full
+ * lines are dropped instead of blocking the scheduler on disk I/O.
+ *
+ * Until the writer runs, and after it is stopped, lines are written
+ * synchronously.
+ */
+class FilesystemLogWriter : public InternalRunnable {
+ public:
+  /// Queue data for a file, or write it if the writer is not running.
+  Status write(const std::string& path, std::string data);
+
+  /// Write data to a file now.
+  Status append(const std::string& path, const std::string& data);
+
+  /// Write the queued data and stop.
+  void stop() override;
+
+  /// See getLoggerBufferStats.
+  LoggerBufferStats stats() const;
+
+ protected:
+  /// Write queued data until stopped.
+  void start() override;
+
+ private:
+  /// Open a log file if needed, files moved or removed are opened again.
+  Status open(const std::string& path, FilesystemLogFile& file);
+
+  /// Rotate a log file if it is too large or too old.
+  void rotate(const std::string& path, FilesystemLogFile& file);
+
+  /// Close a log file.
+  void close(FilesystemLogFile& file);
+
+ private:
+  /// Data waiting to be written, by file path.
+  std::map<std::string, std::string> pending_;
+
+  /// The bytes of pending data.
+  size_t pending_bytes_{0};
+
+  /// The lines of pending data.
+  std::atomic<size_t> pending_lines_{0};
+
+  /// Lines dropped because buffer was full.
+  std::atomic<size_t> dropped_lines_{0};
+
+  /// The milliseconds the last write of the queued data took.
+  std::atomic<size_t> flush_latency_{0};
+
+  /// Set while the writer thread writes the queued data.
+  bool running_{false};
+
+  /// Set when the writer thread should stop.
+  bool stopping_{false};
+
+  /// Protect the pending data and writer state.
+  std::mutex mutex_;
+
+  /// Signaled when data is pending or the writer should stop.
+  std::condition_variable wake_;
+
+  /// The open log files, by file path.
+  std::map<std::string, FilesystemLogFile> files_;
+
+  /// Protect the open log files.
+  std::mutex files_mutex_;
+};
+
+/// The writer is shared by every filesystem logger, it owns the log files.
+static std::shared_ptr<FilesystemLogWriter> getFilesystemLogWriter() {
+  static auto writer = std::make_shared<FilesystemLogWriter>();
+  return writer;
+}
+
+Status FilesystemLogWriter::write(const std::string& path, std::string data) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ && FLAGS_logger_buffer_size > 0) {
+      // A line is always accepted by an empty buffer.
+      if (pending_bytes_ > 0 &&
+          pending_bytes_ + data.size() > FLAGS_logger_buffer_size) {
+        dropped_lines_++;
+        return Status(1, "Filesystem logger buffer is full");
+      }
+
+      auto wake = (pending_bytes_ == 0);
+      pending_bytes_ += data.size();
+      pending_lines_++;
+      auto& buffer = pending_[path];
+      if (buffer.empty()) {
+        buffer.swap(data);
+      } else {
+        buffer += data;
+      }
+
+      if (wake) {
+        wake_.notify_one();
+      }
+      return Status(0, "OK");
+    }
+  }
+  return append(path, data);
+}
+
+void FilesystemLogWriter::start() {
+  std::map<std::string, std::string> batch;
+  std::unique_lock<std::mutex> lock(mutex_);
+  running_ = !stopping_;
+  while (running_) {
+    wake_.wait(lock, [this]() { return !pending_.empty() || stopping_; });
+    // After stopping the queued data is written and later writes are not.
+    running_ = !stopping_;
+    batch.swap(pending_);
+    pending_bytes_ = 0;
+    pending_lines_ = 0;
+    lock.unlock();
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& file : batch) {
+      auto status = append(file.first, file.second);
+      if (!status.ok()) {
+        VLOG(1) << "Cannot write results log: " << status.getMessage();
+      }
+    }
+    batch.clear();
+    flush_latency_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    lock.lock();
+  }
+}
+
+void FilesystemLogWriter::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+}
+
+LoggerBufferStats FilesystemLogWriter::stats() const {
+  LoggerBufferStats stats;
+  stats.queued_lines = pending_lines_;
+  stats.dropped_lines = dropped_lines_;
+  stats.flush_latency = flush_latency_;
+  return stats;
+}
+
+Status FilesystemLogWriter::append(const std::string& path,
+                                   const std::string& data) {
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  auto& file = files_[path];
+  auto status = open(path, file);
+  if (!status.ok()) {
+    return status;
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    auto bytes = ::write(file.fd, data.data() + written, data.size() - written);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      close(file);
+      return Status(1, "Failed to write contents to file: " + path);
+    }
+    written += bytes;
+  }
+  file.size += written;
+
+  if (written > 0) {
+    if (FLAGS_logger_fsync) {
+      ::fsync(file.fd);
+    }
+    rotate(path, file);
+  }
+  return Status(0, "OK");
+}
+
+Status FilesystemLogWriter::open(const std::string& path,
+                                 FilesystemLogFile& file) {
+  struct stat opened;
+  if (file.fd >= 0) {
+    // Another process may have rotated or removed the file.
+    struct stat current;
+    if (::stat(path.c_str(), &current) == 0 &&
+        ::fstat(file.fd, &opened) == 0 && current.st_dev == opened.st_dev &&
+        current.st_ino == opened.st_ino) {
+      return Status(0, "OK");
+    }
+    close(file);
+  }
+
+  file.fd = ::open(path.c_str(),
+                   O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC,
+                   FLAGS_logger_mode);
+  if (file.fd < 0) {
+    return Status(1, "Could not create file: " + path);
+  }
+
+  // If the file existed with different permissions before our open
+  // they must be restricted.
+  if (::fchmod(file.fd, FLAGS_logger_mode) != 0 ||
+      ::fstat(file.fd, &opened) != 0) {
+    close(file);
+    return Status(1, "Failed to change permissions for file: " + path);
+  }
+  file.size = opened.st_size;
+  file.started = std::time(nullptr);
+  return Status(0, "OK");
+}
+
+void FilesystemLogWriter::rotate(const std::string& path,
+                                 FilesystemLogFile& file) {
+  auto full = FLAGS_logger_rotate_size > 0 &&
+              file.size >= FLAGS_logger_rotate_size;
+  auto expired =
+      FLAGS_logger_rotate_interval > 0 &&
+      std::difftime(std::time(nullptr), file.started) >=
+          static_cast<double>(FLAGS_logger_rotate_interval);
+  if (!full && !expired) {
+    return;
+  }
+
+  // Shift the rotated files, replacing the oldest, the next write creates the
+  // log file again.
+  close(file);
+  auto files = std::max<size_t>(FLAGS_logger_rotate_max_files, 1);
+  for (size_t i = files; i > 1; i--) {
+    ::rename((path + "." + std::to_string(i - 1)).c_str(),
+             (path + "." + std::to_string(i)).c_str());
+  }
+  if (::rename(path.c_str(), (path + ".1").c_str()) != 0) {
+    VLOG(1) << "Cannot rotate results log: " << path;
+  }
+}
+
+void FilesystemLogWriter::close(FilesystemLogFile& file) {
+  if (file.fd >= 0) {
+    ::close(file.fd);
+  }
+  file.fd = -1;
+  file.size = 0;
+}
+
+LoggerBufferStats getLoggerBufferStats() {
+  // Include the lines buffered by the syslog socket writer.
+  auto stats = getFilesystemLogWriter()->stats();
+  auto syslog = getSyslogBufferStats();
+  stats.queued_lines += syslog.queued_lines;
+  stats.dropped_lines += syslog.dropped_lines;
+  stats.flush_latency = std::max(stats.flush_latency, syslog.flush_latency);
+  return stats;
+}
 
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp();
   Status logString(const std::string& s);
+  Status logResults(const QueryLogItem& item);
   Status logStringToFile(const std::string& s, const std::string& filename);
   Status logSnapshot(const std::string& s);
   Status logHealth(const std::string& s);
@@ -63,11 +369,18 @@ Status FilesystemLoggerPlugin::setUp() {
   FLAGS_logfile_mode = FLAGS_logger_mode;
 
   // Ensure that we create the results log here.
-  auto status = logString("");
+  auto writer = getFilesystemLogWriter();
+  auto status =
+      writer->append((log_path_ / kFilesystemLoggerFilename).string(), "");
   if (!status.ok()) {
     return status;
   }
 
+  // Start one writer thread for the process, later results are buffered.
+  static std::once_flag started;
+  if (FLAGS_logger_buffer_size > 0) {
+    std::call_once(started, [&writer]() { Dispatcher::addService(writer); });
+  }
   return Status(0, "OK");
 }
 
@@ -75,19 +388,29 @@ Status FilesystemLoggerPlugin::logString(const std::string& s) {
   return logStringToFile(s + "\n", kFilesystemLoggerFilename);
 }
 
-Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
-                                               const std::string& filename) {
-  std::lock_guard<std::mutex> lock(filesystemLoggerPluginMutex);
-  try {
-    auto status = writeTextFile(
-        (log_path_ / filename).string(), s, FLAGS_logger_mode, true);
-    if (!status.ok()) {
-      return status;
+Status FilesystemLoggerPlugin::logResults(const QueryLogItem& item) {
+  std::vector<std::string> lines;
+  auto status = serializeResultLines(item, lines);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Queue every line of the results at once.
+  std::string data;
+  for (const auto& line : lines) {
+    if (!line.empty()) {
+      data += line + "\n";
     }
-  } catch (const std::exception& e) {
-    return Status(1, e.what());
   }
-  return Status(0, "OK");
+  if (data.empty()) {
+    return Status(0, "OK");
+  }
+  return logStringToFile(data, kFilesystemLoggerFilename);
+}
+
+Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
+                                               const std::string& filename) {
+  return getFilesystemLogWriter()->write((log_path_ / filename).string(), s);
 }
 
 Status FilesystemLoggerPlugin::logStatus(
@@ -8,11 +8,26 @@
  *
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <syslog.h>
+#include <unistd.h>
 
+#include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/logger/plugins/syslog.h"
+
 namespace osquery {
 
 FLAG(int32,
@@ -20,17 +35,370 @@ FLAG(int32,
      LOG_LOCAL3 >> 3,
      "Syslog facility for status and results logs (0-23, default 19)");
 
+FLAG(string,
+     logger_syslog_transport,
+     "syslog",
+     "Syslog transport: syslog (libc), unix, or tcp");
+
+FLAG(string,
+     logger_syslog_address,
+     "/dev/log",
+     "Socket path of the unix syslog transport, or host:port for tcp");
+
+FLAG(uint64,
+     logger_syslog_buffer_size,
+     4 * 1024 * 1024,
+     "Max bytes of messages queued by the unix and tcp syslog transports");
+
+/// The writer is shared by every syslog logger, it owns the socket.
+static std::shared_ptr<SyslogLogWriter> getSyslogLogWriter() {
+  static auto writer = std::make_shared<SyslogLogWriter>();
+  return writer;
+}
+
+std::string formatSyslogMessage(int priority,
+                                size_t time,
+                                const std::string& app,
+                                const std::string& message) {
+  static const auto hostname = getHostname();
+  static const auto pid = std::to_string(getpid());
+
+  // The timestamp is UTC with microseconds, e.g. 2016-01-01T00:00:00.000000Z.
+  auto seconds = static_cast<time_t>(time / 1000000);
+  struct tm utc;
+  gmtime_r(&seconds, &utc);
+  char timestamp[40] = {0};
+  auto size = strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(timestamp + size,
+           sizeof(timestamp) - size,
+           ".%06uZ",
+           static_cast<unsigned int>(time % 1000000));
+
+  // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+  std::string line = "<" + std::to_string(priority) + ">1 ";
+  line += timestamp;
+  line += " " + ((hostname.empty()) ? "-" : hostname);
+  line += " " + ((app.empty()) ? "-" : app);
+  line += " " + pid + " - - ";
+  line += message;
+  return line;
+}
+
+SyslogLogWriter::~SyslogLogWriter() {
+  disconnect();
+}
+
+void SyslogLogWriter::write(std::string message) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+      // A message is always accepted by an empty queue.
+      if (pending_bytes_ > 0 &&
+          pending_bytes_ + message.size() > FLAGS_logger_syslog_buffer_size) {
+        dropped_lines_++;
+        return;
+      }
+
+      auto wake = pending_.empty();
+      pending_bytes_ += message.size();
+      pending_lines_++;
+      pending_.push_back(std::move(message));
+      if (wake) {
+        wake_.notify_one();
+      }
+      return;
+    }
+  }
+
+  std::vector<std::string> messages(1);
+  messages[0].swap(message);
+  send(messages);
+}
+
+void SyslogLogWriter::start() {
+  std::vector<std::string> batch;
+  std::unique_lock<std::mutex> lock(mutex_);
+  running_ = !stopping_;
+  while (running_) {
+    wake_.wait(lock, [this]() { return !pending_.empty() || stopping_; });
+    // After stopping the queued messages are sent and later messages are not.
+    running_ = !stopping_;
+    batch.swap(pending_);
+    pending_bytes_ = 0;
+    pending_lines_ = 0;
+    lock.unlock();
+
+    auto start = std::chrono::steady_clock::now();
+    send(batch);
+    batch.clear();
+    flush_latency_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    lock.lock();
+  }
+}
+
+void SyslogLogWriter::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+}
+
+LoggerBufferStats SyslogLogWriter::stats() const {
+  LoggerBufferStats stats;
+  stats.queued_lines = pending_lines_;
+  stats.dropped_lines = dropped_lines_;
+  stats.flush_latency = flush_latency_;
+  return stats;
+}
+
+void SyslogLogWriter::send(std::vector<std::string>& messages) {
+  if (messages.empty()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(socket_mutex_);
+  if (!connect()) {
+    dropped_lines_ += messages.size();
+    return;
+  }
+
+  if (FLAGS_logger_syslog_transport == "tcp") {
+    dropped_lines_ += sendFrames(messages);
+  } else {
+    dropped_lines_ += sendDatagrams(messages);
+  }
+}
+
+size_t SyslogLogWriter::sendDatagrams(std::vector<std::string>& messages) {
+#ifdef __linux__
+  // Send every message with one call while the socket accepts them.
+  std::vector<struct iovec> vectors(messages.size());
+  std::vector<struct mmsghdr> headers(messages.size());
+  for (size_t i = 0; i < messages.size(); i++) {
+    vectors[i].iov_base = &messages[i][0];
+    vectors[i].iov_len = messages[i].size();
+    headers[i].msg_hdr.msg_iov = &vectors[i];
+    headers[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+
+  size_t sent = 0;
+  size_t dropped = 0;
+  while (sent + dropped < messages.size()) {
+    auto offset = sent + dropped;
+#ifdef __linux__
+    auto count = ::sendmmsg(
+        socket_, &headers[offset], messages.size() - offset, MSG_DONTWAIT);
+#else
+    const auto& message = messages[offset];
+    auto count =
+        (::send(socket_, message.data(), message.size(), MSG_DONTWAIT) < 0)
+            ? -1
+            : 1;
+#endif
+    if (count > 0) {
+      sent += count;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EMSGSIZE) {
+      // Only the message too large for a datagram is dropped.
+      dropped++;
+    } else {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        disconnect();
+      }
+      break;
+    }
+  }
+  return messages.size() - sent;
+}
+
+size_t SyslogLogWriter::sendFrames(std::vector<std::string>& messages) {
+  // Each message is framed by its size in octets, see RFC 6587.
+  std::string data;
+  data.swap(partial_);
+  std::vector<size_t> ends;
+  ends.reserve(messages.size());
+  for (const auto& message : messages) {
+    data += std::to_string(message.size()) + " " + message;
+    ends.push_back(data.size());
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+#ifdef MSG_NOSIGNAL
+    auto flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+    auto flags = MSG_DONTWAIT;
+#endif
+    auto bytes =
+        ::send(socket_, data.data() + written, data.size() - written, flags);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      break;
+    }
+    written += bytes;
+  }
+  if (written == data.size()) {
+    return 0;
+  }
+
+  // A stream that failed drops every unsent message.
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    disconnect();
+    auto unsent = std::upper_bound(ends.begin(), ends.end(), written);
+    return ends.end() - unsent;
+  }
+
+  // The frame being written is finished by the next send, later are dropped.
+  auto current = std::upper_bound(ends.begin(), ends.end(), written);
+  if (current == ends.end()) {
+    return 0;
+  }
+  partial_ = data.substr(written, *current - written);
+  return ends.end() - current - 1;
+}
+
+bool SyslogLogWriter::connect() {
+  if (socket_ >= 0) {
+    return true;
+  }
+
+  // Do not retry a missing syslog daemon for every message.
+  auto now = getUnixTime();
+  if (connect_time_ == now) {
+    return false;
+  }
+  connect_time_ = now;
+  partial_.clear();
+
+  const auto& address = FLAGS_logger_syslog_address;
+  if (FLAGS_logger_syslog_transport == "tcp") {
+    auto colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+      return false;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(address.substr(0, colon).c_str(),
+                    address.substr(colon + 1).c_str(),
+                    &hints,
+                    &addresses) != 0) {
+      return false;
+    }
+
+    // The connect may wait, but only for a second.
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    for (auto info = addresses; info != nullptr; info = info->ai_next) {
+      socket_ = ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+      if (socket_ < 0) {
+        continue;
+      }
+      ::setsockopt(
+          socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      if (::connect(socket_, info->ai_addr, info->ai_addrlen) == 0) {
+        break;
+      }
+      disconnect();
+    }
+    freeaddrinfo(addresses);
+  } else {
+    struct sockaddr_un target;
+    memset(&target, 0, sizeof(target));
+    target.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(target.sun_path)) {
+      return false;
+    }
+    memcpy(target.sun_path, address.c_str(), address.size());
+    socket_ = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (socket_ >= 0 &&
+        ::connect(socket_, (struct sockaddr*)&target, sizeof(target)) != 0) {
+      disconnect();
+    }
+  }
+
+  if (socket_ < 0) {
+    return false;
+  }
+  ::fcntl(socket_, F_SETFD, FD_CLOEXEC);
+  ::fcntl(socket_, F_SETFL, ::fcntl(socket_, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+  int enabled = 1;
+  ::setsockopt(socket_, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+  return true;
+}
+
+void SyslogLogWriter::disconnect() {
+  if (socket_ >= 0) {
+    ::close(socket_);
+  }
+  socket_ = -1;
+}
+
+LoggerBufferStats getSyslogBufferStats() {
+  return getSyslogLogWriter()->stats();
+}
+
 class SyslogLoggerPlugin : public LoggerPlugin {
  public:
+  Status setUp();
   Status logString(const std::string& s);
   Status init(const std::string& name, const std::vector<StatusLogLine>& log);
   Status logStatus(const std::vector<StatusLogLine>& log);
+
+ private:
+  /// Send a message using the libc syslog call or the socket writer.
+  void log(int severity, const std::string& message);
+
+ private:
+  /// The application name of socket transport messages.
+  std::string name_;
 };
 
 REGISTER(SyslogLoggerPlugin, "logger", "syslog");
 
+Status SyslogLoggerPlugin::setUp() {
+  const auto& transport = FLAGS_logger_syslog_transport;
+  if (transport == "syslog") {
+    return Status(0, "OK");
+  } else if (transport != "unix" && transport != "tcp") {
+    return Status(1, "Unknown syslog transport: " + transport);
+  }
+
+  // Start one writer thread for the process, later messages are queued.
+  static std::once_flag started;
+  std::call_once(started,
+                 []() { Dispatcher::addService(getSyslogLogWriter()); });
+  return Status(0, "OK");
+}
+
+void SyslogLoggerPlugin::log(int severity, const std::string& message) {
+  if (FLAGS_logger_syslog_transport == "syslog") {
+    syslog(severity, "%s", message.c_str());
+    return;
+  }
+
+  auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::system_clock::now().time_since_epoch())
+                  .count();
+  auto priority = (FLAGS_logger_syslog_facility << 3) | severity;
+  getSyslogLogWriter()->write(
+      formatSyslogMessage(priority, time, name_, message));
+}
+
 Status SyslogLoggerPlugin::logString(const std::string& s) {
-  syslog(LOG_INFO, "%s", s.c_str());
+  log(LOG_INFO, s);
   return Status(0, "OK");
 }
 
@@ -51,7 +419,7 @@ Status SyslogLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
                        " location=" + item.filename + ":" +
                        std::to_string(item.line) + " message=" + item.message;
 
-    syslog(severity, "%s", line.c_str());
+    this->log(severity, line);
   }
   return Status(0, "OK");
 }
@@ -64,7 +432,11 @@ Status SyslogLoggerPlugin::init(const std::string& name,
   if (FLAGS_logger_syslog_facility < 0 || FLAGS_logger_syslog_facility > 23) {
     FLAGS_logger_syslog_facility = LOG_LOCAL3 >> 3;
   }
-  openlog(name.c_str(), LOG_PID | LOG_CONS, FLAGS_logger_syslog_facility << 3);
+  name_ = name;
+  if (FLAGS_logger_syslog_transport == "syslog") {
+    openlog(
+        name.c_str(), LOG_PID | LOG_CONS, FLAGS_logger_syslog_facility << 3);
+  }
 
   // Now funnel the intermediate status logs provided to `init`.
   return logStatus(log);
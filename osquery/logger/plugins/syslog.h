@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osquery/logger.h>
+
+#include "osquery/dispatcher/dispatcher.h"
+
+namespace osquery {
+
+/**
+ * @brief Format an RFC 5424 syslog message.
+ *
+ * @param priority The facility and severity, facility * 8 + severity.
+ * @param time The UNIX time in microseconds.
+ * @param app The application name, the binary name given to init.
+ * @param message The message, results or a status line.
+ */
+std::string formatSyslogMessage(int priority,
+                                size_t time,
+                                const std::string& app,
+                                const std::string& message);
+
+/**
+ * @brief A writer thread sending syslog messages directly to a socket.
+ *
+ * Used when logger_syslog_transport is unix or tcp instead of the libc
+ * syslog call. Loggers queue messages and return, the writer swaps the queue
+ * and sends every queued message at once: one sendmmsg of datagrams to a
+ * UNIX socket, or one write of octet-counted frames to a TCP stream.
+ *
+ * The socket does not block. Messages that do not fit the queue or the
+ * socket buffer are dropped and counted, the scheduler never waits for the
+ * syslog daemon. Until the writer runs, and after it is stopped, messages are
+ * sent without queueing.
+ */
+class SyslogLogWriter : public InternalRunnable {
+ public:
+  ~SyslogLogWriter();
+
+  /// Queue a message, or send it if the writer is not running.
+  void write(std::string message);
+
+  /// Send the queued messages and stop.
+  void stop() override;
+
+  /// See getLoggerBufferStats.
+  LoggerBufferStats stats() const;
+
+ protected:
+  /// Send queued messages until stopped.
+  void start() override;
+
+  /// Send messages, dropping those the socket does not accept.
+  void send(std::vector<std::string>& messages);
+
+  /// Send messages as datagrams to a UNIX socket.
+  size_t sendDatagrams(std::vector<std::string>& messages);
+
+  /// Send messages as octet-counted frames to a TCP stream.
+  size_t sendFrames(std::vector<std::string>& messages);
+
+  /// Connect to logger_syslog_address if not connected.
+  bool connect();
+
+  /// Close the socket, a later send connects again.
+  void disconnect();
+
+ private:
+  /// Messages waiting to be sent.
+  std::vector<std::string> pending_;
+
+  /// The bytes of pending messages.
+  size_t pending_bytes_{0};
+
+  /// The number of pending messages.
+  std::atomic<size_t> pending_lines_{0};
+
+  /// Messages dropped because the queue or socket was full.
+  std::atomic<size_t> dropped_lines_{0};
+
+  /// The milliseconds the last send of the queued messages took.
+  std::atomic<size_t> flush_latency_{0};
+
+  /// Set while the writer thread sends the queued messages.
+  bool running_{false};
+
+  /// Set when the writer thread should stop.
+  bool stopping_{false};
+
+  /// Protect the pending messages and writer state.
+  std::mutex mutex_;
+
+  /// Signaled when messages are pending or the writer should stop.
+  std::condition_variable wake_;
+
+  /// The connected socket, or -1.
+  int socket_{-1};
+
+  /// The UNIX time of the last connect attempt, retried once per second.
+  size_t connect_time_{0};
+
+  /// The unsent end of a frame partially written to a TCP stream.
+  std::string partial_;
+
+  /// Protect the socket, messages are sent by the writer or by callers.
+  std::mutex socket_mutex_;
+
+ private:
+  friend class SyslogLoggerTests;
+};
+
+/// Get the statistics of the syslog socket writer, see getLoggerBufferStats.
+LoggerBufferStats getSyslogBufferStats();
+}
@@ -0,0 +1,520 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+
+#include "osquery/remote/requests.h"
+
+#include "osquery/logger/plugins/tcp.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// The size of a frame header: payload size, sequence, log type, and codec.
+constexpr size_t kTCPFrameHeaderSize = 14;
+
+/// The most batches of spilled lines sent by each flush.
+constexpr size_t kTCPMaxSpillBatches = 16;
+
+/// The longest backoff after failed flushes, in milliseconds.
+constexpr size_t kTCPMaxBackoff = 60 * 1000;
+
+/// The logs domain key prefix of spilled lines, for each log type.
+const std::string kTCPSpillPrefixes[] = {"tcp_r", "tcp_s"};
+
+FLAG(string,
+     logger_tcp_endpoint,
+     "",
+     "Host and port of the TCP results logger endpoint, host:port");
+
+FLAG(uint64,
+     logger_tcp_period,
+     1000,
+     "Milliseconds before sending a partial batch of TCP logs");
+
+FLAG(uint64,
+     logger_tcp_batch_lines,
+     4096,
+     "Max number of log lines per TCP logger batch");
+
+FLAG(uint64,
+     logger_tcp_batch_bytes,
+     1024 * 1024,
+     "Max size in bytes of log lines per TCP logger batch");
+
+FLAG(uint64,
+     logger_tcp_queue_size,
+     16 * 1024 * 1024,
+     "Max bytes of TCP logs queued in memory before spilling to the database");
+
+FLAG(bool, logger_tcp_compress, false, "Compress TCP logger batches");
+
+FLAG(string,
+     logger_tcp_compression,
+     "lz4",
+     "Codec used by logger_tcp_compress: gzip or lz4");
+
+FLAG(uint64,
+     logger_tcp_timeout,
+     5,
+     "Seconds to wait for the TCP logger endpoint to accept a batch");
+
+REGISTER(TCPLoggerPlugin, "logger", "tcp");
+
+/// The forwarder is shared by every TCP logger, it owns the connection.
+static std::shared_ptr<TCPLogForwarder> getTCPLogForwarder() {
+  static auto forwarder = std::make_shared<TCPLogForwarder>();
+  return forwarder;
+}
+
+/// Append an integer to a frame as big-endian bytes.
+static inline void appendInteger(std::string& frame,
+                                 uint64_t value,
+                                 size_t size) {
+  for (size_t i = size; i > 0; i--) {
+    frame.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xFF));
+  }
+}
+
+TCPLogForwarder::TCPLogForwarder() {}
+
+TCPLogForwarder::~TCPLogForwarder() {
+  disconnect();
+}
+
+Status TCPLogForwarder::write(TCPLogType type, std::string line) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A line is always accepted by an empty queue.
+    if (running_ && (pending_bytes_ == 0 || pending_bytes_ + line.size() <=
+                                                FLAGS_logger_tcp_queue_size)) {
+      pending_bytes_ += line.size();
+      pending_lines_++;
+      pending_[type].push_back(std::move(line));
+      if (pending_lines_ >= FLAGS_logger_tcp_batch_lines ||
+          pending_bytes_ >= FLAGS_logger_tcp_batch_bytes) {
+        wake_.notify_one();
+      }
+      return Status(0, "OK");
+    }
+  }
+
+  // The queue is full, or the forwarder is not running.
+  std::vector<std::string> lines(1);
+  lines[0].swap(line);
+  return spill(type, lines);
+}
+
+void TCPLogForwarder::start() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  running_ = !stopping_;
+  while (running_) {
+    // Back off exponentially after failures, full batches do not wake.
+    auto period = std::max<size_t>(FLAGS_logger_tcp_period, 1);
+    if (failures_ > 0) {
+      period = std::min<size_t>(
+          period * (1ULL << std::min<size_t>(failures_, 16)), kTCPMaxBackoff);
+    }
+    wake_.wait_for(lock, std::chrono::milliseconds(period), [this]() {
+      return stopping_ ||
+             (failures_ == 0 &&
+              (pending_lines_ >= FLAGS_logger_tcp_batch_lines ||
+               pending_bytes_ >= FLAGS_logger_tcp_batch_bytes));
+    });
+
+    // After stopping the queued lines are sent and later lines are spilled.
+    running_ = !stopping_;
+    lock.unlock();
+    failures_ = (flush()) ? 0 : failures_ + 1;
+    lock.lock();
+  }
+  lock.unlock();
+  disconnect();
+}
+
+void TCPLogForwarder::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+}
+
+bool TCPLogForwarder::flush() {
+  std::vector<std::string> pending[2];
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending[TCP_LOG_RESULT].swap(pending_[TCP_LOG_RESULT]);
+    pending[TCP_LOG_STATUS].swap(pending_[TCP_LOG_STATUS]);
+    pending_bytes_ = 0;
+    pending_lines_ = 0;
+  }
+
+  auto sent = sendLines(TCP_LOG_RESULT, pending[TCP_LOG_RESULT]);
+  sent = sendLines(TCP_LOG_STATUS, pending[TCP_LOG_STATUS]) && sent;
+
+  // Spilled lines are sent once the endpoint acknowledges again.
+  if (sent) {
+    sent = sendSpilled(TCP_LOG_RESULT);
+    sent = sent && sendSpilled(TCP_LOG_STATUS);
+  }
+  return sent;
+}
+
+bool TCPLogForwarder::sendLines(TCPLogType type,
+                                std::vector<std::string>& lines) {
+  auto max_lines = std::max<size_t>(FLAGS_logger_tcp_batch_lines, 1);
+  size_t begin = 0;
+  while (begin < lines.size()) {
+    // Split the lines into batches by count and size.
+    size_t end = begin;
+    size_t bytes = 0;
+    while (end < lines.size() && end - begin < max_lines &&
+           (end == begin ||
+            bytes + lines[end].size() <= FLAGS_logger_tcp_batch_bytes)) {
+      bytes += lines[end++].size();
+    }
+
+    std::vector<std::string> batch(
+        std::make_move_iterator(lines.begin() + begin),
+        std::make_move_iterator(lines.begin() + end));
+    auto status = send(type, batch);
+    if (!status.ok()) {
+      VLOG(1) << "Could not send logs to TCP logger endpoint "
+              << FLAGS_logger_tcp_endpoint << ": " << status.getMessage();
+
+      // Spill the batch and every later line, in order.
+      batch.insert(batch.end(),
+                   std::make_move_iterator(lines.begin() + end),
+                   std::make_move_iterator(lines.end()));
+      spill(type, batch);
+      return false;
+    }
+    begin = end;
+  }
+  return true;
+}
+
+bool TCPLogForwarder::sendSpilled(TCPLogType type) {
+  auto max_lines = std::max<size_t>(FLAGS_logger_tcp_batch_lines, 1);
+  for (size_t i = 0; i < kTCPMaxSpillBatches; i++) {
+    std::vector<std::pair<std::string, std::string>> items;
+    scanDatabasePrefix(kLogs, items, kTCPSpillPrefixes[type], max_lines);
+    if (items.empty()) {
+      return true;
+    }
+
+    std::vector<std::string> indexes;
+    std::vector<std::string> lines;
+    size_t bytes = 0;
+    for (auto& item : items) {
+      if (!lines.empty() &&
+          bytes + item.second.size() > FLAGS_logger_tcp_batch_bytes) {
+        break;
+      }
+      bytes += item.second.size();
+      indexes.push_back(std::move(item.first));
+      lines.push_back(std::move(item.second));
+    }
+
+    auto status = send(type, lines);
+    if (!status.ok()) {
+      VLOG(1) << "Could not send spilled logs to TCP logger endpoint "
+              << FLAGS_logger_tcp_endpoint << ": " << status.getMessage();
+      return false;
+    }
+
+    // Remove the spilled lines once they were acknowledged.
+    writeDatabaseValues(kLogs, {}, indexes);
+    if (items.size() < max_lines) {
+      return true;
+    }
+  }
+  return true;
+}
+
+Status TCPLogForwarder::send(TCPLogType type,
+                             const std::vector<std::string>& lines) {
+  if (lines.empty()) {
+    return Status(0, "OK");
+  }
+
+  std::string payload;
+  uint8_t codec = 0;
+  if (FLAGS_logger_tcp_compress) {
+    auto compression = getCompressionType(FLAGS_logger_tcp_compression);
+    codec = (compression == COMPRESSION_LZ4) ? 2 : 1;
+    Compressor compressor(compression);
+    for (size_t i = 0; i < lines.size(); i++) {
+      if (i > 0) {
+        compressor.append("\n", 1);
+      }
+      compressor.append(lines[i]);
+    }
+    auto status = compressor.finish(payload);
+    if (!status.ok()) {
+      return status;
+    }
+  } else {
+    size_t size = lines.size() - 1;
+    for (const auto& line : lines) {
+      size += line.size();
+    }
+    payload.reserve(size);
+    for (size_t i = 0; i < lines.size(); i++) {
+      if (i > 0) {
+        payload.push_back('\n');
+      }
+      payload += lines[i];
+    }
+  }
+  if (payload.size() > UINT32_MAX) {
+    return Status(1, "Batch exceeds the TCP logger frame size");
+  }
+
+  auto status = connect();
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::string header;
+  header.reserve(kTCPFrameHeaderSize);
+  auto sequence = ++sequence_;
+  appendInteger(header, payload.size(), 4);
+  appendInteger(header, sequence, 8);
+  appendInteger(header, type, 1);
+  appendInteger(header, codec, 1);
+
+  auto write = [this](const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      auto bytes = ::send(socket_,
+                          data.data() + written,
+                          data.size() - written,
+#ifdef MSG_NOSIGNAL
+                          MSG_NOSIGNAL);
+#else
+                          0);
+#endif
+      if (bytes < 0 && errno == EINTR) {
+        continue;
+      } else if (bytes <= 0) {
+        return false;
+      }
+      written += bytes;
+    }
+    return true;
+  };
+  if (!write(header) || !write(payload)) {
+    disconnect();
+    return Status(1, "Cannot write batch to TCP logger endpoint");
+  }
+
+  // Wait for the endpoint to acknowledge the sequence of the batch.
+  unsigned char ack[8];
+  size_t read = 0;
+  while (read < sizeof(ack)) {
+    auto bytes = ::recv(socket_, ack + read, sizeof(ack) - read, 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      disconnect();
+      return Status(1, "TCP logger endpoint did not acknowledge batch");
+    }
+    read += bytes;
+  }
+
+  uint64_t acknowledged = 0;
+  for (size_t i = 0; i < sizeof(ack); i++) {
+    acknowledged = (acknowledged << 8) | ack[i];
+  }
+  if (acknowledged != sequence) {
+    disconnect();
+    return Status(1, "TCP logger endpoint acknowledged another batch");
+  }
+  return Status(0, "OK");
+}
+
+Status TCPLogForwarder::connect() {
+  if (socket_ >= 0) {
+    return Status(0, "OK");
+  }
+
+  // The endpoint is host:port, an IPv6 host may be within brackets.
+  const auto& endpoint = FLAGS_logger_tcp_endpoint;
+  auto colon = endpoint.rfind(':');
+  if (colon == std::string::npos || colon == 0) {
+    return Status(1, "Invalid TCP logger endpoint: " + endpoint);
+  }
+  auto host = endpoint.substr(0, colon);
+  auto port = endpoint.substr(colon + 1);
+  if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+    return Status(1, "Cannot resolve TCP logger endpoint: " + endpoint);
+  }
+
+  struct timeval timeout;
+  timeout.tv_sec = std::max<size_t>(FLAGS_logger_tcp_timeout, 1);
+  timeout.tv_usec = 0;
+  for (auto address = addresses; address != nullptr;
+       address = address->ai_next) {
+    socket_ = ::socket(
+        address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (socket_ < 0) {
+      continue;
+    }
+    ::fcntl(socket_, F_SETFD, FD_CLOEXEC);
+
+    // The send timeout also limits the connect.
+    ::setsockopt(
+        socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(
+        socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    int enabled = 1;
+    ::setsockopt(socket_, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+    if (::connect(socket_, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    disconnect();
+  }
+  freeaddrinfo(addresses);
+
+  if (socket_ < 0) {
+    return Status(1, "Cannot connect to TCP logger endpoint: " + endpoint);
+  }
+  return Status(0, "OK");
+}
+
+void TCPLogForwarder::disconnect() {
+  if (socket_ >= 0) {
+    ::close(socket_);
+  }
+  socket_ = -1;
+}
+
+Status TCPLogForwarder::spill(TCPLogType type,
+                              std::vector<std::string>& lines) {
+  // Keys sort by time then by a fixed-width counter, in the order written.
+  std::vector<std::pair<std::string, std::string>> puts;
+  puts.reserve(lines.size());
+  auto time = std::to_string(getUnixTime());
+  for (auto& line : lines) {
+    std::stringstream index;
+    index << kTCPSpillPrefixes[type] << time << "_" << std::setfill('0')
+          << std::setw(20) << ++spill_index_;
+    puts.push_back(std::make_pair(index.str(), ""));
+    puts.back().second.swap(line);
+  }
+  return writeDatabaseValues(kLogs, puts, {});
+}
+
+Status TCPLoggerPlugin::setUp() {
+  if (FLAGS_logger_tcp_endpoint.empty()) {
+    return Status(1, "No TCP logger endpoint configured");
+  }
+
+  // Start one forwarder thread for the process, until then lines are spilled.
+  static std::once_flag started;
+  std::call_once(started,
+                 []() { Dispatcher::addService(getTCPLogForwarder()); });
+  return Status(0, "OK");
+}
+
+Status TCPLoggerPlugin::logString(const std::string& s) {
+  return getTCPLogForwarder()->write(TCP_LOG_RESULT, s);
+}
+
+Status TCPLoggerPlugin::logResults(const QueryLogItem& item) {
+  std::vector<std::string> lines;
+  auto status = serializeResultLines(item, lines);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto forwarder = getTCPLogForwarder();
+  for (auto& line : lines) {
+    if (!line.empty()) {
+      status = forwarder->write(TCP_LOG_RESULT, std::move(line));
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status TCPLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
+  auto forwarder = getTCPLogForwarder();
+  for (const auto& item : log) {
+    // Convert the StatusLogLine into ptree format, to convert to JSON.
+    pt::ptree buffer;
+    buffer.put("severity", (google::LogSeverity)item.severity);
+    buffer.put("filename", item.filename);
+    buffer.put("line", item.line);
+    buffer.put("message", item.message);
+
+    std::string json;
+    try {
+      std::stringstream json_output;
+      pt::write_json(json_output, buffer, false);
+      json = json_output.str();
+    } catch (const pt::json_parser::json_parser_error& e) {
+      // The log could not be represented as JSON.
+      return Status(1, e.what());
+    }
+
+    if (!json.empty()) {
+      json.pop_back();
+    }
+    auto status = forwarder->write(TCP_LOG_STATUS, std::move(json));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status TCPLoggerPlugin::init(const std::string& name,
+                             const std::vector<StatusLogLine>& log) {
+  // Restart the glog facilities using the name init was provided.
+  google::ShutdownGoogleLogging();
+  google::InitGoogleLogging(name.c_str());
+  return logStatus(log);
+}
+}
@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osquery/logger.h>
+
+#include "osquery/dispatcher/dispatcher.h"
+
+namespace osquery {
+
+/// The log types sent in a frame.
+enum TCPLogType {
+  TCP_LOG_RESULT = 0,
+  TCP_LOG_STATUS = 1,
+};
+
+/**
+ * @brief A forwarder thread streaming batches of log lines over TCP.
+ *
+ * Loggers queue lines in memory and return. The forwarder sends a batch of
+ * one log type when it reaches logger_tcp_batch_lines or
+ * logger_tcp_batch_bytes, or after logger_tcp_period milliseconds. Each batch
+ * is one frame:
+ *
+ *   uint32 payload size, uint64 sequence, uint8 log type, uint8 codec,
+ *   payload of newline-separated lines, compressed if the codec is not 0.
+ *
+ * Integers are big-endian, the codec is 0 for none, 1 for gzip, and 2 for
+ * LZ4. The endpoint acknowledges a batch by replying with its uint64
+ * sequence. A batch that is not acknowledged, and lines queued while the
+ * endpoint is unavailable or the queue is full, are spilled to the logs
+ * domain of the database and sent once the endpoint acknowledges again.
+ */
+class TCPLogForwarder : public InternalRunnable {
+ public:
+  TCPLogForwarder();
+  ~TCPLogForwarder();
+
+  /// Queue a line, or spill it if the queue is full or the forwarder stopped.
+  Status write(TCPLogType type, std::string line);
+
+  /// Send the queued lines and stop.
+  void stop() override;
+
+ protected:
+  /// Send queued and spilled lines until stopped.
+  void start() override;
+
+  /**
+   * @brief Send the queued lines, then the spilled lines.
+   *
+   * Lines that cannot be sent are spilled.
+   *
+   * @return true if the endpoint acknowledged every batch sent.
+   */
+  bool flush();
+
+  /// Send batches of lines of one type, spilling the lines not acknowledged.
+  bool sendLines(TCPLogType type, std::vector<std::string>& lines);
+
+  /// Send the spilled lines of one type, removing them once acknowledged.
+  bool sendSpilled(TCPLogType type);
+
+  /// Send one batch frame and wait for its acknowledgement.
+  Status send(TCPLogType type, const std::vector<std::string>& lines);
+
+  /// Connect to logger_tcp_endpoint if not connected.
+  Status connect();
+
+  /// Close the connection, a later send connects again.
+  void disconnect();
+
+  /// Write lines to the logs domain.
+  Status spill(TCPLogType type, std::vector<std::string>& lines);
+
+ private:
+  /// The lines queued for each log type.
+  std::vector<std::string> pending_[2];
+
+  /// The bytes of queued lines.
+  size_t pending_bytes_{0};
+
+  /// The lines queued.
+  size_t pending_lines_{0};
+
+  /// Set while the forwarder thread is sending the queued lines.
+  bool running_{false};
+
+  /// Set when the forwarder thread should stop.
+  bool stopping_{false};
+
+  /// Protect the queued lines and forwarder state.
+  std::mutex mutex_;
+
+  /// Signaled when a batch is full or the forwarder should stop.
+  std::condition_variable wake_;
+
+  /// The connected socket, or -1.
+  int socket_{-1};
+
+  /// The sequence of the last batch sent.
+  uint64_t sequence_{0};
+
+  /// The number of consecutive flushes that failed to send.
+  size_t failures_{0};
+
+  /// An auto-incrementing suffix for the keys of spilled lines.
+  std::atomic<size_t> spill_index_{0};
+
+ private:
+  friend class TCPLoggerTests;
+};
+
+class TCPLoggerPlugin : public LoggerPlugin {
+ public:
+  /// Start the forwarder thread.
+  Status setUp() override;
+
+  /// Log a result string. This is the basic catch-all for snapshots and events.
+  Status logString(const std::string& s) override;
+
+  /// Queue the lines of query results.
+  Status logResults(const QueryLogItem& item) override;
+
+  /// Restart the glog facilities and queue the buffered status logs.
+  Status init(const std::string& name,
+              const std::vector<StatusLogLine>& log) override;
+
+  /// Log a status (ERROR/WARNING/INFO) message.
+  Status logStatus(const std::vector<StatusLogLine>& log) override;
+};
+}
@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/test_util.h"
+#include "osquery/logger/plugins/syslog.h"
+
+namespace osquery {
+
+DECLARE_string(logger_syslog_transport);
+DECLARE_string(logger_syslog_address);
+
+class SyslogLoggerTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    FLAGS_logger_syslog_transport = "syslog";
+    FLAGS_logger_syslog_address = "/dev/log";
+    if (!path_.empty()) {
+      ::unlink(path_.c_str());
+    }
+  }
+
+  /// Bind a UNIX datagram socket, as a syslog daemon would.
+  int bindDatagrams() {
+    path_ = kTestWorkingDirectory + "syslog.sock";
+    ::unlink(path_.c_str());
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path_.c_str(), sizeof(address.sun_path) - 1);
+    auto daemon = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+    EXPECT_EQ(::bind(daemon, (struct sockaddr*)&address, sizeof(address)), 0);
+    FLAGS_logger_syslog_transport = "unix";
+    FLAGS_logger_syslog_address = path_;
+    return daemon;
+  }
+
+  void send(SyslogLogWriter& writer, std::vector<std::string> messages) {
+    writer.send(messages);
+  }
+
+  size_t dropped(const SyslogLogWriter& writer) {
+    return writer.stats().dropped_lines;
+  }
+
+ protected:
+  std::string path_;
+};
+
+TEST_F(SyslogLoggerTests, test_format) {
+  // The local3 facility with the info severity.
+  auto message = formatSyslogMessage(
+      (19 << 3) | 6, 1451606400000001ULL, "osqueryd", "hello");
+  EXPECT_TRUE(
+      boost::starts_with(message, "<158>1 2016-01-01T00:00:00.000001Z "));
+  EXPECT_TRUE(boost::ends_with(
+      message, " osqueryd " + std::to_string(getpid()) + " - - hello"));
+
+  // An application name is not yet known before init.
+  message = formatSyslogMessage(14, 0, "", "hello");
+  EXPECT_NE(message.find(" - " + std::to_string(getpid()) + " - - "),
+            std::string::npos);
+}
+
+TEST_F(SyslogLoggerTests, test_unix_datagrams) {
+  auto daemon = bindDatagrams();
+  SyslogLogWriter writer;
+  send(writer, {"first", "second", "third"});
+  EXPECT_EQ(dropped(writer), 0U);
+
+  // Each message is one datagram.
+  char buffer[64];
+  for (const auto& expected : {"first", "second", "third"}) {
+    auto bytes = ::recv(daemon, buffer, sizeof(buffer), MSG_DONTWAIT);
+    ASSERT_GT(bytes, 0);
+    EXPECT_EQ(std::string(buffer, bytes), expected);
+  }
+  ::close(daemon);
+}
+
+TEST_F(SyslogLoggerTests, test_drop_unavailable) {
+  // Messages to a missing syslog daemon are dropped, not retried.
+  FLAGS_logger_syslog_transport = "unix";
+  FLAGS_logger_syslog_address = kTestWorkingDirectory + "missing.sock";
+  SyslogLogWriter writer;
+  writer.write("first");
+  send(writer, {"second", "third"});
+  EXPECT_EQ(dropped(writer), 3U);
+}
+
+TEST_F(SyslogLoggerTests, test_tcp_frames) {
+  auto listener = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t size = sizeof(address);
+  ASSERT_EQ(::bind(listener, (struct sockaddr*)&address, size), 0);
+  ASSERT_EQ(::listen(listener, 1), 0);
+  ::getsockname(listener, (struct sockaddr*)&address, &size);
+  FLAGS_logger_syslog_transport = "tcp";
+  FLAGS_logger_syslog_address =
+      "127.0.0.1:" + std::to_string(ntohs(address.sin_port));
+
+  SyslogLogWriter writer;
+  send(writer, {"hello", "syslog"});
+  EXPECT_EQ(dropped(writer), 0U);
+
+  // Each message is framed by its size.
+  auto client = ::accept(listener, nullptr, nullptr);
+  std::string expected = "5 hello6 syslog";
+  std::string received;
+  char buffer[64];
+  while (received.size() < expected.size()) {
+    auto bytes = ::recv(client, buffer, sizeof(buffer), 0);
+    ASSERT_GT(bytes, 0);
+    received.append(buffer, bytes);
+  }
+  EXPECT_EQ(received, expected);
+  ::close(client);
+  ::close(listener);
+}
+}
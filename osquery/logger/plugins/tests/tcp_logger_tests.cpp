@@ -0,0 +1,192 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/logger/plugins/tcp.h"
+
+namespace osquery {
+
+DECLARE_string(logger_tcp_endpoint);
+DECLARE_uint64(logger_tcp_batch_lines);
+DECLARE_bool(logger_tcp_compress);
+
+/// A frame read by the test endpoint.
+struct TCPTestFrame {
+  uint8_t type{0};
+  uint8_t codec{0};
+  std::string payload;
+};
+
+class TCPLoggerTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    listener_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    ASSERT_EQ(::bind(listener_, (struct sockaddr*)&address, size), 0);
+    ASSERT_EQ(::listen(listener_, 1), 0);
+    ::getsockname(listener_, (struct sockaddr*)&address, &size);
+    FLAGS_logger_tcp_endpoint =
+        "127.0.0.1:" + std::to_string(ntohs(address.sin_port));
+  }
+
+  void TearDown() override {
+    if (listener_ >= 0) {
+      ::close(listener_);
+    }
+    for (const auto& prefix : {"tcp_r", "tcp_s"}) {
+      std::vector<std::string> keys;
+      scanDatabasePrefix(kLogs, keys, prefix);
+      writeDatabaseValues(kLogs, {}, keys);
+    }
+    FLAGS_logger_tcp_batch_lines = 4096;
+    FLAGS_logger_tcp_compress = false;
+  }
+
+  /// Accept a connection and acknowledge the sequence of each frame read.
+  void serve(size_t count) {
+    endpoint_ = std::thread([this, count]() {
+      auto client = ::accept(listener_, nullptr, nullptr);
+      auto read = [client](std::string& data, size_t size) {
+        data.resize(size);
+        size_t done = 0;
+        while (done < size) {
+          auto bytes = ::recv(client, &data[done], size - done, 0);
+          if (bytes <= 0) {
+            return false;
+          }
+          done += bytes;
+        }
+        return true;
+      };
+
+      std::string header;
+      for (size_t i = 0; i < count && read(header, 14); i++) {
+        size_t size = 0;
+        for (size_t j = 0; j < 4; j++) {
+          size = (size << 8) | static_cast<uint8_t>(header[j]);
+        }
+        TCPTestFrame frame;
+        frame.type = header[12];
+        frame.codec = header[13];
+        if (!read(frame.payload, size)) {
+          break;
+        }
+        frames_.push_back(std::move(frame));
+        ::send(client, header.data() + 4, 8, 0);
+      }
+      ::close(client);
+    });
+  }
+
+  /// Wait for the endpoint to read its frames.
+  void join() {
+    if (endpoint_.joinable()) {
+      endpoint_.join();
+    }
+  }
+
+  /// Queue lines as a running forwarder would.
+  void queue(TCPLogForwarder& forwarder,
+             TCPLogType type,
+             const std::vector<std::string>& lines) {
+    forwarder.running_ = true;
+    for (const auto& line : lines) {
+      forwarder.write(type, line);
+    }
+  }
+
+  bool flush(TCPLogForwarder& forwarder) {
+    return forwarder.flush();
+  }
+
+  size_t spilled(const std::string& prefix) {
+    std::vector<std::string> keys;
+    scanDatabasePrefix(kLogs, keys, prefix);
+    return keys.size();
+  }
+
+ protected:
+  int listener_{-1};
+  std::thread endpoint_;
+  std::vector<TCPTestFrame> frames_;
+};
+
+TEST_F(TCPLoggerTests, test_send_batches) {
+  TCPLogForwarder forwarder;
+  FLAGS_logger_tcp_batch_lines = 2;
+  queue(forwarder, TCP_LOG_RESULT, {"{\"a\":1}", "{\"a\":2}", "{\"a\":3}"});
+  queue(forwarder, TCP_LOG_STATUS, {"{\"s\":1}"});
+
+  // The results are split into two batches, then one status batch.
+  serve(3);
+  EXPECT_TRUE(flush(forwarder));
+  join();
+  ASSERT_EQ(frames_.size(), 3U);
+  EXPECT_EQ(frames_[0].type, TCP_LOG_RESULT);
+  EXPECT_EQ(frames_[0].codec, 0U);
+  EXPECT_EQ(frames_[0].payload, "{\"a\":1}\n{\"a\":2}");
+  EXPECT_EQ(frames_[1].payload, "{\"a\":3}");
+  EXPECT_EQ(frames_[2].type, TCP_LOG_STATUS);
+  EXPECT_EQ(frames_[2].payload, "{\"s\":1}");
+  EXPECT_EQ(spilled("tcp_"), 0U);
+}
+
+TEST_F(TCPLoggerTests, test_spill_unavailable) {
+  // Lines written before the forwarder runs are spilled.
+  TCPLogForwarder forwarder;
+  forwarder.write(TCP_LOG_RESULT, "{\"a\":1}");
+  EXPECT_EQ(spilled("tcp_r"), 1U);
+
+  // Lines that are not acknowledged are spilled, in order.
+  ::close(listener_);
+  listener_ = -1;
+  queue(forwarder, TCP_LOG_RESULT, {"{\"a\":2}", "{\"a\":3}"});
+  EXPECT_FALSE(flush(forwarder));
+  EXPECT_EQ(spilled("tcp_r"), 3U);
+  SetUp();
+
+  // Once the endpoint acknowledges, the spilled lines are sent and removed.
+  serve(1);
+  EXPECT_TRUE(flush(forwarder));
+  join();
+  ASSERT_EQ(frames_.size(), 1U);
+  EXPECT_EQ(frames_[0].payload, "{\"a\":1}\n{\"a\":2}\n{\"a\":3}");
+  EXPECT_EQ(spilled("tcp_r"), 0U);
+}
+
+TEST_F(TCPLoggerTests, test_compress) {
+  TCPLogForwarder forwarder;
+  FLAGS_logger_tcp_compress = true;
+  queue(forwarder, TCP_LOG_RESULT, {std::string(4096, 'a')});
+
+  serve(1);
+  EXPECT_TRUE(flush(forwarder));
+  join();
+  ASSERT_EQ(frames_.size(), 1U);
+  EXPECT_EQ(frames_[0].codec, 2U);
+  EXPECT_LT(frames_[0].payload.size(), 4096U);
+}
+}
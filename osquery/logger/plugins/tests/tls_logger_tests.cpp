@@ -8,6 +8,10 @@
  *
  */
 
+#include <sstream>
+
+#include <boost/property_tree/json_parser.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/logger.h>
@@ -16,11 +20,14 @@
 #include "osquery/core/test_util.h"
 
 #include "osquery/logger/plugins/tls.h"
+#include "osquery/remote/serializers/columnar.h"
 
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(logger_tls_period);
+
 class TLSLoggerTests : public testing::Test {
  public:
   size_t getIndex(const std::shared_ptr<TLSLoggerPlugin>& plugin) {
@@ -30,6 +37,36 @@ class TLSLoggerTests : public testing::Test {
   void runCheck(const std::shared_ptr<TLSLogForwarderRunner>& runner) {
     runner->check();
   }
+
+  Status serialize(const std::shared_ptr<TLSLogForwarderRunner>& runner,
+                   std::vector<std::string>& log_data,
+                   std::string& body) {
+    return runner->serialize(log_data, "result", body);
+  }
+
+  Status serializeColumnar(const std::shared_ptr<TLSLogForwarderRunner>& runner,
+                           std::vector<std::string>& log_data,
+                           std::string& body) {
+    return runner->serializeColumnar(log_data, "result", body);
+  }
+
+  size_t& batchLines(const std::shared_ptr<TLSLogForwarderRunner>& runner) {
+    return runner->batch_lines_;
+  }
+
+  void adapt(const std::shared_ptr<TLSLogForwarderRunner>& runner,
+             bool sent,
+             size_t latency,
+             bool full) {
+    runner->adapt(sent, latency, full);
+  }
+
+  size_t delay(const std::shared_ptr<TLSLogForwarderRunner>& runner,
+               size_t failures,
+               bool more) {
+    runner->failures_ = failures;
+    return runner->delay(more);
+  }
 };
 
 TEST_F(TLSLoggerTests, test_log) {
@@ -87,4 +124,76 @@ TEST_F(TLSLoggerTests, test_send) {
   TLSServerRunner::unsetClientConfig();
   TLSServerRunner::stop();
 }
+
+TEST_F(TLSLoggerTests, test_serialize) {
+  auto runner = std::make_shared<TLSLogForwarderRunner>("fake_key");
+  std::vector<std::string> log_data = {
+      "{\"name\":\"one\",\"count\":1}", "not json", "{\"name\":\"two\"}"};
+
+  std::string body;
+  auto s = serialize(runner, log_data, body);
+  ASSERT_TRUE(s.ok());
+
+  // Lines are spliced verbatim, invalid lines are skipped.
+  std::string expected = "[{\"name\":\"one\",\"count\":1},{\"name\":\"two\"}]";
+  EXPECT_NE(body.find(expected), std::string::npos);
+
+  pt::ptree params;
+  std::stringstream input(body);
+  pt::read_json(input, params);
+  EXPECT_EQ(params.get<std::string>("node_key"), "fake_key");
+  EXPECT_EQ(params.get<std::string>("log_type"), "result");
+  EXPECT_EQ(params.get_child("data").size(), 2U);
+}
+
+TEST_F(TLSLoggerTests, test_serialize_columnar) {
+  auto runner = std::make_shared<TLSLogForwarderRunner>("fake_key");
+  std::vector<std::string> log_data = {
+      "{\"name\":\"one\",\"columns\":{\"pid\":\"1\"}}",
+      "not json",
+      "{\"name\":\"two\",\"columns\":{\"pid\":\"2\"}}"};
+
+  std::string body;
+  auto s = serializeColumnar(runner, log_data, body);
+  ASSERT_TRUE(s.ok());
+
+  // Column names are written once per batch.
+  EXPECT_EQ(body.find("pid"), body.rfind("pid"));
+
+  pt::ptree params;
+  s = ColumnarSerializer().deserialize(body, params);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(params.get<std::string>("node_key"), "fake_key");
+  EXPECT_EQ(params.get<std::string>("log_type"), "result");
+  auto& data = params.get_child("data");
+  ASSERT_EQ(data.size(), 2U);
+  EXPECT_EQ(data.back().second.get<std::string>("columns.pid"), "2");
+}
+
+TEST_F(TLSLoggerTests, test_adaptive_batches) {
+  auto runner = std::make_shared<TLSLogForwarderRunner>("fake_key");
+  auto initial = batchLines(runner);
+
+  // Fast requests grow the batches only while a backlog remains.
+  adapt(runner, true, 10, false);
+  EXPECT_EQ(batchLines(runner), initial);
+  adapt(runner, true, 10, true);
+  EXPECT_EQ(batchLines(runner), initial * 2);
+
+  // Slow or failed requests shrink the batches.
+  adapt(runner, true, 5000, true);
+  EXPECT_EQ(batchLines(runner), initial);
+  adapt(runner, false, 0, false);
+  EXPECT_EQ(batchLines(runner), initial / 2);
+
+  // A backlog is drained without waiting, failures back off with jitter.
+  EXPECT_EQ(delay(runner, 0, true), 0U);
+  EXPECT_EQ(delay(runner, 0, false), FLAGS_logger_tls_period * 1000);
+  auto backoff = std::max<size_t>(FLAGS_logger_tls_period * 4, 1) * 1000;
+  for (size_t i = 0; i < 10; i++) {
+    auto wait = delay(runner, 2, true);
+    EXPECT_GE(wait, backoff / 2);
+    EXPECT_LE(wait, backoff);
+  }
+}
 }
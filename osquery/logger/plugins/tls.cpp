@@ -8,21 +8,26 @@
  *
  */
 
-#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/database.h>
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 
 #include "osquery/remote/requests.h"
 #include "osquery/remote/transports/tls.h"
+#include "osquery/remote/serializers/columnar.h"
 #include "osquery/remote/serializers/json.h"
 #include "osquery/remote/utility.h"
-#include "osquery/database/db_handle.h"
 
 #include "osquery/logger/plugins/tls.h"
 
@@ -30,8 +35,19 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+/// The initial number of lines per request batch.
 constexpr size_t kTLSMaxLogLines = 1024;
 
+/// Adaptive batches stay within these line counts.
+constexpr size_t kTLSMinBatchLines = 64;
+constexpr size_t kTLSMaxBatchLines = 16384;
+
+/// Batches grow while requests finish within this many milliseconds.
+constexpr size_t kTLSTargetLatency = 1000;
+
+/// The longest backoff after failed requests, in seconds.
+constexpr size_t kTLSMaxBackoff = 300;
+
 FLAG(string, logger_tls_endpoint, "", "TLS/HTTPS endpoint for results logging");
 
 FLAG(uint64,
@@ -46,6 +62,21 @@ FLAG(uint64,
 
 FLAG(bool, logger_tls_compress, false, "GZip compress TLS/HTTPS request body");
 
+FLAG(string,
+     logger_tls_compression,
+     "gzip",
+     "Codec used by logger_tls_compress: gzip or lz4");
+
+FLAG(uint64,
+     logger_tls_batch_bytes,
+     4 * 1024 * 1024,
+     "Max size in bytes of log lines per TLS/HTTPS request");
+
+FLAG(uint64,
+     logger_tls_inflight,
+     1,
+     "Max number of concurrent TLS/HTTPS log requests");
+
 DECLARE_bool(tls_secret_always);
 DECLARE_string(tls_enroll_override);
 DECLARE_bool(tls_node_api);
@@ -73,7 +104,9 @@ static inline void iterate(std::vector<std::string>& input,
 }
 
 TLSLogForwarderRunner::TLSLogForwarderRunner(const std::string& node_key)
-    : node_key_(node_key) {
+    : node_key_(node_key),
+      batch_lines_(kTLSMaxLogLines),
+      jitter_(std::random_device()()) {
   uri_ = TLSRequestHelper::makeURI(FLAGS_logger_tls_endpoint);
 }
 
@@ -82,6 +115,24 @@ Status TLSLoggerPlugin::logString(const std::string& s) {
   return setDatabaseValue(kLogs, index, s);
 }
 
+Status TLSLoggerPlugin::logResults(const QueryLogItem& item) {
+  std::vector<std::string> lines;
+  auto status = serializeResultLines(item, lines);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::vector<std::pair<std::string, std::string>> puts;
+  puts.reserve(lines.size());
+  for (auto& line : lines) {
+    if (!line.empty()) {
+      puts.push_back(std::make_pair(genLogIndex(true, log_index_), ""));
+      puts.back().second.swap(line);
+    }
+  }
+  return writeDatabaseValues(kLogs, puts, {});
+}
+
 Status TLSLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
   for (const auto& item : log) {
     // Convert the StatusLogLine into ptree format, to convert to JSON.
@@ -134,106 +185,273 @@ Status TLSLoggerPlugin::init(const std::string& name,
   return logStatus(log);
 }
 
-Status TLSLogForwarderRunner::send(std::vector<std::string>& log_data,
-                                   const std::string& log_type) {
+/// A cheap check that a buffered line is a JSON object or array.
+static inline bool isJSONValue(const std::string& line) {
+  auto first = line.find_first_not_of(" \t\r\n");
+  auto last = line.find_last_not_of(" \t\r\n");
+  if (first == std::string::npos) {
+    return false;
+  }
+  return (line[first] == '{' && line[last] == '}') ||
+         (line[first] == '[' && line[last] == ']');
+}
+
+Status TLSLogForwarderRunner::serialize(std::vector<std::string>& log_data,
+                                        const std::string& log_type,
+                                        std::string& body) {
+  // Serialize the other params once and open the 'data' list after them.
   pt::ptree params;
   params.put<std::string>("node_key", node_key_);
   params.put<std::string>("log_type", log_type);
+  offerColumnarEncoding(params);
+  std::string header;
+  auto status = JSONSerializer().serialize(params, header);
+  auto end = header.rfind('}');
+  if (!status.ok() || end == std::string::npos) {
+    return Status(1, "Cannot serialize log request parameters");
+  }
+  header.resize(end);
+  header += ",\"data\":[";
 
-  {
-    // Read each logged line into JSON and populate a list of lines.
-    // The result list will use the 'data' key.
-    pt::ptree children;
-    iterate(log_data,
-            ([&children](std::string& item) {
-              pt::ptree child;
-              try {
-                std::stringstream input;
-                input << item;
-                std::string().swap(item);
-                pt::read_json(input, child);
-              } catch (const pt::json_parser::json_parser_error& e) {
-                // The log line entered was not valid JSON, skip it.
-              }
-              children.push_back(std::make_pair("", std::move(child)));
-            }));
-    params.add_child("data", std::move(children));
-  }
-
-  auto request = Request<TLSTransport, JSONSerializer>(uri_);
+  std::unique_ptr<Compressor> compressor;
   if (FLAGS_logger_tls_compress) {
-    request.setOption("compress", true);
+    compressor.reset(
+        new Compressor(getCompressionType(FLAGS_logger_tls_compression)));
+  } else {
+    size_t size = header.size() + 2;
+    for (const auto& item : log_data) {
+      size += item.size() + 1;
+    }
+    body.clear();
+    body.reserve(size);
   }
-  return request.call(params);
+
+  auto write = [&compressor, &body](const std::string& data) {
+    if (compressor != nullptr) {
+      compressor->append(data);
+    } else {
+      body += data;
+    }
+  };
+
+  write(header);
+  bool first = true;
+  iterate(log_data,
+          ([&write, &first](std::string& item) {
+            if (!isJSONValue(item)) {
+              // The log line entered was not valid JSON, skip it.
+              return;
+            }
+            if (!first) {
+              write(",");
+            }
+            first = false;
+            write(item);
+            std::string().swap(item);
+          }));
+  write("]}");
+
+  if (compressor != nullptr) {
+    return compressor->finish(body);
+  }
+  return Status(0, "OK");
 }
 
-void TLSLogForwarderRunner::check() {
-  // Instead of using the 'help' database API, prefer to interact with the
-  // DBHandle directly for additional performance.
-  auto handle = DBHandle::getInstance();
+Status TLSLogForwarderRunner::serializeColumnar(
+    std::vector<std::string>& log_data,
+    const std::string& log_type,
+    std::string& body) {
+  pt::ptree params;
+  params.put<std::string>("node_key", node_key_);
+  params.put<std::string>("log_type", log_type);
+  offerColumnarEncoding(params);
 
-  // Get a list of all the buffered log items, with a max of 1024 lines.
-  std::vector<std::string> indexes;
-  auto status = handle->Scan(kLogs, indexes, kTLSMaxLogLines);
-
-  // For each index, accumulate the log line into the result or status set.
-  std::vector<std::string> results, statuses;
-  iterate(indexes,
-          ([&handle, &results, &statuses](std::string& index) {
-            std::string value;
-            auto& target = ((index.at(0) == 'r') ? results : statuses);
-            if (handle->Get(kLogs, index, value)) {
-              // Enforce a max log line size for TLS logging.
-              if (value.size() > FLAGS_logger_tls_max) {
-                LOG(WARNING) << "Line exceeds TLS logger max: " << value.size();
-              } else {
-                target.push_back(std::move(value));
-              }
+  pt::ptree data;
+  iterate(log_data,
+          ([&data](std::string& item) {
+            if (!isJSONValue(item)) {
+              return;
             }
+            pt::ptree line;
+            try {
+              std::stringstream input(item);
+              pt::read_json(input, line);
+            } catch (const pt::json_parser::json_parser_error& /* e */) {
+              // The log line entered was not valid JSON, skip it.
+              return;
+            }
+            data.push_back(std::make_pair("", pt::ptree()))->second.swap(line);
+            std::string().swap(item);
           }));
+  params.add_child("data", data);
+
+  if (!FLAGS_logger_tls_compress) {
+    return ColumnarSerializer().serialize(params, body);
+  }
 
-  // If any results/statuses were found in the flushed buffer, send.
-  if (results.size() > 0) {
-    status = send(results, "result");
+  Compressor compressor(getCompressionType(FLAGS_logger_tls_compression));
+  {
+    CompressorStream stream(compressor);
+    auto status = ColumnarSerializer().serializeTo(params, stream);
     if (!status.ok()) {
-      VLOG(1) << "Could not send results to logger URI: " << uri_ << " ("
-              << status.getMessage() << ")";
-    } else {
-      // Clear the results logs once they were sent.
-      iterate(indexes,
-              ([&results](std::string& index) {
-                if (index.at(0) != 'r') {
-                  return;
-                }
-                deleteDatabaseValue(kLogs, index);
-              }));
+      return status;
     }
   }
+  return compressor.finish(body);
+}
 
-  if (statuses.size() > 0) {
-    status = send(statuses, "status");
-    if (!status.ok()) {
-      VLOG(1) << "Could not send status logs to logger URI: " << uri_ << " ("
-              << status.getMessage() << ")";
+Status TLSLogForwarderRunner::send(std::vector<std::string>& log_data,
+                                   const std::string& log_type) {
+  std::string body;
+  bool columnar = columnar_;
+  auto status = (columnar) ? serializeColumnar(log_data, log_type, body)
+                           : serialize(log_data, log_type, body);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The body is already compressed, do not set the request option.
+  pt::ptree recv;
+  if (columnar) {
+    auto request = Request<TLSTransport, ColumnarSerializer>(uri_);
+    status = request.callSerialized(body);
+    request.getResponse(recv);
+  } else {
+    auto request = Request<TLSTransport, JSONSerializer>(uri_);
+    status = request.callSerialized(body);
+    request.getResponse(recv);
+  }
+
+  if (status.ok()) {
+    columnar_ = acceptsColumnarEncoding(recv);
+  }
+  return status;
+}
+
+/// A batch of log lines sent in one request.
+struct TLSLogBatch {
+  std::vector<std::string> indexes;
+  std::vector<std::string> lines;
+  Status status;
+
+  /// The request latency in milliseconds.
+  size_t latency{0};
+};
+
+bool TLSLogForwarderRunner::checkType(const std::string& prefix,
+                                      const std::string& log_type,
+                                      bool& failed) {
+  // Get the buffered log items and their lines, for every in-flight batch.
+  auto inflight = std::max<size_t>(FLAGS_logger_tls_inflight, 1);
+  std::vector<std::pair<std::string, std::string>> items;
+  scanDatabasePrefix(kLogs, items, prefix, batch_lines_ * inflight);
+  if (items.empty()) {
+    return false;
+  }
+  auto more = (items.size() == batch_lines_ * inflight);
+
+  // Split the lines into batches by count and size.
+  std::vector<TLSLogBatch> batches(1);
+  size_t bytes = 0;
+  for (auto& item : items) {
+    auto full = batches.back().indexes.size() >= batch_lines_ ||
+                bytes + item.second.size() > FLAGS_logger_tls_batch_bytes;
+    if (full && !batches.back().indexes.empty()) {
+      if (batches.size() == inflight) {
+        more = true;
+        break;
+      }
+      batches.emplace_back();
+      bytes = 0;
+    }
+
+    auto& batch = batches.back();
+    // Enforce a max log line size for TLS logging.
+    if (item.second.size() > FLAGS_logger_tls_max) {
+      LOG(WARNING) << "Line exceeds TLS logger max: " << item.second.size();
     } else {
-      // Clear the status logs once they were sent.
-      iterate(indexes,
-              ([&results](std::string& index) {
-                if (index.at(0) != 's') {
-                  return;
-                }
-                deleteDatabaseValue(kLogs, index);
-              }));
+      bytes += item.second.size();
+      batch.lines.push_back(std::move(item.second));
+    }
+    batch.indexes.push_back(std::move(item.first));
+  }
+
+  // Send each batch concurrently, the first on this thread.
+  auto run = [this, &log_type](TLSLogBatch& batch) {
+    auto start = std::chrono::steady_clock::now();
+    batch.status = (batch.lines.empty()) ? Status(0, "OK")
+                                         : send(batch.lines, log_type);
+    batch.latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  };
+  std::vector<std::future<void>> requests;
+  for (size_t i = 1; i < batches.size(); i++) {
+    requests.push_back(
+        std::async(std::launch::async, run, std::ref(batches[i])));
+  }
+  run(batches[0]);
+  for (auto& request : requests) {
+    request.wait();
+  }
+
+  // Acknowledge in order, clearing the logs once they were sent.
+  size_t latency = 0;
+  for (auto& batch : batches) {
+    if (!batch.status.ok()) {
+      VLOG(1) << "Could not send " << log_type << " logs to logger URI: "
+              << uri_ << " (" << batch.status.getMessage() << ")";
+      adapt(false, batch.latency, false);
+      failed = true;
+      return false;
     }
+    latency = std::max(latency, batch.latency);
+    iterate(batch.indexes,
+            ([](std::string& index) { deleteDatabaseValue(kLogs, index); }));
   }
+
+  adapt(true, latency, more);
+  return more;
+}
+
+void TLSLogForwarderRunner::adapt(bool sent, size_t latency, bool full) {
+  if (!sent || latency > kTLSTargetLatency) {
+    batch_lines_ = std::max(batch_lines_ / 2, kTLSMinBatchLines);
+  } else if (full && latency < kTLSTargetLatency / 2) {
+    // Grow while draining a backlog and the endpoint keeps up.
+    batch_lines_ = std::min(batch_lines_ * 2, kTLSMaxBatchLines);
+  }
+}
+
+bool TLSLogForwarderRunner::check() {
+  bool failed = false;
+  auto more = checkType("r", "result", failed);
+  more = checkType("s", "status", failed) || more;
+  failures_ = (failed) ? failures_ + 1 : 0;
+  return more && !failed;
+}
+
+size_t TLSLogForwarderRunner::delay(bool more) {
+  if (failures_ > 0) {
+    // Back off exponentially, waiting between half and all of the backoff.
+    auto backoff = std::min<size_t>(
+        FLAGS_logger_tls_period * (1ULL << std::min<size_t>(failures_, 16)),
+        kTLSMaxBackoff);
+    backoff = std::max<size_t>(backoff, 1) * 1000;
+    std::uniform_int_distribution<size_t> distribution(backoff / 2, backoff);
+    return distribution(jitter_);
+  }
+
+  // Drain a backlog without waiting for the next period.
+  return (more) ? 0 : FLAGS_logger_tls_period * 1000;
 }
 
 void TLSLogForwarderRunner::start() {
   while (true) {
-    check();
+    auto more = check();
 
     // Cool off and time wait the configured period.
-    osquery::interruptableSleep(FLAGS_logger_tls_period * 1000);
+    osquery::interruptableSleep(delay(more));
   }
 }
 }
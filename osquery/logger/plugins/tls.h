@@ -10,6 +10,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+
 #include <osquery/logger.h>
 
 #include "osquery/dispatcher/dispatcher.h"
@@ -37,19 +42,61 @@ class TLSLogForwarderRunner : public InternalRunnable {
    * @brief Send labeled result logs.
    *
    * The log_data provided to send must be mutable.
-   * To optimize for smaller memory, this will be moved into place within the
-   * constructed property tree before sending.
+   * To optimize for smaller memory, each line is released once it is copied
+   * into the request body.
    */
   Status send(std::vector<std::string>& log_data, const std::string& log_type);
 
+  /**
+   * @brief Build the JSON request body for a batch of log lines.
+   *
+   * Each buffered line is already JSON, it is spliced verbatim into the `data`
+   * array instead of being parsed and serialized again. The body is
+   * compressed as it is built if logger_tls_compress is set.
+   */
+  Status serialize(std::vector<std::string>& log_data,
+                   const std::string& log_type,
+                   std::string& body);
+
+  /**
+   * @brief Build a columnar request body for a batch of log lines.
+   *
+   * Used once the endpoint accepts the columnar encoding. Each line is parsed
+   * so the rows of a batch are written as a table, repeated keys are written
+   * once per batch instead of once per line.
+   */
+  Status serializeColumnar(std::vector<std::string>& log_data,
+                           const std::string& log_type,
+                           std::string& body);
+
   /**
    * @brief Check for new logs and send.
    *
-   * Scan the logs domain for up to 1024 log lines.
-   * Sort those lines into status and request types then forward (send) each
-   * set. On success, clear the data and indexes.
+   * Scan the logs domain for the result and status lines, split each into
+   * batches by line count and bytes, and forward (send) up to
+   * logger_tls_inflight batches concurrently. Batches are acknowledged in
+   * order: the lines of each batch are cleared only if it and every earlier
+   * batch were sent, later batches are sent again on the next check.
+   *
+   * @return true if more buffered lines remain than were checked.
    */
-  void check();
+  bool check();
+
+  /**
+   * @brief Send the batches of the lines with an index prefix, see check.
+   *
+   * @param failed Set if a batch could not be sent.
+   * @return true if more lines with the prefix remain.
+   */
+  bool checkType(const std::string& prefix,
+                 const std::string& log_type,
+                 bool& failed);
+
+  /// Adapt the batch size to the request latency and failures.
+  void adapt(bool sent, size_t latency, bool full);
+
+  /// The wait before the next check, with jitter after failures.
+  size_t delay(bool more);
 
   /// Receive an enrollment/node key from the backing store cache.
   std::string node_key_;
@@ -57,6 +104,18 @@ class TLSLogForwarderRunner : public InternalRunnable {
   /// Endpoint URI
   std::string uri_;
 
+  /// The current number of lines per request batch.
+  size_t batch_lines_{0};
+
+  /// The number of consecutive checks that failed to send.
+  size_t failures_{0};
+
+  /// Randomize the backoff so a fleet does not retry in lockstep.
+  std::minstd_rand jitter_;
+
+  /// Set if the last response accepted columnar log uploads.
+  std::atomic<bool> columnar_{false};
+
  private:
   friend class TLSLoggerTests;
 };
@@ -81,6 +140,9 @@ class TLSLoggerPlugin : public LoggerPlugin {
   /// Log a result string. This is the basic catch-all for snapshots and events.
   Status logString(const std::string& s) override;
 
+  /// Buffer the lines of query results with a single database write.
+  Status logResults(const QueryLogItem& item) override;
+
   /// Log a status (ERROR/WARNING/INFO) message.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
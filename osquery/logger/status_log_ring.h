@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <osquery/logger.h>
+
+namespace osquery {
+
+/// The records of a StatusLogRing, a power of two.
+const size_t kStatusLogRingSize = 256;
+
+/// The bytes of a record's file name, longer names are truncated.
+const size_t kStatusLogRecordFile = 48;
+
+/// The bytes of a record's message, longer messages are truncated.
+const size_t kStatusLogRecordMessage = 960;
+
+/// A fixed size status log within a StatusLogRing.
+struct StatusLogRecord {
+  /// The ring position the record is free or filled for, see StatusLogRing.
+  std::atomic<uint64_t> sequence;
+  int32_t severity;
+  int32_t line;
+  uint32_t length;
+  char filename[kStatusLogRecordFile];
+  char message[kStatusLogRecordMessage];
+};
+
+/**
+ * @brief A ring of status logs in memory shared by processes.
+ *
+ * The watcher maps the ring before creating a worker and passes its
+ * descriptor through the OSQUERY_STATUS_LOG_RING environment variable. The
+ * watcher's status logs are copied into fixed size records instead of being
+ * serialized into a registry request. The worker takes them in batches and
+ * forwards them with its own status logs.
+ *
+ * Like the in-process status log queue each record holds a sequence number,
+ * so pushing only uses atomic operations and fails if the ring is full. The
+ * one consumer copies a record before releasing it. Records of a worker that
+ * crashed while reading stay in the ring and are read by the next worker.
+ *
+ * The ring is trivially constructible so it may be placed in a zeroed shared
+ * mapping, call init before the first use.
+ */
+struct StatusLogRing {
+  /// Prepare the records of a zeroed ring.
+  void init();
+
+  /// Copy a line into the ring, fails and counts a drop if the ring is full.
+  bool push(const StatusLogLine& line);
+
+  /**
+   * @brief Take the oldest lines.
+   *
+   * Only one process may take lines at a time.
+   *
+   * @param lines The output lines, appended in the order they were pushed.
+   * @param max The most lines to take.
+   * @return The number of lines taken.
+   */
+  size_t pop(std::vector<StatusLogLine>& lines, size_t max);
+
+  /// The next position to push.
+  std::atomic<uint64_t> tail;
+
+  /// The next position to take.
+  std::atomic<uint64_t> head;
+
+  /// The number of lines dropped because the ring was full.
+  std::atomic<uint64_t> dropped;
+
+  StatusLogRecord records[kStatusLogRingSize];
+};
+
+/**
+ * @brief Relay this process's status logs through a shared ring.
+ *
+ * Set by the watcher once the ring shared with workers is mapped, see
+ * relayStatusLogs. Use nullptr to relay with a logger registry call.
+ */
+void setStatusLogRing(StatusLogRing* ring);
+
+/**
+ * @brief Forward status logs read from another process.
+ *
+ * The lines are queued with this process's status logs and forwarded to the
+ * logger plugins in batches.
+ */
+void forwardStatusLogs(std::vector<StatusLogLine>& lines);
+}
@@ -8,15 +8,28 @@
  *
  */
 
+#include <boost/filesystem/operations.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/test_util.h"
+#include "osquery/logger/status_log_ring.h"
+
+namespace fs = boost::filesystem;
+
 namespace osquery {
 
 DECLARE_string(logger_plugin);
+DECLARE_string(logger_path);
+DECLARE_uint64(logger_buffer_size);
+DECLARE_uint64(logger_rotate_size);
+DECLARE_uint64(logger_rotate_max_files);
+DECLARE_uint64(logger_status_rate);
 
 class LoggerTests : public testing::Test {
  public:
@@ -26,6 +39,7 @@ class LoggerTests : public testing::Test {
 
     log_lines.clear();
     status_messages.clear();
+    forwarded_statuses.clear();
     statuses_logged = 0;
     last_status = {O_INFO, "", -1, ""};
   }
@@ -41,6 +55,8 @@ class LoggerTests : public testing::Test {
 
   // Count calls to logStatus
   static int statuses_logged;
+  // Track the messages sent to logStatus
+  static std::vector<std::string> forwarded_statuses;
   // Count added and removed snapshot rows
   static int snapshot_rows_added;
   static int snapshot_rows_removed;
@@ -56,6 +72,7 @@ std::vector<std::string> LoggerTests::log_lines;
 StatusLogLine LoggerTests::last_status;
 std::vector<std::string> LoggerTests::status_messages;
 int LoggerTests::statuses_logged = 0;
+std::vector<std::string> LoggerTests::forwarded_statuses;
 int LoggerTests::snapshot_rows_added = 0;
 int LoggerTests::snapshot_rows_removed = 0;
 int LoggerTests::health_status_rows = 0;
@@ -87,6 +104,9 @@ class TestLoggerPlugin : public LoggerPlugin {
 
   Status logStatus(const std::vector<StatusLogLine>& log) {
     ++LoggerTests::statuses_logged;
+    for (const auto& status : log) {
+      LoggerTests::forwarded_statuses.push_back(status.message);
+    }
     return Status(0, "OK");
   }
 
@@ -136,6 +156,7 @@ TEST_F(LoggerTests, test_logger_init) {
 TEST_F(LoggerTests, test_logger_log_status) {
   // This will be printed to stdout.
   LOG(WARNING) << "Logger test is generating a warning status (2)";
+  flushStatusLogs();
 
   // The second warning status will be sent to the logger plugin.
   EXPECT_EQ(LoggerTests::statuses_logged, 1);
@@ -149,6 +170,7 @@ TEST_F(LoggerTests, test_logger_variations) {
 
   // This will be printed to stdout.
   LOG(WARNING) << "Logger test is generating a warning status (3)";
+  flushStatusLogs();
 
   // Since the initLogger call triggered a failed init, meaning the logger
   // does NOT handle Glog logs, there will be no statuses logged.
@@ -186,6 +208,7 @@ TEST_F(LoggerTests, test_multiple_loggers) {
   EXPECT_EQ(LoggerTests::log_lines.size(), 2U);
 
   LOG(WARNING) << "Logger test is generating a warning status (4)";
+  flushStatusLogs();
   // Refer to the above notes about status logs not emitting until the logger
   // it initialized. We do a 0-test to check for dead locks around attempting
   // to forward Glog-based sinks recursively into our sinks.
@@ -195,11 +218,33 @@ TEST_F(LoggerTests, test_multiple_loggers) {
   Registry::setActive("logger", "test,filesystem");
   initLogger("logger_test");
   LOG(WARNING) << "Logger test is generating a warning status (5)";
+  flushStatusLogs();
   // Now that the "test" logger is initialized, the status log will be
   // forwarded.
   EXPECT_EQ(LoggerTests::statuses_logged, 1);
 }
 
+TEST_F(LoggerTests, test_logger_status_rate) {
+  Registry::setActive("logger", "test");
+  initLogger("logger_test");
+  flushStatusLogs();
+  LoggerTests::forwarded_statuses.clear();
+
+  // Logs from one source line beyond the rate are dropped and reported.
+  auto rate = FLAGS_logger_status_rate;
+  FLAGS_logger_status_rate = 2;
+  for (size_t i = 0; i < 5; i++) {
+    LOG(WARNING) << "Logger test is generating a repeated warning status";
+  }
+  flushStatusLogs();
+  FLAGS_logger_status_rate = rate;
+
+  // The logs may span two rate windows, at least one is dropped.
+  ASSERT_FALSE(LoggerTests::forwarded_statuses.empty());
+  EXPECT_LE(LoggerTests::forwarded_statuses.size(), 5U);
+  EXPECT_EQ(LoggerTests::forwarded_statuses.back().find("Dropped "), 0U);
+}
+
 TEST_F(LoggerTests, test_logger_scheduled_query) {
   QueryLogItem item;
   item.name = "test_query";
@@ -214,4 +259,106 @@ TEST_F(LoggerTests, test_logger_scheduled_query) {
   logQueryLogItem(item);
   EXPECT_EQ(LoggerTests::log_lines.size(), 3U);
 }
+
+TEST_F(LoggerTests, test_logger_results_request) {
+  // Extension loggers receive the whole item as one request.
+  QueryLogItem item;
+  item.name = "test_query";
+  item.identifier = "unknown_test_host";
+  item.time = 0;
+  item.calendar_time = "no_time";
+  item.results.added.push_back({{"test_column", "test_value"}});
+  item.results.added.push_back({{"test_column", "test_other_value"}});
+  item.results.removed.push_back({{"test_column", "test_old_value"}});
+
+  std::string json;
+  ASSERT_TRUE(serializeQueryLogItemJSON(item, json).ok());
+  EXPECT_TRUE(Registry::call("logger", "test", {{"results", json}}).ok());
+  ASSERT_EQ(LoggerTests::log_lines.size(), 3U);
+
+  // The plugin writes the item as events, one line per row.
+  EXPECT_NE(LoggerTests::log_lines[0].find("\"action\":\"added\""),
+            std::string::npos);
+  EXPECT_NE(LoggerTests::log_lines[2].find("test_old_value"),
+            std::string::npos);
+}
+
+TEST_F(LoggerTests, test_filesystem_rotate) {
+  auto logger_path = FLAGS_logger_path;
+  auto buffer_size = FLAGS_logger_buffer_size;
+  auto rotate_size = FLAGS_logger_rotate_size;
+  auto rotate_max_files = FLAGS_logger_rotate_max_files;
+
+  // Write synchronously and rotate after every two lines.
+  FLAGS_logger_path = kTestWorkingDirectory + "logger_rotate/";
+  FLAGS_logger_buffer_size = 0;
+  FLAGS_logger_rotate_size = 64;
+  FLAGS_logger_rotate_max_files = 2;
+  fs::remove_all(FLAGS_logger_path);
+  fs::create_directories(FLAGS_logger_path);
+
+  auto plugin = Registry::get("logger", "filesystem");
+  ASSERT_TRUE(plugin->setUp().ok());
+  for (size_t i = 0; i < 8; i++) {
+    EXPECT_TRUE(Registry::call("logger",
+                               "filesystem",
+                               {{"string", std::string(40, 'a')}}).ok());
+  }
+
+  auto results = FLAGS_logger_path + "osqueryd.results.log";
+  EXPECT_FALSE(pathExists(results).ok());
+  EXPECT_TRUE(pathExists(results + ".2").ok());
+  EXPECT_FALSE(pathExists(results + ".3").ok());
+
+  std::string content;
+  EXPECT_TRUE(readFile(results + ".1", content).ok());
+  EXPECT_EQ(content, std::string(40, 'a') + "\n" + std::string(40, 'a') + "\n");
+
+  FLAGS_logger_path = logger_path;
+  FLAGS_logger_buffer_size = buffer_size;
+  FLAGS_logger_rotate_size = rotate_size;
+  FLAGS_logger_rotate_max_files = rotate_max_files;
+  plugin->setUp();
+}
+
+TEST_F(LoggerTests, test_status_log_ring) {
+  std::unique_ptr<StatusLogRing> ring(new StatusLogRing());
+  ring->init();
+
+  // Lines longer than a record are truncated.
+  EXPECT_TRUE(ring->push({O_ERROR, "watcher.cpp", 10, "first"}));
+  EXPECT_TRUE(ring->push(
+      {O_WARNING, "watcher.cpp", 20, std::string(2 * 1024, 'a')}));
+  std::vector<StatusLogLine> lines;
+  EXPECT_EQ(ring->pop(lines, 1), 1U);
+  EXPECT_EQ(ring->pop(lines, kStatusLogRingSize), 1U);
+  ASSERT_EQ(lines.size(), 2U);
+  EXPECT_EQ(lines[0].severity, O_ERROR);
+  EXPECT_EQ(lines[0].filename, "watcher.cpp");
+  EXPECT_EQ(lines[0].line, 10);
+  EXPECT_EQ(lines[0].message, "first");
+  EXPECT_EQ(lines[1].message.size(), kStatusLogRecordMessage);
+
+  // A full ring drops lines, the drops are reported with the next lines.
+  for (size_t i = 0; i < kStatusLogRingSize; i++) {
+    EXPECT_TRUE(ring->push({O_INFO, "watcher.cpp", 30, std::to_string(i)}));
+  }
+  EXPECT_FALSE(ring->push({O_INFO, "watcher.cpp", 30, "dropped"}));
+  lines.clear();
+  EXPECT_EQ(ring->pop(lines, kStatusLogRingSize), kStatusLogRingSize);
+  ASSERT_EQ(lines.size(), kStatusLogRingSize + 1);
+  EXPECT_EQ(lines[0].message, "0");
+  EXPECT_EQ(lines.back().message.find("Dropped 1 "), 0U);
+
+  // Relayed lines are forwarded as status logs of this process.
+  Registry::setActive("logger", "test");
+  initLogger("logger_test");
+  flushStatusLogs();
+  LoggerTests::forwarded_statuses.clear();
+  lines = {{O_WARNING, "watcher.cpp", 40, "relayed"}};
+  forwardStatusLogs(lines);
+  flushStatusLogs();
+  ASSERT_EQ(LoggerTests::forwarded_statuses.size(), 1U);
+  EXPECT_EQ(LoggerTests::forwarded_statuses[0], "relayed");
+}
 }
@@ -8,11 +8,14 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 
 #include <dlfcn.h>
 
+#include <boost/functional/hash.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/extensions.h>
@@ -20,6 +23,7 @@
 #include <osquery/registry.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/tracing.h"
 
 namespace pt = boost::property_tree;
 
@@ -27,10 +31,35 @@ namespace osquery {
 
 HIDDEN_FLAG(bool, registry_exceptions, false, "Allow plugin exceptions");
 
+size_t hashRouteInfo(const PluginResponse& info) {
+  size_t hash = 0;
+  for (const auto& row : info) {
+    boost::hash_combine(hash, row.size());
+    for (const auto& value : row) {
+      boost::hash_combine(hash, value.first);
+      boost::hash_combine(hash, value.second);
+    }
+  }
+  return hash;
+}
+
 void RegistryHelperCore::remove(const std::string& item_name) {
+  version_++;
+  size_t table = 0;
+  size_t index = 0;
   if (items_.count(item_name) > 0) {
     items_[item_name]->tearDown();
     items_.erase(item_name);
+  } else if (findStatic(item_name, table, index)) {
+    PluginRef plugin;
+    {
+      std::lock_guard<std::recursive_mutex> lock(statics_mutex_);
+      plugin = std::move(statics_[table].plugins[index]);
+      statics_[table].removed[index] = true;
+    }
+    if (plugin != nullptr) {
+      plugin->tearDown();
+    }
   }
 
   // Populate list of aliases to remove (those that mask item_name).
@@ -57,7 +86,7 @@ bool RegistryHelperCore::isInternal(const std::string& item_name) const {
 Status RegistryHelperCore::setActive(const std::string& item_name) {
   // Default support multiple active plugins.
   for (const auto& item : osquery::split(item_name, ",")) {
-    if (items_.count(item) == 0 && external_.count(item) == 0) {
+    if (!exists(item, true) && external_.count(item) == 0) {
       return Status(1, "Unknown registry plugin: " + item);
     }
   }
@@ -82,8 +111,16 @@ Status RegistryHelperCore::setActive(const std::string& item_name) {
 const std::string& RegistryHelperCore::getActive() const { return active_; }
 
 RegistryRoutes RegistryHelperCore::getRoutes() const {
+  if (snapshot_ && snapshot_version_ == version_) {
+    return routes_snapshot_;
+  }
+
+  // Broadcasting needs the route info of static items, so they are created.
+  auto items = getStatics(true);
+  items.insert(items_.begin(), items_.end());
+
   RegistryRoutes route_table;
-  for (const auto& item : items_) {
+  for (const auto& item : items) {
     if (isInternal(item.first)) {
       // This is an internal plugin, do not include the route.
       continue;
@@ -103,6 +140,10 @@ RegistryRoutes RegistryHelperCore::getRoutes() const {
       route_table[item.first] = item.second->routeInfo();
     }
   }
+
+  routes_snapshot_ = route_table;
+  snapshot_version_ = version_;
+  snapshot_ = true;
   return route_table;
 }
 
@@ -110,8 +151,9 @@ Status RegistryHelperCore::call(const std::string& item_name,
                                 const PluginRequest& request,
                                 PluginResponse& response) {
   // Search local plugins (items) for the plugin.
-  if (items_.count(item_name) > 0) {
-    return items_.at(item_name)->call(request, response);
+  auto plugin = getLocal(item_name);
+  if (plugin != nullptr) {
+    return plugin->call(request, response);
   }
 
   // Check if the item was broadcasted as a plugin within an extension.
@@ -136,6 +178,7 @@ Status RegistryHelperCore::addAlias(const std::string& item_name,
   if (aliases_.count(alias) > 0) {
     return Status(1, "Duplicate alias: " + alias);
   }
+  version_++;
   aliases_[alias] = item_name;
   return Status(0, "OK");
 }
@@ -149,6 +192,7 @@ const std::string& RegistryHelperCore::getAlias(
 }
 
 Status RegistryHelperCore::add(const std::string& item_name, bool internal) {
+  version_++;
   // The item can be listed as internal, meaning it does not broadcast.
   if (internal) {
     internal_.push_back(item_name);
@@ -162,6 +206,103 @@ Status RegistryHelperCore::add(const std::string& item_name, bool internal) {
   return Status(0, "OK");
 }
 
+static bool registrationLess(const PluginRegistration& registration,
+                             const std::string& name) {
+  return std::strcmp(registration.name, name.c_str()) < 0;
+}
+
+Status RegistryHelperCore::addStatic(const PluginRegistration* registrations,
+                                     size_t count) {
+  for (size_t i = 1; i < count; i++) {
+    if (std::strcmp(registrations[i - 1].name, registrations[i].name) >= 0) {
+      return Status(1, "Registrations are not sorted: " +
+                           std::string(registrations[i].name));
+    }
+  }
+
+  version_++;
+  StaticItems items;
+  items.registrations = registrations;
+  items.count = count;
+  items.plugins.resize(count);
+  items.removed.resize(count, false);
+  for (size_t i = 0; i < count; i++) {
+    if (registrations[i].internal) {
+      internal_.push_back(registrations[i].name);
+    }
+  }
+  statics_.push_back(std::move(items));
+  return Status(0, "OK");
+}
+
+bool RegistryHelperCore::findStatic(const std::string& item_name,
+                                    size_t& table,
+                                    size_t& index) const {
+  for (size_t i = 0; i < statics_.size(); i++) {
+    const auto& items = statics_[i];
+    auto end = items.registrations + items.count;
+    auto it =
+        std::lower_bound(items.registrations, end, item_name, registrationLess);
+    if (it != end && item_name == it->name) {
+      table = i;
+      index = static_cast<size_t>(it - items.registrations);
+      std::lock_guard<std::recursive_mutex> lock(statics_mutex_);
+      return !items.removed[index];
+    }
+  }
+  return false;
+}
+
+PluginRef RegistryHelperCore::getStatic(const std::string& item_name) const {
+  size_t table = 0;
+  size_t index = 0;
+  if (!findStatic(item_name, table, index)) {
+    return nullptr;
+  }
+
+  // The lock is recursive, a plugin's constructor may use the registry.
+  std::lock_guard<std::recursive_mutex> lock(statics_mutex_);
+  auto& plugin = statics_[table].plugins[index];
+  if (plugin != nullptr || statics_[table].removed[index]) {
+    return plugin;
+  }
+
+  plugin.reset(statics_[table].registrations[index].create());
+  plugin->setName(item_name);
+  if (auto_setup_ && setup_ && !plugin->setUp().ok()) {
+    // The registry was set up before this item, which failed like in setUp.
+    plugin.reset();
+    statics_[table].removed[index] = true;
+  }
+  return plugin;
+}
+
+std::map<std::string, PluginRef> RegistryHelperCore::getStatics(
+    bool create) const {
+  std::map<std::string, PluginRef> plugins;
+  for (const auto& items : statics_) {
+    for (size_t i = 0; i < items.count; i++) {
+      PluginRef plugin;
+      {
+        std::lock_guard<std::recursive_mutex> lock(statics_mutex_);
+        if (items.removed[i]) {
+          continue;
+        }
+        plugin = items.plugins[i];
+      }
+
+      std::string name = items.registrations[i].name;
+      if (plugin == nullptr && create) {
+        plugin = getStatic(name);
+      }
+      if (plugin != nullptr) {
+        plugins[name] = plugin;
+      }
+    }
+  }
+  return plugins;
+}
+
 void RegistryHelperCore::setUp() {
   // If this registry does not auto-setup do NOT setup the registry items.
   if (!auto_setup_) {
@@ -171,14 +312,18 @@ void RegistryHelperCore::setUp() {
   // If the registry is using a single 'active' plugin, setUp that plugin.
   // For config and logger, only setUp the selected plugin.
   if (active_.size() != 0 && exists(active_, true)) {
-    items_.at(active_)->setUp();
+    getLocal(active_)->setUp();
     return;
   }
 
   // Try to set up each of the registry items.
-  // If they fail, remove them from the registry.
+  // If they fail, remove them from the registry. Static items are set up
+  // when they are created.
+  setup_ = true;
+  auto items = getStatics(false);
+  items.insert(items_.begin(), items_.end());
   std::vector<std::string> failed;
-  for (auto& item : items_) {
+  for (auto& item : items) {
     if (!item.second->setUp().ok()) {
       failed.push_back(item.first);
     }
@@ -191,11 +336,16 @@ void RegistryHelperCore::setUp() {
 
 void RegistryHelperCore::configure() {
   if (!active_.empty() && exists(active_, true)) {
-    items_.at(active_)->configure();
+    getLocal(active_)->configure();
   } else {
     for (auto& item : items_) {
       item.second->configure();
     }
+
+    // Static items not created yet have no configuration to update.
+    for (auto& item : getStatics(false)) {
+      item.second->configure();
+    }
   }
 }
 
@@ -234,12 +384,21 @@ void RegistryHelperCore::removeExternal(const RouteUUID& uuid) {
 /// Facility method to check if a registry item exists.
 bool RegistryHelperCore::exists(const std::string& item_name,
                                 bool local) const {
-  bool has_local = (items_.count(item_name) > 0);
+  size_t table = 0;
+  size_t index = 0;
+  bool has_local = (items_.count(item_name) > 0) ||
+                   findStatic(item_name, table, index);
   bool has_external = (external_.count(item_name) > 0);
   bool has_route = (routes_.count(item_name) > 0);
   return (local) ? has_local : has_local || has_external || has_route;
 }
 
+std::shared_ptr<Plugin> RegistryHelperCore::getLocal(
+    const std::string& item_name) const {
+  auto item = items_.find(item_name);
+  return (item != items_.end()) ? item->second : getStatic(item_name);
+}
+
 /// Facility method to list the registry item identifiers.
 std::vector<std::string> RegistryHelperCore::names() const {
   std::vector<std::string> names;
@@ -247,6 +406,20 @@ std::vector<std::string> RegistryHelperCore::names() const {
     names.push_back(item.first);
   }
 
+  // Static item names are listed without creating the plugins.
+  size_t local = names.size();
+  for (const auto& items : statics_) {
+    std::lock_guard<std::recursive_mutex> lock(statics_mutex_);
+    for (size_t i = 0; i < items.count; i++) {
+      if (!items.removed[i]) {
+        names.push_back(items.registrations[i].name);
+      }
+    }
+  }
+  if (local < names.size()) {
+    std::sort(names.begin(), names.end());
+  }
+
   // Also add names of external plugins.
   for (const auto& item : external_) {
     names.push_back(item.first);
@@ -255,7 +428,14 @@ std::vector<std::string> RegistryHelperCore::names() const {
 }
 
 /// Facility method to count the number of items in this registry.
-size_t RegistryHelperCore::count() const { return items_.size(); }
+size_t RegistryHelperCore::count() const {
+  size_t count = items_.size();
+  std::lock_guard<std::recursive_mutex> lock(statics_mutex_);
+  for (const auto& items : statics_) {
+    count += std::count(items.removed.begin(), items.removed.end(), false);
+  }
+  return count;
+}
 
 /// Allow the registry to introspect into the registered name (for logging).
 void RegistryHelperCore::setName(const std::string& name) { name_ = name; }
@@ -274,6 +454,15 @@ const std::map<std::string, PluginRef> RegistryFactory::all(
   return instance().registry(registry_name)->all();
 }
 
+Status RegistryFactory::addStatic(const std::string& registry_name,
+                                  const PluginRegistration* registrations,
+                                  size_t count) {
+  if (locked()) {
+    return Status(0, "Registry locked");
+  }
+  return instance().registry(registry_name)->addStatic(registrations, count);
+}
+
 PluginRef RegistryFactory::get(const std::string& registry_name,
                                const std::string& item_name) {
   return instance().registry(registry_name)->get(item_name);
@@ -369,6 +558,7 @@ Status RegistryFactory::call(const std::string& registry_name,
                              const std::string& item_name,
                              const PluginRequest& request,
                              PluginResponse& response) {
+  TRACE_SCOPE_DETAIL("registry.call", item_name);
   // Forward factory call to the registry.
   try {
     if (item_name.find(",") != std::string::npos) {
@@ -60,6 +60,66 @@ TEST_F(RegistryTests, test_registry) {
   EXPECT_EQ(cats.all().size(), 2U);
 }
 
+/// A cat counting its instances, to check when static items are created.
+class AlleyCat : public CatPlugin {
+ public:
+  AlleyCat() { instances++; }
+
+  Status call(const PluginRequest& request, PluginResponse& response) {
+    response.push_back({{"name", name_}});
+    return Status(0, "OK");
+  }
+
+  static size_t instances;
+};
+
+size_t AlleyCat::instances{0};
+
+const PluginRegistration kTestCats[] = {
+    {"alley", &createPlugin<AlleyCat>, false},
+    {"barn", &createPlugin<AlleyCat>, true},
+    {"tom", &createPlugin<AlleyCat>, false},
+};
+
+TEST_F(RegistryTests, test_registry_static) {
+  CatRegistry cats;
+  cats.add<HouseCat>("house");
+  EXPECT_TRUE(cats.addStatic(kTestCats, 3).ok());
+
+  // Static items are listed without creating their plugins.
+  EXPECT_EQ(cats.count(), 4U);
+  EXPECT_TRUE(cats.exists("tom", true));
+  EXPECT_FALSE(cats.exists("stray", true));
+  EXPECT_TRUE(cats.isInternal("barn"));
+  auto names = cats.names();
+  EXPECT_EQ(names, std::vector<std::string>({"alley", "barn", "house", "tom"}));
+  EXPECT_EQ(AlleyCat::instances, 0U);
+
+  // A plugin is created by its first use, once.
+  PluginResponse response;
+  EXPECT_TRUE(cats.call("tom", {}, response).ok());
+  EXPECT_EQ(response[0]["name"], "tom");
+  EXPECT_EQ(cats.get("tom"), cats.getLocal("tom"));
+  EXPECT_EQ(AlleyCat::instances, 1U);
+
+  // A duplicate of a static item is not added, and removed items are gone.
+  EXPECT_FALSE(cats.add<HouseCat>("alley").ok());
+  cats.remove("tom");
+  EXPECT_FALSE(cats.exists("tom"));
+  EXPECT_EQ(cats.getLocal("tom"), nullptr);
+  EXPECT_EQ(cats.count(), 3U);
+
+  // Listing every plugin creates the remaining static plugins.
+  EXPECT_EQ(cats.all().size(), 3U);
+  EXPECT_EQ(AlleyCat::instances, 3U);
+
+  const PluginRegistration unsorted[] = {
+      {"tom", &createPlugin<AlleyCat>, false},
+      {"alley", &createPlugin<AlleyCat>, false},
+  };
+  EXPECT_FALSE(cats.addStatic(unsorted, 2).ok());
+}
+
 /// Normally we have "Registry" that dictates the set of possible API methods
 /// for all registry types. Here we use a "TestRegistry" instead.
 class TestCoreRegistry : public RegistryFactory {};
@@ -89,6 +149,13 @@ TEST_F(RegistryTests, test_auto_factory) {
   auto cat = TestCoreRegistry::get("cat", "auto_house");
   auto same_cat = TestCoreRegistry::get("cat", "auto_house");
   EXPECT_EQ(cat, same_cat);
+
+  /// Local plugins are available as their plugin type without a call.
+  auto typed_cat = TestCoreRegistry::getLocal<CatPlugin>("cat", "auto_house");
+  EXPECT_EQ(typed_cat, cat);
+  EXPECT_EQ(TestCoreRegistry::getLocal<CatPlugin>("cat", "stray"), nullptr);
+  EXPECT_EQ(TestCoreRegistry::getLocal<CatPlugin>("none", "auto_house"),
+            nullptr);
 }
 
 class DogPlugin : public Plugin {
@@ -198,6 +265,15 @@ TEST_F(RegistryTests, test_registry_api) {
   EXPECT_EQ(rr.size(), 1U);
   EXPECT_EQ(rr.at("special")[0].at("name"), "special");
 
+  // The routes snapshot is rebuilt when the registry changes.
+  TestCoreRegistry::add<SpecialWidget>("widgets", "special_copy");
+  rr = TestCoreRegistry::registry("widgets")->getRoutes();
+  EXPECT_EQ(rr.size(), 2U);
+  EXPECT_EQ(hashRouteInfo(rr.at("special")), hashRouteInfo(ri));
+  EXPECT_NE(hashRouteInfo(rr.at("special")), hashRouteInfo(PluginResponse()));
+  TestCoreRegistry::registry("widgets")->remove("special_copy");
+  EXPECT_EQ(TestCoreRegistry::registry("widgets")->getRoutes().size(), 1U);
+
   // Broadcast will include all registries, and all their items.
   auto broadcast_info = TestCoreRegistry::getBroadcast();
   EXPECT_TRUE(broadcast_info.size() >= 3U);
@@ -14,6 +14,7 @@
 #include "osquery/remote/requests.h"
 #include "osquery/remote/transports/tls.h"
 #include "osquery/remote/serializers/json.h"
+#include "osquery/remote/utility.h"
 
 namespace osquery {
 
@@ -70,7 +71,7 @@ std::string TLSEnrollPlugin::enroll() {
 
     LOG(WARNING) << "Failed enrollment request to " << uri << " ("
                  << status.what() << ") retrying...";
-    ::sleep(i * i);
+    TLSRequestHelper::backoff(i);
   }
 
   return node_key;
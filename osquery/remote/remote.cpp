@@ -11,50 +11,143 @@
 #include <string>
 #include <cstring>
 
+#include <lz4frame.h>
 #include <zlib.h>
 
+#include "osquery/remote/requests.h"
+
 namespace osquery {
 
 #define MOD_GZIP_ZLIB_WINDOWSIZE 15
 #define MOD_GZIP_ZLIB_CFACTOR 9
 
-void compress(std::string& data) {
-  z_stream zs;
-  memset(&zs, 0, sizeof(zs));
+/// The largest LZ4 frame header.
+const size_t kLZ4FrameHeaderSize = 19;
+
+CompressionType getCompressionType(const std::string& name) {
+  return (name == "lz4") ? COMPRESSION_LZ4 : COMPRESSION_GZIP;
+}
 
-  if (deflateInit2(&zs,
-                   Z_BEST_COMPRESSION,
-                   Z_DEFLATED,
-                   MOD_GZIP_ZLIB_WINDOWSIZE + 16,
-                   MOD_GZIP_ZLIB_CFACTOR,
-                   Z_DEFAULT_STRATEGY) != Z_OK) {
+std::string getContentEncoding(CompressionType type) {
+  return (type == COMPRESSION_LZ4) ? "lz4" : "gzip";
+}
+
+Compressor::Compressor(CompressionType type) : type_(type) {
+  if (type_ == COMPRESSION_LZ4) {
+    LZ4F_compressionContext_t context = nullptr;
+    if (LZ4F_isError(LZ4F_createCompressionContext(&context, LZ4F_VERSION))) {
+      failed_ = true;
+      return;
+    }
+    lz4_ = context;
+    appendFrame(
+        [context](char* output, size_t capacity) {
+          return LZ4F_compressBegin(context, output, capacity, nullptr);
+        },
+        kLZ4FrameHeaderSize);
     return;
   }
 
-  zs.next_in = (Bytef*)data.data();
-  zs.avail_in = data.size();
+  stream_.reset(new z_stream);
+  memset(stream_.get(), 0, sizeof(z_stream));
+  ret_ = deflateInit2(stream_.get(),
+                      Z_BEST_COMPRESSION,
+                      Z_DEFLATED,
+                      MOD_GZIP_ZLIB_WINDOWSIZE + 16,
+                      MOD_GZIP_ZLIB_CFACTOR,
+                      Z_DEFAULT_STRATEGY);
+  initialized_ = (ret_ == Z_OK);
+  failed_ = !initialized_;
+}
 
-  int ret = Z_OK;
-  std::string output;
+Compressor::~Compressor() {
+  if (lz4_ != nullptr) {
+    LZ4F_freeCompressionContext((LZ4F_compressionContext_t)lz4_);
+  }
+  if (initialized_) {
+    deflateEnd(stream_.get());
+  }
+}
 
-  {
-    char buffer[16384] = {0};
-    while (ret == Z_OK) {
-      zs.next_out = reinterpret_cast<Bytef*>(buffer);
-      zs.avail_out = sizeof(output);
+void Compressor::appendFrame(
+    const std::function<size_t(char*, size_t)>& compress, size_t bound) {
+  auto size = output_.size();
+  output_.resize(size + bound);
+  auto written = compress(&output_[size], bound);
+  if (LZ4F_isError(written)) {
+    failed_ = true;
+    written = 0;
+  }
+  output_.resize(size + written);
+}
 
-      ret = deflate(&zs, Z_FINISH);
-      if (output.size() < zs.total_out) {
-        output.append(buffer, zs.total_out - output.size());
-      }
-    }
+void Compressor::deflateInput(int flush) {
+  char buffer[16384] = {0};
+  do {
+    stream_->next_out = reinterpret_cast<Bytef*>(buffer);
+    stream_->avail_out = sizeof(buffer);
+    ret_ = deflate(stream_.get(), flush);
+    output_.append(buffer, sizeof(buffer) - stream_->avail_out);
+  } while (ret_ == Z_OK && stream_->avail_out == 0);
+}
+
+void Compressor::append(const char* data, size_t size) {
+  if (failed_ || size == 0) {
+    return;
   }
 
-  deflateEnd(&zs);
-  if (ret != Z_STREAM_END) {
+  if (type_ == COMPRESSION_LZ4) {
+    auto context = (LZ4F_compressionContext_t)lz4_;
+    appendFrame(
+        [context, data, size](char* output, size_t capacity) {
+          return LZ4F_compressUpdate(
+              context, output, capacity, data, size, nullptr);
+        },
+        LZ4F_compressBound(size, nullptr));
     return;
   }
 
-  data = std::move(output);
+  stream_->next_in = (Bytef*)data;
+  stream_->avail_in = size;
+  deflateInput(Z_NO_FLUSH);
+  if (ret_ == Z_BUF_ERROR) {
+    // No progress was possible, the next call continues the stream.
+    ret_ = Z_OK;
+  }
+  failed_ = (ret_ != Z_OK);
+}
+
+Status Compressor::finish(std::string& output) {
+  if (!failed_ && type_ == COMPRESSION_LZ4) {
+    auto context = (LZ4F_compressionContext_t)lz4_;
+    appendFrame(
+        [context](char* output, size_t capacity) {
+          return LZ4F_compressEnd(context, output, capacity, nullptr);
+        },
+        LZ4F_compressBound(0, nullptr));
+  } else if (!failed_) {
+    stream_->next_in = nullptr;
+    stream_->avail_in = 0;
+    while (ret_ == Z_OK) {
+      deflateInput(Z_FINISH);
+    }
+    failed_ = (ret_ != Z_STREAM_END);
+  }
+
+  if (failed_) {
+    return Status(1, "Cannot compress data");
+  }
+  output = std::move(output_);
+  output_.clear();
+  return Status(0, "OK");
+}
+
+void compress(std::string& data, CompressionType type) {
+  Compressor compressor(type);
+  compressor.append(data);
+  std::string output;
+  if (compressor.finish(output).ok()) {
+    data = std::move(output);
+  }
 }
 }
@@ -10,29 +10,160 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
 #include <memory>
-#include <utility>
+#include <ostream>
+#include <streambuf>
 #include <string>
+#include <utility>
 
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/logger.h>
 #include <osquery/status.h>
 
+struct z_stream_s;
+
 namespace osquery {
 
 class Serializer;
 
+/// The compression codecs for request bodies.
+enum CompressionType {
+  COMPRESSION_GZIP,
+  COMPRESSION_LZ4,
+};
+
+/**
+ * @brief Parse a compression codec name, "gzip" or "lz4".
+ *
+ * Unknown names use GZip.
+ */
+CompressionType getCompressionType(const std::string& name);
+
+/// The HTTP Content-Encoding of a compression codec, "gzip" or "lz4".
+std::string getContentEncoding(CompressionType type);
+
 /**
- * @brief Compress data using GZip.
+ * @brief Compress data using GZip or LZ4.
  *
  * Requests API callers may request data be compressed before sending.
  * The compression step occurs after serialization, immediately before the
  * transport call.
  *
  * @param data The input/output mutable container.
+ * @param type The compression codec.
  */
-void compress(std::string& data);
+void compress(std::string& data, CompressionType type = COMPRESSION_GZIP);
+
+/**
+ * @brief Incrementally compress data using GZip or LZ4 frames.
+ *
+ * Callers building a large request body append each piece as it is produced
+ * instead of holding the uncompressed and compressed body at once.
+ */
+class Compressor : private boost::noncopyable {
+ public:
+  explicit Compressor(CompressionType type = COMPRESSION_GZIP);
+  ~Compressor();
+
+  /// Compress the next piece of the input.
+  void append(const char* data, size_t size);
+
+  /// Compress the next piece of the input.
+  void append(const std::string& data) { append(data.data(), data.size()); }
+
+  /**
+   * @brief Finish the stream.
+   *
+   * @param output The compressed data.
+   * @return Failure if the input could not be compressed.
+   */
+  Status finish(std::string& output);
+
+ private:
+  /// Deflate the pending input using the zlib flush mode.
+  void deflateInput(int flush);
+
+  /// Append the LZ4 frame output of a compression call, or fail.
+  void appendFrame(const std::function<size_t(char*, size_t)>& compress,
+                   size_t bound);
+
+ private:
+  /// The compression codec.
+  CompressionType type_{COMPRESSION_GZIP};
+
+  /// The zlib stream state.
+  std::unique_ptr<z_stream_s> stream_;
+
+  /// The LZ4 frame compression context.
+  void* lz4_{nullptr};
+
+  /// The compressed data produced so far.
+  std::string output_;
+
+  /// The last zlib return code.
+  int ret_{0};
+
+  /// Set if the stream must be ended.
+  bool initialized_{false};
+
+  /// Set if the codec reported an error, the stream cannot finish.
+  bool failed_{false};
+};
+
+/// A stream buffer passing the written data to a Compressor in pieces.
+class CompressorBuffer : public std::streambuf {
+ public:
+  explicit CompressorBuffer(Compressor& compressor) : compressor_(compressor) {
+    setp(buffer_, buffer_ + sizeof(buffer_));
+  }
+
+ protected:
+  int_type overflow(int_type ch) override {
+    sync();
+    if (ch != traits_type::eof()) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  int sync() override {
+    compressor_.append(pbase(), pptr() - pbase());
+    setp(buffer_, buffer_ + sizeof(buffer_));
+    return 0;
+  }
+
+ private:
+  /// The compressor receiving the written data.
+  Compressor& compressor_;
+
+  /// Written data waiting to be compressed.
+  char buffer_[16384];
+};
+
+/**
+ * @brief An output stream compressing everything written to it.
+ *
+ * A Serializer writes into the stream so the uncompressed serialized body is
+ * only buffered in small pieces. The stream is flushed when destroyed.
+ */
+class CompressorStream : public std::ostream {
+ public:
+  explicit CompressorStream(Compressor& compressor)
+      : std::ostream(nullptr), buffer_(compressor) {
+    rdbuf(&buffer_);
+  }
+
+  ~CompressorStream() { flush(); }
+
+ private:
+  CompressorBuffer buffer_;
+};
 
 /**
  * @brief Abstract base class for remote transport implementations
@@ -96,6 +227,21 @@ class Transport {
     return response_params_;
   }
 
+  /**
+   * @brief Get a header of the response
+   *
+   * @param name The case-insensitive header name
+   *
+   * @return The header value, empty if the response did not include it
+   */
+  std::string getResponseHeader(const std::string& name) const {
+    auto header = response_headers_.find(boost::algorithm::to_lower_copy(name));
+    return (header != response_headers_.end()) ? header->second : "";
+  }
+
+  /// Get the protocol status code of the response, 0 if there is none.
+  int getResponseCode() const { return response_code_; }
+
   template <typename T>
   void setOption(const std::string& name, const T& value) {
     options_.put(name, value);
@@ -119,6 +265,12 @@ class Transport {
   /// storage for response parameters
   boost::property_tree::ptree response_params_;
 
+  /// storage for response headers, by lowercase name
+  std::map<std::string, std::string> response_headers_;
+
+  /// storage for the response protocol status code
+  int response_code_{0};
+
   /// options from request call (use defined by specific transport)
   boost::property_tree::ptree options_;
 };
@@ -154,6 +306,26 @@ class Serializer {
   virtual Status serialize(const boost::property_tree::ptree& params,
                            std::string& serialized) = 0;
 
+  /**
+   * @brief Serialize a property tree into a stream
+   *
+   * Serializers able to write incrementally should override this, the default
+   * serializes into a string and writes it to the stream.
+   *
+   * @param params A property tree of parameters
+   * @param output the output stream
+   * @return success or failure of the operation
+   */
+  virtual Status serializeTo(const boost::property_tree::ptree& params,
+                             std::ostream& output) {
+    std::string serialized;
+    auto s = serialize(params, serialized);
+    if (s.ok()) {
+      output << serialized;
+    }
+    return s;
+  }
+
   /**
    * @brief Deserialize a property tree into a property tree
    *
@@ -226,13 +398,47 @@ class Request {
    */
   Status call(const boost::property_tree::ptree& params) {
     std::string serialized;
-    auto s = serializer_->serialize(params, serialized);
+    if (!options_.get("compress", false)) {
+      auto s = serializer_->serialize(params, serialized);
+      if (!s.ok()) {
+        return s;
+      }
+      return transport_->sendRequest(serialized);
+    }
+
+    // Compress while serializing, only the compressed body is held whole.
+    Compressor compressor(getCompressionType(
+        options_.get<std::string>("compression", "gzip")));
+    {
+      CompressorStream stream(compressor);
+      auto s = serializer_->serializeTo(params, stream);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    auto s = compressor.finish(serialized);
     if (!s.ok()) {
       return s;
     }
+    return transport_->sendRequest(serialized);
+  }
 
+  /**
+   * @brief Send parameters the caller already serialized
+   *
+   * The serialized parameters must match the request's serializer, they are
+   * compressed if the `compress` option is set, using the `compression`
+   * option codec.
+   *
+   * @param serialized The mutable serialized parameters
+   *
+   * @return success or failure of the operation
+   */
+  Status callSerialized(std::string& serialized) {
     if (options_.get("compress", false)) {
-      compress(serialized);
+      compress(serialized,
+               getCompressionType(
+                   options_.get<std::string>("compression", "gzip")));
     }
     return transport_->sendRequest(serialized);
   }
@@ -247,6 +453,14 @@ class Request {
     return transport_->getResponseStatus();
   }
 
+  /// Get a header of the response, see Transport::getResponseHeader.
+  std::string getResponseHeader(const std::string& name) const {
+    return transport_->getResponseHeader(name);
+  }
+
+  /// Get the protocol status code of the response.
+  int getResponseCode() const { return transport_->getResponseCode(); }
+
   template <typename T>
   void setOption(const std::string& name, const T& value) {
     options_.put(name, value);
@@ -272,6 +486,8 @@ class Request {
   FRIEND_TEST(TLSTransportsTests, test_call_verify_peer);
   FRIEND_TEST(TLSTransportsTests, test_call_server_cert_pinning);
   FRIEND_TEST(TLSTransportsTests, test_call_client_auth);
+  FRIEND_TEST(TLSTransportsTests, test_call_conditional);
+  FRIEND_TEST(RequestsTests, test_call_compressed);
 
   friend class TestDistributedPlugin;
 };
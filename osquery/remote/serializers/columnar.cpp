@@ -0,0 +1,579 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "osquery/remote/serializers/columnar.h"
+#include "osquery/remote/serializers/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+FLAG(bool,
+     tls_columnar_results,
+     false,
+     "Upload results in the columnar encoding if the server accepts it");
+
+const std::string kColumnarEncoding = "columnar";
+
+/// Columnar data starts with a magic and format version.
+const std::string kColumnarMagic("OSQC\x01", 5);
+
+/// Deserializing rejects trees nested deeper than this.
+const size_t kColumnarMaxDepth = 128;
+
+/// The tag written before each node.
+enum ColumnarNode {
+  NODE_LEAF = 0,
+  NODE_OBJECT,
+  NODE_ARRAY,
+  NODE_TABLE,
+};
+
+/// The encoding of a table column's values.
+enum ColumnarValues {
+  VALUES_STRINGS = 0,
+  VALUES_DICTIONARY,
+  VALUES_INTEGERS,
+  VALUES_NODES,
+  VALUES_TABLE,
+};
+
+/// Set in the column flags if some rows do not have the column.
+const uint8_t kColumnSparse = 1;
+
+/// The rows of a table, or the present values of a column.
+using ColumnarRows = std::vector<const pt::ptree*>;
+
+void offerColumnarEncoding(pt::ptree& params) {
+  if (FLAGS_tls_columnar_results) {
+    params.put<std::string>("result_encoding", kColumnarEncoding);
+  }
+}
+
+bool acceptsColumnarEncoding(const pt::ptree& response) {
+  return FLAGS_tls_columnar_results &&
+         response.get<std::string>("result_encoding", "") == kColumnarEncoding;
+}
+
+/// Check if every child of a non-leaf node has an empty key.
+static bool isArray(const pt::ptree& tree) {
+  for (const auto& child : tree) {
+    if (!child.first.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Check if a node is an object with unique keys, which may be a table row.
+static bool isRow(const pt::ptree& tree) {
+  if (tree.empty()) {
+    return false;
+  }
+  for (const auto& child : tree) {
+    if (child.first.empty() || tree.count(child.first) > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Parse a canonical decimal integer, which prints back to the same string.
+static bool isInteger(const std::string& value, int64_t& integer) {
+  size_t start = (!value.empty() && value[0] == '-') ? 1 : 0;
+  if (value.size() == start || value.size() > 20) {
+    return false;
+  }
+  for (size_t i = start; i < value.size(); i++) {
+    if (value[i] < '0' || value[i] > '9') {
+      return false;
+    }
+  }
+  // Leading zeros and negative zero do not print back the same.
+  if (value[start] == '0' && (start == 1 || value.size() > 1)) {
+    return false;
+  }
+  errno = 0;
+  integer = std::strtoll(value.c_str(), nullptr, 10);
+  return errno == 0;
+}
+
+namespace {
+
+class ColumnarWriter {
+ public:
+  explicit ColumnarWriter(std::ostream& output) : output_(output) {}
+
+  /// Write a tagged node, arrays of objects are written as tables.
+  void node(const pt::ptree& tree);
+
+ private:
+  /// Write the column dictionary and each column of the rows.
+  void table(const ColumnarRows& rows);
+
+  /// Write the present values of a column, using the smallest encoding.
+  void column(const ColumnarRows& values);
+
+  void byte(uint8_t value) { output_.put(static_cast<char>(value)); }
+
+  void varint(uint64_t value) {
+    char buffer[10];
+    size_t size = 0;
+    while (value >= 0x80) {
+      buffer[size++] = static_cast<char>((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    buffer[size++] = static_cast<char>(value);
+    output_.write(buffer, size);
+  }
+
+  void string(const std::string& value) {
+    varint(value.size());
+    output_.write(value.data(), value.size());
+  }
+
+ private:
+  std::ostream& output_;
+};
+
+void ColumnarWriter::node(const pt::ptree& tree) {
+  if (tree.empty()) {
+    byte(NODE_LEAF);
+    string(tree.data());
+    return;
+  }
+
+  if (isArray(tree)) {
+    ColumnarRows rows;
+    rows.reserve(tree.size());
+    for (const auto& child : tree) {
+      if (!isRow(child.second)) {
+        rows.clear();
+        break;
+      }
+      rows.push_back(&child.second);
+    }
+    if (!rows.empty()) {
+      byte(NODE_TABLE);
+      table(rows);
+      return;
+    }
+
+    byte(NODE_ARRAY);
+    varint(tree.size());
+    for (const auto& child : tree) {
+      node(child.second);
+    }
+    return;
+  }
+
+  byte(NODE_OBJECT);
+  varint(tree.size());
+  for (const auto& child : tree) {
+    string(child.first);
+    node(child.second);
+  }
+}
+
+void ColumnarWriter::table(const ColumnarRows& rows) {
+  // The column dictionary holds every key in the order first seen.
+  std::vector<std::string> columns;
+  std::unordered_set<std::string> seen;
+  for (const auto* row : rows) {
+    for (const auto& child : *row) {
+      if (seen.insert(child.first).second) {
+        columns.push_back(child.first);
+      }
+    }
+  }
+
+  varint(rows.size());
+  varint(columns.size());
+  ColumnarRows values;
+  std::string present;
+  for (const auto& key : columns) {
+    values.clear();
+    present.assign((rows.size() + 7) / 8, 0);
+    for (size_t i = 0; i < rows.size(); i++) {
+      auto value = rows[i]->find(key);
+      if (value != rows[i]->not_found()) {
+        present[i / 8] = static_cast<char>(present[i / 8] | (1 << (i % 8)));
+        values.push_back(&value->second);
+      }
+    }
+
+    string(key);
+    if (values.size() == rows.size()) {
+      byte(0);
+    } else {
+      byte(kColumnSparse);
+      output_.write(present.data(), present.size());
+    }
+    column(values);
+  }
+}
+
+void ColumnarWriter::column(const ColumnarRows& values) {
+  bool leaves = true;
+  bool objects = true;
+  std::vector<int64_t> integers;
+  for (size_t i = 0; i < values.size(); i++) {
+    const auto& value = *values[i];
+    int64_t integer = 0;
+    if (!value.empty()) {
+      leaves = false;
+      objects = objects && isRow(value);
+    } else {
+      objects = false;
+      // Stop parsing integers once any value is not an integer.
+      if (integers.size() == i && isInteger(value.data(), integer)) {
+        integers.push_back(integer);
+      }
+    }
+    if (!leaves && !objects) {
+      break;
+    }
+  }
+
+  if (objects) {
+    byte(VALUES_TABLE);
+    table(values);
+    return;
+  }
+
+  if (!leaves) {
+    byte(VALUES_NODES);
+    for (const auto* value : values) {
+      node(*value);
+    }
+    return;
+  }
+
+  if (integers.size() == values.size()) {
+    // Delta encode, timestamps and counters are often close to their peers.
+    byte(VALUES_INTEGERS);
+    uint64_t previous = 0;
+    for (const auto& integer : integers) {
+      uint64_t delta = static_cast<uint64_t>(integer) - previous;
+      previous = static_cast<uint64_t>(integer);
+      varint((delta << 1) ^ ((delta >> 63) ? ~0ULL : 0));
+    }
+    return;
+  }
+
+  // Use a dictionary if at most half of the values are distinct.
+  std::unordered_map<std::string, size_t> indexes;
+  ColumnarRows dictionary;
+  for (const auto* value : values) {
+    if (indexes.emplace(value->data(), dictionary.size()).second) {
+      dictionary.push_back(value);
+      if (dictionary.size() * 2 > values.size()) {
+        break;
+      }
+    }
+  }
+
+  if (dictionary.size() * 2 > values.size()) {
+    byte(VALUES_STRINGS);
+    for (const auto* value : values) {
+      string(value->data());
+    }
+    return;
+  }
+
+  byte(VALUES_DICTIONARY);
+  varint(dictionary.size());
+  for (const auto* value : dictionary) {
+    string(value->data());
+  }
+  for (const auto* value : values) {
+    varint(indexes[value->data()]);
+  }
+}
+
+class ColumnarReader {
+ public:
+  ColumnarReader(const std::string& data, size_t offset)
+      : data_(data), offset_(offset) {}
+
+  /// Read a tagged node.
+  Status node(pt::ptree& tree, size_t depth);
+
+  /// Check if all of the data was read.
+  bool done() const { return offset_ == data_.size(); }
+
+ private:
+  /// Read a table's rows.
+  Status table(std::vector<pt::ptree>& rows, size_t depth);
+
+  /// Read a column's values into the rows with the column present.
+  Status column(const std::string& key,
+                const std::vector<size_t>& present,
+                std::vector<pt::ptree>& rows,
+                size_t depth);
+
+  size_t remaining() const { return data_.size() - offset_; }
+
+  bool byte(uint8_t& value) {
+    if (remaining() == 0) {
+      return false;
+    }
+    value = static_cast<uint8_t>(data_[offset_++]);
+    return true;
+  }
+
+  bool varint(uint64_t& value) {
+    value = 0;
+    for (size_t shift = 0; shift < 64; shift += 7) {
+      uint8_t next = 0;
+      if (!byte(next)) {
+        return false;
+      }
+      value |= static_cast<uint64_t>(next & 0x7f) << shift;
+      if ((next & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool string(std::string& value) {
+    uint64_t size = 0;
+    if (!varint(size) || size > remaining()) {
+      return false;
+    }
+    value.assign(data_, offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+  /// Append a child to a node without copying it.
+  static void append(pt::ptree& tree,
+                     const std::string& key,
+                     pt::ptree& child) {
+    tree.push_back(std::make_pair(key, pt::ptree()))->second.swap(child);
+  }
+
+ private:
+  const std::string& data_;
+  size_t offset_{0};
+};
+
+inline Status invalidColumnarData() {
+  return Status(1, "Invalid columnar data");
+}
+
+Status ColumnarReader::node(pt::ptree& tree, size_t depth) {
+  uint8_t tag = 0;
+  if (depth > kColumnarMaxDepth || !byte(tag)) {
+    return invalidColumnarData();
+  }
+
+  if (tag == NODE_LEAF) {
+    if (!string(tree.data())) {
+      return invalidColumnarData();
+    }
+    return Status(0, "OK");
+  }
+
+  if (tag == NODE_TABLE) {
+    std::vector<pt::ptree> rows;
+    auto s = table(rows, depth + 1);
+    if (!s.ok()) {
+      return s;
+    }
+    for (auto& row : rows) {
+      append(tree, "", row);
+    }
+    return Status(0, "OK");
+  }
+
+  uint64_t count = 0;
+  if ((tag != NODE_OBJECT && tag != NODE_ARRAY) || !varint(count) ||
+      count > remaining()) {
+    return invalidColumnarData();
+  }
+  std::string key;
+  for (size_t i = 0; i < count; i++) {
+    if (tag == NODE_OBJECT && !string(key)) {
+      return invalidColumnarData();
+    }
+    pt::ptree child;
+    auto s = node(child, depth + 1);
+    if (!s.ok()) {
+      return s;
+    }
+    append(tree, key, child);
+  }
+  return Status(0, "OK");
+}
+
+Status ColumnarReader::table(std::vector<pt::ptree>& rows, size_t depth) {
+  // Every row has a column, and each present value takes at least one byte.
+  uint64_t count = 0;
+  uint64_t columns = 0;
+  if (depth > kColumnarMaxDepth || !varint(count) || !varint(columns) ||
+      count > remaining() * 8 || columns == 0 || columns > remaining()) {
+    return invalidColumnarData();
+  }
+
+  rows.resize(count);
+  std::vector<size_t> present;
+  for (size_t c = 0; c < columns; c++) {
+    std::string key;
+    uint8_t flags = 0;
+    if (!string(key) || !byte(flags)) {
+      return invalidColumnarData();
+    }
+
+    present.clear();
+    if (flags & kColumnSparse) {
+      size_t bytes = (count + 7) / 8;
+      if (bytes > remaining()) {
+        return invalidColumnarData();
+      }
+      for (size_t i = 0; i < count; i++) {
+        if ((data_[offset_ + i / 8] >> (i % 8)) & 1) {
+          present.push_back(i);
+        }
+      }
+      offset_ += bytes;
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        present.push_back(i);
+      }
+    }
+
+    auto s = column(key, present, rows, depth);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status ColumnarReader::column(const std::string& key,
+                              const std::vector<size_t>& present,
+                              std::vector<pt::ptree>& rows,
+                              size_t depth) {
+  uint8_t type = 0;
+  if (!byte(type)) {
+    return invalidColumnarData();
+  }
+
+  if (type == VALUES_TABLE) {
+    std::vector<pt::ptree> values;
+    auto s = table(values, depth + 1);
+    if (!s.ok()) {
+      return s;
+    }
+    if (values.size() != present.size()) {
+      return invalidColumnarData();
+    }
+    for (size_t i = 0; i < present.size(); i++) {
+      append(rows[present[i]], key, values[i]);
+    }
+    return Status(0, "OK");
+  }
+
+  std::vector<std::string> dictionary;
+  if (type == VALUES_DICTIONARY) {
+    uint64_t size = 0;
+    if (!varint(size) || size > remaining()) {
+      return invalidColumnarData();
+    }
+    dictionary.resize(size);
+    for (auto& value : dictionary) {
+      if (!string(value)) {
+        return invalidColumnarData();
+      }
+    }
+  } else if (type > VALUES_TABLE) {
+    return invalidColumnarData();
+  }
+
+  uint64_t previous = 0;
+  for (const auto& index : present) {
+    pt::ptree value;
+    if (type == VALUES_NODES) {
+      auto s = node(value, depth + 1);
+      if (!s.ok()) {
+        return s;
+      }
+    } else if (type == VALUES_INTEGERS) {
+      uint64_t delta = 0;
+      if (!varint(delta)) {
+        return invalidColumnarData();
+      }
+      previous += (delta >> 1) ^ (0 - (delta & 1));
+      value.data() = std::to_string(static_cast<int64_t>(previous));
+    } else if (type == VALUES_DICTIONARY) {
+      uint64_t entry = 0;
+      if (!varint(entry) || entry >= dictionary.size()) {
+        return invalidColumnarData();
+      }
+      value.data() = dictionary[entry];
+    } else if (!string(value.data())) {
+      return invalidColumnarData();
+    }
+    append(rows[index], key, value);
+  }
+  return Status(0, "OK");
+}
+}
+
+Status ColumnarSerializer::serialize(const pt::ptree& params,
+                                     std::string& serialized) {
+  std::ostringstream output;
+  auto s = serializeTo(params, output);
+  if (s.ok()) {
+    serialized = output.str();
+  }
+  return s;
+}
+
+Status ColumnarSerializer::serializeTo(const pt::ptree& params,
+                                       std::ostream& output) {
+  output.write(kColumnarMagic.data(), kColumnarMagic.size());
+  ColumnarWriter(output).node(params);
+  if (!output.good()) {
+    return Status(1, "Cannot write columnar data");
+  }
+  return Status(0, "OK");
+}
+
+Status ColumnarSerializer::deserialize(const std::string& serialized,
+                                       pt::ptree& params) {
+  if (serialized.compare(0, kColumnarMagic.size(), kColumnarMagic) != 0) {
+    // Servers may answer columnar requests with JSON.
+    return JSONSerializer().deserialize(serialized, params);
+  }
+
+  ColumnarReader reader(serialized, kColumnarMagic.size());
+  pt::ptree tree;
+  auto s = reader.node(tree, 0);
+  if (!s.ok()) {
+    return s;
+  }
+  if (!reader.done()) {
+    return invalidColumnarData();
+  }
+  params.swap(tree);
+  return Status(0, "OK");
+}
+}
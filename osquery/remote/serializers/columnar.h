@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <osquery/flags.h>
+
+#include "osquery/remote/requests.h"
+
+namespace osquery {
+
+DECLARE_bool(tls_columnar_results);
+
+/// The "result_encoding" a client offers and a server answers to accept it.
+extern const std::string kColumnarEncoding;
+
+/**
+ * @brief Offer the columnar encoding in request parameters.
+ *
+ * If tls_columnar_results is set the parameters include "result_encoding".
+ */
+void offerColumnarEncoding(boost::property_tree::ptree& params);
+
+/**
+ * @brief Check if a server response accepts columnar result uploads.
+ *
+ * A server accepts by answering with a "result_encoding" of "columnar". Each
+ * response decides again, servers may stop accepting at any time.
+ */
+bool acceptsColumnarEncoding(const boost::property_tree::ptree& response);
+
+/**
+ * @brief Columnar binary serializer
+ *
+ * Result rows serialized as JSON repeat every column name in every row. This
+ * serializer writes arrays of objects, such as query results, as tables: the
+ * column names are written once and each column's values follow together.
+ * Canonical decimal integers are written as delta encoded varints and columns
+ * with few distinct strings as a dictionary and indexes.
+ *
+ * Any other property tree node is written as a tagged leaf, object, or array.
+ * Object keys within table rows are restored in column order, and JSON
+ * responses are accepted by deserialize, so servers may answer with either.
+ */
+class ColumnarSerializer : public Serializer {
+ public:
+  /**
+   * @brief Serialize a property tree into a string
+   *
+   * @param params A property tree of parameters
+   * @param serialized The string to populate the final serialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status serialize(const boost::property_tree::ptree& params,
+                   std::string& serialized) override;
+
+  /**
+   * @brief Serialize a property tree into a stream, see Serializer.
+   *
+   * @param params A property tree of parameters
+   * @param output The stream to write the final serialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status serializeTo(const boost::property_tree::ptree& params,
+                     std::ostream& output) override;
+
+  /**
+   * @brief Deserialize columnar or JSON data into a property tree
+   *
+   * @param serialized A string of serialized parameters
+   * @param params The property tree to populate the deserialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status deserialize(const std::string& serialized,
+                     boost::property_tree::ptree& params) override;
+
+  /**
+   * @brief Returns the HTTP content type, for HTTP/TLS transport
+   *
+   * @return The content type
+   */
+  std::string getContentType() const override {
+    return "application/x-osquery-columnar";
+  }
+};
+}
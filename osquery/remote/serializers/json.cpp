@@ -8,8 +8,11 @@
  *
  */
 
+#include <iterator>
+
 #include <boost/property_tree/json_parser.hpp>
 
+#include "osquery/core/conversions.h"
 #include "osquery/remote/serializers/json.h"
 
 namespace pt = boost::property_tree;
@@ -28,6 +31,16 @@ Status JSONSerializer::serialize(const pt::ptree& params,
   return Status(0, "OK");
 }
 
+Status JSONSerializer::serializeTo(const pt::ptree& params,
+                                   std::ostream& output) {
+  try {
+    pt::write_json(output, params, false);
+  } catch (const pt::json_parser::json_parser_error& e) {
+    return Status(1, e.what());
+  }
+  return Status(0, "OK");
+}
+
 Status JSONSerializer::deserialize(const std::string& serialized,
                                    pt::ptree& params) {
   try {
@@ -39,4 +52,143 @@ Status JSONSerializer::deserialize(const std::string& serialized,
   }
   return Status(0, "OK");
 }
+
+/// Split a JSON Pointer into its unescaped reference tokens.
+static bool parsePointer(const std::string& pointer,
+                         std::vector<std::string>& tokens) {
+  tokens.clear();
+  if (pointer.empty()) {
+    return true;
+  } else if (pointer[0] != '/') {
+    return false;
+  }
+
+  size_t start = 1;
+  while (true) {
+    auto end = pointer.find('/', start);
+    auto token = pointer.substr(
+        start, (end == std::string::npos) ? std::string::npos : end - start);
+    replaceAll(token, "~1", "/");
+    replaceAll(token, "~0", "~");
+    tokens.push_back(std::move(token));
+    if (end == std::string::npos) {
+      return true;
+    }
+    start = end + 1;
+  }
+}
+
+/// Property tree arrays are nodes with unnamed children.
+static bool isArray(const pt::ptree& node) {
+  return !node.empty() && node.begin()->first.empty();
+}
+
+/// Parse an array index token, "-" is the index after the last element.
+static bool parseIndex(const pt::ptree& node,
+                       const std::string& token,
+                       size_t& index) {
+  if (token == "-") {
+    index = node.size();
+    return true;
+  }
+  long long value = 0;
+  if (token.empty() || (token.size() > 1 && token[0] == '0') ||
+      !parseDecimal(token, value) || value < 0) {
+    return false;
+  }
+  index = static_cast<size_t>(value);
+  return true;
+}
+
+/// Find the child of an object member or array element token.
+static pt::ptree::iterator findChild(pt::ptree& node,
+                                     const std::string& token) {
+  if (!isArray(node)) {
+    auto child = node.find(token);
+    return (child == node.not_found()) ? node.end() : node.to_iterator(child);
+  }
+
+  size_t index = 0;
+  if (!parseIndex(node, token, index) || index >= node.size()) {
+    return node.end();
+  }
+  auto child = node.begin();
+  std::advance(child, index);
+  return child;
+}
+
+static Status applyOperation(const pt::ptree& operation,
+                             pt::ptree& document) {
+  auto op = operation.get<std::string>("op", "");
+  std::vector<std::string> tokens;
+  if (!parsePointer(operation.get<std::string>("path", ""), tokens)) {
+    return Status(1, "Invalid JSON Patch path");
+  }
+
+  auto value = operation.get_child_optional("value");
+  if ((op == "add" || op == "replace") && !value) {
+    return Status(1, "JSON Patch " + op + " requires a value");
+  } else if (op != "add" && op != "replace" && op != "remove") {
+    return Status(1, "Unsupported JSON Patch operation: " + op);
+  }
+
+  if (tokens.empty()) {
+    // The operation targets the whole document.
+    if (op == "remove") {
+      return Status(1, "Cannot remove the JSON Patch document");
+    }
+    document = *value;
+    return Status(0, "OK");
+  }
+
+  auto* parent = &document;
+  for (size_t i = 0; i + 1 < tokens.size(); i++) {
+    auto child = findChild(*parent, tokens[i]);
+    if (child == parent->end()) {
+      return Status(1, "JSON Patch path does not exist");
+    }
+    parent = &child->second;
+  }
+
+  const auto& token = tokens.back();
+  if (op == "add" && (isArray(*parent) || (parent->empty() && token == "-"))) {
+    // Add inserts array elements, shifting the following elements.
+    size_t index = 0;
+    if (!parseIndex(*parent, token, index) || index > parent->size()) {
+      return Status(1, "JSON Patch array index is out of range");
+    }
+    auto position = parent->begin();
+    std::advance(position, index);
+    parent->insert(position, std::make_pair("", *value));
+    return Status(0, "OK");
+  }
+
+  auto child = findChild(*parent, token);
+  if (op == "add" && child == parent->end()) {
+    parent->push_back(std::make_pair(token, *value));
+    return Status(0, "OK");
+  } else if (child == parent->end()) {
+    return Status(1, "JSON Patch path does not exist");
+  }
+
+  if (op == "remove") {
+    parent->erase(child);
+  } else {
+    child->second = *value;
+  }
+  return Status(0, "OK");
+}
+
+Status applyJSONPatch(const pt::ptree& patch, pt::ptree& document) {
+  // Operations are applied to a copy, a failed patch changes nothing.
+  auto patched = document;
+  for (const auto& operation : patch) {
+    auto status = applyOperation(operation.second, patched);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  document = std::move(patched);
+  return Status(0, "OK");
+}
 }
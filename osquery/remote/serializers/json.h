@@ -32,6 +32,18 @@ class JSONSerializer : public Serializer {
   Status serialize(const boost::property_tree::ptree& params,
                    std::string& serialized);
 
+  /**
+   * @brief Serialize a property tree into a stream, see Serializer.
+   *
+   * @param params A property tree of parameters
+   * @param output The stream to write the final serialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status serializeTo(const boost::property_tree::ptree& params,
+                     std::ostream& output) override;
+
   /**
    * @brief Deerialize a property tree into a property tree
    *
@@ -53,4 +65,21 @@ class JSONSerializer : public Serializer {
    */
   std::string getContentType() const { return "application/json"; }
 };
+
+/**
+ * @brief Apply a JSON Patch (RFC 6902) to a property tree
+ *
+ * Remote APIs may send a list of changes to a previously sent document
+ * instead of the complete document. The "add", "remove", and "replace"
+ * operations are supported. Paths are JSON Pointers (RFC 6901), an array
+ * element is referenced by its index and "-" appends to an array.
+ *
+ * @param patch The list of patch operations
+ * @param document The document to patch, unchanged if an operation fails
+ *
+ * @return An instance of osquery::Status indicating the success or failure
+ * of the operation
+ */
+Status applyJSONPatch(const boost::property_tree::ptree& patch,
+                      boost::property_tree::ptree& document);
 }
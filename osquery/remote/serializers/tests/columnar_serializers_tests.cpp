@@ -0,0 +1,144 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <gtest/gtest.h>
+
+#include "osquery/remote/serializers/columnar.h"
+#include "osquery/remote/serializers/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+DECLARE_bool(tls_columnar_results);
+
+class ColumnarSerializersTests : public testing::Test {
+ protected:
+  /// Build distributed results with a file hunt like table of rows.
+  pt::ptree getResults(size_t count) {
+    pt::ptree rows;
+    for (size_t i = 0; i < count; i++) {
+      pt::ptree row;
+      row.put<std::string>("path", "/tmp/file_" + std::to_string(i));
+      row.put<std::string>("size", std::to_string(i * 512));
+      row.put<std::string>("type", (i % 4 == 0) ? "directory" : "regular");
+      row.put<std::string>("mode", "0644");
+      if (i % 2 == 0) {
+        // Sparse columns and nested objects are tables too.
+        row.put<std::string>("hashes.md5", "d41d8cd98f00b204e9800998ecf8427e");
+      }
+      rows.push_back(std::make_pair("", row));
+    }
+
+    pt::ptree results;
+    results.put<std::string>("node_key", "fake_key");
+    results.add_child("queries.hunt", rows);
+    results.put<std::string>("statuses.hunt", "0");
+    return results;
+  }
+};
+
+TEST_F(ColumnarSerializersTests, test_serialize) {
+  auto results = getResults(100);
+  std::string serialized;
+  auto s = ColumnarSerializer().serialize(results, serialized);
+  ASSERT_TRUE(s.ok());
+
+  // Each column name is written once.
+  EXPECT_EQ(serialized.find("path"), serialized.rfind("path"));
+  EXPECT_EQ(serialized.find("md5"), serialized.rfind("md5"));
+
+  std::string json;
+  JSONSerializer().serialize(results, json);
+  EXPECT_LT(serialized.size() * 4, json.size());
+
+  pt::ptree params;
+  s = ColumnarSerializer().deserialize(serialized, params);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(params, results);
+}
+
+TEST_F(ColumnarSerializersTests, test_serialize_values) {
+  // Values are restored exactly, including strings that look like integers.
+  pt::ptree rows;
+  for (const auto& value : {"9223372036854775807",
+                            "-9223372036854775808",
+                            "0",
+                            "-0",
+                            "007",
+                            "",
+                            "text"}) {
+    pt::ptree row;
+    row.put<std::string>("value", value);
+    rows.push_back(std::make_pair("", row));
+  }
+
+  // Arrays of values and objects with duplicate keys are not tables.
+  pt::ptree params;
+  params.add_child("rows", rows);
+  pt::ptree list;
+  list.push_back(std::make_pair("", pt::ptree("1")));
+  list.push_back(std::make_pair("", pt::ptree("2")));
+  params.add_child("list", list);
+  pt::ptree duplicates;
+  duplicates.add("key", "1");
+  duplicates.add("key", "2");
+  params.add_child("duplicates", duplicates);
+
+  std::string serialized;
+  auto s = ColumnarSerializer().serialize(params, serialized);
+  ASSERT_TRUE(s.ok());
+
+  pt::ptree output;
+  s = ColumnarSerializer().deserialize(serialized, output);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(output, params);
+}
+
+TEST_F(ColumnarSerializersTests, test_deserialize) {
+  // Servers may answer with JSON.
+  pt::ptree params;
+  auto s = ColumnarSerializer().deserialize("{\"foo\":\"bar\"}\n", params);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(params.get<std::string>("foo"), "bar");
+
+  // Truncated data is rejected.
+  std::string serialized;
+  ColumnarSerializer().serialize(getResults(10), serialized);
+  for (size_t size = 5; size < serialized.size(); size++) {
+    pt::ptree output;
+    s = ColumnarSerializer().deserialize(serialized.substr(0, size), output);
+    EXPECT_FALSE(s.ok());
+  }
+}
+
+TEST_F(ColumnarSerializersTests, test_negotiate) {
+  auto columnar = FLAGS_tls_columnar_results;
+  pt::ptree response;
+  response.put<std::string>("result_encoding", "columnar");
+
+  FLAGS_tls_columnar_results = false;
+  pt::ptree params;
+  offerColumnarEncoding(params);
+  EXPECT_EQ(params.count("result_encoding"), 0U);
+  EXPECT_FALSE(acceptsColumnarEncoding(response));
+
+  FLAGS_tls_columnar_results = true;
+  offerColumnarEncoding(params);
+  EXPECT_EQ(params.get<std::string>("result_encoding"), "columnar");
+  EXPECT_TRUE(acceptsColumnarEncoding(response));
+  EXPECT_FALSE(acceptsColumnarEncoding(pt::ptree()));
+  FLAGS_tls_columnar_results = columnar;
+}
+}
@@ -39,4 +39,40 @@ TEST_F(JSONSerializersTests, test_deserialize) {
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(params, expected);
 }
+
+TEST_F(JSONSerializersTests, test_apply_patch) {
+  auto json = JSONSerializer();
+  boost::property_tree::ptree document;
+  std::string serialized =
+      "{\"options\":{\"a\":\"1\",\"b/c\":\"2\"},\"packs\":[\"x\",\"y\"]}";
+  ASSERT_TRUE(json.deserialize(serialized, document).ok());
+
+  boost::property_tree::ptree patch;
+  serialized =
+      "[{\"op\":\"replace\",\"path\":\"/options/a\",\"value\":\"3\"},"
+      "{\"op\":\"remove\",\"path\":\"/options/b~1c\"},"
+      "{\"op\":\"add\",\"path\":\"/packs/1\",\"value\":\"z\"},"
+      "{\"op\":\"add\",\"path\":\"/packs/-\",\"value\":\"w\"},"
+      "{\"op\":\"add\",\"path\":\"/schedule\",\"value\":{}}]";
+  ASSERT_TRUE(json.deserialize(serialized, patch).ok());
+  ASSERT_TRUE(applyJSONPatch(patch, document).ok());
+
+  ASSERT_TRUE(json.serialize(document, serialized).ok());
+  EXPECT_EQ(serialized,
+            "{\"options\":{\"a\":\"3\"},\"packs\":[\"x\",\"z\",\"y\","
+            "\"w\"],\"schedule\":\"\"}\n");
+
+  // A failed operation leaves the document unchanged.
+  auto expected = document;
+  serialized =
+      "[{\"op\":\"remove\",\"path\":\"/options/a\"},"
+      "{\"op\":\"remove\",\"path\":\"/options/missing\"}]";
+  ASSERT_TRUE(json.deserialize(serialized, patch).ok());
+  EXPECT_FALSE(applyJSONPatch(patch, document).ok());
+  EXPECT_EQ(document, expected);
+
+  serialized = "[{\"op\":\"move\",\"from\":\"/packs\",\"path\":\"/p\"}]";
+  ASSERT_TRUE(json.deserialize(serialized, patch).ok());
+  EXPECT_FALSE(applyJSONPatch(patch, document).ok());
+}
 }
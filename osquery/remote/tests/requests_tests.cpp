@@ -8,6 +8,10 @@
  *
  */
 
+#include <cstring>
+
+#include <zlib.h>
+
 #include <gtest/gtest.h>
 
 #include "osquery/remote/requests.h"
@@ -29,10 +33,14 @@ class MockTransport : public Transport {
   }
 
   Status sendRequest(const std::string& params) {
+    sent_ = params;
     response_params_.put<std::string>("foo", "baz");
     response_status_ = Status(0, "OK");
     return response_status_;
   }
+
+  /// The last body sent.
+  std::string sent_;
 };
 
 class MockSerializer : public Serializer {
@@ -138,4 +146,59 @@ TEST_F(RequestsTests, test_compression) {
   EXPECT_EQ(compressed, expected);
   EXPECT_LT(compressed.size(), uncompressed.size());
 }
+
+TEST_F(RequestsTests, test_compressor) {
+  std::string input;
+  for (size_t i = 0; i < 10000; i++) {
+    input += "{\"line\":" + std::to_string(i) + "},";
+  }
+
+  // Compress the input in pieces, the result should inflate to the input.
+  Compressor compressor;
+  for (size_t i = 0; i < input.size(); i += 1000) {
+    compressor.append(input.substr(i, 1000));
+  }
+  std::string output;
+  ASSERT_TRUE(compressor.finish(output).ok());
+  ASSERT_GT(output.size(), 2U);
+  EXPECT_LT(output.size(), input.size());
+  // The GZip magic.
+  EXPECT_EQ((unsigned char)output[0], 0x1f);
+  EXPECT_EQ((unsigned char)output[1], 0x8b);
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  ASSERT_EQ(inflateInit2(&zs, 15 + 16), Z_OK);
+  std::string inflated(input.size() + 1, '\0');
+  zs.next_in = (Bytef*)output.data();
+  zs.avail_in = output.size();
+  zs.next_out = (Bytef*)&inflated[0];
+  zs.avail_out = inflated.size();
+  EXPECT_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END);
+  inflated.resize(zs.total_out);
+  inflateEnd(&zs);
+  EXPECT_EQ(inflated, input);
+}
+
+TEST_F(RequestsTests, test_call_compressed) {
+  auto transport = std::make_shared<MockTransport>();
+  auto req = Request<MockTransport, JSONSerializer>("foobar", transport);
+  req.setOption("compress", true);
+
+  boost::property_tree::ptree params;
+  params.put<std::string>("foo", "bar");
+  ASSERT_TRUE(req.call(params).ok());
+
+  // The body is serialized and compressed in one pass.
+  auto& sent = transport->sent_;
+  ASSERT_GT(sent.size(), 2U);
+  EXPECT_EQ((unsigned char)sent[0], 0x1f);
+  EXPECT_EQ((unsigned char)sent[1], 0x8b);
+
+  // LZ4 frames start with their magic number.
+  req.setOption("compression", "lz4");
+  ASSERT_TRUE(req.call(params).ok());
+  ASSERT_GT(sent.size(), 4U);
+  EXPECT_EQ(sent.substr(0, 4), std::string("\x04\x22\x4d\x18", 4));
+}
 }
@@ -12,6 +12,7 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
 #include "osquery/remote/requests.h"
@@ -96,6 +97,60 @@ TEST_F(TLSTransportsTests, test_call_with_params) {
   }
 }
 
+TEST_F(TLSTransportsTests, test_call_conditional) {
+  auto t = std::make_shared<TLSTransport>();
+  t->disableVerifyPeer();
+
+  auto url = "https://localhost:" + port_;
+  auto r = Request<TLSTransport, JSONSerializer>(url, t);
+
+  // The testing server tags GET responses with an ETag.
+  Status status;
+  ASSERT_NO_THROW(status = r.call());
+  if (verify(status)) {
+    EXPECT_EQ(r.getResponseCode(), 200);
+    auto etag = r.getResponseHeader("etag");
+    ASSERT_FALSE(etag.empty());
+
+    // A request with the current ETag is answered with Not Modified.
+    r = Request<TLSTransport, JSONSerializer>(url, t);
+    r.setOption("etag", etag);
+    ASSERT_NO_THROW(status = r.call());
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(r.getResponseCode(), 304);
+
+    pt::ptree recv;
+    EXPECT_TRUE(r.getResponse(recv).ok());
+    EXPECT_TRUE(recv.empty());
+  }
+}
+
+TEST_F(TLSTransportsTests, test_content_encoding) {
+  auto t = std::make_shared<TLSTransport>();
+  auto url = "https://localhost:" + port_;
+  auto r = Request<TLSTransport, JSONSerializer>(url, t);
+  auto encoding = [&t, &url]() {
+    TLSClient::request request(url);
+    t->decorateRequest(request);
+    std::string value;
+    for (const auto& header : headers(request)) {
+      if (header.first == "Content-Encoding") {
+        value = header.second;
+      }
+    }
+    return value;
+  };
+
+  // Uncompressed bodies have no encoding.
+  EXPECT_TRUE(encoding().empty());
+
+  // A compressed body names the codec it was compressed with.
+  r.setOption("compress", true);
+  EXPECT_EQ(encoding(), "gzip");
+  r.setOption("compression", "lz4");
+  EXPECT_EQ(encoding(), "lz4");
+}
+
 TEST_F(TLSTransportsTests, test_call_verify_peer) {
   // Create a default request without a transport that accepts invalid peers.
   auto url = "https://localhost:" + port_;
@@ -155,4 +210,44 @@ TEST_F(TLSTransportsTests, test_call_client_auth) {
     EXPECT_TRUE(status.ok());
   }
 }
+
+TEST_F(TLSTransportsTests, test_client_pool) {
+  TLSTransport::resetClientPool();
+  auto hits = TLSTransport::clientPoolHits();
+  auto misses = TLSTransport::clientPoolMisses();
+
+  // Transports to the same endpoint share a client, the path is ignored.
+  auto url = "https://localhost:" + port_;
+  TLSTransport first, second, unverified;
+  first.setDestination(url + "/config");
+  second.setDestination(url + "/log");
+  unverified.setDestination(url + "/config");
+  unverified.disableVerifyPeer();
+
+  first.getClient();
+  EXPECT_EQ(TLSTransport::clientPoolMisses(), misses + 1);
+  second.getClient();
+  EXPECT_EQ(TLSTransport::clientPoolHits(), hits + 1);
+
+  // Different TLS options require a different client.
+  unverified.getClient();
+  EXPECT_EQ(TLSTransport::clientPoolMisses(), misses + 2);
+
+  // A failed request releases the client, the next request connects again.
+  first.releaseClient();
+  first.getClient();
+  EXPECT_EQ(TLSTransport::clientPoolMisses(), misses + 3);
+
+  // Replacing a certificate file in place selects a new client.
+  auto cert = kTestWorkingDirectory + "test_pool_client.pem";
+  writeTextFile(cert, "first");
+  TLSTransport rotated;
+  rotated.setDestination(url + "/config");
+  rotated.setClientCertificate(cert, cert);
+  auto key = rotated.getClientKey();
+  writeTextFile(cert, "second certificate");
+  EXPECT_NE(rotated.getClientKey(), key);
+  osquery::remove(cert);
+  TLSTransport::resetClientPool();
+}
 }
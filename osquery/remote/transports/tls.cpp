@@ -10,8 +10,16 @@
 
 #include "osquery/remote/transports/tls.h"
 
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include <sys/stat.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/asio/ssl/context_base.hpp>
 
+#include <osquery/core.h>
 #include <osquery/filesystem.h>
 
 namespace http = boost::network::http;
@@ -80,8 +88,44 @@ HIDDEN_FLAG(bool, tls_dump, false, "Print remote requests and responses");
 /// Undocumented feature to override TLS endpoints.
 HIDDEN_FLAG(bool, tls_node_api, false, "Use node key as TLS endpoints");
 
+HIDDEN_FLAG(bool,
+            tls_client_pool,
+            true,
+            "Share TLS/HTTPS clients between requests to the same endpoint");
+
 DECLARE_bool(verbose);
 
+/// A pooled client and the time it was created.
+struct PooledTLSClient {
+  TLSClient client;
+  size_t created{0};
+};
+
+/// Pooled clients, keyed by endpoint and TLS options.
+static std::map<std::string, PooledTLSClient> kTLSClients;
+static std::mutex kTLSClientsMutex;
+
+/// Client pool statistics.
+static std::atomic<size_t> kTLSClientHits{0};
+static std::atomic<size_t> kTLSClientMisses{0};
+
+const size_t kTLSTimeout = 4;
+
+/// The pool never holds more clients than this, it is reset when full.
+const size_t kTLSMaxClients = 32;
+
+/// Seconds a pooled client is used, it then resolves the endpoint again.
+const size_t kTLSClientLifetime = 600;
+
+/// The modification time and size identifying the content of a file.
+static std::string getFileVersion(const std::string& path) {
+  struct stat file;
+  if (path.empty() || stat(path.c_str(), &file) != 0) {
+    return "";
+  }
+  return std::to_string(file.st_mtime) + ":" + std::to_string(file.st_size);
+}
+
 TLSTransport::TLSTransport() : verify_peer_(true) {
   if (FLAGS_tls_server_certs.size() > 0) {
     server_certificate_file_ = FLAGS_tls_server_certs;
@@ -93,17 +137,130 @@ TLSTransport::TLSTransport() : verify_peer_(true) {
   }
 }
 
-void TLSTransport::decorateRequest(http::client::request& r) {
-  r << boost::network::header("Connection", "close");
+void TLSTransport::decorateRequest(TLSClient::request& r) {
+  if (!FLAGS_tls_client_pool) {
+    // Only pooled clients reuse their connections.
+    r << boost::network::header("Connection", "close");
+  }
   r << boost::network::header("Content-Type", serializer_->getContentType());
   r << boost::network::header("Accept", serializer_->getContentType());
   r << boost::network::header("Host", FLAGS_tls_hostname);
   r << boost::network::header("User-Agent", kTLSUserAgentBase + kVersion);
+
+  // The server decompresses the body with the codec the request used.
+  if (options_.get("compress", false)) {
+    auto type =
+        getCompressionType(options_.get<std::string>("compression", "gzip"));
+    r << boost::network::header("Content-Encoding", getContentEncoding(type));
+  }
+
+  // A conditional request, the server may respond 304 Not Modified.
+  if (isConditional()) {
+    r << boost::network::header("If-None-Match",
+                                options_.get<std::string>("etag"));
+  }
+}
+
+bool TLSTransport::isConditional() const {
+  return !options_.get<std::string>("etag", "").empty();
+}
+
+Status TLSTransport::readResponse() {
+  response_code_ = status(response_);
+  response_headers_.clear();
+  for (const auto& header : headers(response_)) {
+    response_headers_[boost::algorithm::to_lower_copy(header.first)] =
+        header.second;
+  }
+
+  // A Not Modified response has no body, the caller keeps its content.
+  response_params_.clear();
+  if (response_code_ == 304) {
+    return Status(0, "OK");
+  }
+
+  const auto& response_body = body(response_);
+  if (FLAGS_verbose && FLAGS_tls_dump) {
+    fprintf(stdout, "%s\n", std::string(response_body).c_str());
+  }
+  return serializer_->deserialize(response_body, response_params_);
+}
+
+size_t TLSTransport::clientPoolHits() { return kTLSClientHits; }
+
+size_t TLSTransport::clientPoolMisses() { return kTLSClientMisses; }
+
+void TLSTransport::resetClientPool() {
+  std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+  kTLSClients.clear();
+}
+
+std::string TLSTransport::getClientKey() const {
+  // Only the scheme, host, and port of the destination select a client.
+  auto host = destination_.find("://");
+  host = (host == std::string::npos) ? 0 : host + 3;
+  auto path = destination_.find('/', host);
+  auto key = destination_.substr(0, path);
+
+  key += "|" + std::to_string(verify_peer_);
+#if defined(DEBUG)
+  key += std::to_string(FLAGS_tls_allow_unsafe);
+#endif
+  key += "|" + server_certificate_file_ + "@" +
+         getFileVersion(server_certificate_file_);
+  key += "|" + client_certificate_file_ + "@" +
+         getFileVersion(client_certificate_file_);
+  key += "|" + client_private_key_file_ + "@" +
+         getFileVersion(client_private_key_file_);
+  key += "|" + std::to_string(options_.get<size_t>("timeout", kTLSTimeout));
+  key += "|" + std::to_string(isConditional());
+  return key;
+}
+
+TLSClient TLSTransport::getClient() {
+  if (!FLAGS_tls_client_pool) {
+    return createClient();
+  }
+
+  auto key = getClientKey();
+  auto now = getUnixTime();
+  {
+    std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+    auto client = kTLSClients.find(key);
+    if (client != kTLSClients.end() &&
+        now < client->second.created + kTLSClientLifetime) {
+      kTLSClientHits++;
+      return client->second.client;
+    }
+  }
+
+  // Create the client without the lock, it may read certificates.
+  kTLSClientMisses++;
+  PooledTLSClient pooled{createClient(), now};
+  std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+  if (kTLSClients.size() >= kTLSMaxClients) {
+    kTLSClients.clear();
+  }
+  kTLSClients[key] = pooled;
+  return pooled.client;
 }
 
-http::client TLSTransport::getClient() {
-  http::client::options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(4);
+void TLSTransport::releaseClient() {
+  if (FLAGS_tls_client_pool) {
+    auto key = getClientKey();
+    std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+    kTLSClients.erase(key);
+  }
+}
+
+TLSClient TLSTransport::createClient() {
+  // Redirects must include a Location, a 304 Not Modified response does not.
+  TLSClient::options options;
+  options.follow_redirects(!isConditional())
+      .always_verify_peer(verify_peer_)
+      .timeout(options_.get<size_t>("timeout", kTLSTimeout));
+  // Pooled clients resolve each endpoint once, see kTLSClientLifetime.
+  options.cache_resolved(FLAGS_tls_client_pool);
 
   std::string ciphers = kTLSCiphers;
 // Some Ubuntu 12.04 clients exhaust their cipher suites without SHA.
@@ -146,7 +303,7 @@ http::client TLSTransport::getClient() {
     }
   }
 
-  http::client client(options);
+  TLSClient client(options);
   return client;
 }
 
@@ -163,19 +320,16 @@ Status TLSTransport::sendRequest() {
   }
 
   auto client = getClient();
-  http::client::request r(destination_);
+  TLSClient::request r(destination_);
   decorateRequest(r);
 
   try {
     VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
     response_ = client.get(r);
-    const auto& response_body = body(response_);
-    if (FLAGS_verbose && FLAGS_tls_dump) {
-      fprintf(stdout, "%s\n", std::string(response_body).c_str());
-    }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
+    response_status_ = readResponse();
   } catch (const std::exception& e) {
+    // The connection or the resolved address may be stale, connect again.
+    releaseClient();
     return Status((tlsFailure(e.what())) ? 2 : 1,
                   std::string("Request error: ") + e.what());
   }
@@ -188,7 +342,7 @@ Status TLSTransport::sendRequest(const std::string& params) {
   }
 
   auto client = getClient();
-  http::client::request r(destination_);
+  TLSClient::request r(destination_);
   decorateRequest(r);
 
   // Allow request calls to override the default HTTP POST verb.
@@ -208,14 +362,10 @@ Status TLSTransport::sendRequest(const std::string& params) {
     } else {
       response_ = client.put(r, params);
     }
-
-    const auto& response_body = body(response_);
-    if (FLAGS_verbose && FLAGS_tls_dump) {
-      fprintf(stdout, "%s\n", std::string(response_body).c_str());
-    }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
+    response_status_ = readResponse();
   } catch (const std::exception& e) {
+    // The connection or the resolved address may be stale, connect again.
+    releaseClient();
     return Status((tlsFailure(e.what())) ? 2 : 1,
                   std::string("Request error: ") + e.what());
   }
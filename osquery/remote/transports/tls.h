@@ -52,6 +52,9 @@ _Pragma("clang diagnostic pop")
 
 namespace osquery {
 
+/// The default seconds a request may take, see the "timeout" option.
+extern const size_t kTLSTimeout;
+
 /// Path to optional TLS client secret key, used for enrollment/requests.
 DECLARE_string(tls_client_key);
 
@@ -61,6 +64,12 @@ DECLARE_string(tls_client_cert);
 /// TLS server hostname.
 DECLARE_string(tls_hostname);
 
+/// Clients keep their connections to an endpoint open between requests.
+using TLSClient = boost::network::http::basic_client<
+    boost::network::http::tags::http_keepalive_8bit_udp_resolve,
+    1,
+    1>;
+
 /**
  * @brief HTTP verb selections.
  */
@@ -102,8 +111,44 @@ class TLSTransport : public Transport {
  public:
   TLSTransport();
 
+  /// The number of requests that reused a pooled client.
+  static size_t clientPoolHits();
+
+  /// The number of requests that created a client for the pool.
+  static size_t clientPoolMisses();
+
+  /// Release the pooled clients, for example when TLS options change.
+  static void resetClientPool();
+
  protected:
-  boost::network::http::client getClient();
+  /**
+   * @brief Get a client for the destination and TLS options.
+   *
+   * Clients are pooled by endpoint (scheme, host, and port) and TLS options
+   * and shared by every transport. A pooled client keeps its connections
+   * alive, so requests to an endpoint reuse the established TLS session
+   * instead of connecting and handshaking again. Resolved endpoint addresses
+   * are kept until a request fails or the client is replaced after
+   * kTLSClientLifetime seconds.
+   */
+  TLSClient getClient();
+
+  /// Create a client for the destination and TLS options.
+  TLSClient createClient();
+
+  /// Remove the pooled client after a failed request, to connect again.
+  void releaseClient();
+
+  /**
+   * @brief The pool key of the destination and TLS options.
+   *
+   * Certificate and key files are identified by their modification time and
+   * size, a file replaced in place selects a new client.
+   */
+  std::string getClientKey() const;
+
+  /// Check if the request sends the "etag" option as If-None-Match.
+  bool isConditional() const;
 
  private:
   /// Testing-only, disable peer verification.
@@ -140,11 +185,14 @@ class TLSTransport : public Transport {
     *
     * @param The request object, to be modified
     */
-  void decorateRequest(boost::network::http::client::request& r);
+  void decorateRequest(TLSClient::request& r);
+
+  /// Read the status code, headers, and deserialized body of the response.
+  Status readResponse();
 
  protected:
   /// Storage for the HTTP response object
-  boost::network::http::client::response response_;
+  TLSClient::response response_;
 
  private:
   FRIEND_TEST(TLSTransportsTests, test_call);
@@ -153,6 +201,9 @@ class TLSTransport : public Transport {
   FRIEND_TEST(TLSTransportsTests, test_call_server_cert_pinning);
   FRIEND_TEST(TLSTransportsTests, test_call_client_auth);
   FRIEND_TEST(TLSTransportsTests, test_call_http);
+  FRIEND_TEST(TLSTransportsTests, test_client_pool);
+  FRIEND_TEST(TLSTransportsTests, test_call_conditional);
+  FRIEND_TEST(TLSTransportsTests, test_content_encoding);
 
   friend class TestDistributedPlugin;
 };
@@ -13,6 +13,7 @@
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
 
+#include "osquery/dispatcher/dispatcher.h"
 #include "osquery/remote/requests.h"
 #include "osquery/remote/transports/tls.h"
 
@@ -68,13 +69,15 @@ class TLSRequestHelper : private boost::noncopyable {
    * const because it will be modified to include node_key.
    * @param output is the ptree which will be populated with the deserialized
    * results
+   * @param timeout is the seconds the request may take, 0 for the default
    *
    * @return a Status object indicating the success or failure of the operation
    */
   template <class TSerializer>
   static Status go(const std::string& uri,
                    boost::property_tree::ptree& params,
-                   boost::property_tree::ptree& output) {
+                   boost::property_tree::ptree& output,
+                   size_t timeout = 0) {
     auto node_key = getNodeKey("tls");
 
     // If using a GET request, append the node_key to the URI variables.
@@ -87,6 +90,9 @@ class TLSRequestHelper : private boost::noncopyable {
 
     // Again check for GET to call with/without parameters.
     auto request = Request<TLSTransport, TSerializer>(uri + uri_suffix);
+    if (timeout > 0) {
+      request.setOption("timeout", timeout);
+    }
     auto status = (FLAGS_tls_node_api) ? request.call() : request.call(params);
 
     if (!status.ok()) {
@@ -98,20 +104,116 @@ class TLSRequestHelper : private boost::noncopyable {
     if (!status.ok()) {
       return status;
     }
+    return checkResponse(output);
+  }
 
-    // Receive config or key rejection
-    if (output.count("error") > 0) {
-      return Status(1, "Request failed: " + output.get("error", "<unknown>"));
-    } else if (output.count("node_invalid") > 0) {
-      auto invalid = output.get("node_invalid", "");
-      if (invalid == "1" || invalid == "true" || invalid == "True") {
-        if (!FLAGS_disable_reenrollment) {
-          clearNodeKey();
+  /**
+   * @brief Send a TLS request
+   *
+   * @param uri is the URI to send the request to
+   * @param params is a ptree of the params to send to the server. This isn't
+   * const because it will be modified to include node_key.
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   * @param attempts is the number of attempts to make if the request fails
+   * @param timeout is the seconds each attempt may take, 0 for the default
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status go(const std::string& uri,
+                   boost::property_tree::ptree& params,
+                   boost::property_tree::ptree& output,
+                   const size_t attempts,
+                   size_t timeout) {
+    Status s;
+    for (size_t i = 1; i <= attempts; i++) {
+      output.clear();
+      s = TLSRequestHelper::go<TSerializer>(uri, params, output, timeout);
+      if (s.ok()) {
+        return s;
+      }
+      if (i == attempts) {
+        break;
+      }
+      backoff(i);
+    }
+    return s;
+  }
+
+  /**
+   * @brief Wait before retrying a failed request
+   *
+   * The wait grows with the square of the attempt that failed. It is an
+   * interruptableSleep so a retrying service thread still stops promptly.
+   *
+   * @param attempt is the 1-based attempt that failed
+   */
+  static void backoff(size_t attempt) {
+    interruptableSleep(attempt * attempt * 1000);
+  }
+
+  /**
+   * @brief Send a conditional TLS request
+   *
+   * The ETag of a previous response is sent as If-None-Match. If the server
+   * responds 304 Not Modified the output is empty and modified is false, the
+   * caller should keep using the content of the previous response.
+   *
+   * @param uri is the URI to send the request to
+   * @param params is a ptree of the params to send to the server. This isn't
+   * const because it will be modified to include node_key.
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   * @param etag is the ETag of the previous response, empty for none, and is
+   * replaced by the ETag of a modified response
+   * @param modified is set to false if the server responded Not Modified
+   * @param attempts is the number of attempts to make if the request fails
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status goConditional(const std::string& uri,
+                              boost::property_tree::ptree& params,
+                              boost::property_tree::ptree& output,
+                              std::string& etag,
+                              bool& modified,
+                              const size_t attempts) {
+    Status status;
+    for (size_t i = 1; i <= attempts; i++) {
+      auto node_key = getNodeKey("tls");
+      std::string uri_suffix;
+      if (FLAGS_tls_node_api) {
+        uri_suffix = "&node_key=" + node_key;
+      } else {
+        params.put<std::string>("node_key", node_key);
+      }
+
+      auto request = Request<TLSTransport, TSerializer>(uri + uri_suffix);
+      if (!etag.empty()) {
+        request.setOption("etag", etag);
+      }
+      status = (FLAGS_tls_node_api) ? request.call() : request.call(params);
+      if (status.ok()) {
+        status = request.getResponse(output);
+      }
+      if (status.ok()) {
+        modified = (request.getResponseCode() != 304);
+        if (!modified) {
+          return status;
+        }
+        status = checkResponse(output);
+        if (status.ok()) {
+          etag = request.getResponseHeader("ETag");
+          return status;
         }
-        return Status(1, "Request failed: Invalid node key");
       }
+      if (i == attempts) {
+        break;
+      }
+      backoff(i);
     }
-    return Status(0, "OK");
+    return status;
   }
 
   /**
@@ -195,7 +297,7 @@ class TLSRequestHelper : private boost::noncopyable {
       if (i == attempts) {
         break;
       }
-      ::sleep(i * i);
+      backoff(i);
     }
     return s;
   }
@@ -217,5 +319,23 @@ class TLSRequestHelper : private boost::noncopyable {
     boost::property_tree::ptree params;
     return TLSRequestHelper::go<TSerializer>(uri, params, output, attempts);
   }
+
+ private:
+  /// Check a response for an error or a node key rejection.
+  static Status checkResponse(const boost::property_tree::ptree& output) {
+    // Receive config or key rejection
+    if (output.count("error") > 0) {
+      return Status(1, "Request failed: " + output.get("error", "<unknown>"));
+    } else if (output.count("node_invalid") > 0) {
+      auto invalid = output.get("node_invalid", "");
+      if (invalid == "1" || invalid == "true" || invalid == "True") {
+        if (!FLAGS_disable_reenrollment) {
+          clearNodeKey();
+        }
+        return Status(1, "Request failed: Invalid node key");
+      }
+    }
+    return Status(0, "OK");
+  }
 };
 }
@@ -8,6 +8,8 @@
  *
  */
 
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 
 #include <osquery/core.h>
@@ -32,6 +34,10 @@ typedef unsigned char byte;
 
 SQL::SQL(const std::string& q) { status_ = query(q, results_); }
 
+SQL::SQL(const std::string& q, const RowCallback& callback) {
+  status_ = query(q, callback);
+}
+
 const QueryData& SQL::rows() const { return results_; }
 
 bool SQL::ok() { return status_.ok(); }
@@ -40,45 +46,62 @@ const Status& SQL::getStatus() const { return status_; }
 
 std::string SQL::getMessageString() { return status_.toString(); }
 
+/// Every byte of a word set to the same value.
+static const uint64_t kEveryByte = 0x0101010101010101ULL;
+
+/// Find the first byte below 0x20 or above 0x7F, data.size() if none.
+static size_t findNonPrintableByte(const std::string& data) {
+  const auto* bytes = reinterpret_cast<const byte*>(data.data());
+  size_t size = data.size();
+  size_t i = 0;
+  // Check 8 bytes at a time, printable data is the common case.
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    // A byte below 0x20 borrows into its high bit, after masking high bytes.
+    auto flags = (word | ((word - kEveryByte * 0x20) & ~word)) &
+                 (kEveryByte * 0x80);
+    if (flags != 0) {
+      break;
+    }
+  }
+
+  for (; i < size; i++) {
+    if (bytes[i] < 0x20 || bytes[i] >= 0x80) {
+      return i;
+    }
+  }
+  return size;
+}
+
 void escapeNonPrintableBytes(std::string& data) {
+  auto first = findNonPrintableByte(data);
+  if (first == data.size()) {
+    // Only replace if any escapes are needed.
+    return;
+  }
+
+  static const char kHexChars[] = "0123456789ABCDEF";
+  const auto* bytes = reinterpret_cast<const byte*>(data.data());
+  size_t count = 0;
+  for (size_t i = first; i < data.size(); i++) {
+    count += (bytes[i] < 0x20 || bytes[i] >= 0x80) ? 1 : 0;
+  }
+
+  // Each escaped byte becomes 4 characters.
   std::string escaped;
-  // clang-format off
-  char const hex_chars[16] = {
-      '0',
-      '1',
-      '2',
-      '3',
-      '4',
-      '5',
-      '6',
-      '7',
-      '8',
-      '9',
-      'A',
-      'B',
-      'C',
-      'D',
-      'E',
-      'F',
-  };
-  // clang-format on
-
-  bool needs_replacement = false;
-  for (size_t i = 0; i < data.length(); i++) {
-    if (((byte)data[i]) < 0x20 || ((byte)data[i]) >= 0x80) {
-      needs_replacement = true;
+  escaped.reserve(data.size() + count * 3);
+  escaped.append(data, 0, first);
+  for (size_t i = first; i < data.size(); i++) {
+    if (bytes[i] < 0x20 || bytes[i] >= 0x80) {
       escaped += "\\x";
-      escaped += hex_chars[(((byte)data[i])) >> 4];
-      escaped += hex_chars[((byte)data[i] & 0x0F) >> 0];
+      escaped += kHexChars[bytes[i] >> 4];
+      escaped += kHexChars[bytes[i] & 0x0F];
     } else {
       escaped += data[i];
     }
   }
-
-  // Only replace if any escapes were made.
-  if (needs_replacement) {
-    data = escaped;
-  }
+  data = std::move(escaped);
 }
 
 void SQL::escapeResults() {
@@ -100,16 +123,39 @@ QueryData SQL::selectAllFrom(const std::string& table,
                              const std::string& column,
                              ConstraintOperator op,
                              const std::string& expr) {
-  PluginResponse response;
-  PluginRequest request = {{"action", "generate"}};
   QueryContext ctx;
   ctx.constraints[column].add(Constraint(op, expr));
+  return selectAllFrom(table, ctx);
+}
 
-  TablePlugin::setRequestFromContext(ctx, request);
+QueryData SQL::selectAllFrom(const std::string& table,
+                             const QueryContext& context) {
+  PluginResponse response;
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
   Registry::call("table", table, request, response);
   return response;
 }
 
+/// Pass complete results to a row callback until it stops reading.
+static void streamRows(QueryData& results, const RowCallback& callback) {
+  for (auto& row : results) {
+    if (!callback(row)) {
+      break;
+    }
+  }
+}
+
+Status SQLPlugin::query(const std::string& q,
+                        const RowCallback& callback) const {
+  QueryData results;
+  auto status = this->query(q, results);
+  if (status.ok()) {
+    streamRows(results, callback);
+  }
+  return status;
+}
+
 Status SQLPlugin::call(const PluginRequest& request, PluginResponse& response) {
   response.clear();
   if (request.count("action") == 0) {
@@ -127,6 +173,15 @@ Status SQLPlugin::call(const PluginRequest& request, PluginResponse& response) {
           {{"n", column.first}, {"t", columnTypeName(column.second)}});
     }
     return status;
+  } else if (request.at("action") == "scans") {
+    std::vector<TableScan> scans;
+    auto status = this->getQueryScans(request.at("query"), scans);
+    for (const auto& scan : scans) {
+      response.push_back({{"table", scan.table},
+                          {"cost", std::to_string(scan.cost)},
+                          {"constraints", std::to_string(scan.constraints)}});
+    }
+    return status;
   } else if (request.at("action") == "attach") {
     // Attach a virtual table name using an optional included definition.
     return this->attach(request.at("table"));
@@ -142,6 +197,21 @@ Status query(const std::string& q, QueryData& results) {
       "sql", "sql", {{"action", "query"}, {"query", q}}, results);
 }
 
+Status query(const std::string& q, const RowCallback& callback) {
+  // Only a plugin in this process can stream rows, extensions reply in full.
+  auto plugin = Registry::getLocal<SQLPlugin>("sql", "sql");
+  if (plugin != nullptr) {
+    return plugin->query(q, callback);
+  }
+
+  QueryData results;
+  auto status = query(q, results);
+  if (status.ok()) {
+    streamRows(results, callback);
+  }
+  return status;
+}
+
 Status getQueryColumns(const std::string& q, TableColumns& columns) {
   PluginResponse response;
   auto status = Registry::call(
@@ -153,4 +223,19 @@ Status getQueryColumns(const std::string& q, TableColumns& columns) {
   }
   return status;
 }
+
+Status getQueryScans(const std::string& q, std::vector<TableScan>& scans) {
+  PluginResponse response;
+  auto status = Registry::call(
+      "sql", "sql", {{"action", "scans"}, {"query", q}}, response);
+
+  for (const auto& item : response) {
+    TableScan scan;
+    scan.table = item.at("table");
+    scan.cost = strtod(item.at("cost").c_str(), nullptr);
+    scan.constraints = strtoul(item.at("constraints").c_str(), nullptr, 10);
+    scans.push_back(std::move(scan));
+  }
+  return status;
+}
 }
@@ -0,0 +1,579 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+#include "osquery/core/conversions.h"
+#include "osquery/sql/sqlite_util.h"
+
+namespace osquery {
+
+/// Read a text argument, NULL arguments are nullptr.
+static const char* textArgument(sqlite3_value* value) {
+  if (sqlite3_value_type(value) == SQLITE_NULL) {
+    return nullptr;
+  }
+  return reinterpret_cast<const char*>(sqlite3_value_text(value));
+}
+
+/// Parse an IPv4 or IPv6 address into network-order bytes.
+static bool parseAddress(const std::string& address,
+                         std::vector<unsigned char>& bytes) {
+  unsigned char buffer[16];
+  if (inet_pton(AF_INET, address.c_str(), buffer) == 1) {
+    bytes.assign(buffer, buffer + 4);
+    return true;
+  } else if (inet_pton(AF_INET6, address.c_str(), buffer) == 1) {
+    bytes.assign(buffer, buffer + 16);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief in_cidr_block(CIDR, ADDRESS): 1 if the address is within the block.
+ *
+ * Both IPv4 and IPv6 are supported, an address is never within a block of the
+ * other family. Invalid blocks are an error and invalid addresses are NULL.
+ */
+static void sqliteInCIDRBlock(sqlite3_context* ctx,
+                              int argc,
+                              sqlite3_value** argv) {
+  auto cidr = textArgument(argv[0]);
+  auto address = textArgument(argv[1]);
+  if (cidr == nullptr || address == nullptr) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  std::string block = cidr;
+  auto slash = block.find('/');
+  std::vector<unsigned char> network;
+  if (slash == std::string::npos ||
+      !parseAddress(block.substr(0, slash), network)) {
+    sqlite3_result_error(ctx, "Invalid CIDR block", -1);
+    return;
+  }
+
+  long bits = 0;
+  if (!safeStrtol(block.substr(slash + 1), 10, bits) || bits < 0 ||
+      static_cast<size_t>(bits) > network.size() * 8) {
+    sqlite3_result_error(ctx, "Invalid CIDR block prefix length", -1);
+    return;
+  }
+
+  std::vector<unsigned char> host;
+  if (!parseAddress(address, host)) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  if (host.size() != network.size()) {
+    sqlite3_result_int(ctx, 0);
+    return;
+  }
+
+  // Compare every whole byte of the prefix, then the remaining high bits.
+  size_t whole = static_cast<size_t>(bits) / 8;
+  int match = (memcmp(host.data(), network.data(), whole) == 0) ? 1 : 0;
+  auto remaining = bits % 8;
+  if (match && remaining > 0) {
+    auto mask = static_cast<unsigned char>(0xFF << (8 - remaining));
+    match = ((host[whole] & mask) == (network[whole] & mask)) ? 1 : 0;
+  }
+  sqlite3_result_int(ctx, match);
+}
+
+/**
+ * @brief split(STRING, TOKENS, INDEX): the INDEX-th token-separated element.
+ *
+ * Every character of TOKENS is a separator, empty elements are skipped and
+ * elements are trimmed, as with osquery::split. An out of range index is NULL.
+ */
+static void sqliteSplit(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  auto input = textArgument(argv[0]);
+  auto tokens = textArgument(argv[1]);
+  if (input == nullptr || tokens == nullptr ||
+      sqlite3_value_type(argv[2]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  auto index = sqlite3_value_int64(argv[2]);
+  auto elements = osquery::split(input, tokens);
+  if (index < 0 || static_cast<size_t>(index) >= elements.size()) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  sqlite3_result_text(ctx, elements[index].c_str(), -1, SQLITE_TRANSIENT);
+}
+
+/// Remove the trailing separators of a path, keeping a root separator.
+static std::string trimPath(const std::string& path) {
+  auto end = path.find_last_not_of('/');
+  if (end == std::string::npos) {
+    return path.empty() ? path : "/";
+  }
+  return path.substr(0, end + 1);
+}
+
+/**
+ * @brief dirname(PATH): the parent directory of a path.
+ *
+ * Follows dirname(1): "/usr/lib/" is "/usr", "/usr" is "/" and "usr" is ".".
+ */
+static void sqliteDirname(sqlite3_context* ctx,
+                          int argc,
+                          sqlite3_value** argv) {
+  auto input = textArgument(argv[0]);
+  if (input == nullptr) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  auto path = trimPath(input);
+  auto slash = path.find_last_of('/');
+  std::string parent;
+  if (slash == std::string::npos) {
+    parent = ".";
+  } else if (path == "/") {
+    parent = "/";
+  } else {
+    parent = trimPath(path.substr(0, slash));
+    if (parent.empty()) {
+      parent = "/";
+    }
+  }
+  sqlite3_result_text(ctx, parent.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+/**
+ * @brief basename(PATH): the last element of a path.
+ *
+ * Follows basename(1): "/usr/lib/" is "lib" and "/" is "/".
+ */
+static void sqliteBasename(sqlite3_context* ctx,
+                           int argc,
+                           sqlite3_value** argv) {
+  auto input = textArgument(argv[0]);
+  if (input == nullptr) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  auto path = trimPath(input);
+  auto slash = path.find_last_of('/');
+  if (slash != std::string::npos && path != "/") {
+    path = path.substr(slash + 1);
+  }
+  sqlite3_result_text(ctx, path.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+/**
+ * @brief hex_to_int(HEX): the integer value of a hexadecimal string.
+ *
+ * An optional "0x" prefix is accepted, such as an address or port read from
+ * /proc/net. Invalid or empty strings are NULL.
+ */
+static void sqliteHexToInt(sqlite3_context* ctx,
+                           int argc,
+                           sqlite3_value** argv) {
+  auto input = textArgument(argv[0]);
+  if (input == nullptr) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  std::string hex = input;
+  if (hex.compare(0, 2, "0x") == 0 || hex.compare(0, 2, "0X") == 0) {
+    hex = hex.substr(2);
+  }
+
+  // At most 64 bits are decoded, wider strings are not integers.
+  if (hex.empty() || hex.size() > 16) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  unsigned long long value = 0;
+  for (const auto& c : hex) {
+    if (!isxdigit(static_cast<unsigned char>(c))) {
+      sqlite3_result_null(ctx);
+      return;
+    }
+    value = (value << 4) |
+            static_cast<unsigned long long>(
+                isdigit(static_cast<unsigned char>(c)) ? c - '0'
+                                                       : tolower(c) - 'a' + 10);
+  }
+  sqlite3_result_int64(ctx, static_cast<sqlite3_int64>(value));
+}
+
+/// Release a compiled pattern cached as SQLite auxiliary data.
+static void deleteRegex(void* pattern) {
+  delete static_cast<boost::regex*>(pattern);
+}
+
+/**
+ * @brief regex_match(STRING, PATTERN, INDEX): the INDEX-th capture of a match.
+ *
+ * Index 0 is the whole match. The compiled pattern is cached as auxiliary data
+ * for the life of the statement, so a constant pattern is compiled once per
+ * query instead of once per row. No match or missing group is NULL.
+ */
+static void sqliteRegexMatch(sqlite3_context* ctx,
+                             int argc,
+                             sqlite3_value** argv) {
+  auto input = textArgument(argv[0]);
+  auto pattern = textArgument(argv[1]);
+  if (input == nullptr || pattern == nullptr ||
+      sqlite3_value_type(argv[2]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  auto re = static_cast<boost::regex*>(sqlite3_get_auxdata(ctx, 1));
+  if (re == nullptr) {
+    try {
+      re = new boost::regex(pattern);
+    } catch (const boost::regex_error& e) {
+      auto error = std::string("Invalid regex: ") + e.what();
+      sqlite3_result_error(ctx, error.c_str(), -1);
+      return;
+    }
+    // SQLite owns the pattern and may release it immediately.
+    sqlite3_set_auxdata(ctx, 1, re, deleteRegex);
+    re = static_cast<boost::regex*>(sqlite3_get_auxdata(ctx, 1));
+    if (re == nullptr) {
+      sqlite3_result_error_nomem(ctx);
+      return;
+    }
+  }
+
+  auto index = sqlite3_value_int64(argv[2]);
+  boost::cmatch match;
+  if (!boost::regex_search(input, match, *re) || index < 0 ||
+      static_cast<size_t>(index) >= match.size() || !match[index].matched) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  auto group = match[index].str();
+  sqlite3_result_text(ctx, group.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+/// Split a version into its numeric and alphabetic parts.
+static std::vector<std::string> versionParts(const std::string& version) {
+  std::vector<std::string> parts;
+  std::string part;
+  for (const auto& c : version) {
+    auto digit = isdigit(static_cast<unsigned char>(c)) != 0;
+    auto alpha = isalpha(static_cast<unsigned char>(c)) != 0;
+    if (!digit && !alpha) {
+      // Punctuation such as '.', '-', and '_' only separates parts.
+      if (!part.empty()) {
+        parts.push_back(std::move(part));
+        part.clear();
+      }
+      continue;
+    }
+
+    if (!part.empty() &&
+        (isdigit(static_cast<unsigned char>(part.back())) != 0) != digit) {
+      parts.push_back(std::move(part));
+      part.clear();
+    }
+    part += c;
+  }
+
+  if (!part.empty()) {
+    parts.push_back(std::move(part));
+  }
+  return parts;
+}
+
+/// Compare two version parts, numbers by value and words lexically.
+static int compareVersionPart(const std::string& left,
+                              const std::string& right) {
+  auto left_digit = isdigit(static_cast<unsigned char>(left[0])) != 0;
+  auto right_digit = isdigit(static_cast<unsigned char>(right[0])) != 0;
+  if (left_digit && right_digit) {
+    auto l = left.find_first_not_of('0');
+    auto r = right.find_first_not_of('0');
+    auto lhs = (l == std::string::npos) ? std::string() : left.substr(l);
+    auto rhs = (r == std::string::npos) ? std::string() : right.substr(r);
+    if (lhs.size() != rhs.size()) {
+      return (lhs.size() < rhs.size()) ? -1 : 1;
+    }
+    auto c = lhs.compare(rhs);
+    return (c == 0) ? 0 : ((c < 0) ? -1 : 1);
+  } else if (left_digit != right_digit) {
+    // A number is newer than a word, such as "1.0.1" and "1.0.rc1".
+    return left_digit ? 1 : -1;
+  }
+  auto c = left.compare(right);
+  return (c == 0) ? 0 : ((c < 0) ? -1 : 1);
+}
+
+/**
+ * @brief version_compare(LEFT, RIGHT): -1, 0, or 1 as LEFT is older or newer.
+ *
+ * Versions are compared part by part, numbers by value and words lexically,
+ * so "1.10" is newer than "1.9". A version with more parts is newer.
+ */
+static void sqliteVersionCompare(sqlite3_context* ctx,
+                                 int argc,
+                                 sqlite3_value** argv) {
+  auto left = textArgument(argv[0]);
+  auto right = textArgument(argv[1]);
+  if (left == nullptr || right == nullptr) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  auto lhs = versionParts(left);
+  auto rhs = versionParts(right);
+  for (size_t i = 0; i < lhs.size() && i < rhs.size(); i++) {
+    auto c = compareVersionPart(lhs[i], rhs[i]);
+    if (c != 0) {
+      sqlite3_result_int(ctx, c);
+      return;
+    }
+  }
+
+  if (lhs.size() == rhs.size()) {
+    sqlite3_result_int(ctx, 0);
+  } else {
+    sqlite3_result_int(ctx, (lhs.size() < rhs.size()) ? -1 : 1);
+  }
+}
+
+/// A native SQL function and its argument count.
+/// The bits of a hash selecting an approx_count_distinct register.
+#define HLL_PRECISION 12
+
+/// The HyperLogLog registers, the standard error is 1.04 / sqrt(4096).
+const size_t kHLLRegisters = 1 << HLL_PRECISION;
+
+/// Hash a value with FNV-1a, finished with the MurmurHash3 mix.
+static uint64_t hashValue(const unsigned char* data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/**
+ * @brief Estimate the number of distinct values, approx_count_distinct(X).
+ *
+ * A HyperLogLog sketch of the text of each non-NULL value, so 1 and '1' are
+ * the same value. The sketch is the aggregate context, 4KB for each group.
+ */
+static void sqliteApproxDistinctStep(sqlite3_context* ctx,
+                                     int argc,
+                                     sqlite3_value** argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    return;
+  }
+  auto registers = static_cast<unsigned char*>(
+      sqlite3_aggregate_context(ctx, kHLLRegisters));
+  if (registers == nullptr) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+
+  auto text = sqlite3_value_text(argv[0]);
+  auto hash = hashValue(text, sqlite3_value_bytes(argv[0]));
+  auto index = hash >> (64 - HLL_PRECISION);
+
+  // The rank is the position of the first set bit after the register bits.
+  auto rest = (hash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1));
+  unsigned char rank = 1;
+  while ((rest & (1ULL << 63)) == 0) {
+    rank++;
+    rest <<= 1;
+  }
+  registers[index] = std::max(registers[index], rank);
+}
+
+static void sqliteApproxDistinctFinal(sqlite3_context* ctx) {
+  auto registers =
+      static_cast<unsigned char*>(sqlite3_aggregate_context(ctx, 0));
+  if (registers == nullptr) {
+    sqlite3_result_int64(ctx, 0);
+    return;
+  }
+
+  double m = kHLLRegisters;
+  double sum = 0;
+  size_t zeros = 0;
+  for (size_t i = 0; i < kHLLRegisters; i++) {
+    sum += std::ldexp(1.0, -registers[i]);
+    zeros += (registers[i] == 0) ? 1 : 0;
+  }
+  auto estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+  // Small counts are estimated from the empty registers, linear counting.
+  if (estimate <= 2.5 * m && zeros > 0) {
+    estimate = m * std::log(m / zeros);
+  }
+  sqlite3_result_int64(ctx, std::llround(estimate));
+}
+
+/// The samples an approx_quantile reservoir keeps.
+const size_t kReservoirSize = 1024;
+
+/// A uniform sample of the values of an approx_quantile group.
+struct Reservoir {
+  /// The number of values stepped.
+  size_t count;
+  /// The requested quantile, read with the first value.
+  double quantile;
+  /// The xorshift state choosing the replaced samples.
+  uint64_t state;
+  double samples[kReservoirSize];
+};
+
+/**
+ * @brief Estimate a quantile of the values, approx_quantile(X, Q).
+ *
+ * The quantile within [0, 1] is selected from a uniform reservoir sample of
+ * at most 1024 non-NULL values, exact for groups of up to 1024 values.
+ */
+static void sqliteApproxQuantileStep(sqlite3_context* ctx,
+                                     int argc,
+                                     sqlite3_value** argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    return;
+  }
+  auto reservoir = static_cast<Reservoir*>(
+      sqlite3_aggregate_context(ctx, sizeof(Reservoir)));
+  if (reservoir == nullptr) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+
+  if (reservoir->count == 0) {
+    auto quantile = sqlite3_value_double(argv[1]);
+    if (quantile < 0 || quantile > 1) {
+      sqlite3_result_error(ctx, "Quantile must be within 0 and 1", -1);
+      return;
+    }
+    reservoir->quantile = quantile;
+    reservoir->state = 0x9e3779b97f4a7c15ULL;
+  }
+
+  auto value = sqlite3_value_double(argv[0]);
+  if (reservoir->count < kReservoirSize) {
+    reservoir->samples[reservoir->count] = value;
+  } else {
+    // Algorithm R, the value replaces a sample with probability size/count.
+    auto& state = reservoir->state;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    auto replaced = state % (reservoir->count + 1);
+    if (replaced < kReservoirSize) {
+      reservoir->samples[replaced] = value;
+    }
+  }
+  reservoir->count++;
+}
+
+static void sqliteApproxQuantileFinal(sqlite3_context* ctx) {
+  auto reservoir = static_cast<Reservoir*>(sqlite3_aggregate_context(ctx, 0));
+  if (reservoir == nullptr || reservoir->count == 0) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  auto size = std::min(reservoir->count, kReservoirSize);
+  std::sort(reservoir->samples, reservoir->samples + size);
+  auto index = static_cast<size_t>(
+      std::llround(reservoir->quantile * static_cast<double>(size - 1)));
+  sqlite3_result_double(ctx, reservoir->samples[index]);
+}
+
+struct SQLiteFunction {
+  const char* name;
+  int arguments;
+  void (*function)(sqlite3_context*, int, sqlite3_value**);
+};
+
+const SQLiteFunction kSQLiteFunctions[] = {
+    {"in_cidr_block", 2, sqliteInCIDRBlock},
+    {"split", 3, sqliteSplit},
+    {"dirname", 1, sqliteDirname},
+    {"basename", 1, sqliteBasename},
+    {"hex_to_int", 1, sqliteHexToInt},
+    {"regex_match", 3, sqliteRegexMatch},
+    {"version_compare", 2, sqliteVersionCompare},
+};
+
+struct SQLiteAggregate {
+  const char* name;
+  int arguments;
+  void (*step)(sqlite3_context*, int, sqlite3_value**);
+  void (*final)(sqlite3_context*);
+};
+
+const SQLiteAggregate kSQLiteAggregates[] = {
+    {"approx_count_distinct",
+     1,
+     sqliteApproxDistinctStep,
+     sqliteApproxDistinctFinal},
+    {"approx_quantile", 2, sqliteApproxQuantileStep, sqliteApproxQuantileFinal},
+};
+
+void registerSQLFunctions(sqlite3* db) {
+  // Each function depends only on its arguments, the planner may factor it.
+  int flags = SQLITE_UTF8;
+#if defined(SQLITE_DETERMINISTIC)
+  flags |= SQLITE_DETERMINISTIC;
+#endif
+
+  for (const auto& function : kSQLiteFunctions) {
+    sqlite3_create_function(db,
+                            function.name,
+                            function.arguments,
+                            flags,
+                            nullptr,
+                            function.function,
+                            nullptr,
+                            nullptr);
+  }
+
+  for (const auto& aggregate : kSQLiteAggregates) {
+    sqlite3_create_function(db,
+                            aggregate.name,
+                            aggregate.arguments,
+                            SQLITE_UTF8,
+                            nullptr,
+                            nullptr,
+                            aggregate.step,
+                            aggregate.final);
+  }
+}
+}
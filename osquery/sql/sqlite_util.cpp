@@ -8,11 +8,17 @@
  *
  */
 
+#include <strings.h>
+
+#include <memory>
+#include <mutex>
+
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/flags.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/tracing.h"
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -28,8 +34,37 @@ FLAG(string,
      "Not Specified",
      "Comma-delimited list of table names to be disabled");
 
+FLAG(bool,
+     sqlite_temp_memory,
+     true,
+     "Keep SQLite sorters and temporary tables in memory");
+
+FLAG(uint64,
+     sqlite_heap_limit,
+     0,
+     "Soft limit of SQLite heap MB, 0 for 3/4 of the watchdog SQLite limit");
+
+FLAG(uint64,
+     sqlite_page_cache,
+     0,
+     "KB of SQLite page cache allocated at startup, 0 to use the heap");
+
+DECLARE_uint64(watchdog_sqlite_limit);
+
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
 
+/// The number of compiled statements each connection may cache.
+const size_t kStatementCacheSize = 256;
+
+/// Page cache slots hold pages of the default size.
+const int kSQLitePageSize = 4096;
+
+/// Schema changes retained for connections that have not applied them.
+const size_t kSchemaChangesMax = 1024;
+
+/// Page cache bytes a connection keeps between queries.
+const int kSQLiteCacheRelease = 4 * 1024 * 1024;
+
 /**
  * @brief A map of SQLite status codes to their corresponding message string
  *
@@ -129,13 +164,6 @@ std::string getStringForSQLiteReturnCode(int code) {
 }
 
 Status SQLiteSQLPlugin::attach(const std::string& name) {
-  // This may be the managed DB, or a transient.
-  auto dbc = SQLiteDBManager::get();
-  if (!dbc->isPrimary()) {
-    // Do not "reattach" to transient instance.
-    return Status(0, "OK");
-  }
-
   PluginResponse response;
   auto status =
       Registry::call("table", name, {{"action", "columns"}}, response);
@@ -143,37 +171,78 @@ Status SQLiteSQLPlugin::attach(const std::string& name) {
     return status;
   }
 
-  auto statement = columnDefinition(response);
-  return attachTableInternal(name, statement, dbc->db());
+  // Managed connections attach the table when they are next handed out.
+  SQLiteDBManager::updateSchema(name, true, hashRouteInfo(response));
+  return Status(0, "OK");
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
-  auto dbc = SQLiteDBManager::get();
-  if (!dbc->isPrimary()) {
-    return;
-  }
-  detachTableInternal(name, dbc->db());
+  SQLiteDBManager::updateSchema(name, false);
+}
+
+/**
+ * @brief Configure the SQLite library before the first connection opens.
+ *
+ * Connections are owned by one thread at a time, the primary by its lock and
+ * the others by the pool, so SQLite's per-connection mutexes are not needed.
+ * The soft heap limit makes SQLite release cached pages before the watchdog
+ * restarts the worker for its SQLite memory.
+ */
+static void configureSQLite() {
+  static std::once_flag configured;
+  std::call_once(configured, []() {
+    if (sqlite3_threadsafe() != 0) {
+      sqlite3_config(SQLITE_CONFIG_MULTITHREAD);
+    }
+
+    if (FLAGS_sqlite_page_cache > 0) {
+      // Each slot holds a page and SQLite's header for it.
+      int header = 0;
+      sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header);
+      auto size = kSQLitePageSize + header;
+      auto count = static_cast<int>(FLAGS_sqlite_page_cache * 1024 / size);
+      // The arena is used until the process exits.
+      static std::unique_ptr<char[]> arena(new char[size * count]);
+      sqlite3_config(SQLITE_CONFIG_PAGECACHE, arena.get(), size, count);
+    }
+    sqlite3_initialize();
+
+    auto limit = FLAGS_sqlite_heap_limit;
+    if (limit == 0) {
+      limit = FLAGS_watchdog_sqlite_limit / 4 * 3;
+    }
+    if (limit > 0) {
+      sqlite3_soft_heap_limit64(static_cast<sqlite3_int64>(limit) * 1024 *
+                                1024);
+    }
+  });
 }
 
-SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, std::mutex& mtx)
+SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, SQLiteMutex& mtx)
     : db_(db), lock_(mtx, std::try_to_lock) {
   if (lock_.owns_lock()) {
     primary_ = true;
+    SQLiteDBManager::applySchema(db_);
   } else {
-    db_ = nullptr;
-    VLOG(1) << "DBManager contention: opening transient SQLite database";
-    init();
+    pooled_ = true;
+    db_ = SQLiteDBManager::acquire();
   }
 }
 
 void SQLiteDBInstance::init() {
   primary_ = false;
+  configureSQLite();
   sqlite3_open(":memory:", &db_);
-  attachVirtualTables(db_);
+  SQLiteDBManager::setupConnection(db_);
 }
 
 SQLiteDBInstance::~SQLiteDBInstance() {
-  if (!primary_) {
+  if (pooled_) {
+    SQLiteDBManager::release(db_);
+    db_ = nullptr;
+  } else if (!primary_) {
+    // Statements must be finalized before the connection may close.
+    SQLiteDBManager::resetStatements(db_);
     sqlite3_close(db_);
   } else {
     db_ = nullptr;
@@ -196,26 +265,325 @@ SQLiteDBInstanceRef SQLiteDBManager::getUnique() {
 }
 
 SQLiteDBInstanceRef SQLiteDBManager::get() {
+  TRACE_SCOPE("sql.SQLiteDBManager.get");
   auto& self = instance();
-  std::unique_lock<std::mutex> lock(self.create_mutex_);
+  std::unique_lock<SQLiteMutex> lock(self.create_mutex_);
 
   if (self.db_ == nullptr) {
     // Create primary SQLite DB instance.
-    sqlite3_open(":memory:", &self.db_);
-    attachVirtualTables(self.db_);
+    self.db_ = self.open();
   }
 
   return std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
 }
 
+void SQLiteDBManager::prewarm() {
+  auto& self = instance();
+  {
+    std::unique_lock<SQLiteMutex> lock(self.create_mutex_);
+    if (self.db_ == nullptr) {
+      self.db_ = self.open();
+    }
+  }
+
+  // The primary connection serves one caller, the pool serves the others.
+  while (true) {
+    {
+      std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+      if (self.idle_.size() + 1 >= self.pool_size_) {
+        return;
+      }
+    }
+    release(self.open());
+  }
+}
+
+sqlite3* SQLiteDBManager::open() {
+  size_t version = 0;
+  {
+    // Changes recorded while attaching are applied on the next checkout.
+    std::lock_guard<SQLiteMutex> lock(pool_mutex_);
+    version = schemaVersion();
+  }
+
+  sqlite3* db = nullptr;
+  configureSQLite();
+  sqlite3_open(":memory:", &db);
+  setupConnection(db);
+
+  std::lock_guard<SQLiteMutex> lock(pool_mutex_);
+  versions_[db] = version;
+  return db;
+}
+
+sqlite3* SQLiteDBManager::acquire() {
+  auto& self = instance();
+  sqlite3* db = nullptr;
+  {
+    std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+    if (!self.idle_.empty()) {
+      db = self.idle_.back();
+      self.idle_.pop_back();
+    }
+  }
+
+  if (db == nullptr) {
+    VLOG(1) << "DBManager contention: opening pooled SQLite database";
+    db = self.open();
+  }
+
+  applySchema(db);
+  return db;
+}
+
+void SQLiteDBManager::release(sqlite3* db) {
+  auto& self = instance();
+  {
+    std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+    if (self.idle_.size() < self.pool_size_) {
+      self.idle_.push_back(db);
+      return;
+    }
+    self.versions_.erase(db);
+    self.pruneSchema();
+  }
+
+  // The pool is full, this connection was only needed during contention.
+  resetStatements(db);
+  sqlite3_close(db);
+}
+
+void SQLiteDBManager::updateSchema(const std::string& name,
+                                   bool attach,
+                                   size_t definition) {
+  auto& self = instance();
+  std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+  if (attach) {
+    self.detached_.erase(name);
+    auto attached = self.definitions_.find(name);
+    if (attached == self.definitions_.end() ||
+        (definition != 0 && attached->second == definition)) {
+      // Connections attach the table when used, or keep the same columns.
+      return;
+    }
+  } else {
+    self.detached_.insert(name);
+  }
+  self.schema_.push_back(std::make_pair(name, attach));
+  self.columns_.erase(name);
+  self.pruneSchema();
+}
+
+bool SQLiteDBManager::isDetached(const std::string& name) {
+  auto& self = instance();
+  std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+  return self.detached_.count(name) > 0;
+}
+
+Status SQLiteDBManager::getColumns(const std::string& name,
+                                   PluginResponse& response) {
+  auto& self = instance();
+  auto plugin = Registry::getLocal<Plugin>("table", name);
+  size_t version = 0;
+  {
+    std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+    auto cached = self.columns_.find(name);
+    if (cached != self.columns_.end() &&
+        cached->second.local == (plugin != nullptr) &&
+        cached->second.plugin.lock() == plugin) {
+      response = cached->second.columns;
+      return Status(0, "OK");
+    }
+    version = self.schemaVersion();
+  }
+
+  response.clear();
+  auto status =
+      Registry::call("table", name, {{"action", "columns"}}, response);
+  if (!status.ok() || response.empty()) {
+    return status;
+  }
+
+  std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+  // The caller attaches these columns, even if they are already stale.
+  self.definitions_[name] = hashRouteInfo(response);
+  // Columns requested across a schema change may already be stale.
+  if (self.schemaVersion() == version) {
+    auto& cache = self.columns_[name];
+    cache.local = (plugin != nullptr);
+    cache.plugin = plugin;
+    cache.columns = response;
+  }
+  return status;
+}
+
+/// The virtual tables attached to the temp schema of a connection.
+static std::vector<std::string> getAttachedTables(sqlite3* db) {
+  std::vector<std::string> tables;
+  sqlite3_stmt* stmt = nullptr;
+  auto rc = sqlite3_prepare_v2(
+      db,
+      "SELECT name FROM sqlite_temp_master WHERE type = 'table' AND "
+      "sql LIKE 'CREATE VIRTUAL TABLE%'",
+      -1,
+      &stmt,
+      nullptr);
+  if (rc != SQLITE_OK || stmt == nullptr) {
+    return tables;
+  }
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto name = sqlite3_column_text(stmt, 0);
+    tables.push_back(reinterpret_cast<const char*>(name));
+  }
+  sqlite3_finalize(stmt);
+  return tables;
+}
+
+void SQLiteDBManager::applySchema(sqlite3* db) {
+  auto& self = instance();
+  std::vector<std::string> changes;
+  bool pruned = false;
+  {
+    std::lock_guard<SQLiteMutex> lock(self.pool_mutex_);
+    auto& version = self.versions_[db];
+    if (version >= self.schemaVersion()) {
+      return;
+    }
+    if (version < self.schema_base_) {
+      // Changes this connection did not apply were forgotten.
+      pruned = true;
+    } else {
+      auto first = self.schema_.begin() + (version - self.schema_base_);
+      for (auto it = first; it != self.schema_.end(); ++it) {
+        changes.push_back(it->first);
+      }
+    }
+    version = self.schemaVersion();
+    self.pruneSchema();
+  }
+
+  // The caller owns the connection, apply changes without the pool lock.
+  // A changed table is attached again, with its new columns, when next used.
+  if (pruned) {
+    changes = getAttachedTables(db);
+  }
+  for (const auto& name : changes) {
+    detachTableInternal(name, db);
+  }
+}
+
+void SQLiteDBManager::pruneSchema() {
+  auto oldest = schemaVersion();
+  for (const auto& version : versions_) {
+    oldest = std::min(oldest, version.second);
+  }
+
+  // A connection idle across many changes detaches every table instead.
+  if (schema_.size() > kSchemaChangesMax) {
+    oldest = std::max(oldest, schemaVersion() - kSchemaChangesMax);
+  }
+  if (oldest > schema_base_) {
+    schema_.erase(schema_.begin(), schema_.begin() + (oldest - schema_base_));
+    schema_base_ = oldest;
+  }
+}
+
+Status SQLiteDBManager::getStatement(sqlite3* db,
+                                     const std::string& query,
+                                     sqlite3_stmt*& stmt) {
+  auto& self = instance();
+  stmt = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(self.statements_mutex_);
+    auto& cache = self.statements_[db];
+    if (cache.generation != self.generation_ ||
+        cache.statements.size() >= kStatementCacheSize) {
+      // The connection is owned by the caller, no statement is stepping.
+      for (auto& statement : cache.statements) {
+        sqlite3_finalize(statement.second);
+      }
+      cache.statements.clear();
+      cache.generation = self.generation_;
+    }
+
+    auto it = cache.statements.find(query);
+    if (it != cache.statements.end()) {
+      stmt = it->second;
+      return Status(0, "OK");
+    }
+  }
+
+  // Compiling may create virtual table cursors, do not hold the cache lock.
+  const char* tail = nullptr;
+  auto rc = prepareStatement(
+      db, query.c_str(), static_cast<int>(query.size() + 1), &stmt, &tail);
+  if (rc != SQLITE_OK) {
+    if (stmt != nullptr) {
+      sqlite3_finalize(stmt);
+      stmt = nullptr;
+    }
+    return Status(1, sqlite3_errmsg(db));
+  }
+
+  while (tail != nullptr && *tail != 0 && (isspace(*tail) || *tail == ';')) {
+    tail++;
+  }
+
+  if (stmt == nullptr || (tail != nullptr && *tail != 0)) {
+    // Empty and multi-statement queries are not cached.
+    if (stmt != nullptr) {
+      sqlite3_finalize(stmt);
+      stmt = nullptr;
+    }
+    return Status(0, "OK");
+  }
+
+  std::lock_guard<std::mutex> lock(self.statements_mutex_);
+  self.statements_[db].statements[query] = stmt;
+  return Status(0, "OK");
+}
+
+void SQLiteDBManager::resetStatements(sqlite3* db) {
+  auto& self = instance();
+  std::lock_guard<std::mutex> lock(self.statements_mutex_);
+  auto cache = self.statements_.find(db);
+  if (cache == self.statements_.end()) {
+    return;
+  }
+
+  for (auto& statement : cache->second.statements) {
+    sqlite3_finalize(statement.second);
+  }
+  self.statements_.erase(cache);
+}
+
+void SQLiteDBManager::resetStatements() {
+  // Connections may be in use, each cache is finalized by its owner.
+  instance().generation_++;
+}
+
 SQLiteDBManager::~SQLiteDBManager() {
+  for (auto& cache : statements_) {
+    for (auto& statement : cache.second.statements) {
+      sqlite3_finalize(statement.second);
+    }
+  }
+  statements_.clear();
+
+  for (auto& db : idle_) {
+    sqlite3_close(db);
+  }
+  idle_.clear();
+
   if (db_ != nullptr) {
     sqlite3_close(db_);
     db_ = nullptr;
   }
 }
 
-QueryPlanner::QueryPlanner(const std::string& query, sqlite3* db) {
+QueryPlanner::QueryPlanner(const std::string& query, sqlite3* db)
+    : query_(query), db_(db) {
   QueryData plan;
   queryInternal("EXPLAIN QUERY PLAN " + query, plan, db);
   queryInternal("EXPLAIN " + query, program_, db);
@@ -262,6 +630,74 @@ Status QueryPlanner::applyTypes(TableColumns& columns) {
   return Status(0);
 }
 
+bool QueryPlanner::hasAggregate() const {
+  for (const auto& row : program_) {
+    // AggStep, AggStep0, AggFinal and the window function opcodes.
+    auto opcode = row.find("opcode");
+    if (opcode != row.end() && opcode->second.compare(0, 3, "Agg") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status QueryPlanner::getScans(std::vector<TableScan>& scans) {
+  std::vector<VirtualTableContent*> contents;
+  return getScans(scans, contents);
+}
+
+Status QueryPlanner::getScans(std::vector<TableScan>& scans,
+                              std::vector<VirtualTableContent*>& contents) {
+  // Compile without the statement cache, a cached plan skips xBestIndex.
+  auto explain = "EXPLAIN QUERY PLAN " + query_;
+  std::map<int, TableScan> offered;
+  std::map<int, VirtualTableContent*> tables;
+  sqlite3_stmt* stmt = nullptr;
+  setPlanRecorder(&offered, &tables);
+  auto rc = prepareStatement(db_,
+                             explain.c_str(),
+                             static_cast<int>(explain.size() + 1),
+                             &stmt,
+                             nullptr);
+  setPlanRecorder(nullptr, nullptr);
+  if (rc != SQLITE_OK || stmt == nullptr) {
+    if (stmt != nullptr) {
+      sqlite3_finalize(stmt);
+    }
+    return Status(1, sqlite3_errmsg(db_));
+  }
+
+  // The detail column names the index number of a virtual table's plan.
+  static const std::string kVirtualIndex = "VIRTUAL TABLE INDEX ";
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto text = sqlite3_column_text(stmt, sqlite3_column_count(stmt) - 1);
+    if (text == nullptr) {
+      continue;
+    }
+    std::string detail(reinterpret_cast<const char*>(text));
+    auto position = detail.find(kVirtualIndex);
+    if (position == std::string::npos) {
+      continue;
+    }
+    auto index = strtol(
+        detail.c_str() + position + kVirtualIndex.size(), nullptr, 10);
+    auto scan = offered.find(static_cast<int>(index));
+    if (scan != offered.end()) {
+      scans.push_back(scan->second);
+      contents.push_back(tables[scan->first]);
+    }
+  }
+  sqlite3_finalize(stmt);
+  return Status(0, "OK");
+}
+
+Status getQueryScansInternal(const std::string& q,
+                             std::vector<TableScan>& scans,
+                             sqlite3* db) {
+  QueryPlanner planner(q, db);
+  return planner.getScans(scans);
+}
+
 int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
   if (argument == nullptr) {
     VLOG(1) << "Query execution failed: received a bad callback argument";
@@ -279,25 +715,198 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
   return 0;
 }
 
-Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
-  char* err = nullptr;
-  sqlite3_exec(db, q.c_str(), queryDataCallback, &results, &err);
-  sqlite3_db_release_memory(db);
-  if (err != nullptr) {
-    auto error_string = std::string(err);
-    sqlite3_free(err);
-    return Status(1, "Error running query: " + error_string);
+/// Tables introspected by a PRAGMA compiled on this thread.
+static thread_local std::vector<std::string> kPragmaTables;
+
+/// Record the tables a PRAGMA introspects, which SQLite never reports missing.
+static int pragmaAuthorizer(void* data,
+                            int action,
+                            const char* pragma,
+                            const char* argument,
+                            const char* schema,
+                            const char* trigger) {
+  if (action == SQLITE_PRAGMA && pragma != nullptr && argument != nullptr &&
+      (strcasecmp(pragma, "table_info") == 0 ||
+       strcasecmp(pragma, "table_xinfo") == 0)) {
+    kPragmaTables.push_back(argument);
+  }
+  return SQLITE_OK;
+}
+
+void SQLiteDBManager::setupConnection(sqlite3* db) {
+  registerSQLFunctions(db);
+  if (FLAGS_sqlite_temp_memory) {
+    // Large sorts and GROUP BYs do not spill to temporary files.
+    sqlite3_exec(db, "PRAGMA temp_store = MEMORY", nullptr, nullptr, nullptr);
+  }
+  // Setting an authorizer expires compiled statements, set it once.
+  sqlite3_set_authorizer(db, pragmaAuthorizer, nullptr);
+}
+
+int prepareStatement(sqlite3* db,
+                     const char* sql,
+                     int bytes,
+                     sqlite3_stmt** stmt,
+                     const char** tail) {
+  kPragmaTables.clear();
+  auto rc = sqlite3_prepare_v2(db, sql, bytes, stmt, tail);
+  // Each attached table may reveal the next missing table of the statement.
+  while (rc != SQLITE_OK && attachMissingTable(db)) {
+    if (*stmt != nullptr) {
+      sqlite3_finalize(*stmt);
+      *stmt = nullptr;
+    }
+    rc = sqlite3_prepare_v2(db, sql, bytes, stmt, tail);
   }
 
+  if (rc == SQLITE_OK && !kPragmaTables.empty()) {
+    // A PRAGMA is evaluated while compiling, attach its tables and compile.
+    auto tables = std::move(kPragmaTables);
+    kPragmaTables.clear();
+    bool attached = false;
+    for (const auto& table : tables) {
+      attached = attachRegisteredTable(db, table) || attached;
+    }
+
+    if (attached) {
+      sqlite3_finalize(*stmt);
+      *stmt = nullptr;
+      rc = sqlite3_prepare_v2(db, sql, bytes, stmt, tail);
+    }
+  }
+  return rc;
+}
+
+/**
+ * @brief Step a compiled statement and pass each result row to a callback.
+ *
+ * Stepping ends when the callback returns false, then cancelled is set.
+ */
+static Status stepRows(sqlite3_stmt* stmt,
+                       const RowCallback& callback,
+                       bool& cancelled,
+                       sqlite3* db) {
+  // Column names are stable for the life of the compiled statement.
+  RowKeys columns;
+  auto count = sqlite3_column_count(stmt);
+  for (int i = 0; i < count; i++) {
+    auto name = sqlite3_column_name(stmt, i);
+    if (name != nullptr) {
+      columns.add(i, name);
+    }
+  }
+
+  int rc = SQLITE_OK;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    auto r = columns.build([stmt](size_t i, RowData& field) {
+      // Read each value in place with its length, NULL becomes empty.
+      auto value = sqlite3_column_text(stmt, i);
+      if (value != nullptr) {
+        field.assign(reinterpret_cast<const char*>(value),
+                     sqlite3_column_bytes(stmt, i));
+      }
+    });
+    if (!callback(r)) {
+      cancelled = true;
+      return Status(0, "OK");
+    }
+  }
+
+  if (rc != SQLITE_DONE) {
+    return Status(1, std::string("Error running query: ") +
+                         sqlite3_errmsg(db));
+  }
   return Status(0, "OK");
 }
 
+/// Release a connection's page cache once it grows beyond kSQLiteCacheRelease.
+static void releaseMemory(sqlite3* db) {
+  // Releasing after every query would drop the pages the next query reuses.
+  int used = 0;
+  int highwater = 0;
+  if (sqlite3_db_status(
+          db, SQLITE_DBSTATUS_CACHE_USED, &used, &highwater, 0) == SQLITE_OK &&
+      used > kSQLiteCacheRelease) {
+    sqlite3_db_release_memory(db);
+  }
+}
+
+/// Run a non-cacheable query text, which may contain several statements.
+static Status execInternal(const std::string& q,
+                           const RowCallback& callback,
+                           sqlite3* db) {
+  Status status(0, "OK");
+  bool cancelled = false;
+  const char* sql = q.c_str();
+  while (sql != nullptr && *sql != 0 && !cancelled) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    if (prepareStatement(db, sql, -1, &stmt, &tail) != SQLITE_OK) {
+      status = Status(1, std::string("Error running query: ") +
+                             sqlite3_errmsg(db));
+      break;
+    }
+
+    if (stmt != nullptr) {
+      // Statements run in order and the first failure stops the text.
+      status = stepRows(stmt, callback, cancelled, db);
+      sqlite3_finalize(stmt);
+      if (!status.ok()) {
+        break;
+      }
+    }
+    sql = tail;
+  }
+
+  releaseMemory(db);
+  return status;
+}
+
+Status queryInternal(const std::string& q,
+                     const RowCallback& callback,
+                     sqlite3* db) {
+  sqlite3_stmt* stmt = nullptr;
+  auto status = SQLiteDBManager::getStatement(db, q, stmt);
+  if (!status.ok()) {
+    return Status(1, "Error running query: " + status.getMessage());
+  }
+
+  if (stmt == nullptr) {
+    return execInternal(q, callback, db);
+  }
+
+  bool cancelled = false;
+  {
+    // Tables share resources, such as a process snapshot, until the end.
+    QueryResources resources;
+    // Independent table scans are generated while the statement steps.
+    TablePrefetch prefetch(q, db);
+    status = stepRows(stmt, callback, cancelled, db);
+  }
+
+  // Reset the statement for the next execution on this connection, this
+  // also ends a cancelled scan and releases its table cursors.
+  sqlite3_reset(stmt);
+  releaseMemory(db);
+  return status;
+}
+
+Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
+  return queryInternal(q,
+                       [&results](Row& row) {
+                         results.push_back(std::move(row));
+                         return true;
+                       },
+                       db);
+}
+
 Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db) {
   // Turn the query into a prepared statement
   sqlite3_stmt* stmt{nullptr};
-  auto rc = sqlite3_prepare_v2(db, q.c_str(), q.length() + 1, &stmt, nullptr);
+  auto rc = prepareStatement(
+      db, q.c_str(), static_cast<int>(q.length() + 1), &stmt, nullptr);
   if (rc != SQLITE_OK || stmt == nullptr) {
     if (stmt != nullptr) {
       sqlite3_finalize(stmt);
@@ -10,10 +10,15 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -25,6 +30,11 @@
 
 namespace osquery {
 
+struct VirtualTableContent;
+
+/// The SQLite manager locks report their contention in osquery_locks.
+using SQLiteMutex = InstrumentedMutex<std::mutex>;
+
 /**
  * @brief An RAII wrapper around an `sqlite3` object.
  *
@@ -33,18 +43,21 @@ namespace osquery {
  * database is needed during the life of an osquery tool.
  *
  * If there is resource contention (multiple threads want access to the SQLite
- * abstraction layer), then the SQLiteDBManager will provide a transient
- * SQLiteDBInstance.
+ * abstraction layer), then the SQLiteDBManager will provide a pooled
+ * SQLiteDBInstance, which returns its connection to the pool when destroyed.
  */
 class SQLiteDBInstance : private boost::noncopyable {
  public:
   SQLiteDBInstance() { init(); }
-  SQLiteDBInstance(sqlite3*& db, std::mutex& mtx);
+  SQLiteDBInstance(sqlite3*& db, SQLiteMutex& mtx);
   ~SQLiteDBInstance();
 
   /// Check if the instance is the osquery primary.
   bool isPrimary() const { return primary_; }
 
+  /// Check if the instance borrowed a connection from the manager's pool.
+  bool isPooled() const { return pooled_; }
+
   /// Generate a new 'transient' connection.
   void init();
 
@@ -58,11 +71,14 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Introspection into the database pointer, primary means managed.
   bool primary_{false};
 
+  /// The database is owned by the manager's connection pool.
+  bool pooled_{false};
+
   /// Either the managed primary database or an ephemeral instance.
   sqlite3* db_{nullptr};
 
   /// An attempted unique lock on the manager's primary database access mutex.
-  std::unique_lock<std::mutex> lock_;
+  std::unique_lock<SQLiteMutex> lock_;
 };
 
 /**
@@ -84,24 +100,34 @@ class SQLiteDBManager : private boost::noncopyable {
    *
    * An osquery database is basically just a SQLite3 database with several
    * virtual tables attached. This method is the main abstraction for accessing
-   * SQLite3 databases within osquery.
+   * SQLite3 databases within osquery. Tables are attached to a connection the
+   * first time one of its statements references them, see prepareStatement.
    *
    * A RAII wrapper around the `sqlite3` database will manage attaching tables
    * and freeing resources when the instance (connection per-say) goes out of
    * scope. Using the SQLiteDBManager will also try to optimize the number of
    * `sqlite3` databases in use by managing a single global instance and
-   * returning resource-safe transient databases if there's access contention.
+   * returning resource-safe pooled databases if there's access contention.
+   * Pooled databases stay attached and are reused, up to the number of cores.
    *
    * Note: osquery::initOsquery must be called before calling `get` in order
    * for virtual tables to be registered.
    *
-   * @return a SQLiteDBInstance with all virtual tables attached.
+   * @return a SQLiteDBInstance that resolves every registered virtual table.
    */
   static std::shared_ptr<SQLiteDBInstance> get();
 
   /// See `get` but always return a transient DB connection (for testing).
   static std::shared_ptr<SQLiteDBInstance> getUnique();
 
+  /**
+   * @brief Open the primary and pooled connections before they are needed.
+   *
+   * A standby worker opens its connections while it waits, so the first
+   * scheduled queries do not pay for opening them.
+   */
+  static void prewarm();
+
   /**
    * @brief Check if `table_name` is disabled.
    *
@@ -116,28 +142,172 @@ class SQLiteDBManager : private boost::noncopyable {
   /// When the primary SQLiteDBInstance is destructed it will unlock.
   static void unlock();
 
+  /**
+   * @brief Return a prepared statement for a query on a connection.
+   *
+   * Statements are compiled once per connection and query text and reused for
+   * every later execution. The caller must own the connection and reset the
+   * statement before releasing it. A query text containing more than one
+   * statement is not cached and `stmt` is set to nullptr.
+   *
+   * @param db The connection that will step the statement.
+   * @param query The query text, used as the cache key.
+   * @param stmt [output] The cached statement or nullptr.
+   * @return Failure if the query could not be compiled.
+   */
+  static Status getStatement(sqlite3* db,
+                             const std::string& query,
+                             sqlite3_stmt*& stmt);
+
+  /// Finalize the cached statements for a connection owned by the caller.
+  static void resetStatements(sqlite3* db);
+
+  /// Invalidate every connection's cached statements before their next use.
+  static void resetStatements();
+
+  /**
+   * @brief Record a table registration change for managed connections.
+   *
+   * The primary and pooled connections apply schema changes the next time
+   * they are handed out, so a registration attaches only the changed table
+   * to existing connections instead of every table to new connections.
+   *
+   * A registered table whose definition hash matches the columns a
+   * connection may have attached, or that no connection has attached, is
+   * not a change. Extensions re-registering hundreds of unchanged tables do
+   * not detach them from every connection.
+   *
+   * @param name The virtual table name.
+   * @param attach True if the table was registered, false if removed.
+   * @param definition The hashRouteInfo of the registered columns.
+   */
+  static void updateSchema(const std::string& name,
+                           bool attach,
+                           size_t definition = 0);
+
+  /// Check if a table was detached and not attached again since.
+  static bool isDetached(const std::string& name);
+
+  /// Install functions and the PRAGMA table resolver on a new connection.
+  static void setupConnection(sqlite3* db);
+
+  /**
+   * @brief Get a table's "columns" route, cached until the table changes.
+   *
+   * Every connection attaching a table needs its column definition. Extension
+   * tables answer with a Thrift call, so each route is requested once and kept
+   * until a schema change for the table or a new local plugin of that name.
+   *
+   * @param name The virtual table name.
+   * @param response [output] The table's column details.
+   * @return Failure if the table did not answer its columns action.
+   */
+  static Status getColumns(const std::string& name, PluginResponse& response);
+
  protected:
   SQLiteDBManager() : db_(nullptr) {
     sqlite3_soft_heap_limit64(SQLITE_SOFT_HEAP_LIMIT);
     disabled_tables_ = parseDisableTablesFlag(Flag::getValue("disable_tables"));
+    pool_size_ = std::max<size_t>(1, std::thread::hardware_concurrency());
   }
   SQLiteDBManager(SQLiteDBManager const&);
   SQLiteDBManager& operator=(SQLiteDBManager const&);
   virtual ~SQLiteDBManager();
 
+ private:
+  /// Open a new managed connection at the current schema version.
+  sqlite3* open();
+
+  /// Borrow an idle pooled connection or open a new one.
+  static sqlite3* acquire();
+
+  /// Return a pooled connection, closing it if the pool is full.
+  static void release(sqlite3* db);
+
+  /// Detach tables changed since the connection's version.
+  static void applySchema(sqlite3* db);
+
+  /// The version after the latest schema change, the pool lock is held.
+  size_t schemaVersion() const { return schema_base_ + schema_.size(); }
+
+  /// Forget changes every connection applied, the pool lock is held.
+  void pruneSchema();
+
  private:
   /// Primary (managed) sqlite3 database.
   sqlite3* db_{nullptr};
 
   /// Mutex and lock around sqlite3 access.
-  std::mutex mutex_;
+  SQLiteMutex mutex_{"sqlite_primary"};
 
   /// A write mutex for initializing the primary database.
-  std::mutex create_mutex_;
+  SQLiteMutex create_mutex_{"sqlite_create"};
 
   /// Member variable to hold set of disabled tables.
   std::unordered_set<std::string> disabled_tables_;
 
+  /// Prepared statements compiled for a single connection.
+  struct StatementCache {
+    /// The invalidation generation the statements were compiled within.
+    size_t generation{0};
+
+    /// Statements keyed by their query text.
+    std::map<std::string, sqlite3_stmt*> statements;
+  };
+
+  /// Lazily-filled statement caches for each connection.
+  std::map<sqlite3*, StatementCache> statements_;
+
+  /// Protect the statement cache map, statements are owned by connections.
+  std::mutex statements_mutex_;
+
+  /// Incremented to invalidate all statement caches.
+  std::atomic<size_t> generation_{0};
+
+  /// Idle pooled connections, keeping the tables they attached.
+  std::vector<sqlite3*> idle_;
+
+  /// The maximum number of idle pooled connections.
+  size_t pool_size_{1};
+
+  /// The schema version applied by each managed connection.
+  std::map<sqlite3*, size_t> versions_;
+
+  /// Ordered table attach (true) and detach (false) changes not yet applied
+  /// by every connection, at most kSchemaChangesMax.
+  std::deque<std::pair<std::string, bool>> schema_;
+
+  /// The version of the first retained schema change.
+  size_t schema_base_{0};
+
+  /// A table's column route and the local plugin that answered it.
+  struct ColumnCache {
+    /// True if a local plugin answered, rather than an extension.
+    bool local{false};
+
+    /// The local plugin, a replaced plugin must answer again.
+    std::weak_ptr<Plugin> plugin;
+
+    /// The "columns" route response.
+    PluginResponse columns;
+  };
+
+  /// Tables detached by a schema change, they are not attached on reference.
+  std::unordered_set<std::string> detached_;
+
+  /// Cached column routes for each table name.
+  std::map<std::string, ColumnCache> columns_;
+
+  /// The hashRouteInfo of the columns each table was last attached with.
+  std::map<std::string, size_t> definitions_;
+
+  /// Protect the pool, schema versions, detached tables, column routes, and
+  /// table definitions.
+  SQLiteMutex pool_mutex_{"sqlite_pool"};
+
+ private:
+  friend class SQLiteDBInstance;
+
   /// Parse a comma-delimited set of tables names, passed in as a flag.
   std::unordered_set<std::string> parseDisableTablesFlag(const std::string& s);
 };
@@ -172,6 +342,28 @@ class QueryPlanner : private boost::noncopyable {
    */
   Status applyTypes(TableColumns& columns);
 
+  /**
+   * @brief Plan the query again and collect its virtual table scans.
+   *
+   * Each scan has the cost and constraints of the plan xBestIndex offered
+   * and SQLite chose. A query should not full-scan an expensive table.
+   *
+   * @param scans the virtual table scans, in the order they are planned.
+   * @return success if the query was planned.
+   */
+  Status getScans(std::vector<TableScan>& scans);
+
+  /**
+   * @brief See getScans, also collect the virtual table of each scan.
+   *
+   * @param contents the connection's content of each scanned virtual table.
+   */
+  Status getScans(std::vector<TableScan>& scans,
+                  std::vector<VirtualTableContent*>& contents);
+
+  /// Check if the program computes an aggregate function.
+  bool hasAggregate() const;
+
   /**
    * @brief A helper structure to represent an opcode's result and type.
    *
@@ -199,6 +391,10 @@ class QueryPlanner : private boost::noncopyable {
   };
 
  private:
+  /// The planned query and connection.
+  std::string query_;
+  sqlite3* db_{nullptr};
+
   /// The results of EXPLAIN q.
   QueryData program_;
   /// The order of tables scanned.
@@ -223,6 +419,47 @@ extern const std::map<std::string, QueryPlanner::Opcode> kSQLOpcodes;
  */
 Status queryInternal(const std::string& q, QueryData& results, sqlite3* db);
 
+/**
+ * @brief SQLite Internal: Execute a query and stream rows to a callback
+ *
+ * Each row is passed to the callback as SQLite steps it. When the callback
+ * returns false no more rows are stepped and the status is OK, the rows that
+ * were not read are never generated by streaming virtual tables.
+ *
+ * @param q the query to execute
+ * @param callback A RowCallback, return false to stop reading rows
+ * @param db the SQLite3 database to execute query q against
+ *
+ * @return A status indicating SQL query results.
+ */
+Status queryInternal(const std::string& q,
+                     const RowCallback& callback,
+                     sqlite3* db);
+
+/**
+ * @brief Install osquery's native SQL functions on a connection.
+ *
+ * Queries filter and transform table output with these instead of generators
+ * computing every derived string: in_cidr_block, split, dirname, basename,
+ * hex_to_int, regex_match, and version_compare.
+ */
+void registerSQLFunctions(sqlite3* db);
+
+/**
+ * @brief Compile a statement, attaching the osquery tables it references.
+ *
+ * Connections do not attach every registered table when they are opened.
+ * When SQLite cannot find a table that is registered it is attached and the
+ * statement is compiled again. The arguments match sqlite3_prepare_v2.
+ *
+ * @return The SQLite return code of the last compile.
+ */
+int prepareStatement(sqlite3* db,
+                     const char* sql,
+                     int bytes,
+                     sqlite3_stmt** stmt,
+                     const char** tail);
+
 /**
  * @brief SQLite Intern: Analyze a query, providing information about the
  * result columns
@@ -242,6 +479,19 @@ Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db);
 
+/**
+ * @brief SQLite Intern: Plan a query and return its virtual table scans
+ *
+ * @param q the query to plan
+ * @param scans the virtual table scans SQLite chose
+ * @param db the SQLite3 database to plan the query with
+ *
+ * @return status indicating success or failure of the operation
+ */
+Status getQueryScansInternal(const std::string& q,
+                             std::vector<TableScan>& scans,
+                             sqlite3* db);
+
 /// The SQLiteSQLPlugin implements the "sql" registry for internal/core.
 class SQLiteSQLPlugin : SQLPlugin {
  public:
@@ -250,15 +500,29 @@ class SQLiteSQLPlugin : SQLPlugin {
     return queryInternal(q, results, dbc->db());
   }
 
+  Status query(const std::string& q, const RowCallback& callback) const {
+    auto dbc = SQLiteDBManager::get();
+    return queryInternal(q, callback, dbc->db());
+  }
+
   Status getQueryColumns(const std::string& q, TableColumns& columns) const {
     auto dbc = SQLiteDBManager::get();
     return getQueryColumnsInternal(q, columns, dbc->db());
   }
 
+  Status getQueryScans(const std::string& q,
+                       std::vector<TableScan>& scans) const {
+    auto dbc = SQLiteDBManager::get();
+    return getQueryScansInternal(q, scans, dbc->db());
+  }
+
   /// Create a SQLite module and attach (CREATE).
   Status attach(const std::string& name);
   /// Detach a virtual table (DROP).
   void detach(const std::string& name);
+
+  /// A configuration change invalidates cached statements.
+  void configure() override { SQLiteDBManager::resetStatements(); }
 };
 
 /**
@@ -275,6 +539,16 @@ class SQLInternal : public SQL {
     auto dbc = SQLiteDBManager::get();
     status_ = queryInternal(q, results_, dbc->db());
   }
+
+  /**
+   * @brief Instantiate an instance of the class with a query and connection.
+   *
+   * @param q An osquery SQL query
+   * @param db A database connection, for example from getUnique
+   */
+  SQLInternal(const std::string& q, sqlite3* db) {
+    status_ = queryInternal(q, results_, db);
+  }
 };
 
 /**
@@ -101,5 +101,14 @@ TEST_F(SQLTests, test_sql_escape) {
   input = "The quick brown fox jumps over the lazy dog.";
   escapeNonPrintableBytes(input);
   EXPECT_EQ(input, "The quick brown fox jumps over the lazy dog.");
+
+  // Control bytes are found anywhere within, or after, the checked words.
+  input = std::string("0123456789ABCDE\x1F") + " ~\x7F";
+  escapeNonPrintableBytes(input);
+  EXPECT_EQ(input, "0123456789ABCDE\\x1F ~\x7F");
+
+  input = std::string("01234567\t");
+  escapeNonPrintableBytes(input);
+  EXPECT_EQ(input, "01234567\\x09");
 }
 }
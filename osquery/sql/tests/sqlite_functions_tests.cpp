@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/sql.h>
+
+#include "osquery/sql/sqlite_util.h"
+
+namespace osquery {
+
+class SQLiteFunctionsTests : public testing::Test {
+ protected:
+  /// Select a single expression on a new connection.
+  std::string select(const std::string& expression) {
+    auto dbc = SQLiteDBManager::getUnique();
+    QueryData results;
+    auto status =
+        queryInternal("select " + expression + " as r", results, dbc->db());
+    if (!status.ok() || results.size() != 1) {
+      return "error";
+    }
+    return results[0].at("r");
+  }
+};
+
+TEST_F(SQLiteFunctionsTests, test_in_cidr_block) {
+  EXPECT_EQ(select("in_cidr_block('10.0.0.0/8', '10.1.2.3')"), "1");
+  EXPECT_EQ(select("in_cidr_block('10.0.0.0/8', '11.1.2.3')"), "0");
+  EXPECT_EQ(select("in_cidr_block('192.168.1.128/25', '192.168.1.200')"), "1");
+  EXPECT_EQ(select("in_cidr_block('192.168.1.128/25', '192.168.1.100')"), "0");
+  EXPECT_EQ(select("in_cidr_block('0.0.0.0/0', '8.8.8.8')"), "1");
+  EXPECT_EQ(select("in_cidr_block('fe80::/10', 'fe80::1')"), "1");
+  EXPECT_EQ(select("in_cidr_block('fe80::/10', '10.0.0.1')"), "0");
+  EXPECT_EQ(select("in_cidr_block('10.0.0.0/8', 'not an address')"), "");
+  EXPECT_EQ(select("in_cidr_block('10.0.0.0/33', '10.0.0.1')"), "error");
+}
+
+TEST_F(SQLiteFunctionsTests, test_split) {
+  EXPECT_EQ(select("split('a.b.c', '.', 1)"), "b");
+  EXPECT_EQ(select("split('a..c', '.', 1)"), "c");
+  EXPECT_EQ(select("split('a.b.c', '.', 3)"), "");
+}
+
+TEST_F(SQLiteFunctionsTests, test_paths) {
+  EXPECT_EQ(select("dirname('/usr/lib/')"), "/usr");
+  EXPECT_EQ(select("dirname('/usr')"), "/");
+  EXPECT_EQ(select("dirname('usr')"), ".");
+  EXPECT_EQ(select("dirname('/')"), "/");
+  EXPECT_EQ(select("basename('/usr/lib/')"), "lib");
+  EXPECT_EQ(select("basename('/usr/lib/libc.so')"), "libc.so");
+  EXPECT_EQ(select("basename('/')"), "/");
+}
+
+TEST_F(SQLiteFunctionsTests, test_hex_to_int) {
+  EXPECT_EQ(select("hex_to_int('0016')"), "22");
+  EXPECT_EQ(select("hex_to_int('0xFF')"), "255");
+  EXPECT_EQ(select("hex_to_int('zz')"), "");
+}
+
+TEST_F(SQLiteFunctionsTests, test_regex_match) {
+  EXPECT_EQ(select("regex_match('osquery 2.1.0', '(\\d+)\\.(\\d+)', 2)"), "1");
+  EXPECT_EQ(select("regex_match('osquery', '\\d+', 0)"), "");
+  EXPECT_EQ(select("regex_match('osquery', '(', 0)"), "error");
+
+  // A constant pattern is compiled once for every row of the statement.
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "with recursive n(i) as (select 1 union all select i + 1 from n "
+      "where i < 100) select count(*) as c from n "
+      "where regex_match(i, '^[0-9]?5$', 0) is not null",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0].at("c"), "10");
+}
+
+TEST_F(SQLiteFunctionsTests, test_version_compare) {
+  EXPECT_EQ(select("version_compare('1.10', '1.9')"), "1");
+  EXPECT_EQ(select("version_compare('1.2.0', '1.2.0')"), "0");
+  EXPECT_EQ(select("version_compare('1.2', '1.2.1')"), "-1");
+  EXPECT_EQ(select("version_compare('1.0.rc1', '1.0.1')"), "-1");
+  EXPECT_EQ(select("version_compare('2.0-beta', '2.0-alpha')"), "1");
+}
+
+TEST_F(SQLiteFunctionsTests, test_approx_aggregates) {
+  // Aggregate an expression of the numbers from 1 to count.
+  auto aggregate = [](const std::string& expression, size_t count) {
+    auto dbc = SQLiteDBManager::getUnique();
+    QueryData results;
+    auto status = queryInternal(
+        "with recursive n(i) as (select 1 union all select i + 1 from n "
+        "where i < " +
+            std::to_string(count) + ") select " + expression + " as r from n",
+        results,
+        dbc->db());
+    if (!status.ok() || results.size() != 1) {
+      return std::string("error");
+    }
+    return results[0].at("r");
+  };
+
+  // The estimates are within a few percent.
+  auto small = std::stoul(aggregate("approx_count_distinct(i)", 100));
+  EXPECT_GE(small, 95U);
+  EXPECT_LE(small, 105U);
+  auto distinct =
+      std::stoul(aggregate("approx_count_distinct(i % 20000)", 50000));
+  EXPECT_GT(distinct, 19000U);
+  EXPECT_LT(distinct, 21000U);
+  EXPECT_EQ(aggregate("approx_count_distinct(null)", 10), "0");
+
+  // A group of fewer than 1024 values keeps every value.
+  EXPECT_EQ(aggregate("approx_quantile(i, 0.5)", 999), "500.0");
+  EXPECT_EQ(aggregate("approx_quantile(i, 1)", 999), "999.0");
+  auto median = std::stod(aggregate("approx_quantile(i, 0.5)", 100000));
+  EXPECT_GT(median, 45000);
+  EXPECT_LT(median, 55000);
+  EXPECT_EQ(aggregate("approx_quantile(i, 2)", 10), "error");
+}
+}
@@ -55,6 +55,152 @@ TEST_F(SQLiteUtilTests, test_sqlite_instance_manager) {
   EXPECT_EQ(dbc1->db(), dbc1->db());
 }
 
+TEST_F(SQLiteUtilTests, test_sqlite_instance_pool) {
+  auto primary = SQLiteDBManager::get();
+  sqlite3* pooled_db = nullptr;
+  {
+    auto pooled = SQLiteDBManager::get();
+    EXPECT_FALSE(pooled->isPrimary());
+    EXPECT_TRUE(pooled->isPooled());
+    pooled_db = pooled->db();
+  }
+
+  // The released connection is reused while the primary is held.
+  auto pooled = SQLiteDBManager::get();
+  EXPECT_EQ(pooled_db, pooled->db());
+}
+
+TEST_F(SQLiteUtilTests, test_sqlite_instance_schema) {
+  auto primary = SQLiteDBManager::get();
+  { auto pooled = SQLiteDBManager::get(); }
+
+  // A schema change is applied to the idle connection when it is reused.
+  SQLiteDBManager::updateSchema("time", false);
+  {
+    auto pooled = SQLiteDBManager::get();
+    QueryData results;
+    EXPECT_FALSE(
+        queryInternal("select * from time", results, pooled->db()).ok());
+  }
+
+  SQLiteDBManager::updateSchema("time", true);
+  {
+    auto pooled = SQLiteDBManager::get();
+    QueryData results;
+    EXPECT_TRUE(
+        queryInternal("select * from time", results, pooled->db()).ok());
+    EXPECT_EQ(1U, results.size());
+  }
+}
+
+TEST_F(SQLiteUtilTests, test_sqlite_schema_definitions) {
+  auto primary = SQLiteDBManager::get();
+  auto attached = [](sqlite3* db) {
+    QueryData results;
+    queryInternal(
+        "select name from sqlite_temp_master where name = 'time'", results, db);
+    return !results.empty();
+  };
+
+  {
+    auto pooled = SQLiteDBManager::get();
+    QueryData results;
+    EXPECT_TRUE(
+        queryInternal("select * from time", results, pooled->db()).ok());
+  }
+  PluginResponse columns;
+  ASSERT_TRUE(SQLiteDBManager::getColumns("time", columns).ok());
+
+  // Registering the same columns again is not a schema change.
+  SQLiteDBManager::updateSchema("time", true, hashRouteInfo(columns));
+  {
+    auto pooled = SQLiteDBManager::get();
+    EXPECT_TRUE(attached(pooled->db()));
+  }
+
+  // Changed columns detach the table until it is next used.
+  SQLiteDBManager::updateSchema("time", true, hashRouteInfo(columns) + 1);
+  {
+    auto pooled = SQLiteDBManager::get();
+    EXPECT_FALSE(attached(pooled->db()));
+  }
+}
+
+TEST_F(SQLiteUtilTests, test_sqlite_schema_pruned) {
+  auto primary = SQLiteDBManager::get();
+  {
+    auto pooled = SQLiteDBManager::get();
+    QueryData results;
+    EXPECT_TRUE(
+        queryInternal("select * from time", results, pooled->db()).ok());
+  }
+
+  // An idle connection missing more changes than are kept detaches every
+  // table, it does not know which of them changed.
+  for (size_t i = 0; i < 2048; i++) {
+    SQLiteDBManager::updateSchema("pruned" + std::to_string(i), false);
+  }
+  {
+    auto pooled = SQLiteDBManager::get();
+    QueryData results;
+    queryInternal("select name from sqlite_temp_master where name = 'time'",
+                  results,
+                  pooled->db());
+    EXPECT_TRUE(results.empty());
+    EXPECT_TRUE(
+        queryInternal("select * from time", results, pooled->db()).ok());
+  }
+}
+
+TEST_F(SQLiteUtilTests, test_sqlite_lazy_tables) {
+  // A new connection attaches a table when a statement first references it.
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "select name from sqlite_temp_master where type = 'table'",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(results.empty());
+
+  results.clear();
+  status = queryInternal(
+      "select * from time join osquery_info", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(1U, results.size());
+
+  results.clear();
+  queryInternal("select name from sqlite_temp_master where type = 'table'",
+                results,
+                dbc->db());
+  EXPECT_EQ(2U, results.size());
+
+  // A PRAGMA does not report a missing table, it is attached while compiling.
+  results.clear();
+  status = queryInternal(
+      "pragma table_info(osquery_registry)", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(results.empty());
+
+  // Unregistered tables are still missing.
+  results.clear();
+  EXPECT_FALSE(
+      queryInternal("select * from not_a_table", results, dbc->db()).ok());
+}
+
+TEST_F(SQLiteUtilTests, test_sqlite_connection_settings) {
+  // Managed and transient connections keep temporary storage in memory.
+  auto primary = SQLiteDBManager::get();
+  auto transient = SQLiteDBManager::getUnique();
+  for (auto db : {primary->db(), transient->db()}) {
+    QueryData results;
+    auto status = queryInternal("PRAGMA temp_store", results, db);
+    ASSERT_TRUE(status.ok());
+    ASSERT_EQ(results.size(), 1U);
+    EXPECT_EQ(results[0]["temp_store"], "2");
+  }
+}
+
 TEST_F(SQLiteUtilTests, test_sqlite_instance) {
   // Don't do this at home kids.
   // Keep a copy of the internal DB and let the SQLiteDBInstance go oos.
@@ -72,6 +218,72 @@ TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   EXPECT_EQ(results, getTestDBExpectedResults());
 }
 
+TEST_F(SQLiteUtilTests, test_row_callback) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(kTestQuery,
+                              [&results](Row& row) {
+                                results.push_back(std::move(row));
+                                return true;
+                              },
+                              dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+
+  // Returning false stops an unbounded query, even across statements.
+  size_t count = 0;
+  auto first_rows = [&count](Row& row) { return ++count < 3; };
+  status = queryInternal(
+      "with recursive n(i) as (select 1 union all select i + 1 from n) "
+      "select i from n",
+      first_rows,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(count, 3U);
+
+  count = 0;
+  status = queryInternal(
+      "select 1; select 2; select 3; select 4", first_rows, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(count, 3U);
+
+  // The cancelled statement is reset and runs again from the first row.
+  results.clear();
+  status = queryInternal(kTestQuery, results, dbc->db());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+}
+
+TEST_F(SQLiteUtilTests, test_statement_cache) {
+  auto dbc = getTestDBC();
+  sqlite3_stmt* first = nullptr;
+  auto status = SQLiteDBManager::getStatement(dbc->db(), kTestQuery, first);
+  ASSERT_TRUE(status.ok());
+  ASSERT_NE(nullptr, first);
+
+  // The same query text on the same connection reuses the statement.
+  sqlite3_stmt* second = nullptr;
+  SQLiteDBManager::getStatement(dbc->db(), kTestQuery, second);
+  EXPECT_EQ(first, second);
+
+  // Repeated executions of a cached statement return identical results.
+  QueryData results;
+  queryInternal(kTestQuery, results, dbc->db());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+  results.clear();
+  queryInternal(kTestQuery, results, dbc->db());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+
+  // Multiple statements are executed but not cached.
+  sqlite3_stmt* multiple = nullptr;
+  status = SQLiteDBManager::getStatement(
+      dbc->db(), "select 1; select 2", multiple);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(nullptr, multiple);
+
+  status = SQLiteDBManager::getStatement(dbc->db(), "select * from foo", first);
+  EXPECT_FALSE(status.ok());
+}
+
 TEST_F(SQLiteUtilTests, test_passing_callback_no_data_param) {
   char* err = nullptr;
   auto dbc = getTestDBC();
@@ -108,6 +320,16 @@ TEST_F(SQLiteUtilTests, test_get_test_db_result_stream) {
   }
 }
 
+TEST_F(SQLiteUtilTests, test_query_planner_aggregate) {
+  auto dbc = getTestDBC();
+  EXPECT_FALSE(QueryPlanner("select * from time", dbc->db()).hasAggregate());
+  EXPECT_TRUE(
+      QueryPlanner("select count(*) from time", dbc->db()).hasAggregate());
+  EXPECT_TRUE(QueryPlanner("select max(seconds) from time group by hour",
+                           dbc->db())
+                  .hasAggregate());
+}
+
 TEST_F(SQLiteUtilTests, test_get_query_columns) {
   auto dbc = getTestDBC();
   TableColumns results;
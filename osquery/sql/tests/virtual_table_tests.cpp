@@ -8,17 +8,26 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 #include <osquery/sql.h>
 
+#include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
+DECLARE_bool(table_prefetch);
+
 class VirtualTableTests : public testing::Test {};
 
 // sample plugin used on tests
@@ -202,4 +211,546 @@ TEST_F(VirtualTableTests, test_constraints_stacking) {
     EXPECT_EQ(results, union_results[index++]);
   }
 }
+
+class typedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"i", INTEGER_TYPE},
+        {"b", BIGINT_TYPE},
+        {"d", DOUBLE_TYPE},
+        {"t", TEXT_TYPE},
+        {"c", BIGINT_TYPE},
+    };
+  }
+
+ public:
+  void generateRows(QueryContext&, TableRows& rows) override {
+    rows.push_back({1LL, 3000000000LL, 1.5, std::string("typed"), 7LL});
+    rows.push_back({2LL, 4LL, 0.5, 8LL, std::string("9")});
+    rows.push_back({5000000000LL, 10LL, 0.0, std::string(""), 0LL});
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_typed_rows);
+};
+
+TEST_F(VirtualTableTests, test_typed_rows) {
+  Registry::add<typedTablePlugin>("table", "typed");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto typed = std::make_shared<typedTablePlugin>();
+    attachTableInternal("typed", typed->columnDefinition(), dbc->db());
+  }
+
+  QueryData results;
+  auto status = queryInternal(
+      "select i, b, d, t, c from typed where i > 0", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["b"], "3000000000");
+  EXPECT_EQ(results[0]["d"], "1.5");
+  EXPECT_EQ(results[0]["t"], "typed");
+  // Text cells within typed columns and typed cells within text columns.
+  EXPECT_EQ(results[1]["t"], "8");
+  EXPECT_EQ(results[1]["c"], "9");
+  // Typed INTEGER cells beyond 32 bits are not truncated.
+  EXPECT_EQ(results[2]["i"], "5000000000");
+
+  // Typed cells are compared using the column affinity.
+  results.clear();
+  queryInternal("select i from typed where b < 5", results, dbc->db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["i"], "2");
+}
+
+static size_t kStreamingTasksRun{0};
+
+class streamingTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"i", INTEGER_TYPE},
+    };
+  }
+
+ public:
+  RowGeneratorRef generator(QueryContext&) override {
+    RowTasks tasks;
+    for (size_t i = 0; i < 100; i++) {
+      tasks.push_back([i](QueryData& results) {
+        kStreamingTasksRun++;
+        results.push_back({{"i", INTEGER(i)}});
+      });
+    }
+    return std::make_shared<LazyRowGenerator>(columns(), std::move(tasks), 4);
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_streaming_rows);
+};
+
+TEST_F(VirtualTableTests, test_streaming_rows) {
+  Registry::add<streamingTablePlugin>("table", "streaming");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto streaming = std::make_shared<streamingTablePlugin>();
+    attachTableInternal(
+        "streaming", streaming->columnDefinition(), dbc->db());
+  }
+
+  // A LIMIT stops the cursor before every task is run.
+  kStreamingTasksRun = 0;
+  QueryData results;
+  auto status =
+      queryInternal("select i from streaming limit 5", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 5U);
+  EXPECT_EQ(results[4]["i"], "4");
+  EXPECT_LT(kStreamingTasksRun, 100U);
+
+  // Every batch is visited for a full scan, with unique rowids.
+  results.clear();
+  queryInternal("select count(distinct rowid) as c, max(i) as m from streaming",
+                results,
+                dbc->db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["c"], "100");
+  EXPECT_EQ(results[0]["m"], "99");
+}
+
+static QueryContext kProjectedContext;
+
+class projectedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"name", TEXT_TYPE}, {"hash", TEXT_TYPE}, {"size", INTEGER_TYPE},
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kProjectedContext = context;
+    return {{{"name", "a"}, {"size", "1"}}, {{"name", "b"}, {"size", "2"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_column_projection);
+};
+
+TEST_F(VirtualTableTests, test_column_projection) {
+  Registry::add<projectedTablePlugin>("table", "projected");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto projected = std::make_shared<projectedTablePlugin>();
+    attachTableInternal(
+        "projected", projected->columnDefinition(), dbc->db());
+  }
+
+  // Columns read by the selection or a predicate are used.
+  QueryData results;
+  auto status = queryInternal(
+      "select name from projected where size > 1", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_TRUE(kProjectedContext.projected);
+  EXPECT_TRUE(kProjectedContext.isColumnUsed("name"));
+  EXPECT_TRUE(kProjectedContext.isColumnUsed("size"));
+  EXPECT_FALSE(kProjectedContext.isColumnUsed("hash"));
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // A LIMIT and OFFSET without other constraints are passed as a hint.
+  results.clear();
+  queryInternal(
+      "select name from projected limit 1 offset 1", results, dbc->db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["name"], "b");
+  EXPECT_EQ(kProjectedContext.limit, 2);
+#endif
+}
+
+static QueryContext kOrderedContext;
+
+class orderedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"time", INTEGER_TYPE}, {"value", TEXT_TYPE},
+    };
+  }
+
+  TableColumnOptions columnOptions() const {
+    return {{"time", COLUMN_ORDERED}};
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kOrderedContext = context;
+    QueryData results;
+    for (size_t i = 1; i <= 10; i++) {
+      auto time = (context.descending) ? 11 - i : i;
+      results.push_back({{"time", INTEGER(time)}, {"value", "v"}});
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_ordered_column);
+};
+
+TEST_F(VirtualTableTests, test_ordered_column) {
+  Registry::add<orderedTablePlugin>("table", "ordered");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto ordered = std::make_shared<orderedTablePlugin>();
+    attachTableInternal("ordered", ordered->columnDefinition(), dbc->db());
+  }
+
+  // The table generates the requested order, SQLite does not sort.
+  QueryData results;
+  auto status = queryInternal(
+      "select time from ordered order by time desc limit 3",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["time"], "10");
+  EXPECT_EQ(results[2]["time"], "8");
+  EXPECT_TRUE(kOrderedContext.descending);
+  // A LIMIT hint is not passed with an ORDER BY.
+  EXPECT_EQ(kOrderedContext.limit, 0);
+
+  // An order of other columns is sorted by SQLite, without a LIMIT hint.
+  results.clear();
+  queryInternal("select time from ordered order by value, time desc limit 2",
+                results,
+                dbc->db());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["time"], "10");
+  EXPECT_FALSE(kOrderedContext.descending);
+  EXPECT_EQ(kOrderedContext.limit, 0);
+}
+
+class driverTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"id", INTEGER_TYPE},
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext&) override {
+    return {{{"id", "1"}}, {{"id", "2"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_cost_aware_planning);
+  FRIEND_TEST(VirtualTableTests, test_query_scans);
+};
+
+static size_t kLookupScans{0};
+
+class lookupTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"id", INTEGER_TYPE}, {"value", TEXT_TYPE},
+    };
+  }
+
+  TableColumnOptions columnOptions() const { return {{"id", COLUMN_INDEX}}; }
+
+  size_t cost() const { return 1000; }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    QueryData results;
+    auto ids = context.constraints["id"].getAll(EQUALS);
+    if (ids.empty()) {
+      // Count the number of expensive full scans.
+      kLookupScans++;
+      for (size_t i = 0; i < 100; i++) {
+        ids.insert(std::to_string(i));
+      }
+    }
+
+    for (const auto& id : ids) {
+      results.push_back({{"id", id}, {"value", "v" + id}});
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_cost_aware_planning);
+  FRIEND_TEST(VirtualTableTests, test_query_scans);
+};
+
+TEST_F(VirtualTableTests, test_cost_aware_planning) {
+  Registry::add<driverTablePlugin>("table", "driver");
+  Registry::add<lookupTablePlugin>("table", "lookup");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto driver = std::make_shared<driverTablePlugin>();
+    attachTableInternal("driver", driver->columnDefinition(), dbc->db());
+    auto lookup = std::make_shared<lookupTablePlugin>();
+    attachTableInternal("lookup", lookup->columnDefinition(), dbc->db());
+  }
+
+  // The lookup table is expensive to scan, but cheap to probe by index.
+  kLookupScans = 0;
+  QueryData results;
+  auto status = queryInternal(
+      "select l.value from lookup l join driver d on l.id = d.id",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(kLookupScans, 0U);
+
+  // An omitted lookup constraint still yields exact results.
+  results.clear();
+  queryInternal("select value from lookup where id = 5", results, dbc->db());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["value"], "v5");
+  EXPECT_EQ(kLookupScans, 0U);
+}
+
+TEST_F(VirtualTableTests, test_query_scans) {
+  Registry::add<driverTablePlugin>("table", "driver");
+  Registry::add<lookupTablePlugin>("table", "lookup");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto driver = std::make_shared<driverTablePlugin>();
+    attachTableInternal("driver", driver->columnDefinition(), dbc->db());
+    auto lookup = std::make_shared<lookupTablePlugin>();
+    attachTableInternal("lookup", lookup->columnDefinition(), dbc->db());
+  }
+
+  // A lookup by index is cheap, planning does not generate rows.
+  kLookupScans = 0;
+  std::vector<TableScan> scans;
+  auto status = getQueryScansInternal(
+      "select value from lookup where id = 5", scans, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(scans.size(), 1U);
+  EXPECT_EQ(scans[0].table, "lookup");
+  EXPECT_EQ(scans[0].constraints, 1U);
+  EXPECT_EQ(scans[0].columns, std::set<std::string>({"id"}));
+  EXPECT_LT(scans[0].cost, 1000);
+
+  // A full scan costs the table's declared cost.
+  scans.clear();
+  getQueryScansInternal("select value from lookup", scans, dbc->db());
+  ASSERT_EQ(scans.size(), 1U);
+  EXPECT_EQ(scans[0].constraints, 0U);
+  EXPECT_TRUE(scans[0].columns.empty());
+  EXPECT_GE(scans[0].cost, 1000);
+  EXPECT_EQ(kLookupScans, 0U);
+
+  scans.clear();
+  EXPECT_FALSE(
+      getQueryScansInternal("select * from missing", scans, dbc->db()).ok());
+}
+
+class manyTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"id", INTEGER_TYPE},
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext&) override {
+    QueryData results;
+    for (size_t i = 0; i < 500; i++) {
+      results.push_back({{"id", INTEGER(i % 250)}});
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_batched_probes);
+  FRIEND_TEST(VirtualTableTests, test_table_profiling);
+  FRIEND_TEST(VirtualTableTests, test_table_stats);
+};
+
+static size_t kProbeGenerates{0};
+
+/// The value constraints of the last complete scan of the probed table.
+static std::set<std::string> kProbeScanValues;
+
+class probedTablePlugin : public lookupTablePlugin {
+ public:
+  QueryData generate(QueryContext& context) override {
+    kProbeGenerates++;
+    if (!context.hasConstraint("id")) {
+      kProbeScanValues = context.constraints["value"].getAll(EQUALS);
+    }
+    return lookupTablePlugin::generate(context);
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_batched_probes);
+};
+
+TEST_F(VirtualTableTests, test_batched_probes) {
+  Registry::add<manyTablePlugin>("table", "many");
+  Registry::add<probedTablePlugin>("table", "probed");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto many = std::make_shared<manyTablePlugin>();
+    attachTableInternal("many", many->columnDefinition(), dbc->db());
+    auto probed = std::make_shared<probedTablePlugin>();
+    attachTableInternal("probed", probed->columnDefinition(), dbc->db());
+  }
+
+  // Each outer row probes the inner table's index column.
+  kLookupScans = 0;
+  kProbeGenerates = 0;
+  QueryData results;
+  auto status = queryInternal(
+      "select p.value from many m join probed p on p.id = m.id",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  // The lookup table only generates ids 0-99.
+  EXPECT_EQ(results.size(), 200U);
+  // After enough probes the table is scanned once and indexed.
+  EXPECT_EQ(kLookupScans, 1U);
+  EXPECT_LT(kProbeGenerates, 500U);
+
+  // The scan keeps the probes' other constraints.
+  kLookupScans = 0;
+  results.clear();
+  status = queryInternal(
+      "select p.value from many m join probed p on p.id = m.id "
+      "where p.value = 'v7'",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(kLookupScans, 1U);
+  EXPECT_EQ(kProbeScanValues.count("v7"), 1U);
+}
+
+TEST_F(VirtualTableTests, test_table_profiling) {
+  Registry::add<manyTablePlugin>("table", "many");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto many = std::make_shared<manyTablePlugin>();
+    attachTableInternal("many", many->columnDefinition(), dbc->db());
+  }
+
+  setTableProfiling(true);
+  takeTableProfiles();
+  QueryData results;
+  auto status = queryInternal(
+      "select id from many where id = 1 limit 1", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  setTableProfiling(false);
+
+  auto profiles = takeTableProfiles();
+  ASSERT_EQ(profiles.count("many"), 1U);
+  const auto& profile = profiles.at("many");
+  EXPECT_EQ(profile.filters, 1U);
+  EXPECT_EQ(profile.constrained, 1U);
+  EXPECT_EQ(profile.rows_produced, 500U);
+  // SQLite stops stepping the cursor after the first match.
+  EXPECT_LT(profile.rows_consumed, profile.rows_produced);
+  EXPECT_GT(profile.bytes, 0U);
+
+  // Cursors opened without profiling are not recorded.
+  status = queryInternal("select id from many", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(takeTableProfiles().empty());
+}
+
+TEST_F(VirtualTableTests, test_table_stats) {
+  Registry::add<manyTablePlugin>("table", "many");
+  auto dbc = SQLiteDBManager::get();
+  {
+    auto many = std::make_shared<manyTablePlugin>();
+    attachTableInternal("many", many->columnDefinition(), dbc->db());
+  }
+
+  auto before = getTableStats()["many"];
+  QueryData results;
+  auto status = queryInternal("select id from many", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+
+  // Each scan calling the generator is recorded.
+  auto after = getTableStats()["many"];
+  EXPECT_EQ(after.scans, before.scans + 1);
+  EXPECT_EQ(after.rows, before.rows + 500);
+  EXPECT_EQ(after.times.count(), before.times.count() + 1);
+}
+
+/// The thread running the prefetch test's queries.
+static std::thread::id kQueryThread;
+
+/// Generations of the slow tables, and those on another thread.
+static std::atomic<size_t> kSlowScans{0};
+static std::atomic<size_t> kPrefetchedScans{0};
+
+class slowTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        {"name", TEXT_TYPE},
+    };
+  }
+
+ public:
+  void generateRows(QueryContext&, TableRows& rows) override {
+    kSlowScans++;
+    if (std::this_thread::get_id() != kQueryThread) {
+      kPrefetchedScans++;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    rows.push_back({std::string("slow")});
+  }
+};
+
+TEST_F(VirtualTableTests, test_table_prefetch) {
+  kQueryThread = std::this_thread::get_id();
+  auto dbc = SQLiteDBManager::get();
+  for (const auto& name : {"slow_first", "slow_second", "slow_third"}) {
+    Registry::add<slowTablePlugin>("table", name);
+    auto slow = std::make_shared<slowTablePlugin>();
+    attachTableInternal(name, slow->columnDefinition(), dbc->db());
+  }
+
+  auto prefetch = FLAGS_table_prefetch;
+  FLAGS_table_prefetch = true;
+  kSlowScans = 0;
+  kPrefetchedScans = 0;
+  QueryData results;
+  auto status = queryInternal(
+      "select name from slow_first union all select name from slow_second "
+      "union all select name from slow_third",
+      results,
+      dbc->db());
+  FLAGS_table_prefetch = prefetch;
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 3U);
+
+  // Each table is generated once, the later scans on the executor.
+  EXPECT_EQ(kSlowScans, 3U);
+  EXPECT_GT(kPrefetchedScans, 0U);
+
+  // Without prefetching every scan is generated by the query's thread.
+  kSlowScans = 0;
+  kPrefetchedScans = 0;
+  results.clear();
+  queryInternal("select name from slow_first union all select name from "
+                "slow_second",
+                results,
+                dbc->db());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(kSlowScans, 2U);
+  EXPECT_EQ(kPrefetchedScans, 0U);
+}
 }
@@ -8,20 +8,122 @@
  *
  */
 
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <osquery/extensions.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/memory.h"
+#include "osquery/core/tracing.h"
+#include "osquery/dispatcher/dispatcher.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
 SHELL_FLAG(bool, planner, false, "Enable osquery runtime planner output");
 
+FLAG(bool,
+     table_prefetch,
+     false,
+     "Generate a query's table scans without constraints concurrently");
+
+DECLARE_bool(registry_exceptions);
+
+/// Cursors opened while this is set collect a TableProfile.
+static std::atomic<bool> kTableProfiling{false};
+
+/// Protects the profiles of closed cursors.
+static std::mutex kTableProfilesMutex;
+
+/// Profiles of closed cursors, taken by takeTableProfiles.
+static TableProfiles kTableProfiles;
+
+void setTableProfiling(bool enabled) {
+  kTableProfiling = enabled;
+}
+
+bool isTableProfiling() {
+  return kTableProfiling;
+}
+
+TableProfiles takeTableProfiles() {
+  std::lock_guard<std::mutex> lock(kTableProfilesMutex);
+  TableProfiles profiles;
+  profiles.swap(kTableProfiles);
+  return profiles;
+}
+
+/// Protects the generator statistics.
+static std::mutex kTableStatsMutex;
+
+/// Generator statistics by table name, for the life of the process.
+static std::map<std::string, TableStats> kTableStats;
+
+std::map<std::string, TableStats> getTableStats() {
+  std::lock_guard<std::mutex> lock(kTableStatsMutex);
+  return kTableStats;
+}
+
 namespace tables {
 namespace sqlite {
 
-static size_t kPlannerCursorID = 0;
-static size_t kConstraintIndexID = 0;
+/// Cursor and plan identifiers, connections on several threads take them.
+static std::atomic<size_t> kPlannerCursorID{0};
+static std::atomic<size_t> kConstraintIndexID{0};
+
+/// Plans offered by xBestIndex on this thread, recorded while set.
+static thread_local std::map<int, TableScan> *kPlanRecorder{nullptr};
+
+/// The virtual tables of the recorded plans.
+static thread_local std::map<int, VirtualTableContent *> *kContentRecorder{
+    nullptr};
+
+/// Microseconds of CPU time used by the process.
+static uint64_t processCPUTime() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Add the wall time of generator work to a cursor's scan.
+ *
+ * A profiled cursor also adds the wall and CPU time to its profile.
+ */
+class GeneratorTimer : private boost::noncopyable {
+ public:
+  explicit GeneratorTimer(BaseCursor *cursor) : cursor_(cursor) {
+    wall_ = std::chrono::steady_clock::now();
+    if (cursor_->profiled) {
+      cpu_ = processCPUTime();
+    }
+  }
+
+  ~GeneratorTimer() {
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - wall_);
+    cursor_->scan_time += wall.count();
+    if (cursor_->profiled) {
+      cursor_->profile.wall_time += wall.count();
+      cursor_->profile.cpu_time += processCPUTime() - cpu_;
+    }
+  }
+
+ private:
+  BaseCursor *cursor_{nullptr};
+  std::chrono::steady_clock::time_point wall_;
+  uint64_t cpu_{0};
+};
 
 static std::string opString(unsigned char op) {
   switch (op) {
@@ -45,14 +147,30 @@ static void plan(const std::string &output) {
   }
 }
 
+/// Add a cursor's finished scan to the generator statistics of its table.
+static void recordScan(BaseCursor *pCur, const std::string &name) {
+  if (pCur->scanned) {
+    std::lock_guard<std::mutex> lock(kTableStatsMutex);
+    auto &stats = kTableStats[name];
+    stats.scans++;
+    stats.rows += pCur->scan_rows;
+    stats.time += pCur->scan_time;
+    stats.times.record(pCur->scan_time);
+  }
+  pCur->scanned = false;
+  pCur->scan_time = 0;
+  pCur->scan_rows = 0;
+}
+
 int xOpen(sqlite3_vtab *tab, sqlite3_vtab_cursor **ppCursor) {
   int rc = SQLITE_NOMEM;
   auto *pCur = new BaseCursor;
   auto *pVtab = (VirtualTable *)tab;
   if (pCur != nullptr) {
-    plan("Opening cursor (" + std::to_string(kPlannerCursorID) +
-         ") for table: " + pVtab->content->name);
     pCur->id = kPlannerCursorID++;
+    plan("Opening cursor (" + std::to_string(pCur->id) +
+         ") for table: " + pVtab->content->name);
+    pCur->profiled = kTableProfiling;
     pCur->base.pVtab = tab;
     *ppCursor = (sqlite3_vtab_cursor *)pCur;
     rc = SQLITE_OK;
@@ -68,6 +186,19 @@ int xClose(sqlite3_vtab_cursor *cur) {
   if (pVtab != nullptr) {
     // Reset all constraints for the virtual table content.
     pVtab->content->constraints.clear();
+    recordScan(pCur, pVtab->content->name);
+    if (pCur->profiled) {
+      std::lock_guard<std::mutex> lock(kTableProfilesMutex);
+      auto &profile = kTableProfiles[pVtab->content->name];
+      profile.filters += pCur->profile.filters;
+      profile.constrained += pCur->profile.constrained;
+      profile.probe_hits += pCur->profile.probe_hits;
+      profile.wall_time += pCur->profile.wall_time;
+      profile.cpu_time += pCur->profile.cpu_time;
+      profile.rows_produced += pCur->profile.rows_produced;
+      profile.rows_consumed += pCur->profile.rows_consumed;
+      profile.bytes += pCur->profile.bytes;
+    }
   }
   delete pCur;
   return SQLITE_OK;
@@ -90,15 +221,47 @@ int xDestroy(sqlite3_vtab *p) {
   return SQLITE_OK;
 }
 
+/// Replace the cursor's consumed rows with the generator's next batch.
+static void pullRows(BaseCursor *pCur) {
+  TRACE_SCOPE("table.next");
+  pCur->offset += pCur->n;
+  pCur->rows.clear();
+  pCur->row = 0;
+  while (pCur->generator != nullptr && pCur->rows.empty()) {
+    bool more = false;
+    try {
+      more = pCur->generator->next(pCur->rows);
+    } catch (const std::exception &e) {
+      LOG(ERROR) << "Row generator caused exception: " << e.what();
+    }
+    if (!more) {
+      // The generator is exhausted, release its remaining resources.
+      pCur->generator = nullptr;
+    }
+  }
+  pCur->n = pCur->rows.size();
+  pCur->scan_rows += pCur->n;
+  if (pCur->profiled) {
+    pCur->profile.rows_produced += pCur->n;
+  }
+}
+
 int xNext(sqlite3_vtab_cursor *cur) {
   BaseCursor *pCur = (BaseCursor *)cur;
+  if (pCur->profiled && pCur->row < pCur->n) {
+    pCur->profile.rows_consumed++;
+  }
   pCur->row++;
+  if (pCur->row >= pCur->n && pCur->generator != nullptr) {
+    GeneratorTimer timer(pCur);
+    pullRows(pCur);
+  }
   return SQLITE_OK;
 }
 
 int xRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
   const BaseCursor *pCur = (BaseCursor *)cur;
-  *pRowid = pCur->row;
+  *pRowid = pCur->offset + pCur->row;
   return SQLITE_OK;
 }
 
@@ -120,9 +283,8 @@ int xCreate(sqlite3 *db,
   // Create a TablePlugin Registry call, expect column details as the response.
   PluginResponse response;
   pVtab->content->name = std::string(argv[0]);
-  // Get the table column information.
-  auto status = Registry::call(
-      "table", pVtab->content->name, {{"action", "columns"}}, response);
+  // Get the table column information, shared by every connection.
+  auto status = SQLiteDBManager::getColumns(pVtab->content->name, response);
   if (!status.ok() || response.size() == 0) {
     delete pVtab->content;
     delete pVtab;
@@ -144,33 +306,42 @@ int xCreate(sqlite3 *db,
   for (const auto &column : response) {
     pVtab->content->columns.push_back(
         std::make_pair(column.at("name"), columnTypeName(column.at("type"))));
+    long options = COLUMN_DEFAULT;
+    if (column.count("options") > 0 &&
+        safeStrtol(column.at("options"), 10, options) &&
+        options != COLUMN_DEFAULT) {
+      pVtab->content->column_options[column.at("name")] = options;
+    }
   }
-  *ppVtab = (sqlite3_vtab *)pVtab;
-  return rc;
-}
 
-int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
-  BaseCursor *pCur = (BaseCursor *)cur;
-  const auto *pVtab = (VirtualTable *)cur->pVtab;
-  if (col >= static_cast<int>(pVtab->content->columns.size())) {
-    // Requested column index greater than column set size.
-    return SQLITE_ERROR;
-  }
+  // Filters on local tables use the plugin's typed generate API.
+  pVtab->content->plugin =
+      Registry::getLocal<TablePlugin>("table", pVtab->content->name);
 
-  const auto &column_name = pVtab->content->columns[col].first;
-  const auto &type = pVtab->content->columns[col].second;
-  if (pCur->row >= pCur->data.size()) {
-    // Request row index greater than row set size.
-    return SQLITE_ERROR;
+  // Tables may declare a scan cost, older extensions may not respond.
+  response.clear();
+  status = Registry::call(
+      "table", pVtab->content->name, {{"action", "attributes"}}, response);
+  if (status.ok() && response.size() > 0 && response[0].count("cost") > 0) {
+    long cost = 0;
+    if (safeStrtol(response[0].at("cost"), 10, cost) && cost > 0) {
+      pVtab->content->cost = static_cast<size_t>(cost);
+    }
   }
+  *ppVtab = (sqlite3_vtab *)pVtab;
+  return rc;
+}
 
-  // Attempt to cast each xFilter-populated row/column to the SQLite type.
-  const auto &value = pCur->data[pCur->row][column_name];
+/// Cast a Row-style text cell to the SQLite type of the column.
+static void resultText(sqlite3_context *ctx,
+                       const std::string &column_name,
+                       ColumnType type,
+                       const std::string &value) {
   if (type == TEXT_TYPE) {
     sqlite3_result_text(ctx, value.c_str(), value.size(), SQLITE_STATIC);
   } else if (type == INTEGER_TYPE) {
-    long afinite;
-    if (!safeStrtol(value, 10, afinite) || afinite < INT_MIN ||
+    long long afinite;
+    if (!parseDecimal(value, afinite) || afinite < INT_MIN ||
         afinite > INT_MAX) {
       VLOG(1) << "Error casting " << column_name << " (" << value
               << ") to INTEGER";
@@ -179,7 +350,7 @@ int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
     sqlite3_result_int(ctx, (int)afinite);
   } else if (type == BIGINT_TYPE || type == UNSIGNED_BIGINT_TYPE) {
     long long afinite;
-    if (!safeStrtoll(value, 10, afinite)) {
+    if (!parseDecimal(value, afinite)) {
       VLOG(1) << "Error casting " << column_name << " (" << value
               << ") to BIGINT";
       afinite = -1;
@@ -197,18 +368,79 @@ int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
   } else {
     LOG(ERROR) << "Error unknown column type " << column_name;
   }
+}
+
+int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
+  BaseCursor *pCur = (BaseCursor *)cur;
+  const auto *pVtab = (VirtualTable *)cur->pVtab;
+  if (col >= static_cast<int>(pVtab->content->columns.size())) {
+    // Requested column index greater than column set size.
+    return SQLITE_ERROR;
+  }
+
+  const auto &column_name = pVtab->content->columns[col].first;
+  const auto &type = pVtab->content->columns[col].second;
+  if (pCur->row >= pCur->rows.size() ||
+      static_cast<size_t>(col) >= pCur->rows[pCur->row].size()) {
+    // Request row index greater than row set size.
+    return SQLITE_ERROR;
+  }
+
+  // Typed cells are emitted directly, text cells are cast to the column type.
+  const auto &cell = pCur->rows[pCur->row][col];
+  if (pCur->profiled) {
+    const auto *text = boost::get<std::string>(&cell);
+    pCur->profile.bytes +=
+        (text != nullptr) ? text->size() : sizeof(long long int);
+  }
+  if (const auto *value = boost::get<long long int>(&cell)) {
+    if (type == TEXT_TYPE) {
+      auto text = std::to_string(*value);
+      sqlite3_result_text(ctx, text.c_str(), text.size(), SQLITE_TRANSIENT);
+    } else if (type == DOUBLE_TYPE) {
+      sqlite3_result_double(ctx, static_cast<double>(*value));
+    } else if (type == INTEGER_TYPE && *value >= INT_MIN &&
+               *value <= INT_MAX) {
+      sqlite3_result_int(ctx, static_cast<int>(*value));
+    } else {
+      // BIGINT cells, and INTEGER cells beyond the int range, keep 64 bits.
+      sqlite3_result_int64(ctx, *value);
+    }
+  } else if (const auto *value = boost::get<double>(&cell)) {
+    if (type == TEXT_TYPE) {
+      auto text = DOUBLE(*value);
+      sqlite3_result_text(ctx, text.c_str(), text.size(), SQLITE_TRANSIENT);
+    } else if (type == DOUBLE_TYPE) {
+      sqlite3_result_double(ctx, *value);
+    } else {
+      sqlite3_result_int64(ctx, static_cast<long long int>(*value));
+    }
+  } else {
+    resultText(ctx, column_name, type, boost::get<std::string>(cell));
+  }
 
   return SQLITE_OK;
 }
 
+/// The fraction of a table scan generated by a lookup on an index column.
+static const double kIndexSelectivity = 100;
+
+/// Plans missing a required column constraint generate no useful rows.
+static const double kRequiredColumnCost = 1e9;
+
 static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
   auto *pVtab = (VirtualTable *)tab;
+  const auto &content = pVtab->content;
   ConstraintSet constraints;
   // Keep track of the index used for each valid constraint.
   // Expect this index to correspond with argv within xFilter.
   size_t expr_index = 0;
+  // The OR'd column options of all usable EQUALS constraints.
+  int equals_options = COLUMN_DEFAULT;
+  // The term of the single usable constraint on an index column, if any.
+  int index_term = -1;
   // If any constraints are unusable increment the cost of the index.
-  size_t cost = 1;
+  size_t unusable = 0;
   // Expressions operating on the same virtual table are loosely identified by
   // the consecutive sets of terms each of the constraint sets are applied onto.
   // Subsequent attempts from failed (unusable) constraints replace the set,
@@ -218,26 +450,34 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
       // Record the term index (this index exists across all expressions).
       const auto &constraint_info = pIdxInfo->aConstraint[i];
 #if defined(DEBUG)
-      plan("Evaluating constraints for table: " + pVtab->content->name +
+      plan("Evaluating constraints for table: " + content->name +
            " [index=" + std::to_string(i) + " column=" +
            std::to_string(constraint_info.iColumn) + " term=" +
            std::to_string((int)constraint_info.iTermOffset) + " usable=" +
            std::to_string((int)constraint_info.usable) + "]");
 #endif
+#if SQLITE_VERSION_NUMBER >= 3038000
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT ||
+          constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+        // Applied as plan hints once the column constraints are known.
+        continue;
+      }
+#endif
+
       if (!constraint_info.usable) {
         // A higher cost less priority, prefer more usable query constraints.
-        cost += 10;
+        unusable++;
         continue;
       }
 
       // Lookup the column name given an index into the table column set.
       if (constraint_info.iColumn < 0 ||
           static_cast<size_t>(constraint_info.iColumn) >=
-              pVtab->content->columns.size()) {
-        cost += 10;
+              content->columns.size()) {
+        unusable++;
         continue;
       }
-      const auto &name = pVtab->content->columns[constraint_info.iColumn].first;
+      const auto &name = content->columns[constraint_info.iColumn].first;
       // Save a pair of the name and the constraint operator.
       // Use this constraint during xFilter by performing a scan and column
       // name lookup through out all cursor constraint lists.
@@ -245,26 +485,316 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
           std::make_pair(name, Constraint(constraint_info.op)));
       pIdxInfo->aConstraintUsage[i].argvIndex = ++expr_index;
 #if defined(DEBUG)
-      plan("Adding constraint for table: " + pVtab->content->name +
-           " [column=" + name + " arg_index=" + std::to_string(expr_index) +
-           "]");
+      plan("Adding constraint for table: " + content->name + " [column=" +
+           name + " arg_index=" + std::to_string(expr_index) + "]");
 #endif
+
+      auto options = content->column_options.find(name);
+      if (constraint_info.op == EQUALS &&
+          options != content->column_options.end()) {
+        equals_options |= options->second;
+        if (options->second & COLUMN_INDEX) {
+          index_term = static_cast<int>(i);
+        }
+      }
     }
   }
 
+  // Any required column satisfies the table's constraint requirement.
+  bool requires_constraint = false;
+  for (const auto &options : content->column_options) {
+    requires_constraint |= ((options.second & COLUMN_REQUIRED) != 0);
+  }
+
+  // Scale the table's relative scan cost by the selectivity of the plan.
+  double cost = static_cast<double>(content->cost);
+  if (requires_constraint && !(equals_options & COLUMN_REQUIRED)) {
+    cost = kRequiredColumnCost;
+  } else if (equals_options & COLUMN_INDEX) {
+    cost /= kIndexSelectivity;
+  }
+  cost += 10 * unusable;
+
+  // A lookup is exact when it is the only constraint applied to the table.
+  // SQLite does not need to evaluate the constraint again for each row.
+  if (index_term >= 0 && expr_index == 1) {
+    pIdxInfo->aConstraintUsage[index_term].omit = 1;
+  }
+
+  PlanHints hints;
+#if SQLITE_VERSION_NUMBER >= 3010000
+  hints.columns_used = pIdxInfo->colUsed;
+#endif
+  // A table generating rows in the order of a column replaces the sort.
+  if (pIdxInfo->nOrderBy == 1 && pIdxInfo->aOrderBy[0].iColumn >= 0 &&
+      static_cast<size_t>(pIdxInfo->aOrderBy[0].iColumn) <
+          content->columns.size()) {
+    const auto &name = content->columns[pIdxInfo->aOrderBy[0].iColumn].first;
+    auto options = content->column_options.find(name);
+    bool equals = false;
+    for (const auto &constraint : constraints) {
+      // Each value of an IN list is filtered separately.
+      equals |= (constraint.first == name && constraint.second.op == EQUALS);
+    }
+    if (options != content->column_options.end() &&
+        (options->second & COLUMN_ORDERED) && !equals) {
+      pIdxInfo->orderByConsumed = 1;
+      hints.descending = (pIdxInfo->aOrderBy[0].desc != 0);
+    }
+  }
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // SQLite 3.38 offers LIMIT and OFFSET as constraints. A LIMIT only bounds
+  // the generated rows if no rows are filtered later. With an ORDER BY the
+  // first rows generated are not the first rows selected, even if the table
+  // generates in a column's order, so the limit is not passed.
+  if (expr_index == 0 && unusable == 0 && pIdxInfo->nOrderBy == 0) {
+    for (int i = 0; i < pIdxInfo->nConstraint; ++i) {
+      const auto &constraint_info = pIdxInfo->aConstraint[i];
+      if (!constraint_info.usable) {
+        continue;
+      }
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT) {
+        hints.limit_arg = ++expr_index;
+        pIdxInfo->aConstraintUsage[i].argvIndex = hints.limit_arg;
+      } else if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+        hints.offset_arg = ++expr_index;
+        pIdxInfo->aConstraintUsage[i].argvIndex = hints.offset_arg;
+      }
+    }
+  }
+#endif
+
   pIdxInfo->idxNum = kConstraintIndexID++;
 // Add the constraint set to the table's tracked constraints.
 #if defined(DEBUG)
-  plan("Recording constraint set for table: " + pVtab->content->name +
-       " [cost=" + std::to_string(cost) + " size=" +
-       std::to_string(constraints.size()) + " idx=" +
-       std::to_string(pIdxInfo->idxNum) + "]");
+  plan("Recording constraint set for table: " + content->name + " [cost=" +
+       std::to_string(cost) + " size=" + std::to_string(constraints.size()) +
+       " idx=" + std::to_string(pIdxInfo->idxNum) + "]");
 #endif
-  pVtab->content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  if (kPlanRecorder != nullptr) {
+    auto &scan = (*kPlanRecorder)[pIdxInfo->idxNum];
+    scan.table = content->name;
+    scan.cost = cost;
+    scan.constraints = constraints.size();
+    scan.columns.clear();
+    for (const auto &constraint : constraints) {
+      scan.columns.insert(constraint.first);
+    }
+  }
+  if (kContentRecorder != nullptr) {
+    (*kContentRecorder)[pIdxInfo->idxNum] = content;
+  }
+  content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  content->hints[pIdxInfo->idxNum] = hints;
   pIdxInfo->estimatedCost = cost;
   return SQLITE_OK;
 }
 
+/**
+ * @brief Generate rows for a query context using the table's route.
+ *
+ * A local table may return a streaming generator, which is set in generator.
+ * If the caller cannot accept a generator it is drained into rows.
+ */
+static void generateRows(const VirtualTableContent *content,
+                         QueryContext &context,
+                         TableRows &rows,
+                         RowGeneratorRef *generator) {
+  TRACE_SCOPE_DETAIL("table.generate", content->name);
+  auto table = content->plugin.lock();
+  if (table == nullptr) {
+    table = Registry::getLocal<TablePlugin>("table", content->name);
+  }
+
+  if (table != nullptr) {
+    // A local table plugin fills typed rows without a registry call.
+    try {
+      // Prefer a streaming generator, rows are pulled in batches by xNext.
+      auto streaming = table->generator(context);
+      if (streaming == nullptr) {
+        table->generateRows(context, rows);
+      } else if (generator != nullptr) {
+        *generator = std::move(streaming);
+      } else {
+        while (streaming->next(rows)) {
+        }
+      }
+    } catch (const std::exception &e) {
+      LOG(ERROR) << "table registry " << content->name
+                 << " plugin caused exception: " << e.what();
+      rows.clear();
+      if (generator != nullptr) {
+        *generator = nullptr;
+      }
+      if (FLAGS_registry_exceptions) {
+        throw;
+      }
+    }
+  } else {
+    // Generate the row data set using the external table's route.
+    PluginRequest request = {{"action", "generate"}};
+    TablePlugin::setRequestFromContext(context, request);
+    const auto& external = Registry::registry("table")->getExternal();
+    auto route = external.find(content->name);
+    if (route != external.end()) {
+      // Extension tables may return typed columns instead of Row maps.
+      generateExtensionTable(
+          route->second, content->name, request, content->columns, rows);
+    } else {
+      QueryData data;
+      Registry::call("table", content->name, request, data);
+      TablePlugin::setRowsFromQueryData(content->columns, data, rows);
+    }
+  }
+}
+
+/// Build the key of the constraints and columns a probe's scan generates.
+static std::string probeKey(const QueryContext &context) {
+  std::string key;
+  for (const auto &column : context.constraints) {
+    for (const auto &constraint : column.second.getAll()) {
+      key += '\x1f' + column.first + '\x1e' + std::to_string(constraint.op) +
+             '\x1e' + constraint.expr;
+    }
+  }
+  if (context.projected) {
+    key += '\x1d';
+    for (const auto &column : context.used_columns) {
+      key += '\x1f' + column;
+    }
+  }
+  return key + '\x1c' + std::to_string(context.sample_rate);
+}
+
+/**
+ * @brief Serve an exact index lookup from the cursor's ProbeIndex.
+ *
+ * Each probe of an index column would otherwise call the table generator
+ * again, once per outer row of a JOIN or value of an IN list. After as many
+ * probes as a lookup is assumed cheaper than a scan, the table is generated
+ * once without the probed constraint and the remaining probes use a hash
+ * index.
+ *
+ * The scan keeps the query's other constraints, used columns and sample rate,
+ * and the index is only used by probes with the same ones.
+ *
+ * @return true if the cursor rows were filled from the index.
+ */
+static bool probeRows(BaseCursor *pCur,
+                      const VirtualTableContent *content,
+                      const QueryContext &context,
+                      const ConstraintSet &constraints) {
+  // Only a single EQUALS constraint of an index column is an exact lookup.
+  int column = -1;
+  std::string name;
+  for (const auto &constraint : constraints) {
+    auto options = content->column_options.find(constraint.first);
+    if (constraint.second.op != EQUALS ||
+        options == content->column_options.end() ||
+        options->second != COLUMN_INDEX ||
+        context.constraints.count(constraint.first) == 0 ||
+        context.constraints.at(constraint.first).getAll().size() != 1) {
+      continue;
+    }
+    for (size_t i = 0; i < content->columns.size(); ++i) {
+      if (content->columns[i].first == constraint.first) {
+        column = static_cast<int>(i);
+        name = constraint.first;
+        break;
+      }
+    }
+    break;
+  }
+  if (column < 0) {
+    return false;
+  }
+
+  // The scan generates every row matching the other constraints.
+  QueryContext scan;
+  for (const auto &list : context.constraints) {
+    auto &scan_list = scan.constraints[list.first];
+    scan_list.affinity = list.second.affinity;
+    if (list.first != name) {
+      for (const auto &constraint : list.second.getAll()) {
+        scan_list.add(constraint);
+      }
+    }
+  }
+  scan.used_columns = context.used_columns;
+  scan.projected = context.projected;
+  scan.sample_rate = context.sample_rate;
+  if (scan.projected) {
+    // The index column is read to build the index.
+    scan.used_columns.insert(name);
+  }
+  auto key = probeKey(scan);
+
+  auto &probe = pCur->probe;
+  if (probe.column != column || probe.key != key) {
+    // The cursor is now probing a different column or set of constraints.
+    probe = ProbeIndex();
+    probe.column = column;
+    probe.key = std::move(key);
+  }
+
+  if (!probe.ready) {
+    if (++probe.probes < kIndexSelectivity) {
+      return false;
+    }
+
+    plan("Indexing complete scan for cursor (" + std::to_string(pCur->id) +
+         "): " + name);
+    generateRows(content, scan, probe.rows, nullptr);
+    for (size_t i = 0; i < probe.rows.size(); ++i) {
+      if (static_cast<size_t>(column) < probe.rows[i].size()) {
+        probe.index[TablePlugin::cellText(probe.rows[i][column])].push_back(i);
+      }
+    }
+    probe.ready = true;
+  }
+
+  const auto &expr = context.constraints.at(name).getAll()[0].expr;
+  auto matches = probe.index.find(expr);
+  if (matches != probe.index.end()) {
+    pCur->rows.reserve(matches->second.size());
+    for (const auto &i : matches->second) {
+      pCur->rows.push_back(probe.rows[i]);
+    }
+  }
+  return true;
+}
+
+/// Read the integer value of an xFilter argument, 0 if absent or negative.
+static int hintArgument(int arg, int argc, sqlite3_value **argv) {
+  if (arg <= 0 || arg > argc) {
+    return 0;
+  }
+  return std::max(sqlite3_value_int(argv[arg - 1]), 0);
+}
+
+/// Pass the used columns, LIMIT, and order of a plan to the table generator.
+static void applyHints(const PlanHints &hints,
+                       const VirtualTableContent *content,
+                       int argc,
+                       sqlite3_value **argv,
+                       QueryContext &context) {
+  // The highest bit stands for every column from the 64th.
+  context.projected = true;
+  for (size_t i = 0; i < content->columns.size(); ++i) {
+    auto bit = std::min<size_t>(i, 63);
+    if ((hints.columns_used & (1ULL << bit)) != 0) {
+      context.used_columns.insert(content->columns[i].first);
+    }
+  }
+
+  // Rows skipped by an OFFSET must still be generated.
+  auto limit = hintArgument(hints.limit_arg, argc, argv);
+  if (limit > 0) {
+    context.limit = limit + hintArgument(hints.offset_arg, argc, argv);
+  }
+  context.descending = hints.descending;
+}
+
 static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
                    int idxNum,
                    const char *idxStr,
@@ -273,16 +803,31 @@ static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
   BaseCursor *pCur = (BaseCursor *)pVtabCursor;
   auto *pVtab = (VirtualTable *)pVtabCursor->pVtab;
   auto *content = pVtab->content;
+  TRACE_SCOPE_DETAIL("sql.xFilter", content->name);
 
+  // A new filter starts a new scan of the cursor.
+  recordScan(pCur, content->name);
   pCur->row = 0;
   pCur->n = 0;
-  QueryContext context;
+  pCur->profile.filters++;
 
-  for (size_t i = 0; i < content->columns.size(); ++i) {
-    // Set the column affinity for each optional constraint list.
-    // There is a separate list for each column name.
-    context.constraints[content->columns[i].first].affinity =
-        content->columns[i].second;
+  // Reset the virtual table contents.
+  pCur->rows.clear();
+  pCur->generator = nullptr;
+  pCur->offset = 0;
+
+  // A JOIN filters the inner cursor once per outer row, the cursor's context
+  // and its constraint lists are reused instead of allocated by each filter.
+  auto &context = pCur->context;
+  if (context.constraints.empty()) {
+    for (size_t i = 0; i < content->columns.size(); ++i) {
+      // Set the column affinity for each optional constraint list.
+      // There is a separate list for each column name.
+      context.constraints[content->columns[i].first].affinity =
+          content->columns[i].second;
+    }
+  } else {
+    context.reset();
   }
 
 // Filtering between cursors happens iteratively, not consecutively.
@@ -294,10 +839,14 @@ static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
 #endif
 
   // Iterate over every argument to xFilter, filling in constraint values.
+  bool constrained = false;
   if (content->constraints.size() > 0) {
     auto &constraints = content->constraints[idxNum];
     if (argc > 0) {
-      for (size_t i = 0; i < static_cast<size_t>(argc); ++i) {
+      // Arguments after the column constraints hold the plan hints.
+      auto constraint_args = std::min(static_cast<size_t>(argc),
+                                      constraints.size());
+      for (size_t i = 0; i < constraint_args; ++i) {
         auto expr = (const char *)sqlite3_value_text(argv[i]);
         if (expr == nullptr || expr[0] == 0) {
           // SQLite did not expose the expression value.
@@ -305,33 +854,216 @@ static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
         }
         // Set the expression from SQLite's now-populated argv.
         auto &constraint = constraints[i];
-        constraint.second.expr = std::string(expr);
-        plan("Adding constraint to cursor (" + std::to_string(pCur->id) +
-             "): " + constraint.first + " " + opString(constraint.second.op) +
-             " " + constraint.second.expr);
+        constraint.second.expr.assign(expr);
+        if (FLAGS_planner) {
+          plan("Adding constraint to cursor (" + std::to_string(pCur->id) +
+               "): " + constraint.first + " " +
+               opString(constraint.second.op) + " " + constraint.second.expr);
+        }
         // Add the constraint to the column-sorted query request map.
         context.constraints[constraint.first].add(constraint.second);
+        constrained = true;
       }
     } else if (constraints.size() > 0) {
       // Constraints failed.
     }
   }
 
-  // Reset the virtual table contents.
-  pCur->data.clear();
-  // Generate the row data set.
-  PluginRequest request = {{"action", "generate"}};
-  plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
-  TablePlugin::setRequestFromContext(context, request);
-  Registry::call("table", pVtab->content->name, request, pCur->data);
+  auto hints = content->hints.find(idxNum);
+  if (hints != content->hints.end()) {
+    applyHints(hints->second, content, argc, argv, context);
+  }
+  context.sample_rate = getQuerySampleRate();
+
+  if (constrained) {
+    pCur->profile.constrained++;
+  }
+  if (FLAGS_planner) {
+    plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
+  }
+  GeneratorTimer timer(pCur);
+  if (!constrained && context.limit == 0 && !context.descending &&
+      TablePrefetch::take(content, pCur->rows)) {
+    // The scan was generated concurrently with the statement's other scans.
+    pCur->scanned = true;
+    pCur->n = pCur->rows.size();
+    pCur->scan_rows += pCur->n;
+    pCur->profile.rows_produced += pCur->n;
+    return SQLITE_OK;
+  }
+
+  if (probeRows(pCur, content, context, content->constraints[idxNum])) {
+    pCur->n = pCur->rows.size();
+    pCur->profile.probe_hits++;
+    pCur->profile.rows_produced += pCur->n;
+    return SQLITE_OK;
+  }
+
+  pCur->scanned = true;
+  generateRows(content, context, pCur->rows, &pCur->generator);
+  if (pCur->generator != nullptr) {
+    pullRows(pCur);
+    return SQLITE_OK;
+  }
 
   // Set the number of rows.
-  pCur->n = pCur->data.size();
+  pCur->n = pCur->rows.size();
+  pCur->scan_rows += pCur->n;
+  pCur->profile.rows_produced += pCur->n;
   return SQLITE_OK;
 }
 }
 }
 
+struct PrefetchScan {
+  /// The scanned virtual table.
+  VirtualTableContent *content{nullptr};
+
+  /// Set by the first of the task or a filter to generate the rows.
+  std::atomic<bool> claimed{false};
+
+  /// Set when a filter took the scan.
+  bool taken{false};
+
+  /// Set if the task generated the rows.
+  bool ready{false};
+
+  /// The generated rows.
+  TableRows rows;
+
+  /// The executor task generating the rows.
+  TaskRef task{nullptr};
+};
+
+/// The prefetch of the statement this thread is stepping.
+static thread_local TablePrefetch *kTablePrefetch{nullptr};
+
+/// Generate the rows of a scan without constraints, on an executor worker.
+static void generatePrefetch(PrefetchScan &scan,
+                             size_t interval,
+                             double sample_rate,
+                             QueryResources *resources) {
+  MemoryArenaScope arena(ARENA_SQL);
+  QueryResources scope(resources);
+  // Tables use the query thread's cache interval to check their cache.
+  auto cache_interval = TablePlugin::kCacheInterval;
+  TablePlugin::kCacheInterval = interval;
+
+  QueryContext context;
+  for (const auto &column : scan.content->columns) {
+    context.constraints[column.first].affinity = column.second;
+  }
+  context.sample_rate = sample_rate;
+  try {
+    tables::sqlite::generateRows(scan.content, context, scan.rows, nullptr);
+    scan.ready = true;
+  } catch (const std::exception &) {
+    // The filter generates the table again and reports the failure.
+    scan.rows.clear();
+  }
+  TablePlugin::kCacheInterval = cache_interval;
+}
+
+TablePrefetch::TablePrefetch(const std::string &query, sqlite3 *db)
+    : previous_(kTablePrefetch) {
+  // A nested statement, run by a table generator, does not use this prefetch.
+  kTablePrefetch = this;
+  if (!FLAGS_table_prefetch) {
+    return;
+  }
+
+  std::vector<TableScan> scans;
+  std::vector<VirtualTableContent *> contents;
+  QueryPlanner planner(query, db);
+  if (!planner.getScans(scans, contents).ok() || scans.size() < 2) {
+    // A single scan has no other scan to overlap with.
+    return;
+  }
+
+  auto interval = TablePlugin::kCacheInterval;
+  auto sample_rate = getQuerySampleRate();
+  auto resources = QueryResources::current();
+  for (size_t i = 0; i < scans.size(); ++i) {
+    auto content = contents[i];
+    if (scans[i].constraints > 0 || content == nullptr) {
+      continue;
+    }
+
+    // Tables requiring a constraint do not generate complete scans.
+    bool required = false;
+    for (const auto &options : content->column_options) {
+      required |= ((options.second & COLUMN_REQUIRED) != 0);
+    }
+    bool started = false;
+    for (const auto &scan : scans_) {
+      started |= (scan->content == content);
+    }
+    if (required || started) {
+      continue;
+    }
+
+    auto scan = std::make_shared<PrefetchScan>();
+    scan->content = content;
+    scan->task = Dispatcher::submit(
+        [scan, interval, sample_rate, resources](const Task &) {
+          if (!scan->claimed.exchange(true)) {
+            generatePrefetch(*scan, interval, sample_rate, resources);
+          }
+        },
+        TASK_PRIORITY_SCHEDULE);
+    if (scan->task != nullptr) {
+      scans_.push_back(std::move(scan));
+    }
+  }
+}
+
+TablePrefetch::~TablePrefetch() {
+  for (auto &scan : scans_) {
+    if (scan->taken) {
+      continue;
+    }
+    if (!scan->claimed.exchange(true)) {
+      scan->task->cancel();
+    } else {
+      // The task references the table content until it finishes.
+      scan->task->wait();
+    }
+  }
+  kTablePrefetch = previous_;
+}
+
+bool TablePrefetch::take(const VirtualTableContent *content, TableRows &rows) {
+  auto prefetch = kTablePrefetch;
+  if (prefetch == nullptr) {
+    return false;
+  }
+
+  for (auto &scan : prefetch->scans_) {
+    if (scan->content != content || scan->taken) {
+      continue;
+    }
+    scan->taken = true;
+    if (!scan->claimed.exchange(true)) {
+      // The scan has not started, the filter generates it without waiting.
+      scan->task->cancel();
+      return false;
+    }
+    scan->task->wait();
+    if (!scan->ready) {
+      return false;
+    }
+    rows = std::move(scan->rows);
+    return true;
+  }
+  return false;
+}
+
+void setPlanRecorder(std::map<int, TableScan> *plans,
+                     std::map<int, VirtualTableContent *> *contents) {
+  tables::sqlite::kPlanRecorder = plans;
+  tables::sqlite::kContentRecorder = contents;
+}
+
 Status attachTableInternal(const std::string &name,
                            const std::string &statement,
                            sqlite3 *db) {
@@ -369,6 +1101,9 @@ Status attachTableInternal(const std::string &name,
   };
   // clang-format on
 
+  // Cached statements were compiled against the previous schema.
+  SQLiteDBManager::resetStatements(db);
+
   // Note, if the clientData API is used then this will save a registry call
   // within xCreate.
   int rc = sqlite3_create_module(db, name.c_str(), &module, 0);
@@ -383,6 +1118,8 @@ Status attachTableInternal(const std::string &name,
 }
 
 Status detachTableInternal(const std::string &name, sqlite3 *db) {
+  // Cached statements may reference the table.
+  SQLiteDBManager::resetStatements(db);
   auto format = "DROP TABLE IF EXISTS temp." + name;
   int rc = sqlite3_exec(db, format.c_str(), nullptr, nullptr, 0);
   if (rc != SQLITE_OK) {
@@ -392,16 +1129,60 @@ Status detachTableInternal(const std::string &name, sqlite3 *db) {
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
 
-void attachVirtualTables(sqlite3 *db) {
-  PluginResponse response;
-  for (const auto &name : Registry::names("table")) {
-    // Column information is nice for virtual table create call.
-    auto status =
-        Registry::call("table", name, {{"action", "columns"}}, response);
-    if (status.ok()) {
-      auto statement = columnDefinition(response);
-      attachTableInternal(name, statement, db);
+/// Check if a table is attached to the temp schema of a connection.
+static bool isAttached(sqlite3 *db, const std::string &name) {
+  sqlite3_stmt *stmt = nullptr;
+  auto rc = sqlite3_prepare_v2(
+      db,
+      "SELECT 1 FROM sqlite_temp_master WHERE type = 'table' AND name = ?",
+      -1,
+      &stmt,
+      nullptr);
+  if (rc != SQLITE_OK || stmt == nullptr) {
+    return false;
+  }
+
+  sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+  auto attached = (sqlite3_step(stmt) == SQLITE_ROW);
+  sqlite3_finalize(stmt);
+  return attached;
+}
+
+bool attachMissingTable(sqlite3 *db) {
+  static const std::string kNoSuchTable = "no such table: ";
+  std::string error = sqlite3_errmsg(db);
+  if (error.compare(0, kNoSuchTable.size(), kNoSuchTable) != 0) {
+    return false;
+  }
+
+  // Tables are attached to the temp schema, other schemas are not resolved.
+  auto name = error.substr(kNoSuchTable.size());
+  if (name.compare(0, 5, "temp.") == 0) {
+    name = name.substr(5);
+  } else if (name.find('.') != std::string::npos) {
+    return false;
+  }
+  return attachRegisteredTable(db, name);
+}
+
+bool attachRegisteredTable(sqlite3 *db, std::string name) {
+  // SQLite names are case insensitive, registered table names are lowercase.
+  if (!Registry::exists("table", name)) {
+    name = boost::algorithm::to_lower_copy(name);
+    if (!Registry::exists("table", name)) {
+      return false;
     }
   }
+
+  if (SQLiteDBManager::isDisabled(name) || SQLiteDBManager::isDetached(name) ||
+      isAttached(db, name)) {
+    return false;
+  }
+
+  PluginResponse response;
+  if (!SQLiteDBManager::getColumns(name, response).ok() || response.empty()) {
+    return false;
+  }
+  return attachTableInternal(name, columnDefinition(response), db).ok();
 }
 }
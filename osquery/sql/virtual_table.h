@@ -10,7 +10,12 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
 #include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
 
 #include <osquery/tables.h>
 
@@ -33,15 +38,95 @@ namespace osquery {
  * additional data, restrict based on constraints, or potentially yield from
  * a cache or choose not to generate certain columns.
  */
+/// Hints from an xBestIndex plan that are not column constraints.
+struct PlanHints {
+  /// Bitmap of the column ordinals the plan reads, see colUsed.
+  uint64_t columns_used{~0ULL};
+  /// The xFilter argument number of a LIMIT, 0 if SQLite did not pass one.
+  int limit_arg{0};
+  /// The xFilter argument number of an OFFSET, 0 if SQLite did not pass one.
+  int offset_arg{0};
+  /// Set if SQLite expects the rows of an ordered column in descending order.
+  bool descending{false};
+};
+
 struct VirtualTableContent {
   /// Friendly name for the table.
   TableName name;
   /// Table column structure, retrieved once via the TablePlugin call API.
   TableColumns columns;
+  /// Planner options for columns, retrieved with the column structure.
+  TableColumnOptions column_options;
+  /// Relative cost of a full table scan, retrieved via the attributes action.
+  size_t cost{kDefaultTableCost};
+  /// The local table plugin, filters use it without a registry call.
+  std::weak_ptr<TablePlugin> plugin;
   /// Transient set of virtual table access constraints.
   std::unordered_map<size_t, ConstraintSet> constraints;
+  /// Transient plan hints, keyed like the constraints.
+  std::unordered_map<size_t, PlanHints> hints;
+};
+
+/**
+ * @brief The rows of a complete table scan, indexed by one column's values.
+ *
+ * A cursor that repeatedly probes the same index column, as the inner table
+ * of a JOIN or with an IN list, generates the table once and serves each
+ * remaining probe from this hash index.
+ */
+struct ProbeIndex {
+  /// The column ordinal of the probed index column.
+  int column{-1};
+  /// The other constraints and columns of the probes, see probeRows.
+  std::string key;
+  /// Number of probes of the column by the cursor.
+  size_t probes{0};
+  /// True when the complete scan has been generated and indexed.
+  bool ready{false};
+  /// The typed rows of the complete scan.
+  TableRows rows;
+  /// Map of each column value to the row ordinals with that value.
+  std::unordered_map<std::string, std::vector<size_t>> index;
+};
+
+/**
+ * @brief Work done for a table by query cursors while profiling is enabled.
+ *
+ * The timed work is the table generator, called from xFilter or to pull a
+ * batch of streamed rows. CPU time is the process CPU time, which includes
+ * threads the generator waits on.
+ */
+struct TableProfile {
+  /// Number of xFilter calls.
+  size_t filters{0};
+  /// Filters passing at least one constraint to the generator.
+  size_t constrained{0};
+  /// Filters served from a ProbeIndex without calling the generator.
+  size_t probe_hits{0};
+  /// Microseconds of wall time spent generating rows.
+  uint64_t wall_time{0};
+  /// Microseconds of process CPU time spent generating rows.
+  uint64_t cpu_time{0};
+  /// Rows returned by the generator or a ProbeIndex.
+  size_t rows_produced{0};
+  /// Rows SQLite stepped over with xNext.
+  size_t rows_consumed{0};
+  /// Bytes of column values read by SQLite with xColumn.
+  size_t bytes{0};
 };
 
+/// Profiles by table name.
+using TableProfiles = std::map<std::string, TableProfile>;
+
+/// Enable or disable the profiling of virtual table cursors.
+void setTableProfiling(bool enabled);
+
+/// Check if the virtual table cursors are profiled.
+bool isTableProfiling();
+
+/// Return the profiles of cursors closed since the last call, and clear them.
+TableProfiles takeTableProfiles();
+
 /**
  * @brief osquery cursor object.
  *
@@ -52,12 +137,30 @@ struct BaseCursor {
   sqlite3_vtab_cursor base;
   /// Track cursors for optional planner output.
   size_t id{0};
-  /// Table data generated from last access.
-  QueryData data;
+  /// Typed, column-ordered table data generated from last access.
+  TableRows rows;
   /// Current cursor position.
   size_t row{0};
   /// Total number of rows.
   size_t n{0};
+  /// Optional streaming source, rows holds only the current batch.
+  RowGeneratorRef generator{nullptr};
+  /// Number of rows in batches already consumed from the generator.
+  size_t offset{0};
+  /// Rows for repeated index probes, kept for the life of the cursor.
+  ProbeIndex probe;
+  /// The constraints of the current scan, reused by each filter.
+  QueryContext context;
+  /// True if the generator was called for the current scan.
+  bool scanned{false};
+  /// Microseconds of generator wall time spent on the current scan.
+  uint64_t scan_time{0};
+  /// Rows generated for the current scan.
+  size_t scan_rows{0};
+  /// True if the cursor was opened while profiling was enabled.
+  bool profiled{false};
+  /// The cursor's work, added to the table's profile when closed.
+  TableProfile profile;
 };
 
 /**
@@ -71,6 +174,55 @@ struct VirtualTable {
   VirtualTableContent *content{nullptr};
 };
 
+/**
+ * @brief Record the plans xBestIndex offers on this thread while set.
+ *
+ * Plans are keyed by their index number, EXPLAIN QUERY PLAN reports the
+ * index number of the plan SQLite chose for each virtual table scan. The
+ * virtual table of each plan is recorded in contents.
+ */
+void setPlanRecorder(std::map<int, TableScan> *plans,
+                     std::map<int, VirtualTableContent *> *contents);
+
+/// A table scan generated by a TablePrefetch.
+struct PrefetchScan;
+
+/**
+ * @brief Generate the independent table scans of a statement concurrently.
+ *
+ * SQLite generates each table of a UNION ALL, or of a JOIN of unrelated
+ * tables, in turn as the statement reaches it. With `table_prefetch` the
+ * QueryPlanner finds the scans without constraints, which do not depend on
+ * another table, and each is generated on the Dispatcher's executor. The first
+ * filter without constraints of each table takes the generated rows. A scan
+ * that has not started when its filter is reached is generated by the filter.
+ *
+ * The prefetch applies to the statement stepped by this thread while in scope.
+ */
+class TablePrefetch : private boost::noncopyable {
+ public:
+  TablePrefetch(const std::string &query, sqlite3 *db);
+
+  /// Cancel the scans that have not started and wait for the running scans.
+  ~TablePrefetch();
+
+  /**
+   * @brief Take the rows of a table scanned by this thread's prefetch.
+   *
+   * @param content the virtual table filtered without constraints.
+   * @param rows output, the generated rows.
+   * @return true if the rows were generated by the prefetch.
+   */
+  static bool take(const VirtualTableContent *content, TableRows &rows);
+
+ private:
+  /// The scans started for the statement.
+  std::vector<std::shared_ptr<PrefetchScan>> scans_;
+
+  /// The prefetch of a statement this thread was stepping before.
+  TablePrefetch *previous_{nullptr};
+};
+
 /// Attach a table plugin name to an in-memory SQLite database.
 Status attachTableInternal(const std::string &name,
                            const std::string &statement,
@@ -79,6 +231,20 @@ Status attachTableInternal(const std::string &name,
 /// Detach (drop) a table.
 Status detachTableInternal(const std::string &name, sqlite3 *db);
 
-/// Attach all table plugins to an in-memory SQLite database.
-void attachVirtualTables(sqlite3 *db);
+/**
+ * @brief Attach the registered table SQLite last reported as missing.
+ *
+ * A connection attaches tables on first reference: when compiling a statement
+ * fails with "no such table" the named table plugin is attached.
+ *
+ * @return true if a table was attached and the statement may compile again.
+ */
+bool attachMissingTable(sqlite3 *db);
+
+/**
+ * @brief Attach a registered table if the connection has not attached it.
+ *
+ * @return true if the table was attached by this call.
+ */
+bool attachRegisteredTable(sqlite3 *db, std::string name);
 }
@@ -52,8 +52,10 @@ const std::map<std::string, std::string> kFirefoxAddonKeys = {
     {"descriptor", "path"},
 };
 
-void genFirefoxAddonsFromExtensions(const std::string& uid,
-                                    const std::string& path,
+/// The most profiles with kept addon rows.
+const size_t kFirefoxCacheMax = 16384;
+
+void genFirefoxAddonsFromExtensions(const std::string& path,
                                     QueryData& results) {
   pt::ptree tree;
   if (!osquery::parseJSON(path + kFirefoxExtensionsFile, tree).ok()) {
@@ -63,7 +65,6 @@ void genFirefoxAddonsFromExtensions(const std::string& uid,
 
   for (const auto& addon : tree.get_child("addons")) {
     Row r;
-    r["uid"] = uid;
     // Most of the keys are in the top-level JSON dictionary.
     for (const auto& it : kFirefoxAddonKeys) {
       r[it.second] = addon.second.get(it.first, "");
@@ -85,26 +86,33 @@ void genFirefoxAddonsFromExtensions(const std::string& uid,
 }
 
 QueryData genFirefoxAddons(QueryContext& context) {
+  static FileRowsCache profiles(kFirefoxCacheMax);
   QueryData results;
 
-  // Iterate over each user
-  QueryData users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their Firefox profiles.
-      std::vector<std::string> profiles;
-      auto directory = fs::path(row.at("directory")) / kFirefoxPath;
-      if (!listDirectoriesInDirectory(directory, profiles).ok()) {
-        continue;
-      }
-
-      // Generate an addons list from their extensions JSON.
-      for (const auto& profile : profiles) {
-        genFirefoxAddonsFromExtensions(row.at("uid"), profile, results);
-      }
-    }
-  }
-
+  // Each user's profiles are <kFirefoxPath>/<PROFILE>/extensions.json.
+  auto users = usersFromContext(context);
+  walkBrowserFiles(
+      users,
+      kFirefoxPath,
+      2,
+      "extensions.json",
+      ([&results](const WalkEntry& extensions,
+                  const std::vector<std::string>& uids) {
+        const auto& profile = extensions.directory;
+        QueryData rows;
+        profiles.get(extensions.path,
+                     extensions.info,
+                     [&profile](QueryData& parsed) {
+                       genFirefoxAddonsFromExtensions(profile, parsed);
+                     },
+                     rows);
+        for (const auto& uid : uids) {
+          for (auto r : rows) {
+            r["uid"] = uid;
+            results.push_back(std::move(r));
+          }
+        }
+      }));
   return results;
 }
 }
@@ -8,9 +8,16 @@
  *
  */
 
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+
 #include <osquery/logger.h>
 #include <osquery/tables/applications/browser_utils.h>
 
+#include "osquery/core/json.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
@@ -27,9 +34,94 @@ const std::map<std::string, std::string> kExtensionKeys = {
     {"author", "author"},
     {"background.persistent", "persistent"}};
 
-void genExtension(const std::string& uid,
-                  const std::string& path,
-                  QueryData& results) {
+/// The most manifests with kept rows.
+const size_t kManifestCacheMax = 32768;
+
+/// Remove the trailing separators of a directory path.
+static std::string trimDirectory(std::string path) {
+  while (!path.empty() && path.back() == '/') {
+    path.pop_back();
+  }
+  return path;
+}
+
+void walkBrowserFiles(const QueryData& users,
+                      const std::string& sub_dir,
+                      size_t depth,
+                      const std::string& name,
+                      const BrowserFileCallback& callback) {
+  // The browser directory of each user, several users may share a home.
+  auto profile = sub_dir.find('%');
+  std::map<std::string, std::vector<std::string>> browsers;
+  for (const auto& row : users) {
+    if (row.count("uid") > 0 && row.count("directory") > 0) {
+      auto home = trimDirectory(row.at("directory"));
+      auto browser = trimDirectory(home + sub_dir.substr(0, profile));
+      browsers[browser].push_back(row.at("uid"));
+    }
+  }
+
+  WalkLimits limits;
+  limits.follow_links = true;
+  limits.hidden = false;
+
+  // The directories walked for files, within each profile if any.
+  std::map<std::string, std::vector<std::string>> roots;
+  if (profile == std::string::npos) {
+    roots = std::move(browsers);
+  } else {
+    std::vector<std::string> directories;
+    for (const auto& browser : browsers) {
+      directories.push_back(browser.first);
+    }
+
+    limits.max_depth = 1;
+    std::vector<WalkEntry> profiles;
+    FileWalker::walk(directories, limits, profiles);
+    auto suffix = trimDirectory(sub_dir.substr(profile + 1));
+    for (const auto& entry : profiles) {
+      if (S_ISDIR(entry.info.st_mode)) {
+        const auto& uids = browsers.at(entry.directory);
+        auto& root = roots[entry.path + suffix];
+        root.insert(root.end(), uids.begin(), uids.end());
+      }
+    }
+  }
+
+  std::vector<std::string> directories;
+  for (const auto& root : roots) {
+    directories.push_back(root.first);
+  }
+
+  limits.max_depth = depth;
+  FileWalker walker(directories, limits);
+  std::vector<WalkEntry> entries;
+  bool more = true;
+  while (more) {
+    entries.clear();
+    more = walker.next(entries);
+    for (const auto& entry : entries) {
+      auto separator = entry.path.rfind('/');
+      if (entry.depth != depth || !S_ISREG(entry.info.st_mode) ||
+          entry.path.compare(separator + 1, std::string::npos, name) != 0) {
+        continue;
+      }
+
+      // Entries at the walked depth are depth components below their root.
+      auto root = entry.path;
+      for (size_t level = 0; level < depth; level++) {
+        root.erase(root.rfind('/'));
+      }
+      auto owners = roots.find(root);
+      if (owners != roots.end()) {
+        callback(entry, owners->second);
+      }
+    }
+  }
+}
+
+/// Parse the manifest within an extension version directory.
+static void genManifest(const std::string& path, QueryData& results) {
   std::string json_data;
   if (!forensicReadFile(path + kManifestFile, json_data).ok()) {
     VLOG(1) << "Could not read file: " << path + kManifestFile;
@@ -38,17 +130,12 @@ void genExtension(const std::string& uid,
 
   // Read the extensions data into a JSON blob, then property tree.
   pt::ptree tree;
-  try {
-    std::stringstream json_stream;
-    json_stream << json_data;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
+  if (!parseJSONTree(json_data, tree).ok()) {
     VLOG(1) << "Could not parse JSON from: " << path + kManifestFile;
     return;
   }
 
   Row r;
-  r["uid"] = uid;
   // Most of the keys are in the top-level JSON dictionary.
   for (const auto& it : kExtensionKeys) {
     r[it.second] = tree.get<std::string>(it.first, "");
@@ -71,39 +158,80 @@ void genExtension(const std::string& uid,
   results.push_back(r);
 }
 
-QueryData genChromeBasedExtensions(QueryContext& context,
-                                   const fs::path& sub_dir) {
-  QueryData results;
+/// Append the extension rows of a version directory for each owning user.
+static void genExtension(const std::string& path,
+                         const struct stat& info,
+                         const std::vector<std::string>& uids,
+                         QueryData& results) {
+  static FileRowsCache manifests(kManifestCacheMax);
+
+  QueryData rows;
+  manifests.get(path + kManifestFile,
+                info,
+                [&path](QueryData& parsed) { genManifest(path, parsed); },
+                rows);
+  for (const auto& uid : uids) {
+    for (auto r : rows) {
+      r["uid"] = uid;
+      results.push_back(std::move(r));
+    }
+  }
+}
 
-  auto users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their chrome profiles.
-      std::vector<std::string> profiles;
-      fs::path extension_path = row.at("directory") / sub_dir;
-      if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
-        continue;
+/// Generate the extensions of the version directories in path constraints.
+static void genExtensionsFromPaths(const QueryContext& context,
+                                   const QueryData& users,
+                                   const std::string& sub_dir,
+                                   QueryData& results) {
+  // Version directories are <sub_dir>/<EXTENSION>/<VERSION>/.
+  auto pattern = sub_dir;
+  std::replace(pattern.begin(), pattern.end(), '%', '*');
+  pattern += "*/*/";
+
+  auto paths = context.constraints.at("path").getAll(EQUALS);
+  for (const auto& path : paths) {
+    // Only the home directory owning the path is read.
+    std::vector<std::string> uids;
+    for (const auto& row : users) {
+      if (row.count("uid") > 0 && row.count("directory") > 0) {
+        auto expected = trimDirectory(row.at("directory")) + pattern;
+        if (fnmatch(expected.c_str(),
+                    path.c_str(),
+                    FNM_PATHNAME | FNM_PERIOD) == 0) {
+          uids.push_back(row.at("uid"));
+        }
       }
+    }
 
-      // For each profile list each extension in the Extensions directory.
-      std::vector<std::string> extensions;
-      for (const auto& profile : profiles) {
-        listDirectoriesInDirectory(profile, extensions);
-      }
+    struct stat info;
+    if (uids.empty() || stat((path + kManifestFile).c_str(), &info) != 0 ||
+        !S_ISREG(info.st_mode)) {
+      continue;
+    }
+    genExtension(path, info, uids, results);
+  }
+}
 
-      // Generate an addons list from their extensions JSON.
-      std::vector<std::string> versions;
-      for (const auto& extension : extensions) {
-        listDirectoriesInDirectory(extension, versions);
-      }
+QueryData genChromeBasedExtensions(QueryContext& context,
+                                   const fs::path& sub_dir) {
+  QueryData results;
 
-      // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
-      for (const auto& version : versions) {
-        genExtension(row.at("uid"), version, results);
-      }
-    }
+  auto users = usersFromContext(context);
+  if (context.hasConstraint("path", EQUALS)) {
+    genExtensionsFromPaths(context, users, sub_dir.string(), results);
+    return results;
   }
 
+  // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
+  walkBrowserFiles(
+      users,
+      sub_dir.string(),
+      3,
+      "manifest.json",
+      ([&results](const WalkEntry& manifest,
+                  const std::vector<std::string>& uids) {
+        genExtension(manifest.directory + "/", manifest.info, uids, results);
+      }));
   return results;
 }
 }
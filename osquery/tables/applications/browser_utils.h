@@ -8,11 +8,15 @@
  *
  */
 
+#include <functional>
+
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/walker.h"
+
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
@@ -22,6 +26,29 @@ namespace tables {
 QueryData genChromeBasedExtensions(QueryContext& context,
                                    const fs::path& sub_dir);
 
+/// Called for a file found in a browser directory with the uids owning it.
+using BrowserFileCallback = std::function<void(
+    const WalkEntry& file, const std::vector<std::string>& uids)>;
+
+/**
+ * @brief Walk the browser directory of each user for files of a name.
+ *
+ * The home directories are walked in parallel by the filesystem walker
+ * workers. Hidden files are not walked.
+ *
+ * @param users The rows of the users, from usersFromContext.
+ * @param sub_dir The browser directory within a home, a '%' matches each
+ *   profile directory.
+ * @param depth The depth of the files below the browser directory.
+ * @param name The name of the files.
+ * @param callback Called for each file found.
+ */
+void walkBrowserFiles(const QueryData& users,
+                      const std::string& sub_dir,
+                      size_t depth,
+                      const std::string& name,
+                      const BrowserFileCallback& callback);
+
 /// A helper check to rename bool-type values as 1 or 0.
 inline void jsonBoolAsInt(std::string& s) {
   if (s == "true" || s == "YES" || s == "Yes") {
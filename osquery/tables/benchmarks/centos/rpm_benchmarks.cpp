@@ -0,0 +1,30 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+QueryData genRpmPackages(QueryContext& context);
+
+static void TABLES_rpm_packages(benchmark::State& state) {
+  // The package database is opened through librpm, the host's is used.
+  QueryContext context;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(genRpmPackages(context));
+  }
+}
+
+BENCHMARK(TABLES_rpm_packages);
+}
+}
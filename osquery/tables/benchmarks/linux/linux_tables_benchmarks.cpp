@@ -0,0 +1,186 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+namespace tables {
+
+QueryData genProcesses(QueryContext& context);
+QueryData genOpenSockets(QueryContext& context);
+QueryData genUsers(QueryContext& context);
+QueryData genRoutesFromDump(QueryContext& context,
+                            const std::vector<char>& dump);
+
+/// The first socket inode of a synthetic proc root.
+const size_t kBenchmarkInode = 100000;
+
+/**
+ * @brief Write a synthetic `/proc` root with a number of processes.
+ *
+ * Each process has stat, status, and cmdline files and a descriptor of a
+ * socket. The socket of each process is listed in the net/tcp file.
+ */
+static std::string getBenchmarkProc(size_t size) {
+  auto root = kTestWorkingDirectory + "tables_benchmark_proc_" +
+              std::to_string(size);
+  fs::create_directories(root + "/net");
+
+  std::string tcp =
+      "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when "
+      "retrnsmt   uid  timeout inode\n";
+  for (size_t i = 0; i < size; i++) {
+    auto pid = std::to_string(i + 1);
+    auto path = root + "/" + pid;
+    fs::create_directories(path + "/fd");
+    writeTextFile(path + "/stat",
+                  pid + " (benchmark) S 1 " + pid +
+                      " 1 0 -1 4194560 100 0 0 0 5 3 0 0 20 0 1 0 1000 "
+                      "16384 100\n");
+    writeTextFile(path + "/status",
+                  "Name:\tbenchmark\nUid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\n"
+                  "VmSize:\t    1000 kB\nVmRSS:\t     100 kB\n");
+    writeTextFile(path + "/cmdline", std::string("benchmark\0--flag\0", 17));
+
+    auto inode = std::to_string(kBenchmarkInode + i);
+    symlink("/dev/null", (path + "/fd/0").c_str());
+    symlink(("socket:[" + inode + "]").c_str(), (path + "/fd/3").c_str());
+
+    char port[8];
+    snprintf(port, sizeof(port), "%04zX", 1024 + (i % 60000));
+    tcp += "   " + std::to_string(i) + ": 0100007F:" + port +
+           " 00000000:0000 0A 00000000:00000000 00:00000000 00000000     0 "
+           "       0 " +
+           inode + " 1 0000000000000000 100 0 0 10 0\n";
+  }
+  writeTextFile(root + "/net/tcp", tcp);
+  return root;
+}
+
+static void TABLES_processes(benchmark::State& state) {
+  auto root = getBenchmarkProc(state.range_x());
+  QueryContext context;
+  while (state.KeepRunning()) {
+    // Setting the root drops the shared snapshot, each query walks the root.
+    ProcSnapshot::setRoot(root);
+    benchmark::DoNotOptimize(genProcesses(context));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+  ProcSnapshot::setRoot("/proc");
+  fs::remove_all(root);
+}
+
+BENCHMARK(TABLES_processes)->Arg(64)->Arg(512)->Arg(4096);
+
+static void TABLES_process_open_sockets(benchmark::State& state) {
+  auto root = getBenchmarkProc(state.range_x());
+  QueryContext context;
+  while (state.KeepRunning()) {
+    ProcSnapshot::setRoot(root);
+    benchmark::DoNotOptimize(genOpenSockets(context));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+  ProcSnapshot::setRoot("/proc");
+  fs::remove_all(root);
+}
+
+BENCHMARK(TABLES_process_open_sockets)->Arg(64)->Arg(512)->Arg(4096);
+
+/// Append a route attribute to a netlink message in a dump.
+static void addRouteAttribute(std::vector<char>& dump,
+                              size_t message,
+                              unsigned short type,
+                              const void* data,
+                              size_t size) {
+  auto offset = dump.size();
+  dump.resize(offset + RTA_SPACE(size));
+  auto attr = reinterpret_cast<struct rtattr*>(dump.data() + offset);
+  attr->rta_type = type;
+  attr->rta_len = RTA_LENGTH(size);
+  memcpy(RTA_DATA(attr), data, size);
+  reinterpret_cast<struct nlmsghdr*>(dump.data() + message)->nlmsg_len =
+      dump.size() - message;
+}
+
+/// Append a netlink message header, and a route message if it is a route.
+static size_t addRouteMessage(std::vector<char>& dump, unsigned short type) {
+  auto message = dump.size();
+  auto size = (type == RTM_NEWROUTE) ? sizeof(struct rtmsg) : 0;
+  dump.resize(message + NLMSG_SPACE(size));
+  auto header = reinterpret_cast<struct nlmsghdr*>(dump.data() + message);
+  header->nlmsg_type = type;
+  header->nlmsg_len = NLMSG_LENGTH(size);
+  header->nlmsg_flags = NLM_F_MULTI;
+  if (type == RTM_NEWROUTE) {
+    auto route = static_cast<struct rtmsg*>(NLMSG_DATA(header));
+    route->rtm_family = AF_INET;
+    route->rtm_dst_len = 24;
+    route->rtm_table = RT_TABLE_MAIN;
+    route->rtm_type = RTN_UNICAST;
+  }
+  return message;
+}
+
+/// Build a canned IPv4 route dump, as received from the kernel.
+static std::vector<char> getBenchmarkRouteDump(size_t size) {
+  std::vector<char> dump;
+  int interface = 1;
+  for (size_t i = 0; i < size; i++) {
+    auto message = addRouteMessage(dump, RTM_NEWROUTE);
+    uint32_t destination = htonl(0x0A000000 | (i << 8));
+    uint32_t gateway = htonl(0x0A000001);
+    int priority = 100;
+    addRouteAttribute(dump, message, RTA_DST, &destination, 4);
+    addRouteAttribute(dump, message, RTA_GATEWAY, &gateway, 4);
+    addRouteAttribute(dump, message, RTA_PRIORITY, &priority, 4);
+    addRouteAttribute(dump, message, RTA_OIF, &interface, 4);
+  }
+  addRouteMessage(dump, NLMSG_DONE);
+  return dump;
+}
+
+static void TABLES_routes(benchmark::State& state) {
+  auto dump = getBenchmarkRouteDump(state.range_x());
+  QueryContext context;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(genRoutesFromDump(context, dump));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+BENCHMARK(TABLES_routes)->Arg(16)->Arg(1024)->Arg(16384);
+
+static void TABLES_users(benchmark::State& state) {
+  // Accounts are read through NSS, the host's accounts are used.
+  QueryContext context;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(genUsers(context));
+  }
+}
+
+BENCHMARK(TABLES_users);
+}
+}
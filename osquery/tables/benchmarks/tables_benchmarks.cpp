@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem/operations.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+namespace tables {
+
+RowTasks genFile(QueryContext& context);
+RowTasks genHash(QueryContext& context);
+
+/// Write a directory of the benchmark's size, in files, of 4k each.
+static std::string getBenchmarkTree(size_t size) {
+  auto path = kTestWorkingDirectory + "tables_benchmark_tree_" +
+              std::to_string(size);
+  fs::create_directories(path);
+  std::string content(4096, 'A');
+  for (size_t i = 0; i < size; i++) {
+    writeTextFile(path + "/" + std::to_string(i), content);
+  }
+  return path;
+}
+
+/// Run the deferred row tasks of a generator.
+static size_t runTasks(const RowTasks& tasks) {
+  QueryData results;
+  for (const auto& task : tasks) {
+    task(results);
+  }
+  return results.size();
+}
+
+static void TABLES_file(benchmark::State& state) {
+  auto path = getBenchmarkTree(state.range_x());
+  QueryContext context;
+  context.constraints["directory"].add(Constraint(EQUALS, path));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(runTasks(genFile(context)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+  fs::remove_all(path);
+}
+
+BENCHMARK(TABLES_file)->Arg(10)->Arg(100)->Arg(1000);
+
+static void TABLES_hash(benchmark::State& state) {
+  auto path = getBenchmarkTree(state.range_x());
+  QueryContext context;
+  context.constraints["directory"].add(Constraint(EQUALS, path));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(runTasks(genHash(context)));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+  state.SetBytesProcessed(state.iterations() * state.range_x() * 4096);
+  fs::remove_all(path);
+}
+
+BENCHMARK(TABLES_hash)->Arg(10)->Arg(100)->Arg(1000);
+}
+}
@@ -10,6 +10,7 @@
 
 #include <osquery/config.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 
 #include "osquery/events/kernel.h"
 
@@ -42,21 +43,22 @@ Status ProcessEventSubscriber::Callback(
     const KernelSubscriptionContextRef &sc) {
   Row r;
   r["overflows"] = "";
-  r["cmdline_size"] = BIGINT(ec->event.arg_length);
-  if (ec->event.argc != ec->event.actual_argc) {
+  r["cmdline_size"] = BIGINT(ec->event->arg_length);
+  if (ec->event->argc != ec->event->actual_argc) {
     r["overflows"] = "cmdline";
   }
 
-  r["environment_count"] = BIGINT(ec->event.actual_envc);
-  r["environment_size"] = BIGINT(ec->event.env_length);
-  if (ec->event.envc != ec->event.actual_envc) {
+  r["environment_count"] = BIGINT(ec->event->actual_envc);
+  r["environment_size"] = BIGINT(ec->event->env_length);
+  if (ec->event->envc != ec->event->actual_envc) {
     r["overflows"] +=
         std::string(((r["overflows"].size() > 0) ? ", " : "")) + "environment";
   }
 
-  char *argv = &(ec->flexible_data.data()[ec->event.argv_offset]);
+  // The event may reference the shared kernel queue, it is not modified.
+  const char *argv = ec->flexible_data + ec->event->argv_offset;
   std::string argv_accumulator("");
-  while (ec->event.argc-- > 0) {
+  for (auto argc = ec->event->argc; argc > 0; argc--) {
     argv_accumulator += argv;
     argv_accumulator += " ";
     argv += strlen(argv) + 1;
@@ -81,9 +83,9 @@ Status ProcessEventSubscriber::Callback(
       }
     }
 
-    char *envv = &(ec->flexible_data.data()[ec->event.envv_offset]);
+    const char *envv = ec->flexible_data + ec->event->envv_offset;
     std::string envv_accumulator("");
-    while (ec->event.envc-- > 0) {
+    for (auto envc = ec->event->envc; envc > 0; envc--) {
       auto envv_string = std::string(envv);
       if (use_whitelist) {
         for (const auto &item : whitelist) {
@@ -100,24 +102,26 @@ Status ProcessEventSubscriber::Callback(
     r["environment"] = std::move(envv_accumulator);
   }
 
-  r["pid"] = BIGINT(ec->event.pid);
-  r["parent"] = BIGINT(ec->event.ppid);
-  r["uid"] = BIGINT(ec->event.uid);
-  r["euid"] = BIGINT(ec->event.euid);
-  r["gid"] = BIGINT(ec->event.gid);
-  r["egid"] = BIGINT(ec->event.egid);
-  r["owner_uid"] = BIGINT(ec->event.owner_uid);
-  r["owner_gid"] = BIGINT(ec->event.owner_gid);
-  r["create_time"] = BIGINT(ec->event.create_time);
-  r["access_time"] = BIGINT(ec->event.access_time);
-  r["modify_time"] = BIGINT(ec->event.modify_time);
-  r["change_time"] = BIGINT(ec->event.change_time);
-  r["mode"] = BIGINT(ec->event.mode);
-  r["path"] = ec->event.path;
+  r["pid"] = BIGINT(ec->event->pid);
+  r["parent"] = BIGINT(ec->event->ppid);
+  r["uid"] = BIGINT(ec->event->uid);
+  r["euid"] = BIGINT(ec->event->euid);
+  r["gid"] = BIGINT(ec->event->gid);
+  r["egid"] = BIGINT(ec->event->egid);
+  r["owner_uid"] = BIGINT(ec->event->owner_uid);
+  r["owner_gid"] = BIGINT(ec->event->owner_gid);
+  r["create_time"] = BIGINT(ec->event->create_time);
+  r["access_time"] = BIGINT(ec->event->access_time);
+  r["modify_time"] = BIGINT(ec->event->modify_time);
+  r["change_time"] = BIGINT(ec->event->change_time);
+  r["mode"] = BIGINT(ec->event->mode);
+  r["path"] = ec->event->path;
   r["uptime"] = BIGINT(ec->uptime);
 
   add(r, ec->time);
 
+  // A new process may change the result of discovery queries.
+  Pack::invalidateDiscovery("processes");
   return Status(0, "OK");
 }
 } // namespace osquery
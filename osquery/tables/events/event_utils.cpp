@@ -32,7 +32,7 @@ void decorateFileEvent(const std::string& path, bool hash, Row& r) {
   }
 
   if (hash) {
-    auto hashes = hashMultiFromFile(
+    auto hashes = hashMultiFromFileCached(
         HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
     r["md5"] = std::move(hashes.md5);
     r["sha1"] = std::move(hashes.sha1);
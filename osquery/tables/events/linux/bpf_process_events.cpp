@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <linux/limits.h>
+#include <unistd.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/packs.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+#include "osquery/events/linux/process_cache.h"
+
+namespace osquery {
+
+// Depend on the external getUptime table method.
+namespace tables {
+extern long getUptime();
+}
+
+class BPFProcessEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  /// The process event subscriber declares BPF exec and exit subscriptions.
+  Status init() override;
+
+  /// Exec and exit events from the publisher's programs will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(BPFProcessEventSubscriber, "event_subscriber", "bpf_process_events");
+
+Status BPFProcessEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = {BPF_TYPE_EXEC, BPF_TYPE_EXIT};
+  subscribe(&BPFProcessEventSubscriber::Callback, sc);
+  return Status(0, "OK");
+}
+
+/// Copy the tab-separated values of a /proc status line, such as "Uid:".
+static std::vector<std::string> getStatusValues(const std::string& status,
+                                                const std::string& key) {
+  auto line = status.find("\n" + key);
+  if (line == std::string::npos) {
+    return {};
+  }
+  auto begin = line + key.size() + 1;
+  return split(status.substr(begin, status.find('\n', begin) - begin));
+}
+
+Status BPFProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  auto& cache = ProcessCache::getInstance();
+  if (ec->type == BPF_TYPE_EXIT) {
+    // Exits only keep the process cache current.
+    cache.exit(ec->pid);
+    return Status(0, "OK");
+  }
+
+  Row r;
+  r["pid"] = INTEGER(ec->pid);
+  r["tid"] = INTEGER(ec->tid);
+  r["path"] = ec->path;
+  r["comm"] = ec->comm;
+  r["uid"] = INTEGER(ec->uid);
+  r["gid"] = INTEGER(ec->gid);
+
+  // The record holds the kernel's view of the exec, the arguments, parent,
+  // and credentials are read while the process is running.
+  ProcessCacheEntry process;
+  process.pid = ec->pid;
+  process.path = ec->path;
+  process = cache.exec(process);
+  r["cmdline"] = process.cmdline;
+  r["sha256"] = process.sha256;
+  r["parent"] = INTEGER(process.parent);
+  ProcessCacheEntry parent;
+  r["parent_path"] = (cache.getParent(process, parent)) ? parent.path : "";
+
+  auto proc = "/proc/" + std::to_string(ec->pid);
+  char cwd[PATH_MAX] = {0};
+  auto size = ::readlink((proc + "/cwd").c_str(), cwd, sizeof(cwd) - 1);
+  r["cwd"] = (size > 0) ? std::string(cwd, size) : "";
+
+  std::string status;
+  readFile(proc + "/status", status);
+  auto uids = getStatusValues(status, "Uid:");
+  auto gids = getStatusValues(status, "Gid:");
+  r["euid"] = (uids.size() > 1) ? uids[1] : r["uid"];
+  r["egid"] = (gids.size() > 1) ? gids[1] : r["gid"];
+
+  // Uptime is helpful for execution-based events.
+  r["uptime"] = BIGINT(tables::getUptime());
+  add(r, ec->time);
+
+  // A new process may change the result of discovery queries.
+  Pack::invalidateDiscovery("processes");
+  return Status(0, "OK");
+}
+}
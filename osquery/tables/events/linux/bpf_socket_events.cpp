@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <linux/limits.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+#include "osquery/events/linux/process_cache.h"
+
+namespace osquery {
+
+// Depend on the external getUptime table method.
+namespace tables {
+extern long getUptime();
+}
+
+class BPFSocketEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  /// The socket event subscriber declares BPF connect and bind subscriptions.
+  Status init() override;
+
+  /// Connect and bind events from the publisher's programs will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(BPFSocketEventSubscriber, "event_subscriber", "bpf_socket_events");
+
+Status BPFSocketEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = {BPF_TYPE_CONNECT, BPF_TYPE_BIND};
+  subscribe(&BPFSocketEventSubscriber::Callback, sc);
+  return Status(0, "OK");
+}
+
+/// Fill in the family, address, and port columns from a socket address.
+void parseBPFSockAddr(const std::string& address, Row& r, bool local) {
+  auto& port = r[(local) ? "local_port" : "remote_port"];
+  auto& ip = r[(local) ? "local_address" : "remote_address"];
+  sa_family_t family = AF_UNSPEC;
+  if (address.size() >= sizeof(family)) {
+    memcpy(&family, address.data(), sizeof(family));
+  }
+
+  char buffer[INET6_ADDRSTRLEN] = {0};
+  if (family == AF_INET && address.size() >= sizeof(struct sockaddr_in)) {
+    struct sockaddr_in in;
+    memcpy(&in, address.data(), sizeof(in));
+    r["family"] = INTEGER(AF_INET);
+    port = INTEGER(ntohs(in.sin_port));
+    ip = inet_ntop(AF_INET, &in.sin_addr, buffer, sizeof(buffer));
+  } else if (family == AF_INET6 &&
+             address.size() >= sizeof(struct sockaddr_in6)) {
+    struct sockaddr_in6 in6;
+    memcpy(&in6, address.data(), sizeof(in6));
+    r["family"] = INTEGER(AF_INET6);
+    port = INTEGER(ntohs(in6.sin6_port));
+    ip = inet_ntop(AF_INET6, &in6.sin6_addr, buffer, sizeof(buffer));
+  } else if (family == AF_UNIX) {
+    // The path may not be terminated, an abstract path starts with a null.
+    r["family"] = INTEGER(AF_UNIX);
+    auto path = address.substr(offsetof(struct sockaddr_un, sun_path));
+    if (!path.empty() && path[0] == '\0') {
+      path = path.substr(1);
+    }
+    r["socket"] = path.substr(0, path.find('\0'));
+  } else {
+    r["family"] = "-1";
+    r["local_address"] = "unknown";
+    r["remote_address"] = "unknown";
+  }
+}
+
+Status BPFSocketEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  bool bind = (ec->type == BPF_TYPE_BIND);
+  r["action"] = (bind) ? "bind" : "connect";
+  r["pid"] = INTEGER(ec->pid);
+  r["fd"] = BIGINT(ec->fd);
+
+  // A non-blocking connect is in progress when the syscall exits.
+  r["success"] =
+      (ec->ret == 0 || (!bind && ec->ret == -EINPROGRESS)) ? "1" : "0";
+
+  char path[PATH_MAX] = {0};
+  auto exe = "/proc/" + std::to_string(ec->pid) + "/exe";
+  auto size = ::readlink(exe.c_str(), path, sizeof(path) - 1);
+  r["path"] = (size > 0) ? std::string(path, size) : "";
+  addProcessCacheColumns(ec->pid, r);
+
+  // The protocol is not known from the address.
+  r["protocol"] = "0";
+  r["local_port"] = "0";
+  r["remote_port"] = "0";
+  parseBPFSockAddr(ec->address, r, bind);
+  r["uptime"] = BIGINT(tables::getUptime());
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
@@ -91,6 +91,8 @@ Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->event->cookie);
+  r["pid"] = INTEGER(ec->pid);
+  r["count"] = INTEGER(ec->count);
 
   if ((sc->mask & kFileAccessMasks) != kFileAccessMasks) {
     // Add hashing and 'join' against the file table for stat-information.
@@ -42,18 +42,18 @@ Status HardwareEventSubscriber::init() {
 Status HardwareEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   Row r;
 
-  if (ec->devtype.empty()) {
+  if (ec->devtype().empty()) {
     // Superfluous hardware event.
     return Status(0, "Missing type.");
-  } else if (ec->devnode.empty() && ec->driver.empty()) {
+  } else if (ec->devnode().empty() && ec->driver().empty()) {
     return Status(0, "Missing node and driver.");
   }
 
   struct udev_device* device = ec->device;
   r["action"] = ec->action_string;
-  r["path"] = ec->devnode;
-  r["type"] = ec->devtype;
-  r["driver"] = ec->driver;
+  r["path"] = ec->devnode();
+  r["type"] = ec->devtype();
+  r["driver"] = ec->driver();
 
   // UDEV properties.
   r["model"] = UdevEventPublisher::getValue(device, "ID_MODEL_FROM_DATABASE");
@@ -8,13 +8,14 @@
  *
  */
 
-#include <boost/algorithm/hex.hpp>
-
 #include <osquery/config.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/process_cache.h"
 
 namespace osquery {
 
@@ -41,17 +42,20 @@ class ProcessEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   Row row_;
 };
 
-inline std::string decodeAuditValue(const std::string& s) {
+void decodeAuditValue(const AuditFieldValue& s, std::string& output) {
   if (s.size() > 1 && s[0] == '"') {
-    return s.substr(1, s.size() - 2);
-  }
-  try {
-    return boost::algorithm::unhex(s);
-  } catch (const boost::algorithm::hex_decode_error& e) {
-    return s;
+    output.append(s.data() + 1, s.size() - 2);
+  } else if (!decodeAuditHex(s, output)) {
+    output.append(s.data(), s.size());
   }
 }
 
+std::string decodeAuditValue(const std::string& s) {
+  std::string output;
+  decodeAuditValue(AuditFieldValue(s), output);
+  return output;
+}
+
 Status validAuditState(int type, AuditProcessEventState& state) {
   // Define some acceptable transitions outside of the default state.
   bool acceptable = (type == STATE_PATH && state == STATE_EXECVE);
@@ -75,19 +79,34 @@ Status validAuditState(int type, AuditProcessEventState& state) {
   return Status(0, "OK");
 }
 
+/// Copy a field into a row column, reusing the column's storage.
+inline void setAuditColumn(std::string& column,
+                           const AuditFields& fields,
+                           const char* key,
+                           const char* missing) {
+  auto value = fields[key];
+  if (value.empty()) {
+    column.assign(missing);
+  } else {
+    column.assign(value.data(), value.size());
+  }
+}
+
 inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
   const auto& fields = ec->fields;
   if (ec->type == AUDIT_SYSCALL) {
-    r["pid"] = (fields.count("pid")) ? fields.at("pid") : "0";
-    r["parent"] = fields.count("ppid") ? fields.at("ppid") : "0";
-    r["uid"] = fields.count("uid") ? fields.at("uid") : "0";
-    r["euid"] = fields.count("euid") ? fields.at("euid") : "0";
-    r["gid"] = fields.count("gid") ? fields.at("gid") : "0";
-    r["egid"] = fields.count("egid") ? fields.at("euid") : "0";
-    r["path"] = (fields.count("exe")) ? decodeAuditValue(fields.at("exe")) : "";
+    setAuditColumn(r["pid"], fields, "pid", "0");
+    setAuditColumn(r["parent"], fields, "ppid", "0");
+    setAuditColumn(r["uid"], fields, "uid", "0");
+    setAuditColumn(r["euid"], fields, "euid", "0");
+    setAuditColumn(r["gid"], fields, "gid", "0");
+    setAuditColumn(r["egid"], fields, "egid", "0");
+    auto& path = r["path"];
+    path.clear();
+    decodeAuditValue(fields["exe"], path);
 
     // This should get overwritten during the EXECVE state.
-    r["cmdline"] = (fields.count("comm")) ? fields.at("comm") : "";
+    setAuditColumn(r["cmdline"], fields, "comm", "");
     // Do not record a cmdline size. If the final state is reached and no 'argc'
     // has been filled in then the EXECVE state was not used.
     r["cmdline_size"] = "";
@@ -100,28 +119,29 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
 
   if (ec->type == AUDIT_EXECVE) {
     // Reset the temporary storage from the SYSCALL state.
-    r["cmdline"] = "";
+    auto& cmdline = r["cmdline"];
+    cmdline.clear();
     for (const auto& arg : fields) {
       if (arg.first == "argc") {
         continue;
       }
 
-      // Amalgamate all the "arg*" fields.
-      if (r.at("cmdline").size() > 0) {
-        r["cmdline"] += " ";
+      // Amalgamate all the "arg*" fields, in the order of the record.
+      if (cmdline.size() > 0) {
+        cmdline += ' ';
       }
-      r["cmdline"] += decodeAuditValue(arg.second);
+      decodeAuditValue(arg.second, cmdline);
     }
 
     // There may be a better way to calculate actual size from audit.
     // Then an overflow could be calculated/determined based on actual/expected.
-    r["cmdline_size"] = std::to_string(r.at("cmdline").size());
+    r["cmdline_size"] = std::to_string(cmdline.size());
   }
 
   if (ec->type == AUDIT_PATH) {
-    r["mode"] = (fields.count("mode")) ? fields.at("mode") : "";
-    r["owner_uid"] = fields.count("ouid") ? fields.at("ouid") : "0";
-    r["owner_gid"] = fields.count("ogid") ? fields.at("ogid") : "0";
+    setAuditColumn(r["mode"], fields, "mode", "");
+    setAuditColumn(r["owner_uid"], fields, "ouid", "0");
+    setAuditColumn(r["owner_gid"], fields, "ogid", "0");
 
     auto qd = SQL::selectAllFrom("file", "path", EQUALS, r.at("path"));
     if (qd.size() == 1) {
@@ -136,13 +156,36 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
   }
 }
 
+/// Record the exec in the process cache, adding the hash and parent path.
+static void enrichProcessRow(Row& r) {
+  long long pid = 0;
+  long long parent = 0;
+  if (!safeStrtoll(r.at("pid"), 10, pid).ok()) {
+    return;
+  }
+  safeStrtoll(r.at("parent"), 10, parent);
+
+  auto& cache = ProcessCache::getInstance();
+  ProcessCacheEntry process;
+  process.pid = static_cast<pid_t>(pid);
+  process.parent = static_cast<pid_t>(parent);
+  process.path = r.at("path");
+  process.cmdline = r.at("cmdline");
+  process = cache.exec(process);
+  r["sha256"] = process.sha256;
+
+  ProcessCacheEntry parent_process;
+  r["parent_path"] =
+      (cache.getParent(process, parent_process)) ? parent_process.path : "";
+}
+
 REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
 
 Status ProcessEventSubscriber::init() {
   auto sc = createSubscriptionContext();
 
-  // Monitor for execve syscalls.
-  sc->rules.push_back({AUDIT_SYSCALL_EXECVE, ""});
+  // Monitor for successful execve syscalls, failures are dropped in the kernel.
+  sc->rules.push_back({AUDIT_SYSCALL_EXECVE, "success=1"});
 
   // Request call backs for all parts of the process execution state.
   // Drop events if they are encountered outside of the expected state.
@@ -177,8 +220,12 @@ Status ProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
       row_["cmdline_size"] = "1";
     }
 
+    enrichProcessRow(row_);
     add(row_, getUnixTime());
     Row().swap(row_);
+
+    // A new process may change the result of discovery queries.
+    Pack::invalidateDiscovery("processes");
   }
 
   return Status(0, "OK");
@@ -8,13 +8,15 @@
  *
  */
 
-#include <boost/algorithm/hex.hpp>
-#include <boost/algorithm/string.hpp>
+#include <stdio.h>
+
+#include <algorithm>
 
 #include <osquery/sql.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/process_cache.h"
 
 namespace osquery {
 
@@ -63,47 +65,75 @@ Status SocketEventSubscriber::init() {
   return Status(0, "OK");
 }
 
-void parseSockAddr(const std::string& saddr, Row& r, bool local) {
+/// Read a big-endian integer from a hex-encoded sockaddr.
+inline bool readSockAddrHex(const AuditFieldValue& saddr,
+                            size_t offset,
+                            size_t length,
+                            unsigned long& result) {
+  if (offset + length > saddr.size()) {
+    return false;
+  }
+
+  result = 0;
+  for (size_t i = offset; i < offset + length; i++) {
+    int value = auditHexValue(saddr[i]);
+    if (value < 0) {
+      return false;
+    }
+    result = (result << 4) | value;
+  }
+  return true;
+}
+
+void parseSockAddr(const AuditFieldValue& saddr, Row& r, bool local) {
   // The protocol is not included in the audit message.
-  if (saddr[0] == '0' && saddr[1] == '2') {
+  auto& port = r[(local) ? "local_port" : "remote_port"];
+  auto& address = r[(local) ? "local_address" : "remote_address"];
+  unsigned long result{0};
+  if (saddr.size() >= 16 && saddr[0] == '0' && saddr[1] == '2') {
     // IPv4
     r["family"] = "2";
-    long result{0};
-    safeStrtol(saddr.substr(4, 4), 16, result);
-    r[(local) ? "local_port" : "remote_port"] = INTEGER(result);
-    safeStrtol(saddr.substr(8, 8), 16, result);
-    auto address = std::to_string((result & 0xff000000) >> 24) + "." +
-                   std::to_string((result & 0x00ff0000) >> 16) + "." +
-                   std::to_string((result & 0x0000ff00) >> 8) + "." +
-                   std::to_string((result & 0x000000ff));
-    r[(local) ? "local_address" : "remote_address"] = std::move(address);
-  } else if (saddr[0] == '0' && saddr[1] == 'A') {
+    readSockAddrHex(saddr, 4, 4, result);
+    port = INTEGER(result);
+    readSockAddrHex(saddr, 8, 8, result);
+    char buffer[16] = {0};
+    snprintf(buffer,
+             sizeof(buffer),
+             "%lu.%lu.%lu.%lu",
+             (result & 0xff000000) >> 24,
+             (result & 0x00ff0000) >> 16,
+             (result & 0x0000ff00) >> 8,
+             (result & 0x000000ff));
+    address.assign(buffer);
+  } else if (saddr.size() >= 48 && saddr[0] == '0' && saddr[1] == 'A') {
     // IPv6
     r["family"] = "11";
-    long result{0};
-    safeStrtol(saddr.substr(4, 4), 16, result);
-    r[(local) ? "local_port" : "remote_port"] = INTEGER(result);
-    std::string address;
+    readSockAddrHex(saddr, 4, 4, result);
+    port = INTEGER(result);
+    address.clear();
+    address.reserve(39);
     for (size_t i = 0; i < 8; ++i) {
-      address += saddr.substr(16 + (i * 4), 4);
+      for (size_t j = 0; j < 4; j++) {
+        address += static_cast<char>(tolower(saddr[16 + (i * 4) + j]));
+      }
       if (i == 0 || i % 7 != 0) {
-        address += ":";
+        address += ':';
       }
     }
-    boost::algorithm::to_lower(address);
-    r[(local) ? "local_address" : "remote_address"] = std::move(address);
-  } else if (saddr[0] == '0' && saddr[1] == '1' && saddr.size() > 6) {
+  } else if (saddr.size() > 6 && saddr[0] == '0' && saddr[1] == '1') {
     // Unix domain
     r["family"] = "1";
     r["local_port"] = "0";
     r["remote_port"] = "0";
-    off_t begin = (saddr[4] == '0' && saddr[5] == '0') ? 6 : 4;
+    size_t begin = (saddr[4] == '0' && saddr[5] == '0') ? 6 : 4;
     auto end = saddr.substr(begin).find("00");
-    end = (end == std::string::npos) ? saddr.size() : end + 4;
-    try {
-      r["socket"] = boost::algorithm::unhex(saddr.substr(begin, end - begin));
-    } catch (const boost::algorithm::hex_decode_error& e) {
-      r["socket"] = "unknown";
+    end = (end == AuditFieldValue::npos) ? saddr.size() : end + 4;
+    end = std::min(end, saddr.size());
+    auto& socket = r["socket"];
+    socket.clear();
+    if (end < begin ||
+        !decodeAuditHex(saddr.substr(begin, end - begin), socket)) {
+      socket = "unknown";
     }
   } else {
     r["family"] = "-1";
@@ -113,10 +143,14 @@ void parseSockAddr(const std::string& saddr, Row& r, bool local) {
   }
 }
 
+void parseSockAddr(const std::string& saddr, Row& r, bool local) {
+  parseSockAddr(AuditFieldValue(saddr), r, local);
+}
+
 Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
   if (waiting_for_saddr_) {
     if (ec->type == AUDIT_TYPE_SOCKADDR) {
-      auto& saddr = ec->fields["saddr"];
+      auto saddr = ec->fields["saddr"];
       if (saddr.size() < 4 || saddr[0] == '1') {
         return Status(0);
       }
@@ -125,6 +159,10 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
       row_["remote_port"] = "0";
       // Parse the struct and emit the row.
       parseSockAddr(saddr, row_, (row_.at("action") == "bind"));
+      long long pid = 0;
+      if (safeStrtoll(row_.at("pid"), 10, pid).ok()) {
+        addProcessCacheColumns(static_cast<pid_t>(pid), row_);
+      }
       add(row_, getUnixTime());
       Row().swap(row_);
       waiting_for_saddr_ = false;
@@ -145,10 +183,10 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
     return Status(0);
   }
 
-  row_["pid"] = ec->fields["pid"];
-  row_["path"] = ec->fields["exe"];
+  row_["pid"] = ec->fields["pid"].to_string();
+  row_["path"] = ec->fields["exe"].to_string();
   // TODO: This is a hex value.
-  row_["fd"] = ec->fields["a0"];
+  row_["fd"] = ec->fields["a0"].to_string();
   // The open/bind success status.
   row_["success"] = (ec->fields["success"] == "yes") ? "1" : "0";
   row_["uptime"] = BIGINT(tables::getUptime());
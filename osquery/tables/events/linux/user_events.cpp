@@ -22,7 +22,7 @@ extern long getUptime();
 }
 
 // From process_events.
-extern std::string decodeAuditValue(const std::string& s);
+extern void decodeAuditValue(const AuditFieldValue& s, std::string& output);
 
 class UserEventSubscriber : public EventSubscriber<AuditEventPublisher> {
  public:
@@ -46,13 +46,13 @@ Status UserEventSubscriber::init() {
 
 Status UserEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   Row r;
-  r["uid"] = ec->fields["uid"];
-  r["pid"] = ec->fields["pid"];
-  r["message"] = ec->fields["msg"];
+  r["uid"] = ec->fields["uid"].to_string();
+  r["pid"] = ec->fields["pid"].to_string();
+  r["message"] = ec->fields["msg"].to_string();
   r["type"] = INTEGER(ec->type);
-  r["path"] = decodeAuditValue(ec->fields["exe"]);
-  r["address"] = ec->fields["addr"];
-  r["terminal"] = ec->fields["terminal"];
+  decodeAuditValue(ec->fields["exe"], r["path"]);
+  r["address"] = ec->fields["addr"].to_string();
+  r["terminal"] = ec->fields["terminal"].to_string();
   r["uptime"] = INTEGER(tables::getUptime());
 
   add(r, getUnixTime());
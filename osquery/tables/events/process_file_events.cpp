@@ -48,14 +48,15 @@ void ProcessFileEventSubscriber::configure() {
     for (const auto &file : files) {
       auto sc = createSubscriptionContext();
       sc->event_type = OSQUERY_FILE_EVENT;
-      osquery_file_event_subscription_t sub = {
-          .actions = (osquery_file_action_t)(
-              OSQUERY_FILE_ACTION_OPEN | OSQUERY_FILE_ACTION_CLOSE |
-              OSQUERY_FILE_ACTION_CLOSE_MODIFIED)};
+      // The kernel only queues file events within the path prefix.
+      sc->filter.fields = OSQUERY_FILTER_ACTIONS | OSQUERY_FILTER_PATH;
+      sc->filter.actions = OSQUERY_FILE_ACTION_OPEN |
+                           OSQUERY_FILE_ACTION_CLOSE |
+                           OSQUERY_FILE_ACTION_CLOSE_MODIFIED;
       auto path = file;
       replaceGlobWildcards(path);
       path = path.substr(0, path.find("*"));
-      strncpy(sub.path, path.c_str(), MAXPATHLEN);
+      strncpy(sc->filter.path, path.c_str(), MAXPATHLEN - 1);
       sc->category = category;
       VLOG(1) << "Added process file event listener to: " << path;
       subscribe(&ProcessFileEventSubscriber::Callback, sc);
@@ -67,7 +68,7 @@ Status ProcessFileEventSubscriber::Callback(
     const TypedKernelEventContextRef<osquery_file_event_t> &ec,
     const KernelSubscriptionContextRef &sc) {
   Row r;
-  switch (ec->event.action) {
+  switch (ec->event->action) {
   case OSQUERY_FILE_ACTION_OPEN:
     r["action"] = "OPEN";
     break;
@@ -82,19 +83,19 @@ Status ProcessFileEventSubscriber::Callback(
     break;
   }
 
-  r["pid"] = BIGINT(ec->event.pid);
-  r["parent"] = BIGINT(ec->event.ppid);
-  r["uid"] = BIGINT(ec->event.uid);
-  r["euid"] = BIGINT(ec->event.euid);
-  r["gid"] = BIGINT(ec->event.gid);
-  r["egid"] = BIGINT(ec->event.egid);
-  r["owner_uid"] = BIGINT(ec->event.owner_uid);
-  r["owner_gid"] = BIGINT(ec->event.owner_gid);
-  r["ctime"] = BIGINT(ec->event.change_time);
-  r["atime"] = BIGINT(ec->event.access_time);
-  r["mtime"] = BIGINT(ec->event.modify_time);
-  r["mode"] = BIGINT(ec->event.mode);
-  r["path"] = ec->event.path;
+  r["pid"] = BIGINT(ec->event->pid);
+  r["parent"] = BIGINT(ec->event->ppid);
+  r["uid"] = BIGINT(ec->event->uid);
+  r["euid"] = BIGINT(ec->event->euid);
+  r["gid"] = BIGINT(ec->event->gid);
+  r["egid"] = BIGINT(ec->event->egid);
+  r["owner_uid"] = BIGINT(ec->event->owner_uid);
+  r["owner_gid"] = BIGINT(ec->event->owner_gid);
+  r["ctime"] = BIGINT(ec->event->change_time);
+  r["atime"] = BIGINT(ec->event->access_time);
+  r["mtime"] = BIGINT(ec->event->modify_time);
+  r["mode"] = BIGINT(ec->event->mode);
+  r["path"] = ec->event->path;
   r["uptime"] = BIGINT(ec->uptime);
 
   add(r, ec->time);
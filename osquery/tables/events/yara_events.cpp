@@ -9,9 +9,13 @@
  */
 
 #include <map>
+#include <mutex>
 #include <string>
 
+#include <sys/stat.h>
+
 #include <osquery/config.h>
+#include <osquery/hash.h>
 #include <osquery/logger.h>
 
 /// The file change event publishers are slightly different in OS X and Linux.
@@ -45,12 +49,17 @@ using FileSubscriptionContextRef = INotifySubscriptionContextRef;
 #define FILE_CHANGE_MASK ((IN_CREATE) | (IN_CLOSE_WRITE) | (IN_MODIFY))
 #endif
 
+/// The most scanned files and scan results remembered.
+const size_t kYARAScanCacheMax = 4096;
+
 /**
  * @brief Track YARA matches to files.
  */
 class YARAEventSubscriber : public FileEventSubscriber {
  public:
   Status init() override {
+    // File scans are slow, do not block the file event publisher.
+    useDispatchQueue();
     configure();
     return Status(0);
   }
@@ -68,6 +77,42 @@ class YARAEventSubscriber : public FileEventSubscriber {
    */
   Status Callback(const FileEventContextRef& ec,
                   const FileSubscriptionContextRef& sc);
+
+  /**
+   * @brief Scan a file with a signature group, reusing results by content.
+   *
+   * @param parser The YARA config parser owning the compiled rules.
+   * @param group The signature group to scan with.
+   * @param path The file to scan.
+   * @param hash The content hash of the file, empty if unknown.
+   * @param r The output row, matches are appended.
+   */
+  Status scanGroup(const YARAConfigParserPlugin& parser,
+                   const std::string& group,
+                   const std::string& path,
+                   const std::string& hash,
+                   Row& r);
+
+  /**
+   * @brief Record the status of a file about to be scanned.
+   *
+   * A file event is often followed by more events for the same change, such
+   * as a create, modify, and close. The later events of an unchanged file,
+   * scanned with the same rules, are not scanned again.
+   *
+   * @return false if the file was already scanned in this status.
+   */
+  bool recordScan(const std::string& key, const std::string& state);
+
+ private:
+  /// Protects the scan caches, callbacks run on the dispatch queue workers.
+  std::mutex scan_mutex_;
+
+  /// The status of each scanned file by path and category.
+  std::map<std::string, std::string> scanned_;
+
+  /// Scan results by rules generation, signature group, and content hash.
+  std::map<std::string, Row> results_;
 };
 
 /**
@@ -161,7 +206,31 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
     return Status(1, "Yara parser unknown.");
   }
 
-  auto rules = yaraParser->rules();
+  // Skip repeated events for a file that has not changed since its scan.
+  struct stat file_stat;
+  if (stat(ec->path.c_str(), &file_stat) != 0) {
+    return Status(1, "Cannot stat file: " + ec->path);
+  }
+  auto state = std::to_string(file_stat.st_dev) + ':' +
+               std::to_string(file_stat.st_ino) + ':' +
+               std::to_string(file_stat.st_size) + ':' +
+               std::to_string(file_stat.st_mtime) + '.' +
+#ifdef __APPLE__
+               std::to_string(file_stat.st_mtimespec.tv_nsec) + ':' +
+#else
+               std::to_string(file_stat.st_mtim.tv_nsec) + ':' +
+#endif
+               std::to_string(yaraParser->generation());
+  if (!recordScan(sc->category + ':' + ec->path, state)) {
+    return Status(0, "OK");
+  }
+
+  // Identical content is scanned once, the hash cache skips rereading files.
+  std::string hash;
+  if (FLAGS_yara_max_file_size == 0 ||
+      static_cast<size_t>(file_stat.st_size) <= FLAGS_yara_max_file_size) {
+    hash = hashMultiFromFileCached(HASH_TYPE_SHA256, ec->path).sha256;
+  }
 
   // Use the category as a lookup into the yara file_paths. The value will be
   // a list of signature groups to scan with.
@@ -171,15 +240,9 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
   const auto& sig_groups = yara_paths.find(category);
   for (const auto& rule : sig_groups->second) {
     const std::string group = rule.second.data();
-    int result = yr_rules_scan_file(rules[group],
-                                    ec->path.c_str(),
-                                    SCAN_FLAGS_FAST_MODE,
-                                    YARACallback,
-                                    (void*)&r,
-                                    0);
-
-    if (result != ERROR_SUCCESS) {
-      return Status(1, "YARA error: " + std::to_string(result));
+    auto status = scanGroup(*yaraParser, group, ec->path, hash, r);
+    if (!status.ok()) {
+      return status;
     }
   }
 
@@ -189,5 +252,68 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
 
   return Status(0, "OK");
 }
+
+bool YARAEventSubscriber::recordScan(const std::string& key,
+                                     const std::string& state) {
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  auto scanned = scanned_.find(key);
+  if (scanned != scanned_.end() && scanned->second == state) {
+    return false;
+  }
+  if (scanned_.size() >= kYARAScanCacheMax) {
+    scanned_.clear();
+  }
+  scanned_[key] = state;
+  return true;
+}
+
+/// Append the matches of one scan to a row of matches.
+static void appendMatches(const Row& scan, Row& r) {
+  for (const auto& column : {"matches", "strings", "tags"}) {
+    const auto& value = scan.at(column);
+    if (value.empty()) {
+      continue;
+    }
+    auto& target = r[column];
+    target += (target.empty()) ? value : "," + value;
+  }
+  r["count"] = INTEGER(std::stoi(r.at("count")) + std::stoi(scan.at("count")));
+}
+
+Status YARAEventSubscriber::scanGroup(const YARAConfigParserPlugin& parser,
+                                      const std::string& group,
+                                      const std::string& path,
+                                      const std::string& hash,
+                                      Row& r) {
+  auto key = std::to_string(parser.generation()) + ':' + group + ':' + hash;
+  if (!hash.empty()) {
+    std::lock_guard<std::mutex> lock(scan_mutex_);
+    auto result = results_.find(key);
+    if (result != results_.end()) {
+      appendMatches(result->second, r);
+      return Status(0, "OK");
+    }
+  }
+
+  // The rules are kept until the scan completes, even if they are replaced.
+  Row scan = {{"count", INTEGER(0)},
+              {"matches", ""},
+              {"strings", ""},
+              {"tags", ""}};
+  auto status = scanYARAFile(parser.rules(group), path, scan);
+  if (!status.ok()) {
+    return status;
+  }
+  appendMatches(scan, r);
+
+  if (!hash.empty()) {
+    std::lock_guard<std::mutex> lock(scan_mutex_);
+    if (results_.size() >= kYARAScanCacheMax) {
+      results_.clear();
+    }
+    results_[key] = std::move(scan);
+  }
+  return Status(0, "OK");
+}
 }
 }
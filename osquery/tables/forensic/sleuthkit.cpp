@@ -8,6 +8,7 @@
  *
  */
 
+#include <algorithm>
 #include <map>
 #include <set>
 
@@ -17,17 +18,36 @@
 #include <tsk/libtsk.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/governor.h"
 
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+FLAG(uint64,
+     device_file_max_rows,
+     10240,
+     "Most rows of a device_file partition walk, 0 for unlimited");
+
+FLAG(uint64,
+     device_hash_max_bytes,
+     0,
+     "Most inode bytes hashed by a device_hash query, 0 for unlimited");
+
 namespace tables {
 
+/// The inode content read by each TSK read, runs within are read together.
+const size_t kDeviceReadSize = 1024 * 1024;
+
+/// The most directories read by a device_file partition walk.
+const size_t kDeviceWalkMaxDirectories = 1024;
+
 const std::map<TSK_FS_META_TYPE_ENUM, std::string> kTSKTypeNames{
     {TSK_FS_META_TYPE_REG, "regular"},
     {TSK_FS_META_TYPE_DIR, "directory"},
@@ -60,13 +80,20 @@ class DeviceHelper : private boost::noncopyable {
     }
   }
 
+  /// Iterate the constraint inodes in address order.
   void inodes(
       const std::set<std::string>& inodes,
       TskFsInfo* fs,
       std::function<void(const std::string&, TskFsFile*, const std::string&)>
           predicate);
 
-  /// Provide a partition description for context and iterate from path.
+  /**
+   * @brief Provide a partition description for context and iterate from path.
+   *
+   * Directories are read in inode address order rather than depth first,
+   * which is near the order of their metadata on disk. The walk generates up
+   * to device_file_max_rows rows.
+   */
   void generateFiles(const std::string& partition,
                      TskFsInfo* fs,
                      const std::string& path,
@@ -83,13 +110,6 @@ class DeviceHelper : private boost::noncopyable {
   /// Volume accessor, used for computing offsets using block/sector size.
   const std::shared_ptr<TskVsInfo>& getVolume() { return volume_; }
 
-  /// Reset stack counting for directory iteration.
-  void resetStack() {
-    stack_ = 0;
-    count_ = 0;
-    std::set<std::string>().swap(loops_);
-  }
-
  private:
   /// Attempt to open the provided device image and volume.
   bool open();
@@ -109,10 +129,6 @@ class DeviceHelper : private boost::noncopyable {
 
   /// Filesystem path to the device node.
   std::string device_path_;
-
-  size_t stack_{0};
-  size_t count_{0};
-  std::set<std::string> loops_;
 };
 
 bool DeviceHelper::open() {
@@ -139,12 +155,20 @@ void DeviceHelper::inodes(
     TskFsInfo* fs,
     std::function<void(const std::string&, TskFsFile*, const std::string&)>
         predicate) {
-  // Given a set of constraint inodes, convert each to an INUM.
+  // Given a set of constraint inodes, convert each to an INUM. Reading in
+  // address order keeps reads of the inode tables sequential.
+  std::map<TSK_INUM_T, std::string> addresses;
   for (const auto& inode : inodes) {
     long int meta = 0;
-    safeStrtol(inode, 10, meta);
+    if (safeStrtol(inode, 10, meta).ok() && meta >= 0) {
+      addresses[static_cast<TSK_INUM_T>(meta)] = inode;
+    }
+  }
+
+  for (const auto& address : addresses) {
+    const auto& inode = address.second;
     auto* file = new TskFsFile();
-    if (file->open(fs, file, static_cast<TSK_INUM_T>(meta)) == 0) {
+    if (file->open(fs, file, address.first) == 0) {
       // Attempt to get the meta and filesystem name for the inode.
       // If this inode is a file a valid meta/name structures are parsed.
       auto* meta = file->getMeta();
@@ -203,107 +227,119 @@ void DeviceHelper::generateFiles(const std::string& partition,
                                  const std::string& path,
                                  QueryData& results,
                                  TSK_INUM_T inode) {
-  if (stack_++ > 1024) {
-    return;
-  }
-
-  auto* dir = new TskFsDir();
-  if (dir->open(fs, ((inode == 0) ? fs->getRootINum() : inode))) {
-    delete dir;
-    return;
-  }
-
-  // Iterate through the directory.
-  std::map<TSK_INUM_T, std::string> additional;
-  for (size_t i = 0; i < dir->getSize(); i++) {
-    if (count_++ > 1024 * 10) {
-      break;
-    }
-
-    auto* file = dir->getFile(i);
-    if (file == nullptr) {
+  auto max_rows = results.size() + FLAGS_device_file_max_rows;
+  auto budget = [&results, max_rows]() {
+    return FLAGS_device_file_max_rows == 0 || results.size() < max_rows;
+  };
+
+  // The directories to read by inode address, and those read, to stop loops.
+  std::map<TSK_INUM_T, std::string> pending;
+  std::set<TSK_INUM_T> visited;
+  pending[(inode == 0) ? fs->getRootINum() : inode] = path;
+  while (!pending.empty() && budget() &&
+         visited.size() < kDeviceWalkMaxDirectories) {
+    auto address = pending.begin()->first;
+    auto dir_path = std::move(pending.begin()->second);
+    pending.erase(pending.begin());
+    visited.insert(address);
+
+    auto* dir = new TskFsDir();
+    if (dir->open(fs, address)) {
+      delete dir;
       continue;
     }
 
-    // Failure to access the file's metadata information.
-    auto* meta = file->getMeta();
-    if (meta == nullptr) {
-      delete file;
-      continue;
-    }
+    // Iterate through the directory.
+    for (size_t i = 0; i < dir->getSize() && budget(); i++) {
+      auto* file = dir->getFile(i);
+      if (file == nullptr) {
+        continue;
+      }
 
-    std::string leaf;
-    auto* name = file->getName();
-    if (name != nullptr) {
-      leaf = (fs::path(path) / name->getName()).string();
-    }
+      // Failure to access the file's metadata information.
+      auto* meta = file->getMeta();
+      if (meta == nullptr) {
+        delete file;
+        continue;
+      }
 
-    if (meta->getType() == TSK_FS_META_TYPE_REG) {
-      generateFile(partition, file, fs, leaf, results);
-    } else if (meta->getType() == TSK_FS_META_TYPE_DIR) {
-      if (name != nullptr && !TSK_FS_ISDOT(name->getName())) {
-        additional[meta->getAddr()] = leaf;
+      std::string leaf;
+      auto* name = file->getName();
+      if (name != nullptr) {
+        leaf = (fs::path(dir_path) / name->getName()).string();
       }
-    }
 
-    if (name != nullptr) {
-      delete name;
-    }
-    delete meta;
-    delete file;
-  }
-  delete dir;
+      if (meta->getType() == TSK_FS_META_TYPE_REG) {
+        generateFile(partition, file, fs, leaf, results);
+      } else if (meta->getType() == TSK_FS_META_TYPE_DIR) {
+        if (name != nullptr && !TSK_FS_ISDOT(name->getName()) &&
+            visited.count(meta->getAddr()) == 0) {
+          pending.insert(std::make_pair(meta->getAddr(), leaf));
+        }
+      }
 
-  // If we are recursing.
-  for (const auto& dir : additional) {
-    if (std::find(loops_.begin(), loops_.end(), dir.second) == loops_.end()) {
-      generateFiles(partition, fs, dir.second, results, dir.first);
-      loops_.insert(dir.second);
+      if (name != nullptr) {
+        delete name;
+      }
+      delete meta;
+      delete file;
     }
+    delete dir;
   }
 }
 
-MultiHashes hashInode(TskFsFile* file) {
-  Hash md5(HASH_TYPE_MD5);
-  Hash sha1(HASH_TYPE_SHA1);
-  Hash sha256(HASH_TYPE_SHA256);
-
+/**
+ * @brief Hash the content of an inode.
+ *
+ * @param file The inode file.
+ * @param budget The bytes that may be hashed, reduced by the inode size.
+ * @return The hashes, empty if the inode could not be read or the budget
+ *   does not allow the inode size.
+ */
+MultiHashes hashInode(TskFsFile* file, size_t& budget) {
   // We are guaranteed by the expected callsite to have a valid meta.
   auto* meta = file->getMeta();
   if (meta == nullptr) {
     return MultiHashes();
   }
 
-  // Set a maximum 'chunk' or block size to 1 page or the file size.
   TSK_OFF_T size = meta->getSize();
-  if (size == 0) {
+  delete meta;
+  if (size <= 0) {
     return MultiHashes();
   }
 
-  // Allocate some heap memory and iterate over reading a chunk and updating.
-  auto buffer_size = (size < 4096) ? size : 4096;
-  auto* buffer = (char*)malloc(buffer_size * sizeof(char));
-  if (buffer != nullptr) {
-    ssize_t chunk_size = 0;
-    for (ssize_t offset = 0; offset < size; offset += chunk_size) {
-      // Here max represents the local max requested bytes.
-      auto max = (size - offset < buffer_size) ? (size - offset) : buffer_size;
-      chunk_size =
-          file->read(offset, buffer, max, (TSK_FS_FILE_READ_FLAG_ENUM)0U);
-      if (chunk_size == -1 || chunk_size != max) {
-        // Huge problem, either a read failed or didn't read the max size.
-        free(buffer);
-        delete meta;
-        return MultiHashes();
-      }
+  if (FLAGS_device_hash_max_bytes > 0) {
+    if (static_cast<size_t>(size) > budget) {
+      VLOG(1) << "Inode of " << size << " bytes exceeds the hash budget";
+      return MultiHashes();
+    }
+    budget -= static_cast<size_t>(size);
+  }
+
+  Hash md5(HASH_TYPE_MD5);
+  Hash sha1(HASH_TYPE_SHA1);
+  Hash sha256(HASH_TYPE_SHA256);
 
-      md5.update(buffer, chunk_size);
-      sha1.update(buffer, chunk_size);
-      sha256.update(buffer, chunk_size);
+  // Read in large blocks, TSK reads the data runs within a block together.
+  auto buffer_size = std::min(static_cast<size_t>(size), kDeviceReadSize);
+  std::string buffer(buffer_size, '\0');
+  ssize_t chunk_size = 0;
+  for (TSK_OFF_T offset = 0; offset < size; offset += chunk_size) {
+    // Here max represents the local max requested bytes.
+    auto max = std::min(static_cast<size_t>(size - offset), buffer_size);
+    chunk_size =
+        file->read(offset, &buffer[0], max, (TSK_FS_FILE_READ_FLAG_ENUM)0U);
+    if (chunk_size == -1 || static_cast<size_t>(chunk_size) != max) {
+      // Huge problem, either a read failed or didn't read the max size.
+      return MultiHashes();
     }
-    free(buffer);
+
+    throttleRead(static_cast<size_t>(chunk_size));
+    md5.update(buffer.data(), chunk_size);
+    sha1.update(buffer.data(), chunk_size);
+    sha256.update(buffer.data(), chunk_size);
   }
-  delete meta;
 
   // Convert the set of hashes into a device hashes transport.
   MultiHashes dhs;
@@ -321,11 +357,18 @@ QueryData genDeviceHash(QueryContext& context) {
   auto parts = context.constraints["partition"].getAll(EQUALS);
   auto inodes = context.constraints["inode"].getAll(EQUALS);
 
+  if (devices.empty() || parts.size() != 1 || inodes.empty()) {
+    TLOG << "Device hashes require a device, a single partition, and inodes";
+    return {};
+  }
+
+  // The bytes hashed by this query are limited by device_hash_max_bytes.
+  size_t budget = FLAGS_device_hash_max_bytes;
   for (const auto& dev : devices) {
     // For each require device path, open a device helper that checks the
     // image, checks the volume, and allows partition iteration.
     DeviceHelper dh(dev);
-    dh.partitions(([&results, &dev, &dh, &parts, &inodes](
+    dh.partitions(([&results, &dev, &dh, &parts, &inodes, &budget](
         const TskVsPartInfo* part) {
       // The table also requires a partition for searching.
       auto address = std::to_string(part->getAddr());
@@ -344,15 +387,15 @@ QueryData genDeviceHash(QueryContext& context) {
 
       dh.inodes(inodes,
                 fs,
-                ([&results, &address, &dev, &dh, &fs](const std::string& inode,
-                                                      TskFsFile* file,
-                                                      const std::string& path) {
+                ([&results, &address, &dev, &budget](const std::string& inode,
+                                                     TskFsFile* file,
+                                                     const std::string& path) {
                   Row r;
                   r["device"] = dev;
                   r["partition"] = address;
                   r["inode"] = inode;
 
-                  auto hashes = hashInode(file);
+                  auto hashes = hashInode(file, budget);
                   r["md5"] = std::move(hashes.md5);
                   r["sha1"] = std::move(hashes.sha1);
                   r["sha256"] = std::move(hashes.sha256);
@@ -405,7 +448,6 @@ QueryData genDeviceFile(QueryContext& context) {
       // the partition was requested.
       if (inodes.empty() && paths.empty()) {
         dh.generateFiles(address, fs, "/", results);
-        dh.resetStack();
       }
 
       // For each path the canonical name must be mapped to an inode address.
@@ -15,11 +15,12 @@
 #include <osquery/logger.h>
 
 #include "osquery/tables/networking/utils.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
 
-QueryData genDNSResolvers(QueryContext& context) {
+static QueryData genResolvers() {
   QueryData results;
 
   // libresolv will populate a global structure with resolver information.
@@ -71,5 +72,11 @@ QueryData genDNSResolvers(QueryContext& context) {
   res_close();
   return results;
 }
+
+QueryData genDNSResolvers(QueryContext& context) {
+  // The resolver state is read again only when its configuration changes.
+  static FileStateCache resolvers({"/etc/resolv.conf"});
+  return resolvers.get(genResolvers);
+}
 }
 }
@@ -20,6 +20,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -51,13 +52,19 @@ QueryData parseEtcHostsContent(const std::string& content) {
 }
 
 QueryData genEtcHosts(QueryContext& context) {
-  std::string content;
-  auto s = readFile("/etc/hosts", content);
-  if (s.ok()) {
-    return parseEtcHostsContent(content);
-  } else {
-    return {};
-  }
+  // The rows are parsed again only when the hosts file changes.
+  static FileRowsCache hosts(1);
+
+  QueryData results;
+  hosts.get({"/etc/hosts"},
+            ([](const std::string& path, QueryData& rows) {
+              std::string content;
+              if (readFile(path, content).ok()) {
+                rows = parseEtcHostsContent(content);
+              }
+            }),
+            results);
+  return results;
 }
 }
 }
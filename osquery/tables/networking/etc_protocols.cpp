@@ -20,6 +20,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -67,14 +68,22 @@ QueryData parseEtcProtocolsContent(const std::string& content) {
 }
 
 QueryData genEtcProtocols(QueryContext& context) {
-  std::string content;
-  auto s = readFile("/etc/protocols", content);
-  if (s.ok()) {
-    return parseEtcProtocolsContent(content);
-  } else {
-    TLOG << "Error reading /etc/protocols: " << s.toString();
-    return {};
-  }
+  // The rows are parsed again only when the protocols file changes.
+  static FileRowsCache protocols(1);
+
+  QueryData results;
+  protocols.get({"/etc/protocols"},
+                ([](const std::string& path, QueryData& rows) {
+                  std::string content;
+                  auto s = readFile(path, content);
+                  if (s.ok()) {
+                    rows = parseEtcProtocolsContent(content);
+                  } else {
+                    TLOG << "Error reading " << path << ": " << s.toString();
+                  }
+                }),
+                results);
+  return results;
 }
 }
 }
@@ -20,6 +20,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -77,13 +78,19 @@ QueryData parseEtcServicesContent(const std::string& content) {
 }
 
 QueryData genEtcServices(QueryContext& context) {
-  std::string content;
-  auto s = readFile("/etc/services", content);
-  if (s.ok()) {
-    return parseEtcServicesContent(content);
-  } else {
-    return {};
-  }
+  // The rows are parsed again only when the services file changes.
+  static FileRowsCache services(1);
+
+  QueryData results;
+  services.get({"/etc/services"},
+               ([](const std::string& path, QueryData& rows) {
+                 std::string content;
+                 if (readFile(path, content).ok()) {
+                   rows = parseEtcServicesContent(content);
+                 }
+               }),
+               results);
+  return results;
 }
 }
 }
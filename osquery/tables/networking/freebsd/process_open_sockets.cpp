@@ -103,17 +103,15 @@ void genSockets(struct procstat* pstat,
 
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
 
-  auto cnt = getProcesses(context, &pstat, &procs);
-
-  for (size_t i = 0; i < cnt; i++) {
-    genSockets(pstat, &procs[i], results);
+  auto snapshot = ProcstatSnapshot::current();
+  for (auto proc : snapshot->select(context)) {
+    // Socket details are read with the files, using the handle once.
+    snapshot->use([proc, &results](struct procstat* pstat) {
+      genSockets(pstat, proc, results);
+    });
   }
 
-  procstatCleanup(pstat, procs);
-
   return results;
 }
 }
@@ -8,8 +8,10 @@
  *
  */
 
-#include <sstream>
+#include <cstring>
 #include <iomanip>
+#include <mutex>
+#include <sstream>
 
 // Maintain the order of includes (ifaddrs after if).
 #include <net/if.h>
@@ -18,18 +20,32 @@
 
 #ifdef __linux__
 #include <linux/if_link.h>
-#include <sys/ioctl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
 #endif
 
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/networking/interfaces.h"
 #include "osquery/tables/networking/utils.h"
 
 namespace osquery {
 namespace tables {
 
+/// The life of an interface snapshot, in seconds.
+const size_t kInterfaceSnapshotTTL = 1;
+
+#ifdef __linux__
+/// The size of each netlink dump read.
+const size_t kNetlinkBufferSize = 32 * 1024;
+#endif
+
+static std::shared_ptr<InterfaceSnapshot> kInterfaceSnapshot;
+static std::mutex kInterfaceSnapshotMutex;
+
 // Functions for safe sign-extension
 std::basic_string<char> INTEGER_FROM_UCHAR(unsigned char x) {
   return INTEGER(static_cast<uint16_t>(x));
@@ -42,7 +58,7 @@ std::basic_string<char> BIGINT_FROM_UINT32(uint32_t x) {
 void genAddressesFromAddr(const struct ifaddrs *addr, QueryData &results) {
   std::string dest_address;
   Row r;
-  r["interface"] = std::string(addr->ifa_name);
+  r["interface"] = (addr->ifa_name != nullptr) ? addr->ifa_name : "";
 
   // Address and mask will appear every time.
   if (addr->ifa_addr != nullptr) {
@@ -67,6 +83,106 @@ void genAddressesFromAddr(const struct ifaddrs *addr, QueryData &results) {
   results.push_back(r);
 }
 
+#ifdef __linux__
+/// Parse the interface_details row of an RTM_NEWLINK message.
+static Row genDetailsFromLink(const struct nlmsghdr *header) {
+  auto info = static_cast<const struct ifinfomsg *>(NLMSG_DATA(header));
+
+  Row r;
+  r["mac"] = "00:00:00:00:00:00";
+  r["type"] = INTEGER_FROM_UCHAR(info->ifi_type);
+  r["mtu"] = "0";
+  r["metric"] = "0";
+
+  auto length = static_cast<int>(IFLA_PAYLOAD(header));
+  auto attr = IFLA_RTA(info);
+  for (; RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+    auto data = static_cast<const char *>(RTA_DATA(attr));
+    auto size = RTA_PAYLOAD(attr);
+    if (attr->rta_type == IFLA_IFNAME) {
+      r["interface"] = std::string(data, strnlen(data, size));
+    } else if (attr->rta_type == IFLA_MTU && size >= sizeof(uint32_t)) {
+      uint32_t mtu = 0;
+      memcpy(&mtu, data, sizeof(mtu));
+      r["mtu"] = BIGINT_FROM_UINT32(mtu);
+    } else if (attr->rta_type == IFLA_ADDRESS && size == 6) {
+      r["mac"] = macAsString(data);
+    } else if (attr->rta_type == IFLA_STATS64 &&
+               size >= sizeof(struct rtnl_link_stats64)) {
+      struct rtnl_link_stats64 stats;
+      memcpy(&stats, data, sizeof(stats));
+      r["ipackets"] = BIGINT(stats.rx_packets);
+      r["opackets"] = BIGINT(stats.tx_packets);
+      r["ibytes"] = BIGINT(stats.rx_bytes);
+      r["obytes"] = BIGINT(stats.tx_bytes);
+      r["ierrors"] = BIGINT(stats.rx_errors);
+      r["oerrors"] = BIGINT(stats.tx_errors);
+    }
+  }
+
+  // Last change is not implemented in Linux.
+  r["last_change"] = "-1";
+  return r;
+}
+
+/// Read the details of every link with one netlink RTM_GETLINK dump.
+static bool genLinkDetails(std::vector<Row> &links) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct {
+    struct nlmsghdr header;
+    struct ifinfomsg info;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  request.header.nlmsg_type = RTM_GETLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = 1;
+  request.info.ifi_family = AF_UNSPEC;
+  if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+    close(fd);
+    return false;
+  }
+
+  // The dump is read as multipart messages until NLMSG_DONE.
+  std::vector<char> buffer(kNetlinkBufferSize);
+  bool done = false;
+  bool failed = false;
+  while (!done && !failed) {
+    auto bytes = recv(fd, buffer.data(), buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      failed = true;
+      break;
+    }
+
+    auto remaining = static_cast<int>(bytes);
+    auto header = reinterpret_cast<struct nlmsghdr *>(buffer.data());
+    for (; NLMSG_OK(header, remaining);
+         header = NLMSG_NEXT(header, remaining)) {
+      if (header->nlmsg_type == NLMSG_DONE) {
+        done = true;
+        break;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        failed = true;
+        break;
+      } else if (header->nlmsg_type == RTM_NEWLINK) {
+        auto r = genDetailsFromLink(header);
+        if (!r["interface"].empty()) {
+          links.push_back(std::move(r));
+        }
+      }
+    }
+  }
+
+  close(fd);
+  return done;
+}
+#else
 void genDetailsFromAddr(const struct ifaddrs *addr, QueryData &results) {
   Row r;
   if (addr->ifa_name != nullptr) {
@@ -77,42 +193,6 @@ void genDetailsFromAddr(const struct ifaddrs *addr, QueryData &results) {
   r["mac"] = macAsString(addr);
 
   if (addr->ifa_data != nullptr && addr->ifa_name != nullptr) {
-#ifdef __linux__
-    // Linux/Netlink interface details parsing.
-    auto ifd = static_cast<struct rtnl_link_stats *>(addr->ifa_data);
-    r["mtu"] = "0";
-    r["metric"] = "0";
-    r["type"] = "0";
-    r["ipackets"] = BIGINT_FROM_UINT32(ifd->rx_packets);
-    r["opackets"] = BIGINT_FROM_UINT32(ifd->tx_packets);
-    r["ibytes"] = BIGINT_FROM_UINT32(ifd->rx_bytes);
-    r["obytes"] = BIGINT_FROM_UINT32(ifd->tx_bytes);
-    r["ierrors"] = BIGINT_FROM_UINT32(ifd->rx_errors);
-    r["oerrors"] = BIGINT_FROM_UINT32(ifd->tx_errors);
-
-    // Get Linux physical properties for the AF_PACKET entry.
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd >= 0) {
-      struct ifreq ifr;
-      memcpy(ifr.ifr_name, addr->ifa_name, IFNAMSIZ);
-      if (ioctl(fd, SIOCGIFMTU, &ifr) >= 0) {
-        r["mtu"] = BIGINT_FROM_UINT32(ifr.ifr_mtu);
-      }
-
-      if (ioctl(fd, SIOCGIFMETRIC, &ifr) >= 0) {
-        r["metric"] = BIGINT_FROM_UINT32(ifr.ifr_metric);
-      }
-
-      if (ioctl(fd, SIOCGIFHWADDR, &ifr) >= 0) {
-        r["type"] = INTEGER_FROM_UCHAR(ifr.ifr_hwaddr.sa_family);
-      }
-
-      close(fd);
-    }
-
-    // Last change is not implemented in Linux.
-    r["last_change"] = "-1";
-#else
     // Apple and FreeBSD interface details parsing.
     auto ifd = (struct if_data *)addr->ifa_data;
     r["type"] = INTEGER_FROM_UCHAR(ifd->ifi_type);
@@ -125,55 +205,113 @@ void genDetailsFromAddr(const struct ifaddrs *addr, QueryData &results) {
     r["ierrors"] = BIGINT_FROM_UINT32(ifd->ifi_ierrors);
     r["oerrors"] = BIGINT_FROM_UINT32(ifd->ifi_oerrors);
     r["last_change"] = BIGINT_FROM_UINT32(ifd->ifi_lastchange.tv_sec);
-#endif
   }
 
   results.push_back(r);
 }
+#endif
 
-QueryData genInterfaceAddresses(QueryContext &context) {
-  QueryData results;
+std::shared_ptr<InterfaceSnapshot> InterfaceSnapshot::current() {
+  std::lock_guard<std::mutex> lock(kInterfaceSnapshotMutex);
+  if (kInterfaceSnapshot == nullptr ||
+      getUnixTime() >= kInterfaceSnapshot->time_ + kInterfaceSnapshotTTL) {
+    kInterfaceSnapshot = std::make_shared<InterfaceSnapshot>();
+  }
+  return kInterfaceSnapshot;
+}
+
+InterfaceSnapshot::InterfaceSnapshot() : time_(getUnixTime()) {
+#ifdef __linux__
+  std::vector<Row> links;
+  if (!genLinkDetails(links)) {
+    VLOG(1) << "Cannot read the netlink interface details";
+  }
+  for (auto &link : links) {
+    auto name = link["interface"];
+    addName(name);
+    details_[name] = std::move(link);
+  }
+#endif
 
   struct ifaddrs *if_addrs = nullptr;
   struct ifaddrs *if_addr = nullptr;
   if (getifaddrs(&if_addrs) != 0 || if_addrs == nullptr) {
-    return {};
+    return;
   }
 
   for (if_addr = if_addrs; if_addr != nullptr; if_addr = if_addr->ifa_next) {
-    if (if_addr->ifa_addr == nullptr) {
+    if (if_addr->ifa_name == nullptr) {
       continue;
     }
-    if (if_addr->ifa_addr->sa_family == AF_INET ||
-        if_addr->ifa_addr->sa_family == AF_INET6) {
-      genAddressesFromAddr(if_addr, results);
+    std::string name = if_addr->ifa_name;
+    if (if_addr->ifa_addr != nullptr &&
+        (if_addr->ifa_addr->sa_family == AF_INET ||
+         if_addr->ifa_addr->sa_family == AF_INET6)) {
+      addName(name);
+      genAddressesFromAddr(if_addr, addresses_[name]);
+    }
+#ifndef __linux__
+    if (if_addr->ifa_addr == nullptr ||
+        if_addr->ifa_addr->sa_family == AF_INTERFACE) {
+      QueryData details;
+      genDetailsFromAddr(if_addr, details);
+      addName(name);
+      details_[name] = std::move(details.front());
     }
+#endif
   }
 
   freeifaddrs(if_addrs);
-  return results;
 }
 
-QueryData genInterfaceDetails(QueryContext &context) {
-  QueryData results;
+void InterfaceSnapshot::addName(const std::string &name) {
+  if (addresses_.count(name) == 0 && details_.count(name) == 0) {
+    names_.push_back(name);
+  }
+}
 
-  struct ifaddrs *if_addrs = nullptr;
-  struct ifaddrs *if_addr = nullptr;
-  if (getifaddrs(&if_addrs) != 0 || if_addrs == nullptr) {
-    return {};
+void InterfaceSnapshot::getAddresses(const std::string &name,
+                                     QueryData &results) const {
+  auto addresses = addresses_.find(name);
+  if (addresses != addresses_.end()) {
+    results.insert(
+        results.end(), addresses->second.begin(), addresses->second.end());
   }
+}
 
-  for (if_addr = if_addrs; if_addr != nullptr; if_addr = if_addr->ifa_next) {
-    if (if_addr->ifa_addr != nullptr &&
-        if_addr->ifa_addr->sa_family != AF_INTERFACE) {
-      // This interface entry does not describe the link details.
-      continue;
-    }
+void InterfaceSnapshot::getDetails(const std::string &name,
+                                   QueryData &results) const {
+  auto details = details_.find(name);
+  if (details != details_.end()) {
+    results.push_back(details->second);
+  }
+}
 
-    genDetailsFromAddr(if_addr, results);
+/// The interfaces constrained by a query, or every interface.
+static std::vector<std::string> getInterfaceNames(
+    const InterfaceSnapshot &snapshot, QueryContext &context) {
+  if (context.constraints["interface"].exists(EQUALS)) {
+    auto names = context.constraints["interface"].getAll(EQUALS);
+    return std::vector<std::string>(names.begin(), names.end());
   }
+  return snapshot.names();
+}
 
-  freeifaddrs(if_addrs);
+QueryData genInterfaceAddresses(QueryContext &context) {
+  QueryData results;
+  auto snapshot = InterfaceSnapshot::current();
+  for (const auto &name : getInterfaceNames(*snapshot, context)) {
+    snapshot->getAddresses(name, results);
+  }
+  return results;
+}
+
+QueryData genInterfaceDetails(QueryContext &context) {
+  QueryData results;
+  auto snapshot = InterfaceSnapshot::current();
+  for (const auto &name : getInterfaceNames(*snapshot, context)) {
+    snapshot->getDetails(name, results);
+  }
   return results;
 }
 }
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief A shared view of the network interfaces, their links and addresses.
+ *
+ * The interface tables generating in the same scheduler step share one
+ * enumeration through InterfaceSnapshot::current. The addresses are read with
+ * one getifaddrs call. On Linux the link details are read with one netlink
+ * RTM_GETLINK dump, instead of ioctls for each interface.
+ *
+ * The rows of each interface are indexed by name for `interface` constraints
+ * and join probes.
+ */
+class InterfaceSnapshot : private boost::noncopyable {
+ public:
+  /// Return the current snapshot, a new snapshot is taken every step.
+  static std::shared_ptr<InterfaceSnapshot> current();
+
+  /// Enumerate the current interfaces.
+  InterfaceSnapshot();
+
+  /// The interface names, in enumeration order.
+  const std::vector<std::string>& names() const { return names_; }
+
+  /// Append the interface_addresses rows of an interface.
+  void getAddresses(const std::string& name, QueryData& results) const;
+
+  /// Append the interface_details row of an interface.
+  void getDetails(const std::string& name, QueryData& results) const;
+
+ private:
+  /// Add an interface name the first time it is enumerated.
+  void addName(const std::string& name);
+
+ private:
+  /// The interface names, in enumeration order.
+  std::vector<std::string> names_;
+
+  /// The address rows and details row of each interface.
+  std::unordered_map<std::string, QueryData> addresses_;
+  std::unordered_map<std::string, Row> details_;
+
+  /// The time the snapshot was taken.
+  size_t time_{0};
+};
+}
+}
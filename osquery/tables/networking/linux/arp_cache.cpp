@@ -8,15 +8,12 @@
  *
  */
 
-#include <fstream>
-
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
 namespace tables {
 
@@ -31,36 +28,27 @@ QueryData genArpCache(QueryContext& context) {
     return results;
   }
 
-  std::ifstream fd(arp_path.string(), std::ios::in | std::ios::binary);
-  std::string line;
-
-  if (fd.fail() || fd.eof()) {
+  std::string content;
+  if (!readFile(arp_path, content).ok() || content.empty()) {
     VLOG(1) << "Empty or failed arp table";
     return results;
   }
 
-  // Read the header line.
-  std::getline(fd, line, '\n');
-  while (!(fd.fail() || fd.eof())) {
-    std::getline(fd, line, '\n');
-
+  // Skip the header line.
+  LineScanner scanner(content, " ");
+  scanner.next();
+  while (scanner.next()) {
     // IP address, HW type, Flags, HW address, Mask Device
-    std::vector<std::string> fields;
-    boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
-    for (auto& f : fields) {
-      // Inline trim each split.
-      boost::trim(f);
-    }
-
+    const auto& fields = scanner.fields();
     if (fields.size() != 6) {
       // An unhandled error case.
       continue;
     }
 
     Row r;
-    r["address"] = fields[0];
-    r["mac"] = fields[3];
-    r["interface"] = fields[5];
+    r["address"] = fields[0].to_string();
+    r["mac"] = fields[3].to_string();
+    r["interface"] = fields[5].to_string();
 
     // Note: it's also possible to detect publish entries (ATF_PUB).
     if (fields[2] == "0x6") {
@@ -70,7 +58,7 @@ QueryData genArpCache(QueryContext& context) {
       r["permanent"] = "0";
     }
 
-    results.push_back(r);
+    results.push_back(std::move(r));
   }
 
   return results;
@@ -13,9 +13,6 @@
 #include <arpa/inet.h>
 #include <libiptc/libiptc.h>
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
@@ -137,11 +134,9 @@ QueryData genIptables(QueryContext &context) {
   std::string content;
   auto s = osquery::readFile(kLinuxIpTablesNames, content);
   if (s.ok()) {
-    for (auto &line : split(content, "\n")) {
-      boost::trim(line);
-      if (line.size() > 0) {
-        genIPTablesRules(line, results);
-      }
+    LineScanner scanner(content);
+    while (scanner.next()) {
+      genIPTablesRules(scanner.line().to_string(), results);
     }
   } else {
     // Permissions issue or iptables modules are not loaded.
@@ -9,12 +9,22 @@
  */
 
 #include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
+
+#ifndef SOCK_DIAG_BY_FAMILY
+#define SOCK_DIAG_BY_FAMILY 20
+#endif
 
 namespace osquery {
 namespace tables {
@@ -31,6 +41,45 @@ const std::map<int, std::string> kLinuxProtocolNames = {
 // A map of socket handles (inodes) to their pid and file descriptor.
 typedef std::map<std::string, std::pair<std::string, std::string> > InodeMap;
 
+/// Every socket state, as a bit mask of TCP states.
+const uint32_t kAllSocketStates = 0xFFFFFFFF;
+
+/// States of sockets without a remote port: listening or unconnected.
+const uint32_t kListeningSocketStates = (1 << TCP_LISTEN) | (1 << TCP_CLOSE);
+
+/// The size of each read of a netlink socket dump.
+const size_t kSocketDiagBufferSize = 32768;
+
+/// Kernel-side filters for a socket dump, from the query constraints.
+struct SocketFilter {
+  /// The socket states to dump, as a bit mask of TCP states.
+  uint32_t states{kAllSocketStates};
+
+  /// Only dump sockets bound to this local port, 0 for any port.
+  unsigned short local_port{0};
+};
+
+/// Check if a column value may match the equality constraints of a query.
+static bool isRequested(QueryContext &context,
+                        const std::string &column,
+                        const std::string &value) {
+  auto &constraint = context.constraints[column];
+  return !constraint.exists(EQUALS) ||
+         constraint.getAll(EQUALS).count(value) > 0;
+}
+
+/// Set the pid and descriptor owning a socket from its inode.
+static void setSocketOwner(const InodeMap &inodes, Row &r) {
+  auto owner = inodes.find(r["socket"]);
+  if (owner != inodes.end()) {
+    r["pid"] = owner->second.second;
+    r["fd"] = owner->second.first;
+  } else {
+    r["pid"] = "-1";
+    r["fd"] = "-1";
+  }
+}
+
 std::string addressFromHex(const std::string &encoded_address, int family) {
   char addr_buffer[INET6_ADDRSTRLEN] = {0};
   if (family == AF_INET) {
@@ -66,8 +115,9 @@ unsigned short portFromHex(const std::string &encoded_port) {
 void genSocketsFromProc(const InodeMap &inodes,
                         int protocol,
                         int family,
+                        const std::string &net,
                         QueryData &results) {
-  std::string path = "/proc/net/";
+  auto path = net;
   if (family == AF_UNIX) {
     path += "unix";
   } else {
@@ -133,15 +183,197 @@ void genSocketsFromProc(const InodeMap &inodes,
       r["path"] = "";
     }
 
-    if (inodes.count(r["socket"]) > 0) {
-      r["pid"] = inodes.at(r["socket"]).second;
-      r["fd"] = inodes.at(r["socket"]).first;
-    } else {
-      r["pid"] = "-1";
-      r["fd"] = "-1";
+    setSocketOwner(inodes, r);
+    results.push_back(r);
+  }
+}
+
+/// The socket dump request, with optional bytecode matching a local port.
+struct SocketDiagRequest {
+  struct nlmsghdr header;
+  struct inet_diag_req_v2 request;
+  struct nlattr bytecode_attribute;
+
+  // Local port >= port, then local port <= port, otherwise reject.
+  struct inet_diag_bc_op port_ge;
+  struct inet_diag_bc_op port_ge_value;
+  struct inet_diag_bc_op port_le;
+  struct inet_diag_bc_op port_le_value;
+};
+
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             int protocol,
+                             int family,
+                             const SocketFilter &filter,
+                             QueryData &results) {
+  int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_INET_DIAG);
+  if (fd < 0) {
+    return Status(1, "Cannot open NETLINK_INET_DIAG socket");
+  }
+
+  SocketDiagRequest message;
+  memset(&message, 0, sizeof(message));
+  message.header.nlmsg_len = NLMSG_LENGTH(sizeof(message.request));
+  message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  message.request.sdiag_family = family;
+  message.request.sdiag_protocol = protocol;
+  message.request.idiag_states = filter.states;
+
+  if (filter.local_port != 0) {
+    // Each comparison is an op followed by its port, a failure jumps past
+    // the end of the bytecode and rejects the socket.
+    size_t bytecode_size = 4 * sizeof(struct inet_diag_bc_op);
+    message.bytecode_attribute.nla_type = INET_DIAG_REQ_BYTECODE;
+    message.bytecode_attribute.nla_len = NLA_HDRLEN + bytecode_size;
+    message.port_ge = {INET_DIAG_BC_S_GE, 8, 20};
+    message.port_ge_value.no = filter.local_port;
+    message.port_le = {INET_DIAG_BC_S_LE, 8, 12};
+    message.port_le_value.no = filter.local_port;
+    message.header.nlmsg_len += message.bytecode_attribute.nla_len;
+  }
+
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(fd,
+             &message,
+             message.header.nlmsg_len,
+             0,
+             (struct sockaddr *)&kernel,
+             sizeof(kernel)) < 0) {
+    close(fd);
+    return Status(1, "Cannot write NETLINK_INET_DIAG request");
+  }
+
+  // Sockets are parsed as each part of the dump is read.
+  std::vector<char> buffer(kSocketDiagBufferSize);
+  Status status(0, "OK");
+  bool done = false;
+  while (!done) {
+    auto size = recv(fd, buffer.data(), buffer.size(), 0);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      status = Status(1, "Cannot read NETLINK_INET_DIAG response");
+      break;
     }
 
-    results.push_back(r);
+    int remaining = static_cast<int>(size);
+    auto header = reinterpret_cast<struct nlmsghdr *>(buffer.data());
+    for (; NLMSG_OK(header, remaining);
+         header = NLMSG_NEXT(header, remaining)) {
+      if (header->nlmsg_type == NLMSG_DONE) {
+        // A dump ends with an error code if it could not be started.
+        if (header->nlmsg_len >= NLMSG_LENGTH(sizeof(int)) &&
+            *static_cast<const int *>(NLMSG_DATA(header)) < 0) {
+          status = Status(1, "NETLINK_INET_DIAG dump failed");
+        }
+        done = true;
+        break;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        // The kernel may not support diagnostics for this protocol.
+        status = Status(1, "NETLINK_INET_DIAG request failed");
+        done = true;
+        break;
+      } else if (header->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+                 header->nlmsg_len < NLMSG_LENGTH(sizeof(inet_diag_msg))) {
+        continue;
+      }
+
+      auto diag = static_cast<const struct inet_diag_msg *>(NLMSG_DATA(header));
+      char address[INET6_ADDRSTRLEN] = {0};
+
+      Row r;
+      r["socket"] = TEXT(diag->idiag_inode);
+      r["family"] = INTEGER(family);
+      r["protocol"] = INTEGER(protocol);
+      inet_ntop(family, diag->id.idiag_src, address, sizeof(address));
+      r["local_address"] = address;
+      r["local_port"] = INTEGER(ntohs(diag->id.idiag_sport));
+      inet_ntop(family, diag->id.idiag_dst, address, sizeof(address));
+      r["remote_address"] = address;
+      r["remote_port"] = INTEGER(ntohs(diag->id.idiag_dport));
+      r["path"] = "";
+      setSocketOwner(inodes, r);
+      results.push_back(std::move(r));
+    }
+  }
+
+  close(fd);
+  return status;
+}
+
+/// The sockets of a network namespace and the processes using it.
+struct NetNamespace {
+  /// The `/proc` net directory of a process in the namespace.
+  std::string net;
+
+  /// Netlink diagnostics report the sockets of osquery's namespace.
+  bool own{false};
+
+  std::vector<std::string> pids;
+};
+
+void genSockets(const InodeMap &inodes,
+                int protocol,
+                int family,
+                const SocketFilter &filter,
+                const NetNamespace &ns,
+                QueryData &results) {
+  // Only TCP and UDP diagnostics report the same details as proc.
+  // The sockets of a synthetic proc root are only in its net files.
+  if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP ||
+       protocol == IPPROTO_UDPLITE) &&
+      ns.own && ProcSnapshot::root() == "/proc") {
+    QueryData sockets;
+    auto status =
+        genSocketsFromNetlink(inodes, protocol, family, filter, sockets);
+    if (status.ok()) {
+      results.insert(results.end(),
+                     std::make_move_iterator(sockets.begin()),
+                     std::make_move_iterator(sockets.end()));
+      return;
+    }
+    VLOG(1) << "Reading sockets from proc: " << status.getMessage();
+  }
+  genSocketsFromProc(inodes, protocol, family, ns.net, results);
+}
+
+/// Generate the sockets of a network namespace.
+static void genNamespaceSockets(QueryContext &context,
+                                ProcSnapshot &snapshot,
+                                const NetNamespace &ns,
+                                const SocketFilter &filter,
+                                QueryData &results) {
+  // Generate a map of socket inode to process tid.
+  InodeMap socket_inodes;
+  for (const auto &process : ns.pids) {
+    for (const auto &fd : snapshot.descriptors(process)) {
+      if (fd.second.find("socket:[") == 0) {
+        // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
+        auto inode = fd.second.substr(8);
+        socket_inodes[inode.substr(0, inode.size() - 1)] =
+            std::make_pair(fd.first, process);
+      }
+    }
+  }
+
+  // Use netlink socket diagnostics, proc is read for other protocols and if
+  // the kernel does not support diagnostics for a protocol.
+  for (const auto &protocol : kLinuxProtocolNames) {
+    if (!isRequested(context, "protocol", INTEGER(protocol.first))) {
+      continue;
+    }
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (isRequested(context, "family", INTEGER(family))) {
+        genSockets(socket_inodes, protocol.first, family, filter, ns, results);
+      }
+    }
+  }
+
+  if (isRequested(context, "family", "0")) {
+    genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, ns.net, results);
   }
 }
 
@@ -149,37 +381,67 @@ QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
   // If a pid is given then set that as the only item in processes.
+  auto snapshot = ProcSnapshot::current();
   std::set<std::string> pids;
-  if (context.constraints["pid"].exists(EQUALS)) {
+  bool constrained = context.constraints["pid"].exists(EQUALS);
+  if (constrained) {
     pids = context.constraints["pid"].getAll(EQUALS);
   } else {
-    osquery::procProcesses(pids);
+    pids = snapshot->pids();
   }
 
-  // Generate a map of socket inode to process tid.
-  InodeMap socket_inodes;
+  // Each network namespace, such as a container's, has its own sockets. A
+  // process whose namespace cannot be read is counted in osquery's.
+  auto root = ProcSnapshot::root();
+  auto self = snapshot->getNamespace(std::to_string(getpid()), "net");
+  std::map<std::string, NetNamespace> namespaces;
+  if (!constrained && isRequested(context, "net_namespace", self)) {
+    // Sockets without a process are reported for osquery's namespace.
+    namespaces[self].net = root + "/net/";
+    namespaces[self].own = true;
+  }
+  std::set<std::string> requested;
   for (const auto &process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      for (const auto &fd : descriptors) {
-        if (fd.second.find("socket:[") == 0) {
-          // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
-          auto inode = fd.second.substr(8);
-          socket_inodes[inode.substr(0, inode.size() - 1)] =
-              std::make_pair(fd.first, process);
-        }
-      }
+    auto ns = snapshot->getNamespace(process, "net");
+    ns = (ns.empty()) ? self : ns;
+    if (!isRequested(context, "net_namespace", ns)) {
+      continue;
+    }
+    auto &net_namespace = namespaces[ns];
+    if (net_namespace.net.empty()) {
+      net_namespace.own = (ns == self);
+      net_namespace.net =
+          (net_namespace.own) ? root + "/net/" : root + "/" + process + "/net/";
     }
+    net_namespace.pids.push_back(process);
+    requested.insert(process);
   }
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
-  for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+  // The descriptor links of every process are read in one batch.
+  snapshot->readDescriptors(requested);
+
+  // Listening sockets and a local port are filtered by the kernel.
+  SocketFilter filter;
+  auto remote_ports = context.constraints["remote_port"].getAll(EQUALS);
+  if (remote_ports.size() == 1 && *remote_ports.begin() == "0") {
+    filter.states = kListeningSocketStates;
+  }
+  auto local_ports = context.constraints["local_port"].getAll(EQUALS);
+  if (local_ports.size() == 1) {
+    auto port = std::atoi(local_ports.begin()->c_str());
+    if (port > 0 && port <= 0xFFFF) {
+      filter.local_port = static_cast<unsigned short>(port);
+    }
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  for (const auto &ns : namespaces) {
+    QueryData sockets;
+    genNamespaceSockets(context, *snapshot, ns.second, filter, sockets);
+    for (auto &socket : sockets) {
+      socket["net_namespace"] = ns.first;
+      results.push_back(std::move(socket));
+    }
+  }
   return results;
 }
 }
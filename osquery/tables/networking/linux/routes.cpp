@@ -13,6 +13,8 @@
 #include <linux/rtnetlink.h>
 #include <net/if.h>
 
+#include <mutex>
+
 #include <boost/algorithm/string/trim.hpp>
 
 #include <osquery/core.h>
@@ -21,11 +23,19 @@
 
 #include "osquery/tables/networking/utils.h"
 
+// Strict dump requests, from Linux 4.20 headers.
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
 namespace osquery {
 namespace tables {
 
-#define MAX_NETLINK_SIZE 8192
-#define MAX_NETLINK_ATTEMPTS 8
+/// The route dump datagrams are received into a buffer of this size.
+#define MAX_NETLINK_SIZE (64 * 1024)
+
+/// Seconds to wait for each datagram of a route dump.
+#define NETLINK_RECV_TIMEOUT 2
 
 std::string getNetlinkIP(int family, const char* buffer) {
   char dst[INET6_ADDRSTRLEN];
@@ -38,62 +48,88 @@ std::string getNetlinkIP(int family, const char* buffer) {
   return address;
 }
 
-Status readNetlink(int socket_fd, int seq, char* output, size_t* size) {
-  struct nlmsghdr* nl_hdr = nullptr;
-
-  size_t message_size = 0;
-  do {
-    size_t latency = 0;
-    size_t total_bytes = 0;
-    ssize_t bytes = 0;
-    while (bytes == 0) {
-      bytes = recv(socket_fd, output, MAX_NETLINK_SIZE - message_size, 0);
-      if (bytes < 0) {
-        // Unrecoverable NETLINK error, bail.
-        return Status(1, "Could not read from NETLINK");
+/// The route type names of the type column.
+static std::string getRouteType(unsigned char type) {
+  switch (type) {
+  case RTN_UNICAST:
+    return "gateway";
+  case RTN_LOCAL:
+    return "local";
+  case RTN_BROADCAST:
+    return "broadcast";
+  case RTN_ANYCAST:
+    return "anycast";
+  default:
+    return "other";
+  }
+}
+
+/**
+ * @brief The route dump filters derived from the query constraints.
+ *
+ * A strict dump request asks the kernel to return only the routes of a
+ * family, type, and output interface. Kernels without strict requests
+ * ignore the filters except the family, so routes are filtered again as
+ * they are parsed.
+ */
+struct RouteFilter {
+  explicit RouteFilter(const QueryContext& context) {
+    if (context.constraints.count("destination") > 0) {
+      // Dump a single family if every destination is of one family.
+      int families = 0;
+      for (const auto& destination :
+           context.constraints.at("destination").getAll(EQUALS)) {
+        families |= (destination.find(':') != std::string::npos) ? 2 : 1;
       }
+      family = (families == 1) ? AF_INET : (families == 2) ? AF_INET6 : 0;
+    }
 
-      // Bytes were returned by we might need to read more.
-      total_bytes += bytes;
-      if (latency >= MAX_NETLINK_ATTEMPTS) {
-        // Too many attempts to read bytes have occurred.
-        // Prevent the NETLINK socket from handing and bail.
-        return Status(1, "Netlink timeout");
-      } else if (bytes == 0) {
-        if (total_bytes > 0) {
-          // Bytes were read, but now no more are available, attempt to parse
-          // the received NETLINK message.
-          break;
+    if (context.constraints.count("type") > 0) {
+      types = context.constraints.at("type").getAll(EQUALS);
+      if (types.size() == 1) {
+        const auto& name = *types.begin();
+        for (unsigned char t : {RTN_UNICAST, RTN_LOCAL, RTN_BROADCAST,
+                                RTN_ANYCAST}) {
+          if (getRouteType(t) == name) {
+            type = t;
+          }
         }
-        ::usleep(20);
-        latency += 1;
       }
     }
 
-    // Assure valid header response, and not an error type.
-    nl_hdr = (struct nlmsghdr*)output;
-    if (NLMSG_OK(nl_hdr, bytes) == 0 || nl_hdr->nlmsg_type == NLMSG_ERROR) {
-      return Status(1, "Read invalid NETLINK message");
+    if (context.constraints.count("interface") > 0) {
+      interfaces = context.constraints.at("interface").getAll(EQUALS);
+      if (interfaces.size() == 1) {
+        interface = if_nametoindex(interfaces.begin()->c_str());
+      }
     }
+  }
 
-    if (nl_hdr->nlmsg_type == NLMSG_DONE) {
-      break;
+  /// Check if a route of a type and interface is selected.
+  bool matches(const std::string& route_type,
+               const std::string& route_interface) const {
+    if (!types.empty() && types.count(route_type) == 0) {
+      return false;
     }
+    return interfaces.empty() || interfaces.count(route_interface) > 0;
+  }
 
-    // Move the buffer pointer
-    output += bytes;
-    message_size += bytes;
-    if ((nl_hdr->nlmsg_flags & NLM_F_MULTI) == 0) {
-      break;
-    }
-  } while (static_cast<pid_t>(nl_hdr->nlmsg_seq) != seq ||
-           static_cast<pid_t>(nl_hdr->nlmsg_pid) != getpid());
+  /// The family dumped, 0 for every family.
+  unsigned char family{0};
 
-  *size = message_size;
-  return Status(0, "OK");
-}
+  /// The route type dumped by the kernel, 0 for every type.
+  unsigned char type{0};
+
+  /// The output interface dumped by the kernel, 0 for every interface.
+  unsigned int interface{0};
 
-void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
+  std::set<std::string> types;
+  std::set<std::string> interfaces;
+};
+
+void genNetlinkRoutes(const struct nlmsghdr* netlink_msg,
+                      const RouteFilter& filter,
+                      QueryData& results) {
   std::string address;
   int mask = 0;
   char interface[IF_NAMESIZE];
@@ -102,6 +138,12 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
   struct rtattr* attr = static_cast<struct rtattr*>(RTM_RTA(message));
   uint32_t attr_size = RTM_PAYLOAD(netlink_msg);
 
+  // Filter before parsing the attributes of the route.
+  auto type = getRouteType(message->rtm_type);
+  if (!filter.types.empty() && filter.types.count(type) == 0) {
+    return;
+  }
+
   Row r;
 
   // Iterate over each route in the netlink message
@@ -136,6 +178,10 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
     attr = RTA_NEXT(attr, attr_size);
   }
 
+  if (!filter.matches(type, r["interface"])) {
+    return;
+  }
+
   if (!has_destination) {
     r["destination"] = "0.0.0.0";
     if (message->rtm_dst_len) {
@@ -144,18 +190,7 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
   }
 
   // Route type determination
-  if (message->rtm_type == RTN_UNICAST) {
-    r["type"] = "gateway";
-  } else if (message->rtm_type == RTN_LOCAL) {
-    r["type"] = "local";
-  } else if (message->rtm_type == RTN_BROADCAST) {
-    r["type"] = "broadcast";
-  } else if (message->rtm_type == RTN_ANYCAST) {
-    r["type"] = "anycast";
-  } else {
-    r["type"] = "other";
-  }
-
+  r["type"] = std::move(type);
   r["flags"] = INTEGER(message->rtm_flags);
 
   // This is the cidr-formatted mask
@@ -163,57 +198,185 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
 
   // Fields not supported by Linux routes:
   r["mtu"] = "0";
-  results.push_back(r);
+  results.push_back(std::move(r));
 }
 
-QueryData genRoutes(QueryContext& context) {
-  QueryData results;
+/**
+ * @brief Parse the route messages of a dump datagram.
+ *
+ * @return true, with the dump status set, when the dump is done.
+ */
+static bool parseRouteDump(const char* buffer,
+                           size_t size,
+                           uint32_t seq,
+                           const RouteFilter& filter,
+                           QueryData& results,
+                           Status& status) {
+  // Treat the netlink response as route information
+  auto netlink_msg = reinterpret_cast<const struct nlmsghdr*>(buffer);
+  for (; NLMSG_OK(netlink_msg, size);
+       netlink_msg = NLMSG_NEXT(netlink_msg, size)) {
+    if (netlink_msg->nlmsg_seq != seq) {
+      // A reply to an earlier request.
+      continue;
+    }
+    if (netlink_msg->nlmsg_type == NLMSG_DONE) {
+      status = Status(0, "OK");
+      return true;
+    } else if (netlink_msg->nlmsg_type == NLMSG_ERROR) {
+      status = Status(1, "Read invalid NETLINK message");
+      return true;
+    } else if (netlink_msg->nlmsg_type == RTM_NEWROUTE) {
+      genNetlinkRoutes(netlink_msg, filter, results);
+    }
+  }
+  return false;
+}
 
-  int socket_fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-  if (socket_fd < 0) {
-    VLOG(1) << "Cannot open NETLINK socket";
-    return {};
+/**
+ * @brief A netlink route socket and receive buffer kept between queries.
+ *
+ * Each dumped datagram is parsed into rows as it is received, so a large
+ * routing table never needs a buffer larger than one datagram. The socket
+ * is closed after an error so an interrupted dump is not read by the next
+ * query.
+ */
+class RouteNetlink : private boost::noncopyable {
+ public:
+  RouteNetlink() : buffer_(MAX_NETLINK_SIZE) {}
+
+  ~RouteNetlink() { reset(); }
+
+  /// Dump the routes selected by a filter.
+  Status dump(const RouteFilter& filter, QueryData& results);
+
+ private:
+  /// Open the socket if it is not open.
+  bool open();
+
+  /// Close the socket.
+  void reset();
+
+  /// Send a dump request and parse the replies.
+  Status request(const RouteFilter& filter, QueryData& results);
+
+ private:
+  int socket_{-1};
+
+  /// The sequence number of the last request.
+  uint32_t seq_{0};
+
+  std::vector<char> buffer_;
+
+  /// Serializes queries sharing the socket.
+  std::mutex mutex_;
+};
+
+bool RouteNetlink::open() {
+  if (socket_ >= 0) {
+    return true;
   }
 
-  // Create netlink message header
-  auto netlink_buffer = (void*)malloc(MAX_NETLINK_SIZE);
-  if (netlink_buffer == nullptr) {
-    close(socket_fd);
-    return {};
+  socket_ = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (socket_ < 0) {
+    return false;
   }
 
-  auto netlink_msg = (struct nlmsghdr*)netlink_buffer;
-  netlink_msg->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-  netlink_msg->nlmsg_type = RTM_GETROUTE; // routes from kernel routing table
-  netlink_msg->nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
-  netlink_msg->nlmsg_seq = 0;
-  netlink_msg->nlmsg_pid = getpid();
+  struct timeval timeout = {NETLINK_RECV_TIMEOUT, 0};
+  setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Older kernels do not filter dumps, filters are applied when parsing.
+  int strict = 1;
+  setsockopt(socket_, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &strict,
+             sizeof(strict));
+  return true;
+}
+
+void RouteNetlink::reset() {
+  if (socket_ >= 0) {
+    close(socket_);
+    socket_ = -1;
+  }
+}
+
+Status RouteNetlink::request(const RouteFilter& filter, QueryData& results) {
+  struct {
+    struct nlmsghdr header;
+    struct rtmsg message;
+    char attributes[RTA_SPACE(sizeof(uint32_t))];
+  } request;
+  memset(&request, 0, sizeof(request));
+
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+  request.header.nlmsg_type = RTM_GETROUTE; // routes from kernel routing table
+  request.header.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
+  request.header.nlmsg_seq = ++seq_;
+  request.message.rtm_family = filter.family;
+  request.message.rtm_type = filter.type;
+  if (filter.interface != 0) {
+    auto attr = reinterpret_cast<struct rtattr*>(
+        reinterpret_cast<char*>(&request) +
+        NLMSG_ALIGN(request.header.nlmsg_len));
+    attr->rta_type = RTA_OIF;
+    attr->rta_len = RTA_LENGTH(sizeof(uint32_t));
+    memcpy(RTA_DATA(attr), &filter.interface, sizeof(uint32_t));
+    request.header.nlmsg_len =
+        NLMSG_ALIGN(request.header.nlmsg_len) + RTA_SPACE(sizeof(uint32_t));
+  }
 
   // Send the netlink request to the kernel
-  if (send(socket_fd, netlink_msg, netlink_msg->nlmsg_len, 0) < 0) {
-    TLOG << "Cannot write NETLINK request header to socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+  if (send(socket_, &request, request.header.nlmsg_len, 0) < 0) {
+    return Status(1, "Cannot write NETLINK request header to socket");
   }
 
-  // Wrap the read socket to support multi-netlink messages
-  size_t size = 0;
-  if (!readNetlink(socket_fd, 1, (char*)netlink_msg, &size).ok()) {
-    TLOG << "Cannot read NETLINK response from socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+  while (true) {
+    auto bytes = recv(socket_, buffer_.data(), buffer_.size(), MSG_TRUNC);
+    if (bytes < 0) {
+      // Unrecoverable NETLINK error or timeout, bail.
+      return Status(1, "Could not read from NETLINK");
+    } else if (static_cast<size_t>(bytes) > buffer_.size()) {
+      return Status(1, "NETLINK message exceeded the receive buffer");
+    }
+
+    Status status;
+    if (parseRouteDump(buffer_.data(), bytes, seq_, filter, results, status)) {
+      return status;
+    }
   }
+}
 
-  // Treat the netlink response as route information
-  while (NLMSG_OK(netlink_msg, size)) {
-    genNetlinkRoutes(netlink_msg, results);
-    netlink_msg = NLMSG_NEXT(netlink_msg, size);
+Status RouteNetlink::dump(const RouteFilter& filter, QueryData& results) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!open()) {
+    return Status(1, "Cannot open NETLINK socket");
+  }
+
+  auto status = request(filter, results);
+  if (!status.ok()) {
+    reset();
+  }
+  return status;
+}
+
+QueryData genRoutes(QueryContext& context) {
+  QueryData results;
+
+  static RouteNetlink netlink;
+  auto status = netlink.dump(RouteFilter(context), results);
+  if (!status.ok()) {
+    TLOG << "Cannot read routes: " << status.getMessage();
+    return {};
   }
+  return results;
+}
 
-  close(socket_fd);
-  free(netlink_buffer);
+/// Generate routes from a captured dump of sequence 0, used by benchmarks.
+QueryData genRoutesFromDump(QueryContext& context,
+                            const std::vector<char>& dump) {
+  QueryData results;
+  Status status;
+  parseRouteDump(
+      dump.data(), dump.size(), 0, RouteFilter(context), results, status);
   return results;
 }
 }
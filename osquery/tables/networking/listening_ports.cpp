@@ -15,12 +15,28 @@ namespace osquery {
 namespace tables {
 
 typedef std::pair<std::string, std::string> ProtoFamilyPair;
-typedef std::map<std::string, std::vector<ProtoFamilyPair> > PortMap;
+
+/// The binds of each port, by network namespace and port.
+typedef std::map<std::pair<std::string, std::string>,
+                 std::vector<ProtoFamilyPair> >
+    PortMap;
 
 QueryData genListeningPorts(QueryContext& context) {
   QueryData results;
 
-  auto sockets = SQL::selectAllFrom("process_open_sockets");
+  // Ask for bound sockets, platforms may filter them while enumerating.
+  QueryContext sockets_context;
+  sockets_context.constraints["remote_port"].add(Constraint(EQUALS, "0"));
+  for (const auto& port : context.constraints["port"].getAll(EQUALS)) {
+    sockets_context.constraints["local_port"].add(Constraint(EQUALS, port));
+  }
+  for (const auto& family : context.constraints["family"].getAll(EQUALS)) {
+    sockets_context.constraints["family"].add(Constraint(EQUALS, family));
+  }
+  for (const auto& ns : context.constraints["net_namespace"].getAll(EQUALS)) {
+    sockets_context.constraints["net_namespace"].add(Constraint(EQUALS, ns));
+  }
+  auto sockets = SQL::selectAllFrom("process_open_sockets", sockets_context);
 
   PortMap ports;
   for (const auto& socket : sockets) {
@@ -29,9 +45,13 @@ QueryData genListeningPorts(QueryContext& context) {
       continue;
     }
 
-    if (ports.count(socket.at("local_port")) > 0) {
+    // Containers may bind the same port in their own network namespaces.
+    auto ns = socket.find("net_namespace");
+    auto port = std::make_pair(
+        (ns != socket.end()) ? ns->second : "", socket.at("local_port"));
+    if (ports.count(port) > 0) {
       bool duplicate = false;
-      for (const auto& entry : ports[socket.at("local_port")]) {
+      for (const auto& entry : ports[port]) {
         if (entry.first == socket.at("protocol") &&
             entry.second == socket.at("family")) {
           duplicate = true;
@@ -46,7 +66,7 @@ QueryData genListeningPorts(QueryContext& context) {
     }
 
     // Add this family/protocol/port bind to the tracked map.
-    ports[socket.at("local_port")].push_back(
+    ports[port].push_back(
         std::make_pair(socket.at("protocol"), socket.at("family")));
 
     Row r;
@@ -55,6 +75,7 @@ QueryData genListeningPorts(QueryContext& context) {
     r["protocol"] = socket.at("protocol");
     r["family"] = socket.at("family");
     r["address"] = socket.at("local_address");
+    r["net_namespace"] = port.first;
 
     results.push_back(r);
   }
@@ -13,6 +13,7 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/test_util.h"
+#include "osquery/tables/networking/interfaces.h"
 
 namespace osquery {
 namespace tables {
@@ -31,5 +32,31 @@ TEST_F(NetworkingTablesTests, test_parse_etc_protocols_content) {
   EXPECT_EQ(parseEtcProtocolsContent(getEtcProtocolsContent()),
             getEtcProtocolsExpectedResults());
 }
+
+TEST_F(NetworkingTablesTests, test_interface_snapshot) {
+  InterfaceSnapshot snapshot;
+  ASSERT_FALSE(snapshot.names().empty());
+
+  // Each interface has at most one details row, indexed by its name.
+  for (const auto& name : snapshot.names()) {
+    QueryData details;
+    snapshot.getDetails(name, details);
+    ASSERT_LE(details.size(), 1U);
+    if (!details.empty()) {
+      EXPECT_EQ(details[0]["interface"], name);
+      EXPECT_FALSE(details[0]["mtu"].empty());
+    }
+
+    QueryData addresses;
+    snapshot.getAddresses(name, addresses);
+    for (auto& address : addresses) {
+      EXPECT_EQ(address["interface"], name);
+    }
+  }
+
+  QueryData missing;
+  snapshot.getDetails("not-an-interface", missing);
+  EXPECT_TRUE(missing.empty());
+}
 }
 }
@@ -8,14 +8,21 @@
  *
  */
 
+#include <boost/filesystem/operations.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/filesystem.h>
 
 #include "osquery/tables/other/yara_utils.h"
 
+namespace fs = boost::filesystem;
+
 namespace osquery {
 
+DECLARE_string(database_path);
+DECLARE_bool(database_in_memory);
+
 const std::string ruleFile = "/tmp/osquery-yara.sig";
 const std::string ls = "/bin/ls";
 const std::string alwaysTrue = "rule always_true { condition: true }";
@@ -73,4 +80,68 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_scan_limits) {
+  EXPECT_TRUE(yr_initialize() == ERROR_SUCCESS);
+  writeTextFile(ruleFile, alwaysTrue);
+  YR_RULES* compiled = nullptr;
+  ASSERT_TRUE(compileSingleFile(ruleFile, &compiled).ok());
+  auto rules = makeYARARules(compiled);
+
+  Row r = {{"count", "0"}, {"matches", ""}, {"strings", ""}, {"tags", ""}};
+  EXPECT_TRUE(scanYARAFile(rules, ls, r).ok());
+  EXPECT_EQ(r["count"], "1");
+
+  // Files larger than the limit are not scanned.
+  auto max_file_size = FLAGS_yara_max_file_size;
+  FLAGS_yara_max_file_size = 1;
+  EXPECT_FALSE(scanYARAFile(rules, ls, r).ok());
+  EXPECT_EQ(r["count"], "1");
+  FLAGS_yara_max_file_size = max_file_size;
+
+  EXPECT_FALSE(scanYARAFile(nullptr, ls, r).ok());
+}
+
+TEST_F(YARATest, test_rules_cache) {
+  EXPECT_TRUE(yr_initialize() == ERROR_SUCCESS);
+  auto database_path = FLAGS_database_path;
+  auto database_in_memory = FLAGS_database_in_memory;
+  FLAGS_database_path = "/tmp/osquery-yara-cache";
+  FLAGS_database_in_memory = false;
+  fs::remove_all(FLAGS_database_path);
+  fs::create_directories(FLAGS_database_path);
+
+  // Compiled rules are saved, and loaded while the rule file is unchanged.
+  writeTextFile(ruleFile, alwaysTrue);
+  for (size_t i = 0; i < 2; i++) {
+    YR_RULES* compiled = nullptr;
+    ASSERT_TRUE(compileSingleFile(ruleFile, &compiled).ok());
+    auto rules = makeYARARules(compiled);
+    Row r = {{"count", "0"}, {"matches", ""}, {"strings", ""}, {"tags", ""}};
+    EXPECT_TRUE(scanYARAFile(rules, ls, r).ok());
+    EXPECT_EQ(r["matches"], "always_true");
+  }
+
+  std::vector<std::string> saved;
+  listFilesInDirectory(FLAGS_database_path + "/yara", saved);
+  EXPECT_EQ(saved.size(), 1U);
+
+  // Changed rules are compiled again and replace the saved rules.
+  remove(ruleFile);
+  writeTextFile(ruleFile, alwaysFalse);
+  YR_RULES* compiled = nullptr;
+  ASSERT_TRUE(compileSingleFile(ruleFile, &compiled).ok());
+  auto rules = makeYARARules(compiled);
+  Row r = {{"count", "0"}, {"matches", ""}, {"strings", ""}, {"tags", ""}};
+  EXPECT_TRUE(scanYARAFile(rules, ls, r).ok());
+  EXPECT_EQ(r["count"], "0");
+
+  saved.clear();
+  listFilesInDirectory(FLAGS_database_path + "/yara", saved);
+  EXPECT_EQ(saved.size(), 1U);
+
+  fs::remove_all(FLAGS_database_path);
+  FLAGS_database_path = database_path;
+  FLAGS_database_in_memory = database_in_memory;
+}
 }
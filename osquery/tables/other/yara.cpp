@@ -25,7 +25,7 @@
 namespace osquery {
 namespace tables {
 
-void doYARAScan(YR_RULES* rules,
+void doYARAScan(const YARARules& rules,
                 const std::string& path,
                 const std::string& pattern,
                 QueryData& results,
@@ -46,14 +46,11 @@ void doYARAScan(YR_RULES* rules,
   r["sigfile"] = std::string(sigfile);
 
   // Perform the scan, using the static YARA subscriber callback.
-  int result = yr_rules_scan_file(rules,
-                                  path.c_str(),
-                                  SCAN_FLAGS_FAST_MODE,
-                                  YARACallback,
-                                  (void*)&r,
-                                  0);
-  if (result == ERROR_SUCCESS) {
+  auto status = scanYARAFile(rules, path, r);
+  if (status.ok()) {
     results.push_back(std::move(r));
+  } else {
+    VLOG(1) << status.getMessage();
   }
 }
 
@@ -86,8 +83,6 @@ QueryData genYara(QueryContext& context) {
     return results;
   }
 
-  auto& rules = yaraParser->rules();
-
   // Store resolved paths in a vector of pairs.
   // Each pair has the first element as the path to scan and the second
   // element as the pattern which generated it.
@@ -119,7 +114,7 @@ QueryData genYara(QueryContext& context) {
   // Compile all sigfiles into a map.
   for (const auto& file : sigfiles) {
     // Check if this "ad-hoc" signature file has not been used/compiled.
-    if (rules.count(file) == 0) {
+    if (yaraParser->rules(file) == nullptr) {
       // If this is a relative path append the default yara search path.
       auto path = (file[0] != '/') ? std::string("/etc/osquery/yara/") : "";
       path += file;
@@ -133,7 +128,7 @@ QueryData genYara(QueryContext& context) {
       // Cache the compiled rules by setting the unique signature file path
       // as the lookup name. Additional signature file uses will skip the
       // compile step and be added as rule groups.
-      rules[file] = tmp_rules;
+      yaraParser->addRules(file, tmp_rules);
     }
     // Assemble an "ad-hoc" group using the signature file path as the name.
     groups.insert(file);
@@ -143,8 +138,9 @@ QueryData genYara(QueryContext& context) {
   for (const auto& path_pair : path_pairs) {
     // Scan using the signature groups.
     for (const auto& group : groups) {
-      if (rules.count(group) > 0) {
-        doYARAScan(rules[group],
+      auto rules = yaraParser->rules(group);
+      if (rules != nullptr) {
+        doYARAScan(rules,
                    path_pair.first.c_str(),
                    path_pair.second,
                    results,
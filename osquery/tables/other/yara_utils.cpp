@@ -11,13 +11,48 @@
 #include <map>
 #include <string>
 
+#include <sys/stat.h>
+
+#include <boost/filesystem/operations.hpp>
+
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
+#include <osquery/hash.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/governor.h"
 #include "osquery/tables/other/yara_utils.h"
 
+namespace fs = boost::filesystem;
+
 namespace osquery {
 
+DECLARE_string(database_path);
+DECLARE_bool(database_in_memory);
+
+FLAG(bool,
+     yara_rules_cache,
+     true,
+     "Save compiled YARA rules in the database directory for reuse");
+
+FLAG(uint64,
+     yara_scan_timeout,
+     60,
+     "Seconds a YARA scan of one file may run (0 is unlimited)");
+
+FLAG(uint64,
+     yara_max_file_size,
+     64 * 1024 * 1024,
+     "Largest file in bytes scanned by YARA (0 is unlimited)");
+
+YARARules makeYARARules(YR_RULES *rules) {
+  return YARARules(rules, [](YR_RULES *compiled) {
+    if (compiled != nullptr) {
+      yr_rules_destroy(compiled);
+    }
+  });
+}
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -33,10 +68,122 @@ void YARACompilerCallback(int error_level,
   }
 }
 
+/// Compiled rules are saved within the database directory.
+const std::string kYARACacheDirectory = "/yara";
+
+/// The extension of saved compiled rules.
+const std::string kYARACacheExtension = ".yarc";
+
+/// The libyara version, compiled rules may only be loaded by the same version.
+static std::string getYARAVersion() {
+#ifdef YR_MAJOR_VERSION
+  return std::to_string(YR_MAJOR_VERSION) + "." +
+         std::to_string(YR_MINOR_VERSION) + "." +
+         std::to_string(YR_MICRO_VERSION);
+#else
+  return "unknown";
+#endif
+}
+
+/**
+ * @brief Find where the compiled rules of a set of rule files are saved.
+ *
+ * The path is named by the rules' name and a hash of the libyara version and
+ * the content of each rule file, so any change compiles the rules again.
+ *
+ * @return The saved rules path, empty if the rules are not saved.
+ */
+static std::string getCachedRulesPath(const std::string &name,
+                                      const std::vector<std::string> &files) {
+  if (!FLAGS_yara_rules_cache || FLAGS_database_in_memory ||
+      !isDirectory(FLAGS_database_path).ok()) {
+    return "";
+  }
+
+  auto key = "libyara " + getYARAVersion() + '\n';
+  for (const auto &file : files) {
+    auto hash = hashFromFile(HASH_TYPE_SHA256, file);
+    if (hash.empty()) {
+      return "";
+    }
+    key += file + ':' + hash + '\n';
+  }
+
+  auto prefix = hashFromBuffer(HASH_TYPE_SHA256, name.data(), name.size());
+  return FLAGS_database_path + kYARACacheDirectory + '/' +
+         prefix.substr(0, 16) + '.' +
+         hashFromBuffer(HASH_TYPE_SHA256, key.data(), key.size()) +
+         kYARACacheExtension;
+}
+
+/// Load saved compiled rules, only from a directory owned by osquery.
+static bool loadCachedRules(const std::string &path, YR_RULES **rules) {
+  if (path.empty() || !pathExists(path).ok()) {
+    return false;
+  }
+
+  auto directory = fs::path(path).parent_path().string();
+  if (!safePermissions(directory, path)) {
+    LOG(WARNING) << "Not loading compiled YARA rules with unsafe permissions: "
+                 << path;
+    return false;
+  }
+
+  if (yr_rules_load(path.c_str(), rules) != ERROR_SUCCESS) {
+    VLOG(1) << "Cannot load compiled YARA rules: " << path;
+    return false;
+  }
+  VLOG(1) << "Loaded compiled YARA rules: " << path;
+  return true;
+}
+
+/// Save compiled rules, replacing the saved rules of previous rule files.
+static void saveCachedRules(const std::string &path, YR_RULES *rules) {
+  if (path.empty() || rules == nullptr) {
+    return;
+  }
+
+  boost::system::error_code ec;
+  auto directory = fs::path(path).parent_path();
+  if (!fs::exists(directory, ec)) {
+    fs::create_directories(directory, ec);
+    fs::permissions(directory, fs::owner_all, ec);
+  }
+
+  // Rules are named by name prefix, remove the stale rules of this name.
+  auto name = fs::path(path).filename().string();
+  auto prefix = name.substr(0, name.find('.') + 1);
+  std::vector<std::string> saved;
+  listFilesInDirectory(directory, saved);
+  for (const auto &file : saved) {
+    if (fs::path(file).filename().string().compare(0, prefix.size(), prefix) ==
+        0) {
+      fs::remove(file, ec);
+    }
+  }
+
+  // Write a temporary file so a partially saved file is never loaded.
+  auto temporary = path + ".tmp";
+  if (yr_rules_save(rules, temporary.c_str()) != ERROR_SUCCESS) {
+    VLOG(1) << "Cannot save compiled YARA rules: " << path;
+    fs::remove(temporary, ec);
+    return;
+  }
+  fs::rename(temporary, path, ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+  }
+}
+
 /**
  * Compile a single rule file and load it into rule pointer.
  */
 Status compileSingleFile(const std::string &file, YR_RULES **rules) {
+  auto cached = getCachedRulesPath(file, {file});
+  if (loadCachedRules(cached, rules)) {
+    return Status(0, "OK");
+  }
+
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -92,6 +239,7 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
       yr_compiler_destroy(compiler);
       return Status(1, "Insufficient memory to get YARA rules");
     }
+    saveCachedRules(cached, *rules);
   }
 
   if (compiler != nullptr) {
@@ -106,9 +254,48 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
  * Given a vector of strings, attempt to compile them and store the result
  * in the map under the given category.
  */
+/// Resolve a configured rule file, relative paths use the osquery YARA home.
+static std::string rulePath(const pt::ptree &item) {
+  auto rule = item.get("", "");
+  if (rule[0] != '/') {
+    rule = std::string("/etc/osquery/yara/") + rule;
+  }
+  return rule;
+}
+
+/// Identify a signature group by its rule files and their modification times.
+static std::string ruleFingerprint(const pt::ptree &rule_files) {
+  std::string fingerprint;
+  for (const auto &item : rule_files) {
+    auto rule = rulePath(item.second);
+    struct stat file_stat;
+    if (stat(rule.c_str(), &file_stat) == 0) {
+      rule += ":" + std::to_string(file_stat.st_mtime);
+    }
+    fingerprint += rule + '\n';
+  }
+  return fingerprint;
+}
+
 Status handleRuleFiles(const std::string &category,
                        const pt::ptree &rule_files,
                        std::map<std::string, YR_RULES *> &rules) {
+  std::vector<std::string> files;
+  for (const auto &item : rule_files) {
+    files.push_back(rulePath(item.second));
+  }
+
+  // Unchanged rule files load the rules compiled by a previous run.
+  YR_RULES *cached_rules = nullptr;
+  auto cached = getCachedRulesPath(category, files);
+  if (loadCachedRules(cached, &cached_rules)) {
+    if (rules.count(category) > 0 && rules[category] != nullptr) {
+      yr_rules_destroy(rules[category]);
+    }
+    rules[category] = cached_rules;
+    return Status(0, "OK");
+  }
+
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -121,10 +308,7 @@ Status handleRuleFiles(const std::string &category,
   bool compiled = false;
   for (const auto &item : rule_files) {
     YR_RULES *tmp_rules = nullptr;
-    auto rule = item.second.get("", "");
-    if (rule[0] != '/') {
-      rule = std::string("/etc/osquery/yara/") + rule;
-    }
+    auto rule = rulePath(item.second);
 
     // First attempt to load the file, in case it is saved (pre-compiled)
     // rules. Sadly there is no way to load multiple compiled rules in
@@ -184,6 +368,7 @@ Status handleRuleFiles(const std::string &category,
       yr_compiler_destroy(compiler);
       return Status(1, "Insufficient memory to get YARA rules");
     }
+    saveCachedRules(cached, rules[category]);
   }
 
   if (compiler != nullptr) {
@@ -240,6 +425,53 @@ int YARACallback(int message, void *message_data, void *user_data) {
   return CALLBACK_CONTINUE;
 }
 
+Status scanYARAFile(const YARARules &rules, const std::string &path, Row &r) {
+  if (rules == nullptr) {
+    return Status(1, "No YARA rules");
+  }
+
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return Status(1, "Cannot stat file: " + path);
+  }
+  if (FLAGS_yara_max_file_size > 0 &&
+      static_cast<size_t>(file_stat.st_size) > FLAGS_yara_max_file_size) {
+    return Status(1, "File exceeds yara_max_file_size: " + path);
+  }
+
+  // YARA maps and reads the file itself, the read rate is taken up front.
+  throttleRead(static_cast<size_t>(file_stat.st_size));
+  int result = yr_rules_scan_file(rules.get(),
+                                  path.c_str(),
+                                  SCAN_FLAGS_FAST_MODE,
+                                  YARACallback,
+                                  (void *)&r,
+                                  static_cast<int>(FLAGS_yara_scan_timeout));
+  if (result != ERROR_SUCCESS) {
+    return Status(1, "YARA error: " + std::to_string(result));
+  }
+  return Status(0, "OK");
+}
+
+YARARules YARAConfigParserPlugin::rules(const std::string &group) const {
+  ReadLock lock(rules_mutex_);
+  auto rules = rules_.find(group);
+  return (rules != rules_.end()) ? rules->second : nullptr;
+}
+
+YARARules YARAConfigParserPlugin::addRules(const std::string &name,
+                                           YR_RULES *rules) {
+  auto compiled = makeYARARules(rules);
+  WriteLock lock(rules_mutex_);
+  auto existing = rules_.find(name);
+  if (existing != rules_.end()) {
+    // Another query compiled the same signature file.
+    return existing->second;
+  }
+  rules_[name] = compiled;
+  return compiled;
+}
+
 Status YARAConfigParserPlugin::setUp() {
   int result = yr_initialize();
   if (result != ERROR_SUCCESS) {
@@ -260,12 +492,35 @@ Status YARAConfigParserPlugin::update(const std::string &source,
     const auto &signatures = yara_config.get_child("signatures");
     data_.add_child("signatures", signatures);
     for (const auto &element : signatures) {
+      // Only groups with changed rule files, or modified files, recompile.
+      auto fingerprint = ruleFingerprint(element.second);
+      if (rules(element.first) != nullptr &&
+          fingerprints_[element.first] == fingerprint) {
+        continue;
+      }
+
+      // Compile aside so scans keep using the previous rules meanwhile.
       VLOG(1) << "Compiling YARA signature group: " << element.first;
-      auto status = handleRuleFiles(element.first, element.second, rules_);
+      std::map<std::string, YR_RULES *> compiled;
+      auto status = handleRuleFiles(element.first, element.second, compiled);
       if (!status.ok()) {
+        for (auto &group : compiled) {
+          if (group.second != nullptr) {
+            yr_rules_destroy(group.second);
+          }
+        }
+        fingerprints_.erase(element.first);
         VLOG(1) << "YARA rule compile error: " << status.getMessage();
         return status;
       }
+
+      // The previous rules are destroyed when their last scan completes.
+      {
+        WriteLock lock(rules_mutex_);
+        rules_[element.first] = makeYARARules(compiled[element.first]);
+      }
+      fingerprints_[element.first] = fingerprint;
+      generation_++;
     }
   }
 
@@ -8,7 +8,12 @@
  *
  */
 
+#include <atomic>
+#include <memory>
+
 #include <osquery/config.h>
+#include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 #ifdef CONCAT
@@ -20,6 +25,15 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(yara_scan_timeout);
+DECLARE_uint64(yara_max_file_size);
+
+/// Compiled rules, destroyed when the last scan using them releases them.
+using YARARules = std::shared_ptr<YR_RULES>;
+
+/// Take ownership of compiled rules.
+YARARules makeYARARules(YR_RULES* rules);
+
 void YARACompilerCallback(int error_level,
                           const char* file_name,
                           int line_number,
@@ -34,6 +48,20 @@ Status handleRuleFiles(const std::string& category,
 
 int YARACallback(int message, void* message_data, void* user_data);
 
+/**
+ * @brief Scan a file with compiled rules, within the YARA scan limits.
+ *
+ * A file larger than yara_max_file_size is not scanned, and a scan stops
+ * after yara_scan_timeout seconds. Matches are added to the row by
+ * YARACallback.
+ *
+ * @param rules The compiled rules to scan with.
+ * @param path The file to scan.
+ * @param r The output row, with the default YARACallback columns.
+ * @return failure if the file was not scanned.
+ */
+Status scanYARAFile(const YARARules& rules, const std::string& path, Row& r);
+
 /**
  * @brief A simple ConfigParserPlugin for a "yara" dictionary key.
  *
@@ -49,14 +77,43 @@ class YARAConfigParserPlugin : public ConfigParserPlugin {
   /// Request a single "yara" top level key.
   std::vector<std::string> keys() const override { return {"yara"}; }
 
-  // Retrieve compiled rules.
-  std::map<std::string, YR_RULES*>& rules() { return rules_; }
+  /**
+   * @brief Retrieve the compiled rules of a signature group.
+   *
+   * Groups are replaced when their rule files change. A scan keeps the rules
+   * it retrieved until it completes, while later scans use the new rules.
+   *
+   * @param group A signature group or ad-hoc signature file name.
+   * @return The compiled rules, or nullptr for an unknown group.
+   */
+  YARARules rules(const std::string& group) const;
+
+  /**
+   * @brief Add the compiled rules of an ad-hoc signature file.
+   *
+   * @param name The signature file name, used as the group name.
+   * @param rules The compiled rules, owned by the parser.
+   * @return The rules of the group, the existing rules if already added.
+   */
+  YARARules addRules(const std::string& name, YR_RULES* rules);
+
+  /// A count of signature group changes, scans are repeated after a change.
+  size_t generation() const { return generation_; }
 
   Status setUp() override;
 
  private:
   // Store compiled rules in a map (group => rules).
-  std::map<std::string, YR_RULES*> rules_;
+  std::map<std::string, YARARules> rules_;
+
+  /// The rule files and modification times each group was compiled from.
+  std::map<std::string, std::string> fingerprints_;
+
+  /// Incremented as signature groups are compiled.
+  std::atomic<size_t> generation_{0};
+
+  /// Protects the compiled rules, which are read by scanning threads.
+  mutable boost::shared_mutex rules_mutex_;
 
   /// Store the signatures and file_paths and compile the rules.
   Status update(const std::string& source, const ParserConfig& config) override;
@@ -11,11 +11,12 @@
 #include <string>
 #include <vector>
 
+#include <boost/algorithm/string/trim.hpp>
+
 #include <osquery/core.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
-#include "osquery/core/conversions.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
@@ -24,30 +25,49 @@ namespace tables {
 const std::vector<std::string> kSSHAuthorizedkeys = {".ssh/authorized_keys",
                                                      ".ssh/authorized_keys2"};
 
+/// The most keys files with kept rows.
+const size_t kSSHAuthorizedKeysCacheMax = 4096;
+
+/// Append the keys of a keys file, without the owning user.
+static void genAuthorizedKeysFile(const std::string& path,
+                                  QueryData& results) {
+  // Protocol 1 public key consist of: options, bits, exponent, modulus,
+  // comment; Protocol 2 public key consist of: options, keytype,
+  // base64-encoded key, comment.
+  readLines(path,
+            ([&path, &results](FileLine line) {
+              auto key = line.to_string();
+              boost::trim(key);
+              if (key.empty() || key[0] == '#') {
+                return;
+              }
+
+              Row r;
+              r["key"] = std::move(key);
+              r["key_file"] = path;
+              results.push_back(r);
+            }),
+            true);
+}
+
 void genSSHkeysForUser(const std::string& uid,
                        const std::string& directory,
                        QueryData& results) {
+  static FileRowsCache keys(kSSHAuthorizedKeysCacheMax);
+
+  std::vector<std::string> keys_files;
   for (const auto& kfile : kSSHAuthorizedkeys) {
     boost::filesystem::path keys_file = directory;
     keys_file /= kfile;
+    keys_files.push_back(keys_file.string());
+  }
 
-    std::string keys_content;
-    if (!osquery::forensicReadFile(keys_file, keys_content).ok()) {
-      // Cannot read a specific keys file.
-      continue;
-    }
-    // Protocol 1 public key consist of: options, bits, exponent, modulus,
-    // comment; Protocol 2 public key consist of: options, keytype,
-    // base64-encoded key, comment.
-    for (const auto& line : split(keys_content, "\n")) {
-      if (!line.empty() && line[0] != '#') {
-        Row r;
-        r["uid"] = uid;
-        r["key"] = line;
-        r["key_file"] = keys_file.string();
-        results.push_back(r);
-      }
-    }
+  // Home directories may be shared, the rows are kept without a user.
+  QueryData rows;
+  keys.get(keys_files, genAuthorizedKeysFile, rows);
+  for (auto& r : rows) {
+    r["uid"] = uid;
+    results.push_back(std::move(r));
   }
 }
 
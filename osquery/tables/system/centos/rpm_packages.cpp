@@ -22,12 +22,17 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/system_utils.h"
+
 namespace osquery {
 namespace tables {
 
 // Maximum number of files per RPM.
 #define MAX_RPM_FILES 2048
 
+/// The RPM database directory, a change to its files changes the packages.
+const std::string kRpmDatabasePath = "/var/lib/rpm";
+
 /**
  * @brief Return a string representation of the RPM tag type.
  *
@@ -65,7 +70,8 @@ static std::string getRpmAttribute(const Header& header,
   return result;
 }
 
-QueryData genRpmPackages(QueryContext& context) {
+/// Read every package header from the RPM database.
+static QueryData genAllRpmPackages() {
   QueryData results;
   // The following implementation uses http://rpm.org/api/4.11.1/
   rpmInitCrypto();
@@ -75,13 +81,7 @@ QueryData genRpmPackages(QueryContext& context) {
   }
 
   rpmts ts = rpmtsCreate();
-  rpmdbMatchIterator matches;
-  if (context.constraints["name"].exists(EQUALS)) {
-    auto name = (*context.constraints["name"].getAll(EQUALS).begin());
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
-  } else {
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
-  }
+  auto matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
 
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
@@ -107,6 +107,13 @@ QueryData genRpmPackages(QueryContext& context) {
   return results;
 }
 
+QueryData genRpmPackages(QueryContext& context) {
+  // The packages are read again only when the RPM database changes. Name
+  // constraints are applied by SQLite to the complete package list.
+  static FileStateCache packages({kRpmDatabasePath});
+  return packages.get(genAllRpmPackages);
+}
+
 QueryData genRpmPackageFiles(QueryContext& context) {
   QueryData results;
   if (rpmReadConfigFiles(nullptr, nullptr) != 0) {
@@ -18,6 +18,7 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -28,27 +29,25 @@ const std::vector<std::string> kUserCronPaths = {
     "/var/at/tabs/", "/var/spool/cron/", "/var/spool/cron/crontabs/",
 };
 
+/// The most crontabs with kept rows.
+const size_t kCronCacheMax = 1024;
+
 std::vector<std::string> cronFromFile(const std::string& path) {
-  std::string content;
   std::vector<std::string> cron_lines;
   if (!isReadable(path).ok()) {
     return cron_lines;
   }
 
-  if (!forensicReadFile(path, content).ok()) {
-    return cron_lines;
-  }
-
-  auto lines = split(content, "\n");
-
   // Only populate the lines that are not comments or blank.
-  for (auto& line : lines) {
-    // Cheat and use a non-const iteration, to inline trim.
-    boost::trim(line);
-    if (line.size() > 0 && line.at(0) != '#') {
-      cron_lines.push_back(line);
-    }
-  }
+  readLines(path,
+            ([&cron_lines](FileLine line) {
+              auto cron_line = line.to_string();
+              boost::trim(cron_line);
+              if (cron_line.size() > 0 && cron_line.at(0) != '#') {
+                cron_lines.push_back(std::move(cron_line));
+              }
+            }),
+            true);
 
   return cron_lines;
 }
@@ -98,26 +97,22 @@ void genCronLine(const std::string& path,
 }
 
 QueryData genCronTab(QueryContext& context) {
-  QueryData results;
-
-  auto system_lines = cronFromFile(kSystemCron);
-  for (const auto& line : system_lines) {
-    genCronLine(kSystemCron, line, results);
-  }
+  static FileRowsCache crons(kCronCacheMax);
 
-  std::vector<std::string> user_crons;
-  for (const auto cron_path : kUserCronPaths) {
-    osquery::listFilesInDirectory(cron_path, user_crons);
+  std::vector<std::string> cron_files = {kSystemCron};
+  for (const auto& cron_path : kUserCronPaths) {
+    osquery::listFilesInDirectory(cron_path, cron_files);
   }
 
   // The user-based crons are identified by their path.
-  for (const auto& user_path : user_crons) {
-    auto user_lines = cronFromFile(user_path);
-    for (const auto& line : user_lines) {
-      genCronLine(user_path, line, results);
-    }
-  }
-
+  QueryData results;
+  crons.get(cron_files,
+            ([](const std::string& path, QueryData& rows) {
+              for (const auto& line : cronFromFile(path)) {
+                genCronLine(path, line, rows);
+              }
+            }),
+            results);
   return results;
 }
 }
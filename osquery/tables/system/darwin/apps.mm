@@ -25,7 +25,6 @@
 #include "osquery/core/conversions.h"
 
 namespace fs = boost::filesystem;
-namespace pt = boost::property_tree;
 
 namespace osquery {
 namespace tables {
@@ -177,7 +176,7 @@ void genApplicationsFromPath(const fs::path& path,
   }
 }
 
-void genApplication(const pt::ptree& tree,
+void genApplication(const std::map<std::string, std::string>& values,
                     const fs::path& path,
                     QueryData& results) {
   Row r;
@@ -186,7 +185,8 @@ void genApplication(const pt::ptree& tree,
 
   // Loop through each column and its mapped Info.plist key name.
   for (const auto& item : kAppsInfoPlistTopLevelStringKeys) {
-    r[item.second] = tree.get<std::string>(item.first, "");
+    auto value = values.find(item.first);
+    r[item.second] = (value != values.end()) ? value->second : "";
     // Change boolean values into integer 1, 0.
     if (r[item.second] == "true" || r[item.second] == "YES" ||
         r[item.second] == "Yes") {
@@ -263,20 +263,22 @@ QueryData genApps(QueryContext& context) {
     }
   }
 
-  // The osquery::parsePlist method will reset/clear a property tree.
-  // Keeping the data structure in a larger scope preserves allocations
-  // between similar-sized trees.
-  pt::ptree tree;
+  // Only the Info.plist keys used as columns are read.
+  std::set<std::string> keys;
+  for (const auto& item : kAppsInfoPlistTopLevelStringKeys) {
+    keys.insert(item.first);
+  }
 
   // For each found application (path with an Info.plist) parse the plist.
+  std::map<std::string, std::string> values;
   for (const auto& path : apps) {
-    if (!osquery::parsePlist(path, tree).ok()) {
+    if (!osquery::parsePlistKeys(path, keys, values).ok()) {
       TLOG << "Error parsing application plist: " << path;
       continue;
     }
 
     // Using the parsed plist, pull out each interesting key.
-    genApplication(tree, path, results);
+    genApplication(values, path, results);
   }
 
   return std::move(results);
@@ -8,32 +8,87 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/dispatcher/executor.h"
 #include "osquery/tables/system/darwin/keychain.h"
 
 namespace osquery {
+
+FLAG(uint64,
+     certificate_threads,
+     4,
+     "Threads decoding keychain certificates for the certificates table");
+
 namespace tables {
 
-void genCertificate(const SecCertificateRef& SecCert, QueryData& results) {
-  Row r;
+/// The most decoded certificates kept.
+const size_t kCertificateCacheMax = 4096;
 
-  auto der_encoded_data = SecCertificateCopyData(SecCert);
-  if (der_encoded_data == nullptr) {
-    return;
+/// A keychain certificate waiting to be decoded.
+struct CertificateItem {
+  /// The DER encoded certificate.
+  std::string der;
+
+  /// The keychain containing the certificate.
+  std::string path;
+
+  /// The certificate SHA1, the key of decoded certificates.
+  std::string sha1;
+};
+
+/**
+ * @brief Decoded certificate columns by SHA1.
+ *
+ * The same certificate is often in several keychains and is unchanged
+ * between queries, the columns decoded by OpenSSL are kept without the path.
+ */
+class CertificateCache : private boost::noncopyable {
+ public:
+  bool get(const std::string& sha1, Row& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(sha1);
+    if (entry == entries_.end()) {
+      return false;
+    }
+    r = entry->second;
+    return true;
+  }
+
+  void set(const std::string& sha1, const Row& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= kCertificateCacheMax) {
+      entries_.clear();
+    }
+    entries_[sha1] = r;
   }
 
-  auto der_bytes = CFDataGetBytePtr(der_encoded_data);
-  auto length = CFDataGetLength(der_encoded_data);
-  auto cert = d2i_X509(nullptr, &der_bytes, length);
+ private:
+  std::map<std::string, Row> entries_;
+  std::mutex mutex_;
+};
 
+static CertificateCache& certificateCache() {
+  static CertificateCache cache;
+  return cache;
+}
+
+/// Decode the columns of a DER encoded certificate, except path and sha1.
+static bool decodeCertificate(const std::string& der, Row& r) {
+  auto der_bytes = reinterpret_cast<const unsigned char*>(der.data());
+  X509* cert = nullptr;
+  OSX_OPENSSL(cert = d2i_X509(nullptr, &der_bytes, der.size()));
   if (cert == nullptr) {
     VLOG(1) << "Error decoding DER encoded certificate";
-    CFRelease(der_encoded_data);
-    return;
+    return false;
   }
 
   // Generate the common name and subject.
@@ -48,11 +103,6 @@ void genCertificate(const SecCertificateRef& SecCert, QueryData& results) {
   r["not_valid_before"] = INTEGER(genEpoch(X509_get_notBefore(cert)));
   r["not_valid_after"] = INTEGER(genEpoch(X509_get_notAfter(cert)));
 
-  // Get the keychain for the certificate.
-  r["path"] = getKeychainPath((SecKeychainItemRef)SecCert);
-  // Hash is not a certificate property, calculate using raw data.
-  r["sha1"] = genSHA1ForCertificate(der_encoded_data);
-
   // X509_check_ca() populates key_usage, {authority,subject}_key_id
   // so it should be called before others.
   r["ca"] = (CertificateIsCA(cert)) ? INTEGER(1) : INTEGER(0);
@@ -65,30 +115,66 @@ void genCertificate(const SecCertificateRef& SecCert, QueryData& results) {
   r["subject_key_id"] =
       (cert->skid) ? genKIDProperty(cert->skid->data, cert->skid->length) : "";
 
-  results.push_back(r);
-  X509_free(cert);
+  OSX_OPENSSL(X509_free(cert));
+  return true;
+}
+
+/// Copy the DER data, keychain, and hash of a certificate.
+static bool getCertificateItem(const SecCertificateRef& SecCert,
+                               CertificateItem& item) {
+  auto der_encoded_data = SecCertificateCopyData(SecCert);
+  if (der_encoded_data == nullptr) {
+    return false;
+  }
+
+  item.der.assign(
+      reinterpret_cast<const char*>(CFDataGetBytePtr(der_encoded_data)),
+      CFDataGetLength(der_encoded_data));
+  // Get the keychain for the certificate.
+  item.path = getKeychainPath((SecKeychainItemRef)SecCert);
+  // Hash is not a certificate property, calculate using raw data.
+  item.sha1 = genSHA1ForCertificate(der_encoded_data);
   CFRelease(der_encoded_data);
+  return true;
 }
 
-QueryData genCerts(QueryContext& context) {
-  QueryData results;
+/// Decode the certificates not already decoded, on the certificate threads.
+static void decodeCertificates(const std::vector<CertificateItem>& items,
+                               QueryData& results) {
+  std::vector<Row> rows(items.size());
+  std::vector<bool> decoded(items.size(), false);
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (certificateCache().get(items[i].sha1, rows[i])) {
+      decoded[i] = true;
+    } else {
+      pending.push_back(i);
+    }
+  }
 
-  // Allow the caller to set an explicit certificate (keychain) search path.
-  std::set<std::string> keychain_paths;
-  if (context.constraints["path"].exists(EQUALS)) {
-    keychain_paths = context.constraints["path"].getAll(EQUALS);
-  } else {
-    for (const auto& path : kSystemKeychainPaths) {
-      keychain_paths.insert(path);
+  parallelFor(pending.size(),
+              FLAGS_certificate_threads,
+              [&items, &rows, &pending](size_t i) {
+                decodeCertificate(items[pending[i]].der, rows[pending[i]]);
+              });
+
+  // Results keep the keychain search order.
+  for (size_t i = 0; i < items.size(); i++) {
+    auto& r = rows[i];
+    if (r.empty()) {
+      // The certificate could not be decoded.
+      continue;
     }
-    auto homes = osquery::getHomeDirectories();
-    for (const auto& dir : homes) {
-      for (const auto& keychains_dir : kUserKeychainPaths) {
-        keychain_paths.insert((dir / keychains_dir).string());
-      }
+    if (!decoded[i]) {
+      certificateCache().set(items[i].sha1, r);
     }
+    r["path"] = items[i].path;
+    r["sha1"] = items[i].sha1;
+    results.push_back(std::move(r));
   }
+}
 
+static QueryData genCertsForPaths(const std::set<std::string>& keychain_paths) {
   // Keychains/certificate stores belonging to the OS.
   CFArrayRef certs = CreateKeychainItems(keychain_paths, kSecClassCertificate);
   // Must have returned an array of matching certificates.
@@ -100,15 +186,48 @@ QueryData genCerts(QueryContext& context) {
     return {};
   }
 
-  // Evaluate the certificate data, check for CA in Basic constraints.
+  // The Security framework items are read on this thread, only the OpenSSL
+  // decoding of each certificate is shared with the certificate threads.
+  std::vector<CertificateItem> items;
   auto certificate_count = CFArrayGetCount(certs);
   for (CFIndex i = 0; i < certificate_count; i++) {
     auto cert = (SecCertificateRef)CFArrayGetValueAtIndex(certs, i);
-    genCertificate(cert, results);
+    CertificateItem item;
+    if (getCertificateItem(cert, item)) {
+      items.push_back(std::move(item));
+    }
   }
-
   CFRelease(certs);
+
+  // Evaluate the certificate data, check for CA in Basic constraints.
+  QueryData results;
+  initOpenSSLThreading();
+  decodeCertificates(items, results);
   return results;
 }
+
+QueryData genCerts(QueryContext& context) {
+  // Allow the caller to set an explicit certificate (keychain) search path.
+  std::set<std::string> keychain_paths;
+  if (context.constraints["path"].exists(EQUALS)) {
+    keychain_paths = context.constraints["path"].getAll(EQUALS);
+  } else {
+    for (const auto& path : kSystemKeychainPaths) {
+      keychain_paths.insert(path);
+    }
+    auto homes = osquery::getHomeDirectories();
+    for (const auto& dir : homes) {
+      for (const auto& keychains_dir : kUserKeychainPaths) {
+        keychain_paths.insert((dir / keychains_dir).string());
+      }
+    }
+  }
+
+  // Results are reused while the keychain files are unchanged.
+  return getCachedKeychainResults(
+      "certificates", keychain_paths, [&keychain_paths]() {
+        return genCertsForPaths(keychain_paths);
+      });
+}
 }
 }
@@ -8,6 +8,9 @@
  *
  */
 
+#include <algorithm>
+#include <set>
+
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -16,23 +19,75 @@
 namespace osquery {
 namespace tables {
 
+/// The registry walk limits and the columns selected by a query.
+struct IOKitWalk {
+  IOKitWalk(const QueryContext& context, const char* walk_plane)
+      : plane(walk_plane) {
+    parent = context.isColumnUsed("parent");
+    device_path = context.isColumnUsed("device_path");
+    service = context.isColumnUsed("service");
+    busy_state = context.isColumnUsed("busy_state");
+    retain_count = context.isColumnUsed("retain_count");
+
+    if (context.constraints.count("class") > 0) {
+      classes = context.constraints.at("class").getAll(EQUALS);
+    }
+    if (context.constraints.count("depth") == 0) {
+      return;
+    }
+
+    // Entries deeper than an upper bound on depth are not walked.
+    const auto& depth = context.constraints.at("depth");
+    auto limit = [this](int bound) {
+      max_depth = (max_depth < 0) ? bound : std::min(max_depth, bound);
+    };
+    for (const auto& bound : depth.getAll<int>(LESS_THAN)) {
+      limit(std::max(bound - 1, 0));
+    }
+    for (const auto& bound : depth.getAll<int>(LESS_THAN_OR_EQUALS)) {
+      limit(std::max(bound, 0));
+    }
+    auto equals = depth.getAll<int>(EQUALS);
+    if (!equals.empty()) {
+      limit(std::max(*equals.rbegin(), 0));
+    }
+  }
+
+  /// Check if a query selects an entry of this class.
+  bool matchesClass(const std::string& device_class) const {
+    return classes.empty() || classes.count(device_class) > 0;
+  }
+
+  /// The registry plane walked.
+  const char* plane{nullptr};
+
+  /// Children deeper than this are not walked, -1 for no limit.
+  int max_depth{-1};
+
+  /// The classes of the entries selected, empty for every class.
+  std::set<std::string> classes;
+
+  /// The optional columns used by the query.
+  bool parent{true};
+  bool device_path{true};
+  bool service{true};
+  bool busy_state{true};
+  bool retain_count{true};
+};
+
 void genIOKitDevice(const io_service_t& device,
                     const io_service_t& parent,
-                    const io_name_t plane,
+                    const IOKitWalk& walk,
+                    const std::string& device_class,
                     int depth,
                     QueryData& results) {
   Row r;
-  io_name_t name, device_class;
+  io_name_t name;
   auto kr = IORegistryEntryGetName(device, name);
   if (kr == KERN_SUCCESS) {
     r["name"] = std::string(name);
   }
-
-  // Get the device class.
-  kr = IOObjectGetClass(device, device_class);
-  if (kr == KERN_SUCCESS) {
-    r["class"] = std::string(device_class);
-  }
+  r["class"] = device_class;
 
   // The entry into the registry is the ID, and is used for children as parent.
   uint64_t device_id, parent_id;
@@ -43,16 +98,18 @@ void genIOKitDevice(const io_service_t& device,
     r["id"] = "-1";
   }
 
-  kr = IORegistryEntryGetRegistryEntryID(parent, &parent_id);
-  if (kr == KERN_SUCCESS) {
-    r["parent"] = BIGINT(parent_id);
-  } else {
-    r["parent"] = "-1";
+  if (walk.parent) {
+    kr = IORegistryEntryGetRegistryEntryID(parent, &parent_id);
+    if (kr == KERN_SUCCESS) {
+      r["parent"] = BIGINT(parent_id);
+    } else {
+      r["parent"] = "-1";
+    }
   }
 
   r["depth"] = INTEGER(depth);
 
-  if (IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
+  if (walk.device_path && IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
     io_string_t device_path;
     kr = IORegistryEntryGetPath(device, kIODeviceTreePlane, device_path);
     if (kr == KERN_SUCCESS) {
@@ -62,32 +119,51 @@ void genIOKitDevice(const io_service_t& device,
   }
 
   // Fill in service bits and busy/latency time.
-  if (IOObjectConformsTo(device, "IOService")) {
-    r["service"] = "1";
-  } else {
-    r["service"] = "0";
+  if (walk.service) {
+    if (IOObjectConformsTo(device, "IOService")) {
+      r["service"] = "1";
+    } else {
+      r["service"] = "0";
+    }
   }
 
-  uint32_t busy_state;
-  kr = IOServiceGetBusyState(device, &busy_state);
-  if (kr == KERN_SUCCESS) {
-    r["busy_state"] = INTEGER(busy_state);
-  } else {
-    r["busy_state"] = "0";
+  if (walk.busy_state) {
+    uint32_t busy_state;
+    kr = IOServiceGetBusyState(device, &busy_state);
+    if (kr == KERN_SUCCESS) {
+      r["busy_state"] = INTEGER(busy_state);
+    } else {
+      r["busy_state"] = "0";
+    }
   }
 
-  auto retain_count = IOObjectGetKernelRetainCount(device);
-  r["retain_count"] = INTEGER(retain_count);
+  if (walk.retain_count) {
+    auto retain_count = IOObjectGetKernelRetainCount(device);
+    r["retain_count"] = INTEGER(retain_count);
+  }
 
   results.push_back(r);
 }
 
+/// Read the class of an entry, empty if the class is unknown.
+static std::string getIOKitClass(const io_service_t& device) {
+  io_name_t device_class;
+  if (IOObjectGetClass(device, device_class) == KERN_SUCCESS) {
+    return std::string(device_class);
+  }
+  return "";
+}
+
 void genIOKitDeviceChildren(const io_registry_entry_t& service,
-                            const io_name_t plane,
+                            const IOKitWalk& walk,
                             int depth,
                             QueryData& results) {
+  if (walk.max_depth >= 0 && depth > walk.max_depth) {
+    return;
+  }
+
   io_iterator_t it;
-  auto kr = IORegistryEntryGetChildIterator(service, plane, &it);
+  auto kr = IORegistryEntryGetChildIterator(service, walk.plane, &it);
   if (kr != KERN_SUCCESS) {
     return;
   }
@@ -95,38 +171,97 @@ void genIOKitDeviceChildren(const io_registry_entry_t& service,
   io_service_t device;
   while ((device = IOIteratorNext(it))) {
     // Use this entry as the parent, and generate a result row.
-    genIOKitDevice(device, service, plane, depth, results);
-    genIOKitDeviceChildren(device, plane, depth + 1, results);
+    auto device_class = getIOKitClass(device);
+    if (walk.matchesClass(device_class)) {
+      genIOKitDevice(device, service, walk, device_class, depth, results);
+    }
+    genIOKitDeviceChildren(device, walk, depth + 1, results);
     IOObjectRelease(device);
   }
 
   IOObjectRelease(it);
 }
 
-QueryData genIOKitDeviceTree(QueryContext& context) {
-  QueryData results;
+/**
+ * @brief Generate the entries of the selected classes without a walk.
+ *
+ * The depth and parent of each matched service are found from its parents
+ * in the plane.
+ *
+ * @return false if a class had no match, the class may not be a service.
+ */
+static bool genIOKitMatches(const IOKitWalk& walk, QueryData& results) {
+  for (const auto& device_class : walk.classes) {
+    bool matched = false;
+    auto matching = IOServiceMatching(device_class.c_str());
+    forEachIOKitMatch(matching, [&](const io_service_t& device) {
+      // Matching includes the subclasses of a class.
+      if (getIOKitClass(device) != device_class ||
+          !IORegistryEntryInPlane(device, walk.plane)) {
+        return;
+      }
+      matched = true;
 
-  // Get the IO registry root node.
-  auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
+      io_registry_entry_t parent = 0;
+      if (IORegistryEntryGetParentEntry(device, walk.plane, &parent) !=
+          KERN_SUCCESS) {
+        return;
+      }
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIODeviceTreePlane, 0, results);
+      // The children of the root entry have depth 0.
+      int depth = -1;
+      io_registry_entry_t ancestor = parent;
+      IOObjectRetain(ancestor);
+      while (ancestor != 0) {
+        io_registry_entry_t next = 0;
+        if (IORegistryEntryGetParentEntry(ancestor, walk.plane, &next) !=
+            KERN_SUCCESS) {
+          next = 0;
+        }
+        IOObjectRelease(ancestor);
+        ancestor = next;
+        depth++;
+      }
 
-  IOObjectRelease(service);
-  return results;
+      if (walk.max_depth < 0 || depth <= walk.max_depth) {
+        genIOKitDevice(device, parent, walk, device_class, depth, results);
+      }
+      IOObjectRelease(parent);
+    });
+
+    if (!matched) {
+      results.clear();
+      return false;
+    }
+  }
+  return true;
 }
 
-QueryData genIOKitRegistry(QueryContext& context) {
+static QueryData genIOKitPlane(QueryContext& context, const char* plane) {
   QueryData results;
+  IOKitWalk walk(context, plane);
+
+  // Services of the selected classes are found by matching, not walking.
+  if (!walk.classes.empty() && genIOKitMatches(walk, results)) {
+    return results;
+  }
 
   // Get the IO registry root node.
   auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIOServicePlane, 0, results);
+  // Begin recursing along the "plane".
+  genIOKitDeviceChildren(service, walk, 0, results);
 
   IOObjectRelease(service);
   return results;
 }
+
+QueryData genIOKitDeviceTree(QueryContext& context) {
+  return genIOKitPlane(context, kIODeviceTreePlane);
+}
+
+QueryData genIOKitRegistry(QueryContext& context) {
+  return genIOKitPlane(context, kIOServicePlane);
+}
 }
 }
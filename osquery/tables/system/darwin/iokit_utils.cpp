@@ -50,16 +50,10 @@ IOKitPCIProperties::IOKitPCIProperties(const std::string& compatible) {
   }
 }
 
-std::string getIOKitProperty(const CFMutableDictionaryRef& details,
-                             const std::string& key) {
+/// Convert an IOKit-encoded property to a string.
+static std::string getIOKitValue(CFTypeRef property) {
   std::string value;
 
-  // Get a property from the device.
-  auto cfkey = CFStringCreateWithCString(
-      kCFAllocatorDefault, key.c_str(), kCFStringEncodingUTF8);
-  auto property = CFDictionaryGetValue(details, cfkey);
-  CFRelease(cfkey);
-
   // Several supported ways of parsing IOKit-encoded data.
   if (property) {
     if (CFGetTypeID(property) == CFNumberGetTypeID()) {
@@ -75,5 +69,55 @@ std::string getIOKitProperty(const CFMutableDictionaryRef& details,
 
   return value;
 }
+
+std::string getIOKitProperty(const CFMutableDictionaryRef& details,
+                             const std::string& key) {
+  // Get a property from the device.
+  auto cfkey = CFStringCreateWithCString(
+      kCFAllocatorDefault, key.c_str(), kCFStringEncodingUTF8);
+  auto property = CFDictionaryGetValue(details, cfkey);
+  CFRelease(cfkey);
+
+  return getIOKitValue(property);
+}
+
+std::string getIOKitEntryProperty(const io_registry_entry_t& entry,
+                                  const std::string& key) {
+  auto cfkey = CFStringCreateWithCString(
+      kCFAllocatorDefault, key.c_str(), kCFStringEncodingUTF8);
+  auto property =
+      IORegistryEntryCreateCFProperty(entry, cfkey, kCFAllocatorDefault, 0);
+  CFRelease(cfkey);
+  if (property == nullptr) {
+    return "";
+  }
+
+  auto value = getIOKitValue(property);
+  CFRelease(property);
+  return value;
+}
+
+bool forEachIOKitMatch(
+    CFMutableDictionaryRef matching,
+    const std::function<void(const io_service_t& service)>& predicate) {
+  if (matching == nullptr) {
+    return false;
+  }
+
+  io_iterator_t it;
+  auto kr = IOServiceGetMatchingServices(kIOMasterPortDefault, matching, &it);
+  if (kr != KERN_SUCCESS) {
+    return false;
+  }
+
+  io_service_t service;
+  while ((service = IOIteratorNext(it))) {
+    predicate(service);
+    IOObjectRelease(service);
+  }
+
+  IOObjectRelease(it);
+  return true;
+}
 }
 }
@@ -8,6 +8,7 @@
  *
  */
 
+#include <functional>
 #include <iomanip>
 #include <sstream>
 
@@ -49,5 +50,29 @@ inline void idToHex(std::string& id) {
 
 std::string getIOKitProperty(const CFMutableDictionaryRef& details,
                              const std::string& key);
+
+/**
+ * @brief Copy a single property of a registry entry.
+ *
+ * Tables reading a few properties avoid copying every property of the entry
+ * with IORegistryEntryCreateCFProperties.
+ */
+std::string getIOKitEntryProperty(const io_registry_entry_t& entry,
+                                  const std::string& key);
+
+/**
+ * @brief Call a function for each registered service matching a dictionary.
+ *
+ * The kernel finds the matches of IOServiceMatching or IOServiceNameMatching
+ * without walking the registry. Matching is a service API, a registry entry
+ * that is not an IOService is not matched.
+ *
+ * @param matching A matching dictionary, the reference is consumed.
+ * @param predicate Called for each matching service, released after.
+ * @return false if the matching services could not be found.
+ */
+bool forEachIOKitMatch(
+    CFMutableDictionaryRef matching,
+    const std::function<void(const io_service_t& service)>& predicate);
 }
 }
@@ -8,6 +8,7 @@
  *
  */
 
+#include <functional>
 #include <map>
 #include <set>
 #include <vector>
@@ -86,6 +87,20 @@ CFArrayRef CreateKeychainItems(const std::set<std::string>& paths,
                                const CFTypeRef& item_type);
 
 std::set<std::string> getKeychainPaths();
+
+/**
+ * @brief Keychain table results, kept while the keychain files are unchanged.
+ *
+ * Searching keychains opens and reads every keychain in the search paths.
+ * The results of each table and set of search paths are generated again
+ * when the status of a keychain file changes.
+ */
+QueryData getCachedKeychainResults(const std::string& table,
+                                   const std::set<std::string>& paths,
+                                   const std::function<QueryData()>& generator);
+
+/// Allow OpenSSL to decode certificates on several threads.
+void initOpenSSLThreading();
 std::string genKeyUsage(unsigned long flag);
 std::string genHumanReadableDateTime(ASN1_TIME* time);
 }
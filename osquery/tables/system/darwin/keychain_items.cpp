@@ -83,17 +83,9 @@ void genKeychainItem(const SecKeychainItemRef& item, QueryData& results) {
   results.push_back(r);
 }
 
-QueryData genKeychainItems(QueryContext& context) {
+static QueryData genKeychainItemsForPaths(
+    const std::set<std::string>& keychain_paths) {
   QueryData results;
-
-  // Allow the caller to set an explicit certificate (keychain) search path.
-  std::set<std::string> keychain_paths;
-  if (context.constraints["path"].exists(EQUALS)) {
-    keychain_paths = context.constraints["path"].getAll(EQUALS);
-  } else {
-    keychain_paths = getKeychainPaths();
-  }
-
   for (const auto& item_type : kKeychainItemTypes) {
     CFArrayRef items = CreateKeychainItems(keychain_paths, item_type);
     if (items == nullptr) {
@@ -110,5 +102,21 @@ QueryData genKeychainItems(QueryContext& context) {
 
   return results;
 }
+
+QueryData genKeychainItems(QueryContext& context) {
+  // Allow the caller to set an explicit certificate (keychain) search path.
+  std::set<std::string> keychain_paths;
+  if (context.constraints["path"].exists(EQUALS)) {
+    keychain_paths = context.constraints["path"].getAll(EQUALS);
+  } else {
+    keychain_paths = getKeychainPaths();
+  }
+
+  // Results are reused while the keychain files are unchanged.
+  return getCachedKeychainResults(
+      "keychain_items", keychain_paths, [&keychain_paths]() {
+        return genKeychainItemsForPaths(keychain_paths);
+      });
+}
 }
 }
@@ -10,14 +10,19 @@
 
 #include <string>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 
 #include <boost/lexical_cast.hpp>
 
+#include <openssl/crypto.h>
+
 #include <osquery/filesystem.h>
 #include <osquery/hash.h>
 #include <osquery/core.h>
 
 #include "osquery/tables/system/darwin/keychain.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -316,5 +321,63 @@ std::set<std::string> getKeychainPaths() {
 
   return keychain_paths;
 }
+
+/// The most sets of search paths with kept results.
+const size_t kKeychainResultsMax = 16;
+
+QueryData getCachedKeychainResults(
+    const std::string& table,
+    const std::set<std::string>& paths,
+    const std::function<QueryData()>& generator) {
+  static std::map<std::string, std::shared_ptr<FileStateCache>> caches;
+  static std::mutex caches_mutex;
+
+  std::vector<std::string> files(paths.begin(), paths.end());
+  auto key = table + ":" + osquery::join(files, ":");
+  std::shared_ptr<FileStateCache> cache;
+  {
+    std::lock_guard<std::mutex> lock(caches_mutex);
+    if (caches.count(key) == 0) {
+      if (caches.size() >= kKeychainResultsMax) {
+        caches.clear();
+      }
+      // A search path directory checks the status of each keychain within.
+      caches[key] = std::make_shared<FileStateCache>(files);
+    }
+    cache = caches[key];
+  }
+  return cache->get(generator);
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/// The OpenSSL static locks, before 1.1 OpenSSL does not lock by itself.
+static std::vector<std::mutex>* kOpenSSLLocks{nullptr};
+
+static void lockOpenSSL(int mode, int n, const char* file, int line) {
+  if (mode & CRYPTO_LOCK) {
+    (*kOpenSSLLocks)[n].lock();
+  } else {
+    (*kOpenSSLLocks)[n].unlock();
+  }
+}
+#endif
+
+void initOpenSSLThreading() {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  static std::once_flag once;
+  std::call_once(once, []() {
+    // Another library may have installed locking first, the locks are kept
+    // for the life of the process.
+    bool installed = false;
+    OSX_OPENSSL(installed = (CRYPTO_get_locking_callback() != nullptr));
+    if (!installed) {
+      int locks = 0;
+      OSX_OPENSSL(locks = CRYPTO_num_locks());
+      kOpenSSLLocks = new std::vector<std::mutex>(locks);
+      OSX_OPENSSL(CRYPTO_set_locking_callback(lockOpenSSL));
+    }
+  });
+#endif
+}
 }
 }
@@ -10,7 +10,6 @@
 
 #include <sstream>
 
-#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
 
 #include <osquery/core.h>
@@ -19,6 +18,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
@@ -37,6 +37,9 @@ const std::vector<std::string> kUserLaunchdSearchPaths = {
     "/Library/LaunchAgents",
 };
 
+/// The most launchd plists with kept rows.
+const size_t kLaunchdCacheMax = 8192;
+
 const std::map<std::string, std::string> kLaunchdTopLevelStringKeys = {
     {"Label", "label"},
     {"RunAtLoad", "run_at_load"},
@@ -65,7 +68,7 @@ const std::map<std::string, std::string> kLaunchdTopLevelArrayKeys = {
 const std::string kLaunchdOverridesPath =
     "/var/db/launchd.db/%/overrides.plist";
 
-void genLaunchdItem(const pt::ptree& tree,
+void genLaunchdItem(const std::map<std::string, std::string>& values,
                     const fs::path& path,
                     QueryData& results) {
   Row r;
@@ -73,21 +76,16 @@ void genLaunchdItem(const pt::ptree& tree,
   r["name"] = path.filename().string();
   for (const auto& it : kLaunchdTopLevelStringKeys) {
     // For known string-values, the column is the value.
-    r[it.second] = tree.get(it.first, "");
+    auto value = values.find(it.first);
+    r[it.second] = (value != values.end()) ? value->second : "";
   }
 
   for (const auto& it : kLaunchdTopLevelArrayKeys) {
-    // Otherwise walk an array item and join the arguments.
-    if (tree.count(it.first) == 0) {
-      continue;
-    }
-
-    auto subtree = tree.get_child(it.first);
-    std::vector<std::string> arguments;
-    for (const auto& argument : subtree) {
-      arguments.push_back(argument.second.get<std::string>(""));
+    // Otherwise the array items are joined arguments.
+    auto value = values.find(it.first);
+    if (value != values.end()) {
+      r[it.second] = value->second;
     }
-    r[it.second] = boost::algorithm::join(arguments, " ");
   }
 
   results.push_back(std::move(r));
@@ -109,27 +107,38 @@ QueryData genLaunchd(QueryContext& context) {
     }
   }
 
-  // The osquery::parsePlist method will reset/clear a property tree.
-  // Keeping the data structure in a larger scope preserves allocations
-  // between similar-sized trees.
-  pt::ptree tree;
+  // Only the launchd keys used as columns are read.
+  std::set<std::string> keys;
+  for (const auto& it : kLaunchdTopLevelStringKeys) {
+    keys.insert(it.first);
+  }
+  for (const auto& it : kLaunchdTopLevelArrayKeys) {
+    keys.insert(it.first);
+  }
 
-  // For each found launcher (plist in known paths) parse the plist.
+  // Optimize by not searching when a path is a constraint.
+  std::vector<std::string> plists;
   for (const auto& path : launchers) {
-    if (!context.constraints["path"].matches(path)) {
-      // Optimize by not searching when a path is a constraint.
-      continue;
-    }
-
-    if (!osquery::parsePlist(path, tree).ok()) {
-      TLOG << "Error parsing launch daemon/agent plist: " << path;
-      continue;
+    if (context.constraints["path"].matches(path)) {
+      plists.push_back(path);
     }
-
-    // Using the parsed plist, pull out each set of interesting keys.
-    genLaunchdItem(tree, path, results);
   }
 
+  // For each found launcher (plist in known paths) parse the plist.
+  static FileRowsCache items(kLaunchdCacheMax);
+  items.get(plists,
+            ([&keys](const std::string& path, QueryData& rows) {
+              std::map<std::string, std::string> values;
+              if (!osquery::parsePlistKeys(path, keys, values).ok()) {
+                TLOG << "Error parsing launch daemon/agent plist: " << path;
+                return;
+              }
+
+              // Using the parsed plist, pull out each set of interesting keys.
+              genLaunchdItem(values, path, rows);
+            }),
+            results);
+
   return std::move(results);
 }
 
@@ -8,7 +8,16 @@
  *
  */
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/hash.h>
 #include <osquery/sql.h>
@@ -37,6 +46,9 @@ const std::map<std::string, std::string> kPkgReceiptKeys = {
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+DECLARE_bool(disable_forensic);
+
 namespace tables {
 
 BOM::BOM(const char* data, size_t size)
@@ -86,8 +98,8 @@ const char* BOM::getPointer(int index, size_t* length) const {
   }
 
   const BOMPointer* pointer = Table->blockPointers + ntohl(index);
-  uint32_t addr = ntohl(pointer->address);
-  if (size_ < addr + ntohl(pointer->length)) {
+  size_t addr = ntohl(pointer->address);
+  if (addr > size_ || size_ - addr < ntohl(pointer->length)) {
     // Address value is out of range.
     return nullptr;
   }
@@ -110,7 +122,8 @@ const BOMVar* BOM::getVariable(size_t* offset) const {
   }
 
   const BOMVar* var = (BOMVar*)((char*)Vars->list + *offset);
-  if (var == nullptr) {
+  if (size_ < vars_offset_ + *offset + sizeof(BOMVar) + var->length) {
+    // The variable name overflows the variable list.
     *offset = 0;
     return nullptr;
   }
@@ -127,90 +140,236 @@ const BOMPaths* BOM::getPaths(int index) const {
   }
 
   // Check the number of indexes.
-  if (paths_size < ntohs(paths->count) * sizeof(BOMPathIndices)) {
+  if (paths_size - sizeof(BOMPaths) <
+      ntohs(paths->count) * sizeof(BOMPathIndices)) {
     return nullptr;
   }
   return paths;
 }
 
-void genBOMPaths(const std::string& path,
-                 const BOM& bom,
-                 const BOMPaths* paths,
-                 QueryData& results) {
-  std::map<uint32_t, std::string> filenames;
-  std::map<uint32_t, uint32_t> parents;
-
-  while (paths != nullptr) {
-    for (unsigned j = 0; j < ntohs(paths->count); j++) {
-      uint32_t index0 = paths->indices[j].index0;
-      uint32_t index1 = paths->indices[j].index1;
-
-      auto info1 = (const BOMPathInfo1*)bom.getPointer(index0);
-      if (info1 == nullptr) {
-        // Invalid BOMPathInfo1 structure.
-        return;
-      }
+/// A read-only mapping of a BOM file, restoring the file times when unmapped.
+class BOMMapping : private boost::noncopyable {
+ public:
+  explicit BOMMapping(const std::string& path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat file;
+    if (fd_ < 0 || ::fstat(fd_, &file) != 0 || file.st_size <= 0) {
+      return;
+    }
 
-      auto info2 = (const BOMPathInfo2*)bom.getPointer(info1->index);
-      if (info2 == nullptr) {
-        // Invalid BOMPathInfo2 structure.
-        return;
-      }
+    TIMESPEC_TO_TIMEVAL(&times_[0], &file.st_atimespec);
+    TIMESPEC_TO_TIMEVAL(&times_[1], &file.st_mtimespec);
+    auto data = ::mmap(nullptr, file.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data == MAP_FAILED) {
+      return;
+    }
+    data_ = static_cast<const char*>(data);
+    size_ = static_cast<size_t>(file.st_size);
+  }
 
-      // Compute full name using pointer size.
-      size_t file_size;
-      auto file = (const BOMFile*)bom.getPointer(index1, &file_size);
-      if (file == nullptr || file_size <= sizeof(BOMFile)) {
-        // Invalid BOMFile structure or size out of bounds.
-        return;
+  ~BOMMapping() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+      // Attempt to restore the atime and mtime before the file read.
+      if (!FLAGS_disable_forensic) {
+        ::futimes(fd_, times_);
       }
-      std::string filename(file->name, file_size - sizeof(BOMFile));
-      filename = std::string(filename.c_str());
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  int fd_{-1};
+  const char* data_{nullptr};
+  size_t size_{0};
+  struct timeval times_[2];
+};
+
+/**
+ * @brief The state of generating the paths of one BOM, shared by its tasks.
+ *
+ * Each leaf of the BOM paths tree is generated by a task, leaves are linked
+ * in order and parents precede their children. The full path of each
+ * directory is kept so a path is a single append to its parent. Directories
+ * that cannot contain a path matching the filepath constraints are pruned.
+ */
+struct BOMWalk {
+  BOMWalk(const std::string& bom_path, const QueryContext& context)
+      : path(bom_path),
+        mapping(bom_path),
+        bom(mapping.data(), mapping.size()) {
+    if (context.constraints.count("filepath") == 0) {
+      return;
+    }
 
-      // Maintain a lookup from BOM file index to filename.
-      filenames[info1->id] = filename;
-      if (file->parent) {
-        parents[info1->id] = file->parent;
+    const auto& filepath = context.constraints.at("filepath");
+    equals = filepath.getAll(EQUALS);
+    for (const auto& lower : filepath.getAll(GREATER_THAN)) {
+      lowers.push_back(std::make_pair(lower, false));
+    }
+    for (const auto& lower : filepath.getAll(GREATER_THAN_OR_EQUALS)) {
+      lowers.push_back(std::make_pair(lower, true));
+    }
+    for (const auto& upper : filepath.getAll(LESS_THAN)) {
+      uppers.push_back(std::make_pair(upper, false));
+    }
+    for (const auto& upper : filepath.getAll(LESS_THAN_OR_EQUALS)) {
+      uppers.push_back(std::make_pair(upper, true));
+    }
+  }
+
+  /// Check if a file path satisfies the constraints.
+  bool matches(const std::string& filepath) const {
+    if (!equals.empty() && equals.count(filepath) == 0) {
+      return false;
+    }
+    for (const auto& lower : lowers) {
+      if (filepath < lower.first || (filepath == lower.first && !lower.second)) {
+        return false;
       }
+    }
+    for (const auto& upper : uppers) {
+      if (filepath > upper.first || (filepath == upper.first && !upper.second)) {
+        return false;
+      }
+    }
+    return true;
+  }
 
-      auto it = parents.find(info1->id);
-      while (it != parents.end()) {
-        filename = filenames[it->second] + "/" + filename;
-        it = parents.find(it->second);
+  /// Check if the children of a directory may satisfy the constraints.
+  bool mayContain(const std::string& directory) const {
+    // Every child is at least directory + "/" and less than directory + "0".
+    auto first = directory + "/";
+    auto last = directory + "0";
+    if (!equals.empty()) {
+      auto it = equals.lower_bound(first);
+      if (it == equals.end() || *it >= last) {
+        return false;
+      }
+    }
+    for (const auto& lower : lowers) {
+      if (lower.first >= last) {
+        return false;
+      }
+    }
+    for (const auto& upper : uppers) {
+      if (upper.first < first) {
+        return false;
       }
+    }
+    return true;
+  }
+
+  std::string path;
+  BOMMapping mapping;
+  BOM bom;
+
+  /// The filepath constraints, an inclusive flag with each bound.
+  std::set<std::string> equals;
+  std::vector<std::pair<std::string, bool>> lowers;
+  std::vector<std::pair<std::string, bool>> uppers;
+
+  /// The full path of each directory by BOM file id.
+  std::map<uint32_t, std::string> directories;
 
-      Row r;
-      r["filepath"] = filename;
-      r["uid"] = INTEGER(ntohl(info2->user));
-      r["gid"] = INTEGER(ntohl(info2->group));
-      r["mode"] = INTEGER(ntohs(info2->mode));
-      r["size"] = INTEGER(ntohl(info2->size));
-      r["modified_time"] = INTEGER(ntohl(info2->modtime));
-      r["path"] = path;
-      results.push_back(r);
+  /// Directories pruned by the constraints, their children are skipped.
+  std::set<uint32_t> pruned;
+
+  /// The number of equal filepath constraints found.
+  size_t found{0};
+
+  /// Set when the walk cannot generate more rows.
+  bool done{false};
+};
+
+/// The BOMPathInfo2 type of a directory.
+const uint8_t kBOMDirectoryType = 2;
+
+void genBOMPaths(BOMWalk& walk, const BOMPaths* paths, QueryData& results) {
+  const auto& bom = walk.bom;
+  for (unsigned j = 0; j < ntohs(paths->count) && !walk.done; j++) {
+    uint32_t index0 = paths->indices[j].index0;
+    uint32_t index1 = paths->indices[j].index1;
+
+    size_t info1_size = 0;
+    auto info1 = (const BOMPathInfo1*)bom.getPointer(index0, &info1_size);
+    if (info1 == nullptr || info1_size < sizeof(BOMPathInfo1)) {
+      // Invalid BOMPathInfo1 structure.
+      walk.done = true;
+      return;
     }
 
-    if (paths->forward == htonl(0)) {
+    size_t info2_size = 0;
+    auto info2 = (const BOMPathInfo2*)bom.getPointer(info1->index, &info2_size);
+    if (info2 == nullptr || info2_size < sizeof(BOMPathInfo2)) {
+      // Invalid BOMPathInfo2 structure.
+      walk.done = true;
       return;
-    } else {
-      paths = bom.getPaths(paths->forward);
     }
-  }
-}
 
-void genPackageBOM(const std::string& path, QueryData& results) {
-  std::string content;
-  // Read entire BOM file.
-  if (!forensicReadFile(path, content).ok()) {
-    return;
-  }
+    // Compute full name using pointer size.
+    size_t file_size;
+    auto file = (const BOMFile*)bom.getPointer(index1, &file_size);
+    if (file == nullptr || file_size <= sizeof(BOMFile)) {
+      // Invalid BOMFile structure or size out of bounds.
+      walk.done = true;
+      return;
+    }
 
-  // Create a BOM representation.
-  BOM bom(content.c_str(), content.size());
-  if (!bom.isValid()) {
-    return;
+    // The children of a pruned directory are pruned.
+    bool directory = (info2->type == kBOMDirectoryType);
+    if (file->parent && walk.pruned.count(file->parent) > 0) {
+      if (directory) {
+        walk.pruned.insert(info1->id);
+      }
+      continue;
+    }
+
+    std::string filename(file->name,
+                         strnlen(file->name, file_size - sizeof(BOMFile)));
+    if (file->parent) {
+      auto parent = walk.directories.find(file->parent);
+      if (parent != walk.directories.end()) {
+        filename = parent->second + "/" + filename;
+      }
+    }
+
+    if (directory) {
+      if (walk.mayContain(filename)) {
+        walk.directories[info1->id] = filename;
+      } else {
+        walk.pruned.insert(info1->id);
+      }
+    }
+
+    if (!walk.matches(filename)) {
+      continue;
+    }
+
+    Row r;
+    r["filepath"] = filename;
+    r["uid"] = INTEGER(ntohl(info2->user));
+    r["gid"] = INTEGER(ntohl(info2->group));
+    r["mode"] = INTEGER(ntohs(info2->mode));
+    r["size"] = INTEGER(ntohl(info2->size));
+    r["modified_time"] = INTEGER(ntohl(info2->modtime));
+    r["path"] = walk.path;
+    results.push_back(r);
+
+    // Every equal filepath was found.
+    if (!walk.equals.empty() && ++walk.found == walk.equals.size()) {
+      walk.done = true;
+    }
   }
+}
 
+/// Find the first leaf of the BOM paths tree.
+const BOMPaths* getBOMPathsLeaf(const BOM& bom) {
   size_t var_offset = 0;
   for (unsigned i = 0; i < ntohl(bom.Vars->count); i++) {
     // Iterate through each BOM variable, a packed set of structures.
@@ -235,28 +394,53 @@ void genPackageBOM(const std::string& path, QueryData& results) {
     const BOMTree* tree = (const BOMTree*)var_data;
     auto paths = bom.getPaths(tree->child);
     while (paths != nullptr && paths->isLeaf == htons(0)) {
-      if ((BOMPathIndices*)paths->indices == nullptr) {
-        break;
+      if (ntohs(paths->count) == 0) {
+        return nullptr;
       }
       paths = bom.getPaths(paths->indices[0].index0);
     }
+    return paths;
+  }
+  return nullptr;
+}
+
+void genPackageBOM(const std::string& path,
+                   const QueryContext& context,
+                   RowTasks& tasks) {
+  // Map the BOM file, pages are read as the leaves are walked.
+  auto walk = std::make_shared<BOMWalk>(path, context);
+  if (walk->mapping.data() == nullptr || !walk->bom.isValid()) {
+    return;
+  }
+
+  // Each leaf is generated by a task so a cursor may stop early (LIMIT).
+  std::set<const BOMPaths*> leaves;
+  auto paths = getBOMPathsLeaf(walk->bom);
+  while (paths != nullptr && leaves.insert(paths).second) {
+    tasks.push_back([walk, paths](QueryData& results) {
+      if (!walk->done) {
+        genBOMPaths(*walk, paths, results);
+      }
+    });
 
-    genBOMPaths(path, bom, paths, results);
-    break;
+    if (paths->forward == htonl(0)) {
+      break;
+    }
+    paths = walk->bom.getPaths(paths->forward);
   }
 }
 
-QueryData genPackageBOM(QueryContext& context) {
-  QueryData results;
+RowTasks genPackageBOM(QueryContext& context) {
+  RowTasks tasks;
   if (context.constraints["path"].exists(EQUALS)) {
     // If an explicit path was given, generate and return.
     auto paths = context.constraints["path"].getAll(EQUALS);
     for (const auto& path : paths) {
-      genPackageBOM(path, results);
+      genPackageBOM(path, context, tasks);
     }
   }
 
-  return results;
+  return tasks;
 }
 
 void genPackageReceipt(const std::string& path, QueryData& results) {
@@ -18,14 +18,10 @@ namespace tables {
 void genPCIDevice(const io_service_t& device, QueryData& results) {
   Row r;
 
-  // Get the device details
-  CFMutableDictionaryRef details;
-  IORegistryEntryCreateCFProperties(
-      device, &details, kCFAllocatorDefault, kNilOptions);
+  // Copy only the device details used, not every property.
+  r["pci_slot"] = getIOKitEntryProperty(device, "pcidebug");
 
-  r["pci_slot"] = getIOKitProperty(details, "pcidebug");
-
-  auto compatible = getIOKitProperty(details, "compatible");
+  auto compatible = getIOKitEntryProperty(device, "compatible");
   auto properties = IOKitPCIProperties(compatible);
   r["vendor_id"] = properties.vendor_id;
   r["model_id"] = properties.model_id;
@@ -33,31 +29,15 @@ void genPCIDevice(const io_service_t& device, QueryData& results) {
   r["driver"] = properties.driver;
 
   results.push_back(r);
-  CFRelease(details);
 }
 
 QueryData genPCIDevices(QueryContext& context) {
   QueryData results;
 
   auto matching = IOServiceMatching(kIOPCIDeviceClassName_.c_str());
-  if (matching == nullptr) {
-    // No devices matched PCI, very odd.
-    return results;
-  }
-
-  io_iterator_t it;
-  auto kr = IOServiceGetMatchingServices(kIOMasterPortDefault, matching, &it);
-  if (kr != KERN_SUCCESS) {
-    return results;
-  }
-
-  io_service_t device;
-  while ((device = IOIteratorNext(it))) {
+  forEachIOKitMatch(matching, [&results](const io_service_t& device) {
     genPCIDevice(device, results);
-    IOObjectRelease(device);
-  }
-
-  IOObjectRelease(it);
+  });
   return results;
 }
 }
@@ -16,6 +16,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
@@ -25,6 +26,9 @@ namespace tables {
 
 const size_t kPreferenceDepthLimit = 20;
 
+/// The most plists at path constraints with kept rows.
+const size_t kPreferencesCacheMax = 1024;
+
 struct TRowResults {
   const Row* const base;
   QueryData* const results;
@@ -245,11 +249,12 @@ QueryData genOSXPreferences(QueryContext& context) {
   QueryData results;
 
   if (context.constraints["path"].exists(EQUALS)) {
-    // Read preferences from a plist at path.
+    // Read preferences from a plist at path, parsed again when it changes.
+    static FileRowsCache plists(kPreferencesCacheMax);
     auto paths = context.constraints["path"].getAll(EQUALS);
-    for (const auto& path : paths) {
-      genOSXPlistPreferences(path, results);
-    }
+    plists.get(std::vector<std::string>(paths.begin(), paths.end()),
+               genOSXPlistPreferences,
+               results);
   } else {
     genOSXDefaultPreferences(context, results);
   }
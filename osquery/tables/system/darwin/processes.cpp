@@ -8,8 +8,11 @@
  *
  */
 
+#include <algorithm>
+#include <iterator>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <libproc.h>
 #include <mach/mach.h>
@@ -23,12 +26,21 @@
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/dispatcher/executor.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+FLAG(uint64,
+     process_threads,
+     4,
+     "Threads collecting process details for the processes table on OS X");
+
 namespace tables {
 
 // The maximum number of expected memory regions per process.
@@ -57,12 +69,13 @@ std::set<int> getProcList(const QueryContext &context) {
 
   // arbitrarily create a list with 2x capacity in case more processes have
   // been loaded since the last proc_listpids was executed
-  pid_t pids[2 * bufsize / sizeof(pid_t)];
+  std::vector<pid_t> pids(2 * bufsize / sizeof(pid_t));
 
   // now that we've allocated "pids", let's overwrite num_pids with the actual
   // amount of data that was returned for proc_listpids when we populate the
   // pids data structure
-  bufsize = proc_listpids(PROC_ALL_PIDS, 0, pids, sizeof(pids));
+  bufsize = proc_listpids(
+      PROC_ALL_PIDS, 0, pids.data(), pids.size() * sizeof(pid_t));
   if (bufsize <= 0) {
     VLOG(1) << "An error occurred retrieving the process list";
     return pidlist;
@@ -72,7 +85,7 @@ std::set<int> getProcList(const QueryContext &context) {
   for (int i = 0; i < num_pids; ++i) {
     // if the pid is negative or 0, it doesn't represent a real process so
     // continue the iterations so that we don't add it to the results set
-    if (pids[i] <= 0) {
+    if (pids[i] <= 0 || !context.isSampled(std::to_string(pids[i]))) {
       continue;
     }
     pidlist.insert(pids[i]);
@@ -177,12 +190,18 @@ struct proc_args {
   std::map<std::string, std::string> env;
 };
 
-proc_args getProcRawArgs(int pid, size_t argmax) {
+/// Read the arguments and environment, the buffer is reused between calls.
+proc_args getProcRawArgs(int pid, std::vector<char> &buffer) {
   proc_args args;
   uid_t euid = geteuid();
-  char procargs[argmax];
+  if (buffer.empty()) {
+    buffer.resize(genMaxArgs());
+  }
+  size_t argmax = buffer.size();
+  char *procargs = buffer.data();
   int mib[3] = {CTL_KERN, KERN_PROCARGS2, pid};
-  if (sysctl(mib, 3, &procargs, &argmax, nullptr, 0) == -1 || argmax == 0) {
+  if (argmax == 0 || sysctl(mib, 3, procargs, &argmax, nullptr, 0) == -1 ||
+      argmax == 0) {
     if (euid == 0) {
       TLOG << "An error occurred retrieving the env for pid: " << pid;
     }
@@ -224,99 +243,179 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   return args;
 }
 
-QueryData genProcesses(QueryContext &context) {
-  QueryData results;
-
-  // Initialize time conversions.
-  static mach_timebase_info_data_t time_base;
-  if (time_base.denom == 0) {
-    mach_timebase_info(&time_base);
-  }
-
-  auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+/// The fewest processes collected by each worker.
+const size_t kProcessChunk = 64;
 
-  for (auto &pid : pidlist) {
-    Row r;
-    r["pid"] = INTEGER(pid);
+void genProcess(int pid,
+                const QueryContext &context,
+                const mach_timebase_info_data_t &time_base,
+                std::vector<char> &args_buffer,
+                QueryData &results) {
+  Row r;
+  r["pid"] = INTEGER(pid);
+  // Each proc_pidinfo flavor is only requested if the query uses its columns.
+  if (context.isAnyColumnUsed({"path", "name", "on_disk"})) {
     r["path"] = getProcPath(pid);
     // OS X proc_name only returns 16 bytes, use the basename of the path.
     r["name"] = fs::path(r["path"]).filename().string();
+  }
 
-    {
-      // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
-    }
+  if (context.isColumnUsed("cmdline")) {
+    // The command line invocation including arguments.
+    auto args = getProcRawArgs(pid, args_buffer);
+    r["cmdline"] = boost::algorithm::join(args.args, " ");
+  }
 
+  if (context.isAnyColumnUsed({"cwd", "root"})) {
     // The process relative root and current working directory.
     genProcRootAndCWD(pid, r);
+  }
 
-    proc_cred cred;
-    if (getProcCred(pid, cred)) {
-      r["parent"] = BIGINT(cred.parent);
-      r["group"] = BIGINT(cred.group);
-      // Use Linux diction for process status/state.
-      r["state"] = INTEGER(cred.status);
-      r["nice"] = INTEGER(cred.nice);
-      r["uid"] = BIGINT(cred.real.uid);
-      r["gid"] = BIGINT(cred.real.gid);
-      r["euid"] = BIGINT(cred.effective.uid);
-      r["egid"] = BIGINT(cred.effective.gid);
-      r["suid"] = BIGINT(cred.saved.uid);
-      r["sgid"] = BIGINT(cred.saved.gid);
-    } else {
-      r["parent"] = "0";
-      r["group"] = "0";
-      r["state"] = "0";
-      r["nice"] = "0";
-      r["uid"] = "-1";
-      r["gid"] = "-1";
-      r["euid"] = "-1";
-      r["egid"] = "-1";
-      r["suid"] = "-1";
-      r["sgid"] = "-1";
-    }
+  proc_cred cred;
+  if (!context.isAnyColumnUsed({"parent",
+                                "group",
+                                "state",
+                                "nice",
+                                "uid",
+                                "gid",
+                                "euid",
+                                "egid",
+                                "suid",
+                                "sgid"})) {
+    // The credentials are not needed.
+  } else if (getProcCred(pid, cred)) {
+    r["parent"] = BIGINT(cred.parent);
+    r["group"] = BIGINT(cred.group);
+    // Use Linux diction for process status/state.
+    r["state"] = INTEGER(cred.status);
+    r["nice"] = INTEGER(cred.nice);
+    r["uid"] = BIGINT(cred.real.uid);
+    r["gid"] = BIGINT(cred.real.gid);
+    r["euid"] = BIGINT(cred.effective.uid);
+    r["egid"] = BIGINT(cred.effective.gid);
+    r["suid"] = BIGINT(cred.saved.uid);
+    r["sgid"] = BIGINT(cred.saved.gid);
+  } else {
+    r["parent"] = "0";
+    r["group"] = "0";
+    r["state"] = "0";
+    r["nice"] = "0";
+    r["uid"] = "-1";
+    r["gid"] = "-1";
+    r["euid"] = "-1";
+    r["egid"] = "-1";
+    r["suid"] = "-1";
+    r["sgid"] = "-1";
+  }
 
-    // If the path of the executable that started the process is available and
-    // the path exists on disk, set on_disk to 1. If the path is not
-    // available, set on_disk to -1. If, and only if, the path of the
-    // executable is available and the file does NOT exist on disk, set on_disk
-    // to 0.
+  // If the path of the executable that started the process is available and
+  // the path exists on disk, set on_disk to 1. If the path is not
+  // available, set on_disk to -1. If, and only if, the path of the
+  // executable is available and the file does NOT exist on disk, set on_disk
+  // to 0.
+  if (context.isColumnUsed("on_disk")) {
     r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  }
+
+  if (!context.isAnyColumnUsed({"wired_size",
+                                "resident_size",
+                                "phys_footprint",
+                                "user_time",
+                                "system_time",
+                                "start_time"})) {
+    results.push_back(r);
+    return;
+  }
+
+  // systems usage and time information
+  struct rusage_info_v2 rusage_info_data;
+  int rusage_status = proc_pid_rusage(
+      pid, RUSAGE_INFO_V2, (rusage_info_t *)&rusage_info_data);
+  // proc_pid_rusage returns -1 if it was unable to gather information
+  if (rusage_status == 0) {
+    // size/memory information
+    r["wired_size"] = TEXT(rusage_info_data.ri_wired_size);
+    r["resident_size"] = TEXT(rusage_info_data.ri_resident_size);
+    r["phys_footprint"] = TEXT(rusage_info_data.ri_phys_footprint);
+
+    // time information
+    r["user_time"] = TEXT(rusage_info_data.ri_user_time / CPU_TIME_RATIO);
+    r["system_time"] = TEXT(rusage_info_data.ri_system_time / CPU_TIME_RATIO);
+    // Convert the time in CPU ticks since boot to seconds.
+    // This is relative to time not-sleeping since boot.
+    r["start_time"] =
+        TEXT((rusage_info_data.ri_proc_start_abstime / START_TIME_RATIO) *
+             time_base.numer / time_base.denom);
+  } else {
+    r["wired_size"] = "-1";
+    r["resident_size"] = "-1";
+    r["phys_footprint"] = "-1";
+    r["user_time"] = "-1";
+    r["system_time"] = "-1";
+    r["start_time"] = "-1";
+  }
+
+  results.push_back(r);
+}
+
+QueryData genProcesses(QueryContext &context) {
+  QueryData results;
+
+  // Initialize time conversions.
+  static mach_timebase_info_data_t time_base;
+  if (time_base.denom == 0) {
+    mach_timebase_info(&time_base);
+  }
 
-    // systems usage and time information
-    struct rusage_info_v2 rusage_info_data;
-    int rusage_status = proc_pid_rusage(
-        pid, RUSAGE_INFO_V2, (rusage_info_t *)&rusage_info_data);
-    // proc_pid_rusage returns -1 if it was unable to gather information
-    if (rusage_status == 0) {
-      // size/memory information
-      r["wired_size"] = TEXT(rusage_info_data.ri_wired_size);
-      r["resident_size"] = TEXT(rusage_info_data.ri_resident_size);
-      r["phys_footprint"] = TEXT(rusage_info_data.ri_phys_footprint);
-
-      // time information
-      r["user_time"] = TEXT(rusage_info_data.ri_user_time / CPU_TIME_RATIO);
-      r["system_time"] = TEXT(rusage_info_data.ri_system_time / CPU_TIME_RATIO);
-      // Convert the time in CPU ticks since boot to seconds.
-      // This is relative to time not-sleeping since boot.
-      r["start_time"] =
-          TEXT((rusage_info_data.ri_proc_start_abstime / START_TIME_RATIO) *
-               time_base.numer / time_base.denom);
-    } else {
-      r["wired_size"] = "-1";
-      r["resident_size"] = "-1";
-      r["phys_footprint"] = "-1";
-      r["user_time"] = "-1";
-      r["system_time"] = "-1";
-      r["start_time"] = "-1";
+  auto pidlist = getProcList(context);
+  std::vector<int> pids(pidlist.begin(), pidlist.end());
+
+  // Split the pids into a contiguous chunk for each worker, each chunk has
+  // its own arguments buffer and results, appended in pid order.
+  size_t chunks = std::min<size_t>(std::max<size_t>(FLAGS_process_threads, 1),
+                                   (pids.size() / kProcessChunk) + 1);
+  if (chunks == 1) {
+    std::vector<char> args_buffer;
+    for (const auto &pid : pids) {
+      genProcess(pid, context, time_base, args_buffer, results);
     }
+    return results;
+  }
 
-    results.push_back(r);
+  std::vector<QueryData> chunk_results(chunks);
+  std::vector<TaskRef> tasks;
+  size_t chunk_size = (pids.size() + chunks - 1) / chunks;
+  for (size_t i = 0; i < chunks; i++) {
+    auto begin = std::min(i * chunk_size, pids.size());
+    auto end = std::min(begin + chunk_size, pids.size());
+    auto &output = chunk_results[i];
+    auto work = [&pids, &context, &output, begin, end](const Task &task) {
+      std::vector<char> args_buffer;
+      for (size_t j = begin; j < end && !task.isCancelled(); j++) {
+        genProcess(pids[j], context, time_base, args_buffer, output);
+      }
+    };
+
+    auto task = getTableExecutor().submit(work, TASK_PRIORITY_SCHEDULE);
+    if (task == nullptr) {
+      // The executor is stopping, collect the chunk on this thread.
+      std::vector<char> args_buffer;
+      for (size_t j = begin; j < end; j++) {
+        genProcess(pids[j], context, time_base, args_buffer, output);
+      }
+      continue;
+    }
+    tasks.push_back(task);
   }
 
+  for (const auto &task : tasks) {
+    task->runOrWait();
+  }
+  for (auto &output : chunk_results) {
+    results.insert(results.end(),
+                   std::make_move_iterator(output.begin()),
+                   std::make_move_iterator(output.end()));
+  }
   return results;
 }
 
@@ -324,9 +423,9 @@ QueryData genProcessEnvs(QueryContext &context) {
   QueryData results;
 
   auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+  std::vector<char> args_buffer;
   for (const auto &pid : pidlist) {
-    auto args = getProcRawArgs(pid, argmax);
+    auto args = getProcRawArgs(pid, args_buffer);
     for (const auto &env : args.env) {
       Row r;
       r["pid"] = INTEGER(pid);
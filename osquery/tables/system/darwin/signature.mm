@@ -8,19 +8,163 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
 #include <Foundation/Foundation.h>
 #include <Security/CodeSigning.h>
 
 #include <osquery/core.h>
 #include <osquery/core/conversions.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/dispatcher/executor.h"
+#include "osquery/events/darwin/fsevents.h"
+
 namespace osquery {
+
+FLAG(uint64,
+     signature_threads,
+     4,
+     "Threads verifying code signatures for the signature table");
+
 namespace tables {
 
+/// The most signature results kept.
+const size_t kSignatureCacheMax = 4096;
+
+/// Bundle files rewritten when a bundle is updated or signed again.
+const std::vector<std::string> kSignatureBundleFiles = {
+    "/Contents/_CodeSignature/CodeResources", "/Contents/Info.plist",
+};
+
+/// Changes within these paths invalidate cached signature results.
+const std::vector<std::string> kSignatureWatchPaths = {
+    "/Applications/**", "/Library/Extensions/**",
+};
+
+/**
+ * @brief Signature results by path, verifying rehashes every file signed.
+ *
+ * A result is reused while the stat of the path, and of a bundle's
+ * signature resources, and the verify flags are unchanged. File changes
+ * reported by FSEvents remove the results of the changed bundles.
+ */
+class SignatureCache : private boost::noncopyable {
+ public:
+  static SignatureCache& get() {
+    static SignatureCache cache;
+    return cache;
+  }
+
+  /// Copy a cached result if its key is unchanged.
+  bool find(const std::string& path, const std::string& key, Row& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(path);
+    if (entry == entries_.end() || entry->second.first != key) {
+      return false;
+    }
+    r = entry->second.second;
+    return true;
+  }
+
+  void insert(const std::string& path, const std::string& key, const Row& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= kSignatureCacheMax) {
+      entries_.clear();
+    }
+    entries_[path] = std::make_pair(key, r);
+  }
+
+  /// Remove the results of a changed path, its parents, and its children.
+  void invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto parent = path;
+    while (!parent.empty()) {
+      entries_.erase(parent);
+      auto separator = parent.find_last_of('/');
+      if (separator == std::string::npos) {
+        break;
+      }
+      parent.resize(separator);
+    }
+
+    auto child = entries_.lower_bound(path + "/");
+    while (child != entries_.end() &&
+           child->first.compare(0, path.size() + 1, path + "/") == 0) {
+      child = entries_.erase(child);
+    }
+  }
+
+ private:
+  SignatureCache() {}
+
+ private:
+  /// The key and result, by path.
+  std::map<std::string, std::pair<std::string, Row>> entries_;
+
+  std::mutex mutex_;
+};
+
+/// Invalidate cached signature results as bundles change.
+class SignatureCacheSubscriber
+    : public EventSubscriber<FSEventsEventPublisher> {
+ public:
+  Status init() override {
+    for (const auto& path : kSignatureWatchPaths) {
+      auto sc = createSubscriptionContext();
+      sc->path = path;
+      subscribe(&SignatureCacheSubscriber::Callback, sc);
+    }
+    return Status(0, "OK");
+  }
+
+  Status Callback(const FSEventsEventContextRef& ec,
+                  const FSEventsSubscriptionContextRef& sc) {
+    SignatureCache::get().invalidate(ec->path);
+    return Status(0, "OK");
+  }
+};
+
+REGISTER(SignatureCacheSubscriber, "event_subscriber", "signature_cache");
+
+/// Build the cache key of a path, empty if the path cannot be read.
+std::string getSignatureCacheKey(const std::string& path, SecCSFlags flags) {
+  struct stat info;
+  if (::stat(path.c_str(), &info) != 0) {
+    return "";
+  }
+
+  auto append = [](const struct stat& file, std::string& key) {
+    key += ":" + std::to_string(file.st_ino) + ":" +
+           std::to_string(file.st_mtimespec.tv_sec) + "." +
+           std::to_string(file.st_mtimespec.tv_nsec) + ":" +
+           std::to_string(file.st_size);
+  };
+
+  auto key = std::to_string(flags);
+  append(info, key);
+  if (S_ISDIR(info.st_mode)) {
+    for (const auto& file : kSignatureBundleFiles) {
+      struct stat resource;
+      if (::stat((path + file).c_str(), &resource) == 0) {
+        append(resource, key);
+      } else {
+        key += ":-";
+      }
+    }
+  }
+  return key;
+}
+
 // Get the flags to pass to SecStaticCodeCheckValidityWithErrors, depending on
 // the OS version.
 Status getVerifyFlags(SecCSFlags& flags) {
@@ -58,11 +202,6 @@ void genSignatureForFile(const std::string& path,
   Row r;
   OSStatus result;
 
-  // Defaults
-  r["path"] = path;
-  r["signed"] = INTEGER(0);
-  r["identifier"] = "";
-
   // Get flags for the file.
   SecCSFlags flags = 0;
   if (!getVerifyFlags(flags).ok()) {
@@ -70,6 +209,19 @@ void genSignatureForFile(const std::string& path,
     return;
   }
 
+  // The key is read before verifying, a change during verification is missed
+  // by the next query only if the stat is unchanged.
+  auto key = getSignatureCacheKey(path, flags);
+  if (!key.empty() && SignatureCache::get().find(path, key, r)) {
+    results.push_back(r);
+    return;
+  }
+
+  // Defaults
+  r["path"] = path;
+  r["signed"] = INTEGER(0);
+  r["identifier"] = "";
+
   // Create a URL that points to this file.
   auto url = (__bridge CFURLRef)[NSURL fileURLWithPath:@(path.c_str())];
   if (url == nullptr) {
@@ -119,6 +271,9 @@ void genSignatureForFile(const std::string& path,
     VLOG(1) << "Static code validity check failed for file: " << path;
   }
 
+  if (!key.empty()) {
+    SignatureCache::get().insert(path, key, r);
+  }
   results.push_back(r);
   CFRelease(staticCode);
 }
@@ -130,17 +285,36 @@ QueryData genSignature(QueryContext& context) {
   // directory. We search for the parsed predicate constraints with the equals
   // operator.
   auto paths = context.constraints["path"].getAll(EQUALS);
+  std::vector<std::string> existing;
   for (const auto& path_string : paths) {
     // Note: we are explicitly *not* using is_regular_file here, since you can
     // pass a directory path to the verification functions (e.g. for app
     // bundles, etc.)
-    if (!pathExists(path_string).ok()) {
-      continue;
+    if (pathExists(path_string).ok()) {
+      existing.push_back(path_string);
     }
+  }
 
-    genSignatureForFile(path_string, results);
+  if (existing.size() == 1) {
+    genSignatureForFile(existing.front(), results);
+    return results;
   }
 
+  // Verify each path on the bounded pool, results keep the path order.
+  // The verify flags are determined once, before the workers use them.
+  SecCSFlags flags = 0;
+  getVerifyFlags(flags);
+  std::vector<QueryData> path_results(existing.size());
+  parallelFor(existing.size(),
+              FLAGS_signature_threads,
+              [&existing, &path_results](size_t i) {
+                @autoreleasepool {
+                  genSignatureForFile(existing[i], path_results[i]);
+                }
+              });
+  for (auto& output : path_results) {
+    results.insert(results.end(), output.begin(), output.end());
+  }
   return results;
 }
 }
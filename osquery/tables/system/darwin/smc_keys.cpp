@@ -9,6 +9,7 @@
  */
 
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 
 #include <IOKit/IOKitLib.h>
@@ -269,7 +270,7 @@ class SMCHelper : private boost::noncopyable {
   /// Read a given SMC key into an output parameter value.
   bool read(const std::string &key, SMCValue_t *val) const;
 
-  /// Read all keys (a service API call) into a string vector.
+  /// Read all keys (a service API call per key), enumerated once.
   std::vector<std::string> getKeys() const;
 
  private:
@@ -281,6 +282,9 @@ class SMCHelper : private boost::noncopyable {
   /// Read the size of the internal SMC key structure.
   size_t getKeysCount() const;
 
+  /// Read the type and size of a key, kept for the life of the process.
+  bool getKeyInfo(UInt32 key, SMCKeyDataKeyInfo_t &info) const;
+
  private:
   /// IOKit master port.
   mach_port_t master_port_{0};
@@ -331,6 +335,38 @@ kern_return_t SMCHelper::call(uint32_t selector,
       connection_, selector, in, in_size, out, &out_size);
 }
 
+/// The SMC key infos, keys do not change type or size until a reboot.
+static std::map<UInt32, SMCKeyDataKeyInfo_t> kSMCKeyInfos;
+static std::mutex kSMCKeyInfosMutex;
+
+bool SMCHelper::getKeyInfo(UInt32 key, SMCKeyDataKeyInfo_t &info) const {
+  {
+    std::lock_guard<std::mutex> lock(kSMCKeyInfosMutex);
+    auto cached = kSMCKeyInfos.find(key);
+    if (cached != kSMCKeyInfos.end()) {
+      info = cached->second;
+      return true;
+    }
+  }
+
+  SMCKeyData_t in;
+  SMCKeyData_t out;
+  memset(&in, 0, sizeof(SMCKeyData_t));
+  memset(&out, 0, sizeof(SMCKeyData_t));
+  in.key = key;
+  in.data8 = SMCCMDType::READ_KEYINFO;
+
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
+  if (result != kIOReturnSuccess) {
+    return false;
+  }
+
+  info = out.keyInfo;
+  std::lock_guard<std::mutex> lock(kSMCKeyInfosMutex);
+  kSMCKeyInfos[key] = info;
+  return true;
+}
+
 inline uint32_t strtoul(const char *str, size_t size, size_t base) {
   uint32_t total = 0;
   for (size_t i = 0; i < size; i++) {
@@ -355,17 +391,11 @@ inline float strtof(const char *str, size_t size, size_t e) {
   return total;
 }
 
-float getConvertedValue(const std::string &smcType,
-                        const std::string &smcVal) {
-  // Convert hex string to decimal.
-  std::string val;
-  try {
-    val = boost::algorithm::unhex(smcVal);
-  } catch (const boost::algorithm::hex_decode_error &e) {
-    return -1.0;
-  }
-
-  if (val.size() < 2) {
+/// Decode the bytes of a numeric SMC value, -1 if the type is not numeric.
+float decodeSMCValue(const std::string &smcType,
+                     const char *val,
+                     size_t size) {
+  if (size < 2) {
     return -1.0;
   }
 
@@ -381,6 +411,19 @@ float getConvertedValue(const std::string &smcType,
   return convertedVal;
 }
 
+float getConvertedValue(const std::string &smcType,
+                        const std::string &smcVal) {
+  // Convert hex string to decimal.
+  std::string val;
+  try {
+    val = boost::algorithm::unhex(smcVal);
+  } catch (const boost::algorithm::hex_decode_error &e) {
+    return -1.0;
+  }
+
+  return decodeSMCValue(smcType, val.data(), val.size());
+}
+
 bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
   SMCKeyData_t in;
   SMCKeyData_t out;
@@ -389,24 +432,28 @@ bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
   memset(&out, 0, sizeof(SMCKeyData_t));
   memset(val, 0, sizeof(SMCValue_t));
 
+  if (key.size() != 4) {
+    return false;
+  }
+
   in.key = strtoul(key.c_str(), 4, 16);
   memcpy(val->key.bytes, key.c_str(), 4);
-  in.data8 = SMCCMDType::READ_KEYINFO;
 
-  auto result = call(KERNEL_INDEX_SMC, &in, &out);
-  if (result != kIOReturnSuccess) {
+  // Only the first read of a key asks for its type and size.
+  SMCKeyDataKeyInfo_t info;
+  if (!getKeyInfo(in.key, info)) {
     return false;
   }
 
-  val->dataSize = out.keyInfo.dataSize;
-  val->dataType.bytes[0] = (uint32_t)out.keyInfo.dataType >> 24;
-  val->dataType.bytes[1] = (uint32_t)out.keyInfo.dataType >> 16;
-  val->dataType.bytes[2] = (uint32_t)out.keyInfo.dataType >> 8;
-  val->dataType.bytes[3] = (uint32_t)out.keyInfo.dataType;
+  val->dataSize = info.dataSize;
+  val->dataType.bytes[0] = (uint32_t)info.dataType >> 24;
+  val->dataType.bytes[1] = (uint32_t)info.dataType >> 16;
+  val->dataType.bytes[2] = (uint32_t)info.dataType >> 8;
+  val->dataType.bytes[3] = (uint32_t)info.dataType;
   in.keyInfo.dataSize = val->dataSize;
   in.data8 = SMCCMDType::READ_BYTES;
 
-  result = call(KERNEL_INDEX_SMC, &in, &out);
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
   if (result != kIOReturnSuccess) {
     return false;
   }
@@ -422,7 +469,14 @@ size_t SMCHelper::getKeysCount() const {
 }
 
 std::vector<std::string> SMCHelper::getKeys() const {
-  std::vector<std::string> keys;
+  // The key index is fixed until a reboot, enumerate it once.
+  static std::vector<std::string> keys;
+  static std::mutex keys_mutex;
+  std::lock_guard<std::mutex> lock(keys_mutex);
+  if (!keys.empty()) {
+    return keys;
+  }
+
   size_t totalKeys = getKeysCount();
   for (size_t i = 0; i < totalKeys; i++) {
     SMCKeyData_t in;
@@ -476,6 +530,17 @@ void genSMCKey(const std::string &key,
   results.push_back(r);
 }
 
+/// Read and decode a numeric SMC key, without formatting its bytes as hex.
+bool readSMCNumber(const SMCHelper &smc, const std::string &key, float &value) {
+  SMCValue_t val;
+  if (!smc.read(key, &val) || val.dataSize == 0) {
+    return false;
+  }
+
+  value = decodeSMCValue(val.dataType.bytes, val.bytes.bytes, val.dataSize);
+  return true;
+}
+
 QueryData genSMCKeys(QueryContext &context) {
   QueryData results;
 
@@ -509,18 +574,13 @@ QueryData genSMCKeys(QueryContext &context) {
   return results;
 }
 
-void genTemperature(const Row &row,
+void genTemperature(const std::string &key,
+                    float celsiusValue,
                     QueryData &results) {
-  auto &smcRow = row;
-  if (smcRow.at("value").empty()) {
-    return;
-  }
-
   Row r;
-  r["key"] = smcRow.at("key");
-  r["name"] = kSMCKeyDescriptions.at(smcRow.at("key"));
+  r["key"] = key;
+  r["name"] = kSMCKeyDescriptions.at(key);
 
-  float celsiusValue = getConvertedValue(smcRow.at("type"), smcRow.at("value"));
   float fahrenheitValue = (celsiusValue * (9.0 / 5.0)) + 32;
 
   std::stringstream buff;
@@ -533,6 +593,18 @@ void genTemperature(const Row &row,
   results.push_back(r);
 }
 
+void genTemperature(const Row &row,
+                    QueryData &results) {
+  auto &smcRow = row;
+  if (smcRow.at("value").empty()) {
+    return;
+  }
+
+  genTemperature(smcRow.at("key"),
+                 getConvertedValue(smcRow.at("type"), smcRow.at("value")),
+                 results);
+}
+
 QueryData getTemperatures(QueryContext &context) {
   QueryData results;
 
@@ -545,21 +617,18 @@ QueryData getTemperatures(QueryContext &context) {
     context.forEachConstraint("key",
                               EQUALS,
                               ([&smc, &results](const std::string &expr) {
-                                if (kSMCTemperatureKeys.count(expr) > 0) {
-                                  QueryData key_data;
-                                  genSMCKey(expr, smc, key_data);
-                                  if (!key_data.empty()) {
-                                    genTemperature(key_data.back(), results);
-                                  }
+                                float value = 0;
+                                if (kSMCTemperatureKeys.count(expr) > 0 &&
+                                    readSMCNumber(smc, expr, value)) {
+                                  genTemperature(expr, value, results);
                                 }
                               }));
   } else {
     // Perform a full scan of temperature keys.
     for (const auto &smcTempKey : kSMCTemperatureKeys) {
-      QueryData key_data;
-      genSMCKey(smcTempKey, smc, key_data);
-      if (!key_data.empty()) {
-        genTemperature(key_data.back(), results);
+      float value = 0;
+      if (readSMCNumber(smc, smcTempKey, value)) {
+        genTemperature(smcTempKey, value, results);
       }
     }
   }
@@ -567,18 +636,13 @@ QueryData getTemperatures(QueryContext &context) {
   return results;
 }
 
-void genVoltage(const Row &row,
-                QueryData &results) {
-  auto &smcRow = row;
-  if (smcRow.at("value").empty()) {
-    return;
-  }
-
+/// Generate a voltage or current row from a decoded value.
+void genSMCMeasurement(const std::string &key,
+                       float value,
+                       QueryData &results) {
   Row r;
-  r["key"] = smcRow.at("key");
-  r["name"] = kSMCKeyDescriptions.at(smcRow.at("key"));
-
-  float value = getConvertedValue(smcRow.at("type"), smcRow.at("value"));
+  r["key"] = key;
+  r["name"] = kSMCKeyDescriptions.at(key);
 
   std::stringstream buff;
   buff << std::fixed << std::setprecision(2) << value;
@@ -587,6 +651,18 @@ void genVoltage(const Row &row,
   results.push_back(r);
 }
 
+void genVoltage(const Row &row,
+                QueryData &results) {
+  auto &smcRow = row;
+  if (smcRow.at("value").empty()) {
+    return;
+  }
+
+  genSMCMeasurement(smcRow.at("key"),
+                    getConvertedValue(smcRow.at("type"), smcRow.at("value")),
+                    results);
+}
+
 QueryData getVoltages(QueryContext &context) {
   QueryData results;
 
@@ -599,21 +675,18 @@ QueryData getVoltages(QueryContext &context) {
     context.forEachConstraint("key",
                               EQUALS,
                               ([&smc, &results](const std::string &expr) {
-                                if (kSMCVoltageKeys.count(expr) > 0) {
-                                  QueryData key_data;
-                                  genSMCKey(expr, smc, key_data);
-                                  if (!key_data.empty()) {
-                                    genVoltage(key_data.back(), results);
-                                  }
+                                float value = 0;
+                                if (kSMCVoltageKeys.count(expr) > 0 &&
+                                    readSMCNumber(smc, expr, value)) {
+                                  genSMCMeasurement(expr, value, results);
                                 }
                               }));
   } else {
     // Perform a full scan of voltage keys.
     for (const auto &smcVoltageKey : kSMCVoltageKeys) {
-      QueryData key_data;
-      genSMCKey(smcVoltageKey, smc, key_data);
-      if (!key_data.empty()) {
-        genVoltage(key_data.back(), results);
+      float value = 0;
+      if (readSMCNumber(smc, smcVoltageKey, value)) {
+        genSMCMeasurement(smcVoltageKey, value, results);
       }
     }
   }
@@ -628,17 +701,9 @@ void genCurrent(const Row &row,
     return;
   }
 
-  Row r;
-  r["key"] = smcRow.at("key");
-  r["name"] = kSMCKeyDescriptions.at(smcRow.at("key"));
-
-  float value = getConvertedValue(smcRow.at("type"), smcRow.at("value"));
-
-  std::stringstream buff;
-  buff << std::fixed << std::setprecision(2) << value;
-  r["value"] = buff.str();
-
-  results.push_back(r);
+  genSMCMeasurement(smcRow.at("key"),
+                    getConvertedValue(smcRow.at("type"), smcRow.at("value")),
+                    results);
 }
 
 QueryData getCurrents(QueryContext &context) {
@@ -653,21 +718,18 @@ QueryData getCurrents(QueryContext &context) {
     context.forEachConstraint("key",
                               EQUALS,
                               ([&smc, &results](const std::string &expr) {
-                                if (kSMCCurrentKeys.count(expr) > 0) {
-                                  QueryData key_data;
-                                  genSMCKey(expr, smc, key_data);
-                                  if (!key_data.empty()) {
-                                    genCurrent(key_data.back(), results);
-                                  }
+                                float value = 0;
+                                if (kSMCCurrentKeys.count(expr) > 0 &&
+                                    readSMCNumber(smc, expr, value)) {
+                                  genSMCMeasurement(expr, value, results);
                                 }
                               }));
   } else {
     // Perform a full scan of current keys.
     for (const auto &smcCurrentKey : kSMCCurrentKeys) {
-      QueryData key_data;
-      genSMCKey(smcCurrentKey, smc, key_data);
-      if (!key_data.empty()) {
-        genCurrent(key_data.back(), results);
+      float value = 0;
+      if (readSMCNumber(smc, smcCurrentKey, value)) {
+        genSMCMeasurement(smcCurrentKey, value, results);
       }
     }
   }
@@ -684,20 +746,14 @@ QueryData getFanSpeeds(QueryContext &context) {
   }
 
   // Get number of fans.
-  QueryData key_data;
-  genSMCKey("FNum", smc, key_data);
-  if (key_data.empty()) {
+  SMCValue_t fans;
+  if (!smc.read("FNum", &fans) || fans.dataSize == 0) {
     // The SMC search for key information failed.
     return results;
   }
 
-  auto &smcRow = key_data.back();
-  if (smcRow["value"].empty()) {
-    return results;
-  }
-
   // Get attributes for each fan.
-  int numFans = std::stoi(smcRow["value"]);
+  int numFans = strtoul(fans.bytes.bytes, fans.dataSize, 10);
   for (int fanIdx = 0; fanIdx < numFans; fanIdx++) {
     Row r;
     r["fan"] = std::to_string(fanIdx);
@@ -708,19 +764,10 @@ QueryData getFanSpeeds(QueryContext &context) {
       std::stringstream key;
       key << boost::format(smcFanSpeedKey.first) % fanIdx;
 
-      QueryData key_data;
-      genSMCKey(key.str(), smc, key_data);
-      if (key_data.empty()) {
-        continue;
+      float fanSpeed = 0;
+      if (readSMCNumber(smc, key.str(), fanSpeed)) {
+        r[smcFanSpeedKey.second] = INTEGER(fanSpeed);
       }
-
-      auto &smcRow = key_data.back();
-      if (smcRow["value"].empty()) {
-        continue;
-      }
-
-      float fanSpeed = getConvertedValue(smcRow["type"], smcRow["value"]);
-      r[smcFanSpeedKey.second] = INTEGER(fanSpeed);
     }
 
     results.push_back(r);
@@ -10,11 +10,14 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <Foundation/Foundation.h>
+#include <Security/CodeSigning.h>
 #include <gtest/gtest.h>
 #include <boost/filesystem/operations.hpp>
 #include <boost/make_unique.hpp>
 #include <mach-o/dyld.h>
 
+#include <osquery/filesystem.h>
+
 #include "osquery/core/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -23,6 +26,7 @@ namespace osquery {
 namespace tables {
 
 void genSignatureForFile(const std::string& path, QueryData& results);
+std::string getSignatureCacheKey(const std::string& path, SecCSFlags flags);
 
 // Gets the full path to the current executable (only works on Darwin)
 std::string getExecutablePath() {
@@ -157,6 +161,25 @@ TEST_F(SignatureTest, test_get_invalid_signature) {
   }
 }
 
+TEST_F(SignatureTest, test_signature_cache_key) {
+  EXPECT_TRUE(getSignatureCacheKey(tempFile, 0).empty());
+
+  writeTextFile(tempFile, "unsigned");
+  auto key = getSignatureCacheKey(tempFile, 0);
+  EXPECT_FALSE(key.empty());
+  EXPECT_EQ(key, getSignatureCacheKey(tempFile, 0));
+  EXPECT_NE(key, getSignatureCacheKey(tempFile, kSecCSStrictValidate));
+
+  // A rewrite changes the size, an unchanged file reuses the cached result.
+  writeTextFile(tempFile, "still unsigned");
+  EXPECT_NE(key, getSignatureCacheKey(tempFile, 0));
+
+  QueryData first;
+  QueryData second;
+  genSignatureForFile("/bin/ls", first);
+  genSignatureForFile("/bin/ls", second);
+  ASSERT_EQ(first.size(), 1U);
+  EXPECT_EQ(first, second);
+}
 }
 }
-
@@ -24,6 +24,11 @@ void genVoltage(const Row &row,
                 QueryData &results);
 void genCurrent(const Row &row,
                 QueryData &results);
+float decodeSMCValue(const std::string &smcType,
+                     const char *val,
+                     size_t size);
+float getConvertedValue(const std::string &smcType,
+                        const std::string &smcVal);
 
 class SmcTests : public testing::Test {};
 
@@ -103,5 +108,18 @@ TEST_F(SmcTests, test_gen_current) {
   }
 }
 
+TEST_F(SmcTests, test_decode_value) {
+  // Typed decoding of the key bytes matches decoding the hex value.
+  const char temperature[] = {0x3d, (char)0xd0};
+  EXPECT_EQ(getConvertedValue("sp78", "3dd0"),
+            decodeSMCValue("sp78", temperature, 2));
+  const char fan[] = {0x1f, 0x40};
+  EXPECT_EQ(2000.0, decodeSMCValue("fpe2", fan, 2));
+  EXPECT_EQ(getConvertedValue("fpe2", "1f40"), decodeSMCValue("fpe2", fan, 2));
+
+  // Values without a numeric type or too short are not decoded.
+  EXPECT_EQ(-1.0, decodeSMCValue("ui8", fan, 2));
+  EXPECT_EQ(-1.0, decodeSMCValue("sp78", fan, 1));
+}
 }
 }
@@ -17,71 +17,67 @@
 namespace osquery {
 namespace tables {
 
-void genUSBDevice(const io_service_t& device, QueryData& results) {
+void genUSBDevice(const io_service_t& device,
+                  const QueryContext& context,
+                  QueryData& results) {
   Row r;
 
-  // Get the device details
-  CFMutableDictionaryRef details;
-  IORegistryEntryCreateCFProperties(
-      device, &details, kCFAllocatorDefault, kNilOptions);
+  // Devices without a Vendor and Model ID are skipped, read those first.
+  // On OS X 10.11 the simulation hubs are PCI devices within IOKit and
+  // lack the useful USB metadata.
+  r["model_id"] = getIOKitEntryProperty(device, "idProduct");
+  r["vendor_id"] = getIOKitEntryProperty(device, "idVendor");
+  if (r.at("vendor_id").size() == 0 || r.at("model_id").size() == 0) {
+    return;
+  }
+  idToHex(r["vendor_id"]);
+  idToHex(r["model_id"]);
 
-  r["usb_address"] = getIOKitProperty(details, "USB Address");
-  r["usb_port"] = getIOKitProperty(details, "PortNum");
+  // Copy only the device details used, not every property.
+  if (context.isColumnUsed("usb_address")) {
+    r["usb_address"] = getIOKitEntryProperty(device, "USB Address");
+  }
+  if (context.isColumnUsed("usb_port")) {
+    r["usb_port"] = getIOKitEntryProperty(device, "PortNum");
+  }
 
-  r["model"] = getIOKitProperty(details, "USB Product Name");
-  if (r.at("model").size() == 0) {
-    // Could not find the model name from IOKit, use the label.
-    io_name_t name;
-    if (IORegistryEntryGetName(device, name) == KERN_SUCCESS) {
-      r["model"] = std::string(name);
+  if (context.isColumnUsed("model")) {
+    r["model"] = getIOKitEntryProperty(device, "USB Product Name");
+    if (r.at("model").size() == 0) {
+      // Could not find the model name from IOKit, use the label.
+      io_name_t name;
+      if (IORegistryEntryGetName(device, name) == KERN_SUCCESS) {
+        r["model"] = std::string(name);
+      }
     }
   }
 
-  r["model_id"] = getIOKitProperty(details, "idProduct");
-  r["vendor"] = getIOKitProperty(details, "USB Vendor Name");
-  r["vendor_id"] = getIOKitProperty(details, "idVendor");
-
-  r["serial"] = getIOKitProperty(details, "USB Serial Number");
-  if (r.at("serial").size() == 0) {
-    r["serial"] = getIOKitProperty(details, "iSerialNumber");
+  if (context.isColumnUsed("vendor")) {
+    r["vendor"] = getIOKitEntryProperty(device, "USB Vendor Name");
   }
 
-  auto non_removable = getIOKitProperty(details, "non-removable");
-  r["removable"] = (non_removable == "yes") ? "0" : "1";
+  if (context.isColumnUsed("serial")) {
+    r["serial"] = getIOKitEntryProperty(device, "USB Serial Number");
+    if (r.at("serial").size() == 0) {
+      r["serial"] = getIOKitEntryProperty(device, "iSerialNumber");
+    }
+  }
 
-  if (r.at("vendor_id").size() > 0 && r.at("model_id").size() > 0) {
-    // Only add the USB device on OS X if it contains a Vendor and Model ID.
-    // On OS X 10.11 the simulation hubs are PCI devices within IOKit and
-    // lack the useful USB metadata.
-    idToHex(r["vendor_id"]);
-    idToHex(r["model_id"]);
-    results.push_back(r);
+  if (context.isColumnUsed("removable")) {
+    auto non_removable = getIOKitEntryProperty(device, "non-removable");
+    r["removable"] = (non_removable == "yes") ? "0" : "1";
   }
-  CFRelease(details);
+
+  results.push_back(r);
 }
 
 QueryData genUSBDevices(QueryContext& context) {
   QueryData results;
 
   auto matching = IOServiceMatching(kIOUSBDeviceClassName);
-  if (matching == nullptr) {
-    // No devices matched USB, very odd.
-    return results;
-  }
-
-  io_iterator_t it;
-  auto kr = IOServiceGetMatchingServices(kIOMasterPortDefault, matching, &it);
-  if (kr != KERN_SUCCESS) {
-    return results;
-  }
-
-  io_service_t device;
-  while ((device = IOIteratorNext(it))) {
-    genUSBDevice(device, results);
-    IOObjectRelease(device);
-  }
-
-  IOObjectRelease(it);
+  forEachIOKitMatch(matching, [&context, &results](const io_service_t& device) {
+    genUSBDevice(device, context, results);
+  });
   return results;
 }
 }
@@ -25,51 +25,30 @@
 namespace osquery {
 namespace tables {
 
-void genDescriptors(struct procstat* pstat,
+void genDescriptors(ProcstatSnapshot& snapshot,
                     struct kinfo_proc* proc,
                     QueryData& results) {
-
-  Row r;
-  struct filestat_list* files = nullptr;
-  struct filestat* file = nullptr;
-
-  files = procstat_getfiles(pstat, proc, 0);
-  if (files == nullptr) {
-    return;
-  }
-
-  STAILQ_FOREACH(file, files, next) {
+  for (const auto& file : snapshot.getFiles(proc)) {
     // Skip files that aren't "open" (no fd).
-    if (file->fs_fd == -1) {
+    if (file.fd == -1) {
       continue;
     }
 
+    Row r;
     r["pid"] = INTEGER(proc->ki_pid);
-    if (file->fs_path == nullptr) {
-      r["path"] = TEXT("");
-    } else {
-      r["path"] = TEXT(file->fs_path);
-    }
-    r["fd"] = BIGINT(file->fs_fd);
-
+    r["path"] = TEXT(file.path);
+    r["fd"] = BIGINT(file.fd);
     results.push_back(r);
   }
-
-  procstat_freefiles(pstat, files);
 }
 
 QueryData genOpenFiles(QueryContext& context) {
   QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
 
-  auto cnt = getProcesses(context, &pstat, &procs);
-
-  for (size_t i = 0; i < cnt; i++) {
-    genDescriptors(pstat, &procs[i], results);
+  auto snapshot = ProcstatSnapshot::current();
+  for (auto proc : snapshot->select(context)) {
+    genDescriptors(*snapshot, proc, results);
   }
-
-  procstatCleanup(pstat, procs);
   return results;
 }
 }
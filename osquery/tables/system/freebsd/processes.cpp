@@ -30,46 +30,37 @@
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/tables/system/freebsd/procstat.h"
 
 namespace osquery {
 namespace tables {
 
-void genProcessEnvironment(struct procstat* pstat,
+void genProcessEnvironment(ProcstatSnapshot& snapshot,
                            struct kinfo_proc* proc,
                            QueryData& results) {
-  char** envs;
-  unsigned int i;
-
-  envs = procstat_getenvv(pstat, proc, 0);
-  if (envs != nullptr) {
-    for (i = 0; envs[i] != NULL; i++) {
-      Row r;
-      size_t idx;
-      std::string buf = std::string(envs[i]);
-
-      r["pid"] = INTEGER(proc->ki_pid);
-
-      idx = buf.find_first_of("=");
-      r["key"] = buf.substr(0, idx);
-      r["value"] = buf.substr(idx + 1);
-      results.push_back(r);
-    }
-
-    procstat_freeenvv(pstat);
+  for (const auto& env : snapshot.getEnvironment(proc)) {
+    Row r;
+    r["pid"] = INTEGER(proc->ki_pid);
+
+    auto idx = env.find_first_of("=");
+    r["key"] = env.substr(0, idx);
+    r["value"] = (idx != std::string::npos) ? env.substr(idx + 1) : "";
+    results.push_back(r);
   }
 }
 
-void genProcessMap(struct procstat* pstat,
+void genProcessMap(ProcstatSnapshot& snapshot,
                    struct kinfo_proc* proc,
                    QueryData& results) {
-  struct kinfo_vmentry* vmentry;
-  unsigned int i;
-  unsigned int cnt = 0;
+  snapshot.use([proc, &results](struct procstat* pstat) {
+    unsigned int cnt = 0;
+    auto vmentry = procstat_getvmmap(pstat, proc, &cnt);
+    if (vmentry == nullptr) {
+      return;
+    }
 
-  vmentry = procstat_getvmmap(pstat, proc, &cnt);
-  if (vmentry != nullptr) {
-    for (i = 0; i < cnt; i++) {
+    for (unsigned int i = 0; i < cnt; i++) {
       Row r;
 
       r["pid"] = INTEGER(proc->ki_pid);
@@ -104,22 +95,14 @@ void genProcessMap(struct procstat* pstat,
     }
 
     procstat_freevmmap(pstat, vmentry);
-  }
+  });
 }
 
-void genProcess(struct procstat* pstat,
+void genProcess(ProcstatSnapshot& snapshot,
                 struct kinfo_proc* proc,
+                const QueryContext& context,
                 QueryData& results) {
   Row r;
-  static char path[PATH_MAX];
-  char** args;
-  struct filestat_list* files = nullptr;
-  struct filestat* file = nullptr;
-  struct kinfo_vmentry* vmentry = nullptr;
-  unsigned int i;
-  unsigned int cnt = 0;
-  unsigned int pages = 0;
-
   r["pid"] = INTEGER(proc->ki_pid);
   r["parent"] = INTEGER(proc->ki_ppid);
   r["name"] = TEXT(proc->ki_comm);
@@ -128,55 +111,37 @@ void genProcess(struct procstat* pstat,
   r["gid"] = INTEGER(proc->ki_rgid);
   r["egid"] = INTEGER(proc->ki_groups[0]);
 
-  if (procstat_getpathname(pstat, proc, path, sizeof(path)) == 0) {
-    r["path"] = TEXT(path);
-    // If the path of the executable that started the process is available and
-    // the path exists on disk, set on_disk to 1. If the path is not
-    // available, set on_disk to -1. If, and only if, the path of the
-    // executable is available and the file does NOT exist on disk, set on_disk
-    // to 0.
-    r["on_disk"] = TEXT(osquery::pathExists(r["path"]).toString());
-  }
-
-  args = procstat_getargv(pstat, proc, 0);
-  if (args != nullptr) {
-    for (i = 0; args[i] != NULL; i++) {
-      r["cmdline"] += TEXT(args[i]);
-      // Need to add spaces between arguments, except last one.
-      if (args[i + 1] != NULL) {
-        r["cmdline"] += TEXT(" ");
-      }
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    auto path = snapshot.getPath(proc);
+    if (!path.empty()) {
+      r["path"] = TEXT(path);
+      // If the path of the executable that started the process is available
+      // and the path exists on disk, set on_disk to 1. If the path is not
+      // available, set on_disk to -1. If, and only if, the path of the
+      // executable is available and the file does NOT exist on disk, set
+      // on_disk to 0.
+      r["on_disk"] = TEXT(osquery::pathExists(r["path"]).toString());
     }
+  }
 
-    procstat_freeargv(pstat);
+  if (context.isColumnUsed("cmdline")) {
+    // Arguments are separated by spaces.
+    r["cmdline"] = osquery::join(snapshot.getArguments(proc), " ");
   }
 
-  files = procstat_getfiles(pstat, proc, 0);
-  if (files != nullptr) {
-    STAILQ_FOREACH(file, files, next) {
-      if (file->fs_uflags & PS_FST_UFLAG_CDIR) {
-        r["cwd"] = TEXT(file->fs_path);
-      }
-      else if (file->fs_uflags & PS_FST_UFLAG_RDIR) {
-        r["root"] = TEXT(file->fs_path);
+  if (context.isAnyColumnUsed({"cwd", "root"})) {
+    for (const auto& file : snapshot.getFiles(proc)) {
+      if (file.uflags & PS_FST_UFLAG_CDIR) {
+        r["cwd"] = TEXT(file.path);
+      } else if (file.uflags & PS_FST_UFLAG_RDIR) {
+        r["root"] = TEXT(file.path);
       }
     }
-
-    procstat_freefiles(pstat, files);
   }
 
-  vmentry = procstat_getvmmap(pstat, proc, &cnt);
-  if (vmentry != nullptr) {
-    // Add up all the resident pages for each vmmap entry.
-    for (i = 0; i < cnt; i++) {
-      pages += vmentry[i].kve_resident;
-    }
-
-    // The column is in bytes.
-    r["resident_size"] += INTEGER(pages * getpagesize());
-
-    procstat_freevmmap(pstat, vmentry);
-  }
+  // The kernel reports the resident pages of the process's address space.
+  r["resident_size"] = BIGINT(static_cast<unsigned long long>(proc->ki_rssize) *
+                              getpagesize());
 
   // XXX: Not sure how to get these on FreeBSD yet.
   r["wired_size"] = INTEGER("0");
@@ -191,46 +156,31 @@ void genProcess(struct procstat* pstat,
 
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
-
-  auto cnt = getProcesses(context, &pstat, &procs);
 
-  for (size_t i = 0; i < cnt; i++) {
-    genProcess(pstat, &procs[i], results);
+  auto snapshot = ProcstatSnapshot::current();
+  for (auto proc : snapshot->select(context)) {
+    genProcess(*snapshot, proc, context, results);
   }
-
-  procstatCleanup(pstat, procs);
   return results;
 }
 
 QueryData genProcessEnvs(QueryContext& context) {
   QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
-
-  auto cnt = getProcesses(context, &pstat, &procs);
 
-  for (size_t i = 0; i < cnt; i++) {
-    genProcessEnvironment(pstat, &procs[i], results);
+  auto snapshot = ProcstatSnapshot::current();
+  for (auto proc : snapshot->select(context)) {
+    genProcessEnvironment(*snapshot, proc, results);
   }
-
-  procstatCleanup(pstat, procs);
   return results;
 }
 
 QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
-
-  auto cnt = getProcesses(context, &pstat, &procs);
 
-  for (size_t i = 0; i < cnt; i++) {
-    genProcessMap(pstat, &procs[i], results);
+  auto snapshot = ProcstatSnapshot::current();
+  for (auto proc : snapshot->select(context)) {
+    genProcessMap(*snapshot, proc, results);
   }
-
-  procstatCleanup(pstat, procs);
   return results;
 }
 }
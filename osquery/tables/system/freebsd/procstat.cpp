@@ -8,6 +8,7 @@
  *
  */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -16,77 +17,169 @@
 #include <sys/queue.h>
 #include <libprocstat.h>
 
-#include <osquery/tables.h>
+#include <osquery/core.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/system/freebsd/procstat.h"
 
 namespace osquery {
 namespace tables {
 
-/**
- * A helper function to retrieve processes using libprocstat(3). It is the
- * responsibility of the caller to call procstat_freeprocs() and
- * procstat_close() when done.
- *
- * Returns the number of processes in the "procs" list. On failure, returns 0
- * and sets pstat and procs to NULL.
- *
- * Errors are not well exposed in some of the calls in libprocstat(3). This is
- * a bit of a bummer as libkvm(3) is much better in that respect but I would
- * rather use libprocstat(3) as it provides a nicer abstraction.
- */
-unsigned int getProcesses(QueryContext& context,
-                          struct procstat** pstat,
-                          struct kinfo_proc** procs) {
-  std::set<std::string> pids;
-  unsigned int cnt = 0;
-
-  *pstat = procstat_open_sysctl();
-  if (*pstat == nullptr) {
-    TLOG << "Problem in procstat_open_sysctl()";
-    return 0;
+/// Seconds a process snapshot is shared, the scheduler steps every second.
+const size_t kProcstatSnapshotTTL = 1;
+
+/// The snapshot shared by process tables.
+static std::shared_ptr<ProcstatSnapshot> kProcstatSnapshot;
+static std::mutex kProcstatSnapshotMutex;
+
+/// The libprocstat handle, opened once and used under its mutex.
+static struct procstat* kProcstat{nullptr};
+static std::recursive_mutex kProcstatMutex;
+
+/// Open the shared handle if needed, the caller holds its mutex.
+static struct procstat* getProcstat() {
+  if (kProcstat == nullptr) {
+    kProcstat = procstat_open_sysctl();
+    if (kProcstat == nullptr) {
+      TLOG << "Problem in procstat_open_sysctl()";
+    }
+  }
+  return kProcstat;
+}
+
+std::shared_ptr<ProcstatSnapshot> ProcstatSnapshot::current() {
+  std::lock_guard<std::mutex> lock(kProcstatSnapshotMutex);
+  if (kProcstatSnapshot == nullptr ||
+      getUnixTime() >= kProcstatSnapshot->time_ + kProcstatSnapshotTTL) {
+    kProcstatSnapshot = std::make_shared<ProcstatSnapshot>();
+  }
+  return kProcstatSnapshot;
+}
+
+ProcstatSnapshot::ProcstatSnapshot() : time_(getUnixTime()) {
+  std::lock_guard<std::recursive_mutex> lock(kProcstatMutex);
+  auto pstat = getProcstat();
+  if (pstat == nullptr) {
+    return;
+  }
+
+  procs_ = procstat_getprocs(pstat, KERN_PROC_PROC, 0, &count_);
+  if (procs_ == nullptr) {
+    TLOG << "Problem retrieving processes.";
+    count_ = 0;
   }
+}
+
+ProcstatSnapshot::~ProcstatSnapshot() {
+  if (procs_ != nullptr) {
+    std::lock_guard<std::recursive_mutex> lock(kProcstatMutex);
+    procstat_freeprocs(kProcstat, procs_);
+  }
+}
 
+std::vector<struct kinfo_proc*> ProcstatSnapshot::select(
+    QueryContext& context) {
+  std::vector<struct kinfo_proc*> procs;
   if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-
-    // Generate data for all pids in the vector.
-    // If there are comparison constraints this could apply the operator
-    // before generating the process structure.
-    for (const auto& pid : pids) {
-      *procs = procstat_getprocs(*pstat, KERN_PROC_PID, std::stoi(pid), &cnt);
-      if (*procs == nullptr) {
-        TLOG << "Problem retrieving processes.";
-        procstat_close(*pstat);
-        *pstat = nullptr;
-        return 0;
+    // Generate data for the processes in the snapshot with a requested pid.
+    auto pids = context.constraints["pid"].getAll(EQUALS);
+    for (unsigned int i = 0; i < count_; i++) {
+      if (pids.count(std::to_string(procs_[i].ki_pid)) > 0) {
+        procs.push_back(&procs_[i]);
       }
     }
-  } else {
-    // Get all PIDS.
-    *procs = procstat_getprocs(*pstat, KERN_PROC_PROC, 0, &cnt);
-    if (*procs == nullptr) {
-      TLOG << "Problem retrieving processes.";
-      procstat_close(*pstat);
-      *pstat = nullptr;
-      return 0;
-    }
+    return procs;
   }
 
-  return cnt;
-}
-
-/**
- * Helper function to cleanup the libprocstat(3) pointers used.
- */
-void procstatCleanup(struct procstat* pstat, struct kinfo_proc* procs) {
-  if (procs != nullptr) {
-    procstat_freeprocs(pstat, procs);
+  procs.reserve(count_);
+  for (unsigned int i = 0; i < count_; i++) {
+    procs.push_back(&procs_[i]);
   }
+  return procs;
+}
 
+void ProcstatSnapshot::use(const std::function<void(struct procstat*)>& call) {
+  std::lock_guard<std::recursive_mutex> lock(kProcstatMutex);
+  auto pstat = getProcstat();
   if (pstat != nullptr) {
-    procstat_close(pstat);
+    call(pstat);
   }
 }
 
+std::string ProcstatSnapshot::getPath(struct kinfo_proc* proc) {
+  std::string path;
+  use([proc, &path](struct procstat* pstat) {
+    char buffer[PATH_MAX] = {0};
+    if (procstat_getpathname(pstat, proc, buffer, sizeof(buffer)) == 0) {
+      path = buffer;
+    }
+  });
+  return path;
+}
+
+std::vector<std::string> ProcstatSnapshot::getArguments(
+    struct kinfo_proc* proc) {
+  std::vector<std::string> arguments;
+  use([proc, &arguments](struct procstat* pstat) {
+    auto args = procstat_getargv(pstat, proc, 0);
+    if (args != nullptr) {
+      for (size_t i = 0; args[i] != nullptr; i++) {
+        arguments.push_back(args[i]);
+      }
+      procstat_freeargv(pstat);
+    }
+  });
+  return arguments;
+}
+
+std::vector<std::string> ProcstatSnapshot::getEnvironment(
+    struct kinfo_proc* proc) {
+  std::vector<std::string> environment;
+  use([proc, &environment](struct procstat* pstat) {
+    auto envs = procstat_getenvv(pstat, proc, 0);
+    if (envs != nullptr) {
+      for (size_t i = 0; envs[i] != nullptr; i++) {
+        environment.push_back(envs[i]);
+      }
+      procstat_freeenvv(pstat);
+    }
+  });
+  return environment;
+}
+
+const std::vector<ProcessFile>& ProcstatSnapshot::getFiles(
+    struct kinfo_proc* proc) {
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    auto files = files_.find(proc->ki_pid);
+    if (files != files_.end()) {
+      return files->second;
+    }
+  }
+
+  std::vector<ProcessFile> result;
+  use([proc, &result](struct procstat* pstat) {
+    auto files = procstat_getfiles(pstat, proc, 0);
+    if (files == nullptr) {
+      return;
+    }
+
+    struct filestat* file = nullptr;
+    STAILQ_FOREACH(file, files, next) {
+      ProcessFile process_file;
+      process_file.fd = file->fs_fd;
+      process_file.uflags = file->fs_uflags;
+      if (file->fs_path != nullptr) {
+        process_file.path = file->fs_path;
+      }
+      result.push_back(std::move(process_file));
+    }
+    procstat_freefiles(pstat, files);
+  });
+
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  return files_.emplace(proc->ki_pid, std::move(result)).first->second;
+}
 }
 }
@@ -14,16 +14,82 @@
 #include <sys/user.h>
 #include <libprocstat.h>
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/tables.h>
 
 namespace osquery {
 namespace tables {
 
-unsigned int getProcesses(QueryContext& context,
-                          struct procstat** pstat,
-                          struct kinfo_proc** procs);
+/// A file used by a process, from procstat_getfiles.
+struct ProcessFile {
+  /// The descriptor number, -1 for the cwd, root, text, or a mapping.
+  int fd{-1};
+
+  /// The PS_FST_UFLAG_* use of the file.
+  int uflags{0};
+
+  std::string path;
+};
+
+/**
+ * @brief A shared view of the process list and per-process details.
+ *
+ * Process tables generating in the same scheduler step share one
+ * KERN_PROC_PROC listing through ProcstatSnapshot::current. The arguments,
+ * environment, and files of a process are fetched from the kernel only when
+ * a table asks for them. Files are kept for the life of the snapshot, since
+ * processes and process_open_files both read them.
+ *
+ * Every snapshot uses one libprocstat handle, opened once for the process.
+ * libprocstat keeps the buffers of argument and environment vectors in the
+ * handle, so its use is serialized.
+ */
+class ProcstatSnapshot : private boost::noncopyable {
+ public:
+  /// Return the current snapshot, a new snapshot is taken every step.
+  static std::shared_ptr<ProcstatSnapshot> current();
+
+  /// Take a new snapshot of the current processes.
+  ProcstatSnapshot();
+  ~ProcstatSnapshot();
+
+  /// Select the processes matching the query's pid constraints.
+  std::vector<struct kinfo_proc*> select(QueryContext& context);
+
+  /// The path of the process's executable, empty if it cannot be read.
+  std::string getPath(struct kinfo_proc* proc);
+
+  /// The process arguments.
+  std::vector<std::string> getArguments(struct kinfo_proc* proc);
+
+  /// The process environment, as "key=value" strings.
+  std::vector<std::string> getEnvironment(struct kinfo_proc* proc);
+
+  /// The files used by the process, fetched once per snapshot.
+  const std::vector<ProcessFile>& getFiles(struct kinfo_proc* proc);
+
+  /// Call libprocstat with the shared handle, serialized with other users.
+  void use(const std::function<void(struct procstat*)>& call);
+
+ private:
+  /// The processes listed when the snapshot was taken.
+  struct kinfo_proc* procs_{nullptr};
+  unsigned int count_{0};
 
-void procstatCleanup(struct procstat* pstat, struct kinfo_proc* procs);
+  /// The time the snapshot was taken.
+  size_t time_{0};
 
+  /// The files of each process, by pid.
+  std::map<pid_t, std::vector<ProcessFile>> files_;
+  std::mutex files_mutex_;
+};
 }
 }
@@ -8,43 +8,225 @@
  *
  */
 
-#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utmpx.h>
 
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
 namespace tables {
 
+/// Copy a fixed-size record field that may not be terminated.
+template <size_t N>
+static std::string recordField(const char (&field)[N]) {
+  return std::string(field, strnlen(field, N));
+}
+
+static Row genRecordRow(const struct utmpx& ut) {
+  Row r;
+  r["username"] = recordField(ut.ut_user);
+  r["tty"] = recordField(ut.ut_line);
+  r["pid"] = INTEGER(ut.ut_pid);
+  r["type"] = INTEGER(ut.ut_type);
+  r["time"] = INTEGER(ut.ut_tv.tv_sec);
+  r["host"] = recordField(ut.ut_host);
+  return r;
+}
+
+#ifdef __linux__
+
+/// The login records files read by getutxent, the first that exists is read.
+const std::vector<std::string> kWtmpPaths = {"/var/log/wtmpx",
+                                             "/var/log/wtmp"};
+
+/// The login records read by each read of the file.
+const size_t kWtmpBlockRecords = 256;
+
+/**
+ * @brief An index of the login records file by time.
+ *
+ * Records are appended in time order, but the clock may move back. The index
+ * keeps the latest time of each record and all records before it, which is
+ * ordered, so the first record matching an earliest time is found with a
+ * binary search. Only records appended since the last query are indexed.
+ */
+struct WtmpIndex {
+  /// The device and inode of the indexed file.
+  dev_t device{0};
+  ino_t inode{0};
+
+  /// The latest time of each record and the records before it.
+  std::vector<long long> latest;
+
+  /// The last record indexed, a rewritten file is indexed again.
+  std::string last;
+
+  /// Protects the index, the table may be queried concurrently.
+  std::mutex mutex;
+};
+
+using RecordCallback = std::function<void(const struct utmpx& record)>;
+
+/// Read the records from first to the end of the file, stops if truncated.
+static void readRecords(int fd, size_t first, const RecordCallback& callback) {
+  std::vector<struct utmpx> records(kWtmpBlockRecords);
+  auto offset = static_cast<off_t>(first * sizeof(struct utmpx));
+  while (true) {
+    auto bytes = pread(fd,
+                       records.data(),
+                       records.size() * sizeof(struct utmpx),
+                       offset);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      break;
+    }
+
+    // A record being appended is read by the next query.
+    auto count = static_cast<size_t>(bytes) / sizeof(struct utmpx);
+    if (count == 0) {
+      break;
+    }
+    for (size_t i = 0; i < count; i++) {
+      callback(records[i]);
+    }
+    offset += static_cast<off_t>(count * sizeof(struct utmpx));
+  }
+}
+
+/// Index the records appended since the last query, call locked.
+static void updateIndex(int fd, const struct stat& file, WtmpIndex& index) {
+  bool same = index.device == file.st_dev && index.inode == file.st_ino;
+  auto records = static_cast<size_t>(file.st_size) / sizeof(struct utmpx);
+  if (same && !index.latest.empty() && records >= index.latest.size()) {
+    std::string last(sizeof(struct utmpx), '\0');
+    auto offset = (index.latest.size() - 1) * sizeof(struct utmpx);
+    same = pread(fd, &last[0], last.size(), static_cast<off_t>(offset)) ==
+               static_cast<ssize_t>(last.size()) &&
+           last == index.last;
+  } else if (records < index.latest.size()) {
+    same = false;
+  }
+
+  if (!same) {
+    index.device = file.st_dev;
+    index.inode = file.st_ino;
+    index.latest.clear();
+    index.last.clear();
+  }
+
+  readRecords(fd, index.latest.size(), [&index](const struct utmpx& record) {
+    long long time = record.ut_tv.tv_sec;
+    if (!index.latest.empty()) {
+      time = std::max(time, index.latest.back());
+    }
+    index.latest.push_back(time);
+    index.last.assign(reinterpret_cast<const char*>(&record), sizeof(record));
+  });
+}
+
+/// The earliest time of a row matching the time constraints, or 0.
+static long long getEarliestTime(const QueryContext& context) {
+  if (context.constraints.count("time") == 0) {
+    return 0;
+  }
+
+  long long earliest = 0;
+  long long value = 0;
+  const auto& constraints = context.constraints.at("time");
+  for (const auto& expr : constraints.getAll(GREATER_THAN)) {
+    if (safeStrtoll(expr, 10, value).ok()) {
+      earliest = std::max(earliest, value + 1);
+    }
+  }
+  for (const auto& expr : constraints.getAll(GREATER_THAN_OR_EQUALS)) {
+    if (safeStrtoll(expr, 10, value).ok()) {
+      earliest = std::max(earliest, value);
+    }
+  }
+
+  // A row may match any of several equality constraints.
+  std::set<long long> times;
+  for (const auto& expr : constraints.getAll(EQUALS)) {
+    if (!safeStrtoll(expr, 10, value).ok()) {
+      return earliest;
+    }
+    times.insert(value);
+  }
+  if (!times.empty()) {
+    earliest = std::max(earliest, *times.begin());
+  }
+  return earliest;
+}
+
 QueryData genLastAccess(QueryContext& context) {
+  static WtmpIndex index;
+
   QueryData results;
-  struct utmpx *ut;
+  int fd = -1;
+  for (const auto& path : kWtmpPaths) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      break;
+    }
+  }
+
+  struct stat file;
+  if (fd < 0 || fstat(fd, &file) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return results;
+  }
+
+  // Only the records after the first with a matching time are read.
+  size_t first = 0;
+  auto earliest = getEarliestTime(context);
+  {
+    std::lock_guard<std::mutex> lock(index.mutex);
+    updateIndex(fd, file, index);
+    if (earliest > 0) {
+      first = std::lower_bound(
+                  index.latest.begin(), index.latest.end(), earliest) -
+              index.latest.begin();
+    }
+  }
+
+  readRecords(fd, first, [&results](const struct utmpx& record) {
+    results.push_back(genRecordRow(record));
+  });
+  close(fd);
+  return results;
+}
+
+#else
+
+QueryData genLastAccess(QueryContext& context) {
+  QueryData results;
+  struct utmpx* ut;
 #ifdef __APPLE__
   setutxent_wtmp(0); // 0 = reverse chronological order
 
   while ((ut = getutxent_wtmp()) != nullptr) {
 #else
-
-#ifndef __FreeBSD__
-  utmpxname("/var/log/wtmpx");
-#endif
   setutxent();
 
   while ((ut = getutxent()) != nullptr) {
 #endif
-
-    Row r;
-    r["username"] = TEXT(ut->ut_user);
-    r["tty"] = TEXT(ut->ut_line);
-    r["pid"] = INTEGER(ut->ut_pid);
-    r["type"] = INTEGER(ut->ut_type);
-    r["time"] = INTEGER(ut->ut_tv.tv_sec);
-    r["host"] = TEXT(ut->ut_host);
-
-    results.push_back(r);
+    results.push_back(genRecordRow(*ut));
   }
 
 #ifdef __APPLE__
@@ -55,5 +237,6 @@ QueryData genLastAccess(QueryContext& context) {
 
   return results;
 }
+#endif
 }
 }
@@ -8,39 +8,24 @@
  *
  */
 
-#include <set>
-#include <mutex>
-
-#include <grp.h>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/user_directory.h"
+
 namespace osquery {
 namespace tables {
 
-std::mutex grpEnumerationMutex;
-
 QueryData genGroups(QueryContext &context) {
-  std::lock_guard<std::mutex> lock(grpEnumerationMutex);
   QueryData results;
-  struct group *grp = nullptr;
-  std::set<long> groups_in;
-
-  setgrent();
-  while ((grp = getgrent()) != nullptr) {
-    if (std::find(groups_in.begin(), groups_in.end(), grp->gr_gid) ==
-        groups_in.end()) {
-      Row r;
-      r["gid"] = INTEGER(grp->gr_gid);
-      r["gid_signed"] = INTEGER((int32_t) grp->gr_gid);
-      r["groupname"] = TEXT(grp->gr_name);
-      results.push_back(r);
-      groups_in.insert(grp->gr_gid);
-    }
+  auto directory = UserDirectory::getInstance().get();
+  for (const auto &group : directory->groups) {
+    Row r;
+    r["gid"] = INTEGER(group.gid);
+    r["gid_signed"] = INTEGER((int32_t)group.gid);
+    r["groupname"] = TEXT(group.name);
+    results.push_back(r);
   }
-  endgrent();
-  groups_in.clear();
 
   return results;
 }
@@ -10,8 +10,6 @@
 
 #include <fstream>
 
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -42,28 +40,30 @@ QueryData genKernelModules(QueryContext& context) {
   auto module_info = std::string(std::istreambuf_iterator<char>(fd),
                                  std::istreambuf_iterator<char>());
 
-  for (const auto& module : osquery::split(module_info, "\n")) {
-    Row r;
-    auto module_info = osquery::split(module, " ");
-    if (module_info.size() < 6) {
+  LineScanner scanner(module_info, " ");
+  while (scanner.next()) {
+    const auto& fields = scanner.fields();
+    if (fields.size() < 6) {
       // Interesting error case, this module line is not well formed.
       continue;
     }
 
-    for (auto& detail : module_info) {
-      // Clean up the delimiters
-      boost::trim(detail);
-      if (detail.back() == ',') {
-        detail.pop_back();
+    // Clean up the delimiters
+    auto detail = [&fields](size_t index) {
+      auto value = fields[index];
+      if (!value.empty() && value.back() == ',') {
+        value.remove_suffix(1);
       }
-    }
+      return value.to_string();
+    };
 
-    r["name"] = module_info[0];
-    r["size"] = module_info[1];
-    r["used_by"] = module_info[3];
-    r["status"] = module_info[4];
-    r["address"] = module_info[5];
-    results.push_back(r);
+    Row r;
+    r["name"] = detail(0);
+    r["size"] = detail(1);
+    r["used_by"] = detail(3);
+    r["status"] = detail(4);
+    r["address"] = detail(5);
+    results.push_back(std::move(r));
   }
 
   return results;
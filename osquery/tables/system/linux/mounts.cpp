@@ -8,38 +8,153 @@
  *
  */
 
+#include <fcntl.h>
 #include <mntent.h>
+#include <poll.h>
 #include <sys/vfs.h>
+#include <unistd.h>
+
+#include <mutex>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 namespace osquery {
+
+DECLARE_bool(disable_caching);
+
 namespace tables {
 
-QueryData genMounts(QueryContext &context) {
-  QueryData results;
+/// A mount entry, the filesystem statistics are read for each query.
+struct MountEntry {
+  std::string device;
+  std::string device_alias;
+  std::string path;
+  std::string type;
+  std::string flags;
+};
 
-  FILE *mounts = setmntent("/proc/mounts", "r");
+/// Parse a mount table, such as `/proc/<pid>/mounts`.
+static bool readMounts(const std::string &path,
+                       std::vector<MountEntry> &entries) {
+  FILE *mounts = setmntent(path.c_str(), "r");
   if (mounts == nullptr) {
-    return {};
+    return false;
   }
 
   char real_path[PATH_MAX + 1] = {0};
   struct mntent *ent = nullptr;
   while ((ent = getmntent(mounts))) {
-    Row r;
-
-    r["device"] = std::string(ent->mnt_fsname);
-    r["device_alias"] = std::string(
+    MountEntry entry;
+    entry.device = std::string(ent->mnt_fsname);
+    entry.device_alias = std::string(
         realpath(ent->mnt_fsname, real_path) ? real_path : ent->mnt_fsname);
-    r["path"] = std::string(ent->mnt_dir);
-    r["type"] = std::string(ent->mnt_type);
-    r["flags"] = std::string(ent->mnt_opts);
+    entry.path = std::string(ent->mnt_dir);
+    entry.type = std::string(ent->mnt_type);
+    entry.flags = std::string(ent->mnt_opts);
+    entries.push_back(std::move(entry));
+  }
+  endmntent(mounts);
+  return true;
+}
+
+/**
+ * @brief The mount entries, read again when the kernel reports a change.
+ *
+ * Polling /proc/self/mountinfo reports POLLPRI when the mount namespace
+ * changed since the last poll, so the mount table is parsed only after a
+ * mount or unmount. Filesystem statistics change without a mount change and
+ * are never kept.
+ */
+class MountCache : private boost::noncopyable {
+ public:
+  ~MountCache() {
+    if (mountinfo_ >= 0) {
+      ::close(mountinfo_);
+    }
+  }
+
+  /// Return the mount entries, parsing the mount table if it changed.
+  std::vector<MountEntry> get() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (changed()) {
+      entries_.clear();
+      if (!read()) {
+        // Read again when the next query polls.
+        valid_ = false;
+        return entries_;
+      }
+      valid_ = true;
+    }
+    return entries_;
+  }
+
+ private:
+  /// Check if the mount table changed since it was read, call locked.
+  bool changed() {
+    // Poll before reading, a change while reading is reported next time.
+    bool change = poll();
+    return change || FLAGS_disable_caching || !valid_;
+  }
+
+  /// Poll the mountinfo for a change, an error counts as a change.
+  bool poll() {
+    if (mountinfo_ < 0) {
+      mountinfo_ = ::open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+      if (mountinfo_ < 0) {
+        return true;
+      }
+    }
+
+    struct pollfd event;
+    event.fd = mountinfo_;
+    event.events = POLLPRI;
+    event.revents = 0;
+    if (::poll(&event, 1, 0) < 0) {
+      return true;
+    }
+    return (event.revents & (POLLPRI | POLLERR | POLLNVAL)) != 0;
+  }
+
+  /// Parse the mount table into the entries, call locked.
+  bool read() { return readMounts("/proc/mounts", entries_); }
+
+ private:
+  /// The mountinfo descriptor polled for changes.
+  int mountinfo_{-1};
+
+  /// The entries were read and are kept until a change.
+  bool valid_{false};
+
+  std::vector<MountEntry> entries_;
+  std::mutex mutex_;
+};
+
+/**
+ * @brief Add the rows of a mount table.
+ *
+ * @param entries The mount entries.
+ * @param root The root the mount paths are relative to, such as the
+ * `/proc/<pid>/root` of a process in another mount namespace.
+ * @param ns The mount namespace inode.
+ */
+static void genMountRows(const std::vector<MountEntry> &entries,
+                         const std::string &root,
+                         const std::string &ns,
+                         QueryData &results) {
+  for (const auto &entry : entries) {
+    Row r;
+    r["device"] = entry.device;
+    r["device_alias"] = entry.device_alias;
+    r["path"] = entry.path;
+    r["type"] = entry.type;
+    r["flags"] = entry.flags;
+    r["mnt_namespace"] = ns;
 
     struct statfs st;
-    if (!statfs(ent->mnt_dir, &st)) {
+    if (!statfs((root + entry.path).c_str(), &st)) {
       r["blocks_size"] = BIGINT(st.f_bsize);
       r["blocks"] = BIGINT(st.f_blocks);
       r["blocks_free"] = BIGINT(st.f_bfree);
@@ -50,7 +165,44 @@ QueryData genMounts(QueryContext &context) {
 
     results.push_back(std::move(r));
   }
-  endmntent(mounts);
+}
+
+QueryData genMounts(QueryContext &context) {
+  QueryData results;
+
+  // The mounts of osquery's namespace are reported unless other mount
+  // namespaces, such as a container's, are requested.
+  auto snapshot = ProcSnapshot::current();
+  auto self = snapshot->getNamespace(std::to_string(getpid()), "mnt");
+  auto namespaces = context.constraints["mnt_namespace"].getAll(EQUALS);
+  if (namespaces.empty() || namespaces.count(self) > 0) {
+    static MountCache cache;
+    genMountRows(cache.get(), "", self, results);
+    namespaces.erase(self);
+  }
+  if (namespaces.empty()) {
+    return results;
+  }
+
+  // Read the mount table of another namespace through a process in it.
+  auto root = ProcSnapshot::root();
+  for (const auto &pid : snapshot->pids()) {
+    const auto& inode = snapshot->getNamespace(pid, "mnt");
+    auto ns = namespaces.find(inode);
+    if (inode.empty() || ns == namespaces.end()) {
+      continue;
+    }
+
+    std::vector<MountEntry> entries;
+    auto process = root + "/" + pid;
+    if (readMounts(process + "/mounts", entries)) {
+      genMountRows(entries, process + "/root", *ns, results);
+      namespaces.erase(ns);
+      if (namespaces.empty()) {
+        break;
+      }
+    }
+  }
 
   return results;
 }
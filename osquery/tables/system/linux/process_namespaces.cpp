@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cctype>
+
+#include <osquery/filesystem.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+
+namespace osquery {
+namespace tables {
+
+/// The namespace types of `/proc/<pid>/ns`, each a column prefix.
+const std::vector<std::string> kNamespaceTypes = {
+    "cgroup", "ipc", "mnt", "net", "pid", "user", "uts",
+};
+
+/// The length of Docker, containerd, and CRI-O container IDs.
+const size_t kContainerIdLength = 64;
+
+/**
+ * @brief The container ID of a process from its `/proc/<pid>/cgroup`.
+ *
+ * Container runtimes name the cgroup of a container with its ID, such as
+ * "/docker/<id>" or "/kubepods/.../cri-containerd-<id>.scope". The last
+ * 64 hexadecimal characters of a cgroup path are the ID.
+ */
+std::string getContainerId(const std::string& cgroup) {
+  std::string id;
+  for (const auto& line : split(cgroup, "\n")) {
+    size_t run = 0;
+    for (size_t i = 0; i <= line.size(); i++) {
+      if (i < line.size() && isxdigit(line[i]) && !isupper(line[i])) {
+        run++;
+        continue;
+      }
+      if (run == kContainerIdLength) {
+        id = line.substr(i - run, run);
+      }
+      run = 0;
+    }
+  }
+  return id;
+}
+
+QueryData genProcessNamespaces(QueryContext& context) {
+  QueryData results;
+
+  auto snapshot = ProcSnapshot::current();
+  std::set<std::string> pids;
+  if (context.constraints["pid"].exists(EQUALS)) {
+    pids = context.constraints["pid"].getAll(EQUALS);
+  } else {
+    pids = snapshot->pids();
+  }
+
+  for (const auto& pid : pids) {
+    if (!snapshot->exists(pid)) {
+      continue;
+    }
+
+    // Namespace constraints are checked before reading the cgroup.
+    Row r;
+    bool matches = true;
+    for (const auto& type : kNamespaceTypes) {
+      auto column = type + "_namespace";
+      r[column] = snapshot->getNamespace(pid, type);
+      if (!context.constraints[column].notExistsOrMatches(r[column])) {
+        matches = false;
+        break;
+      }
+    }
+    if (!matches) {
+      continue;
+    }
+
+    r["pid"] = pid;
+    r["container_id"] = getContainerId(snapshot->read(pid, "cgroup"));
+    results.push_back(std::move(r));
+  }
+
+  return results;
+}
+}
+}
@@ -40,18 +40,18 @@ void genDescriptors(const std::string& process,
 QueryData genOpenFiles(QueryContext& context) {
   QueryData results;
 
+  auto snapshot = ProcSnapshot::current();
   std::set<std::string> pids;
   if (context.constraints["pid"].exists(EQUALS)) {
     pids = context.constraints["pid"].getAll(EQUALS);
   } else {
-    osquery::procProcesses(pids);
+    pids = snapshot->pids();
   }
 
+  // The descriptor links of every process are read in one batch.
+  snapshot->readDescriptors(pids);
   for (const auto& process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      genDescriptors(process, descriptors, results);
-    }
+    genDescriptors(process, snapshot->descriptors(process), results);
   }
 
   return results;
@@ -11,31 +11,37 @@
 #include <string>
 #include <map>
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <boost/algorithm/string/trim.hpp>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/dispatcher/executor.h"
 
 namespace osquery {
-namespace tables {
 
-inline std::string getProcAttr(const std::string& attr,
-                               const std::string& pid) {
-  return "/proc/" + pid + "/" + attr;
-}
+FLAG(uint64,
+     process_threads,
+     4,
+     "Threads reading process memory maps for process_memory_map on Linux");
 
-inline std::string readProcCMDLine(const std::string& pid) {
-  auto attr = getProcAttr("cmdline", pid);
+namespace tables {
 
-  std::string content;
-  readFile(attr, content);
+/// The fewest pids read by each process_memory_map worker.
+const size_t kProcessMapChunk = 16;
+
+inline std::string readProcCMDLine(ProcSnapshot& snapshot,
+                                   const std::string& pid) {
+  auto content = snapshot.read(pid, "cmdline");
   // Remove \0 delimiters.
   std::replace_if(content.begin(),
                   content.end(),
@@ -46,42 +52,32 @@ inline std::string readProcCMDLine(const std::string& pid) {
   return content;
 }
 
-inline std::string readProcLink(const std::string& attr,
-                                const std::string& pid) {
-  // The exe is a symlink to the binary on-disk.
-  auto attr_path = getProcAttr(attr, pid);
-
-  std::string result;
-  char link_path[PATH_MAX] = {0};
-  auto bytes = readlink(attr_path.c_str(), link_path, sizeof(link_path) - 1);
-  if (bytes >= 0) {
-    result = std::string(link_path);
-  }
-
-  return result;
-}
-
-std::set<std::string> getProcList(const QueryContext& context) {
+std::set<std::string> getProcList(ProcSnapshot& snapshot,
+                                  const QueryContext& context) {
   std::set<std::string> pidlist;
   if (context.constraints.count("pid") > 0 &&
       context.constraints.at("pid").exists(EQUALS)) {
     for (const auto& pid : context.constraints.at("pid").getAll(EQUALS)) {
-      if (isDirectory("/proc/" + pid)) {
+      if (snapshot.exists(pid)) {
         pidlist.insert(pid);
       }
     }
   } else {
-    osquery::procProcesses(pidlist);
+    // A sampled query reads the details of a sample of the processes.
+    for (const auto& pid : snapshot.pids()) {
+      if (context.isSampled(pid)) {
+        pidlist.insert(pid);
+      }
+    }
   }
 
   return pidlist;
 }
 
-void genProcessEnvironment(const std::string& pid, QueryData& results) {
-  auto attr = getProcAttr("environ", pid);
-
-  std::string content;
-  readFile(attr, content);
+void genProcessEnvironment(ProcSnapshot& snapshot,
+                           const std::string& pid,
+                           QueryData& results) {
+  auto content = snapshot.read(pid, "environ");
   const char* variable = content.c_str();
 
   // Stop at the end of nul-delimited string content.
@@ -98,52 +94,118 @@ void genProcessEnvironment(const std::string& pid, QueryData& results) {
   }
 }
 
-void genProcessMap(const std::string& pid, QueryData& results) {
-  auto map = getProcAttr("maps", pid);
+/// The path and pseudo constraints checked before a region row is built.
+struct ProcessMapFilter {
+  explicit ProcessMapFilter(const QueryContext& context) {
+    if (context.constraints.count("path") > 0) {
+      paths = context.constraints.at("path").getAll(EQUALS);
+    }
+    if (context.constraints.count("pseudo") > 0) {
+      pseudo = context.constraints.at("pseudo").getAll(EQUALS);
+    }
+  }
 
-  std::string content;
-  readFile(map, content);
-  for (auto& line : osquery::split(content, "\n")) {
-    auto fields = osquery::split(line, " ");
+  bool matches(const std::string& path, bool is_pseudo) const {
+    if (!paths.empty() && paths.count(path) == 0) {
+      return false;
+    }
+    return pseudo.empty() || pseudo.count(is_pseudo ? "1" : "0") > 0;
+  }
+
+  std::set<std::string> paths;
+  std::set<std::string> pseudo;
+};
+
+/// Return the end of the field at begin, the next space or the line end.
+static const char* mapsField(const char* begin, const char* end) {
+  auto field = static_cast<const char*>(memchr(begin, ' ', end - begin));
+  return (field == nullptr) ? end : field;
+}
+
+/// Return the start of the next field, skipping the spaces after a field.
+static const char* mapsNext(const char* field, const char* end) {
+  while (field < end && *field == ' ') {
+    field++;
+  }
+  return field;
+}
+
+void genProcessMap(ProcSnapshot& snapshot,
+                   const std::string& pid,
+                   const ProcessMapFilter& filter,
+                   QueryData& results) {
+  // Lines are parsed in place: address, perms, offset, dev, inode, pathname.
+  const auto& content = snapshot.maps(pid);
+  const char* line = content.data();
+  const char* content_end = line + content.size();
+  for (; line < content_end; line++) {
+    auto end = static_cast<const char*>(
+        memchr(line, '\n', content_end - line));
+    if (end == nullptr) {
+      end = content_end;
+    }
+
+    const char* fields[5];
+    const char* field_ends[5];
+    const char* field = line;
+    size_t count = 0;
+    for (; count < 5 && field < end; count++) {
+      fields[count] = field;
+      field_ends[count] = mapsField(field, end);
+      field = mapsNext(field_ends[count], end);
+    }
     // If can't read address, not sure.
-    if (fields.size() < 5) {
+    if (count < 5) {
+      line = end;
       continue;
     }
 
-    Row r;
-    r["pid"] = pid;
-    if (!fields[0].empty()) {
-      auto addresses = osquery::split(fields[0], "-");
-      if (addresses.size() >= 2) {
-        r["start"] = "0x" + addresses[0];
-        r["end"] = "0x" + addresses[1];
-      } else {
-        // Problem with the address format.
-        continue;
-      }
+    // Path name must be trimmed.
+    const char* path_end = end;
+    while (path_end > field && isspace(*(path_end - 1))) {
+      path_end--;
     }
+    std::string path(field, path_end - field);
+    std::string inode(fields[4], field_ends[4] - fields[4]);
 
-    r["permissions"] = fields[1];
-    try {
-      auto offset = std::stoll(fields[2], nullptr, 16);
-      r["offset"] = (offset != 0) ? BIGINT(offset) : r["start"];
+    // BSS with name in pathname.
+    bool pseudo = (inode == "0" && !path.empty());
+    if (!filter.matches(path, pseudo)) {
+      line = end;
+      continue;
+    }
 
-    } catch (const std::exception& e) {
-      // Value was out of range or could not be interpreted as a hex long long.
-      r["offset"] = "-1";
+    auto dash = static_cast<const char*>(
+        memchr(fields[0], '-', field_ends[0] - fields[0]));
+    if (dash == nullptr || dash + 1 == field_ends[0]) {
+      // Problem with the address format.
+      line = end;
+      continue;
     }
-    r["device"] = fields[3];
-    r["inode"] = fields[4];
 
-    // Path name must be trimmed.
-    if (fields.size() > 5) {
-      boost::trim(fields[5]);
-      r["path"] = fields[5];
+    Row r;
+    r["pid"] = pid;
+    r["start"] = "0x" + std::string(fields[0], dash - fields[0]);
+    r["end"] = "0x" + std::string(dash + 1, field_ends[0] - dash - 1);
+    r["permissions"] = std::string(fields[1], field_ends[1] - fields[1]);
+
+    // The offset field ends at a space, as a hex long long.
+    char* offset_end = nullptr;
+    errno = 0;
+    auto offset = strtoll(fields[2], &offset_end, 16);
+    if (errno != 0 || offset_end == fields[2]) {
+      // Value was out of range or could not be interpreted as a hex long long.
+      r["offset"] = "-1";
+    } else {
+      r["offset"] = (offset != 0) ? BIGINT(offset) : r["start"];
     }
 
-    // BSS with name in pathname.
-    r["pseudo"] = (fields[4] == "0" && !r["path"].empty()) ? "1" : "0";
-    results.push_back(r);
+    r["device"] = std::string(fields[3], field_ends[3] - fields[3]);
+    r["inode"] = std::move(inode);
+    r["path"] = std::move(path);
+    r["pseudo"] = (pseudo) ? "1" : "0";
+    results.push_back(std::move(r));
+    line = end;
   }
 }
 
@@ -171,11 +233,20 @@ struct SimpleProcStat {
   std::string start_time;
 };
 
-static inline SimpleProcStat getProcStat(const std::string& pid) {
+static inline SimpleProcStat getProcStat(ProcSnapshot& snapshot,
+                                         const std::string& pid,
+                                         const QueryContext& context) {
   SimpleProcStat stat;
-  std::string content;
 
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
+  // Each file is only read if the query uses one of the columns it fills.
+  if (context.isAnyColumnUsed({"parent",
+                               "group",
+                               "state",
+                               "nice",
+                               "user_time",
+                               "system_time",
+                               "start_time"})) {
+    const auto& content = snapshot.stat(pid);
     auto start = content.find_last_of(")");
     // Start parsing stats from ") <MODE>..."
     if (start == std::string::npos || content.size() <= start + 2) {
@@ -199,7 +270,16 @@ static inline SimpleProcStat getProcStat(const std::string& pid) {
     }
   }
 
-  if (readFile(getProcAttr("status", pid), content).ok()) {
+  if (context.isAnyColumnUsed({"name",
+                               "uid",
+                               "euid",
+                               "suid",
+                               "gid",
+                               "egid",
+                               "sgid",
+                               "resident_size",
+                               "phys_footprint"})) {
+    const auto& content = snapshot.status(pid);
     for (const auto& line : osquery::split(content, "\n")) {
       // Status lines are formatted: Key: Value....\n.
       auto detail = osquery::split(line, ":", 1);
@@ -240,22 +320,33 @@ static inline SimpleProcStat getProcStat(const std::string& pid) {
   return stat;
 }
 
-void genProcess(const std::string& pid, QueryData& results) {
+void genProcess(ProcSnapshot& snapshot,
+                const std::string& pid,
+                const QueryContext& context,
+                QueryData& results) {
   // Parse the process stat and status.
-  auto proc_stat = getProcStat(pid);
+  auto proc_stat = getProcStat(snapshot, pid, context);
 
   Row r;
   r["pid"] = pid;
   r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    r["path"] = snapshot.readLink(pid, "exe");
+  }
   r["name"] = proc_stat.name;
   r["group"] = proc_stat.group;
   r["state"] = proc_stat.state;
   r["nice"] = proc_stat.nice;
   // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
+  if (context.isColumnUsed("cmdline")) {
+    r["cmdline"] = readProcCMDLine(snapshot, pid);
+  }
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = snapshot.readLink(pid, "cwd");
+  }
+  if (context.isColumnUsed("root")) {
+    r["root"] = snapshot.readLink(pid, "root");
+  }
   r["uid"] = proc_stat.real_uid;
   r["euid"] = proc_stat.effective_uid;
   r["suid"] = proc_stat.saved_uid;
@@ -268,7 +359,9 @@ void genProcess(const std::string& pid, QueryData& results) {
   // available, set on_disk to -1. If, and only if, the path of the
   // executable is available and the file does NOT exist on disk, set on_disk
   // to 0.
-  r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  if (context.isColumnUsed("on_disk")) {
+    r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  }
 
   // size/memory information
   r["wired_size"] = "0"; // No support for unpagable counters in linux.
@@ -286,9 +379,10 @@ void genProcess(const std::string& pid, QueryData& results) {
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  auto snapshot = ProcSnapshot::current();
+  auto pidlist = getProcList(*snapshot, context);
   for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+    genProcess(*snapshot, pid, context, results);
   }
 
   return results;
@@ -297,9 +391,10 @@ QueryData genProcesses(QueryContext& context) {
 QueryData genProcessEnvs(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  auto snapshot = ProcSnapshot::current();
+  auto pidlist = getProcList(*snapshot, context);
   for (const auto& pid : pidlist) {
-    genProcessEnvironment(pid, results);
+    genProcessEnvironment(*snapshot, pid, results);
   }
 
   return results;
@@ -308,11 +403,56 @@ QueryData genProcessEnvs(QueryContext& context) {
 QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcessMap(pid, results);
+  auto snapshot = ProcSnapshot::current();
+  auto pidlist = getProcList(*snapshot, context);
+  std::vector<std::string> pids(pidlist.begin(), pidlist.end());
+  ProcessMapFilter filter(context);
+
+  // Split the pids into a contiguous chunk for each worker, the results of
+  // each chunk are appended in pid order.
+  size_t chunks =
+      std::min<size_t>(std::max<size_t>(FLAGS_process_threads, 1),
+                       (pids.size() / kProcessMapChunk) + 1);
+  if (chunks == 1) {
+    for (const auto& pid : pids) {
+      genProcessMap(*snapshot, pid, filter, results);
+    }
+    return results;
+  }
+
+  std::vector<QueryData> chunk_results(chunks);
+  std::vector<TaskRef> tasks;
+  size_t chunk_size = (pids.size() + chunks - 1) / chunks;
+  for (size_t i = 0; i < chunks; i++) {
+    auto begin = std::min(i * chunk_size, pids.size());
+    auto end = std::min(begin + chunk_size, pids.size());
+    auto& output = chunk_results[i];
+    auto& maps = *snapshot;
+    auto work = [&pids, &maps, &filter, &output, begin, end](const Task& task) {
+      for (size_t j = begin; j < end && !task.isCancelled(); j++) {
+        genProcessMap(maps, pids[j], filter, output);
+      }
+    };
+
+    auto task = getTableExecutor().submit(work, TASK_PRIORITY_SCHEDULE);
+    if (task == nullptr) {
+      // The executor is stopping, read the chunk on this thread.
+      for (size_t j = begin; j < end; j++) {
+        genProcessMap(*snapshot, pids[j], filter, output);
+      }
+      continue;
+    }
+    tasks.push_back(task);
   }
 
+  for (const auto& task : tasks) {
+    task->runOrWait();
+  }
+  for (auto& output : chunk_results) {
+    results.insert(results.end(),
+                   std::make_move_iterator(output.begin()),
+                   std::make_move_iterator(output.end()));
+  }
   return results;
 }
 }
@@ -16,6 +16,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/rows/shared_memory.h"
+
 namespace osquery {
 namespace tables {
 
@@ -28,15 +30,13 @@ struct shm_info {
   unsigned long swap_successes;
 } __attribute__((unused));
 
-QueryData genSharedMemory(QueryContext &context) {
-  QueryData results;
-
+void genSharedMemory(QueryContext &context, TableRows &rows) {
   // Use shared memory control (shmctl) to get the max SHMID.
   struct shm_info shm_info;
   int maxid = shmctl(0, SHM_INFO, (struct shmid_ds *)(void *)&shm_info);
   if (maxid < 0) {
     VLOG(1) << "Linux kernel not configured for shared memory";
-    return {};
+    return;
   }
 
   // Use a static pointer to access IPC permissions structure.
@@ -44,44 +44,38 @@ QueryData genSharedMemory(QueryContext &context) {
   struct ipc_perm *ipcp = &shmseg.shm_perm;
 
   // Then iterate each shared memory ID up to the max.
+  SharedMemoryRow r;
   for (int id = 0; id <= maxid; id++) {
     int shmid = shmctl(id, SHM_STAT, &shmseg);
     if (shmid < 0) {
       continue;
     }
 
-    Row r;
-    r["shmid"] = INTEGER(shmid);
+    r.shmid(shmid);
 
     struct passwd *pw = getpwuid(shmseg.shm_perm.uid);
     if (pw != nullptr) {
-      r["owner_uid"] = BIGINT(pw->pw_uid);
+      r.owner_uid(pw->pw_uid);
     }
 
     pw = getpwuid(shmseg.shm_perm.cuid);
     if (pw != nullptr) {
-      r["creator_uid"] = BIGINT(pw->pw_uid);
+      r.creator_uid(pw->pw_uid);
     }
 
     // Accessor, creator pids.
-    r["pid"] = BIGINT(shmseg.shm_lpid);
-    r["creator_pid"] = BIGINT(shmseg.shm_cpid);
+    r.pid(shmseg.shm_lpid).creator_pid(shmseg.shm_cpid);
 
     // Access, detached, creator times
-    r["atime"] = BIGINT(shmseg.shm_atime);
-    r["dtime"] = BIGINT(shmseg.shm_dtime);
-    r["ctime"] = BIGINT(shmseg.shm_ctime);
-
-    r["permissions"] = lsperms(ipcp->mode);
-    r["size"] = BIGINT(shmseg.shm_segsz);
-    r["attached"] = INTEGER(shmseg.shm_nattch);
-    r["status"] = (ipcp->mode & SHM_DEST) ? "dest" : "";
-    r["locked"] = (ipcp->mode & SHM_LOCKED) ? "1" : "0";
-
-    results.push_back(r);
+    r.atime(shmseg.shm_atime).dtime(shmseg.shm_dtime).ctime(shmseg.shm_ctime);
+
+    r.permissions(lsperms(ipcp->mode));
+    r.size(shmseg.shm_segsz);
+    r.attached(shmseg.shm_nattch);
+    r.status((ipcp->mode & SHM_DEST) ? "dest" : "");
+    r.locked((ipcp->mode & SHM_LOCKED) ? 1 : 0);
+    r.appendTo(rows);
   }
-
-  return results;
 }
 }
 }
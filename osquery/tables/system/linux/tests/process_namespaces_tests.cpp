@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+extern std::string getContainerId(const std::string& cgroup);
+extern QueryData genProcessNamespaces(QueryContext& context);
+
+class ProcessNamespacesTests : public testing::Test {};
+
+TEST_F(ProcessNamespacesTests, test_container_id) {
+  std::string id(64, 'a');
+  id.replace(0, 8, "0123cdef");
+  EXPECT_EQ(getContainerId("12:cpu,cpuacct:/docker/" + id + "\n"), id);
+  EXPECT_EQ(getContainerId("0::/kubepods.slice/kubepods-pod1234.slice/"
+                           "cri-containerd-" +
+                           id + ".scope\n"),
+            id);
+  EXPECT_EQ(getContainerId("0::/system.slice/crio-" + id + ".scope\n"
+                           "1:name=systemd:/\n"),
+            id);
+
+  // Host processes, and shorter or upper case hexadecimal runs, are not in a
+  // container.
+  EXPECT_EQ(getContainerId("0::/user.slice/user-1000.slice\n"), "");
+  EXPECT_EQ(getContainerId("0::/docker/" + id.substr(1) + "\n"), "");
+  EXPECT_EQ(getContainerId("0::/docker/" + std::string(64, 'A') + "\n"), "");
+  EXPECT_EQ(getContainerId("0::/x/" + id + "f\n"), "");
+}
+
+TEST_F(ProcessNamespacesTests, test_process_namespaces) {
+  auto pid = std::to_string(getpid());
+  QueryContext context;
+  context.constraints["pid"].add(Constraint(EQUALS, pid));
+  auto results = genProcessNamespaces(context);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["pid"], pid);
+  auto net = results[0]["net_namespace"];
+  EXPECT_FALSE(net.empty());
+
+  // A namespace constraint drops the processes in other namespaces.
+  context.constraints["net_namespace"].add(Constraint(EQUALS, net));
+  EXPECT_EQ(genProcessNamespaces(context).size(), 1U);
+  context.constraints["net_namespace"].add(Constraint(EQUALS, "1"));
+  EXPECT_EQ(genProcessNamespaces(context).size(), 0U);
+}
+}
+}
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/tables/rows/shared_memory.h"
+
+namespace osquery {
+namespace tables {
+
+extern void genSharedMemory(QueryContext& context, TableRows& rows);
+
+class SharedMemoryTests : public testing::Test {};
+
+TEST_F(SharedMemoryTests, test_typed_row) {
+  SharedMemoryRow row;
+  row.shmid(1).status("dest");
+  EXPECT_EQ(row.cells().size(), SharedMemoryRow::kColumnCount);
+  const auto& cells = row.cells();
+  EXPECT_EQ(boost::get<long long int>(cells[SharedMemoryRow::kShmid]), 1);
+  EXPECT_EQ(boost::get<std::string>(cells[SharedMemoryRow::kStatus]), "dest");
+
+  // Unset cells are empty, and appending leaves an empty row to refill.
+  EXPECT_EQ(boost::get<std::string>(cells[SharedMemoryRow::kPid]), "");
+  TableRows rows;
+  row.appendTo(rows);
+  ASSERT_EQ(rows.size(), 1U);
+  EXPECT_EQ(boost::get<std::string>(cells[SharedMemoryRow::kShmid]), "");
+}
+
+TEST_F(SharedMemoryTests, test_shared_memory) {
+  auto shmid = shmget(IPC_PRIVATE, 4096, IPC_CREAT | 0600);
+  if (shmid < 0) {
+    // The kernel may not be configured for System V shared memory.
+    return;
+  }
+
+  QueryContext context;
+  TableRows rows;
+  genSharedMemory(context, rows);
+  shmctl(shmid, IPC_RMID, nullptr);
+
+  bool found = false;
+  for (const auto& row : rows) {
+    ASSERT_EQ(row.size(), SharedMemoryRow::kColumnCount);
+    if (boost::get<long long int>(row[SharedMemoryRow::kShmid]) != shmid) {
+      continue;
+    }
+    found = true;
+    EXPECT_EQ(boost::get<long long int>(row[SharedMemoryRow::kSize]), 4096);
+    EXPECT_EQ(boost::get<long long int>(row[SharedMemoryRow::kCreatorPid]),
+              getpid());
+  }
+  EXPECT_TRUE(found);
+}
+}
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/linux/user_directory.h"
+
+namespace osquery {
+
+DECLARE_bool(disable_caching);
+
+namespace tables {
+
+class UserDirectoryTests : public testing::Test {};
+
+TEST_F(UserDirectoryTests, test_files_only) {
+  EXPECT_TRUE(UserDirectory::filesOnly(""));
+  EXPECT_TRUE(UserDirectory::filesOnly("passwd: files\ngroup: compat\n"));
+  EXPECT_TRUE(UserDirectory::filesOnly("hosts: files dns\npasswd: files\n"));
+  EXPECT_TRUE(UserDirectory::filesOnly("passwd: files # sss\n"));
+  EXPECT_TRUE(
+      UserDirectory::filesOnly("passwd: files [NOTFOUND=return] files\n"));
+
+  EXPECT_FALSE(UserDirectory::filesOnly("passwd: files sss\n"));
+  EXPECT_FALSE(UserDirectory::filesOnly("passwd: files\ngroup: files ldap\n"));
+  EXPECT_FALSE(UserDirectory::filesOnly("group:\tsystemd files\n"));
+}
+
+TEST_F(UserDirectoryTests, test_snapshot) {
+  auto disable_caching = FLAGS_disable_caching;
+  FLAGS_disable_caching = false;
+
+  auto& directory = UserDirectory::getInstance();
+  auto snapshot = directory.get();
+  ASSERT_NE(snapshot, nullptr);
+  auto root = snapshot->getUser(0);
+  ASSERT_NE(root, nullptr);
+  EXPECT_EQ(root->uid, 0U);
+  EXPECT_LE(snapshot->uids.size(), snapshot->users.size());
+  EXPECT_EQ(snapshot->gids.size(), snapshot->groups.size());
+
+  // The enumeration is kept while the files are unchanged.
+  if (directory.get() != snapshot) {
+    // The files changed too recently to keep the enumeration.
+    EXPECT_TRUE(directory.state_.empty());
+  }
+
+  // Without caching every request enumerates again.
+  FLAGS_disable_caching = true;
+  EXPECT_NE(directory.get(), snapshot);
+  FLAGS_disable_caching = disable_caching;
+}
+}
+}
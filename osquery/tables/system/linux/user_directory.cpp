@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/stat.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/user_directory.h"
+#include "osquery/tables/system/system_utils.h"
+#include "osquery/tables/system/user_groups.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     user_cache_ttl,
+     60,
+     "Seconds to keep users and groups read from a directory service");
+
+DECLARE_bool(disable_caching);
+
+namespace tables {
+
+/// The NSS configuration, which selects the passwd and group sources.
+const std::string kNsswitchPath = "/etc/nsswitch.conf";
+
+/// The files that change when a local user or group changes.
+const std::vector<std::string> kUserDirectoryFiles = {
+    "/etc/passwd", "/etc/group", kNsswitchPath,
+};
+
+DirectoryUser makeDirectoryUser(const struct passwd& pwd) {
+  DirectoryUser user;
+  user.uid = pwd.pw_uid;
+  user.gid = pwd.pw_gid;
+  user.name = (pwd.pw_name != nullptr) ? pwd.pw_name : "";
+  user.description = (pwd.pw_gecos != nullptr) ? pwd.pw_gecos : "";
+  user.directory = (pwd.pw_dir != nullptr) ? pwd.pw_dir : "";
+  user.shell = (pwd.pw_shell != nullptr) ? pwd.pw_shell : "";
+  return user;
+}
+
+const DirectoryUser* UserDirectorySnapshot::getUser(uid_t uid) const {
+  auto index = uids.find(uid);
+  return (index == uids.end()) ? nullptr : &users[index->second];
+}
+
+UserDirectory& UserDirectory::getInstance() {
+  static UserDirectory directory;
+  return directory;
+}
+
+/// Read the status of the directory files, false if one changed too recently.
+static bool getDirectoryState(std::string& state) {
+  bool settled = true;
+  for (const auto& path : kUserDirectoryFiles) {
+    struct stat info;
+    state += path + ":";
+    if (stat(path.c_str(), &info) != 0) {
+      state += "missing,";
+      continue;
+    }
+    settled = getFileState(info, state) && settled;
+  }
+  return settled;
+}
+
+std::shared_ptr<const UserDirectorySnapshot> UserDirectory::get() {
+  // The state is read before enumerating, a change while enumerating
+  // enumerates again for the next query.
+  std::string state;
+  bool settled = getDirectoryState(state);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (snapshot_ == nullptr || expired(state)) {
+    std::string nsswitch;
+    files_only_ =
+        !readFile(kNsswitchPath, nsswitch).ok() || filesOnly(nsswitch);
+    snapshot_ = enumerate();
+    memberships_.clear();
+    state_ = (settled) ? state : "";
+    time_ = getUnixTime();
+  }
+  return snapshot_;
+}
+
+void UserDirectory::getGroups(const DirectoryUser& user, QueryData& results) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto membership = memberships_.find(user.uid);
+  if (membership == memberships_.end()) {
+    user_t<uid_t, gid_t> entry;
+    entry.name = user.name.c_str();
+    entry.uid = user.uid;
+    entry.gid = user.gid;
+    QueryData rows;
+    getGroupsForUser<uid_t, gid_t>(rows, entry);
+    membership = memberships_.emplace(user.uid, std::move(rows)).first;
+  }
+  results.insert(
+      results.end(), membership->second.begin(), membership->second.end());
+}
+
+bool UserDirectory::expired(const std::string& state) const {
+  if (FLAGS_disable_caching || state != state_) {
+    return true;
+  }
+  return !files_only_ && getUnixTime() >= time_ + FLAGS_user_cache_ttl;
+}
+
+std::shared_ptr<UserDirectorySnapshot> UserDirectory::enumerate() {
+  auto snapshot = std::make_shared<UserDirectorySnapshot>();
+
+  struct passwd* pwd = nullptr;
+  setpwent();
+  while ((pwd = getpwent()) != nullptr) {
+    if (snapshot->uids.count(pwd->pw_uid) == 0) {
+      snapshot->uids[pwd->pw_uid] = snapshot->users.size();
+    }
+    snapshot->users.push_back(makeDirectoryUser(*pwd));
+  }
+  endpwent();
+
+  struct group* grp = nullptr;
+  setgrent();
+  while ((grp = getgrent()) != nullptr) {
+    if (snapshot->gids.count(grp->gr_gid) > 0) {
+      continue;
+    }
+    snapshot->gids[grp->gr_gid] = snapshot->groups.size();
+    DirectoryGroup group;
+    group.gid = grp->gr_gid;
+    group.name = (grp->gr_name != nullptr) ? grp->gr_name : "";
+    snapshot->groups.push_back(std::move(group));
+  }
+  endgrent();
+  return snapshot;
+}
+
+bool UserDirectory::filesOnly(const std::string& nsswitch) {
+  for (auto& line : split(nsswitch, "\n")) {
+    line = line.substr(0, line.find('#'));
+    auto delimiter = line.find(':');
+    if (delimiter == std::string::npos) {
+      continue;
+    }
+
+    auto database = line.substr(0, delimiter);
+    boost::trim(database);
+    if (database != "passwd" && database != "group") {
+      continue;
+    }
+
+    // Skip the status actions, such as [NOTFOUND=return], between sources.
+    bool action = false;
+    for (const auto& source : split(line.substr(delimiter + 1))) {
+      if (source.front() == '[') {
+        action = true;
+      }
+      if (!action && source != "files" && source != "compat") {
+        return false;
+      }
+      if (source.back() == ']') {
+        action = false;
+      }
+    }
+  }
+  return true;
+}
+}
+}
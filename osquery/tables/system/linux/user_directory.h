@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <grp.h>
+#include <pwd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <gtest/gtest_prod.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// A user enumerated from the password database.
+struct DirectoryUser {
+  uid_t uid;
+  gid_t gid;
+  std::string name;
+  std::string description;
+  std::string directory;
+  std::string shell;
+};
+
+/// A group enumerated from the group database.
+struct DirectoryGroup {
+  gid_t gid;
+  std::string name;
+};
+
+/// Copy a password database entry, missing fields are empty.
+DirectoryUser makeDirectoryUser(const struct passwd& pwd);
+
+/// The users and groups of one enumeration, indexed by uid and gid.
+struct UserDirectorySnapshot {
+  /// Users in enumeration order, a uid may be shared by several users.
+  std::vector<DirectoryUser> users;
+
+  /// Groups with a distinct gid, in enumeration order.
+  std::vector<DirectoryGroup> groups;
+
+  /// The index of the first user of each uid, and of each gid.
+  std::unordered_map<uid_t, size_t> uids;
+  std::unordered_map<gid_t, size_t> gids;
+
+  /// The enumerated user with a uid, nullptr if it was not enumerated.
+  const DirectoryUser* getUser(uid_t uid) const;
+};
+
+/**
+ * @brief The enumerated users and groups, shared by every table.
+ *
+ * Enumerating the password and group databases through NSS may query a
+ * directory server, such as LDAP or SSSD, and take seconds. The users and
+ * groups tables, user_groups, and every table finding users' home directories
+ * share one enumeration.
+ *
+ * The enumeration is read again when the status of /etc/passwd, /etc/group,
+ * or /etc/nsswitch.conf changes. When nsswitch.conf configures a source
+ * other than files for passwd or group, the enumeration also expires after
+ * --user_cache_ttl seconds.
+ */
+class UserDirectory : private boost::noncopyable {
+ public:
+  /// The process-wide directory.
+  static UserDirectory& getInstance();
+
+  /// The current enumeration, read again if it changed or expired.
+  std::shared_ptr<const UserDirectorySnapshot> get();
+
+  /**
+   * @brief Append the user_groups rows of every group a user is a member of.
+   *
+   * The group lists are kept with the current enumeration.
+   */
+  void getGroups(const DirectoryUser& user, QueryData& results);
+
+ private:
+  UserDirectory() = default;
+
+  /// Check if the enumeration must be read again, call locked.
+  bool expired(const std::string& state) const;
+
+  /// Enumerate the users and groups.
+  static std::shared_ptr<UserDirectorySnapshot> enumerate();
+
+  /// Check if nsswitch.conf only uses files for passwd and group.
+  static bool filesOnly(const std::string& nsswitch);
+
+ private:
+  /// The current enumeration.
+  std::shared_ptr<const UserDirectorySnapshot> snapshot_;
+
+  /// The status of the files when the enumeration was read.
+  std::string state_;
+
+  /// The time the enumeration was read.
+  size_t time_{0};
+
+  /// If the enumeration is only read from files, and never expires.
+  bool files_only_{false};
+
+  /// The user_groups rows of each uid, for the current enumeration.
+  std::map<uid_t, QueryData> memberships_;
+
+  /// Protects the enumeration, NSS enumeration is not reentrant.
+  std::mutex mutex_;
+
+ private:
+  FRIEND_TEST(UserDirectoryTests, test_files_only);
+  FRIEND_TEST(UserDirectoryTests, test_snapshot);
+};
+}
+}
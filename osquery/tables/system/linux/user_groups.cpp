@@ -8,46 +8,44 @@
  *
  */
 
+#include <set>
+#include <string>
+
 #include "osquery/core/conversions.h"
-#include "osquery/tables/system/user_groups.h"
+#include "osquery/tables/system/linux/user_directory.h"
 
 namespace osquery {
 namespace tables {
 
-extern std::mutex pwdEnumerationMutex;
-
 QueryData genUserGroups(QueryContext &context) {
   QueryData results;
-  struct passwd *pwd = nullptr;
+  auto &directory = UserDirectory::getInstance();
+  auto snapshot = directory.get();
 
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto &uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
+      if (!safeStrtol(uid, 10, auid)) {
+        continue;
+      }
+
+      auto user = snapshot->getUser(auid);
+      struct passwd *pwd = nullptr;
+      if (user != nullptr) {
+        directory.getGroups(*user, results);
+      } else if ((pwd = getpwuid(auid)) != nullptr) {
+        directory.getGroups(makeDirectoryUser(*pwd), results);
       }
     }
   } else {
-    std::lock_guard<std::mutex> lock(pwdEnumerationMutex);
-    std::set<gid_t> users_in;
-    while ((pwd = getpwent()) != nullptr) {
-      if (std::find(users_in.begin(), users_in.end(), pwd->pw_uid) ==
-          users_in.end()) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
-        users_in.insert(pwd->pw_uid);
+    // Only the first user of each uid is listed.
+    for (size_t i = 0; i < snapshot->users.size(); i++) {
+      const auto &user = snapshot->users[i];
+      if (snapshot->uids.at(user.uid) == i) {
+        directory.getGroups(user, results);
       }
     }
-    endpwent();
-    users_in.clear();
   }
 
   return results;
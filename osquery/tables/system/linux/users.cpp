@@ -9,53 +9,55 @@
  */
 
 #include <set>
-#include <mutex>
-#include <vector>
 #include <string>
 
-#include <pwd.h>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/user_directory.h"
 
 namespace osquery {
 namespace tables {
 
-std::mutex pwdEnumerationMutex;
-
-void genUser(const struct passwd* pwd, QueryData& results) {
+void genUser(const DirectoryUser& user, QueryData& results) {
   Row r;
-  r["uid"] = BIGINT(pwd->pw_uid);
-  r["gid"] = BIGINT(pwd->pw_gid);
-  r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
-  r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
-  r["username"] = TEXT(pwd->pw_name);
-  r["description"] = TEXT(pwd->pw_gecos);
-  r["directory"] = TEXT(pwd->pw_dir);
-  r["shell"] = TEXT(pwd->pw_shell);
+  r["uid"] = BIGINT(user.uid);
+  r["gid"] = BIGINT(user.gid);
+  r["uid_signed"] = BIGINT((int32_t)user.uid);
+  r["gid_signed"] = BIGINT((int32_t)user.gid);
+  r["username"] = TEXT(user.name);
+  r["description"] = TEXT(user.description);
+  r["directory"] = TEXT(user.directory);
+  r["shell"] = TEXT(user.shell);
   results.push_back(r);
 }
 
 QueryData genUsers(QueryContext& context) {
   QueryData results;
-  struct passwd *pwd = nullptr;
+  auto directory = UserDirectory::getInstance().get();
 
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        genUser(pwd, results);
+      if (!safeStrtol(uid, 10, auid)) {
+        continue;
+      }
+
+      // A directory service may not enumerate every user it can look up.
+      auto user = directory->getUser(auid);
+      struct passwd* pwd = nullptr;
+      if (user != nullptr) {
+        genUser(*user, results);
+      } else if ((pwd = getpwuid(auid)) != nullptr) {
+        genUser(makeDirectoryUser(*pwd), results);
       }
     }
   } else {
-    std::lock_guard<std::mutex> lock(pwdEnumerationMutex);
-    while ((pwd = getpwent()) != nullptr) {
-      genUser(pwd, results);
+    for (const auto& user : directory->users) {
+      genUser(user, results);
     }
-    endpwent();
   }
 
   return results;
@@ -11,48 +11,174 @@
 #include <stdio.h>
 #include <magic.h>
 
+#include <mutex>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/dispatcher/executor.h"
+
 namespace osquery {
+
+FLAG(uint64,
+     magic_threads,
+     4,
+     "Threads detecting file types for the magic table");
+
 namespace tables {
 
-QueryData genMagicData(QueryContext& context) {
-  QueryData results;
-  magic_t magic_cookie = nullptr;
+/// The fewest paths detected by each magic worker.
+const size_t kMagicChunk = 16;
 
-  // No default flags
-  magic_cookie = magic_open(MAGIC_NONE);
+/// The separator between the MIME type and encoding of MAGIC_MIME.
+const std::string kMagicCharset = "; charset=";
 
-  if (magic_cookie == nullptr) {
-    VLOG(1) << "Unable to initialize magic library";
-    return results;
+/**
+ * @brief Loaded libmagic cookies, kept for the life of the process.
+ *
+ * Loading a cookie parses the compiled magic database. A cookie may only be
+ * used by one thread at a time, each worker acquires a cookie for a chunk of
+ * paths and returns it to the pool. A cookie is loaded when none are free.
+ */
+class MagicCookies : private boost::noncopyable {
+ public:
+  static MagicCookies& get() {
+    static MagicCookies cookies;
+    return cookies;
   }
-  if (magic_load(magic_cookie, nullptr) != 0) {
-    VLOG(1) << "Unable to load magic database : " << magic_error(magic_cookie);
-    magic_close(magic_cookie);
-    return results;
+
+  ~MagicCookies() {
+    for (auto& cookie : free_) {
+      magic_close(cookie);
+    }
   }
 
-  // Iterate through all the provided paths
-  auto paths = context.constraints["path"].getAll(EQUALS);
-  for (const auto& path_string : paths) {
-    Row r;
-    r["path"] = path_string;
-    r["data"] = magic_file(magic_cookie, path_string.c_str());
+  /// Take a free cookie or load a cookie, nullptr if one cannot be loaded.
+  magic_t acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        auto cookie = free_.back();
+        free_.pop_back();
+        return cookie;
+      }
+    }
+
+    // No default flags
+    auto cookie = magic_open(MAGIC_NONE);
+    if (cookie == nullptr) {
+      VLOG(1) << "Unable to initialize magic library";
+      return nullptr;
+    }
+    if (magic_load(cookie, nullptr) != 0) {
+      VLOG(1) << "Unable to load magic database : " << magic_error(cookie);
+      magic_close(cookie);
+      return nullptr;
+    }
+    return cookie;
+  }
+
+  /// Return a cookie to the pool.
+  void release(magic_t cookie) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(cookie);
+  }
 
-    // Retrieve MIME type
-    magic_setflags(magic_cookie, MAGIC_MIME_TYPE);
-    r["mime_type"] = magic_file(magic_cookie, path_string.c_str());
+ private:
+  MagicCookies() = default;
 
-    // Retrieve MIME encoding
-    magic_setflags(magic_cookie, MAGIC_MIME_ENCODING);
-    r["mime_encoding"] = magic_file(magic_cookie, path_string.c_str());
+ private:
+  /// Loaded cookies not used by a thread.
+  std::vector<magic_t> free_;
 
+  /// Protects the free cookies.
+  std::mutex mutex_;
+};
+
+/// Read one magic_file result with a set of flags, empty on error.
+static std::string getMagic(magic_t cookie,
+                            int flags,
+                            const std::string& path) {
+  magic_setflags(cookie, flags);
+  auto result = magic_file(cookie, path.c_str());
+  return (result != nullptr) ? result : "";
+}
+
+/// Detect a range of paths with one cookie, appending in path order.
+static void genMagicForPaths(const std::vector<std::string>& paths,
+                             size_t begin,
+                             size_t end,
+                             QueryData& results) {
+  auto cookie = MagicCookies::get().acquire();
+  if (cookie == nullptr) {
+    return;
+  }
+
+  for (size_t i = begin; i < end; i++) {
+    Row r;
+    r["path"] = paths[i];
+    r["data"] = getMagic(cookie, MAGIC_NONE, paths[i]);
+
+    // MAGIC_MIME reports the MIME type and encoding with one lookup.
+    auto mime = getMagic(cookie, MAGIC_MIME, paths[i]);
+    auto charset = mime.find(kMagicCharset);
+    r["mime_type"] = mime.substr(0, charset);
+    r["mime_encoding"] = (charset == std::string::npos)
+                             ? ""
+                             : mime.substr(charset + kMagicCharset.size());
     results.push_back(r);
   }
+  MagicCookies::get().release(cookie);
+}
 
-  magic_close(magic_cookie);
+QueryData genMagicData(QueryContext& context) {
+  QueryData results;
+
+  // Iterate through all the provided paths
+  auto path_set = context.constraints["path"].getAll(EQUALS);
+  std::vector<std::string> paths(path_set.begin(), path_set.end());
+
+  // Split the paths into a contiguous chunk for each worker, the results of
+  // each chunk are appended in path order.
+  size_t chunks = std::min<size_t>(std::max<size_t>(FLAGS_magic_threads, 1),
+                                   (paths.size() / kMagicChunk) + 1);
+  if (chunks == 1) {
+    genMagicForPaths(paths, 0, paths.size(), results);
+    return results;
+  }
+
+  std::vector<QueryData> chunk_results(chunks);
+  std::vector<TaskRef> tasks;
+  size_t chunk_size = (paths.size() + chunks - 1) / chunks;
+  for (size_t i = 0; i < chunks; i++) {
+    auto begin = std::min(i * chunk_size, paths.size());
+    auto end = std::min(begin + chunk_size, paths.size());
+    auto& output = chunk_results[i];
+    auto work = [&paths, &output, begin, end](const Task& task) {
+      genMagicForPaths(paths, begin, end, output);
+    };
+
+    auto task = getTableExecutor().submit(work, TASK_PRIORITY_SCHEDULE);
+    if (task == nullptr) {
+      // The executor is stopping, detect the chunk on this thread.
+      genMagicForPaths(paths, begin, end, output);
+      continue;
+    }
+    tasks.push_back(task);
+  }
+
+  for (const auto& task : tasks) {
+    task->runOrWait();
+  }
+  for (auto& output : chunk_results) {
+    results.insert(results.end(),
+                   std::make_move_iterator(output.begin()),
+                   std::make_move_iterator(output.end()));
+  }
   return results;
 }
 }
@@ -8,23 +8,89 @@
  *
  */
 
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include <boost/algorithm/string/trim.hpp>
+
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
-#include "osquery/core/conversions.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
+
+DECLARE_bool(disable_caching);
+
 namespace tables {
 
 const std::vector<std::string> kShellHistoryFiles = {
     ".bash_history", ".zsh_history", ".zhistory", ".history", ".sh_history",
 };
 
+/// The commands of a history file and the position they were read to.
+struct ShellHistory {
+  FileCheckpoint checkpoint;
+  std::vector<std::string> commands;
+};
+
+/// Append the trimmed command of a history line, if any.
+static void addCommand(FileLine line, std::vector<std::string>& commands) {
+  auto command = line.to_string();
+  boost::trim(command);
+  if (!command.empty()) {
+    commands.push_back(std::move(command));
+  }
+}
+
+/**
+ * @brief Read the commands appended to a history file since the last query.
+ *
+ * The commands of each history file are kept with the checkpoint of the
+ * read, only lines appended since are read. A rewritten history is read again.
+ */
+static void readHistory(const std::string& path,
+                        std::vector<std::string>& commands) {
+  static std::map<std::string, ShellHistory> histories;
+  static std::mutex histories_mutex;
+
+  ShellHistory uncached;
+  std::unique_lock<std::mutex> lock(histories_mutex, std::defer_lock);
+  auto* history = &uncached;
+  if (!FLAGS_disable_caching) {
+    lock.lock();
+    history = &histories[path];
+  }
+
+  std::vector<std::string> appended;
+  auto status = readNewLines(
+      path,
+      history->checkpoint,
+      ([&appended](FileLine line) { addCommand(line, appended); }),
+      true);
+  if (!status.ok()) {
+    if (lock.owns_lock()) {
+      histories.erase(path);
+    }
+    return;
+  }
+
+  if (history->checkpoint.reset) {
+    history->commands.clear();
+  }
+  history->commands.insert(history->commands.end(),
+                           std::make_move_iterator(appended.begin()),
+                           std::make_move_iterator(appended.end()));
+  commands = history->commands;
+
+  // A last line still being written is not kept.
+  addCommand(FileLine(history->checkpoint.partial), commands);
+}
+
 void genShellHistoryForUser(const std::string& uid,
                             const std::string& directory,
                             QueryData& results) {
@@ -32,16 +98,12 @@ void genShellHistoryForUser(const std::string& uid,
     boost::filesystem::path history_file = directory;
     history_file /= hfile;
 
-    std::string history_content;
-    if (!forensicReadFile(history_file, history_content).ok()) {
-      // Cannot read a specific history file.
-      continue;
-    }
-
-    for (const auto& line : split(history_content, "\n")) {
+    std::vector<std::string> commands;
+    readHistory(history_file.string(), commands);
+    for (auto& command : commands) {
       Row r;
       r["uid"] = uid;
-      r["command"] = line;
+      r["command"] = std::move(command);
       r["history_file"] = history_file.string();
       results.push_back(r);
     }
@@ -12,13 +12,11 @@
 #include <grp.h>
 #include <sys/stat.h>
 
-#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
-#include <osquery/filesystem.h>
-#include <osquery/logger.h>
 #include <osquery/tables.h>
 
-namespace fs = boost::filesystem;
+#include "osquery/filesystem/walker.h"
 
 namespace osquery {
 namespace tables {
@@ -33,16 +31,12 @@ std::vector<std::string> kBinarySearchPaths = {
   "/tmp",
 };
 
-Status genBin(const fs::path& path, int perms, QueryData& results) {
-  struct stat info;
-  // store user and group
-  if (stat(path.c_str(), &info) != 0) {
-    return Status(1, "stat failed");
-  }
+void genBin(const WalkEntry& entry, QueryData& results) {
+  const auto& info = entry.info;
 
   // store path
   Row r;
-  r["path"] = path.string();
+  r["path"] = entry.path;
   struct passwd *pw = getpwuid(info.st_uid);
   struct group *gr = getgrgid(info.st_gid);
 
@@ -65,67 +59,42 @@ Status genBin(const fs::path& path, int perms, QueryData& results) {
   r["groupname"] = group;
 
   r["permissions"] = "";
-  if ((perms & 04000) == 04000) {
+  if ((info.st_mode & S_ISUID) == S_ISUID) {
     r["permissions"] += "S";
   }
 
-  if ((perms & 02000) == 02000) {
+  if ((info.st_mode & S_ISGID) == S_ISGID) {
     r["permissions"] += "G";
   }
 
   results.push_back(r);
-  return Status(0, "OK");
 }
 
-bool isSuidBin(const fs::path& path, int perms) {
-  if (!fs::is_regular_file(path)) {
+bool isSuidBin(const WalkEntry& entry) {
+  if (!S_ISREG(entry.info.st_mode)) {
     return false;
   }
 
-  if ((perms & 04000) == 04000 || (perms & 02000) == 02000) {
-    return true;
-  }
-  return false;
-}
-
-void genSuidBinsFromPath(const std::string& path, QueryData& results) {
-  if (!pathExists(path).ok()) {
-    // Creating an iterator on a missing path will except.
-    return;
-  }
-
-  auto it = fs::recursive_directory_iterator(fs::path(path));
-  fs::recursive_directory_iterator end;
-  while (it != end) {
-    fs::path path = *it;
-    try {
-      // Do not traverse symlinked directories.
-      if (fs::is_directory(path) && fs::is_symlink(path)) {
-        it.no_push();
-      }
-
-      int perms = it.status().permissions();
-      if (isSuidBin(path, perms)) {
-        // Only emit suid bins.
-        genBin(path, perms, results);
-      }
-
-      ++it;
-    } catch (fs::filesystem_error& e) {
-      VLOG(1) << "Cannot read binary from " << path;
-      it.no_push();
-      // Try to recover, otherwise break.
-      try { ++it; } catch(fs::filesystem_error& e) { break; }
-    }
-  }
+  return (entry.info.st_mode & (S_ISUID | S_ISGID)) != 0;
 }
 
 QueryData genSuidBin(QueryContext& context) {
   QueryData results;
 
+  // Do not traverse symlinked directories, the walk reuses each entry's stat.
   // Todo: add hidden column to select on that triggers non-std path searches.
-  for (const auto& path : kBinarySearchPaths) {
-    genSuidBinsFromPath(path, results);
+  FileWalker walker(kBinarySearchPaths, WalkLimits());
+  std::vector<WalkEntry> entries;
+  bool more = true;
+  while (more) {
+    entries.clear();
+    more = walker.next(entries);
+    for (const auto& entry : entries) {
+      if (isSuidBin(entry)) {
+        // Only emit suid bins.
+        genBin(entry, results);
+      }
+    }
   }
 
   return results;
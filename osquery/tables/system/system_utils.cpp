@@ -8,11 +8,22 @@
  *
  */
 
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <sstream>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/sql.h>
 
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
+
+DECLARE_bool(disable_caching);
+
 namespace tables {
 
 QueryData usersFromContext(const QueryContext& context, bool all) {
@@ -52,5 +63,130 @@ QueryData pidsFromContext(const QueryContext& context, bool all) {
   }
   return procs;
 }
+
+bool getFileState(const struct stat& info, std::string& state) {
+#ifdef __APPLE__
+  const auto& mtime = info.st_mtimespec;
+  const auto& ctime = info.st_ctimespec;
+#else
+  const auto& mtime = info.st_mtim;
+  const auto& ctime = info.st_ctim;
+#endif
+  std::stringstream stream;
+  stream << info.st_dev << ":" << info.st_ino << ":" << info.st_size << ":"
+         << mtime.tv_sec << "." << mtime.tv_nsec << ":" << ctime.tv_sec << "."
+         << ctime.tv_nsec << ",";
+  state += stream.str();
+
+  // Changes within the granularity of the change time may go unnoticed.
+  return static_cast<size_t>(ctime.tv_sec) + 1 < getUnixTime();
+}
+
+bool FileStateCache::getState(std::string& state) const {
+  std::vector<std::string> files;
+  for (const auto& path : paths_) {
+    files.push_back(path);
+    auto dir = opendir(path.c_str());
+    if (dir == nullptr) {
+      continue;
+    }
+    struct dirent* entry = nullptr;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        files.push_back(path + "/" + entry->d_name);
+      }
+    }
+    closedir(dir);
+  }
+
+  bool settled = true;
+  for (const auto& file : files) {
+    struct stat info;
+    state += file + ":";
+    if (stat(file.c_str(), &info) != 0) {
+      state += "missing,";
+      continue;
+    }
+    settled = getFileState(info, state) && settled;
+  }
+  return settled;
+}
+
+QueryData FileStateCache::get(const std::function<QueryData()>& generator) {
+  if (FLAGS_disable_caching) {
+    return generator();
+  }
+
+  // The state is read before generating, a change while generating
+  // generates again for the next query.
+  std::string state;
+  bool settled = getState(state);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (state != state_) {
+    results_ = generator();
+    state_ = (settled) ? state : "";
+  }
+  return results_;
+}
+
+void FileRowsCache::get(const std::string& path,
+                        const struct stat& info,
+                        const std::function<void(QueryData&)>& parser,
+                        QueryData& results) {
+  if (FLAGS_disable_caching) {
+    parser(results);
+    return;
+  }
+
+  std::string state;
+  bool settled = getFileState(info, state);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto file = files_.find(path);
+    if (file != files_.end() && file->second.first == state) {
+      const auto& rows = file->second.second;
+      results.insert(results.end(), rows.begin(), rows.end());
+      return;
+    }
+  }
+
+  QueryData rows;
+  parser(rows);
+  results.insert(results.end(), rows.begin(), rows.end());
+  if (!settled) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (files_.size() >= max_files_ && files_.count(path) == 0) {
+    files_.clear();
+  }
+  files_[path] = std::make_pair(std::move(state), std::move(rows));
+}
+
+void FileRowsCache::get(
+    const std::vector<std::string>& patterns,
+    const std::function<void(const std::string&, QueryData&)>& parser,
+    QueryData& results) {
+  std::vector<std::string> paths;
+  for (const auto& pattern : patterns) {
+    if (pattern.find('%') == std::string::npos) {
+      paths.push_back(pattern);
+    } else {
+      resolveFilePattern(pattern, paths, GLOB_FILES);
+    }
+  }
+
+  for (const auto& path : paths) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+      continue;
+    }
+    get(path,
+        info,
+        [&parser, &path](QueryData& rows) { parser(path, rows); },
+        results);
+  }
+}
 }
 }
@@ -8,6 +8,16 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -34,5 +44,113 @@ QueryData usersFromContext(const QueryContext& context, bool all = false);
  * @return A complete set of rows for each process.
  */
 QueryData pidsFromContext(const QueryContext& context, bool all = true);
+
+/**
+ * @brief Describe the device, inode, size, and times of a file status.
+ *
+ * @param info The file status.
+ * @param state The output description, appended.
+ * @return false if the file changed too recently to detect another change.
+ */
+bool getFileState(const struct stat& info, std::string& state);
+
+/**
+ * @brief Results generated from files, kept while the files are unchanged.
+ *
+ * Tables reading an expensive database, such as the packages installed, keep
+ * its results until the status of a database file changes. A directory path
+ * checks the status of each file within the directory.
+ *
+ * @code{.cpp}
+ *   static FileStateCache cache({"/var/lib/dpkg/status"});
+ *   return cache.get([]() { return genAllPackages(); });
+ * @endcode
+ */
+class FileStateCache : private boost::noncopyable {
+ public:
+  explicit FileStateCache(const std::vector<std::string>& paths)
+      : paths_(paths) {}
+
+  /// Return the kept results, or generate them if a file changed.
+  QueryData get(const std::function<QueryData()>& generator);
+
+ private:
+  /**
+   * @brief Read the status of the files.
+   *
+   * @param state The output device, inode, size, and times of each file.
+   * @return false if a file changed too recently to detect another change.
+   */
+  bool getState(std::string& state) const;
+
+ private:
+  /// The files or directories the results are generated from.
+  std::vector<std::string> paths_;
+
+  /// The state of the files when the results were generated.
+  std::string state_;
+
+  /// The results kept for the state.
+  QueryData results_;
+
+  /// Protects the state and results, tables may be queried concurrently.
+  std::mutex mutex_;
+};
+
+/**
+ * @brief Rows parsed from many files, kept for each file while it is unchanged.
+ *
+ * Tables parsing a file for each user or profile, such as browser extension
+ * manifests, keep the rows of each file until its status changes. When more
+ * than max_files files are kept every kept file is dropped.
+ */
+class FileRowsCache : private boost::noncopyable {
+ public:
+  explicit FileRowsCache(size_t max_files) : max_files_(max_files) {}
+
+  /**
+   * @brief Append the kept rows of a file, or parse them if it changed.
+   *
+   * @param path The path of the file.
+   * @param info The status of the file, read by the caller.
+   * @param parser Appends the rows parsed from the file.
+   * @param results The output rows, appended.
+   */
+  void get(const std::string& path,
+           const struct stat& info,
+           const std::function<void(QueryData&)>& parser,
+           QueryData& results);
+
+  /**
+   * @brief Append the rows of each file a table is generated from.
+   *
+   * Tables that are a function of a few files, such as /etc/hosts, declare the
+   * paths or patterns of their files. Each matching regular file is parsed only
+   * when its status changed, missing files have no rows.
+   *
+   * @code{.cpp}
+   *   static FileRowsCache cache(kEtcHostsCacheMax);
+   *   QueryData results;
+   *   cache.get({"/etc/hosts"}, parseEtcHostsFile, results);
+   * @endcode
+   *
+   * @param patterns The file paths, or file patterns using % and %% wildcards.
+   * @param parser Appends the rows parsed from a file path.
+   * @param results The output rows, appended.
+   */
+  void get(const std::vector<std::string>& patterns,
+           const std::function<void(const std::string&, QueryData&)>& parser,
+           QueryData& results);
+
+ private:
+  /// The most files kept.
+  size_t max_files_{0};
+
+  /// The state and rows of each file.
+  std::map<std::string, std::pair<std::string, QueryData>> files_;
+
+  /// Protects the kept files, parsing happens while unlocked.
+  std::mutex mutex_;
+};
 }
 }
@@ -8,13 +8,17 @@
  *
  */
 
+#include <boost/filesystem/operations.hpp>
+
 #include <gtest/gtest.h>
 
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/sql.h>
 
 #include "osquery/core/test_util.h"
+#include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
 namespace tables {
@@ -49,5 +53,124 @@ TEST_F(SystemsTablesTests, test_process_info) {
   EXPECT_NE(results.rows()[0].at("uid"), "-1");
   EXPECT_NE(results.rows()[0].at("parent"), "-1");
 }
+
+TEST_F(SystemsTablesTests, test_magic) {
+  auto text = kTestWorkingDirectory + "magic-text";
+  auto empty = kTestWorkingDirectory + "magic-empty";
+  writeTextFile(text, "magic text\n");
+  writeTextFile(empty, "");
+
+  // Each path is detected once, the MIME type and encoding are split.
+  auto results = SQL("select * from magic where path in ('" + text + "', '" +
+                     empty + "') order by path");
+  ASSERT_EQ(results.rows().size(), 2U);
+  EXPECT_EQ(results.rows()[0].at("mime_type"), "inode/x-empty");
+  EXPECT_EQ(results.rows()[0].at("mime_encoding"), "binary");
+  EXPECT_EQ(results.rows()[1].at("mime_type"), "text/plain");
+  EXPECT_EQ(results.rows()[1].at("mime_encoding"), "us-ascii");
+  EXPECT_FALSE(results.rows()[1].at("data").empty());
+  osquery::remove(text);
+  osquery::remove(empty);
+}
+
+TEST_F(SystemsTablesTests, test_file_state_cache) {
+  auto path = kTestWorkingDirectory + "file-state-cache";
+  writeTextFile(path, "1");
+
+  size_t generated = 0;
+  auto generator = [&generated]() {
+    generated++;
+    return QueryData{{{"generated", std::to_string(generated)}}};
+  };
+
+  // A file changed within the last second is read on each query.
+  FileStateCache cache({path});
+  cache.get(generator);
+  cache.get(generator);
+  EXPECT_EQ(generated, 2U);
+
+  // Once settled, an unchanged file keeps the results.
+  ::sleep(2);
+  cache.get(generator);
+  auto results = cache.get(generator);
+  EXPECT_EQ(generated, 3U);
+  EXPECT_EQ(results[0]["generated"], "3");
+
+  // A change to the file generates the results again.
+  writeTextFile(path, "22");
+  results = cache.get(generator);
+  EXPECT_EQ(generated, 4U);
+  osquery::remove(path);
+}
+TEST_F(SystemsTablesTests, test_file_rows_cache) {
+  auto path = kTestWorkingDirectory + "file-rows-cache";
+  writeTextFile(path, "1");
+  struct stat info;
+  ASSERT_EQ(::stat(path.c_str(), &info), 0);
+
+  size_t parsed = 0;
+  auto parser = [&parsed](QueryData& rows) {
+    parsed++;
+    rows.push_back({{"parsed", std::to_string(parsed)}});
+  };
+
+  // A file changed within the last second is parsed on each query.
+  FileRowsCache cache(1);
+  QueryData results;
+  cache.get(path, info, parser, results);
+  cache.get(path, info, parser, results);
+  EXPECT_EQ(parsed, 2U);
+  EXPECT_EQ(results.size(), 2U);
+
+  // A settled file keeps its rows while its status is unchanged.
+  info.st_ctime -= 10;
+  results.clear();
+  cache.get(path, info, parser, results);
+  cache.get(path, info, parser, results);
+  EXPECT_EQ(parsed, 3U);
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["parsed"], "3");
+
+  // A different status parses the file again.
+  info.st_size++;
+  cache.get(path, info, parser, results);
+  EXPECT_EQ(parsed, 4U);
+
+  // Keeping more than the most files drops the kept files.
+  cache.get(path + "-other", info, parser, results);
+  cache.get(path, info, parser, results);
+  EXPECT_EQ(parsed, 6U);
+  osquery::remove(path);
+}
+
+TEST_F(SystemsTablesTests, test_file_rows_cache_patterns) {
+  auto dir = kTestWorkingDirectory + "file-rows-patterns/";
+  boost::filesystem::create_directories(dir);
+  writeTextFile(dir + "first", "1");
+  writeTextFile(dir + "second", "2");
+
+  std::map<std::string, size_t> parsed;
+  auto parser = [&parsed](const std::string& path, QueryData& rows) {
+    parsed[path]++;
+    rows.push_back({{"path", path}});
+  };
+
+  // Each matching file is parsed, missing files have no rows.
+  ::sleep(2);
+  FileRowsCache cache(8);
+  QueryData results;
+  cache.get({dir + "%", dir + "missing"}, parser, results);
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(parsed.size(), 2U);
+
+  // Only the changed file is parsed again.
+  writeTextFile(dir + "second", "22");
+  results.clear();
+  cache.get({dir + "%"}, parser, results);
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(parsed[dir + "first"], 1U);
+  EXPECT_EQ(parsed[dir + "second"], 2U);
+  boost::filesystem::remove_all(dir);
+}
 }
 }
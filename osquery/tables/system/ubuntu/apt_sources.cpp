@@ -23,9 +23,16 @@
 
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/system_utils.h"
+
 namespace osquery {
 namespace tables {
 
+/// The source lists and package cache the sources are read from.
+const std::vector<std::string> kAptSourcesPaths = {
+    "/etc/apt/sources.list", "/etc/apt/sources.list.d", "/var/cache/apt",
+};
+
 /**
 * @brief Empty the configuration out of memory when we're done with it
 *
@@ -74,7 +81,7 @@ void extractAptSourceInfo(pkgCache::PkgFileIterator src,
   results.push_back(r);
 }
 
-QueryData genAptSrcs(QueryContext& context) {
+static QueryData genAptSources() {
   QueryData results;
 
   // Load our apt configuration into memory
@@ -111,5 +118,11 @@ QueryData genAptSrcs(QueryContext& context) {
 
   return results;
 }
+
+QueryData genAptSrcs(QueryContext& context) {
+  // Loading the package cache is expensive, keep the sources until it changes.
+  static FileStateCache sources(kAptSourcesPaths);
+  return sources.get(genAptSources);
+}
 }
 }
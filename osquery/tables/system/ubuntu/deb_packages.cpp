@@ -11,6 +11,8 @@
 #include <boost/algorithm/string.hpp>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/system_utils.h"
+
 // see README.api of libdpkg-dev
 #define LIBDPKG_VOLATILE_API
 
@@ -74,6 +76,12 @@ enum pkgpriority {
 namespace osquery {
 namespace tables {
 
+/// The dpkg database of installed packages.
+const std::string kDpkgStatusPath = "/var/lib/dpkg/status";
+
+/// Changes to the dpkg database are journaled here before the status.
+const std::string kDpkgUpdatesPath = "/var/lib/dpkg/updates";
+
 /**
 * @brief A comparator used to sort the packages array
 */
@@ -194,7 +202,8 @@ void extractDebPackageInfo(const struct pkginfo *pkg, QueryData &results) {
   results.push_back(r);
 }
 
-QueryData genDebs(QueryContext &context) {
+/// Read every installed package from the dpkg database.
+static QueryData genAllDebs() {
   QueryData results;
 
   struct pkg_array packages;
@@ -213,5 +222,12 @@ QueryData genDebs(QueryContext &context) {
   dpkg_teardown(&packages);
   return results;
 }
+
+QueryData genDebs(QueryContext &context) {
+  // The packages are read again only when the dpkg status database, or its
+  // journal of pending updates, changes.
+  static FileStateCache packages({kDpkgStatusPath, kDpkgUpdatesPath});
+  return packages.get(genAllDebs);
+}
 }
 }
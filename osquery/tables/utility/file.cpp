@@ -10,46 +10,68 @@
 
 #include <sys/stat.h>
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/walker.h"
+
+#if defined(__linux__)
+#include "osquery/filesystem/linux/batch.h"
+#endif
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
 namespace tables {
 
-const std::map<fs::file_type, std::string> kTypeNames{
-    {fs::regular_file, "regular"},
-    {fs::directory_file, "directory"},
-    {fs::symlink_file, "symlink"},
-    {fs::block_file, "block"},
-    {fs::character_file, "character"},
-    {fs::fifo_file, "fifo"},
-    {fs::socket_file, "socket"},
-    {fs::type_unknown, "unknown"},
-    {fs::status_error, "error"},
-};
-
-void genFileInfo(const fs::path& path,
-                 const fs::path& parent,
-                 const std::string& pattern,
-                 QueryData& results) {
-  // Must provide the path, filename, directory separate from boost path->string
-  // helpers to match any explicit (query-parsed) predicate constraints.
-  struct stat file_stat, link_stat;
-  if (lstat(path.string().c_str(), &link_stat) < 0 ||
-      stat(path.string().c_str(), &file_stat)) {
-    // Path was not real, had too may links, or could not be accessed.
-    return;
+/// The file type name of a status mode, matching the boost file_type names.
+std::string getFileTypeName(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return "regular";
+  } else if (S_ISDIR(mode)) {
+    return "directory";
+  } else if (S_ISLNK(mode)) {
+    return "symlink";
+  } else if (S_ISBLK(mode)) {
+    return "block";
+  } else if (S_ISCHR(mode)) {
+    return "character";
+  } else if (S_ISFIFO(mode)) {
+    return "fifo";
+  } else if (S_ISSOCK(mode)) {
+    return "socket";
   }
+  return "unknown";
+}
+
+/// The paths stat-ed by each task, large enough to batch the syscalls.
+const size_t kFileBatchSize = 256;
+
+/// The optional file details a query reads.
+struct FileDetails {
+  /// Read the link status, for is_link.
+  bool link{true};
+  /// The fraction of walked directory entries read, see isSampledKey.
+  double sample_rate{1.0};
+};
 
+void genFileRow(const std::string& path,
+                const std::string& filename,
+                const std::string& directory,
+                const std::string& pattern,
+                const struct stat& file_stat,
+                bool is_link,
+                const FileDetails& details,
+                QueryData& results) {
   Row r;
-  r["path"] = path.string();
-  r["filename"] = path.filename().string();
-  r["directory"] = parent.string();
+  r["path"] = path;
+  r["filename"] = filename;
+  r["directory"] = directory;
 
   r["inode"] = BIGINT(file_stat.st_ino);
   r["uid"] = BIGINT(file_stat.st_uid);
@@ -71,18 +93,13 @@ void genFileInfo(const fs::path& path,
   r["btime"] = BIGINT(file_stat.st_birthtimespec.tv_sec);
 #endif
 
-  // Type booleans
-  boost::system::error_code ec;
-  auto status = fs::status(path, ec);
-  if (kTypeNames.count(status.type())) {
-    r["type"] = kTypeNames.at(status.type());
-  } else {
-    r["type"] = "unknown";
-  }
-
+  // Type booleans, the status follows links like boost's fs::status.
+  r["type"] = getFileTypeName(file_stat.st_mode);
   r["is_file"] = (!S_ISDIR(file_stat.st_mode)) ? "1" : "0";
   r["is_dir"] = (S_ISDIR(file_stat.st_mode)) ? "1" : "0";
-  r["is_link"] = (S_ISLNK(link_stat.st_mode)) ? "1" : "0";
+  if (details.link) {
+    r["is_link"] = (is_link) ? "1" : "0";
+  }
   r["is_char"] = (S_ISCHR(file_stat.st_mode)) ? "1" : "0";
   r["is_block"] = (S_ISBLK(file_stat.st_mode)) ? "1" : "0";
 
@@ -92,14 +109,141 @@ void genFileInfo(const fs::path& path,
   results.push_back(r);
 }
 
-QueryData genFile(QueryContext& context) {
-  QueryData results;
+void genFileInfo(const fs::path& path,
+                 const fs::path& parent,
+                 const std::string& pattern,
+                 const FileDetails& details,
+                 QueryData& results) {
+  // Must provide the path, filename, directory separate from boost path->string
+  // helpers to match any explicit (query-parsed) predicate constraints.
+  struct stat file_stat, link_stat;
+  if ((details.link && lstat(path.string().c_str(), &link_stat) < 0) ||
+      stat(path.string().c_str(), &file_stat)) {
+    // Path was not real, had too may links, or could not be accessed.
+    return;
+  }
+
+  genFileRow(path.string(),
+             path.filename().string(),
+             parent.string(),
+             pattern,
+             file_stat,
+             details.link && S_ISLNK(link_stat.st_mode),
+             details,
+             results);
+}
+
+void genFileInfoBatch(const std::vector<fs::path>& paths,
+                      const std::string& pattern,
+                      const FileDetails& details,
+                      QueryData& results) {
+#if defined(__linux__)
+  // The link and file status of every path are read in one batch.
+  std::vector<BatchStat> requests;
+  for (const auto& path : paths) {
+    BatchStat request;
+    request.path = path.string();
+    if (details.link) {
+      request.follow = false;
+      requests.push_back(request);
+      request.follow = true;
+    }
+    requests.push_back(std::move(request));
+  }
+  batchStat(requests);
 
-  auto paths = context.constraints["path"].getAll(EQUALS);
-  for (const auto& path_string : paths) {
-    fs::path path = path_string;
-    genFileInfo(path, path.parent_path(), "", results);
+  size_t i = 0;
+  for (const auto& path : paths) {
+    bool is_link = false;
+    if (details.link) {
+      const auto& link = requests[i++];
+      if (!link.ok) {
+        i++;
+        continue;
+      }
+      is_link = S_ISLNK(link.info.st_mode);
+    }
+    const auto& file = requests[i++];
+    if (!file.ok) {
+      // Path was not real, had too may links, or could not be accessed.
+      continue;
+    }
+    genFileRow(path.string(),
+               path.filename().string(),
+               path.parent_path().string(),
+               pattern,
+               file.info,
+               is_link,
+               details,
+               results);
   }
+#else
+  for (const auto& path : paths) {
+    genFileInfo(path, path.parent_path(), pattern, details, results);
+  }
+#endif
+}
+
+/// Queue a task for each batch of paths.
+void genFileTasks(const std::vector<fs::path>& paths,
+                  const std::string& pattern,
+                  const FileDetails& details,
+                  RowTasks& tasks) {
+  for (size_t begin = 0; begin < paths.size(); begin += kFileBatchSize) {
+    auto end = std::min(begin + kFileBatchSize, paths.size());
+    std::vector<fs::path> batch(paths.begin() + begin, paths.begin() + end);
+    tasks.push_back([batch, pattern, details](QueryData& results) {
+      genFileInfoBatch(batch, pattern, details, results);
+    });
+  }
+}
+
+void genDirectoryInfo(const std::string& directory,
+                      const FileDetails& details,
+                      QueryData& results) {
+  // The walk reads each entry's link and file status relative to the
+  // directory, a single level deep.
+  WalkLimits limits;
+  limits.max_depth = 1;
+  FileWalker walker({directory}, limits);
+  std::vector<WalkEntry> entries;
+  bool more = true;
+  while (more) {
+    entries.clear();
+    more = walker.next(entries);
+    for (const auto& entry : entries) {
+      if (entry.is_link && S_ISLNK(entry.info.st_mode)) {
+        // A broken link has no file status.
+        continue;
+      }
+      if (!isSampledKey(entry.path, details.sample_rate)) {
+        continue;
+      }
+      genFileRow(entry.path,
+                 fs::path(entry.path).filename().string(),
+                 directory,
+                 "",
+                 entry.info,
+                 entry.is_link,
+                 details,
+                 results);
+    }
+  }
+}
+
+RowTasks genFile(QueryContext& context) {
+  RowTasks tasks;
+
+  // Each batch of stats is deferred into a task so a cursor may stop early
+  // (LIMIT).
+  FileDetails details;
+  details.link = context.isColumnUsed("is_link");
+  details.sample_rate = context.sample_rate;
+  auto paths = context.constraints["path"].getAll(EQUALS);
+  genFileTasks(std::vector<fs::path>(paths.begin(), paths.end()),
+               "",
+               details,
+               tasks);
 
   // Now loop through constraints using the directory column constraint.
   auto directories = context.constraints["directory"].getAll(EQUALS);
@@ -108,21 +252,16 @@ QueryData genFile(QueryContext& context) {
       continue;
     }
 
-    try {
-      // Iterate over the directory and generate info for each regular file.
-      fs::directory_iterator begin(directory_string), end;
-      for (; begin != end; ++begin) {
-        genFileInfo(begin->path(), directory_string, "", results);
-      }
-    } catch (const fs::filesystem_error& e) {
-      continue;
-    }
+    // Walk each directory in a single task, the walk stats its entries.
+    tasks.push_back([directory_string, details](QueryData& results) {
+      genDirectoryInfo(directory_string, details, results);
+    });
   }
 
   // Now loop through constraints using the pattern column constraint.
   auto patterns = context.constraints["pattern"].getAll(EQUALS);
   if (patterns.size() != 1) {
-    return results;
+    return tasks;
   }
 
   for (const auto& pattern : patterns) {
@@ -130,16 +269,20 @@ QueryData genFile(QueryContext& context) {
     auto status = resolveFilePattern(pattern, expanded_patterns);
     if (!status.ok()) {
       VLOG(1) << "Could not expand pattern properly: " << status.toString();
-      return results;
+      return tasks;
     }
 
-    for (const auto& resolved : expanded_patterns) {
-      fs::path path = resolved;
-      genFileInfo(path, path.parent_path(), pattern, results);
+    // A sampled query only stats a sample of the expanded paths.
+    std::vector<fs::path> expanded_paths;
+    for (const auto& path : expanded_patterns) {
+      if (context.isSampled(path)) {
+        expanded_paths.push_back(path);
+      }
     }
+    genFileTasks(expanded_paths, pattern, details, tasks);
   }
 
-  return results;
+  return tasks;
 }
 }
 }
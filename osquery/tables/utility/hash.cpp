@@ -8,48 +8,69 @@
  *
  */
 
+#include <sys/stat.h>
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/hash.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/walker.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
 namespace tables {
 
+/// The hashes of the columns a query reads.
+static int usedHashes(const QueryContext& context) {
+  int mask = 0;
+  mask |= (context.isColumnUsed("md5")) ? HASH_TYPE_MD5 : 0;
+  mask |= (context.isColumnUsed("sha1")) ? HASH_TYPE_SHA1 : 0;
+  mask |= (context.isColumnUsed("sha256")) ? HASH_TYPE_SHA256 : 0;
+  return mask;
+}
+
 void genHashForFile(const std::string& path,
                     const std::string& dir,
+                    int mask,
                     QueryData& results) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
   Row r;
   r["path"] = path;
   r["directory"] = dir;
-  auto hashes = hashMultiFromFile(
-      HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-  r["md5"] = std::move(hashes.md5);
-  r["sha1"] = std::move(hashes.sha1);
-  r["sha256"] = std::move(hashes.sha256);
+  if (mask != 0) {
+    // Only read the file for the hashes the query selected.
+    auto hashes = hashMultiFromFileCached(mask, path);
+    r["md5"] = std::move(hashes.md5);
+    r["sha1"] = std::move(hashes.sha1);
+    r["sha256"] = std::move(hashes.sha256);
+  }
   results.push_back(r);
 }
 
-QueryData genHash(QueryContext& context) {
-  QueryData results;
+RowTasks genHash(QueryContext& context) {
+  RowTasks tasks;
   boost::system::error_code ec;
 
   // The query must provide a predicate with constraints including path or
   // directory. We search for the parsed predicate constraints with the equals
-  // operator.
+  // operator. Hashing is deferred into a task per file.
+  auto mask = usedHashes(context);
   auto paths = context.constraints["path"].getAll(EQUALS);
   for (const auto& path_string : paths) {
-    boost::filesystem::path path = path_string;
-    if (!boost::filesystem::is_regular_file(path, ec)) {
-      continue;
-    }
+    tasks.push_back([path_string, mask](QueryData& results) {
+      boost::system::error_code path_ec;
+      boost::filesystem::path path = path_string;
+      if (!boost::filesystem::is_regular_file(path, path_ec)) {
+        return;
+      }
 
-    genHashForFile(path_string, path.parent_path().string(), results);
+      genHashForFile(
+          path_string, path.parent_path().string(), mask, results);
+    });
   }
 
   // Now loop through constraints using the directory column constraint.
@@ -60,16 +81,24 @@ QueryData genHash(QueryContext& context) {
       continue;
     }
 
-    // Iterate over the directory and generate a hash for each regular file.
-    boost::filesystem::directory_iterator begin(directory), end;
-    for (; begin != end; ++begin) {
-      if (boost::filesystem::is_regular_file(begin->path(), ec)) {
-        genHashForFile(begin->path().string(), directory_string, results);
+    // Walk the directory and generate a hash for each regular file, the walk
+    // stats the entries while hashing stays deferred into a task per file.
+    WalkLimits limits;
+    limits.max_depth = 1;
+    std::vector<WalkEntry> entries;
+    FileWalker::walk({directory_string}, limits, entries);
+    for (const auto& entry : entries) {
+      if (S_ISREG(entry.info.st_mode)) {
+        auto path_string = entry.path;
+        tasks.push_back(
+            [path_string, directory_string, mask](QueryData& results) {
+              genHashForFile(path_string, directory_string, mask, results);
+            });
       }
     }
   }
 
-  return results;
+  return tasks;
 }
 }
 }
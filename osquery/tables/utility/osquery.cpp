@@ -8,8 +8,11 @@
  *
  */
 
+#include <sqlite3.h>
+
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/extensions.h>
 #include <osquery/events.h>
 #include <osquery/flags.h>
@@ -20,9 +23,29 @@
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/memory.h"
+
 namespace osquery {
 namespace tables {
 
+/// Fill the rate and percentile columns from rolling-window EventMetrics.
+static void genEventMetrics(const EventMetrics* metrics,
+                            const std::string& prefix,
+                            Row& r,
+                            bool rate) {
+  double events = 0;
+  Histogram durations;
+  if (metrics != nullptr) {
+    metrics->merge(events, durations);
+  }
+  if (rate) {
+    r["rate"] = DOUBLE(events);
+  }
+  r[prefix + "_p50"] = BIGINT(durations.percentile(50));
+  r[prefix + "_p99"] = BIGINT(durations.percentile(99));
+}
+
 QueryData genOsqueryEvents(QueryContext& context) {
   QueryData results;
 
@@ -38,13 +61,27 @@ QueryData genOsqueryEvents(QueryContext& context) {
       r["subscriptions"] = INTEGER(pubref->numSubscriptions());
       r["events"] = INTEGER(pubref->numEvents());
       r["restarts"] = INTEGER(pubref->restartCount());
+      r["expired"] = "0";
+      r["dropped"] = INTEGER(pubref->numDropped());
+      r["queued"] = "0";
+      r["latency"] = "0";
+      r["overflowed"] = "0";
       r["active"] = (pubref->hasStarted() && !pubref->isEnding()) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
       r["restarts"] = "0";
+      r["expired"] = "0";
+      r["dropped"] = "0";
+      r["queued"] = "0";
+      r["latency"] = "0";
+      r["overflowed"] = "0";
       r["active"] = "-1";
     }
+    auto fire = (pubref != nullptr) ? &pubref->fireMetrics() : nullptr;
+    genEventMetrics(fire, "duration", r, true);
+    // Publishers do not store events.
+    genEventMetrics(nullptr, "store", r, false);
     results.push_back(r);
   }
 
@@ -61,14 +98,28 @@ QueryData genOsqueryEvents(QueryContext& context) {
       r["publisher"] = subref->getType();
       r["subscriptions"] = INTEGER(subref->numSubscriptions());
       r["events"] = INTEGER(subref->numEvents());
+      r["expired"] = INTEGER(subref->numExpired());
+      r["dropped"] = INTEGER(subref->numDropped());
+      r["queued"] = INTEGER(subref->numQueued());
+      r["latency"] = INTEGER(subref->dispatchLatency());
+      r["overflowed"] = INTEGER(subref->numOverflowed());
 
       // Subscribers are always active, even if their publisher is not.
       r["active"] = (subref->state() == SUBSCRIBER_RUNNING) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
+      r["expired"] = "0";
+      r["dropped"] = "0";
+      r["queued"] = "0";
+      r["latency"] = "0";
+      r["overflowed"] = "0";
       r["active"] = "-1";
     }
+    auto callback = (subref != nullptr) ? &subref->callbackMetrics() : nullptr;
+    auto store = (subref != nullptr) ? &subref->storeMetrics() : nullptr;
+    genEventMetrics(callback, "duration", r, true);
+    genEventMetrics(store, "store", r, false);
     results.push_back(r);
   }
 
@@ -84,6 +135,7 @@ QueryData genOsqueryPacks(QueryContext& context) {
     r["version"] = pack->getVersion();
     r["platform"] = pack->getPlatform();
     r["shard"] = INTEGER(pack->getShard());
+    r["sample"] = DOUBLE(pack->getSample());
 
     auto stats = pack->getStats();
     r["discovery_cache_hits"] = INTEGER(stats.hits);
@@ -164,6 +216,10 @@ QueryData genOsqueryExtensions(QueryContext& context) {
       r["sdk_version"] = extension.second.sdk_version;
       r["path"] = getExtensionSocket(extension.first);
       r["type"] = (extension.first == 0) ? "core" : "extension";
+      r["threads"] = INTEGER(extension.second.server_threads);
+      auto stats = getExtensionCallStats(extension.first);
+      r["calls"] = BIGINT(stats.calls);
+      r["latency"] = BIGINT((stats.calls > 0) ? stats.latency / stats.calls : 0);
       results.push_back(r);
     }
   }
@@ -177,12 +233,24 @@ QueryData genOsqueryExtensions(QueryContext& context) {
     r["sdk_version"] = module.second.sdk_version;
     r["path"] = module.second.path;
     r["type"] = "module";
+    r["threads"] = "0";
+    r["calls"] = "0";
+    r["latency"] = "0";
     results.push_back(r);
   }
 
   return results;
 }
 
+QueryData genOsqueryDatabase(QueryContext& context) {
+  QueryData results;
+  auto status = getDatabaseStats(results);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read database statistics: " << status.getMessage();
+  }
+  return results;
+}
+
 QueryData genOsqueryInfo(QueryContext& context) {
   QueryData results;
   Row r;
@@ -199,15 +267,68 @@ QueryData genOsqueryInfo(QueryContext& context) {
   r["build_distro"] = STR(OSQUERY_BUILD_DISTRO);
   r["start_time"] = INTEGER(Config::getInstance().getStartTime());
 
+  auto logger = getLoggerBufferStats();
+  r["logger_queue_depth"] = INTEGER(logger.queued_lines);
+  r["logger_dropped"] = INTEGER(logger.dropped_lines);
+  r["logger_flush_latency"] = INTEGER(logger.flush_latency);
+
+  size_t startup = 0;
+  for (const auto& phase : getStartupPhases()) {
+    startup = std::max(startup, phase.start + phase.duration);
+  }
+  r["startup_duration"] = INTEGER(startup);
+
+  sqlite3_int64 used = 0;
+  sqlite3_int64 highwater = 0;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &highwater, 0);
+  r["sqlite_memory"] = BIGINT(used);
+  r["sqlite_memory_highwater"] = BIGINT(highwater);
+
   results.push_back(r);
   return results;
 }
 
+QueryData genOsqueryStartup(QueryContext& context) {
+  QueryData results;
+  for (const auto& phase : getStartupPhases()) {
+    Row r;
+    r["phase"] = phase.name;
+    r["start"] = BIGINT(phase.start);
+    r["duration"] = BIGINT(phase.duration);
+    results.push_back(r);
+  }
+  return results;
+}
+
+/// Fill in the advisory plan estimate of a scheduled query.
+static void genQueryEstimate(const std::string& query, Row& r) {
+  std::vector<TableScan> scans;
+  if (!getQueryScans(query, scans).ok()) {
+    r["planned_cost"] = "-1";
+    r["full_scans"] = "";
+    return;
+  }
+
+  double cost = 0;
+  std::vector<std::string> full_scans;
+  for (const auto& scan : scans) {
+    cost += scan.cost;
+    // Only flag unconstrained scans of tables declaring an above-default cost.
+    if (scan.constraints == 0 && scan.cost > kDefaultTableCost) {
+      full_scans.push_back(scan.table);
+    }
+  }
+  r["planned_cost"] = DOUBLE(cost);
+  r["full_scans"] = osquery::join(full_scans, ",");
+}
+
 QueryData genOsquerySchedule(QueryContext& context) {
   QueryData results;
 
+  auto estimate = context.isAnyColumnUsed({"planned_cost", "full_scans"});
   Config::getInstance().scheduledQueries(
-      [&results](const std::string& name, const ScheduledQuery& query) {
+      [&results, estimate](const std::string& name,
+                           const ScheduledQuery& query) {
         Row r;
         r["name"] = TEXT(name);
         r["query"] = TEXT(query.query);
@@ -215,11 +336,18 @@ QueryData genOsquerySchedule(QueryContext& context) {
         // Set default (0) values for each query if it has not yet executed.
         r["executions"] = "0";
         r["output_size"] = "0";
+        r["output_rows"] = "0";
         r["wall_time"] = "0";
         r["user_time"] = "0";
         r["system_time"] = "0";
         r["average_memory"] = "0";
         r["last_executed"] = "0";
+        r["wall_time_p50"] = "0";
+        r["wall_time_p99"] = "0";
+        r["cpu_time_p50"] = "0";
+        r["cpu_time_p99"] = "0";
+        r["output_size_p50"] = "0";
+        r["output_size_p99"] = "0";
 
         // Report optional performance information.
         Config::getInstance().getPerformanceStats(
@@ -227,15 +355,91 @@ QueryData genOsquerySchedule(QueryContext& context) {
               r["executions"] = BIGINT(perf.executions);
               r["last_executed"] = BIGINT(perf.last_executed);
               r["output_size"] = BIGINT(perf.output_size);
+              r["output_rows"] = BIGINT(perf.output_rows);
               r["wall_time"] = BIGINT(perf.wall_time);
               r["user_time"] = BIGINT(perf.user_time);
               r["system_time"] = BIGINT(perf.system_time);
               r["average_memory"] = BIGINT(perf.average_memory);
+              r["wall_time_p50"] = BIGINT(perf.wall_times.percentile(50));
+              r["wall_time_p99"] = BIGINT(perf.wall_times.percentile(99));
+              r["cpu_time_p50"] = BIGINT(perf.cpu_times.percentile(50));
+              r["cpu_time_p99"] = BIGINT(perf.cpu_times.percentile(99));
+              r["output_size_p50"] = BIGINT(perf.output_sizes.percentile(50));
+              r["output_size_p99"] = BIGINT(perf.output_sizes.percentile(99));
             });
 
+        if (estimate) {
+          genQueryEstimate(query.query, r);
+        }
+
         results.push_back(r);
       });
   return results;
 }
+
+QueryData genOsqueryLocks(QueryContext& context) {
+  QueryData results;
+  getLocks([&results](const std::string& name, const LockStats& stats) {
+    Row r;
+    r["name"] = name;
+    r["acquisitions"] = BIGINT(stats.acquisitions.load());
+    r["contentions"] = BIGINT(stats.contentions.load());
+    r["wait_time"] = BIGINT(stats.wait_time.load() / 1000);
+    r["max_wait"] = BIGINT(stats.max_wait.load() / 1000);
+    r["hold_time"] = BIGINT(stats.hold_time.load() / 1000);
+    results.push_back(r);
+  });
+  return results;
+}
+
+QueryData genOsqueryMemory(QueryContext& context) {
+  QueryData results;
+  auto add = [&results](const std::string& arena,
+                        const MemoryArenaStats& stats) {
+    Row r;
+    r["arena"] = arena;
+    r["allocator"] = getMemoryAllocator();
+    r["allocated"] = BIGINT(stats.allocated);
+    r["retained"] = BIGINT(stats.retained);
+    r["threads"] = INTEGER(stats.threads);
+    results.push_back(r);
+  };
+
+  if (hasMemoryArenas()) {
+    for (size_t i = ARENA_DEFAULT; i < ARENA_COUNT; i++) {
+      auto arena = static_cast<MemoryArena>(i);
+      MemoryArenaStats stats;
+      if (getMemoryArenaStats(arena, stats).ok()) {
+        add(getMemoryArenaName(arena), stats);
+      }
+    }
+  }
+
+  MemoryArenaStats total;
+  auto status = getMemoryStats(total);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read allocator statistics: " << status.getMessage();
+    return results;
+  }
+  add("total", total);
+  return results;
+}
+
+QueryData genOsqueryTableStats(QueryContext& context) {
+  QueryData results;
+  for (const auto& table : getTableStats()) {
+    const auto& stats = table.second;
+    Row r;
+    r["name"] = table.first;
+    r["scans"] = BIGINT(stats.scans);
+    r["rows"] = BIGINT(stats.rows);
+    r["total_time"] = BIGINT(stats.time);
+    r["time_p50"] = BIGINT(stats.times.percentile(50));
+    r["time_p99"] = BIGINT(stats.times.percentile(99));
+    r["time_max"] = BIGINT(stats.times.max());
+    results.push_back(r);
+  }
+  return results;
+}
 }
 }
@@ -31,6 +31,10 @@ export BENCHMARK_TO_FILE="--benchmark_format=csv \
   --benchmark_repetitions=$REPETITIONS :>$OUTDIR/$NODE-kernel-benchmark.csv"
 make run-kernel-benchmark/fast
 
+export BENCHMARK_TO_FILE="--benchmark_format=csv \
+  --benchmark_repetitions=$REPETITIONS :>$OUTDIR/$NODE-tables-benchmark.csv"
+make run-tables-benchmark/fast
+
 strip $(find $SCRIPT_DIR/../build -name "osqueryi" | xargs)
 strip $(find $SCRIPT_DIR/../build -name "osqueryd" | xargs)
 wc -c $(find $SCRIPT_DIR/../build -name "osqueryi" | xargs) \
@@ -20,6 +20,7 @@ import sys
 TEMPLATE_NAME = "amalgamation.cpp.in"
 BEGIN_LINE = "/// BEGIN[GENTABLE]"
 END_LINE = "/// END[GENTABLE]"
+REGISTER_LINE = "/// REGISTER[GENTABLE]"
 
 
 def usage(progname):
@@ -30,20 +31,31 @@ def usage(progname):
 
 
 def genTableData(filename):
+    """Return a generated table's code and its registration, if any."""
     with open(filename, "rU") as fh:
         data = fh.read()
     begin_table = False
     table_data = []
+    registration = None
     for line in data.split("\n"):
         if line.find(BEGIN_LINE) >= 0:
             begin_table = True
         elif line.find(END_LINE) >= 0:
             begin_table = False
+        elif begin_table and line.find(REGISTER_LINE) >= 0:
+            # The table name, plugin class, and an optional internal flag.
+            fields = line[line.find(REGISTER_LINE) + len(REGISTER_LINE):]
+            fields = fields.split()
+            registration = {
+                "name": fields[0],
+                "plugin": fields[1],
+                "internal": "true" if "internal" in fields[2:] else "false",
+            }
         elif begin_table:
             table_data.append(line)
     if len(table_data) == 0:
-        return None
-    return "\n".join(table_data)
+        return None, None
+    return "\n".join(table_data), registration
 
 
 def main(argc, argv):
@@ -54,22 +66,28 @@ def main(argc, argv):
     name = argv[3]
 
     tables = []
+    registrations = []
     # Discover the output template, usually a black cpp file with includes.
     template = os.path.join(specs, "templates", TEMPLATE_NAME)
     with open(template, "rU") as fh:
-        template_data = fh.read()
+        template_data = fh.read().replace("\\\n", "")
 
     for base, _, filenames in os.walk(os.path.join(directory,
                                                    "tables_%s" % (name))):
         for filename in filenames:
             if filename == name:
                 continue
-            table_data = genTableData(os.path.join(base, filename))
+            table_data, registration = genTableData(
+                os.path.join(base, filename))
             if table_data is not None:
                 tables.append(table_data)
+            if registration is not None:
+                registrations.append(registration)
 
+    # The registry binary searches the registrations by name.
+    registrations.sort(key=lambda registration: registration["name"])
     amalgamation = jinja2.Template(template_data).render(
-        tables=tables)
+        tables=tables, registrations=registrations)
     output = os.path.join(directory, "%s_amalgamation.cpp" % name)
     try:
         os.makedirs(os.path.dirname(output))
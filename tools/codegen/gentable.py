@@ -40,10 +40,15 @@ PLATFORM = platform()
 
 
 class DataType(object):
-    def __init__(self, affinity, cpp_type="std::string"):
-        '''A column datatype is a pair of a SQL affinity to C++ type.'''
+    def __init__(self, affinity, cpp_type="std::string",
+                 cell_type="std::string"):
+        '''A column datatype is a pair of a SQL affinity to C++ type.
+
+        The cell type is the setter argument of a typed row builder.
+        '''
         self.affinity = affinity
         self.type = cpp_type
+        self.cell_type = cell_type
 
     def __repr__(self):
         return self.affinity
@@ -52,12 +57,33 @@ class DataType(object):
 TEXT = DataType("TEXT_TYPE")
 DATE = DataType("TEXT_TYPE")
 DATETIME = DataType("TEXT_TYPE")
-INTEGER = DataType("INTEGER_TYPE", "int")
-BIGINT = DataType("BIGINT_TYPE", "long long int")
-UNSIGNED_BIGINT = DataType("UNSIGNED_BIGINT_TYPE", "long long unsigned int")
-DOUBLE = DataType("DOUBLE_TYPE", "double")
+INTEGER = DataType("INTEGER_TYPE", "int", "long long int")
+BIGINT = DataType("BIGINT_TYPE", "long long int", "long long int")
+UNSIGNED_BIGINT = DataType("UNSIGNED_BIGINT_TYPE", "long long unsigned int",
+                           "long long unsigned int")
+DOUBLE = DataType("DOUBLE_TYPE", "double", "double")
 BLOB = DataType("BLOB_TYPE", "Blob")
 
+# Map spec column options to the query planner ColumnOptions
+PLANNER_OPTIONS = {
+    "index": "COLUMN_INDEX",
+    "required": "COLUMN_REQUIRED",
+    "additional": "COLUMN_ADDITIONAL",
+    "ordered": "COLUMN_ORDERED",
+}
+
+# Column names that cannot be typed row setters
+CPP_KEYWORDS = [
+    "and", "auto", "bool", "break", "case", "catch", "char", "class", "const",
+    "continue", "default", "delete", "do", "double", "else", "enum",
+    "explicit", "export", "extern", "false", "float", "for", "friend", "goto",
+    "if", "inline", "int", "long", "mutable", "namespace", "new", "not",
+    "operator", "or", "private", "protected", "public", "register", "return",
+    "short", "signed", "sizeof", "static", "struct", "switch", "template",
+    "this", "throw", "true", "try", "typedef", "typename", "union",
+    "unsigned", "using", "virtual", "void", "volatile", "while", "xor",
+]
+
 # Define table-category MACROS from the table specs
 UNKNOWN = "UNKNOWN"
 UTILITY = "UTILITY"
@@ -79,6 +105,11 @@ def to_camel_case(snake_case):
     return components[0] + "".join(x.title() for x in components[1:])
 
 
+def to_pascal_case(snake_case):
+    """ convert a snake_case string to PascalCase """
+    return "".join(x.title() for x in snake_case.split('_'))
+
+
 def lightred(msg):
     return "\033[1;31m %s \033[0m" % str(msg)
 
@@ -169,6 +200,72 @@ class TableState(Singleton):
     def foreign_keys(self):
         return [i for i in self.schema if isinstance(i, ForeignKey)]
 
+    def column_options(self):
+        """Return the (name, ColumnOptions) planner hints of each column"""
+        planner_options = []
+        for column in self.columns():
+            options = [PLANNER_OPTIONS[option] for option in sorted(
+                column.options) if option in PLANNER_OPTIONS and
+                column.options[option]]
+            if len(options) > 0:
+                planner_options.append((column.name, " | ".join(options)))
+        return planner_options
+
+    def column_schema(self):
+        """Return the (name, affinity, ColumnOptions) of each column"""
+        options = dict(self.column_options())
+        return [(column.name, column.type.affinity,
+                 options.get(column.name, "COLUMN_DEFAULT"))
+                for column in self.columns()]
+
+    def row_columns(self):
+        """Return the typed row ordinal, setter, and cell of each column"""
+        columns = []
+        for column in self.columns():
+            setter = column.name
+            if setter in CPP_KEYWORDS:
+                setter += "_"
+            cell = "value"
+            if column.type.cell_type == "std::string":
+                cell = "std::move(value)"
+            elif column.type is UNSIGNED_BIGINT:
+                # Cells hold signed integers, SQLite has no unsigned type.
+                cell = "static_cast<long long int>(value)"
+            columns.append({
+                "ordinal": "k%s" % to_pascal_case(column.name),
+                "setter": setter,
+                "type": column.type.cell_type,
+                "cell": cell,
+            })
+        return columns
+
+    def generate_row(self, path):
+        """Generate the typed row builder header"""
+        logging.debug("TableState.generate_row")
+        content = jinja2.Template(TEMPLATES["typed_row"]).render(
+            table_name=self.table_name,
+            row_class="%sRow" % to_pascal_case(self.table_name),
+            row_columns=self.row_columns(),
+        )
+        self.write(path, content)
+
+    def write(self, path, content):
+        """Write a generated file, creating its directories"""
+        path_bits = path.split("/")
+        for i in range(1, len(path_bits)):
+            dir_path = ""
+            for j in range(i):
+                dir_path += "%s/" % path_bits[j]
+            if not os.path.exists(dir_path):
+                try:
+                    os.mkdir(dir_path)
+                except:
+                    # May encounter a race when using a make jobserver.
+                    pass
+        logging.debug("generating %s" % path)
+        with open(path, "w+") as file_h:
+            file_h.write(content)
+
     def generate(self, path, template="default"):
         """Generate the virtual table files"""
         logging.debug("TableState.generate")
@@ -182,16 +279,55 @@ class TableState(Singleton):
             class_name=self.class_name,
             attributes=self.attributes,
             examples=self.examples,
+            column_options=self.column_options(),
+            column_schema=self.column_schema(),
         )
 
         column_options = []
         for column in self.columns():
             column_options += column.options
-        non_cachable = ["index", "required", "additional", "superuser"]
+        # Cached results are keyed by query constraints, but results that
+        # depend on the caller's privileges cannot be shared.
+        non_cachable = ["superuser"]
         if "cachable" in self.attributes:
             if len(set(column_options).intersection(non_cachable)) > 0:
                 print(lightred("Table cannot be marked cachable: %s" % (path)))
                 exit(1)
+        if "cache_ttl" in self.attributes:
+            if "cachable" not in self.attributes or \
+                    not isinstance(self.attributes["cache_ttl"], int) or \
+                    self.attributes["cache_ttl"] <= 0:
+                print(lightred("Table cache_ttl must be a positive integer "
+                               "for a cachable table: %s" % (path)))
+                exit(1)
+        if "cache_boot" in self.attributes:
+            if "cachable" not in self.attributes or \
+                    "cache_ttl" in self.attributes:
+                print(lightred("Table cache_boot requires a cachable table "
+                               "without a cache_ttl: %s" % (path)))
+                exit(1)
+        if "hotplug" in self.attributes:
+            if "cache_boot" not in self.attributes:
+                print(lightred("Table hotplug requires cache_boot: %s" % (
+                    path)))
+                exit(1)
+        if "cost" in self.attributes:
+            if not isinstance(self.attributes["cost"], int) or \
+                    self.attributes["cost"] <= 0:
+                print(lightred("Table cost must be a positive integer: %s" % (
+                    path)))
+                exit(1)
+        if "streaming" in self.attributes:
+            if "cachable" in self.attributes or self.class_name != "":
+                print(lightred("Table cannot be marked streaming: %s" % (
+                    path)))
+                exit(1)
+        if "typed_rows" in self.attributes:
+            if "cachable" in self.attributes or \
+                    "streaming" in self.attributes or self.class_name != "":
+                print(lightred("Table cannot be marked typed_rows: %s" % (
+                    path)))
+                exit(1)
         if self.table_name == "" or self.function == "":
             print(lightred("Invalid table spec: %s" % (path)))
             exit(1)
@@ -204,20 +340,7 @@ class TableState(Singleton):
                                     column.name, self.table_name))))
                 exit(1)
 
-        path_bits = path.split("/")
-        for i in range(1, len(path_bits)):
-            dir_path = ""
-            for j in range(i):
-                dir_path += "%s/" % path_bits[j]
-            if not os.path.exists(dir_path):
-                try:
-                    os.mkdir(dir_path)
-                except:
-                    # May encounter a race when using a make jobserver.
-                    pass
-        logging.debug("generating %s" % path)
-        with open(path, "w+") as file_h:
-            file_h.write(self.impl_content)
+        self.write(path, self.impl_content)
 
     def blacklist(self, path):
         print(lightred("Blacklisting generated %s" % path))
@@ -335,6 +458,10 @@ def implementation(impl_string):
                 "Event subscriber: %s, 'time' column must be a %s type" % (
                     table.table_name, BIGINT)))
             sys.exit(1)
+        # Events are stored, and generated, in the order of their time.
+        for column in table.columns():
+            if column.name == "time":
+                column.options["ordered"] = True
 
 
 def main(argc, argv):
@@ -346,6 +473,10 @@ def main(argc, argv):
     )
     parser.add_argument("--templates", default=SCRIPT_DIR + "/templates",
                         help="Path to codegen output .cpp.in templates")
+    parser.add_argument(
+        "--row", default=False, action="store_true",
+        help="Output the table's typed row builder header"
+    )
     parser.add_argument("spec_file", help="Path to input .table spec file")
     parser.add_argument("output", help="Path to output .cpp file")
     args = parser.parse_args()
@@ -369,6 +500,10 @@ def main(argc, argv):
         with open(filename, "rU") as file_handle:
             tree = ast.parse(file_handle.read())
             exec(compile(tree, "<string>", "exec"))
+            if args.row:
+                # Implementations of blacklisted tables still compile.
+                table.generate_row(output)
+                return
             blacklisted = is_blacklisted(table.table_name, path=filename)
             if not disable_blacklist and blacklisted:
                 table.blacklist(output)
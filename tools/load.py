@@ -0,0 +1,564 @@
+#!/usr/bin/env python
+
+#  Copyright (c) 2014-present, Facebook, Inc.
+#  All rights reserved.
+#
+#  This source code is licensed under the BSD-style license found in the
+#  LICENSE file in the root directory of this source tree. An additional grant
+#  of patent rights can be found in the PATENTS file in the same directory.
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+from __future__ import unicode_literals
+
+import json
+import os
+import shutil
+import ssl
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+try:
+    import argparse
+except ImportError:
+    print("Cannot import argparse.")
+    exit(1)
+
+try:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+except ImportError:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+
+import psutil
+
+# Import the testing utils
+SCRIPT_DIR = os.path.dirname(os.path.realpath(__file__))
+sys.path.append(SCRIPT_DIR + "/tests/")
+
+import utils
+
+# Metrics compared by --check, lower values are better.
+GATED_METRICS = [
+    ("cpu", "avg"),
+    ("cpu", "p95"),
+    ("rss", "max"),
+    ("events", "file_loss"),
+    ("events", "process_loss"),
+    ("drift", "avg"),
+    ("drift", "max"),
+    ("log_latency", "p95"),
+    ("distributed", "latency_p95"),
+]
+
+# Differences below these are not regressions, for baselines near zero.
+GATED_MINIMUMS = {
+    "cpu": 1.0,
+    "rss": 4 * 1024 * 1024,
+    "events": 0.01,
+    "drift": 0.5,
+    "log_latency": 0.5,
+    "distributed": 0.5,
+}
+
+
+def percentile(values, percent):
+    if len(values) == 0:
+        return 0
+    values = sorted(values)
+    index = int(round((len(values) - 1) * percent / 100.0))
+    return values[index]
+
+
+def average(values):
+    if len(values) == 0:
+        return 0
+    return sum(values) / len(values)
+
+
+class Results(object):
+    """Log lines received from the daemon and the time each was seen."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.lines = []
+
+    def add(self, line):
+        if not isinstance(line, dict):
+            try:
+                line = json.loads(line)
+            except ValueError:
+                return
+        with self.lock:
+            self.lines.append((time.time(), line))
+
+    def named(self, name):
+        with self.lock:
+            return [l for l in self.lines if l[1].get("name") == name]
+
+
+def tail_logs(paths, results, stop):
+    """Follow the filesystem logger results files."""
+    offsets = {}
+    while not stop.is_set():
+        for path in paths:
+            if not os.path.exists(path):
+                continue
+            with open(path, "rb") as fh:
+                fh.seek(offsets.get(path, 0))
+                content = fh.read()
+            # Only read complete lines, the logger may be mid-write.
+            complete = content.rfind(b"\n") + 1
+            for line in content[:complete].decode("utf-8").splitlines():
+                results.add(line)
+            offsets[path] = offsets.get(path, 0) + complete
+        stop.wait(0.25)
+
+
+class LoadHandler(BaseHTTPRequestHandler):
+    """A TLS logger, enroll, and distributed endpoint recording requests."""
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_POST(self):
+        length = int(self.headers.get("content-length", 0))
+        try:
+            request = json.loads(self.rfile.read(length))
+        except ValueError:
+            request = {}
+        response = {}
+        server = self.server
+        if self.path == "/enroll":
+            response = {"node_key": "load_node_key"}
+        elif self.path == "/log":
+            if request.get("log_type") == "result":
+                for line in request.get("data", []):
+                    server.results.add(line)
+        elif self.path == "/distributed_read":
+            with server.lock:
+                server.distributed_id += 1
+                query_id = "load_%d" % server.distributed_id
+                server.distributed_reads[query_id] = time.time()
+            response = {"queries": {query_id: server.distributed_query}}
+        elif self.path == "/distributed_write":
+            now = time.time()
+            with server.lock:
+                for query_id in request.get("queries", {}):
+                    if query_id in server.distributed_reads:
+                        server.distributed_latency.append(
+                            now - server.distributed_reads.pop(query_id))
+        self.send_response(200)
+        self.send_header("Content-type", "application/json")
+        self.end_headers()
+        self.wfile.write(json.dumps(response).encode("utf-8"))
+
+
+def start_endpoint(port, results, query):
+    httpd = HTTPServer(("localhost", port), LoadHandler)
+    httpd.results = results
+    httpd.lock = threading.Lock()
+    httpd.distributed_id = 0
+    httpd.distributed_reads = {}
+    httpd.distributed_latency = []
+    httpd.distributed_query = query
+    ctx = ssl.SSLContext(ssl.PROTOCOL_SSLv23)
+    ctx.load_cert_chain(SCRIPT_DIR + "/tests/test_server.pem",
+                        keyfile=SCRIPT_DIR + "/tests/test_server.key")
+    httpd.socket = ctx.wrap_socket(httpd.socket, server_side=True)
+    thread = threading.Thread(target=httpd.serve_forever)
+    thread.daemon = True
+    thread.start()
+    return httpd
+
+
+def paced(rate, stop, action):
+    """Call an action a number of times per second until stopped."""
+    if rate <= 0:
+        return
+    step = 1.0 / rate
+    deadline = time.time()
+    while not stop.is_set():
+        action()
+        deadline += step
+        delay = deadline - time.time()
+        if delay > 0:
+            stop.wait(delay)
+
+
+def churn_files(directory, rate, stop, counts):
+    """Create, write, and delete files, a CREATED and DELETED event each."""
+    def action():
+        path = os.path.join(directory, "churn_%d" % counts["files"])
+        with open(path, "w") as fh:
+            fh.write("load")
+        os.remove(path)
+        counts["files"] += 1
+    paced(rate, stop, action)
+
+
+def exec_storm(path, rate, stop, counts):
+    """Fork and execute a binary, an audited process event each."""
+    def action():
+        subprocess.call([path])
+        counts["execs"] += 1
+    paced(rate, stop, action)
+
+
+def sample_daemon(pid, stop, samples):
+    """Sample the CPU and RSS of the daemon and its worker."""
+    try:
+        watcher = psutil.Process(pid)
+    except psutil.NoSuchProcess:
+        return
+    processes = {}
+    while not stop.is_set():
+        try:
+            current = [watcher] + watcher.children(recursive=True)
+        except psutil.NoSuchProcess:
+            break
+        cpu = 0
+        rss = 0
+        for process in current:
+            # Keep each process so CPU is measured across samples.
+            process = processes.setdefault(process.pid, process)
+            try:
+                cpu += process.cpu_percent(interval=None)
+                rss += process.memory_info().rss
+            except (psutil.NoSuchProcess, psutil.AccessDenied):
+                continue
+        samples.append((cpu, rss))
+        stop.wait(1)
+
+
+def make_config(args, work, churn):
+    config = {}
+    if args.config is not None:
+        config = utils.read_config(args.config)
+    config.setdefault("schedule", {})
+    config["schedule"]["load_heartbeat"] = {
+        "query": "select unix_time from time",
+        "interval": args.heartbeat,
+        "snapshot": True,
+    }
+    config["schedule"]["load_file_events"] = {
+        "query": ("select target_path, action, time from file_events "
+                  "where target_path like '%s/%%'" % churn),
+        "interval": args.event_interval,
+    }
+    config["schedule"]["load_process_events"] = {
+        "query": ("select path, time from process_events "
+                  "where path = '%s'" % os.path.realpath(args.exec_path)),
+        "interval": args.event_interval,
+    }
+    config.setdefault("file_paths", {})["load"] = [churn + "/%%"]
+    path = os.path.join(work, "osquery.conf")
+    utils.write_config(config, path)
+    return path
+
+
+def daemon_flags(args, work, config_path):
+    flags = [
+        "--config_path=%s" % config_path,
+        "--database_path=%s" % os.path.join(work, "osquery.db"),
+        "--pidfile=%s" % os.path.join(work, "osquery.pid"),
+        "--extensions_socket=%s" % os.path.join(work, "osquery.em"),
+        "--logger_path=%s" % os.path.join(work, "logs"),
+        "--disable_extensions",
+        "--disable_events=false",
+        "--disable_audit=%s" % ("false" if args.exec_rate > 0 else "true"),
+    ]
+    if not args.watchdog:
+        flags.append("--disable_watchdog")
+    if args.tls:
+        flags += [
+            "--tls_hostname=localhost:%d" % args.port,
+            "--tls_server_certs=%s" % (
+                SCRIPT_DIR + "/tests/test_server_ca.pem"),
+            "--enroll_secret_path=%s" % (
+                SCRIPT_DIR + "/tests/test_enroll_secret.txt"),
+            "--enroll_tls_endpoint=/enroll",
+            "--logger_plugin=tls",
+            "--logger_tls_endpoint=/log",
+            "--logger_tls_period=1",
+            "--disable_distributed=false",
+            "--distributed_plugin=tls",
+            "--distributed_interval=%d" % args.distributed_interval,
+            "--distributed_tls_read_endpoint=/distributed_read",
+            "--distributed_tls_write_endpoint=/distributed_write",
+        ]
+    return flags
+
+
+def executions(results, name):
+    """The distinct execution times of a query, in order."""
+    times = set()
+    for _, line in results.named(name):
+        if "unixTime" in line:
+            times.add(int(line["unixTime"]))
+    return sorted(times)
+
+
+def observed_events(results, name, column, actions=None):
+    events = set()
+    for _, line in results.named(name):
+        if line.get("action") != "added":
+            continue
+        columns = line.get("columns", {})
+        if actions is not None and columns.get("action") not in actions:
+            continue
+        events.add((columns.get(column), columns.get("action"),
+                    columns.get("time")))
+    return len(events)
+
+
+def loss(generated, observed):
+    if generated == 0:
+        return 0
+    return max(0, 1 - observed / generated)
+
+
+def report(args, samples, results, counts, endpoint, duration):
+    # The daemon's configuration and event setup are not sustained load.
+    sustained = samples[min(len(samples) - 1, args.warmup):] or [(0, 0)]
+    cpu = [s[0] for s in sustained]
+    rss = [s[1] for s in sustained]
+
+    # Drift is the delay of each heartbeat beyond its interval.
+    times = executions(results, "load_heartbeat")
+    drift = [max(0, b - a - args.heartbeat) for a, b in zip(times, times[1:])]
+
+    latency = []
+    for seen, line in results.lines:
+        if "unixTime" in line:
+            latency.append(max(0, seen - int(line["unixTime"])))
+
+    files = observed_events(
+        results, "load_file_events", "target_path", ["CREATED", "DELETED"])
+    processes = observed_events(results, "load_process_events", "path")
+    distributed = [] if endpoint is None else endpoint.distributed_latency
+    return {
+        "duration": duration,
+        "cpu": {"avg": average(cpu), "p95": percentile(cpu, 95)},
+        "rss": {"max": max(rss), "final": rss[-1]},
+        "events": {
+            "file_generated": counts["files"] * 2,
+            "file_observed": files,
+            "file_loss": loss(counts["files"] * 2, files),
+            "process_generated": counts["execs"],
+            "process_observed": processes,
+            "process_loss": loss(counts["execs"], processes),
+        },
+        "drift": {
+            "executions": len(times),
+            "avg": average(drift),
+            "max": max(drift) if len(drift) > 0 else 0,
+        },
+        "log_latency": {
+            "lines": len(latency),
+            "p50": percentile(latency, 50),
+            "p95": percentile(latency, 95),
+            "max": max(latency) if len(latency) > 0 else 0,
+        },
+        "distributed": {
+            "writes": len(distributed),
+            "latency_p50": percentile(distributed, 50),
+            "latency_p95": percentile(distributed, 95),
+        },
+    }
+
+
+def run(args):
+    work = tempfile.mkdtemp(prefix="osquery-load-")
+    churn = os.path.join(work, "churn")
+    os.makedirs(churn)
+    os.makedirs(os.path.join(work, "logs"))
+
+    results = Results()
+    stop = threading.Event()
+    stop_load = threading.Event()
+    endpoint = None
+    if args.tls:
+        endpoint = start_endpoint(
+            args.port, results, "select * from osquery_info")
+
+    config_path = make_config(args, work, churn)
+    sink = None if args.verbose else open(os.devnull, "w")
+    daemon = subprocess.Popen(
+        [args.daemon] + daemon_flags(args, work, config_path),
+        stdout=sink, stderr=sink)
+
+    counts = {"files": 0, "execs": 0}
+    samples = []
+    logs = [os.path.join(work, "logs", name) for name in
+            ["osqueryd.results.log", "osqueryd.snapshots.log"]]
+    load = [
+        threading.Thread(target=churn_files,
+                         args=(churn, args.inotify_rate, stop_load, counts)),
+        threading.Thread(target=exec_storm,
+                         args=(args.exec_path, args.exec_rate, stop_load,
+                               counts)),
+    ]
+    threads = load + [
+        threading.Thread(target=sample_daemon,
+                         args=(daemon.pid, stop, samples)),
+    ]
+    if not args.tls:
+        threads.append(threading.Thread(target=tail_logs,
+                                        args=(logs, results, stop)))
+    start = time.time()
+    for thread in threads:
+        thread.daemon = True
+        thread.start()
+
+    # Stop the load first, then let the daemon collect the last events.
+    while time.time() - start < args.duration and daemon.poll() is None:
+        time.sleep(1)
+    stop_load.set()
+    for thread in load:
+        thread.join()
+    duration = time.time() - start
+    if daemon.poll() is None:
+        time.sleep(args.event_interval + 2)
+        daemon.terminate()
+        daemon.wait()
+    else:
+        print("osqueryd exited early: %d" % daemon.returncode)
+    stop.set()
+    for thread in threads:
+        thread.join()
+
+    output = report(args, samples, results, counts, endpoint, duration)
+    if endpoint is not None:
+        endpoint.shutdown()
+    if not args.keep:
+        shutil.rmtree(work, ignore_errors=True)
+    else:
+        print("Kept daemon files: %s" % work)
+    return output
+
+
+def regress_check(baseline, output, tolerance):
+    regressed = False
+    for group, metric in GATED_METRICS:
+        if group not in baseline or metric not in baseline[group]:
+            continue
+        old = baseline[group][metric]
+        new = output[group][metric]
+        if new - old > max(old * tolerance / 100.0, GATED_MINIMUMS[group]):
+            print("%s %s has regressed (%s->%s)!" % (group, metric, old, new))
+            regressed = True
+    if not regressed:
+        print("No regressions!")
+        return 0
+    return 1
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=(
+        "Replay a schedule and synthetic event load against osqueryd."
+    ))
+    parser.add_argument(
+        "--verbose", action="store_true", default=False,
+        help="Show the daemon's output.")
+    parser.add_argument(
+        "--daemon", metavar="PATH", default="./build/%s/osquery/osqueryd" % (
+            utils.platform()),
+        help="Path to osqueryd (./build/<sys>/osquery/osqueryd)."
+    )
+    parser.add_argument(
+        "--config", metavar="FILE", default=None,
+        help="Config with the schedule and packs to replay."
+    )
+    parser.add_argument(
+        "--keep", action="store_true", default=False,
+        help="Keep the daemon's database, config, and logs."
+    )
+
+    group = parser.add_argument_group("Load Options:")
+    group.add_argument(
+        "--duration", metavar="N", default=120, type=int,
+        help="Seconds to apply the load."
+    )
+    group.add_argument(
+        "--warmup", metavar="N", default=10, type=int,
+        help="Seconds of startup excluded from CPU and memory."
+    )
+    group.add_argument(
+        "--inotify_rate", metavar="N", default=50, type=int,
+        help="Files created and deleted per second."
+    )
+    group.add_argument(
+        "--exec_rate", metavar="N", default=0, type=int,
+        help="Processes executed per second, audited if set (requires root)."
+    )
+    group.add_argument(
+        "--exec_path", metavar="PATH", default="/bin/true",
+        help="Binary executed by the process storm."
+    )
+    group.add_argument(
+        "--event_interval", metavar="N", default=10, type=int,
+        help="Interval of the event counting queries."
+    )
+    group.add_argument(
+        "--heartbeat", metavar="N", default=5, type=int,
+        help="Interval of the snapshot query used to measure drift."
+    )
+    group.add_argument(
+        "--watchdog", action="store_true", default=False,
+        help="Run the daemon with its watchdog."
+    )
+
+    group = parser.add_argument_group("TLS Options:")
+    group.add_argument(
+        "--tls", action="store_true", default=False,
+        help="Log results to and poll queries from a local TLS endpoint."
+    )
+    group.add_argument(
+        "--port", metavar="PORT", default=8443, type=int,
+        help="Local TCP port of the TLS endpoint."
+    )
+    group.add_argument(
+        "--distributed_interval", metavar="N", default=5, type=int,
+        help="Seconds between distributed query reads."
+    )
+
+    group = parser.add_argument_group("Performance Options:")
+    group.add_argument(
+        "--output", metavar="FILE", default=None,
+        help="Write the JSON load report to file."
+    )
+    group.add_argument(
+        "--check", metavar="OLD_OUTPUT", default=None,
+        help="Check regressions using an existing report."
+    )
+    group.add_argument(
+        "--tolerance", metavar="PERCENT", default=10, type=int,
+        help="Percent a gated metric may grow before it has regressed."
+    )
+    args = parser.parse_args()
+
+    if not os.path.exists(args.daemon):
+        print("Cannot find --daemon: %s" % (args.daemon))
+        exit(1)
+    if args.config is not None and not os.path.exists(args.config):
+        print("Cannot find --config: %s" % (args.config))
+        exit(1)
+
+    baseline = None
+    if args.check is not None:
+        with open(args.check) as fh:
+            baseline = json.loads(fh.read())
+
+    output = run(args)
+    print(json.dumps(output, indent=1))
+    if args.output is not None:
+        with open(args.output, "w") as fh:
+            fh.write(json.dumps(output, indent=1))
+        print("Wrote load report: %s" % args.output)
+
+    if baseline is not None:
+        exit(regress_check(baseline, output, args.tolerance))
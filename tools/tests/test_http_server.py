@@ -13,6 +13,7 @@ from __future__ import print_function
 from __future__ import unicode_literals
 
 import argparse
+import hashlib
 import json
 import os
 import signal
@@ -72,7 +73,17 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
 
     def do_GET(self):
         debug("RealSimpleHandler::get %s" % self.path)
-        self._set_headers()
+        # Support conditional requests using the response's content hash.
+        etag = '"%s"' % hashlib.md5(json.dumps(TEST_RESPONSE)).hexdigest()
+        if self.headers.getheader('if-none-match', '') == etag:
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header('Content-type', 'application/json')
+        self.send_header('ETag', etag)
+        self.end_headers()
         self._reply(TEST_RESPONSE)
 
     def do_HEAD(self):